@@ -12,16 +12,25 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <jni.h>
+#include <time.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
 
 #include "torch/script.h"
 #include "torch/torch.h"
 
 #include "decoder/asr_decoder.h"
 #include "decoder/torch_asr_model.h"
+#include "frontend/fbank_kernels.h"
 #include "frontend/feature_pipeline.h"
 #include "frontend/wav.h"
 #include "post_processor/post_processor.h"
 #include "utils/log.h"
+#include "utils/snapshot.h"
 #include "utils/string.h"
 
 namespace wenet {
@@ -31,14 +40,91 @@ std::shared_ptr<FeaturePipelineConfig> feature_config;
 std::shared_ptr<FeaturePipeline> feature_pipeline;
 std::shared_ptr<AsrDecoder> decoder;
 std::shared_ptr<DecodeResource> resource;
-DecodeState state = kEndBatch;
+std::atomic<DecodeState> state(kEndBatch);
+
+// The decode worker lives as long as the process, and decodes one utterance
+// per startDecode, so no thread is created per utterance
+std::once_flag decode_worker_once;
+std::mutex decode_mutex;
+std::condition_variable decode_cond;
+bool decode_requested = false;
+
+// Written by the decode worker and reset, the text of the UI is published
+// as a snapshot of them, which getResult reads without any lock
+std::mutex result_mutex;
 std::string total_result;  // NOLINT
+std::string partial_result;  // NOLINT
+Snapshot<std::string> ui_result;
+// The CPU time of the decode worker of the last chunk and of the utterance
+std::atomic<int64_t> last_chunk_cpu_us(0);
+std::atomic<int64_t> total_cpu_us(0);
+
+int64_t ThreadCpuTimeUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void decode_one_utterance() {
+  while (true) {
+    int64_t start = ThreadCpuTimeUs();
+    DecodeState s = decoder->Decode();
+    if (s == kEndFeats || s == kEndpoint) {
+      decoder->Rescoring();
+    }
+    int64_t cpu_us = ThreadCpuTimeUs() - start;
+    last_chunk_cpu_us = cpu_us;
+    total_cpu_us += cpu_us;
+
+    std::string result;
+    if (decoder->DecodedSomething()) {
+      result = decoder->result()[0].sentence;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(result_mutex);
+      if (s == kEndFeats) {
+        total_result += result;
+        partial_result.clear();
+      } else if (s == kEndpoint) {
+        total_result += result + "，";
+        partial_result.clear();
+      } else {
+        partial_result = result;
+      }
+      ui_result.Publish(total_result + partial_result);
+    }
+    if (s == kEndFeats) {
+      LOG(INFO) << "wenet endfeats final result: " << result;
+    } else if (s == kEndpoint) {
+      LOG(INFO) << "wenet endpoint final result: " << result;
+      decoder->ResetContinuousDecoding();
+    } else if (!result.empty()) {
+      VLOG(1) << "wenet partial result: " << result;
+    }
+    // Published after the result, so getFinished implies the final result
+    state = s;
+    if (s == kEndFeats) break;
+  }
+}
+
+void decode_worker_func() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(decode_mutex);
+      decode_cond.wait(lock, [] { return decode_requested; });
+      decode_requested = false;
+    }
+    decode_one_utterance();
+  }
+}
 
 void init(JNIEnv* env, jobject, jstring jModelDir) {
   const char* pModelDir = env->GetStringUTFChars(jModelDir, nullptr);
 
   std::string modelPath = std::string(pModelDir) + "/final.zip";
   std::string dictPath = std::string(pModelDir) + "/units.txt";
+  env->ReleaseStringUTFChars(jModelDir, pModelDir);
   auto model = std::make_shared<TorchAsrModel>();
   model->Read(modelPath);
   LOG(INFO) << "model path: " << modelPath;
@@ -55,25 +141,50 @@ void init(JNIEnv* env, jobject, jstring jModelDir) {
 
   feature_config = std::make_shared<FeaturePipelineConfig>(80, 16000);
   feature_pipeline = std::make_shared<FeaturePipeline>(*feature_config);
+  LOG(INFO) << "fbank kernels: " << GetFbankKernels().name;
 
   decode_config = std::make_shared<DecodeOptions>();
   decode_config->chunk_size = 16;
   decoder = std::make_shared<AsrDecoder>(feature_pipeline, resource,
                                          *decode_config);
+  std::call_once(decode_worker_once,
+                 [] { std::thread(decode_worker_func).detach(); });
 }
 
 void reset(JNIEnv *env, jobject) {
   LOG(INFO) << "wenet reset";
   decoder->Reset();
   state = kEndBatch;
+  std::lock_guard<std::mutex> lock(result_mutex);
   total_result = "";
+  partial_result = "";
+  ui_result.Publish(std::string());
+  last_chunk_cpu_us = 0;
+  total_cpu_us = 0;
 }
 
 void accept_waveform(JNIEnv *env, jobject, jshortArray jWaveform) {
   jsize size = env->GetArrayLength(jWaveform);
-  int16_t* waveform = env->GetShortArrayElements(jWaveform, 0);
+  // No copy of the java array, the pipeline converts it to float at once,
+  // so the critical section is short
+  int16_t* waveform = reinterpret_cast<int16_t*>(
+      env->GetPrimitiveArrayCritical(jWaveform, nullptr));
+  if (waveform == nullptr) return;
   feature_pipeline->AcceptWaveform(waveform, size);
-  LOG(INFO) << "wenet accept waveform in ms: " << int(size / 16);
+  env->ReleasePrimitiveArrayCritical(jWaveform, waveform, JNI_ABORT);
+  VLOG(1) << "wenet accept waveform in ms: " << int(size / 16);
+}
+
+// The 16 bits pcm in a direct ByteBuffer of native order, e.g. the one
+// AudioRecord.read(ByteBuffer, int) writes, which is read in place
+void accept_waveform_direct(JNIEnv *env, jobject, jobject jBuffer,
+                            jint numSamples) {
+  auto waveform =
+      reinterpret_cast<const int16_t*>(env->GetDirectBufferAddress(jBuffer));
+  CHECK(waveform != nullptr) << "the buffer must be a direct ByteBuffer";
+  CHECK_LE(numSamples * sizeof(int16_t),
+           env->GetDirectBufferCapacity(jBuffer));
+  feature_pipeline->AcceptWaveform(waveform, numSamples);
 }
 
 void set_input_finished() {
@@ -81,37 +192,10 @@ void set_input_finished() {
   feature_pipeline->set_input_finished();
 }
 
-void decode_thread_func() {
-  while (true) {
-    state = decoder->Decode();
-    if (state == kEndFeats || state == kEndpoint) {
-      decoder->Rescoring();
-    }
-
-    std::string result;
-    if (decoder->DecodedSomething()) {
-      result = decoder->result()[0].sentence;
-    }
-
-    if (state == kEndFeats) {
-      LOG(INFO) << "wenet endfeats final result: " << result;
-      total_result += result;
-      break;
-    } else if (state == kEndpoint) {
-      LOG(INFO) << "wenet endpoint final result: " << result;
-      total_result += result + "，";
-      decoder->ResetContinuousDecoding();
-    } else {
-      if (decoder->DecodedSomething()) {
-        LOG(INFO) << "wenet partial result: " << result;
-      }
-    }
-  }
-}
-
 void start_decode() {
-  std::thread decode_thread(decode_thread_func);
-  decode_thread.detach();
+  std::lock_guard<std::mutex> lock(decode_mutex);
+  decode_requested = true;
+  decode_cond.notify_one();
 }
 
 jboolean get_finished(JNIEnv *env, jobject) {
@@ -123,13 +207,16 @@ jboolean get_finished(JNIEnv *env, jobject) {
 }
 
 jstring get_result(JNIEnv *env, jobject) {
-  std::string result;
-  if (decoder->DecodedSomething()) {
-    result = decoder->result()[0].sentence;
-  }
-  LOG(INFO) << "wenet ui result: " << total_result + result;
-  return env->NewStringUTF((total_result + result).c_str());
+  std::shared_ptr<const std::string> result = ui_result.Get();
+  VLOG(1) << "wenet ui result: " << *result;
+  return env->NewStringUTF(result->c_str());
 }
+
+jlong get_last_chunk_cpu_time_us(JNIEnv *env, jobject) {
+  return last_chunk_cpu_us;
+}
+
+jlong get_total_cpu_time_us(JNIEnv *env, jobject) { return total_cpu_us; }
 }  // namespace wenet
 
 JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *) {
@@ -148,12 +235,18 @@ JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *) {
     {"reset", "()V", reinterpret_cast<void *>(wenet::reset)},
     {"acceptWaveform", "([S)V",
      reinterpret_cast<void *>(wenet::accept_waveform)},
+    {"acceptWaveformDirect", "(Ljava/nio/ByteBuffer;I)V",
+     reinterpret_cast<void *>(wenet::accept_waveform_direct)},
     {"setInputFinished", "()V",
      reinterpret_cast<void *>(wenet::set_input_finished)},
     {"getFinished", "()Z", reinterpret_cast<void *>(wenet::get_finished)},
     {"startDecode", "()V", reinterpret_cast<void *>(wenet::start_decode)},
     {"getResult", "()Ljava/lang/String;",
      reinterpret_cast<void *>(wenet::get_result)},
+    {"getLastChunkCpuTimeUs", "()J",
+     reinterpret_cast<void *>(wenet::get_last_chunk_cpu_time_us)},
+    {"getTotalCpuTimeUs", "()J",
+     reinterpret_cast<void *>(wenet::get_total_cpu_time_us)},
   };
   int rc = env->RegisterNatives(c, methods,
                                 sizeof(methods) / sizeof(JNINativeMethod));
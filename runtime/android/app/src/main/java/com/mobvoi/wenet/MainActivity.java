@@ -208,6 +208,8 @@ public class MainActivity extends AppCompatActivity {
             textView.setText(Recognize.getResult());
           });
         } else {
+          Log.i(LOG_TAG, "Decoding cpu time(ms): "
+              + Recognize.getTotalCpuTimeUs() / 1000);
           runOnUiThread(() -> {
             Button button = findViewById(R.id.button);
             button.setEnabled(true);
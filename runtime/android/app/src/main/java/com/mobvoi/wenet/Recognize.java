@@ -1,5 +1,7 @@
 package com.mobvoi.wenet;
 
+import java.nio.ByteBuffer;
+
 public class Recognize {
 
   static {
@@ -9,8 +11,13 @@ public class Recognize {
   public static native void init(String modelDir);
   public static native void reset();
   public static native void acceptWaveform(short[] waveform);
+  // 16 bits pcm of native order in a direct buffer, read without copy
+  public static native void acceptWaveformDirect(ByteBuffer waveform, int numSamples);
   public static native void setInputFinished();
   public static native boolean getFinished();
   public static native void startDecode();
   public static native String getResult();
+  // CPU time of the decoding of the last chunk and of the utterance
+  public static native long getLastChunkCpuTimeUs();
+  public static native long getTotalCpuTimeUs();
 }
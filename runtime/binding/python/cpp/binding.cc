@@ -13,6 +13,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
@@ -21,20 +26,96 @@
 
 namespace py = pybind11;
 
+using Int16Array = py::array_t<int16_t, py::array::c_style>;
+using FloatArray = py::array_t<float, py::array::c_style>;
+
+// The samples of a numpy array, which are read in place without the GIL,
+// the array is kept alive by the caller during the call
+template <typename T>
+std::pair<const T*, int> Samples(const py::array_t<T, py::array::c_style>& a) {
+  if (a.ndim() != 1) {
+    throw std::invalid_argument("the audio must be a 1-D array");
+  }
+  return {a.data(), static_cast<int>(a.shape(0))};
+}
+
+// The batch as the float samples of BatchRecognizer, which is the copy of
+// the float32 arrays, or where the int16 arrays are converted, and it's
+// done without the GIL. The arrays of other dtypes are converted to float32
+// first.
+std::vector<std::vector<float>> BatchSamples(const py::list& arrays) {
+  std::vector<Int16Array> int16_arrays;
+  std::vector<FloatArray> float_arrays;
+  std::vector<bool> is_int16;
+  for (const auto& item : arrays) {
+    is_int16.push_back(py::isinstance<Int16Array>(item));
+    if (is_int16.back()) {
+      int16_arrays.push_back(item.cast<Int16Array>());
+    } else {
+      float_arrays.push_back(item.cast<FloatArray>());
+    }
+  }
+  std::vector<std::pair<const int16_t*, int>> int16_wavs;
+  std::vector<std::pair<const float*, int>> float_wavs;
+  for (const auto& a : int16_arrays) int16_wavs.push_back(Samples(a));
+  for (const auto& a : float_arrays) float_wavs.push_back(Samples(a));
+  py::gil_scoped_release release;
+  std::vector<std::vector<float>> wavs(is_int16.size());
+  size_t int16_index = 0, float_index = 0;
+  for (size_t i = 0; i < wavs.size(); ++i) {
+    if (is_int16[i]) {
+      const auto& wav = int16_wavs[int16_index++];
+      wavs[i].assign(wav.first, wav.first + wav.second);
+    } else {
+      const auto& wav = float_wavs[float_index++];
+      wavs[i].assign(wav.first, wav.first + wav.second);
+    }
+  }
+  return wavs;
+}
 
 PYBIND11_MODULE(_wenet, m) {
   m.doc() = "wenet pybind11 plugin";  // optional module docstring
   m.def("wenet_init", &wenet_init, py::return_value_policy::reference,
         "wenet init");
+  m.def("wenet_model_load", &wenet_model_load,
+        py::return_value_policy::reference, "load the shared model");
+  m.def("wenet_model_free", &wenet_model_free, "free the shared model");
+  m.def("wenet_decoder_create", &wenet_decoder_create,
+        py::return_value_policy::reference,
+        "create a decoder of the shared model");
   m.def("wenet_free", &wenet_free, "wenet free");
   m.def("wenet_reset", &wenet_reset, "wenet reset");
-  m.def("wenet_decode", &wenet_decode, "wenet decode");
+  m.def("wenet_decode", &wenet_decode, "wenet decode",
+        py::call_guard<py::gil_scoped_release>());
+  // numpy audio, read in place by the decoder without the GIL
+  m.def(
+      "wenet_decode_array",
+      [](void* decoder, Int16Array pcm, int last) {
+        auto samples = Samples(pcm);
+        py::gil_scoped_release release;
+        wenet_decode(decoder, reinterpret_cast<const char*>(samples.first),
+                     samples.second * sizeof(int16_t), last);
+      },
+      py::arg("decoder"), py::arg("pcm").noconvert(), py::arg("last"),
+      "wenet decode int16 numpy array");
+  m.def(
+      "wenet_decode_array",
+      [](void* decoder, FloatArray pcm, int last) {
+        auto samples = Samples(pcm);
+        py::gil_scoped_release release;
+        wenet_decode_float(decoder, samples.first, samples.second, last);
+      },
+      py::arg("decoder"), py::arg("pcm").noconvert(), py::arg("last"),
+      "wenet decode float32 numpy array in 16 bits pcm range");
   m.def("wenet_get_result", &wenet_get_result, py::return_value_policy::copy,
         "wenet get result");
   m.def("wenet_set_log_level", &wenet_set_log_level, "set log level");
   m.def("wenet_set_nbest", &wenet_set_nbest, "set nbest");
   m.def("wenet_set_timestamp", &wenet_set_timestamp, "set timestamp flag");
   m.def("wenet_add_context", &wenet_add_context, "add one context word");
+  m.def("wenet_remove_context", &wenet_remove_context,
+        "remove one context word");
   m.def("wenet_set_context_score", &wenet_set_context_score,
         "set context bonus score");
   m.def("wenet_set_language", &wenet_set_language, "set language");
@@ -42,10 +123,21 @@ PYBIND11_MODULE(_wenet, m) {
         "enable continuous decoding or not");
   py::class_<BatchRecognizer>(m, "BatchRecognizer")
     .def(py::init<const char*>())
+    .def(py::init<const char*, int>())
+    .def("set_nbest", &BatchRecognizer::set_nbest)
     .def("set_enable_timestamp", &BatchRecognizer::set_enable_timestamp)
     .def("AddContext", &BatchRecognizer::AddContext)
+    .def("RemoveContext", &BatchRecognizer::RemoveContext)
     .def("set_context_score", &BatchRecognizer::set_context_score)
     .def("set_language", &BatchRecognizer::set_language)
-    .def("DecodeData", &BatchRecognizer::DecodeData)
-    .def("Decode", &BatchRecognizer::Decode);
+    .def("DecodeData", &BatchRecognizer::DecodeData,
+         py::call_guard<py::gil_scoped_release>())
+    .def("Decode", &BatchRecognizer::Decode,
+         py::call_guard<py::gil_scoped_release>())
+    .def("DecodeArrays", [](BatchRecognizer& recognizer,
+                            const py::list& arrays) {
+      std::vector<std::vector<float>> wavs = BatchSamples(arrays);
+      py::gil_scoped_release release;
+      return recognizer.DecodeData(wavs);
+    });
 }
@@ -1,3 +1,3 @@
-from .decoder import Decoder  # noqa
+from .decoder import Decoder, Model  # noqa
 from .batch_decoder import BatchDecoder  # noqa
 from _wenet import wenet_set_log_level as set_log_level  # noqa
@@ -13,7 +13,7 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
-from typing import List, Optional
+from typing import List, Optional, Union
 
 import _wenet
 
@@ -28,7 +28,8 @@ class BatchDecoder:
                  nbest: int = 1,
                  enable_timestamp: bool = False,
                  context: Optional[List[str]] = None,
-                 context_score: float = 3.0):
+                 context_score: float = 3.0,
+                 num_threads: int = 1):
         """ Init WeNet decoder
         Args:
             lang: language type of the model
@@ -37,13 +38,15 @@ class BatchDecoder:
                for the final result
             context: context words
             context_score: bonus score when the context is matched
+            num_threads: number of the intra-op threads of the model
         """
         if model_dir is None:
             model_dir = Hub.get_model_by_lang(lang)
 
-        self.d = _wenet.BatchRecognizer(model_dir)
+        self.d = _wenet.BatchRecognizer(model_dir, num_threads)
 
         self.set_language(lang)
+        self.d.set_nbest(nbest)
         self.enable_timestamp(enable_timestamp)
         if context is not None:
             self.add_context(context)
@@ -61,6 +64,11 @@ class BatchDecoder:
             assert isinstance(c, str)
             self.d.AddContext(c)
 
+    def remove_context(self, contexts: List[str]):
+        for c in contexts:
+            assert isinstance(c, str)
+            self.d.RemoveContext(c)
+
     def set_context_score(self, score: float):
         self.d.set_context_score(score)
 
@@ -68,12 +76,15 @@ class BatchDecoder:
         assert lang in ['chs', 'en']
         self.d.set_language(lang)
 
-    def decode(self, pcms: List[bytes]) -> str:
+    def decode(self, pcms: List[Union[bytes, 'numpy.ndarray']]) -> str:
         """ Decode the input data
 
         Args:
-            pcms: a list of wav pcm
+            pcms: a list of wav pcm, bytes of 16 bits pcm, or 1-D numpy
+                int16 or float32(in the range of 16 bits pcm) arrays
         """
-        assert isinstance(pcms[0], bytes)
-        result = self.d.Decode(pcms)
+        if isinstance(pcms[0], bytes):
+            result = self.d.Decode(pcms)
+        else:
+            result = self.d.DecodeArrays(list(pcms))
         return result
@@ -12,13 +12,27 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
-from typing import List, Optional
+from typing import List, Optional, Union
 
 import _wenet
 
 from .hub import Hub
 
 
+class Model:
+
+    def __init__(self, model_dir: Optional[str] = None, lang: str = 'chs'):
+        """ Load the model once for many decoders, e.g. the decoders of
+            the worker threads, which share it
+        """
+        if model_dir is None:
+            model_dir = Hub.get_model_by_lang(lang)
+        self.m = _wenet.wenet_model_load(model_dir)
+
+    def __del__(self):
+        _wenet.wenet_model_free(self.m)
+
+
 class Decoder:
 
     def __init__(self,
@@ -28,7 +42,8 @@ class Decoder:
                  enable_timestamp: bool = False,
                  context: Optional[List[str]] = None,
                  context_score: float = 3.0,
-                 continuous_decoding: bool = False):
+                 continuous_decoding: bool = False,
+                 model: Optional[Model] = None):
         """ Init WeNet decoder
         Args:
             lang: language type of the model
@@ -38,11 +53,14 @@ class Decoder:
             context: context words
             context_score: bonus score when the context is matched
             continuous_decoding: enable countinous decoding or not
+            model: the shared model, model_dir is ignored if it's given
         """
-        if model_dir is None:
-            model_dir = Hub.get_model_by_lang(lang)
-
-        self.d = _wenet.wenet_init(model_dir)
+        if model is not None:
+            self.d = _wenet.wenet_decoder_create(model.m)
+        else:
+            if model_dir is None:
+                model_dir = Hub.get_model_by_lang(lang)
+            self.d = _wenet.wenet_init(model_dir)
 
         self.set_language(lang)
         self.set_nbest(nbest)
@@ -73,6 +91,13 @@ class Decoder:
             assert isinstance(c, str)
             _wenet.wenet_add_context(self.d, c)
 
+    def remove_context(self, contexts: List[str]):
+        """ The changed contexts take effect from the next reset
+        """
+        for c in contexts:
+            assert isinstance(c, str)
+            _wenet.wenet_remove_context(self.d, c)
+
     def set_context_score(self, score: float):
         _wenet.wenet_set_context_score(self.d, score)
 
@@ -84,16 +109,25 @@ class Decoder:
         flag = 1 if continuous_decoding else 0
         _wenet.wenet_set_continuous_decoding(self.d, flag)
 
-    def decode(self, pcm: bytes, last: bool = True) -> str:
+    def decode(self, pcm: Union[bytes, 'numpy.ndarray'],
+               last: bool = True) -> str:
         """ Decode the input data
 
         Args:
-            pcm: wav pcm
+            pcm: wav pcm, bytes of 16 bits pcm, or a 1-D numpy int16 or
+                float32(in the range of 16 bits pcm) array, which is read
+                in place
             last: if it is the last package of the data
         """
-        assert isinstance(pcm, bytes)
         finish = 1 if last else 0
-        _wenet.wenet_decode(self.d, pcm, len(pcm), finish)
+        if isinstance(pcm, bytes):
+            _wenet.wenet_decode(self.d, pcm, len(pcm), finish)
+        else:
+            import numpy as np
+            if pcm.dtype != np.int16:
+                pcm = pcm.astype(np.float32, copy=False)
+            pcm = np.ascontiguousarray(pcm)
+            _wenet.wenet_decode_array(self.d, pcm, finish)
         result = _wenet.wenet_get_result(self.d)
         if last:  # Reset status for next decoding automatically
             self.reset()
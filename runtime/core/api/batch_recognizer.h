@@ -15,6 +15,8 @@
 #ifndef API_BATCH_RECOGNIZER_H_
 #define API_BATCH_RECOGNIZER_H_
 
+#include <algorithm>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -23,44 +25,30 @@
 #include "decoder/asr_decoder.h"
 #include "decoder/batch_asr_decoder.h"
 #include "decoder/batch_torch_asr_model.h"
+#include "decoder/result_cache.h"
 #include "post_processor/post_processor.h"
 #include "utils/file.h"
+#include "utils/fst_io.h"
 #include "utils/json.h"
+#include "utils/model_bundle.h"
 #include "utils/string.h"
 
 class BatchRecognizer {
  public:
-  explicit BatchRecognizer(const std::string& model_dir, int num_threads = 1) {
+  explicit BatchRecognizer(const std::string& model_dir, int num_threads = 1)
+      : model_dir_(model_dir) {
     // FeaturePipeline init
     feature_config_ = std::make_shared<wenet::FeaturePipelineConfig>(80, 16000);
     // Resource init
     resource_ = std::make_shared<wenet::DecodeResource>();
     wenet::BatchTorchAsrModel::InitEngineThreads(num_threads);
-    std::string model_path = wenet::JoinPath(model_dir, "final.zip");
-    CHECK(wenet::FileExists(model_path));
-
-    auto model = std::make_shared<wenet::BatchTorchAsrModel>();
-    model->Read(model_path);
-    resource_->batch_model = model;
-
-    // units.txt: E2E model unit
-    std::string unit_path = wenet::JoinPath(model_dir, "units.txt");
-    CHECK(wenet::FileExists(unit_path));
-    resource_->unit_table = std::shared_ptr<fst::SymbolTable>(
-      fst::SymbolTable::ReadText(unit_path));
-
-    std::string fst_path = wenet::JoinPath(model_dir, "TLG.fst");
-    if (wenet::FileExists(fst_path)) {  // With LM
-      resource_->fst = std::shared_ptr<fst::Fst<fst::StdArc>>(
-          fst::Fst<fst::StdArc>::Read(fst_path));
-
-      std::string symbol_path = wenet::JoinPath(model_dir, "words.txt");
-      CHECK(wenet::FileExists(symbol_path));
-      resource_->symbol_table = std::shared_ptr<fst::SymbolTable>(
-          fst::SymbolTable::ReadText(symbol_path));
-    } else {  // Without LM, symbol_table is the same as unit_table
-      resource_->symbol_table = resource_->unit_table;
+    // A bundle file of the resources, or the directory of the files
+    if (wenet::ModelBundle::IsBundle(model_dir)) {
+      ReadBundle(model_dir);
+    } else {
+      ReadModelDir(model_dir);
     }
+    wenet::BuildSymbolMaps(resource_.get());
 
     // Context config init
     context_config_ = std::make_shared<wenet::ContextConfig>();
@@ -69,13 +57,16 @@ class BatchRecognizer {
   }
 
   void InitDecoder() {
-    CHECK(decoder_ == nullptr);
+    CHECK(decoder_ == nullptr || contexts_changed_);
+    decoder_ = nullptr;
+    contexts_changed_ = false;
     // Optional init context graph
+    resource_->context_graph = nullptr;
     if (context_.size() > 0) {
       context_config_->context_score = context_score_;
       auto context_graph =
           std::make_shared<wenet::ContextGraph>(*context_config_);
-      context_graph->BuildContextGraph(context_, resource_->symbol_table);
+      context_graph->BuildContextGraph(context_, *resource_->symbol_map);
       resource_->context_graph = context_graph;
     }
     // PostProcessor
@@ -90,11 +81,17 @@ class BatchRecognizer {
     decoder_ = std::make_shared<wenet::BatchAsrDecoder>(
         feature_config_, resource_,
         *decode_options_);
+    // The results of the cache depend on the model, the context and the
+    // language, which are fixed until the contexts are changed
+    std::string context = model_dir_ + "\n" + language_;
+    if (!context_.empty()) context += "\n" + std::to_string(context_score_);
+    for (const auto& word : context_) context += "\n" + word;
+    result_context_ = wenet::ResultCache::Hash(context);
   }
 
   std::string Decode(const std::vector<std::string>& wavs) {
-    // Init decoder when it is called first time
-    if (decoder_ == nullptr) {
+    // Init decoder when it is called first time or the contexts are changed
+    if (decoder_ == nullptr || contexts_changed_) {
       InitDecoder();
     }
     std::vector<std::vector<float>> wavs_float;
@@ -107,40 +104,170 @@ class BatchRecognizer {
       }
       wavs_float.push_back(std::move(wav_float));
     }
-    decoder_->Reset();
-    decoder_->Decode(wavs_float);
-    return decoder_->get_batch_result(nbest_, enable_timestamp_);
+    return DecodeData(wavs_float);
   }
 
   std::string DecodeData(const std::vector<std::vector<float>>& wavs) {
     // Init decoder when it is called first time
-    if (decoder_ == nullptr) {
+    if (decoder_ == nullptr || contexts_changed_) {
       InitDecoder();
     }
-    decoder_->Reset();
-    decoder_->Decode(wavs);
-    return decoder_->get_batch_result(nbest_, enable_timestamp_);
+    if (result_cache_ == nullptr) {
+      decoder_->Reset();
+      decoder_->Decode(wavs);
+      return decoder_->get_batch_result(nbest_, enable_timestamp_);
+    }
+    // Only the waves not in the cache are decoded
+    std::vector<std::vector<wenet::DecodeResult>> results(wavs.size());
+    std::vector<size_t> misses;
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < wavs.size(); ++i) {
+      uint64_t key = wenet::ResultCache::Key(wavs[i].data(), wavs[i].size(),
+                                             result_context_);
+      if (!result_cache_->Lookup(key, wavs[i].data(), wavs[i].size(),
+                                 &results[i])) {
+        misses.push_back(i);
+        keys.push_back(key);
+      }
+    }
+    if (!misses.empty()) {
+      std::vector<std::vector<float>> decode_wavs;
+      for (size_t i : misses) decode_wavs.push_back(wavs[i]);
+      decoder_->Reset();
+      decoder_->Decode(decode_wavs);
+      const auto& batch_result = decoder_->batch_result();
+      for (size_t j = 0; j < misses.size(); ++j) {
+        results[misses[j]] = batch_result[j];
+        result_cache_->Insert(keys[j], wavs[misses[j]].data(),
+                              wavs[misses[j]].size(), batch_result[j]);
+      }
+    }
+    return SerializeResult(results);
   }
 
+  // Pipelined DecodeData, see BatchAsrDecoder::DecodeAsync, the results are
+  // serialized by SerializeResult when the future is ready
+  std::future<std::vector<std::vector<wenet::DecodeResult>>> DecodeAsync(
+      std::vector<std::vector<float>> wavs) {
+    if (decoder_ == nullptr || contexts_changed_) {
+      InitDecoder();
+    }
+    return decoder_->DecodeAsync(std::move(wavs));
+  }
 
+  std::string SerializeResult(
+      const std::vector<std::vector<wenet::DecodeResult>>& results) const {
+    return wenet::BatchAsrDecoder::SerializeBatchResult(results, nbest_,
+                                                        enable_timestamp_);
+  }
 
   void set_nbest(int n) { nbest_ = n; }
   void set_enable_timestamp(bool flag) { enable_timestamp_ = flag; }
-  void AddContext(const char* word) { context_.emplace_back(word); }
-  void set_context_score(float score) { context_score_ = score; }
+  // The contexts changed after the decoder is inited take effect from the
+  // next call of decoding, the graph is rebuilt then, which is cheap for the
+  // contexts of the cache of the compiled context graphs
+  void AddContext(const char* word) {
+    context_.emplace_back(word);
+    contexts_changed_ = decoder_ != nullptr;
+  }
+  void RemoveContext(const char* word) {
+    auto end = std::remove(context_.begin(), context_.end(), word);
+    if (end == context_.end()) return;
+    context_.erase(end, context_.end());
+    contexts_changed_ = decoder_ != nullptr;
+  }
+  void set_context_score(float score) {
+    context_score_ = score;
+    contexts_changed_ = decoder_ != nullptr;
+  }
   void set_language(const char* lang) { language_ = lang; }
+  // Cache the results of up to `capacity` waves by a hash of the audio, so
+  // the same waves aren't decoded again by Decode and DecodeData, see
+  // wenet::ResultCache
+  void set_result_cache(int capacity) {
+    result_cache_ = capacity > 0
+                        ? std::make_shared<wenet::ResultCache>(capacity)
+                        : nullptr;
+  }
+  // See DecodeOptions::max_batch_frames, set it before InitDecoder
+  void set_max_batch_frames(int frames) {
+    decode_options_->max_batch_frames = frames;
+  }
 
  private:
+  void ReadModelDir(const std::string& model_dir) {
+    std::string model_path = wenet::JoinPath(model_dir, "final.zip");
+    CHECK(wenet::FileExists(model_path));
+
+    auto model = std::make_shared<wenet::BatchTorchAsrModel>();
+    model->Read(model_path);
+    resource_->batch_model = model;
+
+    // units.txt: E2E model unit
+    std::string unit_path = wenet::JoinPath(model_dir, "units.txt");
+    CHECK(wenet::FileExists(unit_path));
+    resource_->unit_table = std::shared_ptr<fst::SymbolTable>(
+      fst::SymbolTable::ReadText(unit_path));
+
+    std::string fst_path = wenet::JoinPath(model_dir, "TLG.fst");
+    std::string tl_path = wenet::JoinPath(model_dir, "TL.fst");
+    std::string g_path = wenet::JoinPath(model_dir, "G.fst");
+    if (wenet::FileExists(fst_path)) {
+      resource_->fst = wenet::ReadFst(fst_path);
+    } else if (wenet::FileExists(tl_path) && wenet::FileExists(g_path)) {
+      // Without the static TLG, compose TL with G on the fly, the cache of
+      // each decoding session is up to 64MB
+      auto tl = wenet::ReadFst(tl_path);
+      auto g = wenet::ReadFst(g_path);
+      CHECK(tl != nullptr && g != nullptr);
+      resource_->fst = wenet::ComposeLazily(*tl, *g, 64 << 20);
+    }
+    if (resource_->fst != nullptr) {  // With LM
+      std::string symbol_path = wenet::JoinPath(model_dir, "words.txt");
+      CHECK(wenet::FileExists(symbol_path));
+      resource_->symbol_table = std::shared_ptr<fst::SymbolTable>(
+          fst::SymbolTable::ReadText(symbol_path));
+    } else {  // Without LM, symbol_table is the same as unit_table
+      resource_->symbol_table = resource_->unit_table;
+    }
+  }
+
+  // The sections of the bundle are the files of the model directory, see
+  // wenet::ModelBundle
+  void ReadBundle(const std::string& path) {
+    auto bundle = wenet::ModelBundle::Open(path);
+    CHECK(bundle != nullptr) << "Invalid bundle " << path;
+    const wenet::ModelBundle::Section* model = bundle->Find("final.zip");
+    CHECK(model != nullptr) << "No torch model in " << path;
+    auto batch_model = std::make_shared<wenet::BatchTorchAsrModel>();
+    batch_model->set_model_data(model->data, model->size);
+    batch_model->Read(path);
+    resource_->batch_model = batch_model;
+    resource_->unit_table = bundle->ReadSymbolTable("units");
+    CHECK(resource_->unit_table != nullptr) << "No units in " << path;
+    if (bundle->Find("TLG.fst") != nullptr) {  // With LM
+      resource_->fst = bundle->ReadFst("TLG.fst");
+      resource_->symbol_table = bundle->ReadSymbolTable("words");
+      CHECK(resource_->fst != nullptr && resource_->symbol_table != nullptr);
+    } else {  // Without LM, symbol_table is the same as unit_table
+      resource_->symbol_table = resource_->unit_table;
+    }
+  }
+
   std::shared_ptr<wenet::FeaturePipelineConfig> feature_config_ = nullptr;
   std::shared_ptr<wenet::DecodeResource> resource_ = nullptr;
   std::shared_ptr<wenet::DecodeOptions> decode_options_ = nullptr;
   std::shared_ptr<wenet::BatchAsrDecoder> decoder_ = nullptr;
   std::shared_ptr<wenet::ContextConfig> context_config_ = nullptr;
   std::shared_ptr<wenet::PostProcessOptions> post_process_opts_ = nullptr;
+  std::shared_ptr<wenet::ResultCache> result_cache_ = nullptr;
+  std::string model_dir_;
+  uint64_t result_context_ = 0;
 
   int nbest_ = 1;
   bool enable_timestamp_ = false;
   std::vector<std::string> context_;
+  bool contexts_changed_ = false;
   float context_score_;
   std::string language_ = "chs";
 };
@@ -14,25 +14,49 @@
 
 #include "api/wenet_api.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "api/batch_recognizer.h"
 #include "decoder/asr_decoder.h"
 #include "decoder/torch_asr_model.h"
 #include "post_processor/post_processor.h"
 #include "utils/file.h"
+#include "utils/fst_io.h"
+#include "utils/blocking_queue.h"
 #include "utils/json.h"
+#include "utils/snapshot.h"
 #include "utils/string.h"
+#include "utils/thread_pool.h"
 
-class Recognizer {
+// The decode threads of the asynchronous calls, shared by all the decoders
+static int g_num_threads = 0;
+
+static wenet::ThreadPool* DecodePool() {
+  static std::once_flag once;
+  static std::unique_ptr<wenet::ThreadPool> pool;
+  std::call_once(once, []() {
+    int num_threads = g_num_threads > 0
+                          ? g_num_threads
+                          : std::max(1u, std::thread::hardware_concurrency());
+    pool.reset(new wenet::ThreadPool(num_threads));
+  });
+  return pool.get();
+}
+
+// The model, the unit table and the optional TLG loaded from the model dir,
+// which are shared by the decoders created from it
+class Model {
  public:
-  explicit Recognizer(const std::string& model_dir) {
-    // FeaturePipeline init
-    feature_config_ = std::make_shared<wenet::FeaturePipelineConfig>(80, 16000);
-    feature_pipeline_ =
-        std::make_shared<wenet::FeaturePipeline>(*feature_config_);
-    // Resource init
+  explicit Model(const std::string& model_dir) {
     resource_ = std::make_shared<wenet::DecodeResource>();
     wenet::TorchAsrModel::InitEngineThreads();
     std::string model_path = wenet::JoinPath(model_dir, "final.zip");
@@ -49,10 +73,19 @@ class Recognizer {
       fst::SymbolTable::ReadText(unit_path));
 
     std::string fst_path = wenet::JoinPath(model_dir, "TLG.fst");
-    if (wenet::FileExists(fst_path)) {  // With LM
-      resource_->fst = std::shared_ptr<fst::Fst<fst::StdArc>>(
-          fst::Fst<fst::StdArc>::Read(fst_path));
-
+    std::string tl_path = wenet::JoinPath(model_dir, "TL.fst");
+    std::string g_path = wenet::JoinPath(model_dir, "G.fst");
+    if (wenet::FileExists(fst_path)) {
+      resource_->fst = wenet::ReadFst(fst_path);
+    } else if (wenet::FileExists(tl_path) && wenet::FileExists(g_path)) {
+      // Without the static TLG, compose TL with G on the fly, the cache of
+      // each decoding session is up to 64MB
+      auto tl = wenet::ReadFst(tl_path);
+      auto g = wenet::ReadFst(g_path);
+      CHECK(tl != nullptr && g != nullptr);
+      resource_->fst = wenet::ComposeLazily(*tl, *g, 64 << 20);
+    }
+    if (resource_->fst != nullptr) {  // With LM
       std::string symbol_path = wenet::JoinPath(model_dir, "words.txt");
       CHECK(wenet::FileExists(symbol_path));
       resource_->symbol_table = std::shared_ptr<fst::SymbolTable>(
@@ -60,6 +93,30 @@ class Recognizer {
     } else {  // Without LM, symbol_table is the same as unit_table
       resource_->symbol_table = resource_->unit_table;
     }
+    wenet::BuildSymbolMaps(resource_.get());
+    resource_->fbank_tables =
+        wenet::FeaturePipelineConfig(80, 16000).NewFbankTables();
+  }
+
+  const wenet::DecodeResource& resource() const { return *resource_; }
+
+ private:
+  std::shared_ptr<wenet::DecodeResource> resource_ = nullptr;
+};
+
+class Recognizer {
+ public:
+  explicit Recognizer(const std::string& model_dir)
+      : Recognizer(std::make_shared<Model>(model_dir)) {}
+
+  explicit Recognizer(std::shared_ptr<Model> model) : model_(model) {
+    // FeaturePipeline init
+    feature_config_ = std::make_shared<wenet::FeaturePipelineConfig>(80, 16000);
+    feature_pipeline_ = std::make_shared<wenet::FeaturePipeline>(
+        *feature_config_, model_->resource().fbank_tables);
+    // Resource init, a shallow copy of the model's, since the post processor
+    // and the contexts are of the decoder
+    resource_ = std::make_shared<wenet::DecodeResource>(model_->resource());
 
     // Context config init
     context_config_ = std::make_shared<wenet::ContextConfig>();
@@ -67,25 +124,34 @@ class Recognizer {
     post_process_opts_ = std::make_shared<wenet::PostProcessOptions>();
   }
 
+  ~Recognizer() { Wait(); }
+
   void Reset() {
     if (feature_pipeline_ != nullptr) {
       feature_pipeline_->Reset();
     }
+    if (contexts_changed_) {
+      // Rebuilt with the new contexts by the next Decode, which is cheap
+      // for the contexts of the cache of the compiled context graphs
+      decoder_ = nullptr;
+      contexts_changed_ = false;
+    }
     if (decoder_ != nullptr) {
       decoder_->Reset();
     }
-    result_.clear();
+    result_.Publish(std::string());
   }
 
   void InitDecoder() {
     CHECK(decoder_ == nullptr);
-    // Optional init context graph
+    // Optional init context graph of this decoder, as an overlay on the
+    // shared contexts of the resource if there are
+    std::shared_ptr<wenet::ContextGraph> context_graph = nullptr;
     if (context_.size() > 0) {
       context_config_->context_score = context_score_;
-      auto context_graph =
-          std::make_shared<wenet::ContextGraph>(*context_config_);
-      context_graph->BuildContextGraph(context_, resource_->symbol_table);
-      resource_->context_graph = context_graph;
+      context_graph = std::make_shared<wenet::ContextGraph>(
+          *context_config_, resource_->context_graph);
+      context_graph->BuildContextGraph(context_, *resource_->symbol_map);
     }
     // PostProcessor
     if (language_ == "chs") {  // TODO(Binbin Zhang): CJK(chs, jp, kr)
@@ -96,12 +162,11 @@ class Recognizer {
     resource_->post_processor =
         std::make_shared<wenet::PostProcessor>(*post_process_opts_);
     // Init decoder
-    decoder_ = std::make_shared<wenet::AsrDecoder>(feature_pipeline_, resource_,
-                                                   *decode_options_);
+    decoder_ = std::make_shared<wenet::AsrDecoder>(
+        feature_pipeline_, resource_, *decode_options_, context_graph);
   }
 
   void Decode(const char* data, int len, int last) {
-    using wenet::DecodeState;
     // Init decoder when it is called first time
     if (decoder_ == nullptr) {
       InitDecoder();
@@ -110,6 +175,21 @@ class Recognizer {
     CHECK_EQ(len % 2, 0);
     feature_pipeline_->AcceptWaveform(reinterpret_cast<const int16_t*>(data),
                                       len / 2);
+    DecodeAccepted(last);
+  }
+
+  // Samples of 16 bits PCM range as float
+  void DecodeFloat(const float* data, int num_samples, int last) {
+    // Init decoder when it is called first time
+    if (decoder_ == nullptr) {
+      InitDecoder();
+    }
+    feature_pipeline_->AcceptWaveform(data, num_samples);
+    DecodeAccepted(last);
+  }
+
+  void DecodeAccepted(int last) {
+    using wenet::DecodeState;
     if (last > 0) {
       feature_pipeline_->set_input_finished();
     }
@@ -132,6 +212,23 @@ class Recognizer {
     }
   }
 
+  // The packages are queued, and a task of the decode pool drains the queue,
+  // so there is at most one task of the decoder at a time
+  void DecodeAsync(const char* data, int len, int last) {
+    std::lock_guard<std::mutex> lock(async_mutex_);
+    pending_.emplace_back(std::string(data, len), last);
+    if (!running_) {
+      running_ = true;
+      DecodePool()->post(wenet::TaskPriority::kNormal,
+                         [this]() { RunPending(); });
+    }
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(async_mutex_);
+    async_cond_.wait(lock, [this]() { return !running_; });
+  }
+
   void UpdateResult(bool final_result) {
     json::JSON obj;
     obj["type"] = final_result ? "final_result" : "partial_result";
@@ -153,20 +250,66 @@ class Recognizer {
       one["sentence"] = decoder_->result()[i].sentence;
       obj["nbest"].append(one);
     }
-    result_ = obj.dump();
+    auto result = std::make_shared<const std::string>(obj.dump());
+    result_.Publish(result);
+    if (callback_ != nullptr) {
+      callback_(user_data_, result->c_str(), final_result ? 1 : 0);
+    }
   }
 
-  const char* GetResult() { return result_.c_str(); }
+  // The snapshot of the result, which is read without blocking the decoding
+  // thread, and is held by the polling thread until its next call
+  const char* GetResult() {
+    thread_local std::shared_ptr<const std::string> polled;
+    polled = result_.Get();
+    return polled->c_str();
+  }
 
   void set_nbest(int n) { nbest_ = n; }
   void set_enable_timestamp(bool flag) { enable_timestamp_ = flag; }
-  void AddContext(const char* word) { context_.emplace_back(word); }
-  void set_context_score(float score) { context_score_ = score; }
+  // The contexts changed after the decoder is inited take effect from the
+  // next Reset
+  void AddContext(const char* word) {
+    context_.emplace_back(word);
+    contexts_changed_ = decoder_ != nullptr;
+  }
+  void RemoveContext(const char* word) {
+    auto end = std::remove(context_.begin(), context_.end(), word);
+    if (end == context_.end()) return;
+    context_.erase(end, context_.end());
+    contexts_changed_ = decoder_ != nullptr;
+  }
+  void set_context_score(float score) {
+    context_score_ = score;
+    contexts_changed_ = decoder_ != nullptr;
+  }
   void set_language(const char* lang) { language_ = lang; }
   void set_continuous_decoding(bool flag) { continuous_decoding_ = flag; }
+  void set_result_callback(wenet_result_callback callback, void* user_data) {
+    callback_ = callback;
+    user_data_ = user_data;
+  }
 
  private:
+  void RunPending() {
+    while (true) {
+      std::pair<std::string, int> package;
+      {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        if (pending_.empty()) {
+          running_ = false;
+          async_cond_.notify_all();
+          return;
+        }
+        package = std::move(pending_.front());
+        pending_.pop_front();
+      }
+      Decode(package.first.data(), package.first.size(), package.second);
+    }
+  }
+
   // NOTE(Binbin Zhang): All use shared_ptr for clone in the future
+  std::shared_ptr<Model> model_ = nullptr;
   std::shared_ptr<wenet::FeaturePipelineConfig> feature_config_ = nullptr;
   std::shared_ptr<wenet::FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<wenet::DecodeResource> resource_ = nullptr;
@@ -176,19 +319,106 @@ class Recognizer {
   std::shared_ptr<wenet::PostProcessOptions> post_process_opts_ = nullptr;
 
   int nbest_ = 1;
-  std::string result_;
+  // Published by the decoding thread, polled by GetResult on any thread
+  wenet::Snapshot<std::string> result_;
   bool enable_timestamp_ = false;
   std::vector<std::string> context_;
+  bool contexts_changed_ = false;
   float context_score_;
   std::string language_ = "chs";
   bool continuous_decoding_ = false;
+  wenet_result_callback callback_ = nullptr;
+  void* user_data_ = nullptr;
+
+  std::mutex async_mutex_;
+  std::condition_variable async_cond_;
+  // The packages of DecodeAsync with their last flags
+  std::deque<std::pair<std::string, int>> pending_;
+  bool running_ = false;
 };
 
+// The C handle of BatchRecognizer, the calls of the recognizer are
+// serialized by the mutex
+struct BatchDecoder {
+  // A batch of wenet_batch_decode_async in the pipeline of the decoder
+  struct PendingBatch {
+    std::future<std::vector<std::vector<wenet::DecodeResult>>> results;
+    wenet_result_callback callback = nullptr;
+    void* user_data = nullptr;
+  };
+
+  BatchDecoder(const std::string& model_dir, int num_threads)
+      : recognizer(model_dir, num_threads),
+        complete_thread(&BatchDecoder::CompleteFunc, this) {}
+  ~BatchDecoder() {
+    pending.Push(nullptr);
+    complete_thread.join();
+  }
+
+  // Wait for the pending batches in order and report their results, on its
+  // own thread rather than the decode threads, which it would block.
+  void CompleteFunc() {
+    while (true) {
+      std::shared_ptr<PendingBatch> batch = pending.Pop();
+      if (batch == nullptr) break;
+      std::string result;
+      try {
+        auto results = batch->results.get();
+        std::lock_guard<std::mutex> lock(mutex);
+        result = recognizer.SerializeResult(results);
+      } catch (const std::exception& e) {
+        LOG(ERROR) << "Failed to decode the batch: " << e.what();
+      }
+      if (batch->callback != nullptr) {
+        batch->callback(batch->user_data, result.c_str(), 1);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      --num_pending;
+      cond.notify_all();
+    }
+  }
+
+  BatchRecognizer recognizer;
+  std::mutex mutex;
+  std::string result;
+  std::condition_variable cond;
+  int num_pending = 0;
+  wenet::BlockingQueue<std::shared_ptr<PendingBatch>> pending;
+  std::thread complete_thread;
+};
+
+static std::vector<std::vector<float>> ToFloatWavs(const char** data,
+                                                   const int* len,
+                                                   int num_wavs) {
+  std::vector<std::vector<float>> wavs(num_wavs);
+  for (int i = 0; i < num_wavs; ++i) {
+    CHECK_EQ(len[i] % 2, 0);
+    const int16_t* pcm = reinterpret_cast<const int16_t*>(data[i]);
+    wavs[i].assign(pcm, pcm + len[i] / 2);
+  }
+  return wavs;
+}
+
 void* wenet_init(const char* model_dir) {
   Recognizer* decoder = new Recognizer(model_dir);
   return reinterpret_cast<void*>(decoder);
 }
 
+void* wenet_model_load(const char* model_dir) {
+  auto model = new std::shared_ptr<Model>(std::make_shared<Model>(model_dir));
+  return reinterpret_cast<void*>(model);
+}
+
+void wenet_model_free(void* model) {
+  delete reinterpret_cast<std::shared_ptr<Model>*>(model);
+}
+
+void* wenet_decoder_create(void* model) {
+  Recognizer* decoder =
+      new Recognizer(*reinterpret_cast<std::shared_ptr<Model>*>(model));
+  return reinterpret_cast<void*>(decoder);
+}
+
 void wenet_free(void* decoder) {
   delete reinterpret_cast<Recognizer*>(decoder);
 }
@@ -229,6 +459,11 @@ void wenet_add_context(void* decoder, const char* word) {
   recognizer->AddContext(word);
 }
 
+void wenet_remove_context(void* decoder, const char* word) {
+  Recognizer* recognizer = reinterpret_cast<Recognizer*>(decoder);
+  recognizer->RemoveContext(word);
+}
+
 void wenet_set_context_score(void* decoder, float score) {
   Recognizer* recognizer = reinterpret_cast<Recognizer*>(decoder);
   recognizer->set_context_score(score);
@@ -243,3 +478,95 @@ void wenet_set_continuous_decoding(void* decoder, int flag) {
   Recognizer* recognizer = reinterpret_cast<Recognizer*>(decoder);
   recognizer->set_continuous_decoding(flag > 0);
 }
+
+void wenet_decode_float(void* decoder, const float* data, int num_samples,
+                        int last) {
+  Recognizer* recognizer = reinterpret_cast<Recognizer*>(decoder);
+  recognizer->DecodeFloat(data, num_samples, last);
+}
+
+void wenet_set_num_threads(int num_threads) { g_num_threads = num_threads; }
+
+void wenet_set_result_callback(void* decoder, wenet_result_callback callback,
+                               void* user_data) {
+  Recognizer* recognizer = reinterpret_cast<Recognizer*>(decoder);
+  recognizer->set_result_callback(callback, user_data);
+}
+
+void wenet_decode_async(void* decoder, const char* data, int len, int last) {
+  Recognizer* recognizer = reinterpret_cast<Recognizer*>(decoder);
+  recognizer->DecodeAsync(data, len, last);
+}
+
+void wenet_wait(void* decoder) {
+  Recognizer* recognizer = reinterpret_cast<Recognizer*>(decoder);
+  recognizer->Wait();
+}
+
+void* wenet_batch_init(const char* model_dir, int num_threads) {
+  BatchDecoder* decoder = new BatchDecoder(model_dir, num_threads);
+  return reinterpret_cast<void*>(decoder);
+}
+
+void wenet_batch_free(void* decoder) {
+  wenet_batch_wait(decoder);
+  delete reinterpret_cast<BatchDecoder*>(decoder);
+}
+
+const char* wenet_batch_decode(void* decoder, const char** data,
+                               const int* len, int num_wavs) {
+  BatchDecoder* batch = reinterpret_cast<BatchDecoder*>(decoder);
+  auto wavs = ToFloatWavs(data, len, num_wavs);
+  std::lock_guard<std::mutex> lock(batch->mutex);
+  batch->result = batch->recognizer.DecodeData(wavs);
+  return batch->result.c_str();
+}
+
+void wenet_batch_decode_async(void* decoder, const char** data,
+                              const int* len, int num_wavs,
+                              wenet_result_callback callback,
+                              void* user_data) {
+  BatchDecoder* batch = reinterpret_cast<BatchDecoder*>(decoder);
+  auto wavs = ToFloatWavs(data, len, num_wavs);
+  auto pending = std::make_shared<BatchDecoder::PendingBatch>();
+  pending->callback = callback;
+  pending->user_data = user_data;
+  {
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    pending->results = batch->recognizer.DecodeAsync(std::move(wavs));
+    ++batch->num_pending;
+  }
+  // The batch is pipelined by the decoder, its result is reported by the
+  // complete thread of the decoder
+  batch->pending.Push(std::move(pending));
+}
+
+void wenet_batch_wait(void* decoder) {
+  BatchDecoder* batch = reinterpret_cast<BatchDecoder*>(decoder);
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->cond.wait(lock, [batch]() { return batch->num_pending == 0; });
+}
+
+void wenet_batch_set_nbest(void* decoder, int n) {
+  BatchDecoder* batch = reinterpret_cast<BatchDecoder*>(decoder);
+  std::lock_guard<std::mutex> lock(batch->mutex);
+  batch->recognizer.set_nbest(n);
+}
+
+void wenet_batch_set_timestamp(void* decoder, int flag) {
+  BatchDecoder* batch = reinterpret_cast<BatchDecoder*>(decoder);
+  std::lock_guard<std::mutex> lock(batch->mutex);
+  batch->recognizer.set_enable_timestamp(flag > 0);
+}
+
+void wenet_batch_set_language(void* decoder, const char* lang) {
+  BatchDecoder* batch = reinterpret_cast<BatchDecoder*>(decoder);
+  std::lock_guard<std::mutex> lock(batch->mutex);
+  batch->recognizer.set_language(lang);
+}
+
+void wenet_batch_set_result_cache(void* decoder, int capacity) {
+  BatchDecoder* batch = reinterpret_cast<BatchDecoder*>(decoder);
+  std::lock_guard<std::mutex> lock(batch->mutex);
+  batch->recognizer.set_result_cache(capacity);
+}
@@ -26,6 +26,23 @@ extern "C" {
  */
 void* wenet_init(const char* model_dir);
 
+/** Load the model from the model dir once, for the decoders created by
+ *  wenet_decoder_create, which share it
+ * @returns model object or NULL if problem occured
+ */
+void* wenet_model_load(const char* model_dir);
+
+/** Free the model, the decoders created from it hold their references, so
+ *  it can be freed before them
+ */
+void wenet_model_free(void* model);
+
+/** Create a decoder of the loaded model, only the search and the feature
+ *  states of the stream are allocated. It's freed by wenet_free.
+ * @returns decoder object or NULL if problem occured
+ */
+void* wenet_decoder_create(void* model);
+
 /** Free wenet decoder and corresponding resource
  */
 void wenet_free(void* decoder);
@@ -41,6 +58,14 @@ void wenet_reset(void* decoder);
  */
 void wenet_decode(void* decoder, const char* data, int len, int last);
 
+/** Decode the input wav samples, which are float in the range of 16 bits
+ *  PCM, e.g. the samples of a numpy float32 array
+ * @param num_samples: number of the samples
+ * @param last: if it is the last package
+ */
+void wenet_decode_float(void* decoder, const float* data, int num_samples,
+                        int last);
+
 /** Get decode result in json format
  *  It returns partial result when last is 0
  *  It returns final result when last is 1
@@ -68,6 +93,10 @@ void wenet_decode(void* decoder, const char* data, int len, int last);
     "nbest": nbest is enabled when n > 1 in final_result
         "sentence": the ASR result
         "word_pieces": optional, output timestamp when enabled
+
+    It may be polled on any thread while the decoding runs on another, e.g.
+    of wenet_decode_async, without blocking it. The string is valid until
+    the next wenet_get_result on the same thread.
  */
 const char* wenet_get_result(void* decoder);
 
@@ -85,6 +114,12 @@ void wenet_set_timestamp(void* decoder, int flag);
  */
 void wenet_add_context(void* decoder, const char* word);
 
+/** Remove all the contextual biasings of the word
+ *  The contexts added or removed after the decoding has begun take effect
+ *  from the next wenet_reset
+ */
+void wenet_remove_context(void* decoder, const char* word);
+
 /** Set contextual biasing bonus score
  */
 void wenet_set_context_score(void* decoder, float score);
@@ -104,6 +139,86 @@ void wenet_set_log_level(int level);
  */
 void wenet_set_continuous_decoding(void* decoder, int flag);
 
+/** Result callback of the asynchronous calls
+ *  @param user_data: the user_data given when the callback is set
+ *  @param result: the result in json format of wenet_get_result, or of
+ *                 wenet_batch_decode for the batch calls, which is only
+ *                 valid during the callback
+ *  @param last: 1 for the final result, 0 for the partial one
+ *  It's called from the internal decode threads, so it should return soon.
+ */
+typedef void (*wenet_result_callback)(void* user_data, const char* result,
+                                      int last);
+
+/** Set the number of the internal decode threads shared by all the
+ *  asynchronous calls, it only takes effect before the first one
+ */
+void wenet_set_num_threads(int num_threads);
+
+/** Set the callback of the decoder, which is called every time the result
+ *  is updated, by wenet_decode or wenet_decode_async
+ */
+void wenet_set_result_callback(void* decoder, wenet_result_callback callback,
+                               void* user_data);
+
+/** Decode the input wav data on the internal decode threads, it returns
+ *  without waiting for the decoding, and the results are reported by the
+ *  result callback. The data is copied, and the packages of a decoder are
+ *  decoded one by one in the order they are given.
+ *  The parameters are the same as wenet_decode.
+ */
+void wenet_decode_async(void* decoder, const char* data, int len, int last);
+
+/** Wait until all the packages given by wenet_decode_async are decoded,
+ *  it's required before wenet_reset, and is done by wenet_free
+ */
+void wenet_wait(void* decoder);
+
+/** Init batch decoder from the model dir, for the non-streaming recognition
+ *  of a batch of wavs at once
+ * @param num_threads: the intra-op threads of the model
+ * @returns batch decoder object or NULL if problem occured
+ */
+void* wenet_batch_init(const char* model_dir, int num_threads);
+
+/** Free the batch decoder, after waiting for its asynchronous calls
+ */
+void wenet_batch_free(void* decoder);
+
+/** Decode a batch of wavs and return the results in json format, which
+ *  are valid until the next call of the decoder
+ * @param data: the wavs, pcm data encoded as int16_t(16 bits)
+ * @param len: the data length of each wav
+ * @param num_wavs: the batch size
+ */
+const char* wenet_batch_decode(void* decoder, const char** data,
+                               const int* len, int num_wavs);
+
+/** Asynchronous version of wenet_batch_decode, the data is copied, and the
+ *  results are reported by the callback once with last = 1, from a thread
+ *  of the decoder. The batches given one after another are pipelined by the
+ *  decoder, and their callbacks are called in order.
+ */
+void wenet_batch_decode_async(void* decoder, const char** data,
+                              const int* len, int num_wavs,
+                              wenet_result_callback callback, void* user_data);
+
+/** Wait until all the batches given by wenet_batch_decode_async are done
+ */
+void wenet_batch_wait(void* decoder);
+
+/** Same as the setters of the decoder above, for the batch decoder
+ */
+void wenet_batch_set_nbest(void* decoder, int n);
+void wenet_batch_set_timestamp(void* decoder, int flag);
+void wenet_batch_set_language(void* decoder, const char* lang);
+
+/** Cache the results of up to `capacity` wavs by a hash of the audio, so
+ *  the same wavs given to wenet_batch_decode again are not decoded, 0 to
+ *  disable the cache
+ */
+void wenet_batch_set_result_cache(void* decoder, int capacity);
+
 #ifdef __cplusplus
 }
 #endif
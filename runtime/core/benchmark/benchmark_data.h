@@ -0,0 +1,102 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BENCHMARK_BENCHMARK_DATA_H_
+#define BENCHMARK_BENCHMARK_DATA_H_
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fst/symbol-table.h"
+
+// Synthetic inputs of realistic sizes for the benchmarks, they are generated
+// with fixed seeds so the runs are comparable.
+namespace wenet {
+namespace benchmark_data {
+
+// The vocabulary size of a typical mandarin char model
+const int kVocabSize = 5000;
+// Decoded frames per chunk, chunk size 16 after 4x subsampling
+const int kChunkFrames = 16;
+// 10s of speech after 4x subsampling
+const int kUtteranceFrames = 250;
+
+// CTC log posteriors, most frames are dominated by blank as in the real
+// output, and the others peak at a random token.
+inline std::vector<std::vector<float>> CtcLogp(int num_frames,
+                                               int vocab_size = kVocabSize,
+                                               float blank_ratio = 0.7) {
+  std::mt19937 rng(17);
+  std::normal_distribution<float> noise(0, 1);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  std::uniform_int_distribution<int> token(1, vocab_size - 1);
+  std::vector<std::vector<float>> logp(num_frames,
+                                       std::vector<float>(vocab_size));
+  for (auto& frame : logp) {
+    for (auto& x : frame) x = noise(rng);
+    int peak = uniform(rng) < blank_ratio ? 0 : token(rng);
+    frame[peak] += 12;
+    // log softmax
+    float max = *std::max_element(frame.begin(), frame.end());
+    float sum = 0;
+    for (float x : frame) sum += std::exp(x - max);
+    float log_sum = max + std::log(sum);
+    for (auto& x : frame) x -= log_sum;
+  }
+  return logp;
+}
+
+// UTF-8 of the i-th CJK unified ideograph
+inline std::string CjkChar(int i) {
+  int code = 0x4E00 + i;
+  std::string s;
+  s += static_cast<char>(0xE0 | (code >> 12));
+  s += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+  s += static_cast<char>(0x80 | (code & 0x3F));
+  return s;
+}
+
+// A char unit table, <blank> is 0 and the chars are 1 ~ vocab_size - 1
+inline std::shared_ptr<fst::SymbolTable> UnitTable(
+    int vocab_size = kVocabSize) {
+  auto table = std::make_shared<fst::SymbolTable>();
+  table->AddSymbol("<blank>", 0);
+  for (int i = 1; i < vocab_size; ++i) {
+    table->AddSymbol(CjkChar(i - 1), i);
+  }
+  return table;
+}
+
+// Contexts of 2 ~ 6 random chars of the unit table
+inline std::vector<std::string> Contexts(int num_contexts,
+                                         int vocab_size = kVocabSize) {
+  std::mt19937 rng(29);
+  std::uniform_int_distribution<int> length(2, 6);
+  std::uniform_int_distribution<int> unit(0, vocab_size - 2);
+  std::vector<std::string> contexts(num_contexts);
+  for (auto& context : contexts) {
+    int n = length(rng);
+    for (int i = 0; i < n; ++i) context += CjkChar(unit(rng));
+  }
+  return contexts;
+}
+
+}  // namespace benchmark_data
+}  // namespace wenet
+
+#endif  // BENCHMARK_BENCHMARK_DATA_H_
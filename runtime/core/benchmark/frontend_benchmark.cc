@@ -0,0 +1,127 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "frontend/fbank.h"
+#include "frontend/fft.h"
+#include "frontend/resampler.h"
+
+static std::vector<float> RandomWave(int num_samples) {
+  std::mt19937 rng(7);
+  std::normal_distribution<float> noise(0, 1000);
+  std::vector<float> wave(num_samples);
+  for (auto& x : wave) x = noise(rng);
+  return wave;
+}
+
+// Arg: number of samples, 100ms chunk of streaming, 1s and 10s of 16k audio
+static void BM_FbankCompute(benchmark::State& state) {
+  wenet::Fbank fbank(80, 16000, 400, 160);
+  std::vector<float> wave = RandomWave(state.range(0));
+  std::vector<std::vector<float>> feat;
+  int num_frames = 0;
+  for (auto _ : state) {
+    feat.clear();
+    num_frames = fbank.Compute(wave, &feat);
+    benchmark::DoNotOptimize(feat.data());
+  }
+  state.SetItemsProcessed(state.iterations() * num_frames);
+}
+BENCHMARK(BM_FbankCompute)->Arg(1600)->Arg(16000)->Arg(160000);
+
+static void BM_FbankComputeBatch(benchmark::State& state) {
+  wenet::Fbank fbank(80, 16000, 400, 160);
+  std::vector<float> wave = RandomWave(state.range(0));
+  std::vector<std::vector<float>> feat;
+  int num_frames = 0;
+  for (auto _ : state) {
+    feat.clear();
+    num_frames = fbank.ComputeBatch(wave, &feat);
+    benchmark::DoNotOptimize(feat.data());
+  }
+  state.SetItemsProcessed(state.iterations() * num_frames);
+}
+BENCHMARK(BM_FbankComputeBatch)->Arg(1600)->Arg(16000)->Arg(160000);
+
+static void BM_FbankComputeComplexFft(benchmark::State& state) {
+  wenet::Fbank fbank(80, 16000, 400, 160);
+  fbank.set_use_real_fft(false);
+  std::vector<float> wave = RandomWave(state.range(0));
+  std::vector<std::vector<float>> feat;
+  int num_frames = 0;
+  for (auto _ : state) {
+    feat.clear();
+    num_frames = fbank.Compute(wave, &feat);
+    benchmark::DoNotOptimize(feat.data());
+  }
+  state.SetItemsProcessed(state.iterations() * num_frames);
+}
+BENCHMARK(BM_FbankComputeComplexFft)->Arg(16000);
+
+// Arg: fft length, 512 is the padded length of a 25ms frame of 16k audio
+static void BM_Fft(benchmark::State& state) {
+  const int n = state.range(0);
+  std::vector<float> sintbl(n + n / 4);
+  std::vector<int> bitrev(n);
+  wenet::make_sintbl(n, sintbl.data());
+  wenet::make_bitrev(n, bitrev.data());
+  std::vector<float> wave = RandomWave(n);
+  std::vector<float> x(n), y(n);
+  for (auto _ : state) {
+    std::copy(wave.begin(), wave.end(), x.begin());
+    std::fill(y.begin(), y.end(), 0);
+    wenet::fft(bitrev.data(), sintbl.data(), x.data(), y.data(), n);
+    benchmark::DoNotOptimize(x.data());
+    benchmark::DoNotOptimize(y.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Fft)->Arg(512)->Arg(1024);
+
+static void BM_Rfft(benchmark::State& state) {
+  const int n = state.range(0);
+  std::vector<float> sintbl(n + n / 4);
+  std::vector<int> bitrev(n / 2);
+  wenet::make_sintbl(n, sintbl.data());
+  wenet::make_bitrev(n / 2, bitrev.data());
+  std::vector<float> wave = RandomWave(n);
+  std::vector<float> x(n), y(n / 2 + 1);
+  for (auto _ : state) {
+    std::copy(wave.begin(), wave.end(), x.begin());
+    wenet::rfft(bitrev.data(), sintbl.data(), x.data(), y.data(), n);
+    benchmark::DoNotOptimize(x.data());
+    benchmark::DoNotOptimize(y.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Rfft)->Arg(512)->Arg(1024);
+
+// Arg: input sample rate, 100ms chunks of streaming resampled to 16k
+static void BM_Resample(benchmark::State& state) {
+  int input_rate = state.range(0);
+  wenet::Resampler resampler(input_rate, 16000);
+  std::vector<float> wave = RandomWave(input_rate / 10);
+  std::vector<float> output;
+  for (auto _ : state) {
+    output.clear();
+    resampler.Resample(wave.data(), wave.size(), false, &output);
+    benchmark::DoNotOptimize(output.data());
+  }
+  state.SetItemsProcessed(state.iterations() * wave.size());
+}
+BENCHMARK(BM_Resample)->Arg(8000)->Arg(44100)->Arg(48000);
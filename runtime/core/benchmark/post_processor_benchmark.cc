@@ -0,0 +1,42 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "post_processor/post_processor.h"
+
+// A mandarin english mixed sentence of about 10s of speech, with the ▁ of
+// the bpe units as the decoder outputs
+static std::string MixedSentence() {
+  std::string sentence;
+  for (int i = 0; i < 4; ++i) {
+    sentence += "今天我们来聊一聊▁DEEP▁LEARNING▁的▁MODEL▁的一些问题";
+  }
+  return sentence;
+}
+
+static void BM_PostProcessorProcess(benchmark::State& state) {
+  wenet::PostProcessOptions opts;
+  opts.language_type = static_cast<wenet::LanguageType>(state.range(0));
+  wenet::PostProcessor post_processor(opts);
+  std::string sentence = MixedSentence();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(post_processor.Process(sentence, true));
+  }
+  state.SetBytesProcessed(state.iterations() * sentence.size());
+}
+BENCHMARK(BM_PostProcessorProcess)
+    ->Arg(wenet::kMandarinEnglish)
+    ->Arg(wenet::kIndoEuropean);
@@ -0,0 +1,188 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "benchmark/benchmark_data.h"
+#include "decoder/context_graph.h"
+#include "decoder/ctc_prefix_beam_search.h"
+#include "decoder/language_model.h"
+#include "utils/utils.h"
+
+namespace data = wenet::benchmark_data;
+
+static std::shared_ptr<wenet::ContextGraph> BuildContextGraph(
+    int num_contexts) {
+  wenet::ContextConfig config;
+  config.max_contexts = num_contexts;
+  auto graph = std::make_shared<wenet::ContextGraph>(config);
+  graph->BuildContextGraph(data::Contexts(num_contexts), data::UnitTable());
+  return graph;
+}
+
+// Decodes an utterance chunk by chunk as the AsrDecoder does.
+// Args: number of contexts, 0 means without context graph, and whether the
+// times are kept
+static void BM_CtcPrefixBeamSearch(benchmark::State& state) {
+  std::shared_ptr<wenet::ContextGraph> context_graph = nullptr;
+  if (state.range(0) > 0) context_graph = BuildContextGraph(state.range(0));
+  wenet::CtcPrefixBeamSearchOptions opts;
+  opts.enable_times = state.range(1) != 0;
+  wenet::CtcPrefixBeamSearch search(opts, context_graph);
+  auto logp = data::CtcLogp(data::kUtteranceFrames);
+  std::vector<std::vector<std::vector<float>>> chunks;
+  for (size_t i = 0; i < logp.size(); i += data::kChunkFrames) {
+    size_t end = std::min(logp.size(), i + data::kChunkFrames);
+    chunks.emplace_back(logp.begin() + i, logp.begin() + end);
+  }
+  for (auto _ : state) {
+    for (const auto& chunk : chunks) {
+      search.Search(chunk);
+    }
+    search.FinalizeSearch();
+    benchmark::DoNotOptimize(search.Outputs().data());
+    search.Reset();
+  }
+  state.SetItemsProcessed(state.iterations() * logp.size());
+}
+BENCHMARK(BM_CtcPrefixBeamSearch)
+    ->Args({0, 1})
+    ->Args({0, 0})
+    ->Args({100, 1})
+    ->Args({5000, 1});
+
+// The blank frames are skipped when their posterior is over the thresh
+static void BM_CtcPrefixBeamSearchBlankSkip(benchmark::State& state) {
+  wenet::CtcPrefixBeamSearchOptions opts;
+  opts.blank_skip_thresh = 0.98;
+  wenet::CtcPrefixBeamSearch search(opts);
+  auto logp = data::CtcLogp(data::kUtteranceFrames);
+  for (auto _ : state) {
+    search.Search(logp);
+    benchmark::DoNotOptimize(search.Outputs().data());
+    search.Reset();
+  }
+  state.SetItemsProcessed(state.iterations() * logp.size());
+}
+BENCHMARK(BM_CtcPrefixBeamSearchBlankSkip);
+
+// The shallow fusion of an n-gram of random sentences, for the overhead of
+// the LanguageModel batches and the state cache. Arg: order of the n-gram
+static void BM_CtcPrefixBeamSearchLm(benchmark::State& state) {
+  std::mt19937 rng(43);
+  std::uniform_int_distribution<int> token(1, data::kVocabSize - 1);
+  std::vector<std::vector<int>> sentences(10000, std::vector<int>(20));
+  for (auto& sentence : sentences) {
+    for (auto& t : sentence) t = token(rng);
+  }
+  auto lm = std::make_shared<wenet::NgramLanguageModel>(
+      state.range(0), data::kVocabSize, sentences);
+  wenet::CtcPrefixBeamSearchOptions opts;
+  wenet::CtcPrefixBeamSearch search(opts, nullptr, lm->Copy());
+  auto logp = data::CtcLogp(data::kUtteranceFrames);
+  for (auto _ : state) {
+    search.Search(logp);
+    benchmark::DoNotOptimize(search.Outputs().data());
+    search.Reset();
+  }
+  state.SetItemsProcessed(state.iterations() * logp.size());
+}
+BENCHMARK(BM_CtcPrefixBeamSearchLm)->Arg(2)->Arg(4);
+
+// Walks the graph by random words, most of which fall back along the
+// failure links. Arg: number of contexts
+static void BM_ContextGraphGetNextState(benchmark::State& state) {
+  auto graph = BuildContextGraph(state.range(0));
+  std::mt19937 rng(37);
+  std::uniform_int_distribution<int> word(1, data::kVocabSize - 1);
+  std::vector<int> words(4096);
+  for (auto& w : words) w = word(rng);
+  int cur_state = 0;
+  for (auto _ : state) {
+    for (int w : words) {
+      float score = 0;
+      bool is_start = false, is_end = false;
+      cur_state = graph->GetNextState(cur_state, w, &score, &is_start, &is_end);
+      benchmark::DoNotOptimize(score);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * words.size());
+}
+BENCHMARK(BM_ContextGraphGetNextState)->Arg(100)->Arg(5000);
+
+static void BM_ContextGraphBuild(benchmark::State& state) {
+  wenet::ContextConfig config;
+  config.max_contexts = state.range(0);
+  auto contexts = data::Contexts(state.range(0));
+  auto unit_table = data::UnitTable();
+  for (auto _ : state) {
+    wenet::ContextGraph graph(config);
+    graph.BuildContextGraph(contexts, unit_table);
+  }
+  state.SetItemsProcessed(state.iterations() * contexts.size());
+}
+BENCHMARK(BM_ContextGraphBuild)->Arg(100)->Arg(5000);
+
+// The top k of a frame over the vocabulary, as the prefix beam search does
+static void BM_TopK(benchmark::State& state) {
+  auto logp = data::CtcLogp(64);
+  std::vector<float> values;
+  std::vector<int32_t> indices;
+  for (auto _ : state) {
+    for (const auto& frame : logp) {
+      wenet::TopK(frame, state.range(0), &values, &indices);
+      benchmark::DoNotOptimize(values.data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * logp.size());
+}
+BENCHMARK(BM_TopK)->Arg(10)->Arg(16)->Arg(17)->Arg(100);
+
+static void BM_LogAdd(benchmark::State& state) {
+  std::mt19937 rng(41);
+  std::uniform_real_distribution<float> score(-50, 0);
+  std::vector<float> x(4096), y(4096);
+  for (size_t i = 0; i < x.size(); ++i) {
+    x[i] = score(rng);
+    y[i] = score(rng);
+  }
+  for (auto _ : state) {
+    for (size_t i = 0; i < x.size(); ++i) {
+      benchmark::DoNotOptimize(wenet::LogAdd(x[i], y[i]));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * x.size());
+}
+BENCHMARK(BM_LogAdd);
+
+static void BM_FastLogAdd(benchmark::State& state) {
+  std::mt19937 rng(41);
+  std::uniform_real_distribution<float> score(-50, 0);
+  std::vector<float> x(4096), y(4096);
+  for (size_t i = 0; i < x.size(); ++i) {
+    x[i] = score(rng);
+    y[i] = score(rng);
+  }
+  for (auto _ : state) {
+    for (size_t i = 0; i < x.size(); ++i) {
+      benchmark::DoNotOptimize(wenet::FastLogAdd(x[i], y[i]));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * x.size());
+}
+BENCHMARK(BM_FastLogAdd);
@@ -0,0 +1,156 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "benchmark/benchmark_data.h"
+#include "decoder/ctc_wfst_beam_search.h"
+#include "fst/vector-fst.h"
+#include "util/hash-list.h"
+#include "util/open-hash-list.h"
+#include "utils/fst_io.h"
+
+namespace data = wenet::benchmark_data;
+
+// A char loop graph, every token loops on the only state and outputs itself
+// while blank outputs nothing. The input labels are the token ids plus one,
+// as those of the TLG.
+static std::unique_ptr<fst::StdVectorFst> CharLoopGraph() {
+  auto graph = std::unique_ptr<fst::StdVectorFst>(new fst::StdVectorFst());
+  int s = graph->AddState();
+  graph->SetStart(s);
+  graph->SetFinal(s, fst::TropicalWeight::One());
+  for (int i = 0; i < data::kVocabSize; ++i) {
+    graph->AddArc(s, fst::StdArc(i + 1, i, 0.0, s));
+  }
+  return graph;
+}
+
+// Decodes an utterance chunk by chunk as the AsrDecoder does.
+static void DecodeChunks(const fst::Fst<fst::StdArc>& graph, int vocab_size,
+                         benchmark::State& state) {
+  wenet::CtcWfstBeamSearchOptions opts;
+  opts.max_active = state.range(0);
+  opts.beam = 16;
+  opts.lattice_beam = 10;
+  wenet::CtcWfstBeamSearch search(graph, opts, nullptr);
+  auto logp = data::CtcLogp(data::kUtteranceFrames, vocab_size);
+  std::vector<std::vector<std::vector<float>>> chunks;
+  for (size_t i = 0; i < logp.size(); i += data::kChunkFrames) {
+    size_t end = std::min(logp.size(), i + data::kChunkFrames);
+    chunks.emplace_back(logp.begin() + i, logp.begin() + end);
+  }
+  for (auto _ : state) {
+    for (const auto& chunk : chunks) {
+      search.Search(chunk);
+    }
+    search.FinalizeSearch();
+    benchmark::DoNotOptimize(search.Outputs().data());
+    search.Reset();
+  }
+  state.SetItemsProcessed(state.iterations() * logp.size());
+}
+
+// Arg: max active states
+static void BM_CtcWfstBeamSearch(benchmark::State& state) {
+  auto graph = CharLoopGraph();
+  DecodeChunks(*graph, data::kVocabSize, state);
+}
+BENCHMARK(BM_CtcWfstBeamSearch)->Arg(1000)->Arg(7000);
+
+// The same on the TLG of the path in the env WENET_BENCHMARK_TLG, e.g. of
+// the production model, to compare the builds with and without
+// OPEN_HASH_TOKENS. The tokens are the input labels of the graph.
+// Arg: max active states
+static void BM_CtcWfstBeamSearchTlg(benchmark::State& state) {
+  static std::shared_ptr<fst::Fst<fst::StdArc>> graph;
+  static int vocab_size = 0;
+  const char* path = std::getenv("WENET_BENCHMARK_TLG");
+  if (path == nullptr) {
+    state.SkipWithError("WENET_BENCHMARK_TLG is not set");
+    return;
+  }
+  if (graph == nullptr) {
+    graph = wenet::ReadFst(path);
+    if (graph == nullptr) {
+      state.SkipWithError("Failed to read WENET_BENCHMARK_TLG");
+      return;
+    }
+    for (fst::StateIterator<fst::Fst<fst::StdArc>> siter(*graph);
+         !siter.Done(); siter.Next()) {
+      for (fst::ArcIterator<fst::Fst<fst::StdArc>> aiter(*graph,
+                                                         siter.Value());
+           !aiter.Done(); aiter.Next()) {
+        vocab_size = std::max(vocab_size,
+                              static_cast<int>(aiter.Value().ilabel));
+      }
+    }
+  }
+  DecodeChunks(*graph, vocab_size, state);
+}
+BENCHMARK(BM_CtcWfstBeamSearchTlg)->Arg(1000)->Arg(7000);
+
+// The token hash of LatticeFasterDecoderTpl on its own, HashList or
+// OpenHashList. Each frame, the tokens of the previous frame are deleted
+// while about as many tokens of the next frame are inserted, of which a
+// quarter of the states are met again, as the recombined arcs.
+// Arg: active tokens
+template <class List>
+static void BM_TokenHash(benchmark::State& state) {
+  const int num_tokens = state.range(0);
+  std::mt19937 rng(7);
+  // The states of a large TLG
+  std::uniform_int_distribution<int> states(0, 5000000);
+  std::vector<int> keys(num_tokens * 5 / 4);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    keys[i] = i < static_cast<size_t>(num_tokens) ? states(rng)
+                                                  : keys[i - num_tokens];
+  }
+  std::shuffle(keys.begin(), keys.end(), rng);
+  List toks;
+  toks.SetSize(num_tokens * 2);
+  for (auto _ : state) {
+    typename List::Elem* prev = toks.Clear();
+    for (int key : keys) {
+      typename List::Elem* e = toks.Find(key);
+      if (e == nullptr) {
+        toks.Insert(key, key);
+      } else {
+        benchmark::DoNotOptimize(e->val);
+      }
+    }
+    while (prev != nullptr) {
+      typename List::Elem* tail = prev->tail;
+      toks.Delete(prev);
+      prev = tail;
+    }
+  }
+  for (auto* e = toks.Clear(); e != nullptr;) {
+    auto* tail = e->tail;
+    toks.Delete(e);
+    e = tail;
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK_TEMPLATE(BM_TokenHash, kaldi::HashList<int, int>)
+    ->Arg(1000)
+    ->Arg(7000);
+BENCHMARK_TEMPLATE(BM_TokenHash, kaldi::OpenHashList<int, int>)
+    ->Arg(1000)
+    ->Arg(7000);
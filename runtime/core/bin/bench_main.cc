@@ -0,0 +1,435 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Benchmark of the decoding in process, with the results in JSON, see
+// utils/benchmark.h. Each line of --scenarios is a scenario, its name and
+// the flags it overrides, e.g.
+//   streaming_tlg mode=streaming num_streams=8 chunk_size=16 fst_path=TLG.fst
+//   offline_onnx mode=offline onnx_dir=onnx chunk_size=-1
+// which are any flags of decoder/params.h or of this file. The model is read
+// per scenario, but the engine threads of the backends are set once per
+// process, so the scenarios of different intra_op_threads are to be run
+// by different processes. Without --scenarios, one scenario "default" is
+// run by the flags as they are.
+// The streaming scenarios replay the waves at --pace by --num_streams
+// concurrent streams, and measure the latencies as stream_benchmark_main.
+// The offline ones feed each wave at once and measure its decoding time.
+// With --text, the final results are scored by the error rate of the words
+// for English and of the chars for the others.
+// The rtf and the error rate of each scenario are logged against the
+// --reference_scenario of the same run, e.g. of the precisions by
+//   fp32 mode=offline
+//   bf16 mode=offline cpu_bf16=true
+// with --reference_scenario fp32.
+// The results are compared with the ones of --baseline, and it exits with 1
+// if any metric regresses beyond --thresholds.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "decoder/params.h"
+#include "frontend/wav.h"
+#include "utils/benchmark.h"
+#include "utils/flags.h"
+#include "utils/memory_budget.h"
+#include "utils/string.h"
+#include "utils/timer.h"
+
+DEFINE_string(wav_scp, "", "input wav scp of the benchmark");
+DEFINE_string(text, "",
+              "reference text of the wav scp, optional, to report the error "
+              "rate as the metric wer");
+DEFINE_string(scenarios, "",
+              "file of the scenarios, one per line of its name and the flags "
+              "it overrides as flag=value");
+DEFINE_string(mode, "streaming", "streaming or offline");
+DEFINE_int32(num_streams, 1, "number of the concurrent streams");
+DEFINE_int32(num_rounds, 1, "times the wav scp are decoded");
+DEFINE_int32(send_interval_ms, 100,
+             "interval of the audio sent to a streaming stream");
+DEFINE_double(pace, 1.0,
+              "pace of the streaming relative to real time, 0 means as fast "
+              "as possible");
+DEFINE_string(output, "", "the JSON file of the results, empty for stdout");
+DEFINE_string(baseline, "", "the JSON file of the results to compare with");
+DEFINE_string(thresholds, "",
+              "relative regressions allowed over the baseline, e.g. "
+              "rtf=0.05,chunk_latency_p99_ms=0.2, and default=0.1 for the "
+              "others, a negative one for no comparison");
+DEFINE_string(reference_scenario, "",
+              "scenario of this run to log the rtf and the wer of the others "
+              "against, optional");
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchStats {
+  std::mutex mutex;
+  std::vector<double> first_partial_ms;
+  std::vector<double> chunk_ms;
+  std::vector<double> final_ms;
+  double wave_ms = 0;
+  // Time in Decode() and Rescoring()
+  double decode_ms = 0;
+  int num_errors = 0;
+  int num_ref_tokens = 0;
+};
+
+struct BenchWave {
+  std::string key;
+  std::shared_ptr<wenet::WavReader> wav;
+};
+
+static double MsBetween(Clock::time_point a, Clock::time_point b) {
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+static double CpuSeconds() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static double Percentile(std::vector<double>* values, double p) {
+  if (values->empty()) return 0;
+  size_t k = std::min(values->size() - 1,
+                      static_cast<size_t>(p / 100 * values->size()));
+  std::nth_element(values->begin(), values->begin() + k, values->end());
+  return (*values)[k];
+}
+
+// Decode a wave, fed at the pace by another thread if it's streaming, and
+// return the final result
+static std::string RunStream(const wenet::WavReader& wav,
+                             const wenet::FeaturePipelineConfig& feature_config,
+                             std::shared_ptr<wenet::DecodeResource> resource,
+                             const wenet::DecodeOptions& decode_config,
+                             bool streaming, BenchStats* stats) {
+  CHECK_EQ(wav.sample_rate(), feature_config.sample_rate);
+  auto pipeline = std::make_shared<wenet::FeaturePipeline>(
+      feature_config, resource->fbank_tables);
+  wenet::AsrDecoder decoder(pipeline, resource, decode_config);
+  // The number of samples arrived and the time, ascending
+  std::mutex mutex;
+  std::vector<std::pair<int, Clock::time_point>> arrivals;
+  Clock::time_point end_of_speech;
+  auto feed = [&]() {
+    const int step = streaming
+                         ? wav.sample_rate() / 1000 * FLAGS_send_interval_ms
+                         : wav.num_samples();
+    Clock::time_point next = Clock::now();
+    for (int start = 0; start < wav.num_samples(); start += step) {
+      int size = std::min(step, wav.num_samples() - start);
+      if (streaming && FLAGS_pace > 0) {
+        next += std::chrono::microseconds(
+            static_cast<int64_t>(FLAGS_send_interval_ms * 1000 / FLAGS_pace));
+        std::this_thread::sleep_until(next);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        arrivals.emplace_back(start + size, Clock::now());
+      }
+      pipeline->AcceptWaveform(wav.data() + start, size);
+    }
+    end_of_speech = Clock::now();
+    pipeline->set_input_finished();
+  };
+  auto arrival_of = [&](int offset) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::lower_bound(
+        arrivals.begin(), arrivals.end(), offset,
+        [](const std::pair<int, Clock::time_point>& arrival, int value) {
+          return arrival.first < value;
+        });
+    if (arrivals.empty()) return Clock::now();
+    if (it == arrivals.end()) return arrivals.back().second;
+    return it->second;
+  };
+
+  Clock::time_point start = Clock::now();
+  std::thread feed_thread;
+  if (streaming) {
+    feed_thread = std::thread(feed);
+  } else {
+    feed();
+  }
+  std::vector<double> chunk_ms;
+  double first_partial_ms = -1;
+  double decode_ms = 0;
+  int num_frames = 0;
+  while (true) {
+    Clock::time_point decode_start = Clock::now();
+    wenet::DecodeState state = decoder.Decode();
+    Clock::time_point now = Clock::now();
+    decode_ms += MsBetween(decode_start, now);
+    if (state == wenet::DecodeState::kEndFeats) break;
+    if (!streaming || decoder.num_frames_in_current_chunk() == 0) continue;
+    num_frames += decoder.num_frames_in_current_chunk();
+    int last_sample = (num_frames - 1) * feature_config.frame_shift +
+                      feature_config.frame_length;
+    chunk_ms.push_back(MsBetween(arrival_of(last_sample), now));
+    if (first_partial_ms < 0 && decoder.DecodedSomething()) {
+      first_partial_ms = MsBetween(start, now);
+    }
+  }
+  Clock::time_point rescoring_start = Clock::now();
+  decoder.Rescoring();
+  Clock::time_point end = Clock::now();
+  decode_ms += MsBetween(rescoring_start, end);
+  if (feed_thread.joinable()) feed_thread.join();
+
+  std::lock_guard<std::mutex> lock(stats->mutex);
+  if (first_partial_ms >= 0) {
+    stats->first_partial_ms.push_back(first_partial_ms);
+  }
+  stats->chunk_ms.insert(stats->chunk_ms.end(), chunk_ms.begin(),
+                         chunk_ms.end());
+  stats->final_ms.push_back(MsBetween(end_of_speech, end));
+  stats->wave_ms +=
+      static_cast<double>(wav.num_samples()) / wav.sample_rate() * 1000;
+  stats->decode_ms += decode_ms;
+  return decoder.DecodedSomething() ? decoder.result()[0].sentence : "";
+}
+
+static wenet::BenchResult RunScenario(
+    const std::string& name, const std::vector<BenchWave>& waves,
+    const std::unordered_map<std::string, std::string>& refs) {
+  CHECK(FLAGS_mode == "streaming" || FLAGS_mode == "offline")
+      << "Unknown mode " << FLAGS_mode;
+  CHECK_GT(FLAGS_num_streams, 0);
+  bool streaming = FLAGS_mode == "streaming";
+  auto decode_config = wenet::InitDecodeOptionsFromFlags();
+  auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
+  auto decode_resource = wenet::InitDecodeResourceFromFlags();
+  wenet::ResetPeakProcessMemory();
+
+  BenchStats stats;
+  std::atomic<int> next(0);
+  const int num_tasks = waves.size() * FLAGS_num_rounds;
+  double cpu_start = CpuSeconds();
+  wenet::Timer timer;
+  std::vector<std::thread> streams;
+  for (int i = 0; i < FLAGS_num_streams; ++i) {
+    streams.emplace_back([&]() {
+      for (int j = next++; j < num_tasks; j = next++) {
+        const BenchWave& wave = waves[j % waves.size()];
+        std::string result =
+            RunStream(*wave.wav, *feature_config, decode_resource,
+                      *decode_config, streaming, &stats);
+        auto it = refs.find(wave.key);
+        if (it == refs.end()) continue;
+        std::vector<std::string> ref_tokens = wenet::ScoringTokens(it->second);
+        int num_errors =
+            wenet::EditDistance(ref_tokens, wenet::ScoringTokens(result));
+        std::lock_guard<std::mutex> lock(stats.mutex);
+        stats.num_errors += num_errors;
+        stats.num_ref_tokens += ref_tokens.size();
+      }
+    });
+  }
+  for (auto& t : streams) t.join();
+  double wall_seconds = timer.Elapsed() / 1000.0;
+  double cpu_seconds = CpuSeconds() - cpu_start;
+
+  wenet::BenchResult result;
+  result.scenario = name;
+  auto& metrics = result.metrics;
+  metrics["rtf"] = stats.decode_ms / stats.wave_ms;
+  metrics["cpu_rtf"] = cpu_seconds * 1000 / stats.wave_ms;
+  metrics["throughput"] = stats.wave_ms / 1000 / wall_seconds;
+  auto add_latency = [&](const std::string& stage,
+                         std::vector<double>* values) {
+    if (values->empty()) return;
+    for (int p : {50, 90, 99}) {
+      metrics[stage + "_latency_p" + std::to_string(p) + "_ms"] =
+          Percentile(values, p);
+    }
+  };
+  if (streaming) {
+    add_latency("first_partial", &stats.first_partial_ms);
+    add_latency("chunk", &stats.chunk_ms);
+  }
+  add_latency("final", &stats.final_ms);
+  if (stats.num_ref_tokens > 0) {
+    metrics["wer"] = static_cast<double>(stats.num_errors) /
+                     stats.num_ref_tokens;
+  }
+  int64_t rss = 0, peak_rss = 0;
+  if (wenet::ReadProcessMemory(&rss, &peak_rss)) {
+    metrics["peak_rss_mb"] = peak_rss / 1048576.0;
+  }
+  LOG(INFO) << name << ": decoded " << num_tasks << " utterances of "
+            << stats.wave_ms / 1000 << "s by " << FLAGS_num_streams
+            << " streams in " << wall_seconds << "s, rtf " << metrics["rtf"];
+  return result;
+}
+
+// The name and the flag=value overrides of each line
+static std::vector<std::pair<std::string, std::vector<std::string>>>
+ReadScenarios(const std::string& path) {
+  std::vector<std::pair<std::string, std::vector<std::string>>> scenarios;
+  std::ifstream in(path);
+  CHECK(in) << "Failed to open " << path;
+  std::string line;
+  while (getline(in, line)) {
+    line = wenet::Trim(line);
+    if (line.empty() || line[0] == '#') continue;
+    std::vector<std::string> strs;
+    wenet::SplitString(line, &strs);
+    std::string name = strs[0];
+    strs.erase(strs.begin());
+    scenarios.emplace_back(name, std::move(strs));
+  }
+  return scenarios;
+}
+
+// The speedup of the rtfs and the difference of the error rate
+static void LogAgainstReference(const std::vector<wenet::BenchResult>& results,
+                                const std::string& name) {
+  auto reference = std::find_if(
+      results.begin(), results.end(),
+      [&](const wenet::BenchResult& r) { return r.scenario == name; });
+  if (reference == results.end()) {
+    LOG(WARNING) << "No reference scenario " << name;
+    return;
+  }
+  const auto& ref = reference->metrics;
+  for (const auto& result : results) {
+    if (result.scenario == name) continue;
+    const auto& metrics = result.metrics;
+    std::ostringstream line;
+    line << result.scenario << " against " << name << ":";
+    for (const char* rtf : {"rtf", "cpu_rtf"}) {
+      if (metrics.count(rtf) == 0 || ref.count(rtf) == 0) continue;
+      line << " " << rtf << " " << metrics.at(rtf) << " vs " << ref.at(rtf);
+      if (metrics.at(rtf) > 0) {
+        line << " (x" << ref.at(rtf) / metrics.at(rtf) << ")";
+      }
+    }
+    if (metrics.count("wer") > 0 && ref.count("wer") > 0) {
+      line << " wer " << metrics.at("wer") << " vs " << ref.at("wer") << " ("
+           << std::showpos << metrics.at("wer") - ref.at("wer")
+           << std::noshowpos << ")";
+    }
+    LOG(INFO) << line.str();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  std::vector<BenchWave> waves;
+  std::ifstream wav_scp(FLAGS_wav_scp);
+  std::string line;
+  while (getline(wav_scp, line)) {
+    std::vector<std::string> strs;
+    wenet::SplitString(line, &strs);
+    CHECK_GE(strs.size(), 2);
+    waves.push_back({strs[0], std::make_shared<wenet::WavReader>(strs[1])});
+  }
+  if (waves.empty()) {
+    LOG(FATAL) << "Please provide non-empty wav scp.";
+  }
+
+  std::unordered_map<std::string, std::string> refs;
+  if (!FLAGS_text.empty()) {
+    std::ifstream text(FLAGS_text);
+    CHECK(text) << "Failed to open " << FLAGS_text;
+    while (getline(text, line)) {
+      std::vector<std::string> strs;
+      wenet::SplitString(line, &strs);
+      if (strs.empty()) continue;
+      size_t pos = line.find(strs[0]) + strs[0].size();
+      refs[strs[0]] = line.substr(pos);
+    }
+  }
+
+  std::vector<std::pair<std::string, std::vector<std::string>>> scenarios;
+  if (FLAGS_scenarios.empty()) {
+    scenarios.emplace_back("default", std::vector<std::string>());
+  } else {
+    scenarios = ReadScenarios(FLAGS_scenarios);
+  }
+  std::vector<wenet::BenchResult> results;
+  for (const auto& scenario : scenarios) {
+    // The overrides are restored after the scenario
+    gflags::FlagSaver saver;
+    for (const auto& flag : scenario.second) {
+      size_t pos = flag.find('=');
+      CHECK(pos != std::string::npos)
+          << "flag=value is expected, got " << flag;
+      std::string name = flag.substr(0, pos);
+      CHECK(!gflags::SetCommandLineOption(name.c_str(),
+                                          flag.substr(pos + 1).c_str())
+                 .empty())
+          << "Invalid flag " << flag << " of scenario " << scenario.first;
+    }
+    results.push_back(RunScenario(scenario.first, waves, refs));
+  }
+
+  if (!FLAGS_reference_scenario.empty()) {
+    LogAgainstReference(results, FLAGS_reference_scenario);
+  }
+  std::string json = wenet::BenchResultsToJson(results);
+  if (FLAGS_output.empty()) {
+    std::cout << json << std::endl;
+  } else {
+    std::ofstream out(FLAGS_output);
+    out << json << std::endl;
+  }
+
+  if (FLAGS_baseline.empty()) return 0;
+  std::ifstream in(FLAGS_baseline);
+  std::stringstream text;
+  text << in.rdbuf();
+  std::vector<wenet::BenchResult> baselines;
+  CHECK(wenet::ParseBenchResults(text.str(), &baselines))
+      << "Failed to read the baseline " << FLAGS_baseline;
+  wenet::BenchThresholds thresholds;
+  CHECK(wenet::ParseBenchThresholds(FLAGS_thresholds, &thresholds))
+      << "Invalid thresholds " << FLAGS_thresholds;
+  int num_regressions = 0;
+  for (const auto& result : results) {
+    auto baseline = std::find_if(baselines.begin(), baselines.end(),
+                                 [&](const wenet::BenchResult& b) {
+                                   return b.scenario == result.scenario;
+                                 });
+    if (baseline == baselines.end()) {
+      LOG(WARNING) << "No baseline of scenario " << result.scenario;
+      continue;
+    }
+    for (const auto& regression :
+         wenet::CompareBenchResults(result, *baseline, thresholds)) {
+      LOG(ERROR) << regression;
+      ++num_regressions;
+    }
+  }
+  LOG(INFO) << num_regressions << " regressions over " << FLAGS_baseline;
+  return num_regressions > 0 ? 1 : 0;
+}
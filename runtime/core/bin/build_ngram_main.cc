@@ -0,0 +1,37 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Build the binary n-gram model of an ARPA file, which is used by the
+// decoders with --word_lm_path and --lexicon_path, e.g.
+//   build_ngram_main --arpa lm.arpa --ngram lm.bin
+
+#include "decoder/ngram_model.h"
+#include "utils/flags.h"
+#include "utils/log.h"
+
+DEFINE_string(arpa, "", "input ARPA file");
+DEFINE_string(ngram, "", "output binary n-gram model");
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  CHECK(!FLAGS_arpa.empty() && !FLAGS_ngram.empty())
+      << "--arpa and --ngram are required";
+  if (!wenet::NgramModel::Build(FLAGS_arpa, FLAGS_ngram)) return 1;
+  wenet::NgramModel model;
+  CHECK(model.Open(FLAGS_ngram));
+  LOG(INFO) << "Built the " << model.order() << "-gram of "
+            << model.num_words() << " words to " << FLAGS_ngram;
+  return 0;
+}
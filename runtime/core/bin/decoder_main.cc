@@ -12,13 +12,30 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <future>
 #include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "decoder/params.h"
+#include "decoder/posterior_dump.h"
+#include "frontend/fbank_kernels.h"
+#include "frontend/mapped_wav_reader.h"
+#include "frontend/segmenter.h"
 #include "frontend/wav.h"
+#include "utils/blocking_queue.h"
+#include "utils/cpu_affinity.h"
 #include "utils/flags.h"
+#include "utils/memory_budget.h"
 #include "utils/string.h"
 #include "utils/thread_pool.h"
 #include "utils/timer.h"
@@ -32,42 +49,142 @@ DEFINE_string(result, "", "result output file");
 DEFINE_bool(continuous_decoding, false, "continuous decoding mode");
 DEFINE_int32(thread_num, 1, "num of decode thread");
 DEFINE_int32(warmup, 0, "num of warmup decode, 0 means no warmup");
+DEFINE_int32(io_thread_num, 1, "num of threads reading the waves");
+DEFINE_int32(prefetch, 16,
+             "num of waves read ahead of the decode threads, which bounds "
+             "the memory of the read waves");
+DEFINE_bool(sort_by_duration, false,
+            "decode the longest waves first by the file size, so the decode "
+            "threads don't wait for a long one at the end");
+DEFINE_bool(long_audio, false,
+            "split the waves at the silences into segments, which are "
+            "decoded in parallel by --thread_num threads, and the results "
+            "are stitched with the timestamps of the whole wave");
+DEFINE_int32(segment_min_ms, 10000, "min length of a segment of long audio");
+DEFINE_int32(segment_max_ms, 30000, "max length of a segment of long audio");
+DEFINE_int32(segment_silence_ms, 300,
+             "min silence to split the long audio at");
+DEFINE_bool(output_timestamp, false,
+            "output the word pieces of the result with their start and end "
+            "ms, which requires --unit_path");
+DEFINE_string(posterior_dump, "",
+              "dump the ctc log probs and the encoder outputs of the waves "
+              "to this file, which are searched again by posterior_search "
+              "for the sweeps of the search options");
+DEFINE_int32(posterior_dump_topk, 0,
+             "dump only the top k log probs of each frame if > 0");
+DEFINE_bool(posterior_dump_fp16, true, "dump the log probs as fp16");
 
 std::shared_ptr<wenet::DecodeOptions> g_decode_config;
 std::shared_ptr<wenet::FeaturePipelineConfig> g_feature_config;
-std::shared_ptr<wenet::DecodeResource> g_decode_resource;
+// A replica per cpu set of g_cpu_sets with --numa_replicas
+std::vector<std::shared_ptr<wenet::DecodeResource>> g_decode_resources;
+std::vector<std::vector<int>> g_cpu_sets;
 
 std::ofstream g_result;
-std::mutex g_mutex;
 int g_total_waves_dur = 0;
 int g_total_decode_time = 0;
+// The max bytes of the states of a session, for --memory_budget_mb
+std::atomic<int64_t> g_max_session_bytes(0);
+// Where the segments of --long_audio are decoded
+std::unique_ptr<ThreadPool> g_segment_pool;
+// The results of the waves decoded, for the repeated ones of the scp, see
+// --result_cache_size
+std::shared_ptr<wenet::ResultCache> g_result_cache;
+uint64_t g_result_context = 0;
+// Of --posterior_dump
+std::unique_ptr<wenet::PosteriorWriter> g_posterior_writer;
+
+// A wave read by the I/O threads
+struct Utterance {
+  std::string key;
+  int sample_rate = 0;
+  std::vector<float> data;
+};
 
-void decode(std::pair<std::string, std::string> wav, bool warmup = false) {
-  wenet::WavReader wav_reader(wav.second);
-  int num_samples = wav_reader.num_samples();
-  CHECK_EQ(wav_reader.sample_rate(), FLAGS_sample_rate);
+// The result of decoding a wave or a segment of it
+struct Transcript {
+  // The final results of continuous decoding are joined
+  std::string sentence;
+  // The word pieces of the sentence, in ms of the wave
+  std::vector<wenet::WordPiece> word_pieces;
+  // N-best of the last part of continuous decoding
+  std::vector<wenet::DecodeResult> nbest;
+  int decode_time = 0;
+  // Of --posterior_dump
+  wenet::PosteriorRecord posteriors;
+};
 
-  auto feature_pipeline =
-      std::make_shared<wenet::FeaturePipeline>(*g_feature_config);
-  feature_pipeline->AcceptWaveform(wav_reader.data(), num_samples);
-  feature_pipeline->set_input_finished();
-  LOG(INFO) << "num frames " << feature_pipeline->num_frames();
+// The result lines of an utterance for the writer thread
+struct DecodeOutput {
+  std::string text;
+  int wave_dur = 0;
+  int decode_time = 0;
+};
+
+std::shared_ptr<Utterance> load(
+    const std::pair<std::string, std::string>& wav) {
+  auto utterance = std::make_shared<Utterance>();
+  utterance->key = wav.first;
+  // 16 bit PCM is mapped, the other formats are read by WavReader. All the
+  // samples are converted here, so the pages of the file are read by the
+  // I/O thread instead of the decode thread.
+  wenet::MappedWavReader mapped_wav;
+  if (mapped_wav.Open(wav.second)) {
+    int num_samples = mapped_wav.num_samples();
+    utterance->sample_rate = mapped_wav.sample_rate();
+    utterance->data.resize(num_samples);
+    wenet::GetFbankKernels().int16_to_float(
+        mapped_wav.data(), utterance->data.data(), num_samples);
+  } else {
+    wenet::WavReader wav_reader(wav.second);
+    utterance->sample_rate = wav_reader.sample_rate();
+    utterance->data.assign(wav_reader.data(),
+                           wav_reader.data() + wav_reader.num_samples());
+  }
+  return utterance;
+}
 
-  wenet::AsrDecoder decoder(feature_pipeline, g_decode_resource,
+Transcript transcribe(const float* data, int num_samples, int sample_rate,
+                      std::shared_ptr<wenet::DecodeResource> resource) {
+  auto feature_pipeline = std::make_shared<wenet::FeaturePipeline>(
+      *g_feature_config, resource->fbank_tables);
+  // Resampled to FLAGS_sample_rate if it's not
+  feature_pipeline->set_input_sample_rate(sample_rate);
+  wenet::AsrDecoder decoder(feature_pipeline, std::move(resource),
                             *g_decode_config);
+  if (g_posterior_writer != nullptr) {
+    decoder.set_record_posteriors(true, FLAGS_posterior_dump_topk);
+  }
 
-  int wave_dur = static_cast<int>(static_cast<float>(num_samples) /
-                                  wav_reader.sample_rate() * 1000);
-  int decode_time = 0;
-  std::string final_result;
-  while (true) {
+  Transcript transcript;
+  auto append_final = [&]() {
+    const wenet::DecodeResult& best = decoder.result()[0];
+    transcript.sentence.append(best.sentence);
+    transcript.word_pieces.insert(transcript.word_pieces.end(),
+                                  best.word_pieces.begin(),
+                                  best.word_pieces.end());
+  };
+  // The non streaming case takes the offline path, no feature pipeline or
+  // chunk loop
+  bool offline = FLAGS_chunk_size <= 0 && !FLAGS_continuous_decoding;
+  if (offline) {
+    wenet::Timer timer;
+    decoder.DecodeUtterance(data, num_samples);
+    transcript.decode_time = timer.Elapsed();
+  } else {
+    feature_pipeline->AcceptWaveform(data, num_samples);
+    feature_pipeline->set_input_finished();
+    LOG(INFO) << "num frames " << feature_pipeline->num_frames();
+  }
+  while (!offline) {
     wenet::Timer timer;
     wenet::DecodeState state = decoder.Decode();
     if (state == wenet::DecodeState::kEndFeats) {
       decoder.Rescoring();
     }
     int chunk_decode_time = timer.Elapsed();
-    decode_time += chunk_decode_time;
+    transcript.decode_time += chunk_decode_time;
     if (decoder.DecodedSomething()) {
       LOG(INFO) << "Partial result: " << decoder.result()[0].sentence;
     }
@@ -77,7 +194,7 @@ void decode(std::pair<std::string, std::string> wav, bool warmup = false) {
         decoder.Rescoring();
         LOG(INFO) << "Final result (continuous decoding): "
                   << decoder.result()[0].sentence;
-        final_result.append(decoder.result()[0].sentence);
+        append_final();
       }
       decoder.ResetContinuousDecoding();
     }
@@ -87,7 +204,7 @@ void decode(std::pair<std::string, std::string> wav, bool warmup = false) {
     } else if (FLAGS_chunk_size > 0 && FLAGS_simulate_streaming) {
       float frame_shift_in_ms =
           static_cast<float>(g_feature_config->frame_shift) /
-          wav_reader.sample_rate() * 1000;
+          g_feature_config->sample_rate * 1000;
       auto wait_time =
           decoder.num_frames_in_current_chunk() * frame_shift_in_ms -
           chunk_decode_time;
@@ -99,29 +216,194 @@ void decode(std::pair<std::string, std::string> wav, bool warmup = false) {
     }
   }
   if (decoder.DecodedSomething()) {
-    final_result.append(decoder.result()[0].sentence);
+    append_final();
   }
-  LOG(INFO) << wav.first << " Final result: " << final_result << std::endl;
-  LOG(INFO) << "Decoded " << wave_dur << "ms audio taken " << decode_time
-            << "ms.";
+  transcript.nbest = decoder.result();
+  if (g_posterior_writer != nullptr) {
+    decoder.TakePosteriors(&transcript.posteriors);
+  }
+  if (FLAGS_memory_budget_mb > 0) {
+    int64_t session_bytes = decoder.memory_usage().total();
+    int64_t max_bytes = g_max_session_bytes;
+    while (session_bytes > max_bytes &&
+           !g_max_session_bytes.compare_exchange_weak(max_bytes,
+                                                      session_bytes)) {
+    }
+  }
+  return transcript;
+}
 
-  if (!warmup) {
-    g_mutex.lock();
-    std::ostream& buffer = FLAGS_result.empty() ? std::cout : g_result;
-    if (!FLAGS_output_nbest) {
-      buffer << wav.first << " " << final_result << std::endl;
-    } else {
-      buffer << "wav " << wav.first << std::endl;
-      auto& results = decoder.result();
-      for (auto& r : results) {
-        if (r.sentence.empty()) continue;
-        buffer << "candidate " << r.score << " " << r.sentence << std::endl;
-      }
+// Decode the segments of the wave in parallel, each by a decoder of its
+// own, then join the results, of which the timestamps are shifted by the
+// start of the segments. The n-best is the joined best path only.
+Transcript transcribe_long(const Utterance& utterance) {
+  wenet::Timer timer;
+  wenet::SegmenterOptions opts;
+  opts.num_bins = FLAGS_num_bins;
+  opts.min_segment_ms = FLAGS_segment_min_ms;
+  opts.max_segment_ms = FLAGS_segment_max_ms;
+  opts.min_silence_ms = FLAGS_segment_silence_ms;
+  std::vector<std::pair<int, int>> segments =
+      wenet::SplitBySilence(utterance.data.data(), utterance.data.size(),
+                            utterance.sample_rate, opts);
+  LOG(INFO) << utterance.key << " is split into " << segments.size()
+            << " segments";
+  std::vector<std::future<Transcript>> futures;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    futures.emplace_back(g_segment_pool->enqueue([&utterance, &segments, i]() {
+      const std::pair<int, int>& segment = segments[i];
+      return transcribe(utterance.data.data() + segment.first,
+                        segment.second - segment.first, utterance.sample_rate,
+                        g_decode_resources[i % g_decode_resources.size()]);
+    }));
+  }
+  Transcript transcript;
+  wenet::DecodeResult best;
+  best.score = 0;
+  for (size_t i = 0; i < futures.size(); ++i) {
+    Transcript part = futures[i].get();
+    int offset = static_cast<int64_t>(segments[i].first) * 1000 /
+                 utterance.sample_rate;
+    transcript.sentence.append(part.sentence);
+    for (wenet::WordPiece& piece : part.word_pieces) {
+      piece.start += offset;
+      piece.end += offset;
+      transcript.word_pieces.push_back(std::move(piece));
+    }
+    if (!part.nbest.empty()) best.score += part.nbest[0].score;
+  }
+  best.sentence = transcript.sentence;
+  best.word_pieces = transcript.word_pieces;
+  transcript.nbest.push_back(std::move(best));
+  // The time of the segments in parallel
+  transcript.decode_time = timer.Elapsed();
+  return transcript;
+}
+
+DecodeOutput decode(const Utterance& utterance,
+                    std::shared_ptr<wenet::DecodeResource> resource) {
+  int num_samples = utterance.data.size();
+  int sample_rate = utterance.sample_rate;
+  int wave_dur = static_cast<int>(static_cast<float>(num_samples) /
+                                  sample_rate * 1000);
+  Transcript transcript;
+  bool cached = false;
+  uint64_t key = 0;
+  if (g_result_cache != nullptr) {
+    key = wenet::ResultCache::Key(
+        utterance.data.data(), num_samples,
+        wenet::ResultCache::Hash(&sample_rate, sizeof(sample_rate),
+                                 g_result_context));
+    cached = g_result_cache->Lookup(key, utterance.data.data(), num_samples,
+                                    &transcript.nbest);
+    if (cached && !transcript.nbest.empty()) {
+      transcript.sentence = transcript.nbest[0].sentence;
+      transcript.word_pieces = transcript.nbest[0].word_pieces;
+    }
+  }
+  if (!cached) {
+    transcript = FLAGS_long_audio
+                     ? transcribe_long(utterance)
+                     : transcribe(utterance.data.data(), num_samples,
+                                  sample_rate, std::move(resource));
+    if (g_result_cache != nullptr) {
+      g_result_cache->Insert(key, utterance.data.data(), num_samples,
+                             transcript.nbest);
     }
-    g_total_waves_dur += wave_dur;
-    g_total_decode_time += decode_time;
-    g_mutex.unlock();
+    if (g_posterior_writer != nullptr) {
+      transcript.posteriors.key = utterance.key;
+      g_posterior_writer->Write(transcript.posteriors);
+    }
+  }
+  LOG(INFO) << utterance.key << " Final result: " << transcript.sentence
+            << std::endl;
+  LOG(INFO) << "Decoded " << wave_dur << "ms audio taken "
+            << transcript.decode_time << "ms.";
+
+  DecodeOutput output;
+  output.wave_dur = wave_dur;
+  output.decode_time = transcript.decode_time;
+  std::ostringstream buffer;
+  if (!FLAGS_output_nbest) {
+    buffer << utterance.key << " " << transcript.sentence << "\n";
+  } else {
+    buffer << "wav " << utterance.key << "\n";
+    for (auto& r : transcript.nbest) {
+      if (r.sentence.empty()) continue;
+      buffer << "candidate " << r.score << " " << r.sentence << "\n";
+    }
+  }
+  if (FLAGS_output_timestamp) {
+    for (const auto& piece : transcript.word_pieces) {
+      buffer << "timestamp " << piece.start << " " << piece.end << " "
+             << piece.word << "\n";
+    }
+  }
+  output.text = buffer.str();
+  return output;
+}
+
+// The waves are read by io_thread_num threads into a queue of prefetch
+// waves, from which thread_num threads decode them, and the results are
+// written by one writer thread, so neither a slow disk nor the output
+// stalls the decode threads.
+void decode_all(
+    const std::vector<std::pair<std::string, std::string>>& waves) {
+  std::vector<size_t> order(waves.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  if (FLAGS_sort_by_duration) {
+    std::vector<int64_t> sizes(waves.size(), 0);
+    for (size_t i = 0; i < waves.size(); ++i) {
+      struct stat st;
+      if (stat(waves[i].second.c_str(), &st) == 0) sizes[i] = st.st_size;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return sizes[a] > sizes[b];
+    });
+  }
+
+  wenet::BlockingQueue<std::shared_ptr<Utterance>> utterances(
+      std::max(FLAGS_prefetch, 1));
+  wenet::BlockingQueue<std::shared_ptr<DecodeOutput>> outputs;
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> io_threads;
+  for (int i = 0; i < std::max(FLAGS_io_thread_num, 1); ++i) {
+    io_threads.emplace_back([&]() {
+      for (size_t j = next++; j < order.size(); j = next++) {
+        utterances.Push(load(waves[order[j]]));
+      }
+    });
   }
+  std::vector<std::thread> decode_threads;
+  for (int i = 0; i < FLAGS_thread_num; ++i) {
+    decode_threads.emplace_back([&, i]() {
+      // Decode thread i is pinned to the cpu set i, and decodes with the
+      // replica of it
+      if (!g_cpu_sets.empty()) {
+        wenet::PinCurrentThread(g_cpu_sets[i % g_cpu_sets.size()]);
+      }
+      auto resource = g_decode_resources[i % g_decode_resources.size()];
+      // nullptr marks the end of the waves
+      while (auto utterance = utterances.Pop()) {
+        outputs.Push(
+            std::make_shared<DecodeOutput>(decode(*utterance, resource)));
+      }
+    });
+  }
+  std::thread writer([&]() {
+    std::ostream& buffer = FLAGS_result.empty() ? std::cout : g_result;
+    while (auto output = outputs.Pop()) {
+      buffer << output->text << std::flush;
+      g_total_waves_dur += output->wave_dur;
+      g_total_decode_time += output->decode_time;
+    }
+  });
+
+  for (auto& thread : io_threads) thread.join();
+  for (int i = 0; i < FLAGS_thread_num; ++i) utterances.Push(nullptr);
+  for (auto& thread : decode_threads) thread.join();
+  outputs.Push(nullptr);
+  writer.join();
 }
 
 int main(int argc, char* argv[]) {
@@ -130,7 +412,22 @@ int main(int argc, char* argv[]) {
 
   g_decode_config = wenet::InitDecodeOptionsFromFlags();
   g_feature_config = wenet::InitFeaturePipelineConfigFromFlags();
-  g_decode_resource = wenet::InitDecodeResourceFromFlags();
+  g_decode_resources = wenet::InitDecodeResourcesFromFlags();
+  g_cpu_sets = wenet::CpuSetsFromFlags();
+  // The posteriors are of one segment, which are dumped for every wave
+  bool dump = !FLAGS_posterior_dump.empty();
+  CHECK(!dump || (!FLAGS_continuous_decoding && !FLAGS_long_audio))
+      << "--posterior_dump is not for the continuous decoding or long audio";
+  // The joined result of the continuous decoding isn't its n-best, which is
+  // what the cache keeps
+  if (dump && FLAGS_result_cache_size > 0) {
+    LOG(WARNING) << "The result cache is disabled by the posterior dump";
+  } else if (FLAGS_continuous_decoding && FLAGS_result_cache_size > 0) {
+    LOG(WARNING) << "The result cache is disabled by continuous decoding";
+  } else {
+    g_result_cache = wenet::InitResultCacheFromFlags();
+    g_result_context = wenet::ResultCacheContextFromFlags();
+  }
 
   if (FLAGS_wav_path.empty() && FLAGS_wav_scp.empty()) {
     LOG(FATAL) << "Please provide the wave path or the wav scp.";
@@ -156,30 +453,51 @@ int main(int argc, char* argv[]) {
   if (!FLAGS_result.empty()) {
     g_result.open(FLAGS_result, std::ios::out);
   }
+  if (FLAGS_long_audio) {
+    g_segment_pool = std::make_unique<ThreadPool>(FLAGS_thread_num);
+  }
 
   // Warmup
   if (FLAGS_warmup > 0) {
     LOG(INFO) << "Warming up...";
     {
       ThreadPool pool(FLAGS_thread_num);
-      auto wav = waves[0];
+      auto utterance = load(waves[0]);
       for (int i = 0; i < FLAGS_warmup; i++) {
-        pool.enqueue(decode, wav, true);
+        pool.enqueue(
+            [utterance]() { decode(*utterance, g_decode_resources[0]); });
       }
     }
     LOG(INFO) << "Warmup done.";
   }
 
-  {
-    ThreadPool pool(FLAGS_thread_num);
-    for (auto& wav : waves) {
-      pool.enqueue(decode, wav, false);
-    }
+  // After the warmup, whose waves are not dumped
+  if (dump) {
+    g_posterior_writer = std::make_unique<wenet::PosteriorWriter>(
+        FLAGS_posterior_dump, FLAGS_posterior_dump_fp16);
+  }
+  decode_all(waves);
+  if (dump) {
+    g_posterior_writer->Close();
+    LOG(INFO) << "Dumped the posteriors of "
+              << g_posterior_writer->num_records() << " waves to "
+              << FLAGS_posterior_dump;
   }
 
   LOG(INFO) << "Total: decoded " << g_total_waves_dur << "ms audio taken "
             << g_total_decode_time << "ms.";
   LOG(INFO) << "RTF: " << std::setprecision(4)
             << static_cast<float>(g_total_decode_time) / g_total_waves_dur;
+  if (FLAGS_memory_budget_mb > 0) {
+    wenet::MemoryBudget budget(static_cast<int64_t>(FLAGS_memory_budget_mb)
+                               << 20);
+    for (const auto& resource : g_decode_resources) {
+      if (resource->model != nullptr) {
+        budget.Add("model weights", resource->model->weight_bytes());
+      }
+    }
+    budget.Add("sessions", g_max_session_bytes * FLAGS_thread_num);
+    budget.Log();
+  }
   return 0;
 }
@@ -12,20 +12,65 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <future>
 #include <iomanip>
+#include <map>
+#include <memory>
+#include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "decoder/params.h"
+#include "frontend/fbank_kernels.h"
+#include "frontend/mapped_wav_reader.h"
+#include "frontend/resampler.h"
+#include "frontend/shard_reader.h"
 #include "frontend/wav.h"
 #include "utils/flags.h"
 #include "utils/string.h"
 #include "utils/timer.h"
 #include "utils/utils.h"
+#include "utils/work_coordinator.h"
+#ifdef USE_GRPC
+#include <grpcpp/grpcpp.h>
+
+#include "grpc/decode_coordinator.h"
+#endif
 
 DEFINE_string(wav_path, "", "single wave path");
 DEFINE_int32(thread_num, 1, "num of decode thread");
 DEFINE_int32(batch_size, 1, "batch size of input");
+DEFINE_int32(num_batches, 1, "num of batches to decode, for benchmark");
+DEFINE_bool(pipeline, false,
+            "overlap the encoder of one batch with the search and "
+            "rescoring of the previous batch");
+DEFINE_string(shard_list, "",
+              "list of the tar shards made by tools/make_shard_list.py, "
+              "a local tar file or an url per line, all the utterances of "
+              "which are decoded instead of the wav_path");
+DEFINE_int32(read_ahead, 64, "num of utterances read ahead of the shards");
+DEFINE_string(result, "",
+              "result output file of the shard_list or the coordinator");
+DEFINE_string(wav_scp, "",
+              "kaldi style wav scp of the coordinator, whose utterances are "
+              "decoded by the workers");
+DEFINE_int32(coordinator_port, 0,
+             "if > 0, serve the wav_scp to the workers on the port instead "
+             "of decoding, the results are appended to the result file, "
+             "and the utterances in it are skipped on a restart");
+DEFINE_string(coordinator, "",
+              "host:port of the coordinator, decode its units as a worker");
+DEFINE_int32(unit_size, 256, "utterances per unit of the coordinator");
+DEFINE_int32(steal_after_s, 300,
+             "the units in progress for longer are handed out again to the "
+             "idle workers once all are handed out");
 
 std::shared_ptr<wenet::DecodeOptions> g_decode_config;
 std::shared_ptr<wenet::FeaturePipelineConfig> g_feature_config;
@@ -36,46 +81,292 @@ int g_total_decode_time = 0;
 
 // using namespace wenet;
 
+// Read the wave, and return its sample rate, 0 if it can't be read
+int read_wave(const std::string& wav, std::vector<float>* wav_data) {
+  // 16 bit PCM is mapped, the other formats are read by WavReader
+  wenet::MappedWavReader mapped_wav;
+  if (mapped_wav.Open(wav)) {
+    int num_samples = mapped_wav.num_samples();
+    wav_data->resize(num_samples);
+    wenet::GetFbankKernels().int16_to_float(mapped_wav.data(),
+                                            wav_data->data(), num_samples);
+    return mapped_wav.sample_rate();
+  }
+  wenet::WavReader wav_reader;
+  if (!wav_reader.Open(wav)) return 0;
+  wav_data->assign(wav_reader.data(),
+                   wav_reader.data() + wav_reader.num_samples());
+  return wav_reader.sample_rate();
+}
+
+// Resample the wave to the sample rate of the model, by the resamplers of
+// the input sample rates
+void to_model_rate(
+    int sample_rate, std::vector<float>* wav,
+    std::map<int, std::unique_ptr<wenet::Resampler>>* resamplers) {
+  if (sample_rate == g_feature_config->sample_rate) return;
+  auto& resampler = (*resamplers)[sample_rate];
+  if (resampler == nullptr) {
+    resampler = std::make_unique<wenet::Resampler>(
+        sample_rate, g_feature_config->sample_rate);
+  }
+  std::vector<float> out;
+  resampler->Resample(wav->data(), wav->size(), true, &out);
+  resampler->Reset();
+  wav->swap(out);
+}
+
 void decode(const std::string& wav) {
-  wenet::WavReader wav_reader(wav);
   std::vector<float> wav_data;
-  int num_samples = wav_reader.num_samples();
-  wav_data.insert(
-      wav_data.end(), wav_reader.data(), wav_reader.data() + num_samples);
+  int sample_rate = read_wave(wav, &wav_data);
+  CHECK_GT(sample_rate, 0) << "Error in reading " << wav;
+  int num_samples = wav_data.size();
   std::vector<std::vector<float>> batch_wav_data;
   int wav_dur = static_cast<int>(
-      static_cast<float>(num_samples) / wav_reader.sample_rate() * 1000);
+      static_cast<float>(num_samples) / sample_rate * 1000);
   for (int i = 0; i < FLAGS_batch_size; ++i) {
     batch_wav_data.push_back(wav_data);
-    g_total_waves_dur += wav_dur;
   }
+  g_total_waves_dur = wav_dur * FLAGS_batch_size * FLAGS_num_batches;
 
   auto decoder = std::make_unique<wenet::BatchAsrDecoder>(
       g_feature_config, g_decode_resource, *g_decode_config);
   wenet::Timer timer;
-  decoder->Decode(batch_wav_data);
+  if (FLAGS_pipeline) {
+    std::vector<std::future<std::vector<std::vector<wenet::DecodeResult>>>>
+        futures;
+    for (int i = 0; i < FLAGS_num_batches; ++i) {
+      futures.emplace_back(decoder->DecodeAsync(batch_wav_data));
+    }
+    for (auto& future : futures) {
+      std::cout << wenet::BatchAsrDecoder::SerializeBatchResult(
+                       future.get(), 1, false)
+                << std::endl;
+    }
+  } else {
+    for (int i = 0; i < FLAGS_num_batches; ++i) {
+      decoder->Reset();
+      decoder->Decode(batch_wav_data);
+      std::cout << decoder->get_batch_result(1, false) << std::endl;
+    }
+  }
   int decode_time = timer.Elapsed();
-  std::string result = decoder->get_batch_result(1, false);
-  std::cout << result << std::endl;
 
-  LOG(INFO) << "batch_size : " << FLAGS_batch_size << std::endl;
+  LOG(INFO) << "batch_size : " << FLAGS_batch_size << ", num_batches : "
+            << FLAGS_num_batches;
   LOG(INFO) << "Total: decoded " << g_total_waves_dur << "ms audio taken "
             << decode_time << "ms.";
   LOG(INFO) << "RTF: " << std::setprecision(4)
             << static_cast<float>(decode_time) / g_total_waves_dur;
 }
 
+// Decode the utterances of the shards by batches of batch_size, the result
+// of each utterance is written as a line of "key sentence"
+void decode_shards(const std::string& shard_list) {
+  std::vector<std::string> shards =
+      wenet::ShardReader::ReadShardList(shard_list);
+  LOG(INFO) << "decoding " << shards.size() << " shards";
+  wenet::ShardReader reader(shards, FLAGS_read_ahead);
+  std::ofstream result;
+  if (!FLAGS_result.empty()) result.open(FLAGS_result, std::ios::out);
+  std::ostream& buffer = FLAGS_result.empty() ? std::cout : result;
+  // Resamplers by the input sample rate
+  std::map<int, std::unique_ptr<wenet::Resampler>> resamplers;
+  const int sample_rate = g_feature_config->sample_rate;
+
+  auto decoder = std::make_unique<wenet::BatchAsrDecoder>(
+      g_feature_config, g_decode_resource, *g_decode_config);
+  std::vector<std::future<std::vector<std::vector<wenet::DecodeResult>>>>
+      futures;
+  std::vector<std::vector<std::string>> batch_keys;
+  auto write_results =
+      [&](const std::vector<std::string>& keys,
+          const std::vector<std::vector<wenet::DecodeResult>>& results) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+          buffer << keys[i] << " "
+                 << (results[i].empty() ? "" : results[i][0].sentence)
+                 << std::endl;
+        }
+      };
+
+  int64_t total_samples = 0;
+  int num_utts = 0;
+  wenet::Timer timer;
+  wenet::ShardSample sample;
+  bool done = false;
+  while (!done) {
+    std::vector<std::string> keys;
+    std::vector<std::vector<float>> batch_wav_data;
+    while (static_cast<int>(keys.size()) < FLAGS_batch_size) {
+      if (!reader.Next(&sample)) {
+        done = true;
+        break;
+      }
+      to_model_rate(sample.sample_rate, &sample.wav, &resamplers);
+      total_samples += sample.wav.size();
+      keys.emplace_back(std::move(sample.key));
+      batch_wav_data.emplace_back(std::move(sample.wav));
+    }
+    if (keys.empty()) break;
+    num_utts += keys.size();
+    if (FLAGS_pipeline) {
+      futures.emplace_back(decoder->DecodeAsync(batch_wav_data));
+      batch_keys.emplace_back(std::move(keys));
+      // Keep one batch in flight to overlap with the next one
+      if (futures.size() > 1) {
+        write_results(batch_keys.front(), futures.front().get());
+        futures.erase(futures.begin());
+        batch_keys.erase(batch_keys.begin());
+      }
+    } else {
+      decoder->Reset();
+      decoder->Decode(batch_wav_data);
+      write_results(keys, decoder->batch_result());
+    }
+  }
+  for (size_t i = 0; i < futures.size(); ++i) {
+    write_results(batch_keys[i], futures[i].get());
+  }
+  int decode_time = timer.Elapsed();
+  int wav_dur = static_cast<int>(total_samples * 1000 / sample_rate);
+
+  LOG(INFO) << "batch_size : " << FLAGS_batch_size << ", num_utts : "
+            << num_utts;
+  LOG(INFO) << "Total: decoded " << wav_dur << "ms audio taken "
+            << decode_time << "ms.";
+  if (wav_dur > 0) {
+    LOG(INFO) << "RTF: " << std::setprecision(4)
+              << static_cast<float>(decode_time) / wav_dur;
+  }
+}
+
+#ifdef USE_GRPC
+// Serve the utterances of wav_scp to the workers until all are decoded
+void coordinate(int port) {
+  CHECK(!FLAGS_result.empty()) << "The coordinator needs --result";
+  std::vector<wenet::WorkItem> items;
+  std::ifstream wav_is(FLAGS_wav_scp);
+  std::string line;
+  while (std::getline(wav_is, line)) {
+    std::vector<std::string> strs;
+    wenet::SplitString(line, &strs);
+    if (strs.size() != 2) continue;
+    struct stat st;
+    int64_t size = stat(strs[1].c_str(), &st) == 0 ? st.st_size : 0;
+    items.push_back({strs[0], strs[1], size});
+  }
+  auto done_keys = wenet::ReadDoneKeys(FLAGS_result);
+  auto coordinator = std::make_shared<wenet::WorkCoordinator>(
+      std::move(items), FLAGS_unit_size, done_keys,
+      FLAGS_steal_after_s * 1000);
+  LOG(INFO) << done_keys.size() << " utterances done before, "
+            << coordinator->num_units() << " units to decode";
+  std::ofstream result(FLAGS_result, std::ios::app);
+  wenet::CoordinatorService service(coordinator, &result);
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("0.0.0.0:" + std::to_string(port),
+                           grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+  LOG(INFO) << "Coordinator listening on " << port;
+  wenet::Timer timer;
+  while (coordinator->num_completed() < coordinator->num_units()) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+  LOG(INFO) << "All units completed in " << timer.Elapsed() << "ms, "
+            << coordinator->num_stolen() << " stolen";
+  // The waiting workers fetch the done status before it's gone
+  std::this_thread::sleep_for(std::chrono::seconds(3));
+  server->Shutdown();
+}
+
+// Decode the units of the coordinator by batches of batch_size
+void work(const std::string& address) {
+  char hostname[256] = {0};
+  gethostname(hostname, sizeof(hostname) - 1);
+  wenet::CoordinatorClient client(
+      address, std::string(hostname) + ":" + std::to_string(getpid()));
+  auto decoder = std::make_unique<wenet::BatchAsrDecoder>(
+      g_feature_config, g_decode_resource, *g_decode_config);
+  std::map<int, std::unique_ptr<wenet::Resampler>> resamplers;
+  int num_utts = 0;
+  wenet::Timer timer;
+  while (true) {
+    int unit_id = -1;
+    std::vector<wenet::WorkItem> items;
+    bool ok = true;
+    auto status = client.FetchWork(&unit_id, &items, &ok);
+    if (status == wenet::WorkCoordinator::Status::kDone) break;
+    if (status == wenet::WorkCoordinator::Status::kWait) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      continue;
+    }
+    std::vector<std::pair<std::string, std::string>> results;
+    for (size_t i = 0; i < items.size(); i += FLAGS_batch_size) {
+      std::vector<std::string> keys;
+      std::vector<std::vector<float>> batch_wav_data;
+      size_t end = std::min(items.size(), i + FLAGS_batch_size);
+      for (size_t j = i; j < end; ++j) {
+        std::vector<float> wav;
+        int sample_rate = read_wave(items[j].path, &wav);
+        if (sample_rate <= 0) {
+          LOG(WARNING) << "Error in reading " << items[j].path;
+          results.emplace_back(items[j].key, "");
+          continue;
+        }
+        to_model_rate(sample_rate, &wav, &resamplers);
+        keys.push_back(items[j].key);
+        batch_wav_data.emplace_back(std::move(wav));
+      }
+      if (keys.empty()) continue;
+      decoder->Reset();
+      decoder->Decode(batch_wav_data);
+      const auto& batch_result = decoder->batch_result();
+      for (size_t j = 0; j < keys.size(); ++j) {
+        results.emplace_back(keys[j], batch_result[j].empty()
+                                          ? ""
+                                          : batch_result[j][0].sentence);
+      }
+    }
+    num_utts += items.size();
+    if (!client.SubmitResults(unit_id, results)) break;
+  }
+  LOG(INFO) << "Worker decoded " << num_utts << " utterances in "
+            << timer.Elapsed() << "ms";
+}
+#endif
 
 int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   google::InitGoogleLogging(argv[0]);
 
+  if (FLAGS_coordinator_port > 0) {
+#ifdef USE_GRPC
+    coordinate(FLAGS_coordinator_port);
+    return 0;
+#else
+    LOG(FATAL) << "Please rebuild with cmake options '-DGRPC=ON'.";
+#endif
+  }
+
   g_decode_config = wenet::InitDecodeOptionsFromFlags();
   g_feature_config = wenet::InitFeaturePipelineConfigFromFlags();
   g_decode_resource = wenet::InitDecodeResourceFromFlags();
 
+  if (!FLAGS_coordinator.empty()) {
+#ifdef USE_GRPC
+    work(FLAGS_coordinator);
+    return 0;
+#else
+    LOG(FATAL) << "Please rebuild with cmake options '-DGRPC=ON'.";
+#endif
+  }
+  if (!FLAGS_shard_list.empty()) {
+    decode_shards(FLAGS_shard_list);
+    return 0;
+  }
   if (FLAGS_wav_path.empty()) {
-    LOG(FATAL) << "Please provide the wave path.";
+    LOG(FATAL) << "Please provide the wave path or the shard list.";
   }
   LOG(INFO) << "decoding " << FLAGS_wav_path;
   decode(FLAGS_wav_path);
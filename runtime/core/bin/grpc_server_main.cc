@@ -12,33 +12,182 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <signal.h>
+
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
 
 #include "decoder/params.h"
+#include "grpc/async_grpc_server.h"
 #include "grpc/grpc_server.h"
 #include "utils/log.h"
+#include "utils/metrics_server.h"
+#include "utils/profiler.h"
+#include "utils/session_record.h"
+#include "utils/trace.h"
 
 DEFINE_int32(port, 10086, "grpc listening port");
 DEFINE_int32(workers, 4, "grpc num workers");
+DEFINE_bool(async_server, false,
+            "use the completion queue based async server, in which case "
+            "workers is the number of completion queues");
+DEFINE_int32(num_decode_threads, 8,
+             "number of decode threads for async server");
+DEFINE_bool(batch_scheduler, false,
+            "batch utterances of all BatchRecognize calls by length in the "
+            "server");
+DEFINE_int32(scheduler_batch_size, 32, "max batch size of batch scheduler");
+DEFINE_int32(scheduler_batch_frames, 32000,
+             "max padded frames of a batch of batch scheduler");
+DEFINE_int32(scheduler_wait_ms, 50,
+             "max time(ms) an utterance waits in batch scheduler");
+DEFINE_int32(scheduler_bucket_frames, 200,
+             "length bucket width(frames) of batch scheduler");
+DEFINE_int32(metrics_port, 0,
+             "port of the HTTP /metrics endpoint for Prometheus, 0 means "
+             "no metrics endpoint");
+DEFINE_bool(enable_trace, false,
+            "record the stages of each session, which are exported as chrome "
+            "trace at /trace of the metrics port");
+DEFINE_int32(trace_buffer_size, 4096,
+             "number of the latest trace spans kept for each thread");
+DEFINE_string(profile_dir, ".",
+              "dir of the profiles of the requests captured by "
+              "/profile?requests=N of the metrics port");
+DEFINE_int32(session_pool_size, 0,
+             "number of the idle decoding sessions kept for the new streams, "
+             "which are constructed at start, 0 means a session is "
+             "constructed per stream");
+DEFINE_int32(batch_decoder_pool_size, 0,
+             "number of the idle batch decoders kept for the new batch calls "
+             "without the batch scheduler, which are constructed at start, 0 "
+             "means a batch decoder is constructed per call");
+DEFINE_int32(max_sessions, 0,
+             "max concurrent sessions, over which the new streams are "
+             "rejected, 0 means no limit");
+DEFINE_int32(max_queued_frames, 0,
+             "max feature frames queued in a session for decoding, over "
+             "which it's terminated as overloaded, 0 means no limit");
+DEFINE_double(max_decode_queue_depth, 0,
+              "max pending decode tasks per decode thread of the async "
+              "server, over which the new streams are rejected, 0 means "
+              "no limit");
+DEFINE_int32(max_session_memory_mb, 0,
+             "max memory of the states of all the live sessions, e.g. the "
+             "caches and the hypotheses, over which the new streams are "
+             "rejected, 0 means no limit");
+DEFINE_string(tenant_quotas, "",
+              "quotas of the tenants of the start messages, "
+              "name=weight[:max_sessions[:max_batch_audio_rate]] separated "
+              "by commas, the tenants not listed share the one named "
+              "default, see utils/tenant_quota.h");
+DEFINE_string(record_dir, "",
+              "dir to record the messages of the streams to with their "
+              "arrival times, which are replayed by session_replay_main, "
+              "empty means no recording");
+DEFINE_int32(record_sessions, 100,
+             "max number of the streams recorded, 0 means no limit");
+DEFINE_bool(reload_on_sighup, true,
+            "reload the model and graphs from the flags on SIGHUP, the "
+            "running streams keep the old ones");
 
 using grpc::Server;
 using grpc::ServerBuilder;
 
 int main(int argc, char* argv[]) {
+  // Warm up the model before accepting any connection unless it's disabled
+  gflags::SetCommandLineOptionWithMode("warmup_model", "true",
+                                       gflags::SET_FLAGS_DEFAULT);
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   google::InitGoogleLogging(argv[0]);
+  if (FLAGS_reload_on_sighup) {
+    wenet::BlockSignal(SIGHUP);
+  }
+
+  if (FLAGS_enable_trace) {
+    wenet::Tracer::Instance().Enable(FLAGS_trace_buffer_size);
+  }
+  std::unique_ptr<wenet::MetricsServer> metrics_server;
+  if (FLAGS_metrics_port > 0) {
+    wenet::Profiler::Instance().set_output_dir(FLAGS_profile_dir);
+    metrics_server.reset(new wenet::MetricsServer(FLAGS_metrics_port));
+    CHECK(metrics_server->Start());
+  }
 
   auto decode_config = wenet::InitDecodeOptionsFromFlags();
   auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
   auto decode_resource = wenet::InitDecodeResourceFromFlags();
 
-  wenet::GrpcServer service(feature_config, decode_config, decode_resource);
   grpc::EnableDefaultHealthCheckService(true);
   grpc::reflection::InitProtoReflectionServerBuilderPlugin();
-  ServerBuilder builder;
   std::string address("0.0.0.0:" + std::to_string(FLAGS_port));
+  if (!FLAGS_record_dir.empty()) {
+    wenet::SessionRecorder::Enable(FLAGS_record_dir, FLAGS_record_sessions);
+  }
+  wenet::AdmissionOptions admission_opts;
+  admission_opts.max_sessions = FLAGS_max_sessions;
+  admission_opts.max_queued_frames = FLAGS_max_queued_frames;
+  admission_opts.max_queue_depth = FLAGS_max_decode_queue_depth;
+  admission_opts.max_session_bytes =
+      static_cast<int64_t>(FLAGS_max_session_memory_mb) * 1024 * 1024;
+  if (!wenet::ParseTenantQuotas(FLAGS_tenant_quotas,
+                                &admission_opts.tenant_quotas)) {
+    LOG(FATAL) << "Invalid --tenant_quotas " << FLAGS_tenant_quotas;
+  }
+  wenet::BatchSchedulerOptions scheduler_opts;
+  scheduler_opts.max_batch_size = FLAGS_scheduler_batch_size;
+  scheduler_opts.max_batch_frames = FLAGS_scheduler_batch_frames;
+  scheduler_opts.max_wait_ms = FLAGS_scheduler_wait_ms;
+  scheduler_opts.bucket_width_frames = FLAGS_scheduler_bucket_frames;
+  auto result_cache = wenet::InitResultCacheFromFlags();
+  uint64_t result_context = wenet::ResultCacheContextFromFlags();
+  auto loader = [=]() {
+    return wenet::ReloadDecodeResourceFromFlags(*feature_config,
+                                                *decode_config);
+  };
+  if (FLAGS_async_server) {
+    wenet::AsyncGrpcServer server(feature_config, decode_config,
+                                  decode_resource);
+    if (FLAGS_session_pool_size > 0) {
+      server.EnableSessionPool(FLAGS_session_pool_size);
+    }
+    if (FLAGS_batch_decoder_pool_size > 0 && !FLAGS_batch_scheduler) {
+      server.EnableBatchDecoderPool(FLAGS_batch_decoder_pool_size);
+    }
+    server.EnableAdmissionControl(admission_opts);
+    if (FLAGS_batch_scheduler) {
+      server.EnableBatchScheduler(scheduler_opts);
+    }
+    if (result_cache != nullptr) {
+      server.EnableResultCache(result_cache, result_context);
+    }
+    if (FLAGS_reload_on_sighup) {
+      wenet::ReloadOnSignal(SIGHUP, server.resources(), loader);
+    }
+    server.Run(address, FLAGS_workers, FLAGS_num_decode_threads);
+    google::ShutdownGoogleLogging();
+    return 0;
+  }
+
+  wenet::GrpcServer service(feature_config, decode_config, decode_resource);
+  if (FLAGS_session_pool_size > 0) {
+    service.EnableSessionPool(FLAGS_session_pool_size);
+  }
+  if (FLAGS_batch_decoder_pool_size > 0 && !FLAGS_batch_scheduler) {
+    service.EnableBatchDecoderPool(FLAGS_batch_decoder_pool_size);
+  }
+  service.EnableAdmissionControl(admission_opts);
+  if (FLAGS_batch_scheduler) {
+    service.EnableBatchScheduler(scheduler_opts);
+  }
+  if (result_cache != nullptr) {
+    service.EnableResultCache(result_cache, result_context);
+  }
+  if (FLAGS_reload_on_sighup) {
+    wenet::ReloadOnSignal(SIGHUP, service.resources(), loader);
+  }
+  ServerBuilder builder;
   builder.AddListeningPort(address, grpc::InsecureServerCredentials());
   builder.RegisterService(&service);
   builder.SetSyncServerOption(ServerBuilder::SyncServerOption::NUM_CQS,
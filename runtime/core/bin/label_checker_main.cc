@@ -13,9 +13,15 @@
 // limitations under the License.
 
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "decoder/params.h"
@@ -30,6 +36,7 @@ DEFINE_double(is_penalty, 1.0,
 DEFINE_double(del_penalty, 1.0, "deletion penalty for align insertion");
 DEFINE_string(result, "", "result output file");
 DEFINE_string(timestamp, "", "timestamp output file");
+DEFINE_int32(thread_num, 1, "num of decode thread");
 
 namespace wenet {
 
@@ -75,62 +82,70 @@ std::shared_ptr<fst::SymbolTable> MakeSymbolTableForFst(
   return osymbol_table;
 }
 
-void CompileCtcFst(std::shared_ptr<fst::SymbolTable> symbol_table,
-                   fst::StdVectorFst* ofst) {
+// The utterance independent part of the decoding graphs, which is the
+// filler of the insertions and substitutions composed with the ctc
+// topology. State 0 is the start of the filler and state 1 is its end,
+// state 2 + k emits token k and repeats it. Every state of the ctc start
+// takes the blanks.
+void CompileFillerFst(std::shared_ptr<fst::SymbolTable> symbol_table,
+                      fst::StdVectorFst* ofst) {
   ofst->DeleteStates();
-  int start = ofst->AddState();
-  ofst->SetStart(start);
   CHECK_EQ(symbol_table->Find("<eps>"), 0);
   CHECK_EQ(symbol_table->Find("<blank>"), 1);
-  ofst->AddArc(start, fst::StdArc(1, 0, 0.0, start));
+  int filler_start = ofst->AddState();
+  int filler_end = ofst->AddState();
+  ofst->AddArc(filler_start, fst::StdArc(1, 0, 0.0, filler_start));
+  ofst->AddArc(filler_end, fst::StdArc(1, 0, 0.0, filler_end));
   // Exclude kDeletion and kInsertion
   for (int i = 2; i < symbol_table->NumSymbols() - 3; i++) {
     int s = ofst->AddState();
-    ofst->AddArc(start, fst::StdArc(i, i, 0.0, s));
+    ofst->AddArc(filler_start, fst::StdArc(i, i, FLAGS_is_penalty, s));
     ofst->AddArc(s, fst::StdArc(i, 0, 0.0, s));
-    ofst->AddArc(s, fst::StdArc(0, 0, 0.0, start));
+    ofst->AddArc(s, fst::StdArc(0, 0, 0.0, filler_end));
   }
-  ofst->SetFinal(start, fst::StdArc::Weight::One());
-  fst::ArcSort(ofst, fst::StdOLabelCompare());
+  ofst->AddArc(filler_end, fst::StdArc(0, 0, 0.0, filler_start));
 }
 
-void CompileAlignFst(std::vector<int> labels,
-                     std::shared_ptr<fst::SymbolTable> symbol_table,
-                     fst::StdVectorFst* ofst) {
-  ofst->DeleteStates();
+// The decoding graph of the labels, which is the alignment graph composed
+// with the ctc topology, built on a copy of the filler of
+// CompileFillerFst() instead of composing the graphs of every utterance.
+// The repeats of a token are taken before the epsilons of the alignment,
+// so it's equivalent to the composition.
+void CompileDecodingFst(const std::vector<int>& labels,
+                        std::shared_ptr<fst::SymbolTable> symbol_table,
+                        const fst::StdVectorFst& filler_fst,
+                        fst::StdVectorFst* ofst) {
+  *ofst = filler_fst;
+  const int filler_start = 0;
+  const int filler_end = 1;
   int deletion = symbol_table->Find(kDeletion);
   int insertion_start = symbol_table->Find(kIsStart);
   int insertion_end = symbol_table->Find(kIsEnd);
 
-  int start = ofst->AddState();
-  ofst->SetStart(start);
-  // Filler State
-  int filler_start = ofst->AddState();
-  int filler_end = ofst->AddState();
-  for (int i = 2; i < symbol_table->NumSymbols() - 3; i++) {
-    ofst->AddArc(filler_start, fst::StdArc(i, i, FLAGS_is_penalty, filler_end));
-  }
-  ofst->AddArc(filler_end, fst::StdArc(0, 0, 0.0, filler_start));
-
-  int prev = start;
+  int prev = ofst->AddState();
+  ofst->SetStart(prev);
   // Alignment path and optional filler
   for (size_t i = 0; i < labels.size(); i++) {
+    int emit = ofst->AddState();
     int cur = ofst->AddState();
+    ofst->AddArc(prev, fst::StdArc(1, 0, 0.0, prev));
     // 1. Insertion or Substitution
     ofst->AddArc(prev, fst::StdArc(0, insertion_start, 0.0, filler_start));
     ofst->AddArc(filler_end, fst::StdArc(0, insertion_end, 0.0, prev));
     // 2. Correct
-    ofst->AddArc(prev, fst::StdArc(labels[i], labels[i], 0.0, cur));
+    ofst->AddArc(prev, fst::StdArc(labels[i], labels[i], 0.0, emit));
+    ofst->AddArc(emit, fst::StdArc(labels[i], 0, 0.0, emit));
+    ofst->AddArc(emit, fst::StdArc(0, 0, 0.0, cur));
     // 3. Deletion
     ofst->AddArc(prev, fst::StdArc(0, deletion, FLAGS_del_penalty, cur));
 
     prev = cur;
   }
   // Optional add endding filler
+  ofst->AddArc(prev, fst::StdArc(1, 0, 0.0, prev));
   ofst->AddArc(prev, fst::StdArc(0, insertion_start, 0.0, filler_start));
   ofst->AddArc(filler_end, fst::StdArc(0, insertion_end, 0.0, prev));
   ofst->SetFinal(prev, fst::StdArc::Weight::One());
-  fst::ArcSort(ofst, fst::StdILabelCompare());
 }
 
 }  // namespace wenet
@@ -149,11 +164,12 @@ int main(int argc, char* argv[]) {
   // wfst_symbol_table->WriteText("fst.txt");
   // Reset symbol_table to on-the-fly generated wfst_symbol_table
   decode_resource->symbol_table = wfst_symbol_table;
+  decode_resource->symbol_map =
+      std::make_shared<wenet::SymbolMap>(*wfst_symbol_table);
 
-  // Compile ctc FST
-  fst::StdVectorFst ctc_fst;
-  wenet::CompileCtcFst(wfst_symbol_table, &ctc_fst);
-  // ctc_fst.Write("ctc.fst");
+  // Compile the filler shared by the decoding graphs
+  fst::StdVectorFst filler_fst;
+  wenet::CompileFillerFst(wfst_symbol_table, &filler_fst);
 
   std::unordered_map<std::string, std::string> wav_table;
   std::ifstream wav_is(FLAGS_wav_scp);
@@ -164,8 +180,21 @@ int main(int argc, char* argv[]) {
     CHECK_EQ(strs.size(), 2);
     wav_table[strs[0]] = strs[1];
   }
-
+  std::vector<std::pair<std::string, std::string>> texts;
   std::ifstream text_is(FLAGS_text);
+  while (std::getline(text_is, line)) {
+    std::vector<std::string> strs;
+    wenet::SplitString(line, &strs);
+    if (strs.size() < 2) continue;
+    std::string key = strs[0];
+    if (wav_table.find(key) == wav_table.end()) {
+      LOG(WARNING) << "No wav file for " << key;
+      continue;
+    }
+    strs.erase(strs.begin());
+    texts.emplace_back(key, wenet::JoinString(" ", strs));
+  }
+
   std::ofstream result_os(FLAGS_result, std::ios::out);
   std::ofstream timestamp_out;
   if (!FLAGS_timestamp.empty()) {
@@ -173,65 +202,69 @@ int main(int argc, char* argv[]) {
   }
   std::ostream& timestamp_os =
       FLAGS_timestamp.empty() ? std::cout : timestamp_out;
+  std::mutex output_mutex;
 
-  while (std::getline(text_is, line)) {
-    std::vector<std::string> strs;
-    wenet::SplitString(line, &strs);
-    if (strs.size() < 2) continue;
-    std::string key = strs[0];
+  auto check = [&](const std::string& key, const std::string& text) {
     LOG(INFO) << "Processing " << key;
-    if (wav_table.find(key) != wav_table.end()) {
-      strs.erase(strs.begin());
-      std::string text = wenet::JoinString(" ", strs);
-      std::vector<int> labels;
-      wenet::MapToLabel(text, wfst_symbol_table, &labels);
-      // Prepare FST for alignment decoding
-      fst::StdVectorFst align_fst;
-      wenet::CompileAlignFst(labels, wfst_symbol_table, &align_fst);
-      // align_fst.Write("align.fst");
-      auto decoding_fst = std::make_shared<fst::StdVectorFst>();
-      fst::Compose(ctc_fst, align_fst, decoding_fst.get());
-      // decoding_fst->Write("decoding.fst");
-      // Preapre feature pipeline
-      wenet::WavReader wav_reader;
-      if (!wav_reader.Open(wav_table[key])) {
-        LOG(WARNING) << "Error in reading " << wav_table[key];
-        continue;
-      }
-      int num_samples = wav_reader.num_samples();
-      CHECK_EQ(wav_reader.sample_rate(), FLAGS_sample_rate);
-      auto feature_pipeline =
-          std::make_shared<wenet::FeaturePipeline>(*feature_config);
-      feature_pipeline->AcceptWaveform(wav_reader.data(), num_samples);
-      feature_pipeline->set_input_finished();
-      decode_resource->fst = decoding_fst;
-      LOG(INFO) << "num frames " << feature_pipeline->num_frames();
-      wenet::AsrDecoder decoder(feature_pipeline, decode_resource,
-                                *decode_config);
-      while (true) {
-        wenet::DecodeState state = decoder.Decode();
-        if (state == wenet::DecodeState::kEndFeats) {
-          decoder.Rescoring();
-          break;
-        }
+    std::vector<int> labels;
+    wenet::MapToLabel(text, wfst_symbol_table, &labels);
+    // Prepare FST for alignment decoding
+    auto decoding_fst = std::make_shared<fst::StdVectorFst>();
+    wenet::CompileDecodingFst(labels, wfst_symbol_table, filler_fst,
+                              decoding_fst.get());
+    // decoding_fst->Write("decoding.fst");
+    // Preapre feature pipeline
+    wenet::WavReader wav_reader;
+    if (!wav_reader.Open(wav_table.at(key))) {
+      LOG(WARNING) << "Error in reading " << wav_table.at(key);
+      return;
+    }
+    int num_samples = wav_reader.num_samples();
+    CHECK_EQ(wav_reader.sample_rate(), FLAGS_sample_rate);
+    auto feature_pipeline = std::make_shared<wenet::FeaturePipeline>(
+        *feature_config, decode_resource->fbank_tables);
+    feature_pipeline->AcceptWaveform(wav_reader.data(), num_samples);
+    feature_pipeline->set_input_finished();
+    // The model and the tables are shared, the graph is of the utterance
+    auto resource = std::make_shared<wenet::DecodeResource>(*decode_resource);
+    resource->fst = decoding_fst;
+    LOG(INFO) << "num frames " << feature_pipeline->num_frames();
+    wenet::AsrDecoder decoder(feature_pipeline, resource, *decode_config);
+    while (true) {
+      wenet::DecodeState state = decoder.Decode();
+      if (state == wenet::DecodeState::kEndFeats) {
+        decoder.Rescoring();
+        break;
       }
-      std::string final_result;
-      std::string timestamp_str;
-      if (decoder.DecodedSomething()) {
-        const wenet::DecodeResult& result = decoder.result()[0];
-        final_result = result.sentence;
-        std::stringstream ss;
-        for (const auto& w : result.word_pieces) {
-          ss << " " << w.word << " " << w.start << " " << w.end;
-        }
-        timestamp_str = ss.str();
+    }
+    std::string final_result;
+    std::string timestamp_str;
+    if (decoder.DecodedSomething()) {
+      const wenet::DecodeResult& result = decoder.result()[0];
+      final_result = result.sentence;
+      std::stringstream ss;
+      for (const auto& w : result.word_pieces) {
+        ss << " " << w.word << " " << w.start << " " << w.end;
       }
-      result_os << key << " " << final_result << std::endl;
-      timestamp_os << key << " " << timestamp_str << std::endl;
-      LOG(INFO) << key << " " << final_result;
-    } else {
-      LOG(WARNING) << "No wav file for " << key;
+      timestamp_str = ss.str();
     }
+    std::lock_guard<std::mutex> lock(output_mutex);
+    result_os << key << " " << final_result << std::endl;
+    timestamp_os << key << " " << timestamp_str << std::endl;
+    LOG(INFO) << key << " " << final_result;
+  };
+
+  // The utterances are decoded by thread_num threads, and the encoder
+  // forwards of them are batched by --enable_chunk_scheduler
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < std::max(FLAGS_thread_num, 1); ++i) {
+    threads.emplace_back([&]() {
+      for (size_t j = next++; j < texts.size(); j = next++) {
+        check(texts[j].first, texts[j].second);
+      }
+    });
   }
+  for (auto& thread : threads) thread.join();
   return 0;
 }
@@ -0,0 +1,80 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Build the single file bundle of a deployment, which is used by the
+// decoders with --bundle_path, and by BatchRecognizer in place of the model
+// directory, e.g.
+//   model_bundle_main --model_path final.zip --unit_path units.txt \
+//       --fst_path TLG.fst --dict_path words.txt --bundle model.bundle
+// The symbol tables are converted to the binary format, and the TLG fst is
+// kept as is, so convert it by fsttoconst first to map it in place. The
+// bundle is renamed into place once it's written, so it can be built over
+// the one being served.
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/flags.h"
+#include "utils/log.h"
+#include "utils/model_bundle.h"
+
+DEFINE_string(model_path, "", "pytorch exported model path");
+DEFINE_string(unit_path, "", "e2e model unit symbol table");
+DEFINE_string(fst_path, "", "TLG fst path, optional");
+DEFINE_string(dict_path, "", "dict symbol table path, required by fst_path");
+DEFINE_string(context_path, "", "contexts of one per line, optional");
+DEFINE_string(bundle, "", "output bundle");
+
+static std::string ReadFile(const std::string& path) {
+  std::ifstream is(path, std::ios::binary);
+  CHECK(is) << "Can't open " << path;
+  std::ostringstream os;
+  os << is.rdbuf();
+  return os.str();
+}
+
+static std::string SymbolTableContent(const std::string& path) {
+  std::unique_ptr<fst::SymbolTable> table(fst::SymbolTable::ReadText(path));
+  CHECK(table != nullptr) << "Can't read symbol table " << path;
+  return wenet::ModelBundle::SymbolTableContent(*table);
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  CHECK(!FLAGS_model_path.empty() && !FLAGS_unit_path.empty() &&
+        !FLAGS_bundle.empty())
+      << "--model_path, --unit_path and --bundle are required";
+  CHECK(FLAGS_fst_path.empty() || !FLAGS_dict_path.empty())
+      << "--fst_path takes --dict_path";
+  std::vector<std::pair<std::string, std::string>> sections;
+  sections.emplace_back("final.zip", ReadFile(FLAGS_model_path));
+  sections.emplace_back("units", SymbolTableContent(FLAGS_unit_path));
+  if (!FLAGS_fst_path.empty()) {
+    sections.emplace_back("TLG.fst", ReadFile(FLAGS_fst_path));
+    sections.emplace_back("words", SymbolTableContent(FLAGS_dict_path));
+  }
+  if (!FLAGS_context_path.empty()) {
+    sections.emplace_back("context", ReadFile(FLAGS_context_path));
+  }
+  if (!wenet::ModelBundle::Write(FLAGS_bundle, sections)) return 1;
+  LOG(INFO) << "Built the bundle of " << sections.size() << " sections to "
+            << FLAGS_bundle;
+  return 0;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Search the posteriors dumped by decoder_main --posterior_dump again by the
+// search and rescoring flags, e.g. the beams, the weights and the contexts,
+// without the encoder forward, so each point of a sweep costs only the
+// search and the attention rescoring, e.g.
+//   decoder_main --model_path final.zip --unit_path units.txt
+//       --wav_scp wav.scp --posterior_dump dump.bin --result ref_result
+//   posterior_search_main --model_path final.zip --unit_path units.txt
+//       --posterior_dump dump.bin --ctc_weight 0.3 --result result
+// The chunk size and the model are the ones of the dump, and the first beam
+// size of the prefix search is at most --posterior_dump_topk if it's set.
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "decoder/params.h"
+#include "decoder/posterior_dump.h"
+#include "utils/flags.h"
+#include "utils/timer.h"
+
+DEFINE_string(posterior_dump, "",
+              "posteriors of decoder_main --posterior_dump");
+DEFINE_string(result, "", "result output file");
+DEFINE_bool(output_nbest, false, "output n-best of decode result");
+DEFINE_int32(thread_num, 1, "num of search threads");
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  auto decode_config = wenet::InitDecodeOptionsFromFlags();
+  auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
+  auto decode_resource = wenet::InitDecodeResourceFromFlags();
+  wenet::PosteriorReader reader;
+  if (!reader.Open(FLAGS_posterior_dump)) {
+    LOG(FATAL) << "Failed to open the posteriors " << FLAGS_posterior_dump;
+  }
+  LOG(INFO) << "Search " << reader.num_records() << " utterances";
+
+  // The records are searched by thread_num threads, each of a decoder of
+  // its own, whose feature pipeline is not fed
+  std::vector<std::string> outputs(reader.num_records());
+  std::atomic<int> next(0);
+  std::atomic<int> num_failed(0);
+  wenet::Timer timer;
+  auto search = [&]() {
+    auto feature_pipeline = std::make_shared<wenet::FeaturePipeline>(
+        *feature_config, decode_resource->fbank_tables);
+    wenet::AsrDecoder decoder(feature_pipeline, decode_resource,
+                              *decode_config);
+    wenet::PosteriorRecord record;
+    for (int i = next++; i < reader.num_records(); i = next++) {
+      if (!reader.Read(i, &record)) {
+        LOG(WARNING) << "Corrupted posteriors of " << reader.key(i);
+        ++num_failed;
+        continue;
+      }
+      decoder.DecodePosteriors(record);
+      std::ostringstream buffer;
+      const auto& result = decoder.result();
+      if (!FLAGS_output_nbest) {
+        buffer << record.key << " "
+               << (result.empty() ? "" : result[0].sentence) << "\n";
+      } else {
+        buffer << "wav " << record.key << "\n";
+        for (const auto& r : result) {
+          if (r.sentence.empty()) continue;
+          buffer << "candidate " << r.score << " " << r.sentence << "\n";
+        }
+      }
+      outputs[i] = buffer.str();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < std::max(FLAGS_thread_num, 1); ++i) {
+    threads.emplace_back(search);
+  }
+  for (auto& thread : threads) thread.join();
+  LOG(INFO) << "Searched " << reader.num_records() << " utterances taken "
+            << timer.Elapsed() << "ms, " << num_failed << " failed";
+
+  // In the order of the dump
+  std::ofstream result_file;
+  if (!FLAGS_result.empty()) result_file.open(FLAGS_result, std::ios::out);
+  std::ostream& result_os = FLAGS_result.empty() ? std::cout : result_file;
+  for (const std::string& output : outputs) result_os << output;
+  return 0;
+}
@@ -0,0 +1,159 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Check the int8 quantized model against the float one on a wav scp. Both
+// models are read by the model flags of decoder/params.h, with --quantized
+// false and true, and every wave is decoded by both. It reports the error
+// rate of each model against --text if given, the disagreement of the int8
+// results with the float ones, and the RTF of each model, e.g.
+//   quant_checker_main --onnx_dir dir --unit_path units.txt \
+//       --wav_scp wav.scp --text text
+// where dir has both encoder.onnx and encoder.quant.onnx and so on.
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "decoder/params.h"
+#include "frontend/wav.h"
+#include "utils/flags.h"
+#include "utils/string.h"
+#include "utils/timer.h"
+
+DEFINE_string(wav_scp, "", "input wav scp");
+DEFINE_string(text, "", "reference text of the wav scp, optional");
+DEFINE_int32(max_utts, 0, "check the first max_utts waves, 0 means all");
+
+struct ModelStats {
+  int num_errors = 0;
+  int decode_ms = 0;
+};
+
+static std::string Decode(const wenet::WavReader& wav,
+                          std::shared_ptr<wenet::DecodeResource> resource,
+                          const wenet::FeaturePipelineConfig& feature_config,
+                          const wenet::DecodeOptions& decode_config,
+                          ModelStats* stats) {
+  auto feature_pipeline =
+      std::make_shared<wenet::FeaturePipeline>(feature_config);
+  feature_pipeline->set_input_sample_rate(wav.sample_rate());
+  feature_pipeline->AcceptWaveform(wav.data(), wav.num_samples());
+  feature_pipeline->set_input_finished();
+  wenet::AsrDecoder decoder(feature_pipeline, std::move(resource),
+                            decode_config);
+  wenet::Timer timer;
+  std::string result;
+  while (true) {
+    wenet::DecodeState state = decoder.Decode();
+    if (state == wenet::DecodeState::kEndFeats) {
+      decoder.Rescoring();
+      break;
+    }
+  }
+  stats->decode_ms += timer.Elapsed();
+  if (decoder.DecodedSomething()) result = decoder.result()[0].sentence;
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  CHECK(!FLAGS_wav_scp.empty()) << "Please provide the wav scp";
+
+  auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
+  auto decode_config = wenet::InitDecodeOptionsFromFlags();
+  FLAGS_quantized = false;
+  auto float_resource = wenet::InitDecodeResourceFromFlags();
+  FLAGS_quantized = true;
+  auto int8_resource = wenet::InitDecodeResourceFromFlags();
+
+  std::unordered_map<std::string, std::string> refs;
+  if (!FLAGS_text.empty()) {
+    std::ifstream text(FLAGS_text);
+    std::string line;
+    while (getline(text, line)) {
+      std::vector<std::string> strs;
+      wenet::SplitString(line, &strs);
+      if (strs.empty()) continue;
+      size_t pos = line.find(strs[0]) + strs[0].size();
+      refs[strs[0]] = line.substr(pos);
+    }
+  }
+
+  ModelStats float_stats, int8_stats;
+  int num_ref_tokens = 0, num_float_tokens = 0, num_diffs = 0;
+  int num_utts = 0, wave_ms = 0;
+  std::ifstream wav_scp(FLAGS_wav_scp);
+  std::string line;
+  while (getline(wav_scp, line)) {
+    std::vector<std::string> strs;
+    wenet::SplitString(line, &strs);
+    if (strs.size() < 2) continue;
+    if (FLAGS_max_utts > 0 && num_utts >= FLAGS_max_utts) break;
+    wenet::WavReader wav(strs[1]);
+    wave_ms += static_cast<int>(static_cast<float>(wav.num_samples()) /
+                                wav.sample_rate() * 1000);
+    std::string float_result = Decode(wav, float_resource, *feature_config,
+                                      *decode_config, &float_stats);
+    std::string int8_result = Decode(wav, int8_resource, *feature_config,
+                                     *decode_config, &int8_stats);
+    std::vector<std::string> float_tokens =
+        wenet::ScoringTokens(float_result);
+    std::vector<std::string> int8_tokens = wenet::ScoringTokens(int8_result);
+    int diff = wenet::EditDistance(float_tokens, int8_tokens);
+    num_diffs += diff;
+    num_float_tokens += float_tokens.size();
+    auto it = refs.find(strs[0]);
+    if (it != refs.end()) {
+      std::vector<std::string> ref_tokens =
+          wenet::ScoringTokens(it->second);
+      num_ref_tokens += ref_tokens.size();
+      float_stats.num_errors += wenet::EditDistance(ref_tokens, float_tokens);
+      int8_stats.num_errors += wenet::EditDistance(ref_tokens, int8_tokens);
+    }
+    if (diff > 0) {
+      LOG(INFO) << strs[0] << " float: " << float_result
+                << " int8: " << int8_result;
+    }
+    ++num_utts;
+  }
+  CHECK_GT(wave_ms, 0) << "No wave is decoded";
+
+  std::cout << std::fixed << std::setprecision(4);
+  std::cout << "Checked " << num_utts << " waves of " << wave_ms / 1000.0
+            << "s\n";
+  if (num_ref_tokens > 0) {
+    float float_wer = static_cast<float>(float_stats.num_errors) /
+                      num_ref_tokens * 100;
+    float int8_wer =
+        static_cast<float>(int8_stats.num_errors) / num_ref_tokens * 100;
+    std::cout << "Error rate float " << float_wer << "% int8 " << int8_wer
+              << "% delta " << int8_wer - float_wer << "%\n";
+  }
+  if (num_float_tokens > 0) {
+    std::cout << "Int8 results differ from float by "
+              << static_cast<float>(num_diffs) / num_float_tokens * 100
+              << "%\n";
+  }
+  float float_rtf = static_cast<float>(float_stats.decode_ms) / wave_ms;
+  float int8_rtf = static_cast<float>(int8_stats.decode_ms) / wave_ms;
+  std::cout << "RTF float " << float_rtf << " int8 " << int8_rtf;
+  if (int8_rtf > 0) std::cout << " speedup " << float_rtf / int8_rtf;
+  std::cout << "\n";
+  return 0;
+}
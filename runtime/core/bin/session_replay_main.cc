@@ -0,0 +1,302 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Replay the sessions recorded by the servers with --record_dir, see
+// utils/session_record.h, to a websocket server run in this process. The
+// messages are sent at their recorded times, and the sessions start at
+// their recorded offsets to each other, so the arrival pattern of the
+// packets is reproduced with the model and the options of the flags. The
+// latency of each packet is the time from it's sent to the next result
+// received, which are written to --latency_file.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boost/json.hpp"
+
+#include "decoder/params.h"
+#include "utils/log.h"
+#include "utils/session_record.h"
+#include "utils/string.h"
+#include "websocket/websocket_server.h"
+
+DEFINE_string(records, "",
+              "comma separated session records, or @file of one per line");
+DEFINE_int32(port, 10087, "port of the websocket server of the replay");
+DEFINE_double(pace, 1.0,
+              "pace of the packets relative to the recorded times, 0 means "
+              "as fast as possible");
+DEFINE_bool(sequential, false,
+            "replay the sessions one by one, instead of at their recorded "
+            "offsets");
+DEFINE_string(latency_file, "",
+              "tsv of the latency of each packet: record, packet, time(ms) "
+              "of it's sent, latency(ms)");
+
+namespace json = boost::json;
+using Clock = std::chrono::steady_clock;
+
+static double Ms(Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// The client side of a recorded session
+class ReplaySession {
+ public:
+  ReplaySession(std::string path, wenet::SessionRecord record)
+      : path_(std::move(path)), record_(std::move(record)) {}
+
+  // Send the packets of the record at their times from `start`, and wait
+  // for the speech end
+  void Run(Clock::time_point start, int port) {
+    wenet::asio::io_context ioc;
+    wenet::websocket::stream<wenet::tcp::socket> ws(ioc);
+    try {
+      wenet::tcp::resolver resolver(ioc);
+      wenet::asio::connect(ws.next_layer(),
+                           resolver.resolve("127.0.0.1", std::to_string(port)));
+      ws.handshake("127.0.0.1:" + std::to_string(port), "/");
+    } catch (std::exception const& e) {
+      error_ = std::string("connect: ") + e.what();
+      return;
+    }
+    std::thread reader(&ReplaySession::ReadLoop, this, &ws);
+    bool has_end = false;
+    try {
+      for (const auto& packet : record_.packets) {
+        if (FLAGS_pace > 0) {
+          std::this_thread::sleep_until(
+              start + std::chrono::microseconds(static_cast<int64_t>(
+                          packet.time_us / FLAGS_pace)));
+        }
+        bool text = packet.type == wenet::RecordedPacket::kText;
+        if (text) {
+          has_end = packet.data.find("\"end\"") != std::string::npos;
+          if (has_end) end_time_ = Clock::now();
+        } else {
+          std::lock_guard<std::mutex> lock(mutex_);
+          send_times_.push_back(Clock::now());
+        }
+        ws.text(text);
+        ws.write(wenet::asio::buffer(packet.data));
+        if (has_end) break;
+      }
+      // The connection was closed without the end signal
+      if (!has_end) {
+        end_time_ = Clock::now();
+        ws.text(true);
+        ws.write(wenet::asio::buffer(std::string("{\"signal\":\"end\"}")));
+      }
+    } catch (std::exception const& e) {
+      // The server closes the connection at the speech end, e.g. of the
+      // endpoint, before all the packets are sent
+      VLOG(1) << path_ << " write: " << e.what();
+    }
+    reader.join();
+  }
+
+  const std::string& path() const { return path_; }
+  int64_t record_start_us() const { return record_.start_unix_us; }
+  const std::string& error() const { return error_; }
+  // The latency of each packet sent, -1 if no result follows it
+  const std::vector<double>& latencies_ms() const { return latencies_ms_; }
+  // The packets sent, relative to the first one
+  std::vector<double> send_ms() const {
+    std::vector<double> ms;
+    for (const auto& t : send_times_) ms.push_back(Ms(t - send_times_[0]));
+    return ms;
+  }
+  // From the end signal to the speech end, -1 if it's not ended
+  double final_ms() const { return final_ms_; }
+
+ private:
+  void ReadLoop(wenet::websocket::stream<wenet::tcp::socket>* ws) {
+    try {
+      while (true) {
+        wenet::beast::flat_buffer buffer;
+        ws->read(buffer);
+        Clock::time_point now = Clock::now();
+        bool speech_end = false;
+        if (ws->got_text()) {
+          json::value value =
+              json::parse(wenet::beast::buffers_to_string(buffer.data()));
+          const json::object& obj = value.as_object();
+          if (obj.at("status") != "ok") {
+            error_ = json::serialize(value);
+            break;
+          }
+          if (obj.at("type") == "server_ready") continue;
+          speech_end = obj.at("type") == "speech_end";
+        }
+        // A partial or a final result answers all the packets before it
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = latencies_ms_.size(); i < send_times_.size(); ++i) {
+          latencies_ms_.push_back(Ms(now - send_times_[i]));
+        }
+        if (speech_end) {
+          final_ms_ = Ms(now - end_time_);
+          break;
+        }
+      }
+    } catch (std::exception const& e) {
+      if (final_ms_ < 0) error_ = std::string("read: ") + e.what();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    latencies_ms_.resize(send_times_.size(), -1);
+  }
+
+  std::string path_;
+  wenet::SessionRecord record_;
+  std::string error_;
+  std::mutex mutex_;
+  std::vector<Clock::time_point> send_times_;
+  std::vector<double> latencies_ms_;
+  Clock::time_point end_time_;
+  double final_ms_ = -1;
+};
+
+static std::vector<std::string> RecordPaths() {
+  std::vector<std::string> paths;
+  if (!FLAGS_records.empty() && FLAGS_records[0] == '@') {
+    std::ifstream in(FLAGS_records.substr(1));
+    std::string line;
+    while (getline(in, line)) {
+      line = wenet::Trim(line);
+      if (!line.empty()) paths.push_back(line);
+    }
+  } else {
+    wenet::SplitStringToVector(FLAGS_records, ",", true, &paths);
+  }
+  return paths;
+}
+
+static double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0;
+  size_t k = std::min(values.size() - 1,
+                      static_cast<size_t>(p / 100 * values.size()));
+  std::nth_element(values.begin(), values.begin() + k, values.end());
+  return values[k];
+}
+
+static void Report(const std::string& name, const std::vector<double>& ms) {
+  std::vector<double> values;
+  for (double v : ms) {
+    if (v >= 0) values.push_back(v);
+  }
+  LOG(INFO) << std::fixed << std::setprecision(1) << name << " latency(ms) "
+            << "p50 " << Percentile(values, 50) << " p90 "
+            << Percentile(values, 90) << " p99 " << Percentile(values, 99)
+            << " max " << Percentile(values, 100) << " of " << values.size();
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  std::vector<std::unique_ptr<ReplaySession>> sessions;
+  int64_t first_start_us = 0;
+  for (const auto& path : RecordPaths()) {
+    wenet::SessionRecord record;
+    if (!wenet::ReadSessionRecord(path, &record)) {
+      LOG(FATAL) << "Failed to read the session record " << path;
+    }
+    if (sessions.empty() || record.start_unix_us < first_start_us) {
+      first_start_us = record.start_unix_us;
+    }
+    sessions.emplace_back(new ReplaySession(path, std::move(record)));
+  }
+  if (sessions.empty()) {
+    LOG(FATAL) << "Please provide the session records by --records.";
+  }
+
+  auto decode_config = wenet::InitDecodeOptionsFromFlags();
+  auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
+  auto decode_resource = wenet::InitDecodeResourcesFromFlags();
+  wenet::WebSocketServer server(FLAGS_port, feature_config, decode_config,
+                                decode_resource);
+  // The server runs until the process exits
+  std::thread server_thread([&server]() { server.Start(); });
+  server_thread.detach();
+  // Wait for it to listen
+  for (int i = 0; i < 100; ++i) {
+    try {
+      wenet::asio::io_context ioc;
+      wenet::tcp::socket socket(ioc);
+      socket.connect(wenet::tcp::endpoint(
+          wenet::asio::ip::make_address("127.0.0.1"), FLAGS_port));
+      break;
+    } catch (std::exception const&) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+  }
+
+  Clock::time_point start = Clock::now();
+  if (FLAGS_sequential) {
+    for (auto& session : sessions) session->Run(Clock::now(), FLAGS_port);
+  } else {
+    std::vector<std::thread> threads;
+    for (auto& session : sessions) {
+      int64_t offset_us = session->record_start_us() - first_start_us;
+      if (FLAGS_pace > 0) offset_us /= FLAGS_pace;
+      Clock::time_point session_start =
+          start + std::chrono::microseconds(offset_us);
+      ReplaySession* s = session.get();
+      threads.emplace_back([s, session_start]() {
+        std::this_thread::sleep_until(session_start);
+        s->Run(session_start, FLAGS_port);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+  }
+  LOG(INFO) << "Replayed " << sessions.size() << " sessions in "
+            << Ms(Clock::now() - start) << " ms";
+
+  std::ofstream latency_file;
+  if (!FLAGS_latency_file.empty()) latency_file.open(FLAGS_latency_file);
+  std::vector<double> all_latencies, final_latencies;
+  int num_failed = 0;
+  for (const auto& session : sessions) {
+    if (!session->error().empty()) {
+      LOG(WARNING) << session->path() << " failed, " << session->error();
+      ++num_failed;
+    }
+    const auto& latencies = session->latencies_ms();
+    std::vector<double> send_ms = session->send_ms();
+    for (size_t i = 0; i < latencies.size(); ++i) {
+      if (latency_file.is_open()) {
+        latency_file << session->path() << "\t" << i << "\t" << send_ms[i]
+                     << "\t" << latencies[i] << "\n";
+      }
+    }
+    all_latencies.insert(all_latencies.end(), latencies.begin(),
+                         latencies.end());
+    final_latencies.push_back(session->final_ms());
+  }
+  Report("packet", all_latencies);
+  Report("final", final_latencies);
+  LOG(INFO) << num_failed << " of " << sessions.size() << " sessions failed";
+  latency_file.close();
+  google::FlushLogFiles(google::GLOG_INFO);
+  // Not returned, the server thread is still serving
+  std::_Exit(num_failed > 0 ? 1 : 0);
+}
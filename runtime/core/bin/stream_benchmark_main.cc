@@ -0,0 +1,240 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Streaming latency benchmark. The waves of the wav scp are replayed at real
+// time pace by `num_streams` concurrent streams, each of which feeds an
+// in-process AsrDecoder from one thread and decodes it on another, as the
+// websocket server does. It reports:
+//   first partial latency: from the start of the stream to its first
+//                          non-empty partial result
+//   chunk latency: from the arrival of the last sample of a chunk to the end
+//                  of its decoding
+//   final latency: from the end of the speech to the final result
+//   CPU usage of the process.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "decoder/params.h"
+#include "frontend/wav.h"
+#include "utils/flags.h"
+#include "utils/string.h"
+#include "utils/timer.h"
+
+DEFINE_string(wav_scp, "", "input wav scp, which is replayed by the streams");
+DEFINE_int32(num_streams, 1, "number of the concurrent streams");
+DEFINE_int32(num_rounds, 1, "times the wav scp are replayed");
+DEFINE_int32(send_interval_ms, 100, "interval of the audio sent to a stream");
+DEFINE_double(pace, 1.0,
+              "pace of the replay relative to real time, 0 means as fast as "
+              "possible");
+
+using Clock = std::chrono::steady_clock;
+
+struct LatencyStats {
+  std::mutex mutex;
+  std::vector<double> first_partial_ms;
+  std::vector<double> chunk_ms;
+  std::vector<double> final_ms;
+  double total_wave_ms = 0;
+};
+
+static double MsBetween(Clock::time_point a, Clock::time_point b) {
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+// The feeding side of a stream, it records when the samples arrive
+class WaveFeeder {
+ public:
+  explicit WaveFeeder(std::shared_ptr<wenet::FeaturePipeline> pipeline)
+      : pipeline_(std::move(pipeline)) {}
+
+  void Feed(const wenet::WavReader& wav) {
+    const int step = wav.sample_rate() / 1000 * FLAGS_send_interval_ms;
+    Clock::time_point next = Clock::now();
+    for (int start = 0; start < wav.num_samples(); start += step) {
+      int size = std::min(step, wav.num_samples() - start);
+      if (FLAGS_pace > 0) {
+        next += std::chrono::microseconds(
+            static_cast<int64_t>(FLAGS_send_interval_ms * 1000 / FLAGS_pace));
+        std::this_thread::sleep_until(next);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        arrivals_.emplace_back(start + size, Clock::now());
+      }
+      pipeline_->AcceptWaveform(wav.data() + start, size);
+    }
+    end_of_speech_ = Clock::now();
+    pipeline_->set_input_finished();
+  }
+
+  // When the sample at `offset` arrived
+  Clock::time_point ArrivalOf(int offset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::lower_bound(
+        arrivals_.begin(), arrivals_.end(), offset,
+        [](const std::pair<int, Clock::time_point>& arrival, int value) {
+          return arrival.first < value;
+        });
+    if (arrivals_.empty()) return Clock::now();
+    if (it == arrivals_.end()) return arrivals_.back().second;
+    return it->second;
+  }
+  // Only valid after Feed() returns
+  Clock::time_point end_of_speech() const { return end_of_speech_; }
+
+ private:
+  std::shared_ptr<wenet::FeaturePipeline> pipeline_;
+  std::mutex mutex_;
+  // Number of samples arrived and the time, ascending
+  std::vector<std::pair<int, Clock::time_point>> arrivals_;
+  Clock::time_point end_of_speech_;
+};
+
+void RunStream(const wenet::WavReader& wav,
+               const wenet::FeaturePipelineConfig& feature_config,
+               std::shared_ptr<wenet::DecodeResource> resource,
+               const wenet::DecodeOptions& decode_config,
+               LatencyStats* stats) {
+  CHECK_EQ(wav.sample_rate(), feature_config.sample_rate);
+  auto pipeline = std::make_shared<wenet::FeaturePipeline>(
+      feature_config, resource->fbank_tables);
+  wenet::AsrDecoder decoder(pipeline, resource, decode_config);
+  WaveFeeder feeder(pipeline);
+  Clock::time_point start = Clock::now();
+  std::thread feed_thread([&]() { feeder.Feed(wav); });
+
+  std::vector<double> chunk_ms;
+  double first_partial_ms = -1;
+  int num_frames = 0;
+  while (true) {
+    wenet::DecodeState state = decoder.Decode();
+    Clock::time_point now = Clock::now();
+    if (state == wenet::DecodeState::kEndFeats) break;
+    if (decoder.num_frames_in_current_chunk() == 0) continue;
+    // The last sample needed by the frames decoded so far
+    num_frames += decoder.num_frames_in_current_chunk();
+    int last_sample = (num_frames - 1) * feature_config.frame_shift +
+                      feature_config.frame_length;
+    chunk_ms.push_back(MsBetween(feeder.ArrivalOf(last_sample), now));
+    if (first_partial_ms < 0 && decoder.DecodedSomething()) {
+      first_partial_ms = MsBetween(start, now);
+    }
+  }
+  decoder.Rescoring();
+  feed_thread.join();
+  double final_ms = MsBetween(feeder.end_of_speech(), Clock::now());
+  if (decoder.DecodedSomething()) {
+    VLOG(1) << "Final result: " << decoder.result()[0].sentence;
+  }
+
+  std::lock_guard<std::mutex> lock(stats->mutex);
+  if (first_partial_ms >= 0) {
+    stats->first_partial_ms.push_back(first_partial_ms);
+  }
+  stats->chunk_ms.insert(stats->chunk_ms.end(), chunk_ms.begin(),
+                         chunk_ms.end());
+  stats->final_ms.push_back(final_ms);
+  stats->total_wave_ms +=
+      static_cast<double>(wav.num_samples()) / wav.sample_rate() * 1000;
+}
+
+static double Percentile(std::vector<double>* values, double p) {
+  if (values->empty()) return 0;
+  size_t k = std::min(values->size() - 1,
+                      static_cast<size_t>(p / 100 * values->size()));
+  std::nth_element(values->begin(), values->begin() + k, values->end());
+  return (*values)[k];
+}
+
+static void Report(const std::string& name, std::vector<double>* values) {
+  LOG(INFO) << std::fixed << std::setprecision(1) << name << " latency(ms) "
+            << "p50 " << Percentile(values, 50) << " p90 "
+            << Percentile(values, 90) << " p99 " << Percentile(values, 99)
+            << " max " << Percentile(values, 100) << " of " << values->size();
+}
+
+static double CpuSeconds() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  CHECK_GT(FLAGS_chunk_size, 0) << "Only streaming decoding is benchmarked";
+  CHECK_GT(FLAGS_num_streams, 0);
+  auto decode_config = wenet::InitDecodeOptionsFromFlags();
+  auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
+  auto decode_resource = wenet::InitDecodeResourceFromFlags();
+
+  std::vector<std::shared_ptr<wenet::WavReader>> waves;
+  std::ifstream wav_scp(FLAGS_wav_scp);
+  std::string line;
+  while (getline(wav_scp, line)) {
+    std::vector<std::string> strs;
+    wenet::SplitString(line, &strs);
+    CHECK_GE(strs.size(), 2);
+    waves.emplace_back(std::make_shared<wenet::WavReader>(strs[1]));
+  }
+  if (waves.empty()) {
+    LOG(FATAL) << "Please provide non-empty wav scp.";
+  }
+
+  LatencyStats stats;
+  std::atomic<int> next(0);
+  const int num_tasks = waves.size() * FLAGS_num_rounds;
+  double cpu_start = CpuSeconds();
+  wenet::Timer timer;
+  std::vector<std::thread> streams;
+  for (int i = 0; i < FLAGS_num_streams; ++i) {
+    streams.emplace_back([&]() {
+      for (int j = next++; j < num_tasks; j = next++) {
+        RunStream(*waves[j % waves.size()], *feature_config, decode_resource,
+                  *decode_config, &stats);
+      }
+    });
+  }
+  for (auto& t : streams) {
+    t.join();
+  }
+  double wall_seconds = timer.Elapsed() / 1000.0;
+  double cpu_seconds = CpuSeconds() - cpu_start;
+
+  LOG(INFO) << "Replayed " << num_tasks << " utterances of "
+            << stats.total_wave_ms / 1000 << "s by " << FLAGS_num_streams
+            << " streams in " << wall_seconds << "s";
+  Report("First partial", &stats.first_partial_ms);
+  Report("Chunk", &stats.chunk_ms);
+  Report("Final", &stats.final_ms);
+  LOG(INFO) << std::fixed << std::setprecision(2) << "CPU usage "
+            << cpu_seconds / wall_seconds << " cores, "
+            << cpu_seconds * 1000 / stats.total_wave_ms
+            << " cpu seconds per second of audio";
+  return 0;
+}
@@ -22,6 +22,9 @@ DEFINE_int32(port, 10086, "port of websocket server");
 DEFINE_int32(nbest, 1, "n-best of decode result");
 DEFINE_string(wav_path, "", "test wav file path");
 DEFINE_bool(continuous_decoding, false, "continuous decoding mode");
+DEFINE_bool(delta_partial, false, "receive the partial results as deltas");
+DEFINE_bool(binary_result, false, "receive the results as binary protobuf");
+DEFINE_string(model, "", "named model of the server, empty for the default");
 
 int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
@@ -29,6 +32,9 @@ int main(int argc, char* argv[]) {
   wenet::WebSocketClient client(FLAGS_hostname, FLAGS_port);
   client.set_nbest(FLAGS_nbest);
   client.set_continuous_decoding(FLAGS_continuous_decoding);
+  client.set_delta_partial(FLAGS_delta_partial);
+  client.set_binary_result(FLAGS_binary_result);
+  client.set_model(FLAGS_model);
   client.SendStartSignal();
 
   wenet::WavReader wav_reader(FLAGS_wav_path);
@@ -0,0 +1,99 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Load test of the websocket server, the waves of the wav scp are replayed
+// by many concurrent streams, see LoadGenerator for the details.
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boost/asio/executor_work_guard.hpp"
+
+#include "frontend/wav.h"
+#include "utils/flags.h"
+#include "utils/load_generator.h"
+#include "utils/string.h"
+#include "websocket/async_websocket_client.h"
+
+DEFINE_string(hostname, "127.0.0.1", "hostname of websocket server");
+DEFINE_int32(port, 10086, "port of websocket server");
+DEFINE_int32(nbest, 1, "n-best of decode result");
+DEFINE_bool(continuous_decoding, false, "continuous decoding mode");
+DEFINE_string(wav_scp, "", "input wav scp, which is replayed by the streams");
+DEFINE_int32(num_streams, 100, "total number of the streams");
+DEFINE_int32(max_concurrency, 1000, "number of the streams in flight at most");
+DEFINE_double(arrival_rate, 10,
+              "new streams per second, 0 means as many as max_concurrency "
+              "allows");
+DEFINE_int32(chunk_ms, 100, "duration of the audio sent at a time");
+DEFINE_double(pace, 1.0,
+              "pace of the audio relative to real time, 0 means as fast as "
+              "possible");
+DEFINE_int32(timeout_ms, 30000, "timeout of a stream after its end signal");
+DEFINE_int32(num_io_threads, 2, "number of the I/O threads of all streams");
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  const int sample_rate = 16000;
+  std::vector<std::shared_ptr<std::vector<int16_t>>> waves;
+  std::ifstream wav_scp(FLAGS_wav_scp);
+  std::string line;
+  while (getline(wav_scp, line)) {
+    std::vector<std::string> strs;
+    wenet::SplitString(line, &strs);
+    CHECK_GE(strs.size(), 2);
+    wenet::WavReader wav_reader(strs[1]);
+    // Only support 16K
+    CHECK_EQ(wav_reader.sample_rate(), sample_rate);
+    waves.emplace_back(std::make_shared<std::vector<int16_t>>(
+        wav_reader.data(), wav_reader.data() + wav_reader.num_samples()));
+  }
+  if (waves.empty()) {
+    LOG(FATAL) << "Please provide non-empty wav scp.";
+  }
+
+  wenet::LoadOptions opts;
+  opts.num_streams = FLAGS_num_streams;
+  opts.max_concurrency = FLAGS_max_concurrency;
+  opts.arrival_rate = FLAGS_arrival_rate;
+  opts.chunk_ms = FLAGS_chunk_ms;
+  opts.pace = FLAGS_pace;
+  opts.timeout_ms = FLAGS_timeout_ms;
+  wenet::LoadGenerator generator(opts, std::move(waves), sample_rate);
+
+  boost::asio::io_context ioc;
+  auto work = boost::asio::make_work_guard(ioc);
+  std::vector<std::thread> io_threads;
+  for (int i = 0; i < FLAGS_num_io_threads; ++i) {
+    io_threads.emplace_back([&ioc]() { ioc.run(); });
+  }
+  generator.Run([&ioc](wenet::LoadStreamListener* listener) {
+    return std::make_shared<wenet::AsyncWebSocketClient>(
+        &ioc, FLAGS_hostname, FLAGS_port, FLAGS_nbest,
+        FLAGS_continuous_decoding, listener);
+  });
+  // The streams are all done, only their closes may be pending
+  work.reset();
+  ioc.stop();
+  for (auto& t : io_threads) {
+    t.join();
+  }
+  generator.Report();
+  return 0;
+}
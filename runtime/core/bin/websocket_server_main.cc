@@ -12,24 +12,236 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <signal.h>
+
 #include "decoder/params.h"
 #include "utils/log.h"
+#include "utils/memory_budget.h"
+#include "utils/metrics_server.h"
+#include "utils/prefork.h"
+#include "utils/profiler.h"
+#include "utils/session_record.h"
+#include "utils/trace.h"
 #include "websocket/websocket_server.h"
 
 DEFINE_int32(port, 10086, "websocket listening port");
+DEFINE_bool(async_server, false,
+            "serve connections with fixed I/O and decode thread pools "
+            "instead of threads per connection");
+DEFINE_bool(multiplexed, false,
+            "serve many streams over each connection, see "
+            "websocket/mux_connection_handler.h, only for async_server");
+DEFINE_int32(num_io_threads, 2, "number of I/O threads for async server");
+DEFINE_int32(num_decode_threads, 8,
+             "number of decode threads for async server");
+DEFINE_bool(batch_scheduler, false,
+            "batch utterances of all connections by length in the server, "
+            "only for run_batch");
+DEFINE_int32(scheduler_batch_size, 32, "max batch size of batch scheduler");
+DEFINE_int32(scheduler_batch_frames, 32000,
+             "max padded frames of a batch of batch scheduler");
+DEFINE_int32(scheduler_wait_ms, 50,
+             "max time(ms) an utterance waits in batch scheduler");
+DEFINE_int32(scheduler_bucket_frames, 200,
+             "length bucket width(frames) of batch scheduler");
+DEFINE_int32(metrics_port, 0,
+             "port of the HTTP /metrics endpoint for Prometheus, 0 means "
+             "no metrics endpoint");
+DEFINE_bool(enable_trace, false,
+            "record the stages of each session, which are exported as chrome "
+            "trace at /trace of the metrics port");
+DEFINE_int32(trace_buffer_size, 4096,
+             "number of the latest trace spans kept for each thread");
+DEFINE_string(profile_dir, ".",
+              "dir of the profiles of the requests captured by "
+              "/profile?requests=N of the metrics port");
+DEFINE_int32(session_pool_size, 0,
+             "number of the idle decoding sessions kept for the new connections, "
+             "which are constructed at start, 0 means a session is "
+             "constructed per connection");
+DEFINE_int32(batch_decoder_pool_size, 0,
+             "number of the idle batch decoders kept for the new batch "
+             "connections, which are constructed at start, 0 means a batch "
+             "decoder is constructed per connection, only for run_batch "
+             "without the batch scheduler");
+DEFINE_int32(max_sessions, 0,
+             "max concurrent sessions, over which the new connections are "
+             "rejected, 0 means no limit");
+DEFINE_int32(max_queued_frames, 0,
+             "max feature frames queued in a session for decoding, over "
+             "which it's terminated as overloaded, 0 means no limit");
+DEFINE_double(max_decode_queue_depth, 0,
+              "max pending decode tasks per decode thread of the async "
+              "server, over which the new connections are rejected, 0 means "
+              "no limit");
+DEFINE_int32(max_session_memory_mb, 0,
+             "max memory of the states of all the live sessions, e.g. the "
+             "caches and the hypotheses, over which the new connections are "
+             "rejected, 0 means no limit");
+DEFINE_string(tenant_quotas, "",
+              "quotas of the tenants of the start messages, "
+              "name=weight[:max_sessions[:max_batch_audio_rate]] separated "
+              "by commas, the tenants not listed share the one named "
+              "default, see utils/tenant_quota.h");
+DEFINE_string(record_dir, "",
+              "dir to record the messages of the connections to with their "
+              "arrival times, which are replayed by session_replay_main, "
+              "empty means no recording");
+DEFINE_int32(record_sessions, 100,
+             "max number of the connections recorded, 0 means no limit");
+DEFINE_bool(reload_on_sighup, true,
+            "reload the model and graphs from the flags on SIGHUP, the "
+            "running connections keep the old ones");
+DEFINE_int32(prefork_workers, 0,
+             "number of the worker processes forked by the master which "
+             "loads the model and graphs once, so the workers share their "
+             "memory, and they listen on the port by SO_REUSEPORT. The "
+             "failed workers are restarted, SIGHUP is forwarded to them, and "
+             "each one reloads a copy of its own. Worker i serves the "
+             "metrics at --metrics_port + i. Only for the cpu torch model, "
+             "whose runtime is forkable before it runs. 0 means serving in "
+             "this process");
+
+// Serve the loaded resources, by this process or by a pre-fork worker
+static int Serve(
+    int worker, std::shared_ptr<wenet::FeaturePipelineConfig> feature_config,
+    std::shared_ptr<wenet::DecodeOptions> decode_config,
+    const std::vector<std::shared_ptr<wenet::DecodeResource>>&
+        decode_resources) {
+  std::unique_ptr<wenet::MetricsServer> metrics_server;
+  if (FLAGS_prefork_workers > 0 && FLAGS_metrics_port > 0) {
+    metrics_server.reset(
+        new wenet::MetricsServer(FLAGS_metrics_port + worker));
+    CHECK(metrics_server->Start());
+  }
+  if (FLAGS_prefork_workers > 0) {
+    wenet::StartDecodeThreadsFromFlags(decode_resources);
+    // The threads of the model runtimes of the master are not forked
+    // either, so each worker warms up the model on its own
+    if (FLAGS_warmup_model) {
+      for (const auto& resource : decode_resources) {
+        wenet::WarmupModelFromFlags(*resource);
+      }
+    }
+  }
+
+  wenet::WebSocketServer server(FLAGS_port, feature_config, decode_config,
+                                decode_resources);
+  server.set_cpu_sets(wenet::CpuSetsFromFlags());
+  server.set_reuse_port(FLAGS_prefork_workers > 0);
+  auto resources = server.resources();
+  if (!FLAGS_models.empty()) {
+    CHECK(!FLAGS_run_batch) << "--models is for the streaming decoding";
+    wenet::LoadNamedDecodeResourcesFromFlags(*feature_config, *decode_config,
+                                             false, resources.get());
+  }
+  if (FLAGS_memory_budget_mb > 0) {
+    wenet::MemoryBudget budget(static_cast<int64_t>(FLAGS_memory_budget_mb)
+                               << 20);
+    resources->AddToBudget(&budget);
+    budget.Log();
+  }
+  if (FLAGS_run_batch && FLAGS_batch_scheduler) {
+    wenet::BatchSchedulerOptions opts;
+    opts.max_batch_size = FLAGS_scheduler_batch_size;
+    opts.max_batch_frames = FLAGS_scheduler_batch_frames;
+    opts.max_wait_ms = FLAGS_scheduler_wait_ms;
+    opts.bucket_width_frames = FLAGS_scheduler_bucket_frames;
+    server.EnableBatchScheduler(opts);
+  }
+  if (FLAGS_session_pool_size > 0) {
+    server.EnableSessionPool(FLAGS_session_pool_size);
+  }
+  if (FLAGS_run_batch && !FLAGS_batch_scheduler &&
+      FLAGS_batch_decoder_pool_size > 0) {
+    server.EnableBatchDecoderPool(FLAGS_batch_decoder_pool_size);
+  }
+  if (!FLAGS_record_dir.empty()) {
+    wenet::SessionRecorder::Enable(FLAGS_record_dir, FLAGS_record_sessions);
+  }
+  wenet::AdmissionOptions admission_opts;
+  admission_opts.max_sessions = FLAGS_max_sessions;
+  admission_opts.max_queued_frames = FLAGS_max_queued_frames;
+  admission_opts.max_queue_depth = FLAGS_max_decode_queue_depth;
+  admission_opts.max_session_bytes =
+      static_cast<int64_t>(FLAGS_max_session_memory_mb) * 1024 * 1024;
+  if (!wenet::ParseTenantQuotas(FLAGS_tenant_quotas,
+                                &admission_opts.tenant_quotas)) {
+    LOG(FATAL) << "Invalid --tenant_quotas " << FLAGS_tenant_quotas;
+  }
+  server.EnableAdmissionControl(admission_opts);
+  if (FLAGS_reload_on_sighup) {
+    // The batch scheduler keeps the initial resource
+    wenet::ReloadOnSignal(SIGHUP, resources, [=]() {
+      wenet::LoadNamedDecodeResourcesFromFlags(*feature_config, *decode_config,
+                                               true, resources.get());
+      return wenet::ReloadDecodeResourcesFromFlags(*feature_config,
+                                                   *decode_config);
+    });
+  }
+  LOG(INFO) << "Listening at port " << FLAGS_port;
+  LOG(INFO) << "run for batch decoding: " << FLAGS_run_batch;
+  if (FLAGS_async_server && !FLAGS_run_batch) {
+    if (FLAGS_multiplexed) server.EnableMultiplexing();
+    server.StartAsync(FLAGS_num_io_threads, FLAGS_num_decode_threads);
+  } else {
+    server.Start(FLAGS_run_batch);
+  }
+  return 0;
+}
 
 int main(int argc, char* argv[]) {
+  // Warm up the model before accepting any connection unless it's disabled
+  gflags::SetCommandLineOptionWithMode("warmup_model", "true",
+                                       gflags::SET_FLAGS_DEFAULT);
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   google::InitGoogleLogging(argv[0]);
+  if (FLAGS_reload_on_sighup) {
+    wenet::BlockSignal(SIGHUP);
+  }
+
+  if (FLAGS_enable_trace) {
+    wenet::Tracer::Instance().Enable(FLAGS_trace_buffer_size);
+  }
+  wenet::Profiler::Instance().set_output_dir(FLAGS_profile_dir);
+  if (FLAGS_prefork_workers > 0) {
+    // The CUDA context and the thread pools of onnxruntime and of the xpu
+    // runtime are created with their models in the master, and they are
+    // unusable in a forked worker. The pools of libtorch on cpu are created
+    // lazily by the first forward, which the master doesn't run, and they
+    // are reset in the forked child.
+#ifdef USE_GPU
+    LOG(FATAL) << "--prefork_workers is not supported by the GPU build";
+#endif
+    CHECK(FLAGS_onnx_dir.empty() && FLAGS_xpu_model_dir.empty())
+        << "--prefork_workers is only supported by the torch model";
+  }
+  // The master of the pre-fork starts no thread of its own before it forks,
+  // the workers start their metrics servers
+  std::unique_ptr<wenet::MetricsServer> metrics_server;
+  if (FLAGS_metrics_port > 0 && FLAGS_prefork_workers == 0) {
+    metrics_server.reset(new wenet::MetricsServer(FLAGS_metrics_port));
+    CHECK(metrics_server->Start());
+  }
 
   auto decode_config = wenet::InitDecodeOptionsFromFlags();
   auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
-  auto decode_resource = wenet::InitDecodeResourceFromFlags();
+  // The pre-fork workers warm up the model themselves
+  const bool warmup_model = FLAGS_warmup_model;
+  if (FLAGS_prefork_workers > 0) FLAGS_warmup_model = false;
+  // And start their threads, which are not forked
+  auto decode_resources =
+      wenet::InitDecodeResourcesFromFlags(FLAGS_prefork_workers == 0);
+  FLAGS_warmup_model = warmup_model;
 
-  wenet::WebSocketServer server(FLAGS_port, feature_config, decode_config,
-                                decode_resource);
-  LOG(INFO) << "Listening at port " << FLAGS_port;
-  LOG(INFO) << "run for batch decoding: " << FLAGS_run_batch;
-  server.Start(FLAGS_run_batch);
-  return 0;
+  if (FLAGS_prefork_workers > 0) {
+    wenet::PreforkOptions opts;
+    opts.num_workers = FLAGS_prefork_workers;
+    opts.forward_sighup = FLAGS_reload_on_sighup;
+    wenet::RunPreforkWorkers(opts, [&](int worker) {
+      return Serve(worker, feature_config, decode_config, decode_resources);
+    });
+    return 0;
+  }
+  return Serve(0, feature_config, decode_config, decode_resources);
 }
@@ -0,0 +1,6 @@
+set(BENCHMARK_ENABLE_TESTING OFF CACHE BOOL "" FORCE)
+set(BENCHMARK_ENABLE_GTEST_TESTS OFF CACHE BOOL "" FORCE)
+FetchContent_Declare(benchmark
+  URL      https://github.com/google/benchmark/archive/v1.7.1.zip
+)
+FetchContent_MakeAvailable(benchmark)
@@ -49,4 +49,9 @@ if(ONNX)
   endif()
 
   add_definitions(-DUSE_ONNX)
+  # The onnxruntime built with the ARM Compute Library EP, e.g. for the
+  # Raspberry Pi, its ONNX_URL has to be given since there is no release
+  if(ONNX_ACL)
+    add_definitions(-DUSE_ACL)
+  endif()
 endif()
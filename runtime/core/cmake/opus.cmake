@@ -0,0 +1,8 @@
+set(OPUS_BUILD_TESTING OFF CACHE BOOL "" FORCE)
+set(OPUS_BUILD_PROGRAMS OFF CACHE BOOL "" FORCE)
+FetchContent_Declare(opus
+  GIT_REPOSITORY https://github.com/xiph/opus
+  GIT_TAG        v1.3.1
+)
+FetchContent_MakeAvailable(opus)
+add_definitions(-DUSE_OPUS)
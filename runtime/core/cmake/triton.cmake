@@ -0,0 +1,22 @@
+# third_party: the common, core and backend repos of Triton, which provide
+# the headers of the backend API and the utils of the backends.
+set(TRITON_REPO_TAG "r22.03" CACHE STRING "the tag of the triton repos")
+set(TRITON_ENABLE_GPU ON CACHE BOOL "" FORCE)
+set(TRITON_ENABLE_MALI_GPU OFF CACHE BOOL "" FORCE)
+FetchContent_Declare(repo-common
+  GIT_REPOSITORY https://github.com/triton-inference-server/common.git
+  GIT_TAG        ${TRITON_REPO_TAG}
+  GIT_SHALLOW    ON
+)
+FetchContent_Declare(repo-core
+  GIT_REPOSITORY https://github.com/triton-inference-server/core.git
+  GIT_TAG        ${TRITON_REPO_TAG}
+  GIT_SHALLOW    ON
+)
+FetchContent_Declare(repo-backend
+  GIT_REPOSITORY https://github.com/triton-inference-server/backend.git
+  GIT_TAG        ${TRITON_REPO_TAG}
+  GIT_SHALLOW    ON
+)
+FetchContent_MakeAvailable(repo-common repo-core repo-backend)
+find_package(CUDAToolkit REQUIRED)
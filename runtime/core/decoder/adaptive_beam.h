@@ -0,0 +1,62 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_ADAPTIVE_BEAM_H_
+#define DECODER_ADAPTIVE_BEAM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace wenet {
+
+// Narrow the beams of the ctc search of a session when its search time of a
+// chunk is over the budget, e.g. under a load spike, and widen them back
+// when it's well below. The beams are scaled, see
+// SearchInterface::SetBeamScale, so the configured ones are the widest.
+struct AdaptiveBeamOptions {
+  // The budget of the search time of a chunk over the duration of the
+  // audio of it, 0 disables it
+  float max_search_rtf = 0.0;
+  // The beams are scaled down to it at most
+  float min_beam_scale = 0.5;
+  // The scale is multiplied by it when over the budget, and divided by it
+  // when below low_rtf_ratio of the budget, so it's kept in between
+  float beam_scale_step = 0.8;
+  float low_rtf_ratio = 0.5;
+};
+
+// The beam scale of the next chunk by the real time factor of the search of
+// the last one
+inline float AdaptBeamScale(float beam_scale, const AdaptiveBeamOptions& opts,
+                            float search_rtf) {
+  if (opts.max_search_rtf <= 0) return 1.0;
+  if (search_rtf > opts.max_search_rtf) {
+    return std::max(beam_scale * opts.beam_scale_step, opts.min_beam_scale);
+  }
+  if (search_rtf < opts.max_search_rtf * opts.low_rtf_ratio) {
+    return std::min(beam_scale / opts.beam_scale_step, 1.0f);
+  }
+  return beam_scale;
+}
+
+// A beam size scaled, at least 1, the unlimited one is kept
+inline int ScaleBeamSize(int beam_size, float beam_scale) {
+  if (beam_size == std::numeric_limits<int>::max()) return beam_size;
+  return std::max(static_cast<int>(std::lround(beam_size * beam_scale)), 1);
+}
+
+}  // namespace wenet
+
+#endif  // DECODER_ADAPTIVE_BEAM_H_
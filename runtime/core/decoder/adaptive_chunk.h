@@ -0,0 +1,71 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_ADAPTIVE_CHUNK_H_
+#define DECODER_ADAPTIVE_CHUNK_H_
+
+#include <algorithm>
+
+namespace wenet {
+
+// Grow the chunk size of the streaming sessions when the server is
+// overloaded, which trades the latency for the throughput, and shrink it
+// back when the load is low. The model must be trained with dynamic chunk,
+// and take the chunk size at runtime, e.g. the torch models.
+struct AdaptiveChunkOptions {
+  // The chunk size is doubled up to it when overloaded, and halved down to
+  // the chunk_size of DecodeOptions when not, 0 disables it
+  int max_chunk_size = 0;
+  // Overloaded if the cpu usage or the queued tasks per decode thread is
+  // above the high threshold, not if both are below the low threshold, and
+  // the chunk size is kept in between
+  float high_cpu_usage = 0.9;
+  float low_cpu_usage = 0.6;
+  float high_queue_depth = 2.0;
+  float low_queue_depth = 0.5;
+  // Catch up a session fallen behind, e.g. by a burst of the network: when
+  // two chunks or more of frames are queued, up to max_catchup_chunks of
+  // them are forwarded as one chunk and searched together, so the backlog
+  // pays one model dispatch instead of one per chunk. 0 disables it.
+  int max_catchup_chunks = 0;
+};
+
+// The chunk size of the next chunk by the load, see LoadMonitor
+inline int AdaptChunkSize(int chunk_size, int min_chunk_size,
+                          const AdaptiveChunkOptions& opts, float cpu_usage,
+                          float queue_depth) {
+  if (opts.max_chunk_size <= min_chunk_size || min_chunk_size <= 0) {
+    return min_chunk_size;
+  }
+  if (cpu_usage > opts.high_cpu_usage || queue_depth > opts.high_queue_depth) {
+    return std::min(chunk_size * 2, opts.max_chunk_size);
+  }
+  if (cpu_usage < opts.low_cpu_usage && queue_depth < opts.low_queue_depth) {
+    return std::max(chunk_size / 2, min_chunk_size);
+  }
+  return chunk_size;
+}
+
+// The number of the chunks of `chunk_frames` frames to forward as one, of
+// the `num_queued_frames` frames queued, see max_catchup_chunks
+inline int CatchupChunks(int num_queued_frames, int chunk_frames,
+                         const AdaptiveChunkOptions& opts) {
+  if (opts.max_catchup_chunks <= 1 || chunk_frames <= 0) return 1;
+  return std::max(1, std::min(num_queued_frames / chunk_frames,
+                              opts.max_catchup_chunks));
+}
+
+}  // namespace wenet
+
+#endif  // DECODER_ADAPTIVE_CHUNK_H_
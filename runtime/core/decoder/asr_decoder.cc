@@ -19,58 +19,311 @@
 #include <ctype.h>
 
 #include <algorithm>
+#include <chrono>
 #include <limits>
 #include <utility>
 
+#include "utils/load_monitor.h"
+#include "utils/metrics.h"
+#include "utils/profiler.h"
+#include "utils/stage_timer.h"
 #include "utils/timer.h"
+#include "utils/trace.h"
 
 namespace wenet {
 
+static Gauge* ActiveDecoders() {
+  static Gauge* active_decoders = Metrics::Instance().GetGauge(
+      "wenet_active_decoders", "Number of the alive decoding sessions");
+  return active_decoders;
+}
+
+static StageStats* RescoringLatency() {
+  static StageStats* rescoring_latency = StageStats::Get(
+      "wenet_rescoring_seconds", "Attention rescoring latency of a session");
+  return rescoring_latency;
+}
+
+static Counter* ConfirmedRescorings() {
+  static Counter* num_confirmed = Metrics::Instance().GetCounter(
+      "wenet_speculative_rescoring_confirmed_total",
+      "Number of the speculative rescorings used at the endpoint");
+  return num_confirmed;
+}
+
+std::shared_ptr<const SymbolMap> SymbolMapOf(
+    const std::shared_ptr<const SymbolMap>& map,
+    const std::shared_ptr<fst::SymbolTable>& table) {
+  if (map != nullptr || table == nullptr) return map;
+  return std::make_shared<SymbolMap>(*table);
+}
+
+void BuildSymbolMaps(DecodeResource* resource) {
+  if (resource->symbol_table != nullptr) {
+    resource->symbol_table->AddSymbol("<context>");
+    resource->symbol_table->AddSymbol("</context>");
+    resource->symbol_map =
+        std::make_shared<SymbolMap>(*resource->symbol_table);
+  }
+  if (resource->unit_table == resource->symbol_table) {
+    resource->unit_map = resource->symbol_map;
+  } else if (resource->unit_table != nullptr) {
+    resource->unit_map = std::make_shared<SymbolMap>(*resource->unit_table);
+  }
+}
+
 AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
                        std::shared_ptr<DecodeResource> resource,
-                       const DecodeOptions& opts)
+                       const DecodeOptions& opts,
+                       std::shared_ptr<ContextGraph> context_graph)
     : feature_pipeline_(std::move(feature_pipeline)),
+      model_replicas_(resource->model_replicas),
+      replica_(model_replicas_ != nullptr ? model_replicas_->Acquire() : 0),
       // Make a copy of the model ASR model since we will change the inner
       // status of the model
-      model_(resource->model->Copy()),
+      model_(model_replicas_ != nullptr
+                 ? model_replicas_->model(replica_)->Copy()
+                 : resource->model->Copy()),
       post_processor_(resource->post_processor),
-      symbol_table_(resource->symbol_table),
+      chunk_scheduler_(resource->chunk_scheduler),
+      rescoring_scheduler_(resource->rescoring_scheduler),
+      rescoring_pool_(resource->rescoring_pool),
+      symbols_(SymbolMapOf(resource->symbol_map, resource->symbol_table)),
       fst_(resource->fst),
-      unit_table_(resource->unit_table),
+      units_(SymbolMapOf(resource->unit_map, resource->unit_table)),
       opts_(opts),
-      ctc_endpointer_(new CtcEndpoint(opts.ctc_endpoint_config)) {
+      ctc_endpointer_(new CtcEndpoint(opts.ctc_endpoint_config)),
+      chunk_size_(opts.chunk_size),
+      rescoring_cache_(opts.rescoring_cache_size) {
   if (opts_.reverse_weight > 0) {
     // Check if model has a right to left decoder
     CHECK(model_->is_bidirectional_decoder());
   }
+  if (context_graph == nullptr) {
+    context_graph = resource->context_graph;
+  }
   if (nullptr == fst_) {
+    std::shared_ptr<LanguageModel> lm =
+        resource->language_model != nullptr ? resource->language_model->Copy()
+                                            : nullptr;
     searcher_.reset(new CtcPrefixBeamSearch(opts.ctc_prefix_search_opts,
-                                            resource->context_graph));
+                                            context_graph, lm, &arena_));
+  } else if (opts.ctc_wfst_search_opts.lg_graph) {
+    if (context_graph != nullptr) {
+      LOG(WARNING) << "The context graph is not supported on the LG graph";
+    }
+    searcher_.reset(new CtcLgBeamSearch(*fst_, opts.ctc_wfst_search_opts));
   } else {
     searcher_.reset(new CtcWfstBeamSearch(*fst_, opts.ctc_wfst_search_opts,
-                                          resource->context_graph));
+                                          context_graph,
+                                          resource->lattice_rescorer));
   }
+  model_->set_replica(replica_);
   ctc_endpointer_->frame_shift_in_ms(frame_shift_in_ms());
+  ActiveDecoders()->Add(1);
+}
+
+AsrDecoder::~AsrDecoder() {
+  DropSegments();
+  set_trace_id(0);
+  if (model_replicas_ != nullptr) model_replicas_->Release(replica_);
+  ActiveDecoders()->Add(-1);
+}
+
+void AsrDecoder::set_trace_id(uint64_t trace_id) {
+  trace_id_ = trace_id;
+  if (profiled_) {
+    model_->set_profile_prefix("");
+    Profiler::Instance().Release();
+    profiled_ = false;
+  }
+  // The captured requests are traced, the Tracer is enabled by the capture
+  std::string prefix;
+  if (trace_id != 0 && Profiler::Instance().Acquire(&prefix)) {
+    profiled_ = true;
+    model_->set_profile_prefix(prefix);
+  }
 }
 
 void AsrDecoder::Reset() {
   start_ = false;
   result_.clear();
+  path_caches_.clear();
+  partial_nbest_ = 1;
   num_frames_ = 0;
   global_frame_offset_ = 0;
+  num_chunks_ = 0;
+  second_pass_chunk_ = 0;
+  first_pass_us_ = 0;
+  second_pass_us_ = 0;
+  DropSegments();
   model_->Reset();
   searcher_->Reset();
   feature_pipeline_->Reset();
   ctc_endpointer_->Reset();
+  rescoring_cache_.Clear();
+  rescoring_segment_ = 0;
+  speculated_ = false;
+  idle_ms_ = 0;
+  recorded_chunks_.clear();
+  chunk_size_ = opts_.chunk_size;
+  if (beam_scale_ != 1.0 || late_) {
+    beam_scale_ = 1.0;
+    late_ = false;
+    searcher_->SetBeamScale(SearchBeamScale());
+  }
+  UpdateMemoryUsage();
 }
 
 void AsrDecoder::ResetContinuousDecoding() {
   global_frame_offset_ = num_frames_;
   start_ = false;
   result_.clear();
+  path_caches_.clear();
   model_->Reset();
   searcher_->Reset();
   ctc_endpointer_->Reset();
+  ++rescoring_segment_;
+  speculated_ = false;
+  idle_ms_ = 0;
+}
+
+void AsrDecoder::FinishSegment() {
+  std::unique_ptr<Segment> segment(new Segment);
+  if (rescoring_pool_ == nullptr || profiled_) {
+    Rescoring();
+    segment->result = result_;
+    segments_.push_back(std::move(segment));
+    ResetContinuousDecoding();
+    return;
+  }
+  TraceScope trace(trace_id_, "finish_segment");
+  if (FinalizeResult()) {
+    const auto& hypotheses = searcher_->Inputs();
+    segment->rescoring_score.resize(hypotheses.size());
+    if (LookupRescoring(hypotheses, &segment->rescoring_score,
+                        &segment->unique_hyps, &segment->index) ==
+        static_cast<int>(hypotheses.size())) {
+      ConfirmedRescorings()->Increment();
+    }
+  }
+  segment->result = result_;
+  if (!segment->rescoring_score.empty()) {
+    // The model of the segment goes with it, the next segment is decoded
+    // by the spare one or a new copy
+    SessionMemory usage;
+    model_->GetMemoryUsage(&usage);
+    segment->encoder_outs_bytes = usage.encoder_outs;
+    segment->model = std::move(model_);
+    if (spare_model_ != nullptr) {
+      model_ = std::move(spare_model_);
+    } else {
+      model_ = segment->model->Copy();
+      model_->set_replica(replica_);
+    }
+    Segment* pending = segment.get();
+    segment->done = rescoring_pool_->enqueue(
+        [this, pending] { RescoreSegment(pending); });
+  }
+  segments_.push_back(std::move(segment));
+  ResetContinuousDecoding();
+}
+
+void AsrDecoder::RescoreSegment(Segment* segment) const {
+  Timer timer;
+  if (!segment->unique_hyps.empty()) {
+    std::vector<float> scores;
+    RescoreUniqueHyps(segment->model.get(), segment->unique_hyps, &scores);
+    for (size_t i = 0; i < segment->index.size(); ++i) {
+      if (segment->index[i] >= 0) {
+        segment->rescoring_score[i] = scores[segment->index[i]];
+      }
+    }
+  }
+  CombineScores(segment->rescoring_score, &segment->result);
+  RescoringLatency()->Record(timer.ElapsedNs());
+}
+
+bool AsrDecoder::PopSegmentResult(std::vector<DecodeResult>* result,
+                                  bool block) {
+  if (segments_.empty()) return false;
+  Segment* segment = segments_.front().get();
+  if (segment->done.valid()) {
+    if (!block && segment->done.wait_for(std::chrono::seconds(0)) !=
+                      std::future_status::ready) {
+      return false;
+    }
+    segment->done.get();
+  }
+  result->swap(segment->result);
+  if (segment->model != nullptr) {
+    segment->model->Reset();
+    spare_model_ = std::move(segment->model);
+  }
+  segments_.pop_front();
+  return true;
+}
+
+void AsrDecoder::DropSegments() {
+  for (auto& segment : segments_) {
+    if (segment->done.valid()) segment->done.wait();
+  }
+  segments_.clear();
+}
+
+// The header of the saved state, "WNST" and the version of the layout
+static const uint32_t kStateMagic = 0x54534e57;
+static const uint32_t kStateVersion = 3;
+
+bool AsrDecoder::SaveState(std::string* state) {
+  // The segments being rescored are not saved
+  if (!segments_.empty()) return false;
+  StateWriter writer;
+  writer.Write(kStateMagic);
+  writer.Write(kStateVersion);
+  writer.Write(start_);
+  writer.Write(num_frames_);
+  writer.Write(global_frame_offset_);
+  writer.Write(num_chunks_);
+  writer.Write(chunk_size_);
+  writer.Write(idle_ms_);
+  writer.Write(vocab_size_);
+  writer.Write(beam_scale_);
+  writer.Write(partial_nbest_);
+  if (!model_->SaveState(&writer) || !searcher_->SaveState(&writer)) {
+    return false;
+  }
+  ctc_endpointer_->SaveState(&writer);
+  if (!feature_pipeline_->SaveState(&writer)) return false;
+  *state = writer.str();
+  return true;
+}
+
+bool AsrDecoder::LoadState(const std::string& state) {
+  StateReader reader(state);
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  if (!reader.Read(&magic) || magic != kStateMagic ||
+      !reader.Read(&version) || version != kStateVersion) {
+    LOG(WARNING) << "Not a decoder state of version " << kStateVersion;
+    return false;
+  }
+  if (!reader.Read(&start_) || !reader.Read(&num_frames_) ||
+      !reader.Read(&global_frame_offset_) || !reader.Read(&num_chunks_) ||
+      !reader.Read(&chunk_size_) || !reader.Read(&idle_ms_) ||
+      !reader.Read(&vocab_size_) || !reader.Read(&beam_scale_) ||
+      !reader.Read(&partial_nbest_) || !model_->LoadState(&reader) ||
+      !searcher_->LoadState(&reader) || !ctc_endpointer_->LoadState(&reader) ||
+      !feature_pipeline_->LoadState(&reader) || !reader.done()) {
+    LOG(WARNING) << "Failed to load the decoder state";
+    return false;
+  }
+  result_.clear();
+  path_caches_.clear();
+  rescoring_cache_.Clear();
+  searcher_->SetBeamScale(SearchBeamScale());
+  UpdateResult();
+  return true;
 }
 
 DecodeState AsrDecoder::Decode(bool block) {
@@ -79,75 +332,477 @@ DecodeState AsrDecoder::Decode(bool block) {
 
 void AsrDecoder::Rescoring() {
   // Do attention rescoring
+  TraceScope trace(trace_id_, "rescoring");
   Timer timer;
   AttentionRescoring();
-  VLOG(2) << "Rescoring cost latency: " << timer.Elapsed() << "ms.";
+  RescoringLatency()->Record(timer.ElapsedNs());
+  VLOG(2) << "Rescoring cost latency: " << timer.ElapsedNs() / 1e6 << "ms.";
+}
+
+void AsrDecoder::set_late(bool late) {
+  if (late == late_) return;
+  VLOG(1) << (late ? "Session is late, coarser decoding" : "Session caught up");
+  late_ = late;
+  searcher_->SetBeamScale(SearchBeamScale());
+}
+
+float AsrDecoder::SearchBeamScale() const {
+  return late_ ? std::min(beam_scale_, opts_.adaptive_beam_opts.min_beam_scale)
+               : beam_scale_;
+}
+
+bool AsrDecoder::SecondPassDue() {
+  if (late_ || opts_.second_pass_chunks <= 0 || opts_.rescoring_weight == 0.0 ||
+      !model_->has_decoder() || searcher_->Type() != kPrefixBeamSearch ||
+      !DecodedSomething() ||
+      num_chunks_ - second_pass_chunk_ < opts_.second_pass_chunks) {
+    return false;
+  }
+  return second_pass_us_ <= opts_.second_pass_budget * first_pass_us_ &&
+         LoadMonitor::Instance().cpu_usage() <=
+             opts_.second_pass_max_cpu_usage;
+}
+
+bool AsrDecoder::SecondPassPartial() {
+  static Counter* num_second_passes = Metrics::Instance().GetCounter(
+      "wenet_second_pass_partials_total",
+      "Number of the partial results reranked by the attention rescoring");
+  if (!SecondPassDue()) return false;
+  TraceScope trace(trace_id_, "second_pass");
+  Timer timer;
+  num_second_passes->Increment();
+  second_pass_chunk_ = num_chunks_;
+  // The scores are dropped by the cache once speech resumes
+  speculated_ = true;
+  std::vector<float> rescoring_score;
+  RescoreHyps(searcher_->Inputs(), &rescoring_score);
+  // result_ is in the order of the hyps until it's sorted
+  for (size_t i = 0; i < result_.size(); ++i) {
+    result_[i].score = opts_.rescoring_weight * rescoring_score[i] +
+                       opts_.ctc_weight * result_[i].score;
+  }
+  std::sort(result_.begin(), result_.end(), DecodeResult::CompareFunc);
+  second_pass_us_ += timer.ElapsedUs();
+  return true;
+}
+
+void AsrDecoder::DecodeUtterance(const float* pcm, int num_samples) {
+  static Metrics& metrics = Metrics::Instance();
+  static StageStats* forward_latency = StageStats::Get(
+      "wenet_encoder_forward_seconds",
+      "Encoder forward latency of a chunk, including the wait in the chunk "
+      "scheduler if enabled");
+  static StageStats* search_latency = StageStats::Get(
+      "wenet_search_seconds", "CTC search latency of a chunk");
+  static Counter* num_decoded_frames = metrics.GetCounter(
+      "wenet_decoded_frames_total", "Number of the decoded feature frames");
+  Reset();
+  FeatureView feats;
+  feature_pipeline_->ComputeUtterance(pcm, num_samples, &feats);
+  VLOG(1) << "Decode the utterance of " << feats.num_frames() << " frames";
+  // The whole utterance is one chunk
+  model_->set_chunk_size(-1);
+  model_->set_num_left_chunks(-1);
+  ctc_log_probs_.Clear();
+  bool prefix = searcher_->Type() == kPrefixBeamSearch;
+  int topk_size = prefix ? opts_.ctc_prefix_search_opts.first_beam_size
+                         : opts_.ctc_wfst_search_opts.sparse_topk;
+  bool topk = opts_.enable_topk_ctc && topk_size > 0;
+  std::vector<std::vector<float>> topk_scores;
+  std::vector<std::vector<int32_t>> topk_indexs;
+  Timer timer;
+  if (topk) {
+    model_->ForwardEncoderTopK(feats, topk_size, &topk_scores, &topk_indexs);
+  } else {
+    model_->ForwardEncoder(feats, &ctc_log_probs_);
+    if (!ctc_log_probs_.empty()) vocab_size_ = ctc_log_probs_.cols();
+  }
+  num_frames_ = feats.num_frames();
+  num_frames_in_current_chunk_ = feats.num_frames();
+  forward_latency->Record(timer.ElapsedNs());
+  num_decoded_frames->Increment(feats.num_frames());
+  timer.Reset();
+  if (topk) {
+    searcher_->Search(topk_scores, topk_indexs);
+  } else {
+    searcher_->Search(ctc_log_probs_.view());
+  }
+  search_latency->Record(timer.ElapsedNs());
+  if (record_posteriors_) RecordChunk(topk, topk_scores, topk_indexs);
+  start_ = true;
+  ++num_chunks_;
+  // The result is updated by the rescoring
+  Rescoring();
+}
+
+void AsrDecoder::RecordChunk(
+    bool topk, const std::vector<std::vector<float>>& topk_scores,
+    const std::vector<std::vector<int32_t>>& topk_indexs) {
+  recorded_chunks_.emplace_back();
+  PosteriorChunk& chunk = recorded_chunks_.back();
+  if (!topk && record_topk_ <= 0) {
+    chunk.log_probs = ctc_log_probs_;
+    return;
+  }
+  chunk.topk = true;
+  if (topk) {
+    chunk.topk_scores = topk_scores;
+    chunk.topk_indexs = topk_indexs;
+    return;
+  }
+  int num_rows = ctc_log_probs_.rows();
+  chunk.topk_scores.resize(num_rows);
+  chunk.topk_indexs.resize(num_rows);
+  std::vector<int> index;
+  for (int t = 0; t < num_rows; ++t) {
+    TopK(ctc_log_probs_.row(t), ctc_log_probs_.cols(), record_topk_,
+         &chunk.topk_scores[t], &index);
+    chunk.topk_indexs[t].assign(index.begin(), index.end());
+  }
+}
+
+void AsrDecoder::TakePosteriors(PosteriorRecord* record) {
+  record->num_frames = num_frames_;
+  record->chunks = std::move(recorded_chunks_);
+  recorded_chunks_.clear();
+  record->model_state.clear();
+  StateWriter writer;
+  if (model_->SaveState(&writer)) record->model_state = writer.str();
+}
+
+void AsrDecoder::DecodePosteriors(const PosteriorRecord& record) {
+  static StageStats* search_latency = StageStats::Get(
+      "wenet_search_seconds", "CTC search latency of a chunk");
+  Reset();
+  for (const PosteriorChunk& chunk : record.chunks) {
+    Timer timer;
+    if (chunk.topk) {
+      searcher_->Search(chunk.topk_scores, chunk.topk_indexs);
+    } else {
+      searcher_->Search(chunk.log_probs.view());
+    }
+    search_latency->Record(timer.ElapsedNs());
+    ++num_chunks_;
+  }
+  num_frames_ = record.num_frames;
+  start_ = true;
+  if (!record.model_state.empty()) {
+    // The state is loaded by the model of its chunk size and num_left_chunks,
+    // which come first, see AsrModel::SaveState
+    StateReader header(record.model_state);
+    int chunk_size = 0;
+    int num_left_chunks = 0;
+    header.Read(&chunk_size);
+    header.Read(&num_left_chunks);
+    model_->set_chunk_size(chunk_size);
+    model_->set_num_left_chunks(num_left_chunks);
+    StateReader reader(record.model_state);
+    if (model_->LoadState(&reader)) {
+      Rescoring();
+      return;
+    }
+    LOG(WARNING) << "Failed to load the model state of " << record.key
+                 << ", the result is not rescored";
+    model_->Reset();
+  }
+  FinalizeResult();
 }
 
 DecodeState AsrDecoder::AdvanceDecoding(bool block) {
+  static Metrics& metrics = Metrics::Instance();
+  static StageStats* forward_latency = StageStats::Get(
+      "wenet_encoder_forward_seconds",
+      "Encoder forward latency of a chunk, including the wait in the chunk "
+      "scheduler if enabled");
+  static StageStats* search_latency = StageStats::Get(
+      "wenet_search_seconds", "CTC search latency of a chunk");
+  static StageStats* endpoint_latency = StageStats::Get(
+      "wenet_endpoint_seconds", "Endpoint detection latency of a chunk");
+  static Counter* num_endpoints = metrics.GetCounter(
+      "wenet_endpoints_total", "Number of the detected endpoints");
+  static Counter* num_decoded_frames = metrics.GetCounter(
+      "wenet_decoded_frames_total", "Number of the decoded feature frames");
+  static Counter* num_skipped_chunks = metrics.GetCounter(
+      "wenet_skipped_chunks_total",
+      "Number of the silent chunks of which the encoder forward is skipped");
+  static Counter* num_catchups = metrics.GetCounter(
+      "wenet_catchup_chunks_total",
+      "Number of the chunks forwarded together with another to catch up");
+  static Counter* num_offloads = metrics.GetCounter(
+      "wenet_offloaded_sessions_total",
+      "Number of the offloads of the model caches of the idle sessions");
+  static Histogram* beam_scale = metrics.GetHistogram(
+      "wenet_search_beam_scale",
+      "Beam scale of the search of a chunk, see AdaptiveBeamOptions",
+      {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.0});
   DecodeState state = DecodeState::kEndBatch;
-  model_->set_chunk_size(opts_.chunk_size);
+  // The chunk size of the models whose caches are sized at Reset() is fixed
+  const bool adaptive = model_->chunk_size_changeable();
+  if (adaptive && opts_.adaptive_chunk_opts.max_chunk_size > 0) {
+    LoadMonitor& monitor = LoadMonitor::Instance();
+    int chunk_size = AdaptChunkSize(chunk_size_, opts_.chunk_size,
+                                    opts_.adaptive_chunk_opts,
+                                    monitor.cpu_usage(), monitor.queue_depth());
+    if (chunk_size != chunk_size_) {
+      VLOG(1) << "Chunk size " << chunk_size_ << " -> " << chunk_size;
+      chunk_size_ = chunk_size;
+    }
+  }
+  model_->set_chunk_size(chunk_size_);
   model_->set_num_left_chunks(opts_.num_left_chunks);
   int num_required_frames = model_->num_frames_for_chunk(start_);
-  std::vector<std::vector<float>> chunk_feats;
+  // The deferred waveform is extracted here, on the decoding thread
+  feature_pipeline_->ComputePending();
+  // The chunk size of this call, which is of the queued chunks when the
+  // session catches up, see AdaptiveChunkOptions::max_catchup_chunks
+  int chunk_size = chunk_size_;
+  int num_catchup_chunks =
+      adaptive && chunk_size_ > 0
+          ? CatchupChunks(feature_pipeline_->NumQueuedFrames(),
+                          num_required_frames, opts_.adaptive_chunk_opts)
+          : 1;
+  if (num_catchup_chunks > 1) {
+    VLOG(2) << "Catch up " << num_catchup_chunks << " chunks";
+    num_catchups->Increment(num_catchup_chunks - 1);
+    chunk_size = chunk_size_ * num_catchup_chunks;
+    model_->set_chunk_size(chunk_size);
+    num_required_frames = model_->num_frames_for_chunk(start_);
+  }
   // Return immediately if we do not want to block
   if (!block && !feature_pipeline_->input_finished() &&
       feature_pipeline_->NumQueuedFrames() < num_required_frames) {
     return DecodeState::kWaitFeats;
   }
-  // If not okay, that means we reach the end of the input
-  if (!feature_pipeline_->Read(num_required_frames, &chunk_feats)) {
-    state = DecodeState::kEndFeats;
+  int num_chunk_frames = 0;
+  ctc_log_probs_.Clear();
+  // Only the topk of each frame are copied out of the model for prefix
+  // beam search or the sparse wfst search, see DecodeOptions::enable_topk_ctc
+  bool prefix = searcher_->Type() == kPrefixBeamSearch;
+  int topk_size = prefix ? opts_.ctc_prefix_search_opts.first_beam_size
+                         : opts_.ctc_wfst_search_opts.sparse_topk;
+  bool topk = opts_.enable_topk_ctc && chunk_scheduler_ == nullptr &&
+              topk_size > 0;
+  std::vector<std::vector<float>>& topk_scores = topk_scores_;
+  std::vector<std::vector<int32_t>>& topk_indexs = topk_indexs_;
+  // The full chunk of silence is searched as blank frames, which are topk
+  // frames for prefix beam search and the sparse wfst search, or full log
+  // probs of the output dim known after the first forward for wfst search
+  bool sparse = prefix || opts_.ctc_wfst_search_opts.sparse_topk > 0;
+  bool skip = opts_.skip_silent_chunks && chunk_size > 0 &&
+              (sparse || vocab_size_ > 0);
+  // Whether the chunk scheduler has searched the chunk with the others
+  bool searched = false;
+  Timer timer;
+  // The feature_wait stage is the blocking Read() of the chunk
+  int64_t stage_start = trace_id_ != 0 ? Tracer::NowNs() : 0;
+  if (chunk_scheduler_ != nullptr) {
+    std::vector<std::vector<float>> chunk_feats;
+    // If not okay, that means we reach the end of the input
+    if (!feature_pipeline_->Read(num_required_frames, &chunk_feats)) {
+      state = DecodeState::kEndFeats;
+    }
+    num_chunk_frames = chunk_feats.size();
+    stage_start = TraceStage("feature_wait", stage_start);
+    timer.Reset();
+    skip = skip && state != DecodeState::kEndFeats &&
+           feature_pipeline_->last_read_silent();
+    if (skip) {
+      model_->SkipChunk(chunk_feats);
+    } else {
+      std::vector<std::vector<float>> ctc_log_probs;
+      searched = chunk_scheduler_->ForwardEncoder(
+          model_.get(), chunk_feats, &ctc_log_probs, searcher_.get());
+      ctc_log_probs_.CopyFrom(ctc_log_probs);
+    }
+  } else {
+    // Read the chunk as a contiguous view, no per frame copy
+    FeatureView chunk_feats;
+    if (!feature_pipeline_->Read(num_required_frames, &chunk_feats)) {
+      state = DecodeState::kEndFeats;
+    }
+    num_chunk_frames = chunk_feats.num_frames();
+    stage_start = TraceStage("feature_wait", stage_start);
+    timer.Reset();
+    skip = skip && state != DecodeState::kEndFeats &&
+           feature_pipeline_->last_read_silent();
+    if (skip) {
+      model_->SkipChunk(chunk_feats);
+    } else if (topk) {
+      model_->ForwardEncoderTopK(chunk_feats, topk_size, &topk_scores,
+                                 &topk_indexs);
+    } else {
+      model_->ForwardEncoder(chunk_feats, &ctc_log_probs_);
+    }
   }
-
-  num_frames_ += chunk_feats.size();
+  if (skip) {
+    // The chunk_size output frames of the full chunk are all blank
+    num_skipped_chunks->Increment();
+    int idle_ms = idle_ms_ + chunk_size * frame_shift_in_ms();
+    if (opts_.offload_idle_ms > 0 && idle_ms_ < opts_.offload_idle_ms &&
+        idle_ms >= opts_.offload_idle_ms) {
+      VLOG(1) << "Offload the idle session at " << num_frames_;
+      num_offloads->Increment();
+      model_->Offload();
+    }
+    idle_ms_ = idle_ms;
+    const int blank = opts_.ctc_prefix_search_opts.blank;
+    if (sparse) {
+      topk = true;
+      topk_scores.assign(chunk_size, std::vector<float>(1, 0.0f));
+      topk_indexs.assign(chunk_size, std::vector<int32_t>(1, blank));
+    } else {
+      ctc_log_probs_.Resize(chunk_size, vocab_size_);
+      std::fill_n(ctc_log_probs_.data(), chunk_size * vocab_size_,
+                  -kFloatMax);
+      for (int t = 0; t < chunk_size; ++t) ctc_log_probs_(t, blank) = 0.0f;
+    }
+  } else {
+    idle_ms_ = 0;
+    if (!ctc_log_probs_.empty()) vocab_size_ = ctc_log_probs_.cols();
+  }
+  num_frames_ += num_chunk_frames;
+  num_frames_in_current_chunk_ = num_chunk_frames;
   VLOG(2) << "Required " << num_required_frames << " get "
-          << chunk_feats.size();
-  Timer timer;
-  std::vector<std::vector<float>> ctc_log_probs;
-  model_->ForwardEncoder(chunk_feats, &ctc_log_probs);
-  int forward_time = timer.Elapsed();
+          << num_chunk_frames;
+  double forward_time = timer.ElapsedNs() / 1e6;
+  forward_latency->Record(timer.ElapsedNs());
+  first_pass_us_ += timer.ElapsedUs();
+  num_decoded_frames->Increment(num_chunk_frames);
+  stage_start = TraceStage("encoder_forward", stage_start);
+  if (record_posteriors_) RecordChunk(topk, topk_scores, topk_indexs);
   timer.Reset();
-  searcher_->Search(ctc_log_probs);
-  int search_time = timer.Elapsed();
+  if (searched) {
+    // With the other chunks of the batch by the chunk scheduler
+  } else if (topk) {
+    searcher_->Search(topk_scores, topk_indexs);
+  } else {
+    searcher_->Search(ctc_log_probs_.view());
+  }
+  double search_time = timer.ElapsedNs() / 1e6;
+  search_latency->Record(timer.ElapsedNs());
+  first_pass_us_ += timer.ElapsedUs();
+  if (opts_.adaptive_beam_opts.max_search_rtf > 0) {
+    beam_scale->Observe(beam_scale_);
+    int chunk_ms = num_chunk_frames * feature_frame_shift_in_ms();
+    if (chunk_ms > 0) {
+      float scale = AdaptBeamScale(beam_scale_, opts_.adaptive_beam_opts,
+                                   timer.ElapsedUs() / 1e3 / chunk_ms);
+      if (scale != beam_scale_) {
+        VLOG(1) << "Beam scale " << beam_scale_ << " -> " << scale;
+        beam_scale_ = scale;
+        searcher_->SetBeamScale(SearchBeamScale());
+      }
+    }
+  }
+  stage_start = TraceStage("search", stage_start);
   VLOG(3) << "forward takes " << forward_time << " ms, search takes "
           << search_time << " ms";
+  LoadMonitor::Instance().RecordChunkLatency(
+      static_cast<int64_t>((forward_time + search_time) * 1000));
   UpdateResult();
+  stage_start = TraceStage("update_result", stage_start);
 
   if (state != DecodeState::kEndFeats) {
-    if (ctc_endpointer_->IsEndpoint(ctc_log_probs, DecodedSomething())) {
+    timer.Reset();
+    // The blank scores read by the search if it keeps them, the frames are
+    // scanned again otherwise
+    const std::vector<float>& blank_scores = searcher_->BlankScores();
+    bool endpoint;
+    if (!blank_scores.empty()) {
+      endpoint = ctc_endpointer_->IsEndpoint(blank_scores, DecodedSomething());
+    } else if (topk) {
+      endpoint = ctc_endpointer_->IsEndpoint(topk_scores, topk_indexs,
+                                             DecodedSomething());
+    } else {
+      endpoint = ctc_endpointer_->IsEndpoint(ctc_log_probs_.view(),
+                                             DecodedSomething());
+    }
+    endpoint_latency->Record(timer.ElapsedNs());
+    TraceStage("endpoint", stage_start);
+    if (endpoint) {
+      num_endpoints->Increment();
       VLOG(1) << "Endpoint is detected at " << num_frames_;
       state = DecodeState::kEndpoint;
+    } else if (opts_.speculative_rescoring_ms > 0 &&
+               opts_.rescoring_weight != 0.0 && model_->has_decoder() &&
+               prefix && DecodedSomething() &&
+               ctc_endpointer_->trailing_silence_ms() >=
+                   opts_.speculative_rescoring_ms) {
+      SpeculativeRescoring();
+    } else if (speculated_) {
+      // Speech resumes, the encoder output of the scores is changed
+      ++rescoring_segment_;
+      speculated_ = false;
     }
   }
 
   start_ = true;
+  ++num_chunks_;
+  UpdateMemoryUsage();
   return state;
 }
 
+void AsrDecoder::GetMemoryUsage(SessionMemory* usage) const {
+  model_->GetMemoryUsage(usage);
+  for (const auto& segment : segments_) {
+    usage->encoder_outs += segment->encoder_outs_bytes;
+  }
+  usage->feature = feature_pipeline_->buffer_bytes();
+  // The free memory of the arena, the one in use is of the search
+  usage->search = searcher_->memory_bytes() + arena_.capacity() -
+                  arena_.used_bytes();
+}
+
+void AsrDecoder::UpdateMemoryUsage() {
+  SessionMemory usage;
+  GetMemoryUsage(&usage);
+  memory_tracker_.Update(usage);
+}
+
+int64_t AsrDecoder::TraceStage(const char* stage, int64_t start_ns) {
+  return Tracer::Instance().Record(trace_id_, stage, start_ns, num_chunks_);
+}
+
 void AsrDecoder::UpdateResult(bool finish) {
   const auto& hypotheses = searcher_->Outputs();
   const auto& inputs = searcher_->Inputs();
   const auto& likelihood = searcher_->Likelihood();
   const auto& times = searcher_->Times();
-  result_.clear();
 
   CHECK_EQ(hypotheses.size(), likelihood.size());
-  for (size_t i = 0; i < hypotheses.size(); i++) {
+  size_t num_paths = hypotheses.size();
+  if (!finish && opts_.second_pass_chunks <= 0) {
+    num_paths = std::min<size_t>(num_paths, std::max(partial_nbest_, 1));
+  }
+  if (path_caches_.size() < num_paths) path_caches_.resize(num_paths);
+  // The results of the last chunk are overwritten in place, so the strings
+  // of the sentences reuse their capacity
+  result_.resize(num_paths);
+  for (size_t i = 0; i < num_paths; i++) {
     const std::vector<int>& hypothesis = hypotheses[i];
 
-    DecodeResult path;
+    DecodeResult& path = result_[i];
     path.score = likelihood[i];
+    path.word_pieces.clear();
     int offset = global_frame_offset_ * feature_frame_shift_in_ms();
-    for (size_t j = 0; j < hypothesis.size(); j++) {
-      std::string word = symbol_table_->Find(hypothesis[j]);
+    // Only the units of the tokens after the common prefix are looked up
+    PathCache& cache = path_caches_[i];
+    size_t prefix = 0;
+    while (prefix < cache.tokens.size() && prefix < hypothesis.size() &&
+           cache.tokens[prefix] == hypothesis[prefix]) {
+      ++prefix;
+    }
+    bool changed = prefix != cache.tokens.size() || prefix != hypothesis.size();
+    cache.tokens.resize(prefix);
+    cache.ends.resize(prefix);
+    cache.sentence.resize(prefix > 0 ? cache.ends.back() : 0);
+    for (size_t j = prefix; j < hypothesis.size(); j++) {
       // A detailed explanation of this if-else branch can be found in
       // https://github.com/wenet-e2e/wenet/issues/583#issuecomment-907994058
-      if (searcher_->Type() == kWfstBeamSearch) {
-        path.sentence += (' ' + word);
-      } else {
-        path.sentence += (word);
-      }
+      if (searcher_->Type() == kWfstBeamSearch) cache.sentence += ' ';
+      symbols_->Append(hypothesis[j], &cache.sentence);
+      cache.tokens.push_back(hypothesis[j]);
+      cache.ends.push_back(cache.sentence.size());
     }
 
     // TimeStamp is only supported in final result
@@ -155,12 +810,12 @@ void AsrDecoder::UpdateResult(bool finish) {
     // various FST operations when building the decoding graph. So here we use
     // time stamp of the input(e2e model unit), which is more accurate, and it
     // requires the symbol table of the e2e model used in training.
-    if (unit_table_ != nullptr && finish) {
+    if (units_ != nullptr && finish && i < times.size()) {
       const std::vector<int>& input = inputs[i];
       const std::vector<int>& time_stamp = times[i];
       CHECK_EQ(input.size(), time_stamp.size());
       for (size_t j = 0; j < input.size(); j++) {
-        std::string word = unit_table_->Find(input[j]);
+        std::string word = units_->Find(input[j]);
         int start = time_stamp[j] * frame_shift_in_ms() - time_stamp_gap_ > 0
                         ? time_stamp[j] * frame_shift_in_ms() - time_stamp_gap_
                         : 0;
@@ -184,10 +839,16 @@ void AsrDecoder::UpdateResult(bool finish) {
       }
     }
 
-    if (post_processor_ != nullptr) {
-      path.sentence = post_processor_->Process(path.sentence, finish);
+    if (post_processor_ == nullptr) {
+      path.sentence = cache.sentence;
+    } else if (finish) {
+      post_processor_->Process(cache.sentence, true, &path.sentence);
+    } else {
+      if (changed || cache.processed.empty()) {
+        post_processor_->Process(cache.sentence, false, &cache.processed);
+      }
+      path.sentence = cache.processed;
     }
-    result_.emplace_back(path);
   }
 
   if (DecodedSomething()) {
@@ -195,31 +856,140 @@ void AsrDecoder::UpdateResult(bool finish) {
   }
 }
 
-void AsrDecoder::AttentionRescoring() {
+bool AsrDecoder::GetWordLattice(WordLattice* lattice) {
+  if (!searcher_->GetWordLattice(lattice)) return false;
+  int offset = global_frame_offset_ * feature_frame_shift_in_ms();
+  for (int s = 0; s < lattice->num_states(); ++s) {
+    lattice->set_time(s, lattice->time(s) * frame_shift_in_ms() + offset);
+  }
+  return true;
+}
+
+bool AsrDecoder::FinalizeResult() {
   searcher_->FinalizeSearch();
   UpdateResult(true);
-  // No need to do rescoring
-  if (0.0 == opts_.rescoring_weight) {
-    return;
+  // No need to do rescoring, or nothing to rescore with
+  if (0.0 == opts_.rescoring_weight || !model_->has_decoder()) {
+    return false;
   }
   // Inputs() returns N-best input ids, which is the basic unit for rescoring
   // In CtcPrefixBeamSearch, inputs are the same to outputs
-  const auto& hypotheses = searcher_->Inputs();
-  int num_hyps = hypotheses.size();
+  int num_hyps = searcher_->Inputs().size();
   if (num_hyps <= 0) {
-    return;
+    return false;
+  }
+  if (opts_.rescoring_ctc_margin > 0) {
+    // The rescoring is skipped if the ctc 1-best leads by the margin
+    static Counter* num_skipped = Metrics::Instance().GetCounter(
+        "wenet_rescoring_skipped_total",
+        "Number of the rescorings skipped by the ctc margin");
+    float best = -kFloatMax, second = -kFloatMax;
+    for (int i = 0; i < num_hyps; ++i) {
+      if (result_[i].score > best) {
+        second = best;
+        best = result_[i].score;
+      } else if (result_[i].score > second) {
+        second = result_[i].score;
+      }
+    }
+    if (num_hyps == 1 || best - second > opts_.rescoring_ctc_margin) {
+      num_skipped->Increment();
+      return false;
+    }
   }
+  return true;
+}
 
+void AsrDecoder::AttentionRescoring() {
+  if (!FinalizeResult()) return;
+  const auto& hypotheses = searcher_->Inputs();
   std::vector<float> rescoring_score;
-  model_->AttentionRescoring(hypotheses, opts_.reverse_weight,
-                             &rescoring_score);
+  // The speculative rescorings are confirmed if they have all the hyps,
+  // which may be reordered by the finalization of the contexts
+  if (RescoreHyps(hypotheses, &rescoring_score) ==
+      static_cast<int>(hypotheses.size())) {
+    ConfirmedRescorings()->Increment();
+  }
+  CombineScores(rescoring_score, &result_);
+}
 
+void AsrDecoder::CombineScores(const std::vector<float>& rescoring_score,
+                               std::vector<DecodeResult>* result) const {
   // Combine ctc score and rescoring score
-  for (size_t i = 0; i < num_hyps; ++i) {
-    result_[i].score = opts_.rescoring_weight * rescoring_score[i] +
-                       opts_.ctc_weight * result_[i].score;
+  for (size_t i = 0; i < rescoring_score.size(); ++i) {
+    (*result)[i].score = opts_.rescoring_weight * rescoring_score[i] +
+                         opts_.ctc_weight * (*result)[i].score;
+  }
+  std::sort(result->begin(), result->end(), DecodeResult::CompareFunc);
+}
+
+void AsrDecoder::SpeculativeRescoring() {
+  static Counter* num_speculative = Metrics::Instance().GetCounter(
+      "wenet_speculative_rescoring_total",
+      "Number of the attention rescorings before the endpoint");
+  const auto& hypotheses = searcher_->Inputs();
+  if (hypotheses.empty()) return;
+  TraceScope trace(trace_id_, "speculative_rescoring");
+  speculated_ = true;
+  std::vector<float> rescoring_score;
+  if (RescoreHyps(hypotheses, &rescoring_score) <
+      static_cast<int>(hypotheses.size())) {
+    num_speculative->Increment();
+  }
+}
+
+int AsrDecoder::RescoreHyps(const std::vector<std::vector<int>>& hyps,
+                            std::vector<float>* rescoring_score) {
+  rescoring_score->resize(hyps.size());
+  std::vector<std::vector<int>> unique_hyps;
+  std::vector<int> index;
+  int hits = LookupRescoring(hyps, rescoring_score, &unique_hyps, &index);
+  if (unique_hyps.empty()) return hits;
+  std::vector<float> scores;
+  RescoreUniqueHyps(model_.get(), unique_hyps, &scores);
+  for (size_t i = 0; i < unique_hyps.size(); ++i) {
+    rescoring_cache_.Insert(rescoring_segment_, unique_hyps[i], scores[i]);
+  }
+  for (size_t i = 0; i < hyps.size(); ++i) {
+    if (index[i] >= 0) (*rescoring_score)[i] = scores[index[i]];
+  }
+  return hits;
+}
+
+int AsrDecoder::LookupRescoring(const std::vector<std::vector<int>>& hyps,
+                                std::vector<float>* rescoring_score,
+                                std::vector<std::vector<int>>* unique_hyps,
+                                std::vector<int>* index) {
+  static Counter* num_hits = Metrics::Instance().GetCounter(
+      "wenet_rescoring_cache_hits_total",
+      "Number of the hyps whose rescoring score is cached");
+  // The same token sequence of different words, e.g. of the wfst search,
+  // is rescored once, -1 for the cached ones
+  index->assign(hyps.size(), -1);
+  int hits = 0;
+  for (size_t i = 0; i < hyps.size(); ++i) {
+    if (rescoring_cache_.Lookup(rescoring_segment_, hyps[i],
+                                &(*rescoring_score)[i])) {
+      ++hits;
+      continue;
+    }
+    auto it = std::find(unique_hyps->begin(), unique_hyps->end(), hyps[i]);
+    (*index)[i] = it - unique_hyps->begin();
+    if (it == unique_hyps->end()) unique_hyps->push_back(hyps[i]);
+  }
+  num_hits->Increment(hits);
+  return hits;
+}
+
+void AsrDecoder::RescoreUniqueHyps(
+    AsrModel* model, const std::vector<std::vector<int>>& unique_hyps,
+    std::vector<float>* scores) const {
+  if (rescoring_scheduler_ != nullptr) {
+    rescoring_scheduler_->AttentionRescoring(model, unique_hyps,
+                                             opts_.reverse_weight, scores);
+  } else {
+    model->AttentionRescoring(unique_hyps, opts_.reverse_weight, scores);
   }
-  std::sort(result_.begin(), result_.end(), DecodeResult::CompareFunc);
 }
 
 }  // namespace wenet
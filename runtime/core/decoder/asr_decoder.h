@@ -17,6 +17,8 @@
 #ifndef DECODER_ASR_DECODER_H_
 #define DECODER_ASR_DECODER_H_
 
+#include <deque>
+#include <future>
 #include <memory>
 #include <string>
 #include <utility>
@@ -25,15 +27,34 @@
 #include "fst/fstlib.h"
 #include "fst/symbol-table.h"
 
+#include "decoder/adaptive_beam.h"
+#include "decoder/adaptive_chunk.h"
 #include "decoder/asr_model.h"
 #include "decoder/batch_asr_model.h"
+#include "decoder/chunk_scheduler.h"
 #include "decoder/context_graph.h"
 #include "decoder/ctc_endpoint.h"
+#include "decoder/ctc_lg_beam_search.h"
 #include "decoder/ctc_prefix_beam_search.h"
 #include "decoder/ctc_wfst_beam_search.h"
+#include "decoder/decode_result.h"
+#include "decoder/feature_placement.h"
+#include "decoder/language_model.h"
+#include "decoder/lattice_rescorer.h"
+#include "decoder/model_replicas.h"
+#include "decoder/posterior_dump.h"
+#include "decoder/rescoring_cache.h"
+#include "decoder/rescoring_scheduler.h"
 #include "decoder/search_interface.h"
+#include "decoder/word_lattice.h"
 #include "frontend/feature_pipeline.h"
 #include "post_processor/post_processor.h"
+#include "utils/arena.h"
+#include "utils/matrix.h"
+#include "utils/memory_budget.h"
+#include "utils/state_io.h"
+#include "utils/symbol_map.h"
+#include "utils/thread_pool.h"
 #include "utils/utils.h"
 
 namespace wenet {
@@ -44,6 +65,8 @@ struct DecodeOptions {
   // one chunk are 64 = 16*4
   int chunk_size = 16;
   int num_left_chunks = -1;
+  AdaptiveChunkOptions adaptive_chunk_opts;
+  AdaptiveBeamOptions adaptive_beam_opts;
 
   // final_score = rescoring_weight * rescoring_score + ctc_weight * ctc_score;
   // rescoring_score = left_to_right_score * (1 - reverse_weight) +
@@ -56,30 +79,70 @@ struct DecodeOptions {
   float ctc_weight = 0.5;
   float rescoring_weight = 1.0;
   float reverse_weight = 0.0;
+  // Skip the attention rescoring if the ctc score of the 1-best is more than
+  // it above the others, where the rescoring is unlikely to change the
+  // 1-best, so are the single hyps. 0 disables it.
+  float rescoring_ctc_margin = 0.0;
   CtcEndpointConfig ctc_endpoint_config;
+  // For CtcPrefixBeamSearch, only copy the top first_beam_size ctc log probs
+  // of each frame out of the model, which does the topk on the device or in
+  // the graph if supported, and the top sparse_topk for CtcWfstBeamSearch
+  // if it's set
+  bool enable_topk_ctc = false;
+  // For BatchAsrDecoder with the torch model, run the prefix beam search or
+  // the wfst beam search of the batch on the device, see
+  // BatchCtcPrefixBeamSearch and BatchCtcWfstBeamSearch
+  bool gpu_ctc_search = false;
+  // For BatchAsrDecoder, sort the utterances of a batch by length and split
+  // them into sub batches of at most max_batch_frames padded feature frames,
+  // so the short ones aren't padded to the longest. The results are in the
+  // order of the batch. 0 disables it.
+  int max_batch_frames = 0;
+  // For BatchAsrDecoder, decode the utterances of a batch chunk by chunk by
+  // the streaming model of the resource, in continuous decoding, instead of
+  // one full context forward of the batch model. The chunks of the
+  // utterances are forwarded together by the chunk scheduler of the
+  // resource, with the caches of each, so the memory is of the chunks of the
+  // batch rather than of the whole length, e.g. for the long recordings.
+  bool streaming_batch = false;
+  // Skip the encoder forward of the full chunks which are all silence by
+  // the Vad of the FeaturePipeline, whose frames are searched as blank, so
+  // the timestamps and the endpoint stay as they are. Only for streaming,
+  // and the enable_vad of FeaturePipelineConfig is required.
+  bool skip_silent_chunks = false;
+  // For CtcPrefixBeamSearch, start the attention rescoring of the nbest
+  // when the trailing silence is over it, before the endpoint, so the
+  // rescoring is done while the rest of the silence streams in. It's
+  // confirmed by the Rescoring() at the endpoint if the nbest stays the
+  // same, or discarded if speech resumes. 0 disables it.
+  int speculative_rescoring_ms = 0;
+  // Number of the rescoring scores of the hyps kept by the session, so the
+  // hyps rescored by the speculative rescorings are not rescored again at
+  // the endpoint, even if the nbest is changed. 0 disables it.
+  int rescoring_cache_size = 64;
+  // For CtcPrefixBeamSearch, rescore the partial nbest by the attention
+  // decoder at most once every second_pass_chunks chunks, when the session
+  // waits for the audio, see AsrDecoder::SecondPassPartial(). 0 disables it.
+  int second_pass_chunks = 0;
+  // The cpu budget of the second pass partials: the max ratio of their time
+  // to the first pass time of the session, and the max cpu usage of the
+  // machine, over which they're skipped
+  float second_pass_budget = 0.2;
+  float second_pass_max_cpu_usage = 0.8;
+  // For the servers decoding the streams on a shared pool, the latency
+  // target of the audio of a session, the decoding tasks are run by the
+  // earliest deadline of their audio, and the sessions past it are decoded
+  // coarser, see ChunkDeadline and AsrDecoder::set_late(). 0 disables it.
+  int chunk_deadline_ms = 0;
+  // Offload the caches of the model out of the device when the session has
+  // skipped the silent chunks for it, e.g. the long pauses of a meeting,
+  // they're restored by the next forward. It takes skip_silent_chunks,
+  // and 0 disables it.
+  int offload_idle_ms = 0;
   CtcPrefixBeamSearchOptions ctc_prefix_search_opts;
   CtcWfstBeamSearchOptions ctc_wfst_search_opts;
 };
 
-struct WordPiece {
-  std::string word;
-  int start = -1;
-  int end = -1;
-
-  WordPiece(std::string word, int start, int end)
-      : word(std::move(word)), start(start), end(end) {}
-};
-
-struct DecodeResult {
-  float score = -kFloatMax;
-  std::string sentence;
-  std::vector<WordPiece> word_pieces;
-
-  static bool CompareFunc(const DecodeResult& a, const DecodeResult& b) {
-    return a.score > b.score;
-  }
-};
-
 enum DecodeState {
   kEndBatch = 0x00,  // End of current decoding batch, normal case
   kEndpoint = 0x01,  // Endpoint is detected
@@ -91,26 +154,119 @@ enum DecodeState {
 // decoding threads
 struct DecodeResource {
   std::shared_ptr<AsrModel> model = nullptr;
+  // Optional, the replicas of the model, e.g. one per GPU, of which model
+  // is the first. A session is placed on the least loaded one.
+  std::shared_ptr<ModelReplicas> model_replicas = nullptr;
   std::shared_ptr<BatchAsrModel> batch_model = nullptr;
   std::shared_ptr<fst::SymbolTable> symbol_table = nullptr;
   std::shared_ptr<fst::Fst<fst::StdArc>> fst = nullptr;
+  // Optional, rescore the final lattices of the wfst search by a larger LM
+  // than the G of fst
+  std::shared_ptr<const LatticeRescorer> lattice_rescorer = nullptr;
   std::shared_ptr<fst::SymbolTable> unit_table = nullptr;
+  // The SymbolMaps of symbol_table and unit_table for the lookups of the
+  // decoders, see BuildSymbolMaps(). A decoder builds its own without them.
+  std::shared_ptr<const SymbolMap> symbol_map = nullptr;
+  std::shared_ptr<const SymbolMap> unit_map = nullptr;
   std::shared_ptr<ContextGraph> context_graph = nullptr;
+  // Optional, the LanguageModel of the shallow fusion in the prefix beam
+  // search, of which each session uses a Copy()
+  std::shared_ptr<LanguageModel> language_model = nullptr;
   std::shared_ptr<PostProcessor> post_processor = nullptr;
+  // Optional, the fbank tables shared by the FeaturePipelines of the
+  // sessions, which build their own if it's not set
+  std::shared_ptr<const FbankTables> fbank_tables = nullptr;
+  // Optional, batch the encoder forward of chunks across decoding sessions
+  std::shared_ptr<ChunkScheduler> chunk_scheduler = nullptr;
+  // Optional, batch the end of utterance rescoring across decoding sessions
+  std::shared_ptr<RescoringScheduler> rescoring_scheduler = nullptr;
+  // Optional, long-lived workers for the feature and search stages of
+  // batch decoding
+  std::shared_ptr<ThreadPool> thread_pool = nullptr;
+  // Optional, where the segments of the continuous decoding are rescored
+  // while the next ones are decoded, see AsrDecoder::FinishSegment()
+  std::shared_ptr<ThreadPool> rescoring_pool = nullptr;
+  // Optional, where the fbank of the batches is computed, shared by the
+  // batch decoders so the GPU load is counted across them. The decoders
+  // place their own batches by the default options if it's not set.
+  std::shared_ptr<FeaturePlacer> feature_placer = nullptr;
 };
 
+// Build the SymbolMaps of the symbol tables of the resource. The tags of the
+// contexts are added to symbol_table first, so the contexts built later,
+// e.g. of the sessions, are built by the symbol_map.
+void BuildSymbolMaps(DecodeResource* resource);
+// `map` if it's set, or the SymbolMap of `table`
+std::shared_ptr<const SymbolMap> SymbolMapOf(
+    const std::shared_ptr<const SymbolMap>& map,
+    const std::shared_ptr<fst::SymbolTable>& table);
+
 // Torch ASR decoder
 class AsrDecoder {
  public:
+  // context_graph: optional contexts of this session, which is usually an
+  // overlay on resource->context_graph, and is used instead of it if set
   AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
              std::shared_ptr<DecodeResource> resource,
-             const DecodeOptions& opts);
+             const DecodeOptions& opts,
+             std::shared_ptr<ContextGraph> context_graph = nullptr);
+  ~AsrDecoder();
   // @param block: if true, block when feature is not enough for one chunk
   //               inference. Otherwise, return kWaitFeats.
   DecodeState Decode(bool block = true);
   void Rescoring();
+  // Whether the partial result is due for the second pass, see
+  // DecodeOptions::second_pass_chunks. The servers ask it when Decode()
+  // returns kWaitFeats, and run SecondPassPartial() on a low priority task.
+  bool SecondPassDue();
+  // Whether the session is past the real time deadline of its audio, e.g.
+  // by ChunkDeadline of the servers, which is decoded coarser until it
+  // catches up: the beams are narrowed to min_beam_scale of
+  // AdaptiveBeamOptions and the second pass partials are skipped. It's
+  // false after Reset().
+  void set_late(bool late);
+  // Rerank the partial result by the attention rescoring of its nbest,
+  // return false if it's not due
+  bool SecondPassPartial();
+  // Offline, decode the whole waveform at once and rescore the result. The
+  // features are computed in one batch, bypassing the feature pipeline, and
+  // the encoder is run in one forward of full context instead of chunks,
+  // so neither the chunk scheduler nor the endpoint is involved. The
+  // session is Reset() first, don't mix it with Decode().
+  void DecodeUtterance(const float* pcm, int num_samples);
+  // Record the ctc log probs of the chunks as they are searched, to be
+  // taken by TakePosteriors(), e.g. for the search sweeps of
+  // posterior_search. The full ones are reduced to the top `topk` of each
+  // frame if topk > 0. It's kept after Reset(), not for the continuous
+  // decoding.
+  void set_record_posteriors(bool record, int topk = 0) {
+    record_posteriors_ = record;
+    record_topk_ = topk;
+  }
+  // Move the chunks recorded since Reset() to `record`, with the model state
+  // after the last chunk for the rescoring, which is empty if the model
+  // can't save it. The key of the record is left to the caller.
+  void TakePosteriors(PosteriorRecord* record);
+  // Search the chunks of the record by the options of this decoder, and
+  // rescore the result by the model state of the record if it has one, as
+  // DecodeUtterance() does the waveform. The session is Reset() first, and
+  // no endpoint is detected.
+  void DecodePosteriors(const PosteriorRecord& record);
   void Reset();
   void ResetContinuousDecoding();
+  // Continuous decoding without waiting for the rescoring at the endpoint:
+  // the result of the segment is finalized and its nbest is rescored on
+  // the rescoring_pool of the resource, by the model holding the encoder
+  // outputs of the segment, while the next segment is decoded on another
+  // copy of the model. Then the final result of the segment is taken by
+  // PopSegmentResult(). It's Rescoring() and ResetContinuousDecoding() if
+  // there is no rescoring pool, or the session is profiled.
+  void FinishSegment();
+  // The final result of the earliest finished segment, false if there is
+  // none, or if it's being rescored and !block. The segments are popped in
+  // their order, and are dropped by Reset().
+  bool PopSegmentResult(std::vector<DecodeResult>* result, bool block = false);
+  int num_pending_segments() const { return segments_.size(); }
   bool DecodedSomething() const {
     return !result_.empty() && !result_[0].sentence.empty();
   }
@@ -129,22 +285,113 @@ class AsrDecoder {
            feature_pipeline_->config().sample_rate;
   }
   const std::vector<DecodeResult>& result() const { return result_; }
+  // The word lattice of the final result, with the times in ms as the word
+  // pieces, e.g. for the keyword search. It's only of the wfst search,
+  // false for the prefix search. The words are of the symbol table.
+  bool GetWordLattice(WordLattice* lattice);
+  // The bytes of the states of the session by component. They're updated
+  // to the server-wide gauges after every chunk, and are removed when the
+  // decoder is destroyed, see SessionMemoryTracker.
+  void GetMemoryUsage(SessionMemory* usage) const;
+  // The usage as of the last chunk
+  const SessionMemory& memory_usage() const { return memory_tracker_.usage(); }
+  // Record the stages of each chunk to the Tracer for the session if it's
+  // not 0, see utils/trace.h. It's set at the start of every request, which
+  // may be captured by the Profiler, until it's set again or the decoder
+  // is destroyed.
+  void set_trace_id(uint64_t trace_id);
+  // The paths of the partial results, e.g. the nbest the client asks for,
+  // the others are not built until the final result. All of them are built
+  // for the second pass partials, which rerank them. It's 1 after Reset().
+  void set_partial_nbest(int nbest) { partial_nbest_ = nbest; }
+  uint64_t trace_id() const { return trace_id_; }
+  // Save the state of the session, i.e. the frames not decoded yet, the
+  // model caches and the hypotheses of the search, to `state`, which is
+  // loaded by the decoder of another process with the same resource and
+  // options to continue the session, e.g. to migrate it off a draining
+  // server. The session must be paused, no waveform is accepted and no
+  // Decode() runs while saving. The rescoring is done again from the loaded
+  // encoder outputs. False if the model, the search, or the pipeline
+  // doesn't support it, e.g. the wfst search or the LanguageModel fusion.
+  bool SaveState(std::string* state);
+  // Load the state on a decoder just constructed or Reset(), before any
+  // input. False if the state is corrupted or of other options, after which
+  // the decoder is to be Reset().
+  bool LoadState(const std::string& state);
 
  private:
   DecodeState AdvanceDecoding(bool block = true);
   void AttentionRescoring();
+  // Rescore the nbest before the endpoint, see speculative_rescoring_ms
+  void SpeculativeRescoring();
+  // Finalize the search and the final result, return whether the nbest is
+  // to be rescored
+  bool FinalizeResult();
+  // The rescoring scores of `hyps` by the model or the rescoring scheduler,
+  // the ones in rescoring_cache_ are not rescored, return the number of them
+  int RescoreHyps(const std::vector<std::vector<int>>& hyps,
+                  std::vector<float>* rescoring_score);
+  // Set the scores of the hyps in rescoring_cache_, the others are added to
+  // unique_hyps once, index: of each hyp in unique_hyps, -1 for the cached.
+  // Return the number of the cached ones.
+  int LookupRescoring(const std::vector<std::vector<int>>& hyps,
+                      std::vector<float>* rescoring_score,
+                      std::vector<std::vector<int>>* unique_hyps,
+                      std::vector<int>* index);
+  // The scores of unique_hyps by `model`, which is thread safe with the
+  // other sessions' models by the rescoring scheduler
+  void RescoreUniqueHyps(AsrModel* model,
+                         const std::vector<std::vector<int>>& unique_hyps,
+                         std::vector<float>* scores) const;
+  // Combine the ctc scores of `result` with the rescoring scores, and sort
+  // it by the final scores
+  void CombineScores(const std::vector<float>& rescoring_score,
+                     std::vector<DecodeResult>* result) const;
+
+  // A segment finished by FinishSegment(), the model and the hyps are
+  // only accessed by the rescoring task until `done` is ready
+  struct Segment {
+    std::vector<DecodeResult> result;
+    std::shared_ptr<AsrModel> model;
+    std::vector<std::vector<int>> unique_hyps;
+    std::vector<int> index;
+    std::vector<float> rescoring_score;
+    int64_t encoder_outs_bytes = 0;
+    // Invalid if the segment is not rescored
+    std::future<void> done;
+  };
+  void RescoreSegment(Segment* segment) const;
+  // Wait for the rescoring of the pending segments and drop them
+  void DropSegments();
 
   void UpdateResult(bool finish = false);
+  // Append the searched chunk to recorded_chunks_, which is of
+  // ctc_log_probs_ if !topk
+  void RecordChunk(bool topk,
+                   const std::vector<std::vector<float>>& topk_scores,
+                   const std::vector<std::vector<int32_t>>& topk_indexs);
+  // The beam scale of the search, of the adaptive beam and set_late()
+  float SearchBeamScale() const;
+  // Record the span of `stage` from `start_ns` to now for the current chunk,
+  // and return now, which is the start of the next stage
+  int64_t TraceStage(const char* stage, int64_t start_ns);
+  void UpdateMemoryUsage();
 
   std::shared_ptr<FeaturePipeline> feature_pipeline_;
+  std::shared_ptr<ModelReplicas> model_replicas_;
+  // The replica the session is placed on
+  int replica_;
   std::shared_ptr<AsrModel> model_;
   std::shared_ptr<PostProcessor> post_processor_;
+  std::shared_ptr<ChunkScheduler> chunk_scheduler_;
+  std::shared_ptr<RescoringScheduler> rescoring_scheduler_;
+  std::shared_ptr<ThreadPool> rescoring_pool_;
 
   std::shared_ptr<fst::Fst<fst::StdArc>> fst_ = nullptr;
-  // output symbol table
-  std::shared_ptr<fst::SymbolTable> symbol_table_;
-  // e2e unit symbol table
-  std::shared_ptr<fst::SymbolTable> unit_table_ = nullptr;
+  // output symbols
+  std::shared_ptr<const SymbolMap> symbols_;
+  // e2e unit symbols
+  std::shared_ptr<const SymbolMap> units_ = nullptr;
   const DecodeOptions& opts_;
   // cache feature
   bool start_ = false;
@@ -153,11 +400,67 @@ class AsrDecoder {
   int global_frame_offset_ = 0;
   const int time_stamp_gap_ = 100;  // timestamp gap between words in a sentence
 
+  // The memory of the search of the session, which outlives the searcher
+  Arena arena_;
   std::unique_ptr<SearchInterface> searcher_;
   std::unique_ptr<CtcEndpoint> ctc_endpointer_;
+  SessionMemoryTracker memory_tracker_;
 
   int num_frames_in_current_chunk_ = 0;
   std::vector<DecodeResult> result_;
+  int partial_nbest_ = 1;
+  // The sentences of the last result, by the rank of the path. The next
+  // UpdateResult keeps the units of the common prefix of the tokens, and
+  // reuses the processed sentence if the tokens stay the same.
+  struct PathCache {
+    std::vector<int> tokens;
+    // The end of the unit of each token in sentence
+    std::vector<size_t> ends;
+    std::string sentence;
+    std::string processed;
+  };
+  std::vector<PathCache> path_caches_;
+  // The output dim of the model, known after the first forward, which is
+  // required to search a skipped chunk by the full log probs
+  int vocab_size_ = 0;
+  // The [T, vocab] ctc log probs of the chunk, reused across the chunks
+  Matrix<float> ctc_log_probs_;
+  // The [T, k] topk ctc log probs and token ids of the chunk, reused across
+  // the chunks as well
+  std::vector<std::vector<float>> topk_scores_;
+  std::vector<std::vector<int32_t>> topk_indexs_;
+  // See set_record_posteriors()
+  bool record_posteriors_ = false;
+  int record_topk_ = 0;
+  std::vector<PosteriorChunk> recorded_chunks_;
+  // The chunk size of the session, see AdaptiveChunkOptions
+  int chunk_size_;
+  // The beam scale of the search of the session, see AdaptiveBeamOptions
+  float beam_scale_ = 1.0;
+  // See set_late()
+  bool late_ = false;
+  // The rescoring scores of the hyps by the segment of the encoder output.
+  // A new segment starts when the continuous decoding is reset, or speech
+  // resumes after the speculative rescoring or the second pass.
+  RescoringCache rescoring_cache_;
+  int rescoring_segment_ = 0;
+  bool speculated_ = false;
+  // The chunk of the last second pass, and the time of the passes, see
+  // DecodeOptions::second_pass_budget
+  int second_pass_chunk_ = 0;
+  int64_t first_pass_us_ = 0;
+  int64_t second_pass_us_ = 0;
+  // The silence skipped since the last forward
+  int idle_ms_ = 0;
+  // The segments finished by FinishSegment() by their order, and the model
+  // of a popped one, which is reused by the next segment
+  std::deque<std::unique_ptr<Segment>> segments_;
+  std::shared_ptr<AsrModel> spare_model_;
+
+  uint64_t trace_id_ = 0;
+  // Whether the request is captured by the Profiler
+  bool profiled_ = false;
+  int num_chunks_ = 0;
 
  public:
   WENET_DISALLOW_COPY_AND_ASSIGN(AsrDecoder);
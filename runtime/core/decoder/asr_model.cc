@@ -3,9 +3,13 @@
 
 #include "decoder/asr_model.h"
 
+#include <map>
 #include <memory>
 #include <utility>
 
+#include "utils/log.h"
+#include "utils/stage_timer.h"
+
 namespace wenet {
 
 int AsrModel::num_frames_for_chunk(bool start) const {
@@ -23,6 +27,32 @@ int AsrModel::num_frames_for_chunk(bool start) const {
   return num_required_frames;
 }
 
+bool AsrModel::SaveState(StateWriter* writer) const {
+  writer->Write(chunk_size_);
+  writer->Write(num_left_chunks_);
+  writer->Write(offset_);
+  writer->Write<uint64_t>(cached_feature_.size());
+  for (const auto& frame : cached_feature_) writer->WriteVector(frame);
+  return SaveStateFunc(writer);
+}
+
+bool AsrModel::LoadState(StateReader* reader) {
+  int chunk_size = 0;
+  int num_left_chunks = 0;
+  uint64_t num_cached = 0;
+  if (!reader->Read(&chunk_size) || chunk_size != chunk_size_ ||
+      !reader->Read(&num_left_chunks) || num_left_chunks != num_left_chunks_ ||
+      !reader->Read(&offset_) || !reader->Read(&num_cached) ||
+      num_cached > reader->remaining() / sizeof(uint64_t)) {
+    return false;
+  }
+  cached_feature_.resize(num_cached);
+  for (auto& frame : cached_feature_) {
+    if (!reader->ReadVector(&frame)) return false;
+  }
+  return LoadStateFunc(reader);
+}
+
 void AsrModel::CacheFeature(
     const std::vector<std::vector<float>>& chunk_feats) {
   // Cache feature for next chunk
@@ -40,15 +70,271 @@ void AsrModel::CacheFeature(
   }
 }
 
+void AsrModel::CacheFeature(const FeatureView& chunk_feats) {
+  const int cached_feature_size = 1 + right_context_ - subsampling_rate_;
+  if (chunk_feats.num_frames() >= cached_feature_size) {
+    cached_feature_.resize(cached_feature_size);
+    const int dim = chunk_feats.feature_dim();
+    int start = chunk_feats.num_frames() - cached_feature_size;
+    for (int i = 0; i < cached_feature_size; ++i) {
+      const float* frame = chunk_feats.frame(start + i);
+      cached_feature_[i].assign(frame, frame + dim);
+    }
+  }
+}
+
+// The model part of the encoder forward of a chunk, without the wait in the
+// chunk scheduler
+static StageStats* ForwardStats() {
+  static StageStats* stats = StageStats::Get(
+      "wenet_model_forward_seconds",
+      "Encoder forward latency of the model of a chunk");
+  return stats;
+}
+
 void AsrModel::ForwardEncoder(
     const std::vector<std::vector<float>>& chunk_feats,
     std::vector<std::vector<float>>* ctc_prob) {
   ctc_prob->clear();
   int num_frames = cached_feature_.size() + chunk_feats.size();
   if (num_frames >= right_context_ + 1) {
+    StageTimer stage(ForwardStats());
     this->ForwardEncoderFunc(chunk_feats, ctc_prob);
     this->CacheFeature(chunk_feats);
   }
 }
 
+void AsrModel::ForwardEncoder(const FeatureView& chunk_feats,
+                              std::vector<std::vector<float>>* ctc_prob) {
+  ctc_prob->clear();
+  int num_frames = cached_feature_.size() + chunk_feats.num_frames();
+  if (num_frames >= right_context_ + 1) {
+    StageTimer stage(ForwardStats());
+    this->ForwardEncoderFunc(chunk_feats, ctc_prob);
+    this->CacheFeature(chunk_feats);
+  }
+}
+
+void AsrModel::ForwardEncoder(const FeatureView& chunk_feats,
+                              Matrix<float>* ctc_prob) {
+  ctc_prob->Clear();
+  int num_frames = cached_feature_.size() + chunk_feats.num_frames();
+  if (num_frames >= right_context_ + 1) {
+    StageTimer stage(ForwardStats());
+    this->ForwardEncoderFunc(chunk_feats, ctc_prob);
+    this->CacheFeature(chunk_feats);
+  }
+}
+
+void AsrModel::ForwardEncoderFunc(const FeatureView& chunk_feats,
+                                  Matrix<float>* ctc_prob) {
+  std::vector<std::vector<float>> probs;
+  this->ForwardEncoderFunc(chunk_feats, &probs);
+  ctc_prob->CopyFrom(probs);
+}
+
+void AsrModel::ForwardEncoderFunc(const FeatureView& chunk_feats,
+                                  std::vector<std::vector<float>>* ctc_prob) {
+  std::vector<std::vector<float>> feats(chunk_feats.num_frames());
+  for (int i = 0; i < chunk_feats.num_frames(); ++i) {
+    feats[i].assign(chunk_feats.frame(i),
+                    chunk_feats.frame(i) + chunk_feats.feature_dim());
+  }
+  this->ForwardEncoderFunc(feats, ctc_prob);
+}
+
+void AsrModel::ForwardEncoderTopK(
+    const FeatureView& chunk_feats, int k,
+    std::vector<std::vector<float>>* topk_scores,
+    std::vector<std::vector<int32_t>>* topk_indexs) {
+  int num_frames = cached_feature_.size() + chunk_feats.num_frames();
+  if (num_frames >= right_context_ + 1) {
+    // The frames of the outputs are resized and assigned, so the topk of
+    // the last chunk reuse their capacity
+    StageTimer stage(ForwardStats());
+    this->ForwardEncoderTopKFunc(chunk_feats, k, topk_scores, topk_indexs);
+    this->CacheFeature(chunk_feats);
+  } else {
+    topk_scores->clear();
+    topk_indexs->clear();
+  }
+}
+
+void AsrModel::ForwardEncoderTopKFunc(
+    const FeatureView& chunk_feats, int k,
+    std::vector<std::vector<float>>* topk_scores,
+    std::vector<std::vector<int32_t>>* topk_indexs) {
+  std::vector<std::vector<float>> ctc_prob;
+  this->ForwardEncoderFunc(chunk_feats, &ctc_prob);
+  topk_scores->resize(ctc_prob.size());
+  topk_indexs->resize(ctc_prob.size());
+  for (size_t i = 0; i < ctc_prob.size(); ++i) {
+    TopK(ctc_prob[i], k, &(*topk_scores)[i], &(*topk_indexs)[i]);
+  }
+}
+
+void AsrModel::ForwardEncoderBatch(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+    const std::vector<std::vector<std::vector<float>>*>& ctc_probs) {
+  CHECK_EQ(models.size(), chunk_feats.size());
+  CHECK_EQ(models.size(), ctc_probs.size());
+  std::vector<AsrModel*> valid_models;
+  std::vector<const std::vector<std::vector<float>>*> valid_feats;
+  std::vector<std::vector<std::vector<float>>*> valid_probs;
+  for (size_t i = 0; i < models.size(); ++i) {
+    ctc_probs[i]->clear();
+    int num_frames = models[i]->cached_feature_.size() + chunk_feats[i]->size();
+    if (num_frames >= models[i]->right_context_ + 1) {
+      valid_models.push_back(models[i]);
+      valid_feats.push_back(chunk_feats[i]);
+      valid_probs.push_back(ctc_probs[i]);
+    }
+  }
+  if (valid_models.empty()) return;
+  static StageStats* batch_stats = StageStats::Get(
+      "wenet_model_batch_forward_seconds",
+      "Encoder forward latency of the model of a batch of chunks");
+  StageTimer stage(batch_stats);
+  // The sessions of each replica are forwarded by it
+  std::map<int, std::vector<int>> replicas;
+  for (size_t i = 0; i < valid_models.size(); ++i) {
+    replicas[valid_models[i]->replica()].push_back(i);
+  }
+  if (replicas.size() == 1) {
+    valid_models[0]->ForwardEncoderBatchFunc(valid_models, valid_feats,
+                                             valid_probs);
+  } else {
+    for (const auto& replica : replicas) {
+      std::vector<AsrModel*> group_models;
+      std::vector<const std::vector<std::vector<float>>*> group_feats;
+      std::vector<std::vector<std::vector<float>>*> group_probs;
+      for (int i : replica.second) {
+        group_models.push_back(valid_models[i]);
+        group_feats.push_back(valid_feats[i]);
+        group_probs.push_back(valid_probs[i]);
+      }
+      group_models[0]->ForwardEncoderBatchFunc(group_models, group_feats,
+                                               group_probs);
+    }
+  }
+  for (size_t i = 0; i < valid_models.size(); ++i) {
+    valid_models[i]->CacheFeature(*valid_feats[i]);
+  }
+}
+
+void AsrModel::ForwardEncoderBatchFunc(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+    const std::vector<std::vector<std::vector<float>>*>& ctc_probs) {
+  for (size_t i = 0; i < models.size(); ++i) {
+    models[i]->ForwardEncoderFunc(*chunk_feats[i], ctc_probs[i]);
+  }
+}
+
+void AsrModel::AttentionRescoringBatch(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<int>>*>& hyps,
+    float reverse_weight,
+    const std::vector<std::vector<float>*>& rescoring_scores) {
+  CHECK_EQ(models.size(), hyps.size());
+  CHECK_EQ(models.size(), rescoring_scores.size());
+  if (models.empty()) return;
+  std::map<int, std::vector<int>> replicas;
+  for (size_t i = 0; i < models.size(); ++i) {
+    replicas[models[i]->replica()].push_back(i);
+  }
+  if (replicas.size() == 1) {
+    models[0]->AttentionRescoringBatchFunc(models, hyps, reverse_weight,
+                                           rescoring_scores);
+    return;
+  }
+  for (const auto& replica : replicas) {
+    std::vector<AsrModel*> group_models;
+    std::vector<const std::vector<std::vector<int>>*> group_hyps;
+    std::vector<std::vector<float>*> group_scores;
+    for (int i : replica.second) {
+      group_models.push_back(models[i]);
+      group_hyps.push_back(hyps[i]);
+      group_scores.push_back(rescoring_scores[i]);
+    }
+    group_models[0]->AttentionRescoringBatchFunc(group_models, group_hyps,
+                                                 reverse_weight, group_scores);
+  }
+}
+
+void AsrModel::Warmup(int feature_dim, const std::vector<int>& chunk_sizes,
+                      const std::vector<int>& batch_sizes, int num_chunks,
+                      int num_hyps) const {
+  // Frames of the chunk of the non streaming case
+  const int kFullChunkFrames = 500;
+  Timer timer;
+  // Hyps of different lengths, the tokens don't matter
+  std::vector<std::vector<int>> hyps(num_hyps);
+  for (int i = 0; i < num_hyps; ++i) {
+    hyps[i].assign(i + 1, 0);
+  }
+  float reverse_weight = is_bidirectional_decoder_ ? 0.5 : 0.0;
+  for (int chunk_size : chunk_sizes) {
+    for (int batch_size : batch_sizes) {
+      CHECK_GT(batch_size, 0);
+      std::vector<std::shared_ptr<AsrModel>> copies;
+      std::vector<AsrModel*> models;
+      for (int i = 0; i < batch_size; ++i) {
+        copies.emplace_back(Copy());
+        copies[i]->set_chunk_size(chunk_size);
+        copies[i]->set_num_left_chunks(num_left_chunks_);
+        models.push_back(copies[i].get());
+      }
+      std::vector<std::vector<std::vector<float>>> probs(batch_size);
+      std::vector<std::vector<std::vector<float>>*> prob_ptrs;
+      for (auto& prob : probs) prob_ptrs.push_back(&prob);
+      for (int i = 0; i < num_chunks; ++i) {
+        int num_frames = chunk_size > 0
+                             ? models[0]->num_frames_for_chunk(i == 0)
+                             : kFullChunkFrames;
+        std::vector<std::vector<float>> feats(
+            num_frames, std::vector<float>(feature_dim, 0.0f));
+        std::vector<const std::vector<std::vector<float>>*> feat_ptrs(
+            batch_size, &feats);
+        if (batch_size == 1) {
+          models[0]->ForwardEncoder(feats, &probs[0]);
+        } else {
+          ForwardEncoderBatch(models, feat_ptrs, prob_ptrs);
+        }
+        // The whole utterance is one chunk in the non streaming case
+        if (chunk_size <= 0) break;
+      }
+      // Nothing to rescore with in the ctc only mode
+      if (has_decoder_) {
+        std::vector<std::vector<float>> scores(batch_size);
+        std::vector<std::vector<float>*> score_ptrs;
+        for (auto& score : scores) score_ptrs.push_back(&score);
+        if (batch_size == 1) {
+          models[0]->AttentionRescoring(hyps, reverse_weight, &scores[0]);
+        } else {
+          std::vector<const std::vector<std::vector<int>>*> hyps_ptrs(
+              batch_size, &hyps);
+          AttentionRescoringBatch(models, hyps_ptrs, reverse_weight,
+                                  score_ptrs);
+        }
+      }
+      VLOG(1) << "Warmup chunk size " << chunk_size << " batch size "
+              << batch_size;
+    }
+  }
+  LOG(INFO) << "Warmup the model in " << timer.Elapsed() << "ms";
+}
+
+void AsrModel::AttentionRescoringBatchFunc(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<int>>*>& hyps,
+    float reverse_weight,
+    const std::vector<std::vector<float>*>& rescoring_scores) {
+  for (size_t i = 0; i < models.size(); ++i) {
+    models[i]->AttentionRescoring(*hyps[i], reverse_weight,
+                                  rescoring_scores[i]);
+  }
+}
+
 }  // namespace wenet
@@ -4,11 +4,16 @@
 #ifndef DECODER_ASR_MODEL_H_
 #define DECODER_ASR_MODEL_H_
 
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "frontend/feature_pipeline.h"
+#include "utils/matrix.h"
+#include "utils/memory_budget.h"
+#include "utils/state_io.h"
 #include "utils/timer.h"
 #include "utils/utils.h"
 
@@ -16,6 +21,7 @@ namespace wenet {
 
 class AsrModel {
  public:
+  virtual ~AsrModel() = default;
   virtual int right_context() const { return right_context_; }
   virtual int subsampling_rate() const { return subsampling_rate_; }
   virtual int sos() const { return sos_; }
@@ -24,12 +30,23 @@ class AsrModel {
     return is_bidirectional_decoder_;
   }
   virtual int offset() const { return offset_; }
+  // False if the model is read without the attention decoder, then the
+  // hyps can't be rescored, see AttentionRescoring.
+  bool has_decoder() const { return has_decoder_; }
 
   // If chunk_size > 0, streaming case. Otherwise, none streaming case
   virtual void set_chunk_size(int chunk_size) { chunk_size_ = chunk_size; }
   virtual void set_num_left_chunks(int num_left_chunks) {
     num_left_chunks_ = num_left_chunks;
   }
+  // Whether the chunk size can be changed in the middle of a session, whose
+  // caches are then of another length, see AdaptiveChunkOptions. The models
+  // of the caches bound to the length at Reset() can't.
+  virtual bool chunk_size_changeable() const { return false; }
+  // The index of the replica of the model this copy is of, see
+  // ModelReplicas, the batches only take the copies of the same replica
+  int replica() const { return replica_; }
+  void set_replica(int replica) { replica_ = replica; }
   // start: if it is the start chunk of one sentence
   virtual int num_frames_for_chunk(bool start) const;
 
@@ -38,18 +55,137 @@ class AsrModel {
   virtual void ForwardEncoder(
       const std::vector<std::vector<float>>& chunk_feats,
       std::vector<std::vector<float>>* ctc_prob);
+  // Same as above, but the chunk is a contiguous [T, D] view of the
+  // FeaturePipeline buffer, which saves the per frame copies.
+  void ForwardEncoder(const FeatureView& chunk_feats,
+                      std::vector<std::vector<float>>* ctc_prob);
+  // Same as above, but the log probs are written to one contiguous
+  // [T, vocab] matrix, reused across the chunks.
+  void ForwardEncoder(const FeatureView& chunk_feats, Matrix<float>* ctc_prob);
+  // Same as above, but only the top k ctc log probs and their ids of each
+  // frame are returned, for the topk Search of CtcPrefixBeamSearch.
+  void ForwardEncoderTopK(const FeatureView& chunk_feats, int k,
+                          std::vector<std::vector<float>>* topk_scores,
+                          std::vector<std::vector<int32_t>>* topk_indexs);
+
+  // Skip the encoder forward of a chunk of silence, which is only kept as
+  // the context of the next chunk, the encoder caches and the offset are
+  // not advanced, as if the chunk is cut off from the speech.
+  void SkipChunk(const std::vector<std::vector<float>>& chunk_feats) {
+    this->CacheFeature(chunk_feats);
+  }
+  void SkipChunk(const FeatureView& chunk_feats) {
+    this->CacheFeature(chunk_feats);
+  }
+
+  // Move the caches of an idle session out of the device, to be restored
+  // by the next forward, see DecodeOptions::offload_idle_ms. The models
+  // which keep the caches in host memory do nothing.
+  virtual void Offload() {}
+  // Profile the backend kernels of the forwards and the rescoring of this
+  // copy into the files of `prefix`, e.g. of a request captured by the
+  // Profiler, and an empty prefix stops it. The models without a
+  // profiling backend do nothing.
+  virtual void set_profile_prefix(const std::string& prefix) {}
+
+  // Save the states of the session, i.e. the offset, the cached frames, the
+  // caches and the encoder outputs kept for rescoring, which are loaded by a
+  // copy of the same model with the same chunk size and num_left_chunks, see
+  // AsrDecoder::SaveState. False if the model doesn't support it.
+  bool SaveState(StateWriter* writer) const;
+  // Called on a copy just Reset(), before any forward
+  bool LoadState(StateReader* reader);
+
+  // The bytes of the weights, which are shared by the copies, and of the
+  // states of the session, i.e. the caches and the encoder outputs kept for
+  // rescoring, for the memory budget. 0 if the model doesn't know.
+  virtual int64_t weight_bytes() const { return 0; }
+  int64_t session_bytes() const {
+    SessionMemory usage;
+    GetMemoryUsage(&usage);
+    return usage.total();
+  }
+  // Set the cached_feature, cache and encoder_outs bytes of the session
+  virtual void GetMemoryUsage(SessionMemory* usage) const {
+    usage->cached_feature = 0;
+    for (const auto& frame : cached_feature_) {
+      usage->cached_feature += frame.capacity() * sizeof(float);
+    }
+  }
+
+  // Whether the chunks of several sessions are forwarded, or their hyps
+  // rescored, in one batched call of the model rather than one by one, see
+  // ForwardEncoderBatchFunc and AttentionRescoringBatchFunc. The schedulers
+  // leave the sessions of the models without it to their own threads.
+  virtual bool batch_forward_supported() const { return false; }
+  virtual bool batch_rescoring_supported() const { return false; }
+
+  // Forward the chunks of several decoding sessions in one call, all the
+  // models must be copies of the same model, or of its replicas, which are
+  // batched by replica, see ChunkScheduler.
+  static void ForwardEncoderBatch(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+      const std::vector<std::vector<std::vector<float>>*>& ctc_probs);
 
   virtual void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                                   float reverse_weight,
                                   std::vector<float>* rescoring_score) = 0;
+  // Rescore the hyps of several decoding sessions in one call, all the
+  // models must be copies of the same model or of its replicas, see
+  // RescoringScheduler.
+  static void AttentionRescoringBatch(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<int>>*>& hyps,
+      float reverse_weight,
+      const std::vector<std::vector<float>*>& rescoring_scores);
 
   virtual std::shared_ptr<AsrModel> Copy() const = 0;
 
+  // Forward `num_chunks` chunks of silence of each chunk size with each
+  // batch size, and rescore `num_hyps` hyps of each batch, on the copies of
+  // the model. The runtimes optimize and allocate lazily on the first calls
+  // of each shape, which is done here before the model serves any session.
+  void Warmup(int feature_dim, const std::vector<int>& chunk_sizes,
+              const std::vector<int>& batch_sizes, int num_chunks = 3,
+              int num_hyps = 10) const;
+
  protected:
   virtual void ForwardEncoderFunc(
       const std::vector<std::vector<float>>& chunk_feats,
       std::vector<std::vector<float>>* ctc_prob) = 0;
+  // The default implementation copies the view to frames and calls the one
+  // above, models which can consume the buffer directly should override it.
+  virtual void ForwardEncoderFunc(const FeatureView& chunk_feats,
+                                  std::vector<std::vector<float>>* ctc_prob);
+  // The default implementation copies the frames of the one above into the
+  // matrix, models which can write it directly should override it.
+  virtual void ForwardEncoderFunc(const FeatureView& chunk_feats,
+                                  Matrix<float>* ctc_prob);
+  // The default implementation does the topk on the full log probs on CPU,
+  // models which can do it on the device or in the graph should override it.
+  virtual void ForwardEncoderTopKFunc(
+      const FeatureView& chunk_feats, int k,
+      std::vector<std::vector<float>>* topk_scores,
+      std::vector<std::vector<int32_t>>* topk_indexs);
+  // The default implementation forwards the chunks one by one, models
+  // which support batch chunk inference should override it.
+  virtual void ForwardEncoderBatchFunc(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+      const std::vector<std::vector<std::vector<float>>*>& ctc_probs);
+  // The default implementation rescores the sessions one by one, models
+  // which support batch rescoring should override it.
+  virtual void AttentionRescoringBatchFunc(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<int>>*>& hyps,
+      float reverse_weight,
+      const std::vector<std::vector<float>*>& rescoring_scores);
   virtual void CacheFeature(const std::vector<std::vector<float>>& chunk_feats);
+  // The states of the model besides the ones of the base class
+  virtual bool SaveStateFunc(StateWriter* writer) const { return false; }
+  virtual bool LoadStateFunc(StateReader* reader) { return false; }
+  void CacheFeature(const FeatureView& chunk_feats);
 
   int right_context_ = 1;
   int subsampling_rate_ = 1;
@@ -59,6 +195,8 @@ class AsrModel {
   int chunk_size_ = 16;
   int num_left_chunks_ = -1;  // -1 means all left chunks
   int offset_ = 0;
+  int replica_ = 0;
+  bool has_decoder_ = true;
 
   std::vector<std::vector<float>> cached_feature_;
 };
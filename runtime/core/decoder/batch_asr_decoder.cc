@@ -20,14 +20,44 @@
 #include <ctype.h>
 
 #include <algorithm>
-#include <thread>
+#include <future>
 #include <limits>
+#include <numeric>
+#include <thread>
 #include <utility>
 
+#ifdef USE_TORCH
+#include "decoder/batch_ctc_prefix_beam_search.h"
+#include "decoder/batch_ctc_wfst_beam_search.h"
+#include "decoder/batch_torch_asr_model.h"
+#endif
+#include "decoder/result_serializer.h"
+#include "utils/stage_timer.h"
 #include "utils/timer.h"
 
 namespace wenet {
 
+// Latency metrics of the stages of a batch, see utils/metrics.h
+struct BatchDecodeMetrics {
+  StageStats* feature;
+  StageStats* forward;
+  StageStats* search;
+  StageStats* rescoring;
+};
+
+static const BatchDecodeMetrics& GetBatchDecodeMetrics() {
+  static const BatchDecodeMetrics batch_metrics = {
+      StageStats::Get("wenet_batch_feature_seconds",
+                      "Fbank extraction latency of a batch"),
+      StageStats::Get("wenet_batch_encoder_forward_seconds",
+                      "Encoder forward latency of a batch"),
+      StageStats::Get("wenet_batch_search_seconds",
+                      "CTC search latency of a batch"),
+      StageStats::Get("wenet_batch_rescoring_seconds",
+                      "Attention rescoring latency of a batch")};
+  return batch_metrics;
+}
+
 BatchAsrDecoder::BatchAsrDecoder(std::shared_ptr<FeaturePipelineConfig> config,
                        std::shared_ptr<DecodeResource> resource,
                        const DecodeOptions& opts)
@@ -35,79 +65,128 @@ BatchAsrDecoder::BatchAsrDecoder(std::shared_ptr<FeaturePipelineConfig> config,
       beam_size_(opts.ctc_prefix_search_opts.first_beam_size),
       fbank_(config->num_bins, config->sample_rate,
           config->frame_length, config->frame_shift),
+#ifdef USE_GPU
       fbank_cuda_(config->num_bins, config->sample_rate),
-      model_(resource->batch_model->Copy()),
+#endif
+      feature_placer_(resource->feature_placer),
+      model_(resource->batch_model != nullptr ? resource->batch_model->Copy()
+                                              : nullptr),
       post_processor_(resource->post_processor),
-      symbol_table_(resource->symbol_table),
+      symbols_(SymbolMapOf(resource->symbol_map, resource->symbol_table)),
       fst_(resource->fst),
-      unit_table_(resource->unit_table),
+      units_(SymbolMapOf(resource->unit_map, resource->unit_table)),
       resource_(resource),
+      thread_pool_(resource->thread_pool),
       opts_(opts) {
-  if (opts_.reverse_weight > 0) {
+  if (opts_.streaming_batch) {
+    CHECK(resource_->model != nullptr)
+        << "The streaming batch requires the streaming model";
+  } else {
+    CHECK(model_ != nullptr);
+  }
+  if (opts_.reverse_weight > 0 && model_ != nullptr) {
     // Check if model has a right to left decoder
     CHECK(model_->is_bidirectional_decoder());
   }
-  if (nullptr == fst_) {
-    searcher_.reset(new CtcPrefixBeamSearch(opts.ctc_prefix_search_opts,
-                                            resource->context_graph));
-  } else {
-    searcher_.reset(new CtcWfstBeamSearch(*fst_, opts.ctc_wfst_search_opts,
-                                          resource->context_graph));
+  if (opts_.gpu_ctc_search) {
+#ifdef USE_TORCH
+    auto torch_model = dynamic_cast<BatchTorchAsrModel*>(model_.get());
+    use_gpu_search_ = torch_model != nullptr &&
+                      resource_->context_graph == nullptr &&
+                      !opts_.ctc_wfst_search_opts.lg_graph;
+    if (use_gpu_search_ && fst_ != nullptr) {
+      csr_fst_ = std::make_shared<CsrFst>(*fst_, torch_model->device());
+    }
+#endif
+    if (!use_gpu_search_) {
+      LOG(WARNING) << "GPU ctc search is only supported by the torch model "
+                   << "without the context graph and the LG graph, fallback "
+                   << "to the CPU search";
+    }
+  }
+  free_searchers_.push_back(CreateSearcher());
+  if (nullptr == feature_placer_) {
+#ifdef USE_GPU
+    bool gpu_available = true;
+#else
+    bool gpu_available = false;
+#endif
+    feature_placer_ = std::make_shared<FeaturePlacer>(
+        FeaturePlacementOptions(), gpu_available);
+  }
+  if (nullptr == thread_pool_) {
+    thread_pool_ = std::make_shared<ThreadPool>(
+        std::max(1u, std::thread::hardware_concurrency()));
   }
 }
 
+BatchAsrDecoder::~BatchAsrDecoder() {
+  // The encoder stage enqueues to the search stage, so stop it first
+  encoder_stage_.reset();
+  search_stage_.reset();
+}
+
 void BatchAsrDecoder::Reset() {
   batch_result_.clear();
-  searcher_->Reset();
 }
 
-void BatchAsrDecoder::SearchWorker(
-    const std::vector<std::vector<float>>& topk_scores,
-    const std::vector<std::vector<int>>& topk_indexs,
-    int index) {
-  Timer ctc_timer;
+std::unique_ptr<SearchInterface> BatchAsrDecoder::CreateSearcher() const {
   std::unique_ptr<SearchInterface> searcher;
   if (nullptr == fst_) {
+    std::shared_ptr<LanguageModel> lm =
+        resource_->language_model != nullptr
+            ? resource_->language_model->Copy()
+            : nullptr;
     searcher.reset(new CtcPrefixBeamSearch(opts_.ctc_prefix_search_opts,
-                                            resource_->context_graph));
+                                           resource_->context_graph, lm));
+  } else if (opts_.ctc_wfst_search_opts.lg_graph) {
+    searcher.reset(new CtcLgBeamSearch(*fst_, opts_.ctc_wfst_search_opts));
   } else {
     searcher.reset(new CtcWfstBeamSearch(*fst_, opts_.ctc_wfst_search_opts,
-                                          resource_->context_graph));
+                                         resource_->context_graph,
+                                         resource_->lattice_rescorer));
   }
-  // 3.1. ctc search
-  ctc_timer.Reset();
-  searcher->Search(topk_scores, topk_indexs);
-  searcher->FinalizeSearch();
-  std::vector<DecodeResult> result;
-  UpdateResult(searcher.get(), &result);
-  VLOG(1) << "\tctc search i==" << index
-          << " takes " << ctc_timer.Elapsed() << " ms";
-  std::lock_guard<std::mutex> lock(mutex_);
-  batch_pair_result_.emplace_back(std::make_pair(index, std::move(result)));
-  const auto& hypotheses = searcher->Inputs();
-  if (hypotheses.size() < beam_size_) {
-    VLOG(2) << "=== searcher->Inputs() size < beam_size_, padding...";
-    std::vector<std::vector<int>> hyps = hypotheses;
-    int to_pad = beam_size_ - hypotheses.size();
-    for (size_t i = 0; i < to_pad; i++) {
-      std::vector<int> pad = {0};
-      hyps.push_back(std::move(pad));
+  return searcher;
+}
+
+std::unique_ptr<SearchInterface> BatchAsrDecoder::AcquireSearcher() {
+  {
+    std::lock_guard<std::mutex> lock(searcher_mutex_);
+    if (!free_searchers_.empty()) {
+      std::unique_ptr<SearchInterface> searcher =
+          std::move(free_searchers_.back());
+      free_searchers_.pop_back();
+      return searcher;
     }
-    batch_hyps_.emplace_back(std::make_pair(index, std::move(hyps)));
-  } else {
-    batch_hyps_.emplace_back(std::make_pair(index, std::move(hypotheses)));
   }
+  return CreateSearcher();
 }
 
-void BatchAsrDecoder::FbankWorker(const std::vector<float>& wav, int index) {
-  Timer timer;
-  feature_t feats;
-  int num_frames = fbank_.Compute(wav, &feats);
-  std::lock_guard<std::mutex> lock(mutex_);
-  batch_feats_.push_back(std::make_pair(index, std::move(feats)));
-  batch_feats_lens_.push_back(std::make_pair(index, num_frames));
-  VLOG(1) << "\tfeature comput i==" << index
-          << ", takes " << timer.Elapsed() << " ms.";
+void BatchAsrDecoder::ReleaseSearcher(
+    std::unique_ptr<SearchInterface> searcher) {
+  searcher->Reset();
+  std::lock_guard<std::mutex> lock(searcher_mutex_);
+  free_searchers_.push_back(std::move(searcher));
+}
+
+void BatchAsrDecoder::SearchWorker(
+    const MatrixView<float>& topk_scores,
+    const MatrixView<int32_t>& topk_indexs,
+    int index,
+    std::vector<std::vector<int>>* hyps,
+    std::vector<DecodeResult>* result) {
+  Timer ctc_timer;
+  std::unique_ptr<SearchInterface> searcher = AcquireSearcher();
+  // 3.1. ctc search
+  searcher->Search(topk_scores, topk_indexs);
+  searcher->FinalizeSearch();
+  UpdateResult(searcher.get(), result);
+  VLOG(1) << "\tctc search i==" << index
+          << " takes " << ctc_timer.ElapsedNs() / 1e6 << " ms";
+  // The models pad the short n-best if they need to
+  *hyps = searcher->Inputs();
+  if (hyps->size() > beam_size_) hyps->resize(beam_size_);
+  ReleaseSearcher(std::move(searcher));
 }
 
 void BatchAsrDecoder::ComputeFeatureCpu(
@@ -117,158 +196,527 @@ void BatchAsrDecoder::ComputeFeatureCpu(
   Timer timer;
   batch_feature_t& batch_feats = *feats;
   std::vector<int>& batch_feats_lens = *feats_lens;
-  if (wavs.size() > 1) {
-    std::vector<std::thread> fbank_threads;
-    for (size_t i = 0; i < wavs.size(); i++) {
-      const std::vector<float>& wav = wavs[i];
-      std::thread thd(&BatchAsrDecoder::FbankWorker, this, wav, i);
-      fbank_threads.push_back(std::move(thd));
-    }
-    for (auto& thd : fbank_threads) {
-      thd.join();
-    }
-    std::sort(batch_feats_.begin(), batch_feats_.end());
-    std::sort(batch_feats_lens_.begin(), batch_feats_lens_.end());
-    for (auto& pair : batch_feats_) {
-      batch_feats.push_back(std::move(pair.second));
+  int batch_size = wavs.size();
+  batch_feats.resize(batch_size);
+  batch_feats_lens.resize(batch_size);
+  if (batch_size > 1) {
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < batch_size; i++) {
+      // The offline batches yield to the streams sharing the pool
+      futures.emplace_back(
+          thread_pool_->enqueue_with_priority(TaskPriority::kLow, [&, i]() {
+            Timer fbank_timer;
+            batch_feats_lens[i] =
+                fbank_.ComputeBatch(wavs[i], &batch_feats[i]);
+            VLOG(1) << "\tfeature comput i==" << i << ", takes "
+                    << fbank_timer.ElapsedNs() / 1e6 << " ms.";
+          }));
     }
-    for (auto& pair : batch_feats_lens_) {
-      batch_feats_lens.push_back(pair.second);
+    for (auto& future : futures) {
+      future.get();
     }
   } else {
     // only one wave
-    feature_t feats;
-    int num_frames = fbank_.Compute(wavs[0], &feats);
-    batch_feats.push_back(feats);
-    batch_feats_lens.push_back(num_frames);
+    batch_feats_lens[0] = fbank_.ComputeBatch(wavs[0], &batch_feats[0]);
   }
+  GetBatchDecodeMetrics().feature->Record(timer.ElapsedNs());
   VLOG(1) << "feature Compute takes " << timer.Elapsed() << " ms.";
 
   // 1.1 feature padding
-  if (wavs.size() > 1) {
-    timer.Reset();
-    int max_len = *std::max_element(
-        batch_feats_lens.begin(), batch_feats_lens.end());
-    for (auto& feat : batch_feats) {
-      if (feat.size() == max_len) continue;
-      int pad_len = max_len - feat.size();
-      for (size_t i = 0; i< pad_len; i++) {
-        std::vector<float> one(feature_config_->num_bins, 0.0);
-        feat.push_back(std::move(one));
-      }
-    }
-    VLOG(1) << "padding feautre takes " << timer.Elapsed() << " ms.";
-  }}
+  PadFeatures(batch_feats_lens, &batch_feats);
+}
 
-void BatchAsrDecoder::Decode(const std::vector<std::vector<float>>& wavs) {
+void BatchAsrDecoder::PadFeatures(const std::vector<int>& batch_feats_lens,
+                                  batch_feature_t* batch_feats) const {
+  if (batch_feats->size() <= 1) return;
+  Timer timer;
+  int max_len =
+      *std::max_element(batch_feats_lens.begin(), batch_feats_lens.end());
+  for (auto& feat : *batch_feats) {
+    feat.resize(max_len, std::vector<float>(feature_config_->num_bins, 0.0));
+  }
+  VLOG(1) << "padding feautre takes " << timer.Elapsed() << " ms.";
+}
+
+void BatchAsrDecoder::ForwardBatch(
+    BatchAsrModel* model, const std::vector<std::vector<float>>& wavs,
+    BatchTopK* batch_topk) {
   // 1. calc fbank feature of the batch of wavs
-  std::vector<std::vector<std::vector<float>>> batch_topk_scores;
-  std::vector<std::vector<std::vector<int>>> batch_topk_indexs;
   Timer timer;
-  bool gpu_feature = true;
-  if (gpu_feature) {
+#ifdef USE_GPU
+  if (feature_placer_->Place(wavs.size())) {
     std::vector<int> batch_feats_lens;
-    timer.Reset();
     auto batch_feats = fbank_cuda_.Compute(wavs, &batch_feats_lens);
-    VLOG(1) << "fbank_cuda_.Comput() takes " << timer.Elapsed() << " ms.";
+    feature_placer_->Release();
+    GetBatchDecodeMetrics().feature->Record(timer.ElapsedNs());
+    VLOG(1) << "fbank_cuda_.Compute() takes " << timer.Elapsed() << " ms.";
     timer.Reset();
     // 2. encoder forward
-    model_->ForwardEncoder(
-        batch_feats, batch_feats_lens, &batch_topk_scores, &batch_topk_indexs);
+#ifdef USE_TORCH
+    if (use_gpu_search_) {
+      // the topk outputs are left on the device for SearchAndRescoreGpu
+      static_cast<BatchTorchAsrModel*>(model)->ForwardEncoder(
+          batch_feats, batch_feats_lens);
+      GetBatchDecodeMetrics().forward->Record(timer.ElapsedNs());
+      VLOG(1) << "encoder forward takes " << timer.Elapsed() << " ms.";
+      return;
+    }
+#endif
+    model->ForwardEncoder(batch_feats, batch_feats_lens, batch_topk);
+    GetBatchDecodeMetrics().forward->Record(timer.ElapsedNs());
     VLOG(1) << "encoder forward takes " << timer.Elapsed() << " ms.";
+    return;
+  }
+#endif
+  batch_feature_t batch_feats;
+  std::vector<int> batch_feats_lens;
+  ComputeFeatureCpu(wavs, &batch_feats, &batch_feats_lens);
+  ForwardFeatures(model, batch_feats, batch_feats_lens, batch_topk);
+}
 
-  } else {
-    batch_feature_t batch_feats;
-    std::vector<int> batch_feats_lens;
-    ComputeFeatureCpu(wavs, &batch_feats, &batch_feats_lens);
-    timer.Reset();
-    // 2. encoder forward
-    model_->ForwardEncoder(
-        batch_feats, batch_feats_lens, &batch_topk_scores, &batch_topk_indexs);
+void BatchAsrDecoder::ForwardFeatures(
+    BatchAsrModel* model, const batch_feature_t& batch_feats,
+    const std::vector<int>& batch_feats_lens, BatchTopK* batch_topk) {
+  Timer timer;
+  // 2. encoder forward
+#ifdef USE_TORCH
+  if (use_gpu_search_) {
+    // The device search takes the features as tensors
+    std::vector<torch::Tensor> feats_tensors;
+    for (size_t i = 0; i < batch_feats.size(); ++i) {
+      torch::Tensor feats = torch::empty(
+          {static_cast<int64_t>(batch_feats[i].size()),
+           feature_config_->num_bins}, torch::kFloat);
+      for (size_t j = 0; j < batch_feats[i].size(); ++j) {
+        std::copy(batch_feats[i][j].begin(), batch_feats[i][j].end(),
+                  feats[j].data_ptr<float>());
+      }
+      feats_tensors.emplace_back(std::move(feats));
+    }
+    static_cast<BatchTorchAsrModel*>(model)->ForwardEncoder(
+        feats_tensors, batch_feats_lens);
+    GetBatchDecodeMetrics().forward->Record(timer.ElapsedNs());
     VLOG(1) << "encoder forward takes " << timer.Elapsed() << " ms.";
+    return;
   }
+#endif
+  model->ForwardEncoder(batch_feats, batch_feats_lens, batch_topk);
+  GetBatchDecodeMetrics().forward->Record(timer.ElapsedNs());
+  VLOG(1) << "encoder forward takes " << timer.Elapsed() << " ms.";
+}
 
+void BatchAsrDecoder::SearchBatch(
+    const BatchTopK& batch_topk,
+    std::vector<std::vector<std::vector<int>>>* batch_hyps,
+    std::vector<std::vector<DecodeResult>>* batch_result) {
   // 3. ctc search one by one of the batch
   // create batch of tct search result for attention decoding
-  timer.Reset();
-  int batch_size = wavs.size();
-  std::vector<std::vector<std::vector<int>>> batch_hyps;
+  Timer timer;
+  int batch_size = batch_topk.batch_size();
+  batch_hyps->clear();
+  batch_hyps->resize(batch_size);
+  batch_result->clear();
+  batch_result->resize(batch_size);
   if (batch_size > 1) {
-    batch_pair_result_.clear();
-    batch_hyps_.clear();
-    std::vector<std::thread> search_threads;
+    std::vector<std::future<void>> futures;
     for (size_t i = 0; i < batch_size; i++) {
-      const auto& topk_scores = batch_topk_scores[i];
-      const auto& topk_indexs = batch_topk_indexs[i];
-      std::thread thd(
-          &BatchAsrDecoder::SearchWorker, this, topk_scores, topk_indexs, i);
-      search_threads.push_back(std::move(thd));
-    }
-    for (auto& thd : search_threads) {
-      thd.join();
+      futures.emplace_back(
+          thread_pool_->enqueue_with_priority(TaskPriority::kLow, [&, i]() {
+            SearchWorker(batch_topk.Scores(i), batch_topk.Indexs(i), i,
+                         &(*batch_hyps)[i], &(*batch_result)[i]);
+          }));
     }
-    std::sort(batch_hyps_.begin(), batch_hyps_.end());
-    std::sort(batch_pair_result_.begin(), batch_pair_result_.end(),
-        [](auto& a, auto& b) {
-          return a.first < b.first; });
-    for (auto& pair : batch_hyps_) {
-      batch_hyps.push_back(std::move(pair.second));
-    }
-    batch_result_.clear();
-    for (auto& pair : batch_pair_result_) {
-      batch_result_.push_back(std::move(pair.second));
+    for (auto& future : futures) {
+      future.get();
     }
   } else {
     // one wav
-    searcher_->Search(batch_topk_scores[0], batch_topk_indexs[0]);
-    searcher_->FinalizeSearch();
-    std::vector<DecodeResult> result;
-    UpdateResult(searcher_.get(), &result);
-    batch_result_.push_back(std::move(result));
-    const auto& hypotheses = searcher_->Inputs();
-    if (hypotheses.size() < beam_size_) {
-      VLOG(2) << "=== searcher->Inputs() size < beam_size_, padding...";
-      std::vector<std::vector<int>> hyps = hypotheses;
-      int to_pad = beam_size_ - hypotheses.size();
-      for (size_t i = 0; i < to_pad; i++) {
-        std::vector<int> pad = {0};
-        hyps.push_back(std::move(pad));
-      }
-      batch_hyps.push_back(std::move(hyps));
-    } else {
-      batch_hyps.push_back(std::move(hypotheses));
-    }
+    SearchWorker(batch_topk.Scores(0), batch_topk.Indexs(0), 0,
+                 &(*batch_hyps)[0], &(*batch_result)[0]);
   }
+  GetBatchDecodeMetrics().search->Record(timer.ElapsedNs());
   VLOG(1) << "ctc search batch(" << batch_size << ") takes "
           << timer.Elapsed() << " ms.";
+}
+
+void BatchAsrDecoder::RescoreBatch(
+    BatchAsrModel* model,
+    const std::vector<std::vector<std::vector<int>>>& batch_hyps,
+    std::vector<std::vector<DecodeResult>>* batch_result) {
+  int batch_size = batch_result->size();
   std::vector<std::vector<float>> ctc_scores(batch_size);
-  for (int i = 0; i < batch_result_.size(); ++i) {
-    ctc_scores[i].resize(beam_size_);
-    for (int j = 0; j < beam_size_; ++j) {
-      ctc_scores[i][j] = batch_result_[i][j].score;
+  for (int i = 0; i < batch_size; ++i) {
+    ctc_scores[i].resize(batch_hyps[i].size(), 0);
+    int n = std::min(batch_hyps[i].size(), (*batch_result)[i].size());
+    for (int j = 0; j < n; ++j) {
+      ctc_scores[i][j] = (*batch_result)[i][j].score;
     }
   }
   // 4. attention rescoring
+  Timer timer;
+  std::vector<std::vector<float>> attention_scores;
+  model->AttentionRescoring(batch_hyps, ctc_scores, &attention_scores);
+  GetBatchDecodeMetrics().rescoring->Record(timer.ElapsedNs());
+  VLOG(1) << "attention rescoring takes " << timer.Elapsed() << " ms.";
+  for (size_t i = 0; i < batch_size; i++) {
+    std::vector<DecodeResult>& result = (*batch_result)[i];
+    size_t n = std::min(attention_scores[i].size(), result.size());
+    for (size_t j = 0; j < n; j++) {
+      result[j].score = attention_scores[i][j];
+    }
+    std::sort(result.begin(), result.end(), DecodeResult::CompareFunc);
+  }
+}
+
+void BatchAsrDecoder::SearchAndRescoreGpu(
+    BatchAsrModel* model,
+    std::vector<std::vector<DecodeResult>>* batch_result) {
+#ifdef USE_TORCH
+  auto torch_model = static_cast<BatchTorchAsrModel*>(model);
+  if (csr_fst_ != nullptr) {
+    // 3. wfst search of the whole batch
+    Timer timer;
+    BatchCtcWfstBeamSearch searcher(*csr_fst_, opts_.ctc_wfst_search_opts);
+    searcher.Search(torch_model->topk_scores(), torch_model->topk_indexs(),
+                    torch_model->encoder_lens());
+    std::vector<std::vector<std::vector<int>>> batch_outputs;
+    std::vector<std::vector<std::vector<int>>> batch_hyps;
+    std::vector<std::vector<float>> batch_likelihood;
+    std::vector<std::vector<std::vector<int>>> batch_times;
+    searcher.GetResults(&batch_outputs, &batch_hyps, &batch_likelihood,
+                        &batch_times);
+    int batch_size = batch_hyps.size();
+    batch_result->clear();
+    batch_result->resize(batch_size);
+    for (int i = 0; i < batch_size; ++i) {
+      UpdateResult(batch_outputs[i], batch_hyps[i], batch_likelihood[i],
+                   batch_times[i], kWfstBeamSearch, &(*batch_result)[i]);
+      // The n-best beyond the beam are not rescored
+      if ((*batch_result)[i].size() > beam_size_) {
+        (*batch_result)[i].resize(beam_size_);
+      }
+      if (batch_hyps[i].size() > beam_size_) batch_hyps[i].resize(beam_size_);
+    }
+    GetBatchDecodeMetrics().search->Record(timer.ElapsedNs());
+    VLOG(1) << "gpu wfst search batch(" << batch_size << ") takes "
+            << timer.Elapsed() << " ms.";
+    // 4. attention rescoring of the n-best on the host, as the CPU search
+    RescoreBatch(model, batch_hyps, batch_result);
+    return;
+  }
+  // 3. ctc search of the whole batch
+  Timer timer;
+  BatchCtcPrefixBeamSearch searcher(opts_.ctc_prefix_search_opts);
+  searcher.Search(torch_model->topk_scores(), torch_model->topk_indexs(),
+                  torch_model->encoder_lens());
+  std::vector<std::vector<std::vector<int>>> batch_hyps;
+  std::vector<std::vector<float>> batch_scores;
+  std::vector<std::vector<std::vector<int>>> batch_times;
+  searcher.GetResults(&batch_hyps, &batch_scores, &batch_times);
+  int batch_size = batch_hyps.size();
+  batch_result->clear();
+  batch_result->resize(batch_size);
+  for (int i = 0; i < batch_size; ++i) {
+    UpdateResult(batch_hyps[i], batch_hyps[i], batch_scores[i],
+                 batch_times[i], kPrefixBeamSearch, &(*batch_result)[i]);
+  }
+  GetBatchDecodeMetrics().search->Record(timer.ElapsedNs());
+  VLOG(1) << "gpu ctc search batch(" << batch_size << ") takes "
+          << timer.Elapsed() << " ms.";
+
+  // 4. attention rescoring on the padded hyps of the search
   timer.Reset();
   std::vector<std::vector<float>> attention_scores;
-  model_->AttentionRescoring(batch_hyps, ctc_scores, &attention_scores);
+  torch_model->AttentionRescoring(searcher.hyps(), searcher.hyps_lens(),
+                                  searcher.scores(), &attention_scores);
+  GetBatchDecodeMetrics().rescoring->Record(timer.ElapsedNs());
   VLOG(1) << "attention rescoring takes " << timer.Elapsed() << " ms.";
   for (size_t i = 0; i < batch_size; i++) {
-    std::vector<DecodeResult>& result = batch_result_[i];
-    for (size_t j = 0; j < beam_size_; j++) {
+    std::vector<DecodeResult>& result = (*batch_result)[i];
+    for (size_t j = 0; j < result.size(); j++) {
       result[j].score = attention_scores[i][j];
     }
     std::sort(result.begin(), result.end(), DecodeResult::CompareFunc);
   }
+#else
+  LOG(FATAL) << "GPU ctc search requires the torch model";
+#endif
+}
+
+std::vector<std::vector<int>> BatchAsrDecoder::SplitBatch(
+    const std::vector<std::vector<float>>& wavs) const {
+  std::vector<int64_t> num_frames(wavs.size());
+  for (size_t i = 0; i < wavs.size(); ++i) {
+    num_frames[i] =
+        static_cast<int64_t>(wavs[i].size()) / feature_config_->frame_shift;
+  }
+  return SplitBatch(num_frames);
+}
+
+std::vector<std::vector<int>> BatchAsrDecoder::SplitBatch(
+    const std::vector<int64_t>& num_frames) const {
+  int num_wavs = num_frames.size();
+  std::vector<int> order(num_wavs);
+  std::iota(order.begin(), order.end(), 0);
+  std::vector<std::vector<int>> batches;
+  if (opts_.max_batch_frames <= 0 || num_wavs <= 1) {
+    batches.push_back(std::move(order));
+    return batches;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return num_frames[a] < num_frames[b];
+  });
+  // The sorted utterances are padded to the last one of the sub batch
+  batches.emplace_back();
+  for (int i : order) {
+    int64_t padded = num_frames[i] * (batches.back().size() + 1);
+    if (!batches.back().empty() && padded > opts_.max_batch_frames) {
+      batches.emplace_back();
+    }
+    batches.back().push_back(i);
+  }
+  return batches;
+}
+
+void BatchAsrDecoder::DecodeBatch(
+    BatchAsrModel* model, const std::vector<std::vector<float>>& wavs,
+    std::vector<std::vector<DecodeResult>>* batch_result) {
+  BatchTopK batch_topk;
+  ForwardBatch(model, wavs, &batch_topk);
+  SearchAndRescore(model, batch_topk, batch_result);
+}
+
+void BatchAsrDecoder::SearchAndRescore(
+    BatchAsrModel* model, const BatchTopK& batch_topk,
+    std::vector<std::vector<DecodeResult>>* batch_result) {
+  if (use_gpu_search_) {
+    SearchAndRescoreGpu(model, batch_result);
+    return;
+  }
+  std::vector<std::vector<std::vector<int>>> batch_hyps;
+  SearchBatch(batch_topk, &batch_hyps, batch_result);
+  RescoreBatch(model, batch_hyps, batch_result);
+}
+
+void BatchAsrDecoder::DecodeFeatures(batch_feature_t batch_feats,
+                                     std::vector<int> batch_feats_lens) {
+  CHECK(!opts_.streaming_batch) << "The streaming batch decodes the audio";
+  CHECK_EQ(batch_feats.size(), batch_feats_lens.size());
+  std::vector<std::vector<int>> batches = SplitBatch(
+      std::vector<int64_t>(batch_feats_lens.begin(), batch_feats_lens.end()));
+  batch_result_.clear();
+  batch_result_.resize(batch_feats.size());
+  for (const auto& batch : batches) {
+    batch_feature_t sub_feats;
+    std::vector<int> sub_lens;
+    for (int i : batch) {
+      sub_feats.push_back(std::move(batch_feats[i]));
+      sub_lens.push_back(batch_feats_lens[i]);
+    }
+    PadFeatures(sub_lens, &sub_feats);
+    BatchTopK batch_topk;
+    ForwardFeatures(model_.get(), sub_feats, sub_lens, &batch_topk);
+    sub_feats.clear();
+    std::vector<std::vector<DecodeResult>> sub_result;
+    SearchAndRescore(model_.get(), batch_topk, &sub_result);
+    for (size_t j = 0; j < batch.size(); ++j) {
+      batch_result_[batch[j]] = std::move(sub_result[j]);
+    }
+  }
+}
+
+void BatchAsrDecoder::DecodeStreaming(
+    const std::vector<std::vector<float>>& wavs,
+    std::vector<std::vector<DecodeResult>>* batch_result) {
+  Timer timer;
+  int batch_size = wavs.size();
+  batch_result->clear();
+  batch_result->resize(batch_size);
+  auto decode = [&](int i) {
+    auto feature_pipeline = std::make_shared<FeaturePipeline>(
+        *feature_config_, resource_->fbank_tables);
+    AsrDecoder decoder(feature_pipeline, resource_, opts_);
+    feature_pipeline->AcceptWaveform(wavs[i].data(), wavs[i].size());
+    feature_pipeline->set_input_finished();
+    std::vector<DecodeResult> finals;
+    while (true) {
+      DecodeState state = decoder.Decode();
+      if (state == DecodeState::kEndFeats) {
+        decoder.Rescoring();
+        break;
+      }
+      if (state == DecodeState::kEndpoint) {
+        if (decoder.DecodedSomething()) {
+          decoder.Rescoring();
+          finals.push_back(decoder.result()[0]);
+        }
+        decoder.ResetContinuousDecoding();
+      }
+    }
+    std::vector<DecodeResult>& result = (*batch_result)[i];
+    if (finals.empty()) {
+      result = decoder.result();
+      return;
+    }
+    if (decoder.DecodedSomething()) finals.push_back(decoder.result()[0]);
+    // The times of the continuous decoding are of the whole utterance
+    result.resize(1);
+    result[0] = std::move(finals[0]);
+    for (size_t j = 1; j < finals.size(); ++j) {
+      result[0].score += finals[j].score;
+      result[0].sentence.append(finals[j].sentence);
+      result[0].word_pieces.insert(result[0].word_pieces.end(),
+                                   finals[j].word_pieces.begin(),
+                                   finals[j].word_pieces.end());
+    }
+  };
+  std::vector<std::future<void>> futures;
+  for (int i = 0; i < batch_size; ++i) {
+    futures.emplace_back(thread_pool_->enqueue_with_priority(
+        TaskPriority::kLow, [&decode, i]() { decode(i); }));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+  VLOG(1) << "streaming decode batch(" << batch_size << ") takes "
+          << timer.Elapsed() << " ms.";
+}
+
+void BatchAsrDecoder::Decode(const std::vector<std::vector<float>>& wavs) {
+  if (opts_.streaming_batch) {
+    DecodeStreaming(wavs, &batch_result_);
+    return;
+  }
+  std::vector<std::vector<int>> batches = SplitBatch(wavs);
+  if (batches.size() == 1) {
+    DecodeBatch(model_.get(), wavs, &batch_result_);
+    return;
+  }
+  VLOG(1) << "Split the batch(" << wavs.size() << ") into " << batches.size()
+          << " sub batches";
+  batch_result_.clear();
+  batch_result_.resize(wavs.size());
+  for (const auto& batch : batches) {
+    std::vector<std::vector<float>> sub_wavs;
+    for (int i : batch) sub_wavs.push_back(wavs[i]);
+    std::vector<std::vector<DecodeResult>> sub_result;
+    DecodeBatch(model_.get(), sub_wavs, &sub_result);
+    for (size_t j = 0; j < batch.size(); ++j) {
+      batch_result_[batch[j]] = std::move(sub_result[j]);
+    }
+  }
+}
+
+std::future<std::vector<std::vector<DecodeResult>>>
+BatchAsrDecoder::DecodeAsync(std::vector<std::vector<float>> wavs) {
+  using BatchResult = std::vector<std::vector<DecodeResult>>;
+  if (opts_.streaming_batch) {
+    // The sessions have no stages to pipeline, the batches just overlap
+    return std::async(std::launch::async,
+                      [this](std::vector<std::vector<float>> wavs) {
+                        BatchResult batch_result;
+                        DecodeStreaming(wavs, &batch_result);
+                        return batch_result;
+                      },
+                      std::move(wavs));
+  }
+  std::vector<std::vector<int>> batches = SplitBatch(wavs);
+  if (batches.size() > 1) {
+    // The sub batches run through the pipeline one after another, and the
+    // results are put back in order by the one who waits for them
+    std::vector<std::future<BatchResult>> futures;
+    int num_wavs = wavs.size();
+    for (const auto& batch : batches) {
+      std::vector<std::vector<float>> sub_wavs;
+      for (int i : batch) sub_wavs.push_back(std::move(wavs[i]));
+      futures.push_back(DecodeAsync(std::move(sub_wavs)));
+    }
+    auto merge = [num_wavs](std::vector<std::vector<int>> batches,
+                            std::vector<std::future<BatchResult>> futures) {
+      BatchResult batch_result(num_wavs);
+      for (size_t i = 0; i < batches.size(); ++i) {
+        BatchResult sub_result = futures[i].get();
+        for (size_t j = 0; j < batches[i].size(); ++j) {
+          batch_result[batches[i][j]] = std::move(sub_result[j]);
+        }
+      }
+      return batch_result;
+    };
+    return std::async(std::launch::deferred, merge, std::move(batches),
+                      std::move(futures));
+  }
+
+  // The model keeps the encoder output of a batch for its rescoring, so
+  // every in-flight batch takes one model out of the free list, which also
+  // bounds the number of in-flight batches.
+  std::shared_ptr<BatchAsrModel> model;
+  {
+    std::unique_lock<std::mutex> lock(pipeline_mutex_);
+    if (encoder_stage_ == nullptr) {
+      encoder_stage_ = std::make_unique<ThreadPool>(1);
+      search_stage_ = std::make_unique<ThreadPool>(1);
+      for (int i = 0; i < kPipelineDepth; ++i) {
+        free_models_.push_back(model_->Copy());
+      }
+    }
+    model_cond_.wait(lock, [this] { return !free_models_.empty(); });
+    model = free_models_.back();
+    free_models_.pop_back();
+  }
+
+  struct BatchTask {
+    std::vector<std::vector<float>> wavs;
+    BatchTopK topk;
+    std::promise<std::vector<std::vector<DecodeResult>>> promise;
+  };
+  auto task = std::make_shared<BatchTask>();
+  task->wavs = std::move(wavs);
+  auto future = task->promise.get_future();
+  auto release_model = [this, model]() {
+    {
+      std::lock_guard<std::mutex> lock(pipeline_mutex_);
+      free_models_.push_back(model);
+    }
+    model_cond_.notify_one();
+  };
+  // Stage 1: feature and encoder, stage 2: search and rescoring. Each stage
+  // runs on a single thread, so the batches are kept in order.
+  encoder_stage_->enqueue([this, task, model, release_model]() {
+    try {
+      ForwardBatch(model.get(), task->wavs, &task->topk);
+    } catch (...) {
+      task->promise.set_exception(std::current_exception());
+      release_model();
+      return;
+    }
+    search_stage_->enqueue([this, task, model, release_model]() {
+      try {
+        std::vector<std::vector<DecodeResult>> batch_result;
+        SearchAndRescore(model.get(), task->topk, &batch_result);
+        task->promise.set_value(std::move(batch_result));
+      } catch (...) {
+        task->promise.set_exception(std::current_exception());
+      }
+      release_model();
+    });
+  });
+  return future;
 }
 
 void BatchAsrDecoder::UpdateResult(SearchInterface* searcher,
     std::vector<DecodeResult>* result) {
+  UpdateResult(searcher->Outputs(), searcher->Inputs(),
+               searcher->Likelihood(), searcher->Times(), searcher->Type(),
+               result);
+}
+
+void BatchAsrDecoder::UpdateResult(
+    const std::vector<std::vector<int>>& hypotheses,
+    const std::vector<std::vector<int>>& inputs,
+    const std::vector<float>& likelihood,
+    const std::vector<std::vector<int>>& times, SearchType search_type,
+    std::vector<DecodeResult>* result) {
   bool finish = true;
-  const auto& hypotheses = searcher->Outputs();
-  const auto& inputs = searcher->Inputs();
-  const auto& likelihood = searcher->Likelihood();
-  const auto& times = searcher->Times();
   result->clear();
 
   CHECK_EQ(hypotheses.size(), likelihood.size());
@@ -278,14 +726,10 @@ void BatchAsrDecoder::UpdateResult(SearchInterface* searcher,
     DecodeResult path;
     path.score = likelihood[i];
     for (size_t j = 0; j < hypothesis.size(); j++) {
-      std::string word = symbol_table_->Find(hypothesis[j]);
       // A detailed explanation of this if-else branch can be found in
       // https://github.com/wenet-e2e/wenet/issues/583#issuecomment-907994058
-      if (searcher->Type() == kWfstBeamSearch) {
-        path.sentence += (' ' + word);
-      } else {
-        path.sentence += (word);
-      }
+      if (search_type == kWfstBeamSearch) path.sentence += ' ';
+      symbols_->Append(hypothesis[j], &path.sentence);
     }
 
     // TimeStamp is only supported in final result
@@ -293,12 +737,12 @@ void BatchAsrDecoder::UpdateResult(SearchInterface* searcher,
     // various FST operations when building the decoding graph. So here we use
     // time stamp of the input(e2e model unit), which is more accurate, and it
     // requires the symbol table of the e2e model used in training.
-    if (unit_table_ != nullptr && finish) {
+    if (units_ != nullptr && finish && i < times.size()) {
       const std::vector<int>& input = inputs[i];
       const std::vector<int>& time_stamp = times[i];
       CHECK_EQ(input.size(), time_stamp.size());
       for (size_t j = 0; j < input.size(); j++) {
-        std::string word = unit_table_->Find(input[j]);
+        std::string word = units_->Find(input[j]);
         int start = time_stamp[j] * frame_shift_in_ms() - time_stamp_gap_ > 0
                         ? time_stamp[j] * frame_shift_in_ms() - time_stamp_gap_
                         : 0;
@@ -331,34 +775,29 @@ void BatchAsrDecoder::UpdateResult(SearchInterface* searcher,
 
 const std::string BatchAsrDecoder::get_batch_result(int nbest,
     bool enable_timestamp) {
-  json::JSON obj;
-  obj["status"] = "ok";
-  obj["type"] = "final_result";
-  obj["batch_size"] = batch_result_.size();
-  obj["batch_result"] = json::Array();
-  for (const auto& result : batch_result_) {
-    json::JSON batch_one;
-    batch_one["nbest"] = json::Array();
-    for (int i = 0; i < nbest && i < result.size(); i++) {
-      json::JSON one;
-      one["sentence"] = result[i].sentence;
-      // one["score"] = result[i].score;
-      if (enable_timestamp) {
-        one["word_pieces"] = json::Array();
-        for (const auto& word_piece : result[i].word_pieces) {
-          json::JSON piece;
-          piece["word"] = word_piece.word;
-          piece["start"] = word_piece.start;
-          piece["end"] = word_piece.end;
-          one["word_pieces"].append(piece);
-        }
-      }
-      one["sentence"] = result[i].sentence;
-      batch_one["nbest"].append(one);
-    }
-    obj["batch_result"].append(batch_one);
-  }
-  return obj.dump();
+  return SerializeBatchResult(batch_result_, nbest, enable_timestamp);
+}
+
+std::string BatchAsrDecoder::SerializeBatchResult(
+    const std::vector<std::vector<DecodeResult>>& batch_result, int nbest,
+    bool enable_timestamp) {
+  JsonWriter writer;
+  writer.StartObject()
+      .Key("status")
+      .String("ok")
+      .Key("type")
+      .String("final_result")
+      .Key("batch_size")
+      .Int(batch_result.size())
+      .Key("batch_result")
+      .StartArray();
+  for (const auto& result : batch_result) {
+    writer.StartObject().Key("nbest");
+    ResultSerializer::WriteNbest(result, nbest, enable_timestamp, &writer);
+    writer.EndObject();
   }
+  writer.EndArray().EndObject();
+  return writer.str();
+}
 
 }  // namespace wenet
@@ -18,7 +18,10 @@
 #ifndef DECODER_BATCH_ASR_DECODER_H_
 #define DECODER_BATCH_ASR_DECODER_H_
 
+#include <condition_variable>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -37,21 +40,44 @@
 #include "utils/utils.h"
 #include "frontend/fbank.h"
 #include "utils/json.h"
+#ifdef USE_GPU
 #include "frontend/fbank_cuda.h"
+#endif
 
 namespace wenet {
 
+struct CsrFst;
+
 // Torch ASR batch decoder
 class BatchAsrDecoder {
  public:
   BatchAsrDecoder(std::shared_ptr<FeaturePipelineConfig> feature_config,
              std::shared_ptr<DecodeResource> resource,
              const DecodeOptions& opts);
+  ~BatchAsrDecoder();
   void Decode(const std::vector<std::vector<float>>& wavs);
+  // The fbank of an utterance for DecodeFeatures. It's thread safe, so the
+  // utterances of a batch are computed as their audio arrives.
+  int ComputeFeature(const std::vector<float>& wav, feature_t* feats) {
+    return fbank_.ComputeBatch(wav, feats);
+  }
+  // Same as Decode, but of the features of ComputeFeature, which are
+  // consumed. Not for DecodeOptions::streaming_batch, which decodes audio.
+  void DecodeFeatures(batch_feature_t batch_feats,
+                      std::vector<int> batch_feats_lens);
+  // Pipelined version of Decode, the feature and encoder stage of a batch
+  // runs while the previous batch is in the search and rescoring stage.
+  // The results are returned by the future, so batch_result() is not
+  // touched and DecodeAsync can be called again before the future is ready.
+  std::future<std::vector<std::vector<DecodeResult>>> DecodeAsync(
+      std::vector<std::vector<float>> wavs);
   void Reset();
 
   int frame_shift_in_ms() const {
-    return model_->subsampling_rate() *
+    int subsampling_rate = model_ != nullptr
+                               ? model_->subsampling_rate()
+                               : resource_->model->subsampling_rate();
+    return subsampling_rate *
            feature_config_->frame_shift * 1000 /
            feature_config_->sample_rate;
   }
@@ -62,46 +88,123 @@ class BatchAsrDecoder {
   const std::vector<std::vector<DecodeResult>>& batch_result() const {
     return batch_result_; }
   const std::string get_batch_result(int nbest, bool enable_timestamp);
+  static std::string SerializeBatchResult(
+      const std::vector<std::vector<DecodeResult>>& batch_result, int nbest,
+      bool enable_timestamp);
 
  private:
   Fbank fbank_;
+#ifdef USE_GPU
   FbankCuda fbank_cuda_;
+#endif
+  std::shared_ptr<FeaturePlacer> feature_placer_;
+
+  // Split the utterances sorted by length into the sub batches of
+  // max_batch_frames, each of the indexes of the utterances. A single sub
+  // batch of all of them if it's 0 or they fit.
+  std::vector<std::vector<int>> SplitBatch(
+      const std::vector<std::vector<float>>& wavs) const;
+  std::vector<std::vector<int>> SplitBatch(
+      const std::vector<int64_t>& num_frames) const;
+  // DecodeOptions::streaming_batch, each utterance is decoded by an
+  // AsrDecoder on a task of the thread pool, so the number of the chunks
+  // forwarded together is bounded by the threads of the pool. The final
+  // results of the endpoints are joined into the 1-best.
+  void DecodeStreaming(const std::vector<std::vector<float>>& wavs,
+                       std::vector<std::vector<DecodeResult>>* batch_result);
+  void DecodeBatch(BatchAsrModel* model,
+                   const std::vector<std::vector<float>>& wavs,
+                   std::vector<std::vector<DecodeResult>>* batch_result);
+  // The stages of Decode
+  void ForwardBatch(BatchAsrModel* model,
+                    const std::vector<std::vector<float>>& wavs,
+                    BatchTopK* batch_topk);
+  // The encoder forward of ForwardBatch on the padded host features
+  void ForwardFeatures(BatchAsrModel* model,
+                       const batch_feature_t& batch_feats,
+                       const std::vector<int>& batch_feats_lens,
+                       BatchTopK* batch_topk);
+  // The search and the rescoring of the batch after ForwardBatch
+  void SearchAndRescore(BatchAsrModel* model, const BatchTopK& batch_topk,
+                        std::vector<std::vector<DecodeResult>>* batch_result);
+  void SearchBatch(
+      const BatchTopK& batch_topk,
+      std::vector<std::vector<std::vector<int>>>* batch_hyps,
+      std::vector<std::vector<DecodeResult>>* batch_result);
+  void RescoreBatch(
+      BatchAsrModel* model,
+      const std::vector<std::vector<std::vector<int>>>& batch_hyps,
+      std::vector<std::vector<DecodeResult>>* batch_result);
+  // Search and rescoring by BatchCtcPrefixBeamSearch, or by
+  // BatchCtcWfstBeamSearch with the WFST, on the device, with the topk ctc
+  // outputs kept in the model by ForwardBatch
+  void SearchAndRescoreGpu(
+      BatchAsrModel* model,
+      std::vector<std::vector<DecodeResult>>* batch_result);
 
   void ComputeFeatureCpu(
       const std::vector<std::vector<float>>& wavs,
       batch_feature_t* batch_feats,
       std::vector<int>* batch_feats_lens);
-  void FbankWorker(const std::vector<float>& wav, int index);
-  std::vector<std::pair<int, feature_t>> batch_feats_;  // for FbankWorker
-  std::vector<std::pair<int, int>> batch_feats_lens_;  // for FbankWorker
+  void PadFeatures(const std::vector<int>& batch_feats_lens,
+                   batch_feature_t* batch_feats) const;
 
+  // Search one utterance, then write the padded hyps and the result to the
+  // slots of the utterance, so no lock is required.
   void SearchWorker(
-      const std::vector<std::vector<float>>& topk_scores,
-      const std::vector<std::vector<int>>& topk_indexs,
-      int index);
-  std::mutex mutex_;
-  // for SearchWorker
-  std::vector<std::pair<int, std::vector<std::vector<int>>>> batch_hyps_;
-  std::vector<std::pair<int, std::vector<DecodeResult>>> batch_pair_result_;
+      const MatrixView<float>& topk_scores,
+      const MatrixView<int32_t>& topk_indexs,
+      int index,
+      std::vector<std::vector<int>>* hyps,
+      std::vector<DecodeResult>* result);
   std::vector<std::vector<DecodeResult>> batch_result_;
 
+  // Searchers are expensive to create(especially the WFST one), so they are
+  // kept in a free list and reused by the search workers.
+  std::unique_ptr<SearchInterface> AcquireSearcher();
+  void ReleaseSearcher(std::unique_ptr<SearchInterface> searcher);
+  std::unique_ptr<SearchInterface> CreateSearcher() const;
+  std::mutex searcher_mutex_;
+  std::vector<std::unique_ptr<SearchInterface>> free_searchers_;
+
+  // Shared by all the decoders of the resource if it's given
+  std::shared_ptr<ThreadPool> thread_pool_;
+
+  // For DecodeAsync, created on the first call
+  static constexpr int kPipelineDepth = 2;
+  std::mutex pipeline_mutex_;
+  std::condition_variable model_cond_;
+  std::vector<std::shared_ptr<BatchAsrModel>> free_models_;
+  std::unique_ptr<ThreadPool> encoder_stage_ = nullptr;
+  std::unique_ptr<ThreadPool> search_stage_ = nullptr;
+
   void UpdateResult(SearchInterface* searcher,
       std::vector<DecodeResult>* result);
+  void UpdateResult(const std::vector<std::vector<int>>& hypotheses,
+                    const std::vector<std::vector<int>>& inputs,
+                    const std::vector<float>& likelihood,
+                    const std::vector<std::vector<int>>& times,
+                    SearchType search_type,
+                    std::vector<DecodeResult>* result);
 
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  // Null for DecodeOptions::streaming_batch without the batch model
   std::shared_ptr<BatchAsrModel> model_;
   std::shared_ptr<PostProcessor> post_processor_;
 
   std::shared_ptr<fst::Fst<fst::StdArc>> fst_ = nullptr;
-  // output symbol table
-  std::shared_ptr<fst::SymbolTable> symbol_table_;
-  // e2e unit symbol table
-  std::shared_ptr<fst::SymbolTable> unit_table_ = nullptr;
+  // output symbols
+  std::shared_ptr<const SymbolMap> symbols_;
+  // e2e unit symbols
+  std::shared_ptr<const SymbolMap> units_ = nullptr;
   std::shared_ptr<DecodeResource> resource_ = nullptr;
   const DecodeOptions& opts_;
   int beam_size_;
+  // Only for BatchTorchAsrModel without the context graph
+  bool use_gpu_search_ = false;
+  // The WFST on the device of the model for the GPU search
+  std::shared_ptr<CsrFst> csr_fst_ = nullptr;
   const int time_stamp_gap_ = 100;  // timestamp gap between words in a sentence
-  std::unique_ptr<SearchInterface> searcher_;
 
  public:
   WENET_DISALLOW_COPY_AND_ASSIGN(BatchAsrDecoder);
@@ -5,12 +5,14 @@
 #ifndef DECODER_BATCH_ASR_MODEL_H_
 #define DECODER_BATCH_ASR_MODEL_H_
 
+#include <algorithm>
 #include <limits>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "torch/torch.h"
+#include "utils/matrix.h"
 #include "utils/timer.h"
 #include "utils/utils.h"
 
@@ -21,6 +23,27 @@ using batch_feature_t = std::vector<feature_t>;
 using ctc_log_prob_t = std::vector<std::vector<float>>;
 using batch_ctc_log_prob_t = std::vector<ctc_log_prob_t>;
 
+// The topk ctc outputs of a batch. The scores and the token ids are each one
+// contiguous (B, Tmax, k) host tensor, pinned if they are copied from GPU,
+// and the frames of utterance b after lens[b] are padding.
+struct BatchTopK {
+  torch::Tensor scores;  // float
+  torch::Tensor indexs;  // int32
+  std::vector<int> lens;
+
+  int batch_size() const { return static_cast<int>(lens.size()); }
+  // The [lens[b], k] topk of utterance b, read in place
+  MatrixView<float> Scores(int b) const {
+    return MatrixView<float>(scores.data_ptr<float>() + b * scores.stride(0),
+                             lens[b], scores.size(2), scores.stride(1));
+  }
+  MatrixView<int32_t> Indexs(int b) const {
+    return MatrixView<int32_t>(
+        indexs.data_ptr<int32_t>() + b * indexs.stride(0), lens[b],
+        indexs.size(2), indexs.stride(1));
+  }
+};
+
 class BatchAsrModel {
  public:
   virtual int right_context() const { return right_context_; }
@@ -31,17 +54,15 @@ class BatchAsrModel {
     return is_bidirectional_decoder_;
   }
 
-  virtual void ForwardEncoder(
-      const batch_feature_t& batch_feats,
-      const std::vector<int>& batch_feats_lens,
-      std::vector<std::vector<std::vector<float>>>* batch_topk_scores,
-      std::vector<std::vector<std::vector<int32_t>>>* batch_topk_indexs) = 0;
-  virtual void ForwardEncoder(
-      const std::vector<torch::Tensor>& batch_feats,
-      const std::vector<int>& batch_feats_lens,
-      std::vector<std::vector<std::vector<float>>>* batch_topk_scores,
-      std::vector<std::vector<std::vector<int32_t>>>* batch_topk_indexs) {};
+  virtual void ForwardEncoder(const batch_feature_t& batch_feats,
+                              const std::vector<int>& batch_feats_lens,
+                              BatchTopK* batch_topk) = 0;
+  virtual void ForwardEncoder(const std::vector<torch::Tensor>& batch_feats,
+                              const std::vector<int>& batch_feats_lens,
+                              BatchTopK* batch_topk) {}
 
+  // The n-best of the utterances may be of different sizes, the scores of
+  // utterance b are of the size of batch_hyps[b]
   virtual void AttentionRescoring(
       const std::vector<std::vector<std::vector<int>>>& batch_hyps,
       const std::vector<std::vector<float>>& ctc_scores,
@@ -50,6 +71,31 @@ class BatchAsrModel {
   virtual std::shared_ptr<BatchAsrModel> Copy() const = 0;
 
  protected:
+  // Pad the n-best of the utterances to the largest one by {0} hyps of
+  // score 0, for the decoders taking the (B, beam) hyps. Return false if
+  // they are of the same size, then nothing is padded.
+  static bool PadHyps(
+      const std::vector<std::vector<std::vector<int>>>& batch_hyps,
+      const std::vector<std::vector<float>>& ctc_scores,
+      std::vector<std::vector<std::vector<int>>>* padded_hyps,
+      std::vector<std::vector<float>>* padded_scores) {
+    size_t beam_size = 0;
+    bool ragged = false;
+    for (const auto& hyps : batch_hyps) {
+      if (beam_size > 0 && hyps.size() != beam_size) ragged = true;
+      beam_size = std::max(beam_size, hyps.size());
+    }
+    if (!ragged && beam_size > 0) return false;
+    *padded_hyps = batch_hyps;
+    *padded_scores = ctc_scores;
+    for (size_t i = 0; i < batch_hyps.size(); ++i) {
+      (*padded_hyps)[i].resize(std::max<size_t>(beam_size, 1),
+                               std::vector<int>{0});
+      (*padded_scores)[i].resize((*padded_hyps)[i].size(), 0);
+    }
+    return true;
+  }
+
   int right_context_ = 1;
   int subsampling_rate_ = 1;
   int sos_ = 0;
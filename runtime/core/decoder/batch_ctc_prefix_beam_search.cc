@@ -0,0 +1,230 @@
+// Copyright (c) 2022 SoundDataConverge Co.LTD (Weiliang Chong)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/batch_ctc_prefix_beam_search.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <tuple>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+BatchCtcPrefixBeamSearch::BatchCtcPrefixBeamSearch(
+    const CtcPrefixBeamSearchOptions& opts)
+    : opts_(opts) {}
+
+// The same token passing of CtcPrefixBeamSearch, see
+// https://robin1001.github.io/2020/12/11/ctc-search
+void BatchCtcPrefixBeamSearch::Search(const torch::Tensor& topk_scores,
+                                      const torch::Tensor& topk_indexs,
+                                      const torch::Tensor& lens) {
+  CHECK_EQ(topk_scores.dim(), 3);
+  CHECK_EQ(topk_indexs.dim(), 3);
+  torch::NoGradGuard no_grad;
+  const int batch_size = topk_scores.size(0);
+  const int num_frames = topk_scores.size(1);
+  const int k = topk_scores.size(2);
+  const int beam = opts_.second_beam_size;
+  // The unchanged prefixes first, then the extended ones of each hypothesis
+  const int num_cands = beam * (k + 1);
+  const int max_len = std::max(num_frames, 1);
+  const float kNegInf = -std::numeric_limits<float>::infinity();
+  auto float_opts = topk_scores.options().dtype(torch::kFloat);
+  auto long_opts = topk_scores.options().dtype(torch::kLong);
+  torch::Tensor scores = topk_scores.to(torch::kFloat);
+  torch::Tensor indexs = topk_indexs.to(long_opts);
+  torch::Tensor valid_lens = lens.to(long_opts).unsqueeze(1);  // (B, 1)
+
+  // Only the empty prefix is alive at first
+  torch::Tensor s = torch::full({batch_size, beam}, kNegInf, float_opts);
+  s.select(1, 0).fill_(0);
+  torch::Tensor ns = torch::full({batch_size, beam}, kNegInf, float_opts);
+  torch::Tensor hyps = torch::zeros({batch_size, beam, max_len}, long_opts);
+  torch::Tensor times = torch::zeros({batch_size, beam, max_len}, long_opts);
+  torch::Tensor hyps_lens = torch::zeros({batch_size, beam}, long_opts);
+  torch::Tensor last = torch::full({batch_size, beam}, -1, long_opts);
+  auto bool_opts = long_opts.dtype(torch::kBool);
+  // pre[b][q][p] is true if the hyp p is a prefix of the hyp q, all of them
+  // are the empty prefix at first
+  torch::Tensor pre = torch::ones({batch_size, beam, beam}, bool_opts);
+  // The topk of a frame are different tokens, so two extensions of the same
+  // prefix are the same only if they are of the same one of the topk
+  torch::Tensor same_token = torch::eye(k, bool_opts).view({1, 1, k, 1, k});
+  // earlier[i][j] is true if j < i, the first one of the same prefixes in the
+  // candidates is kept
+  torch::Tensor earlier =
+      torch::ones({num_cands, num_cands}, bool_opts).tril(-1);
+
+  for (int t = 0; t < num_frames; ++t) {
+    torch::Tensor prob = scores.select(1, t).unsqueeze(1);  // (B, 1, K)
+    torch::Tensor id = indexs.select(1, t).unsqueeze(1);    // (B, 1, K)
+    torch::Tensor score = torch::logaddexp(s, ns);          // (B, beam)
+    torch::Tensor is_blank = id == opts_.blank;             // (B, 1, K)
+    torch::Tensor is_last = id == last.unsqueeze(2);        // (B, beam, K)
+
+    // 1. Candidates of the unchanged prefixes
+    // Case 0: *a + ε => *a
+    torch::Tensor blank_prob =
+        prob.masked_fill(~is_blank, kNegInf).logsumexp(2);  // (B, 1)
+    torch::Tensor stay_s = score + blank_prob;
+    // Case 1: *a + a => *a
+    torch::Tensor stay_ns = (ns.unsqueeze(2) + prob)
+                                .masked_fill(~is_last, kNegInf)
+                                .logsumexp(2);
+
+    // 2. Candidates of the extended prefixes
+    // Case 2: *aε + a => *aa
+    // Case 3: *a + b => *ab, *aε + b => *ab
+    torch::Tensor ext_ns =
+        torch::where(is_last, s.unsqueeze(2), score.unsqueeze(2)) + prob;
+    ext_ns = ext_ns.masked_fill(is_blank, kNegInf).reshape({batch_size, -1});
+
+    torch::Tensor cand_s = torch::cat(
+        {stay_s, torch::full({batch_size, beam * k}, kNegInf, float_opts)}, 1);
+    torch::Tensor cand_ns = torch::cat({stay_ns, ext_ns}, 1);
+
+    // 3. The prefix relation of the candidates from the one of the hyps, q
+    // and p are the hyps, a and b the tokens of their extensions q+b, p+a
+    torch::Tensor lens_q = hyps_lens.unsqueeze(2);  // (B, beam, 1)
+    torch::Tensor lens_p = hyps_lens.unsqueeze(1);  // (B, 1, beam)
+    // The token of q after the length of p, (B, beam, beam)
+    torch::Tensor next_token = hyps.gather(
+        2, hyps_lens.clamp_max(max_len - 1)
+               .unsqueeze(1)
+               .expand({batch_size, beam, beam}));
+    torch::Tensor eq = pre & pre.transpose(1, 2);
+    // p+a is a prefix of q, (B, q, p, a)
+    torch::Tensor ext_of_stay = (pre & (lens_q > lens_p)).unsqueeze(3) &
+                                (next_token.unsqueeze(3) == id.unsqueeze(1));
+    // p is a prefix of q+b if it is one of q or it is q+b, (B, q, b, p)
+    torch::Tensor stay_of_ext =
+        pre.unsqueeze(2) |
+        ((pre.transpose(1, 2) & (lens_p == lens_q + 1)).unsqueeze(2) &
+         (last.reshape({batch_size, 1, 1, beam}) ==
+          id.reshape({batch_size, 1, k, 1})));
+    // p+a is a prefix of q+b if it is one of q or it is q+b, (B, q, b, p, a)
+    torch::Tensor ext_of_ext = ext_of_stay.unsqueeze(2) |
+                               (eq.unsqueeze(2).unsqueeze(4) & same_token);
+    torch::Tensor cand_pre = torch::cat(
+        {torch::cat({pre, ext_of_stay.reshape({batch_size, beam, -1})}, 2),
+         torch::cat({stay_of_ext.reshape({batch_size, -1, beam}),
+                     ext_of_ext.reshape({batch_size, beam * k, -1})},
+                    2)},
+        1);  // (B, C, C)
+
+    // 4. Merge the same prefixes, every one of them gets the merged scores,
+    // and only the first one is kept
+    torch::Tensor same = cand_pre & cand_pre.transpose(1, 2);  // (B, C, C)
+    torch::Tensor merged_s =
+        cand_s.unsqueeze(1).masked_fill(~same, kNegInf).logsumexp(2);
+    torch::Tensor merged_ns =
+        cand_ns.unsqueeze(1).masked_fill(~same, kNegInf).logsumexp(2);
+    torch::Tensor duplicated = (same & earlier).any(2);
+    torch::Tensor total = torch::logaddexp(merged_s, merged_ns)
+                              .masked_fill(duplicated, kNegInf);
+
+    // 5. Beam prune, and append the token to the extended prefixes
+    torch::Tensor best = std::get<1>(total.topk(beam, 1));  // (B, beam)
+    torch::Tensor is_ext = best >= beam;
+    torch::Tensor ext_index = (best - beam).clamp_min(0);
+    torch::Tensor parent =
+        torch::where(is_ext, torch::div(ext_index, k, "floor"), best);
+    torch::Tensor token =
+        id.squeeze(1).gather(1, torch::remainder(ext_index, k));
+    torch::Tensor parent_index =
+        parent.unsqueeze(2).expand({batch_size, beam, max_len});
+    torch::Tensor new_hyps = hyps.gather(1, parent_index);
+    torch::Tensor new_times = times.gather(1, parent_index);
+    torch::Tensor new_lens = hyps_lens.gather(1, parent);
+    torch::Tensor pos = new_lens.clamp_max(max_len - 1).unsqueeze(2);
+    new_hyps.scatter_(
+        2, pos,
+        torch::where(is_ext, token, new_hyps.gather(2, pos).squeeze(2))
+            .unsqueeze(2));
+    new_times.scatter_(2, pos,
+                       torch::where(is_ext, torch::full_like(token, t),
+                                    new_times.gather(2, pos).squeeze(2))
+                           .unsqueeze(2));
+    new_lens += is_ext.to(torch::kLong);
+    torch::Tensor new_last =
+        torch::where(is_ext, token, last.gather(1, parent));
+
+    torch::Tensor new_pre =
+        cand_pre
+            .gather(1, best.unsqueeze(2).expand({batch_size, beam, num_cands}))
+            .gather(2, best.unsqueeze(1).expand({batch_size, beam, beam}));
+
+    // 6. Padding frames of the shorter utterances keep their hypotheses
+    torch::Tensor active = valid_lens > t;  // (B, 1)
+    s = torch::where(active, merged_s.gather(1, best), s);
+    ns = torch::where(active, merged_ns.gather(1, best), ns);
+    pre = torch::where(active.unsqueeze(2), new_pre, pre);
+    last = torch::where(active, new_last, last);
+    hyps_lens = torch::where(active, new_lens, hyps_lens);
+    hyps = torch::where(active.unsqueeze(2), new_hyps, hyps);
+    times = torch::where(active.unsqueeze(2), new_times, times);
+  }
+
+  // The beam is sorted by topk, the padding frames don't change the order
+  scores_ = torch::logaddexp(s, ns);
+  int64_t len = std::max<int64_t>(hyps_lens.max().item<int64_t>(), 1);
+  hyps_ = hyps.narrow(2, 0, len);
+  times_ = times.narrow(2, 0, len);
+  hyps_lens_ = hyps_lens;
+}
+
+void BatchCtcPrefixBeamSearch::GetResults(
+    std::vector<std::vector<std::vector<int>>>* hyps,
+    std::vector<std::vector<float>>* scores,
+    std::vector<std::vector<std::vector<int>>>* times) const {
+  torch::Tensor cpu_hyps = hyps_.to(torch::kCPU).to(torch::kInt).contiguous();
+  torch::Tensor cpu_times =
+      times_.to(torch::kCPU).to(torch::kInt).contiguous();
+  torch::Tensor cpu_lens =
+      hyps_lens_.to(torch::kCPU).to(torch::kInt).contiguous();
+  torch::Tensor cpu_scores = scores_.to(torch::kCPU).contiguous();
+  const int batch_size = cpu_hyps.size(0);
+  const int beam = cpu_hyps.size(1);
+  const int len = cpu_hyps.size(2);
+  const int* hyps_data = cpu_hyps.data_ptr<int>();
+  const int* times_data = cpu_times.data_ptr<int>();
+  const int* lens_data = cpu_lens.data_ptr<int>();
+  const float* scores_data = cpu_scores.data_ptr<float>();
+  hyps->resize(batch_size);
+  scores->resize(batch_size);
+  times->resize(batch_size);
+  for (int i = 0; i < batch_size; ++i) {
+    // The beam is padded by the prefixes of -inf if fewer are alive, which
+    // are the last ones
+    int n_best = 0;
+    while (n_best < beam && !std::isinf(scores_data[i * beam + n_best])) {
+      ++n_best;
+    }
+    (*hyps)[i].resize(n_best);
+    (*times)[i].resize(n_best);
+    (*scores)[i].assign(scores_data + i * beam,
+                        scores_data + i * beam + n_best);
+    for (int j = 0; j < n_best; ++j) {
+      int offset = (i * beam + j) * len;
+      int n = lens_data[i * beam + j];
+      (*hyps)[i][j].assign(hyps_data + offset, hyps_data + offset + n);
+      (*times)[i][j].assign(times_data + offset, times_data + offset + n);
+    }
+  }
+}
+
+}  // namespace wenet
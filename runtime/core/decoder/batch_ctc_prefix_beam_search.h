@@ -0,0 +1,73 @@
+// Copyright (c) 2022 SoundDataConverge Co.LTD (Weiliang Chong)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_BATCH_CTC_PREFIX_BEAM_SEARCH_H_
+#define DECODER_BATCH_CTC_PREFIX_BEAM_SEARCH_H_
+
+#include <vector>
+
+#include "torch/torch.h"
+
+#include "decoder/ctc_prefix_beam_search.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// CTC prefix beam search of a whole batch with tensor ops, so it runs on the
+// device of the topk ctc outputs of the model, and there is no copy of them
+// to the host. All the utterances and all the hypotheses of a frame are
+// processed together, the prefixes are kept as padded token tensors, and
+// the relation of which of them is a prefix of which, from which the same
+// prefixes of the candidates of a frame are found exactly to be merged.
+// Compared with CtcPrefixBeamSearch, context biasing and viterbi scores are
+// not supported, and the time of a token is the frame it is emitted first.
+class BatchCtcPrefixBeamSearch {
+ public:
+  explicit BatchCtcPrefixBeamSearch(const CtcPrefixBeamSearchOptions& opts);
+
+  // topk_scores/topk_indexs: (B, T, K) topk ctc log probs and token ids,
+  // lens: (B,) number of valid frames of each utterance
+  void Search(const torch::Tensor& topk_scores,
+              const torch::Tensor& topk_indexs, const torch::Tensor& lens);
+
+  // Results on the device, sorted by score for each utterance, the beam is
+  // padded by the hyps of score -inf if fewer prefixes are alive
+  // (B, beam, L) token ids padded by 0, L is the max length of the hyps
+  const torch::Tensor& hyps() const { return hyps_; }
+  // (B, beam) lengths of the hyps
+  const torch::Tensor& hyps_lens() const { return hyps_lens_; }
+  // (B, beam) prefix scores
+  const torch::Tensor& scores() const { return scores_; }
+  // (B, beam, L) emitting frame of the tokens
+  const torch::Tensor& times() const { return times_; }
+
+  // Copy the results to the host, without the padding hyps of -inf
+  void GetResults(std::vector<std::vector<std::vector<int>>>* hyps,
+                  std::vector<std::vector<float>>* scores,
+                  std::vector<std::vector<std::vector<int>>>* times) const;
+
+ private:
+  const CtcPrefixBeamSearchOptions& opts_;
+  torch::Tensor hyps_;
+  torch::Tensor hyps_lens_;
+  torch::Tensor scores_;
+  torch::Tensor times_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(BatchCtcPrefixBeamSearch);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_BATCH_CTC_PREFIX_BEAM_SEARCH_H_
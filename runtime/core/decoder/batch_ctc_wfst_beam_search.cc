@@ -0,0 +1,385 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/batch_ctc_wfst_beam_search.h"
+
+#include <algorithm>
+#include <memory>
+#include <tuple>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+// The epsilon arcs followed from a token in a frame, which is about the
+// order of the backoff of G
+static const int kMaxEpsilonSteps = 16;
+// Not a plain bool, which would be taken as the dim of sort
+static const c10::optional<bool> kStable = true;
+
+template <typename T>
+static torch::Tensor ToDevice(const std::vector<T>& data,
+                              torch::ScalarType type, torch::Device device) {
+  if (data.empty()) {
+    return torch::empty({0}, torch::TensorOptions().dtype(type).device(device));
+  }
+  torch::Tensor tensor =
+      torch::from_blob(const_cast<T*>(data.data()),
+                       {static_cast<int64_t>(data.size())}, type);
+  // Copy it even on CPU, the data is freed by the caller
+  return tensor.to(device, type, false, true);
+}
+
+CsrFst::CsrFst(const fst::Fst<fst::StdArc>& shared_fst,
+               torch::Device device) {
+  // The decoders may be built on several threads, and the shared graph like
+  // QuantizedFst can't be expanded concurrently, so the arcs are read from a
+  // thread safe copy
+  std::unique_ptr<fst::Fst<fst::StdArc>> copy(shared_fst.Copy(true));
+  const fst::Fst<fst::StdArc>& fst = *copy;
+  num_states = fst::CountStates(fst);
+  start = fst.Start();
+  CHECK_GE(start, 0) << "Empty fst";
+  std::vector<int64_t> emit_offsets_host(1, 0), eps_offsets_host(1, 0);
+  std::vector<int64_t> emit_ilabels_host, emit_olabels_host;
+  std::vector<int64_t> emit_nextstates_host, eps_nextstates_host;
+  std::vector<int64_t> eps_olabels_host;
+  std::vector<float> emit_weights_host, eps_weights_host, finals_host;
+  finals_host.reserve(num_states);
+  for (int s = 0; s < num_states; ++s) {
+    for (fst::ArcIterator<fst::Fst<fst::StdArc>> aiter(fst, s); !aiter.Done();
+         aiter.Next()) {
+      const fst::StdArc& arc = aiter.Value();
+      if (arc.ilabel == 0) {
+        eps_olabels_host.push_back(arc.olabel);
+        eps_weights_host.push_back(arc.weight.Value());
+        eps_nextstates_host.push_back(arc.nextstate);
+      } else {
+        emit_ilabels_host.push_back(arc.ilabel);
+        emit_olabels_host.push_back(arc.olabel);
+        emit_weights_host.push_back(arc.weight.Value());
+        emit_nextstates_host.push_back(arc.nextstate);
+        max_ilabel = std::max(max_ilabel, static_cast<int>(arc.ilabel));
+      }
+    }
+    emit_offsets_host.push_back(emit_ilabels_host.size());
+    eps_offsets_host.push_back(eps_olabels_host.size());
+    // The weight of a non final state is Zero(), which is inf
+    finals_host.push_back(fst.Final(s).Value());
+  }
+  emit_offsets = ToDevice(emit_offsets_host, torch::kLong, device);
+  emit_ilabels = ToDevice(emit_ilabels_host, torch::kLong, device);
+  emit_olabels = ToDevice(emit_olabels_host, torch::kLong, device);
+  emit_weights = ToDevice(emit_weights_host, torch::kFloat, device);
+  emit_nextstates = ToDevice(emit_nextstates_host, torch::kLong, device);
+  eps_offsets = ToDevice(eps_offsets_host, torch::kLong, device);
+  eps_olabels = ToDevice(eps_olabels_host, torch::kLong, device);
+  eps_weights = ToDevice(eps_weights_host, torch::kFloat, device);
+  eps_nextstates = ToDevice(eps_nextstates_host, torch::kLong, device);
+  finals = ToDevice(finals_host, torch::kFloat, device);
+  LOG(INFO) << "CsrFst of " << num_states << " states, "
+            << emit_ilabels_host.size() << " emitting arcs and "
+            << eps_olabels_host.size() << " epsilon arcs on " << device;
+}
+
+// The source token and the arc of each out arc of the states
+static void ExpandArcs(const torch::Tensor& states,
+                       const torch::Tensor& offsets, torch::Tensor* src,
+                       torch::Tensor* arcs) {
+  torch::Tensor begin = offsets.index_select(0, states);
+  torch::Tensor degree = offsets.index_select(0, states + 1) - begin;
+  *src = torch::repeat_interleave(degree);
+  torch::Tensor first = degree.cumsum(0) - degree;
+  *arcs = begin.index_select(0, *src) +
+          torch::arange(src->size(0), states.options()) -
+          first.index_select(0, *src);
+}
+
+BatchCtcWfstBeamSearch::Tokens BatchCtcWfstBeamSearch::Tokens::Select(
+    const torch::Tensor& index) const {
+  Tokens tokens;
+  tokens.batch = batch.index_select(0, index);
+  tokens.state = state.index_select(0, index);
+  tokens.cost = cost.index_select(0, index);
+  tokens.in_trace = in_trace.index_select(0, index);
+  tokens.out_trace = out_trace.index_select(0, index);
+  tokens.last = last.index_select(0, index);
+  tokens.in_label = in_label.index_select(0, index);
+  tokens.out_label = out_label.index_select(0, index);
+  tokens.fresh = fresh.index_select(0, index);
+  return tokens;
+}
+
+BatchCtcWfstBeamSearch::Tokens BatchCtcWfstBeamSearch::Tokens::Cat(
+    const Tokens& a, const Tokens& b) {
+  Tokens tokens;
+  tokens.batch = torch::cat({a.batch, b.batch});
+  tokens.state = torch::cat({a.state, b.state});
+  tokens.cost = torch::cat({a.cost, b.cost});
+  tokens.in_trace = torch::cat({a.in_trace, b.in_trace});
+  tokens.out_trace = torch::cat({a.out_trace, b.out_trace});
+  tokens.last = torch::cat({a.last, b.last});
+  tokens.in_label = torch::cat({a.in_label, b.in_label});
+  tokens.out_label = torch::cat({a.out_label, b.out_label});
+  tokens.fresh = torch::cat({a.fresh, b.fresh});
+  return tokens;
+}
+
+torch::Tensor BatchCtcWfstBeamSearch::Trace::Append(
+    const torch::Tensor& prev, const torch::Tensor& label, int frame) {
+  torch::Tensor index = (label >= 0).nonzero().squeeze(1);
+  int64_t n = index.size(0);
+  if (n == 0) return prev;
+  prevs.push_back(prev.index_select(0, index).to(torch::kInt));
+  labels.push_back(label.index_select(0, index).to(torch::kInt));
+  frames.push_back(torch::full({n}, frame, prevs.back().options()));
+  torch::Tensor trace = prev.index_copy(
+      0, index, torch::arange(size, size + n, prev.options()));
+  size += n;
+  return trace;
+}
+
+void BatchCtcWfstBeamSearch::Trace::Clear() {
+  prevs.clear();
+  labels.clear();
+  frames.clear();
+  size = 0;
+}
+
+void BatchCtcWfstBeamSearch::Trace::ToHost(std::vector<int>* prev,
+                                           std::vector<int>* label,
+                                           std::vector<int>* frame) const {
+  prev->clear();
+  label->clear();
+  frame->clear();
+  if (size == 0) return;
+  auto copy = [](const std::vector<torch::Tensor>& chunks,
+                 std::vector<int>* out) {
+    torch::Tensor data =
+        torch::cat(chunks).to(torch::kCPU).to(torch::kInt).contiguous();
+    out->assign(data.data_ptr<int>(), data.data_ptr<int>() + data.numel());
+  };
+  copy(prevs, prev);
+  copy(labels, label);
+  copy(frames, frame);
+}
+
+BatchCtcWfstBeamSearch::BatchCtcWfstBeamSearch(
+    const CsrFst& fst, const CtcWfstBeamSearchOptions& opts)
+    : fst_(fst), opts_(opts) {}
+
+BatchCtcWfstBeamSearch::Tokens BatchCtcWfstBeamSearch::Emit(
+    const Tokens& tokens, const torch::Tensor& table) const {
+  torch::Tensor src, arcs;
+  ExpandArcs(tokens.state, fst_.emit_offsets, &src, &arcs);
+  Tokens cands = tokens.Select(src);
+  torch::Tensor ilabel = fst_.emit_ilabels.index_select(0, arcs);
+  torch::Tensor olabel = fst_.emit_olabels.index_select(0, arcs);
+  torch::Tensor am = table.view(-1).index_select(
+      0, cands.batch * table.size(1) + ilabel);
+  cands.state = fst_.emit_nextstates.index_select(0, arcs);
+  cands.cost = cands.cost + fst_.emit_weights.index_select(0, arcs) -
+               opts_.acoustic_scale * am;
+  // Ilabel 1 is the blank, and the repeats of the last token are merged as
+  // ConvertToInputs of CtcWfstBeamSearch does
+  torch::Tensor new_token = (ilabel != 1) & (ilabel != cands.last);
+  cands.in_label = (ilabel - 1).masked_fill(~new_token, -1);
+  cands.out_label = olabel.masked_fill(olabel == 0, -1);
+  cands.last = ilabel;
+  cands.fresh = torch::ones_like(cands.fresh);
+  return cands;
+}
+
+void BatchCtcWfstBeamSearch::CloseEpsilon(int frame, Tokens* tokens) {
+  for (int i = 0; i < kMaxEpsilonSteps; ++i) {
+    torch::Tensor frontier = tokens->fresh.nonzero().squeeze(1);
+    if (frontier.size(0) == 0) break;
+    Tokens from = tokens->Select(frontier);
+    torch::Tensor src, arcs;
+    ExpandArcs(from.state, fst_.eps_offsets, &src, &arcs);
+    if (src.size(0) == 0) break;
+    Tokens cands = from.Select(src);
+    torch::Tensor olabel = fst_.eps_olabels.index_select(0, arcs);
+    cands.state = fst_.eps_nextstates.index_select(0, arcs);
+    cands.cost = cands.cost + fst_.eps_weights.index_select(0, arcs);
+    cands.out_label = olabel.masked_fill(olabel == 0, -1);
+    Tokens old = *tokens;
+    old.fresh = torch::zeros_like(old.fresh);
+    // The new ones survive only if they are better than the old ones of
+    // the same states, so it converges without negative cycles
+    *tokens = Prune(Tokens::Cat(old, cands), frame);
+  }
+}
+
+BatchCtcWfstBeamSearch::Tokens BatchCtcWfstBeamSearch::Prune(
+    const Tokens& cands, int frame) {
+  torch::Tensor order = torch::isfinite(cands.cost).nonzero().squeeze(1);
+  // 1. Recombine, keep the best one of the same state of an utterance
+  torch::Tensor cost = cands.cost.index_select(0, order);
+  order = order.index_select(0, std::get<1>(cost.sort()));
+  torch::Tensor key =
+      (cands.batch * fst_.num_states + cands.state).index_select(0, order);
+  torch::Tensor sorted_key, index;
+  std::tie(sorted_key, index) = key.sort(kStable, 0);
+  order = order.index_select(0, index);
+  torch::Tensor first = torch::ones_like(sorted_key, torch::kBool);
+  if (sorted_key.size(0) > 1) {
+    first.narrow(0, 1, sorted_key.size(0) - 1)
+        .copy_(sorted_key.narrow(0, 1, sorted_key.size(0) - 1) !=
+               sorted_key.narrow(0, 0, sorted_key.size(0) - 1));
+  }
+  order = order.masked_select(first);
+
+  // 2. Prune by the beam and max_active of each utterance, the tokens are
+  // grouped by the utterance and sorted by the cost in the group
+  cost = cands.cost.index_select(0, order);
+  order = order.index_select(0, std::get<1>(cost.sort()));
+  torch::Tensor batch = cands.batch.index_select(0, order);
+  order = order.index_select(0, std::get<1>(batch.sort(kStable, 0)));
+  batch = cands.batch.index_select(0, order);
+  cost = cands.cost.index_select(0, order);
+  torch::Tensor counts = torch::bincount(batch, {}, batch_size_);
+  torch::Tensor starts = counts.cumsum(0) - counts;
+  torch::Tensor start = starts.index_select(0, batch);
+  torch::Tensor rank = torch::arange(batch.size(0), batch.options()) - start;
+  torch::Tensor best = cost.index_select(0, start);
+  torch::Tensor keep =
+      (rank < opts_.max_active) & (cost <= best + opts_.beam);
+  Tokens tokens = cands.Select(order.masked_select(keep));
+
+  // 3. Trace the labels of the survivors
+  tokens.in_trace = in_trace_.Append(tokens.in_trace, tokens.in_label, frame);
+  tokens.out_trace =
+      out_trace_.Append(tokens.out_trace, tokens.out_label, frame);
+  tokens.in_label = torch::full_like(tokens.in_label, -1);
+  tokens.out_label = torch::full_like(tokens.out_label, -1);
+  return tokens;
+}
+
+void BatchCtcWfstBeamSearch::Search(const torch::Tensor& topk_scores,
+                                    const torch::Tensor& topk_indexs,
+                                    const torch::Tensor& lens) {
+  CHECK_EQ(topk_scores.dim(), 3);
+  CHECK_EQ(topk_indexs.dim(), 3);
+  torch::NoGradGuard no_grad;
+  batch_size_ = topk_scores.size(0);
+  const int num_frames = topk_scores.size(1);
+  const int num_ilabels = fst_.max_ilabel + 1;
+  torch::Device device = fst_.finals.device();
+  auto long_opts = torch::TensorOptions().dtype(torch::kLong).device(device);
+  auto float_opts = long_opts.dtype(torch::kFloat);
+  torch::Tensor scores = topk_scores.to(device, torch::kFloat);
+  // The ilabel of a token is its id + 1, the ones out of the graph go to
+  // the column of epsilon, which no emitting arc reads
+  torch::Tensor ilabels = topk_indexs.to(device, torch::kLong) + 1;
+  ilabels.masked_fill_(ilabels > fst_.max_ilabel, 0);
+  torch::Tensor valid_lens = lens.to(device, torch::kLong);
+  in_trace_.Clear();
+  out_trace_.Clear();
+
+  // One token on the start state of each utterance at first
+  Tokens tokens;
+  tokens.batch = torch::arange(batch_size_, long_opts);
+  tokens.state = torch::full({batch_size_}, fst_.start, long_opts);
+  tokens.cost = torch::zeros({batch_size_}, float_opts);
+  tokens.in_trace = torch::full({batch_size_}, -1, long_opts);
+  tokens.out_trace = torch::full({batch_size_}, -1, long_opts);
+  tokens.last = torch::zeros({batch_size_}, long_opts);
+  tokens.in_label = torch::full({batch_size_}, -1, long_opts);
+  tokens.out_label = torch::full({batch_size_}, -1, long_opts);
+  tokens.fresh = torch::ones({batch_size_}, long_opts.dtype(torch::kBool));
+  CloseEpsilon(0, &tokens);
+
+  for (int t = 0; t < num_frames; ++t) {
+    torch::Tensor table =
+        torch::full({batch_size_, num_ilabels}, opts_.sparse_floor, float_opts);
+    table.scatter_(1, ilabels.select(1, t), scores.select(1, t));
+    // Padding frames of the shorter utterances keep their tokens
+    torch::Tensor active = valid_lens.index_select(0, tokens.batch) > t;
+    Tokens emitting = Emit(tokens.Select(active.nonzero().squeeze(1)), table);
+    Tokens kept = tokens.Select((~active).nonzero().squeeze(1));
+    kept.fresh = torch::zeros_like(kept.fresh);
+    tokens = Prune(Tokens::Cat(emitting, kept), t);
+    CloseEpsilon(t, &tokens);
+  }
+
+  // The utterances of which no token reaches a final state take the costs
+  // of the tokens as they are
+  torch::Tensor cost =
+      tokens.cost + fst_.finals.index_select(0, tokens.state);
+  torch::Tensor reached =
+      torch::bincount(tokens.batch, torch::isfinite(cost).to(torch::kFloat),
+                      batch_size_) > 0;
+  cost = torch::where(reached.index_select(0, tokens.batch), cost,
+                      tokens.cost);
+  torch::Tensor order = torch::isfinite(cost).nonzero().squeeze(1);
+  order =
+      order.index_select(0, std::get<1>(cost.index_select(0, order).sort()));
+  order = order.index_select(
+      0, std::get<1>(tokens.batch.index_select(0, order).sort(kStable, 0)));
+  final_batch_ = tokens.batch.index_select(0, order).to(torch::kCPU)
+                     .to(torch::kInt).contiguous();
+  final_cost_ = cost.index_select(0, order).to(torch::kCPU).contiguous();
+  final_in_trace_ = tokens.in_trace.index_select(0, order).to(torch::kCPU)
+                        .to(torch::kInt).contiguous();
+  final_out_trace_ = tokens.out_trace.index_select(0, order).to(torch::kCPU)
+                         .to(torch::kInt).contiguous();
+}
+
+void BatchCtcWfstBeamSearch::GetResults(
+    std::vector<std::vector<std::vector<int>>>* outputs,
+    std::vector<std::vector<std::vector<int>>>* inputs,
+    std::vector<std::vector<float>>* likelihood,
+    std::vector<std::vector<std::vector<int>>>* times) const {
+  std::vector<int> in_prev, in_label, in_frame;
+  std::vector<int> out_prev, out_label, out_frame;
+  in_trace_.ToHost(&in_prev, &in_label, &in_frame);
+  out_trace_.ToHost(&out_prev, &out_label, &out_frame);
+  outputs->assign(batch_size_, {});
+  inputs->assign(batch_size_, {});
+  likelihood->assign(batch_size_, {});
+  times->assign(batch_size_, {});
+  const int num_tokens = final_batch_.numel();
+  const int* batch = final_batch_.data_ptr<int>();
+  const float* cost = final_cost_.data_ptr<float>();
+  const int* in_trace = final_in_trace_.data_ptr<int>();
+  const int* out_trace = final_out_trace_.data_ptr<int>();
+  for (int i = 0; i < num_tokens; ++i) {
+    int b = batch[i];
+    if ((*outputs)[b].size() >= opts_.nbest) continue;
+    std::vector<int> output;
+    for (int e = out_trace[i]; e >= 0; e = out_prev[e]) {
+      output.push_back(out_label[e]);
+    }
+    std::reverse(output.begin(), output.end());
+    // The best one of the same outputs comes first
+    if (std::find((*outputs)[b].begin(), (*outputs)[b].end(), output) !=
+        (*outputs)[b].end()) {
+      continue;
+    }
+    std::vector<int> input, time;
+    for (int e = in_trace[i]; e >= 0; e = in_prev[e]) {
+      input.push_back(in_label[e]);
+      time.push_back(in_frame[e]);
+    }
+    std::reverse(input.begin(), input.end());
+    std::reverse(time.begin(), time.end());
+    (*outputs)[b].emplace_back(std::move(output));
+    (*inputs)[b].emplace_back(std::move(input));
+    (*times)[b].emplace_back(std::move(time));
+    (*likelihood)[b].push_back(-cost[i]);
+  }
+}
+
+}  // namespace wenet
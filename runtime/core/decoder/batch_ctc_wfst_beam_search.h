@@ -0,0 +1,139 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_BATCH_CTC_WFST_BEAM_SEARCH_H_
+#define DECODER_BATCH_CTC_WFST_BEAM_SEARCH_H_
+
+#include <vector>
+
+#include "fst/fstlib.h"
+#include "torch/torch.h"
+
+#include "decoder/ctc_wfst_beam_search.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The decoding graph(TLG) in the CSR layout on a device. The out arcs of a
+// state are contiguous, the emitting ones and the epsilon ones apart, so the
+// arcs of all the tokens of a frame are expanded by a few gathers. A lazy
+// fst, e.g. the one composed with G on the fly, is expanded completely.
+struct CsrFst {
+  CsrFst(const fst::Fst<fst::StdArc>& fst, torch::Device device);
+
+  int num_states = 0;
+  int start = 0;
+  // The max input label, which is the token id + 1
+  int max_ilabel = 0;
+  // (S + 1,) the arcs of state s are [offsets[s], offsets[s + 1])
+  torch::Tensor emit_offsets;
+  torch::Tensor emit_ilabels;
+  torch::Tensor emit_olabels;
+  torch::Tensor emit_weights;
+  torch::Tensor emit_nextstates;
+  torch::Tensor eps_offsets;
+  torch::Tensor eps_olabels;
+  torch::Tensor eps_weights;
+  torch::Tensor eps_nextstates;
+  // (S,) final costs, inf for the non final states
+  torch::Tensor finals;
+};
+
+// Frame synchronous viterbi beam search of a whole batch on the CsrFst with
+// tensor ops, so it runs on the device of the graph, as
+// BatchCtcPrefixBeamSearch does for the prefix search. The tokens of all the
+// utterances are kept together, recombined by the state and pruned by the
+// beam and max_active of CtcWfstBeamSearchOptions for each utterance. Only
+// the topk tokens of each frame are scored, the others get the sparse_floor.
+// The tokens and the words of the best paths are traced instead of a
+// lattice, so the results are the n-best of the final tokens with distinct
+// outputs.
+// Compared with CtcWfstBeamSearch, the context graph, the blank frame
+// skipping and the lattice are not supported.
+class BatchCtcWfstBeamSearch {
+ public:
+  BatchCtcWfstBeamSearch(const CsrFst& fst,
+                         const CtcWfstBeamSearchOptions& opts);
+
+  // topk_scores/topk_indexs: (B, T, K) topk ctc log probs and token ids,
+  // lens: (B,) number of valid frames of each utterance
+  void Search(const torch::Tensor& topk_scores,
+              const torch::Tensor& topk_indexs, const torch::Tensor& lens);
+
+  // Copy the n-best of each utterance to the host, sorted by likelihood,
+  // the inputs are the tokens and the outputs are the words
+  void GetResults(std::vector<std::vector<std::vector<int>>>* outputs,
+                  std::vector<std::vector<std::vector<int>>>* inputs,
+                  std::vector<std::vector<float>>* likelihood,
+                  std::vector<std::vector<std::vector<int>>>* times) const;
+
+ private:
+  // The tokens of the batch, one element of each tensor per token
+  struct Tokens {
+    torch::Tensor batch;      // utterance of the token
+    torch::Tensor state;
+    torch::Tensor cost;
+    torch::Tensor in_trace;   // last entry of the tokens traced, -1 for none
+    torch::Tensor out_trace;  // last entry of the words traced, -1 for none
+    torch::Tensor last;       // ilabel of the last emitting arc, 0 for none
+    // The token and the word to be traced of a candidate, -1 for none
+    torch::Tensor in_label;
+    torch::Tensor out_label;
+    // Whether its epsilon arcs are to be followed
+    torch::Tensor fresh;
+
+    Tokens Select(const torch::Tensor& index) const;
+    static Tokens Cat(const Tokens& a, const Tokens& b);
+  };
+  // The traced labels of a frame are appended as one chunk on the device
+  struct Trace {
+    std::vector<torch::Tensor> prevs;
+    std::vector<torch::Tensor> labels;
+    std::vector<torch::Tensor> frames;
+    int64_t size = 0;
+
+    // Append the labels >= 0, and return the new last entries of the tokens
+    torch::Tensor Append(const torch::Tensor& prev, const torch::Tensor& label,
+                         int frame);
+    void Clear();
+    void ToHost(std::vector<int>* prev, std::vector<int>* label,
+                std::vector<int>* frame) const;
+  };
+
+  // Candidates of the emitting arcs, table: (B, max_ilabel + 1) log probs
+  // of the frame by the ilabel
+  Tokens Emit(const Tokens& tokens, const torch::Tensor& table) const;
+  // Follow the epsilon arcs of the fresh tokens until none is fresh
+  void CloseEpsilon(int frame, Tokens* tokens);
+  // Recombine and prune the candidates, then trace their labels
+  Tokens Prune(const Tokens& cands, int frame);
+
+  const CsrFst& fst_;
+  const CtcWfstBeamSearchOptions& opts_;
+  int batch_size_ = 0;
+  Trace in_trace_;
+  Trace out_trace_;
+  // The final tokens on the host, sorted by the utterance then the cost
+  torch::Tensor final_batch_;
+  torch::Tensor final_cost_;
+  torch::Tensor final_in_trace_;
+  torch::Tensor final_out_trace_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(BatchCtcWfstBeamSearch);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_BATCH_CTC_WFST_BEAM_SEARCH_H_
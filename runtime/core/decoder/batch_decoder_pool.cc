@@ -0,0 +1,129 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/batch_decoder_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+static Gauge* IdleDecoders() {
+  static Gauge* gauge = Metrics::Instance().GetGauge(
+      "wenet_batch_decoder_pool_idle",
+      "Number of the idle batch decoders in the pool");
+  return gauge;
+}
+
+BatchDecoderPool::BatchDecoderPool(
+    std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeOptions> decode_config,
+    std::shared_ptr<ResourceRegistry> resources, int capacity)
+    : feature_config_(std::move(feature_config)),
+      decode_config_(std::move(decode_config)),
+      resources_(std::move(resources)),
+      capacity_(capacity),
+      version_(resources_->version()) {
+  CHECK_GE(capacity_, 0);
+}
+
+std::shared_ptr<BatchAsrDecoder> BatchDecoderPool::Acquire(
+    std::shared_ptr<DecodeResource> resource) {
+  static Metrics& metrics = Metrics::Instance();
+  static Counter* num_hits = metrics.GetCounter(
+      "wenet_batch_decoder_pool_hits_total",
+      "Number of the batch decoders checked out of the pool");
+  static Counter* num_misses = metrics.GetCounter(
+      "wenet_batch_decoder_pool_misses_total",
+      "Number of the batch decoders constructed as there is no idle one");
+  Entry entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DropStale();
+    // The last released one, of which the buffers are likely in the cache
+    for (auto it = idle_.rbegin(); it != idle_.rend(); ++it) {
+      if (it->resource == resource) {
+        entry = std::move(*it);
+        idle_.erase(std::next(it).base());
+        IdleDecoders()->Add(-1);
+        break;
+      }
+    }
+  }
+  if (entry.decoder != nullptr) {
+    num_hits->Increment();
+  } else {
+    num_misses->Increment();
+    entry.decoder = std::make_unique<BatchAsrDecoder>(feature_config_,
+                                                      resource,
+                                                      *decode_config_);
+    entry.resource = std::move(resource);
+  }
+  std::weak_ptr<BatchDecoderPool> weak_pool = shared_from_this();
+  return std::shared_ptr<BatchAsrDecoder>(
+      entry.decoder.release(),
+      [weak_pool, resource = entry.resource](BatchAsrDecoder* released) {
+        Entry entry{std::unique_ptr<BatchAsrDecoder>(released), resource};
+        auto pool = weak_pool.lock();
+        if (pool != nullptr) pool->Release(std::move(entry));
+      });
+}
+
+void BatchDecoderPool::Prefill() {
+  int num_replicas = resources_->num_replicas();
+  for (int i = num_idle(); i < capacity_; ++i) {
+    std::shared_ptr<DecodeResource> resource =
+        resources_->Get(i % num_replicas);
+    Entry entry{std::make_unique<BatchAsrDecoder>(feature_config_, resource,
+                                                  *decode_config_),
+                resource};
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (static_cast<int>(idle_.size()) >= capacity_) break;
+    idle_.push_back(std::move(entry));
+    IdleDecoders()->Add(1);
+  }
+  LOG(INFO) << "Prefilled " << num_idle() << " batch decoders";
+}
+
+int BatchDecoderPool::num_idle() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return idle_.size();
+}
+
+void BatchDecoderPool::Release(Entry entry) {
+  if (capacity_ == 0 || !resources_->IsCurrent(entry.resource)) return;
+  entry.decoder->Reset();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (static_cast<int>(idle_.size()) >= capacity_) return;
+  idle_.push_back(std::move(entry));
+  IdleDecoders()->Add(1);
+}
+
+void BatchDecoderPool::DropStale() {
+  int version = resources_->version();
+  if (version == version_) return;
+  version_ = version;
+  auto stale = std::remove_if(idle_.begin(), idle_.end(),
+                              [this](const Entry& entry) {
+                                return !resources_->IsCurrent(entry.resource);
+                              });
+  IdleDecoders()->Add(-static_cast<int64_t>(idle_.end() - stale));
+  idle_.erase(stale, idle_.end());
+}
+
+}  // namespace wenet
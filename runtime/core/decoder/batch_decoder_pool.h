@@ -0,0 +1,82 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_BATCH_DECODER_POOL_H_
+#define DECODER_BATCH_DECODER_POOL_H_
+
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "decoder/batch_asr_decoder.h"
+#include "decoder/resource_registry.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// BatchDecoderPool keeps the BatchAsrDecoders of the finished batch
+// connections and calls, which are Reset(), so a new one borrows a ready
+// decoder instead of copying the batch model and constructing the fbanks,
+// e.g. the FbankCuda, and the searcher. As the ones of SessionPool, the
+// decoders are kept by their resource, which is the replica of a GPU, go
+// back to the pool when the last reference to them is dropped, and the
+// ones of a resource replaced by ResourceRegistry::Update() are dropped.
+class BatchDecoderPool : public std::enable_shared_from_this<BatchDecoderPool> {
+ public:
+  // Keep at most `capacity` idle decoders, 0 disables the pooling
+  BatchDecoderPool(std::shared_ptr<FeaturePipelineConfig> feature_config,
+                   std::shared_ptr<DecodeOptions> decode_config,
+                   std::shared_ptr<ResourceRegistry> resources, int capacity);
+
+  // A Reset() decoder of `resource`, which is constructed if there is no
+  // idle one of it
+  std::shared_ptr<BatchAsrDecoder> Acquire(
+      std::shared_ptr<DecodeResource> resource);
+  // Construct the idle decoders up to the capacity, spread over the current
+  // replicas of the resources, e.g. before the server is started
+  void Prefill();
+
+  int capacity() const { return capacity_; }
+  int num_idle() const;
+
+ private:
+  struct Entry {
+    std::unique_ptr<BatchAsrDecoder> decoder;
+    std::shared_ptr<DecodeResource> resource;
+  };
+
+  void Release(Entry entry);
+  // Drop the idle decoders of the replaced resources, must be called with
+  // mutex_ held
+  void DropStale();
+
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  const int capacity_;
+  mutable std::mutex mutex_;
+  std::vector<Entry> idle_;
+  // The version of resources_ of which the stale decoders are dropped
+  int version_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(BatchDecoderPool);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_BATCH_DECODER_POOL_H_
@@ -31,7 +31,10 @@
 
 namespace wenet {
 
-Ort::Env BatchOnnxAsrModel::env_ = Ort::Env(ORT_LOGGING_LEVEL_VERBOSE, "");
+// Created by the first Read, the environment is a singleton of the process,
+// which must not be taken before OnnxAsrModel::InitEngineThreads creates it
+// with the global threads
+Ort::Env BatchOnnxAsrModel::env_ = Ort::Env(nullptr);
 Ort::SessionOptions BatchOnnxAsrModel::session_options_ = Ort::SessionOptions();
 Ort::RunOptions BatchOnnxAsrModel::run_option_ = Ort::RunOptions();
 std::vector<Ort::AllocatedStringPtr> BatchOnnxAsrModel::node_names_;
@@ -85,8 +88,83 @@ void BatchOnnxAsrModel::GetInputOutputInfo(
   }
 }
 
+void BatchOnnxAsrModel::AppendTensorrtProvider(
+    const TensorrtOptions& opts, const std::string& model_dir, bool is_fp16,
+    int gpu_id, Ort::SessionOptions* options) {
+  std::vector<std::string> providers = Ort::GetAvailableProviders();
+  if (std::find(providers.begin(), providers.end(),
+                "TensorrtExecutionProvider") == providers.end()) {
+    LOG(WARNING) << "TensorRT is not available, fall back to CUDA";
+    return;
+  }
+  CHECK(!opts.frame_buckets.empty());
+  CHECK(std::is_sorted(opts.frame_buckets.begin(), opts.frame_buckets.end()));
+  // One profile per frame bucket, the (speech, speech_lengths) shapes of
+  // the profiles are separated by commas
+  std::string min_shapes, opt_shapes, max_shapes;
+  const std::string dim = std::to_string(opts.feature_dim);
+  const std::string batch = std::to_string(opts.max_batch_size);
+  int min_frames = 1;
+  for (int frames : opts.frame_buckets) {
+    if (!min_shapes.empty()) {
+      min_shapes += ",";
+      opt_shapes += ",";
+      max_shapes += ",";
+    }
+    std::string max_frames = std::to_string(frames);
+    min_shapes += "speech:1x" + std::to_string(min_frames) + "x" + dim +
+                  ",speech_lengths:1";
+    opt_shapes += "speech:" + batch + "x" + max_frames + "x" + dim +
+                  ",speech_lengths:" + batch;
+    max_shapes += "speech:" + batch + "x" + max_frames + "x" + dim +
+                  ",speech_lengths:" + batch;
+    min_frames = frames + 1;
+  }
+  LOG(INFO) << "TensorRT profiles, min: " << min_shapes
+            << " max: " << max_shapes;
+
+  std::string device_id = std::to_string(gpu_id);
+  std::string workspace_size = std::to_string(opts.max_workspace_size);
+  std::string cache_dir = opts.cache_dir.empty() ? model_dir : opts.cache_dir;
+  std::vector<const char*> keys{
+    "device_id",
+    "trt_max_workspace_size",
+    "trt_fp16_enable",
+    "trt_engine_cache_enable",
+    "trt_engine_cache_path",
+    "trt_timing_cache_enable",
+    "trt_profile_min_shapes",
+    "trt_profile_opt_shapes",
+    "trt_profile_max_shapes"
+  };
+  std::vector<const char*> values{
+    device_id.c_str(),
+    workspace_size.c_str(),
+    (opts.fp16 || is_fp16) ? "1" : "0",
+    "1",
+    cache_dir.c_str(),
+    "1",
+    min_shapes.c_str(),
+    opt_shapes.c_str(),
+    max_shapes.c_str()
+  };
+
+  const auto& api = Ort::GetApi();
+  OrtTensorRTProviderOptionsV2* trt_options = nullptr;
+  Ort::ThrowOnError(api.CreateTensorRTProviderOptions(&trt_options));
+  std::unique_ptr<OrtTensorRTProviderOptionsV2,
+                  decltype(api.ReleaseTensorRTProviderOptions)>
+      rel_trt_options(trt_options, api.ReleaseTensorRTProviderOptions);
+  Ort::ThrowOnError(api.UpdateTensorRTProviderOptions(
+      trt_options, keys.data(), values.data(), keys.size()));
+  Ort::ThrowOnError(api.SessionOptionsAppendExecutionProvider_TensorRT_V2(
+      *options, trt_options));
+  LOG(INFO) << "TensorRT is enabled for the encoder, engines are cached in "
+            << cache_dir;
+}
+
 void BatchOnnxAsrModel::Read(const std::string& model_dir,
-    bool is_fp16, int gpu_id) {
+    bool is_fp16, int gpu_id, const TensorrtOptions& trt_opts) {
   is_fp16_ = is_fp16;
   VLOG(1) << "is_fp16_ " << is_fp16_;
   std::vector<std::string> providers = Ort::GetAvailableProviders();
@@ -129,7 +207,7 @@ void BatchOnnxAsrModel::Read(const std::string& model_dir,
 
   OrtCUDAProviderOptions cuda_options{};
 
-  cuda_options.device_id = 0;
+  cuda_options.device_id = gpu_id;
   cuda_options.cudnn_conv_algo_search =
     OrtCudnnConvAlgoSearch::OrtCudnnConvAlgoSearchExhaustive;
   // cuda_options.gpu_mem_limit = 16 * 1024 * 1024 * 1024ul;
@@ -140,6 +218,15 @@ void BatchOnnxAsrModel::Read(const std::string& model_dir,
   // TODO(veelion): arena_cfg didn't work, it blocked when session.Run()
   // Just comment this out until find a work way.
   cuda_options.default_memory_arena_cfg = arena_cfg;
+  // The providers are tried in the order they are appended, so CUDA takes
+  // the nodes TensorRT rejects. The decoder stays on CUDA, the shapes of
+  // its hyps vary too much to be profiled.
+  Ort::SessionOptions encoder_options = session_options_.Clone();
+  if (trt_opts.enable) {
+    AppendTensorrtProvider(trt_opts, model_dir, is_fp16, gpu_id,
+                           &encoder_options);
+  }
+  encoder_options.AppendExecutionProvider_CUDA(cuda_options);
   session_options_.AppendExecutionProvider_CUDA(cuda_options);
 
   /* TODO(veelion): use OrtCUDAProviderOptionsV2 until it support ArenaCfg
@@ -176,16 +263,33 @@ void BatchOnnxAsrModel::Read(const std::string& model_dir,
   api.ReleaseCUDAProviderOptions(cuda_options);
   */
 
+  if (static_cast<OrtEnv*>(env_) == nullptr) {
+    env_ = Ort::Env(ORT_LOGGING_LEVEL_VERBOSE, "");
+  }
+  // The CUDA provider of each session creates its compute stream
+  CHECK_GT(num_sessions_, 0);
+  session_pairs_ = std::make_shared<std::vector<SessionPair>>();
+  next_session_ = std::make_shared<std::atomic<unsigned>>(1);
   try {
-    encoder_session_ = std::make_shared<Ort::Session>(
-        env_, encoder_onnx_path.c_str(), session_options_);
-    rescore_session_ = std::make_shared<Ort::Session>(
-        env_, rescore_onnx_path.c_str(), session_options_);
+    for (int i = 0; i < num_sessions_; ++i) {
+      SessionPair pair;
+      pair.encoder = std::make_shared<Ort::Session>(
+          env_, encoder_onnx_path.c_str(), encoder_options);
+      pair.rescore = std::make_shared<Ort::Session>(
+          env_, rescore_onnx_path.c_str(), session_options_);
+      session_pairs_->push_back(std::move(pair));
+    }
+    encoder_session_ = (*session_pairs_)[0].encoder;
+    rescore_session_ = (*session_pairs_)[0].rescore;
   } catch (std::exception const& e) {
     LOG(ERROR) << "error when load onnx model: " << e.what();
     exit(0);
   }
   std::cout << "read onnx model done \n";
+  if (num_sessions_ > 1) {
+    LOG(INFO) << num_sessions_ << " sessions of the onnx model on GPU "
+              << gpu_id;
+  }
 
   // 2. Read config
   std::string config_path = JoinPath(model_dir, "config.yaml");
@@ -218,6 +322,9 @@ BatchOnnxAsrModel::BatchOnnxAsrModel(const BatchOnnxAsrModel& other) {
   // sessions
   encoder_session_ = other.encoder_session_;
   rescore_session_ = other.rescore_session_;
+  num_sessions_ = other.num_sessions_;
+  session_pairs_ = other.session_pairs_;
+  next_session_ = other.next_session_;
 
   // node names
   encoder_in_names_ = other.encoder_in_names_;
@@ -228,15 +335,18 @@ BatchOnnxAsrModel::BatchOnnxAsrModel(const BatchOnnxAsrModel& other) {
 
 std::shared_ptr<BatchAsrModel> BatchOnnxAsrModel::Copy() const {
   auto asr_model = std::make_shared<BatchOnnxAsrModel>(*this);
+  if (session_pairs_ != nullptr && session_pairs_->size() > 1) {
+    int turn = next_session_->fetch_add(1) % session_pairs_->size();
+    asr_model->encoder_session_ = (*session_pairs_)[turn].encoder;
+    asr_model->rescore_session_ = (*session_pairs_)[turn].rescore;
+  }
   // Reset the inner states for new decoding
   return asr_model;
 }
 
 void BatchOnnxAsrModel::ForwardEncoder(
     const batch_feature_t& batch_feats,
-    const std::vector<int>& batch_feats_lens,
-    std::vector<std::vector<std::vector<float>>>* batch_topk_scores,
-    std::vector<std::vector<std::vector<int32_t>>>* batch_topk_indexs) {
+    const std::vector<int>& batch_feats_lens, BatchTopK* batch_topk) {
   Ort::MemoryInfo memory_info =
       Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
   // 1. Prepare onnx required data
@@ -307,58 +417,42 @@ void BatchOnnxAsrModel::ForwardEncoder(
       inputs.size(), encoder_out_names_.data(), encoder_out_names_.size());
   VLOG(1) << "\tencoder ->Run() takes " << timer.Elapsed() << " ms.";
 
-  // get topk_scores
+  // get the topk, each is written once into its (B, Tmax, k) tensor
   auto out_shape = ort_outputs[3].GetTensorTypeAndShapeInfo().GetShape();
   int num_outputs = out_shape[1];
-  int output_dim = out_shape[2];
-  float* topk_scores_ptr = nullptr;
-  std::vector<float> topk_scores_data;  // for holding topk_scores in fp16
+  int64_t length = out_shape[0] * out_shape[1] * out_shape[2];
+  batch_topk->scores = torch::empty(out_shape, torch::kFloat);
+  float* topk_scores_ptr = batch_topk->scores.data_ptr<float>();
   if (is_fp16_) {
     timer.Reset();
     auto probs = ort_outputs[3].GetTensorMutableData<uint16_t>();
-    int length = out_shape[0] * out_shape[1] * out_shape[2];
-    topk_scores_data.resize(length);
-    for (size_t i = 0; i < length; ++i) {
-      topk_scores_data[i] = _cvtsh_ss(probs[i]);
+    for (int64_t i = 0; i < length; ++i) {
+      topk_scores_ptr[i] = _cvtsh_ss(probs[i]);
     }
-    topk_scores_ptr = topk_scores_data.data();
     VLOG(1) << "topk_scores from GPU-fp16 to float takes " << timer.Elapsed()
       << " ms. data lenght " << length;
   } else {
-    topk_scores_ptr = ort_outputs[3].GetTensorMutableData<float>();
-  }
-
-  batch_topk_scores->resize(batch_size);
-  for (size_t i = 0; i < batch_size; ++i) {
-    (*batch_topk_scores)[i].resize(num_outputs);
-    for (size_t j = 0; j < num_outputs; j++) {
-      (*batch_topk_scores)[i][j].resize(output_dim);
-      float* p = topk_scores_ptr + (i * num_outputs + j) * output_dim;
-      memcpy((*batch_topk_scores)[i][j].data(), p, sizeof(float) * output_dim);
-    }
+    memcpy(topk_scores_ptr, ort_outputs[3].GetTensorMutableData<float>(),
+           sizeof(float) * length);
   }
-  // get batch_topk_indexs
-  std::vector<int32_t> topk_indexs_data;  // for holding topk_indexs from fp16
   timer.Reset();
-  auto probs = ort_outputs[4].GetTensorMutableData<int64_t>();
-  int length = out_shape[0] * out_shape[1] * out_shape[2];
-  topk_indexs_data.resize(length);
-  for (size_t i = 0; i < length; ++i) {
-    topk_indexs_data[i] = probs[i];
+  batch_topk->indexs = torch::empty(out_shape, torch::kInt);
+  int32_t* topk_indexs_ptr = batch_topk->indexs.data_ptr<int32_t>();
+  auto indexs = ort_outputs[4].GetTensorMutableData<int64_t>();
+  for (int64_t i = 0; i < length; ++i) {
+    topk_indexs_ptr[i] = indexs[i];
   }
-  int32_t* topk_indexs_ptr = topk_indexs_data.data();
-  VLOG(1) << "topk_indexs from GPU-fp16 to float takes "
+  VLOG(1) << "topk_indexs from int64 to int32 takes "
           << timer.Elapsed() << " ms. data lenght " << length;
-
-  batch_topk_indexs->resize(batch_size);
-  for (size_t i = 0; i < batch_size; ++i) {
-    (*batch_topk_indexs)[i].resize(num_outputs);
-    for (size_t j = 0; j < num_outputs; j++) {
-      (*batch_topk_indexs)[i][j].resize(output_dim);
-      int32_t* p = topk_indexs_ptr + (i * num_outputs + j) * output_dim;
-      memcpy((*batch_topk_indexs)[i][j].data(), p,
-          sizeof(int32_t) * output_dim);
-    }
+  // the valid frames of each utterance
+  batch_topk->lens.resize(batch_size);
+  auto lens_info = ort_outputs[1].GetTensorTypeAndShapeInfo();
+  for (int i = 0; i < batch_size; ++i) {
+    int64_t len =
+        lens_info.GetElementType() == ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64
+            ? ort_outputs[1].GetTensorMutableData<int64_t>()[i]
+            : ort_outputs[1].GetTensorMutableData<int32_t>()[i];
+    batch_topk->lens[i] = std::min<int64_t>(len, num_outputs);
   }
   // 3. cache encoder outs
   encoder_outs_ = std::move(ort_outputs[0]);
@@ -369,6 +463,12 @@ void BatchOnnxAsrModel::AttentionRescoring(
     const std::vector<std::vector<std::vector<int>>>& batch_hyps,
     const std::vector<std::vector<float>>& ctc_scores,
     std::vector<std::vector<float>>* attention_scores) {
+  std::vector<std::vector<std::vector<int>>> padded_hyps;
+  std::vector<std::vector<float>> padded_scores;
+  if (PadHyps(batch_hyps, ctc_scores, &padded_hyps, &padded_scores)) {
+    AttentionRescoring(padded_hyps, padded_scores, attention_scores);
+    return;
+  }
   Ort::MemoryInfo memory_info =
       Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
   // 1. prepare input for onnx
@@ -20,6 +20,7 @@
 #ifndef DECODER_BATCH_ONNX_ASR_MODEL_H_
 #define DECODER_BATCH_ONNX_ASR_MODEL_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -34,6 +35,24 @@
 
 namespace wenet {
 
+// The encoder is run by the TensorRT execution provider if enabled, the
+// nodes TensorRT doesn't support and the decoder fall back to CUDA. The
+// engines are built for the profiles of the frame buckets, a profile of
+// bucket i covers the batches of [1, max_batch_size] and the frames of
+// (frame_buckets[i - 1], frame_buckets[i]], and they are cached in
+// cache_dir so only the first run pays for the build.
+struct TensorrtOptions {
+  bool enable = false;
+  // Run TensorRT in fp16, always true for the fp16 models
+  bool fp16 = false;
+  // Where the engines are cached, the model dir if empty
+  std::string cache_dir;
+  int max_workspace_size = 1 << 30;
+  int feature_dim = 80;
+  int max_batch_size = 32;
+  std::vector<int> frame_buckets = {512, 1024, 3072};
+};
+
 class BatchOnnxAsrModel : public BatchAsrModel {
  public:
   // Note: Do not call the InitEngineThreads function more than once.
@@ -42,7 +61,14 @@ class BatchOnnxAsrModel : public BatchAsrModel {
  public:
   BatchOnnxAsrModel() = default;
   BatchOnnxAsrModel(const BatchOnnxAsrModel& other);
-  void Read(const std::string& model_dir, bool is_fp16 = false, int gpu_id = 0);
+  // Create num_sessions pairs of the encoder and the rescore sessions by
+  // Read, each of a CUDA stream of its own, and the copies are assigned
+  // them in turn, so the batches of concurrent decoders overlap on the GPU
+  // instead of queuing on one stream. Each pair holds its own weights on
+  // the device. Call it before Read().
+  void set_num_sessions(int num_sessions) { num_sessions_ = num_sessions; }
+  void Read(const std::string& model_dir, bool is_fp16 = false, int gpu_id = 0,
+            const TensorrtOptions& trt_opts = TensorrtOptions());
   void AttentionRescoring(
       const std::vector<std::vector<std::vector<int>>>& batch_hyps,
       const std::vector<std::vector<float>>& ctc_scores,
@@ -52,13 +78,17 @@ class BatchOnnxAsrModel : public BatchAsrModel {
   void GetInputOutputInfo(const std::shared_ptr<Ort::Session>& session,
                           std::vector<const char*>* in_names,
                           std::vector<const char*>* out_names);
-  void ForwardEncoder(
-      const batch_feature_t& batch_feats,
-      const std::vector<int>& batch_feats_lens,
-      std::vector<std::vector<std::vector<float>>>* batch_topk_scores,
-      std::vector<std::vector<std::vector<int32_t>>>* batch_topk_indexs) override;  // NOLINT
+  void ForwardEncoder(const batch_feature_t& batch_feats,
+                      const std::vector<int>& batch_feats_lens,
+                      BatchTopK* batch_topk) override;
 
  private:
+  // Append the TensorRT EP of the encoder to `options`
+  static void AppendTensorrtProvider(const TensorrtOptions& opts,
+                                     const std::string& model_dir,
+                                     bool is_fp16, int gpu_id,
+                                     Ort::SessionOptions* options);
+
   int encoder_output_size_ = 0;
   bool is_fp16_ = false;
 
@@ -70,6 +100,15 @@ class BatchOnnxAsrModel : public BatchAsrModel {
   static Ort::RunOptions run_option_;
   std::shared_ptr<Ort::Session> encoder_session_ = nullptr;
   std::shared_ptr<Ort::Session> rescore_session_ = nullptr;
+  // All the session pairs, shared by the copies with the turn of the next
+  // copy, see set_num_sessions
+  struct SessionPair {
+    std::shared_ptr<Ort::Session> encoder;
+    std::shared_ptr<Ort::Session> rescore;
+  };
+  int num_sessions_ = 1;
+  std::shared_ptr<std::vector<SessionPair>> session_pairs_ = nullptr;
+  std::shared_ptr<std::atomic<unsigned>> next_session_ = nullptr;
 
   // node names
   static std::vector<Ort::AllocatedStringPtr> node_names_;
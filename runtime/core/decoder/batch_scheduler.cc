@@ -0,0 +1,174 @@
+// Copyright (c) 2022 SoundDataConverge Co.LTD (Weiliang Chong)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/batch_scheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+BatchScheduler::BatchScheduler(
+    const BatchSchedulerOptions& opts,
+    std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeOptions> decode_config,
+    std::shared_ptr<DecodeResource> decode_resource)
+    : opts_(opts),
+      feature_config_(std::move(feature_config)),
+      decode_config_(std::move(decode_config)),
+      buckets_(std::max(1, opts.num_buckets)) {
+  CHECK_GT(opts_.max_batch_size, 0);
+  CHECK_GT(opts_.bucket_width_frames, 0);
+  decoder_ = std::make_unique<BatchAsrDecoder>(
+      feature_config_, std::move(decode_resource), *decode_config_);
+  dispatch_thread_ = std::thread(&BatchScheduler::DispatchFunc, this);
+  complete_thread_ = std::thread(&BatchScheduler::CompleteFunc, this);
+}
+
+BatchScheduler::~BatchScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_one();
+  dispatch_thread_.join();
+  complete_thread_.join();
+}
+
+std::future<std::vector<DecodeResult>> BatchScheduler::Submit(
+    std::vector<float> wav) {
+  auto request = std::make_unique<Request>();
+  int frame_length = feature_config_->frame_length;
+  int frame_shift = feature_config_->frame_shift;
+  request->num_frames =
+      wav.size() < frame_length ? 1
+                                : (wav.size() - frame_length) / frame_shift + 1;
+  request->wav = std::move(wav);
+  request->arrival = std::chrono::steady_clock::now();
+  auto future = request->promise.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int index = BucketIndex(request->num_frames);
+    buckets_[index].push_back(std::move(request));
+  }
+  cond_.notify_one();
+  return future;
+}
+
+int BatchScheduler::BucketIndex(int num_frames) const {
+  return std::min(num_frames / opts_.bucket_width_frames,
+                  static_cast<int>(buckets_.size()) - 1);
+}
+
+bool BatchScheduler::IsFull(
+    const std::deque<std::unique_ptr<Request>>& bucket) const {
+  if (bucket.size() >= opts_.max_batch_size) return true;
+  int max_len = 0;
+  for (const auto& request : bucket) {
+    max_len = std::max(max_len, request->num_frames);
+  }
+  return bucket.size() * max_len >= opts_.max_batch_frames;
+}
+
+std::shared_ptr<BatchScheduler::Batch> BatchScheduler::PopBatch(
+    std::deque<std::unique_ptr<Request>>* bucket) {
+  auto batch = std::make_shared<Batch>();
+  int max_len = 0;
+  while (!bucket->empty() && batch->requests.size() < opts_.max_batch_size) {
+    int len = std::max(max_len, bucket->front()->num_frames);
+    // Always take at least one utterance even if it's too long
+    if (!batch->requests.empty() &&
+        (batch->requests.size() + 1) * len > opts_.max_batch_frames) {
+      break;
+    }
+    max_len = len;
+    batch->requests.push_back(std::move(bucket->front()));
+    bucket->pop_front();
+  }
+  return batch;
+}
+
+void BatchScheduler::DispatchFunc() {
+  Histogram* wait_latency = Metrics::Instance().GetHistogram(
+      "wenet_batch_scheduler_wait_seconds",
+      "Queue wait of an utterance in the batch scheduler");
+  const auto max_wait = std::chrono::milliseconds(opts_.max_wait_ms);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    int ready = -1;
+    bool empty = true;
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+      const auto& bucket = buckets_[i];
+      if (bucket.empty()) continue;
+      empty = false;
+      auto bucket_deadline = bucket.front()->arrival + max_wait;
+      if (stop_ || IsFull(bucket) || bucket_deadline <= now) {
+        ready = i;
+        break;
+      }
+      deadline = std::min(deadline, bucket_deadline);
+    }
+    if (ready >= 0) {
+      std::shared_ptr<Batch> batch = PopBatch(&buckets_[ready]);
+      lock.unlock();
+      std::vector<std::vector<float>> wavs;
+      auto dispatch_time = std::chrono::steady_clock::now();
+      for (auto& request : batch->requests) {
+        wait_latency->Observe(
+            std::chrono::duration<double>(dispatch_time - request->arrival)
+                .count());
+        wavs.push_back(std::move(request->wav));
+      }
+      VLOG(1) << "Dispatch batch of " << wavs.size() << " from bucket "
+              << ready;
+      // DecodeAsync blocks when the decoding pipeline is full
+      batch->results = decoder_->DecodeAsync(std::move(wavs));
+      running_batches_.Push(std::move(batch));
+      lock.lock();
+      continue;
+    }
+    if (stop_ && empty) break;
+    if (empty) {
+      cond_.wait(lock);
+    } else {
+      cond_.wait_until(lock, deadline);
+    }
+  }
+  running_batches_.Push(nullptr);
+}
+
+void BatchScheduler::CompleteFunc() {
+  while (true) {
+    std::shared_ptr<Batch> batch = running_batches_.Pop();
+    if (batch == nullptr) break;
+    try {
+      std::vector<std::vector<DecodeResult>> results = batch->results.get();
+      CHECK_EQ(results.size(), batch->requests.size());
+      for (size_t i = 0; i < results.size(); ++i) {
+        batch->requests[i]->promise.set_value(std::move(results[i]));
+      }
+    } catch (...) {
+      for (auto& request : batch->requests) {
+        request->promise.set_exception(std::current_exception());
+      }
+    }
+  }
+}
+
+}  // namespace wenet
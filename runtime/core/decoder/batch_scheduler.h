@@ -0,0 +1,99 @@
+// Copyright (c) 2022 SoundDataConverge Co.LTD (Weiliang Chong)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_BATCH_SCHEDULER_H_
+#define DECODER_BATCH_SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "decoder/batch_asr_decoder.h"
+#include "utils/blocking_queue.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct BatchSchedulerOptions {
+  int max_batch_size = 32;
+  // Max frames of a batch after padding, that is batch_size * max_len
+  int max_batch_frames = 32000;
+  // Max time(ms) an utterance waits for its batch to be filled up
+  int max_wait_ms = 50;
+  // Utterances with lengths in the same bucket are batched together, the
+  // last bucket holds all the longer utterances
+  int bucket_width_frames = 200;
+  int num_buckets = 16;
+};
+
+// BatchScheduler accepts single utterances from many connections, buckets
+// them by length to reduce the padding, and decodes the batches formed
+// under the max frames and max latency limits by one BatchAsrDecoder.
+class BatchScheduler {
+ public:
+  BatchScheduler(const BatchSchedulerOptions& opts,
+                 std::shared_ptr<FeaturePipelineConfig> feature_config,
+                 std::shared_ptr<DecodeOptions> decode_config,
+                 std::shared_ptr<DecodeResource> decode_resource);
+  ~BatchScheduler();
+
+  // Thread safe, the nbest result of the utterance is returned by future
+  std::future<std::vector<DecodeResult>> Submit(std::vector<float> wav);
+
+ private:
+  struct Request {
+    std::vector<float> wav;
+    int num_frames = 0;
+    std::chrono::steady_clock::time_point arrival;
+    std::promise<std::vector<DecodeResult>> promise;
+  };
+  struct Batch {
+    std::vector<std::unique_ptr<Request>> requests;
+    std::future<std::vector<std::vector<DecodeResult>>> results;
+  };
+
+  int BucketIndex(int num_frames) const;
+  // Whether the bucket can form a full batch
+  bool IsFull(const std::deque<std::unique_ptr<Request>>& bucket) const;
+  // Pop a batch from the front of the bucket within the limits
+  std::shared_ptr<Batch> PopBatch(std::deque<std::unique_ptr<Request>>* bucket);
+  void DispatchFunc();
+  void CompleteFunc();
+
+  const BatchSchedulerOptions opts_;
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  std::unique_ptr<BatchAsrDecoder> decoder_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<std::deque<std::unique_ptr<Request>>> buckets_;
+  bool stop_ = false;
+  // Batches being decoded, nullptr means stop
+  BlockingQueue<std::shared_ptr<Batch>> running_batches_;
+  std::thread dispatch_thread_;
+  std::thread complete_thread_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(BatchScheduler);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_BATCH_SCHEDULER_H_
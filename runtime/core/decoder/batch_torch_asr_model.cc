@@ -28,6 +28,9 @@
 #include "torch/script.h"
 #include "torch/torch.h"
 
+#include "decoder/torch_optimize.h"
+#include "utils/model_bundle.h"
+
 namespace wenet {
 
 void BatchTorchAsrModel::InitEngineThreads(int num_threads) {
@@ -52,10 +55,33 @@ void BatchTorchAsrModel::Read(const std::string& model_path) {
     device_ = at::kCUDA;
   }
 #endif
-  torch::jit::script::Module model = torch::jit::load(model_path, device_);
-  model_ = std::make_shared<TorchModule>(std::move(model));
+  // The cached module is already frozen and optimized
+  if (optimize_) {
+    model_ = LoadOptimizedModule(optimized_cache_path_, model_path, device_);
+  }
+  bool cached = model_ != nullptr;
+  if (!cached) {
+    torch::jit::script::Module model;
+    if (model_data_ != nullptr) {
+      MemoryStream is(model_data_, model_data_size_);
+      model = torch::jit::load(is, device_);
+    } else {
+      model = torch::jit::load(model_path, device_);
+    }
+    model_ = std::make_shared<TorchModule>(std::move(model));
+  }
   torch::NoGradGuard no_grad;
-  model_->eval();
+  // The frozen module has no training attribute to set
+  if (!cached) model_->eval();
+  if (optimize_ && !cached) {
+    model_ = std::make_shared<TorchModule>(OptimizeForInference(
+        *model_, {"batch_forward_encoder", "batch_forward_attention_decoder",
+                  "batch_forward_attention_decoder_hyps", "subsampling_rate",
+                  "right_context", "sos_symbol", "eos_symbol",
+                  "is_bidirectional_decoder", "ctc_weight",
+                  "reverse_weight"}));
+    SaveOptimizedModule(*model_, optimized_cache_path_);
+  }
   torch::jit::IValue o1 = model_->run_method("subsampling_rate");
   CHECK_EQ(o1.isInt(), true);
   subsampling_rate_ = o1.toInt();
@@ -70,12 +96,21 @@ void BatchTorchAsrModel::Read(const std::string& model_path) {
   torch::jit::IValue o5 = model_->run_method("is_bidirectional_decoder");
   CHECK_EQ(o5.isBool(), true);
   is_bidirectional_decoder_ = o5.toBool();
+  has_packed_method_ =
+      model_->find_method("batch_forward_attention_decoder_hyps").has_value();
+  if (model_->hasattr("ctc_weight")) {
+    ctc_weight_ = model_->attr("ctc_weight").toDouble();
+  }
+  if (model_->hasattr("reverse_weight")) {
+    reverse_weight_ = model_->attr("reverse_weight").toDouble();
+  }
 
   VLOG(1) << "Torch Model Info:";
   VLOG(1) << "\tsubsampling_rate " << subsampling_rate_;
   VLOG(1) << "\tsos " << sos_;
   VLOG(1) << "\teos " << eos_;
   VLOG(1) << "\tis bidirectional decoder " << is_bidirectional_decoder_;
+  VLOG(1) << "\tpacked rescoring " << has_packed_method_;
 }
 
 BatchTorchAsrModel::BatchTorchAsrModel(const BatchTorchAsrModel& other) {
@@ -84,6 +119,9 @@ BatchTorchAsrModel::BatchTorchAsrModel(const BatchTorchAsrModel& other) {
   sos_ = other.sos_;
   eos_ = other.eos_;
   is_bidirectional_decoder_ = other.is_bidirectional_decoder_;
+  has_packed_method_ = other.has_packed_method_;
+  ctc_weight_ = other.ctc_weight_;
+  reverse_weight_ = other.reverse_weight_;
   // 2. Model copy, just copy the model ptr since:
   // PyTorch allows using multiple CPU threads during TorchScript model
   // inference, please see https://pytorch.org/docs/stable/notes/cpu_
@@ -99,9 +137,7 @@ std::shared_ptr<BatchAsrModel> BatchTorchAsrModel::Copy() const {
 
 void BatchTorchAsrModel::ForwardEncoder(
     const std::vector<torch::Tensor>& batch_feats,
-    const std::vector<int>& batch_feats_lens,
-    std::vector<std::vector<std::vector<float>>>* batch_topk_scores,
-    std::vector<std::vector<std::vector<int32_t>>>* batch_topk_indexs) {
+    const std::vector<int>& batch_feats_lens) {
   // 1. Prepare libtorch required data
   int batch_size = batch_feats_lens.size();
   torch::Tensor feats_lens =
@@ -112,49 +148,61 @@ void BatchTorchAsrModel::ForwardEncoder(
       -23.025850929940457f);
 
   // 2. Encoder batch forward
-  feats = feats.to(device_);
-  feats_lens = feats_lens.to(device_);
-  torch::NoGradGuard no_grad;
-  std::vector<torch::jit::IValue> inputs = {feats, feats_lens};
+  RunEncoder(feats, feats_lens);
+  VLOG(1) << "batch_forward_encoder done";
+}
+
+void BatchTorchAsrModel::ForwardEncoder(
+    const std::vector<torch::Tensor>& batch_feats,
+    const std::vector<int>& batch_feats_lens, BatchTopK* batch_topk) {
+  ForwardEncoder(batch_feats, batch_feats_lens);
+  CopyTopK(batch_topk);
+}
 
+void BatchTorchAsrModel::RunEncoder(const torch::Tensor& feats,
+                                    const torch::Tensor& feats_lens) {
+  torch::NoGradGuard no_grad;
+  std::vector<torch::jit::IValue> inputs = {feats.to(device_),
+                                            feats_lens.to(device_)};
   auto outputs =
       model_->get_method("batch_forward_encoder")(inputs).toTuple()->elements();
-  VLOG(1) << "batch_forward_encoder done";
   CHECK_EQ(outputs.size(), 5);
   encoder_out_ = outputs[0].toTensor();  // (B, Tmax, dim)
   encoder_lens_ = outputs[1].toTensor();  // (B,)
+  topk_scores_ = outputs[3].toTensor();  // (B, Tmax, beam)
+  topk_indexs_ = outputs[4].toTensor();  // (B, Tmax, beam)
+}
 
-  // Copy topk_scores
-  auto topk_scores = outputs[3].toTensor().to(at::kCPU);
-  int num_outputs = topk_scores.size(1);
-  int output_dim = topk_scores.size(2);
-  batch_topk_scores->resize(batch_size);
-  for (size_t i = 0; i < batch_size; i++) {
-    (*batch_topk_scores)[i].resize(num_outputs);
-    for (size_t j = 0; j < num_outputs; j++) {
-      (*batch_topk_scores)[i][j].resize(output_dim);
-      memcpy((*batch_topk_scores)[i][j].data(), topk_scores[i][j].data_ptr(),
-             sizeof(float) * output_dim);
+void BatchTorchAsrModel::CopyTopK(BatchTopK* batch_topk) {
+  if (topk_scores_.is_cuda()) {
+    int64_t numel = topk_scores_.numel();
+    if (host_topk_scores_.numel() < numel) {
+      auto options = torch::TensorOptions().pinned_memory(true);
+      host_topk_scores_ = torch::empty({numel}, options.dtype(torch::kFloat));
+      host_topk_indexs_ = torch::empty({numel}, options.dtype(torch::kInt));
     }
+    batch_topk->scores =
+        host_topk_scores_.narrow(0, 0, numel).view(topk_scores_.sizes());
+    batch_topk->indexs =
+        host_topk_indexs_.narrow(0, 0, numel).view(topk_indexs_.sizes());
+    batch_topk->scores.copy_(topk_scores_);
+    batch_topk->indexs.copy_(topk_indexs_);
+  } else {
+    batch_topk->scores = topk_scores_.to(torch::kFloat).contiguous();
+    batch_topk->indexs = topk_indexs_.to(torch::kInt).contiguous();
   }
-  // copy topk_indexes
-  auto topk_indexes = outputs[4].toTensor().to(at::kCPU);
-  batch_topk_indexs->resize(batch_size);
-  for (size_t i = 0; i < batch_size; ++i) {
-    (*batch_topk_indexs)[i].resize(num_outputs);
-    for (size_t j = 0; j < num_outputs; ++j) {
-      (*batch_topk_indexs)[i][j].resize(output_dim);
-      memcpy((*batch_topk_indexs)[i][j].data(), topk_indexes[i][j].data_ptr(),
-             sizeof(int) * output_dim);
-    }
+  torch::Tensor lens = encoder_lens_.to(at::kCPU, torch::kInt).contiguous();
+  const int* lens_ptr = lens.data_ptr<int>();
+  int max_len = topk_scores_.size(1);
+  batch_topk->lens.resize(lens.numel());
+  for (int i = 0; i < lens.numel(); ++i) {
+    batch_topk->lens[i] = std::min(lens_ptr[i], max_len);
   }
 }
 
 void BatchTorchAsrModel::ForwardEncoder(
     const batch_feature_t& batch_feats,
-    const std::vector<int>& batch_feats_lens,
-    std::vector<std::vector<std::vector<float>>>* batch_topk_scores,
-    std::vector<std::vector<std::vector<int32_t>>>* batch_topk_indexs) {
+    const std::vector<int>& batch_feats_lens, BatchTopK* batch_topk) {
   // 1. Prepare libtorch required data
   int batch_size = batch_feats.size();
   int num_frames = batch_feats[0].size();
@@ -176,47 +224,24 @@ void BatchTorchAsrModel::ForwardEncoder(
                      {batch_size}, torch::kInt).clone();
 
   // 2. Encoder batch forward
-  feats = feats.to(device_);
-  feats_lens = feats_lens.to(device_);
-  torch::NoGradGuard no_grad;
-  std::vector<torch::jit::IValue> inputs = {feats, feats_lens};
-
-  auto outputs =
-      model_->get_method("batch_forward_encoder")(inputs).toTuple()->elements();
-  CHECK_EQ(outputs.size(), 5);
-  encoder_out_ = outputs[0].toTensor();  // (B, Tmax, dim)
-  encoder_lens_ = outputs[1].toTensor();  // (B,)
-
-  // Copy topk_scores
-  auto topk_scores = outputs[3].toTensor().to(at::kCPU);
-  int num_outputs = topk_scores.size(1);
-  int output_dim = topk_scores.size(2);
-  batch_topk_scores->resize(batch_size);
-  for (size_t i = 0; i < batch_size; i++) {
-    (*batch_topk_scores)[i].resize(num_outputs);
-    for (size_t j = 0; j < num_outputs; j++) {
-      (*batch_topk_scores)[i][j].resize(output_dim);
-      memcpy((*batch_topk_scores)[i][j].data(), topk_scores[i][j].data_ptr(),
-             sizeof(float) * output_dim);
-    }
-  }
-  // copy topk_indexes
-  auto topk_indexes = outputs[4].toTensor().to(at::kCPU);
-  batch_topk_indexs->resize(batch_size);
-  for (size_t i = 0; i < batch_size; ++i) {
-    (*batch_topk_indexs)[i].resize(num_outputs);
-    for (size_t j = 0; j < num_outputs; ++j) {
-      (*batch_topk_indexs)[i][j].resize(output_dim);
-      memcpy((*batch_topk_indexs)[i][j].data(), topk_indexes[i][j].data_ptr(),
-             sizeof(int) * output_dim);
-    }
-  }
+  RunEncoder(feats, feats_lens);
+  CopyTopK(batch_topk);
 }
 
 void BatchTorchAsrModel::AttentionRescoring(
     const std::vector<std::vector<std::vector<int>>>& batch_hyps,
     const std::vector<std::vector<float>>& ctc_scores,
     std::vector<std::vector<float>>* attention_scores) {
+  if (has_packed_method_) {
+    AttentionRescoringPacked(batch_hyps, ctc_scores, attention_scores);
+    return;
+  }
+  std::vector<std::vector<std::vector<int>>> padded_hyps;
+  std::vector<std::vector<float>> padded_scores;
+  if (PadHyps(batch_hyps, ctc_scores, &padded_hyps, &padded_scores)) {
+    AttentionRescoring(padded_hyps, padded_scores, attention_scores);
+    return;
+  }
   // Step 1: Prepare input for libtorch
   int batch_size = batch_hyps.size();
   int beam_size = batch_hyps[0].size();
@@ -259,6 +284,163 @@ void BatchTorchAsrModel::AttentionRescoring(
   }
 
   // Step 2: Forward attention decoder
+  RunAttentionDecoder(hyps_pad_sos_eos, hyps_lens_sos, r_hyps_pad_sos_eos,
+                      ctc_scores_tensor, attention_scores);
+}
+
+void BatchTorchAsrModel::AttentionRescoring(
+    const torch::Tensor& hyps, const torch::Tensor& hyps_lens,
+    const torch::Tensor& ctc_scores,
+    std::vector<std::vector<float>>* attention_scores) {
+  // Same inputs of the decoder as the above, but built on the device
+  torch::NoGradGuard no_grad;
+  int batch_size = hyps.size(0);
+  int beam_size = hyps.size(1);
+  int len = hyps.size(2);
+  auto long_opts = hyps.options().dtype(torch::kLong);
+  torch::Tensor lens = hyps_lens.to(long_opts);
+  torch::Tensor hyps_lens_sos = lens + 1;
+  int max_hyps_len = hyps_lens_sos.max().item<int>();
+  torch::Tensor hyps_pad_sos_eos =
+      torch::zeros({batch_size, beam_size, max_hyps_len + 1}, long_opts);
+  torch::Tensor r_hyps_pad_sos_eos =
+      torch::zeros({batch_size, beam_size, max_hyps_len + 1}, long_opts);
+  hyps_pad_sos_eos.select(2, 0).fill_(sos_);
+  r_hyps_pad_sos_eos.select(2, 0).fill_(sos_);
+  len = std::min(len, max_hyps_len - 1);
+  if (len > 0) {
+    torch::Tensor tokens = hyps.narrow(2, 0, len).to(torch::kLong);
+    torch::Tensor positions = torch::arange(len, long_opts);
+    torch::Tensor padding = positions >= lens.unsqueeze(2);
+    torch::Tensor reverse_index =
+        (lens.unsqueeze(2) - 1 - positions).clamp_min(0);
+    hyps_pad_sos_eos.narrow(2, 1, len).copy_(tokens.masked_fill(padding, 0));
+    r_hyps_pad_sos_eos.narrow(2, 1, len)
+        .copy_(tokens.gather(2, reverse_index).masked_fill(padding, 0));
+  }
+  RunAttentionDecoder(hyps_pad_sos_eos, hyps_lens_sos, r_hyps_pad_sos_eos,
+                      ctc_scores.to(torch::kFloat), attention_scores);
+}
+
+// A bucket of the length sorted hyps ends before a hyp longer than twice
+// the shortest one of it, so at most half of a bucket is padding
+static const size_t kMaxBucketLengthRatio = 2;
+
+void BatchTorchAsrModel::AttentionRescoringPacked(
+    const std::vector<std::vector<std::vector<int>>>& batch_hyps,
+    const std::vector<std::vector<float>>& ctc_scores,
+    std::vector<std::vector<float>>* attention_scores) {
+  torch::NoGradGuard no_grad;
+  int batch_size = batch_hyps.size();
+  attention_scores->resize(batch_size);
+  // (utterance, hyp) of all the hyps, sorted by the length
+  std::vector<std::pair<int, int>> order;
+  for (int i = 0; i < batch_size; ++i) {
+    (*attention_scores)[i].assign(batch_hyps[i].size(), 0.0f);
+    for (size_t j = 0; j < batch_hyps[i].size(); ++j) order.emplace_back(i, j);
+  }
+  auto length = [&batch_hyps](const std::pair<int, int>& hyp) {
+    return batch_hyps[hyp.first][hyp.second].size();
+  };
+  std::stable_sort(order.begin(), order.end(),
+                   [&length](const std::pair<int, int>& a,
+                             const std::pair<int, int>& b) {
+                     return length(a) < length(b);
+                   });
+  auto long_opts = torch::TensorOptions().dtype(torch::kLong);
+  torch::Tensor encoder_lens = encoder_lens_.to(torch::kLong);
+  bool reverse = is_bidirectional_decoder_ && reverse_weight_ > 0;
+  size_t start = 0;
+  while (start < order.size()) {
+    size_t min_len = std::max<size_t>(length(order[start]), 1);
+    size_t end = start + 1;
+    while (end < order.size() &&
+           length(order[end]) <= kMaxBucketLengthRatio * min_len) {
+      ++end;
+    }
+    // The inputs start with sos, and the targets end with eos
+    int num_hyps = end - start;
+    int max_hyps_len = length(order[end - 1]) + 1;
+    std::vector<int64_t> inputs(num_hyps * max_hyps_len, 0);
+    std::vector<int64_t> targets(inputs.size(), 0);
+    std::vector<int64_t> r_targets(inputs.size(), 0);
+    std::vector<int64_t> lens(num_hyps);
+    std::vector<int64_t> utts(num_hyps);
+    std::vector<float> ctc(num_hyps);
+    for (int k = 0; k < num_hyps; ++k) {
+      const std::pair<int, int>& index = order[start + k];
+      const std::vector<int>& hyp = batch_hyps[index.first][index.second];
+      int64_t* input = inputs.data() + k * max_hyps_len;
+      int64_t* target = targets.data() + k * max_hyps_len;
+      int64_t* r_target = r_targets.data() + k * max_hyps_len;
+      input[0] = sos_;
+      std::copy(hyp.begin(), hyp.end(), input + 1);
+      std::copy(hyp.begin(), hyp.end(), target);
+      target[hyp.size()] = eos_;
+      std::reverse_copy(hyp.begin(), hyp.end(), r_target);
+      r_target[hyp.size()] = eos_;
+      lens[k] = hyp.size() + 1;
+      utts[k] = index.first;
+      ctc[k] = ctc_scores[index.first][index.second];
+    }
+    auto to_device = [this](void* data, at::IntArrayRef shape,
+                            torch::Dtype dtype) {
+      return torch::from_blob(data, shape, dtype).to(device_);
+    };
+    torch::Tensor hyps_tensor =
+        to_device(inputs.data(), {num_hyps, max_hyps_len}, torch::kLong);
+    torch::Tensor hyps_lens = to_device(lens.data(), {num_hyps}, torch::kLong);
+    torch::Tensor utt_index =
+        to_device(utts.data(), {num_hyps}, torch::kLong);
+    // The encoder output is repeated for every hyp of the utterance
+    auto outputs =
+        model_
+            ->run_method("batch_forward_attention_decoder_hyps", hyps_tensor,
+                         hyps_lens, encoder_out_.index_select(0, utt_index),
+                         encoder_lens.index_select(0, utt_index),
+                         reverse_weight_)
+            .toTuple()
+            ->elements();
+    // Sum the log probs of the targets, the positions after eos are padding
+    torch::Tensor padding =
+        torch::arange(max_hyps_len, long_opts.device(device_)) >=
+        hyps_lens.unsqueeze(1);
+    auto target_score = [&](const torch::Tensor& probs,
+                            std::vector<int64_t>* data) {
+      torch::Tensor index =
+          to_device(data->data(), {num_hyps, max_hyps_len, 1}, torch::kLong);
+      return probs.to(torch::kFloat)
+          .gather(2, index)
+          .squeeze(2)
+          .masked_fill(padding, 0)
+          .sum(1);
+    };
+    torch::Tensor score = target_score(outputs[0].toTensor(), &targets);
+    if (reverse) {
+      torch::Tensor r_score = target_score(outputs[1].toTensor(), &r_targets);
+      score = score * (1 - reverse_weight_) + r_score * reverse_weight_;
+    }
+    score = score + ctc_weight_ * to_device(ctc.data(), {num_hyps},
+                                            torch::kFloat);
+    score = score.to(at::kCPU).contiguous();
+    const float* data = score.data_ptr<float>();
+    for (int k = 0; k < num_hyps; ++k) {
+      const std::pair<int, int>& index = order[start + k];
+      (*attention_scores)[index.first][index.second] = data[k];
+    }
+    start = end;
+  }
+#ifdef USE_GPU
+  c10::cuda::CUDACachingAllocator::emptyCache();
+#endif
+}
+
+void BatchTorchAsrModel::RunAttentionDecoder(
+    torch::Tensor hyps_pad_sos_eos, torch::Tensor hyps_lens_sos,
+    torch::Tensor r_hyps_pad_sos_eos, torch::Tensor ctc_scores_tensor,
+    std::vector<std::vector<float>>* attention_scores) {
+  int batch_size = hyps_pad_sos_eos.size(0);
+  int beam_size = hyps_pad_sos_eos.size(1);
   hyps_pad_sos_eos = hyps_pad_sos_eos.to(device_);
   hyps_lens_sos = hyps_lens_sos.to(device_);
   r_hyps_pad_sos_eos = r_hyps_pad_sos_eos.to(device_);
@@ -40,28 +40,86 @@ class BatchTorchAsrModel : public BatchAsrModel {
   BatchTorchAsrModel() = default;
   BatchTorchAsrModel(const BatchTorchAsrModel& other);
   void Read(const std::string& model_path);
+  // Freeze and optimize the model in Read, see TorchAsrModel::set_optimize.
+  // Call it before Read().
+  void set_optimize(bool optimize, const std::string& cache_path = "") {
+    optimize_ = optimize;
+    optimized_cache_path_ = cache_path;
+  }
+  // Read the module from the memory, e.g. the section of a mapped
+  // ModelBundle, instead of the file of model_path, which still names it in
+  // the logs and for the optimized cache. The memory must outlive Read().
+  void set_model_data(const char* data, size_t size) {
+    model_data_ = data;
+    model_data_size_ = size;
+  }
   void AttentionRescoring(
       const std::vector<std::vector<std::vector<int>>>& batch_hyps,
       const std::vector<std::vector<float>>& ctc_scores,
       std::vector<std::vector<float>>* attention_scores) override;
+  // Rescoring of the padded hyps on the device, as given by
+  // BatchCtcPrefixBeamSearch
+  // hyps: (B, beam, L), hyps_lens: (B, beam), ctc_scores: (B, beam)
+  void AttentionRescoring(const torch::Tensor& hyps,
+                          const torch::Tensor& hyps_lens,
+                          const torch::Tensor& ctc_scores,
+                          std::vector<std::vector<float>>* attention_scores);
   std::shared_ptr<BatchAsrModel> Copy() const override;
 
-  void ForwardEncoder(
-      const batch_feature_t& batch_feats,
-      const std::vector<int>& batch_feats_lens,
-      std::vector<std::vector<std::vector<float>>>* batch_topk_scores,
-      std::vector<std::vector<std::vector<int32_t>>>* batch_topk_indexs) override;  // NOLINT
-  void ForwardEncoder(
-      const std::vector<torch::Tensor>& batch_feats,
-      const std::vector<int>& batch_feats_lens,
-      std::vector<std::vector<std::vector<float>>>* batch_topk_scores,
-      std::vector<std::vector<std::vector<int32_t>>>* batch_topk_indexs) override;  // NOLINT
+  void ForwardEncoder(const batch_feature_t& batch_feats,
+                      const std::vector<int>& batch_feats_lens,
+                      BatchTopK* batch_topk) override;
+  void ForwardEncoder(const std::vector<torch::Tensor>& batch_feats,
+                      const std::vector<int>& batch_feats_lens,
+                      BatchTopK* batch_topk) override;
+  // Encoder forward only, the topk outputs are kept on the device
+  void ForwardEncoder(const std::vector<torch::Tensor>& batch_feats,
+                      const std::vector<int>& batch_feats_lens);
+  // (B, Tmax, beam) topk ctc log probs and token ids of the last forward
+  const torch::Tensor& topk_scores() const { return topk_scores_; }
+  const torch::Tensor& topk_indexs() const { return topk_indexs_; }
+  // (B,) number of valid encoder frames of each utterance
+  const torch::Tensor& encoder_lens() const { return encoder_lens_; }
+  torch::DeviceType device() const { return device_; }
 
  private:
+  void RunEncoder(const torch::Tensor& feats, const torch::Tensor& feats_lens);
+  // The topk outputs are taken as they are on CPU, and are copied into the
+  // pinned buffers from GPU
+  void CopyTopK(BatchTopK* batch_topk);
+  // Rescore the hyps of all the utterances flattened, without the padding
+  // hyps, by the exported `batch_forward_attention_decoder_hyps` method,
+  // which takes the hyps with the encoder output of their utterance. The
+  // hyps are sorted by length and rescored in buckets of similar lengths,
+  // so the short ones aren't padded to the longest.
+  void AttentionRescoringPacked(
+      const std::vector<std::vector<std::vector<int>>>& batch_hyps,
+      const std::vector<std::vector<float>>& ctc_scores,
+      std::vector<std::vector<float>>* attention_scores);
+  void RunAttentionDecoder(torch::Tensor hyps_pad_sos_eos,
+                           torch::Tensor hyps_lens_sos,
+                           torch::Tensor r_hyps_pad_sos_eos,
+                           torch::Tensor ctc_scores_tensor,
+                           std::vector<std::vector<float>>* attention_scores);
+
   std::shared_ptr<TorchModule> model_ = nullptr;
   torch::Tensor encoder_out_;
   torch::Tensor encoder_lens_;
+  torch::Tensor topk_scores_;
+  torch::Tensor topk_indexs_;
+  // The pinned host buffers of the topk outputs, reused by the batches of
+  // this copy of the model
+  torch::Tensor host_topk_scores_;
+  torch::Tensor host_topk_indexs_;
   torch::DeviceType device_;
+  bool optimize_ = false;
+  std::string optimized_cache_path_;
+  const char* model_data_ = nullptr;
+  size_t model_data_size_ = 0;
+  bool has_packed_method_ = false;
+  // The weights of batch_forward_attention_decoder, for the packed rescoring
+  float ctc_weight_ = 0.5;
+  float reverse_weight_ = 0.0;
 };
 
 }  // namespace wenet
@@ -0,0 +1,53 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/block_allocator.h"
+
+#include "utils/log.h"
+
+namespace wenet {
+
+BlockAllocator::BlockAllocator(int num_blocks)
+    : num_blocks_(num_blocks), in_use_(num_blocks, false) {
+  CHECK_GE(num_blocks, 0);
+  free_blocks_.reserve(num_blocks);
+  for (int i = num_blocks - 1; i >= 0; --i) {
+    free_blocks_.push_back(i);
+  }
+}
+
+int BlockAllocator::Allocate() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_blocks_.empty()) return -1;
+  int block = free_blocks_.back();
+  free_blocks_.pop_back();
+  in_use_[block] = true;
+  return block;
+}
+
+void BlockAllocator::Free(int block) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(block >= 0 && block < num_blocks_) << "Invalid block " << block;
+  CHECK(in_use_[block]) << "Block " << block << " is freed twice";
+  in_use_[block] = false;
+  free_blocks_.push_back(block);
+}
+
+int BlockAllocator::num_free_blocks() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return free_blocks_.size();
+}
+
+}  // namespace wenet
@@ -0,0 +1,52 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_BLOCK_ALLOCATOR_H_
+#define DECODER_BLOCK_ALLOCATOR_H_
+
+#include <mutex>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// A free list of a fixed number of blocks, e.g. the cache blocks of the
+// streaming sessions in a preallocated pool, so the memory of the caches is
+// bounded and isn't fragmented when the sessions come and go. The block
+// freed last is allocated first, which is likely still in the cache.
+class BlockAllocator {
+ public:
+  explicit BlockAllocator(int num_blocks);
+
+  // Return the index of the block, or -1 if all blocks are in use
+  int Allocate();
+  void Free(int block);
+  int num_blocks() const { return num_blocks_; }
+  int num_free_blocks() const;
+
+ private:
+  const int num_blocks_;
+  mutable std::mutex mutex_;
+  std::vector<int> free_blocks_;
+  std::vector<bool> in_use_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(BlockAllocator);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_BLOCK_ALLOCATOR_H_
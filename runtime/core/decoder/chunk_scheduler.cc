@@ -0,0 +1,151 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/chunk_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/timer.h"
+
+namespace wenet {
+
+ChunkScheduler::ChunkScheduler(const ChunkSchedulerOptions& opts)
+    : opts_(opts) {
+  CHECK_GT(opts_.max_batch_size, 0);
+  thread_ = std::thread(&ChunkScheduler::Run, this);
+}
+
+ChunkScheduler::~ChunkScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  task_cond_.notify_one();
+  thread_.join();
+}
+
+bool ChunkScheduler::ForwardEncoder(
+    AsrModel* model, const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<std::vector<float>>* ctc_prob, SearchInterface* searcher) {
+  // Queued, the chunk would only wait for the others forwarded one by one
+  if (!model->batch_forward_supported()) {
+    model->ForwardEncoder(chunk_feats, ctc_prob);
+    return false;
+  }
+  Task task;
+  task.model = model;
+  task.chunk_feats = &chunk_feats;
+  task.ctc_prob = ctc_prob;
+  if (opts_.batch_search) task.searcher = searcher;
+  std::unique_lock<std::mutex> lock(mutex_);
+  tasks_.push_back(&task);
+  task_cond_.notify_one();
+  done_cond_.wait(lock, [&task] { return task.done; });
+  if (task.error != nullptr) std::rethrow_exception(task.error);
+  return task.searched;
+}
+
+void ChunkScheduler::SearchBatch(const std::vector<Task*>& batch) {
+  // The decoding threads of the tasks are blocked until done, so their
+  // searchers are used here
+  std::vector<CtcPrefixBeamSearch*> searches;
+  std::vector<Task*> searched;
+  for (Task* task : batch) {
+    if (task->searcher == nullptr ||
+        task->searcher->Type() != kPrefixBeamSearch) {
+      continue;
+    }
+    auto search = static_cast<CtcPrefixBeamSearch*>(task->searcher);
+    if (!CtcPrefixBeamSearchGroup::Supports(*search)) continue;
+    searches.push_back(search);
+    searched.push_back(task);
+  }
+  if (searches.empty()) return;
+  if (search_logps_.size() < searched.size()) {
+    search_logps_.resize(searched.size());
+  }
+  std::vector<MatrixView<float>> logps;
+  for (size_t i = 0; i < searched.size(); ++i) {
+    search_logps_[i].CopyFrom(*searched[i]->ctc_prob);
+    logps.push_back(search_logps_[i].view());
+  }
+  Timer timer;
+  search_group_.Search(searches, logps);
+  VLOG(2) << "ChunkScheduler search " << searches.size() << " chunks takes "
+          << timer.Elapsed() << " ms";
+  for (Task* task : searched) task->searched = true;
+}
+
+void ChunkScheduler::Run() {
+  Histogram* wait_latency = Metrics::Instance().GetHistogram(
+      "wenet_chunk_scheduler_wait_seconds",
+      "Queue wait of a chunk in the chunk scheduler");
+  std::vector<Task*> batch;
+  std::vector<AsrModel*> models;
+  std::vector<const std::vector<std::vector<float>>*> chunk_feats;
+  std::vector<std::vector<std::vector<float>>*> ctc_probs;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_cond_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      if (stop_ && tasks_.empty()) break;
+      // Wait a while so that chunks from other sessions can join the batch
+      auto deadline = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(opts_.max_wait_ms);
+      task_cond_.wait_until(lock, deadline, [this] {
+        return stop_ || tasks_.size() >= opts_.max_batch_size;
+      });
+      int batch_size =
+          std::min(static_cast<int>(tasks_.size()), opts_.max_batch_size);
+      batch.assign(tasks_.begin(), tasks_.begin() + batch_size);
+      tasks_.erase(tasks_.begin(), tasks_.begin() + batch_size);
+    }
+
+    models.clear();
+    chunk_feats.clear();
+    ctc_probs.clear();
+    for (Task* task : batch) {
+      wait_latency->Observe(task->wait_timer.ElapsedUs() / 1e6);
+      models.push_back(task->model);
+      chunk_feats.push_back(task->chunk_feats);
+      ctc_probs.push_back(task->ctc_prob);
+    }
+    Timer timer;
+    std::exception_ptr error = nullptr;
+    try {
+      AsrModel::ForwardEncoderBatch(models, chunk_feats, ctc_probs);
+      VLOG(2) << "ChunkScheduler forward " << batch.size()
+              << " chunks takes " << timer.Elapsed() << " ms";
+      if (opts_.batch_search) SearchBatch(batch);
+    } catch (...) {
+      // E.g. the error of the runtime of the model, which fails the
+      // sessions of the batch instead of the process
+      error = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (Task* task : batch) {
+        task->error = error;
+        task->done = true;
+      }
+    }
+    done_cond_.notify_all();
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,99 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_CHUNK_SCHEDULER_H_
+#define DECODER_CHUNK_SCHEDULER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "decoder/asr_model.h"
+#include "decoder/ctc_prefix_beam_search_group.h"
+#include "decoder/search_interface.h"
+#include "utils/matrix.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct ChunkSchedulerOptions {
+  // Max number of chunks forwarded in one encoder call
+  int max_batch_size = 16;
+  // Max time(ms) the first ready chunk waits for other chunks to join
+  int max_wait_ms = 5;
+  // Search the chunks of the prefix beam searches of a batch together on
+  // the scheduler thread by CtcPrefixBeamSearchGroup, instead of by each
+  // AsrDecoder on its own thread
+  bool batch_search = false;
+};
+
+// ChunkScheduler collects the ready chunks of many streaming decoding
+// sessions which share the same model, and forwards them in one batched
+// encoder call. It is shared by all the AsrDecoders of a DecodeResource,
+// each AsrDecoder still runs its own searcher on the returned ctc prob.
+class ChunkScheduler {
+ public:
+  explicit ChunkScheduler(const ChunkSchedulerOptions& opts);
+  ~ChunkScheduler();
+
+  // Called by decoding threads, it blocks until the chunk is forwarded.
+  // `model` must be a copy of the model which the scheduler is used for.
+  // With batch_search, the ctc_prob is also searched by `searcher` if it's
+  // a prefix beam search the group supports, and it returns whether so.
+  // A model without batch_forward_supported() is forwarded by the calling
+  // thread instead, and the error of the batch of the chunk is rethrown
+  // here, as if the chunk were forwarded by the calling thread.
+  bool ForwardEncoder(AsrModel* model,
+                      const std::vector<std::vector<float>>& chunk_feats,
+                      std::vector<std::vector<float>>* ctc_prob,
+                      SearchInterface* searcher = nullptr);
+
+ private:
+  struct Task {
+    AsrModel* model = nullptr;
+    const std::vector<std::vector<float>>* chunk_feats = nullptr;
+    std::vector<std::vector<float>>* ctc_prob = nullptr;
+    SearchInterface* searcher = nullptr;
+    bool searched = false;
+    bool done = false;
+    std::exception_ptr error = nullptr;
+    // Started when the task is queued
+    Timer wait_timer;
+  };
+
+  void Run();
+  // Search the ctc probs of the prefix beam search tasks of the batch
+  void SearchBatch(const std::vector<Task*>& batch);
+
+  const ChunkSchedulerOptions opts_;
+  std::mutex mutex_;
+  std::condition_variable task_cond_;
+  std::condition_variable done_cond_;
+  std::deque<Task*> tasks_;
+  bool stop_ = false;
+  std::thread thread_;
+  // Of the scheduler thread
+  CtcPrefixBeamSearchGroup search_group_;
+  std::vector<Matrix<float>> search_logps_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ChunkScheduler);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_CHUNK_SCHEDULER_H_
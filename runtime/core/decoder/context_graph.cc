@@ -15,35 +15,56 @@
 
 #include "decoder/context_graph.h"
 
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+#include <queue>
 #include <utility>
 
-#include "fst/determinize.h"
-
+#include "decoder/result_cache.h"
+#include "utils/log.h"
+#include "utils/metrics.h"
 #include "utils/string.h"
 
 namespace wenet {
 
-ContextGraph::ContextGraph(ContextConfig config) : config_(config) {}
+ContextGraph::ContextGraph(ContextConfig config)
+    : ContextGraph(config, nullptr) {}
+
+ContextGraph::ContextGraph(ContextConfig config,
+                           std::shared_ptr<ContextGraph> base)
+    : config_(config), base_graph_(std::move(base)) {
+  CHECK(base_graph_ == nullptr || base_graph_->base_graph_ == nullptr)
+      << "The base graph can't be an overlay";
+  if (base_graph_ != nullptr) {
+    start_tag_id_ = base_graph_->start_tag_id_;
+    end_tag_id_ = base_graph_->end_tag_id_;
+  }
+  // An empty graph before BuildContextGraph()
+  trie_ = BuildDoubleArray({}, nullptr, config_);
+  layered_states_.assign(1, std::make_pair(0, 0));
+  layered_state_ids_[0] = 0;
+}
 
 void ContextGraph::BuildContextGraph(
     const std::vector<std::string>& query_contexts,
     const std::shared_ptr<fst::SymbolTable>& symbol_table) {
   CHECK(symbol_table != nullptr) << "Symbols table should not be nullptr!";
-  start_tag_id_ = symbol_table->AddSymbol("<context>");
-  end_tag_id_ = symbol_table->AddSymbol("</context>");
-  symbol_table_ = symbol_table;
-  if (query_contexts.empty()) {
-    if (graph_ != nullptr) graph_.reset();
-    return;
-  }
+  symbol_table->AddSymbol("<context>");
+  symbol_table->AddSymbol("</context>");
+  BuildContextGraph(query_contexts, SymbolMap(*symbol_table));
+}
 
-  std::unique_ptr<fst::StdVectorFst> ofst(new fst::StdVectorFst());
-  // State 0 is the start state and the final state.
-  int start_state = ofst->AddState();
-  ofst->SetStart(start_state);
-  ofst->SetFinal(start_state, fst::StdArc::Weight::One());
+void ContextGraph::BuildContextGraph(
+    const std::vector<std::string>& query_contexts, const SymbolMap& symbols) {
+  start_tag_id_ = symbols.Find("<context>");
+  end_tag_id_ = symbols.Find("</context>");
+  CHECK(start_tag_id_ != fst::kNoSymbol && end_tag_id_ != fst::kNoSymbol)
+      << "The tags of the contexts are not in the symbols";
 
   LOG(INFO) << "Contexts count size: " << query_contexts.size();
+  std::vector<std::vector<int>> contexts;
   int count = 0;
   for (const auto& context : query_contexts) {
     if (context.size() > config_.max_context_length) {
@@ -54,58 +75,258 @@ void ContextGraph::BuildContextGraph(
 
     std::vector<std::string> words;
     // Split context to words by symbol table, and build the context graph.
-    bool no_oov = SplitUTF8StringToWords(Trim(context), symbol_table, &words);
+    bool no_oov = SplitUTF8StringToWords(Trim(context), symbols, &words);
     if (!no_oov) {
       LOG(WARNING) << "Ignore unknown word found during compilation.";
       continue;
     }
+    std::vector<int> word_ids;
+    for (const auto& word : words) {
+      word_ids.push_back(symbols.Find(word));
+    }
+    if (!word_ids.empty()) contexts.emplace_back(std::move(word_ids));
+  }
+  trie_ = CompileContexts(contexts, symbols, config_);
+  // State 0 of an overlay is the pair of the roots
+  layered_states_.assign(1, std::make_pair(0, 0));
+  layered_state_ids_.clear();
+  layered_state_ids_[0] = 0;
+}
+
+namespace {
+
+// The compiled tries of the process, in the LRU order
+struct ContextTrieCache {
+  std::mutex mutex;
+  int capacity = 64;
+  std::list<std::pair<uint64_t, std::shared_ptr<const void>>> entries;
+  std::unordered_map<uint64_t, decltype(entries)::iterator> index;
+
+  static ContextTrieCache& Instance() {
+    static ContextTrieCache cache;
+    return cache;
+  }
+  void Trim() {
+    while (static_cast<int>(entries.size()) > capacity) {
+      index.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+};
+
+}  // namespace
+
+void ContextGraph::set_cache_size(int cache_size) {
+  ContextTrieCache& cache = ContextTrieCache::Instance();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.capacity = std::max(cache_size, 0);
+  cache.Trim();
+}
+
+std::shared_ptr<const ContextGraph::Trie> ContextGraph::CompileContexts(
+    const std::vector<std::vector<int>>& contexts, const SymbolMap& symbols,
+    const ContextConfig& config) {
+  // The scores of the trie are of the lengths of the words and the config
+  uint64_t key = ResultCache::Hash(&config.context_score, sizeof(float));
+  key = ResultCache::Hash(&config.incremental_context_score, sizeof(float),
+                          key);
+  for (const auto& context : contexts) {
+    int size = context.size();
+    key = ResultCache::Hash(&size, sizeof(size), key);
+    for (int word_id : context) {
+      int64_t word[2] = {word_id, UTF8StringLength(symbols.Find(word_id))};
+      key = ResultCache::Hash(word, sizeof(word), key);
+    }
+  }
+  static Counter* num_hits = Metrics::Instance().GetCounter(
+      "wenet_context_graph_cache_hits_total",
+      "Number of the context graphs of which the compiled trie is cached");
+  ContextTrieCache& cache = ContextTrieCache::Instance();
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto it = cache.index.find(key);
+    if (it != cache.index.end()) {
+      cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+      num_hits->Increment();
+      return std::static_pointer_cast<const Trie>(it->second->second);
+    }
+  }
+  // Built out of the lock, a trie built twice concurrently is kept once
+  std::shared_ptr<const Trie> trie =
+      BuildDoubleArray(contexts, &symbols, config);
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  if (cache.capacity > 0 && cache.index.count(key) == 0) {
+    cache.entries.emplace_front(key, trie);
+    cache.index[key] = cache.entries.begin();
+    cache.Trim();
+  }
+  return trie;
+}
+
+std::shared_ptr<const ContextGraph::Trie> ContextGraph::BuildDoubleArray(
+    const std::vector<std::vector<int>>& contexts, const SymbolMap* symbols,
+    const ContextConfig& config) {
+  // 1. Build a plain trie, node 0 is the root
+  std::vector<std::map<int, int>> children(1);
+  std::vector<float> scores(1, 0);
+  std::vector<bool> is_end(1, false);
+  for (const auto& context : contexts) {
+    int node = 0;
+    for (size_t i = 0; i < context.size(); ++i) {
+      auto it = children[node].find(context[i]);
+      if (it == children[node].end()) {
+        float score = (i * config.incremental_context_score +
+                       config.context_score) *
+                      UTF8StringLength(symbols->Find(context[i]));
+        children.emplace_back();
+        scores.push_back(scores[node] + score);
+        is_end.push_back(false);
+        it = children[node].emplace(context[i], children.size() - 1).first;
+      }
+      node = it->second;
+    }
+    is_end[node] = true;
+  }
 
-    int prev_state = start_state;
-    int next_state = start_state;
-    float escape_score = 0;
-    for (size_t i = 0; i < words.size(); ++i) {
-      int word_id = symbol_table_->Find(words[i]);
-      float score = (i * config_.incremental_context_score
-                     + config_.context_score) * UTF8StringLength(words[i]);
-      next_state = (i < words.size() - 1) ? ofst->AddState() : start_state;
-      ofst->AddArc(prev_state,
-                   fst::StdArc(word_id, word_id, score, next_state));
-      // Add escape arc to clean the previous context score.
-      if (i > 0) {
-        // ilabel and olabel of the escape arc is 0 (<epsilon>).
-        ofst->AddArc(prev_state, fst::StdArc(0, 0, -escape_score, start_state));
+  // 2. Place the children of the nodes in the double array in BFS order,
+  // the first free index is tracked to find the base quickly
+  auto trie = std::make_shared<Trie>();
+  trie->base.assign(1, 0);
+  trie->check.assign(1, 0);  // The root is its own parent
+  trie->score.assign(1, 0);
+  trie->completed_score.assign(1, 0);
+  trie->is_end.assign(1, false);
+  trie->has_child.assign(1, !children[0].empty());
+  std::vector<int> index_of(children.size(), 0);  // Node to its state
+  std::queue<int> queue;
+  queue.push(0);
+  int first_free = 1;
+  while (!queue.empty()) {
+    int node = queue.front();
+    queue.pop();
+    int state = index_of[node];
+    if (children[node].empty()) continue;
+    while (first_free < trie->check.size() && trie->check[first_free] != -1) {
+      ++first_free;
+    }
+    const int min_label = children[node].begin()->first;
+    int base = std::max(first_free - min_label, 1);
+    for (bool found = false; !found; ++base) {
+      found = true;
+      for (const auto& child : children[node]) {
+        int index = base + child.first;
+        if (index < trie->check.size() && trie->check[index] != -1) {
+          found = false;
+          break;
+        }
       }
-      prev_state = next_state;
-      escape_score += score;
+    }
+    --base;
+    trie->base[state] = base;
+    int max_index = base + children[node].rbegin()->first;
+    if (max_index >= trie->check.size()) {
+      size_t size = max_index + 1;
+      trie->base.resize(size, 0);
+      trie->check.resize(size, -1);
+      trie->score.resize(size, 0);
+      trie->completed_score.resize(size, 0);
+      trie->is_end.resize(size, false);
+      trie->has_child.resize(size, false);
+    }
+    for (const auto& child : children[node]) {
+      int index = base + child.first;
+      trie->check[index] = state;
+      trie->score[index] = scores[child.second];
+      trie->is_end[index] = is_end[child.second];
+      trie->has_child[index] = !children[child.second].empty();
+      trie->completed_score[index] = trie->is_end[index] ? trie->score[index]
+                                               : trie->completed_score[state];
+      index_of[child.second] = index;
+      queue.push(child.second);
     }
   }
-  std::unique_ptr<fst::StdVectorFst> det_fst(new fst::StdVectorFst());
-  fst::Determinize(*ofst, det_fst.get());
-  graph_ = std::move(det_fst);
+  VLOG(1) << "Context graph states " << children.size()
+          << ", double array size " << trie->check.size();
+  return trie;
 }
 
 int ContextGraph::GetNextState(int cur_state, int word_id, float* score,
                                bool* is_start_boundary, bool* is_end_boundary) {
-  int next_state = 0;
-  for (fst::ArcIterator<fst::StdFst> aiter(*graph_, cur_state); !aiter.Done();
-       aiter.Next()) {
-    const fst::StdArc& arc = aiter.Value();
-    if (arc.ilabel == 0) {
-      // escape score, will be overwritten when ilabel equals to word id.
-      *score = arc.weight.Value();
-    } else if (arc.ilabel == word_id) {
-      next_state = arc.nextstate;
-      *score = arc.weight.Value();
-      if (cur_state == 0) {
-        *is_start_boundary = true;
-      }
-      if (graph_->Final(arc.nextstate) == fst::StdArc::Weight::One()) {
-        *is_end_boundary = true;
+  if (base_graph_ == nullptr) {
+    return NextTrieState(cur_state, word_id, score, is_start_boundary,
+                         is_end_boundary);
+  }
+  const std::pair<int, int> cur = layered_states_[cur_state];
+  float base_score = 0;
+  float trie_score = 0;
+  int base_state =
+      base_graph_->NextTrieState(cur.first, word_id, &base_score,
+                                 is_start_boundary, is_end_boundary);
+  int trie_state = NextTrieState(cur.second, word_id, &trie_score,
+                                 is_start_boundary, is_end_boundary);
+  *score = base_score + trie_score;
+  int64_t key = (static_cast<int64_t>(base_state) << 32) | trie_state;
+  auto it = layered_state_ids_.find(key);
+  if (it != layered_state_ids_.end()) return it->second;
+  int next_state = layered_states_.size();
+  layered_states_.emplace_back(base_state, trie_state);
+  layered_state_ids_[key] = next_state;
+  return next_state;
+}
+
+int ContextGraph::NextTrieState(int cur_state, int word_id, float* score,
+                                bool* is_start_boundary,
+                                bool* is_end_boundary) const {
+  const Trie& trie = *trie_;
+  int next_state = trie.Child(cur_state, word_id);
+  bool continued = next_state >= 0;
+  if (!continued && cur_state != 0) next_state = trie.Child(0, word_id);
+  // Clean the score of the uncompleted part of the context if the word doesn't
+  // continue it, the completed contexts keep their scores
+  *score = continued ? -trie.score[cur_state]
+                     : trie.completed_score[cur_state] - trie.score[cur_state];
+  if (next_state < 0) return 0;
+
+  *score += trie.score[next_state];
+  if (!continued || cur_state == 0) {
+    *is_start_boundary = true;
+  }
+  if (trie.is_end[next_state]) {
+    *is_end_boundary = true;
+    // Back to the root when no longer context continues it
+    if (!trie.has_child[next_state]) return 0;
+  }
+  return next_state;
+}
+
+void ContextGraph::BalanceTags(std::vector<int>* output) const {
+  std::vector<bool> keep(output->size(), true);
+  int open = -1;    // The start tag of the context being matched
+  int closed = -1;  // The end tag of the last context, moved by a longer one
+  for (int i = 0; i < output->size(); ++i) {
+    int id = (*output)[i];
+    if (id == start_tag_id_) {
+      if (open >= 0) keep[open] = false;
+      open = i;
+      closed = -1;
+    } else if (id == end_tag_id_) {
+      if (open >= 0) {
+        open = -1;
+      } else if (closed >= 0) {
+        keep[closed] = false;
+      } else {
+        keep[i] = false;
+        continue;
       }
-      break;
+      closed = i;
     }
   }
-  return next_state;
+  if (open >= 0) keep[open] = false;
+  int size = 0;
+  for (int i = 0; i < output->size(); ++i) {
+    if (keep[i]) (*output)[size++] = (*output)[i];
+  }
+  output->resize(size);
 }
 
 }  // namespace wenet
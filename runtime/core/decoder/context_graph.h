@@ -18,11 +18,14 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include "fst/compose.h"
 #include "fst/fst.h"
-#include "fst/vector-fst.h"
+#include "fst/symbol-table.h"
+
+#include "utils/symbol_map.h"
 
 namespace wenet {
 
@@ -35,23 +38,96 @@ struct ContextConfig {
   float incremental_context_score = 0.0;
 };
 
+// The contexts are kept in a double array trie, so GetNextState() is O(1) per
+// word and the graph is built in about linear time of the contexts.
+// The states are the indexes of the double array, 0 is the root. A state
+// scores the words from the root to it, and when the next word doesn't
+// continue the context, the state escapes to the root, where the word may
+// start another context. A suffix of the context isn't followed instead, since
+// its start boundary would be before the word, which has been reported.
+//
+// A graph can be an overlay of a shared base graph, e.g. the hotwords of a
+// caller on the shared contexts of all the sessions. The overlay is small and
+// built per session, the base is never copied nor changed, and the scores of
+// a word in both graphs are added up. The state of an overlay is a pair of
+// the states of the base and the overlay, which is numbered by the overlay,
+// so an overlay is used by one session only, while a base graph without its
+// own base can be shared by multiple threads.
 class ContextGraph {
  public:
   explicit ContextGraph(ContextConfig config);
+  // base is the shared base graph, which must not be an overlay itself, and
+  // is built with the same symbol table
+  ContextGraph(ContextConfig config, std::shared_ptr<ContextGraph> base);
   void BuildContextGraph(const std::vector<std::string>& query_context,
                          const std::shared_ptr<fst::SymbolTable>& symbol_table);
+  // The same by the SymbolMap of the table, which has the tags of the
+  // contexts already, see BuildSymbolMaps() of DecodeResource
+  void BuildContextGraph(const std::vector<std::string>& query_context,
+                         const SymbolMap& symbols);
+  // The start boundary is reported at the first word of a context, and the
+  // end boundary at the last one. A context may be left uncompleted after its
+  // start, and a completed context may be continued by a longer one, which
+  // reports its end again, see BalanceTags().
   int GetNextState(int cur_state, int word_id, float* score,
                    bool* is_start_boundary, bool* is_end_boundary);
+  // Drops the tags of the boundaries in output which enclose no completed
+  // context: the start tag of an uncompleted context, and all but the last end
+  // tag of the contexts continued by the longer ones, so the tags are paired
+  void BalanceTags(std::vector<int>* output) const;
 
   int start_tag_id() { return start_tag_id_; }
   int end_tag_id() { return end_tag_id_; }
 
+  // The compiled tries are kept by the process, by a hash of the word ids of
+  // the contexts, the lengths of the words and the scores of the config, so
+  // the graphs of the same contexts, e.g. the contact list shared by many
+  // sessions, share one trie, and it's built only once. The least recently
+  // built or used ones over cache_size are dropped, 0 disables the cache.
+  static void set_cache_size(int cache_size);
+
  private:
+  // The double array trie of the contexts, which is immutable once built
+  struct Trie {
+    // base[s] + word_id is the index of the child of state s by word_id, and
+    // check[index] is its parent, -1 if the index is free
+    std::vector<int> base;
+    std::vector<int> check;
+    // Total score of the words from the root to each state
+    std::vector<float> score;
+    // Score of the longest completed context on the path to each state,
+    // which is kept when escaping
+    std::vector<float> completed_score;
+    std::vector<bool> is_end;
+    std::vector<bool> has_child;
+
+    // Returns the child of state by word_id, -1 if there isn't
+    int Child(int state, int word_id) const {
+      int index = base[state] + word_id;
+      return (index < check.size() && check[index] == state) ? index : -1;
+    }
+  };
+  // symbols is for the lengths of the words, nullptr if there is no context
+  static std::shared_ptr<const Trie> BuildDoubleArray(
+      const std::vector<std::vector<int>>& contexts, const SymbolMap* symbols,
+      const ContextConfig& config);
+  // The trie of the cache or built, see set_cache_size()
+  static std::shared_ptr<const Trie> CompileContexts(
+      const std::vector<std::vector<int>>& contexts, const SymbolMap& symbols,
+      const ContextConfig& config);
+  // The transition of the trie of this graph
+  int NextTrieState(int cur_state, int word_id, float* score,
+                    bool* is_start_boundary, bool* is_end_boundary) const;
+
   int start_tag_id_ = -1;
   int end_tag_id_ = -1;
   ContextConfig config_;
-  std::shared_ptr<fst::SymbolTable> symbol_table_ = nullptr;
-  std::unique_ptr<fst::StdVectorFst> graph_ = nullptr;
+  std::shared_ptr<const Trie> trie_;
+
+  std::shared_ptr<ContextGraph> base_graph_ = nullptr;
+  // For an overlay, the (base state, trie state) pair of each state
+  std::vector<std::pair<int, int>> layered_states_;
+  std::unordered_map<int64_t, int> layered_state_ids_;
   DISALLOW_COPY_AND_ASSIGN(ContextGraph);
 };
 
@@ -47,20 +47,59 @@ static bool RuleActivated(const CtcEndpointRule& rule,
   return ans;
 }
 
+void CtcEndpoint::AcceptFrame(float blank_prob) {
+  num_frames_decoded_++;
+  if (blank_prob > config_.blank_threshold) {
+    num_frames_trailing_blank_++;
+  } else {
+    num_frames_trailing_blank_ = 0;
+  }
+}
+
 bool CtcEndpoint::IsEndpoint(
     const std::vector<std::vector<float>>& ctc_log_probs,
     bool decoded_something) {
   for (int t = 0; t < ctc_log_probs.size(); ++t) {
     const auto& logp_t = ctc_log_probs[t];
-    float blank_prob = expf(logp_t[config_.blank]);
+    AcceptFrame(expf(logp_t[config_.blank]));
+  }
+  return RulesActivated(decoded_something);
+}
+
+bool CtcEndpoint::IsEndpoint(const MatrixView<float>& ctc_log_probs,
+                             bool decoded_something) {
+  for (int t = 0; t < ctc_log_probs.rows(); ++t) {
+    AcceptFrame(expf(ctc_log_probs(t, config_.blank)));
+  }
+  return RulesActivated(decoded_something);
+}
 
-    num_frames_decoded_++;
-    if (blank_prob > config_.blank_threshold) {
-      num_frames_trailing_blank_++;
-    } else {
-      num_frames_trailing_blank_ = 0;
+bool CtcEndpoint::IsEndpoint(
+    const std::vector<std::vector<float>>& topk_scores,
+    const std::vector<std::vector<int32_t>>& topk_indexs,
+    bool decoded_something) {
+  for (int t = 0; t < topk_scores.size(); ++t) {
+    float blank_prob = 0.0f;
+    for (int i = 0; i < topk_indexs[t].size(); ++i) {
+      if (topk_indexs[t][i] == config_.blank) {
+        blank_prob = expf(topk_scores[t][i]);
+        break;
+      }
     }
+    AcceptFrame(blank_prob);
   }
+  return RulesActivated(decoded_something);
+}
+
+bool CtcEndpoint::IsEndpoint(const std::vector<float>& blank_scores,
+                             bool decoded_something) {
+  for (float blank_score : blank_scores) {
+    AcceptFrame(expf(blank_score));
+  }
+  return RulesActivated(decoded_something);
+}
+
+bool CtcEndpoint::RulesActivated(bool decoded_something) {
   CHECK_GE(num_frames_decoded_, num_frames_trailing_blank_);
   CHECK_GT(frame_shift_in_ms_, 0);
   int utterance_length = num_frames_decoded_ * frame_shift_in_ms_;
@@ -16,8 +16,12 @@
 #ifndef DECODER_CTC_ENDPOINT_H_
 #define DECODER_CTC_ENDPOINT_H_
 
+#include <cstdint>
 #include <vector>
 
+#include "utils/matrix.h"
+#include "utils/state_io.h"
+
 namespace wenet {
 
 struct CtcEndpointRule {
@@ -62,12 +66,42 @@ class CtcEndpoint {
   /// should terminate decoding.
   bool IsEndpoint(const std::vector<std::vector<float>>& ctc_log_probs,
                   bool decoded_something);
+  bool IsEndpoint(const MatrixView<float>& ctc_log_probs,
+                  bool decoded_something);
+  /// Same as above, but on the topk ctc log probs of each frame. The blank
+  /// prob which is not in the topk is taken as 0, it is exact as long as
+  /// blank_threshold >= 0.5, since such a blank must be the top 1.
+  bool IsEndpoint(const std::vector<std::vector<float>>& topk_scores,
+                  const std::vector<std::vector<int32_t>>& topk_indexs,
+                  bool decoded_something);
+  /// Same as above, but on the blank log probs of the frames which the
+  /// search has read, see SearchInterface::BlankScores(), so the frames are
+  /// not scanned again, and the topk or sparse log probs are fine. The blank
+  /// of the search must be the one of the config.
+  bool IsEndpoint(const std::vector<float>& blank_scores,
+                  bool decoded_something);
 
   void frame_shift_in_ms(int frame_shift_in_ms) {
     frame_shift_in_ms_ = frame_shift_in_ms;
   }
+  int trailing_silence_ms() const {
+    return num_frames_trailing_blank_ * frame_shift_in_ms_;
+  }
+
+  // The counters of the session, see AsrDecoder::SaveState
+  void SaveState(StateWriter* writer) const {
+    writer->Write(num_frames_decoded_);
+    writer->Write(num_frames_trailing_blank_);
+  }
+  bool LoadState(StateReader* reader) {
+    return reader->Read(&num_frames_decoded_) &&
+           reader->Read(&num_frames_trailing_blank_);
+  }
 
  private:
+  void AcceptFrame(float blank_prob);
+  bool RulesActivated(bool decoded_something);
+
   CtcEndpointConfig config_;
   int frame_shift_in_ms_ = -1;
   int num_frames_decoded_ = 0;
@@ -0,0 +1,344 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/ctc_lg_beam_search.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <utility>
+
+#include "decoder/adaptive_beam.h"
+
+namespace wenet {
+
+static inline uint64_t TokenKey(int state, int last) {
+  return (static_cast<uint64_t>(state) << 32) | static_cast<uint32_t>(last);
+}
+
+CtcLgBeamSearch::CtcLgBeamSearch(const fst::Fst<fst::StdArc>& fst,
+                                 const CtcWfstBeamSearchOptions& opts)
+    : fst_(fst.Copy(true)),
+      opts_(opts),
+      beam_(opts.beam),
+      max_active_(opts.max_active) {
+  Reset();
+}
+
+void CtcLgBeamSearch::SetBeamScale(float beam_scale) {
+  beam_ = opts_.beam * beam_scale;
+  max_active_ = ScaleBeamSize(opts_.max_active, beam_scale);
+}
+
+void CtcLgBeamSearch::Reset() {
+  num_frames_ = 0;
+  toks_.clear();
+  traces_.clear();
+  for (int32_t id : sparse_ids_) sparse_logp_[id] = opts_.sparse_floor;
+  sparse_ids_.clear();
+  inputs_.clear();
+  outputs_.clear();
+  likelihood_.clear();
+  times_.clear();
+  next_toks_.clear();
+  index_.clear();
+  int start = fst_->Start();
+  if (start == fst::kNoStateId) return;
+  AddToken({start, 0, 0.0f, -1, -1, 0});
+  queue_.assign(1, 0);
+  CloseEpsilon(std::numeric_limits<float>::infinity(), 0);
+  SelectActive(std::numeric_limits<float>::infinity());
+}
+
+void CtcLgBeamSearch::Search(const std::vector<std::vector<float>>& logp) {
+  if (logp.empty()) {
+    return;
+  }
+  if (opts_.sparse_topk > 0) {
+    // Only the topk of each frame are searched
+    std::vector<float> rows;
+    for (const auto& frame : logp) {
+      rows.insert(rows.end(), frame.begin(), frame.end());
+    }
+    Search(MatrixView<float>(rows.data(), logp.size(), logp[0].size()));
+    return;
+  }
+  int vocab_size = logp[0].size();
+  for (const auto& frame : logp) {
+    const float* row = frame.data();
+    SearchFrame(std::exp(row[0]), vocab_size, [row](int k) { return row[k]; });
+  }
+  GetNbest(opts_.partial_nbest, false);
+}
+
+void CtcLgBeamSearch::Search(const MatrixView<float>& logp) {
+  if (logp.empty()) {
+    return;
+  }
+  if (opts_.sparse_topk > 0) {
+    // Only the topk of each frame are searched
+    int k = std::min(opts_.sparse_topk, logp.cols());
+    Matrix<float> topk_scores(logp.rows(), k);
+    Matrix<int32_t> topk_indexs(logp.rows(), k);
+    std::vector<float> scores;
+    std::vector<int32_t> ids;
+    for (int t = 0; t < logp.rows(); ++t) {
+      TopK(logp.row(t), logp.cols(), k, &scores, &ids);
+      std::copy(scores.begin(), scores.end(), topk_scores.row(t));
+      std::copy(ids.begin(), ids.end(), topk_indexs.row(t));
+    }
+    Search(topk_scores.view(), topk_indexs.view());
+    return;
+  }
+  for (int t = 0; t < logp.rows(); ++t) {
+    const float* row = logp.row(t);
+    SearchFrame(std::exp(row[0]), logp.cols(),
+                [row](int k) { return row[k]; });
+  }
+  GetNbest(opts_.partial_nbest, false);
+}
+
+void CtcLgBeamSearch::Search(
+    const std::vector<std::vector<float>>& topk_scores,
+    const std::vector<std::vector<int32_t>>& topk_indexs) {
+  if (topk_scores.empty()) {
+    return;
+  }
+  SearchTopKFrames(
+      topk_scores.size(), topk_scores[0].size(),
+      [&topk_scores](int t) { return topk_scores[t].data(); },
+      [&topk_indexs](int t) { return topk_indexs[t].data(); });
+}
+
+void CtcLgBeamSearch::Search(const MatrixView<float>& topk_scores,
+                             const MatrixView<int32_t>& topk_indexs) {
+  if (topk_scores.empty()) {
+    return;
+  }
+  CHECK_EQ(topk_scores.rows(), topk_indexs.rows());
+  CHECK_EQ(topk_scores.cols(), topk_indexs.cols());
+  SearchTopKFrames(
+      topk_scores.rows(), topk_scores.cols(),
+      [&topk_scores](int t) { return topk_scores.row(t); },
+      [&topk_indexs](int t) { return topk_indexs.row(t); });
+}
+
+template <typename ScoresFunc, typename IdsFunc>
+void CtcLgBeamSearch::SearchTopKFrames(int num_frames, int k,
+                                       const ScoresFunc& scores,
+                                       const IdsFunc& ids) {
+  if (opts_.sparse_topk > 0) k = std::min(k, opts_.sparse_topk);
+  const float floor = opts_.sparse_floor;
+  for (int t = 0; t < num_frames; ++t) {
+    const float* score = scores(t);
+    const int32_t* id = ids(t);
+    // The tokens below sparse_thresh are pruned, the best one is kept
+    int num_kept = 1;
+    while (num_kept < k && std::exp(score[num_kept]) >= opts_.sparse_thresh) {
+      ++num_kept;
+    }
+    // Only the entries of the last frame are restored to the floor
+    for (int32_t i : sparse_ids_) sparse_logp_[i] = floor;
+    sparse_ids_.assign(id, id + num_kept);
+    for (int j = 0; j < num_kept; ++j) {
+      CHECK_GE(id[j], 0);
+      if (id[j] >= sparse_logp_.size()) sparse_logp_.resize(id[j] + 1, floor);
+      sparse_logp_[id[j]] = score[j];
+    }
+    // The blank out of the topk is taken as prob 0
+    float blank_prob = 0.0f;
+    for (int j = 0; j < k; ++j) {
+      if (id[j] == 0) {
+        blank_prob = std::exp(score[j]);
+        break;
+      }
+    }
+    const std::vector<float>& table = sparse_logp_;
+    SearchFrame(blank_prob, std::numeric_limits<int>::max(),
+                [&table, floor](int i) {
+                  return i < table.size() ? table[i] : floor;
+                });
+  }
+  GetNbest(opts_.partial_nbest, false);
+}
+
+template <typename ScoreFunc>
+void CtcLgBeamSearch::SearchFrame(float blank_prob, int vocab_size,
+                                  const ScoreFunc& score) {
+  int frame = num_frames_++;
+  if (toks_.empty()) return;
+  const float scale = opts_.acoustic_scale;
+  const float blank_cost = -scale * score(0);
+  next_toks_.clear();
+  index_.clear();
+  if (blank_prob > opts_.blank_skip_thresh) {
+    // All the tokens take the blank, nothing is pruned
+    VLOG(3) << "skipping frame " << frame << " score " << blank_prob;
+    for (const Token& tok : toks_) {
+      AddToken({tok.state, 0, tok.cost + blank_cost, tok.trace, -1, 0});
+    }
+    toks_.swap(next_toks_);
+    return;
+  }
+  float cutoff = std::numeric_limits<float>::infinity();
+  for (const Token& tok : toks_) {
+    // The blank and the repeat of the last token stay in the state
+    float cost = tok.cost + blank_cost;
+    if (cost < cutoff) {
+      AddToken({tok.state, 0, cost, tok.trace, -1, 0});
+      cutoff = std::min(cutoff, cost + beam_);
+    }
+    if (tok.last > 0) {
+      cost = tok.cost - scale * score(tok.last);
+      if (cost < cutoff) {
+        AddToken({tok.state, tok.last, cost, tok.trace, -1, 0});
+        cutoff = std::min(cutoff, cost + beam_);
+      }
+    }
+    // The new tokens follow the arcs
+    for (fst::ArcIterator<fst::Fst<fst::StdArc>> aiter(*fst_, tok.state);
+         !aiter.Done(); aiter.Next()) {
+      const fst::StdArc& arc = aiter.Value();
+      int k = arc.ilabel - 1;
+      // Skip the epsilons, the blanks and the repeat of the last token
+      if (k <= 0 || k == tok.last || k >= vocab_size) continue;
+      cost = tok.cost + arc.weight.Value() + opts_.length_penalty -
+             scale * score(k);
+      if (cost >= cutoff) continue;
+      AddToken({arc.nextstate, k, cost, tok.trace, k, arc.olabel});
+      cutoff = std::min(cutoff, cost + beam_);
+    }
+  }
+  Prune(cutoff, frame);
+}
+
+int CtcLgBeamSearch::AddToken(const Token& tok) {
+  auto it = index_.emplace(TokenKey(tok.state, tok.last), next_toks_.size());
+  if (it.second) {
+    next_toks_.push_back(tok);
+    return it.first->second;
+  }
+  Token& old = next_toks_[it.first->second];
+  if (tok.cost >= old.cost) return -1;
+  old = tok;
+  return it.first->second;
+}
+
+void CtcLgBeamSearch::TraceLabels(Token* tok, int frame) {
+  if (tok->token < 0 && tok->word == 0) return;
+  traces_.push_back({tok->trace, tok->token, tok->word, frame});
+  tok->trace = traces_.size() - 1;
+  tok->token = -1;
+  tok->word = 0;
+}
+
+void CtcLgBeamSearch::Prune(float cutoff, int frame) {
+  queue_.clear();
+  for (int i = 0; i < next_toks_.size(); ++i) {
+    Token& tok = next_toks_[i];
+    if (tok.cost > cutoff) continue;
+    // The new states by the arcs are closed by the epsilon arcs
+    if (tok.token >= 0) queue_.push_back(i);
+    TraceLabels(&tok, frame);
+  }
+  CloseEpsilon(cutoff, frame);
+  SelectActive(cutoff);
+}
+
+void CtcLgBeamSearch::CloseEpsilon(float cutoff, int frame) {
+  while (!queue_.empty()) {
+    Token tok = next_toks_[queue_.back()];
+    queue_.pop_back();
+    for (fst::ArcIterator<fst::Fst<fst::StdArc>> aiter(*fst_, tok.state);
+         !aiter.Done(); aiter.Next()) {
+      const fst::StdArc& arc = aiter.Value();
+      if (arc.ilabel != 0) continue;
+      float cost = tok.cost + arc.weight.Value();
+      if (cost > cutoff) continue;
+      int i = AddToken({arc.nextstate, tok.last, cost, tok.trace, -1,
+                        static_cast<int>(arc.olabel)});
+      if (i < 0) continue;
+      TraceLabels(&next_toks_[i], frame);
+      queue_.push_back(i);
+    }
+  }
+}
+
+void CtcLgBeamSearch::SelectActive(float cutoff) {
+  toks_.clear();
+  for (const Token& tok : next_toks_) {
+    if (tok.cost <= cutoff) toks_.push_back(tok);
+  }
+  if (toks_.size() > static_cast<size_t>(max_active_)) {
+    std::nth_element(
+        toks_.begin(), toks_.begin() + max_active_, toks_.end(),
+        [](const Token& a, const Token& b) { return a.cost < b.cost; });
+    toks_.resize(max_active_);
+  }
+}
+
+void CtcLgBeamSearch::GetNbest(int nbest, bool final) {
+  inputs_.clear();
+  outputs_.clear();
+  likelihood_.clear();
+  times_.clear();
+  // The final costs are only added if any token is final
+  bool use_final = false;
+  if (final) {
+    for (const Token& tok : toks_) {
+      if (fst_->Final(tok.state) != fst::TropicalWeight::Zero()) {
+        use_final = true;
+        break;
+      }
+    }
+  }
+  std::vector<std::pair<float, int>> order;
+  for (int i = 0; i < toks_.size(); ++i) {
+    float cost = toks_[i].cost;
+    if (use_final) cost += fst_->Final(toks_[i].state).Value();
+    if (cost < std::numeric_limits<float>::infinity()) {
+      order.emplace_back(cost, i);
+    }
+  }
+  std::sort(order.begin(), order.end());
+  std::set<std::vector<int>> seen;
+  for (const auto& item : order) {
+    if (outputs_.size() >= nbest) break;
+    std::vector<int> input, output, time;
+    for (int t = toks_[item.second].trace; t >= 0; t = traces_[t].prev) {
+      const Trace& trace = traces_[t];
+      if (trace.token >= 0) {
+        input.push_back(trace.token);
+        time.push_back(trace.frame);
+      }
+      if (trace.word > 0) output.push_back(trace.word);
+    }
+    std::reverse(output.begin(), output.end());
+    if (!seen.insert(output).second) continue;
+    std::reverse(input.begin(), input.end());
+    std::reverse(time.begin(), time.end());
+    inputs_.emplace_back(std::move(input));
+    outputs_.emplace_back(std::move(output));
+    times_.emplace_back(std::move(time));
+    likelihood_.push_back(-item.first);
+  }
+}
+
+void CtcLgBeamSearch::FinalizeSearch() {
+  GetNbest(std::max(static_cast<int>(opts_.nbest), 1), true);
+}
+
+}  // namespace wenet
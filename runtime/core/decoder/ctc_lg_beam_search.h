@@ -0,0 +1,144 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_CTC_LG_BEAM_SEARCH_H_
+#define DECODER_CTC_LG_BEAM_SEARCH_H_
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "fst/fstlib.h"
+
+#include "decoder/ctc_wfst_beam_search.h"
+#include "decoder/search_interface.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Viterbi beam search of the ctc on the LG graph, i.e. the TLG without T, of
+// which the input labels are the token ids plus one as those of the TLG. The
+// blanks and the repeats of the ctc topology are handled by the token
+// passing instead of the arcs of T: a token is a state of LG with the last
+// token emitted, a blank or a repeat of the last token stays in the state,
+// and only a new token follows the arcs of LG. So the graph is about the size
+// of LG, and the arcs traversed per token are those of the new tokens, while
+// CtcWfstBeamSearch also runs the blank and repeat arcs of T. The frames of
+// which the blank prob is over blank_skip_thresh are taken as blank by all
+// the tokens, without the arcs and the added back blank frames.
+// The tokens are pruned by the beam and max_active of the options, and the
+// tokens and words of their best paths are traced instead of a lattice, so
+// the n-best are those of the final tokens with distinct words. The context
+// graph and the word lattice are not supported.
+class CtcLgBeamSearch : public SearchInterface {
+ public:
+  CtcLgBeamSearch(const fst::Fst<fst::StdArc>& fst,
+                  const CtcWfstBeamSearchOptions& opts);
+  void Search(const std::vector<std::vector<float>>& logp) override;
+  void Search(const MatrixView<float>& logp) override;
+  void Search(const std::vector<std::vector<float>>& topk_scores,
+              const std::vector<std::vector<int32_t>>& topk_indexs) override;
+  void Search(const MatrixView<float>& topk_scores,
+              const MatrixView<int32_t>& topk_indexs) override;
+  void Reset() override;
+  void FinalizeSearch() override;
+  SearchType Type() const override { return SearchType::kWfstBeamSearch; }
+  void SetBeamScale(float beam_scale) override;
+  const std::vector<std::vector<int>>& Inputs() const override {
+    return inputs_;
+  }
+  const std::vector<std::vector<int>>& Outputs() const override {
+    return outputs_;
+  }
+  const std::vector<float>& Likelihood() const override { return likelihood_; }
+  const std::vector<std::vector<int>>& Times() const override { return times_; }
+
+  // The active tokens after the last frame
+  int num_active() const { return toks_.size(); }
+
+ private:
+  struct Token {
+    int state;
+    // The last token emitted, 0 for a blank
+    int last;
+    float cost;
+    // The last entry of the traces, -1 for none
+    int trace;
+    // The token and the word to be traced once the token survives the
+    // pruning, -1 and 0 for none
+    int token;
+    int word;
+  };
+  // The traces of the tokens make a tree, the traced labels of a token are
+  // those of the entries from its trace to the root
+  struct Trace {
+    int prev;
+    int token;
+    int word;
+    int frame;
+  };
+
+  // Search the frame of the log probs `score(k)` of token k, -inf for the
+  // tokens pruned, in the tokens below vocab_size
+  template <typename ScoreFunc>
+  void SearchFrame(float blank_prob, int vocab_size, const ScoreFunc& score);
+  // Search the sparse frames of the k tokens `scores(t)` and `ids(t)`, in
+  // descending order of the scores
+  template <typename ScoresFunc, typename IdsFunc>
+  void SearchTopKFrames(int num_frames, int k, const ScoresFunc& scores,
+                        const IdsFunc& ids);
+  // Add or recombine the candidate of next_toks_, return its index if it's
+  // added or better than the one of the state, otherwise -1
+  int AddToken(const Token& tok);
+  // Prune next_toks_ by the cutoff, trace the labels of the survivors and
+  // follow the epsilon arcs of those which come by the arcs of LG, then
+  // keep the best max_active ones as toks_
+  void Prune(float cutoff, int frame);
+  // Follow the epsilon arcs of the tokens of queue_ in next_toks_
+  void CloseEpsilon(float cutoff, int frame);
+  void SelectActive(float cutoff);
+  void TraceLabels(Token* tok, int frame);
+  // The n-best of the tokens of distinct words, with the final costs if
+  // final and any token is final
+  void GetNbest(int nbest, bool final);
+
+  // A thread safe copy of the graph, see CtcWfstBeamSearch
+  std::unique_ptr<fst::Fst<fst::StdArc>> fst_;
+  const CtcWfstBeamSearchOptions& opts_;
+  // The beam and max_active of the options scaled, see SetBeamScale
+  float beam_;
+  int max_active_;
+  int num_frames_ = 0;
+  std::vector<Token> toks_;
+  std::vector<Token> next_toks_;
+  // The index of next_toks_ by (state, last)
+  std::unordered_map<uint64_t, int> index_;
+  std::vector<int> queue_;
+  std::vector<Trace> traces_;
+  // The lookup table of the current sparse frame and its ids
+  std::vector<float> sparse_logp_;
+  std::vector<int32_t> sparse_ids_;
+  std::vector<std::vector<int>> inputs_, outputs_;
+  std::vector<float> likelihood_;
+  std::vector<std::vector<int>> times_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(CtcLgBeamSearch);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_CTC_LG_BEAM_SEARCH_H_
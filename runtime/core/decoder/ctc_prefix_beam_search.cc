@@ -16,326 +16,487 @@
 #include "decoder/ctc_prefix_beam_search.h"
 
 #include <algorithm>
-#include <tuple>
+#include <cmath>
 #include <unordered_map>
 #include <utility>
 
+#include "decoder/adaptive_beam.h"
 #include "utils/log.h"
 #include "utils/utils.h"
 
 namespace wenet {
 
+const int CtcPrefixBeamSearch::kMinReclaimSize;
+
 CtcPrefixBeamSearch::CtcPrefixBeamSearch(
     const CtcPrefixBeamSearchOptions& opts,
-    const std::shared_ptr<ContextGraph>& context_graph)
-    : opts_(opts), context_graph_(context_graph) {
+    const std::shared_ptr<ContextGraph>& context_graph,
+    const std::shared_ptr<LanguageModel>& lm, Arena* arena)
+    : first_beam_size_(opts.first_beam_size),
+      second_beam_size_(opts.second_beam_size),
+      prefix_tree_(arena),
+      next_hyps_(0, std::hash<int>(), std::equal_to<int>(),
+                 PrefixScoreMap::allocator_type(arena)),
+      context_graph_(context_graph),
+      lm_(lm),
+      lm_states_(0, std::hash<int>(), std::equal_to<int>(),
+                 decltype(lm_states_)::allocator_type(arena)),
+      opts_(opts) {
+  bool times = opts.enable_times;
+  if (context_graph_ != nullptr) {
+    pass_tokens_ = times ? &CtcPrefixBeamSearch::PassTokens<true, true>
+                         : &CtcPrefixBeamSearch::PassTokens<true, false>;
+  } else {
+    pass_tokens_ = times ? &CtcPrefixBeamSearch::PassTokens<false, true>
+                         : &CtcPrefixBeamSearch::PassTokens<false, false>;
+  }
   Reset();
 }
 
+void CtcPrefixBeamSearch::SetBeamScale(float beam_scale) {
+  first_beam_size_ = ScaleBeamSize(opts_.first_beam_size, beam_scale);
+  second_beam_size_ = ScaleBeamSize(opts_.second_beam_size, beam_scale);
+}
+
 void CtcPrefixBeamSearch::Reset() {
-  hypotheses_.clear();
-  likelihood_.clear();
   cur_hyps_.clear();
-  viterbi_likelihood_.clear();
-  times_.clear();
-  outputs_.clear();
+  next_hyps_.clear();
+  materialized_ = false;
+  prefix_tree_.Clear();
+  int_lists_.Clear();
+  reclaim_size_ = kMinReclaimSize;
   abs_time_step_ = 0;
   PrefixScore prefix_score;
   prefix_score.s = 0.0;
   prefix_score.ns = -kFloatMax;
   prefix_score.v_s = 0.0;
   prefix_score.v_ns = 0.0;
-  std::vector<int> empty;
-  cur_hyps_[empty] = prefix_score;
-  outputs_.emplace_back(empty);
-  hypotheses_.emplace_back(empty);
-  likelihood_.emplace_back(prefix_score.total_score());
-  times_.emplace_back(empty);
+  cur_hyps_.emplace_back(static_cast<int>(PrefixTree::kRoot), prefix_score);
+  if (lm_ != nullptr) {
+    lm_->Reset();
+    lm_states_.clear();
+    lm_states_[static_cast<int>(PrefixTree::kRoot)] = {lm_->Start(), 0.0f};
+  }
+}
+
+bool CtcPrefixBeamSearch::SaveState(StateWriter* writer) const {
+  if (lm_ != nullptr) return false;
+  writer->Write(abs_time_step_);
+  prefix_tree_.SaveState(writer);
+  int_lists_.SaveState(writer);
+  writer->Write<uint64_t>(cur_hyps_.size());
+  for (const auto& hyp : cur_hyps_) {
+    writer->Write(hyp.first);
+    writer->Write(hyp.second);
+  }
+  return true;
+}
+
+bool CtcPrefixBeamSearch::LoadState(StateReader* reader) {
+  if (lm_ != nullptr) return false;
+  Reset();
+  uint64_t num_hyps = 0;
+  if (!reader->Read(&abs_time_step_) || !prefix_tree_.LoadState(reader) ||
+      !int_lists_.LoadState(reader) || !reader->Read(&num_hyps)) {
+    return false;
+  }
+  cur_hyps_.clear();
+  for (uint64_t i = 0; i < num_hyps; ++i) {
+    std::pair<int, PrefixScore> hyp;
+    if (!reader->Read(&hyp.first) || !reader->Read(&hyp.second)) return false;
+    if (hyp.first < 0 || hyp.first >= prefix_tree_.size()) return false;
+    cur_hyps_.emplace_back(hyp);
+  }
+  materialized_ = false;
+  return true;
+}
+
+int64_t CtcPrefixBeamSearch::memory_bytes() const {
+  // The maps are estimated as the one of PrefixTree::memory_bytes
+  auto map_bytes = [](size_t size, size_t value_size, size_t bucket_count) {
+    return static_cast<int64_t>(size * (sizeof(int) + value_size +
+                                        sizeof(void*)) +
+                                bucket_count * sizeof(void*));
+  };
+  return prefix_tree_.memory_bytes() + int_lists_.memory_bytes() +
+         CapacityBytes(cur_hyps_) + CapacityBytes(candidates_) +
+         map_bytes(next_hyps_.size(), sizeof(PrefixScore),
+                   next_hyps_.bucket_count()) +
+         map_bytes(lm_states_.size(), sizeof(LmState),
+                   lm_states_.bucket_count()) +
+         CapacityBytes(hypotheses_) + CapacityBytes(times_) +
+         CapacityBytes(outputs_) + CapacityBytes(likelihood_) +
+         CapacityBytes(viterbi_likelihood_);
 }
 
-static bool PrefixScoreCompare(
-    const std::pair<std::vector<int>, PrefixScore>& a,
-    const std::pair<std::vector<int>, PrefixScore>& b) {
+static bool PrefixScoreCompare(const std::pair<int, PrefixScore>& a,
+                               const std::pair<int, PrefixScore>& b) {
   return a.second.total_score() > b.second.total_score();
 }
 
-void CtcPrefixBeamSearch::UpdateOutputs(
-    const std::pair<std::vector<int>, PrefixScore>& prefix) {
-  const std::vector<int>& input = prefix.first;
-  const std::vector<int>& start_boundaries = prefix.second.start_boundaries;
-  const std::vector<int>& end_boundaries = prefix.second.end_boundaries;
+void CtcPrefixBeamSearch::UpdateContext(const PrefixScore& from, int word_id,
+                                        int prefix_len,
+                                        PrefixScore* prefix_score) {
+  prefix_score->CopyContext(from);
+
+  float score = 0;
+  bool is_start_boundary = false;
+  bool is_end_boundary = false;
+
+  prefix_score->context_state =
+      context_graph_->GetNextState(from.context_state, word_id, &score,
+                                   &is_start_boundary, &is_end_boundary);
+  prefix_score->context_score += score;
+  if (is_start_boundary) {
+    prefix_score->start_boundaries =
+        int_lists_.Append(prefix_score->start_boundaries, prefix_len);
+  }
+  if (is_end_boundary) {
+    prefix_score->end_boundaries =
+        int_lists_.Append(prefix_score->end_boundaries, prefix_len);
+  }
+}
+
+void CtcPrefixBeamSearch::UpdateLmScores(
+    PrefixScoreMap* next_hyps) {
+  lm_prefixes_.clear();
+  lm_in_states_.clear();
+  lm_tokens_.clear();
+  for (auto& it : *next_hyps) {
+    auto cached = lm_states_.find(it.first);
+    if (cached != lm_states_.end()) {
+      it.second.lm_score = cached->second.score;
+      continue;
+    }
+    // The parent is a current hypothesis, which is scored
+    lm_prefixes_.push_back(it.first);
+    lm_in_states_.push_back(lm_states_[prefix_tree_.parent(it.first)].state);
+    lm_tokens_.push_back(prefix_tree_.token(it.first));
+  }
+  if (lm_prefixes_.empty()) return;
+  lm_->Score(lm_in_states_, lm_tokens_, &lm_log_probs_, &lm_out_states_);
+  for (size_t i = 0; i < lm_prefixes_.size(); ++i) {
+    int prefix = lm_prefixes_[i];
+    float score = lm_states_[prefix_tree_.parent(prefix)].score +
+                  opts_.lm_weight * lm_log_probs_[i];
+    lm_states_[prefix] = {lm_out_states_[i], score};
+    (*next_hyps)[prefix].lm_score = score;
+  }
+}
+
+void CtcPrefixBeamSearch::UpdateOutputs(int prefix,
+                                        const PrefixScore& prefix_score,
+                                        std::vector<int>* output) const {
+  prefix_tree_.ToVector(prefix, output);
+  if (context_graph_ == nullptr) return;
+  std::vector<int> input;
+  input.swap(*output);
+  std::vector<int> start_boundaries =
+      int_lists_.ToVector(prefix_score.start_boundaries);
+  std::vector<int> end_boundaries =
+      int_lists_.ToVector(prefix_score.end_boundaries);
 
-  std::vector<int> output;
   int s = 0;
   int e = 0;
   for (int i = 0; i < input.size(); ++i) {
     if (s < start_boundaries.size() && i == start_boundaries[s]) {
-      output.emplace_back(context_graph_->start_tag_id());
+      output->emplace_back(context_graph_->start_tag_id());
       ++s;
     }
-    output.emplace_back(input[i]);
+    output->emplace_back(input[i]);
     if (e < end_boundaries.size() && i == end_boundaries[e]) {
-      output.emplace_back(context_graph_->end_tag_id());
+      output->emplace_back(context_graph_->end_tag_id());
       ++e;
     }
   }
-  outputs_.emplace_back(output);
+  context_graph_->BalanceTags(output);
 }
 
 void CtcPrefixBeamSearch::UpdateHypotheses(
-    const std::vector<std::pair<std::vector<int>, PrefixScore>>& hpys) {
-  cur_hyps_.clear();
-  outputs_.clear();
-  hypotheses_.clear();
+    const std::vector<std::pair<int, PrefixScore>>& hpys) {
+  if (&hpys != &cur_hyps_) cur_hyps_ = hpys;
+  materialized_ = false;
+}
+
+void CtcPrefixBeamSearch::Materialize() const {
+  if (materialized_) return;
+  // The vectors of the n-best are refilled in place, so their capacity is
+  // reused across the chunks
+  size_t n = cur_hyps_.size();
+  outputs_.resize(n);
+  hypotheses_.resize(n);
   likelihood_.clear();
   viterbi_likelihood_.clear();
-  times_.clear();
-  for (auto& item : hpys) {
-    cur_hyps_[item.first] = item.second;
-    UpdateOutputs(item);
-    hypotheses_.emplace_back(std::move(item.first));
+  times_.resize(opts_.enable_times ? n : 0);
+  for (size_t i = 0; i < n; ++i) {
+    const auto& item = cur_hyps_[i];
+    UpdateOutputs(item.first, item.second, &outputs_[i]);
+    prefix_tree_.ToVector(item.first, &hypotheses_[i]);
     likelihood_.emplace_back(item.second.total_score());
-    viterbi_likelihood_.emplace_back(item.second.viterbi_score());
-    times_.emplace_back(item.second.times());
+    if (opts_.enable_times) {
+      viterbi_likelihood_.emplace_back(item.second.viterbi_score());
+      int_lists_.ToVector(item.second.times(), &times_[i]);
+    }
   }
+  materialized_ = true;
 }
 
 // Please refer https://robin1001.github.io/2020/12/11/ctc-search
 // for how CTC prefix beam search works, and there is a simple graph demo in
 // it.
 void CtcPrefixBeamSearch::Search(const std::vector<std::vector<float>>& logp) {
+  blank_scores_.clear();
   if (logp.size() == 0) return;
   int first_beam_size =
-      std::min(static_cast<int>(logp[0].size()), opts_.first_beam_size);
+      std::min(static_cast<int>(logp[0].size()), first_beam_size_);
+  std::vector<float> topk_score;
+  std::vector<int32_t> topk_index;
   for (int t = 0; t < logp.size(); ++t, ++abs_time_step_) {
-    const std::vector<float>& logp_t = logp[t];
-    std::unordered_map<std::vector<int>, PrefixScore, PrefixHash> next_hyps;
     // 1. First beam prune, only select topk candidates
-    std::vector<float> topk_score;
-    std::vector<int32_t> topk_index;
-    TopK(logp_t, first_beam_size, &topk_score, &topk_index);
-
-    // 2. Token passing
-    for (int i = 0; i < topk_index.size(); ++i) {
-      int id = topk_index[i];
-      auto prob = topk_score[i];
-      for (const auto& it : cur_hyps_) {
-        const std::vector<int>& prefix = it.first;
-        const PrefixScore& prefix_score = it.second;
-        // If prefix doesn't exist in next_hyps, next_hyps[prefix] will insert
-        // PrefixScore(-inf, -inf) by default, since the default constructor
-        // of PrefixScore will set fields s(blank ending score) and
-        // ns(none blank ending score) to -inf, respectively.
-        if (id == opts_.blank) {
-          // Case 0: *a + ε => *a
-          PrefixScore& next_score = next_hyps[prefix];
-          next_score.s = LogAdd(next_score.s, prefix_score.score() + prob);
-          next_score.v_s = prefix_score.viterbi_score() + prob;
-          next_score.times_s = prefix_score.times();
-          // Prefix not changed, copy the context from prefix.
-          if (context_graph_ && !next_score.has_context) {
-            next_score.CopyContext(prefix_score);
-            next_score.has_context = true;
-          }
-        } else if (!prefix.empty() && id == prefix.back()) {
-          // Case 1: *a + a => *a
-          PrefixScore& next_score1 = next_hyps[prefix];
-          next_score1.ns = LogAdd(next_score1.ns, prefix_score.ns + prob);
-          if (next_score1.v_ns < prefix_score.v_ns + prob) {
-            next_score1.v_ns = prefix_score.v_ns + prob;
-            if (next_score1.cur_token_prob < prob) {
-              next_score1.cur_token_prob = prob;
-              next_score1.times_ns = prefix_score.times_ns;
-              CHECK_GT(next_score1.times_ns.size(), 0);
-              next_score1.times_ns.back() = abs_time_step_;
-            }
-          }
-          if (context_graph_ && !next_score1.has_context) {
-            next_score1.CopyContext(prefix_score);
-            next_score1.has_context = true;
-          }
-
-          // Case 2: *aε + a => *aa
-          std::vector<int> new_prefix(prefix);
-          new_prefix.emplace_back(id);
-          PrefixScore& next_score2 = next_hyps[new_prefix];
-          next_score2.ns = LogAdd(next_score2.ns, prefix_score.s + prob);
-          if (next_score2.v_ns < prefix_score.v_s + prob) {
-            next_score2.v_ns = prefix_score.v_s + prob;
-            next_score2.cur_token_prob = prob;
-            next_score2.times_ns = prefix_score.times_s;
-            next_score2.times_ns.emplace_back(abs_time_step_);
-          }
-          if (context_graph_ && !next_score2.has_context) {
-            // Prefix changed, calculate the context score.
-            next_score2.UpdateContext(context_graph_, prefix_score, id,
-                                      prefix.size());
-            next_score2.has_context = true;
-          }
-        } else {
-          // Case 3: *a + b => *ab, *aε + b => *ab
-          std::vector<int> new_prefix(prefix);
-          new_prefix.emplace_back(id);
-          PrefixScore& next_score = next_hyps[new_prefix];
-          next_score.ns = LogAdd(next_score.ns, prefix_score.score() + prob);
-          if (next_score.v_ns < prefix_score.viterbi_score() + prob) {
-            next_score.v_ns = prefix_score.viterbi_score() + prob;
-            next_score.cur_token_prob = prob;
-            next_score.times_ns = prefix_score.times();
-            next_score.times_ns.emplace_back(abs_time_step_);
-          }
-          if (context_graph_ && !next_score.has_context) {
-            // Calculate the context score.
-            next_score.UpdateContext(context_graph_, prefix_score, id,
-                                     prefix.size());
-            next_score.has_context = true;
-          }
-        }
-      }
-    }
+    TopK(logp[t], first_beam_size, &topk_score, &topk_index);
+    SearchFrame(topk_score.data(), topk_index.data(), topk_score.size());
+  }
+}
 
-    // 3. Second beam prune, only keep top n best paths
-    std::vector<std::pair<std::vector<int>, PrefixScore>> arr(next_hyps.begin(),
-                                                              next_hyps.end());
-    int second_beam_size =
-        std::min(static_cast<int>(arr.size()), opts_.second_beam_size);
-    std::nth_element(arr.begin(), arr.begin() + second_beam_size, arr.end(),
-                     PrefixScoreCompare);
-    arr.resize(second_beam_size);
-    std::sort(arr.begin(), arr.end(), PrefixScoreCompare);
-
-    // 4. Update cur_hyps_ and get new result
-    UpdateHypotheses(arr);
+void CtcPrefixBeamSearch::Search(const MatrixView<float>& logp) {
+  blank_scores_.clear();
+  if (logp.empty()) return;
+  int first_beam_size = std::min(logp.cols(), first_beam_size_);
+  std::vector<float> topk_score;
+  std::vector<int32_t> topk_index;
+  for (int t = 0; t < logp.rows(); ++t, ++abs_time_step_) {
+    TopK(logp.row(t), logp.cols(), first_beam_size, &topk_score, &topk_index);
+    SearchFrame(topk_score.data(), topk_index.data(), topk_score.size());
   }
 }
 
 void CtcPrefixBeamSearch::Search(
     const std::vector<std::vector<float>>& topk_scores,
     const std::vector<std::vector<int32_t>>& topk_indexs) {
+  blank_scores_.clear();
   if (topk_scores.size() == 0) return;
-  int first_beam_size =
-      std::min(static_cast<int>(topk_scores[0].size()), opts_.first_beam_size);
   for (int t = 0; t < topk_scores.size(); ++t, ++abs_time_step_) {
-    std::unordered_map<std::vector<int>, PrefixScore, PrefixHash> next_hyps;
-    // 1. First beam prune, only select topk candidates
-    auto& topk_score = topk_scores[t];
-    auto& topk_index = topk_indexs[t];
-
-    // 2. Token passing
-    for (int i = 0; i < topk_index.size(); ++i) {
-      int id = topk_index[i];
-      auto prob = topk_score[i];
-      for (const auto& it : cur_hyps_) {
-        const std::vector<int>& prefix = it.first;
-        const PrefixScore& prefix_score = it.second;
-        // If prefix doesn't exist in next_hyps, next_hyps[prefix] will insert
-        // PrefixScore(-inf, -inf) by default, since the default constructor
-        // of PrefixScore will set fields s(blank ending score) and
-        // ns(none blank ending score) to -inf, respectively.
-        if (id == opts_.blank) {
-          // Case 0: *a + ε => *a
-          PrefixScore& next_score = next_hyps[prefix];
-          next_score.s = LogAdd(next_score.s, prefix_score.score() + prob);
+    // 1. First beam prune is already done by the model, in descending order
+    // of the scores, so the scaled beam is the head of it
+    int k = std::min(static_cast<int>(topk_scores[t].size()), first_beam_size_);
+    SearchFrame(topk_scores[t].data(), topk_indexs[t].data(), k);
+  }
+}
+
+void CtcPrefixBeamSearch::Search(const MatrixView<float>& topk_scores,
+                                 const MatrixView<int32_t>& topk_indexs) {
+  CHECK_EQ(topk_scores.rows(), topk_indexs.rows());
+  CHECK_EQ(topk_scores.cols(), topk_indexs.cols());
+  blank_scores_.clear();
+  int k = std::min(topk_scores.cols(), first_beam_size_);
+  for (int t = 0; t < topk_scores.rows(); ++t, ++abs_time_step_) {
+    SearchFrame(topk_scores.row(t), topk_indexs.row(t), k);
+  }
+}
+
+template <bool kContext, bool kTimes>
+void CtcPrefixBeamSearch::PassTokens(const float* topk_score,
+                                     const int32_t* topk_index, int k) {
+  PrefixScoreMap& next_hyps = next_hyps_;
+  for (int i = 0; i < k; ++i) {
+    int id = topk_index[i];
+    auto prob = topk_score[i];
+    for (const auto& it : cur_hyps_) {
+      int prefix = it.first;
+      const PrefixScore& prefix_score = it.second;
+      // If prefix doesn't exist in next_hyps, next_hyps[prefix] will insert
+      // PrefixScore(-inf, -inf) by default, since the default constructor
+      // of PrefixScore will set fields s(blank ending score) and
+      // ns(none blank ending score) to -inf, respectively.
+      if (id == opts_.blank) {
+        // Case 0: *a + ε => *a
+        PrefixScore& next_score = next_hyps[prefix];
+        next_score.s = LogAdd(next_score.s, prefix_score.score() + prob);
+        if (kTimes) {
           next_score.v_s = prefix_score.viterbi_score() + prob;
           next_score.times_s = prefix_score.times();
-          // Prefix not changed, copy the context from prefix.
-          if (context_graph_ && !next_score.has_context) {
-            next_score.CopyContext(prefix_score);
-            next_score.has_context = true;
-          }
-        } else if (!prefix.empty() && id == prefix.back()) {
-          // Case 1: *a + a => *a
-          PrefixScore& next_score1 = next_hyps[prefix];
-          next_score1.ns = LogAdd(next_score1.ns, prefix_score.ns + prob);
-          if (next_score1.v_ns < prefix_score.v_ns + prob) {
-            next_score1.v_ns = prefix_score.v_ns + prob;
-            if (next_score1.cur_token_prob < prob) {
-              next_score1.cur_token_prob = prob;
-              next_score1.times_ns = prefix_score.times_ns;
-              CHECK_GT(next_score1.times_ns.size(), 0);
-              next_score1.times_ns.back() = abs_time_step_;
-            }
-          }
-          if (context_graph_ && !next_score1.has_context) {
-            next_score1.CopyContext(prefix_score);
-            next_score1.has_context = true;
+        }
+        // Prefix not changed, copy the context from prefix.
+        if (kContext && !next_score.has_context) {
+          next_score.CopyContext(prefix_score);
+          next_score.has_context = true;
+        }
+      } else if (prefix != PrefixTree::kRoot &&
+                 id == prefix_tree_.token(prefix)) {
+        // Case 1: *a + a => *a
+        PrefixScore& next_score1 = next_hyps[prefix];
+        next_score1.ns = LogAdd(next_score1.ns, prefix_score.ns + prob);
+        if (kTimes && next_score1.v_ns < prefix_score.v_ns + prob) {
+          next_score1.v_ns = prefix_score.v_ns + prob;
+          if (next_score1.cur_token_prob < prob) {
+            next_score1.cur_token_prob = prob;
+            next_score1.times_ns =
+                int_lists_.ReplaceBack(prefix_score.times_ns, abs_time_step_);
           }
+        }
+        if (kContext && !next_score1.has_context) {
+          next_score1.CopyContext(prefix_score);
+          next_score1.has_context = true;
+        }
 
-          // Case 2: *aε + a => *aa
-          std::vector<int> new_prefix(prefix);
-          new_prefix.emplace_back(id);
-          PrefixScore& next_score2 = next_hyps[new_prefix];
-          next_score2.ns = LogAdd(next_score2.ns, prefix_score.s + prob);
-          if (next_score2.v_ns < prefix_score.v_s + prob) {
-            next_score2.v_ns = prefix_score.v_s + prob;
-            next_score2.cur_token_prob = prob;
-            next_score2.times_ns = prefix_score.times_s;
-            next_score2.times_ns.emplace_back(abs_time_step_);
-          }
-          if (context_graph_ && !next_score2.has_context) {
-            // Prefix changed, calculate the context score.
-            next_score2.UpdateContext(context_graph_, prefix_score, id,
-                                      prefix.size());
-            next_score2.has_context = true;
-          }
-        } else {
-          // Case 3: *a + b => *ab, *aε + b => *ab
-          std::vector<int> new_prefix(prefix);
-          new_prefix.emplace_back(id);
-          PrefixScore& next_score = next_hyps[new_prefix];
-          next_score.ns = LogAdd(next_score.ns, prefix_score.score() + prob);
-          if (next_score.v_ns < prefix_score.viterbi_score() + prob) {
-            next_score.v_ns = prefix_score.viterbi_score() + prob;
-            next_score.cur_token_prob = prob;
-            next_score.times_ns = prefix_score.times();
-            next_score.times_ns.emplace_back(abs_time_step_);
-          }
-          if (context_graph_ && !next_score.has_context) {
-            // Calculate the context score.
-            next_score.UpdateContext(context_graph_, prefix_score, id,
-                                     prefix.size());
-            next_score.has_context = true;
-          }
+        // Case 2: *aε + a => *aa
+        int new_prefix = prefix_tree_.Child(prefix, id);
+        PrefixScore& next_score2 = next_hyps[new_prefix];
+        next_score2.ns = LogAdd(next_score2.ns, prefix_score.s + prob);
+        if (kTimes && next_score2.v_ns < prefix_score.v_s + prob) {
+          next_score2.v_ns = prefix_score.v_s + prob;
+          next_score2.cur_token_prob = prob;
+          next_score2.times_ns =
+              int_lists_.Append(prefix_score.times_s, abs_time_step_);
+        }
+        if (kContext && !next_score2.has_context) {
+          // Prefix changed, calculate the context score.
+          UpdateContext(prefix_score, id, prefix_tree_.length(prefix),
+                        &next_score2);
+          next_score2.has_context = true;
+        }
+      } else {
+        // Case 3: *a + b => *ab, *aε + b => *ab
+        int new_prefix = prefix_tree_.Child(prefix, id);
+        PrefixScore& next_score = next_hyps[new_prefix];
+        next_score.ns = LogAdd(next_score.ns, prefix_score.score() + prob);
+        if (kTimes && next_score.v_ns < prefix_score.viterbi_score() + prob) {
+          next_score.v_ns = prefix_score.viterbi_score() + prob;
+          next_score.cur_token_prob = prob;
+          next_score.times_ns =
+              int_lists_.Append(prefix_score.times(), abs_time_step_);
+        }
+        if (kContext && !next_score.has_context) {
+          // Calculate the context score.
+          UpdateContext(prefix_score, id, prefix_tree_.length(prefix),
+                        &next_score);
+          next_score.has_context = true;
         }
       }
     }
+  }
+}
 
-    // 3. Second beam prune, only keep top n best paths
-    std::vector<std::pair<std::vector<int>, PrefixScore>> arr(next_hyps.begin(),
-                                                              next_hyps.end());
-    int second_beam_size =
-        std::min(static_cast<int>(arr.size()), opts_.second_beam_size);
-    std::nth_element(arr.begin(), arr.begin() + second_beam_size, arr.end(),
-                     PrefixScoreCompare);
-    arr.resize(second_beam_size);
-    std::sort(arr.begin(), arr.end(), PrefixScoreCompare);
-
-    // 4. Update cur_hyps_ and get new result
-    UpdateHypotheses(arr);
+void CtcPrefixBeamSearch::SearchFrame(const float* topk_score,
+                                      const int32_t* topk_index, int k) {
+  // The blank out of the topk is taken as prob 0
+  float blank_score = -kFloatMax;
+  for (int i = 0; i < k; ++i) {
+    if (topk_index[i] == opts_.blank) {
+      blank_score = topk_score[i];
+      break;
+    }
+  }
+  blank_scores_.push_back(blank_score);
+  if (opts_.blank_skip_thresh < 1.0 &&
+      std::exp(blank_score) > opts_.blank_skip_thresh) {
+    VLOG(3) << "skipping frame " << abs_time_step_ << " score "
+            << std::exp(blank_score);
+    SkipBlankFrame(blank_score);
+    return;
   }
+
+  PrefixScoreMap& next_hyps = next_hyps_;
+  next_hyps.clear();
+  // 2. Token passing
+  (this->*pass_tokens_)(topk_score, topk_index, k);
+
+  if (lm_ != nullptr) UpdateLmScores(&next_hyps);
+
+  // 3. Second beam prune, only keep top n best paths
+  std::vector<std::pair<int, PrefixScore>>& arr = candidates_;
+  arr.assign(next_hyps.begin(), next_hyps.end());
+  int second_beam_size =
+      std::min(static_cast<int>(arr.size()), second_beam_size_);
+  std::nth_element(arr.begin(), arr.begin() + second_beam_size, arr.end(),
+                   PrefixScoreCompare);
+  arr.resize(second_beam_size);
+  std::sort(arr.begin(), arr.end(), PrefixScoreCompare);
+
+  // 4. Update cur_hyps_ and get new result
+  UpdateHypotheses(arr);
+  ReclaimNodes();
+}
+
+void CtcPrefixBeamSearch::ReclaimNodes() {
+  if (prefix_tree_.size() < reclaim_size_ &&
+      int_lists_.size() < reclaim_size_) {
+    return;
+  }
+  live_nodes_.clear();
+  for (const auto& hyp : cur_hyps_) live_nodes_.push_back(hyp.first);
+  prefix_tree_.Compact(live_nodes_, &new_ids_);
+  for (auto& hyp : cur_hyps_) hyp.first = new_ids_[hyp.first];
+  if (lm_ != nullptr) {
+    // The states of the reclaimed prefixes are dropped, the parents of the
+    // next candidates are the hypotheses, which are kept
+    std::vector<std::pair<int, LmState>> lm_states;
+    for (const auto& it : lm_states_) {
+      if (new_ids_[it.first] >= 0) {
+        lm_states.emplace_back(new_ids_[it.first], it.second);
+      }
+    }
+    lm_states_.clear();
+    lm_states_.insert(lm_states.begin(), lm_states.end());
+  }
+
+  live_nodes_.clear();
+  for (const auto& hyp : cur_hyps_) {
+    const PrefixScore& score = hyp.second;
+    live_nodes_.insert(live_nodes_.end(),
+                       {score.times_s, score.times_ns, score.start_boundaries,
+                        score.end_boundaries});
+  }
+  int_lists_.Compact(live_nodes_, &new_ids_);
+  auto remap = [this](int* list) {
+    if (*list != IntListArena::kEmpty) *list = new_ids_[*list];
+  };
+  for (auto& hyp : cur_hyps_) {
+    PrefixScore& score = hyp.second;
+    remap(&score.times_s);
+    remap(&score.times_ns);
+    remap(&score.start_boundaries);
+    remap(&score.end_boundaries);
+  }
+  reclaim_size_ = std::max(
+      kMinReclaimSize, 2 * std::max(prefix_tree_.size(), int_lists_.size()));
+  VLOG(3) << "Reclaim the prefix tree to " << prefix_tree_.size()
+          << " nodes and the lists to " << int_lists_.size() << " nodes";
+}
+
+void CtcPrefixBeamSearch::SkipBlankFrame(float blank_score) {
+  // Only case 0 applies, every prefix keeps its context and times, and the
+  // order of the hypotheses doesn't change since they all add blank_score.
+  for (int i = 0; i < cur_hyps_.size(); ++i) {
+    PrefixScore& prefix_score = cur_hyps_[i].second;
+    float viterbi_score = prefix_score.viterbi_score();
+    prefix_score.times_s = prefix_score.times();
+    prefix_score.s = prefix_score.score() + blank_score;
+    prefix_score.ns = -kFloatMax;
+    prefix_score.v_s = viterbi_score + blank_score;
+    prefix_score.v_ns = -kFloatMax;
+    prefix_score.cur_token_prob = -kFloatMax;
+  }
+  materialized_ = false;
 }
 
 void CtcPrefixBeamSearch::FinalizeSearch() { UpdateFinalContext(); }
 
 void CtcPrefixBeamSearch::UpdateFinalContext() {
   if (context_graph_ == nullptr) return;
-  CHECK_EQ(hypotheses_.size(), cur_hyps_.size());
-  CHECK_EQ(hypotheses_.size(), likelihood_.size());
   // We should backoff the context score/state when the context is
   // not fully matched at the last time.
-  for (const auto& prefix : hypotheses_) {
-    PrefixScore& prefix_score = cur_hyps_[prefix];
+  for (auto& it : cur_hyps_) {
+    PrefixScore& prefix_score = it.second;
     if (prefix_score.context_state != 0) {
-      prefix_score.UpdateContext(context_graph_, prefix_score, 0,
-                                 prefix.size());
+      PrefixScore from = prefix_score;
+      UpdateContext(from, 0, prefix_tree_.length(it.first), &prefix_score);
     }
   }
-  std::vector<std::pair<std::vector<int>, PrefixScore>> arr(cur_hyps_.begin(),
-                                                            cur_hyps_.end());
-  std::sort(arr.begin(), arr.end(), PrefixScoreCompare);
+  std::sort(cur_hyps_.begin(), cur_hyps_.end(), PrefixScoreCompare);
 
   // Update cur_hyps_ and get new result
-  UpdateHypotheses(arr);
+  UpdateHypotheses(cur_hyps_);
 }
 
 }  // namespace wenet
@@ -16,13 +16,20 @@
 #ifndef DECODER_CTC_PREFIX_BEAM_SEARCH_H_
 #define DECODER_CTC_PREFIX_BEAM_SEARCH_H_
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "decoder/context_graph.h"
+#include "decoder/language_model.h"
 #include "decoder/search_interface.h"
+#include "utils/arena.h"
+#include "utils/log.h"
+#include "utils/state_io.h"
 #include "utils/utils.h"
 
 namespace wenet {
@@ -31,6 +38,188 @@ struct CtcPrefixBeamSearchOptions {
   int blank = 0;  // blank id
   int first_beam_size = 10;
   int second_beam_size = 10;
+  // Frames whose blank posterior is larger than it only update the blank
+  // ending scores of the current hypotheses, 1.0 means no skip
+  float blank_skip_thresh = 1.0;
+  // Weight of the log probs of the LanguageModel of the shallow fusion
+  float lm_weight = 0.5;
+  // Whether to keep the viterbi scores and the times of the hypotheses,
+  // which are only for the timestamps. Without them, Times() and
+  // viterbi_likelihood() are empty.
+  bool enable_times = true;
+};
+
+// Persistent singly linked lists of ints in an arena, so the common part of
+// the times and context boundaries is shared by the prefixes instead of
+// copied. A list is the index of its last node, and kEmpty is the empty list.
+class IntListArena {
+ public:
+  static const int kEmpty = -1;
+
+  int Append(int list, int value) {
+    nodes_.push_back({value, list});
+    return nodes_.size() - 1;
+  }
+  // Return a new list whose last element is replaced by value
+  int ReplaceBack(int list, int value) {
+    CHECK_GE(list, 0);
+    return Append(nodes_[list].prev, value);
+  }
+  std::vector<int> ToVector(int list) const {
+    std::vector<int> values;
+    ToVector(list, &values);
+    return values;
+  }
+  // Into the capacity of values, which is reused across the chunks
+  void ToVector(int list, std::vector<int>* values) const {
+    values->clear();
+    for (; list != kEmpty; list = nodes_[list].prev) {
+      values->push_back(nodes_[list].value);
+    }
+    std::reverse(values->begin(), values->end());
+  }
+  void Clear() { nodes_.clear(); }
+  int size() const { return nodes_.size(); }
+  // Keep only the nodes of the `live` lists, which are renumbered in the
+  // same order, so a node is still after its prev. new_ids is the new index
+  // of each old node, -1 if it's reclaimed.
+  void Compact(const std::vector<int>& live, std::vector<int>* new_ids) {
+    new_ids->assign(nodes_.size(), -1);
+    for (int list : live) {
+      for (; list != kEmpty && (*new_ids)[list] < 0;
+           list = nodes_[list].prev) {
+        (*new_ids)[list] = 0;
+      }
+    }
+    int size = 0;
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      if ((*new_ids)[i] < 0) continue;
+      int prev = nodes_[i].prev;
+      nodes_[size] = {nodes_[i].value, prev == kEmpty ? kEmpty
+                                                      : (*new_ids)[prev]};
+      (*new_ids)[i] = size++;
+    }
+    nodes_.resize(size);
+  }
+  int64_t memory_bytes() const { return CapacityBytes(nodes_); }
+
+  void SaveState(StateWriter* writer) const { writer->WriteVector(nodes_); }
+  bool LoadState(StateReader* reader) {
+    if (!reader->ReadVector(&nodes_)) return false;
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      if (nodes_[i].prev < kEmpty || nodes_[i].prev >= static_cast<int>(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  struct Node {
+    int value;
+    int prev;
+  };
+  std::vector<Node> nodes_;
+};
+
+// Prefix tree of the hypotheses in one utterance, a prefix is represented by
+// its node id, and extending a prefix by a token is O(1).
+class PrefixTree {
+ public:
+  static const int kRoot = 0;  // the empty prefix
+
+  // The nodes of the children map are of the arena, if any
+  explicit PrefixTree(Arena* arena = nullptr)
+      : children_(0, std::hash<int64_t>(), std::equal_to<int64_t>(),
+                  ChildAllocator(arena)) {
+    Clear();
+  }
+
+  // Find or create the prefix of node + token
+  int Child(int node, int token) {
+    int64_t key = (static_cast<int64_t>(node) << 32) | token;
+    auto it = children_.find(key);
+    if (it != children_.end()) return it->second;
+    int child = nodes_.size();
+    nodes_.push_back({token, node, nodes_[node].length + 1});
+    children_.emplace(key, child);
+    return child;
+  }
+  int token(int node) const { return nodes_[node].token; }
+  int parent(int node) const { return nodes_[node].parent; }
+  int length(int node) const { return nodes_[node].length; }
+  int size() const { return nodes_.size(); }
+  std::vector<int> ToVector(int node) const {
+    std::vector<int> tokens;
+    ToVector(node, &tokens);
+    return tokens;
+  }
+  void ToVector(int node, std::vector<int>* tokens) const {
+    tokens->resize(nodes_[node].length);
+    for (int i = tokens->size() - 1; i >= 0; --i, node = nodes_[node].parent) {
+      (*tokens)[i] = nodes_[node].token;
+    }
+  }
+  void Clear() {
+    nodes_.assign(1, {-1, -1, 0});
+    children_.clear();
+  }
+  // Keep only the `live` prefixes and their ancestors, which are renumbered
+  // in the same order, so a node is still after its parent. new_ids is the
+  // new id of each old node, -1 if it's reclaimed.
+  void Compact(const std::vector<int>& live, std::vector<int>* new_ids) {
+    new_ids->assign(nodes_.size(), -1);
+    (*new_ids)[kRoot] = kRoot;
+    for (int node : live) {
+      for (; (*new_ids)[node] < 0; node = nodes_[node].parent) {
+        (*new_ids)[node] = 0;
+      }
+    }
+    // The map nodes of the reclaimed children go back to the arena
+    children_.clear();
+    int size = 1;
+    for (size_t i = 1; i < nodes_.size(); ++i) {
+      if ((*new_ids)[i] < 0) continue;
+      int parent = (*new_ids)[nodes_[i].parent];
+      nodes_[size] = {nodes_[i].token, parent, nodes_[i].length};
+      int64_t key = (static_cast<int64_t>(parent) << 32) | nodes_[i].token;
+      children_.emplace(key, size);
+      (*new_ids)[i] = size++;
+    }
+    nodes_.resize(size);
+  }
+  // The nodes of the map are estimated by their key, value and next pointer
+  int64_t memory_bytes() const {
+    return CapacityBytes(nodes_) +
+           children_.size() * (sizeof(int64_t) + sizeof(int) + sizeof(void*)) +
+           children_.bucket_count() * sizeof(void*);
+  }
+
+  // The children are indexed again from the nodes on loading
+  void SaveState(StateWriter* writer) const { writer->WriteVector(nodes_); }
+  bool LoadState(StateReader* reader) {
+    if (!reader->ReadVector(&nodes_) || nodes_.empty()) return false;
+    children_.clear();
+    for (size_t i = 1; i < nodes_.size(); ++i) {
+      int parent = nodes_[i].parent;
+      if (parent < 0 || parent >= static_cast<int>(i)) return false;
+      int64_t key = (static_cast<int64_t>(parent) << 32) | nodes_[i].token;
+      children_.emplace(key, i);
+    }
+    return true;
+  }
+
+ private:
+  struct Node {
+    int token;
+    int parent;
+    int length;
+  };
+  using ChildAllocator = ArenaAllocator<std::pair<const int64_t, int>>;
+  std::vector<Node> nodes_;
+  std::unordered_map<int64_t, int, std::hash<int64_t>, std::equal_to<int64_t>,
+                     ChildAllocator>
+      children_;
 };
 
 struct PrefixScore {
@@ -39,20 +228,19 @@ struct PrefixScore {
   float v_s = -kFloatMax;             // viterbi blank ending score
   float v_ns = -kFloatMax;            // viterbi none blank ending score
   float cur_token_prob = -kFloatMax;  // prob of current token
-  std::vector<int> times_s;           // times of viterbi blank path
-  std::vector<int> times_ns;          // times of viterbi none blank path
+  // IntListArena lists
+  int times_s = IntListArena::kEmpty;   // times of viterbi blank path
+  int times_ns = IntListArena::kEmpty;  // times of viterbi none blank path
 
   float score() const { return LogAdd(s, ns); }
   float viterbi_score() const { return v_s > v_ns ? v_s : v_ns; }
-  const std::vector<int>& times() const {
-    return v_s > v_ns ? times_s : times_ns;
-  }
+  int times() const { return v_s > v_ns ? times_s : times_ns; }
 
   bool has_context = false;
   int context_state = 0;
   float context_score = 0;
-  std::vector<int> start_boundaries;
-  std::vector<int> end_boundaries;
+  int start_boundaries = IntListArena::kEmpty;
+  int end_boundaries = IntListArena::kEmpty;
 
   void CopyContext(const PrefixScore& prefix_score) {
     context_state = prefix_score.context_state;
@@ -61,81 +249,153 @@ struct PrefixScore {
     end_boundaries = prefix_score.end_boundaries;
   }
 
-  void UpdateContext(const std::shared_ptr<ContextGraph>& context_graph,
-                     const PrefixScore& prefix_score, int word_id,
-                     int prefix_len) {
-    this->CopyContext(prefix_score);
-
-    float score = 0;
-    bool is_start_boundary = false;
-    bool is_end_boundary = false;
+  // The weighted log prob of the prefix by the LanguageModel
+  float lm_score = 0;
 
-    context_state =
-        context_graph->GetNextState(prefix_score.context_state, word_id, &score,
-                                    &is_start_boundary, &is_end_boundary);
-    context_score += score;
-    if (is_start_boundary) start_boundaries.emplace_back(prefix_len);
-    if (is_end_boundary) end_boundaries.emplace_back(prefix_len);
-  }
-
-  float total_score() const { return score() + context_score; }
-};
-
-struct PrefixHash {
-  size_t operator()(const std::vector<int>& prefix) const {
-    size_t hash_code = 0;
-    // here we use KB&DR hash code
-    for (int id : prefix) {
-      hash_code = id + 31 * hash_code;
-    }
-    return hash_code;
-  }
+  float total_score() const { return score() + context_score + lm_score; }
 };
 
 class CtcPrefixBeamSearch : public SearchInterface {
  public:
+  // lm: optional, the LanguageModel of the shallow fusion, which is used by
+  // this search only
+  // arena: optional, the Arena of the session, of which the nodes of the
+  // hash maps are allocated, from the heap if nullptr
   explicit CtcPrefixBeamSearch(
       const CtcPrefixBeamSearchOptions& opts,
-      const std::shared_ptr<ContextGraph>& context_graph = nullptr);
+      const std::shared_ptr<ContextGraph>& context_graph = nullptr,
+      const std::shared_ptr<LanguageModel>& lm = nullptr,
+      Arena* arena = nullptr);
 
   void Search(const std::vector<std::vector<float>>& logp) override;
+  void Search(const MatrixView<float>& logp) override;
   void Search(const std::vector<std::vector<float>>& topk_scores,
               const std::vector<std::vector<int32_t>>& topk_indexs) override;
+  void Search(const MatrixView<float>& topk_scores,
+              const MatrixView<int32_t>& topk_indexs) override;
   void Reset() override;
   void FinalizeSearch() override;
   SearchType Type() const override { return SearchType::kPrefixBeamSearch; }
-  void UpdateOutputs(const std::pair<std::vector<int>, PrefixScore>& prefix);
-  void UpdateHypotheses(
-      const std::vector<std::pair<std::vector<int>, PrefixScore>>& hpys);
+  void SetBeamScale(float beam_scale) override;
+  // Not supported with the LanguageModel, whose states are of its caches
+  bool SaveState(StateWriter* writer) const override;
+  bool LoadState(StateReader* reader) override;
+  int64_t memory_bytes() const override;
+  // The tokens of the prefix with the context tags into output
+  void UpdateOutputs(int prefix, const PrefixScore& prefix_score,
+                     std::vector<int>* output) const;
+  void UpdateHypotheses(const std::vector<std::pair<int, PrefixScore>>& hpys);
   void UpdateFinalContext();
 
+  // The n-best of the current hypotheses is only copied out of the arenas
+  // when it's asked for, e.g. once per chunk, instead of once per frame
   const std::vector<float>& viterbi_likelihood() const {
+    Materialize();
     return viterbi_likelihood_;
   }
   const std::vector<std::vector<int>>& Inputs() const override {
+    Materialize();
     return hypotheses_;
   }
   const std::vector<std::vector<int>>& Outputs() const override {
+    Materialize();
     return outputs_;
   }
-  const std::vector<float>& Likelihood() const override { return likelihood_; }
-  const std::vector<std::vector<int>>& Times() const override { return times_; }
+  const std::vector<float>& Likelihood() const override {
+    Materialize();
+    return likelihood_;
+  }
+  const std::vector<std::vector<int>>& Times() const override {
+    Materialize();
+    return times_;
+  }
+  const std::vector<float>& BlankScores() const override {
+    return blank_scores_;
+  }
 
  private:
+  // Copy the n-best of cur_hyps_ out of the arenas if it has changed
+  void Materialize() const;
+
+  // Token passing and beam prune of one frame
+  void SearchFrame(const float* topk_score, const int32_t* topk_index,
+                   int k);
+  // Token passing of one frame into next_hyps_, specialized by whether
+  // there is the context graph and the times are kept, which is chosen at
+  // construction as pass_tokens_
+  template <bool kContext, bool kTimes>
+  void PassTokens(const float* topk_score, const int32_t* topk_index, int k);
+  // Advance all the hypotheses by a blank frame without token passing
+  void SkipBlankFrame(float blank_score);
+  // Update the context of prefix_score from the one of `from` by word_id
+  void UpdateContext(const PrefixScore& from, int word_id, int prefix_len,
+                     PrefixScore* prefix_score);
+  // Set the lm_score of the candidates of a frame, the new prefixes are
+  // scored by the LanguageModel in one batch
+  using PrefixScoreMap = std::unordered_map<
+      int, PrefixScore, std::hash<int>, std::equal_to<int>,
+      ArenaAllocator<std::pair<const int, PrefixScore>>>;
+  void UpdateLmScores(PrefixScoreMap* next_hyps);
+  // Reclaim the prefixes and the list nodes which no hypothesis refers to
+  // once the arenas have grown to twice of the ones kept last time, so the
+  // memory of a long utterance is bounded by its hypotheses rather than by
+  // all the candidates of its frames, at an amortized O(1) cost per node.
+  void ReclaimNodes();
+
   int abs_time_step_ = 0;
+  // The blank log probs of the frames of the last Search()
+  std::vector<float> blank_scores_;
+  void (CtcPrefixBeamSearch::*pass_tokens_)(const float*, const int32_t*,
+                                            int) = nullptr;
+  // The beam sizes of the options scaled, see SetBeamScale
+  int first_beam_size_;
+  int second_beam_size_;
 
-  // N-best list and corresponding likelihood_, in sorted order
-  std::vector<std::vector<int>> hypotheses_;
-  std::vector<float> likelihood_;
-  std::vector<float> viterbi_likelihood_;
-  std::vector<std::vector<int>> times_;
+  // N-best list and corresponding likelihood_, in sorted order, which are
+  // the ones of cur_hyps_ if materialized_
+  mutable bool materialized_ = false;
+  mutable std::vector<std::vector<int>> hypotheses_;
+  mutable std::vector<float> likelihood_;
+  mutable std::vector<float> viterbi_likelihood_;
+  mutable std::vector<std::vector<int>> times_;
 
-  std::unordered_map<std::vector<int>, PrefixScore, PrefixHash> cur_hyps_;
+  // Arena of the prefixes, times and context boundaries of the utterance
+  PrefixTree prefix_tree_;
+  IntListArena int_lists_;
+  // The size of the arenas to reclaim them at, see ReclaimNodes
+  static const int kMinReclaimSize = 4096;
+  int reclaim_size_ = kMinReclaimSize;
+  // The live nodes and their new ids of ReclaimNodes, reused across it
+  std::vector<int> live_nodes_;
+  std::vector<int> new_ids_;
+  // Current hypotheses, in sorted order
+  std::vector<std::pair<int, PrefixScore>> cur_hyps_;
+  PrefixScoreMap next_hyps_;
+  // The candidates of next_hyps_ to prune, reused across the frames
+  std::vector<std::pair<int, PrefixScore>> candidates_;
   std::shared_ptr<ContextGraph> context_graph_ = nullptr;
+  std::shared_ptr<LanguageModel> lm_ = nullptr;
+  // The LanguageModel state and the lm_score of the prefixes scored so far
+  struct LmState {
+    int state;
+    float score;
+  };
+  std::unordered_map<int, LmState, std::hash<int>, std::equal_to<int>,
+                     ArenaAllocator<std::pair<const int, LmState>>>
+      lm_states_;
+  // The batch of the new prefixes of a frame, reused across the frames
+  std::vector<int> lm_prefixes_;
+  std::vector<int> lm_in_states_;
+  std::vector<int> lm_tokens_;
+  std::vector<float> lm_log_probs_;
+  std::vector<int> lm_out_states_;
   // Outputs contain the hypotheses_ and tags like: <context> and </context>
-  std::vector<std::vector<int>> outputs_;
+  mutable std::vector<std::vector<int>> outputs_;
   const CtcPrefixBeamSearchOptions& opts_;
 
+  // Searches the frames of many sessions on their hypotheses
+  friend class CtcPrefixBeamSearchGroup;
+
  public:
   WENET_DISALLOW_COPY_AND_ASSIGN(CtcPrefixBeamSearch);
 };
@@ -0,0 +1,285 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/ctc_prefix_beam_search_group.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+namespace {
+
+// The viterbi of *a + a => *a, as CtcPrefixBeamSearch::PassTokens
+void RepeatViterbi(const PrefixScore& hyp, int time, float prob,
+                   IntListArena* lists, PrefixScore* next) {
+  if (next->v_ns < hyp.v_ns + prob) {
+    next->v_ns = hyp.v_ns + prob;
+    if (next->cur_token_prob < prob) {
+      next->cur_token_prob = prob;
+      next->times_ns = lists->ReplaceBack(hyp.times_ns, time);
+    }
+  }
+}
+
+// The viterbi of *aε + a => *aa if same, or else of *a + b => *ab
+void ExtendViterbi(const PrefixScore& hyp, bool same, int time, float prob,
+                   IntListArena* lists, PrefixScore* next) {
+  float score = (same ? hyp.v_s : hyp.viterbi_score()) + prob;
+  if (next->v_ns < score) {
+    next->v_ns = score;
+    next->cur_token_prob = prob;
+    next->times_ns = lists->Append(same ? hyp.times_s : hyp.times(), time);
+  }
+}
+
+}  // namespace
+
+bool CtcPrefixBeamSearchGroup::Supports(const CtcPrefixBeamSearch& search) {
+  return search.context_graph_ == nullptr && search.lm_ == nullptr;
+}
+
+void CtcPrefixBeamSearchGroup::Search(
+    const std::vector<CtcPrefixBeamSearch*>& searches,
+    const std::vector<MatrixView<float>>& logps) {
+  CHECK_EQ(searches.size(), logps.size());
+  sessions_.clear();
+  int max_rows = 0;
+  for (size_t i = 0; i < searches.size(); ++i) {
+    CtcPrefixBeamSearch* search = searches[i];
+    if (!Supports(*search)) {
+      search->Search(logps[i]);
+      continue;
+    }
+    search->blank_scores_.clear();
+    if (logps[i].empty()) continue;
+    Session session;
+    session.search = search;
+    session.logp = logps[i];
+    sessions_.push_back(session);
+    max_rows = std::max(max_rows, logps[i].rows());
+  }
+  for (int t = 0; t < max_rows; ++t) SearchFrame(t);
+}
+
+void CtcPrefixBeamSearchGroup::SearchFrame(int t) {
+  // 1. First beam prune of each session, of which the blank frame is
+  // skipped as it is alone
+  active_.clear();
+  topk_scores_.clear();
+  topk_indexs_.clear();
+  for (Session& session : sessions_) {
+    if (t >= session.logp.rows()) continue;
+    CtcPrefixBeamSearch* search = session.search;
+    int first_beam_size =
+        std::min(session.logp.cols(), search->first_beam_size_);
+    TopK(session.logp.row(t), session.logp.cols(), first_beam_size,
+         &topk_score_, &topk_index_);
+    session.k = topk_score_.size();
+    session.blank_pos = -1;
+    float blank_score = -kFloatMax;
+    for (int i = 0; i < session.k; ++i) {
+      if (topk_index_[i] == search->opts_.blank) {
+        session.blank_pos = i;
+        blank_score = topk_score_[i];
+        break;
+      }
+    }
+    search->blank_scores_.push_back(blank_score);
+    if (search->opts_.blank_skip_thresh < 1.0 &&
+        std::exp(blank_score) > search->opts_.blank_skip_thresh) {
+      search->SkipBlankFrame(blank_score);
+      ++search->abs_time_step_;
+      continue;
+    }
+    session.topk_begin = topk_scores_.size();
+    topk_scores_.insert(topk_scores_.end(), topk_score_.begin(),
+                        topk_score_.end());
+    topk_indexs_.insert(topk_indexs_.end(), topk_index_.begin(),
+                        topk_index_.end());
+    active_.push_back(&session);
+  }
+  if (active_.empty()) return;
+
+  // 2. The prefix scores of the hypotheses of all the sessions
+  hyp_s_.clear();
+  hyp_ns_.clear();
+  for (Session* session : active_) {
+    session->hyp_begin = hyp_s_.size();
+    for (const auto& hyp : session->search->cur_hyps_) {
+      hyp_s_.push_back(hyp.second.s);
+      hyp_ns_.push_back(hyp.second.ns);
+    }
+  }
+  hyp_score_.resize(hyp_s_.size());
+  LogAdd(hyp_s_.data(), hyp_ns_.data(), hyp_score_.data(), hyp_s_.size());
+
+  // 3. Token passing of each session, then the merges and the scores of the
+  // candidates of all
+  cand_prefix_.clear();
+  cand_s_.clear();
+  cand_ns_.clear();
+  cand_merged_ns_.clear();
+  cand_viterbi_.clear();
+  for (Session* session : active_) PassTokens(session);
+  const int num_cands = cand_prefix_.size();
+  LogAdd(cand_ns_.data(), cand_merged_ns_.data(), cand_ns_.data(), num_cands);
+  cand_score_.resize(num_cands);
+  LogAdd(cand_s_.data(), cand_ns_.data(), cand_score_.data(), num_cands);
+
+  // 4. Second beam prune of each session
+  for (Session* session : active_) {
+    Prune(*session);
+    ++session->search->abs_time_step_;
+  }
+}
+
+void CtcPrefixBeamSearchGroup::PassTokens(Session* session) {
+  CtcPrefixBeamSearch* search = session->search;
+  const auto& hyps = search->cur_hyps_;
+  PrefixTree& tree = search->prefix_tree_;
+  IntListArena* lists = &search->int_lists_;
+  const bool times = search->opts_.enable_times;
+  const int time = search->abs_time_step_;
+  const float* topk_score = topk_scores_.data() + session->topk_begin;
+  const int32_t* topk_index = topk_indexs_.data() + session->topk_begin;
+  const float* score = hyp_score_.data() + session->hyp_begin;
+  const int num_hyps = hyps.size();
+  const int k = session->k;
+  const int blank_pos = session->blank_pos;
+  auto last_token = [&](int prefix) {
+    return prefix == PrefixTree::kRoot ? -1 : tree.token(prefix);
+  };
+
+  // The candidate of *a is also the one of *a extended by a if its parent is
+  // a hypothesis, which is marked merged for the parent
+  parents_.assign(num_hyps, -1);
+  merged_.assign(num_hyps * k, 0);
+  for (int b = 0; b < num_hyps; ++b) {
+    if (hyps[b].first == PrefixTree::kRoot) continue;
+    int parent = tree.parent(hyps[b].first);
+    for (int a = 0; a < num_hyps; ++a) {
+      if (hyps[a].first == parent) {
+        parents_[b] = a;
+        break;
+      }
+    }
+  }
+
+  session->cand_begin = cand_prefix_.size();
+  // Case 0: *a + ε => *a, case 1: *a + a => *a, and the merged case 2 or 3
+  // of the parent
+  for (int b = 0; b < num_hyps; ++b) {
+    const PrefixScore& hyp = hyps[b].second;
+    const int last = last_token(hyps[b].first);
+    int repeat_pos = -1;
+    for (int i = 0; last >= 0 && i < k; ++i) {
+      if (topk_index[i] == last) {
+        repeat_pos = i;
+        break;
+      }
+    }
+    if (blank_pos < 0 && repeat_pos < 0) continue;
+    PrefixScore next;
+    float s = -kFloatMax;
+    float ns = -kFloatMax;
+    float merged_ns = -kFloatMax;
+    if (blank_pos >= 0) {
+      float prob = topk_score[blank_pos];
+      s = score[b] + prob;
+      if (times) {
+        next.v_s = hyp.viterbi_score() + prob;
+        next.times_s = hyp.times();
+      }
+    }
+    if (repeat_pos >= 0) {
+      float prob = topk_score[repeat_pos];
+      ns = hyp.ns + prob;
+      const int a = parents_[b];
+      bool same = false;
+      if (a >= 0) {
+        merged_[a * k + repeat_pos] = 1;
+        same = last_token(hyps[a].first) == last;
+        merged_ns = (same ? hyps[a].second.s : score[a]) + prob;
+      }
+      // In the order of the hypotheses, as the session passes the tokens
+      if (times) {
+        if (a >= 0 && a < b) {
+          ExtendViterbi(hyps[a].second, same, time, prob, lists, &next);
+        }
+        RepeatViterbi(hyp, time, prob, lists, &next);
+        if (a > b) {
+          ExtendViterbi(hyps[a].second, same, time, prob, lists, &next);
+        }
+      }
+    }
+    cand_prefix_.push_back(hyps[b].first);
+    cand_s_.push_back(s);
+    cand_ns_.push_back(ns);
+    cand_merged_ns_.push_back(merged_ns);
+    cand_viterbi_.push_back(next);
+  }
+  // Case 2: *aε + a => *aa, and case 3: *a + b => *ab, *aε + b => *ab, of
+  // the new prefixes
+  for (int a = 0; a < num_hyps; ++a) {
+    const PrefixScore& hyp = hyps[a].second;
+    const int last = last_token(hyps[a].first);
+    for (int i = 0; i < k; ++i) {
+      if (i == blank_pos || merged_[a * k + i]) continue;
+      const int id = topk_index[i];
+      const float prob = topk_score[i];
+      const bool same = id == last;
+      PrefixScore next;
+      if (times) ExtendViterbi(hyp, same, time, prob, lists, &next);
+      cand_prefix_.push_back(tree.Child(hyps[a].first, id));
+      cand_s_.push_back(-kFloatMax);
+      cand_ns_.push_back((same ? hyp.s : score[a]) + prob);
+      cand_merged_ns_.push_back(-kFloatMax);
+      cand_viterbi_.push_back(next);
+    }
+  }
+  session->cand_end = cand_prefix_.size();
+}
+
+void CtcPrefixBeamSearchGroup::Prune(const Session& session) {
+  CtcPrefixBeamSearch* search = session.search;
+  order_.clear();
+  for (int i = session.cand_begin; i < session.cand_end; ++i) {
+    order_.push_back(i);
+  }
+  int second_beam_size =
+      std::min(static_cast<int>(order_.size()), search->second_beam_size_);
+  auto compare = [this](int a, int b) {
+    return cand_score_[a] > cand_score_[b];
+  };
+  std::nth_element(order_.begin(), order_.begin() + second_beam_size,
+                   order_.end(), compare);
+  order_.resize(second_beam_size);
+  std::sort(order_.begin(), order_.end(), compare);
+  auto& hyps = search->cur_hyps_;
+  hyps.clear();
+  for (int i : order_) {
+    PrefixScore prefix_score = cand_viterbi_[i];
+    prefix_score.s = cand_s_[i];
+    prefix_score.ns = cand_ns_[i];
+    hyps.emplace_back(cand_prefix_[i], prefix_score);
+  }
+  search->materialized_ = false;
+  search->ReclaimNodes();
+}
+
+}  // namespace wenet
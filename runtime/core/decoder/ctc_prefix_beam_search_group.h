@@ -0,0 +1,101 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_CTC_PREFIX_BEAM_SEARCH_GROUP_H_
+#define DECODER_CTC_PREFIX_BEAM_SEARCH_GROUP_H_
+
+#include <vector>
+
+#include "decoder/ctc_prefix_beam_search.h"
+#include "utils/matrix.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// CtcPrefixBeamSearchGroup searches the chunks of many CtcPrefixBeamSearch
+// sessions together frame by frame, e.g. the ones of a ChunkScheduler
+// batch. The hypotheses of all the sessions of a frame are laid out in flat
+// arrays of their scores, so the prefix scores and the merges of the
+// candidates are computed by the vector LogAdd() over the whole batch, and
+// the candidates of a session are recombined by its small arrays instead of
+// its hash map. The hypotheses stay in the sessions, whose SearchInterface
+// gives the results of their own Search() of the chunks, except the order
+// of the ties. The sessions with a context graph or a LanguageModel are
+// searched by their own Search().
+class CtcPrefixBeamSearchGroup {
+ public:
+  CtcPrefixBeamSearchGroup() = default;
+
+  // logps[i]: [T_i, vocab] ctc log probs of the chunk of searches[i]
+  void Search(const std::vector<CtcPrefixBeamSearch*>& searches,
+              const std::vector<MatrixView<float>>& logps);
+  // Whether the search is searched with the others
+  static bool Supports(const CtcPrefixBeamSearch& search);
+
+ private:
+  struct Session {
+    CtcPrefixBeamSearch* search;
+    MatrixView<float> logp;
+    // The topk of the frame in topk_scores_/topk_indexs_
+    int topk_begin = 0;
+    int k = 0;
+    int blank_pos = -1;
+    // The hypotheses in the hyp_ arrays, the candidates in the cand_ ones
+    int hyp_begin = 0;
+    int cand_begin = 0;
+    int cand_end = 0;
+  };
+
+  void SearchFrame(int t);
+  // The candidates of the session of the frame
+  void PassTokens(Session* session);
+  // Keep the best candidates as the hypotheses of the session
+  void Prune(const Session& session);
+
+  std::vector<Session> sessions_;
+  std::vector<Session*> active_;
+  // The flat arrays of the frame, reused across the frames and the calls
+  std::vector<float> topk_scores_;
+  std::vector<int32_t> topk_indexs_;
+  std::vector<float> topk_score_;
+  std::vector<int32_t> topk_index_;
+  // Blank and none blank ending scores of the hypotheses, and their sums
+  std::vector<float> hyp_s_;
+  std::vector<float> hyp_ns_;
+  std::vector<float> hyp_score_;
+  // The candidates, of which the none blank ending score adds up the one
+  // of cand_ns_ and cand_merged_ns_, e.g. *a + a => *a and *aε + a => *aa
+  // for the hypothesis *aa
+  std::vector<int> cand_prefix_;
+  std::vector<float> cand_s_;
+  std::vector<float> cand_ns_;
+  std::vector<float> cand_merged_ns_;
+  std::vector<float> cand_score_;
+  // The viterbi scores and the times of the candidates, whose s and ns are
+  // set from the arrays above by Prune()
+  std::vector<PrefixScore> cand_viterbi_;
+  // Of a session, the parent hypothesis of each hypothesis and whether the
+  // hypothesis extended by the topk token is a hypothesis already
+  std::vector<int> parents_;
+  std::vector<char> merged_;
+  std::vector<int> order_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(CtcPrefixBeamSearchGroup);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_CTC_PREFIX_BEAM_SEARCH_GROUP_H_
@@ -15,8 +15,11 @@
 
 #include "decoder/ctc_wfst_beam_search.h"
 
+#include <algorithm>
 #include <utility>
 
+#include "decoder/adaptive_beam.h"
+
 namespace wenet {
 
 void DecodableTensorScaled::Reset() {
@@ -24,18 +27,41 @@ void DecodableTensorScaled::Reset() {
   done_ = false;
   // Give an empty initialization, will throw error when
   // AcceptLoglikes is not called
-  logp_.clear();
+  logp_ = nullptr;
+  size_ = 0;
+  for (int32_t id : sparse_ids_) sparse_logp_[id] = floor_;
+  sparse_ids_.clear();
 }
 
-void DecodableTensorScaled::AcceptLoglikes(const std::vector<float>& logp) {
+void DecodableTensorScaled::AcceptLoglikes(const float* logp, int size) {
   ++num_frames_ready_;
-  // TODO(Binbin Zhang): Avoid copy here
+  sparse_ = false;
   logp_ = logp;
+  size_ = size;
+}
+
+void DecodableTensorScaled::AcceptTopK(const float* scores, const int32_t* ids,
+                                       int k) {
+  ++num_frames_ready_;
+  sparse_ = true;
+  // Only the entries of the last frame are restored to the floor
+  for (int32_t id : sparse_ids_) sparse_logp_[id] = floor_;
+  sparse_ids_.assign(ids, ids + k);
+  for (int i = 0; i < k; ++i) {
+    CHECK_GE(ids[i], 0);
+    if (ids[i] >= sparse_logp_.size()) sparse_logp_.resize(ids[i] + 1, floor_);
+    sparse_logp_[ids[i]] = scores[i];
+  }
 }
 
 float DecodableTensorScaled::LogLikelihood(int32 frame, int32 index) {
   CHECK_GT(index, 0);
   CHECK_LT(frame, num_frames_ready_);
+  if (sparse_) {
+    return index <= sparse_logp_.size() ? scale_ * sparse_logp_[index - 1]
+                                        : scale_ * floor_;
+  }
+  CHECK_LE(index, size_);
   return scale_ * logp_[index - 1];
 }
 
@@ -51,76 +77,328 @@ int32 DecodableTensorScaled::NumIndices() const {
 
 CtcWfstBeamSearch::CtcWfstBeamSearch(
     const fst::Fst<fst::StdArc>& fst, const CtcWfstBeamSearchOptions& opts,
-    const std::shared_ptr<ContextGraph>& context_graph)
-    : decodable_(opts.acoustic_scale),
-      decoder_(fst, opts, context_graph),
+    const std::shared_ptr<ContextGraph>& context_graph,
+    std::shared_ptr<const LatticeRescorer> lattice_rescorer)
+    : fst_(fst.Copy(true)),
+      decodable_(opts.acoustic_scale, opts.sparse_floor),
+      decoder_(*fst_, opts, context_graph),
       context_graph_(context_graph),
+      lattice_rescorer_(std::move(lattice_rescorer)),
       opts_(opts) {
   Reset();
 }
 
+void CtcWfstBeamSearch::SetBeamScale(float beam_scale) {
+  kaldi::LatticeFasterDecoderConfig config = opts_;
+  config.beam *= beam_scale;
+  config.lattice_beam *= beam_scale;
+  config.max_active = std::max(ScaleBeamSize(opts_.max_active, beam_scale),
+                               opts_.min_active);
+  decoder_.SetOptions(config);
+}
+
 void CtcWfstBeamSearch::Reset() {
   num_frames_ = 0;
   decoded_frames_mapping_.clear();
   is_last_frame_blank_ = false;
   last_best_ = 0;
+  last_frame_prob_.clear();
+  last_frame_topk_scores_.clear();
+  last_frame_topk_ids_.clear();
   inputs_.clear();
   outputs_.clear();
   likelihood_.clear();
   times_.clear();
+  has_lattice_ = false;
+  best_trace_.clear();
+  best_trace_index_.clear();
+  best_alignment_.clear();
+  best_words_.clear();
   decodable_.Reset();
   decoder_.InitDecoding();
 }
 
 void CtcWfstBeamSearch::Search(const std::vector<std::vector<float>>& logp) {
+  blank_scores_.clear();
   if (0 == logp.size()) {
     return;
   }
+  if (opts_.sparse_topk > 0) {
+    // Only the topk of each frame are searched
+    std::vector<float> rows;
+    for (const auto& frame : logp) {
+      rows.insert(rows.end(), frame.begin(), frame.end());
+    }
+    Search(MatrixView<float>(rows.data(), logp.size(), logp[0].size()));
+    return;
+  }
+  SearchFrames(logp.size(), logp[0].size(),
+               [&logp](int t) { return logp[t].data(); });
+}
+
+void CtcWfstBeamSearch::Search(const MatrixView<float>& logp) {
+  blank_scores_.clear();
+  if (logp.empty()) {
+    return;
+  }
+  if (opts_.sparse_topk > 0) {
+    // Only the topk of each frame are searched
+    int k = std::min(opts_.sparse_topk, logp.cols());
+    Matrix<float> topk_scores(logp.rows(), k);
+    Matrix<int32_t> topk_indexs(logp.rows(), k);
+    std::vector<float> scores;
+    std::vector<int32_t> ids;
+    for (int t = 0; t < logp.rows(); ++t) {
+      TopK(logp.row(t), logp.cols(), k, &scores, &ids);
+      std::copy(scores.begin(), scores.end(), topk_scores.row(t));
+      std::copy(ids.begin(), ids.end(), topk_indexs.row(t));
+    }
+    Search(topk_scores.view(), topk_indexs.view());
+    return;
+  }
+  SearchFrames(logp.rows(), logp.cols(),
+               [&logp](int t) { return logp.row(t); });
+}
+
+void CtcWfstBeamSearch::Search(
+    const std::vector<std::vector<float>>& topk_scores,
+    const std::vector<std::vector<int32_t>>& topk_indexs) {
+  blank_scores_.clear();
+  if (topk_scores.empty()) {
+    return;
+  }
+  SearchTopKFrames(
+      topk_scores.size(), topk_scores[0].size(),
+      [&topk_scores](int t) { return topk_scores[t].data(); },
+      [&topk_indexs](int t) { return topk_indexs[t].data(); });
+}
+
+void CtcWfstBeamSearch::Search(const MatrixView<float>& topk_scores,
+                               const MatrixView<int32_t>& topk_indexs) {
+  blank_scores_.clear();
+  if (topk_scores.empty()) {
+    return;
+  }
+  CHECK_EQ(topk_scores.rows(), topk_indexs.rows());
+  CHECK_EQ(topk_scores.cols(), topk_indexs.cols());
+  SearchTopKFrames(
+      topk_scores.rows(), topk_scores.cols(),
+      [&topk_scores](int t) { return topk_scores.row(t); },
+      [&topk_indexs](int t) { return topk_indexs.row(t); });
+}
+
+template <typename ScoresFunc, typename IdsFunc>
+void CtcWfstBeamSearch::SearchTopKFrames(int num_frames, int k,
+                                         const ScoresFunc& scores,
+                                         const IdsFunc& ids) {
+  if (opts_.sparse_topk > 0) k = std::min(k, opts_.sparse_topk);
+  for (int i = 0; i < num_frames; i++) {
+    const float* score = scores(i);
+    const int32_t* id = ids(i);
+    // The tokens below sparse_thresh are pruned, the best one is kept
+    int num_kept = 1;
+    while (num_kept < k && std::exp(score[num_kept]) >= opts_.sparse_thresh) {
+      ++num_kept;
+    }
+    // The blank out of the topk is taken as prob 0
+    float blank_logp = -kFloatMax;
+    for (int j = 0; j < k; ++j) {
+      if (id[j] == 0) {
+        blank_logp = score[j];
+        break;
+      }
+    }
+    blank_scores_.push_back(blank_logp);
+    float blank_score = std::exp(blank_logp);
+    if (blank_score > opts_.blank_skip_thresh) {
+      VLOG(3) << "skipping frame " << num_frames_ << " score " << blank_score;
+      is_last_frame_blank_ = true;
+      last_frame_topk_scores_.assign(score, score + num_kept);
+      last_frame_topk_ids_.assign(id, id + num_kept);
+      last_frame_prob_.clear();
+    } else {
+      int cur_best = id[0];
+      if (cur_best != 0 && is_last_frame_blank_ && cur_best == last_best_ &&
+          !last_frame_topk_ids_.empty()) {
+        decodable_.AcceptTopK(last_frame_topk_scores_.data(),
+                              last_frame_topk_ids_.data(),
+                              last_frame_topk_ids_.size());
+        decoder_.AdvanceDecoding(&decodable_, 1);
+        decoded_frames_mapping_.push_back(num_frames_ - 1);
+        VLOG(2) << "Adding blank frame at symbol " << cur_best;
+      }
+      last_best_ = cur_best;
+
+      decodable_.AcceptTopK(score, id, num_kept);
+      decoder_.AdvanceDecoding(&decodable_, 1);
+      decoded_frames_mapping_.push_back(num_frames_);
+      is_last_frame_blank_ = false;
+    }
+    num_frames_++;
+  }
+  UpdatePartialResult();
+}
+
+template <typename RowFunc>
+void CtcWfstBeamSearch::SearchFrames(int num_frames, int vocab_size,
+                                     const RowFunc& row) {
+  // The skipped blank frame is read in place, it's only copied when it's
+  // the last one of the chunk
+  const float* last_frame_prob =
+      last_frame_prob_.empty() ? nullptr : last_frame_prob_.data();
   // Every time we get the log posterior, we decode it all before return
-  for (int i = 0; i < logp.size(); i++) {
-    float blank_score = std::exp(logp[i][0]);
+  for (int i = 0; i < num_frames; i++) {
+    const float* logp = row(i);
+    blank_scores_.push_back(logp[0]);
+    float blank_score = std::exp(logp[0]);
     if (blank_score > opts_.blank_skip_thresh) {
       VLOG(3) << "skipping frame " << num_frames_ << " score " << blank_score;
       is_last_frame_blank_ = true;
-      last_frame_prob_ = logp[i];
+      last_frame_prob = logp;
     } else {
       // Get the best symbol
-      int cur_best =
-          std::max_element(logp[i].begin(), logp[i].end()) - logp[i].begin();
+      int cur_best = std::max_element(logp, logp + vocab_size) - logp;
       // Optional, adding one blank frame if we has skipped it in two same
       // symbols
-      if (cur_best != 0 && is_last_frame_blank_ && cur_best == last_best_) {
-        decodable_.AcceptLoglikes(last_frame_prob_);
+      if (cur_best != 0 && is_last_frame_blank_ && cur_best == last_best_ &&
+          last_frame_prob != nullptr) {
+        decodable_.AcceptLoglikes(last_frame_prob, vocab_size);
         decoder_.AdvanceDecoding(&decodable_, 1);
         decoded_frames_mapping_.push_back(num_frames_ - 1);
         VLOG(2) << "Adding blank frame at symbol " << cur_best;
       }
       last_best_ = cur_best;
 
-      decodable_.AcceptLoglikes(logp[i]);
+      decodable_.AcceptLoglikes(logp, vocab_size);
       decoder_.AdvanceDecoding(&decodable_, 1);
       decoded_frames_mapping_.push_back(num_frames_);
       is_last_frame_blank_ = false;
     }
     num_frames_++;
   }
-  // Get the best path
+  if (is_last_frame_blank_ && last_frame_prob != nullptr &&
+      last_frame_prob != last_frame_prob_.data()) {
+    last_frame_prob_.assign(last_frame_prob, last_frame_prob + vocab_size);
+    last_frame_topk_ids_.clear();
+  }
+  UpdatePartialResult();
+}
+
+void CtcWfstBeamSearch::UpdatePartialResult() {
+  has_lattice_ = false;
   inputs_.clear();
   outputs_.clear();
   likelihood_.clear();
   if (decoded_frames_mapping_.size() > 0) {
-    inputs_.resize(1);
-    outputs_.resize(1);
-    likelihood_.resize(1);
-    kaldi::Lattice lat;
-    decoder_.GetBestPath(&lat, false);
-    std::vector<int> alignment;
+    if (opts_.partial_nbest > 1) {
+      GetPartialNbest();
+    } else {
+      GetPartialBestPath();
+    }
+  }
+}
+
+void CtcWfstBeamSearch::GetPartialBestPath() {
+  using BestPathIterator = kaldi::LatticeFasterOnlineDecoder::BestPathIterator;
+  BestPathIterator iter = decoder_.BestPathEnd(false);
+  // Trace back the tokens which are not cached, each with the arc into it
+  std::vector<std::pair<BestPathIterator, kaldi::LatticeArc>> traced;
+  int merged = -1;
+  while (!iter.Done()) {
+    auto it = best_trace_index_.find(iter.tok);
+    if (it != best_trace_index_.end() &&
+        best_trace_[it->second].frame == iter.frame) {
+      merged = it->second;
+      break;
+    }
+    kaldi::LatticeArc arc;
+    BestPathIterator prev = decoder_.TraceBackBestPath(iter, &arc);
+    traced.emplace_back(iter, arc);
+    iter = prev;
+  }
+  VLOG(3) << "traced " << traced.size() << " tokens, merged at " << merged;
+  // The cached tokens after the merged one are off the best path, of which
+  // the pruned ones may be reused by the traced ones
+  for (int i = merged + 1; i < best_trace_.size(); ++i) {
+    best_trace_index_.erase(best_trace_[i].tok);
+  }
+  best_trace_.resize(merged + 1);
+  float cost = 0.0;
+  if (merged >= 0) {
+    cost = best_trace_.back().cost;
+    best_alignment_.resize(best_trace_.back().num_alignment);
+    best_words_.resize(best_trace_.back().num_words);
+  } else {
+    best_alignment_.clear();
+    best_words_.clear();
+  }
+  for (auto it = traced.rbegin(); it != traced.rend(); ++it) {
+    const kaldi::LatticeArc& arc = it->second;
+    if (arc.ilabel != 0) best_alignment_.push_back(arc.ilabel);
+    if (arc.olabel != 0) best_words_.push_back(arc.olabel);
+    cost += arc.weight.Value1() + arc.weight.Value2();
+    best_trace_index_[it->first.tok] = best_trace_.size();
+    best_trace_.push_back({it->first.tok, it->first.frame, cost,
+                           static_cast<int>(best_alignment_.size()),
+                           static_cast<int>(best_words_.size())});
+  }
+  if (best_trace_.empty()) return;
+  inputs_.resize(1);
+  outputs_.resize(1);
+  likelihood_.resize(1);
+  ConvertToInputs(best_alignment_, &inputs_[0]);
+  outputs_[0] = best_words_;
+  BalanceTags(&outputs_[0]);
+  likelihood_[0] = -cost;
+}
+
+void CtcWfstBeamSearch::GetPartialNbest() {
+  using Token = kaldi::LatticeFasterOnlineDecoder::Token;
+  using BestPathIterator = kaldi::LatticeFasterOnlineDecoder::BestPathIterator;
+  const int32 kBeginTokenLabel =
+      kaldi::LatticeFasterOnlineDecoder::kBeginTokenLabel;
+  int begin_frame = std::max(
+      decoder_.NumFramesDecoded() - opts_.partial_lattice_frames, 0);
+  std::vector<Token*> begin_toks;
+  kaldi::CompactLattice clat;
+  decoder_.GetLattice(&clat, false, begin_frame, &begin_toks);
+  kaldi::Lattice lat, nbest_lat;
+  std::vector<kaldi::Lattice> nbest_lats;
+  fst::ConvertLattice(clat, &lat);
+  fst::ShortestPath(lat, &nbest_lat, opts_.partial_nbest);
+  fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
+
+  for (const auto& nbest : nbest_lats) {
+    std::vector<int> alignment, output;
     kaldi::LatticeWeight weight;
-    fst::GetLinearSymbolSequence(lat, &alignment, &outputs_[0], &weight);
-    ConvertToInputs(alignment, &inputs_[0]);
-    RemoveContinuousTags(&outputs_[0]);
-    VLOG(3) << weight.Value1() << " " << weight.Value2();
-    likelihood_[0] = -(weight.Value1() + weight.Value2());
+    fst::GetLinearSymbolSequence(nbest, &alignment, &output, &weight);
+    float cost = weight.Value1() + weight.Value2();
+    if (begin_frame > 0) {
+      // The first one is the begin token, replace its forward cost by the
+      // costs of its best path
+      CHECK(!alignment.empty() && alignment[0] >= kBeginTokenLabel);
+      Token* tok = begin_toks[alignment[0] - kBeginTokenLabel];
+      cost -= tok->tot_cost;
+      std::vector<int> prefix_alignment, prefix_output;
+      BestPathIterator iter(tok, begin_frame - 1);
+      while (!iter.Done()) {
+        kaldi::LatticeArc arc;
+        iter = decoder_.TraceBackBestPath(iter, &arc);
+        if (arc.ilabel != 0) prefix_alignment.push_back(arc.ilabel);
+        if (arc.olabel != 0) prefix_output.push_back(arc.olabel);
+        cost += arc.weight.Value1() + arc.weight.Value2();
+      }
+      alignment.erase(alignment.begin());
+      alignment.insert(alignment.begin(), prefix_alignment.rbegin(),
+                       prefix_alignment.rend());
+      output.insert(output.begin(), prefix_output.rbegin(),
+                    prefix_output.rend());
+    }
+    inputs_.emplace_back();
+    ConvertToInputs(alignment, &inputs_.back());
+    BalanceTags(&output);
+    outputs_.emplace_back(std::move(output));
+    likelihood_.push_back(-cost);
   }
 }
 
@@ -131,18 +409,20 @@ void CtcWfstBeamSearch::FinalizeSearch() {
   outputs_.clear();
   likelihood_.clear();
   times_.clear();
+  has_lattice_ = false;
   if (decoded_frames_mapping_.size() > 0) {
     std::vector<kaldi::Lattice> nbest_lats;
-    if (opts_.nbest == 1) {
+    if (opts_.nbest == 1 && lattice_rescorer_ == nullptr) {
       kaldi::Lattice lat;
       decoder_.GetBestPath(&lat, true);
       nbest_lats.push_back(std::move(lat));
     } else {
       // Get N-best path by lattice(CompactLattice)
-      kaldi::CompactLattice clat;
-      decoder_.GetLattice(&clat, true);
+      decoder_.GetLattice(&lattice_, true);
+      has_lattice_ = true;
+      if (lattice_rescorer_ != nullptr) lattice_rescorer_->Rescore(&lattice_);
       kaldi::Lattice lat, nbest_lat;
-      fst::ConvertLattice(clat, &lat);
+      fst::ConvertLattice(lattice_, &lat);
       // TODO(Binbin Zhang): it's n-best word lists here, not character n-best
       fst::ShortestPath(lat, &nbest_lat, opts_.nbest);
       fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
@@ -158,12 +438,65 @@ void CtcWfstBeamSearch::FinalizeSearch() {
       fst::GetLinearSymbolSequence(nbest_lats[i], &alignment, &outputs_[i],
                                    &weight);
       ConvertToInputs(alignment, &inputs_[i], &times_[i]);
-      RemoveContinuousTags(&outputs_[i]);
+      BalanceTags(&outputs_[i]);
       likelihood_[i] = -(weight.Value1() + weight.Value2());
     }
   }
 }
 
+int64_t CtcWfstBeamSearch::memory_bytes() const {
+  return CapacityBytes(decoded_frames_mapping_) +
+         CapacityBytes(last_frame_prob_) +
+         CapacityBytes(last_frame_topk_scores_) +
+         CapacityBytes(last_frame_topk_ids_) + CapacityBytes(inputs_) +
+         CapacityBytes(outputs_) + CapacityBytes(likelihood_) +
+         CapacityBytes(times_) + CapacityBytes(best_trace_) +
+         CapacityBytes(best_alignment_) + CapacityBytes(best_words_) +
+         best_trace_index_.size() *
+             (sizeof(const void*) + sizeof(int) + sizeof(void*)) +
+         best_trace_index_.bucket_count() * sizeof(void*);
+}
+
+bool CtcWfstBeamSearch::GetWordLattice(WordLattice* lattice) {
+  lattice->Clear();
+  if (decoded_frames_mapping_.empty()) return false;
+  if (!has_lattice_) {
+    decoder_.GetLattice(&lattice_, true);
+    has_lattice_ = true;
+  }
+  if (lattice_.Start() == fst::kNoStateId) return false;
+  if (lattice_.Properties(fst::kTopSorted, true) == 0) {
+    fst::TopSort(&lattice_);
+  }
+  // The state times are the decoded frames of the transition ids before
+  // them, which are mapped to the frames with the skipped blank frames
+  std::vector<int> frames(lattice_.NumStates(), 0);
+  int num_decoded = decoded_frames_mapping_.size();
+  for (int s = 0; s < lattice_.NumStates(); ++s) {
+    int frame = frames[s] < num_decoded
+                    ? decoded_frames_mapping_[frames[s]]
+                    : decoded_frames_mapping_.back() + 1;
+    lattice->AddState(frame);
+    const kaldi::CompactLatticeWeight& final_weight = lattice_.Final(s);
+    if (final_weight != kaldi::CompactLatticeWeight::Zero()) {
+      lattice->SetFinal(s, final_weight.Weight().Value1(),
+                        final_weight.Weight().Value2());
+    }
+    for (fst::ArcIterator<kaldi::CompactLattice> aiter(lattice_, s);
+         !aiter.Done(); aiter.Next()) {
+      const kaldi::CompactLatticeArc& arc = aiter.Value();
+      frames[arc.nextstate] = frames[s] + arc.weight.String().size();
+      WordLattice::Arc word_arc;
+      word_arc.word = arc.olabel;
+      word_arc.next = arc.nextstate;
+      word_arc.graph_cost = arc.weight.Weight().Value1();
+      word_arc.acoustic_cost = arc.weight.Weight().Value2();
+      lattice->AddArc(s, word_arc);
+    }
+  }
+  return true;
+}
+
 void CtcWfstBeamSearch::ConvertToInputs(const std::vector<int>& alignment,
                                         std::vector<int>* input,
                                         std::vector<int>* time) {
@@ -182,19 +515,8 @@ void CtcWfstBeamSearch::ConvertToInputs(const std::vector<int>& alignment,
   }
 }
 
-void CtcWfstBeamSearch::RemoveContinuousTags(std::vector<int>* output) {
-  if (context_graph_) {
-    for (auto it = output->begin(); it != output->end();) {
-      if (*it == context_graph_->start_tag_id() ||
-          *it == context_graph_->end_tag_id()) {
-        if (it + 1 != output->end() && *it == *(it + 1)) {
-          it = output->erase(it);
-          continue;
-        }
-      }
-      ++it;
-    }
-  }
+void CtcWfstBeamSearch::BalanceTags(std::vector<int>* output) {
+  if (context_graph_) context_graph_->BalanceTags(output);
 }
 
 }  // namespace wenet
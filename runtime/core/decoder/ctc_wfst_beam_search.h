@@ -16,33 +16,54 @@
 #ifndef DECODER_CTC_WFST_BEAM_SEARCH_H_
 #define DECODER_CTC_WFST_BEAM_SEARCH_H_
 
+#include <limits>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "decoder/context_graph.h"
+#include "decoder/lattice_rescorer.h"
 #include "decoder/search_interface.h"
 #include "kaldi/decoder/lattice-faster-online-decoder.h"
 #include "utils/utils.h"
 
 namespace wenet {
 
+// The frames are either dense, of the log probs of all the tokens read in
+// place, or sparse, of which only the top k tokens are scored and the others
+// take `floor`. With the default floor of -inf, the arcs of the pruned tokens
+// are skipped by the decoder before they make any token.
 class DecodableTensorScaled : public kaldi::DecodableInterface {
  public:
-  explicit DecodableTensorScaled(float scale = 1.0) : scale_(scale) { Reset(); }
+  explicit DecodableTensorScaled(
+      float scale = 1.0, float floor = -std::numeric_limits<float>::infinity())
+      : scale_(scale), floor_(floor) {
+    Reset();
+  }
 
   void Reset();
   int32 NumFramesReady() const override { return num_frames_ready_; }
   bool IsLastFrame(int32 frame) const override;
   float LogLikelihood(int32 frame, int32 index) override;
   int32 NumIndices() const override;
-  void AcceptLoglikes(const std::vector<float>& logp);
+  // The frame is borrowed, it's only read by the next AdvanceDecoding
+  void AcceptLoglikes(const float* logp, int size);
+  // The k (id, log prob) of a sparse frame, which are kept in a lookup table
+  // of the ids seen, only the k entries are updated per frame
+  void AcceptTopK(const float* scores, const int32_t* ids, int k);
   void SetFinish() { done_ = true; }
 
  private:
   int num_frames_ready_ = 0;
   float scale_ = 1.0;
+  float floor_;
   bool done_ = false;
-  std::vector<float> logp_;
+  const float* logp_ = nullptr;
+  int size_ = 0;
+  // The lookup table of the current sparse frame and its ids
+  bool sparse_ = false;
+  std::vector<float> sparse_logp_;
+  std::vector<int32_t> sparse_ids_;
 };
 
 // LatticeFasterDecoderConfig has the following key members
@@ -55,19 +76,44 @@ struct CtcWfstBeamSearchOptions : public kaldi::LatticeFasterDecoderConfig {
   // When blank score is greater than this thresh, skip the frame in viterbi
   // search
   float blank_skip_thresh = 0.98;
+  // N-best of the partial results. If it's greater than 1, only the lattice
+  // of the last partial_lattice_frames decoded frames is determinized, and
+  // the earlier frames are traced back by the best path of each hypothesis,
+  // so the cost of a partial result doesn't grow with the utterance length
+  int partial_nbest = 1;
+  int partial_lattice_frames = 200;
+  // If it's greater than 0, only the top sparse_topk tokens of each frame
+  // are scored, the arcs of the others are skipped, also the tokens of the
+  // top k of which the prob is below sparse_thresh. It's what the topk
+  // Search takes from the model, see DecodeOptions::enable_topk_ctc.
+  int sparse_topk = 0;
+  float sparse_thresh = 0.0;
+  // The log prob of the pruned tokens, -inf skips their arcs
+  float sparse_floor = -std::numeric_limits<float>::infinity();
+  // The graph is LG without the ctc topology T, which is searched by
+  // CtcLgBeamSearch instead
+  bool lg_graph = false;
 };
 
 class CtcWfstBeamSearch : public SearchInterface {
  public:
+  // If lattice_rescorer is set, the final lattice is rescored by it before
+  // the n-best is taken, even if the nbest is 1
   explicit CtcWfstBeamSearch(
       const fst::Fst<fst::StdArc>& fst, const CtcWfstBeamSearchOptions& opts,
-      const std::shared_ptr<ContextGraph>& context_graph);
+      const std::shared_ptr<ContextGraph>& context_graph,
+      std::shared_ptr<const LatticeRescorer> lattice_rescorer = nullptr);
   void Search(const std::vector<std::vector<float>>& logp) override;
+  void Search(const MatrixView<float>& logp) override;
   void Search(const std::vector<std::vector<float>>& topk_scores,
-              const std::vector<std::vector<int32_t>>& topk_indexs) override {};
+              const std::vector<std::vector<int32_t>>& topk_indexs) override;
+  void Search(const MatrixView<float>& topk_scores,
+              const MatrixView<int32_t>& topk_indexs) override;
   void Reset() override;
   void FinalizeSearch() override;
   SearchType Type() const override { return SearchType::kWfstBeamSearch; }
+  // The beam, max_active and lattice_beam of the decoder are scaled
+  void SetBeamScale(float beam_scale) override;
   // For CTC prefix beam search, both inputs and outputs are hypotheses_
   const std::vector<std::vector<int>>& Inputs() const override {
     return inputs_;
@@ -77,26 +123,82 @@ class CtcWfstBeamSearch : public SearchInterface {
   }
   const std::vector<float>& Likelihood() const override { return likelihood_; }
   const std::vector<std::vector<int>>& Times() const override { return times_; }
+  const std::vector<float>& BlankScores() const override {
+    return blank_scores_;
+  }
+  // The lattice determinized for the n-best is reused, so it's only
+  // determinized here if the nbest is 1, and once per utterance
+  bool GetWordLattice(WordLattice* lattice) override;
+  // The results and the traced best path, the tokens of the kaldi decoder
+  // are not counted
+  int64_t memory_bytes() const override;
 
  private:
   // Sub one and remove <blank>
   void ConvertToInputs(const std::vector<int>& alignment,
                        std::vector<int>* input,
                        std::vector<int>* time = nullptr);
-  void RemoveContinuousTags(std::vector<int>* output);
+  // Pair the tags of the contexts, see ContextGraph::BalanceTags()
+  void BalanceTags(std::vector<int>* output);
+  // Decode the frames `row(t)` of t in [0, num_frames)
+  template <typename RowFunc>
+  void SearchFrames(int num_frames, int vocab_size, const RowFunc& row);
+  // Decode the sparse frames of the k tokens `scores(t)` and `ids(t)`, in
+  // descending order of the scores
+  template <typename ScoresFunc, typename IdsFunc>
+  void SearchTopKFrames(int num_frames, int k, const ScoresFunc& scores,
+                        const IdsFunc& ids);
+  void UpdatePartialResult();
+  // 1-best of the partial result by tracing back the best path, until it
+  // merges with the cached best path of the last chunk
+  void GetPartialBestPath();
+  // N-best of the partial result by the lattice of the recent frames
+  void GetPartialNbest();
 
   int num_frames_ = 0;
   std::vector<int> decoded_frames_mapping_;
 
   int last_best_ = 0;  // last none blank best id
+  // The last frame, if it's a skipped blank one, kept for the next chunk
   std::vector<float> last_frame_prob_;
+  // The same of the sparse frames
+  std::vector<float> last_frame_topk_scores_;
+  std::vector<int32_t> last_frame_topk_ids_;
   bool is_last_frame_blank_ = false;
+  // The blank log probs of the frames of the last Search()
+  std::vector<float> blank_scores_;
   std::vector<std::vector<int>> inputs_, outputs_;
   std::vector<float> likelihood_;
   std::vector<std::vector<int>> times_;
+  // The topologically sorted lattice of the finalized search
+  kaldi::CompactLattice lattice_;
+  bool has_lattice_ = false;
+  // The best path traced for the partial result, an entry per token from
+  // the start one. The backpointers of the tokens of the decoded frames are
+  // fixed, so once the best path of the next chunk reaches a cached token,
+  // the rest of it is the cached prefix. The frame tells a cached token from
+  // a new one reusing the memory of a pruned one.
+  struct TraceEntry {
+    const void* tok;
+    int frame;  // frame of the BestPathIterator
+    float cost;  // cost of the path to the token
+    // Sizes of best_alignment_ and best_words_ until the token
+    int num_alignment;
+    int num_words;
+  };
+  std::vector<TraceEntry> best_trace_;
+  std::unordered_map<const void*, int> best_trace_index_;
+  std::vector<int> best_alignment_;
+  std::vector<int> best_words_;
+  // A thread safe copy of the graph. The arcs of the delayed graphs, such as
+  // the lazily composed TL o G, and of the compact graphs like QuantizedFst
+  // are expanded in a cache of each search, while the expanded graphs like
+  // ConstFst are shared by the copies
+  std::unique_ptr<fst::Fst<fst::StdArc>> fst_;
   DecodableTensorScaled decodable_;
   kaldi::LatticeFasterOnlineDecoder decoder_;
   std::shared_ptr<ContextGraph> context_graph_;
+  std::shared_ptr<const LatticeRescorer> lattice_rescorer_;
   const CtcWfstBeamSearchOptions& opts_;
 };
 
@@ -0,0 +1,47 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_DECODE_RESULT_H_
+#define DECODER_DECODE_RESULT_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct WordPiece {
+  std::string word;
+  int start = -1;
+  int end = -1;
+
+  WordPiece(std::string word, int start, int end)
+      : word(std::move(word)), start(start), end(end) {}
+};
+
+struct DecodeResult {
+  float score = -kFloatMax;
+  std::string sentence;
+  std::vector<WordPiece> word_pieces;
+
+  static bool CompareFunc(const DecodeResult& a, const DecodeResult& b) {
+    return a.score > b.score;
+  }
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_DECODE_RESULT_H_
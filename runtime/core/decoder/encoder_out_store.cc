@@ -0,0 +1,151 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/encoder_out_store.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+bool ParseEncoderOutStorage(const std::string& name,
+                            EncoderOutStorage* storage) {
+  if (name == "fp32") {
+    *storage = EncoderOutStorage::kFloat32;
+  } else if (name == "fp16") {
+    *storage = EncoderOutStorage::kFloat16;
+  } else if (name == "int8") {
+    *storage = EncoderOutStorage::kInt8;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void EncoderOutStore::set_storage(EncoderOutStorage storage) {
+  CHECK(empty()) << "The storage of the rows can't be changed";
+  storage_ = storage;
+}
+
+void EncoderOutStore::Append(const float* data, int num_rows, int dim) {
+  if (num_rows <= 0) return;
+  CHECK(empty() || dim == dim_) << "The rows are of dim " << dim_;
+  dim_ = dim;
+  const size_t size = static_cast<size_t>(num_rows) * dim;
+  switch (storage_) {
+    case EncoderOutStorage::kFloat32:
+      fp32_.insert(fp32_.end(), data, data + size);
+      break;
+    case EncoderOutStorage::kFloat16:
+      fp16_.reserve(fp16_.size() + size);
+      for (size_t i = 0; i < size; ++i) fp16_.push_back(FloatToHalf(data[i]));
+      break;
+    case EncoderOutStorage::kInt8:
+      int8_.resize(int8_.size() + size);
+      for (int i = 0; i < num_rows; ++i) {
+        const float* row = data + static_cast<size_t>(i) * dim;
+        float max_abs = 0;
+        for (int j = 0; j < dim; ++j) {
+          max_abs = std::max(max_abs, std::fabs(row[j]));
+        }
+        float scale = max_abs / 127;
+        float inv_scale = scale > 0 ? 1 / scale : 0;
+        int8_t* out = int8_.data() + int8_.size() - size +
+                      static_cast<size_t>(i) * dim;
+        for (int j = 0; j < dim; ++j) {
+          out[j] = static_cast<int8_t>(std::lrint(row[j] * inv_scale));
+        }
+        scales_.push_back(scale);
+      }
+      break;
+  }
+  num_rows_ += num_rows;
+}
+
+void EncoderOutStore::CopyTo(float* out) const {
+  const size_t size = static_cast<size_t>(num_rows_) * dim_;
+  switch (storage_) {
+    case EncoderOutStorage::kFloat32:
+      if (size > 0) memcpy(out, fp32_.data(), size * sizeof(float));
+      break;
+    case EncoderOutStorage::kFloat16:
+      for (size_t i = 0; i < size; ++i) out[i] = HalfToFloat(fp16_[i]);
+      break;
+    case EncoderOutStorage::kInt8:
+      for (int i = 0; i < num_rows_; ++i) {
+        const size_t offset = static_cast<size_t>(i) * dim_;
+        for (int j = 0; j < dim_; ++j) {
+          out[offset + j] = int8_[offset + j] * scales_[i];
+        }
+      }
+      break;
+  }
+}
+
+void EncoderOutStore::Clear() {
+  num_rows_ = 0;
+  dim_ = 0;
+  fp32_.clear();
+  fp16_.clear();
+  int8_.clear();
+  scales_.clear();
+}
+
+int64_t EncoderOutStore::bytes() const {
+  return fp32_.capacity() * sizeof(float) +
+         fp16_.capacity() * sizeof(uint16_t) + int8_.capacity() +
+         scales_.capacity() * sizeof(float);
+}
+
+uint16_t EncoderOutStore::FloatToHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t abs = bits & 0x7fffffff;
+  if (abs >= 0x7f800000) {  // Inf or nan
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  }
+  if (abs >= 0x477ff000) return sign | 0x7c00;  // Rounded to inf
+  if (abs < 0x38800000) {
+    // Subnormal of the half, in the units of 2^-24
+    float magnitude;
+    memcpy(&magnitude, &abs, sizeof(magnitude));
+    return sign | static_cast<uint16_t>(std::lrint(magnitude * 16777216.0f));
+  }
+  // Round the mantissa to the nearest even, then rebias the exponent
+  abs += 0xfff + ((abs >> 13) & 1);
+  return sign | static_cast<uint16_t>((abs - 0x38000000) >> 13);
+}
+
+float EncoderOutStore::HalfToFloat(uint16_t value) {
+  const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  const uint32_t exponent = (value >> 10) & 0x1f;
+  const uint32_t mantissa = value & 0x3ff;
+  if (exponent == 0) {
+    float magnitude = mantissa * 5.9604645e-8f;  // 2^-24
+    return sign ? -magnitude : magnitude;
+  }
+  uint32_t bits = exponent == 0x1f
+                      ? sign | 0x7f800000 | (mantissa << 13)
+                      : sign | ((exponent + 112) << 23) | (mantissa << 13);
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+}  // namespace wenet
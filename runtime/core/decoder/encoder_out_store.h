@@ -0,0 +1,79 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_ENCODER_OUT_STORE_H_
+#define DECODER_ENCODER_OUT_STORE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wenet {
+
+// How the encoder outputs of a session are kept for the attention rescoring
+enum class EncoderOutStorage {
+  kFloat32,
+  kFloat16,
+  // Per row int8 with the scale of the max abs value of the row
+  kInt8,
+};
+
+// Return false if name isn't one of fp32, fp16 and int8
+bool ParseEncoderOutStorage(const std::string& name,
+                            EncoderOutStorage* storage);
+
+// EncoderOutStore keeps the rows of the encoder outputs of a session on
+// host, which are only read by the rescoring at the end, compressed to
+// fp16 or int8 of the storage, i.e. a half or about a quarter of the fp32
+// memory of a long utterance. They are decompressed by CopyTo.
+class EncoderOutStore {
+ public:
+  explicit EncoderOutStore(
+      EncoderOutStorage storage = EncoderOutStorage::kFloat32)
+      : storage_(storage) {}
+
+  // Clear() before changing the storage of the rows
+  void set_storage(EncoderOutStorage storage);
+  EncoderOutStorage storage() const { return storage_; }
+
+  // Append num_rows rows of dim, all the rows are of the same dim
+  void Append(const float* data, int num_rows, int dim);
+  // Decompress all the rows to out of num_rows() * dim()
+  void CopyTo(float* out) const;
+  void Clear();
+
+  int num_rows() const { return num_rows_; }
+  int dim() const { return dim_; }
+  bool empty() const { return num_rows_ == 0; }
+  // Bytes of the compressed rows
+  int64_t bytes() const;
+
+  static uint16_t FloatToHalf(float value);
+  static float HalfToFloat(uint16_t value);
+
+ private:
+  EncoderOutStorage storage_;
+  int num_rows_ = 0;
+  int dim_ = 0;
+  // One of them is used by the storage
+  std::vector<float> fp32_;
+  std::vector<uint16_t> fp16_;
+  std::vector<int8_t> int8_;
+  std::vector<float> scales_;
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_ENCODER_OUT_STORE_H_
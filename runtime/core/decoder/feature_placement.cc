@@ -0,0 +1,69 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/feature_placement.h"
+
+#include "utils/log.h"
+
+namespace wenet {
+
+bool ParseFeaturePlacement(const std::string& name,
+                           FeaturePlacement* placement) {
+  if (name == "cpu") {
+    *placement = FeaturePlacement::kCpu;
+  } else if (name == "gpu") {
+    *placement = FeaturePlacement::kGpu;
+  } else if (name == "auto") {
+    *placement = FeaturePlacement::kAuto;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+FeaturePlacer::FeaturePlacer(const FeaturePlacementOptions& opts,
+                             bool gpu_available)
+    : opts_(opts), gpu_available_(gpu_available) {
+  if (opts_.placement == FeaturePlacement::kGpu && !gpu_available_) {
+    LOG(WARNING) << "GPU fbank requires USE_GPU, fallback to CPU";
+  }
+}
+
+bool FeaturePlacer::Place(int batch_size) {
+  if (!gpu_available_ || opts_.placement == FeaturePlacement::kCpu) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (opts_.placement == FeaturePlacement::kAuto &&
+      (batch_size < opts_.min_gpu_batch_size ||
+       gpu_inflight_ >= opts_.max_gpu_inflight)) {
+    return false;
+  }
+  ++gpu_inflight_;
+  return true;
+}
+
+void FeaturePlacer::Release() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_GT(gpu_inflight_, 0);
+  --gpu_inflight_;
+}
+
+int FeaturePlacer::gpu_inflight() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return gpu_inflight_;
+}
+
+}  // namespace wenet
@@ -0,0 +1,67 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_FEATURE_PLACEMENT_H_
+#define DECODER_FEATURE_PLACEMENT_H_
+
+#include <mutex>
+#include <string>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+enum class FeaturePlacement { kCpu = 0, kGpu, kAuto };
+
+// "cpu", "gpu" or "auto", return false if it's none of them
+bool ParseFeaturePlacement(const std::string& name,
+                           FeaturePlacement* placement);
+
+struct FeaturePlacementOptions {
+  FeaturePlacement placement = FeaturePlacement::kAuto;
+  // For auto, the smaller batches are computed on CPU, where the fbank of
+  // a few wavs is cheaper than the upload and the launches
+  int min_gpu_batch_size = 4;
+  // For auto, the batches beyond these ones in flight on GPU are computed
+  // on CPU, so the feature doesn't queue behind the encoders on the device
+  int max_gpu_inflight = 2;
+};
+
+// Where the fbank of a batch is computed, shared by the batch decoders of a
+// resource so that the GPU load is counted across them. Without GPU fbank,
+// i.e. no USE_GPU, all the batches are placed on CPU.
+class FeaturePlacer {
+ public:
+  FeaturePlacer(const FeaturePlacementOptions& opts, bool gpu_available);
+
+  // Return true if the batch is placed on GPU, which must be released by
+  // Release when its fbank is done
+  bool Place(int batch_size);
+  void Release();
+  int gpu_inflight() const;
+
+ private:
+  const FeaturePlacementOptions opts_;
+  const bool gpu_available_;
+  mutable std::mutex mutex_;
+  int gpu_inflight_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(FeaturePlacer);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_FEATURE_PLACEMENT_H_
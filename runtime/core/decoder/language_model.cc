@@ -0,0 +1,135 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/language_model.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+const int NgramLanguageModel::kRoot;
+const int NgramLanguageModel::kBos;
+
+// The penalty of each backoff of the stupid backoff
+static const float kBackoff = std::log(0.4f);
+
+NgramLanguageModel::NgramLanguageModel(
+    int order, int vocab_size, const std::vector<std::vector<int>>& sentences)
+    : order_(order), vocab_size_(vocab_size) {
+  CHECK_GT(order, 0);
+  auto trie = std::make_shared<Trie>();
+  trie->nodes.push_back({kBos, -1, 0, 0});
+  // All the n-grams up to the order starting at each position, so a node
+  // counts the occurrences of its n-gram
+  for (const auto& sentence : sentences) {
+    std::vector<int> tokens(1, kBos);
+    tokens.insert(tokens.end(), sentence.begin(), sentence.end());
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      int node = kRoot;
+      ++trie->nodes[node].count;
+      size_t end = std::min(tokens.size(), i + order);
+      for (size_t j = i; j < end; ++j) {
+        int child = trie->Child(node, tokens[j]);
+        if (child < 0) {
+          child = trie->nodes.size();
+          trie->nodes.push_back(
+              {tokens[j], node, trie->nodes[node].length + 1, 0});
+          trie->children.emplace(Trie::Key(node, tokens[j]), child);
+        }
+        node = child;
+        ++trie->nodes[node].count;
+      }
+    }
+  }
+  trie_ = trie;
+  if (order_ > 1) {
+    int node = Find({kBos});
+    start_ = State(node, 1 - trie_->nodes[node].length);
+  }
+}
+
+std::vector<int> NgramLanguageModel::History(int node) const {
+  std::vector<int> tokens(trie_->nodes[node].length);
+  for (int i = tokens.size() - 1; i >= 0; --i) {
+    tokens[i] = trie_->nodes[node].token;
+    node = trie_->nodes[node].parent;
+  }
+  return tokens;
+}
+
+int NgramLanguageModel::Find(const std::vector<int>& tokens) const {
+  for (size_t start = 0; start < tokens.size(); ++start) {
+    int node = kRoot;
+    for (size_t i = start; i < tokens.size() && node >= 0; ++i) {
+      node = trie_->Child(node, tokens[i]);
+    }
+    if (node >= 0) return node;
+  }
+  return kRoot;
+}
+
+float NgramLanguageModel::LogProb(int state, int token) const {
+  std::vector<int> history = History(state / order_);
+  float backoff = (state % order_) * kBackoff;
+  for (size_t start = 0; start < history.size(); ++start) {
+    int node = kRoot;
+    for (size_t i = start; i < history.size() && node >= 0; ++i) {
+      node = trie_->Child(node, history[i]);
+    }
+    int child = node >= 0 ? trie_->Child(node, token) : -1;
+    if (child >= 0) {
+      return backoff + std::log(static_cast<float>(trie_->nodes[child].count) /
+                                trie_->nodes[node].count);
+    }
+    backoff += kBackoff;
+  }
+  // The add one unigram, so an unseen token is not impossible
+  int child = trie_->Child(kRoot, token);
+  int count = child >= 0 ? trie_->nodes[child].count : 0;
+  return backoff + std::log(static_cast<float>(count + 1) /
+                            (trie_->nodes[kRoot].count + vocab_size_));
+}
+
+int NgramLanguageModel::NextState(int state, int token) const {
+  if (order_ <= 1) return kRoot;
+  // The tokens out of the node are never followed by the ones of the node,
+  // so they're not in any n-gram of the next history either
+  int lost = state % order_;
+  std::vector<int> history = History(state / order_);
+  history.push_back(token);
+  int length = std::min<int>(history.size() + lost, order_ - 1);
+  if (static_cast<int>(history.size()) > length) {
+    history.erase(history.begin(), history.end() - length);
+  }
+  int node = Find(history);
+  return State(node, length - trie_->nodes[node].length);
+}
+
+void NgramLanguageModel::Score(const std::vector<int>& states,
+                               const std::vector<int>& tokens,
+                               std::vector<float>* log_probs,
+                               std::vector<int>* next_states) {
+  CHECK_EQ(states.size(), tokens.size());
+  log_probs->resize(states.size());
+  next_states->resize(states.size());
+  for (size_t i = 0; i < states.size(); ++i) {
+    (*log_probs)[i] = LogProb(states[i], tokens[i]);
+    (*next_states)[i] = NextState(states[i], tokens[i]);
+  }
+}
+
+}  // namespace wenet
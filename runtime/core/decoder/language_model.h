@@ -0,0 +1,116 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_LANGUAGE_MODEL_H_
+#define DECODER_LANGUAGE_MODEL_H_
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// LanguageModel scores the tokens of the e2e model for the shallow fusion of
+// CtcPrefixBeamSearch. A prefix is represented by a state of the model, and
+// the search caches the state of each prefix, so a prefix is scored once.
+class LanguageModel {
+ public:
+  virtual ~LanguageModel() = default;
+  // The state of the empty prefix
+  virtual int Start() = 0;
+  // Score tokens[i] after states[i] for all i in one call, i.e. all the new
+  // prefixes of a frame of the search, e.g. in one forward of a neural LM,
+  // and return their log probs and next states
+  virtual void Score(const std::vector<int>& states,
+                     const std::vector<int>& tokens,
+                     std::vector<float>* log_probs,
+                     std::vector<int>* next_states) = 0;
+  // Called at the start of an utterance, the states before are not used
+  // any more
+  virtual void Reset() {}
+  // The model of a new session, which shares the weights but not the
+  // states, e.g. the hidden states of a neural LM
+  virtual std::shared_ptr<LanguageModel> Copy() const = 0;
+};
+
+// Token level n-gram model with stupid backoff, which is counted from the
+// token sequences, e.g. to benchmark the shallow fusion. The state is the
+// node of the longest suffix of the history in the trie of the counts, and
+// the number of the tokens of the history out of it, of which the backoffs
+// are charged to the next token. So the model has no states of its own, and
+// the copies share the counts.
+class NgramLanguageModel : public LanguageModel {
+ public:
+  // vocab_size: the number of the tokens, for the floor of unseen tokens
+  NgramLanguageModel(int order, int vocab_size,
+                     const std::vector<std::vector<int>>& sentences);
+
+  int Start() override { return start_; }
+  void Score(const std::vector<int>& states, const std::vector<int>& tokens,
+             std::vector<float>* log_probs,
+             std::vector<int>* next_states) override;
+  std::shared_ptr<LanguageModel> Copy() const override {
+    return std::make_shared<NgramLanguageModel>(*this);
+  }
+
+  // The log prob of token after the history of state
+  float LogProb(int state, int token) const;
+  // The state of the history of state + token
+  int NextState(int state, int token) const;
+
+ private:
+  static const int kRoot = 0;
+  // The token before the first one of a sentence
+  static const int kBos = -1;
+
+  struct Node {
+    int token;
+    int parent;
+    int length;
+    // Occurrences of the n-gram from the root to it
+    int count;
+  };
+  struct Trie {
+    std::vector<Node> nodes;
+    std::unordered_map<int64_t, int> children;
+
+    // -1 if there isn't
+    int Child(int node, int token) const {
+      auto it = children.find(Key(node, token));
+      return it == children.end() ? -1 : it->second;
+    }
+    static int64_t Key(int node, int token) {
+      return (static_cast<int64_t>(node) << 32) |
+             static_cast<uint32_t>(token);
+    }
+  };
+
+  int State(int node, int lost) const { return node * order_ + lost; }
+  // The tokens from the root to node
+  std::vector<int> History(int node) const;
+  // The node of the longest suffix of tokens in the trie
+  int Find(const std::vector<int>& tokens) const;
+
+  int order_;
+  int vocab_size_;
+  int start_ = kRoot;
+  std::shared_ptr<const Trie> trie_;
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_LANGUAGE_MODEL_H_
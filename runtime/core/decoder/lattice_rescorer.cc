@@ -0,0 +1,82 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/lattice_rescorer.h"
+
+#include <utility>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+LatticeRescorer::LatticeRescorer(
+    std::shared_ptr<fst::Fst<fst::StdArc>> old_lm,
+    std::shared_ptr<fst::Fst<fst::StdArc>> new_lm, float lm_scale)
+    : old_lm_(std::move(old_lm)),
+      new_lm_(std::move(new_lm)),
+      lm_scale_(lm_scale) {
+  CHECK(old_lm_ != nullptr && new_lm_ != nullptr);
+  CHECK_NE(lm_scale_, 0.0);
+  // The sorted property is known without visiting the arcs, which is
+  // stored by fstarcsort
+  for (const auto* lm : {old_lm_.get(), new_lm_.get()}) {
+    CHECK(lm->Properties(fst::kILabelSorted, false))
+        << "The LM is not sorted by fstarcsort --sort_type=ilabel";
+  }
+}
+
+bool LatticeRescorer::ComposeLm(const fst::Fst<fst::StdArc>& lm, float scale,
+                                kaldi::CompactLattice* lattice) {
+  kaldi::Lattice lat;
+  fst::ConvertLattice(*lattice, &lat);
+  // Scaled by 1 / scale before the determinization, so it takes the best
+  // path through the LM whatever the sign of the scale
+  fst::ScaleLattice(fst::GraphLatticeScale(1.0 / scale), &lat);
+  fst::ArcSort(&lat, fst::OLabelCompare<kaldi::LatticeArc>());
+  // The arcs of the LM are mapped as they're visited
+  fst::StdToLatticeMapper<kaldi::BaseFloat> mapper;
+  fst::MapFst<fst::StdArc, kaldi::LatticeArc,
+              fst::StdToLatticeMapper<kaldi::BaseFloat>>
+      lattice_lm(lm, mapper);
+  kaldi::Lattice composed;
+  fst::TableCompose(lat, lattice_lm, &composed);
+  if (composed.Start() == fst::kNoStateId) return false;
+  // The words are the input labels of the determinization
+  fst::Invert(&composed);
+  kaldi::CompactLattice determinized;
+  fst::DeterminizeLattice(composed, &determinized);
+  fst::ScaleLattice(fst::GraphLatticeScale(scale), &determinized);
+  *lattice = std::move(determinized);
+  return true;
+}
+
+bool LatticeRescorer::Rescore(kaldi::CompactLattice* lattice) const {
+  static Counter* num_failures = Metrics::Instance().GetCounter(
+      "wenet_lattice_rescoring_failures_total",
+      "Number of the lattices not accepted by the LMs of the rescoring");
+  if (lattice->Start() == fst::kNoStateId) return false;
+  kaldi::CompactLattice rescored = *lattice;
+  if (!ComposeLm(*old_lm_, -lm_scale_, &rescored) ||
+      !ComposeLm(*new_lm_, lm_scale_, &rescored)) {
+    num_failures->Increment();
+    VLOG(1) << "No path of the lattice is accepted by the LMs";
+    return false;
+  }
+  *lattice = std::move(rescored);
+  return true;
+}
+
+}  // namespace wenet
@@ -0,0 +1,66 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_LATTICE_RESCORER_H_
+#define DECODER_LATTICE_RESCORER_H_
+
+#include <memory>
+
+#include "fst/fstlib.h"
+
+#include "kaldi/lat/kaldi-lattice.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// LatticeRescorer replaces the LM scores of the first pass in the word
+// lattice of CtcWfstBeamSearch by the ones of a larger LM, so the first
+// pass runs on the TLG of a small G, and only the final lattices touch the
+// large one, as lattice-lmrescore of kaldi. The lattice is composed with
+// old_lm by the scale -1, which takes the small LM scores out of the graph
+// costs, then with new_lm, and determinized again after each.
+// The LMs are word acceptors of the words of the TLG, i.e. G.fst projected
+// on the output labels, so the #0 of the backoff arcs is epsilon, and
+// sorted by the input labels, e.g.
+//   fstproject --project_output=true G.fst | fstarcsort --sort_type=ilabel
+// They're composed lazily, only the states reached by the lattice are
+// visited, so a mapped ConstFst of fsttoconst isn't read to the heap. It's
+// thread safe, shared by the searches of the sessions.
+class LatticeRescorer {
+ public:
+  LatticeRescorer(std::shared_ptr<fst::Fst<fst::StdArc>> old_lm,
+                  std::shared_ptr<fst::Fst<fst::StdArc>> new_lm,
+                  float lm_scale = 1.0);
+
+  // False if no path of the lattice is accepted by the LMs, e.g. of the
+  // words out of new_lm, or of the context tags, then it's kept as it is
+  bool Rescore(kaldi::CompactLattice* lattice) const;
+
+ private:
+  // Compose the lattice with `lm` by the scale, false if it's empty
+  static bool ComposeLm(const fst::Fst<fst::StdArc>& lm, float scale,
+                        kaldi::CompactLattice* lattice);
+
+  std::shared_ptr<fst::Fst<fst::StdArc>> old_lm_;
+  std::shared_ptr<fst::Fst<fst::StdArc>> new_lm_;
+  const float lm_scale_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(LatticeRescorer);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_LATTICE_RESCORER_H_
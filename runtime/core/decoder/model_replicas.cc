@@ -0,0 +1,54 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/model_replicas.h"
+
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+ModelReplicas::ModelReplicas(std::vector<std::shared_ptr<AsrModel>> models)
+    : models_(std::move(models)), loads_(models_.size(), 0) {
+  CHECK(!models_.empty());
+}
+
+int ModelReplicas::Acquire() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int num_replicas = models_.size();
+  int best = -1;
+  for (int i = 0; i < num_replicas; ++i) {
+    int replica = (next_ + i) % num_replicas;
+    if (best < 0 || loads_[replica] < loads_[best]) best = replica;
+  }
+  next_ = (best + 1) % num_replicas;
+  ++loads_[best];
+  return best;
+}
+
+void ModelReplicas::Release(int replica) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(replica >= 0 && replica < static_cast<int>(loads_.size()));
+  CHECK_GT(loads_[replica], 0);
+  --loads_[replica];
+}
+
+int ModelReplicas::load(int replica) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return loads_[replica];
+}
+
+}  // namespace wenet
@@ -0,0 +1,55 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_MODEL_REPLICAS_H_
+#define DECODER_MODEL_REPLICAS_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "decoder/asr_model.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The replicas of a model, e.g. one per GPU, and the number of sessions
+// placed on each. A new session is placed on the least loaded replica, the
+// ties are broken round robin, and it's released when the session ends.
+class ModelReplicas {
+ public:
+  explicit ModelReplicas(std::vector<std::shared_ptr<AsrModel>> models);
+
+  int Acquire();
+  void Release(int replica);
+  int size() const { return models_.size(); }
+  const std::shared_ptr<AsrModel>& model(int replica) const {
+    return models_[replica];
+  }
+  int load(int replica) const;
+
+ private:
+  std::vector<std::shared_ptr<AsrModel>> models_;
+  mutable std::mutex mutex_;
+  std::vector<int> loads_;
+  int next_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ModelReplicas);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_MODEL_REPLICAS_H_
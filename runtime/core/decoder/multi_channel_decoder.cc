@@ -0,0 +1,119 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/multi_channel_decoder.h"
+
+#include <future>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+MultiChannelDecoder::MultiChannelDecoder(
+    std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeResource> resource, const DecodeOptions& opts,
+    int num_channels, int max_wait_ms)
+    : feature_config_(std::move(feature_config)),
+      finished_(num_channels, false) {
+  CHECK_GT(num_channels, 0);
+  ChunkSchedulerOptions scheduler_opts;
+  scheduler_opts.max_batch_size = num_channels;
+  scheduler_opts.max_wait_ms = max_wait_ms;
+  chunk_scheduler_ = std::make_shared<ChunkScheduler>(scheduler_opts);
+  // A shallow copy of the resource, of which only the scheduler differs
+  auto channel_resource = std::make_shared<DecodeResource>(*resource);
+  channel_resource->chunk_scheduler = chunk_scheduler_;
+  for (int c = 0; c < num_channels; ++c) {
+    feature_pipelines_.emplace_back(std::make_shared<FeaturePipeline>(
+        *feature_config_, resource->fbank_tables));
+    decoders_.emplace_back(
+        new AsrDecoder(feature_pipelines_[c], channel_resource, opts));
+  }
+  if (num_channels > 1) workers_.reset(new ThreadPool(num_channels - 1));
+}
+
+void MultiChannelDecoder::set_input_sample_rate(int sample_rate) {
+  for (auto& pipeline : feature_pipelines_) {
+    pipeline->set_input_sample_rate(sample_rate);
+  }
+}
+
+void MultiChannelDecoder::AcceptWaveform(const float* pcm, int num_samples) {
+  for (int c = 0; c < num_channels(); ++c) {
+    feature_pipelines_[c]->AcceptWaveform(pcm, num_samples, num_channels(),
+                                          c);
+  }
+}
+
+void MultiChannelDecoder::AcceptWaveform(const int16_t* pcm,
+                                         int num_samples) {
+  for (int c = 0; c < num_channels(); ++c) {
+    feature_pipelines_[c]->AcceptWaveform(pcm, num_samples, num_channels(),
+                                          c);
+  }
+}
+
+void MultiChannelDecoder::set_input_finished() {
+  for (auto& pipeline : feature_pipelines_) pipeline->set_input_finished();
+}
+
+void MultiChannelDecoder::ForEachChannel(
+    const std::function<void(int)>& func, bool all) {
+  // The first channel runs on the calling thread, the others on the workers
+  std::vector<std::future<void>> futures;
+  int first = -1;
+  for (int c = 0; c < num_channels(); ++c) {
+    if (finished_[c] && !all) continue;
+    if (first < 0) {
+      first = c;
+    } else {
+      futures.emplace_back(workers_->enqueue(func, c));
+    }
+  }
+  if (first >= 0) func(first);
+  for (auto& future : futures) future.get();
+}
+
+void MultiChannelDecoder::Decode(std::vector<DecodeState>* states,
+                                 bool block) {
+  states->assign(num_channels(), DecodeState::kEndFeats);
+  ForEachChannel([this, states, block](int c) {
+    (*states)[c] = decoders_[c]->Decode(block);
+  });
+  for (int c = 0; c < num_channels(); ++c) {
+    if ((*states)[c] == DecodeState::kEndFeats) finished_[c] = true;
+  }
+}
+
+bool MultiChannelDecoder::finished() const {
+  for (bool finished : finished_) {
+    if (!finished) return false;
+  }
+  return true;
+}
+
+void MultiChannelDecoder::Rescoring() {
+  ForEachChannel([this](int c) { decoders_[c]->Rescoring(); }, true);
+}
+
+void MultiChannelDecoder::Reset() {
+  for (int c = 0; c < num_channels(); ++c) {
+    // Of its feature pipeline as well
+    decoders_[c]->Reset();
+    finished_[c] = false;
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,92 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_MULTI_CHANNEL_DECODER_H_
+#define DECODER_MULTI_CHANNEL_DECODER_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "decoder/chunk_scheduler.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/thread_pool.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// MultiChannelDecoder decodes the channels of an interleaved waveform, e.g.
+// the agent and the customer of a stereo call, in one session. Each channel
+// has a FeaturePipeline and an AsrDecoder of its own, i.e. its own model
+// caches and searcher, while the chunks of all the channels are forwarded
+// in one batched encoder call by a ChunkScheduler of the session, which
+// takes the place of the one of the resource. The channels are decoded on
+// the calling thread and num_channels - 1 workers of the session.
+//
+// The chunks of the channels are batched as long as the channels advance
+// together. A channel reading a silent chunk of skip_silent_chunks, or
+// waiting for the extra frames of the first chunk after an endpoint, has
+// its peers forwarded without it after max_wait_ms.
+class MultiChannelDecoder {
+ public:
+  MultiChannelDecoder(std::shared_ptr<FeaturePipelineConfig> feature_config,
+                      std::shared_ptr<DecodeResource> resource,
+                      const DecodeOptions& opts, int num_channels,
+                      int max_wait_ms = 5);
+
+  int num_channels() const { return decoders_.size(); }
+  // The sample rate of the waveform to accept, see FeaturePipeline
+  void set_input_sample_rate(int sample_rate);
+  // Accept `num_samples` sample points of each channel, interleaved
+  void AcceptWaveform(const float* pcm, int num_samples);
+  void AcceptWaveform(const int16_t* pcm, int num_samples);
+  void set_input_finished();
+
+  // Decode a chunk of each channel which hasn't returned kEndFeats, whose
+  // states are set to `states`, see AsrDecoder::Decode(). The ones ended
+  // are kept as kEndFeats.
+  void Decode(std::vector<DecodeState>* states, bool block = true);
+  bool finished(int channel) const { return finished_[channel]; }
+  bool finished() const;
+  // Rescore the results of all the channels
+  void Rescoring();
+  void Reset();
+
+  // The decoder of the channel, e.g. to ResetContinuousDecoding() it at its
+  // endpoint, which must not be Decode()d by the caller
+  AsrDecoder* decoder(int channel) { return decoders_[channel].get(); }
+  const std::vector<DecodeResult>& result(int channel) const {
+    return decoders_[channel]->result();
+  }
+
+ private:
+  // Run `func` of every channel not finished, or of all if `all`, in
+  // parallel
+  void ForEachChannel(const std::function<void(int)>& func, bool all = false);
+
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<ChunkScheduler> chunk_scheduler_;
+  std::vector<std::shared_ptr<FeaturePipeline>> feature_pipelines_;
+  std::vector<std::unique_ptr<AsrDecoder>> decoders_;
+  std::vector<bool> finished_;
+  std::unique_ptr<ThreadPool> workers_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(MultiChannelDecoder);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_MULTI_CHANNEL_DECODER_H_
@@ -0,0 +1,525 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/ngram_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utils/log.h"
+#include "utils/string.h"
+
+namespace wenet {
+
+const int NgramModel::kMaxOrder;
+const int NgramModel::kUnk;
+const int NgramModel::kCodebookSize;
+const int Lexicon::kRoot;
+
+static const char kMagic[8] = "WENETLM";
+static const uint32_t kVersion = 1;
+// ARPA is in log10
+static const float kLn10 = std::log(10.0f);
+
+static size_t Align(size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+// The centers of the values, which are the values themselves if there are
+// no more than size of them, or the means of the bins of the same number of
+// the sorted values otherwise
+static std::vector<float> Codebook(std::vector<float> values, int size) {
+  std::sort(values.begin(), values.end());
+  std::vector<float> unique(values.begin(),
+                            std::unique(values.begin(), values.end()));
+  std::vector<float> codebook;
+  if (unique.size() <= static_cast<size_t>(size)) {
+    codebook = unique;
+  } else {
+    for (int i = 0; i < size; ++i) {
+      size_t begin = values.size() * i / size;
+      size_t end = values.size() * (i + 1) / size;
+      double sum = 0;
+      for (size_t j = begin; j < end; ++j) sum += values[j];
+      codebook.push_back(end > begin ? sum / (end - begin) : values[begin]);
+    }
+  }
+  if (codebook.empty()) codebook.push_back(0.0f);
+  codebook.resize(size, codebook.back());
+  return codebook;
+}
+
+// The index of the nearest center of the sorted codebook
+static uint8_t Quantize(const std::vector<float>& codebook, float value) {
+  auto it = std::lower_bound(codebook.begin(), codebook.end(), value);
+  if (it == codebook.end()) return codebook.size() - 1;
+  if (it != codebook.begin() && value - *(it - 1) < *it - value) --it;
+  return it - codebook.begin();
+}
+
+static std::string Key(const int* words, int n) {
+  return std::string(reinterpret_cast<const char*>(words), n * sizeof(int));
+}
+
+bool NgramModel::Build(const std::string& arpa_path, const std::string& path) {
+  std::ifstream arpa(arpa_path);
+  if (!arpa) {
+    LOG(ERROR) << "Error in open " << arpa_path;
+    return false;
+  }
+  struct Ngram {
+    std::vector<int> words;
+    float prob;
+    float backoff;
+  };
+  std::vector<std::string> words(1, "<unk>");
+  std::unordered_map<std::string, int> vocab = {{"<unk>", kUnk}};
+  float unk_prob = -100.0f * kLn10;
+  float unk_backoff = 0.0f;
+  std::vector<std::vector<Ngram>> ngrams;
+  std::string line;
+  int order = 0;
+  std::vector<std::string> fields;
+  while (std::getline(arpa, line)) {
+    line = Trim(line);
+    if (line.empty() || line == "\\data\\" ||
+        line.compare(0, 6, "ngram ") == 0) {
+      continue;
+    }
+    if (line == "\\end\\") break;
+    if (line[0] == '\\') {
+      // \N-grams:
+      order = std::atoi(line.c_str() + 1);
+      if (order <= 0 || order > kMaxOrder ||
+          order != static_cast<int>(ngrams.size()) + 1) {
+        LOG(ERROR) << "Unsupported section " << line;
+        return false;
+      }
+      ngrams.emplace_back();
+      continue;
+    }
+    SplitString(line, &fields);
+    if (order == 0 || static_cast<int>(fields.size()) < order + 1) {
+      LOG(ERROR) << "Wrong line " << line;
+      return false;
+    }
+    Ngram ngram;
+    ngram.prob = std::atof(fields[0].c_str()) * kLn10;
+    ngram.backoff = static_cast<int>(fields.size()) > order + 1
+                        ? std::atof(fields[order + 1].c_str()) * kLn10
+                        : 0.0f;
+    bool known = true;
+    for (int i = 1; i <= order; ++i) {
+      auto it = vocab.find(fields[i]);
+      if (order == 1 && it == vocab.end()) {
+        it = vocab.emplace(fields[i], words.size()).first;
+        words.push_back(fields[i]);
+      }
+      if (it == vocab.end()) {
+        known = false;
+        break;
+      }
+      ngram.words.push_back(it->second);
+    }
+    if (!known) {
+      LOG(WARNING) << "Skip the n-gram of unknown words " << line;
+      continue;
+    }
+    if (order == 1 && ngram.words[0] == kUnk) {
+      unk_prob = ngram.prob;
+      unk_backoff = ngram.backoff;
+      continue;
+    }
+    ngrams.back().push_back(std::move(ngram));
+  }
+  if (ngrams.empty()) {
+    LOG(ERROR) << "No n-grams in " << arpa_path;
+    return false;
+  }
+  order = ngrams.size();
+
+  // The unigrams are indexed by the word
+  std::vector<Unigram> unigrams(words.size() + 1, {unk_prob, unk_backoff, 0});
+  for (const auto& ngram : ngrams[0]) {
+    unigrams[ngram.words[0]] = {ngram.prob, ngram.backoff, 0};
+  }
+  std::vector<std::vector<Entry>> entries(order);
+  std::vector<std::vector<float>> codebooks(order);
+  codebooks[0].assign(2 * kCodebookSize, 0.0f);
+  // The index of each n-gram of the last order
+  std::unordered_map<std::string, int> index;
+  for (size_t i = 0; i < words.size(); ++i) {
+    int word = i;
+    index.emplace(Key(&word, 1), i);
+  }
+  for (int n = 1; n < order; ++n) {
+    // Sort by the index of the context, then the word
+    std::vector<std::pair<int, const Ngram*>> sorted;
+    for (const auto& ngram : ngrams[n]) {
+      auto it = index.find(Key(ngram.words.data(), n));
+      if (it == index.end()) {
+        LOG(WARNING) << "Skip the n-gram whose context is missing";
+        continue;
+      }
+      sorted.emplace_back(it->second, &ngram);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [n](const std::pair<int, const Ngram*>& a,
+                  const std::pair<int, const Ngram*>& b) {
+                if (a.first != b.first) return a.first < b.first;
+                return a.second->words[n] < b.second->words[n];
+              });
+    std::vector<float> probs, backoffs;
+    for (const auto& item : sorted) {
+      probs.push_back(item.second->prob);
+      backoffs.push_back(item.second->backoff);
+    }
+    std::vector<float> prob_codebook = Codebook(probs, kCodebookSize);
+    std::vector<float> backoff_codebook = Codebook(backoffs, kCodebookSize);
+    codebooks[n] = prob_codebook;
+    codebooks[n].insert(codebooks[n].end(), backoff_codebook.begin(),
+                        backoff_codebook.end());
+    // The children ranges of the last order
+    size_t num_parents = n == 1 ? words.size() : entries[n - 1].size() - 1;
+    std::vector<uint32_t> next(num_parents + 1, 0);
+    for (const auto& item : sorted) ++next[item.first + 1];
+    for (size_t i = 1; i < next.size(); ++i) next[i] += next[i - 1];
+    for (size_t i = 0; i < next.size(); ++i) {
+      if (n == 1) {
+        unigrams[i].next = next[i];
+      } else {
+        entries[n - 1][i].next = next[i];
+      }
+    }
+    index.clear();
+    for (const auto& item : sorted) {
+      const Ngram& ngram = *item.second;
+      Entry entry;
+      entry.word = ngram.words[n];
+      entry.next = 0;
+      entry.prob = Quantize(prob_codebook, ngram.prob);
+      entry.backoff = Quantize(backoff_codebook, ngram.backoff);
+      entry.unused = 0;
+      if (n + 1 < order) {
+        index.emplace(Key(ngram.words.data(), n + 1), entries[n].size());
+      }
+      entries[n].push_back(entry);
+    }
+    // The sentinel
+    entries[n].push_back({0, 0, 0, 0, 0});
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.order = order;
+  header.counts[0] = words.size();
+  for (int n = 1; n < order; ++n) header.counts[n] = entries[n].size() - 1;
+  std::string vocab_bytes;
+  for (const auto& word : words) {
+    vocab_bytes += word;
+    vocab_bytes += '\0';
+  }
+  header.vocab_bytes = vocab_bytes.size();
+
+  std::ofstream os(path, std::ios::binary);
+  auto write = [&os](const void* data, size_t size) {
+    os.write(static_cast<const char*>(data), size);
+    static const char kZeros[8] = {};
+    os.write(kZeros, Align(size) - size);
+  };
+  write(&header, sizeof(header));
+  for (int n = 0; n < order; ++n) {
+    write(codebooks[n].data(), codebooks[n].size() * sizeof(float));
+  }
+  write(unigrams.data(), unigrams.size() * sizeof(Unigram));
+  for (int n = 1; n < order; ++n) {
+    write(entries[n].data(), entries[n].size() * sizeof(Entry));
+  }
+  write(vocab_bytes.data(), vocab_bytes.size());
+  if (!os) {
+    LOG(ERROR) << "Error in write " << path;
+    return false;
+  }
+  return true;
+}
+
+bool NgramModel::Open(const std::string& path) {
+  Close();
+  const char* data = nullptr;
+  size_t size = 0;
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(WARNING) << "Error in open " << path;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    map_size_ = st.st_size;
+    map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map_ == nullptr || map_ == MAP_FAILED) {
+    map_ = nullptr;
+    LOG(WARNING) << "Error in mmap " << path;
+    return false;
+  }
+  data = static_cast<const char*>(map_);
+  size = map_size_;
+#else
+  std::ifstream is(path, std::ios::binary);
+  if (!is) {
+    LOG(WARNING) << "Error in open " << path;
+    return false;
+  }
+  buffer_.assign(std::istreambuf_iterator<char>(is),
+                 std::istreambuf_iterator<char>());
+  data = buffer_.data();
+  size = buffer_.size();
+#endif
+  if (!Parse(data, size)) {
+    LOG(WARNING) << path << " is not a valid n-gram model";
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool NgramModel::Parse(const char* data, size_t size) {
+  if (size < sizeof(Header)) return false;
+  header_ = reinterpret_cast<const Header*>(data);
+  if (memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header_->version != kVersion || header_->order == 0 ||
+      header_->order > kMaxOrder || header_->counts[0] == 0) {
+    return false;
+  }
+  size_t offset = Align(sizeof(Header));
+  size_t codebooks_size = header_->order * 2 * kCodebookSize * sizeof(float);
+  size_t total = offset + Align(codebooks_size) +
+                 Align((header_->counts[0] + 1) * sizeof(Unigram));
+  for (uint32_t n = 1; n < header_->order; ++n) {
+    total += Align((header_->counts[n] + 1) * sizeof(Entry));
+  }
+  total += header_->vocab_bytes;
+  if (total > size) return false;
+
+  codebooks_ = reinterpret_cast<const float*>(data + offset);
+  offset += Align(codebooks_size);
+  unigrams_ = reinterpret_cast<const Unigram*>(data + offset);
+  offset += Align((header_->counts[0] + 1) * sizeof(Unigram));
+  for (uint32_t n = 1; n < header_->order; ++n) {
+    entries_[n] = reinterpret_cast<const Entry*>(data + offset);
+    offset += Align((header_->counts[n] + 1) * sizeof(Entry));
+  }
+  const char* vocab = data + offset;
+  const char* end = vocab + header_->vocab_bytes;
+  for (int id = 0; vocab < end; ++id) {
+    size_t length = strnlen(vocab, end - vocab);
+    vocab_.emplace(std::string(vocab, length), id);
+    vocab += length + 1;
+  }
+  if (vocab_.size() != header_->counts[0]) return false;
+  bos_ = WordId("<s>");
+  eos_ = WordId("</s>");
+  return true;
+}
+
+void NgramModel::Close() {
+#ifndef _WIN32
+  if (map_ != nullptr) munmap(map_, map_size_);
+#endif
+  map_ = nullptr;
+  map_size_ = 0;
+  buffer_.clear();
+  header_ = nullptr;
+  unigrams_ = nullptr;
+  std::fill_n(entries_, kMaxOrder, nullptr);
+  codebooks_ = nullptr;
+  vocab_.clear();
+  bos_ = eos_ = -1;
+}
+
+int NgramModel::order() const {
+  return header_ != nullptr ? header_->order : 0;
+}
+
+int NgramModel::num_words() const {
+  return header_ != nullptr ? header_->counts[0] : 0;
+}
+
+int NgramModel::WordId(const std::string& word) const {
+  auto it = vocab_.find(word);
+  return it == vocab_.end() ? kUnk : it->second;
+}
+
+int NgramModel::Find(const int* words, int n) const {
+  if (words[0] < 0 || words[0] >= num_words()) return -1;
+  int index = words[0];
+  uint32_t begin = unigrams_[index].next;
+  uint32_t end = unigrams_[index + 1].next;
+  for (int i = 1; i < n; ++i) {
+    const Entry* entries = entries_[i];
+    const Entry* it = std::lower_bound(
+        entries + begin, entries + end, words[i],
+        [](const Entry& entry, int word) {
+          return entry.word < static_cast<uint32_t>(word);
+        });
+    if (it == entries + end || it->word != static_cast<uint32_t>(words[i])) {
+      return -1;
+    }
+    index = it - entries;
+    if (i + 1 < n) {
+      begin = entries[index].next;
+      end = entries[index + 1].next;
+    }
+  }
+  return index;
+}
+
+float NgramModel::Prob(int n, int index) const {
+  if (n == 0) return unigrams_[index].prob;
+  return codebooks_[n * 2 * kCodebookSize + entries_[n][index].prob];
+}
+
+float NgramModel::Backoff(int n, int index) const {
+  if (n == 0) return unigrams_[index].backoff;
+  return codebooks_[(n * 2 + 1) * kCodebookSize + entries_[n][index].backoff];
+}
+
+float NgramModel::LogProb(const std::vector<int>& history, int word) const {
+  int n = std::min<int>(history.size(), order() - 1);
+  int words[kMaxOrder];
+  std::copy(history.end() - n, history.end(), words);
+  float backoff = 0;
+  // The n-grams of the last len words of the history and word, and the
+  // backoff of the context if it's missing
+  for (int len = n; len >= 0; --len) {
+    const int* ngram = words + n - len;
+    words[n] = word;
+    int index = Find(ngram, len + 1);
+    if (index >= 0) return backoff + Prob(len, index);
+    if (len > 0) {
+      int context = Find(ngram, len);
+      if (context >= 0) backoff += Backoff(len - 1, context);
+    }
+  }
+  return backoff + Prob(0, kUnk);
+}
+
+void Lexicon::Add(const std::vector<int>& units, int word) {
+  int node = kRoot;
+  for (int unit : units) {
+    int child = Child(node, unit);
+    if (child < 0) {
+      child = nodes_.size();
+      nodes_.emplace_back();
+      nodes_[child].parent = node;
+      ++nodes_[node].num_children;
+      children_.emplace(Key(node, unit), child);
+    }
+    node = child;
+  }
+  if (node != kRoot && nodes_[node].word < 0) nodes_[node].word = word;
+}
+
+void Lexicon::Smear(const NgramModel& model) {
+  // The children are after their parents
+  for (auto& node : nodes_) node.smear = -kFloatMax;
+  for (int i = nodes_.size() - 1; i > kRoot; --i) {
+    Node& node = nodes_[i];
+    if (node.word >= 0) {
+      node.smear = std::max(node.smear, model.LogProb({}, node.word));
+    }
+    Node& parent = nodes_[node.parent];
+    parent.smear = std::max(parent.smear, node.smear);
+  }
+}
+
+WordNgramLanguageModel::WordNgramLanguageModel(
+    std::shared_ptr<const NgramModel> model,
+    std::shared_ptr<const Lexicon> lexicon)
+    : model_(std::move(model)), lexicon_(std::move(lexicon)) {
+  Reset();
+}
+
+void WordNgramLanguageModel::Reset() {
+  states_.clear();
+  State start;
+  if (model_->bos() >= 0) start.history.push_back(model_->bos());
+  start.node = Lexicon::kRoot;
+  start.smear = 0;
+  states_.push_back(std::move(start));
+}
+
+float WordNgramLanguageModel::Commit(int word, State* state) const {
+  float delta = model_->LogProb(state->history, word) - state->smear;
+  state->history.push_back(word);
+  int max_history = std::max(model_->order() - 1, 0);
+  if (static_cast<int>(state->history.size()) > max_history) {
+    state->history.erase(state->history.begin(),
+                         state->history.end() - max_history);
+  }
+  state->node = Lexicon::kRoot;
+  state->smear = 0;
+  return delta;
+}
+
+float WordNgramLanguageModel::Advance(int unit, State* state) const {
+  float delta = 0;
+  int child = lexicon_->Child(state->node, unit);
+  if (child < 0 && state->node != Lexicon::kRoot) {
+    // The pending word ends before the unit
+    int word = lexicon_->word(state->node);
+    delta += Commit(word >= 0 ? word : NgramModel::kUnk, state);
+    child = lexicon_->Child(Lexicon::kRoot, unit);
+  }
+  if (child < 0) return delta + Commit(NgramModel::kUnk, state);
+  if (lexicon_->leaf(child)) {
+    return delta + Commit(lexicon_->word(child), state);
+  }
+  delta += lexicon_->smear(child) - state->smear;
+  state->node = child;
+  state->smear = lexicon_->smear(child);
+  return delta;
+}
+
+void WordNgramLanguageModel::Score(const std::vector<int>& states,
+                                   const std::vector<int>& tokens,
+                                   std::vector<float>* log_probs,
+                                   std::vector<int>* next_states) {
+  CHECK_EQ(states.size(), tokens.size());
+  log_probs->resize(states.size());
+  next_states->resize(states.size());
+  for (size_t i = 0; i < states.size(); ++i) {
+    State state = states_[states[i]];
+    (*log_probs)[i] = Advance(tokens[i], &state);
+    (*next_states)[i] = states_.size();
+    states_.push_back(std::move(state));
+  }
+}
+
+}  // namespace wenet
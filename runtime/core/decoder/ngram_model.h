@@ -0,0 +1,191 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_NGRAM_MODEL_H_
+#define DECODER_NGRAM_MODEL_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "decoder/language_model.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// NgramModel is a word n-gram model in a binary trie, which is built from an
+// ARPA file once by Build(), e.g. by bin/build_ngram_main, and is memory
+// mapped by Open(), so it loads almost at once and the processes loading it
+// share its pages, without the arpa2fst and the determinization of TLG.
+// As the trie of KenLM, the n-grams of each order are an array, in which the
+// children of an (n-1)-gram are a range sorted by the word, and are found by
+// binary search. The log probs and backoffs above the unigrams are quantized
+// to 8 bits by a codebook of each order.
+class NgramModel {
+ public:
+  static const int kMaxOrder = 8;
+  // <unk>, which is added if the ARPA file doesn't have it
+  static const int kUnk = 0;
+
+  NgramModel() = default;
+  ~NgramModel() { Close(); }
+
+  // Return false if the file can't be read or is not a valid model
+  bool Open(const std::string& path);
+  void Close();
+  // Build the model of arpa_path to path, return false on failure
+  static bool Build(const std::string& arpa_path, const std::string& path);
+
+  int order() const;
+  int num_words() const;
+  // kUnk if the word is not in the vocabulary
+  int WordId(const std::string& word) const;
+  int bos() const { return bos_; }
+  int eos() const { return eos_; }
+  // The natural log prob of word after history, which is oldest first, of
+  // which the last order() - 1 words are used
+  float LogProb(const std::vector<int>& history, int word) const;
+
+ private:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    // Number of the n-grams of each order
+    uint64_t counts[kMaxOrder];
+    uint64_t vocab_bytes;
+  };
+  // The children of an n-gram i are [next of i, next of i + 1) of the next
+  // order, and each order has a sentinel at the end
+  struct Unigram {
+    float prob;
+    float backoff;
+    uint32_t next;
+  };
+  struct Entry {
+    uint32_t word;
+    uint32_t next;
+    // Indexes of the codebooks of the order
+    uint8_t prob;
+    uint8_t backoff;
+    uint16_t unused;
+  };
+  static const int kCodebookSize = 256;
+
+  bool Parse(const char* data, size_t size);
+  // The index of the n-gram words[0, n) in its order, -1 if there isn't
+  int Find(const int* words, int n) const;
+  // Of the n-gram of order n + 1
+  float Prob(int n, int index) const;
+  float Backoff(int n, int index) const;
+
+  const Header* header_ = nullptr;
+  const Unigram* unigrams_ = nullptr;
+  const Entry* entries_[kMaxOrder] = {};
+  // order() x 2 x kCodebookSize, the probs and the backoffs of each order
+  const float* codebooks_ = nullptr;
+  std::unordered_map<std::string, int> vocab_;
+  int bos_ = -1;
+  int eos_ = -1;
+  void* map_ = nullptr;
+  size_t map_size_ = 0;
+  // The file content if it's not mapped
+  std::vector<char> buffer_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(NgramModel);
+};
+
+// Lexicon is the trie of the units of the words of a NgramModel, by which
+// the units of the prefixes of CtcPrefixBeamSearch are mapped to the words.
+class Lexicon {
+ public:
+  static const int kRoot = 0;
+
+  Lexicon() : nodes_(1) {}
+  // The first word of the same units is kept
+  void Add(const std::vector<int>& units, int word);
+  // Set the smear of the nodes by the unigrams of model, after all the words
+  // are added
+  void Smear(const NgramModel& model);
+
+  // -1 if there isn't
+  int Child(int node, int unit) const {
+    auto it = children_.find(Key(node, unit));
+    return it == children_.end() ? -1 : it->second;
+  }
+  // The word ending at node, -1 if there isn't
+  int word(int node) const { return nodes_[node].word; }
+  bool leaf(int node) const { return nodes_[node].num_children == 0; }
+  // The max unigram log prob of the words under node
+  float smear(int node) const { return nodes_[node].smear; }
+
+ private:
+  struct Node {
+    int word = -1;
+    int parent = -1;
+    int num_children = 0;
+    float smear = -kFloatMax;
+  };
+  static int64_t Key(int node, int unit) {
+    return (static_cast<int64_t>(node) << 32) | static_cast<uint32_t>(unit);
+  }
+
+  std::vector<Node> nodes_;
+  std::unordered_map<int64_t, int> children_;
+};
+
+// The LanguageModel of the units by the words of a NgramModel. The units of
+// a prefix are matched with the Lexicon, the longest word is committed when
+// the next unit doesn't extend it, and the unmatched units are <unk>. The
+// word of the pending units is scored by the smear of its lexicon node, which
+// is replaced by the n-gram log prob when it's committed, so the prefixes in
+// the middle of a word are not penalized against the others.
+class WordNgramLanguageModel : public LanguageModel {
+ public:
+  WordNgramLanguageModel(std::shared_ptr<const NgramModel> model,
+                         std::shared_ptr<const Lexicon> lexicon);
+
+  int Start() override { return 0; }
+  void Score(const std::vector<int>& states, const std::vector<int>& tokens,
+             std::vector<float>* log_probs,
+             std::vector<int>* next_states) override;
+  void Reset() override;
+  std::shared_ptr<LanguageModel> Copy() const override {
+    return std::make_shared<WordNgramLanguageModel>(model_, lexicon_);
+  }
+
+ private:
+  struct State {
+    // The last order - 1 words
+    std::vector<int> history;
+    // The lexicon node of the pending units
+    int node;
+    float smear;
+  };
+  // Return the delta of the log prob
+  float Commit(int word, State* state) const;
+  float Advance(int unit, State* state) const;
+
+  std::shared_ptr<const NgramModel> model_;
+  std::shared_ptr<const Lexicon> lexicon_;
+  // The states of the utterance, 0 is the start
+  std::vector<State> states_;
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_NGRAM_MODEL_H_
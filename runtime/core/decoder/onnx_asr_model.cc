@@ -19,19 +19,250 @@
 #include "decoder/onnx_asr_model.h"
 
 #include <algorithm>
+#include <cmath>
+#include <map>
 #include <memory>
+#include <string>
 #include <utility>
 
+#ifdef __ANDROID__
+#include "nnapi_provider_factory.h"  // NOLINT
+#endif
+#ifdef USE_ACL
+#include "acl_provider_factory.h"  // NOLINT
+#endif
+
+#include "utils/file.h"
+#include "utils/metrics.h"
 #include "utils/string.h"
 
 namespace wenet {
 
 Ort::Env OnnxAsrModel::env_ = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "");
 Ort::SessionOptions OnnxAsrModel::session_options_ = Ort::SessionOptions();
+std::string OnnxAsrModel::optimized_model_dir_;  // NOLINT
+bool OnnxAsrModel::has_providers_ = false;
+
+void OnnxAsrModel::InitEngineThreads(int num_threads,
+                                     bool global_thread_pool) {
+  if (global_thread_pool) {
+    const OrtApi& api = Ort::GetApi();
+    OrtThreadingOptions* threading_options = nullptr;
+    Ort::ThrowOnError(api.CreateThreadingOptions(&threading_options));
+    Ort::ThrowOnError(
+        api.SetGlobalIntraOpNumThreads(threading_options, num_threads));
+    Ort::ThrowOnError(
+        api.SetGlobalInterOpNumThreads(threading_options, num_threads));
+    // The environment is a singleton, so the old one is released before the
+    // one with the global threads is created
+    env_ = Ort::Env(nullptr);
+    env_ = Ort::Env(threading_options, ORT_LOGGING_LEVEL_WARNING, "");
+    api.ReleaseThreadingOptions(threading_options);
+    session_options_.DisablePerSessionThreads();
+    LOG(INFO) << "Run the onnx sessions on " << num_threads
+              << " global threads";
+  } else {
+    session_options_.SetIntraOpNumThreads(num_threads);
+    session_options_.SetInterOpNumThreads(num_threads);
+  }
+}
+
+namespace {
+
+// The CPU allocator of onnxruntime by HugePageAllocator::Instance()
+struct HugePageOrtAllocator : public OrtAllocator {
+  HugePageOrtAllocator() {
+    version = ORT_API_VERSION;
+    OrtAllocator::Alloc = [](OrtAllocator* self, size_t size) {
+      return HugePageAllocator::Instance().Allocate(size);
+    };
+    OrtAllocator::Free = [](OrtAllocator* self, void* data) {
+      HugePageAllocator::Free(data);
+    };
+    OrtAllocator::Info = [](const OrtAllocator* self) {
+      return static_cast<const OrtMemoryInfo*>(
+          static_cast<const HugePageOrtAllocator*>(self)->info);
+    };
+    Ort::ThrowOnError(Ort::GetApi().CreateCpuMemoryInfo(
+        OrtDeviceAllocator, OrtMemTypeDefault, &info));
+  }
+  OrtMemoryInfo* info = nullptr;
+};
+
+}  // namespace
 
-void OnnxAsrModel::InitEngineThreads(int num_threads) {
-  session_options_.SetIntraOpNumThreads(num_threads);
-  session_options_.SetInterOpNumThreads(num_threads);
+void OnnxAsrModel::UseHugePages(HugePageSize page_size) {
+  HugePageAllocator::Instance().set_page_size(page_size);
+  if (page_size == HugePageSize::kNone) return;
+  // Never released, the environment holds it
+  static HugePageOrtAllocator* allocator = new HugePageOrtAllocator();
+  Ort::ThrowOnError(Ort::GetApi().RegisterAllocator(env_, allocator));
+  session_options_.AddConfigEntry("session.use_env_allocators", "1");
+  LOG(INFO) << "Allocate the onnx tensors by the huge pages";
+}
+
+void OnnxAsrModel::SetSessionOptions(const OnnxSessionOptions& opts) {
+  static const std::map<std::string, GraphOptimizationLevel> kLevels = {
+      {"disable", ORT_DISABLE_ALL},
+      {"basic", ORT_ENABLE_BASIC},
+      {"extended", ORT_ENABLE_EXTENDED},
+      {"all", ORT_ENABLE_ALL}};
+  auto it = kLevels.find(opts.graph_optimization);
+  CHECK(it != kLevels.end())
+      << "Unknown graph optimization " << opts.graph_optimization;
+  session_options_.SetGraphOptimizationLevel(it->second);
+  if (opts.enable_mem_pattern) {
+    session_options_.EnableMemPattern();
+  } else {
+    session_options_.DisableMemPattern();
+  }
+  if (opts.enable_cpu_mem_arena) {
+    session_options_.EnableCpuMemArena();
+  } else {
+    session_options_.DisableCpuMemArena();
+  }
+  optimized_model_dir_ = opts.optimized_model_dir;
+  if (!optimized_model_dir_.empty() && has_providers_) {
+    LOG(WARNING) << "The graphs of the execution providers can't be saved, "
+                 << "ignore the optimized model dir";
+    optimized_model_dir_.clear();
+  }
+}
+
+std::shared_ptr<Ort::Session> OnnxAsrModel::CreateSession(
+    const std::string& path, const std::string& profile_prefix) {
+  std::string model_path = path;
+  Ort::SessionOptions options = session_options_.Clone();
+  if (!profile_prefix.empty()) {
+#ifdef _MSC_VER
+    options.EnableProfiling(ToWString(profile_prefix).c_str());
+#else
+    options.EnableProfiling(profile_prefix.c_str());
+#endif
+  }
+  if (!optimized_model_dir_.empty()) {
+    // e.g. encoder.quant.onnx is saved as encoder.quant.opt.onnx
+    std::string name = path.substr(path.find_last_of("/\\") + 1);
+    const std::string suffix = ".onnx";
+    if (name.size() > suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) ==
+            0) {
+      name.resize(name.size() - suffix.size());
+    }
+    std::string cache_path = JoinPath(optimized_model_dir_, name + ".opt.onnx");
+    if (FileUpToDate(cache_path, path)) {
+      LOG(INFO) << "Read the optimized model " << cache_path;
+      model_path = cache_path;
+      options.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+    } else {
+      LOG(INFO) << "Save the optimized model " << cache_path;
+#ifdef _MSC_VER
+      options.SetOptimizedModelFilePath(ToWString(cache_path).c_str());
+#else
+      options.SetOptimizedModelFilePath(cache_path.c_str());
+#endif
+    }
+  }
+#ifdef _MSC_VER
+  return std::make_shared<Ort::Session>(env_, ToWString(model_path).c_str(),
+                                        options);
+#else
+  return std::make_shared<Ort::Session>(env_, model_path.c_str(), options);
+#endif
+}
+
+void OnnxAsrModel::set_profile_prefix(const std::string& prefix) {
+  if (prefix == profile_prefix_) return;
+  if (!profile_prefix_.empty()) {
+    Ort::AllocatorWithDefaultOptions allocator;
+    for (const auto& session :
+         {encoder_session_, rescore_session_, ctc_session_}) {
+      if (session == nullptr) continue;
+      auto profile = session->EndProfilingAllocated(allocator);
+      LOG(INFO) << "The onnx profile is written to " << profile.get();
+    }
+    encoder_session_ = shared_encoder_session_;
+    rescore_session_ = shared_rescore_session_;
+    ctc_session_ = shared_ctc_session_;
+    shared_encoder_session_ = nullptr;
+    shared_rescore_session_ = nullptr;
+    shared_ctc_session_ = nullptr;
+  }
+  profile_prefix_ = prefix;
+  if (!prefix.empty()) {
+    shared_encoder_session_ = encoder_session_;
+    shared_rescore_session_ = rescore_session_;
+    shared_ctc_session_ = ctc_session_;
+    encoder_session_ = CreateSession(encoder_path_, prefix + ".encoder");
+    if (rescore_session_ != nullptr) {
+      rescore_session_ = CreateSession(rescore_path_, prefix + ".decoder");
+    }
+    if (ctc_session_ != nullptr) {
+      ctc_session_ = CreateSession(ctc_path_, prefix + ".ctc");
+    }
+  }
+  // The bindings are of the sessions
+  if (encoder_binding_ != nullptr) {
+    encoder_binding_ = std::make_shared<Ort::IoBinding>(*encoder_session_);
+    if (ctc_session_ != nullptr) {
+      ctc_binding_ = std::make_shared<Ort::IoBinding>(*ctc_session_);
+    }
+  }
+}
+
+int OnnxAsrModel::AppendExecutionProviders(
+    const std::vector<std::string>& names, int num_threads, bool fp16) {
+  int num_appended = 0;
+  std::vector<std::string> available = Ort::GetAvailableProviders();
+  auto is_available = [&available](const std::string& provider) {
+    return std::find(available.begin(), available.end(), provider) !=
+           available.end();
+  };
+  for (const std::string& name : names) {
+    if (name == "xnnpack") {
+      if (!is_available("XnnpackExecutionProvider")) {
+        LOG(WARNING) << "XNNPACK is not available, fall back to CPU";
+        continue;
+      }
+      // XNNPACK has its own thread pool, so the intra-op threads of ORT
+      // should be 1 to not oversubscribe the cores
+      session_options_.AppendExecutionProvider(
+          "XNNPACK", {{"intra_op_num_threads", std::to_string(num_threads)}});
+    } else if (name == "nnapi") {
+#ifdef __ANDROID__
+      if (!is_available("NnapiExecutionProvider")) {
+        LOG(WARNING) << "NNAPI is not available, fall back to CPU";
+        continue;
+      }
+      uint32_t flags = NNAPI_FLAG_CPU_DISABLED;
+      if (fp16) flags |= NNAPI_FLAG_USE_FP16;
+      Ort::ThrowOnError(OrtSessionOptionsAppendExecutionProvider_Nnapi(
+          session_options_, flags));
+#else
+      LOG(WARNING) << "NNAPI is only for Android, fall back to CPU";
+      continue;
+#endif
+    } else if (name == "acl") {
+#ifdef USE_ACL
+      if (!is_available("ACLExecutionProvider")) {
+        LOG(WARNING) << "ACL is not available, fall back to CPU";
+        continue;
+      }
+      Ort::ThrowOnError(
+          OrtSessionOptionsAppendExecutionProvider_ACL(session_options_, 1));
+#else
+      LOG(WARNING) << "ACL requires the onnxruntime built with it and "
+                   << "USE_ACL, fall back to CPU";
+      continue;
+#endif
+    } else {
+      LOG(FATAL) << "Unknown execution provider " << name;
+    }
+    has_providers_ = true;
+    ++num_appended;
+    LOG(INFO) << "Append execution provider " << name;
+  }
+  return num_appended;
 }
 
 void OnnxAsrModel::GetInputOutputInfo(
@@ -78,28 +309,49 @@ void OnnxAsrModel::GetInputOutputInfo(
   }
 }
 
-void OnnxAsrModel::Read(const std::string& model_dir) {
-  std::string encoder_onnx_path = model_dir + "/encoder.onnx";
-  std::string rescore_onnx_path = model_dir + "/decoder.onnx";
-  std::string ctc_onnx_path = model_dir + "/ctc.onnx";
+void OnnxAsrModel::Read(const std::string& model_dir, bool quantized,
+                        bool ctc_only) {
+  const std::string suffix = quantized ? ".quant.onnx" : ".onnx";
+  std::string encoder_onnx_path = model_dir + "/encoder" + suffix;
+  std::string rescore_onnx_path = model_dir + "/decoder" + suffix;
+  std::string ctc_onnx_path = model_dir + "/ctc" + suffix;
+  // The fused graph of encoder and ctc, which is preferred if present
+  std::string encoder_ctc_onnx_path = model_dir + "/encoder_ctc" + suffix;
+  // The split graphs of the early exit
+  std::string late_onnx_path = model_dir + "/encoder_late" + suffix;
+  bool early_exit = early_exit_threshold_ > 0;
+  bool fused = !early_exit && FileExists(encoder_ctc_onnx_path);
+  if (early_exit) {
+    encoder_onnx_path = model_dir + "/encoder_early" + suffix;
+    CHECK(FileExists(encoder_onnx_path) && FileExists(late_onnx_path))
+        << "No early exit graphs " << encoder_onnx_path << " and "
+        << late_onnx_path;
+    LOG(INFO) << "Exit early at " << encoder_onnx_path << " of threshold "
+              << early_exit_threshold_;
+  }
+  if (fused) {
+    LOG(INFO) << "Use fused encoder and ctc graph " << encoder_ctc_onnx_path;
+    encoder_onnx_path = encoder_ctc_onnx_path;
+  }
+  if (quantized) {
+    CHECK(FileExists(encoder_onnx_path))
+        << "No int8 model " << encoder_onnx_path;
+    LOG(INFO) << "Use int8 models " << encoder_onnx_path;
+  }
 
   // 1. Load sessions
   try {
-#ifdef _MSC_VER
-    encoder_session_ = std::make_shared<Ort::Session>(
-        env_, ToWString(encoder_onnx_path).c_str(), session_options_);
-    rescore_session_ = std::make_shared<Ort::Session>(
-        env_, ToWString(rescore_onnx_path).c_str(), session_options_);
-    ctc_session_ = std::make_shared<Ort::Session>(
-        env_, ToWString(ctc_onnx_path).c_str(), session_options_);
-#else
-    encoder_session_ = std::make_shared<Ort::Session>(
-        env_, encoder_onnx_path.c_str(), session_options_);
-    rescore_session_ = std::make_shared<Ort::Session>(
-        env_, rescore_onnx_path.c_str(), session_options_);
-    ctc_session_ = std::make_shared<Ort::Session>(env_, ctc_onnx_path.c_str(),
-                                                  session_options_);
-#endif
+    encoder_session_ = CreateSession(encoder_onnx_path);
+    encoder_path_ = encoder_onnx_path;
+    if (!ctc_only) {
+      rescore_session_ = CreateSession(rescore_onnx_path);
+      rescore_path_ = rescore_onnx_path;
+    }
+    if (!fused) {
+      ctc_session_ = CreateSession(ctc_onnx_path);
+      ctc_path_ = ctc_onnx_path;
+    }
+    if (early_exit) late_session_ = CreateSession(late_onnx_path);
   } catch (std::exception const& e) {
     LOG(ERROR) << "error when load onnx model: " << e.what();
     exit(0);
@@ -159,10 +411,47 @@ void OnnxAsrModel::Read(const std::string& model_dir) {
   // 3. Read model nodes
   LOG(INFO) << "Onnx Encoder:";
   GetInputOutputInfo(encoder_session_, &encoder_in_names_, &encoder_out_names_);
-  LOG(INFO) << "Onnx CTC:";
-  GetInputOutputInfo(ctc_session_, &ctc_in_names_, &ctc_out_names_);
-  LOG(INFO) << "Onnx Rescore:";
-  GetInputOutputInfo(rescore_session_, &rescore_in_names_, &rescore_out_names_);
+  if (fused) {
+    // Outputs of the fused graph: output, r_att_cache, r_cnn_cache,
+    // ctc_log_probs and the optional topk_scores, topk_indexs
+    CHECK_GE(encoder_out_names_.size(), 4);
+    ctc_log_probs_name_ = encoder_out_names_[3];
+    for (auto name : encoder_out_names_) {
+      if (!strcmp(name, "ctc_log_probs")) {
+        ctc_log_probs_name_ = name;
+      } else if (!strcmp(name, "topk_scores")) {
+        topk_scores_name_ = name;
+      } else if (!strcmp(name, "topk_indexs")) {
+        topk_indexs_name_ = name;
+      }
+    }
+    LOG(INFO) << "\ttopk outputs " << has_topk_outputs();
+  } else {
+    LOG(INFO) << "Onnx CTC:";
+    GetInputOutputInfo(ctc_session_, &ctc_in_names_, &ctc_out_names_);
+  }
+  if (early_exit) {
+    for (auto name : encoder_out_names_) {
+      if (!strcmp(name, "ctc_log_probs")) ctc_log_probs_name_ = name;
+    }
+    CHECK(ctc_log_probs_name_ != nullptr)
+        << "No intermediate ctc_log_probs of " << encoder_onnx_path;
+    late_num_blocks_ = atoi(late_session_->GetModelMetadata()
+                                .LookupCustomMetadataMapAllocated(
+                                    "num_blocks", allocator)
+                                .get());
+    LOG(INFO) << "Onnx Late Encoder:";
+    LOG(INFO) << "\tnum_blocks " << late_num_blocks_;
+    GetInputOutputInfo(late_session_, &late_in_names_, &late_out_names_);
+  }
+  has_decoder_ = !ctc_only;
+  if (ctc_only) {
+    LOG(INFO) << "Skip the attention decoder " << rescore_onnx_path;
+  } else {
+    LOG(INFO) << "Onnx Rescore:";
+    GetInputOutputInfo(rescore_session_, &rescore_in_names_,
+                       &rescore_out_names_);
+  }
 }
 
 OnnxAsrModel::OnnxAsrModel(const OnnxAsrModel& other) {
@@ -179,19 +468,41 @@ OnnxAsrModel::OnnxAsrModel(const OnnxAsrModel& other) {
   chunk_size_ = other.chunk_size_;
   num_left_chunks_ = other.num_left_chunks_;
   offset_ = other.offset_;
+  use_io_binding_ = other.use_io_binding_;
+  encoder_outs_.set_storage(other.encoder_outs_.storage());
+  has_decoder_ = other.has_decoder_;
 
-  // sessions
-  encoder_session_ = other.encoder_session_;
-  ctc_session_ = other.ctc_session_;
-  rescore_session_ = other.rescore_session_;
+  // sessions, the profiled ones of `other` are not shared
+  encoder_session_ = other.profile_prefix_.empty()
+                         ? other.encoder_session_
+                         : other.shared_encoder_session_;
+  ctc_session_ = other.profile_prefix_.empty() ? other.ctc_session_
+                                               : other.shared_ctc_session_;
+  rescore_session_ = other.profile_prefix_.empty()
+                         ? other.rescore_session_
+                         : other.shared_rescore_session_;
+  encoder_path_ = other.encoder_path_;
+  rescore_path_ = other.rescore_path_;
+  ctc_path_ = other.ctc_path_;
 
   // node names
   encoder_in_names_ = other.encoder_in_names_;
   encoder_out_names_ = other.encoder_out_names_;
   ctc_in_names_ = other.ctc_in_names_;
   ctc_out_names_ = other.ctc_out_names_;
+  ctc_log_probs_name_ = other.ctc_log_probs_name_;
+  topk_scores_name_ = other.topk_scores_name_;
+  topk_indexs_name_ = other.topk_indexs_name_;
   rescore_in_names_ = other.rescore_in_names_;
   rescore_out_names_ = other.rescore_out_names_;
+
+  // early exit, the late session is not profiled
+  early_exit_threshold_ = other.early_exit_threshold_;
+  max_exit_chunks_ = other.max_exit_chunks_;
+  late_session_ = other.late_session_;
+  late_in_names_ = other.late_in_names_;
+  late_out_names_ = other.late_out_names_;
+  late_num_blocks_ = other.late_num_blocks_;
 }
 
 std::shared_ptr<AsrModel> OnnxAsrModel::Copy() const {
@@ -201,9 +512,21 @@ std::shared_ptr<AsrModel> OnnxAsrModel::Copy() const {
   return asr_model;
 }
 
+void OnnxAsrModel::GetMemoryUsage(SessionMemory* usage) const {
+  AsrModel::GetMemoryUsage(usage);
+  usage->cache = (att_cache_.capacity() + cnn_cache_.capacity() +
+                  att_cache_back_.capacity() + cnn_cache_back_.capacity()) *
+                 sizeof(float);
+  usage->cache += (late_att_cache_.capacity() + late_cnn_cache_.capacity() +
+                   exited_outs_.capacity()) *
+                  sizeof(float);
+  usage->encoder_outs = encoder_outs_.bytes();
+}
+
 void OnnxAsrModel::Reset() {
   offset_ = 0;
-  encoder_outs_.clear();
+  chunk_out_ = Ort::Value{nullptr};
+  encoder_outs_.Clear();
   cached_feature_.clear();
   // Reset att_cache
   Ort::MemoryInfo memory_info =
@@ -233,11 +556,135 @@ void OnnxAsrModel::Reset() {
                                      cnn_module_kernel_ - 1};
   cnn_cache_ort_ = Ort::Value::CreateTensor<float>(
       memory_info, cnn_cache_.data(), cnn_cache_.size(), cnn_cache_shape, 4);
+
+  // Back buffers of the caches for IOBinding, whose shapes are fixed.
+  // The att_cache grows with every chunk if num_left_chunks_ <= 0, let
+  // onnxruntime allocate it then.
+  if (use_io_binding_) {
+    if (encoder_binding_ == nullptr) {
+      encoder_binding_ = std::make_shared<Ort::IoBinding>(*encoder_session_);
+      if (ctc_session_ != nullptr) {
+        ctc_binding_ = std::make_shared<Ort::IoBinding>(*ctc_session_);
+      }
+    }
+    if (num_left_chunks_ > 0) {
+      int required_cache_size = chunk_size_ * num_left_chunks_;
+      att_cache_back_.resize(att_cache_.size());
+      const int64_t att_cache_shape[] = {num_blocks_, head_,
+                                         required_cache_size,
+                                         encoder_output_size_ / head_ * 2};
+      att_cache_back_ort_ = Ort::Value::CreateTensor<float>(
+          memory_info, att_cache_back_.data(), att_cache_back_.size(),
+          att_cache_shape, 4);
+    } else {
+      att_cache_back_ort_ = Ort::Value{nullptr};
+    }
+    cnn_cache_back_.resize(cnn_cache_.size());
+    cnn_cache_back_ort_ = Ort::Value::CreateTensor<float>(
+        memory_info, cnn_cache_back_.data(), cnn_cache_back_.size(),
+        cnn_cache_shape, 4);
+  }
+
+  // The caches of the late graph, which are not bound
+  if (late_session_ != nullptr) {
+    int required_cache_size = std::max(chunk_size_ * num_left_chunks_, 0);
+    late_offset_ = required_cache_size;
+    late_att_cache_.assign(late_num_blocks_ * required_cache_size *
+                               encoder_output_size_ * 2,
+                           0.0);
+    const int64_t late_att_cache_shape[] = {late_num_blocks_, head_,
+                                            required_cache_size,
+                                            encoder_output_size_ / head_ * 2};
+    late_att_cache_ort_ = Ort::Value::CreateTensor<float>(
+        memory_info, late_att_cache_.data(), late_att_cache_.size(),
+        late_att_cache_shape, 4);
+    late_cnn_cache_.assign(
+        late_num_blocks_ * encoder_output_size_ * (cnn_module_kernel_ - 1),
+        0.0);
+    const int64_t late_cnn_cache_shape[] = {late_num_blocks_, 1,
+                                            encoder_output_size_,
+                                            cnn_module_kernel_ - 1};
+    late_cnn_cache_ort_ = Ort::Value::CreateTensor<float>(
+        memory_info, late_cnn_cache_.data(), late_cnn_cache_.size(),
+        late_cnn_cache_shape, 4);
+    late_out_ = Ort::Value{nullptr};
+    exited_outs_.clear();
+    num_exited_chunks_ = 0;
+  }
 }
 
-void OnnxAsrModel::ForwardEncoderFunc(
+static void WriteValue(const Ort::Value& value, StateWriter* writer) {
+  auto info = value.GetTensorTypeAndShapeInfo();
+  writer->WriteVector(info.GetShape());
+  writer->Write(value.GetTensorData<float>(), info.GetElementCount());
+}
+
+static bool ReadValue(StateReader* reader, std::vector<int64_t>* shape,
+                      std::vector<float>* data) {
+  if (!reader->ReadVector(shape)) return false;
+  const int64_t max_numel = reader->remaining() / sizeof(float);
+  int64_t numel = 1;
+  for (int64_t dim : *shape) {
+    if (dim < 0 || (dim > 0 && numel > max_numel / dim)) return false;
+    numel *= dim;
+  }
+  data->resize(numel);
+  return reader->Read(data->data(), numel);
+}
+
+bool OnnxAsrModel::SaveStateFunc(StateWriter* writer) const {
+  // The caches of the late graph lag behind the exited chunks
+  if (late_session_ != nullptr) return false;
+  WriteValue(att_cache_ort_, writer);
+  WriteValue(cnn_cache_ort_, writer);
+  // The encoder outputs are saved in fp32 as one [1, T, D] value
+  writer->Write<uint64_t>(encoder_outs_.empty() ? 0 : 1);
+  if (!encoder_outs_.empty()) {
+    std::vector<float> data(encoder_outs_.num_rows() * encoder_outs_.dim());
+    encoder_outs_.CopyTo(data.data());
+    writer->WriteVector(std::vector<int64_t>{1, encoder_outs_.num_rows(),
+                                             encoder_outs_.dim()});
+    writer->Write(data.data(), data.size());
+  }
+  return true;
+}
+
+bool OnnxAsrModel::LoadStateFunc(StateReader* reader) {
+  if (late_session_ != nullptr) return false;
+  std::vector<int64_t> shape;
+  std::vector<float> data;
+  if (!ReadValue(reader, &shape, &data) || shape.size() != 4) return false;
+  Ort::MemoryInfo memory_info =
+      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  if (num_left_chunks_ > 0) {
+    if (data.size() != att_cache_.size()) return false;
+    std::copy(data.begin(), data.end(), att_cache_.begin());
+  } else {
+    att_cache_.swap(data);
+    att_cache_ort_ = Ort::Value::CreateTensor<float>(
+        memory_info, att_cache_.data(), att_cache_.size(), shape.data(), 4);
+  }
+  if (!ReadValue(reader, &shape, &data) || data.size() != cnn_cache_.size()) {
+    return false;
+  }
+  std::copy(data.begin(), data.end(), cnn_cache_.begin());
+  uint64_t num_outs = 0;
+  if (!reader->Read(&num_outs)) return false;
+  encoder_outs_.Clear();
+  for (uint64_t i = 0; i < num_outs; ++i) {
+    if (!ReadValue(reader, &shape, &data) || shape.size() != 3 ||
+        (!encoder_outs_.empty() && shape[2] != encoder_outs_.dim())) {
+      return false;
+    }
+    encoder_outs_.Append(data.data(), shape[1], shape[2]);
+  }
+  return true;
+}
+
+void OnnxAsrModel::RunEncoder(
     const std::vector<std::vector<float>>& chunk_feats,
-    std::vector<std::vector<float>>* out_prob) {
+    const std::vector<const char*>& extra_out_names,
+    std::vector<Ort::Value>* extra_outputs) {
   Ort::MemoryInfo memory_info =
       Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
   // 1. Prepare onnx required data, splice cached_feature_ and chunk_feats
@@ -279,43 +726,308 @@ void OnnxAsrModel::ForwardEncoderFunc(
         att_mask_shape, 3);
   }
 
-  // 2. Encoder chunk forward
+  // 2. Encoder chunk forward, the first 3 outputs are always the chunk
+  // output, r_att_cache and r_cnn_cache
+  std::vector<Ort::Value> ort_outputs;
+  if (use_io_binding_) {
+    for (auto name : encoder_in_names_) {
+      if (!strcmp(name, "chunk")) {
+        encoder_binding_->BindInput(name, feats_ort);
+      } else if (!strcmp(name, "offset")) {
+        encoder_binding_->BindInput(name, offset_ort);
+      } else if (!strcmp(name, "required_cache_size")) {
+        encoder_binding_->BindInput(name, required_cache_size_ort);
+      } else if (!strcmp(name, "att_cache")) {
+        encoder_binding_->BindInput(name, att_cache_ort_);
+      } else if (!strcmp(name, "cnn_cache")) {
+        encoder_binding_->BindInput(name, cnn_cache_ort_);
+      } else if (!strcmp(name, "att_mask")) {
+        encoder_binding_->BindInput(name, att_mask_ort);
+      }
+    }
+    // The chunk output is kept in chunk_out_ for the ctc, so it is
+    // allocated by onnxruntime, the caches are written to the back buffers.
+    encoder_binding_->BindOutput(encoder_out_names_[0], memory_info);
+    if (num_left_chunks_ > 0) {
+      encoder_binding_->BindOutput(encoder_out_names_[1], att_cache_back_ort_);
+    } else {
+      encoder_binding_->BindOutput(encoder_out_names_[1], memory_info);
+    }
+    encoder_binding_->BindOutput(encoder_out_names_[2], cnn_cache_back_ort_);
+    for (auto name : extra_out_names) {
+      encoder_binding_->BindOutput(name, memory_info);
+    }
+    encoder_session_->Run(Ort::RunOptions{nullptr}, *encoder_binding_);
+    ort_outputs = encoder_binding_->GetOutputValues();
+    // Swap the front and back buffers of the caches
+    if (num_left_chunks_ > 0) {
+      std::swap(att_cache_, att_cache_back_);
+      std::swap(att_cache_ort_, att_cache_back_ort_);
+    } else {
+      att_cache_ort_ = std::move(ort_outputs[1]);
+    }
+    std::swap(cnn_cache_, cnn_cache_back_);
+    std::swap(cnn_cache_ort_, cnn_cache_back_ort_);
+    encoder_binding_->ClearBoundInputs();
+    encoder_binding_->ClearBoundOutputs();
+  } else {
+    std::vector<Ort::Value> inputs;
+    for (auto name : encoder_in_names_) {
+      if (!strcmp(name, "chunk")) {
+        inputs.emplace_back(std::move(feats_ort));
+      } else if (!strcmp(name, "offset")) {
+        inputs.emplace_back(std::move(offset_ort));
+      } else if (!strcmp(name, "required_cache_size")) {
+        inputs.emplace_back(std::move(required_cache_size_ort));
+      } else if (!strcmp(name, "att_cache")) {
+        inputs.emplace_back(std::move(att_cache_ort_));
+      } else if (!strcmp(name, "cnn_cache")) {
+        inputs.emplace_back(std::move(cnn_cache_ort_));
+      } else if (!strcmp(name, "att_mask")) {
+        inputs.emplace_back(std::move(att_mask_ort));
+      }
+    }
+    std::vector<const char*> out_names(encoder_out_names_.begin(),
+                                       encoder_out_names_.begin() + 3);
+    out_names.insert(out_names.end(), extra_out_names.begin(),
+                     extra_out_names.end());
+    ort_outputs = encoder_session_->Run(
+        Ort::RunOptions{nullptr}, encoder_in_names_.data(), inputs.data(),
+        inputs.size(), out_names.data(), out_names.size());
+    att_cache_ort_ = std::move(ort_outputs[1]);
+    cnn_cache_ort_ = std::move(ort_outputs[2]);
+  }
+
+  std::vector<int64_t> out_shape =
+      ort_outputs[0].GetTensorTypeAndShapeInfo().GetShape();
+  offset_ += static_cast<int>(out_shape[1]);
+  chunk_out_ = std::move(ort_outputs[0]);
+  // The early outputs are not rescored, see RunLateLayers
+  if (late_session_ == nullptr) {
+    encoder_outs_.Append(chunk_out_.GetTensorData<float>(), out_shape[1],
+                         out_shape[2]);
+  }
+  extra_outputs->clear();
+  for (size_t i = 3; i < ort_outputs.size(); ++i) {
+    extra_outputs->emplace_back(std::move(ort_outputs[i]));
+  }
+}
+
+void OnnxAsrModel::ForwardEncoderFunc(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<std::vector<float>>* out_prob) {
+  std::vector<Ort::Value> extra_outputs;
+  // The fused graph emits the ctc log probs in the same Run
+  if (ctc_session_ == nullptr) {
+    RunEncoder(chunk_feats, {ctc_log_probs_name_}, &extra_outputs);
+    CopyCtcProb(extra_outputs[0], out_prob);
+    return;
+  }
+
+  if (late_session_ != nullptr) {
+    ForwardEarlyExit(chunk_feats, out_prob);
+    return;
+  }
+  RunEncoder(chunk_feats, {}, &extra_outputs);
+  RunCtc(chunk_out_, out_prob);
+}
+
+void OnnxAsrModel::RunCtc(const Ort::Value& chunk_out,
+                          std::vector<std::vector<float>>* out_prob) {
+  if (use_io_binding_) {
+    Ort::MemoryInfo memory_info =
+        Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+    int num_outputs =
+        static_cast<int>(chunk_out.GetTensorTypeAndShapeInfo().GetShape()[1]);
+    ctc_binding_->BindInput(ctc_in_names_[0], chunk_out);
+    // The ctc output only lives in this call, reuse one buffer for it
+    int64_t vocab_size = ctc_session_->GetOutputTypeInfo(0)
+                             .GetTensorTypeAndShapeInfo()
+                             .GetShape()[2];
+    Ort::Value ctc_prob_ort{nullptr};
+    if (vocab_size > 0) {
+      ctc_prob_.resize(num_outputs * vocab_size);
+      const int64_t ctc_prob_shape[] = {1, num_outputs, vocab_size};
+      ctc_prob_ort = Ort::Value::CreateTensor<float>(
+          memory_info, ctc_prob_.data(), ctc_prob_.size(), ctc_prob_shape, 3);
+      ctc_binding_->BindOutput(ctc_out_names_[0], ctc_prob_ort);
+    } else {
+      ctc_binding_->BindOutput(ctc_out_names_[0], memory_info);
+    }
+    ctc_session_->Run(Ort::RunOptions{nullptr}, *ctc_binding_);
+    std::vector<Ort::Value> ctc_ort_outputs = ctc_binding_->GetOutputValues();
+    ctc_binding_->ClearBoundInputs();
+    ctc_binding_->ClearBoundOutputs();
+    CopyCtcProb(ctc_ort_outputs[0], out_prob);
+  } else {
+    std::vector<Ort::Value> ctc_ort_outputs = ctc_session_->Run(
+        Ort::RunOptions{nullptr}, ctc_in_names_.data(), &chunk_out, 1,
+        ctc_out_names_.data(), ctc_out_names_.size());
+    CopyCtcProb(ctc_ort_outputs[0], out_prob);
+  }
+}
+
+// The min over the frames of the max posterior of each
+static float MinMaxPosterior(const Ort::Value& ctc_prob) {
+  auto shape = ctc_prob.GetTensorTypeAndShapeInfo().GetShape();
+  const float* logp = ctc_prob.GetTensorData<float>();
+  float min_logp = 0.0;
+  for (int64_t i = 0; i < shape[1]; ++i) {
+    const float* frame = logp + i * shape[2];
+    min_logp = std::min(min_logp, *std::max_element(frame, frame + shape[2]));
+  }
+  return std::exp(min_logp);
+}
+
+void OnnxAsrModel::ForwardEarlyExit(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<std::vector<float>>* out_prob) {
+  static Counter* num_chunks = Metrics::Instance().GetCounter(
+      "wenet_encoder_chunks_total",
+      "Number of the chunks forwarded by the early exit encoder");
+  static Counter* num_exits = Metrics::Instance().GetCounter(
+      "wenet_encoder_early_exits_total",
+      "Number of the chunks exited at the early graph");
+  static Counter* num_layers = Metrics::Instance().GetCounter(
+      "wenet_encoder_layers_total",
+      "Number of the encoder layers run of the chunks of the early exit "
+      "encoder, the late ones of an exited chunk are counted once they run");
+  std::vector<Ort::Value> extra_outputs;
+  RunEncoder(chunk_feats, {ctc_log_probs_name_}, &extra_outputs);
+  num_chunks->Increment();
+  num_layers->Increment(num_blocks_);
+  if (num_exited_chunks_ < max_exit_chunks_) {
+    float confidence = MinMaxPosterior(extra_outputs[0]);
+    VLOG(2) << "Early exit confidence " << confidence;
+    if (confidence >= early_exit_threshold_) {
+      auto info = chunk_out_.GetTensorTypeAndShapeInfo();
+      const float* data = chunk_out_.GetTensorData<float>();
+      exited_outs_.insert(exited_outs_.end(), data,
+                          data + info.GetElementCount());
+      ++num_exited_chunks_;
+      num_exits->Increment();
+      CopyCtcProb(extra_outputs[0], out_prob);
+      return;
+    }
+  }
+  num_layers->Increment(late_num_blocks_ * (num_exited_chunks_ + 1));
+  RunLateLayers(true);
+  // The ctc of the frames of the chunk, the last ones of the late output
+  Ort::MemoryInfo memory_info =
+      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  auto late_shape = late_out_.GetTensorTypeAndShapeInfo().GetShape();
+  const int64_t num_outputs =
+      chunk_out_.GetTensorTypeAndShapeInfo().GetShape()[1];
+  const int64_t shape[] = {1, num_outputs, late_shape[2]};
+  float* data = late_out_.GetTensorMutableData<float>() +
+                (late_shape[1] - num_outputs) * late_shape[2];
+  Ort::Value chunk_out = Ort::Value::CreateTensor<float>(
+      memory_info, data, num_outputs * late_shape[2], shape, 3);
+  RunCtc(chunk_out, out_prob);
+}
+
+void OnnxAsrModel::RunLateLayers(bool with_chunk) {
+  Ort::MemoryInfo memory_info =
+      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  std::vector<float> hidden;
+  hidden.swap(exited_outs_);
+  if (with_chunk) {
+    const float* data = chunk_out_.GetTensorData<float>();
+    hidden.insert(hidden.end(), data,
+                  data + chunk_out_.GetTensorTypeAndShapeInfo()
+                             .GetElementCount());
+  }
+  num_exited_chunks_ = 0;
+  if (hidden.empty()) return;
+  const int64_t num_frames = hidden.size() / encoder_output_size_;
+  const int64_t hidden_shape[] = {1, num_frames, encoder_output_size_};
+  int64_t offset = late_offset_;
+  int64_t required_cache_size = chunk_size_ * num_left_chunks_;
+  // The frames of the cache of the chunks before are valid, as in
+  // RunEncoder, and the exited chunks are one chunk of the late graph
+  std::vector<uint8_t> att_mask;
+  Ort::Value att_mask_ort{nullptr};
+  if (num_left_chunks_ > 0) {
+    att_mask.assign(required_cache_size + num_frames, 1);
+    int64_t num_invalid = std::max<int64_t>(
+        0, 2 * required_cache_size - late_offset_);
+    std::fill(att_mask.begin(), att_mask.begin() + num_invalid, 0);
+    const int64_t att_mask_shape[] = {
+        1, 1, static_cast<int64_t>(att_mask.size())};
+    att_mask_ort = Ort::Value::CreateTensor<bool>(
+        memory_info, reinterpret_cast<bool*>(att_mask.data()), att_mask.size(),
+        att_mask_shape, 3);
+  }
   std::vector<Ort::Value> inputs;
-  for (auto name : encoder_in_names_) {
+  for (auto name : late_in_names_) {
     if (!strcmp(name, "chunk")) {
-      inputs.emplace_back(std::move(feats_ort));
+      inputs.emplace_back(Ort::Value::CreateTensor<float>(
+          memory_info, hidden.data(), hidden.size(), hidden_shape, 3));
     } else if (!strcmp(name, "offset")) {
-      inputs.emplace_back(std::move(offset_ort));
+      inputs.emplace_back(Ort::Value::CreateTensor<int64_t>(
+          memory_info, &offset, 1, std::vector<int64_t>{}.data(), 0));
     } else if (!strcmp(name, "required_cache_size")) {
-      inputs.emplace_back(std::move(required_cache_size_ort));
+      inputs.emplace_back(Ort::Value::CreateTensor<int64_t>(
+          memory_info, &required_cache_size, 1, std::vector<int64_t>{}.data(),
+          0));
     } else if (!strcmp(name, "att_cache")) {
-      inputs.emplace_back(std::move(att_cache_ort_));
+      inputs.emplace_back(std::move(late_att_cache_ort_));
     } else if (!strcmp(name, "cnn_cache")) {
-      inputs.emplace_back(std::move(cnn_cache_ort_));
+      inputs.emplace_back(std::move(late_cnn_cache_ort_));
     } else if (!strcmp(name, "att_mask")) {
       inputs.emplace_back(std::move(att_mask_ort));
     }
   }
+  std::vector<Ort::Value> ort_outputs = late_session_->Run(
+      Ort::RunOptions{nullptr}, late_in_names_.data(), inputs.data(),
+      inputs.size(), late_out_names_.data(), 3);
+  late_att_cache_ort_ = std::move(ort_outputs[1]);
+  late_cnn_cache_ort_ = std::move(ort_outputs[2]);
+  late_out_ = std::move(ort_outputs[0]);
+  auto out_shape = late_out_.GetTensorTypeAndShapeInfo().GetShape();
+  late_offset_ += static_cast<int>(out_shape[1]);
+  encoder_outs_.Append(late_out_.GetTensorData<float>(), out_shape[1],
+                       out_shape[2]);
+}
 
-  std::vector<Ort::Value> ort_outputs = encoder_session_->Run(
-      Ort::RunOptions{nullptr}, encoder_in_names_.data(), inputs.data(),
-      inputs.size(), encoder_out_names_.data(), encoder_out_names_.size());
-
-  offset_ += static_cast<int>(
-      ort_outputs[0].GetTensorTypeAndShapeInfo().GetShape()[1]);
-  att_cache_ort_ = std::move(ort_outputs[1]);
-  cnn_cache_ort_ = std::move(ort_outputs[2]);
-
-  std::vector<Ort::Value> ctc_inputs;
-  ctc_inputs.emplace_back(std::move(ort_outputs[0]));
+void OnnxAsrModel::ForwardEncoderTopKFunc(
+    const FeatureView& chunk_feats, int k,
+    std::vector<std::vector<float>>* topk_scores,
+    std::vector<std::vector<int32_t>>* topk_indexs) {
+  if (!has_topk_outputs()) {
+    AsrModel::ForwardEncoderTopKFunc(chunk_feats, k, topk_scores, topk_indexs);
+    return;
+  }
+  std::vector<std::vector<float>> feats(chunk_feats.num_frames());
+  for (int i = 0; i < chunk_feats.num_frames(); ++i) {
+    feats[i].assign(chunk_feats.frame(i),
+                    chunk_feats.frame(i) + chunk_feats.feature_dim());
+  }
+  std::vector<Ort::Value> extra_outputs;
+  RunEncoder(feats, {topk_scores_name_, topk_indexs_name_}, &extra_outputs);
 
-  std::vector<Ort::Value> ctc_ort_outputs = ctc_session_->Run(
-      Ort::RunOptions{nullptr}, ctc_in_names_.data(), ctc_inputs.data(),
-      ctc_inputs.size(), ctc_out_names_.data(), ctc_out_names_.size());
-  encoder_outs_.push_back(std::move(ctc_inputs[0]));
+  // The k of the graph is fixed at export, the topk are sorted so take the
+  // first k of them
+  auto shape = extra_outputs[0].GetTensorTypeAndShapeInfo().GetShape();
+  int num_outputs = shape[1];
+  int graph_k = shape[2];
+  k = std::min(k, graph_k);
+  const float* scores = extra_outputs[0].GetTensorData<float>();
+  const int64_t* indexs = extra_outputs[1].GetTensorData<int64_t>();
+  topk_scores->resize(num_outputs);
+  topk_indexs->resize(num_outputs);
+  for (int i = 0; i < num_outputs; ++i) {
+    const float* s = scores + i * graph_k;
+    const int64_t* idx = indexs + i * graph_k;
+    (*topk_scores)[i].assign(s, s + k);
+    (*topk_indexs)[i].assign(idx, idx + k);
+  }
+}
 
-  float* logp_data = ctc_ort_outputs[0].GetTensorMutableData<float>();
-  auto type_info = ctc_ort_outputs[0].GetTensorTypeAndShapeInfo();
+void OnnxAsrModel::CopyCtcProb(Ort::Value& ctc_prob,
+                               std::vector<std::vector<float>>* out_prob) {
+  float* logp_data = ctc_prob.GetTensorMutableData<float>();
+  auto type_info = ctc_prob.GetTensorTypeAndShapeInfo();
 
   int num_outputs = type_info.GetShape()[1];
   int output_dim = type_info.GetShape()[2];
@@ -344,6 +1056,9 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
   Ort::MemoryInfo memory_info =
       Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
   CHECK(rescoring_score != nullptr);
+  CHECK(rescore_session_ != nullptr) << "The attention decoder is not loaded";
+  // The exited chunks at the end are run by the late graph for the rescoring
+  if (late_session_ != nullptr) RunLateLayers(false);
   int num_hyps = hyps.size();
   rescoring_score->resize(num_hyps, 0.0f);
 
@@ -351,7 +1066,7 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
     return;
   }
   // No encoder output
-  if (encoder_outs_.size() == 0) {
+  if (encoder_outs_.empty()) {
     return;
   }
 
@@ -363,16 +1078,10 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
     hyps_lens.emplace_back(static_cast<int64_t>(length));
   }
 
-  std::vector<float> rescore_input;
-  int encoder_len = 0;
-  for (int i = 0; i < encoder_outs_.size(); i++) {
-    float* encoder_outs_data = encoder_outs_[i].GetTensorMutableData<float>();
-    auto type_info = encoder_outs_[i].GetTensorTypeAndShapeInfo();
-    for (int j = 0; j < type_info.GetElementCount(); j++) {
-      rescore_input.emplace_back(encoder_outs_data[j]);
-    }
-    encoder_len += type_info.GetShape()[1];
-  }
+  // The encoder outputs are decompressed if they are stored in fp16/int8
+  const int64_t encoder_len = encoder_outs_.num_rows();
+  std::vector<float> rescore_input(encoder_len * encoder_outs_.dim());
+  encoder_outs_.CopyTo(rescore_input.data());
 
   const int64_t decode_input_shape[] = {1, encoder_len, encoder_output_size_};
 
@@ -26,25 +26,113 @@
 #include "onnxruntime_cxx_api.h"  // NOLINT
 
 #include "decoder/asr_model.h"
+#include "decoder/encoder_out_store.h"
+#include "utils/huge_pages.h"
 #include "utils/log.h"
 #include "utils/utils.h"
 
 namespace wenet {
 
+struct OnnxSessionOptions {
+  // "disable", "basic", "extended" or "all" graph optimizations
+  std::string graph_optimization = "all";
+  // If not empty, the optimized graphs are saved to the dir, e.g.
+  // encoder.opt.onnx, and read instead by the next starts while they are
+  // newer than the models, without optimizing them again. The graphs of the
+  // accelerators can't be saved, so it's only for the CPU provider.
+  std::string optimized_model_dir;
+  // Plan the memory of a session by the shapes of the last run
+  bool enable_mem_pattern = true;
+  bool enable_cpu_mem_arena = true;
+};
+
 class OnnxAsrModel : public AsrModel {
  public:
+  // If global_thread_pool, the sessions run on the threads of the
+  // environment instead of their own, so the sessions of several reads,
+  // e.g. the replicas, the named models and the reloads, share num_threads
+  // threads.
   // Note: Do not call the InitEngineThreads function more than once.
-  static void InitEngineThreads(int num_threads = 1);
+  static void InitEngineThreads(int num_threads = 1,
+                                bool global_thread_pool = false);
+  // Set the options of the sessions read after it. Call it once after
+  // InitEngineThreads.
+  static void SetSessionOptions(const OnnxSessionOptions& opts);
+  // Allocate the CPU tensors of the sessions read after it, e.g. the
+  // weights, by HugePageAllocator of page_size, which is registered to the
+  // environment as the allocator shared by the sessions, instead of the
+  // arena of each one. Call it once after InitEngineThreads.
+  static void UseHugePages(HugePageSize page_size);
+  // Append the execution providers of the on-device accelerators to the
+  // sessions read after it, in the order of preference, which are "xnnpack",
+  // "nnapi"(Android) or "acl"(ARM Compute Library, e.g. Raspberry Pi).
+  // The nodes they don't support, and the providers which are not built in
+  // the onnxruntime, fall back to the CPU one. NNAPI runs the fp32 models
+  // in fp16 if fp16 is true. Returns the number of the providers appended,
+  // which bring their own threads, so the fewer intra-op threads can be
+  // passed to InitEngineThreads called after it.
+  static int AppendExecutionProviders(const std::vector<std::string>& names,
+                                      int num_threads, bool fp16 = false);
 
  public:
   OnnxAsrModel() = default;
   OnnxAsrModel(const OnnxAsrModel& other);
-  void Read(const std::string& model_dir);
+  // If quantized, the int8 models of the dir are read, e.g. encoder.
+  // quant.onnx of wenet/bin/export_onnx_cpu.py, with QDQ or dynamic
+  // quantized operators. If ctc_only, decoder.onnx is not loaded, which
+  // saves its memory and the startup time when the hyps are not rescored,
+  // e.g. the ctc wfst search with rescoring_weight 0.
+  void Read(const std::string& model_dir, bool quantized = false,
+            bool ctc_only = false);
+  // Exit the encoder early on the confident chunks, call it before Read().
+  // The encoder is read as the two graphs of the dir split at a layer:
+  // encoder_early.onnx, the layers below it with an intermediate ctc head
+  // of the output ctc_log_probs, and encoder_late.onnx, the layers above
+  // it, whose output goes to ctc.onnx. A chunk exits at the early graph if
+  // the max posterior of each of its frames is at least `threshold`, then
+  // its early outputs are kept and run by the late graph together with the
+  // next chunk which doesn't exit, so the caches of the late layers are
+  // the ones of all the frames. At most `max_exit_chunks` chunks exit in a
+  // row, and the kept ones are run before the rescoring, which needs the
+  // late outputs. The saving is in the latency of the exited chunks and
+  // the late layers run in the batches of the chunks, and when they are
+  // not rescored, e.g. ctc_only, in the late layers of the chunks exited
+  // at the end. --v=2 and the metrics wenet_encoder_layers_total over
+  // wenet_encoder_chunks_total are the layers run per chunk. The graphs
+  // are exported by wenet/bin/export_onnx_cpu.py --early_exit_layer.
+  void set_early_exit(float threshold, int max_exit_chunks) {
+    early_exit_threshold_ = threshold;
+    max_exit_chunks_ = max_exit_chunks;
+  }
+  // Run the encoder and ctc sessions by IOBinding, the caches are double
+  // buffered and swapped in place instead of allocated for every chunk.
+  // Call it before Reset()/Copy().
+  void set_use_io_binding(bool use_io_binding) {
+    use_io_binding_ = use_io_binding;
+  }
+  // Keep the encoder outputs for the rescoring in fp16 or per row int8,
+  // which are decompressed by AttentionRescoring. Call it before
+  // Reset()/Copy().
+  void set_encoder_out_storage(EncoderOutStorage storage) {
+    encoder_outs_.Clear();
+    encoder_outs_.set_storage(storage);
+  }
   void Reset() override;
+  // The copy runs on its own sessions of the models with the profiling of
+  // onnxruntime enabled, which are read again for it, and the profiles are
+  // written to <prefix>.<model>_<date>.json once it's stopped
+  void set_profile_prefix(const std::string& prefix) override;
   void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                           float reverse_weight,
                           std::vector<float>* rescoring_score) override;
   std::shared_ptr<AsrModel> Copy() const override;
+  // The caches are counted with their back buffers
+  void GetMemoryUsage(SessionMemory* usage) const override;
+  // Whether the fused encoder_ctc.onnx emits topk_scores and topk_indexs,
+  // see --fuse_ctc and --ctc_topk of wenet/bin/export_onnx_cpu.py
+  bool has_topk_outputs() const {
+    return topk_scores_name_ != nullptr && topk_indexs_name_ != nullptr;
+  }
   void GetInputOutputInfo(const std::shared_ptr<Ort::Session>& session,
                           std::vector<const char*>* in_names,
                           std::vector<const char*>* out_names);
@@ -52,11 +140,45 @@ class OnnxAsrModel : public AsrModel {
  protected:
   void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
                           std::vector<std::vector<float>>* ctc_prob) override;
+  // Use the topk outputs of the fused graph if any, so the full log probs
+  // are never copied out
+  void ForwardEncoderTopKFunc(
+      const FeatureView& chunk_feats, int k,
+      std::vector<std::vector<float>>* topk_scores,
+      std::vector<std::vector<int32_t>>* topk_indexs) override;
 
   float ComputeAttentionScore(const float* prob, const std::vector<int>& hyp,
                               int eos, int decode_out_len);
+  // Run the encoder, update the caches, chunk_out_ and encoder_outs_, the
+  // outputs in
+  // extra_out_names(eg. ctc_log_probs of the fused graph) are returned.
+  void RunEncoder(const std::vector<std::vector<float>>& chunk_feats,
+                  const std::vector<const char*>& extra_out_names,
+                  std::vector<Ort::Value>* extra_outputs);
+  void CopyCtcProb(Ort::Value& ctc_prob,  // NOLINT
+                   std::vector<std::vector<float>>* out_prob);
+  // Run ctc.onnx on the encoder output
+  void RunCtc(const Ort::Value& chunk_out,
+              std::vector<std::vector<float>>* out_prob);
+  // Forward the chunk by the early graph, then by the late one unless it
+  // exits, see set_early_exit()
+  void ForwardEarlyExit(const std::vector<std::vector<float>>& chunk_feats,
+                        std::vector<std::vector<float>>* out_prob);
+  // Run the late graph on the early outputs of the exited chunks, and on
+  // chunk_out_ if with_chunk, which are appended to encoder_outs_. The
+  // output is kept in late_out_.
+  void RunLateLayers(bool with_chunk);
+  // The caches are loaded into the front buffers of Reset(), except the
+  // growing att_cache of num_left_chunks <= 0
+  bool SaveStateFunc(StateWriter* writer) const override;
+  bool LoadStateFunc(StateReader* reader) override;
 
  private:
+  // The session of the model at path, or of its optimized graph saved in
+  // optimized_model_dir_ by a previous start
+  static std::shared_ptr<Ort::Session> CreateSession(
+      const std::string& path, const std::string& profile_prefix = "");
+
   int encoder_output_size_ = 0;
   int num_blocks_ = 0;
   int cnn_module_kernel_ = 0;
@@ -67,20 +189,37 @@ class OnnxAsrModel : public AsrModel {
   //  One Env must be created before using any other Onnxruntime functionality.
   static Ort::Env env_;  // shared environment across threads.
   static Ort::SessionOptions session_options_;
+  static std::string optimized_model_dir_;
+  static bool has_providers_;
   std::shared_ptr<Ort::Session> encoder_session_ = nullptr;
   std::shared_ptr<Ort::Session> rescore_session_ = nullptr;
+  // nullptr if the fused encoder_ctc.onnx is used as encoder_session_
   std::shared_ptr<Ort::Session> ctc_session_ = nullptr;
+  // The paths of the sessions, and the shared sessions of the copy while
+  // it's profiled on its own
+  std::string encoder_path_, rescore_path_, ctc_path_;
+  std::string profile_prefix_;
+  std::shared_ptr<Ort::Session> shared_encoder_session_ = nullptr;
+  std::shared_ptr<Ort::Session> shared_rescore_session_ = nullptr;
+  std::shared_ptr<Ort::Session> shared_ctc_session_ = nullptr;
 
   // node names
   std::vector<Ort::AllocatedStringPtr> node_names_;
   std::vector<const char*> encoder_in_names_, encoder_out_names_;
   std::vector<const char*> ctc_in_names_, ctc_out_names_;
   std::vector<const char*> rescore_in_names_, rescore_out_names_;
+  // outputs of the fused graph, or the intermediate ctc of the early one
+  const char* ctc_log_probs_name_ = nullptr;
+  const char* topk_scores_name_ = nullptr;
+  const char* topk_indexs_name_ = nullptr;
 
   // caches
   Ort::Value att_cache_ort_{nullptr};
   Ort::Value cnn_cache_ort_{nullptr};
-  std::vector<Ort::Value> encoder_outs_;
+  // The encoder output of the last chunk, and the ones of the session,
+  // which are for the rescoring only
+  Ort::Value chunk_out_{nullptr};
+  EncoderOutStore encoder_outs_;
   // NOTE: Instead of making a copy of the xx_cache, ONNX only maintains
   //  its data pointer when initializing xx_cache_ort (see https://github.com/
   //  microsoft/onnxruntime/blob/master/onnxruntime/core/framework
@@ -88,6 +227,34 @@ class OnnxAsrModel : public AsrModel {
   //  our data "alive" during the lifetime of decoder.
   std::vector<float> att_cache_;
   std::vector<float> cnn_cache_;
+
+  // IOBinding, the bindings are per model copy since the sessions are shared
+  bool use_io_binding_ = true;
+  std::shared_ptr<Ort::IoBinding> encoder_binding_ = nullptr;
+  std::shared_ptr<Ort::IoBinding> ctc_binding_ = nullptr;
+  // The encoder writes the new caches here, then they are swapped with the
+  // front buffers above
+  Ort::Value att_cache_back_ort_{nullptr};
+  Ort::Value cnn_cache_back_ort_{nullptr};
+  std::vector<float> att_cache_back_;
+  std::vector<float> cnn_cache_back_;
+  std::vector<float> ctc_prob_;
+
+  // Early exit, the encoder session is the early graph if late_session_
+  float early_exit_threshold_ = 0.0;
+  int max_exit_chunks_ = 0;
+  std::shared_ptr<Ort::Session> late_session_ = nullptr;
+  std::vector<const char*> late_in_names_, late_out_names_;
+  int late_num_blocks_ = 0;
+  int late_offset_ = 0;
+  Ort::Value late_att_cache_ort_{nullptr};
+  Ort::Value late_cnn_cache_ort_{nullptr};
+  std::vector<float> late_att_cache_;
+  std::vector<float> late_cnn_cache_;
+  Ort::Value late_out_{nullptr};
+  // The early outputs of the exited chunks, [frames, encoder_output_size_]
+  std::vector<float> exited_outs_;
+  int num_exited_chunks_ = 0;
 };
 
 }  // namespace wenet
@@ -17,12 +17,17 @@
 #define DECODER_PARAMS_H_
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "decoder/asr_decoder.h"
 #include "decoder/batch_asr_decoder.h"
+#include "decoder/encoder_out_store.h"
+#include "decoder/ngram_model.h"
+#include "decoder/resource_registry.h"
+#include "decoder/result_cache.h"
 #ifdef USE_ONNX
 #include "decoder/onnx_asr_model.h"
 #include "decoder/batch_onnx_asr_model.h"
@@ -36,28 +41,156 @@
 #endif
 #include "frontend/feature_pipeline.h"
 #include "post_processor/post_processor.h"
+#include "utils/cpu_affinity.h"
+#include "utils/file.h"
 #include "utils/flags.h"
+#include "utils/fst_io.h"
+#include "utils/huge_pages.h"
+#include "utils/model_bundle.h"
+#include "utils/parallel_loader.h"
 #include "utils/string.h"
 
 DEFINE_int32(device_id, 0, "set XPU DeviceID for ASR model");
 
 // TorchAsrModel flags
 DEFINE_string(model_path, "", "pytorch exported model path");
+DEFINE_string(bundle_path, "",
+              "single file bundle of the torch model, the symbol tables, the "
+              "TLG fst and the contexts by bin/model_bundle_main, which is "
+              "memory mapped, and its sections are used instead of "
+              "--model_path, --unit_path, --dict_path, --fst_path and "
+              "--context_path");
+DEFINE_bool(parallel_loading, true,
+            "load the model, the TLG fst, the symbol tables, the itn and the "
+            "word lm at the same time at startup");
 // OnnxAsrModel flags
 DEFINE_string(onnx_dir, "", "directory where the onnx model is saved");
+DEFINE_bool(quantized, false,
+            "read the int8 quantized model, the *.quant.onnx of onnx_dir, or "
+            "the quantized torchscript model_path which runs on cpu");
+DEFINE_bool(onnx_io_binding, true,
+            "run the streaming onnx model by IOBinding with preallocated "
+            "cache buffers");
+DEFINE_string(onnx_providers, "",
+              "comma separated execution providers of the streaming onnx "
+              "model in the order of preference: xnnpack, nnapi or acl, "
+              "falls back to cpu, empty for cpu only");
+DEFINE_bool(onnx_fp16, false,
+            "run the fp32 onnx model in fp16 on the providers supporting it, "
+            "i.e. nnapi");
+DEFINE_string(onnx_graph_optimization, "all",
+              "graph optimization level of the streaming onnx model: "
+              "disable, basic, extended or all");
+DEFINE_string(onnx_optimized_model_dir, "",
+              "dir to save the optimized graphs of the streaming onnx model, "
+              "which are read instead by the next starts while newer than "
+              "the models, cpu provider only");
+DEFINE_bool(onnx_mem_pattern, true,
+            "plan the memory of the onnx sessions by the last run");
+DEFINE_bool(onnx_cpu_mem_arena, true,
+            "allocate the cpu memory of the onnx sessions from an arena");
+DEFINE_bool(onnx_global_thread_pool, false,
+            "run all the streaming onnx sessions on one global thread pool "
+            "instead of the threads of each session");
+DEFINE_double(onnx_early_exit_threshold, 0,
+              "if > 0, read the split encoder_early.onnx and encoder_late.onnx "
+              "of onnx_dir, and exit the encoder early on the chunks of "
+              "which the intermediate ctc posterior of each frame is at "
+              "least it");
+DEFINE_int32(onnx_max_exit_chunks, 4,
+             "max chunks in a row exited early, whose late layers are run "
+             "together with the next chunk");
+DEFINE_bool(ctc_only, false,
+            "read the streaming torch or onnx model without the attention "
+            "decoder, the hyps are not rescored, i.e. rescoring_weight 0");
 // XPUAsrModel flags
 DEFINE_string(xpu_model_dir, "",
               "directory where the XPU model and weights is saved");
+DEFINE_string(xpu_device_ids, "",
+              "comma separated XPUs to load a replica of the XPU model on "
+              "each, the sessions are placed on the least loaded one, "
+              "--device_id is used if empty");
+DEFINE_int32(xpu_streams_per_device, 1,
+             "number of streams on each XPU, the sessions of the XPU are "
+             "spread over them");
 
 // FeaturePipelineConfig flags
 DEFINE_int32(num_bins, 80, "num mel bins for fbank feature");
 DEFINE_int32(sample_rate, 16000, "sample rate for audio");
+DEFINE_bool(feature_spsc_queue, false,
+            "pass the features to the decoder by a lock-free queue");
+DEFINE_bool(defer_features, false,
+            "extract the features of the received audio on the decoding "
+            "threads instead of the network threads");
+DEFINE_int32(min_accept_frames, 0,
+             "buffer the received audio until it makes at least this many "
+             "frames before the feature extraction, 0 means no buffering");
+DEFINE_bool(skip_silent_chunks, false,
+            "skip the encoder forward of the chunks which are all silence by "
+            "the energy vad, only for streaming decoding");
+DEFINE_double(vad_energy_threshold, 2.3,
+              "log energy above the noise floor of speech frames for the vad");
+DEFINE_int32(vad_hangover_frames, 30,
+             "frames kept as speech after the last speech frame by the vad");
+DEFINE_string(cmvn_path, "",
+              "global_cmvn json of the training, applied by the fbank if set, "
+              "for the models exported without the cmvn");
 
 // TLG fst
 DEFINE_string(fst_path, "", "TLG fst path");
+DEFINE_bool(fst_mmap, true,
+            "memory map the TLG fst if it's an aligned const fst, which is "
+            "converted by fsttoconst, so the processes share the graph");
+DEFINE_string(huge_pages, "none",
+              "none, 2m or 1g, allocate the weights of the torch and onnx "
+              "models on cpu by the huge pages of the size, the reserved ones "
+              "or else the transparent ones, and read the TLG const fst to "
+              "the transparent huge pages instead of mapping it");
+DEFINE_string(g_fst_path, "",
+              "G fst path, if set, fst_path is the T o L fst (TL.fst), which "
+              "is composed with G on the fly instead of the static TLG");
+DEFINE_bool(lg_fst, false,
+            "fst_path is the LG fst without the ctc topology T, or the L fst "
+            "with g_fst_path, of which the ctc blanks and repeats are "
+            "handled by the search");
+DEFINE_string(lattice_old_lm_path, "",
+              "the G of fst_path, projected on the output labels and sorted "
+              "by the input labels, which is replaced by "
+              "lattice_new_lm_path in the final lattices of the wfst search");
+DEFINE_string(lattice_new_lm_path, "",
+              "the larger LM the final lattices are rescored with, of the "
+              "same words and format as lattice_old_lm_path");
+DEFINE_int32(fst_cache_mb, 64,
+             "cache size in MB of the on the fly composed graph, it's kept "
+             "by every decoding session");
 
 // DecodeOptions flags
 DEFINE_int32(chunk_size, 16, "decoding chunk size");
+DEFINE_int32(max_chunk_size, 0,
+             "grow the chunk size up to it when the server is overloaded, "
+             "for the torch models trained with dynamic chunk, the onnx and "
+             "xpu models keep their chunk size, 0 disables it");
+DEFINE_double(high_cpu_usage, 0.9,
+              "cpu usage over which the server is overloaded");
+DEFINE_double(low_cpu_usage, 0.6,
+              "cpu usage under which the chunk size shrinks back");
+DEFINE_double(high_queue_depth, 2.0,
+              "queued tasks per decode thread over which the server is "
+              "overloaded");
+DEFINE_double(low_queue_depth, 0.5,
+              "queued tasks per decode thread under which the chunk size "
+              "shrinks back");
+DEFINE_int32(max_catchup_chunks, 0,
+             "forward up to it of the chunks queued by a session fallen "
+             "behind as one chunk, for the torch models trained with dynamic "
+             "chunk, the onnx and xpu models keep their chunk size, 0 "
+             "disables it");
+DEFINE_double(max_search_rtf, 0.0,
+              "budget of the search time of a chunk over the audio duration "
+              "of it, over which the beams of the session are narrowed, 0 "
+              "disables it");
+DEFINE_double(min_beam_scale, 0.5,
+              "scale of the configured beams they are narrowed down to");
 DEFINE_int32(num_left_chunks, -1, "left chunks in decoding");
 DEFINE_double(ctc_weight, 0.5,
               "ctc weight when combining ctc score and rescoring score");
@@ -73,12 +206,65 @@ DEFINE_double(beam, 16.0, "beam in ctc wfst search");
 DEFINE_double(lattice_beam, 10.0, "lattice beam in ctc wfst search");
 DEFINE_double(acoustic_scale, 1.0, "acoustic scale for ctc wfst search");
 DEFINE_double(blank_skip_thresh, 1.0,
-              "blank skip thresh for ctc wfst search, 1.0 means no skip");
+              "blank skip thresh for ctc wfst and prefix search, "
+              "1.0 means no skip");
 DEFINE_double(length_penalty, 0.0,
               "length penalty ctc wfst search, will not"
               "apply on self-loop arc, for balancing the del/ins ratio, "
               "suggest set to -3.0");
 DEFINE_int32(nbest, 10, "nbest for ctc wfst or prefix search");
+DEFINE_bool(enable_timestamp, true,
+            "keep the times of the hyps in ctc prefix search for the "
+            "timestamps of the final result");
+DEFINE_int32(partial_nbest, 1,
+             "nbest of the partial results in ctc wfst search, the lattice of "
+             "the last partial_lattice_frames frames is determinized for them");
+DEFINE_int32(partial_lattice_frames, 200,
+             "decoded frames in the partial lattice of ctc wfst search");
+DEFINE_int32(wfst_sparse_topk, 0,
+             "only score the top k tokens of each frame in ctc wfst search, "
+             "the arcs of the others are skipped, 0 scores all the tokens");
+DEFINE_double(wfst_sparse_thresh, 0.0,
+              "also prune the tokens of the top k whose prob is below it in "
+              "ctc wfst search");
+DEFINE_double(rescoring_ctc_margin, 0.0,
+              "skip the rescoring if the ctc score of the 1-best is more "
+              "than it above the others, 0 disables it");
+DEFINE_int32(speculative_rescoring_ms, 0,
+             "start the rescoring of prefix search when the trailing silence "
+             "is over it, before the endpoint, 0 disables it");
+DEFINE_int32(rescoring_cache_size, 64,
+             "number of the rescoring scores of the hyps kept by a session, "
+             "0 disables it");
+DEFINE_int32(second_pass_chunks, 0,
+             "rerank the partial result of prefix search by the attention "
+             "rescoring at most once every n chunks, 0 disables it");
+DEFINE_double(second_pass_budget, 0.2,
+              "max ratio of the time of the second pass partials to the "
+              "first pass time of a session");
+DEFINE_double(second_pass_max_cpu_usage, 0.8,
+              "skip the second pass partials when the cpu usage is over it");
+DEFINE_int32(chunk_deadline_ms, 0,
+             "latency target of the audio of a stream, the chunks are decoded "
+             "by the earliest deadline on the decode pool, and coarser when "
+             "late, 0 disables it");
+DEFINE_int32(offload_idle_ms, 0,
+             "offload the model caches of the session to host memory after "
+             "the silence skipped by --skip_silent_chunks is over it, 0 "
+             "disables it");
+DEFINE_bool(enable_topk_ctc, false,
+            "only get the topk ctc log probs from the model for prefix search, "
+            "or for wfst search with --wfst_sparse_topk");
+DEFINE_bool(gpu_ctc_search, false,
+            "run the prefix search, or the wfst search with --fst_path, of "
+            "batch decoding on the device of the torch model");
+DEFINE_int32(max_batch_frames, 0,
+             "split the length sorted utterances of a batch into sub batches "
+             "of at most this many padded feature frames, 0 disables it");
+DEFINE_bool(streaming_batch, false,
+            "with --run_batch, decode the batches chunk by chunk by the "
+            "streaming model, the chunks of a batch are forwarded together by "
+            "the chunk scheduler, e.g. for the long recordings");
 
 // SymbolTable flags
 DEFINE_string(dict_path, "",
@@ -91,20 +277,186 @@ DEFINE_string(unit_path, "",
 DEFINE_string(context_path, "", "context path, is used to build context graph");
 DEFINE_double(context_score, 3.0, "is used to rescore the decoded result");
 
+// LanguageModel flags
+DEFINE_string(token_lm_corpus, "",
+              "text of the units separated by spaces, one sentence per line, "
+              "to count the n-gram of the shallow fusion in prefix search");
+DEFINE_int32(token_lm_order, 3, "order of the n-gram of --token_lm_corpus");
+DEFINE_string(word_lm_path, "",
+              "word n-gram built by build_ngram_main for the shallow fusion "
+              "in prefix search, instead of --token_lm_corpus");
+DEFINE_string(lexicon_path, "",
+              "lexicon of --word_lm_path, a word and its units per line");
+DEFINE_double(lm_weight, 0.5, "weight of the lm score in prefix search");
+
 // PostProcessOptions flags
 DEFINE_int32(language_type, 0,
              "remove spaces according to language type"
              "0x00 = kMandarinEnglish, "
              "0x01 = kIndoEuropean");
 DEFINE_bool(lowercase, true, "lowercase final result if needed");
+DEFINE_string(itn_tagger_path, "",
+              "tagger fst of the inverse text normalization of the final "
+              "results, compiled by WeTextProcessing");
+DEFINE_string(itn_verbalizer_path, "",
+              "verbalizer fst of --itn_tagger_path");
 DEFINE_bool(run_batch, false, "run websocket server for batch decoding");
-DEFINE_bool(is_fp16, false, "the model is of fp16");
+DEFINE_bool(is_fp16, false,
+            "the model is of fp16, or run the encoder of the torch model in "
+            "fp16 on GPU");
+DEFINE_bool(cpu_bf16, false,
+            "run the encoder and the attention decoder of the fp32 torch "
+            "model in bf16 on cpu by oneDNN, e.g. on AMX");
 DEFINE_int32(gpu_id, 0, "which GPU to use");
+DEFINE_string(gpu_ids, "",
+              "comma separated GPUs to load a replica of the streaming torch "
+              "model on each, the sessions are placed on the least loaded "
+              "one, --gpu_id is used if empty");
+DEFINE_bool(trt, false,
+            "run the encoder of the batch onnx model by TensorRT, falls back "
+            "to CUDA if TensorRT is not available");
+DEFINE_int32(onnx_gpu_sessions, 1,
+             "sessions of the batch onnx model on the GPU, each of its own "
+             "CUDA stream, which the decoders are assigned in turn");
+DEFINE_bool(trt_fp16, false, "build the TensorRT engines in fp16");
+DEFINE_string(trt_cache_dir, "",
+              "where the TensorRT engines are cached, the onnx dir if empty");
+DEFINE_int32(trt_max_batch_size, 32, "max batch size of the TensorRT engines");
+DEFINE_string(trt_frame_buckets, "512,1024,3072",
+              "comma separated max frames of the TensorRT profiles, the "
+              "longer utterances are not supported");
+DEFINE_bool(torch_device_cache, true,
+            "keep the streaming caches of the torch model on GPU, only "
+            "ctc log probs are copied back to host");
+DEFINE_int32(cuda_graph_max_chunks, 0,
+             "replay the CUDA graphs of the chunks of the torch model once "
+             "the attention cache is full, captured at load for up to this "
+             "number of the warmup chunk sizes, needs num_left_chunks > 0 "
+             "and the device cache, 0 to disable");
+DEFINE_int32(cache_pool_blocks, 0,
+             "keep the full caches of the streaming sessions of the torch "
+             "model in a pool of this number of blocks, needs "
+             "num_left_chunks > 0, 0 to disable. It bounds the cache memory "
+             "of the sessions but costs a copy of the caches per chunk, "
+             "except the replays of --cuda_graph_max_chunks");
+DEFINE_int32(max_rescoring_frames, 0,
+             "rescore with the encoder outputs of the last frames of the "
+             "torch model only, so the memory of long sessions is bounded, "
+             "0 keeps all");
+DEFINE_string(encoder_out_storage, "fp32",
+              "storage of the encoder outputs kept for the rescoring of the "
+              "streaming torch and onnx models, fp32, fp16 or int8 of the "
+              "per row scale, which halves or about quarters the memory of "
+              "long sessions");
+DEFINE_bool(embedded, false,
+            "small footprint profile of the embedded boards, e.g. the 512MB "
+            "Raspberry Pi: one intra-op thread, the graph is memory mapped, "
+            "and the encoder outputs for rescoring are capped to "
+            "--embedded_rescoring_frames unless --max_rescoring_frames");
+DEFINE_int32(embedded_rescoring_frames, 1024,
+             "encoder frames kept for rescoring in the embedded profile");
+DEFINE_int32(memory_budget_mb, 0,
+             "report the memory breakdown of the model and the sessions "
+             "against the budget, 0 to disable");
+DEFINE_int32(batch_num_threads, 16,
+             "num of threads for feature and search stages of batch decoding");
+DEFINE_string(feature_placement, "auto",
+              "where the fbank of batch decoding is computed: cpu, gpu, or "
+              "auto, which places the small batches and the batches beyond "
+              "--gpu_feature_max_inflight on CPU, gpu needs a GPU build");
+DEFINE_int32(gpu_feature_min_batch_size, 4,
+             "for auto feature placement, min batch size computed on GPU");
+DEFINE_int32(gpu_feature_max_inflight, 2,
+             "for auto feature placement, max batches computed on GPU at "
+             "the same time");
+DEFINE_bool(freeze_torch_model, false,
+            "freeze the torchscript model after loading, the parameters are "
+            "inlined and folded as constants");
+DEFINE_bool(optimize_torch_model, false,
+            "freeze the torchscript model and optimize it for inference "
+            "after loading, i.e. MKLDNN layout on cpu and fusion on gpu");
+DEFINE_string(optimized_torch_model, "",
+              "path to cache the optimized torchscript model, which is read "
+              "instead by the next starts while newer than the model, remove "
+              "it when the model options change");
+DEFINE_int32(intra_op_threads, 1,
+             "num of intra-op threads of the model runtime per decode thread");
+
+// CPU placement flags
+DEFINE_string(cpu_affinity, "",
+              "pin the decode threads, and so the intra-op threads they "
+              "create, to the cpus: empty for no pinning, 'numa' for the "
+              "cpus of one NUMA node per thread, round robin over the "
+              "nodes, or a cpu list, e.g. '0-15,32-47'");
+DEFINE_bool(numa_replicas, false,
+            "load a replica of the model per NUMA node, on the node, and "
+            "decode each session with the replica of its node, with "
+            "--cpu_affinity=numa");
+DEFINE_string(models, "",
+              "named models served besides the default one of the flags, "
+              "as comma separated name:flagfile, of which the flag file "
+              "sets the model, graph and post processing flags, e.g. "
+              "--onnx_dir, --fst_path, --unit_path, --dict_path, on top of "
+              "the command line. A session selects one by the model of its "
+              "start signal, the server and decoding options are shared");
+
+// Model warmup flags
+DEFINE_bool(warmup_model, false,
+            "forward silence through the streaming model with the shapes of "
+            "decoding before it serves any session, it's on for the servers");
+DEFINE_string(warmup_chunk_sizes, "",
+              "comma separated chunk sizes to warm up, empty means the "
+              "chunk_size flag");
+DEFINE_string(warmup_batch_sizes, "",
+              "comma separated batch sizes to warm up, empty means 1 and the "
+              "max batch sizes of the enabled schedulers");
+
+// ChunkScheduler flags
+DEFINE_bool(enable_chunk_scheduler, false,
+            "batch the encoder forward of streaming chunks across sessions");
+DEFINE_int32(scheduler_max_batch_size, 16,
+             "max number of chunks in one batched encoder forward");
+DEFINE_int32(scheduler_max_wait_ms, 5,
+             "max time(ms) a ready chunk waits for the batch to fill up");
+DEFINE_bool(scheduler_batch_search, false,
+            "search the chunks of the prefix beam searches of a batch "
+            "together on the scheduler thread");
+
+// RescoringScheduler flags
+DEFINE_bool(enable_rescoring_scheduler, false,
+            "batch the attention rescoring of utterances across sessions");
+DEFINE_int32(rescoring_max_batch_size, 16,
+             "max number of sessions in one batched attention rescoring");
+DEFINE_int32(rescoring_max_wait_ms, 5,
+             "max time(ms) a rescoring request waits for the batch to fill "
+             "up");
+DEFINE_int32(rescoring_threads, 0,
+             "threads rescoring the segments of the continuous decoding "
+             "while the next ones are decoded, 0 rescores them on the "
+             "decoding threads at the endpoints");
+
+// Result cache flags
+DEFINE_int32(result_cache_size, 0,
+             "number of the n-best of the whole utterances cached with "
+             "their audio, so the repeated audio isn't decoded again by the "
+             "offline paths, 0 disables the cache");
 
 namespace wenet {
 std::shared_ptr<FeaturePipelineConfig> InitFeaturePipelineConfigFromFlags() {
   auto feature_config = std::make_shared<FeaturePipelineConfig>(
       FLAGS_num_bins, FLAGS_sample_rate);
+  feature_config->use_spsc_queue = FLAGS_feature_spsc_queue;
+  feature_config->min_accept_frames = FLAGS_min_accept_frames;
+  feature_config->defer_features = FLAGS_defer_features;
+  feature_config->enable_vad = FLAGS_skip_silent_chunks;
+  feature_config->vad_opts.energy_threshold = FLAGS_vad_energy_threshold;
+  feature_config->vad_opts.hangover_frames = FLAGS_vad_hangover_frames;
+  if (!FLAGS_cmvn_path.empty()) {
+    feature_config->cmvn = GlobalCmvn::Read(FLAGS_cmvn_path);
+    CHECK(feature_config->cmvn != nullptr);
+    CHECK_EQ(feature_config->cmvn->dim(), FLAGS_num_bins)
+        << "The cmvn is not of the fbank";
+  }
   return feature_config;
 }
 
@@ -112,9 +464,20 @@ std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
   auto decode_config = std::make_shared<DecodeOptions>();
   decode_config->chunk_size = FLAGS_chunk_size;
   decode_config->num_left_chunks = FLAGS_num_left_chunks;
+  decode_config->adaptive_chunk_opts.max_chunk_size = FLAGS_max_chunk_size;
+  decode_config->adaptive_chunk_opts.high_cpu_usage = FLAGS_high_cpu_usage;
+  decode_config->adaptive_chunk_opts.low_cpu_usage = FLAGS_low_cpu_usage;
+  decode_config->adaptive_chunk_opts.high_queue_depth = FLAGS_high_queue_depth;
+  decode_config->adaptive_chunk_opts.low_queue_depth = FLAGS_low_queue_depth;
+  decode_config->adaptive_chunk_opts.max_catchup_chunks =
+      FLAGS_max_catchup_chunks;
+  decode_config->adaptive_beam_opts.max_search_rtf = FLAGS_max_search_rtf;
+  decode_config->adaptive_beam_opts.min_beam_scale = FLAGS_min_beam_scale;
   decode_config->ctc_weight = FLAGS_ctc_weight;
   decode_config->reverse_weight = FLAGS_reverse_weight;
-  decode_config->rescoring_weight = FLAGS_rescoring_weight;
+  decode_config->rescoring_weight =
+      FLAGS_ctc_only ? 0.0 : FLAGS_rescoring_weight;
+  decode_config->rescoring_ctc_margin = FLAGS_rescoring_ctc_margin;
   decode_config->ctc_wfst_search_opts.max_active = FLAGS_max_active;
   decode_config->ctc_wfst_search_opts.min_active = FLAGS_min_active;
   decode_config->ctc_wfst_search_opts.beam = FLAGS_beam;
@@ -124,114 +487,682 @@ std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
       FLAGS_blank_skip_thresh;
   decode_config->ctc_wfst_search_opts.length_penalty = FLAGS_length_penalty;
   decode_config->ctc_wfst_search_opts.nbest = FLAGS_nbest;
+  decode_config->ctc_wfst_search_opts.partial_nbest = FLAGS_partial_nbest;
+  decode_config->ctc_wfst_search_opts.sparse_topk = FLAGS_wfst_sparse_topk;
+  decode_config->ctc_wfst_search_opts.sparse_thresh = FLAGS_wfst_sparse_thresh;
+  decode_config->ctc_wfst_search_opts.partial_lattice_frames =
+      FLAGS_partial_lattice_frames;
+  decode_config->ctc_wfst_search_opts.lg_graph = FLAGS_lg_fst;
   decode_config->ctc_prefix_search_opts.first_beam_size = FLAGS_nbest;
   decode_config->ctc_prefix_search_opts.second_beam_size = FLAGS_nbest;
+  decode_config->ctc_prefix_search_opts.lm_weight = FLAGS_lm_weight;
+  decode_config->ctc_prefix_search_opts.enable_times = FLAGS_enable_timestamp;
+  decode_config->ctc_prefix_search_opts.blank_skip_thresh =
+      FLAGS_blank_skip_thresh;
+  decode_config->enable_topk_ctc = FLAGS_enable_topk_ctc;
+  decode_config->gpu_ctc_search = FLAGS_gpu_ctc_search;
+  decode_config->max_batch_frames = FLAGS_max_batch_frames;
+  decode_config->streaming_batch = FLAGS_run_batch && FLAGS_streaming_batch;
+  decode_config->skip_silent_chunks = FLAGS_skip_silent_chunks;
+  decode_config->speculative_rescoring_ms = FLAGS_speculative_rescoring_ms;
+  decode_config->rescoring_cache_size = FLAGS_rescoring_cache_size;
+  decode_config->second_pass_chunks = FLAGS_second_pass_chunks;
+  decode_config->second_pass_budget = FLAGS_second_pass_budget;
+  decode_config->second_pass_max_cpu_usage = FLAGS_second_pass_max_cpu_usage;
+  decode_config->chunk_deadline_ms = FLAGS_chunk_deadline_ms;
+  decode_config->offload_idle_ms = FLAGS_offload_idle_ms;
   return decode_config;
 }
 
-std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
-  auto resource = std::make_shared<DecodeResource>();
-  const int kNumGemmThreads = 1;
-  if (!FLAGS_onnx_dir.empty()) {
+std::vector<int> WarmupChunkSizesFromFlags() {
+  std::vector<std::string> strs;
+  SplitStringToVector(FLAGS_warmup_chunk_sizes, ",", true, &strs);
+  std::vector<int> chunk_sizes;
+  for (const auto& str : strs) {
+    chunk_sizes.push_back(std::stoi(str));
+  }
+  if (chunk_sizes.empty()) {
+    chunk_sizes.push_back(FLAGS_chunk_size);
+    // And the chunk sizes of the overloaded server, of the torch models only
+    const bool adaptive = FLAGS_onnx_dir.empty() && FLAGS_xpu_model_dir.empty();
+    for (int chunk_size = FLAGS_chunk_size * 2;
+         adaptive && FLAGS_chunk_size > 0 &&
+         chunk_size <= FLAGS_max_chunk_size;
+         chunk_size *= 2) {
+      chunk_sizes.push_back(chunk_size);
+    }
+  }
+  return chunk_sizes;
+}
+
+std::vector<int> WarmupBatchSizesFromFlags() {
+  std::vector<std::string> strs;
+  SplitStringToVector(FLAGS_warmup_batch_sizes, ",", true, &strs);
+  std::vector<int> batch_sizes;
+  for (const auto& str : strs) {
+    batch_sizes.push_back(std::stoi(str));
+  }
+  if (batch_sizes.empty()) {
+    batch_sizes.push_back(1);
+    if (FLAGS_enable_chunk_scheduler) {
+      batch_sizes.push_back(FLAGS_scheduler_max_batch_size);
+    }
+    if (FLAGS_enable_rescoring_scheduler &&
+        FLAGS_rescoring_max_batch_size != batch_sizes.back()) {
+      batch_sizes.push_back(FLAGS_rescoring_max_batch_size);
+    }
+  }
+  return batch_sizes;
+}
+
+// Forward the shapes of the --warmup flags through the streaming model and
+// its replicas of the resource
+void WarmupModelFromFlags(const DecodeResource& resource) {
+  if (resource.model == nullptr) return;
+  int num_replicas =
+      resource.model_replicas != nullptr ? resource.model_replicas->size() : 1;
+  for (int i = 0; i < num_replicas; ++i) {
+    const auto& model = resource.model_replicas != nullptr
+                            ? resource.model_replicas->model(i)
+                            : resource.model;
+    model->Warmup(FLAGS_num_bins, WarmupChunkSizesFromFlags(),
+                  WarmupBatchSizesFromFlags());
+  }
+}
+
 #ifdef USE_ONNX
-    if (FLAGS_run_batch) {
-      LOG(INFO) << "BatchOnnxAsrModel Reading ONNX model dir: "
-                << FLAGS_onnx_dir;
-      BatchOnnxAsrModel::InitEngineThreads(kNumGemmThreads);
-      auto model = std::make_shared<BatchOnnxAsrModel>();
-      model->Read(FLAGS_onnx_dir, FLAGS_is_fp16, FLAGS_gpu_id);
-      resource->batch_model = model;
+TensorrtOptions TensorrtOptionsFromFlags() {
+  TensorrtOptions opts;
+  opts.enable = FLAGS_trt;
+  opts.fp16 = FLAGS_trt_fp16;
+  opts.cache_dir = FLAGS_trt_cache_dir;
+  opts.feature_dim = FLAGS_num_bins;
+  opts.max_batch_size = FLAGS_trt_max_batch_size;
+  std::vector<std::string> strs;
+  SplitStringToVector(FLAGS_trt_frame_buckets, ",", true, &strs);
+  opts.frame_buckets.clear();
+  for (const auto& str : strs) {
+    opts.frame_buckets.push_back(std::stoi(str));
+  }
+  return opts;
+}
+#endif
+
+// The cpu sets to pin the decode threads to by --cpu_affinity, the threads
+// of a session are pinned to the set of index session % size. Empty if
+// they are not pinned.
+std::vector<std::vector<int>> CpuSetsFromFlags() {
+  if (FLAGS_cpu_affinity.empty()) return {};
+  if (FLAGS_cpu_affinity == "numa") return GetNumaNodeCpus();
+  std::vector<int> cpus = ParseCpuList(FLAGS_cpu_affinity);
+  CHECK(!cpus.empty()) << "Invalid --cpu_affinity " << FLAGS_cpu_affinity;
+  return {cpus};
+}
+
+// Start the threads of the resource, i.e. the schedulers and the thread
+// pool of the batch decoding, e.g. again in a forked process, which has
+// none of the threads of its parent
+void StartDecodeThreadsFromFlags(DecodeResource* resource) {
+  const bool streaming_batch = FLAGS_run_batch && FLAGS_streaming_batch;
+  const bool batch_model = FLAGS_run_batch && !FLAGS_streaming_batch;
+  // The chunks of the streaming batch are batched only by the scheduler
+  if ((FLAGS_enable_chunk_scheduler && !FLAGS_run_batch) || streaming_batch) {
+    LOG(INFO) << "Enable chunk scheduler, max batch size "
+              << FLAGS_scheduler_max_batch_size << ", max wait "
+              << FLAGS_scheduler_max_wait_ms << "ms";
+    ChunkSchedulerOptions scheduler_opts;
+    scheduler_opts.max_batch_size = FLAGS_scheduler_max_batch_size;
+    scheduler_opts.max_wait_ms = FLAGS_scheduler_max_wait_ms;
+    scheduler_opts.batch_search = FLAGS_scheduler_batch_search;
+    resource->chunk_scheduler =
+        std::make_shared<ChunkScheduler>(scheduler_opts);
+  }
+
+  if (FLAGS_enable_rescoring_scheduler && !batch_model) {
+    LOG(INFO) << "Enable rescoring scheduler, max batch size "
+              << FLAGS_rescoring_max_batch_size << ", max wait "
+              << FLAGS_rescoring_max_wait_ms << "ms";
+    RescoringSchedulerOptions rescoring_opts;
+    rescoring_opts.max_batch_size = FLAGS_rescoring_max_batch_size;
+    rescoring_opts.max_wait_ms = FLAGS_rescoring_max_wait_ms;
+    resource->rescoring_scheduler =
+        std::make_shared<RescoringScheduler>(rescoring_opts);
+  }
+  if (FLAGS_rescoring_threads > 0 && !batch_model) {
+    LOG(INFO) << "Rescore the segments on " << FLAGS_rescoring_threads
+              << " threads";
+    resource->rescoring_pool =
+        std::make_shared<ThreadPool>(FLAGS_rescoring_threads);
+  }
+
+  if (FLAGS_run_batch) {
+    resource->thread_pool =
+        std::make_shared<ThreadPool>(FLAGS_batch_num_threads);
+  }
+}
+
+// The threads of the resource are not started if !start_threads, see
+// StartDecodeThreadsFromFlags
+std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags(
+    bool start_threads = true) {
+  auto resource = std::make_shared<DecodeResource>();
+  const int kNumGemmThreads = FLAGS_embedded ? 1 : FLAGS_intra_op_threads;
+  int max_rescoring_frames = FLAGS_max_rescoring_frames;
+  if (FLAGS_embedded && max_rescoring_frames == 0) {
+    max_rescoring_frames = FLAGS_embedded_rescoring_frames;
+  }
+  HugePageSize huge_pages;
+  CHECK(ParseHugePageSize(FLAGS_huge_pages, &huge_pages))
+      << "Invalid --huge_pages " << FLAGS_huge_pages;
+  // The pages of a mapped graph are the ones of the page cache
+  const bool fst_mmap =
+      (FLAGS_fst_mmap || FLAGS_embedded) && huge_pages == HugePageSize::kNone;
+  EncoderOutStorage encoder_out_storage;
+  CHECK(ParseEncoderOutStorage(FLAGS_encoder_out_storage,
+                               &encoder_out_storage))
+      << "Invalid --encoder_out_storage " << FLAGS_encoder_out_storage;
+  // The sections of the bundle are used instead of the files, see
+  // ModelBundle
+  std::shared_ptr<ModelBundle> bundle = nullptr;
+  if (!FLAGS_bundle_path.empty()) {
+    LOG(INFO) << "Mapping model bundle " << FLAGS_bundle_path;
+    bundle = ModelBundle::Open(FLAGS_bundle_path);
+    CHECK(bundle != nullptr) << "Invalid bundle " << FLAGS_bundle_path;
+  }
+  auto bundle_section = [&bundle](const std::string& name) {
+    return bundle == nullptr ? nullptr : bundle->Find(name);
+  };
+  const ModelBundle::Section* bundle_model = bundle_section("final.zip");
+  const std::string model_path =
+      bundle_model != nullptr ? FLAGS_bundle_path : FLAGS_model_path;
+  // The runtimes don't allow setting the threads again, e.g. at::
+  // set_num_interop_threads, when a replica or a reload is loaded
+  static std::once_flag engine_threads_once;
+  // The streaming batch decodes by the streaming model
+  const bool streaming_batch = FLAGS_run_batch && FLAGS_streaming_batch;
+  const bool batch_model = FLAGS_run_batch && !FLAGS_streaming_batch;
+  CHECK(!(FLAGS_quantized && batch_model))
+      << "The int8 models are for the streaming decoding";
+  CHECK(!(FLAGS_ctc_only && batch_model))
+      << "The ctc only models are for the streaming decoding";
+  CHECK(!(streaming_batch && FLAGS_chunk_size <= 0))
+      << "The streaming batch requires --chunk_size > 0";
+  // The resources independent of each other are loaded at the same time,
+  // the model by this thread, as the engine threads are set by it
+  ParallelLoader loader(FLAGS_parallel_loading);
+  std::shared_ptr<fst::SymbolTable> unit_table;
+  loader.Run("units", [&]() {
+    if (bundle_section("units") != nullptr) {
+      unit_table = bundle->ReadSymbolTable("units");
+    } else {
+      LOG(INFO) << "Reading unit table " << FLAGS_unit_path;
+      unit_table = std::shared_ptr<fst::SymbolTable>(
+          fst::SymbolTable::ReadText(FLAGS_unit_path));
+    }
+    CHECK(unit_table != nullptr);
+  });
+
+  const bool bundle_fst = bundle_section("TLG.fst") != nullptr;
+  const bool with_lm = !FLAGS_fst_path.empty() || bundle_fst;
+  if (with_lm) {
+    if (bundle_fst) {
+      CHECK(bundle_section("words") != nullptr)
+          << "No words of the TLG fst in " << FLAGS_bundle_path;
     } else {
-      LOG(INFO) << "Reading onnx model ";
-      OnnxAsrModel::InitEngineThreads(kNumGemmThreads);
-      auto model = std::make_shared<OnnxAsrModel>();
-      model->Read(FLAGS_onnx_dir);
-      resource->model = model;
+      CHECK(!FLAGS_dict_path.empty());
+    }
+    loader.Run("fst", [&]() {
+      std::shared_ptr<fst::Fst<fst::StdArc>> fst;
+      if (bundle_fst) {
+        fst = bundle->ReadFst("TLG.fst", fst_mmap);
+      } else {
+        LOG(INFO) << "Reading fst " << FLAGS_fst_path;
+        fst = ReadFst(FLAGS_fst_path, fst_mmap);
+      }
+      CHECK(fst != nullptr);
+      if (huge_pages != HugePageSize::kNone) AdviseFstHugePages(*fst);
+      if (!FLAGS_g_fst_path.empty()) {
+        LOG(INFO) << "Reading G fst " << FLAGS_g_fst_path
+                  << ", compose it with " << FLAGS_fst_path << " on the fly";
+        auto g_fst = ReadFst(FLAGS_g_fst_path, fst_mmap);
+        CHECK(g_fst != nullptr);
+        fst = ComposeLazily(*fst, *g_fst,
+                            static_cast<size_t>(FLAGS_fst_cache_mb) << 20);
+        CHECK(fst != nullptr);
+      }
+      resource->fst = fst;
+    });
+    if (!FLAGS_lattice_new_lm_path.empty()) {
+      CHECK(!FLAGS_lattice_old_lm_path.empty())
+          << "--lattice_new_lm_path takes --lattice_old_lm_path";
+      loader.Run("lattice_lm", [&]() {
+        LOG(INFO) << "Reading the lattice rescoring LMs "
+                  << FLAGS_lattice_old_lm_path << " and "
+                  << FLAGS_lattice_new_lm_path;
+        auto old_lm = ReadFst(FLAGS_lattice_old_lm_path, fst_mmap);
+        auto new_lm = ReadFst(FLAGS_lattice_new_lm_path, fst_mmap);
+        CHECK(old_lm != nullptr && new_lm != nullptr);
+        resource->lattice_rescorer =
+            std::make_shared<LatticeRescorer>(old_lm, new_lm);
+      });
     }
+    loader.Run("words", [&]() {
+      std::shared_ptr<fst::SymbolTable> symbol_table;
+      if (bundle_fst) {
+        symbol_table = bundle->ReadSymbolTable("words");
+      } else {
+        LOG(INFO) << "Reading symbol table " << FLAGS_dict_path;
+        symbol_table = std::shared_ptr<fst::SymbolTable>(
+            fst::SymbolTable::ReadText(FLAGS_dict_path));
+      }
+      CHECK(symbol_table != nullptr);
+      resource->symbol_table = symbol_table;
+    });
+  }
+
+  auto post_process_resource = std::make_shared<PostProcessResource>();
+  if (!FLAGS_itn_tagger_path.empty()) {
+    loader.Run("itn", [&]() {
+      LOG(INFO) << "Reading itn " << FLAGS_itn_tagger_path << " and "
+                << FLAGS_itn_verbalizer_path;
+      post_process_resource->itn = ItnProcessor::Read(
+          FLAGS_itn_tagger_path, FLAGS_itn_verbalizer_path);
+      CHECK(post_process_resource->itn != nullptr);
+    });
+  }
+
+  std::shared_ptr<NgramModel> word_lm;
+  if (FLAGS_token_lm_corpus.empty() && !FLAGS_word_lm_path.empty()) {
+    CHECK(!FLAGS_lexicon_path.empty()) << "--word_lm_path takes a lexicon";
+    loader.Run("word lm", [&]() {
+      LOG(INFO) << "Reading word lm " << FLAGS_word_lm_path;
+      word_lm = std::make_shared<NgramModel>();
+      CHECK(word_lm->Open(FLAGS_word_lm_path));
+    });
+  }
+
+  if ((!FLAGS_onnx_dir.empty() || !FLAGS_xpu_model_dir.empty()) &&
+      (FLAGS_max_chunk_size > 0 || FLAGS_max_catchup_chunks > 0)) {
+    LOG(WARNING) << "--max_chunk_size and --max_catchup_chunks are of the "
+                 << "torch models only, the chunk size stays "
+                 << FLAGS_chunk_size;
+  }
+  loader.RunHere("model", [&]() {
+    if (!FLAGS_onnx_dir.empty()) {
+#ifdef USE_ONNX
+      if (batch_model) {
+        LOG(INFO) << "BatchOnnxAsrModel Reading ONNX model dir: "
+                  << FLAGS_onnx_dir;
+        std::call_once(engine_threads_once,
+                       BatchOnnxAsrModel::InitEngineThreads, kNumGemmThreads);
+        auto model = std::make_shared<BatchOnnxAsrModel>();
+        model->set_num_sessions(FLAGS_onnx_gpu_sessions);
+        model->Read(FLAGS_onnx_dir, FLAGS_is_fp16, FLAGS_gpu_id,
+                    TensorrtOptionsFromFlags());
+        resource->batch_model = model;
+      } else {
+        LOG(INFO) << "Reading onnx model ";
+        std::call_once(engine_threads_once, [&]() {
+          std::vector<std::string> providers;
+          SplitStringToVector(FLAGS_onnx_providers, ",", true, &providers);
+          // The accelerators bring their own threads, the providers which
+          // are unavailable fall back to the intra-op threads of the cpu
+          int num_providers = OnnxAsrModel::AppendExecutionProviders(
+              providers, kNumGemmThreads, FLAGS_onnx_fp16);
+          OnnxAsrModel::InitEngineThreads(
+              num_providers > 0 ? 1 : kNumGemmThreads,
+              FLAGS_onnx_global_thread_pool);
+          OnnxSessionOptions session_opts;
+          session_opts.graph_optimization = FLAGS_onnx_graph_optimization;
+          session_opts.optimized_model_dir = FLAGS_onnx_optimized_model_dir;
+          session_opts.enable_mem_pattern = FLAGS_onnx_mem_pattern;
+          session_opts.enable_cpu_mem_arena = FLAGS_onnx_cpu_mem_arena;
+          OnnxAsrModel::SetSessionOptions(session_opts);
+          OnnxAsrModel::UseHugePages(huge_pages);
+        });
+        // The cpu provider has no bf16 kernels of the encoder
+        LOG_IF(WARNING, FLAGS_cpu_bf16)
+            << "--cpu_bf16 is of the torch model, the onnx model runs in "
+               "fp32";
+        auto model = std::make_shared<OnnxAsrModel>();
+        model->set_early_exit(FLAGS_onnx_early_exit_threshold,
+                              FLAGS_onnx_max_exit_chunks);
+        model->Read(FLAGS_onnx_dir, FLAGS_quantized, FLAGS_ctc_only);
+        model->set_use_io_binding(FLAGS_onnx_io_binding);
+        model->set_encoder_out_storage(encoder_out_storage);
+        resource->model = model;
+      }
 #else
-    LOG(FATAL) << "Please rebuild with cmake options '-DONNX=ON'.";
+      LOG(FATAL) << "Please rebuild with cmake options '-DONNX=ON'.";
 #endif
-  } else if (!FLAGS_model_path.empty()) {
+    } else if (!model_path.empty()) {
 #ifdef USE_TORCH
-    if (FLAGS_run_batch) {
-      LOG(INFO) << "BatchTorchAsrModel Reading torch model "
-                << FLAGS_model_path;
-      BatchTorchAsrModel::InitEngineThreads(kNumGemmThreads);
-      auto model = std::make_shared<BatchTorchAsrModel>();
-      model->Read(FLAGS_model_path);
-      resource->batch_model = model;
-    } else {
-      LOG(INFO) << "Reading torch model " << FLAGS_model_path;
-      TorchAsrModel::InitEngineThreads(kNumGemmThreads);
-      auto model = std::make_shared<TorchAsrModel>();
-      model->Read(FLAGS_model_path);
-      resource->model = model;
-    }
+      if (batch_model) {
+        LOG(INFO) << "BatchTorchAsrModel Reading torch model "
+                  << model_path;
+        std::call_once(engine_threads_once,
+                       BatchTorchAsrModel::InitEngineThreads, kNumGemmThreads);
+        TorchAsrModel::UseHugePages(huge_pages);
+        auto model = std::make_shared<BatchTorchAsrModel>();
+        model->set_optimize(FLAGS_optimize_torch_model,
+                            FLAGS_optimized_torch_model);
+        if (bundle_model != nullptr) {
+          model->set_model_data(bundle_model->data, bundle_model->size);
+        }
+        model->Read(model_path);
+        resource->batch_model = model;
+      } else {
+        LOG(INFO) << "Reading torch model " << model_path;
+        std::call_once(engine_threads_once, TorchAsrModel::InitEngineThreads,
+                       kNumGemmThreads);
+        TorchAsrModel::UseHugePages(huge_pages);
+        std::vector<std::string> strs;
+        SplitStringToVector(FLAGS_gpu_ids, ",", true, &strs);
+        std::vector<int> gpu_ids;
+        for (const auto& str : strs) gpu_ids.push_back(std::stoi(str));
+        if (gpu_ids.empty()) gpu_ids.push_back(FLAGS_gpu_id);
+        std::vector<std::shared_ptr<AsrModel>> replicas;
+        for (int gpu_id : gpu_ids) {
+          auto model = std::make_shared<TorchAsrModel>();
+          model->set_optimize(FLAGS_optimize_torch_model,
+                              FLAGS_optimized_torch_model);
+          model->set_bf16(FLAGS_cpu_bf16);
+          if (bundle_model != nullptr) {
+            model->set_model_data(bundle_model->data, bundle_model->size);
+          }
+          model->Read(model_path, FLAGS_freeze_torch_model,
+                      FLAGS_quantized, FLAGS_is_fp16, gpu_id, FLAGS_ctc_only);
+          model->set_device_cache(FLAGS_torch_device_cache);
+          model->set_cuda_graph(FLAGS_cuda_graph_max_chunks);
+          model->CaptureCudaGraphs(FLAGS_num_bins, WarmupChunkSizesFromFlags(),
+                                   FLAGS_num_left_chunks);
+          model->set_cache_pool(FLAGS_cache_pool_blocks);
+          model->set_max_rescoring_frames(max_rescoring_frames);
+          model->set_encoder_out_storage(encoder_out_storage);
+          replicas.push_back(model);
+        }
+        resource->model = replicas[0];
+        if (replicas.size() > 1) {
+          LOG(INFO) << "Replicas of the torch model on " << FLAGS_gpu_ids;
+          resource->model_replicas =
+              std::make_shared<ModelReplicas>(std::move(replicas));
+        }
+      }
 #else
-    LOG(FATAL) << "Please rebuild with cmake options '-DTORCH=ON'.";
+      LOG(FATAL) << "Please rebuild with cmake options '-DTORCH=ON'.";
 #endif
-  } else if (!FLAGS_xpu_model_dir.empty()) {
+    } else if (!FLAGS_xpu_model_dir.empty()) {
 #ifdef USE_XPU
-    LOG(INFO) << "Reading XPU WeNet model weight from " << FLAGS_xpu_model_dir;
-    auto model = std::make_shared<XPUAsrModel>();
-    model->SetEngineThreads(kNumGemmThreads);
-    model->SetDeviceId(FLAGS_device_id);
-    model->Read(FLAGS_xpu_model_dir);
-    resource->model = model;
+      LOG(INFO) << "Reading XPU WeNet model weight from "
+                << FLAGS_xpu_model_dir;
+      std::vector<std::string> strs;
+      SplitStringToVector(FLAGS_xpu_device_ids, ",", true, &strs);
+      std::vector<int> device_ids;
+      for (const auto& str : strs) device_ids.push_back(std::stoi(str));
+      if (device_ids.empty()) device_ids.push_back(FLAGS_device_id);
+      std::vector<std::shared_ptr<AsrModel>> replicas;
+      for (int device_id : device_ids) {
+        auto model = std::make_shared<XPUAsrModel>();
+        model->SetEngineThreads(kNumGemmThreads);
+        model->SetDeviceId(device_id);
+        model->SetNumStreams(FLAGS_xpu_streams_per_device);
+        model->Read(FLAGS_xpu_model_dir);
+        replicas.push_back(model);
+      }
+      resource->model = replicas[0];
+      if (replicas.size() > 1) {
+        LOG(INFO) << "Replicas of the XPU model on " << FLAGS_xpu_device_ids;
+        resource->model_replicas =
+            std::make_shared<ModelReplicas>(std::move(replicas));
+      }
 #else
-    LOG(FATAL) << "Please rebuild with cmake options '-DXPU=ON'.";
+      LOG(FATAL) << "Please rebuild with cmake options '-DXPU=ON'.";
 #endif
-  } else {
-    LOG(FATAL) << "Please set ONNX, TORCH or XPU model path!!!";
-  }
+    } else {
+      LOG(FATAL) << "Please set ONNX, TORCH or XPU model path!!!";
+    }
+  });
+  loader.Wait();
 
-  LOG(INFO) << "Reading unit table " << FLAGS_unit_path;
-  auto unit_table = std::shared_ptr<fst::SymbolTable>(
-      fst::SymbolTable::ReadText(FLAGS_unit_path));
-  CHECK(unit_table != nullptr);
   resource->unit_table = unit_table;
-
-  if (!FLAGS_fst_path.empty()) {  // With LM
-    CHECK(!FLAGS_dict_path.empty());
-    LOG(INFO) << "Reading fst " << FLAGS_fst_path;
-    auto fst = std::shared_ptr<fst::Fst<fst::StdArc>>(
-        fst::Fst<fst::StdArc>::Read(FLAGS_fst_path));
-    CHECK(fst != nullptr);
-    resource->fst = fst;
-
-    LOG(INFO) << "Reading symbol table " << FLAGS_dict_path;
-    auto symbol_table = std::shared_ptr<fst::SymbolTable>(
-        fst::SymbolTable::ReadText(FLAGS_dict_path));
-    CHECK(symbol_table != nullptr);
-    resource->symbol_table = symbol_table;
-  } else {  // Without LM, symbol_table is the same as unit_table
+  if (!with_lm) {  // Without LM, symbol_table is the same as unit_table
     resource->symbol_table = unit_table;
   }
+  BuildSymbolMaps(resource.get());
 
-  if (!FLAGS_context_path.empty()) {
-    LOG(INFO) << "Reading context " << FLAGS_context_path;
+  if (!FLAGS_context_path.empty() || bundle_section("context") != nullptr) {
     std::vector<std::string> contexts;
-    std::ifstream infile(FLAGS_context_path);
-    std::string context;
-    while (getline(infile, context)) {
-      contexts.emplace_back(Trim(context));
+    if (bundle_section("context") != nullptr) {
+      for (const auto& context : bundle->ReadLines("context")) {
+        contexts.emplace_back(Trim(context));
+      }
+    } else {
+      LOG(INFO) << "Reading context " << FLAGS_context_path;
+      std::ifstream infile(FLAGS_context_path);
+      std::string context;
+      while (getline(infile, context)) {
+        contexts.emplace_back(Trim(context));
+      }
+    }
+    loader.RunHere("context graph", [&]() {
+      ContextConfig config;
+      config.context_score = FLAGS_context_score;
+      resource->context_graph = std::make_shared<ContextGraph>(config);
+      resource->context_graph->BuildContextGraph(contexts,
+                                                 *resource->symbol_map);
+    });
+  }
+
+  if (!FLAGS_token_lm_corpus.empty()) {
+    LOG(INFO) << "Reading lm corpus " << FLAGS_token_lm_corpus;
+    std::vector<std::vector<int>> sentences;
+    std::ifstream infile(FLAGS_token_lm_corpus);
+    std::string line;
+    while (getline(infile, line)) {
+      std::vector<std::string> units;
+      SplitString(line, &units);
+      std::vector<int> sentence;
+      for (const auto& unit : units) {
+        int64_t id = unit_table->Find(unit);
+        if (id != fst::kNoSymbol) sentence.push_back(id);
+      }
+      sentences.emplace_back(std::move(sentence));
+    }
+    resource->language_model = std::make_shared<NgramLanguageModel>(
+        FLAGS_token_lm_order, unit_table->NumSymbols(), sentences);
+  } else if (!FLAGS_word_lm_path.empty()) {
+    auto lexicon = std::make_shared<Lexicon>();
+    std::ifstream infile(FLAGS_lexicon_path);
+    std::string line;
+    while (getline(infile, line)) {
+      std::vector<std::string> fields;
+      SplitString(line, &fields);
+      std::vector<int> units;
+      for (size_t i = 1; i < fields.size(); ++i) {
+        int64_t id = unit_table->Find(fields[i]);
+        if (id == fst::kNoSymbol) break;
+        units.push_back(id);
+      }
+      // The words of unknown units are never matched
+      if (fields.size() < 2 || units.size() + 1 < fields.size()) continue;
+      lexicon->Add(units, word_lm->WordId(fields[0]));
     }
-    ContextConfig config;
-    config.context_score = FLAGS_context_score;
-    resource->context_graph = std::make_shared<ContextGraph>(config);
-    resource->context_graph->BuildContextGraph(contexts,
-                                               resource->symbol_table);
+    lexicon->Smear(*word_lm);
+    resource->language_model =
+        std::make_shared<WordNgramLanguageModel>(word_lm, lexicon);
+  }
+
+  if (start_threads) StartDecodeThreadsFromFlags(resource.get());
+  if (FLAGS_warmup_model) WarmupModelFromFlags(*resource);
+
+  if (FLAGS_run_batch) {
+    FeaturePlacementOptions placement_opts;
+    CHECK(ParseFeaturePlacement(FLAGS_feature_placement,
+                                &placement_opts.placement))
+        << "Invalid --feature_placement " << FLAGS_feature_placement;
+    placement_opts.min_gpu_batch_size = FLAGS_gpu_feature_min_batch_size;
+    placement_opts.max_gpu_inflight = FLAGS_gpu_feature_max_inflight;
+#ifdef USE_GPU
+    bool gpu_available = true;
+#else
+    bool gpu_available = false;
+#endif
+    resource->feature_placer =
+        std::make_shared<FeaturePlacer>(placement_opts, gpu_available);
   }
 
   PostProcessOptions post_process_opts;
   post_process_opts.language_type =
       FLAGS_language_type == 0 ? kMandarinEnglish : kIndoEuropean;
   post_process_opts.lowercase = FLAGS_lowercase;
-  resource->post_processor =
-      std::make_shared<PostProcessor>(std::move(post_process_opts));
+  resource->post_processor = std::make_shared<PostProcessor>(
+      std::move(post_process_opts), post_process_resource);
+  resource->fbank_tables =
+      FeaturePipelineConfig(FLAGS_num_bins, FLAGS_sample_rate)
+          .NewFbankTables();
   return resource;
 }
 
+// One resource per NUMA node with --numa_replicas, each loaded by a thread
+// pinned to its node, so its weights are allocated on the node. The
+// replica i is for the sessions pinned to CpuSetsFromFlags()[i].
+std::vector<std::shared_ptr<DecodeResource>> InitDecodeResourcesFromFlags(
+    bool start_threads = true) {
+  if (!FLAGS_numa_replicas) return {InitDecodeResourceFromFlags(start_threads)};
+  CHECK_EQ(FLAGS_cpu_affinity, "numa")
+      << "--numa_replicas requires --cpu_affinity=numa";
+  std::vector<std::vector<int>> nodes = GetNumaNodeCpus();
+  std::vector<std::shared_ptr<DecodeResource>> replicas(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    LOG(INFO) << "Loading the replica of NUMA node " << i;
+    RunOnCpus(nodes[i], [&replicas, i, start_threads]() {
+      replicas[i] = InitDecodeResourceFromFlags(start_threads);
+    });
+  }
+  return replicas;
+}
+
+// StartDecodeThreadsFromFlags of the resources of
+// InitDecodeResourcesFromFlags, each on the node of its replica
+void StartDecodeThreadsFromFlags(
+    const std::vector<std::shared_ptr<DecodeResource>>& replicas) {
+  if (!FLAGS_numa_replicas) {
+    for (const auto& replica : replicas) {
+      StartDecodeThreadsFromFlags(replica.get());
+    }
+    return;
+  }
+  std::vector<std::vector<int>> nodes = GetNumaNodeCpus();
+  CHECK_EQ(nodes.size(), replicas.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    RunOnCpus(nodes[i], [&replicas, i]() {
+      StartDecodeThreadsFromFlags(replicas[i].get());
+    });
+  }
+}
+
+// Load the resource from the flags again for the hot reload of a server,
+// and warm it up before it serves any session. Returns nullptr if any of the
+// files is missing, so the server keeps its current resource.
+std::shared_ptr<DecodeResource> ReloadDecodeResourceFromFlags(
+    const FeaturePipelineConfig& feature_config,
+    const DecodeOptions& decode_config) {
+  const std::vector<std::string> paths = {
+      FLAGS_model_path, FLAGS_onnx_dir,     FLAGS_xpu_model_dir,
+      FLAGS_unit_path,  FLAGS_fst_path,     FLAGS_g_fst_path,
+      FLAGS_dict_path,  FLAGS_context_path, FLAGS_token_lm_corpus,
+      FLAGS_word_lm_path, FLAGS_lexicon_path, FLAGS_itn_tagger_path,
+      FLAGS_itn_verbalizer_path};
+  for (const auto& path : paths) {
+    if (!path.empty() && !FileExists(path)) {
+      LOG(ERROR) << path << " doesn't exist";
+      return nullptr;
+    }
+  }
+  auto resource = InitDecodeResourceFromFlags();
+  // It's warmed up by the shapes of --warmup_model already, else by a
+  // decode of silence. The batch resource has no streaming model to warm up.
+  if (!FLAGS_warmup_model && (!FLAGS_run_batch || FLAGS_streaming_batch)) {
+    WarmupDecodeResource(resource, feature_config, decode_config);
+  }
+  return resource;
+}
+
+// ReloadDecodeResourceFromFlags of all the replicas, each on its node.
+// Returns an empty vector if any of them fails.
+std::vector<std::shared_ptr<DecodeResource>> ReloadDecodeResourcesFromFlags(
+    const FeaturePipelineConfig& feature_config,
+    const DecodeOptions& decode_config) {
+  if (!FLAGS_numa_replicas) {
+    auto resource = ReloadDecodeResourceFromFlags(feature_config,
+                                                  decode_config);
+    if (resource == nullptr) return {};
+    return {resource};
+  }
+  std::vector<std::vector<int>> nodes = GetNumaNodeCpus();
+  std::vector<std::shared_ptr<DecodeResource>> replicas(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    RunOnCpus(nodes[i], [&]() {
+      replicas[i] = ReloadDecodeResourceFromFlags(feature_config,
+                                                  decode_config);
+    });
+    if (replicas[i] == nullptr) return {};
+  }
+  return replicas;
+}
+
+// Load the named resources of --models into the registry, each by the flags
+// with the ones of its flag file set on top, which are restored after it.
+// With reload, e.g. on SIGHUP, they are warmed up first, and one failing to
+// reload keeps the current one. Return false if any of them fails.
+bool LoadNamedDecodeResourcesFromFlags(
+    const FeaturePipelineConfig& feature_config,
+    const DecodeOptions& decode_config, bool reload,
+    ResourceRegistry* registry) {
+  std::vector<std::string> entries;
+  SplitStringToVector(FLAGS_models, ",", true, &entries);
+  bool ok = true;
+  for (const auto& entry : entries) {
+    size_t pos = entry.find(':');
+    CHECK(pos != std::string::npos && pos > 0 && pos + 1 < entry.size())
+        << "name:flagfile is expected in --models, got " << entry;
+    const std::string name = entry.substr(0, pos);
+    const std::string flagfile = entry.substr(pos + 1);
+    std::vector<std::shared_ptr<DecodeResource>> replicas;
+    {
+      gflags::FlagSaver saver;
+      if (!gflags::ReadFromFlagsFile(flagfile, gflags::GetArgv0(), !reload)) {
+        LOG(ERROR) << "Failed to read the flags of model " << name;
+        ok = false;
+        continue;
+      }
+      LOG(INFO) << "Loading model " << name << " by " << flagfile;
+      replicas = reload ? ReloadDecodeResourcesFromFlags(feature_config,
+                                                         decode_config)
+                        : InitDecodeResourcesFromFlags();
+    }
+    if (replicas.empty()) {
+      LOG(ERROR) << "Failed to reload model " << name << ", keep it";
+      ok = false;
+      continue;
+    }
+    registry->Add(name, std::move(replicas));
+  }
+  return ok;
+}
+
+// The ResultCache of --result_cache_size, nullptr if it's disabled
+std::shared_ptr<ResultCache> InitResultCacheFromFlags() {
+  if (FLAGS_result_cache_size <= 0) return nullptr;
+  return std::make_shared<ResultCache>(FLAGS_result_cache_size);
+}
+
+// The context of the cached results, a hash of all the flags, by which the
+// model and the options of the process are identified
+uint64_t ResultCacheContextFromFlags() {
+  return ResultCache::Hash(gflags::CommandlineFlagsIntoString());
+}
+
 }  // namespace wenet
 
 #endif  // DECODER_PARAMS_H_
@@ -0,0 +1,60 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/partial_coalescer.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "utils/metrics.h"
+
+namespace wenet {
+
+bool PartialCoalescer::ShouldSend(const std::vector<DecodeResult>& result) {
+  int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+  return ShouldSend(result, now_ms);
+}
+
+bool PartialCoalescer::ShouldSend(const std::vector<DecodeResult>& result,
+                                  int64_t now_ms) {
+  static Counter* num_coalesced = Metrics::Instance().GetCounter(
+      "wenet_coalesced_partials_total",
+      "Number of the partial results not sent by the coalescing");
+  size_t size = result.size();
+  if (nbest_ > 0) size = std::min(size, static_cast<size_t>(nbest_));
+  bool changed = !sent_ || size != last_sentences_.size();
+  for (size_t i = 0; !changed && i < size; ++i) {
+    changed = result[i].sentence != last_sentences_[i];
+  }
+  if (!changed || (sent_ && now_ms - last_ms_ < interval_ms_)) {
+    num_coalesced->Increment();
+    return false;
+  }
+  sent_ = true;
+  last_ms_ = now_ms;
+  last_sentences_.resize(size);
+  for (size_t i = 0; i < size; ++i) {
+    last_sentences_[i] = result[i].sentence;
+  }
+  return true;
+}
+
+void PartialCoalescer::Reset() {
+  sent_ = false;
+  last_sentences_.clear();
+}
+
+}  // namespace wenet
@@ -0,0 +1,58 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_PARTIAL_COALESCER_H_
+#define DECODER_PARTIAL_COALESCER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decoder/decode_result.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// PartialCoalescer decides which partial results of a session are sent, so
+// the ones that can't be told from the last sent one aren't serialized and
+// sent at all. A partial is sent only if the sentences of its n-best have
+// changed, and at most once per `interval_ms`, the skipped changes are
+// carried by the next partial or the final result.
+class PartialCoalescer {
+ public:
+  // nbest: the paths compared, <= 0 for all of them
+  // interval_ms: 0 means the partials are only coalesced by the text
+  PartialCoalescer(int nbest, int interval_ms)
+      : nbest_(nbest), interval_ms_(interval_ms) {}
+
+  // Whether to send the partial `result`, it's taken as sent if so
+  bool ShouldSend(const std::vector<DecodeResult>& result);
+  bool ShouldSend(const std::vector<DecodeResult>& result, int64_t now_ms);
+  // Start over after a final result
+  void Reset();
+
+ private:
+  const int nbest_;
+  const int interval_ms_;
+  bool sent_ = false;
+  int64_t last_ms_ = 0;
+  std::vector<std::string> last_sentences_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(PartialCoalescer);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_PARTIAL_COALESCER_H_
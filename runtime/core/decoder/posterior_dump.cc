@@ -0,0 +1,226 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/posterior_dump.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "decoder/encoder_out_store.h"
+#include "utils/log.h"
+#include "utils/state_io.h"
+
+namespace wenet {
+
+// The file is the header, the records, the index of the records and the
+// footer of the offset and the size of the index
+static const char kMagic[4] = {'W', 'P', 'S', 'T'};
+static const uint32_t kVersion = 1;
+static const size_t kHeaderBytes = sizeof(kMagic) + sizeof(kVersion) + 1;
+static const size_t kFooterBytes = 2 * sizeof(uint64_t) + sizeof(kMagic);
+// The lowest fp16, to which the -inf and the -kFloatMax of the blank frames
+// are clamped, so there are no inf in the search
+static const float kHalfLowest = -65504.0f;
+
+static void WriteScores(const float* data, size_t size, bool half,
+                        StateWriter* writer) {
+  writer->Write<uint64_t>(size);
+  if (!half) {
+    writer->Write(data, size);
+    return;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    writer->Write(EncoderOutStore::FloatToHalf(
+        std::min(std::max(data[i], kHalfLowest), -kHalfLowest)));
+  }
+}
+
+static bool ReadScores(bool half, StateReader* reader,
+                       std::vector<float>* scores) {
+  if (!half) return reader->ReadVector(scores);
+  std::vector<uint16_t> values;
+  if (!reader->ReadVector(&values)) return false;
+  scores->resize(values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    (*scores)[i] = EncoderOutStore::HalfToFloat(values[i]);
+  }
+  return true;
+}
+
+PosteriorWriter::PosteriorWriter(const std::string& path, bool half)
+    : half_(half), out_(path, std::ios::binary) {
+  CHECK(out_.is_open()) << "Failed to open " << path;
+  out_.write(kMagic, sizeof(kMagic));
+  out_.write(reinterpret_cast<const char*>(&kVersion), sizeof(kVersion));
+  char flag = half_ ? 1 : 0;
+  out_.write(&flag, 1);
+  offset_ = kHeaderBytes;
+}
+
+void PosteriorWriter::Write(const PosteriorRecord& record) {
+  StateWriter writer;
+  writer.WriteString(record.key);
+  writer.Write<int32_t>(record.num_frames);
+  writer.Write<uint64_t>(record.chunks.size());
+  for (const auto& chunk : record.chunks) {
+    writer.Write<uint8_t>(chunk.topk ? 1 : 0);
+    if (!chunk.topk) {
+      writer.Write<int32_t>(chunk.log_probs.rows());
+      writer.Write<int32_t>(chunk.log_probs.cols());
+      WriteScores(chunk.log_probs.data(),
+                  static_cast<size_t>(chunk.log_probs.rows()) *
+                      chunk.log_probs.cols(),
+                  half_, &writer);
+      continue;
+    }
+    CHECK_EQ(chunk.topk_scores.size(), chunk.topk_indexs.size());
+    writer.Write<uint64_t>(chunk.topk_scores.size());
+    for (size_t t = 0; t < chunk.topk_scores.size(); ++t) {
+      WriteScores(chunk.topk_scores[t].data(), chunk.topk_scores[t].size(),
+                  half_, &writer);
+      writer.WriteVector(chunk.topk_indexs[t]);
+    }
+  }
+  writer.WriteString(record.model_state);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(out_.is_open()) << "Write after Close()";
+  out_.write(writer.str().data(), writer.str().size());
+  index_.push_back({record.key, offset_, writer.str().size()});
+  offset_ += writer.str().size();
+}
+
+void PosteriorWriter::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!out_.is_open()) return;
+  StateWriter writer;
+  writer.Write<uint64_t>(index_.size());
+  for (const Entry& entry : index_) {
+    writer.WriteString(entry.key);
+    writer.Write(entry.offset);
+    writer.Write(entry.size);
+  }
+  writer.Write(offset_);
+  writer.Write<uint64_t>(writer.str().size() - sizeof(uint64_t));
+  writer.Write(kMagic, sizeof(kMagic));
+  out_.write(writer.str().data(), writer.str().size());
+  out_.close();
+  if (out_.fail()) LOG(ERROR) << "Failed to write the posteriors";
+}
+
+bool PosteriorReader::Open(const std::string& path) {
+  in_.open(path, std::ios::binary);
+  if (!in_.is_open()) return false;
+  in_.seekg(0, std::ios::end);
+  uint64_t file_size = in_.tellg();
+  if (file_size < kHeaderBytes + kFooterBytes) return false;
+  char header[kHeaderBytes];
+  in_.seekg(0);
+  in_.read(header, kHeaderBytes);
+  uint32_t version = 0;
+  memcpy(&version, header + sizeof(kMagic), sizeof(version));
+  if (memcmp(header, kMagic, sizeof(kMagic)) != 0 || version != kVersion) {
+    return false;
+  }
+  half_ = header[kHeaderBytes - 1] != 0;
+
+  char footer[kFooterBytes];
+  in_.seekg(file_size - kFooterBytes);
+  in_.read(footer, kFooterBytes);
+  uint64_t index_offset = 0, index_size = 0;
+  memcpy(&index_offset, footer, sizeof(index_offset));
+  memcpy(&index_size, footer + sizeof(index_offset), sizeof(index_size));
+  if (memcmp(footer + 2 * sizeof(uint64_t), kMagic, sizeof(kMagic)) != 0 ||
+      index_offset < kHeaderBytes ||
+      index_size != file_size - kFooterBytes - index_offset) {
+    return false;
+  }
+  std::string blob(index_size, '\0');
+  in_.seekg(index_offset);
+  in_.read(&blob[0], index_size);
+  if (!in_) return false;
+  StateReader reader(blob);
+  uint64_t num_records = 0;
+  // A key, an offset and a size are at least 24 bytes
+  if (!reader.Read(&num_records) ||
+      num_records > reader.remaining() / (3 * sizeof(uint64_t))) {
+    return false;
+  }
+  index_.resize(num_records);
+  for (auto& entry : index_) {
+    if (!reader.ReadString(&entry.key) || !reader.Read(&entry.offset) ||
+        !reader.Read(&entry.size) || entry.offset < kHeaderBytes ||
+        entry.offset > index_offset ||
+        entry.size > index_offset - entry.offset) {
+      index_.clear();
+      return false;
+    }
+  }
+  return reader.done();
+}
+
+bool PosteriorReader::Read(int i, PosteriorRecord* record) {
+  const PosteriorWriter::Entry& entry = index_[i];
+  std::string blob(entry.size, '\0');
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_.seekg(entry.offset);
+    in_.read(&blob[0], entry.size);
+    if (!in_) {
+      in_.clear();
+      return false;
+    }
+  }
+  StateReader reader(blob);
+  record->Clear();
+  uint64_t num_chunks = 0;
+  // A chunk is at least 9 bytes
+  if (!reader.ReadString(&record->key) || !reader.Read(&record->num_frames) ||
+      !reader.Read(&num_chunks) || num_chunks > reader.remaining() / 9) {
+    return false;
+  }
+  record->chunks.resize(num_chunks);
+  std::vector<float> scores;
+  for (auto& chunk : record->chunks) {
+    uint8_t topk = 0;
+    if (!reader.Read(&topk)) return false;
+    chunk.topk = topk != 0;
+    if (!chunk.topk) {
+      int32_t rows = 0, cols = 0;
+      if (!reader.Read(&rows) || !reader.Read(&cols) || rows < 0 ||
+          cols < 0 || !ReadScores(half_, &reader, &scores) ||
+          scores.size() != static_cast<size_t>(rows) * cols) {
+        return false;
+      }
+      chunk.log_probs.Resize(rows, cols);
+      std::copy(scores.begin(), scores.end(), chunk.log_probs.data());
+      continue;
+    }
+    uint64_t rows = 0;
+    // A frame is at least 16 bytes of the sizes
+    if (!reader.Read(&rows) || rows > reader.remaining() / 16) return false;
+    chunk.topk_scores.resize(rows);
+    chunk.topk_indexs.resize(rows);
+    for (uint64_t t = 0; t < rows; ++t) {
+      if (!ReadScores(half_, &reader, &chunk.topk_scores[t]) ||
+          !reader.ReadVector(&chunk.topk_indexs[t]) ||
+          chunk.topk_scores[t].size() != chunk.topk_indexs[t].size()) {
+        return false;
+      }
+    }
+  }
+  return reader.ReadString(&record->model_state) && reader.done();
+}
+
+}  // namespace wenet
@@ -0,0 +1,115 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_POSTERIOR_DUMP_H_
+#define DECODER_POSTERIOR_DUMP_H_
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils/matrix.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The ctc log probs of a chunk as they were searched, either the full
+// [T, vocab] matrix or the topk of each frame
+struct PosteriorChunk {
+  bool topk = false;
+  Matrix<float> log_probs;
+  std::vector<std::vector<float>> topk_scores;
+  std::vector<std::vector<int32_t>> topk_indexs;
+};
+
+// The posteriors of an utterance recorded by AsrDecoder, which are searched
+// again by AsrDecoder::DecodePosteriors() of other search options, e.g. to
+// sweep the beams and the weights without the encoder forward
+struct PosteriorRecord {
+  std::string key;
+  // The decoded feature frames, of the timestamps
+  int num_frames = 0;
+  std::vector<PosteriorChunk> chunks;
+  // AsrModel::SaveState() after the last chunk, i.e. the encoder outputs
+  // of the attention rescoring, empty if the model can't save it
+  std::string model_state;
+
+  void Clear() {
+    key.clear();
+    num_frames = 0;
+    chunks.clear();
+    model_state.clear();
+  }
+};
+
+// PosteriorWriter appends the records to an indexed binary file, whose
+// index of the keys is written at the end by Close(). The log probs are
+// stored as fp16 if `half`, which is about a half of the file of fp32. It's
+// thread safe.
+class PosteriorWriter {
+ public:
+  PosteriorWriter(const std::string& path, bool half);
+  ~PosteriorWriter() { Close(); }
+
+  void Write(const PosteriorRecord& record);
+  void Close();
+  int num_records() const { return index_.size(); }
+
+ private:
+  struct Entry {
+    std::string key;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  const bool half_;
+  std::ofstream out_;
+  uint64_t offset_ = 0;
+  std::vector<Entry> index_;
+  std::mutex mutex_;
+
+  friend class PosteriorReader;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(PosteriorWriter);
+};
+
+// PosteriorReader reads the records of the file of PosteriorWriter by their
+// index, it's thread safe, so the records are searched in parallel.
+class PosteriorReader {
+ public:
+  PosteriorReader() = default;
+
+  // False if the file is not of PosteriorWriter, or not closed
+  bool Open(const std::string& path);
+  int num_records() const { return index_.size(); }
+  const std::string& key(int i) const { return index_[i].key; }
+  // False if the record is corrupted
+  bool Read(int i, PosteriorRecord* record);
+
+ private:
+  bool half_ = false;
+  std::ifstream in_;
+  std::vector<PosteriorWriter::Entry> index_;
+  std::mutex mutex_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(PosteriorReader);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_POSTERIOR_DUMP_H_
@@ -0,0 +1,78 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_cache.h"
+
+#include <cstdint>
+
+namespace wenet {
+
+size_t RescoringCache::Hash(int segment, const std::vector<int>& hyp) {
+  // FNV-1a of the segment and the tokens
+  uint64_t hash = 14695981039346656037ULL;
+  auto mix = [&hash](uint32_t value) {
+    hash ^= value;
+    hash *= 1099511628211ULL;
+  };
+  mix(segment);
+  for (int token : hyp) mix(token);
+  return static_cast<size_t>(hash);
+}
+
+std::unordered_multimap<size_t, RescoringCache::EntryList::iterator>::iterator
+RescoringCache::Find(size_t hash, int segment, const std::vector<int>& hyp) {
+  auto range = index_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const Entry& entry = *it->second;
+    if (entry.segment == segment && entry.hyp == hyp) return it;
+  }
+  return index_.end();
+}
+
+bool RescoringCache::Lookup(int segment, const std::vector<int>& hyp,
+                            float* score) {
+  if (capacity_ <= 0) return false;
+  auto it = Find(Hash(segment, hyp), segment, hyp);
+  if (it == index_.end()) return false;
+  // Move it to the front, the iterators of the list stay valid
+  entries_.splice(entries_.begin(), entries_, it->second);
+  *score = it->second->score;
+  return true;
+}
+
+void RescoringCache::Insert(int segment, const std::vector<int>& hyp,
+                            float score) {
+  if (capacity_ <= 0) return;
+  size_t hash = Hash(segment, hyp);
+  auto it = Find(hash, segment, hyp);
+  if (it != index_.end()) {
+    it->second->score = score;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+  if (static_cast<int>(entries_.size()) >= capacity_) {
+    const Entry& last = entries_.back();
+    index_.erase(Find(Hash(last.segment, last.hyp), last.segment, last.hyp));
+    entries_.pop_back();
+  }
+  entries_.push_front({segment, hyp, score});
+  index_.emplace(hash, entries_.begin());
+}
+
+void RescoringCache::Clear() {
+  entries_.clear();
+  index_.clear();
+}
+
+}  // namespace wenet
@@ -0,0 +1,69 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_RESCORING_CACHE_H_
+#define DECODER_RESCORING_CACHE_H_
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// RescoringCache keeps the attention rescoring scores of the hypotheses of
+// one session by (segment, tokens), so the hypotheses rescored again in the
+// same segment, e.g. by the speculative rescorings and the one at the
+// endpoint of AsrDecoder, are not run through the decoder of the model
+// again. The segment is the encoder output the scores are taken as valid
+// for, a new one makes the older entries stale, and they are evicted as
+// the least recently used ones.
+class RescoringCache {
+ public:
+  // capacity: max number of the entries, 0 disables the cache
+  explicit RescoringCache(int capacity) : capacity_(capacity) {}
+
+  // Return true and the score if the hyp of segment is cached
+  bool Lookup(int segment, const std::vector<int>& hyp, float* score);
+  void Insert(int segment, const std::vector<int>& hyp, float score);
+  void Clear();
+  int size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    int segment;
+    std::vector<int> hyp;
+    float score;
+  };
+  using EntryList = std::list<Entry>;
+
+  static size_t Hash(int segment, const std::vector<int>& hyp);
+  // The entry of the hyp in index_, or index_.end()
+  std::unordered_multimap<size_t, EntryList::iterator>::iterator Find(
+      size_t hash, int segment, const std::vector<int>& hyp);
+
+  const int capacity_;
+  // The most recently used first
+  EntryList entries_;
+  std::unordered_multimap<size_t, EntryList::iterator> index_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(RescoringCache);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_RESCORING_CACHE_H_
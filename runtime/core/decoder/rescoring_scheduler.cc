@@ -0,0 +1,120 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_scheduler.h"
+
+#include <chrono>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/timer.h"
+
+namespace wenet {
+
+RescoringScheduler::RescoringScheduler(const RescoringSchedulerOptions& opts)
+    : opts_(opts) {
+  CHECK_GT(opts_.max_batch_size, 0);
+  thread_ = std::thread(&RescoringScheduler::Run, this);
+}
+
+RescoringScheduler::~RescoringScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  task_cond_.notify_one();
+  thread_.join();
+}
+
+void RescoringScheduler::AttentionRescoring(
+    AsrModel* model, const std::vector<std::vector<int>>& hyps,
+    float reverse_weight, std::vector<float>* rescoring_score) {
+  if (!model->batch_rescoring_supported()) {
+    model->AttentionRescoring(hyps, reverse_weight, rescoring_score);
+    return;
+  }
+  Task task;
+  task.model = model;
+  task.hyps = &hyps;
+  task.reverse_weight = reverse_weight;
+  task.rescoring_score = rescoring_score;
+  std::unique_lock<std::mutex> lock(mutex_);
+  tasks_.push_back(&task);
+  task_cond_.notify_one();
+  done_cond_.wait(lock, [&task] { return task.done; });
+  if (task.error != nullptr) std::rethrow_exception(task.error);
+}
+
+void RescoringScheduler::Run() {
+  Histogram* wait_latency = Metrics::Instance().GetHistogram(
+      "wenet_rescoring_scheduler_wait_seconds",
+      "Queue wait of a session in the rescoring scheduler");
+  std::vector<Task*> batch;
+  std::vector<AsrModel*> models;
+  std::vector<const std::vector<std::vector<int>>*> hyps;
+  std::vector<std::vector<float>*> rescoring_scores;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_cond_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      if (stop_ && tasks_.empty()) break;
+      // Wait a while so that requests from other sessions can join the batch
+      auto deadline = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(opts_.max_wait_ms);
+      task_cond_.wait_until(lock, deadline, [this] {
+        return stop_ || tasks_.size() >= opts_.max_batch_size;
+      });
+      // Only the requests with the same reverse_weight are batched
+      batch.clear();
+      float reverse_weight = tasks_.front()->reverse_weight;
+      while (!tasks_.empty() && batch.size() < opts_.max_batch_size &&
+             tasks_.front()->reverse_weight == reverse_weight) {
+        batch.push_back(tasks_.front());
+        tasks_.pop_front();
+      }
+    }
+
+    models.clear();
+    hyps.clear();
+    rescoring_scores.clear();
+    for (Task* task : batch) {
+      wait_latency->Observe(task->wait_timer.ElapsedUs() / 1e6);
+      models.push_back(task->model);
+      hyps.push_back(task->hyps);
+      rescoring_scores.push_back(task->rescoring_score);
+    }
+    Timer timer;
+    std::exception_ptr error = nullptr;
+    try {
+      AsrModel::AttentionRescoringBatch(models, hyps,
+                                        batch[0]->reverse_weight,
+                                        rescoring_scores);
+      VLOG(2) << "RescoringScheduler rescore " << batch.size()
+              << " sessions takes " << timer.Elapsed() << " ms";
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (Task* task : batch) {
+        task->error = error;
+        task->done = true;
+      }
+    }
+    done_cond_.notify_all();
+  }
+}
+
+}  // namespace wenet
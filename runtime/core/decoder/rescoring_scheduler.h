@@ -0,0 +1,83 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_RESCORING_SCHEDULER_H_
+#define DECODER_RESCORING_SCHEDULER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "decoder/asr_model.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct RescoringSchedulerOptions {
+  // Max number of sessions rescored in one attention decoder call
+  int max_batch_size = 16;
+  // Max time(ms) the first request waits for other requests to join
+  int max_wait_ms = 5;
+};
+
+// RescoringScheduler collects the end of utterance attention rescoring
+// requests of many decoding sessions which share the same model, and
+// rescores them in one batched decoder call, like ChunkScheduler does for
+// the encoder forward.
+class RescoringScheduler {
+ public:
+  explicit RescoringScheduler(const RescoringSchedulerOptions& opts);
+  ~RescoringScheduler();
+
+  // Called by decoding threads, it blocks until the hyps are rescored.
+  // `model` must be a copy of the model which the scheduler is used for.
+  // Like ChunkScheduler, a model without batch_rescoring_supported() is
+  // rescored by the calling thread, and the error of the batch is rethrown.
+  void AttentionRescoring(AsrModel* model,
+                          const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score);
+
+ private:
+  struct Task {
+    AsrModel* model = nullptr;
+    const std::vector<std::vector<int>>* hyps = nullptr;
+    float reverse_weight = 0.0;
+    std::vector<float>* rescoring_score = nullptr;
+    bool done = false;
+    std::exception_ptr error = nullptr;
+    // Started when the task is queued
+    Timer wait_timer;
+  };
+
+  void Run();
+
+  const RescoringSchedulerOptions opts_;
+  std::mutex mutex_;
+  std::condition_variable task_cond_;
+  std::condition_variable done_cond_;
+  std::deque<Task*> tasks_;
+  bool stop_ = false;
+  std::thread thread_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(RescoringScheduler);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_RESCORING_SCHEDULER_H_
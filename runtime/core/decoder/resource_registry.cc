@@ -0,0 +1,204 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/resource_registry.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "utils/log.h"
+#include "utils/timer.h"
+
+namespace wenet {
+
+ResourceRegistry::ResourceRegistry(std::shared_ptr<DecodeResource> resource)
+    : ResourceRegistry(
+          std::vector<std::shared_ptr<DecodeResource>>{std::move(resource)}) {}
+
+ResourceRegistry::ResourceRegistry(
+    std::vector<std::shared_ptr<DecodeResource>> replicas)
+    : replicas_(std::move(replicas)) {
+  CHECK(!replicas_.empty());
+  for (const auto& replica : replicas_) CHECK(replica != nullptr);
+}
+
+std::shared_ptr<DecodeResource> ResourceRegistry::Get(size_t replica) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return replicas_[replica % replicas_.size()];
+}
+
+int ResourceRegistry::num_replicas() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return replicas_.size();
+}
+
+void ResourceRegistry::Update(std::shared_ptr<DecodeResource> resource) {
+  Update(std::vector<std::shared_ptr<DecodeResource>>{std::move(resource)});
+}
+
+void ResourceRegistry::Update(
+    std::vector<std::shared_ptr<DecodeResource>> replicas) {
+  CHECK(!replicas.empty());
+  for (const auto& replica : replicas) CHECK(replica != nullptr);
+  std::vector<std::shared_ptr<DecodeResource>> old;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    old.swap(replicas_);
+    replicas_ = std::move(replicas);
+    ++version_;
+  }
+  // `old` is released out of the lock, or later by its last session
+}
+
+int ResourceRegistry::version() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return version_;
+}
+
+void ResourceRegistry::Add(
+    const std::string& name,
+    std::vector<std::shared_ptr<DecodeResource>> replicas) {
+  CHECK(!name.empty());
+  CHECK(!replicas.empty());
+  for (const auto& replica : replicas) CHECK(replica != nullptr);
+  std::vector<std::shared_ptr<DecodeResource>> old;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    old.swap(named_[name]);
+    named_[name] = std::move(replicas);
+    ++version_;
+  }
+}
+
+std::shared_ptr<DecodeResource> ResourceRegistry::Find(const std::string& name,
+                                                       size_t replica) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (name.empty()) return replicas_[replica % replicas_.size()];
+  auto it = named_.find(name);
+  if (it == named_.end()) return nullptr;
+  return it->second[replica % it->second.size()];
+}
+
+std::vector<std::string> ResourceRegistry::names() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> names;
+  for (const auto& kv : named_) names.push_back(kv.first);
+  return names;
+}
+
+bool ResourceRegistry::IsCurrent(
+    const std::shared_ptr<DecodeResource>& resource) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& replica : replicas_) {
+    if (replica == resource) return true;
+  }
+  for (const auto& kv : named_) {
+    for (const auto& replica : kv.second) {
+      if (replica == resource) return true;
+    }
+  }
+  return false;
+}
+
+// The weights of the model copies of the resource, each replica of the
+// ModelReplicas holds its own
+static int64_t WeightBytes(const DecodeResource& resource) {
+  if (resource.model_replicas != nullptr) {
+    int64_t bytes = 0;
+    for (int i = 0; i < resource.model_replicas->size(); ++i) {
+      bytes += resource.model_replicas->model(i)->weight_bytes();
+    }
+    return bytes;
+  }
+  return resource.model != nullptr ? resource.model->weight_bytes() : 0;
+}
+
+void ResourceRegistry::AddToBudget(MemoryBudget* budget) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& replica : replicas_) {
+    budget->Add("model weights", WeightBytes(*replica));
+  }
+  for (const auto& kv : named_) {
+    for (const auto& replica : kv.second) {
+      budget->Add("model weights of " + kv.first, WeightBytes(*replica));
+    }
+  }
+}
+
+void WarmupDecodeResource(std::shared_ptr<DecodeResource> resource,
+                          const FeaturePipelineConfig& feature_config,
+                          const DecodeOptions& decode_options,
+                          float seconds) {
+  Timer timer;
+  auto feature_pipeline = std::make_shared<FeaturePipeline>(
+      feature_config, resource->fbank_tables);
+  std::vector<float> silence(
+      static_cast<int>(seconds * feature_config.sample_rate), 0.0f);
+  feature_pipeline->AcceptWaveform(silence.data(), silence.size());
+  feature_pipeline->set_input_finished();
+  AsrDecoder decoder(feature_pipeline, std::move(resource), decode_options);
+  while (decoder.Decode() != kEndFeats) {
+  }
+  decoder.Rescoring();
+  LOG(INFO) << "Warmup the decode resource in " << timer.Elapsed() << "ms";
+}
+
+void BlockSignal(int signo) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, signo);
+  CHECK_EQ(pthread_sigmask(SIG_BLOCK, &set, nullptr), 0);
+}
+
+void ReloadOnSignal(int signo, std::shared_ptr<ResourceRegistry> registry,
+                    std::function<std::shared_ptr<DecodeResource>()> loader) {
+  ReloadOnSignal(signo, std::move(registry),
+                 [loader]() -> std::vector<std::shared_ptr<DecodeResource>> {
+                   auto resource = loader();
+                   if (resource == nullptr) return {};
+                   return {resource};
+                 });
+}
+
+void ReloadOnSignal(
+    int signo, std::shared_ptr<ResourceRegistry> registry,
+    std::function<std::vector<std::shared_ptr<DecodeResource>>()> loader) {
+  CHECK(registry != nullptr);
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, signo);
+  std::thread t([set, registry, loader]() {
+    for (;;) {
+      int sig = 0;
+      if (sigwait(&set, &sig) != 0) continue;
+      LOG(INFO) << "Received signal " << sig << ", reload decode resource";
+      auto replicas = loader();
+      if (replicas.empty()) {
+        LOG(ERROR) << "Failed to reload decode resource, keep version "
+                   << registry->version();
+        continue;
+      }
+      registry->Update(std::move(replicas));
+      LOG(INFO) << "Decode resource is updated to version "
+                << registry->version();
+    }
+  });
+  t.detach();
+}
+
+}  // namespace wenet
@@ -0,0 +1,112 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_RESOURCE_REGISTRY_H_
+#define DECODER_RESOURCE_REGISTRY_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/memory_budget.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// ResourceRegistry holds the current DecodeResource of a server, which can
+// be replaced while the server is running. A session takes the resource by
+// Get() when it starts, and keeps it until it's finished, so the sessions
+// which started before Update() still decode with the old model and graph,
+// and the old resource is released when the last of them is finished.
+//
+// It may hold a replica of the resource per NUMA node, each loaded on its
+// node(see InitDecodeResourcesFromFlags), for the sessions running there.
+//
+// Besides the default resource, it may hold named ones, e.g. the models of
+// other languages or domains, which a session selects by the name when it
+// starts, so one server serves all of them with the same threads and
+// admission control.
+class ResourceRegistry {
+ public:
+  explicit ResourceRegistry(std::shared_ptr<DecodeResource> resource);
+  explicit ResourceRegistry(
+      std::vector<std::shared_ptr<DecodeResource>> replicas);
+
+  std::shared_ptr<DecodeResource> Get(size_t replica = 0) const;
+  int num_replicas() const;
+  // Swap in a new resource for the new sessions
+  void Update(std::shared_ptr<DecodeResource> resource);
+  void Update(std::vector<std::shared_ptr<DecodeResource>> replicas);
+  // Number of updates
+  int version() const;
+
+  // Add the replicas of a named resource, or replace the ones of the name
+  // as Update() does, see LoadNamedDecodeResourcesFromFlags
+  void Add(const std::string& name,
+           std::vector<std::shared_ptr<DecodeResource>> replicas);
+  // The replica of the named resource, the default one for the empty name,
+  // nullptr if there is no such name
+  std::shared_ptr<DecodeResource> Find(const std::string& name,
+                                       size_t replica = 0) const;
+  // The names of the named resources, in order
+  std::vector<std::string> names() const;
+  // Whether `resource` is a current replica of the default or a named one
+  bool IsCurrent(const std::shared_ptr<DecodeResource>& resource) const;
+  // Add the weights of the models of all the current replicas to `budget`,
+  // one component per resource
+  void AddToBudget(MemoryBudget* budget) const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<std::shared_ptr<DecodeResource>> replicas_;
+  std::map<std::string, std::vector<std::shared_ptr<DecodeResource>>> named_;
+  int version_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ResourceRegistry);
+};
+
+// Decode `seconds` of silence with the resource, so the lazy initialization
+// of the model runtime and the first allocations are done before the
+// resource serves any real session.
+void WarmupDecodeResource(std::shared_ptr<DecodeResource> resource,
+                          const FeaturePipelineConfig& feature_config,
+                          const DecodeOptions& decode_options,
+                          float seconds = 1.0);
+
+// Block `signo` in the calling thread, the threads created by it afterwards
+// inherit the mask. It must be called at the start of main(), before any
+// thread is created, or the signal may be delivered to a thread which
+// doesn't block it and kill the process.
+void BlockSignal(int signo);
+
+// Reload the resource by `loader` when `signo`(e.g. SIGHUP) is received,
+// which must be blocked by BlockSignal() first. It is waited by a detached
+// thread, and a nullptr returned by `loader` keeps the current resource.
+void ReloadOnSignal(int signo, std::shared_ptr<ResourceRegistry> registry,
+                    std::function<std::shared_ptr<DecodeResource>()> loader);
+// Same as above, but `loader` loads all the replicas, or returns an empty
+// vector to keep the current ones
+void ReloadOnSignal(
+    int signo, std::shared_ptr<ResourceRegistry> registry,
+    std::function<std::vector<std::shared_ptr<DecodeResource>>()> loader);
+
+}  // namespace wenet
+
+#endif  // DECODER_RESOURCE_REGISTRY_H_
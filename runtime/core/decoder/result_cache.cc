@@ -0,0 +1,118 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/result_cache.h"
+
+#include <cstring>
+#include <random>
+
+#include "utils/metrics.h"
+
+namespace wenet {
+
+static inline uint64_t Mix(uint64_t x) {
+  // The finalizer of MurmurHash3
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+uint64_t ResultCache::Hash(const void* data, size_t size, uint64_t seed) {
+  // 8 bytes per multiply, which hashes the pcm far faster than it's decoded
+  const uint64_t kMul = 0x9e3779b97f4a7c15ULL;
+  const char* bytes = static_cast<const char*>(data);
+  uint64_t hash = Mix(seed ^ (size * kMul));
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    hash = (hash ^ Mix(word)) * kMul;
+  }
+  if (i < size) {
+    uint64_t word = 0;
+    memcpy(&word, bytes + i, size - i);
+    hash = (hash ^ Mix(word)) * kMul;
+  }
+  return Mix(hash);
+}
+
+uint64_t ResultCache::Key(const float* pcm, size_t num_samples,
+                         uint64_t context) {
+  // Random per process, the keys are not persisted
+  static const uint64_t seed = []() {
+    std::random_device device;
+    return (static_cast<uint64_t>(device()) << 32) ^ device();
+  }();
+  return Hash(pcm, num_samples * sizeof(float), Mix(context ^ seed));
+}
+
+bool ResultCache::SamePcm(const Entry& entry, const float* pcm,
+                          size_t num_samples) {
+  return entry.pcm.size() == num_samples &&
+         (num_samples == 0 ||
+          memcmp(entry.pcm.data(), pcm, num_samples * sizeof(float)) == 0);
+}
+
+bool ResultCache::Lookup(uint64_t key, const float* pcm, size_t num_samples,
+                         std::vector<DecodeResult>* nbest) {
+  static Counter* hits = Metrics::Instance().GetCounter(
+      "wenet_result_cache_hits_total",
+      "Number of the utterances answered by the result cache");
+  static Counter* misses = Metrics::Instance().GetCounter(
+      "wenet_result_cache_misses_total",
+      "Number of the utterances not in the result cache");
+  if (capacity_ <= 0) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end() || !SamePcm(*it->second, pcm, num_samples)) {
+    misses->Increment();
+    return false;
+  }
+  // Move it to the front, the iterators of the list stay valid
+  entries_.splice(entries_.begin(), entries_, it->second);
+  *nbest = it->second->nbest;
+  hits->Increment();
+  return true;
+}
+
+void ResultCache::Insert(uint64_t key, const float* pcm, size_t num_samples,
+                         const std::vector<DecodeResult>& nbest) {
+  if (capacity_ <= 0) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    // The same audio, or another one of the same key, which replaces it
+    it->second->pcm.assign(pcm, pcm + num_samples);
+    it->second->nbest = nbest;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+  if (static_cast<int>(entries_.size()) >= capacity_) {
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+  entries_.push_front({key, std::vector<float>(pcm, pcm + num_samples),
+                       nbest});
+  index_.emplace(key, entries_.begin());
+}
+
+int ResultCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+}  // namespace wenet
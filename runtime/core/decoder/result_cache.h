@@ -0,0 +1,85 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_RESULT_CACHE_H_
+#define DECODER_RESULT_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "decoder/decode_result.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// ResultCache keeps the n-best of the whole utterances decoded by the
+// offline paths, keyed by a hash of the pcm and of the context they are
+// decoded in, i.e. the model and the options, so the same audio decoded
+// again, e.g. the prompts leaking into the recordings, the repeated test
+// calls and the retransmitted uploads, is answered without decoding. The
+// least recently used entries are evicted beyond the capacity. The key is
+// a 64 bit hash seeded per process, so its collisions can't be crafted
+// offline, and an entry keeps the pcm, which is compared on a hit, so the
+// result of another audio, e.g. of another tenant, is never returned. It's
+// thread safe, and shared by the calls of a server.
+class ResultCache {
+ public:
+  // capacity: max number of the entries, 0 disables the cache
+  explicit ResultCache(int capacity) : capacity_(capacity) {}
+
+  // A fast 64 bit hash of the bytes, e.g. of the flags for the context
+  static uint64_t Hash(const void* data, size_t size, uint64_t seed = 0);
+  static uint64_t Hash(const std::string& str, uint64_t seed = 0) {
+    return Hash(str.data(), str.size(), seed);
+  }
+
+  // The key of the pcm decoded in the context, with the seed of the process
+  static uint64_t Key(const float* pcm, size_t num_samples, uint64_t context);
+
+  // Return true and the n-best if the pcm of the key is cached
+  bool Lookup(uint64_t key, const float* pcm, size_t num_samples,
+              std::vector<DecodeResult>* nbest);
+  void Insert(uint64_t key, const float* pcm, size_t num_samples,
+              const std::vector<DecodeResult>& nbest);
+  int size() const;
+  int capacity() const { return capacity_; }
+
+ private:
+  struct Entry {
+    uint64_t key;
+    std::vector<float> pcm;
+    std::vector<DecodeResult> nbest;
+  };
+  static bool SamePcm(const Entry& entry, const float* pcm,
+                      size_t num_samples);
+  using EntryList = std::list<Entry>;
+
+  const int capacity_;
+  mutable std::mutex mutex_;
+  // The most recently used first
+  EntryList entries_;
+  std::unordered_map<uint64_t, EntryList::iterator> index_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ResultCache);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_RESULT_CACHE_H_
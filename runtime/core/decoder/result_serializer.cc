@@ -0,0 +1,192 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/result_serializer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace wenet {
+
+static inline bool IsContinuationByte(char c) { return (c & 0xC0) == 0x80; }
+
+// The protobuf wire format, see
+// https://developers.google.com/protocol-buffers/docs/encoding
+// The fields of the default values are omitted as proto3 does.
+static void AppendVarint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    *out += static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  *out += static_cast<char>(value);
+}
+
+static void AppendInt32(int field, int32_t value, std::string* out) {
+  if (value == 0) return;
+  AppendVarint(field << 3, out);
+  // Negative int32 takes 10 bytes, as the sign extended int64
+  AppendVarint(static_cast<uint64_t>(static_cast<int64_t>(value)), out);
+}
+
+static void AppendBytes(int field, const std::string& value, bool always,
+                        std::string* out) {
+  if (value.empty() && !always) return;
+  AppendVarint((field << 3) | 2, out);
+  AppendVarint(value.size(), out);
+  out->append(value);
+}
+
+// The field numbers of wenet.Response
+enum {
+  kResponseStatus = 1,
+  kResponseType = 2,
+  kResponseNbest = 3,
+  kResponseStreamId = 5,
+  kOneBestSentence = 1,
+  kOneBestWordPieces = 2,
+  kOnePieceWord = 1,
+  kOnePieceStart = 2,
+  kOnePieceEnd = 3,
+};
+enum { kPartialResult = 1, kFinalResult = 2 };
+
+void ResultSerializer::WriteNbest(const std::vector<DecodeResult>& result,
+                                  int nbest, bool word_pieces,
+                                  JsonWriter* writer) {
+  writer->StartArray();
+  for (int i = 0; i < std::min<int>(nbest, result.size()); ++i) {
+    const DecodeResult& path = result[i];
+    writer->StartObject().Key("sentence").String(path.sentence);
+    if (word_pieces) {
+      writer->Key("word_pieces").StartArray();
+      for (const WordPiece& word_piece : path.word_pieces) {
+        writer->StartObject()
+            .Key("word")
+            .String(word_piece.word)
+            .Key("start")
+            .Int(word_piece.start)
+            .Key("end")
+            .Int(word_piece.end)
+            .EndObject();
+      }
+      writer->EndArray();
+    }
+    writer->EndObject();
+  }
+  writer->EndArray();
+}
+
+void ResultSerializer::WriteMessage(const char* type,
+                                    const std::vector<DecodeResult>& result,
+                                    bool word_pieces) {
+  nbest_writer_.Clear();
+  WriteNbest(result, nbest_, word_pieces, &nbest_writer_);
+  writer_.Clear();
+  writer_.StartObject().Key("status").String("ok").Key("type").String(type);
+  if (stream_id_ >= 0) writer_.Key("stream_id").Int(stream_id_);
+  // The nbest is a json string in the protocol
+  writer_.Key("nbest").String(nbest_writer_.str());
+  writer_.EndObject();
+}
+
+void ResultSerializer::WriteDelta(const std::vector<DecodeResult>& result) {
+  int size = std::min<int>(nbest_, result.size());
+  last_sentences_.resize(std::max<int>(size, last_sentences_.size()));
+  writer_.Clear();
+  writer_.StartObject()
+      .Key("status")
+      .String("ok")
+      .Key("type")
+      .String("partial_result");
+  if (stream_id_ >= 0) writer_.Key("stream_id").Int(stream_id_);
+  writer_.Key("delta").StartArray();
+  for (int i = 0; i < size; ++i) {
+    const std::string& sentence = result[i].sentence;
+    std::string* last = &last_sentences_[i];
+    size_t n = std::min(sentence.size(), last->size());
+    size_t p = std::mismatch(sentence.begin(), sentence.begin() + n,
+                             last->begin())
+                   .first -
+               sentence.begin();
+    // Keep whole characters only
+    while (p > 0 && ((p < sentence.size() && IsContinuationByte(sentence[p])) ||
+                     (p < last->size() && IsContinuationByte((*last)[p])))) {
+      --p;
+    }
+    int keep = std::count_if(sentence.begin(), sentence.begin() + p,
+                             [](char c) { return !IsContinuationByte(c); });
+    writer_.StartObject()
+        .Key("keep")
+        .Int(keep)
+        .Key("append")
+        .String(sentence.data() + p, sentence.size() - p)
+        .EndObject();
+    last->replace(p, std::string::npos, sentence, p, std::string::npos);
+  }
+  writer_.EndArray().EndObject();
+}
+
+void ResultSerializer::WriteResponse(int type,
+                                     const std::vector<DecodeResult>& result,
+                                     bool word_pieces) {
+  response_.clear();
+  // status is ok(0)
+  AppendInt32(kResponseType, type, &response_);
+  for (int i = 0; i < std::min<int>(nbest_, result.size()); ++i) {
+    path_.clear();
+    AppendBytes(kOneBestSentence, result[i].sentence, false, &path_);
+    if (word_pieces) {
+      for (const WordPiece& word_piece : result[i].word_pieces) {
+        piece_.clear();
+        AppendBytes(kOnePieceWord, word_piece.word, false, &piece_);
+        AppendInt32(kOnePieceStart, word_piece.start, &piece_);
+        AppendInt32(kOnePieceEnd, word_piece.end, &piece_);
+        AppendBytes(kOneBestWordPieces, piece_, true, &path_);
+      }
+    }
+    // A repeated message is kept even if it's empty
+    AppendBytes(kResponseNbest, path_, true, &response_);
+  }
+  if (stream_id_ >= 0) AppendInt32(kResponseStreamId, stream_id_, &response_);
+}
+
+const std::string& ResultSerializer::PartialMessage(
+    const std::vector<DecodeResult>& result) {
+  if (binary_) {
+    WriteResponse(kPartialResult, result, false);
+    return response_;
+  }
+  if (delta_partial_) {
+    WriteDelta(result);
+  } else {
+    WriteMessage("partial_result", result, false);
+  }
+  return writer_.str();
+}
+
+const std::string& ResultSerializer::FinalMessage(
+    const std::vector<DecodeResult>& result) {
+  // The partials of the next sentence start from scratch
+  for (std::string& sentence : last_sentences_) {
+    sentence.clear();
+  }
+  if (binary_) {
+    WriteResponse(kFinalResult, result, true);
+    return response_;
+  }
+  WriteMessage("final_result", result, true);
+  return writer_.str();
+}
+
+}  // namespace wenet
@@ -0,0 +1,95 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_RESULT_SERIALIZER_H_
+#define DECODER_RESULT_SERIALIZER_H_
+
+#include <string>
+#include <vector>
+
+#include "decoder/decode_result.h"
+#include "utils/json_writer.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// ResultSerializer writes the result messages of the websocket protocol of
+// a session into buffers reused across the messages, e.g.
+//   {"status":"ok","type":"partial_result",
+//    "nbest":"[{\"sentence\":\"...\"}]"}
+// The word pieces are only in the final results.
+//
+// In the opt-in delta mode, a partial result only carries how each path
+// of the n-best changed since the last partial
+//   {"status":"ok","type":"partial_result",
+//    "delta":[{"keep":3,"append":"..."}]}
+// where the sentence is the first `keep` characters(unicode code points) of
+// the sentence of the same path in the last partial, followed by `append`.
+// The last partial is empty at the start and after each final result, so
+// the cost of a partial is of the changed suffix instead of the sentence,
+// which keeps growing in a long speech.
+//
+// In the opt-in binary mode, the results are the protobuf wire format of
+// wenet.Response in grpc/wenet.proto, written without protobuf, which are
+// sent as binary frames, so the gateways decode them instead of parsing
+// JSON. The delta mode only applies to the JSON results.
+//
+// With a stream id, e.g. of the multiplexed websocket protocol(see
+// websocket/mux_connection_handler.h), the messages carry it as
+// "stream_id", or the stream_id field of wenet.Response.
+class ResultSerializer {
+ public:
+  explicit ResultSerializer(int nbest = 1, bool delta_partial = false,
+                            bool binary = false)
+      : nbest_(nbest), delta_partial_(delta_partial), binary_(binary) {}
+
+  bool binary() const { return binary_; }
+  // -1 for none
+  void set_stream_id(int stream_id) { stream_id_ = stream_id; }
+
+  // The messages are valid until the next call
+  const std::string& PartialMessage(const std::vector<DecodeResult>& result);
+  const std::string& FinalMessage(const std::vector<DecodeResult>& result);
+
+  // Write the json array of the top `nbest` paths
+  static void WriteNbest(const std::vector<DecodeResult>& result, int nbest,
+                         bool word_pieces, JsonWriter* writer);
+
+ private:
+  void WriteMessage(const char* type, const std::vector<DecodeResult>& result,
+                    bool word_pieces);
+  void WriteDelta(const std::vector<DecodeResult>& result);
+  void WriteResponse(int type, const std::vector<DecodeResult>& result,
+                     bool word_pieces);
+
+  int nbest_;
+  bool delta_partial_;
+  bool binary_;
+  int stream_id_ = -1;
+  JsonWriter writer_;
+  JsonWriter nbest_writer_;
+  // Sentences of the last partial, for the delta mode
+  std::vector<std::string> last_sentences_;
+  // The wenet.Response and the scratch of its nested messages
+  std::string response_;
+  std::string path_;
+  std::string piece_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ResultSerializer);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_RESULT_SERIALIZER_H_
@@ -16,10 +16,15 @@
 #ifndef DECODER_SEARCH_INTERFACE_H_
 #define DECODER_SEARCH_INTERFACE_H_
 
-namespace wenet {
-
+#include <cstdint>
 #include <vector>
 
+#include "decoder/word_lattice.h"
+#include "utils/matrix.h"
+#include "utils/state_io.h"
+
+namespace wenet {
+
 enum SearchType {
   kPrefixBeamSearch = 0x00,
   kWfstBeamSearch = 0x01,
@@ -29,8 +34,13 @@ class SearchInterface {
  public:
   virtual ~SearchInterface() {}
   virtual void Search(const std::vector<std::vector<float>>& logp) = 0;
+  // The same on the contiguous [T, vocab] log posteriors, read in place
+  virtual void Search(const MatrixView<float>& logp) = 0;
   virtual void Search(const std::vector<std::vector<float>>& topk_scores,
                       const std::vector<std::vector<int32_t>>& topk_indexs) = 0;
+  // The same on the contiguous [T, k] topk of each frame
+  virtual void Search(const MatrixView<float>& topk_scores,
+                      const MatrixView<int32_t>& topk_indexs) = 0;
   virtual void Reset() = 0;
   virtual void FinalizeSearch() = 0;
 
@@ -43,6 +53,28 @@ class SearchInterface {
   virtual const std::vector<float>& Likelihood() const = 0;
   // N-best timestamp
   virtual const std::vector<std::vector<int>>& Times() const = 0;
+  // The blank log prob of each frame of the last Search(), -inf for the
+  // blank out of the topk, which the search reads anyway for the blank
+  // frame skipping, so the endpoint doesn't scan the log probs again, see
+  // CtcEndpoint. Empty if the search doesn't keep them.
+  virtual const std::vector<float>& BlankScores() const {
+    static const std::vector<float> empty;
+    return empty;
+  }
+  // The word lattice of the finalized search, of which the times are the
+  // frames as Times(), false if the search has no lattice
+  virtual bool GetWordLattice(WordLattice* lattice) { return false; }
+  // Scale the beams of the next frames by `beam_scale` in (0, 1], see
+  // AdaptiveBeamOptions
+  virtual void SetBeamScale(float beam_scale) {}
+  // Save the hypotheses of the frames searched so far, which are loaded by a
+  // search of the same graph and options to continue, see
+  // AsrDecoder::SaveState. False if the search doesn't support it.
+  virtual bool SaveState(StateWriter* writer) const { return false; }
+  virtual bool LoadState(StateReader* reader) { return false; }
+  // The bytes of the hypotheses and the traces of the search, for the
+  // memory accounting of the session, 0 if the search doesn't know
+  virtual int64_t memory_bytes() const { return 0; }
 };
 
 }  // namespace wenet
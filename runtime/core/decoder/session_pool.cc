@@ -0,0 +1,141 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/session_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+static Gauge* IdleSessions() {
+  static Gauge* gauge = Metrics::Instance().GetGauge(
+      "wenet_session_pool_idle", "Number of the idle sessions in the pool");
+  return gauge;
+}
+
+SessionPool::SessionPool(std::shared_ptr<FeaturePipelineConfig> feature_config,
+                         std::shared_ptr<DecodeOptions> decode_config,
+                         std::shared_ptr<ResourceRegistry> resources,
+                         int capacity)
+    : feature_config_(std::move(feature_config)),
+      decode_config_(std::move(decode_config)),
+      resources_(std::move(resources)),
+      capacity_(capacity),
+      version_(resources_->version()) {
+  CHECK_GE(capacity_, 0);
+}
+
+std::shared_ptr<DecodeSession> SessionPool::Acquire(
+    std::shared_ptr<DecodeResource> resource) {
+  static Metrics& metrics = Metrics::Instance();
+  static Counter* num_hits = metrics.GetCounter(
+      "wenet_session_pool_hits_total",
+      "Number of the sessions checked out of the pool");
+  static Counter* num_misses = metrics.GetCounter(
+      "wenet_session_pool_misses_total",
+      "Number of the sessions constructed as there is no idle one");
+  std::unique_ptr<DecodeSession> session;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DropStale();
+    // The last released one, of which the buffers are likely in the cache
+    for (auto it = idle_.rbegin(); it != idle_.rend(); ++it) {
+      if ((*it)->resource == resource) {
+        session = std::move(*it);
+        idle_.erase(std::next(it).base());
+        IdleSessions()->Add(-1);
+        break;
+      }
+    }
+  }
+  if (session != nullptr) {
+    num_hits->Increment();
+  } else {
+    num_misses->Increment();
+    session = NewSession(std::move(resource));
+  }
+  std::weak_ptr<SessionPool> weak_pool = shared_from_this();
+  return std::shared_ptr<DecodeSession>(
+      session.release(), [weak_pool](DecodeSession* released) {
+        std::unique_ptr<DecodeSession> owned(released);
+        auto pool = weak_pool.lock();
+        if (pool != nullptr) pool->Release(std::move(owned));
+      });
+}
+
+void SessionPool::Prefill() {
+  int num_replicas = resources_->num_replicas();
+  for (int i = num_idle(); i < capacity_; ++i) {
+    std::unique_ptr<DecodeSession> session =
+        NewSession(resources_->Get(i % num_replicas));
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (static_cast<int>(idle_.size()) >= capacity_) break;
+    idle_.push_back(std::move(session));
+    IdleSessions()->Add(1);
+  }
+  LOG(INFO) << "Prefilled " << num_idle() << " decoding sessions";
+}
+
+int SessionPool::num_idle() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return idle_.size();
+}
+
+std::unique_ptr<DecodeSession> SessionPool::NewSession(
+    std::shared_ptr<DecodeResource> resource) const {
+  auto session = std::make_unique<DecodeSession>();
+  session->feature_pipeline =
+      std::make_shared<FeaturePipeline>(*feature_config_,
+                                        resource->fbank_tables);
+  session->decoder = std::make_shared<AsrDecoder>(
+      session->feature_pipeline, resource, *decode_config_);
+  session->resource = std::move(resource);
+  return session;
+}
+
+void SessionPool::Release(std::unique_ptr<DecodeSession> session) {
+  if (capacity_ == 0 || !resources_->IsCurrent(session->resource)) return;
+  // Still referenced out of the session, the decoder holds the pipeline
+  if (session->decoder.use_count() != 1 ||
+      session->feature_pipeline.use_count() != 2) {
+    return;
+  }
+  // Out of the lock, it resets the caches of the model
+  session->decoder->Reset();
+  session->decoder->set_trace_id(0);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (static_cast<int>(idle_.size()) >= capacity_) return;
+  idle_.push_back(std::move(session));
+  IdleSessions()->Add(1);
+}
+
+void SessionPool::DropStale() {
+  int version = resources_->version();
+  if (version == version_) return;
+  version_ = version;
+  auto stale = std::remove_if(
+      idle_.begin(), idle_.end(),
+      [this](const std::unique_ptr<DecodeSession>& session) {
+        return !resources_->IsCurrent(session->resource);
+      });
+  IdleSessions()->Add(-static_cast<int64_t>(idle_.end() - stale));
+  idle_.erase(stale, idle_.end());
+}
+
+}  // namespace wenet
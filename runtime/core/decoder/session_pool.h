@@ -0,0 +1,89 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_SESSION_POOL_H_
+#define DECODER_SESSION_POOL_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "decoder/resource_registry.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The decoder of a connection and the feature pipeline it reads
+struct DecodeSession {
+  std::shared_ptr<FeaturePipeline> feature_pipeline;
+  std::shared_ptr<AsrDecoder> decoder;
+  // The resource the decoder is constructed with
+  std::shared_ptr<DecodeResource> resource;
+};
+
+// SessionPool keeps the sessions of the finished connections, which are
+// Reset(), so a new connection checks one out instead of constructing the
+// feature pipeline, the copy of the model, the searcher and the endpointer.
+// A session goes back to the pool when the connection drops the last
+// reference to it. The sessions of a resource replaced by
+// ResourceRegistry::Update() are dropped, so the old resource is released
+// as it is without the pool.
+class SessionPool : public std::enable_shared_from_this<SessionPool> {
+ public:
+  // Keep at most `capacity` idle sessions, 0 disables the pooling
+  SessionPool(std::shared_ptr<FeaturePipelineConfig> feature_config,
+              std::shared_ptr<DecodeOptions> decode_config,
+              std::shared_ptr<ResourceRegistry> resources, int capacity);
+
+  // A Reset() session of `resource`, which is constructed if there is no
+  // idle one of it. Set the input sample rate and the trace id of the
+  // session before use.
+  std::shared_ptr<DecodeSession> Acquire(
+      std::shared_ptr<DecodeResource> resource);
+  // Construct the idle sessions up to the capacity, shared by the current
+  // replicas of the resources, e.g. before the server is started
+  void Prefill();
+
+  int capacity() const { return capacity_; }
+  int num_idle() const;
+
+ private:
+  std::unique_ptr<DecodeSession> NewSession(
+      std::shared_ptr<DecodeResource> resource) const;
+  // Reset() and keep the session, or drop it if the pool is full or its
+  // resource is not current
+  void Release(std::unique_ptr<DecodeSession> session);
+  // Drop the idle sessions of the replaced resources, must be called with
+  // mutex_ held
+  void DropStale();
+
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  const int capacity_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<DecodeSession>> idle_;
+  // The version of resources_ of which the stale sessions are dropped
+  int version_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(SessionPool);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_SESSION_POOL_H_
@@ -17,15 +17,125 @@
 #include "decoder/torch_asr_model.h"
 
 #include <algorithm>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
+#include "c10/core/CPUAllocator.h"
 #include "torch/script.h"
 #include "torch/torch.h"
 
+#include "decoder/torch_optimize.h"
+#include "utils/metrics.h"
+#include "utils/model_bundle.h"
+#ifdef USE_GPU
+#include "ATen/cuda/CUDAContext.h"
+#include "ATen/cuda/CUDAEvent.h"
+#include "ATen/cuda/CUDAGraph.h"
+#include "c10/cuda/CUDAGuard.h"
+#endif
+
 namespace wenet {
 
+struct TorchAsrModel::ChunkGraphs {
+#ifdef USE_GPU
+  struct Graph {
+    // Held from the copy in of the inputs to the copy out of the outputs
+    std::mutex mutex;
+    at::cuda::CUDAGraph graph;
+    // Static inputs: feats, offset, att_cache, cnn_cache, and static
+    // outputs: chunk_out, r_att_cache, r_cnn_cache, ctc_log_probs
+    std::vector<torch::Tensor> inputs;
+    std::vector<torch::Tensor> outputs;
+    // Recorded after the copy out on the stream of the replay, which the
+    // next replay waits for on the device instead of a sync on the host
+    at::cuda::CUDAEvent copied;
+  };
+#else
+  struct Graph {};
+#endif
+  int max_graphs = 0;
+  // By (num_frames, cache frames), captured before the model serves, and
+  // read only after it
+  std::map<std::pair<int, int>, std::shared_ptr<Graph>> graphs;
+};
+
+int TorchCachePool::Allocate(const torch::Tensor& att_cache,
+                             const torch::Tensor& cnn_cache) {
+  static Counter* exhausted = Metrics::Instance().GetCounter(
+      "wenet_cache_pool_exhausted_total",
+      "Sessions whose caches are out of the cache pool");
+  static Gauge* used = Metrics::Instance().GetGauge(
+      "wenet_cache_pool_used_blocks", "Blocks of the cache pool in use");
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!att_blocks_.defined()) {
+      auto new_shape = [this](const torch::Tensor& cache) {
+        std::vector<int64_t> shape = {allocator_.num_blocks()};
+        shape.insert(shape.end(), cache.sizes().begin(), cache.sizes().end());
+        return shape;
+      };
+      att_blocks_ = torch::zeros(new_shape(att_cache), att_cache.options());
+      cnn_blocks_ = torch::zeros(new_shape(cnn_cache), cnn_cache.options());
+      LOG(INFO) << "Allocate the cache pool of " << allocator_.num_blocks()
+                << " blocks, " << att_blocks_[0].sizes() << " and "
+                << cnn_blocks_[0].sizes();
+    }
+  }
+  if (att_cache.sizes() != att_blocks_.sizes().slice(1) ||
+      cnn_cache.sizes() != cnn_blocks_.sizes().slice(1) ||
+      att_cache.device() != att_blocks_.device() ||
+      att_cache.scalar_type() != att_blocks_.scalar_type()) {
+    return -1;
+  }
+  int block = allocator_.Allocate();
+  if (block < 0) {
+    exhausted->Increment();
+    return -1;
+  }
+  used->Add(1);
+  return block;
+}
+
+void TorchCachePool::Free(int block) {
+  static Gauge* used = Metrics::Instance().GetGauge(
+      "wenet_cache_pool_used_blocks", "Blocks of the cache pool in use");
+  allocator_.Free(block);
+  used->Add(-1);
+}
+
+namespace {
+
+// The CPU allocator of torch by HugePageAllocator::Instance()
+class HugePageCpuAllocator : public c10::Allocator {
+ public:
+  c10::DataPtr allocate(size_t size) const override {
+    void* data = HugePageAllocator::Instance().Allocate(size);
+    if (data == nullptr && size > 0) {
+      throw std::runtime_error("Failed to allocate " + std::to_string(size) +
+                               " bytes");
+    }
+    return {data, data, &HugePageAllocator::Free, c10::Device(at::kCPU)};
+  }
+  c10::DeleterFnPtr raw_deleter() const override {
+    return &HugePageAllocator::Free;
+  }
+};
+
+}  // namespace
+
+void TorchAsrModel::UseHugePages(HugePageSize page_size) {
+  HugePageAllocator::Instance().set_page_size(page_size);
+  if (page_size == HugePageSize::kNone) return;
+  static HugePageCpuAllocator* allocator = new HugePageCpuAllocator();
+  // Over the default allocator of priority 0
+  c10::SetCPUAllocator(allocator, 1);
+}
+
 void TorchAsrModel::InitEngineThreads(int num_threads) {
   // For multi-thread performance
   at::set_num_threads(num_threads);
@@ -37,21 +147,73 @@ void TorchAsrModel::InitEngineThreads(int num_threads) {
   VLOG(1) << "Num inter-op threads: " << at::get_num_interop_threads();
 }
 
-void TorchAsrModel::Read(const std::string& model_path) {
-  torch::DeviceType device = at::kCPU;
+void TorchAsrModel::Read(const std::string& model_path, bool freeze,
+                         bool quantized, bool fp16, int gpu_id,
+                         bool ctc_only) {
+  device_ = torch::Device(at::kCPU);
+  if (quantized) {
+#ifdef USE_GPU
+    LOG(FATAL) << "The int8 torch model only runs on cpu, please build "
+                  "without GPU";
+#endif
+    // fbgemm on x86, qnnpack on arm
+    const auto& engines = at::globalContext().supportedQEngines();
+    for (at::QEngine engine : {at::QEngine::FBGEMM, at::QEngine::QNNPACK}) {
+      if (std::find(engines.begin(), engines.end(), engine) != engines.end()) {
+        at::globalContext().setQEngine(engine);
+        break;
+      }
+    }
+  }
 #ifdef USE_GPU
   if (!torch::cuda::is_available()) {
     VLOG(1) << "CUDA is not available! Please check your GPU settings";
     throw std::runtime_error("CUDA is not available!");
   } else {
-    VLOG(1) << "CUDA available! Running on GPU";
-    device = at::kCUDA;
+    CHECK_LT(gpu_id, torch::cuda::device_count()) << "No GPU " << gpu_id;
+    VLOG(1) << "CUDA available! Running on GPU " << gpu_id;
+    device_ = torch::Device(at::kCUDA, gpu_id);
   }
 #endif
-  torch::jit::script::Module model = torch::jit::load(model_path, device);
-  model_ = std::make_shared<TorchModule>(std::move(model));
+  // The cached module is already frozen and optimized with the options
+  bool cached = false;
+  if (optimize_) {
+    model_ = LoadOptimizedModule(optimized_cache_path_, model_path, device_);
+    cached = model_ != nullptr;
+    if (cached && !ctc_only &&
+        !model_->find_method("forward_attention_decoder")) {
+      LOG(WARNING) << "The optimized model has no attention decoder";
+      cached = false;
+    }
+  }
+  if (!cached) {
+    torch::jit::script::Module model;
+    if (model_data_ != nullptr) {
+      MemoryStream is(model_data_, model_data_size_);
+      model = torch::jit::load(is, device_);
+    } else {
+      model = torch::jit::load(model_path, device_);
+    }
+    model_ = std::make_shared<TorchModule>(std::move(model));
+  }
   torch::NoGradGuard no_grad;
-  model_->eval();
+  // The frozen module has no training attribute to set
+  if (!cached) model_->eval();
+  if (quantized && !cached) {
+    int num_quantized = 0;
+    for (const auto& module : model_->named_modules()) {
+      auto name = module.value.type()->name();
+      if (name && name->qualifiedName().find(".quantized.") !=
+                      std::string::npos) {
+        ++num_quantized;
+      }
+    }
+    if (num_quantized == 0) {
+      LOG(WARNING) << "No quantized module in " << model_path
+                   << ", is it the quantized model?";
+    }
+    VLOG(1) << num_quantized << " quantized modules";
+  }
   torch::jit::IValue o1 = model_->run_method("subsampling_rate");
   CHECK_EQ(o1.isInt(), true);
   subsampling_rate_ = o1.toInt();
@@ -67,6 +229,86 @@ void TorchAsrModel::Read(const std::string& model_path) {
   torch::jit::IValue o5 = model_->run_method("is_bidirectional_decoder");
   CHECK_EQ(o5.isBool(), true);
   is_bidirectional_decoder_ = o5.toBool();
+  if (fp16) {
+#ifdef USE_GPU
+    // Before the freeze, which folds the parameters as constants
+    if (!cached) {
+      CHECK(model_->hasattr("encoder"));
+      model_->attr("encoder").toModule().to(at::kHalf);
+    }
+    dtype_ = torch::kHalf;
+    VLOG(1) << "Run the encoder in fp16";
+#else
+    LOG(FATAL) << "The fp16 torch model only runs on GPU";
+#endif
+  }
+  if (bf16_) {
+#ifdef USE_GPU
+    LOG(FATAL) << "The bf16 torch model only runs on cpu, please build "
+                  "without GPU";
+#endif
+    CHECK(!quantized && !fp16) << "bf16 is of the fp32 model";
+    // The ctc stays in fp32, its log softmax takes the fp32 encoder outputs
+    if (!cached) {
+      CHECK(model_->hasattr("encoder"));
+      model_->attr("encoder").toModule().to(at::kBFloat16);
+      if (!ctc_only) {
+        CHECK(model_->hasattr("decoder"));
+        model_->attr("decoder").toModule().to(at::kBFloat16);
+      }
+    }
+    dtype_ = torch::kBFloat16;
+    decoder_dtype_ = torch::kBFloat16;
+    VLOG(1) << "Run the encoder and the attention decoder in bf16";
+  }
+  has_graph_method_ =
+      model_->find_method("forward_encoder_chunk_graph").has_value();
+  has_batch_forward_method_ =
+      model_->find_method("batch_forward_encoder_chunk").has_value();
+  has_batch_rescoring_method_ =
+      !ctc_only &&
+      model_->find_method("batch_forward_attention_decoder_hyps").has_value();
+  has_decoder_ = !ctc_only;
+  if (ctc_only && !cached) {
+    // The script module can't drop a submodule, so its tensors are replaced
+    // by empty ones, which frees the weights shared by the copies
+    CHECK(model_->hasattr("decoder"));
+    auto decoder = model_->attr("decoder").toModule();
+    int64_t num_bytes = 0;
+    auto release = [&num_bytes](at::Tensor tensor) {
+      num_bytes += tensor.numel() * tensor.element_size();
+      tensor.set_data(torch::empty({0}, tensor.options()));
+    };
+    for (const at::Tensor& tensor : decoder.parameters()) release(tensor);
+    for (const at::Tensor& tensor : decoder.buffers()) release(tensor);
+    VLOG(1) << "Release " << num_bytes << " bytes of the attention decoder";
+  }
+  if ((freeze || optimize_) && !cached) {
+    // The model info methods are kept for the cached module
+    std::vector<std::string> methods;
+    for (const char* name : {"forward_encoder_chunk", "ctc_activation",
+                             "forward_attention_decoder",
+                             "batch_forward_encoder_chunk",
+                             "batch_forward_attention_decoder_hyps",
+                             "subsampling_rate", "right_context",
+                             "sos_symbol", "eos_symbol",
+                             "is_bidirectional_decoder"}) {
+      bool is_decoder =
+          std::string(name).find("attention_decoder") != std::string::npos;
+      if (ctc_only && is_decoder) continue;
+      if (model_->find_method(name)) methods.emplace_back(name);
+    }
+    if (optimize_) {
+      model_ = std::make_shared<TorchModule>(
+          OptimizeForInference(*model_, methods));
+      SaveOptimizedModule(*model_, optimized_cache_path_);
+    } else {
+      model_ = std::make_shared<TorchModule>(
+          torch::jit::freeze(*model_, methods));
+      VLOG(1) << "Freeze the torch model with " << methods.size()
+              << " methods";
+    }
+  }
 
   VLOG(1) << "Torch Model Info:";
   VLOG(1) << "\tsubsampling_rate " << subsampling_rate_;
@@ -86,6 +328,18 @@ TorchAsrModel::TorchAsrModel(const TorchAsrModel& other) {
   chunk_size_ = other.chunk_size_;
   num_left_chunks_ = other.num_left_chunks_;
   offset_ = other.offset_;
+  device_cache_ = other.device_cache_;
+  dtype_ = other.dtype_;
+  decoder_dtype_ = other.decoder_dtype_;
+  device_ = other.device_;
+  chunk_graphs_ = other.chunk_graphs_;
+  cache_pool_ = other.cache_pool_;
+  has_graph_method_ = other.has_graph_method_;
+  has_batch_forward_method_ = other.has_batch_forward_method_;
+  has_batch_rescoring_method_ = other.has_batch_rescoring_method_;
+  max_encoder_frames_ = other.max_encoder_frames_;
+  encoder_out_storage_ = other.encoder_out_storage_;
+  has_decoder_ = other.has_decoder_;
   // 2. Model copy, just copy the model ptr since:
   // PyTorch allows using multiple CPU threads during TorchScript model
   // inference, please see https://pytorch.org/docs/stable/notes/cpu_
@@ -107,8 +361,91 @@ void TorchAsrModel::Reset() {
   offset_ = 0;
   att_cache_ = std::move(torch::zeros({0, 0, 0, 0}));
   cnn_cache_ = std::move(torch::zeros({0, 0, 0, 0}));
-  encoder_outs_.clear();
+  FreeCacheBlock();
+  offloaded_ = false;
+  encoder_store_ = torch::Tensor();
+  encoder_scales_ = torch::Tensor();
+  encoder_start_ = 0;
+  num_encoder_frames_ = 0;
   cached_feature_.clear();
+  device_cached_feature_ = torch::Tensor();
+}
+
+// An undefined tensor is saved as the empty shape
+static void WriteTensor(const torch::Tensor& tensor, StateWriter* writer) {
+  std::vector<int64_t> shape;
+  torch::Tensor host;
+  if (tensor.defined()) {
+    host = tensor.to(at::kCPU, torch::kFloat).contiguous();
+    shape.assign(host.sizes().begin(), host.sizes().end());
+  }
+  writer->WriteVector(shape);
+  if (host.defined()) writer->Write(host.data_ptr<float>(), host.numel());
+}
+
+static bool ReadTensor(StateReader* reader, torch::Tensor* tensor) {
+  std::vector<int64_t> shape;
+  if (!reader->ReadVector(&shape)) return false;
+  if (shape.empty()) {
+    *tensor = torch::Tensor();
+    return true;
+  }
+  const int64_t max_numel = reader->remaining() / sizeof(float);
+  int64_t numel = 1;
+  for (int64_t dim : shape) {
+    if (dim < 0 || (dim > 0 && numel > max_numel / dim)) return false;
+    numel *= dim;
+  }
+  *tensor = torch::empty(shape, torch::kFloat);
+  return reader->Read(tensor->data_ptr<float>(), numel);
+}
+
+bool TorchAsrModel::SaveStateFunc(StateWriter* writer) const {
+  WriteTensor(att_cache_, writer);
+  WriteTensor(cnn_cache_, writer);
+  // The compressed encoder outputs are saved in fp32
+  WriteTensor(EncoderWindow(), writer);
+  WriteTensor(device_cached_feature_, writer);
+  return true;
+}
+
+bool TorchAsrModel::LoadStateFunc(StateReader* reader) {
+  FreeCacheBlock();
+  torch::Tensor window;
+  if (!ReadTensor(reader, &att_cache_) || !att_cache_.defined() ||
+      !ReadTensor(reader, &cnn_cache_) || !cnn_cache_.defined() ||
+      !ReadTensor(reader, &window) ||
+      !ReadTensor(reader, &device_cached_feature_)) {
+    return false;
+  }
+  att_cache_ = att_cache_.to(dtype_);
+  cnn_cache_ = cnn_cache_.to(dtype_);
+  encoder_start_ = 0;
+  num_encoder_frames_ = 0;
+  encoder_store_ = torch::Tensor();
+  encoder_scales_ = torch::Tensor();
+  if (window.defined()) {
+    AppendEncoderOut(window.to(dtype_));
+  }
+#ifdef USE_GPU
+  if (device_cached_feature_.defined()) {
+    device_cached_feature_ = device_cached_feature_.to(device_);
+  }
+  offloaded_ = device_cache_;
+#endif
+  return true;
+}
+
+torch::Tensor TorchAsrModel::CachedFeatureTensor(int feature_dim) const {
+  int num_cached = cached_feature_.size();
+  torch::Tensor feats =
+      torch::empty({1, num_cached, feature_dim}, torch::kFloat);
+  float* dst = feats.data_ptr<float>();
+  for (const auto& row : cached_feature_) {
+    memcpy(dst, row.data(), sizeof(float) * feature_dim);
+    dst += feature_dim;
+  }
+  return feats;
 }
 
 void TorchAsrModel::ForwardEncoderFunc(
@@ -119,88 +456,815 @@ void TorchAsrModel::ForwardEncoderFunc(
   int num_frames = cached_feature_.size() + chunk_feats.size();
   const int feature_dim = chunk_feats[0].size();
   torch::Tensor feats =
-      torch::zeros({1, num_frames, feature_dim}, torch::kFloat);
-  for (size_t i = 0; i < cached_feature_.size(); ++i) {
-    torch::Tensor row =
-        torch::from_blob(const_cast<float*>(cached_feature_[i].data()),
-                         {feature_dim}, torch::kFloat)
-            .clone();
-    feats[0][i] = std::move(row);
-  }
-  for (size_t i = 0; i < chunk_feats.size(); ++i) {
-    torch::Tensor row =
-        torch::from_blob(const_cast<float*>(chunk_feats[i].data()),
-                         {feature_dim}, torch::kFloat)
-            .clone();
-    feats[0][cached_feature_.size() + i] = std::move(row);
+      torch::empty({1, num_frames, feature_dim}, torch::kFloat);
+  float* dst = feats.data_ptr<float>();
+  for (const auto& row : cached_feature_) {
+    memcpy(dst, row.data(), sizeof(float) * feature_dim);
+    dst += feature_dim;
+  }
+  for (const auto& row : chunk_feats) {
+    memcpy(dst, row.data(), sizeof(float) * feature_dim);
+    dst += feature_dim;
   }
+  CopyCtcProb(ForwardChunk(std::move(feats)), out_prob);
+}
 
-  // 2. Encoder chunk forward
+torch::Tensor TorchAsrModel::ViewToTensor(const FeatureView& chunk_feats) {
+  // The view stays valid during the synchronous forward, so no copy of it
+  const int feature_dim = chunk_feats.feature_dim();
+  torch::Tensor feats =
+      torch::from_blob(const_cast<float*>(chunk_feats.data()),
+                       {1, chunk_feats.num_frames(), feature_dim},
+                       torch::kFloat);
+  if (!cached_feature_.empty()) {
+    feats = torch::cat({CachedFeatureTensor(feature_dim), feats}, 1);
+  }
+  return feats;
+}
+
+void TorchAsrModel::ForwardEncoderFunc(
+    const FeatureView& chunk_feats, std::vector<std::vector<float>>* out_prob) {
+  CopyCtcProb(ForwardChunk(ViewToTensor(chunk_feats)), out_prob);
+}
+
+void TorchAsrModel::ForwardEncoderFunc(const FeatureView& chunk_feats,
+                                       Matrix<float>* out_prob) {
+  CopyCtcProb(ForwardChunk(ViewToTensor(chunk_feats)), out_prob);
+}
+
+void TorchAsrModel::ForwardEncoderTopKFunc(
+    const FeatureView& chunk_feats, int k,
+    std::vector<std::vector<float>>* topk_scores,
+    std::vector<std::vector<int32_t>>* topk_indexs) {
+  torch::Tensor ctc_log_probs = ForwardChunk(ViewToTensor(chunk_feats));
+  // TopK on the device, only [T, k] is copied back
+  k = std::min(k, static_cast<int>(ctc_log_probs.size(1)));
+  auto topk = ctc_log_probs.topk(k);
+  torch::Tensor scores = std::get<0>(topk).to(at::kCPU).contiguous();
+  torch::Tensor indexs =
+      std::get<1>(topk).to(at::kCPU, torch::kInt).contiguous();
+  int num_outputs = scores.size(0);
+  const float* scores_ptr = scores.data_ptr<float>();
+  const int32_t* indexs_ptr = indexs.data_ptr<int32_t>();
+  topk_scores->resize(num_outputs);
+  topk_indexs->resize(num_outputs);
+  for (int i = 0; i < num_outputs; ++i) {
+    (*topk_scores)[i].assign(scores_ptr + i * k, scores_ptr + (i + 1) * k);
+    (*topk_indexs)[i].assign(indexs_ptr + i * k, indexs_ptr + (i + 1) * k);
+  }
+}
+
+void TorchAsrModel::set_cuda_graph(int max_graphs) {
+  if (max_graphs <= 0) {
+    chunk_graphs_ = nullptr;
+    return;
+  }
+#ifdef USE_GPU
+  if (!has_graph_method_) {
+    LOG(WARNING) << "No forward_encoder_chunk_graph in the model, the CUDA "
+                    "graphs are disabled";
+    chunk_graphs_ = nullptr;
+    return;
+  }
+  chunk_graphs_ = std::make_shared<ChunkGraphs>();
+  chunk_graphs_->max_graphs = max_graphs;
+#else
+  LOG(FATAL) << "The CUDA graphs only run on GPU";
+#endif
+}
+
+void TorchAsrModel::CaptureCudaGraphs(int feature_dim,
+                                      const std::vector<int>& chunk_sizes,
+                                      int num_left_chunks) {
+#ifdef USE_GPU
+  if (chunk_graphs_ == nullptr) return;
+  if (!device_cache_ || num_left_chunks <= 0) {
+    LOG(WARNING) << "The CUDA graphs need the device cache and "
+                 << "num_left_chunks > 0";
+    chunk_graphs_ = nullptr;
+    return;
+  }
+  c10::cuda::CUDAGuard device_guard(device_);
+  torch::NoGradGuard no_grad;
+  for (int chunk_size : chunk_sizes) {
+    if (chunk_size <= 0) continue;
+    if (chunk_graphs_->graphs.size() >=
+        static_cast<size_t>(chunk_graphs_->max_graphs)) {
+      break;
+    }
+    // A session of the chunk size with the full attention cache, whose
+    // chunks are forwarded without the graphs
+    auto session = std::static_pointer_cast<TorchAsrModel>(Copy());
+    session->chunk_graphs_ = nullptr;
+    session->set_chunk_size(chunk_size);
+    session->set_num_left_chunks(num_left_chunks);
+    const int num_frames = session->num_frames_for_chunk(false);
+    torch::Tensor feats =
+        torch::zeros({1, num_frames, feature_dim}, torch::kFloat);
+    const int required_cache_size = chunk_size * num_left_chunks;
+    try {
+      for (int i = 0; i < num_left_chunks; ++i) session->ForwardChunk(feats);
+      if (session->att_cache_.size(2) != required_cache_size) {
+        throw std::runtime_error("the attention cache is not full");
+      }
+      auto graph = std::make_shared<ChunkGraphs::Graph>();
+      graph->inputs = {
+          feats.to(device_, dtype_),
+          torch::full({}, session->offset_,
+                      torch::TensorOptions().dtype(torch::kLong).device(
+                          device_)),
+          session->att_cache_.clone(), session->cnn_cache_.clone()};
+      // Capture on a side stream, after the warmup runs, e.g. for the lazy
+      // init of the kernels and the profiling runs of the jit executor.
+      // Nothing else runs on the device before the model serves, so the
+      // global capture mode doesn't fail the calls of the other threads.
+      at::cuda::getCurrentCUDAStream().synchronize();
+      c10::cuda::CUDAStream stream = c10::cuda::getStreamFromPool();
+      {
+        c10::cuda::CUDAStreamGuard guard(stream);
+        for (int i = 0; i < 3; ++i) {
+          session->RunChunk(graph->inputs[0], graph->inputs[1],
+                            graph->inputs[2], graph->inputs[3]);
+        }
+        stream.synchronize();
+        graph->graph.capture_begin();
+        graph->outputs = session->RunChunk(graph->inputs[0], graph->inputs[1],
+                                           graph->inputs[2], graph->inputs[3]);
+        graph->graph.capture_end();
+      }
+      stream.synchronize();
+      chunk_graphs_->graphs[std::make_pair(num_frames, required_cache_size)] =
+          graph;
+    } catch (const std::exception& e) {
+      // E.g. the abs_pos models, whose forward_encoder_chunk_graph fails
+      LOG(WARNING) << "Failed to capture the CUDA graph of chunk size "
+                   << chunk_size << ", the CUDA graphs are disabled: "
+                   << e.what();
+      chunk_graphs_ = nullptr;
+      return;
+    }
+    LOG(INFO) << "Capture the CUDA graph of chunk (" << num_frames << ", "
+              << required_cache_size << ")";
+  }
+#endif
+}
+
+void TorchAsrModel::set_cache_pool(int num_blocks) {
+  FreeCacheBlock();
+  cache_pool_ = num_blocks > 0 ? std::make_shared<TorchCachePool>(num_blocks)
+                               : nullptr;
+}
+
+bool TorchAsrModel::PoolCaches() {
+  if (cache_pool_ == nullptr || num_left_chunks_ <= 0) return false;
+  if (att_cache_.size(2) != chunk_size_ * num_left_chunks_) {
+    // E.g. the chunk size is changed, the caches are of another shape
+    FreeCacheBlock();
+    return false;
+  }
+  if (cache_block_ < 0) {
+    cache_block_ = cache_pool_->Allocate(att_cache_, cnn_cache_);
+    if (cache_block_ < 0) return false;
+  }
+  torch::Tensor att_block = cache_pool_->att_block(cache_block_);
+  torch::Tensor cnn_block = cache_pool_->cnn_block(cache_block_);
+  // The replayed graphs update the caches in the block in place
+  if (att_cache_.data_ptr() != att_block.data_ptr()) {
+    att_block.copy_(att_cache_);
+    att_cache_ = att_block;
+  }
+  if (cnn_cache_.data_ptr() != cnn_block.data_ptr()) {
+    cnn_block.copy_(cnn_cache_);
+    cnn_cache_ = cnn_block;
+  }
+  return true;
+}
+
+void TorchAsrModel::FreeCacheBlock() {
+  if (cache_block_ < 0) return;
+  // The block may be taken by another session once it's freed
+  att_cache_ = att_cache_.clone();
+  cnn_cache_ = cnn_cache_.clone();
+  cache_pool_->Free(cache_block_);
+  cache_block_ = -1;
+}
+
+void TorchAsrModel::Offload() {
 #ifdef USE_GPU
-  feats = feats.to(at::kCUDA);
-  att_cache_ = att_cache_.to(at::kCUDA);
-  cnn_cache_ = cnn_cache_.to(at::kCUDA);
+  if (!device_cache_ || offloaded_) return;
+  // The host copies don't alias the block, which is freed as is
+  att_cache_ = att_cache_.to(at::kCPU);
+  cnn_cache_ = cnn_cache_.to(at::kCPU);
+  if (cache_block_ >= 0) {
+    cache_pool_->Free(cache_block_);
+    cache_block_ = -1;
+  }
+  if (encoder_store_.defined()) encoder_store_ = encoder_store_.to(at::kCPU);
+  if (encoder_scales_.defined()) {
+    encoder_scales_ = encoder_scales_.to(at::kCPU);
+  }
+  offloaded_ = true;
 #endif
+}
+
+void TorchAsrModel::Restore() {
+#ifdef USE_GPU
+  if (!offloaded_) return;
+  att_cache_ = att_cache_.to(device_);
+  cnn_cache_ = cnn_cache_.to(device_);
+  if (encoder_store_.defined()) {
+    encoder_store_ = encoder_store_.to(device_);
+  }
+  if (encoder_scales_.defined()) {
+    encoder_scales_ = encoder_scales_.to(device_);
+  }
+  offloaded_ = false;
+#endif
+}
+
+std::vector<torch::Tensor> TorchAsrModel::RunChunk(
+    const torch::Tensor& feats, const torch::jit::IValue& offset,
+    const torch::Tensor& att_cache, const torch::Tensor& cnn_cache) {
   int required_cache_size = chunk_size_ * num_left_chunks_;
   torch::NoGradGuard no_grad;
-  std::vector<torch::jit::IValue> inputs = {feats, offset_, required_cache_size,
-                                            att_cache_, cnn_cache_};
+  std::vector<torch::jit::IValue> inputs = {feats, offset, required_cache_size,
+                                            att_cache, cnn_cache};
 
   // Refer interfaces in wenet/transformer/asr_model.py
-  auto outputs =
-      model_->get_method("forward_encoder_chunk")(inputs).toTuple()->elements();
+  const char* method = offset.isTensor() ? "forward_encoder_chunk_graph"
+                                         : "forward_encoder_chunk";
+  auto outputs = model_->get_method(method)(inputs).toTuple()->elements();
   CHECK_EQ(outputs.size(), 3);
+  torch::Tensor chunk_out = outputs[0].toTensor();
+  // The first dimension of returned value is for batchsize, which is 1
+  torch::Tensor ctc_log_probs =
+      model_->run_method("ctc_activation", chunk_out.to(torch::kFloat))
+          .toTensor()[0];
+  return {chunk_out, outputs[1].toTensor(), outputs[2].toTensor(),
+          ctc_log_probs};
+}
+
+bool TorchAsrModel::ReplayChunk(const torch::Tensor& feats,
+                                torch::Tensor* ctc_log_probs) {
 #ifdef USE_GPU
-  torch::Tensor chunk_out = outputs[0].toTensor().to(at::kCPU);
-  att_cache_ = outputs[1].toTensor().to(at::kCPU);
-  cnn_cache_ = outputs[2].toTensor().to(at::kCPU);
+  auto it = chunk_graphs_->graphs.find(std::make_pair(
+      static_cast<int>(feats.size(1)), static_cast<int>(att_cache_.size(2))));
+  if (it == chunk_graphs_->graphs.end()) return false;
+  ChunkGraphs::Graph* graph = it->second.get();
+  std::lock_guard<std::mutex> lock(graph->mutex);
+  at::cuda::CUDAStream stream = at::cuda::getCurrentCUDAStream();
+  // The copy out of the last replay, maybe of another stream
+  graph->copied.block(stream);
+  graph->inputs[0].copy_(feats);
+  graph->inputs[1].fill_(offset_);
+  graph->inputs[2].copy_(att_cache_);
+  graph->inputs[3].copy_(cnn_cache_);
+  graph->graph.replay();
+  // The caches of the session are of the full shapes, they are updated in
+  // place, and the encoder out is copied to the store
+  att_cache_.copy_(graph->outputs[1]);
+  cnn_cache_.copy_(graph->outputs[2]);
+  *ctc_log_probs = graph->outputs[3].clone();
+  AppendEncoderOut(graph->outputs[0]);
+  graph->copied.record(stream);
+  offset_ += graph->outputs[0].size(1);
+  return true;
 #else
-  torch::Tensor chunk_out = outputs[0].toTensor();
-  att_cache_ = outputs[1].toTensor();
-  cnn_cache_ = outputs[2].toTensor();
+  return false;
 #endif
-  offset_ += chunk_out.size(1);
+}
 
-  // The first dimension of returned value is for batchsize, which is 1
+std::unique_ptr<torch::autograd::profiler::RecordProfile>
+TorchAsrModel::ProfileCall(const char* name) {
+  if (profile_prefix_.empty()) return nullptr;
+  // The trace is written when the profile is destroyed
+  return std::unique_ptr<torch::autograd::profiler::RecordProfile>(
+      new torch::autograd::profiler::RecordProfile(
+          profile_prefix_ + "." + name + "." +
+          std::to_string(num_profiles_++) + ".json"));
+}
+
+torch::Tensor TorchAsrModel::ForwardChunk(torch::Tensor feats) {
 #ifdef USE_GPU
-  chunk_out = chunk_out.to(at::kCUDA);
-  torch::Tensor ctc_log_probs =
-      model_->run_method("ctc_activation", chunk_out).toTensor();
-  ctc_log_probs = ctc_log_probs.to(at::kCPU)[0];
-  encoder_outs_.push_back(std::move(chunk_out.to(at::kCPU)));
-#else
-  torch::Tensor ctc_log_probs =
-      model_->run_method("ctc_activation", chunk_out).toTensor()[0];
-  encoder_outs_.push_back(std::move(chunk_out));
+  c10::cuda::CUDAGuard device_guard(device_);
 #endif
+  auto profile = ProfileCall("encoder");
+  // 2. Encoder chunk forward
+  Restore();
+  feats = feats.to(device_, dtype_);
+  att_cache_ = att_cache_.to(device_, dtype_);
+  cnn_cache_ = cnn_cache_.to(device_, dtype_);
+#ifdef USE_GPU
+  // The shapes are fixed once the attention cache is full
+  if (chunk_graphs_ != nullptr && device_cache_ && num_left_chunks_ > 0 &&
+      att_cache_.size(2) == chunk_size_ * num_left_chunks_) {
+    torch::Tensor ctc_log_probs;
+    if (ReplayChunk(feats, &ctc_log_probs)) {
+      PoolCaches();
+      return ctc_log_probs;
+    }
+  }
+#endif
+  std::vector<torch::Tensor> outputs =
+      RunChunk(feats, offset_, att_cache_, cnn_cache_);
+  torch::Tensor chunk_out = outputs[0];
+  att_cache_ = outputs[1];
+  cnn_cache_ = outputs[2];
+  offset_ += chunk_out.size(1);
+  torch::Tensor ctc_log_probs = outputs[3];
+#ifdef USE_GPU
+  // Only the ctc log probs are needed on host in device cache mode
+  if (!device_cache_) {
+    chunk_out = chunk_out.to(at::kCPU);
+    att_cache_ = att_cache_.to(at::kCPU);
+    cnn_cache_ = cnn_cache_.to(at::kCPU);
+  }
+#endif
+  PoolCaches();
+  AppendEncoderOut(chunk_out);
+  return ctc_log_probs;
+}
 
-  // Copy to output
+void TorchAsrModel::CopyCtcProb(torch::Tensor ctc_log_probs,
+                                std::vector<std::vector<float>>* out_prob) {
+  ctc_log_probs = ctc_log_probs.to(at::kCPU).contiguous();
   int num_outputs = ctc_log_probs.size(0);
   int output_dim = ctc_log_probs.size(1);
   out_prob->resize(num_outputs);
+  const float* data = ctc_log_probs.data_ptr<float>();
   for (int i = 0; i < num_outputs; i++) {
-    (*out_prob)[i].resize(output_dim);
-    memcpy((*out_prob)[i].data(), ctc_log_probs[i].data_ptr(),
-           sizeof(float) * output_dim);
+    (*out_prob)[i].assign(data + i * output_dim, data + (i + 1) * output_dim);
+  }
+}
+
+void TorchAsrModel::CopyCtcProb(const torch::Tensor& ctc_log_probs,
+                                Matrix<float>* out_prob) {
+  out_prob->Resize(ctc_log_probs.size(0), ctc_log_probs.size(1));
+  // One copy from the device, or from the strided output, into the matrix
+  torch::from_blob(out_prob->data(), {out_prob->rows(), out_prob->cols()},
+                   torch::kFloat)
+      .copy_(ctc_log_probs);
+}
+
+void TorchAsrModel::ForwardEncoderBatchFunc(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+    const std::vector<std::vector<std::vector<float>>*>& ctc_probs) {
+#ifdef USE_GPU
+  c10::cuda::CUDAGuard device_guard(device_);
+#endif
+  if (!has_batch_forward_method_) {
+    AsrModel::ForwardEncoderBatchFunc(models, chunk_feats, ctc_probs);
+    return;
+  }
+  // Only the chunks with the same number of frames and the same offset(so
+  // the same cache size) can be stacked, group them first.
+  std::map<std::pair<int, int>, std::vector<int>> groups;
+  for (size_t i = 0; i < models.size(); ++i) {
+    auto model = dynamic_cast<TorchAsrModel*>(models[i]);
+    CHECK(model != nullptr);
+    int num_frames = model->cached_feature_.size() + chunk_feats[i]->size();
+    groups[std::make_pair(num_frames, model->offset_)].push_back(i);
+  }
+
+  torch::NoGradGuard no_grad;
+  for (const auto& group : groups) {
+    const std::vector<int>& indexes = group.second;
+    if (indexes.size() == 1) {
+      int i = indexes[0];
+      auto model = static_cast<TorchAsrModel*>(models[i]);
+      model->ForwardEncoderFunc(*chunk_feats[i], ctc_probs[i]);
+      continue;
+    }
+    // 1. Splice cached_feature_ and chunk_feats of each session
+    int batch_size = indexes.size();
+    int num_frames = group.first.first;
+    const int feature_dim = (*chunk_feats[indexes[0]])[0].size();
+    torch::Tensor feats =
+        torch::zeros({batch_size, num_frames, feature_dim}, torch::kFloat);
+    std::vector<TorchAsrModel*> group_models;
+    std::vector<std::vector<std::vector<float>>*> group_probs;
+    for (int b = 0; b < batch_size; ++b) {
+      auto model = static_cast<TorchAsrModel*>(models[indexes[b]]);
+      const auto& feat = *chunk_feats[indexes[b]];
+      float* dst = feats[b].data_ptr<float>();
+      for (const auto& row : model->cached_feature_) {
+        memcpy(dst, row.data(), sizeof(float) * feature_dim);
+        dst += feature_dim;
+      }
+      for (const auto& row : feat) {
+        memcpy(dst, row.data(), sizeof(float) * feature_dim);
+        dst += feature_dim;
+      }
+      group_models.push_back(model);
+      group_probs.push_back(ctc_probs[indexes[b]]);
+    }
+    ForwardBatchGroup(group_models, feats, group_probs);
+  }
+}
+
+void TorchAsrModel::ForwardBatchGroup(
+    const std::vector<TorchAsrModel*>& models, torch::Tensor feats,
+    const std::vector<std::vector<std::vector<float>>*>& ctc_probs) {
+  const int batch_size = models.size();
+  std::vector<torch::Tensor> att_caches;
+  std::vector<torch::Tensor> cnn_caches;
+  for (TorchAsrModel* model : models) {
+    model->Restore();
+    att_caches.push_back(model->att_cache_);
+    cnn_caches.push_back(model->cnn_cache_);
+  }
+
+  // 2. Batch encoder chunk forward
+  torch::Tensor att_cache = torch::stack(att_caches);
+  torch::Tensor cnn_cache = torch::stack(cnn_caches);
+  feats = feats.to(device_, dtype_);
+  att_cache = att_cache.to(device_, dtype_);
+  cnn_cache = cnn_cache.to(device_, dtype_);
+  int required_cache_size = chunk_size_ * num_left_chunks_;
+  std::vector<torch::jit::IValue> inputs = {
+      feats, models[0]->offset_, required_cache_size, att_cache, cnn_cache};
+  auto outputs = model_->get_method("batch_forward_encoder_chunk")(inputs)
+                     .toTuple()
+                     ->elements();
+  CHECK_EQ(outputs.size(), 3);
+  torch::Tensor chunk_out = outputs[0].toTensor();
+  torch::Tensor ctc_log_probs =
+      model_->run_method("ctc_activation", chunk_out.to(torch::kFloat))
+          .toTensor();
+  att_cache = outputs[1].toTensor();
+  cnn_cache = outputs[2].toTensor();
+#ifdef USE_GPU
+  ctc_log_probs = ctc_log_probs.to(at::kCPU);
+  if (!device_cache_) {
+    chunk_out = chunk_out.to(at::kCPU);
+    att_cache = att_cache.to(at::kCPU);
+    cnn_cache = cnn_cache.to(at::kCPU);
+  }
+#endif
+  CHECK_EQ(ctc_log_probs.size(0), batch_size);
+
+  // 3. Scatter the outputs and the new caches back to each session
+  int num_outputs = ctc_log_probs.size(1);
+  int output_dim = ctc_log_probs.size(2);
+  for (int b = 0; b < batch_size; ++b) {
+    TorchAsrModel* model = models[b];
+    model->att_cache_ = att_cache[b];
+    model->cnn_cache_ = cnn_cache[b];
+    // Copied to the block if pooled
+    if (!model->PoolCaches()) {
+      model->att_cache_ = model->att_cache_.clone();
+      model->cnn_cache_ = model->cnn_cache_.clone();
+    }
+    model->offset_ += chunk_out.size(1);
+    model->AppendEncoderOut(chunk_out.slice(0, b, b + 1));
+    auto* out_prob = ctc_probs[b];
+    out_prob->resize(num_outputs);
+    torch::Tensor prob = ctc_log_probs[b].contiguous();
+    for (int i = 0; i < num_outputs; i++) {
+      (*out_prob)[i].resize(output_dim);
+      memcpy((*out_prob)[i].data(), prob[i].data_ptr(),
+             sizeof(float) * output_dim);
+    }
+  }
+}
+
+torch::Tensor TorchAsrModel::SpliceDeviceFeature(const torch::Tensor& chunk) {
+  torch::Tensor feats = chunk;
+  if (device_cached_feature_.defined()) {
+    feats = torch::cat({device_cached_feature_, chunk}, 0);
+  } else if (!cached_feature_.empty()) {
+    // E.g. the session was fed from host before
+    feats = torch::cat(
+        {CachedFeatureTensor(chunk.size(1))[0].to(chunk.device()), chunk}, 0);
+    cached_feature_.clear();
+  }
+  const int cached_feature_size = 1 + right_context_ - subsampling_rate_;
+  if (feats.size(0) >= cached_feature_size) {
+    device_cached_feature_ =
+        feats.slice(0, feats.size(0) - cached_feature_size).clone();
+  }
+  return feats;
+}
+
+void TorchAsrModel::ForwardDeviceFeatureBatch(
+    const std::vector<TorchAsrModel*>& models,
+    const std::vector<torch::Tensor>& chunk_feats,
+    const std::vector<std::vector<std::vector<float>>*>& ctc_probs) {
+  CHECK_EQ(models.size(), chunk_feats.size());
+  CHECK_EQ(models.size(), ctc_probs.size());
+  if (models.empty()) return;
+  TorchAsrModel* first = models[0];
+#ifdef USE_GPU
+  c10::cuda::CUDAGuard device_guard(first->device_);
+#endif
+  torch::NoGradGuard no_grad;
+  bool has_batch_method = first->has_batch_forward_method_;
+  std::map<std::pair<int, int>, std::vector<int>> groups;
+  std::vector<torch::Tensor> feats(models.size());
+  for (size_t i = 0; i < models.size(); ++i) {
+    TorchAsrModel* model = models[i];
+    ctc_probs[i]->clear();
+    feats[i] = model->SpliceDeviceFeature(chunk_feats[i].to(torch::kFloat));
+    // Like AsrModel::ForwardEncoder, too few frames are only cached
+    if (feats[i].size(0) < model->right_context_ + 1) continue;
+    if (!has_batch_method) {
+      model->CopyCtcProb(model->ForwardChunk(feats[i].unsqueeze(0)),
+                         ctc_probs[i]);
+      continue;
+    }
+    groups[std::make_pair(feats[i].size(0), model->offset_)].push_back(i);
+  }
+  for (const auto& group : groups) {
+    const std::vector<int>& indexes = group.second;
+    std::vector<TorchAsrModel*> group_models;
+    std::vector<torch::Tensor> group_feats;
+    std::vector<std::vector<std::vector<float>>*> group_probs;
+    for (int i : indexes) {
+      group_models.push_back(models[i]);
+      group_feats.push_back(feats[i]);
+      group_probs.push_back(ctc_probs[i]);
+    }
+    // The stack is on the device of the features, no copy through host
+    first->ForwardBatchGroup(group_models, torch::stack(group_feats),
+                             group_probs);
+  }
+}
+
+void TorchAsrModel::set_max_rescoring_frames(int max_frames) {
+  max_encoder_frames_ = std::max(max_frames, 0);
+}
+
+void TorchAsrModel::set_encoder_out_storage(EncoderOutStorage storage) {
+  encoder_out_storage_ = storage;
+  encoder_store_ = torch::Tensor();
+  encoder_scales_ = torch::Tensor();
+  encoder_start_ = 0;
+  num_encoder_frames_ = 0;
+}
+
+int64_t TorchAsrModel::weight_bytes() const {
+  int64_t bytes = 0;
+  for (const auto& parameter : model_->parameters()) {
+    bytes += parameter.nbytes();
+  }
+  for (const auto& buffer : model_->buffers()) {
+    bytes += buffer.nbytes();
+  }
+  return bytes;
+}
+
+void TorchAsrModel::GetMemoryUsage(SessionMemory* usage) const {
+  AsrModel::GetMemoryUsage(usage);
+  if (device_cached_feature_.defined()) {
+    usage->cached_feature += device_cached_feature_.nbytes();
+  }
+  // The caches in a block of the cache pool are preallocated by the pool
+  usage->cache =
+      cache_block_ < 0 ? att_cache_.nbytes() + cnn_cache_.nbytes() : 0;
+  usage->encoder_outs =
+      (encoder_store_.defined() ? encoder_store_.nbytes() : 0) +
+      (encoder_scales_.defined() ? encoder_scales_.nbytes() : 0);
+}
+
+void TorchAsrModel::AppendEncoderOut(const torch::Tensor& chunk_out) {
+  // The rows of the store, and their scales of int8
+  torch::Tensor rows = chunk_out;
+  torch::Tensor scales;
+  if (encoder_out_storage_ == EncoderOutStorage::kFloat16) {
+    rows = chunk_out.to(torch::kHalf);
+  } else if (encoder_out_storage_ == EncoderOutStorage::kInt8) {
+    torch::Tensor out = chunk_out.to(torch::kFloat);
+    scales = out.abs().amax(2, true) / 127;
+    rows = (out / scales.clamp_min(1e-12)).round().to(torch::kChar);
+  }
+  const int num_new = rows.size(1);
+  const int num_needed = num_encoder_frames_ + num_new;
+  const int capacity = encoder_store_.defined() ? encoder_store_.size(1) : 0;
+  if (encoder_start_ + num_needed > capacity) {
+    // Grow to twice of it, so the window is moved at most once per half
+    // of the capacity frames
+    const int new_capacity = num_needed * 2 > capacity ? num_needed * 2 : 0;
+    MoveEncoderWindow(rows, new_capacity, &encoder_store_);
+    if (scales.defined()) {
+      MoveEncoderWindow(scales, new_capacity, &encoder_scales_);
+    }
+    encoder_start_ = 0;
+  }
+  encoder_store_.narrow(1, encoder_start_ + num_encoder_frames_, num_new)
+      .copy_(rows);
+  if (scales.defined()) {
+    encoder_scales_.narrow(1, encoder_start_ + num_encoder_frames_, num_new)
+        .copy_(scales);
+  }
+  num_encoder_frames_ = num_needed;
+  // Slide the window, the oldest frames are dropped
+  if (max_encoder_frames_ > 0 && num_encoder_frames_ > max_encoder_frames_) {
+    encoder_start_ += num_encoder_frames_ - max_encoder_frames_;
+    num_encoder_frames_ = max_encoder_frames_;
+  }
+}
+
+void TorchAsrModel::MoveEncoderWindow(const torch::Tensor& rows,
+                                      int new_capacity,
+                                      torch::Tensor* store) const {
+  torch::Tensor window;
+  if (num_encoder_frames_ > 0) {
+    window = store->narrow(1, encoder_start_, num_encoder_frames_);
+  }
+  if (new_capacity > 0) {
+    torch::Tensor grown = torch::empty(
+        {1, new_capacity, rows.size(2)},
+        store->defined() ? store->options() : rows.options());
+    if (window.defined()) {
+      grown.narrow(1, 0, num_encoder_frames_).copy_(window);
+    }
+    *store = std::move(grown);
+  } else if (window.defined()) {
+    // Move the window to the front, which may overlap
+    store->narrow(1, 0, num_encoder_frames_).copy_(window.clone());
+  }
+}
+
+torch::Tensor TorchAsrModel::EncoderWindow() const {
+  if (num_encoder_frames_ == 0) return torch::Tensor();
+  // In fp32, which the rescoring converts to the dtype of the decoder
+  torch::Tensor window =
+      encoder_store_.narrow(1, encoder_start_, num_encoder_frames_)
+          .to(torch::kFloat);
+  if (encoder_scales_.defined()) {
+    window = window *
+             encoder_scales_.narrow(1, encoder_start_, num_encoder_frames_);
+  }
+  return window;
+}
+
+torch::Tensor TorchAsrModel::EncoderOut() {
+  Restore();
+  return EncoderWindow();
+}
+
+int TorchAsrModel::HypsToTensor(const std::vector<std::vector<int>>& hyps,
+                                torch::Tensor* hyps_tensor,
+                                torch::Tensor* hyps_length) const {
+  int num_hyps = hyps.size();
+  int max_hyps_len = 0;
+  for (const auto& hyp : hyps) {
+    max_hyps_len = std::max(static_cast<int>(hyp.size()) + 1, max_hyps_len);
+  }
+  // Fill a flat host buffer, then it's one copy to the tensor
+  std::vector<int64_t> data(num_hyps * max_hyps_len, 0);
+  std::vector<int64_t> lengths(num_hyps);
+  for (size_t i = 0; i < num_hyps; ++i) {
+    int64_t* row = data.data() + i * max_hyps_len;
+    row[0] = sos_;
+    std::copy(hyps[i].begin(), hyps[i].end(), row + 1);
+    lengths[i] = hyps[i].size() + 1;
+  }
+  *hyps_tensor = torch::from_blob(data.data(), {num_hyps, max_hyps_len},
+                                  torch::kLong)
+                     .clone();
+  *hyps_length = torch::from_blob(lengths.data(), {num_hyps}, torch::kLong)
+                     .clone();
+  return max_hyps_len;
+}
+
+void TorchAsrModel::AttentionRescoringBatchFunc(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<int>>*>& hyps,
+    float reverse_weight,
+    const std::vector<std::vector<float>*>& rescoring_scores) {
+#ifdef USE_GPU
+  c10::cuda::CUDAGuard device_guard(device_);
+#endif
+  if (!has_batch_rescoring_method_) {
+    AsrModel::AttentionRescoringBatchFunc(models, hyps, reverse_weight,
+                                          rescoring_scores);
+    return;
+  }
+  torch::NoGradGuard no_grad;
+  // Step 1: Flatten the hyps of all the sessions, and pad the encoder
+  // outputs of the sessions to the same length
+  std::vector<std::vector<int>> all_hyps;
+  std::vector<int64_t> hyp_utts;
+  std::vector<torch::Tensor> encoder_outs;
+  std::vector<int64_t> encoder_lens;
+  for (size_t i = 0; i < models.size(); ++i) {
+    auto model = dynamic_cast<TorchAsrModel*>(models[i]);
+    CHECK(model != nullptr);
+    rescoring_scores[i]->assign(hyps[i]->size(), 0.0f);
+    if (hyps[i]->empty() || model->num_encoder_frames_ == 0) continue;
+    for (const auto& hyp : *hyps[i]) {
+      all_hyps.push_back(hyp);
+      hyp_utts.push_back(encoder_outs.size());
+    }
+    encoder_outs.push_back(model->EncoderOut());
+    encoder_lens.push_back(encoder_outs.back().size(1));
+  }
+  if (all_hyps.empty()) return;
+  int64_t max_len = *std::max_element(encoder_lens.begin(), encoder_lens.end());
+  for (auto& encoder_out : encoder_outs) {
+    encoder_out = torch::constant_pad_nd(
+        encoder_out, {0, 0, 0, max_len - encoder_out.size(1)}, 0);
+  }
+  torch::Tensor hyps_tensor;
+  torch::Tensor hyps_length;
+  int max_hyps_len = HypsToTensor(all_hyps, &hyps_tensor, &hyps_length);
+  int num_hyps = all_hyps.size();
+  torch::Tensor utt_index =
+      torch::from_blob(hyp_utts.data(), {num_hyps}, torch::kLong).clone();
+  torch::Tensor lens_tensor =
+      torch::from_blob(encoder_lens.data(),
+                       {static_cast<int64_t>(encoder_lens.size())},
+                       torch::kLong)
+          .clone();
+
+  // Step 2: Forward attention decoder, the encoder output is repeated for
+  // every hyp of the session
+  torch::Tensor encoder_out = torch::cat(encoder_outs, 0);
+#ifdef USE_GPU
+  hyps_tensor = hyps_tensor.to(device_);
+  hyps_length = hyps_length.to(device_);
+  encoder_out = encoder_out.to(device_);
+  utt_index = utt_index.to(device_);
+  lens_tensor = lens_tensor.to(device_);
+#endif
+  encoder_out = encoder_out.to(decoder_dtype_);
+  encoder_out = encoder_out.index_select(0, utt_index);
+  lens_tensor = lens_tensor.index_select(0, utt_index);
+  auto outputs = model_
+                     ->run_method("batch_forward_attention_decoder_hyps",
+                                  hyps_tensor, hyps_length, encoder_out,
+                                  lens_tensor, reverse_weight)
+                     .toTuple()
+                     ->elements();
+  torch::Tensor probs = outputs[0].toTensor();
+  CHECK_EQ(probs.size(0), num_hyps);
+  CHECK_EQ(probs.size(1), max_hyps_len);
+
+  // Step 3: Compute rescoring score on the device, in the same order of the
+  // flattening
+  torch::Tensor score = GatherHypScores(probs, all_hyps, false);
+  if (is_bidirectional_decoder_ && reverse_weight > 0) {
+    torch::Tensor r_score =
+        GatherHypScores(outputs[1].toTensor(), all_hyps, true);
+    score = score * (1 - reverse_weight) + r_score * reverse_weight;
+  }
+  score = score.to(at::kCPU).contiguous();
+  const float* data = score.data_ptr<float>();
+  int k = 0;
+  for (size_t i = 0; i < models.size(); ++i) {
+    auto model = static_cast<TorchAsrModel*>(models[i]);
+    if (hyps[i]->empty() || model->num_encoder_frames_ == 0) continue;
+    for (size_t j = 0; j < hyps[i]->size(); ++j, ++k) {
+      (*rescoring_scores[i])[j] = data[k];
+    }
   }
 }
 
-float TorchAsrModel::ComputeAttentionScore(const torch::Tensor& prob,
-                                           const std::vector<int>& hyp,
-                                           int eos) {
-  float score = 0.0f;
-  auto accessor = prob.accessor<float, 2>();
-  for (size_t j = 0; j < hyp.size(); ++j) {
-    score += accessor[j][hyp[j]];
+torch::Tensor TorchAsrModel::GatherHypScores(
+    const torch::Tensor& probs, const std::vector<std::vector<int>>& hyps,
+    bool reverse) const {
+  int num_hyps = probs.size(0);
+  int max_hyps_len = probs.size(1);
+  // The targets of the hyps end with eos, the positions after it are
+  // padding, which gather the log prob of token 0 and are masked
+  std::vector<int64_t> targets(num_hyps * max_hyps_len, 0);
+  std::vector<uint8_t> padding(targets.size(), 1);
+  for (int i = 0; i < num_hyps; ++i) {
+    const std::vector<int>& hyp = hyps[i];
+    int64_t* target = targets.data() + i * max_hyps_len;
+    if (reverse) {
+      std::reverse_copy(hyp.begin(), hyp.end(), target);
+    } else {
+      std::copy(hyp.begin(), hyp.end(), target);
+    }
+    target[hyp.size()] = eos_;
+    std::fill_n(padding.data() + i * max_hyps_len, hyp.size() + 1, 0);
   }
-  score += accessor[hyp.size()][eos];
-  return score;
+  torch::Tensor index =
+      torch::from_blob(targets.data(), {num_hyps, max_hyps_len, 1},
+                       torch::kLong)
+          .to(probs.device());
+  torch::Tensor mask =
+      torch::from_blob(padding.data(), {num_hyps, max_hyps_len},
+                       torch::kBool)
+          .to(probs.device());
+  return probs.to(torch::kFloat)
+      .gather(2, index)
+      .squeeze(2)
+      .masked_fill(mask, 0)
+      .sum(1);
 }
 
 void TorchAsrModel::AttentionRescoring(
     const std::vector<std::vector<int>>& hyps, float reverse_weight,
     std::vector<float>* rescoring_score) {
+#ifdef USE_GPU
+  c10::cuda::CUDAGuard device_guard(device_);
+#endif
   CHECK(rescoring_score != nullptr);
+  CHECK(has_decoder_) << "The attention decoder is not loaded";
   int num_hyps = hyps.size();
   rescoring_score->resize(num_hyps, 0.0f);
 
@@ -208,73 +1272,51 @@ void TorchAsrModel::AttentionRescoring(
     return;
   }
   // No encoder output
-  if (encoder_outs_.size() == 0) {
+  if (num_encoder_frames_ == 0) {
     return;
   }
 
+  auto profile = ProfileCall("rescoring");
   torch::NoGradGuard no_grad;
   // Step 1: Prepare input for libtorch
-  torch::Tensor hyps_length = torch::zeros({num_hyps}, torch::kLong);
-  int max_hyps_len = 0;
-  for (size_t i = 0; i < num_hyps; ++i) {
-    int length = hyps[i].size() + 1;
-    max_hyps_len = std::max(length, max_hyps_len);
-    hyps_length[i] = static_cast<int64_t>(length);
-  }
-  torch::Tensor hyps_tensor =
-      torch::zeros({num_hyps, max_hyps_len}, torch::kLong);
-  for (size_t i = 0; i < num_hyps; ++i) {
-    const std::vector<int>& hyp = hyps[i];
-    hyps_tensor[i][0] = sos_;
-    for (size_t j = 0; j < hyp.size(); ++j) {
-      hyps_tensor[i][j + 1] = hyp[j];
-    }
-  }
+  torch::Tensor hyps_tensor;
+  torch::Tensor hyps_length;
+  int max_hyps_len = HypsToTensor(hyps, &hyps_tensor, &hyps_length);
 
-  // Step 2: Forward attention decoder by hyps and corresponding encoder_outs_
-  torch::Tensor encoder_out = torch::cat(encoder_outs_, 1);
+  // Step 2: Forward attention decoder by hyps and the encoder outputs
+  torch::Tensor encoder_out = EncoderOut();
 #ifdef USE_GPU
-  hyps_tensor = hyps_tensor.to(at::kCUDA);
-  hyps_length = hyps_length.to(at::kCUDA);
-  encoder_out = encoder_out.to(at::kCUDA);
+  hyps_tensor = hyps_tensor.to(device_);
+  hyps_length = hyps_length.to(device_);
+  encoder_out = encoder_out.to(device_);
 #endif
+  encoder_out = encoder_out.to(decoder_dtype_);
   auto outputs = model_
                      ->run_method("forward_attention_decoder", hyps_tensor,
                                   hyps_length, encoder_out, reverse_weight)
                      .toTuple()
                      ->elements();
-#ifdef USE_GPU
-  auto probs = outputs[0].toTensor().to(at::kCPU);
-  auto r_probs = outputs[1].toTensor().to(at::kCPU);
-#else
-  auto probs = outputs[0].toTensor();
-  auto r_probs = outputs[1].toTensor();
-#endif
+  torch::Tensor probs = outputs[0].toTensor();
   CHECK_EQ(probs.size(0), num_hyps);
   CHECK_EQ(probs.size(1), max_hyps_len);
 
-  // Step 3: Compute rescoring score
-  for (size_t i = 0; i < num_hyps; ++i) {
-    const std::vector<int>& hyp = hyps[i];
-    float score = 0.0f;
-    // left-to-right decoder score
-    score = ComputeAttentionScore(probs[i], hyp, eos_);
-    // Optional: Used for right to left score
-    float r_score = 0.0f;
-    if (is_bidirectional_decoder_ && reverse_weight > 0) {
-      // right-to-left score
-      CHECK_EQ(r_probs.size(0), num_hyps);
-      CHECK_EQ(r_probs.size(1), max_hyps_len);
-      std::vector<int> r_hyp(hyp.size());
-      std::reverse_copy(hyp.begin(), hyp.end(), r_hyp.begin());
-      // right to left decoder score
-      r_score = ComputeAttentionScore(r_probs[i], r_hyp, eos_);
-    }
-
+  // Step 3: Compute rescoring score on the device, only the scores are
+  // copied to host
+  // left-to-right decoder score
+  torch::Tensor score = GatherHypScores(probs, hyps, false);
+  // Optional: Used for right to left score, which is skipped entirely
+  // without the reverse weight
+  if (is_bidirectional_decoder_ && reverse_weight > 0) {
+    torch::Tensor r_probs = outputs[1].toTensor();
+    CHECK_EQ(r_probs.size(0), num_hyps);
+    CHECK_EQ(r_probs.size(1), max_hyps_len);
     // combined left-to-right and right-to-left score
-    (*rescoring_score)[i] =
-        score * (1 - reverse_weight) + r_score * reverse_weight;
+    torch::Tensor r_score = GatherHypScores(r_probs, hyps, true);
+    score = score * (1 - reverse_weight) + r_score * reverse_weight;
   }
+  score = score.to(at::kCPU).contiguous();
+  const float* data = score.data_ptr<float>();
+  std::copy(data, data + num_hyps, rescoring_score->begin());
 }
 
 }  // namespace wenet
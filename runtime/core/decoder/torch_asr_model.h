@@ -18,46 +18,302 @@
 #define DECODER_TORCH_ASR_MODEL_H_
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "torch/script.h"
 #include "torch/torch.h"
+#include "torch/csrc/autograd/profiler.h"
 
 #include "decoder/asr_model.h"
+#include "decoder/block_allocator.h"
+#include "decoder/encoder_out_store.h"
+#include "utils/huge_pages.h"
 #include "utils/utils.h"
 
 namespace wenet {
 
+// The fixed-size att/cnn caches of the streaming sessions with
+// num_left_chunks > 0, in blocks of two tensors preallocated by the shapes
+// of the first cache, so the caches of all the sessions take a bounded
+// memory in place, and a batch of them is gathered by the block indexes.
+class TorchCachePool {
+ public:
+  explicit TorchCachePool(int num_blocks) : allocator_(num_blocks) {}
+
+  // Return the block for the caches, or -1 if the pool is exhausted or the
+  // shapes of the caches are not those of the pool
+  int Allocate(const torch::Tensor& att_cache, const torch::Tensor& cnn_cache);
+  void Free(int block);
+  torch::Tensor att_block(int block) const { return att_blocks_[block]; }
+  torch::Tensor cnn_block(int block) const { return cnn_blocks_[block]; }
+
+ private:
+  BlockAllocator allocator_;
+  std::mutex mutex_;
+  // [num_blocks, ...] of the shape, dtype and device of the first caches
+  torch::Tensor att_blocks_;
+  torch::Tensor cnn_blocks_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(TorchCachePool);
+};
+
 class TorchAsrModel : public AsrModel {
  public:
   // Note: Do not call the InitEngineThreads function more than once.
   static void InitEngineThreads(int num_threads = 1);
+  // Allocate the CPU tensors, e.g. the weights, by HugePageAllocator of
+  // page_size, for the BatchTorchAsrModel too. Call it before any model is
+  // read.
+  static void UseHugePages(HugePageSize page_size);
 
  public:
   using TorchModule = torch::jit::script::Module;
   TorchAsrModel() = default;
   TorchAsrModel(const TorchAsrModel& other);
-  void Read(const std::string& model_path);
+  ~TorchAsrModel() override {
+    if (cache_block_ >= 0) cache_pool_->Free(cache_block_);
+  }
+  // If freeze, the parameters are inlined and folded as constants, and only
+  // the methods used in decoding are kept. If quantized, the model is the
+  // int8 dynamic quantized one, e.g. final_quant.zip of wenet/bin/
+  // export_jit.py, whose quantized linears only run on cpu. If fp16, the
+  // encoder runs in half precision on GPU, so are its caches and outputs,
+  // and the ctc and the attention decoder still run in fp32. With USE_GPU,
+  // the model runs on the GPU of gpu_id, see ModelReplicas for several.
+  // If ctc_only, the weights of the attention decoder are released after
+  // loading, and dropped with its methods by the freeze, so the hyps can't
+  // be rescored, e.g. for the ctc wfst search with rescoring_weight 0.
+  void Read(const std::string& model_path, bool freeze = false,
+            bool quantized = false, bool fp16 = false, int gpu_id = 0,
+            bool ctc_only = false);
+  // Freeze the model and optimize it by OptimizeForInference in Read, the
+  // optimized module is saved to cache_path if not empty, and read from it
+  // by the next starts instead. Call it before Read().
+  void set_optimize(bool optimize, const std::string& cache_path = "") {
+    optimize_ = optimize;
+    optimized_cache_path_ = cache_path;
+  }
+  // Run the encoder and the attention decoder of the fp32 model in bf16 on
+  // cpu, so are the caches, by the oneDNN kernels, which are of AMX on the
+  // cpus having it, e.g. Sapphire Rapids. The ctc log softmax and the
+  // rescoring scores stay in fp32. Call it before Read().
+  void set_bf16(bool bf16) { bf16_ = bf16; }
+  // Read the module from the memory, e.g. the section of a mapped
+  // ModelBundle, instead of the file of model_path, which still names it in
+  // the logs and for the optimized cache. The memory must outlive Read().
+  void set_model_data(const char* data, size_t size) {
+    model_data_ = data;
+    model_data_size_ = size;
+  }
   std::shared_ptr<TorchModule> torch_model() const { return model_; }
+  // The caches of any length are taken by forward_encoder_chunk
+  bool chunk_size_changeable() const override { return true; }
+  // By the exported batch_forward_encoder_chunk and
+  // batch_forward_attention_decoder_hyps methods
+  bool batch_forward_supported() const override {
+    return has_batch_forward_method_;
+  }
+  bool batch_rescoring_supported() const override {
+    return has_batch_rescoring_method_;
+  }
+  // With USE_GPU, keep the att/cnn caches and the encoder outputs on the
+  // device for the whole session, only the ctc log probs are copied back.
+  void set_device_cache(bool device_cache) { device_cache_ = device_cache; }
+  // With USE_GPU, replay the CUDA graphs of the chunks instead of launching
+  // their kernels one by one. Only the chunks after the attention cache is
+  // full with num_left_chunks > 0 have fixed shapes, so a graph is captured
+  // per (num_frames, cache frames) by CaptureCudaGraphs, up to max_graphs
+  // graphs shared by the copies of the model. The exported
+  // forward_encoder_chunk_graph takes the offset as a device tensor, so a
+  // graph replays at any offset, which the abs_pos models don't support.
+  // It needs the device cache, and 0 disables it.
+  void set_cuda_graph(int max_graphs);
+  // Capture the graphs of the chunk sizes before the model serves, since
+  // the capture fails the device calls of the other threads. The graphs
+  // are disabled if any of them fails.
+  void CaptureCudaGraphs(int feature_dim, const std::vector<int>& chunk_sizes,
+                         int num_left_chunks);
+  // Keep the full caches of the sessions in a pool of num_blocks blocks
+  // shared by the copies of the model, the sessions beyond it keep their
+  // own caches. 0 disables it.
+  // The forward returns new caches, which are copied to the block after
+  // each chunk, so the pool bounds the memory of the idle sessions at the
+  // cost of a copy and a transient allocation per chunk. Only the replayed
+  // graphs write the block in place.
+  void set_cache_pool(int num_blocks);
+  // Keep the encoder outputs of the last max_frames frames only, which the
+  // hyps are rescored with, so the memory of a long session without the
+  // endpoint is bounded. 0 keeps all of them.
+  void set_max_rescoring_frames(int max_frames);
+  // Keep the encoder outputs for the rescoring in fp16 or per row int8 with
+  // the scales, which are decompressed by the rescoring
+  void set_encoder_out_storage(EncoderOutStorage storage);
   void Reset() override;
+  // With USE_GPU and the device cache, the caches and the encoder outputs
+  // are moved to host memory, and the block of the cache pool is freed.
+  void Offload() override;
+  // Each forward and rescoring of the copy is profiled by the autograd
+  // profiler into a chrome trace of the prefix, with the record functions
+  // of the kernels
+  void set_profile_prefix(const std::string& prefix) override {
+    profile_prefix_ = prefix;
+    num_profiles_ = 0;
+  }
+  int64_t weight_bytes() const override;
+  void GetMemoryUsage(SessionMemory* usage) const override;
   void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                           float reverse_weight,
                           std::vector<float>* rescoring_score) override;
   std::shared_ptr<AsrModel> Copy() const override;
 
+  // Forward the chunks of many sessions whose features are [T, D] tensors
+  // on the device of the models, e.g. by StreamingFbankCuda, so they don't
+  // take a round trip through host. The cached frames of such a session are
+  // kept on the device. The chunks with the same number of frames and the
+  // same offset are stacked into one batch_forward_encoder_chunk call.
+  static void ForwardDeviceFeatureBatch(
+      const std::vector<TorchAsrModel*>& models,
+      const std::vector<torch::Tensor>& chunk_feats,
+      const std::vector<std::vector<std::vector<float>>*>& ctc_probs);
+
  protected:
   void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
                           std::vector<std::vector<float>>* ctc_prob) override;
+  // Wrap the chunk with a single from_blob, and only the cached frames are
+  // copied.
+  void ForwardEncoderFunc(const FeatureView& chunk_feats,
+                          std::vector<std::vector<float>>* ctc_prob) override;
+  // The log probs are copied from the device straight into the matrix
+  void ForwardEncoderFunc(const FeatureView& chunk_feats,
+                          Matrix<float>* ctc_prob) override;
+  // TopK is done on the device, only [T, k] is copied back to host
+  void ForwardEncoderTopKFunc(
+      const FeatureView& chunk_feats, int k,
+      std::vector<std::vector<float>>* topk_scores,
+      std::vector<std::vector<int32_t>>* topk_indexs) override;
+  // Use the exported `batch_forward_encoder_chunk` method if any, which takes
+  // the caches stacked in a leading batch dim.
+  void ForwardEncoderBatchFunc(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+      const std::vector<std::vector<std::vector<float>>*>& ctc_probs) override;
+
+  // Use the exported `batch_forward_attention_decoder_hyps` method if any,
+  // which takes the hyps of all the sessions with the encoder output of its
+  // session repeated for each hyp, padded and with lengths.
+  void AttentionRescoringBatchFunc(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<int>>*>& hyps,
+      float reverse_weight,
+      const std::vector<std::vector<float>*>& rescoring_scores) override;
 
-  float ComputeAttentionScore(const torch::Tensor& prob,
-                              const std::vector<int>& hyp, int eos);
+  // The sums of the log probs of the hyps followed by eos, which are
+  // gathered on the device of probs, so only the (num_hyps,) scores are
+  // copied to host instead of probs (num_hyps, max_hyps_len, vocab).
+  // reverse is for the probs of the right to left decoder.
+  torch::Tensor GatherHypScores(const torch::Tensor& probs,
+                                const std::vector<std::vector<int>>& hyps,
+                                bool reverse) const;
+  // The caches are saved in fp32 on host, and loaded as offloaded, so they
+  // are moved to the device by the next forward
+  bool SaveStateFunc(StateWriter* writer) const override;
+  bool LoadStateFunc(StateReader* reader) override;
 
  private:
+  // The profile of a call of the captured request, nullptr if it's not
+  std::unique_ptr<torch::autograd::profiler::RecordProfile> ProfileCall(
+      const char* name);
+  // Forward the spliced [1, T, D] feats and update the caches, return the
+  // [T, vocab] ctc log probs, which are on the device with USE_GPU
+  torch::Tensor ForwardChunk(torch::Tensor feats);
+  // Run forward_encoder_chunk and ctc_activation, return chunk_out, the new
+  // att_cache and cnn_cache and the [T, vocab] ctc log probs. A tensor
+  // offset runs forward_encoder_chunk_graph instead.
+  std::vector<torch::Tensor> RunChunk(const torch::Tensor& feats,
+                                      const torch::jit::IValue& offset,
+                                      const torch::Tensor& att_cache,
+                                      const torch::Tensor& cnn_cache);
+  // Move the caches to the block of the session in the pool, allocate it
+  // if needed. Return false if they are not pooled.
+  bool PoolCaches();
+  void FreeCacheBlock();
+  // Move the offloaded caches and encoder outputs back to the device
+  void Restore();
+  // Replay the graph of the chunk, whose outputs are copied to the caches in
+  // place. Return false if no graph is captured of its shape.
+  bool ReplayChunk(const torch::Tensor& feats, torch::Tensor* ctc_log_probs);
+  void CopyCtcProb(torch::Tensor ctc_log_probs,
+                   std::vector<std::vector<float>>* ctc_prob);
+  void CopyCtcProb(const torch::Tensor& ctc_log_probs, Matrix<float>* ctc_prob);
+  // Run batch_forward_encoder_chunk on the [B, T, D] feats of the sessions
+  // of the same offset, and scatter the outputs and the caches back
+  void ForwardBatchGroup(
+      const std::vector<TorchAsrModel*>& models, torch::Tensor feats,
+      const std::vector<std::vector<std::vector<float>>*>& ctc_probs);
+  // Splice the cached frames and the [T, D] chunk on the device, and cache
+  // the last frames of it for the next chunk
+  torch::Tensor SpliceDeviceFeature(const torch::Tensor& chunk);
+  // Splice cached_feature_ and the chunk view to a [1, T, D] tensor
+  torch::Tensor ViewToTensor(const FeatureView& chunk_feats);
+  // Copy cached_feature_ to a [1, T, D] tensor
+  torch::Tensor CachedFeatureTensor(int feature_dim) const;
+  // [1, T, D] encoder outputs of the session in the window
+  torch::Tensor EncoderOut();
+  // The window decompressed to fp32 on the device of the store, undefined
+  // if it's empty
+  torch::Tensor EncoderWindow() const;
+  // Move the window of the store of the rows to the front, of a new store
+  // of new_capacity frames if it's > 0
+  void MoveEncoderWindow(const torch::Tensor& rows, int new_capacity,
+                         torch::Tensor* store) const;
+  // Copy the [1, T, D] chunk_out to the end of the window
+  void AppendEncoderOut(const torch::Tensor& chunk_out);
+  // [num_hyps, max_hyps_len] sos prepended hyps padded by 0 and the lengths,
+  // returns max_hyps_len
+  int HypsToTensor(const std::vector<std::vector<int>>& hyps,
+                   torch::Tensor* hyps_tensor,
+                   torch::Tensor* hyps_length) const;
+
   std::shared_ptr<TorchModule> model_ = nullptr;
-  std::vector<torch::Tensor> encoder_outs_;
+  bool device_cache_ = true;
+  std::string profile_prefix_;
+  int num_profiles_ = 0;
+  struct ChunkGraphs;
+  std::shared_ptr<ChunkGraphs> chunk_graphs_ = nullptr;
+  // The dtype of the encoder and its caches and outputs
+  torch::ScalarType dtype_ = torch::kFloat;
+  // The dtype of the attention decoder and the encoder outputs it takes
+  torch::ScalarType decoder_dtype_ = torch::kFloat;
+  bool bf16_ = false;
+  torch::Device device_ = torch::Device(at::kCPU);
+  // [T, D] cached frames of the features fed on the device
+  torch::Tensor device_cached_feature_;
+  // The encoder outputs of the session are copied to the window [start,
+  // start + num_frames) of the [1, capacity, D] store, which slides by the
+  // max frames if any, see set_max_rescoring_frames
+  torch::Tensor encoder_store_;
+  // [1, capacity, 1] scales of the rows of the int8 storage
+  torch::Tensor encoder_scales_;
+  EncoderOutStorage encoder_out_storage_ = EncoderOutStorage::kFloat32;
+  int encoder_start_ = 0;
+  int num_encoder_frames_ = 0;
+  int max_encoder_frames_ = 0;
+  bool has_graph_method_ = false;
+  bool has_batch_forward_method_ = false;
+  bool has_batch_rescoring_method_ = false;
+  bool optimize_ = false;
+  std::string optimized_cache_path_;
+  const char* model_data_ = nullptr;
+  size_t model_data_size_ = 0;
   // transformer/conformer attention cache
   torch::Tensor att_cache_ = torch::zeros({0, 0, 0, 0});
+  std::shared_ptr<TorchCachePool> cache_pool_ = nullptr;
+  // The block of the caches in cache_pool_, -1 if none
+  int cache_block_ = -1;
+  bool offloaded_ = false;
   // conformer-only conv_module cache
   torch::Tensor cnn_cache_ = torch::zeros({0, 0, 0, 0});
 };
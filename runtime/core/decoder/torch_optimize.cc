@@ -0,0 +1,93 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/torch_optimize.h"
+
+#include <cstdio>
+
+#include "utils/file.h"
+#include "utils/log.h"
+#include "utils/timer.h"
+
+namespace wenet {
+
+torch::jit::script::Module OptimizeForInference(
+    const torch::jit::script::Module& module,
+    const std::vector<std::string>& methods) {
+  Timer timer;
+  std::vector<std::string> kept;
+  std::vector<std::string> attrs;
+  for (const auto& name : methods) {
+    if (module.find_method(name)) {
+      kept.emplace_back(name);
+    } else if (module.hasattr(name)) {
+      attrs.emplace_back(name);
+    }
+  }
+  std::vector<std::string> preserved = kept;
+  preserved.insert(preserved.end(), attrs.begin(), attrs.end());
+  torch::jit::script::Module frozen = torch::jit::freeze(module, preserved);
+  // The frozen module has no training attribute, so it's not frozen again
+  torch::jit::script::Module optimized =
+      torch::jit::optimize_for_inference(frozen, kept);
+  LOG(INFO) << "Optimize the torch model with " << kept.size()
+            << " methods in " << timer.Elapsed() << "ms";
+  return optimized;
+}
+
+std::shared_ptr<torch::jit::script::Module> LoadOptimizedModule(
+    const std::string& cache_path, const std::string& model_path,
+    const torch::Device& device) {
+  if (cache_path.empty() || !FileExists(cache_path)) return nullptr;
+  if (!FileUpToDate(cache_path, model_path)) {
+    LOG(INFO) << "The optimized model " << cache_path << " is older than "
+              << model_path << ", optimize it again";
+    return nullptr;
+  }
+  try {
+    auto module = std::make_shared<torch::jit::script::Module>(
+        torch::jit::load(cache_path, device));
+    LOG(INFO) << "Read the optimized model " << cache_path;
+    return module;
+  } catch (const std::exception& e) {
+    LOG(WARNING) << "Failed to read the optimized model " << cache_path
+                 << ": " << e.what();
+    return nullptr;
+  }
+}
+
+void SaveOptimizedModule(const torch::jit::script::Module& module,
+                         const std::string& cache_path) {
+  if (cache_path.empty()) return;
+  // Save to a temp file then rename, so a concurrent start never reads a
+  // partial cache
+  std::string temp_path = cache_path + ".tmp";
+  try {
+    module.save(temp_path);
+  } catch (const std::exception& e) {
+    LOG(WARNING) << "Failed to save the optimized model " << cache_path
+                 << ": " << e.what();
+    std::remove(temp_path.c_str());
+    return;
+  }
+  if (std::rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+    LOG(WARNING) << "Failed to save the optimized model " << cache_path;
+    std::remove(temp_path.c_str());
+    return;
+  }
+  LOG(INFO) << "Save the optimized model " << cache_path;
+}
+
+}  // namespace wenet
@@ -0,0 +1,50 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DECODER_TORCH_OPTIMIZE_H_
+#define DECODER_TORCH_OPTIMIZE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "torch/script.h"
+
+namespace wenet {
+
+// Freeze the module with only the methods kept, then optimize the graphs of
+// the methods by torch::jit::optimize_for_inference, e.g. the convs and the
+// linears are converted to the MKLDNN layout on CPU and the ops are fused on
+// GPU. The names may also be of the attributes to keep, the methods and the
+// attributes the module doesn't have are skipped.
+torch::jit::script::Module OptimizeForInference(
+    const torch::jit::script::Module& module,
+    const std::vector<std::string>& methods);
+
+// Load the module cached at cache_path by SaveOptimizedModule on the device,
+// if any and newer than model_path, nullptr otherwise. The cache is not
+// keyed by the options it's optimized with, remove it when they change.
+std::shared_ptr<torch::jit::script::Module> LoadOptimizedModule(
+    const std::string& cache_path, const std::string& model_path,
+    const torch::Device& device);
+
+// Save the optimized module to cache_path, a failure is only a warning since
+// some optimized ops can't be serialized, then the next start optimizes again
+void SaveOptimizedModule(const torch::jit::script::Module& module,
+                         const std::string& cache_path);
+
+}  // namespace wenet
+
+#endif  // DECODER_TORCH_OPTIMIZE_H_
@@ -0,0 +1,182 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/word_lattice.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+static const char kMagic[] = "WLAT";
+static const size_t kMagicSize = 4;
+
+void WordLattice::Clear() {
+  times_.clear();
+  finals_.clear();
+  offsets_.assign(1, 0);
+  arcs_.clear();
+}
+
+int WordLattice::AddState(int time) {
+  times_.push_back(time);
+  finals_.emplace_back();
+  offsets_.push_back(arcs_.size());
+  return times_.size() - 1;
+}
+
+void WordLattice::SetFinal(int state, float graph_cost,
+                           float acoustic_cost) {
+  finals_[state].graph_cost = graph_cost;
+  finals_[state].acoustic_cost = acoustic_cost;
+}
+
+void WordLattice::AddArc(int state, const Arc& arc) {
+  CHECK_EQ(state, num_states() - 1) << "the arcs follow their state";
+  CHECK_GT(arc.next, state) << "the states are topologically sorted";
+  arcs_.push_back(arc);
+  ++offsets_.back();
+}
+
+static void AppendVarint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    *out += static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  *out += static_cast<char>(value);
+}
+
+static void AppendFloat(float value, std::string* out) {
+  char bytes[sizeof(float)];
+  memcpy(bytes, &value, sizeof(float));
+  out->append(bytes, sizeof(float));
+}
+
+static uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ (value < 0 ? ~0ULL : 0);
+}
+
+void WordLattice::Serialize(std::string* out) const {
+  out->append(kMagic, kMagicSize);
+  AppendVarint(num_states(), out);
+  AppendVarint(num_arcs(), out);
+  int last_time = 0;
+  for (int s = 0; s < num_states(); ++s) {
+    AppendVarint(ZigZag(static_cast<int64_t>(times_[s]) - last_time), out);
+    last_time = times_[s];
+    uint64_t num_arcs = offsets_[s + 1] - offsets_[s];
+    AppendVarint(num_arcs << 1 | (IsFinal(s) ? 1 : 0), out);
+    if (IsFinal(s)) {
+      AppendFloat(finals_[s].graph_cost, out);
+      AppendFloat(finals_[s].acoustic_cost, out);
+    }
+    for (const Arc* arc = arcs_begin(s); arc != arcs_end(s); ++arc) {
+      AppendVarint(arc->word, out);
+      AppendVarint(arc->next - s, out);
+      AppendFloat(arc->graph_cost, out);
+      AppendFloat(arc->acoustic_cost, out);
+    }
+  }
+}
+
+// Reads the binary form, every read fails once the end is passed
+class LatticeReader {
+ public:
+  LatticeReader(const char* data, size_t size)
+      : data_(data), end_(data + size) {}
+
+  bool ok() const { return ok_; }
+  bool Skip(const char* bytes, size_t size) {
+    if (!ok_ || end_ - data_ < size || memcmp(data_, bytes, size) != 0) {
+      return ok_ = false;
+    }
+    data_ += size;
+    return true;
+  }
+  uint64_t Varint() {
+    uint64_t value = 0;
+    for (int shift = 0; ok_ && shift < 64; shift += 7) {
+      if (data_ == end_) break;
+      uint8_t byte = *data_++;
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if (byte < 0x80) return value;
+    }
+    ok_ = false;
+    return 0;
+  }
+  float Float() {
+    float value = 0.0;
+    if (!ok_ || end_ - data_ < sizeof(float)) {
+      ok_ = false;
+      return value;
+    }
+    memcpy(&value, data_, sizeof(float));
+    data_ += sizeof(float);
+    return value;
+  }
+  bool AtEnd() const { return ok_ && data_ == end_; }
+
+ private:
+  const char* data_;
+  const char* end_;
+  bool ok_ = true;
+};
+
+bool WordLattice::Deserialize(const char* data, size_t size) {
+  Clear();
+  LatticeReader reader(data, size);
+  if (!reader.Skip(kMagic, kMagicSize)) return false;
+  uint64_t num_states = reader.Varint();
+  uint64_t total_arcs = reader.Varint();
+  // Each state and arc takes at least a byte, which bounds the reserve
+  if (!reader.ok() || num_states + total_arcs > size) return false;
+  times_.reserve(num_states);
+  finals_.reserve(num_states);
+  offsets_.reserve(num_states + 1);
+  arcs_.reserve(total_arcs);
+  int64_t time = 0;
+  for (uint64_t s = 0; s < num_states && reader.ok(); ++s) {
+    uint64_t delta = reader.Varint();
+    time += static_cast<int64_t>(delta >> 1) ^ -static_cast<int64_t>(delta & 1);
+    AddState(time);
+    uint64_t flags = reader.Varint();
+    if (flags & 1) {
+      float graph_cost = reader.Float();
+      SetFinal(s, graph_cost, reader.Float());
+    }
+    for (uint64_t i = 0; i < (flags >> 1) && reader.ok(); ++i) {
+      Arc arc;
+      arc.word = reader.Varint();
+      uint64_t next = s + reader.Varint();
+      arc.graph_cost = reader.Float();
+      arc.acoustic_cost = reader.Float();
+      if (next <= s || next >= num_states || arcs_.size() == total_arcs) {
+        Clear();
+        return false;
+      }
+      arc.next = next;
+      arcs_.push_back(arc);
+      ++offsets_.back();
+    }
+  }
+  if (!reader.AtEnd() || arcs_.size() != total_arcs) {
+    Clear();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace wenet
@@ -0,0 +1,102 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_WORD_LATTICE_H_
+#define DECODER_WORD_LATTICE_H_
+
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace wenet {
+
+// The word lattice of a search, e.g. the determinized lattice of
+// CtcWfstBeamSearch, for the keyword search and the confidence estimation
+// downstream. The states are in a topological order and 0 is the start, the
+// arcs of a state are kept together as in CsrFst, and each state has the time
+// at which it's reached, so an arc spans the times of its two states. The
+// costs are the negated log likelihoods of the graph and the acoustic model.
+//
+// Serialize writes the compact binary form, with the integers as varints
+// (https://developers.google.com/protocol-buffers/docs/encoding) and the
+// costs as little endian floats
+//   "WLAT" num_states num_arcs
+//   state: zigzag(time - time of the last state) (num_arcs << 1 | final)
+//          [final graph_cost acoustic_cost]
+//   arc:   word (next - state) graph_cost acoustic_cost
+// where the arcs follow their state, which takes about 12 bytes per arc.
+class WordLattice {
+ public:
+  struct Arc {
+    int word = 0;  // 0 for epsilon
+    int next = 0;
+    float graph_cost = 0.0;
+    float acoustic_cost = 0.0;
+  };
+
+  void Clear();
+  // The states are added in the topological order, the first is the start
+  int AddState(int time);
+  void SetFinal(int state, float graph_cost, float acoustic_cost);
+  // The arcs go to the later states, and are added after their state before
+  // the next state is added
+  void AddArc(int state, const Arc& arc);
+
+  int num_states() const { return times_.size(); }
+  int num_arcs() const { return arcs_.size(); }
+  int time(int state) const { return times_[state]; }
+  void set_time(int state, int time) { times_[state] = time; }
+  bool IsFinal(int state) const {
+    return finals_[state].graph_cost !=
+           std::numeric_limits<float>::infinity();
+  }
+  float final_graph_cost(int state) const {
+    return finals_[state].graph_cost;
+  }
+  float final_acoustic_cost(int state) const {
+    return finals_[state].acoustic_cost;
+  }
+  // The arcs of `state` are [arcs_begin(state), arcs_end(state))
+  const Arc* arcs_begin(int state) const {
+    return arcs_.data() + offsets_[state];
+  }
+  const Arc* arcs_end(int state) const {
+    return arcs_.data() + offsets_[state + 1];
+  }
+
+  // Append the binary form to `out`
+  void Serialize(std::string* out) const;
+  // Return false if `data` is not a valid lattice
+  bool Deserialize(const char* data, size_t size);
+  bool Deserialize(const std::string& data) {
+    return Deserialize(data.data(), data.size());
+  }
+
+ private:
+  struct Final {
+    float graph_cost = std::numeric_limits<float>::infinity();
+    float acoustic_cost = 0.0;
+  };
+
+  std::vector<int> times_;
+  std::vector<Final> finals_;
+  // (S + 1,) the arcs of state s are [offsets_[s], offsets_[s + 1])
+  std::vector<int> offsets_ = {0};
+  std::vector<Arc> arcs_;
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_WORD_LATTICE_H_
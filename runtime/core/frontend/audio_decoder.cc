@@ -0,0 +1,86 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/audio_decoder.h"
+
+#ifdef USE_OPUS
+#include "opus.h"
+#endif
+
+#include "utils/log.h"
+
+namespace wenet {
+
+#ifdef USE_OPUS
+// Opus decodes at any of 8k, 12k, 16k, 24k and 48k sample rate, whatever
+// the sample rate of the encoder is.
+class OpusAudioDecoder : public AudioDecoder {
+ public:
+  explicit OpusAudioDecoder(int sample_rate) : sample_rate_(sample_rate) {
+    int error = OPUS_OK;
+    decoder_ = opus_decoder_create(sample_rate, 1, &error);
+    CHECK_EQ(error, OPUS_OK) << "Failed to create the opus decoder at "
+                             << sample_rate << "Hz: " << opus_strerror(error);
+  }
+  ~OpusAudioDecoder() override { opus_decoder_destroy(decoder_); }
+
+  bool Decode(const char* data, size_t size,
+              std::vector<int16_t>* pcm) override {
+    const unsigned char* packet = reinterpret_cast<const unsigned char*>(data);
+    int num_samples = opus_packet_get_nb_samples(packet, size, sample_rate_);
+    if (num_samples <= 0) {
+      LOG(WARNING) << "Invalid opus packet of " << size << " bytes";
+      return false;
+    }
+    size_t offset = pcm->size();
+    pcm->resize(offset + num_samples);
+    num_samples = opus_decode(decoder_, packet, size, pcm->data() + offset,
+                              num_samples, 0);
+    if (num_samples < 0) {
+      pcm->resize(offset);
+      LOG(WARNING) << "Failed to decode opus packet: "
+                   << opus_strerror(num_samples);
+      return false;
+    }
+    pcm->resize(offset + num_samples);
+    return true;
+  }
+
+ private:
+  int sample_rate_;
+  OpusDecoder* decoder_ = nullptr;
+};
+#endif
+
+bool IsSupportedAudioFormat(const std::string& format) {
+  if (format == "pcm") return true;
+#ifdef USE_OPUS
+  if (format == "opus") return true;
+#endif
+  return false;
+}
+
+std::unique_ptr<AudioDecoder> CreateAudioDecoder(const std::string& format,
+                                                 int sample_rate) {
+  CHECK(IsSupportedAudioFormat(format))
+      << "Unsupported audio format " << format;
+#ifdef USE_OPUS
+  if (format == "opus") {
+    return std::unique_ptr<AudioDecoder>(new OpusAudioDecoder(sample_rate));
+  }
+#endif
+  return nullptr;
+}
+
+}  // namespace wenet
@@ -0,0 +1,46 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_AUDIO_DECODER_H_
+#define FRONTEND_AUDIO_DECODER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace wenet {
+
+// AudioDecoder decodes the compressed audio of a stream into 16 bit mono
+// PCM for FeaturePipeline::AcceptWaveform. Each message of the stream, a
+// websocket binary frame or the audio_data of a gRPC request, is one packet.
+class AudioDecoder {
+ public:
+  virtual ~AudioDecoder() = default;
+  // Decode one packet and append the samples to `pcm`, return false if the
+  // packet is corrupted
+  virtual bool Decode(const char* data, size_t size,
+                      std::vector<int16_t>* pcm) = 0;
+};
+
+// The audio formats of the start signal, "pcm" is the raw 16 bit PCM which
+// is accepted as it is, so there is no decoder for it.
+bool IsSupportedAudioFormat(const std::string& format);
+// Return nullptr for "pcm"
+std::unique_ptr<AudioDecoder> CreateAudioDecoder(const std::string& format,
+                                                 int sample_rate);
+
+}  // namespace wenet
+
+#endif  // FRONTEND_AUDIO_DECODER_H_
@@ -0,0 +1,119 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "frontend/cmvn.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+GlobalCmvn::GlobalCmvn(const std::vector<double>& mean_stat,
+                       const std::vector<double>& var_stat,
+                       double frame_num) {
+  CHECK_EQ(mean_stat.size(), var_stat.size());
+  CHECK_GT(frame_num, 0);
+  int dim = mean_stat.size();
+  mean_.resize(dim);
+  istd_.resize(dim);
+  shift_.resize(dim);
+  for (int i = 0; i < dim; ++i) {
+    double mean = mean_stat[i] / frame_num;
+    double var = std::max(var_stat[i] / frame_num - mean * mean, 1.0e-20);
+    double istd = 1.0 / std::sqrt(var);
+    mean_[i] = mean;
+    istd_[i] = istd;
+    shift_[i] = -mean * istd;
+  }
+}
+
+void GlobalCmvn::Apply(float* frame) const {
+  for (int i = 0; i < dim(); ++i) frame[i] = Normalize(frame[i], i);
+}
+
+// The position after the ':' of the key, or npos
+static size_t FindValue(const std::string& json, const std::string& key) {
+  size_t pos = json.find("\"" + key + "\"");
+  if (pos == std::string::npos) return pos;
+  pos = json.find_first_not_of(" \t\r\n", pos + key.size() + 2);
+  if (pos == std::string::npos || json[pos] != ':') return std::string::npos;
+  return pos + 1;
+}
+
+static bool ParseNumber(const std::string& json, size_t* pos, double* value) {
+  const char* begin = json.c_str() + *pos;
+  char* end = nullptr;
+  *value = strtod(begin, &end);
+  if (end == begin) return false;
+  *pos += end - begin;
+  return true;
+}
+
+// The array of numbers of the key
+static bool ParseArray(const std::string& json, const std::string& key,
+                       std::vector<double>* values) {
+  size_t pos = FindValue(json, key);
+  if (pos == std::string::npos) return false;
+  pos = json.find_first_not_of(" \t\r\n", pos);
+  if (pos == std::string::npos || json[pos] != '[') return false;
+  ++pos;
+  values->clear();
+  while (true) {
+    pos = json.find_first_not_of(" \t\r\n", pos);
+    if (pos == std::string::npos) return false;
+    if (json[pos] == ']' && values->empty()) return true;
+    double value = 0;
+    if (!ParseNumber(json, &pos, &value)) return false;
+    values->push_back(value);
+    pos = json.find_first_not_of(" \t\r\n", pos);
+    if (pos == std::string::npos) return false;
+    if (json[pos] == ']') return true;
+    if (json[pos] != ',') return false;
+    ++pos;
+  }
+}
+
+std::shared_ptr<const GlobalCmvn> GlobalCmvn::Read(const std::string& path) {
+  std::ifstream is(path);
+  if (!is.good()) {
+    LOG(ERROR) << "Failed to open cmvn " << path;
+    return nullptr;
+  }
+  std::stringstream buffer;
+  buffer << is.rdbuf();
+  std::string json = buffer.str();
+  std::vector<double> mean_stat, var_stat;
+  double frame_num = 0;
+  size_t pos = FindValue(json, "frame_num");
+  if (!ParseArray(json, "mean_stat", &mean_stat) ||
+      !ParseArray(json, "var_stat", &var_stat) ||
+      pos == std::string::npos || !ParseNumber(json, &pos, &frame_num)) {
+    LOG(ERROR) << "Invalid cmvn json " << path;
+    return nullptr;
+  }
+  if (mean_stat.empty() || mean_stat.size() != var_stat.size() ||
+      frame_num <= 0) {
+    LOG(ERROR) << "Invalid cmvn stats of " << path;
+    return nullptr;
+  }
+  return std::make_shared<GlobalCmvn>(mean_stat, var_stat, frame_num);
+}
+
+}  // namespace wenet
@@ -0,0 +1,58 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef FRONTEND_CMVN_H_
+#define FRONTEND_CMVN_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace wenet {
+
+// The global cmvn of the training, i.e. x * istd - mean * istd per bin, of
+// the stats in the json of tools/compute_cmvn_stats.py:
+//   {"mean_stat": [...], "var_stat": [...], "frame_num": n}
+// It's fused with the log mel of the Fbank, so the model may be exported
+// without the cmvn layer. It's immutable, and shared by the sessions.
+class GlobalCmvn {
+ public:
+  // The sums of x and x^2 over frame_num frames, the variance is floored
+  // the same as the training
+  GlobalCmvn(const std::vector<double>& mean_stat,
+             const std::vector<double>& var_stat, double frame_num);
+
+  // Return nullptr if the file is not a valid cmvn json
+  static std::shared_ptr<const GlobalCmvn> Read(const std::string& path);
+
+  int dim() const { return static_cast<int>(istd_.size()); }
+  float Normalize(float x, int i) const { return x * istd_[i] + shift_[i]; }
+  float Denormalize(float y, int i) const { return y / istd_[i] + mean_[i]; }
+  // Normalize the frame of dim() in place
+  void Apply(float* frame) const;
+
+  const std::vector<float>& mean() const { return mean_; }
+  const std::vector<float>& istd() const { return istd_; }
+
+ private:
+  std::vector<float> mean_;
+  std::vector<float> istd_;
+  // -mean * istd
+  std::vector<float> shift_;
+};
+
+}  // namespace wenet
+
+#endif  // FRONTEND_CMVN_H_
@@ -15,31 +15,30 @@
 #ifndef FRONTEND_FBANK_H_
 #define FRONTEND_FBANK_H_
 
+#include <algorithm>
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <random>
 #include <utility>
 #include <vector>
 
+#include "frontend/cmvn.h"
+#include "frontend/fbank_kernels.h"
 #include "frontend/fft.h"
 #include "utils/log.h"
 
 namespace wenet {
 
-// This code is based on kaldi Fbank implementation, please see
-// https://github.com/kaldi-asr/kaldi/blob/master/src/feat/feature-fbank.cc
-class Fbank {
+// The tables of the fbank of a config, i.e. the mel filter bank, the povey
+// window and the fft tables. They are immutable once built, so one can be
+// shared by the Fbanks of all the sessions, e.g. by DecodeResource.
+class FbankTables {
  public:
-  Fbank(int num_bins, int sample_rate, int frame_length, int frame_shift)
+  FbankTables(int num_bins, int sample_rate, int frame_length)
       : num_bins_(num_bins),
         sample_rate_(sample_rate),
-        frame_length_(frame_length),
-        frame_shift_(frame_shift),
-        use_log_(true),
-        remove_dc_offset_(true),
-        generator_(0),
-        distribution_(0, 1.0),
-        dither_(0.0) {
+        frame_length_(frame_length) {
     fft_points_ = UpperPowerOfTwo(frame_length_);
     // generate bit reversal table and trigonometric function table
     const int fft_points_4 = fft_points_ / 4;
@@ -47,6 +46,9 @@ class Fbank {
     sintbl_.resize(fft_points_ + fft_points_4);
     make_sintbl(fft_points_, sintbl_.data());
     make_bitrev(fft_points_, bitrev_.data());
+    // bit reversal table of the half length transform in real fft
+    rfft_bitrev_.resize(fft_points_ / 2);
+    make_bitrev(fft_points_ / 2, rfft_bitrev_.data());
 
     int num_fft_bins = fft_points_ / 2;
     float fft_bin_width = static_cast<float>(sample_rate_) / fft_points_;
@@ -95,6 +97,77 @@ class Fbank {
     }
   }
 
+  bool Match(int num_bins, int sample_rate, int frame_length) const {
+    return num_bins_ == num_bins && sample_rate_ == sample_rate &&
+           frame_length_ == frame_length;
+  }
+
+  int num_bins() const { return num_bins_; }
+  int sample_rate() const { return sample_rate_; }
+  int frame_length() const { return frame_length_; }
+  int fft_points() const { return fft_points_; }
+  // The weights of bin i start at fft bin bins()[i].first
+  const std::vector<std::pair<int, std::vector<float>>>& bins() const {
+    return bins_;
+  }
+  const std::vector<float>& center_freqs() const { return center_freqs_; }
+  const std::vector<float>& povey_window() const { return povey_window_; }
+  const std::vector<int>& bitrev() const { return bitrev_; }
+  const std::vector<int>& rfft_bitrev() const { return rfft_bitrev_; }
+  const std::vector<float>& sintbl() const { return sintbl_; }
+
+  static inline float InverseMelScale(float mel_freq) {
+    return 700.0f * (expf(mel_freq / 1127.0f) - 1.0f);
+  }
+
+  static inline float MelScale(float freq) {
+    return 1127.0f * logf(1.0f + freq / 700.0f);
+  }
+
+  static int UpperPowerOfTwo(int n) {
+    return static_cast<int>(pow(2, ceil(log(n) / log(2))));
+  }
+
+ private:
+  int num_bins_;
+  int sample_rate_;
+  int frame_length_;
+  int fft_points_;
+  std::vector<float> center_freqs_;
+  std::vector<std::pair<int, std::vector<float>>> bins_;
+  std::vector<float> povey_window_;
+  // bit reversal table
+  std::vector<int> bitrev_;
+  std::vector<int> rfft_bitrev_;
+  // trigonometric function table
+  std::vector<float> sintbl_;
+};
+
+// This code is based on kaldi Fbank implementation, please see
+// https://github.com/kaldi-asr/kaldi/blob/master/src/feat/feature-fbank.cc
+// The Fbank only keeps the options and the dither noise of a session, the
+// tables are of the FbankTables, which may be shared.
+class Fbank {
+ public:
+  Fbank(int num_bins, int sample_rate, int frame_length, int frame_shift)
+      : Fbank(std::make_shared<FbankTables>(num_bins, sample_rate,
+                                            frame_length),
+              frame_shift) {}
+
+  Fbank(std::shared_ptr<const FbankTables> tables, int frame_shift)
+      : tables_(std::move(tables)),
+        num_bins_(tables_->num_bins()),
+        frame_length_(tables_->frame_length()),
+        frame_shift_(frame_shift),
+        fft_points_(tables_->fft_points()),
+        use_log_(true),
+        remove_dc_offset_(true),
+        use_real_fft_(true),
+        generator_(0),
+        distribution_(0, 1.0),
+        dither_(0.0),
+        kernels_(&GetFbankKernels()) {}
+
   void set_use_log(bool use_log) { use_log_ = use_log; }
 
   void set_remove_dc_offset(bool remove_dc_offset) {
@@ -103,34 +176,41 @@ class Fbank {
 
   void set_dither(float dither) { dither_ = dither; }
 
+  // Use the real input fft, which costs about half of the complex one
+  void set_use_real_fft(bool use_real_fft) { use_real_fft_ = use_real_fft; }
+
+  // Normalize the features by the global cmvn in the same pass as the log,
+  // nullptr for none
+  void set_cmvn(std::shared_ptr<const GlobalCmvn> cmvn) {
+    CHECK(cmvn == nullptr || cmvn->dim() == num_bins_);
+    cmvn_ = std::move(cmvn);
+  }
+  const std::shared_ptr<const GlobalCmvn>& cmvn() const { return cmvn_; }
+
   int num_bins() const { return num_bins_; }
+  const std::shared_ptr<const FbankTables>& tables() const { return tables_; }
 
   static inline float InverseMelScale(float mel_freq) {
-    return 700.0f * (expf(mel_freq / 1127.0f) - 1.0f);
+    return FbankTables::InverseMelScale(mel_freq);
   }
 
   static inline float MelScale(float freq) {
-    return 1127.0f * logf(1.0f + freq / 700.0f);
+    return FbankTables::MelScale(freq);
   }
 
-  static int UpperPowerOfTwo(int n) {
-    return static_cast<int>(pow(2, ceil(log(n) / log(2))));
-  }
+  static int UpperPowerOfTwo(int n) { return FbankTables::UpperPowerOfTwo(n); }
 
   // pre emphasis
   void PreEmphasis(float coeff, std::vector<float>* data) const {
     if (coeff == 0.0) return;
-    for (int i = data->size() - 1; i > 0; i--)
-      (*data)[i] -= coeff * (*data)[i - 1];
-    (*data)[0] -= coeff * (*data)[0];
+    kernels_->pre_emphasis(coeff, data->data(), data->size());
   }
 
   // Apply povey window on data in place
   void Povey(std::vector<float>* data) const {
-    CHECK_GE(data->size(), povey_window_.size());
-    for (size_t i = 0; i < povey_window_.size(); ++i) {
-      (*data)[i] *= povey_window_[i];
-    }
+    const std::vector<float>& window = tables_->povey_window();
+    CHECK_GE(data->size(), window.size());
+    kernels_->mul(window.data(), data->data(), window.size());
   }
 
   // Compute fbank feat, return num frames
@@ -140,77 +220,141 @@ class Fbank {
     if (num_samples < frame_length_) return 0;
     int num_frames = 1 + ((num_samples - frame_length_) / frame_shift_);
     feat->resize(num_frames);
+    // Scratch buffers are allocated once per call rather than per frame, and
+    // are not members since Compute may be called from several threads.
     std::vector<float> fft_real(fft_points_, 0), fft_img(fft_points_, 0);
     std::vector<float> power(fft_points_ / 2);
+    const auto& bins = tables_->bins();
     for (int i = 0; i < num_frames; ++i) {
-      std::vector<float> data(wave.data() + i * frame_shift_,
-                              wave.data() + i * frame_shift_ + frame_length_);
-      // optional add noise
-      if (dither_ != 0.0) {
-        for (size_t j = 0; j < data.size(); ++j)
-          data[j] += dither_ * distribution_(generator_);
-      }
-      // optinal remove dc offset
-      if (remove_dc_offset_) {
-        float mean = 0.0;
-        for (size_t j = 0; j < data.size(); ++j) mean += data[j];
-        mean /= data.size();
-        for (size_t j = 0; j < data.size(); ++j) data[j] -= mean;
+      ComputePowerSpectrum(wave.data() + i * frame_shift_, fft_real.data(),
+                           fft_img.data(), power.data());
+      (*feat)[i].resize(num_bins_);
+      // cepstral coefficients, triangle filter array
+      for (int j = 0; j < num_bins_; ++j) {
+        float mel_energy = kernels_->dot(bins[j].second.data(),
+                                         power.data() + bins[j].first,
+                                         bins[j].second.size());
+        (*feat)[i][j] = MelEnergyToFeature(mel_energy, j);
       }
+    }
+    return num_frames;
+  }
 
-      PreEmphasis(0.97, &data);
-      Povey(&data);
-      // copy data to fft_real
-      memset(fft_img.data(), 0, sizeof(float) * fft_points_);
-      memset(fft_real.data() + frame_length_, 0,
-             sizeof(float) * (fft_points_ - frame_length_));
-      memcpy(fft_real.data(), data.data(), sizeof(float) * frame_length_);
-      fft(bitrev_.data(), sintbl_.data(), fft_real.data(), fft_img.data(),
-          fft_points_);
-      // power
-      for (int j = 0; j < fft_points_ / 2; ++j) {
-        power[j] = fft_real[j] * fft_real[j] + fft_img[j] * fft_img[j];
+  // Same as Compute, but the mel filter bank is applied on kMelBlockFrames
+  // frames at a time. The power spectra of the block are stored transposed,
+  // so the banded mel matrix multiply runs along frames with contiguous
+  // memory and the filter weights are loaded once per block instead of once
+  // per frame. Prefer it when the wave is long, eg. whole utterances.
+  int ComputeBatch(const std::vector<float>& wave,
+                   std::vector<std::vector<float>>* feat) {
+    int num_samples = wave.size();
+    if (num_samples < frame_length_) return 0;
+    int num_frames = 1 + ((num_samples - frame_length_) / frame_shift_);
+    if (num_frames < kMelBlockFrames) return Compute(wave, feat);
+    feat->resize(num_frames);
+    const int num_fft_bins = fft_points_ / 2;
+    std::vector<float> fft_real(fft_points_, 0), fft_img(fft_points_, 0);
+    std::vector<float> power(num_fft_bins);
+    // [num_fft_bins, kMelBlockFrames] and [num_bins_, kMelBlockFrames]
+    std::vector<float> block_power(num_fft_bins * kMelBlockFrames);
+    std::vector<float> block_mel(num_bins_ * kMelBlockFrames);
+    const auto& bins = tables_->bins();
+    for (int t = 0; t < num_frames; t += kMelBlockFrames) {
+      int block_size =
+          std::min(static_cast<int>(kMelBlockFrames), num_frames - t);
+      for (int b = 0; b < block_size; ++b) {
+        ComputePowerSpectrum(wave.data() + (t + b) * frame_shift_,
+                             fft_real.data(), fft_img.data(), power.data());
+        for (int k = 0; k < num_fft_bins; ++k) {
+          block_power[k * kMelBlockFrames + b] = power[k];
+        }
       }
-
-      (*feat)[i].resize(num_bins_);
-      // cepstral coefficients, triangle filter array
+      // banded GEMM, block_mel = bins * block_power
+      std::fill(block_mel.begin(), block_mel.end(), 0.0f);
       for (int j = 0; j < num_bins_; ++j) {
-        float mel_energy = 0.0;
-        int s = bins_[j].first;
-        for (size_t k = 0; k < bins_[j].second.size(); ++k) {
-          mel_energy += bins_[j].second[k] * power[s + k];
+        float* mel = block_mel.data() + j * kMelBlockFrames;
+        const float* p = block_power.data() + bins[j].first * kMelBlockFrames;
+        const std::vector<float>& weights = bins[j].second;
+        for (size_t k = 0; k < weights.size(); ++k) {
+          kernels_->axpy(weights[k], p + k * kMelBlockFrames, mel,
+                         block_size);
         }
-        // optional use log
-        if (use_log_) {
-          if (mel_energy < std::numeric_limits<float>::epsilon())
-            mel_energy = std::numeric_limits<float>::epsilon();
-          mel_energy = logf(mel_energy);
+      }
+      for (int b = 0; b < block_size; ++b) {
+        std::vector<float>& frame = (*feat)[t + b];
+        frame.resize(num_bins_);
+        for (int j = 0; j < num_bins_; ++j) {
+          frame[j] =
+              MelEnergyToFeature(block_mel[j * kMelBlockFrames + b], j);
         }
-
-        (*feat)[i][j] = mel_energy;
       }
     }
     return num_frames;
   }
 
+  // Number of frames of a block in ComputeBatch
+  static constexpr int kMelBlockFrames = 32;
+
  private:
+  // Compute the power spectrum of the frame starting at wave, fft_real and
+  // fft_img are fft_points_ long scratch buffers
+  void ComputePowerSpectrum(const float* wave, float* fft_real,
+                            float* fft_img, float* power) {
+    float* data = fft_real;
+    memcpy(data, wave, sizeof(float) * frame_length_);
+    // optional add noise
+    if (dither_ != 0.0) {
+      for (int j = 0; j < frame_length_; ++j)
+        data[j] += dither_ * distribution_(generator_);
+    }
+    // optinal remove dc offset
+    if (remove_dc_offset_) {
+      float mean = kernels_->sum(data, frame_length_) / frame_length_;
+      kernels_->add_scalar(-mean, data, frame_length_);
+    }
+
+    kernels_->pre_emphasis(0.97, data, frame_length_);
+    kernels_->mul(tables_->povey_window().data(), data, frame_length_);
+    // zero padding to fft_points_
+    memset(fft_real + frame_length_, 0,
+           sizeof(float) * (fft_points_ - frame_length_));
+    if (use_real_fft_) {
+      rfft(tables_->rfft_bitrev().data(), tables_->sintbl().data(), fft_real,
+           fft_img, fft_points_);
+    } else {
+      memset(fft_img, 0, sizeof(float) * fft_points_);
+      fft(tables_->bitrev().data(), tables_->sintbl().data(), fft_real,
+          fft_img, fft_points_);
+    }
+    kernels_->power_spectrum(fft_real, fft_img, power, fft_points_ / 2);
+  }
+
+  // The feature of bin j
+  float MelEnergyToFeature(float mel_energy, int j) const {
+    // optional use log
+    if (use_log_) {
+      if (mel_energy < std::numeric_limits<float>::epsilon())
+        mel_energy = std::numeric_limits<float>::epsilon();
+      mel_energy = logf(mel_energy);
+    }
+    // optional global cmvn
+    if (cmvn_ != nullptr) mel_energy = cmvn_->Normalize(mel_energy, j);
+    return mel_energy;
+  }
+
+  std::shared_ptr<const FbankTables> tables_;
   int num_bins_;
-  int sample_rate_;
   int frame_length_, frame_shift_;
   int fft_points_;
   bool use_log_;
   bool remove_dc_offset_;
-  std::vector<float> center_freqs_;
-  std::vector<std::pair<int, std::vector<float>>> bins_;
-  std::vector<float> povey_window_;
+  bool use_real_fft_;
   std::default_random_engine generator_;
   std::normal_distribution<float> distribution_;
   float dither_;
-
-  // bit reversal table
-  std::vector<int> bitrev_;
-  // trigonometric function table
-  std::vector<float> sintbl_;
+  std::shared_ptr<const GlobalCmvn> cmvn_;
+  // SIMD kernels selected for the running CPU
+  const FbankKernels* kernels_;
 };
 
 }  // namespace wenet
@@ -2,59 +2,241 @@
 #ifndef FRONTEND_FBANK_CUDA_H_
 #define FRONTEND_FBANK_CUDA_H_
 
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#ifdef USE_GPU
+#include "ATen/cuda/CUDAEvent.h"
+#include "c10/cuda/CUDACachingAllocator.h"
+#include "c10/cuda/CUDAGuard.h"
+#include "c10/cuda/CUDAStream.h"
+#endif
 #include "kaldifeat/csrc/feature-fbank.h"
 
 namespace wenet {
 
 class FbankCuda  {
  public:
-  FbankCuda(int num_bins, int sample_rate) {
+  FbankCuda(int num_bins, int sample_rate, float frame_shift_ms = 10.0,
+            float frame_length_ms = 25.0, int device_id = 0)
+      : device_(torch::kCUDA, device_id) {
     fbank_opts_.mel_opts.num_bins = num_bins;
     fbank_opts_.frame_opts.samp_freq = sample_rate;
     fbank_opts_.frame_opts.dither = 0;
-    fbank_opts_.frame_opts.frame_shift_ms = 10.0;
-    fbank_opts_.frame_opts.frame_length_ms = 25.0;
-    fbank_opts_.device = torch::Device(torch::kCUDA, 0);
+    fbank_opts_.frame_opts.frame_shift_ms = frame_shift_ms;
+    fbank_opts_.frame_opts.frame_length_ms = frame_length_ms;
+    fbank_opts_.device = device_;
     fbank_ = std::make_shared<kaldifeat::Fbank>(fbank_opts_);
-    device_ = torch::kCUDA;
+  }
+
+  const torch::Device& device() const { return device_; }
+  int num_bins() const { return fbank_opts_.mel_opts.num_bins; }
+  const kaldifeat::FrameExtractionOptions& frame_opts() const {
+    return fbank_opts_.frame_opts;
+  }
+  // The number of frames of `num_samples` samples, with snip edges
+  int NumFrames(int num_samples) const {
+    return kaldifeat::NumFrames(num_samples, fbank_opts_.frame_opts);
   }
 
   torch::Tensor Compute(torch::Tensor wave_data) {
     return fbank_->ComputeFeatures(wave_data, 1.0f);
   }
 
+  // The fbank of a batch of wavs. The batch is packed and uploaded by one
+  // copy, and the frames of all the wavs are gathered by one index on the
+  // device, rather than a copy and a strided view per wav.
   std::vector<torch::Tensor> Compute(
       const std::vector<std::vector<float>> &wave_data,
       std::vector<int> *num_frames) {
-    const auto &frame_opts = fbank_->GetOptions().frame_opts;
+    const auto &frame_opts = fbank_opts_.frame_opts;
+    const int64_t window_size = frame_opts.WindowSize();
+    const int64_t window_shift = frame_opts.WindowShift();
     std::vector<int64_t> num_frames_vec;
     num_frames_vec.reserve(wave_data.size());
+    int64_t total_frames = 0;
+    for (const auto &w : wave_data) {
+      int n = NumFrames(w.size());
+      num_frames_vec.push_back(n);
+      num_frames->push_back(n);
+      total_frames += n;
+    }
+    if (total_frames == 0) {
+      return torch::empty({0, num_bins()}, device_)
+          .split_with_sizes(num_frames_vec, 0);
+    }
 
-    std::vector<torch::Tensor> strided_vec;
-    strided_vec.reserve(wave_data.size());
+    // The start of each frame in the packed wavs
+    torch::Tensor starts = torch::empty(
+        {total_frames},
+        torch::TensorOptions().dtype(torch::kLong).pinned_memory(kPinned));
+    int64_t* start = starts.data_ptr<int64_t>();
+    int64_t offset = 0;
+    for (size_t i = 0; i < wave_data.size(); ++i) {
+      for (int64_t f = 0; f < num_frames_vec[i]; ++f) {
+        *start++ = offset + f * window_shift;
+      }
+      offset += wave_data[i].size();
+    }
+    torch::Tensor packed = Upload(wave_data);
+    torch::Tensor index =
+        starts.to(device_, /*non_blocking*/ kPinned).unsqueeze(1) +
+        torch::arange(window_size,
+                      torch::TensorOptions().dtype(torch::kLong).device(
+                          device_));
+    torch::Tensor strided =
+        packed.index_select(0, index.view({-1}))
+            .view({total_frames, window_size});
+    torch::Tensor features =
+        fbank_->ComputeFeatures(strided, /*vtln_warp*/ 1.0f);
+    return features.split_with_sizes(num_frames_vec, /*dim*/ 0);
+  }
 
-    for (const auto &w : wave_data) {
-      torch::Tensor t = torch::from_blob(
-          const_cast<float*>(w.data()),
-          {static_cast<int>(w.size())}, torch::kFloat).to(device_);
-      // t = t / 32768.0;
-      torch::Tensor strided = kaldifeat::GetStrided(t, frame_opts);
-      num_frames_vec.push_back(strided.size(0));
-      num_frames->push_back(strided.size(0));
-      strided_vec.emplace_back(std::move(strided));
-    }
-
-    torch::Tensor strided = torch::cat(strided_vec, 0);
-    torch::Tensor features = fbank_->ComputeFeatures(strided, /*vtln_warp*/ 1.0f);
-    auto ans = features.split_with_sizes(num_frames_vec, /*dim*/ 0);
-    return ans;
+  // The wavs packed in a [total] tensor on the device. With USE_GPU they are
+  // copied to a pinned buffer, which is reused across the calls, and
+  // uploaded asynchronously on a dedicated stream, which the current stream
+  // waits for.
+  torch::Tensor Upload(const std::vector<std::vector<float>> &wavs) {
+    int64_t total = 0;
+    for (const auto &w : wavs) total += w.size();
+#ifdef USE_GPU
+    c10::cuda::CUDAGuard device_guard(device_);
+    // The last upload from the buffer must be done before it's overwritten
+    if (upload_event_.isCreated()) upload_event_.synchronize();
+    if (!pinned_.defined() || pinned_.numel() < total) {
+      int64_t capacity =
+          std::max(total, pinned_.defined() ? pinned_.numel() * 2 : 0);
+      pinned_ = torch::empty(
+          {capacity},
+          torch::TensorOptions().dtype(torch::kFloat).pinned_memory(true));
+    }
+    float* dst = pinned_.data_ptr<float>();
+    for (const auto &w : wavs) {
+      std::copy(w.begin(), w.end(), dst);
+      dst += w.size();
+    }
+    if (!upload_stream_.has_value()) {
+      upload_stream_ = c10::cuda::getStreamFromPool(false, device_.index());
+    }
+    torch::Tensor packed;
+    {
+      c10::cuda::CUDAStreamGuard stream_guard(*upload_stream_);
+      packed = pinned_.slice(0, 0, total).to(device_, /*non_blocking*/ true);
+      upload_event_.record(*upload_stream_);
+    }
+    c10::cuda::CUDAStream current =
+        c10::cuda::getCurrentCUDAStream(device_.index());
+    upload_event_.block(current);
+    // It's allocated on the upload stream but used on the current one
+    c10::cuda::CUDACachingAllocator::recordStream(packed.storage().data_ptr(),
+                                                  current);
+    return packed;
+#else
+    torch::Tensor packed = torch::empty({total}, torch::kFloat);
+    float* dst = packed.data_ptr<float>();
+    for (const auto &w : wavs) {
+      std::copy(w.begin(), w.end(), dst);
+      dst += w.size();
+    }
+    return packed.to(device_);
+#endif
   }
 
  private:
+#ifdef USE_GPU
+  static constexpr bool kPinned = true;
+#else
+  static constexpr bool kPinned = false;
+#endif
   kaldifeat::FbankOptions fbank_opts_;
   std::shared_ptr<kaldifeat::Fbank> fbank_;
-  torch::DeviceType device_;
+  torch::Device device_;
+#ifdef USE_GPU
+  torch::Tensor pinned_;
+  at::cuda::CUDAEvent upload_event_;
+  c10::optional<c10::cuda::CUDAStream> upload_stream_;
+#endif
+};
+
+// The fbank of the incremental wavs of many streaming sessions, computed in
+// one call on the device. Like FeaturePipeline on CPU, the samples after the
+// frames of a session are kept on the device for its next wav, so the
+// features of a session are the same as the ones of its whole wav. The
+// features stay on the device, see TorchAsrModel::ForwardDeviceFeatureBatch.
+class StreamingFbankCuda {
+ public:
+  // The state of a session
+  struct Session {
+    torch::Tensor remained_wav;
+    int num_frames = 0;
+    void Reset() {
+      remained_wav = torch::Tensor();
+      num_frames = 0;
+    }
+  };
+
+  StreamingFbankCuda(int num_bins, int sample_rate,
+                     float frame_shift_ms = 10.0,
+                     float frame_length_ms = 25.0, int device_id = 0)
+      : fbank_(num_bins, sample_rate, frame_shift_ms, frame_length_ms,
+               device_id),
+        frame_shift_(sample_rate * frame_shift_ms / 1000) {}
+
+  const torch::Device& device() const { return fbank_.device(); }
+
+  // The [num_frames, num_bins] features of the new wav of each session, it's
+  // empty if the remained samples are still less than a frame. The wavs are
+  // uploaded by one copy.
+  std::vector<torch::Tensor> Compute(
+      const std::vector<Session*>& sessions,
+      const std::vector<std::vector<float>>& wavs) {
+    const int batch_size = sessions.size();
+    std::vector<int64_t> sizes(batch_size);
+    for (int i = 0; i < batch_size; ++i) sizes[i] = wavs[i].size();
+    std::vector<torch::Tensor> uploaded =
+        fbank_.Upload(wavs).split_with_sizes(sizes, 0);
 
+    std::vector<int64_t> num_frames(batch_size, 0);
+    std::vector<torch::Tensor> strided;
+    for (int i = 0; i < batch_size; ++i) {
+      Session* session = sessions[i];
+      torch::Tensor wav = uploaded[i];
+      if (session->remained_wav.defined()) {
+        wav = torch::cat({session->remained_wav, wav}, 0);
+      }
+      num_frames[i] = fbank_.NumFrames(wav.size(0));
+      if (num_frames[i] > 0) {
+        strided.push_back(kaldifeat::GetStrided(wav, fbank_.frame_opts()));
+      }
+      session->remained_wav = wav.slice(0, num_frames[i] * frame_shift_);
+      session->num_frames += num_frames[i];
+    }
+
+    std::vector<torch::Tensor> feats(batch_size);
+    std::vector<torch::Tensor> computed;
+    if (!strided.empty()) {
+      torch::Tensor features = fbank_.Compute(torch::cat(strided, 0));
+      std::vector<int64_t> split_sizes;
+      for (int64_t n : num_frames) {
+        if (n > 0) split_sizes.push_back(n);
+      }
+      computed = features.split_with_sizes(split_sizes, 0);
+    }
+    for (int i = 0, j = 0; i < batch_size; ++i) {
+      if (num_frames[i] > 0) {
+        feats[i] = computed[j++];
+      } else {
+        feats[i] = torch::empty({0, fbank_.num_bins()}, device());
+      }
+    }
+    return feats;
+  }
+
+ private:
+  FbankCuda fbank_;
+  int frame_shift_;
 };
 
 }  // namespace wenet
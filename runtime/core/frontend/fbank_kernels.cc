@@ -0,0 +1,369 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/fbank_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WENET_FBANK_X86 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WENET_FBANK_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace wenet {
+
+namespace {
+
+// Scalar
+float SumScalar(const float* x, int n) {
+  float sum = 0.0f;
+  for (int i = 0; i < n; ++i) sum += x[i];
+  return sum;
+}
+
+void AddScalarScalar(float a, float* x, int n) {
+  for (int i = 0; i < n; ++i) x[i] += a;
+}
+
+void PreEmphasisScalar(float coeff, float* x, int n) {
+  if (n <= 0) return;
+  for (int i = n - 1; i > 0; --i) x[i] -= coeff * x[i - 1];
+  x[0] -= coeff * x[0];
+}
+
+void MulScalar(const float* w, float* x, int n) {
+  for (int i = 0; i < n; ++i) x[i] *= w[i];
+}
+
+void PowerSpectrumScalar(const float* re, const float* im, float* power,
+                         int n) {
+  for (int i = 0; i < n; ++i) power[i] = re[i] * re[i] + im[i] * im[i];
+}
+
+float DotScalar(const float* a, const float* b, int n) {
+  float sum = 0.0f;
+  for (int i = 0; i < n; ++i) sum += a[i] * b[i];
+  return sum;
+}
+
+void AxpyScalar(float a, const float* x, float* y, int n) {
+  for (int i = 0; i < n; ++i) y[i] += a * x[i];
+}
+
+void Int16ToFloatScalar(const int16_t* x, float* y, int n) {
+  for (int i = 0; i < n; ++i) y[i] = x[i];
+}
+
+#ifdef WENET_FBANK_X86
+// AVX2 + FMA
+__attribute__((target("avx2,fma"))) inline float HorizontalSum(__m256 v) {
+  __m128 lo = _mm256_castps256_ps128(v);
+  __m128 hi = _mm256_extractf128_ps(v, 1);
+  lo = _mm_add_ps(lo, hi);
+  lo = _mm_hadd_ps(lo, lo);
+  lo = _mm_hadd_ps(lo, lo);
+  return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2,fma"))) float SumAvx2(const float* x, int n) {
+  __m256 acc = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) acc = _mm256_add_ps(acc, _mm256_loadu_ps(x + i));
+  float sum = HorizontalSum(acc);
+  for (; i < n; ++i) sum += x[i];
+  return sum;
+}
+
+__attribute__((target("avx2,fma"))) void AddScalarAvx2(float a, float* x,
+                                                       int n) {
+  __m256 va = _mm256_set1_ps(a);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), va));
+  }
+  for (; i < n; ++i) x[i] += a;
+}
+
+__attribute__((target("avx2,fma"))) void PreEmphasisAvx2(float coeff,
+                                                         float* x, int n) {
+  if (n <= 0) return;
+  // Go backward, so x[i - 1] is still the original value when x[i] is
+  // updated
+  __m256 vc = _mm256_set1_ps(coeff);
+  int i = n - 8;
+  for (; i >= 1; i -= 8) {
+    __m256 cur = _mm256_loadu_ps(x + i);
+    __m256 prev = _mm256_loadu_ps(x + i - 1);
+    _mm256_storeu_ps(x + i, _mm256_fnmadd_ps(vc, prev, cur));
+  }
+  for (i += 7; i > 0; --i) x[i] -= coeff * x[i - 1];
+  x[0] -= coeff * x[0];
+}
+
+__attribute__((target("avx2,fma"))) void MulAvx2(const float* w, float* x,
+                                                 int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i),
+                                          _mm256_loadu_ps(w + i)));
+  }
+  for (; i < n; ++i) x[i] *= w[i];
+}
+
+__attribute__((target("avx2,fma"))) void PowerSpectrumAvx2(const float* re,
+                                                           const float* im,
+                                                           float* power,
+                                                           int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 r = _mm256_loadu_ps(re + i);
+    __m256 m = _mm256_loadu_ps(im + i);
+    _mm256_storeu_ps(power + i, _mm256_fmadd_ps(r, r, _mm256_mul_ps(m, m)));
+  }
+  for (; i < n; ++i) power[i] = re[i] * re[i] + im[i] * im[i];
+}
+
+__attribute__((target("avx2,fma"))) float DotAvx2(const float* a,
+                                                  const float* b, int n) {
+  __m256 acc = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+  }
+  float sum = HorizontalSum(acc);
+  for (; i < n; ++i) sum += a[i] * b[i];
+  return sum;
+}
+
+__attribute__((target("avx2,fma"))) void AxpyAvx2(float a, const float* x,
+                                                  float* y, int n) {
+  __m256 va = _mm256_set1_ps(a);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i),
+                                            _mm256_loadu_ps(y + i)));
+  }
+  for (; i < n; ++i) y[i] += a * x[i];
+}
+
+__attribute__((target("avx2,fma"))) void Int16ToFloatAvx2(const int16_t* x,
+                                                          float* y, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    _mm256_storeu_ps(y + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)));
+  }
+  for (; i < n; ++i) y[i] = x[i];
+}
+
+// AVX-512, only the long loops(window, power spectrum, dc offset) benefit
+// from the wider vectors, the short mel filters use the AVX2 dot.
+__attribute__((target("avx512f"))) float SumAvx512(const float* x, int n) {
+  __m512 acc = _mm512_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc = _mm512_add_ps(acc, _mm512_loadu_ps(x + i));
+  }
+  float lanes[16];
+  _mm512_storeu_ps(lanes, acc);
+  float sum = 0.0f;
+  for (int j = 0; j < 16; ++j) sum += lanes[j];
+  for (; i < n; ++i) sum += x[i];
+  return sum;
+}
+
+__attribute__((target("avx512f"))) void AddScalarAvx512(float a, float* x,
+                                                        int n) {
+  __m512 va = _mm512_set1_ps(a);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(x + i, _mm512_add_ps(_mm512_loadu_ps(x + i), va));
+  }
+  for (; i < n; ++i) x[i] += a;
+}
+
+__attribute__((target("avx512f"))) void MulAvx512(const float* w, float* x,
+                                                  int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(x + i, _mm512_mul_ps(_mm512_loadu_ps(x + i),
+                                          _mm512_loadu_ps(w + i)));
+  }
+  for (; i < n; ++i) x[i] *= w[i];
+}
+
+__attribute__((target("avx512f"))) void PowerSpectrumAvx512(const float* re,
+                                                            const float* im,
+                                                            float* power,
+                                                            int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 r = _mm512_loadu_ps(re + i);
+    __m512 m = _mm512_loadu_ps(im + i);
+    _mm512_storeu_ps(power + i, _mm512_fmadd_ps(r, r, _mm512_mul_ps(m, m)));
+  }
+  for (; i < n; ++i) power[i] = re[i] * re[i] + im[i] * im[i];
+}
+
+__attribute__((target("avx512f"))) void AxpyAvx512(float a, const float* x,
+                                                   float* y, int n) {
+  __m512 va = _mm512_set1_ps(a);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i),
+                                            _mm512_loadu_ps(y + i)));
+  }
+  for (; i < n; ++i) y[i] += a * x[i];
+}
+
+__attribute__((target("avx512f"))) void Int16ToFloatAvx512(const int16_t* x,
+                                                           float* y, int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+    _mm512_storeu_ps(y + i, _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(v)));
+  }
+  for (; i < n; ++i) y[i] = x[i];
+}
+#endif  // WENET_FBANK_X86
+
+#ifdef WENET_FBANK_NEON
+inline float HorizontalSum(float32x4_t v) {
+#if defined(__aarch64__)
+  return vaddvq_f32(v);
+#else
+  float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+  return vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+}
+
+float SumNeon(const float* x, int n) {
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) acc = vaddq_f32(acc, vld1q_f32(x + i));
+  float sum = HorizontalSum(acc);
+  for (; i < n; ++i) sum += x[i];
+  return sum;
+}
+
+void AddScalarNeon(float a, float* x, int n) {
+  float32x4_t va = vdupq_n_f32(a);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) vst1q_f32(x + i, vaddq_f32(vld1q_f32(x + i), va));
+  for (; i < n; ++i) x[i] += a;
+}
+
+void PreEmphasisNeon(float coeff, float* x, int n) {
+  if (n <= 0) return;
+  float32x4_t vc = vdupq_n_f32(coeff);
+  int i = n - 4;
+  for (; i >= 1; i -= 4) {
+    float32x4_t cur = vld1q_f32(x + i);
+    float32x4_t prev = vld1q_f32(x + i - 1);
+    vst1q_f32(x + i, vmlsq_f32(cur, vc, prev));
+  }
+  for (i += 3; i > 0; --i) x[i] -= coeff * x[i - 1];
+  x[0] -= coeff * x[0];
+}
+
+void MulNeon(const float* w, float* x, int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), vld1q_f32(w + i)));
+  }
+  for (; i < n; ++i) x[i] *= w[i];
+}
+
+void PowerSpectrumNeon(const float* re, const float* im, float* power,
+                       int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t r = vld1q_f32(re + i);
+    float32x4_t m = vld1q_f32(im + i);
+    vst1q_f32(power + i, vmlaq_f32(vmulq_f32(m, m), r, r));
+  }
+  for (; i < n; ++i) power[i] = re[i] * re[i] + im[i] * im[i];
+}
+
+float DotNeon(const float* a, const float* b, int n) {
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+  }
+  float sum = HorizontalSum(acc);
+  for (; i < n; ++i) sum += a[i] * b[i];
+  return sum;
+}
+
+void AxpyNeon(float a, const float* x, float* y, int n) {
+  float32x4_t va = vdupq_n_f32(a);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(y + i, vmlaq_f32(vld1q_f32(y + i), va, vld1q_f32(x + i)));
+  }
+  for (; i < n; ++i) y[i] += a * x[i];
+}
+
+void Int16ToFloatNeon(const int16_t* x, float* y, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16(x + i);
+    vst1q_f32(y + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))));
+    vst1q_f32(y + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))));
+  }
+  for (; i < n; ++i) y[i] = x[i];
+}
+#endif  // WENET_FBANK_NEON
+
+FbankKernels SelectFbankKernels() {
+#ifdef WENET_FBANK_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return {"avx512",        SumAvx512,         AddScalarAvx512,
+            PreEmphasisAvx2, MulAvx512,         PowerSpectrumAvx512,
+            DotAvx2,         AxpyAvx512,        Int16ToFloatAvx512};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {"avx2",          SumAvx2,           AddScalarAvx2,
+            PreEmphasisAvx2, MulAvx2,           PowerSpectrumAvx2,
+            DotAvx2,         AxpyAvx2,          Int16ToFloatAvx2};
+  }
+#endif
+#ifdef WENET_FBANK_NEON
+  return {"neon",          SumNeon,           AddScalarNeon,
+          PreEmphasisNeon, MulNeon,           PowerSpectrumNeon,
+          DotNeon,         AxpyNeon,          Int16ToFloatNeon};
+#endif
+  return GetScalarFbankKernels();
+}
+
+}  // namespace
+
+const FbankKernels& GetScalarFbankKernels() {
+  static const FbankKernels kernels = {
+      "scalar",          SumScalar,           AddScalarScalar,
+      PreEmphasisScalar, MulScalar,           PowerSpectrumScalar,
+      DotScalar,         AxpyScalar,          Int16ToFloatScalar};
+  return kernels;
+}
+
+const FbankKernels& GetFbankKernels() {
+  static const FbankKernels kernels = SelectFbankKernels();
+  return kernels;
+}
+
+}  // namespace wenet
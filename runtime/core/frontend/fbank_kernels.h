@@ -0,0 +1,53 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_FBANK_KERNELS_H_
+#define FRONTEND_FBANK_KERNELS_H_
+
+#include <cstdint>
+
+namespace wenet {
+
+// Vectorized kernels of the per frame loops in Fbank::Compute. The best
+// implementation(AVX-512, AVX2, NEON or scalar) for the running CPU is
+// picked at runtime on the first call of GetFbankKernels().
+struct FbankKernels {
+  const char* name;
+  // return sum(x[0:n])
+  float (*sum)(const float* x, int n);
+  // x[i] += a
+  void (*add_scalar)(float a, float* x, int n);
+  // x[i] -= coeff * x[i - 1], x[0] -= coeff * x[0], in place
+  void (*pre_emphasis)(float coeff, float* x, int n);
+  // x[i] *= w[i]
+  void (*mul)(const float* w, float* x, int n);
+  // power[i] = re[i] * re[i] + im[i] * im[i]
+  void (*power_spectrum)(const float* re, const float* im, float* power,
+                         int n);
+  // return dot(a[0:n], b[0:n])
+  float (*dot)(const float* a, const float* b, int n);
+  // y[i] += a * x[i]
+  void (*axpy)(float a, const float* x, float* y, int n);
+  // y[i] = x[i], the 16 bit PCM to float
+  void (*int16_to_float)(const int16_t* x, float* y, int n);
+};
+
+const FbankKernels& GetFbankKernels();
+
+// The reference implementation, for testing
+const FbankKernels& GetScalarFbankKernels();
+
+}  // namespace wenet
+
+#endif  // FRONTEND_FBANK_KERNELS_H_
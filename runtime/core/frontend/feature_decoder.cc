@@ -0,0 +1,131 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/feature_decoder.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+// IEEE half to float, including the subnormals, inf and nan
+static float HalfToFloat(uint16_t h) {
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1F;
+  uint32_t mantissa = h & 0x3FF;
+  uint32_t bits = 0;
+  if (exponent == 0x1F) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa != 0) {
+    // Subnormal, normalized in float
+    exponent = 113;
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+  } else {
+    bits = sign;
+  }
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+FeatureDecoder::FeatureDecoder(FeatureFormat format, int feature_dim)
+    : format_(format), feature_dim_(feature_dim) {
+  CHECK_GT(feature_dim_, 0);
+}
+
+size_t FeatureDecoder::frame_bytes() const {
+  switch (format_) {
+    case FeatureFormat::kFloat16:
+      return feature_dim_ * sizeof(uint16_t);
+    case FeatureFormat::kInt8:
+      return sizeof(float) + feature_dim_;
+    default:
+      return feature_dim_ * sizeof(float);
+  }
+}
+
+bool FeatureDecoder::Decode(const char* data, size_t size,
+                            std::vector<float>* feats) const {
+  size_t bytes = frame_bytes();
+  if (size % bytes != 0) return false;
+  size_t num_frames = size / bytes;
+  size_t offset = feats->size();
+  feats->resize(offset + num_frames * feature_dim_);
+  float* dst = feats->data() + offset;
+  for (size_t i = 0; i < num_frames; ++i) {
+    const char* frame = data + i * bytes;
+    if (format_ == FeatureFormat::kFloat32) {
+      memcpy(dst, frame, bytes);
+    } else if (format_ == FeatureFormat::kFloat16) {
+      for (int j = 0; j < feature_dim_; ++j) {
+        uint16_t h;
+        memcpy(&h, frame + j * sizeof(h), sizeof(h));
+        dst[j] = HalfToFloat(h);
+      }
+    } else {
+      float scale;
+      memcpy(&scale, frame, sizeof(scale));
+      const int8_t* q = reinterpret_cast<const int8_t*>(frame + sizeof(scale));
+      for (int j = 0; j < feature_dim_; ++j) dst[j] = q[j] * scale;
+    }
+    dst += feature_dim_;
+  }
+  return true;
+}
+
+bool ParseFeatureFormat(const std::string& name, FeatureFormat* format) {
+  if (name == "fbank") {
+    *format = FeatureFormat::kFloat32;
+  } else if (name == "fbank_fp16") {
+    *format = FeatureFormat::kFloat16;
+  } else if (name == "fbank_int8") {
+    *format = FeatureFormat::kInt8;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<FeatureDecoder> CreateFeatureDecoder(
+    const std::string& format, const FeaturePipelineConfig& config,
+    int num_bins, int frame_shift_ms, std::string* error) {
+  FeatureFormat feature_format;
+  if (!ParseFeatureFormat(format, &feature_format)) {
+    *error = "unsupported feature_format option";
+    return nullptr;
+  }
+  if (num_bins != 0 && num_bins != config.num_bins) {
+    *error = "num_bins " + std::to_string(num_bins) +
+             " does not match the server " + std::to_string(config.num_bins);
+    return nullptr;
+  }
+  int config_shift_ms = config.frame_shift * 1000 / config.sample_rate;
+  if (frame_shift_ms != 0 && frame_shift_ms != config_shift_ms) {
+    *error = "frame_shift_ms " + std::to_string(frame_shift_ms) +
+             " does not match the server " + std::to_string(config_shift_ms);
+    return nullptr;
+  }
+  return std::unique_ptr<FeatureDecoder>(
+      new FeatureDecoder(feature_format, config.num_bins));
+}
+
+}  // namespace wenet
@@ -0,0 +1,68 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_FEATURE_DECODER_H_
+#define FRONTEND_FEATURE_DECODER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "frontend/feature_pipeline.h"
+
+namespace wenet {
+
+// The formats of the fbank frames computed by the clients, e.g. the edge
+// devices, which are uploaded instead of the audio and bypass the Fbank of
+// the server. Each message of the stream is a whole number of frames:
+//   "fbank": the float32 of each bin
+//   "fbank_fp16": the IEEE half of each bin
+//   "fbank_int8": a float32 scale, then the int8 of each bin, of which the
+//                 value is int8 * scale
+// All of them are little endian.
+enum class FeatureFormat { kFloat32, kFloat16, kInt8 };
+
+// FeatureDecoder decodes the uploaded frames for
+// FeaturePipeline::AcceptFeatures
+class FeatureDecoder {
+ public:
+  FeatureDecoder(FeatureFormat format, int feature_dim);
+
+  // Decode the frames of one message and append them to `feats`, return
+  // false if it's not of whole frames
+  bool Decode(const char* data, size_t size, std::vector<float>* feats) const;
+
+  FeatureFormat format() const { return format_; }
+  int feature_dim() const { return feature_dim_; }
+  // The bytes of one frame
+  size_t frame_bytes() const;
+
+ private:
+  FeatureFormat format_;
+  int feature_dim_;
+};
+
+// The "feature_format" of the start signal, the empty one is the audio
+bool ParseFeatureFormat(const std::string& name, FeatureFormat* format);
+
+// The FeatureDecoder of the stream, or nullptr with the error if the
+// options of the client don't match the config the server extracts the
+// features by, which are not checked if they're 0
+std::unique_ptr<FeatureDecoder> CreateFeatureDecoder(
+    const std::string& format, const FeaturePipelineConfig& config,
+    int num_bins, int frame_shift_ms, std::string* error);
+
+}  // namespace wenet
+
+#endif  // FRONTEND_FEATURE_DECODER_H_
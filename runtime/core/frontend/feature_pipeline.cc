@@ -17,44 +17,315 @@
 #include <algorithm>
 #include <utility>
 
+#include "frontend/fbank_kernels.h"
+#include "utils/stage_timer.h"
+#include "utils/timer.h"
+
 namespace wenet {
 
-FeaturePipeline::FeaturePipeline(const FeaturePipelineConfig& config)
+// Initial capacity of the frame buffer, 10s of 10ms frames
+static const int kMinCapacityFrames = 1000;
+
+static std::shared_ptr<const FbankTables> FbankTablesOf(
+    const FeaturePipelineConfig& config,
+    std::shared_ptr<const FbankTables> fbank_tables) {
+  if (fbank_tables == nullptr) return config.NewFbankTables();
+  CHECK(fbank_tables->Match(config.num_bins, config.sample_rate,
+                            config.frame_length))
+      << "The fbank tables are not of the feature pipeline config";
+  return fbank_tables;
+}
+
+FeaturePipeline::FeaturePipeline(
+    const FeaturePipelineConfig& config,
+    std::shared_ptr<const FbankTables> fbank_tables)
     : config_(config),
       feature_dim_(config.num_bins),
-      fbank_(config.num_bins, config.sample_rate, config.frame_length,
+      fbank_(FbankTablesOf(config, std::move(fbank_tables)),
              config.frame_shift),
       num_frames_(0),
-      input_finished_(false) {}
+      input_finished_(false),
+      input_sample_rate_(config.sample_rate) {
+  CHECK(!(config.use_spsc_queue && config.defer_features))
+      << "The deferred features are read by the extracting thread";
+  if (config.use_spsc_queue) {
+    queue_ = std::make_unique<SpscQueue<std::vector<float>>>();
+  }
+  if (config.enable_vad) {
+    vad_ = std::make_unique<Vad>(config.vad_opts);
+  }
+  fbank_.set_cmvn(config.cmvn);
+}
+
+void FeaturePipeline::set_input_sample_rate(int sample_rate) {
+  CHECK_EQ(num_frames_, 0);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(pending_wav_.empty());
+    input_sample_rate_ = sample_rate;
+  }
+  if (sample_rate == config_.sample_rate) {
+    resampler_.reset();
+  } else if (resampler_ == nullptr ||
+             resampler_->input_rate() != sample_rate) {
+    resampler_ = std::make_unique<Resampler>(sample_rate, config_.sample_rate);
+  }
+}
 
 void FeaturePipeline::AcceptWaveform(const float* pcm, const int size) {
+  if (config_.defer_features) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_wav_.insert(pending_wav_.end(), pcm, pcm + size);
+    }
+    finish_condition_.notify_one();
+    return;
+  }
+  ExtractWaveform(pcm, size);
+}
+
+void FeaturePipeline::ExtractWaveform(const float* pcm, const int size) {
+  if (resampler_ != nullptr) {
+    resampled_wav_.clear();
+    resampler_->Resample(pcm, size, false, &resampled_wav_);
+    ComputeFeatures(resampled_wav_.data(), resampled_wav_.size());
+  } else {
+    ComputeFeatures(pcm, size);
+  }
+}
+
+void FeaturePipeline::ComputeFeatures(const float* pcm, const int size) {
+  remained_wav_.insert(remained_wav_.end(), pcm, pcm + size);
+  ComputeFrames(false);
+}
+
+void FeaturePipeline::ComputeFrames(bool flush) {
+  static StageStats* feature_latency = StageStats::Get(
+      "wenet_feature_seconds", "Fbank extraction latency of a wave chunk");
+  int num_samples = remained_wav_.size();
+  if (!flush && config_.min_accept_frames > 0) {
+    int num_ready = num_samples < config_.frame_length
+                        ? 0
+                        : 1 + (num_samples - config_.frame_length) /
+                                  config_.frame_shift;
+    if (num_ready < config_.min_accept_frames) return;
+  }
+  Timer timer;
   std::vector<std::vector<float>> feats;
-  std::vector<float> waves;
-  waves.insert(waves.end(), remained_wav_.begin(), remained_wav_.end());
-  waves.insert(waves.end(), pcm, pcm + size);
-  int num_frames = fbank_.Compute(waves, &feats);
-  feature_queue_.Push(std::move(feats));
-  num_frames_ += num_frames;
+  int num_frames = fbank_.ComputeBatch(remained_wav_, &feats);
+  PushFrames(&feats);
+  remained_wav_.erase(remained_wav_.begin(),
+                      remained_wav_.begin() + config_.frame_shift * num_frames);
+  feature_latency->Record(timer.ElapsedNs());
+}
 
-  int left_samples = waves.size() - config_.frame_shift * num_frames;
-  remained_wav_.resize(left_samples);
-  std::copy(waves.begin() + config_.frame_shift * num_frames, waves.end(),
-            remained_wav_.begin());
+void FeaturePipeline::AcceptFeatures(const float* feats,
+                                     const int num_frames) {
+  std::vector<std::vector<float>> frames(num_frames);
+  for (int i = 0; i < num_frames; ++i) {
+    frames[i].assign(feats + i * feature_dim_, feats + (i + 1) * feature_dim_);
+    if (config_.cmvn != nullptr) config_.cmvn->Apply(frames[i].data());
+  }
+  PushFrames(&frames);
+}
+
+void FeaturePipeline::PushFrames(std::vector<std::vector<float>>* feats) {
+  int num_frames = feats->size();
+  if (vad_ != nullptr) MarkSilence(feats);
+  if (queue_ != nullptr) {
+    queue_->Push(feats);
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    AppendFrames(*feats);
+    if (vad_ != nullptr) {
+      silence_.insert(silence_.end(), frame_silence_.begin(),
+                      frame_silence_.end());
+    }
+  }
+  num_frames_ += num_frames;
   // We are still adding wave, notify input is not finished
-  finish_condition_.notify_one();
+  if (queue_ == nullptr) finish_condition_.notify_one();
+}
+
+void FeaturePipeline::ComputeUtterance(const float* pcm, const int size,
+                                       FeatureView* feats) {
+  std::vector<float> waves;
+  if (resampler_ != nullptr) {
+    resampler_->Reset();
+    resampler_->Resample(pcm, size, true, &waves);
+    resampler_->Reset();
+  } else {
+    waves.assign(pcm, pcm + size);
+  }
+  std::vector<std::vector<float>> frames;
+  int num_frames = fbank_.ComputeBatch(waves, &frames);
+  auto storage = std::make_shared<std::vector<float>>(
+      static_cast<size_t>(num_frames) * feature_dim_);
+  float* dst = storage->data();
+  for (const auto& frame : frames) {
+    std::copy(frame.begin(), frame.end(), dst);
+    dst += feature_dim_;
+  }
+  feats->data_ = storage->data();
+  feats->num_frames_ = num_frames;
+  feats->feature_dim_ = feature_dim_;
+  feats->storage_ = std::move(storage);
+}
+
+void FeaturePipeline::MarkSilence(std::vector<std::vector<float>>* feats) {
+  frame_silence_.clear();
+  const GlobalCmvn* cmvn = config_.cmvn.get();
+  std::vector<float> raw(cmvn != nullptr ? feature_dim_ : 0);
+  for (auto& feat : *feats) {
+    // The thresholds of the Vad are of the log mel energies
+    const float* fbank = feat.data();
+    if (cmvn != nullptr) {
+      for (int i = 0; i < feature_dim_; ++i) {
+        raw[i] = cmvn->Denormalize(feat[i], i);
+      }
+      fbank = raw.data();
+    }
+    bool silence = vad_->IsSilence(fbank, feature_dim_);
+    if (queue_ != nullptr) {
+      feat.push_back(silence ? 1.0f : 0.0f);
+    } else {
+      frame_silence_.push_back(silence);
+    }
+  }
+}
+
+void FeaturePipeline::AppendFrames(
+    const std::vector<std::vector<float>>& feats) {
+  int num_frames = feats.size();
+  if (num_frames == 0) return;
+  int num_unread = write_frame_ - read_frame_;
+  if (write_frame_ + num_frames > capacity_frames_) {
+    if (frames_ != nullptr && frames_.use_count() == 1 &&
+        num_unread + num_frames <= capacity_frames_) {
+      // No view refers to the buffer, move unread frames to the front
+      std::copy(frames_->begin() + read_frame_ * feature_dim_,
+                frames_->begin() + write_frame_ * feature_dim_,
+                frames_->begin());
+    } else {
+      // Grow, or leave the old buffer to the views still using it
+      int capacity =
+          std::max(kMinCapacityFrames, 2 * (num_unread + num_frames));
+      auto frames = std::make_shared<std::vector<float>>(
+          static_cast<size_t>(capacity) * feature_dim_);
+      if (num_unread > 0) {
+        std::copy(frames_->begin() + read_frame_ * feature_dim_,
+                  frames_->begin() + write_frame_ * feature_dim_,
+                  frames->begin());
+      }
+      frames_ = std::move(frames);
+      capacity_frames_ = capacity;
+    }
+    read_frame_ = 0;
+    write_frame_ = num_unread;
+  }
+  float* dst = frames_->data() + write_frame_ * feature_dim_;
+  for (const auto& feat : feats) {
+    CHECK_EQ(static_cast<int>(feat.size()), feature_dim_);
+    std::copy(feat.begin(), feat.end(), dst);
+    dst += feature_dim_;
+  }
+  write_frame_ += num_frames;
 }
 
 void FeaturePipeline::AcceptWaveform(const int16_t* pcm, const int size) {
-  auto* float_pcm = new float[size];
-  for (size_t i = 0; i < size; i++) {
-    float_pcm[i] = static_cast<float>(pcm[i]);
+  if (config_.defer_features) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      size_t offset = pending_wav_.size();
+      pending_wav_.resize(offset + size);
+      GetFbankKernels().int16_to_float(pcm, pending_wav_.data() + offset,
+                                       size);
+    }
+    finish_condition_.notify_one();
+    return;
   }
-  this->AcceptWaveform(float_pcm, size);
-  delete[] float_pcm;
+  if (resampler_ != nullptr) {
+    float_wav_.resize(size);
+    GetFbankKernels().int16_to_float(pcm, float_wav_.data(), size);
+    this->AcceptWaveform(float_wav_.data(), size);
+    return;
+  }
+  size_t offset = remained_wav_.size();
+  remained_wav_.resize(offset + size);
+  GetFbankKernels().int16_to_float(pcm, remained_wav_.data() + offset, size);
+  ComputeFrames(false);
+}
+
+// The sample points of `channel` of the interleaved waveform as float
+template <typename T>
+static void Deinterleave(const T* pcm, int num_samples, int num_channels,
+                         int channel, std::vector<float>* wav) {
+  CHECK_GE(channel, 0);
+  CHECK_LT(channel, num_channels);
+  wav->resize(num_samples);
+  for (int i = 0; i < num_samples; ++i) {
+    (*wav)[i] = static_cast<float>(pcm[i * num_channels + channel]);
+  }
+}
+
+void FeaturePipeline::AcceptWaveform(const float* pcm, int num_samples,
+                                     int num_channels, int channel) {
+  Deinterleave(pcm, num_samples, num_channels, channel, &channel_wav_);
+  AcceptWaveform(channel_wav_.data(), num_samples);
+}
+
+void FeaturePipeline::AcceptWaveform(const int16_t* pcm, int num_samples,
+                                     int num_channels, int channel) {
+  Deinterleave(pcm, num_samples, num_channels, channel, &channel_wav_);
+  AcceptWaveform(channel_wav_.data(), num_samples);
 }
 
 void FeaturePipeline::set_input_finished() {
+  if (config_.defer_features) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      CHECK(!finish_pending_);
+      finish_pending_ = true;
+    }
+    finish_condition_.notify_one();
+    return;
+  }
+  FinishInput();
+}
+
+void FeaturePipeline::ComputePending() {
+  if (!config_.defer_features) return;
+  bool finish = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    drained_wav_.swap(pending_wav_);
+    finish = finish_pending_ && !input_finished_;
+  }
+  if (!drained_wav_.empty()) {
+    ExtractWaveform(drained_wav_.data(), drained_wav_.size());
+    drained_wav_.clear();
+  }
+  if (finish) FinishInput();
+}
+
+void FeaturePipeline::FinishInput() {
   CHECK(!input_finished_);
+  if (resampler_ != nullptr) {
+    // The tail of the input in the filter
+    resampled_wav_.clear();
+    resampler_->Resample(nullptr, 0, true, &resampled_wav_);
+    remained_wav_.insert(remained_wav_.end(), resampled_wav_.begin(),
+                         resampled_wav_.end());
+  }
+  // The frames held back for min_accept_frames
+  if (resampler_ != nullptr || config_.min_accept_frames > 0) {
+    ComputeFrames(true);
+  }
+  if (queue_ != nullptr) {
+    input_finished_ = true;
+    queue_->Close();
+    return;
+  }
   {
     std::lock_guard<std::mutex> lock(mutex_);
     input_finished_ = true;
@@ -63,65 +334,173 @@ void FeaturePipeline::set_input_finished() {
 }
 
 bool FeaturePipeline::ReadOne(std::vector<float>* feat) {
-  if (!feature_queue_.Empty()) {
-    *feat = std::move(feature_queue_.Pop());
-    return true;
-  } else {
-    std::unique_lock<std::mutex> lock(mutex_);
-    while (!input_finished_) {
-      // This will release the lock and wait for notify_one()
-      // from AcceptWaveform() or set_input_finished()
-      finish_condition_.wait(lock);
-      if (!feature_queue_.Empty()) {
-        *feat = std::move(feature_queue_.Pop());
-        return true;
-      }
-    }
-    CHECK(input_finished_);
-    // Double check queue.empty, see issue#893 for detailed discussions.
-    if (!feature_queue_.Empty()) {
-      *feat = std::move(feature_queue_.Pop());
-      return true;
-    } else {
-      return false;
-    }
-  }
+  FeatureView view;
+  if (!Read(1, &view)) return false;
+  feat->assign(view.frame(0), view.frame(0) + feature_dim_);
+  return true;
 }
 
 bool FeaturePipeline::Read(int num_frames,
                            std::vector<std::vector<float>>* feats) {
-  feats->clear();
-  if (feature_queue_.Size() >= num_frames) {
-    *feats = std::move(feature_queue_.Pop(num_frames));
-    return true;
-  } else {
-    std::unique_lock<std::mutex> lock(mutex_);
-    while (!input_finished_) {
-      // This will release the lock and wait for notify_one()
-      // from AcceptWaveform() or set_input_finished()
-      finish_condition_.wait(lock);
-      if (feature_queue_.Size() >= num_frames) {
-        *feats = std::move(feature_queue_.Pop(num_frames));
-        return true;
-      }
+  FeatureView view;
+  bool ret = Read(num_frames, &view);
+  feats->resize(view.num_frames());
+  for (int i = 0; i < view.num_frames(); ++i) {
+    (*feats)[i].assign(view.frame(i), view.frame(i) + feature_dim_);
+  }
+  return ret;
+}
+
+bool FeaturePipeline::Read(int num_frames, FeatureView* feats) {
+  if (queue_ != nullptr) return ReadQueue(num_frames, feats);
+  ComputePending();
+  std::unique_lock<std::mutex> lock(mutex_);
+  // This will release the lock and wait for notify_one()
+  // from AcceptWaveform() or set_input_finished()
+  while (!input_finished_ && write_frame_ - read_frame_ < num_frames) {
+    if (!pending_wav_.empty() || finish_pending_) {
+      // The waveform of defer_features arrived
+      lock.unlock();
+      ComputePending();
+      lock.lock();
+      continue;
     }
-    CHECK(input_finished_);
-    // Double check queue.empty, see issue#893 for detailed discussions.
-    if (feature_queue_.Size() >= num_frames) {
-      *feats = std::move(feature_queue_.Pop(num_frames));
-      return true;
-    } else {
-      *feats = std::move(feature_queue_.Pop(feature_queue_.Size()));
-      return false;
+    finish_condition_.wait(lock);
+  }
+  int n = std::min(num_frames, write_frame_ - read_frame_);
+  if (vad_ != nullptr) {
+    last_read_silent_ = n > 0 && std::all_of(silence_.begin(),
+                                             silence_.begin() + n,
+                                             [](bool s) { return s; });
+    silence_.erase(silence_.begin(), silence_.begin() + n);
+  }
+  feats->storage_ = frames_;
+  feats->data_ = frames_ == nullptr
+                     ? nullptr
+                     : frames_->data() + read_frame_ * feature_dim_;
+  feats->num_frames_ = n;
+  feats->feature_dim_ = feature_dim_;
+  read_frame_ += n;
+  return n == num_frames;
+}
+
+bool FeaturePipeline::ReadQueue(int num_frames, FeatureView* feats) {
+  popped_frames_.clear();
+  int n = queue_->Pop(std::max(num_frames, 0), &popped_frames_);
+  if (view_frames_ == nullptr || view_frames_.use_count() > 1) {
+    // The last view is still in use
+    view_frames_ = std::make_shared<std::vector<float>>();
+  }
+  view_frames_->resize(static_cast<size_t>(n) * feature_dim_);
+  float* dst = view_frames_->data();
+  // The trailing value of the frame is its silence if enable_vad
+  int frame_size = feature_dim_ + (vad_ != nullptr ? 1 : 0);
+  last_read_silent_ = vad_ != nullptr && n > 0;
+  for (const auto& feat : popped_frames_) {
+    CHECK_EQ(static_cast<int>(feat.size()), frame_size);
+    std::copy(feat.begin(), feat.begin() + feature_dim_, dst);
+    dst += feature_dim_;
+    if (vad_ != nullptr && feat[feature_dim_] == 0.0f) {
+      last_read_silent_ = false;
     }
   }
+  feats->storage_ = view_frames_;
+  feats->data_ = n > 0 ? view_frames_->data() : nullptr;
+  feats->num_frames_ = n;
+  feats->feature_dim_ = feature_dim_;
+  return n == num_frames;
+}
+
+int64_t FeaturePipeline::buffer_bytes() const {
+  int64_t bytes = (remained_wav_.capacity() + resampled_wav_.capacity() +
+                   float_wav_.capacity() + channel_wav_.capacity()) *
+                  sizeof(float);
+  std::lock_guard<std::mutex> lock(mutex_);
+  bytes += (pending_wav_.capacity() + drained_wav_.capacity()) * sizeof(float);
+  if (frames_ != nullptr) bytes += frames_->capacity() * sizeof(float);
+  if (view_frames_ != nullptr) {
+    bytes += view_frames_->capacity() * sizeof(float);
+  }
+  return bytes;
 }
 
 void FeaturePipeline::Reset() {
   input_finished_ = false;
   num_frames_ = 0;
   remained_wav_.clear();
-  feature_queue_.Clear();
+  last_read_silent_ = false;
+  if (resampler_ != nullptr) resampler_->Reset();
+  if (vad_ != nullptr) vad_->Reset();
+  if (queue_ != nullptr) queue_->Clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  read_frame_ = 0;
+  write_frame_ = 0;
+  silence_.clear();
+  pending_wav_.clear();
+  finish_pending_ = false;
+  // Views may still refer to the old buffer
+  if (frames_.use_count() > 1) {
+    frames_.reset();
+    capacity_frames_ = 0;
+  }
+}
+
+bool FeaturePipeline::SaveState(StateWriter* writer) {
+  if (queue_ != nullptr) return false;
+  ComputePending();
+  writer->Write(input_sample_rate_);
+  writer->Write(num_frames_);
+  writer->Write(input_finished_);
+  writer->Write(last_read_silent_);
+  writer->WriteVector(remained_wav_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int num_unread = write_frame_ - read_frame_;
+    writer->Write(num_unread);
+    if (num_unread > 0) {
+      writer->Write(frames_->data() + read_frame_ * feature_dim_,
+                    static_cast<size_t>(num_unread) * feature_dim_);
+    }
+    std::vector<uint8_t> silence(silence_.begin(), silence_.end());
+    writer->WriteVector(silence);
+  }
+  if (resampler_ != nullptr) resampler_->SaveState(writer);
+  if (vad_ != nullptr) vad_->SaveState(writer);
+  return true;
+}
+
+bool FeaturePipeline::LoadState(StateReader* reader) {
+  if (queue_ != nullptr) return false;
+  int input_sample_rate = 0;
+  int num_unread = 0;
+  if (!reader->Read(&input_sample_rate) ||
+      input_sample_rate != input_sample_rate_ || !reader->Read(&num_frames_) ||
+      !reader->Read(&input_finished_) || !reader->Read(&last_read_silent_) ||
+      !reader->ReadVector(&remained_wav_) || !reader->Read(&num_unread) ||
+      num_unread < 0 || num_unread > num_frames_) {
+    return false;
+  }
+  std::vector<std::vector<float>> feats(num_unread,
+                                        std::vector<float>(feature_dim_));
+  for (auto& feat : feats) {
+    if (!reader->Read(feat.data(), feature_dim_)) return false;
+  }
+  // The vad marks each frame the Read() takes
+  std::vector<uint8_t> silence;
+  if (!reader->ReadVector(&silence) ||
+      silence.size() != static_cast<size_t>(vad_ != nullptr ? num_unread : 0)) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    read_frame_ = 0;
+    write_frame_ = 0;
+    AppendFrames(feats);
+    silence_.assign(silence.begin(), silence.end());
+  }
+  if (resampler_ != nullptr && !resampler_->LoadState(reader)) return false;
+  if (vad_ != nullptr && !vad_->LoadState(reader)) return false;
+  return true;
 }
 
 }  // namespace wenet
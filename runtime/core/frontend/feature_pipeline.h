@@ -15,14 +15,20 @@
 #ifndef FRONTEND_FEATURE_PIPELINE_H_
 #define FRONTEND_FEATURE_PIPELINE_H_
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <vector>
 
 #include "frontend/fbank.h"
-#include "utils/blocking_queue.h"
+#include "frontend/resampler.h"
+#include "frontend/vad.h"
 #include "utils/log.h"
+#include "utils/spsc_queue.h"
+#include "utils/state_io.h"
 
 namespace wenet {
 
@@ -31,6 +37,24 @@ struct FeaturePipelineConfig {
   int sample_rate;
   int frame_length;
   int frame_shift;
+  // Pass the frames by a lock-free SpscQueue instead of the mutex guarded
+  // buffer, if only one thread calls AcceptWaveform and one calls Read
+  bool use_spsc_queue = false;
+  // The waveform is buffered until it makes at least min_accept_frames new
+  // frames, so the small packets of the network, e.g. 20ms, are passed to
+  // the fbank and the decoder together. 0 computes the frames on every
+  // AcceptWaveform(), the buffer is flushed by set_input_finished().
+  int min_accept_frames = 0;
+  // Mark the silent frames by the Vad, see last_read_silent()
+  bool enable_vad = false;
+  // AcceptWaveform() only buffers the waveform, which is extracted by the
+  // reader of the frames, e.g. the decoder on the decode pool, so the
+  // network threads don't run the fbank. It's not for use_spsc_queue.
+  bool defer_features = false;
+  VadOptions vad_opts;
+  // The global cmvn of the training applied by the Fbank, see GlobalCmvn,
+  // so the model may be exported without it. nullptr for none.
+  std::shared_ptr<const GlobalCmvn> cmvn;
   FeaturePipelineConfig(int num_bins, int sample_rate)
       : num_bins(num_bins),                  // 80 dim fbank
         sample_rate(sample_rate) {           // 16k sample rate
@@ -41,28 +65,85 @@ struct FeaturePipelineConfig {
   void Info() const {
     LOG(INFO) << "feature pipeline config"
               << " num_bins " << num_bins << " frame_length " << frame_length
-              << " frame_shift " << frame_shift;
+              << " frame_shift " << frame_shift << " global cmvn "
+              << (cmvn != nullptr);
+  }
+
+  // The FbankTables of the config, to be shared by the FeaturePipelines
+  std::shared_ptr<const FbankTables> NewFbankTables() const {
+    return std::make_shared<FbankTables>(num_bins, sample_rate, frame_length);
   }
 };
 
+// A read only view of num_frames() contiguous frames, frame i starts at
+// data() + i * feature_dim(), so a chunk can be consumed as one [T, D] block.
+// The view shares the storage of the FeaturePipeline, it stays valid after
+// later AcceptWaveform(), Read() or Reset() calls.
+class FeatureView {
+ public:
+  FeatureView() = default;
+
+  const float* data() const { return data_; }
+  const float* frame(int i) const { return data_ + i * feature_dim_; }
+  int num_frames() const { return num_frames_; }
+  int feature_dim() const { return feature_dim_; }
+  bool empty() const { return num_frames_ == 0; }
+
+ private:
+  friend class FeaturePipeline;
+  std::shared_ptr<const std::vector<float>> storage_;
+  const float* data_ = nullptr;
+  int num_frames_ = 0;
+  int feature_dim_ = 0;
+};
+
 // Typically, FeaturePipeline is used in two threads: one thread A calls
 // AcceptWaveform() to add raw wav data and set_input_finished() to notice
 // the end of input wav, another thread B (decoder thread) calls Read() to
-// consume features.So a BlockingQueue is used to make this class thread safe.
+// consume features. The features are kept in one contiguous buffer with a
+// fixed stride of feature_dim, guarded by a mutex. With use_spsc_queue of
+// the config, the frames are passed by a lock-free queue instead, and
+// copied to the buffer of the view by Read().
 
 // The Read() is designed as a blocking method when there is no feature
-// in feature_queue_ and the input is not finished.
+// in the buffer and the input is not finished.
 
 // See bin/decoder_main.cc, websocket/websocket_server.cc and
 // decoder/torch_asr_decoder.cc for usage
 
 class FeaturePipeline {
  public:
-  explicit FeaturePipeline(const FeaturePipelineConfig& config);
+  // The fbank tables of the config are built if `fbank_tables` is not set,
+  // otherwise they must match the config, see FbankTables::Match()
+  explicit FeaturePipeline(
+      const FeaturePipelineConfig& config,
+      std::shared_ptr<const FbankTables> fbank_tables = nullptr);
 
-  // The feature extraction is done in AcceptWaveform().
+  // The feature extraction is done in AcceptWaveform(), or by
+  // ComputePending() if defer_features.
   void AcceptWaveform(const float* pcm, const int size);
   void AcceptWaveform(const int16_t* pcm, const int size);
+  // Accept `channel` of the waveform of `num_channels` interleaved channels
+  // of `num_samples` sample points each, e.g. one side of a stereo call,
+  // see MultiChannelDecoder
+  void AcceptWaveform(const float* pcm, int num_samples, int num_channels,
+                      int channel);
+  void AcceptWaveform(const int16_t* pcm, int num_samples, int num_channels,
+                      int channel);
+  // Accept the frames of feature_dim() computed by the client, e.g. of
+  // FeatureDecoder, which bypass the Fbank. They must not be mixed with
+  // the waveform in one utterance. The cmvn of the config is applied to
+  // them as well.
+  void AcceptFeatures(const float* feats, const int num_frames);
+  // Extract the features of the waveform buffered by AcceptWaveform() and
+  // set_input_finished() if defer_features, on the thread calling it. It's
+  // called by Read(), and by the reader before checking NumQueuedFrames()
+  // or input_finished() without blocking. Only one thread may call it.
+  void ComputePending();
+  // The sample rate of the waveform to accept, which is resampled to the
+  // sample rate of the config if they differ. Set it before any waveform
+  // is accepted.
+  void set_input_sample_rate(int sample_rate);
 
   // Current extracted frames number.
   int num_frames() const { return num_frames_; }
@@ -77,7 +158,7 @@ class FeaturePipeline {
   // Return False if input is finished and no feature could be read.
   // Return True if a feature is read.
   // This function is a blocking method. It will block the thread when
-  // there is no feature in feature_queue_ and the input is not finished.
+  // there is no feature in the buffer and the input is not finished.
   bool ReadOne(std::vector<float>* feat);
 
   // Read #num_frames frame features.
@@ -85,35 +166,132 @@ class FeaturePipeline {
   // input is finished.
   // Return True if #num_frames features are read.
   // This function is a blocking method when there is no feature
-  // in feature_queue_ and the input is not finished.
+  // in the buffer and the input is not finished.
   bool Read(int num_frames, std::vector<std::vector<float>>* feats);
 
+  // Same as above, but without copy, the frames are returned as a view of
+  // the internal buffer.
+  bool Read(int num_frames, FeatureView* feats);
+
+  // Offline, compute the features of the whole waveform by one batch of the
+  // fbank to `feats`, which owns its storage. The waveform is resampled as
+  // AcceptWaveform() does, but the buffer, the queue and the Vad of the
+  // pipeline are bypassed, see AsrDecoder::DecodeUtterance.
+  void ComputeUtterance(const float* pcm, const int size, FeatureView* feats);
+
+  // Whether all the frames of the last Read() are silence by the Vad, always
+  // false if enable_vad of the config is false or nothing is read. Called by
+  // the thread calling Read().
+  bool last_read_silent() const { return last_read_silent_; }
+
+  // The bytes of the buffers of the frames and the waveform
+  int64_t buffer_bytes() const;
+
   void Reset();
+
+  // Save the unread frames, the waveform not framed yet and the states of
+  // the Resampler and the Vad, so the session may be continued by another
+  // pipeline of the same config, see AsrDecoder::SaveState. It's called by
+  // the reader while no waveform is accepted, and the deferred waveform is
+  // computed first. It returns false for use_spsc_queue, whose frames are
+  // not to be peeked.
+  bool SaveState(StateWriter* writer);
+  // Called on a pipeline just constructed or Reset(), before any input, and
+  // with the same input sample rate as the saved one
+  bool LoadState(StateReader* reader);
+
   bool IsLastFrame(int frame) const {
     return input_finished_ && (frame == num_frames_ - 1);
   }
 
-  int NumQueuedFrames() const { return feature_queue_.Size(); }
+  // The buffered waveform of defer_features is counted by the frame shift
+  int NumQueuedFrames() const {
+    if (queue_ != nullptr) return queue_->Size();
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t pending_frames = static_cast<int64_t>(pending_wav_.size()) *
+                             config_.sample_rate / input_sample_rate_ /
+                             config_.frame_shift;
+    return write_frame_ - read_frame_ + pending_frames;
+  }
 
  private:
   const FeaturePipelineConfig& config_;
   int feature_dim_;
   Fbank fbank_;
 
-  BlockingQueue<std::vector<float>> feature_queue_;
+  // Append frames to the buffer, must be called with mutex_ held
+  void AppendFrames(const std::vector<std::vector<float>>& feats);
+  // The AcceptWaveform() and set_input_finished() of the waveform at the
+  // input sample rate, which are deferred to ComputePending()
+  void ExtractWaveform(const float* pcm, const int size);
+  void FinishInput();
+  // Extract the features of the waveform at the config sample rate
+  void ComputeFeatures(const float* pcm, const int size);
+  // Pass the frames to the reader
+  void PushFrames(std::vector<std::vector<float>>* feats);
+  // Extract the frames of remained_wav_ if there are at least
+  // min_accept_frames of the config or `flush`
+  void ComputeFrames(bool flush);
+  // Read() of use_spsc_queue
+  bool ReadQueue(int num_frames, FeatureView* feats);
+  // Mark the silence of the frames, in place as a trailing value of each
+  // frame if use_spsc_queue, or to silence_ otherwise
+  void MarkSilence(std::vector<std::vector<float>>* feats);
+
+  // Frames [read_frame_, write_frame_) of frames_ are not read yet. Frames
+  // before read_frame_ may still be referenced by a FeatureView, so they are
+  // only overwritten when nobody else holds frames_, otherwise a new buffer
+  // is allocated.
+  std::shared_ptr<std::vector<float>> frames_;
+  int capacity_frames_ = 0;
+  int read_frame_ = 0;
+  int write_frame_ = 0;
   int num_frames_;
   bool input_finished_;
 
+  // nullptr if not enable_vad
+  std::unique_ptr<Vad> vad_ = nullptr;
+  // The silence of the unread frames, guarded by mutex_
+  std::deque<bool> silence_;
+  // The silence of the frames of the last MarkSilence()
+  std::vector<bool> frame_silence_;
+  bool last_read_silent_ = false;
+
   // The feature extraction is done in AcceptWaveform().
   // This waveform sample points are consumed by frame size.
-  // The residual waveform sample points after framing are
-  // kept to be used in next AcceptWaveform() calling.
+  // The residual waveform sample points after framing, and the ones
+  // buffered for min_accept_frames, are kept to be used in next
+  // AcceptWaveform() calling. 16 bit PCM at the config sample rate is
+  // converted right into it.
   std::vector<float> remained_wav_;
+  // nullptr if the input is at the config sample rate
+  std::unique_ptr<Resampler> resampler_ = nullptr;
+  std::vector<float> resampled_wav_;
+  // The 16 bit PCM of AcceptWaveform as float, if it's resampled
+  std::vector<float> float_wav_;
+  // The channel deinterleaved from the multi-channel waveform
+  std::vector<float> channel_wav_;
+  int input_sample_rate_;
 
-  // Used to block the Read when there is no feature in feature_queue_
-  // and the input is not finished.
+  // The waveform at the input sample rate buffered for ComputePending(),
+  // guarded by mutex_, which is swapped with drained_wav_ to be extracted
+  std::vector<float> pending_wav_;
+  std::vector<float> drained_wav_;
+  // set_input_finished() is called but not done by ComputePending() yet,
+  // guarded by mutex_
+  bool finish_pending_ = false;
+
+  // Guards the frame buffer, and used to block the Read when there is no
+  // feature in the buffer and the input is not finished.
   mutable std::mutex mutex_;
   std::condition_variable finish_condition_;
+
+  // nullptr if not use_spsc_queue
+  std::unique_ptr<SpscQueue<std::vector<float>>> queue_ = nullptr;
+  // The frames popped by ReadQueue, and the buffer of the last view, which
+  // is reused if the view is released
+  std::vector<std::vector<float>> popped_frames_;
+  std::shared_ptr<std::vector<float>> view_frames_;
 };
 
 }  // namespace wenet
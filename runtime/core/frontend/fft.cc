@@ -64,12 +64,10 @@ void make_bitrev(int n, int* bitrev) {
   }
 }
 
-// bitrev: bit reversal table
-// sintbl: trigonometric function table
-// x:real part
-// y:image part
-// n: fft length
-int fft(const int* bitrev, const float* sintbl, float* x, float* y, int n) {
+// Complex fft of length n, sintbl is the table of length n * stride, so the
+// half length transform of rfft can share the table of the full length.
+static int fft_impl(const int* bitrev, const float* sintbl, int stride,
+                    float* x, float* y, int n) {
   int i, j, k, ik, h, d, k2, n4, inverse;
   float t, s, c, dx, dy;
 
@@ -104,11 +102,11 @@ int fft(const int* bitrev, const float* sintbl, float* x, float* y, int n) {
     k2 = k + k;
     d = n / k2;
     for (j = 0; j < k; ++j) {
-      c = sintbl[h + n4];
+      c = sintbl[(h + n4) * stride];
       if (inverse)
-        s = -sintbl[h];
+        s = -sintbl[h * stride];
       else
-        s = sintbl[h];
+        s = sintbl[h * stride];
       for (i = j; i < n; i += k2) {
         ik = i + k;
         dx = s * y[ik] + c * x[ik];
@@ -131,4 +129,60 @@ int fft(const int* bitrev, const float* sintbl, float* x, float* y, int n) {
   return 0; /* finished successfully */
 }
 
+// bitrev: bit reversal table
+// sintbl: trigonometric function table
+// x:real part
+// y:image part
+// n: fft length
+int fft(const int* bitrev, const float* sintbl, float* x, float* y, int n) {
+  return fft_impl(bitrev, sintbl, 1, x, y, n);
+}
+
+// The real input of length n is packed as a complex sequence
+// z[k] = x[2k] + i * x[2k + 1] of length m = n / 2, then
+// X[k] = E[k] + W^k * O[k], where E and O are the spectrum of the even and
+// odd samples, E[k] = (Z[k] + conj(Z[m - k])) / 2,
+// O[k] = (Z[k] - conj(Z[m - k])) / 2i, W = exp(-2 * pi * i / n).
+int rfft(const int* bitrev, const float* sintbl, float* x, float* y, int n) {
+  int i, k, m, n4;
+  float ar, ai, br, bi, er, ei, or_, oi, c, s, tr, ti;
+
+  if (n < 4) return -1;
+  m = n / 2;
+  n4 = n / 4;
+  /* pack even samples to x, odd samples to y */
+  for (i = 0; i < m; ++i) {
+    y[i] = x[2 * i + 1];
+    x[i] = x[2 * i];
+  }
+  fft_impl(bitrev, sintbl, 2, x, y, m);
+
+  /* split */
+  ar = x[0];
+  ai = y[0];
+  x[0] = ar + ai;
+  y[0] = 0;
+  x[m] = ar - ai;
+  y[m] = 0;
+  for (k = 1; k <= m / 2; ++k) {
+    ar = x[k];
+    ai = y[k];
+    br = x[m - k];
+    bi = y[m - k];
+    er = 0.5f * (ar + br);
+    ei = 0.5f * (ai - bi);
+    or_ = 0.5f * (ai + bi);
+    oi = -0.5f * (ar - br);
+    s = sintbl[k];
+    c = sintbl[k + n4];
+    tr = c * or_ + s * oi;
+    ti = c * oi - s * or_;
+    x[k] = er + tr;
+    y[k] = ei + ti;
+    x[m - k] = er - tr;
+    y[m - k] = ti - ei;
+  }
+  return 0;
+}
+
 }  // namespace wenet
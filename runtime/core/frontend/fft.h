@@ -33,6 +33,13 @@ void make_bitrev(int n, int* bitrev);
 
 int fft(const int* bitrev, const float* sintbl, float* x, float* y, int n);
 
+// Real input fft of length n, which does a complex fft of length n / 2.
+// bitrev: bit reversal table of length n / 2
+// sintbl: trigonometric function table of length n
+// x: n real samples on input, real part of bin [0, n / 2] on output
+// y: output only, image part of bin [0, n / 2], at least n / 2 + 1 long
+int rfft(const int* bitrev, const float* sintbl, float* x, float* y, int n);
+
 }  // namespace wenet
 
 #endif  // FRONTEND_FFT_H_
@@ -0,0 +1,146 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/mapped_wav_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utils/log.h"
+
+namespace wenet {
+
+static uint32_t ReadUint32(const char* p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static uint16_t ReadUint16(const char* p) {
+  uint16_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+bool MappedWavReader::Open(const std::string& filename) {
+  Close();
+  const char* file = nullptr;
+  size_t size = 0;
+#ifndef _WIN32
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(WARNING) << "Error in open " << filename;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    map_size_ = st.st_size;
+    map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map_ == nullptr || map_ == MAP_FAILED) {
+    map_ = nullptr;
+    LOG(WARNING) << "Error in mmap " << filename;
+    return false;
+  }
+  // The samples are read once from the start to the end
+  madvise(map_, map_size_, MADV_SEQUENTIAL | MADV_WILLNEED);
+  file = static_cast<const char*>(map_);
+  size = map_size_;
+#else
+  std::ifstream is(filename, std::ios::binary);
+  if (!is) {
+    LOG(WARNING) << "Error in open " << filename;
+    return false;
+  }
+  buffer_.assign(std::istreambuf_iterator<char>(is),
+                 std::istreambuf_iterator<char>());
+  file = buffer_.data();
+  size = buffer_.size();
+#endif
+  if (!Parse(file, size)) {
+    VLOG(1) << filename << " is not a 16 bit PCM wav file";
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool MappedWavReader::OpenBuffer(const char* data, size_t size) {
+  Close();
+  if (!Parse(data, size)) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool MappedWavReader::Parse(const char* file, size_t size) {
+  if (size < 12 || memcmp(file, "RIFF", 4) != 0 ||
+      memcmp(file + 8, "WAVE", 4) != 0) {
+    return false;
+  }
+  bool got_fmt = false;
+  size_t offset = 12;
+  while (offset + 8 <= size) {
+    const char* chunk = file + offset;
+    size_t chunk_size = ReadUint32(chunk + 4);
+    const char* body = chunk + 8;
+    size_t available = size - offset - 8;
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      if (chunk_size < 16 || chunk_size > available) return false;
+      uint16_t format = ReadUint16(body);
+      num_channel_ = ReadUint16(body + 2);
+      sample_rate_ = ReadUint32(body + 4);
+      uint16_t bits = ReadUint16(body + 14);
+      // PCM or WAVE_FORMAT_EXTENSIBLE
+      if ((format != 1 && format != 0xFFFE) || bits != 16 ||
+          num_channel_ <= 0 || sample_rate_ <= 0) {
+        return false;
+      }
+      got_fmt = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      // The size of a streamed wav may be unknown or too large
+      size_t data_size = std::min(chunk_size, available);
+      if (!got_fmt || offset % 2 != 0) return false;
+      data_ = reinterpret_cast<const int16_t*>(body);
+      num_samples_ = data_size / (sizeof(int16_t) * num_channel_);
+      return true;
+    }
+    // The chunks are padded to even size
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+  return false;
+}
+
+void MappedWavReader::Close() {
+#ifndef _WIN32
+  if (map_ != nullptr) munmap(map_, map_size_);
+#endif
+  map_ = nullptr;
+  map_size_ = 0;
+  buffer_.clear();
+  data_ = nullptr;
+  num_channel_ = sample_rate_ = num_samples_ = 0;
+}
+
+}  // namespace wenet
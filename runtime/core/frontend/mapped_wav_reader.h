@@ -0,0 +1,73 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_MAPPED_WAV_READER_H_
+#define FRONTEND_MAPPED_WAV_READER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// MappedWavReader maps a 16 bit PCM wav file into memory and exposes its
+// samples in place, so reading a file is one mmap instead of a read and a
+// conversion per sample as WavReader does. The samples are converted to
+// float only when they are fed to FeaturePipeline::AcceptWaveform, which
+// does it with the vectorized FbankKernels::int16_to_float. The chunks of
+// the header are validated against the size of the file. There is no
+// mmap on Windows, where the file is read at once instead.
+class MappedWavReader {
+ public:
+  MappedWavReader() = default;
+  explicit MappedWavReader(const std::string& filename) { Open(filename); }
+  ~MappedWavReader() { Close(); }
+
+  // Return false if the file can't be read, or is not a valid 16 bit PCM
+  // wav file, which WavReader may still read.
+  bool Open(const std::string& filename);
+  // Same as above, but the wav file is in `data`, which must outlive the
+  // reader
+  bool OpenBuffer(const char* data, size_t size);
+  void Close();
+
+  int num_channel() const { return num_channel_; }
+  int sample_rate() const { return sample_rate_; }
+  int bits_per_sample() const { return 16; }
+  // Sample points per channel
+  int num_samples() const { return num_samples_; }
+  // The interleaved samples of all the channels, valid until Close()
+  const int16_t* data() const { return data_; }
+
+ private:
+  bool Parse(const char* file, size_t size);
+
+  int num_channel_ = 0;
+  int sample_rate_ = 0;
+  int num_samples_ = 0;
+  const int16_t* data_ = nullptr;
+  void* map_ = nullptr;
+  size_t map_size_ = 0;
+  // The file content if it's not mapped
+  std::vector<char> buffer_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(MappedWavReader);
+};
+
+}  // namespace wenet
+
+#endif  // FRONTEND_MAPPED_WAV_READER_H_
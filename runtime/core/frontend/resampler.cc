@@ -0,0 +1,108 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include "frontend/fbank_kernels.h"
+#include "utils/log.h"
+
+namespace wenet {
+
+static int Gcd(int a, int b) { return b == 0 ? a : Gcd(b, a % b); }
+
+bool IsSupportedSampleRate(int64_t sample_rate) {
+  static const int64_t kRates[] = {8000,  11025, 12000, 16000, 22050,
+                                   24000, 32000, 44100, 48000};
+  return std::find(std::begin(kRates), std::end(kRates), sample_rate) !=
+         std::end(kRates);
+}
+
+Resampler::Resampler(int input_rate, int output_rate, int num_zeros)
+    : input_rate_(input_rate), output_rate_(output_rate) {
+  CHECK_GT(input_rate, 0);
+  CHECK_GT(output_rate, 0);
+  CHECK_GT(num_zeros, 0);
+  int g = Gcd(input_rate, output_rate);
+  up_ = output_rate / g;
+  down_ = input_rate / g;
+  // The cutoff frequency relative to the input nyquist, below the lower
+  // nyquist of the two, with some room for the transition band
+  const float kRolloff = 0.95f;
+  float cutoff = kRolloff * std::min(1.0f, static_cast<float>(up_) / down_);
+  int half = static_cast<int>(std::ceil(num_zeros / cutoff));
+  num_taps_ = 2 * half;
+  // Tap k of phase p is for the input sample k - half + 1 relative to
+  // floor(t), where the output sample is at t = floor(t) + p / up_
+  filters_.resize(up_ * num_taps_);
+  for (int p = 0; p < up_; ++p) {
+    float* filter = filters_.data() + p * num_taps_;
+    for (int k = 0; k < num_taps_; ++k) {
+      double d = k - half + 1 - static_cast<double>(p) / up_;
+      double x = cutoff * d;
+      double sinc = x == 0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+      // Hann window over [-half, half]
+      double w = 0.5 + 0.5 * std::cos(M_PI * d / half);
+      filter[k] = std::abs(d) >= half ? 0.0f : cutoff * sinc * w;
+    }
+  }
+  Reset();
+}
+
+void Resampler::Reset() {
+  // The silence before the start
+  buffer_.assign(num_taps_ / 2 - 1, 0.0f);
+  buffer_start_ = -(num_taps_ / 2 - 1);
+  num_input_ = 0;
+  num_output_ = 0;
+}
+
+void Resampler::Resample(const float* input, int size, bool flush,
+                         std::vector<float>* output) {
+  buffer_.insert(buffer_.end(), input, input + size);
+  num_input_ += size;
+  // The samples at t < num_input_ are all the output of the stream
+  int64_t end_output = (num_input_ * up_ + down_ - 1) / down_;
+  if (flush) {
+    buffer_.resize(buffer_.size() + num_taps_ / 2 + 1, 0.0f);
+  }
+  const FbankKernels& kernels = GetFbankKernels();
+  const int64_t buffer_end = buffer_start_ + buffer_.size();
+  while (num_output_ < end_output) {
+    int64_t t = num_output_ * down_;
+    int64_t first = t / up_ - (num_taps_ / 2 - 1);
+    if (first + num_taps_ > buffer_end) break;
+    int phase = t % up_;
+    output->push_back(kernels.dot(filters_.data() + phase * num_taps_,
+                                  buffer_.data() + (first - buffer_start_),
+                                  num_taps_));
+    ++num_output_;
+  }
+  if (flush) {
+    Reset();
+    return;
+  }
+  // Drop the input before the first tap of the next output
+  int64_t first = num_output_ * down_ / up_ - (num_taps_ / 2 - 1);
+  int64_t drop = std::min<int64_t>(first - buffer_start_, buffer_.size());
+  if (drop > 0) {
+    buffer_.erase(buffer_.begin(), buffer_.begin() + drop);
+    buffer_start_ += drop;
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,91 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_RESAMPLER_H_
+#define FRONTEND_RESAMPLER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "utils/state_io.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Streaming polyphase resampler of a rational ratio, e.g. 8k/48k to 16k.
+// With the ratio reduced to L/M, the output sample n is at n * M / L of
+// the input, whose fraction selects one of the L phases of a windowed sinc
+// lowpass filter, so each output sample is one dot product of K taps(see
+// FbankKernels::dot) instead of an upsampling by L and a downsampling by M.
+// The filter is centered on the output sample, so K / 2 input samples are
+// kept across the calls, the input before the start is taken as silence.
+class Resampler {
+ public:
+  // `num_zeros` zero crossings of the sinc on each side, more for the
+  // steeper filter
+  Resampler(int input_rate, int output_rate, int num_zeros = 16);
+
+  // Append the resampled `input` to `output`. When `flush`, the end of the
+  // input is padded with silence to output all the samples, which is the
+  // end of the stream.
+  void Resample(const float* input, int size, bool flush,
+                std::vector<float>* output);
+  void Reset();
+
+  // The input kept for the filter and the positions, the filters are of
+  // the rates of the constructor
+  void SaveState(StateWriter* writer) const {
+    writer->WriteVector(buffer_);
+    writer->Write(buffer_start_);
+    writer->Write(num_input_);
+    writer->Write(num_output_);
+  }
+  bool LoadState(StateReader* reader) {
+    return reader->ReadVector(&buffer_) && reader->Read(&buffer_start_) &&
+           reader->Read(&num_input_) && reader->Read(&num_output_);
+  }
+
+  int input_rate() const { return input_rate_; }
+  int output_rate() const { return output_rate_; }
+  int num_taps() const { return num_taps_; }
+
+ private:
+  int input_rate_;
+  int output_rate_;
+  // The reduced ratio L / M
+  int up_;
+  int down_;
+  int num_taps_;
+  // up_ phases of num_taps_ taps
+  std::vector<float> filters_;
+  // The input from sample buffer_start_, which is negative at the start
+  std::vector<float> buffer_;
+  int64_t buffer_start_ = 0;
+  int64_t num_input_ = 0;
+  // The next output sample
+  int64_t num_output_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Resampler);
+};
+
+// Whether the input sample rate of a client is accepted by the servers,
+// i.e. one of the common rates of 8k to 48k. The filters of any of them to
+// 16k are at most 160 phases of 44.1k, while an arbitrary rate, e.g. a
+// coprime one, takes as many phases as the output rate or more.
+bool IsSupportedSampleRate(int64_t sample_rate);
+
+}  // namespace wenet
+
+#endif  // FRONTEND_RESAMPLER_H_
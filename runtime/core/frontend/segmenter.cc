@@ -0,0 +1,96 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/segmenter.h"
+
+#include <algorithm>
+
+#include "frontend/fbank.h"
+
+namespace wenet {
+
+// Frames of the fbank computed at a time
+static const int kBlockFrames = 1000;
+
+std::vector<std::pair<int, int>> SplitBySilence(const float* data,
+                                                int num_samples,
+                                                int sample_rate,
+                                                const SegmenterOptions& opts) {
+  // 25ms frames of 10ms shift at the rate of the wave
+  const int frame_length = sample_rate * 25 / 1000;
+  const int frame_shift = sample_rate / 100;
+  const int min_segment = opts.min_segment_ms / 10;
+  const int max_segment = std::max(opts.max_segment_ms / 10, min_segment);
+  const int min_silence = std::max(opts.min_silence_ms / 10, 1);
+  std::vector<std::pair<int, int>> segments;
+  if (num_samples < frame_length || max_segment <= 0) {
+    segments.emplace_back(0, num_samples);
+    return segments;
+  }
+  const int num_frames = 1 + (num_samples - frame_length) / frame_shift;
+
+  Fbank fbank(opts.num_bins, sample_rate, frame_length, frame_shift);
+  Vad vad(opts.vad_opts);
+  std::vector<float> wave;
+  std::vector<std::vector<float>> feats;
+  int begin = 0;  // the first frame of the segment
+  int run = -1;   // the first frame of the current silence, -1 for none
+  // The middle of the longest silence in the segment, for max_segment
+  int best_cut = -1, best_length = 0;
+  auto cut = [&](int frame) {
+    segments.emplace_back(begin * frame_shift, frame * frame_shift);
+    begin = frame;
+    best_cut = -1;
+    best_length = 0;
+  };
+  for (int t = 0; t < num_frames; t += kBlockFrames) {
+    int block_frames = std::min(kBlockFrames, num_frames - t);
+    const float* block = data + t * frame_shift;
+    wave.assign(block, block + (block_frames - 1) * frame_shift + frame_length);
+    fbank.Compute(wave, &feats);
+    for (int i = 0; i < block_frames; ++i) {
+      int frame = t + i;
+      bool silent = vad.IsSilence(feats[i].data(), opts.num_bins);
+      if (silent && run < 0) {
+        run = frame;
+      } else if (!silent && run >= 0) {
+        // A silence of [run, frame) ends
+        int middle = (run + frame) / 2;
+        int length = frame - run;
+        run = -1;
+        if (middle > begin && length >= min_silence &&
+            middle - begin >= min_segment) {
+          cut(middle);
+        } else if (middle > begin && length > best_length) {
+          best_cut = middle;
+          best_length = length;
+        }
+      }
+      if (frame - begin >= max_segment) {
+        // The silence going on counts as the one till now
+        int middle = (run + frame) / 2;
+        if (run >= 0 && frame - run > best_length && middle > begin) {
+          best_cut = middle;
+          best_length = frame - run;
+        }
+        cut(best_cut > begin ? best_cut : frame);
+        if (run >= 0) run = std::max(run, begin);
+      }
+    }
+  }
+  segments.emplace_back(begin * frame_shift, num_samples);
+  return segments;
+}
+
+}  // namespace wenet
@@ -0,0 +1,47 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_SEGMENTER_H_
+#define FRONTEND_SEGMENTER_H_
+
+#include <utility>
+#include <vector>
+
+#include "frontend/vad.h"
+
+namespace wenet {
+
+struct SegmenterOptions {
+  int num_bins = 80;
+  // A segment ends at the middle of the first silence of at least
+  // min_silence_ms after min_segment_ms, or at max_segment_ms anyway, where
+  // it's cut at the longest silence in it if there is one
+  int min_segment_ms = 10000;
+  int max_segment_ms = 30000;
+  int min_silence_ms = 300;
+  VadOptions vad_opts;
+};
+
+// Split a long wave at the silences by the Vad into the segments, which
+// are decoded independently, e.g. in parallel. The fbank of the Vad is
+// computed block by block, so the memory doesn't grow with the wave.
+// Return the [begin, end) samples of the segments, which cover the wave.
+std::vector<std::pair<int, int>> SplitBySilence(const float* data,
+                                                int num_samples,
+                                                int sample_rate,
+                                                const SegmenterOptions& opts);
+
+}  // namespace wenet
+
+#endif  // FRONTEND_SEGMENTER_H_
@@ -0,0 +1,272 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/shard_reader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#include "frontend/fbank_kernels.h"
+#include "frontend/mapped_wav_reader.h"
+#include "utils/log.h"
+#include "utils/string.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+namespace wenet {
+
+static const size_t kTarBlockSize = 512;
+// The buffer of the shard stream, a few big reads per shard
+static const size_t kStreamBufferSize = 1 << 20;
+
+static bool IsUrl(const std::string& shard) {
+  return shard.compare(0, 7, "http://") == 0 ||
+         shard.compare(0, 8, "https://") == 0;
+}
+
+// The numeric fields of the tar header are octal strings
+static size_t ParseOctal(const char* p, size_t size) {
+  size_t value = 0;
+  for (size_t i = 0; i < size && p[i] != '\0'; ++i) {
+    if (p[i] >= '0' && p[i] <= '7') value = value * 8 + (p[i] - '0');
+  }
+  return value;
+}
+
+// Return the "path" record of the pax extended header, or empty
+static std::string ParsePaxPath(const std::string& records) {
+  // Each record is "%d %s=%s\n", of which the number is the record length
+  size_t offset = 0;
+  while (offset < records.size()) {
+    size_t length = strtoul(records.c_str() + offset, nullptr, 10);
+    if (length == 0 || offset + length > records.size()) break;
+    size_t space = records.find(' ', offset);
+    size_t equal = records.find('=', offset);
+    if (space < equal && equal < offset + length &&
+        records.compare(space + 1, equal - space - 1, "path") == 0) {
+      return records.substr(equal + 1, offset + length - equal - 2);
+    }
+    offset += length;
+  }
+  return "";
+}
+
+static bool ReadFully(FILE* fp, char* data, size_t size) {
+  return fread(data, 1, size, fp) == size;
+}
+
+static bool SkipFully(FILE* fp, size_t size) {
+  char buffer[kTarBlockSize * 8];
+  while (size > 0) {
+    size_t n = std::min(size, sizeof(buffer));
+    if (fread(buffer, 1, n, fp) != n) return false;
+    size -= n;
+  }
+  return true;
+}
+
+ShardReader::ShardReader(const std::vector<std::string>& shards,
+                         int read_ahead)
+    : shards_(shards), read_ahead_(std::max(read_ahead, 1)) {
+  thread_ = std::thread(&ShardReader::ReadLoop, this);
+}
+
+ShardReader::~ShardReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  not_full_.notify_all();
+  thread_.join();
+}
+
+std::vector<std::string> ShardReader::ReadShardList(
+    const std::string& filename) {
+  std::vector<std::string> shards;
+  std::ifstream is(filename);
+  if (!is) LOG(FATAL) << "Error in open " << filename;
+  std::string line;
+  while (std::getline(is, line)) {
+    line = Trim(line);
+    if (!line.empty()) shards.emplace_back(std::move(line));
+  }
+  return shards;
+}
+
+bool ShardReader::Next(ShardSample* sample) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_empty_.wait(lock, [this] { return !queue_.empty() || done_; });
+  if (queue_.empty()) return false;
+  *sample = std::move(queue_.front());
+  queue_.pop_front();
+  lock.unlock();
+  not_full_.notify_one();
+  return true;
+}
+
+bool ShardReader::Push(ShardSample* sample) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_full_.wait(lock, [this] { return queue_.size() < read_ahead_ || stop_; });
+  if (stop_) return false;
+  queue_.emplace_back(std::move(*sample));
+  lock.unlock();
+  not_empty_.notify_one();
+  return true;
+}
+
+void ShardReader::ReadLoop() {
+  for (const auto& shard : shards_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) break;
+    }
+    ReadShard(shard);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+  }
+  not_empty_.notify_all();
+}
+
+void ShardReader::ReadShard(const std::string& shard) {
+  bool url = IsUrl(shard);
+  FILE* fp = nullptr;
+  if (url) {
+    // The same way as the url_opener of wenet/dataset/processor.py
+    std::string command = "curl -s -L '" + shard + "'";
+    fp = popen(command.c_str(), "r");
+  } else {
+    std::string path = shard;
+    if (path.compare(0, 7, "file://") == 0) path = path.substr(7);
+    fp = fopen(path.c_str(), "rb");
+  }
+  if (fp == nullptr) {
+    LOG(WARNING) << "Error in open shard " << shard;
+    return;
+  }
+  std::vector<char> buffer(kStreamBufferSize);
+  setvbuf(fp, buffer.data(), _IOFBF, buffer.size());
+  ReadTar(fp, shard);
+  if (url) {
+    pclose(fp);
+  } else {
+    fclose(fp);
+  }
+}
+
+void ShardReader::ReadTar(FILE* fp, const std::string& shard) {
+  ShardSample sample;
+  bool has_wav = false;
+  std::string long_name;
+  std::vector<char> data;
+  MappedWavReader wav_reader;
+  char header[kTarBlockSize];
+  // Emit the grouped entries of the previous key
+  auto flush = [&]() {
+    bool ok = true;
+    if (has_wav) {
+      ok = Push(&sample);
+    } else if (!sample.key.empty()) {
+      LOG(WARNING) << "No wav for " << sample.key << " in " << shard;
+    }
+    sample = ShardSample();
+    has_wav = false;
+    return ok;
+  };
+
+  while (ReadFully(fp, header, kTarBlockSize)) {
+    // The end of the archive is marked by zero blocks
+    if (header[0] == '\0') break;
+    size_t size = ParseOctal(header + 124, 12);
+    size_t padded = (size + kTarBlockSize - 1) / kTarBlockSize * kTarBlockSize;
+    char type = header[156];
+    if (type == 'L' || type == 'x') {
+      // The GNU long name, or the pax header, of the next entry
+      std::string records(size, '\0');
+      if (!ReadFully(fp, &records[0], size) || !SkipFully(fp, padded - size)) {
+        break;
+      }
+      if (type == 'L') {
+        long_name = records.c_str();
+      } else {
+        std::string path = ParsePaxPath(records);
+        if (!path.empty()) long_name = path;
+      }
+      continue;
+    }
+    if (type != '0' && type != '\0') {
+      // Directories, links and the global pax headers
+      if (!SkipFully(fp, padded)) break;
+      continue;
+    }
+    std::string name;
+    if (!long_name.empty()) {
+      name.swap(long_name);
+    } else {
+      name.assign(header, strnlen(header, 100));
+      // The ustar prefix of the name
+      if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+        name = std::string(header + 345, strnlen(header + 345, 155)) + "/" +
+               name;
+      }
+    }
+
+    data.resize(padded);
+    if (!ReadFully(fp, data.data(), padded)) {
+      LOG(WARNING) << "Truncated shard " << shard;
+      break;
+    }
+    size_t pos = name.rfind('.');
+    if (pos == std::string::npos) continue;
+    std::string key = name.substr(0, pos);
+    std::string suffix = name.substr(pos + 1);
+    if (key != sample.key) {
+      if (!flush()) return;
+      sample.key = key;
+    }
+    if (suffix == "txt") {
+      sample.txt = Trim(std::string(data.data(), size));
+    } else if (suffix == "wav") {
+      if (!wav_reader.OpenBuffer(data.data(), size)) {
+        LOG(WARNING) << name << " in " << shard
+                     << " is not a 16 bit PCM wav file";
+        continue;
+      }
+      // Only the first channel is decoded
+      int num_samples = wav_reader.num_samples();
+      int num_channel = wav_reader.num_channel();
+      sample.sample_rate = wav_reader.sample_rate();
+      sample.wav.resize(num_samples);
+      if (num_channel == 1) {
+        GetFbankKernels().int16_to_float(wav_reader.data(), sample.wav.data(),
+                                         num_samples);
+      } else {
+        for (int i = 0; i < num_samples; ++i) {
+          sample.wav[i] = wav_reader.data()[i * num_channel];
+        }
+      }
+      has_wav = true;
+    }
+  }
+  flush();
+}
+
+}  // namespace wenet
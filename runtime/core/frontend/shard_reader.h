@@ -0,0 +1,83 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_SHARD_READER_H_
+#define FRONTEND_SHARD_READER_H_
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// One utterance of a shard, the entries of the same key in the tar file,
+// e.g. BAC009S0002W0122.wav and BAC009S0002W0122.txt
+struct ShardSample {
+  std::string key;
+  std::string txt;
+  int sample_rate = 0;
+  std::vector<float> wav;
+};
+
+// ShardReader streams the utterances of the tar shards made by
+// tools/make_shard_list.py, as wenet/dataset/processor.py does for the
+// training, so millions of utterances are read by a few sequential reads
+// instead of opening millions of small files. A shard is a local tar file
+// or an url which is read by `curl -s -L`. The shards are read and the
+// 16 bit PCM wavs are decoded by a background thread, which stays up to
+// `read_ahead` utterances ahead of the consumer.
+class ShardReader {
+ public:
+  explicit ShardReader(const std::vector<std::string>& shards,
+                       int read_ahead = 64);
+  ~ShardReader();
+
+  // Blocking until the next utterance is read, return false at the end of
+  // all the shards
+  bool Next(ShardSample* sample);
+
+  // Read the shard list file, a tar file or an url per line
+  static std::vector<std::string> ReadShardList(const std::string& filename);
+
+ private:
+  void ReadLoop();
+  void ReadShard(const std::string& shard);
+  // Read the tar stream and group its entries by key
+  void ReadTar(FILE* fp, const std::string& shard);
+  // Return false if it's stopped
+  bool Push(ShardSample* sample);
+
+  std::vector<std::string> shards_;
+  size_t read_ahead_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<ShardSample> queue_;
+  bool done_ = false;
+  bool stop_ = false;
+  std::thread thread_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ShardReader);
+};
+
+}  // namespace wenet
+
+#endif  // FRONTEND_SHARD_READER_H_
@@ -0,0 +1,60 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/vad.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace wenet {
+
+bool Vad::IsSilence(const float* fbank, int dim) {
+  // log(sum(exp(x))) and the mean of x
+  float max_value = *std::max_element(fbank, fbank + dim);
+  float sum = 0;
+  float mean = 0;
+  for (int i = 0; i < dim; ++i) {
+    sum += std::exp(fbank[i] - max_value);
+    mean += fbank[i];
+  }
+  mean /= dim;
+  float energy = max_value + std::log(sum);
+  float log_flatness = mean - (energy - std::log(static_cast<float>(dim)));
+
+  if (num_frames_ == 0 || energy < noise_floor_) {
+    noise_floor_ = energy;
+  } else {
+    noise_floor_ += opts_.floor_rise * (energy - noise_floor_);
+  }
+  bool speech = energy > noise_floor_ + opts_.energy_threshold &&
+                log_flatness < opts_.log_flatness;
+  ++num_frames_;
+  if (speech) {
+    hangover_ = opts_.hangover_frames;
+    return false;
+  }
+  if (hangover_ > 0) {
+    --hangover_;
+    return false;
+  }
+  return num_frames_ > opts_.hangover_frames;
+}
+
+void Vad::Reset() {
+  num_frames_ = 0;
+  noise_floor_ = 0;
+  hangover_ = 0;
+}
+
+}  // namespace wenet
@@ -0,0 +1,72 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_VAD_H_
+#define FRONTEND_VAD_H_
+
+#include "utils/state_io.h"
+
+namespace wenet {
+
+struct VadOptions {
+  // A frame is speech if its log energy is energy_threshold above the noise
+  // floor, about 10dB by default, and its mel spectrum is not as flat as
+  // noise, i.e. log(geometric mean / arithmetic mean) < log_flatness. It's
+  // about -2.4 for white noise and below -4 for voiced speech on 80 bins.
+  float energy_threshold = 2.3;
+  float log_flatness = -3.0;
+  // The noise floor follows the minimum of the energy, and rises by this
+  // rate toward the energy of each frame, so it adapts to the noise level
+  float floor_rise = 0.002;
+  // The frames kept as speech after the last speech frame, and at the start
+  // before the noise floor is known
+  int hangover_frames = 30;
+};
+
+// Vad is a streaming energy and spectral flatness voice activity detector
+// on the log mel fbank frames, which are already computed by the
+// FeaturePipeline, so it costs a pass over each frame. It's meant to find
+// the long silence of which the encoder forward can be skipped, see
+// FeaturePipeline::last_read_silent(), the frames are rather marked as
+// speech if in doubt.
+class Vad {
+ public:
+  explicit Vad(const VadOptions& opts = VadOptions()) : opts_(opts) {}
+
+  // Return true if the frame of `dim` log mel energies is silence
+  bool IsSilence(const float* fbank, int dim);
+  void Reset();
+
+  // The noise floor tracked so far, see FeaturePipeline::SaveState
+  void SaveState(StateWriter* writer) const {
+    writer->Write(num_frames_);
+    writer->Write(noise_floor_);
+    writer->Write(hangover_);
+  }
+  bool LoadState(StateReader* reader) {
+    return reader->Read(&num_frames_) && reader->Read(&noise_floor_) &&
+           reader->Read(&hangover_);
+  }
+
+ private:
+  VadOptions opts_;
+  int num_frames_ = 0;
+  float noise_floor_ = 0;
+  // The frames to be kept as speech
+  int hangover_ = 0;
+};
+
+}  // namespace wenet
+
+#endif  // FRONTEND_VAD_H_
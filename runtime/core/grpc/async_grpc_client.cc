@@ -0,0 +1,177 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "grpc/async_grpc_client.h"
+
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+AsyncGrpcClient::AsyncGrpcClient(ASR::Stub* stub, CompletionQueue* cq,
+                                 int nbest, bool continuous_decoding,
+                                 LoadStreamListener* listener)
+    : stub_(stub),
+      cq_(cq),
+      nbest_(nbest),
+      continuous_decoding_(continuous_decoding),
+      listener_(listener) {}
+
+void AsyncGrpcClient::Poll(CompletionQueue* cq) {
+  void* tag = nullptr;
+  bool ok = false;
+  while (cq->Next(&tag, &ok)) {
+    Tag* t = static_cast<Tag*>(tag);
+    t->client->Proceed(t->op, ok);
+  }
+}
+
+void AsyncGrpcClient::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  self_ = shared_from_this();
+  stream_ = stub_->PrepareAsyncRecognize(&context_, cq_);
+  stream_->StartCall(&start_tag_);
+  ++num_pending_ops_;
+}
+
+void AsyncGrpcClient::SendAudio(const int16_t* data, size_t size) {
+  Request request;
+  request.set_audio_data(data, size * sizeof(int16_t));
+  std::lock_guard<std::mutex> lock(mutex_);
+  Write(request);
+}
+
+void AsyncGrpcClient::SendEnd() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (done_ || end_pending_) return;
+  end_pending_ = true;
+  if (writes_.empty()) {
+    stream_->WritesDone(&writes_done_tag_);
+    ++num_pending_ops_;
+  }
+}
+
+void AsyncGrpcClient::Write(const Request& request) {
+  if (done_ || end_pending_) return;
+  writes_.push_back(request);
+  if (started_ && writes_.size() == 1) {
+    stream_->Write(writes_.front(), &write_tag_);
+    ++num_pending_ops_;
+  }
+}
+
+void AsyncGrpcClient::Proceed(Op op, bool ok) {
+  std::shared_ptr<AsyncGrpcClient> self;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --num_pending_ops_;
+    switch (op) {
+      case kStart:
+        if (!ok) {
+          // The call is dead, get its status
+          stream_->Finish(&status_, &finish_tag_);
+          ++num_pending_ops_;
+          break;
+        }
+        started_ = true;
+        {
+          Request request;
+          request.mutable_decode_config()->set_nbest_config(nbest_);
+          request.mutable_decode_config()->set_continuous_decoding_config(
+              continuous_decoding_);
+          writes_.push_front(request);
+          stream_->Write(writes_.front(), &write_tag_);
+          ++num_pending_ops_;
+        }
+        stream_->Read(&response_, &read_tag_);
+        ++num_pending_ops_;
+        break;
+      case kRead:
+        if (ok) {
+          OnRead();
+          stream_->Read(&response_, &read_tag_);
+          ++num_pending_ops_;
+        } else {
+          // The server has finished the stream
+          stream_->Finish(&status_, &finish_tag_);
+          ++num_pending_ops_;
+        }
+        break;
+      case kWrite:
+        if (!ok) {
+          // The stream is broken, the read will fail and finish it
+          writes_.clear();
+          break;
+        }
+        writes_.pop_front();
+        if (!writes_.empty()) {
+          stream_->Write(writes_.front(), &write_tag_);
+          ++num_pending_ops_;
+        } else if (end_pending_) {
+          stream_->WritesDone(&writes_done_tag_);
+          ++num_pending_ops_;
+        }
+        break;
+      case kWritesDone:
+        break;
+      case kFinish:
+        finished_ = true;
+        if (!status_.ok()) {
+          Fail(status_.error_message());
+        } else {
+          Fail("finished before speech end");
+        }
+        break;
+    }
+    if (finished_ && num_pending_ops_ == 0) {
+      // Release self after the lock is released
+      self = std::move(self_);
+    }
+  }
+}
+
+void AsyncGrpcClient::OnRead() {
+  if (done_) return;
+  if (response_.status() != Response::ok) {
+    Fail("status not ok");
+    context_.TryCancel();
+    return;
+  }
+  switch (response_.type()) {
+    case Response::server_ready:
+      listener_->OnReady();
+      break;
+    case Response::partial_result:
+      listener_->OnPartial();
+      break;
+    case Response::final_result:
+      listener_->OnFinal();
+      break;
+    case Response::speech_end:
+      done_ = true;
+      listener_->OnDone(true, "");
+      break;
+    default:
+      break;
+  }
+}
+
+void AsyncGrpcClient::Fail(const std::string& error) {
+  if (done_) return;
+  done_ = true;
+  listener_->OnDone(false, error);
+}
+
+}  // namespace wenet
@@ -0,0 +1,103 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GRPC_ASYNC_GRPC_CLIENT_H_
+#define GRPC_ASYNC_GRPC_CLIENT_H_
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <grpcpp/grpcpp.h>
+
+#include "utils/load_generator.h"
+#include "utils/utils.h"
+
+#include "grpc/wenet.grpc.pb.h"
+
+namespace wenet {
+
+using grpc::ClientAsyncReaderWriter;
+using grpc::ClientContext;
+using grpc::CompletionQueue;
+using wenet::ASR;
+using wenet::Request;
+using wenet::Response;
+
+// A Recognize stream of the load test. It speaks the protocol of
+// GrpcClient, but is driven by the events of a completion queue shared by
+// many clients, so no thread is pinned to the stream. It keeps itself alive
+// until the stream is finished.
+class AsyncGrpcClient : public LoadStream,
+                        public std::enable_shared_from_this<AsyncGrpcClient> {
+ public:
+  AsyncGrpcClient(ASR::Stub* stub, CompletionQueue* cq, int nbest,
+                  bool continuous_decoding, LoadStreamListener* listener);
+
+  enum Op { kStart = 0, kRead, kWrite, kWritesDone, kFinish };
+  struct Tag {
+    AsyncGrpcClient* client;
+    Op op;
+  };
+  // Called by the completion queue thread
+  void Proceed(Op op, bool ok);
+  // Run the events of `cq` until it's shut down
+  static void Poll(CompletionQueue* cq);
+
+  void Start() override;
+  void SendAudio(const int16_t* data, size_t size) override;
+  void SendEnd() override;
+  void Cancel() override { context_.TryCancel(); }
+
+ private:
+  // With mutex_ held
+  void Write(const Request& request);
+  void OnRead();
+  void Fail(const std::string& error);
+
+  ASR::Stub* stub_;
+  CompletionQueue* cq_;
+  int nbest_;
+  bool continuous_decoding_;
+  LoadStreamListener* listener_;
+
+  std::mutex mutex_;
+  ClientContext context_;
+  std::unique_ptr<ClientAsyncReaderWriter<Request, Response>> stream_;
+  Response response_;
+  grpc::Status status_;
+  // Pending requests, the front one is in flight
+  std::deque<Request> writes_;
+  bool started_ = false;
+  bool end_pending_ = false;
+  bool done_ = false;
+  bool finished_ = false;
+  int num_pending_ops_ = 0;
+  // Released when the stream is finished and no op is pending
+  std::shared_ptr<AsyncGrpcClient> self_;
+
+  Tag start_tag_{this, kStart};
+  Tag read_tag_{this, kRead};
+  Tag write_tag_{this, kWrite};
+  Tag writes_done_tag_{this, kWritesDone};
+  Tag finish_tag_{this, kFinish};
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AsyncGrpcClient);
+};
+
+}  // namespace wenet
+
+#endif  // GRPC_ASYNC_GRPC_CLIENT_H_
@@ -0,0 +1,510 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "grpc/async_grpc_server.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <grpc/compression.h>
+#include <grpc/slice.h>
+
+#include "frontend/resampler.h"
+#include "utils/load_monitor.h"
+#include "utils/trace.h"
+
+namespace wenet {
+
+// Compress the responses of the stream by the `name` of the algorithm,
+// return false if it's unknown
+static bool SetCompression(const std::string& name, ServerContext* context) {
+  if (name.empty()) return true;
+  grpc_compression_algorithm algorithm;
+  if (!grpc_compression_algorithm_parse(
+          grpc_slice_from_static_buffer(name.data(), name.size()),
+          &algorithm)) {
+    return false;
+  }
+  context->set_compression_algorithm(algorithm);
+  return true;
+}
+
+AsyncRecognizeCall::AsyncRecognizeCall(
+    AsyncAsrService* service, ServerCompletionQueue* cq,
+    std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeOptions> decode_config,
+    std::shared_ptr<ResourceRegistry> resources,
+    std::shared_ptr<ThreadPool> decode_pool,
+    std::shared_ptr<SessionPool> session_pool,
+    std::shared_ptr<AdmissionController> admission)
+    : service_(service),
+      cq_(cq),
+      feature_config_(std::move(feature_config)),
+      decode_config_(std::move(decode_config)),
+      resources_(std::move(resources)),
+      decode_pool_(std::move(decode_pool)),
+      session_pool_(std::move(session_pool)),
+      admission_(std::move(admission)),
+      stream_(&ctx_),
+      deadline_(decode_config_->chunk_deadline_ms) {
+  service_->RequestRecognize(&ctx_, &stream_, cq_, cq_, &connect_tag_);
+}
+
+void AsyncRecognizeCall::Proceed(Op op, bool ok) {
+  switch (op) {
+    case kConnect:
+      OnConnect(ok);
+      break;
+    case kRead:
+      OnRead(ok);
+      break;
+    case kWrite:
+      OnWrite(ok);
+      break;
+    case kFinish:
+      // The decode task still running, if any, deletes it
+      Unref();
+      break;
+  }
+}
+
+void AsyncRecognizeCall::OnConnect(bool ok) {
+  if (!ok) {
+    // The server is shutting down
+    Unref();
+    return;
+  }
+  LOG(INFO) << "Get Recognize request";
+  // Wait for the next stream
+  new AsyncRecognizeCall(service_, cq_, feature_config_, decode_config_,
+                         resources_, decode_pool_, session_pool_, admission_);
+  stream_.Read(&request_, &read_tag_);
+}
+
+void AsyncRecognizeCall::OnRead(bool ok) {
+  if (!ok) {
+    // The client is done with writing or the stream is broken
+    LOG(INFO) << "Read all pcm data, wait for decoding";
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      reading_done_ = true;
+      if (decoder_ == nullptr) decode_done_ = true;
+    }
+    if (feature_pipeline_ != nullptr) {
+      feature_pipeline_->set_input_finished();
+      ScheduleDecode();
+    }
+    MaybeFinish();
+    return;
+  }
+  if (!got_start_tag_) {
+    nbest_ = request_.decode_config().nbest_config();
+    continuous_decoding_ =
+        request_.decode_config().continuous_decoding_config();
+    const auto& config = request_.decode_config();
+    std::string audio_format = config.audio_format_config();
+    if (audio_format.empty()) audio_format = "pcm";
+    std::string error;
+    if (!config.feature_format_config().empty()) {
+      feature_decoder_ = CreateFeatureDecoder(
+          config.feature_format_config(), *feature_config_,
+          config.num_bins_config(), config.frame_shift_ms_config(), &error);
+    }
+    int sample_rate = config.sample_rate_config();
+    bool supported = IsSupportedAudioFormat(audio_format) &&
+                     (config.feature_format_config().empty() ||
+                      feature_decoder_ != nullptr) &&
+                     (sample_rate == 0 || IsSupportedSampleRate(sample_rate));
+    if (!supported) {
+      LOG(ERROR) << "Unsupported audio format " << audio_format
+                 << ", features " << config.feature_format_config()
+                 << " or sample rate " << sample_rate;
+      Response* response = NewResponse();
+      response->set_status(Response::failed);
+      response->set_message(error);
+      Send(response);
+      // Stop reading, the stream is finished after the response is written
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reading_done_ = true;
+        decode_done_ = true;
+      }
+      MaybeFinish();
+      return;
+    }
+    std::string reason;
+    ticket_ = admission_->Admit(config.tenant_config(), &reason);
+    if (ticket_ == nullptr) {
+      LOG(WARNING) << "Reject the stream, " << reason;
+      OnReject(Response::rejected, reason,
+               Status(grpc::StatusCode::RESOURCE_EXHAUSTED, reason));
+      return;
+    }
+    // The decoding is not started yet
+    deadline_.set_group(ticket_->tenant());
+    audio_decoder_ =
+        CreateAudioDecoder(audio_format, feature_config_->sample_rate);
+    // Before the initial metadata is sent with the first response
+    if (!SetCompression(config.compression_config(), &ctx_)) {
+      LOG(WARNING) << "Unsupported compression " << config.compression_config()
+                   << ", the responses are not compressed";
+    }
+    sample_rate_ = request_.decode_config().sample_rate_config();
+    partial_interval_ms_ =
+        std::max(request_.decode_config().partial_interval_ms_config(), 0);
+    OnSpeechStart();
+  } else if (feature_decoder_ != nullptr) {
+    // The frames computed by the client, the broken ones are dropped
+    const std::string& feats = request_.audio_data();
+    feats_.clear();
+    if (!feature_decoder_->Decode(feats.data(), feats.size(), &feats_)) {
+      LOG(WARNING) << "Drop the audio_data of partial feature frames";
+    } else if (!overloaded_) {
+      int num_frames = feats_.size() / feature_decoder_->feature_dim();
+      VLOG(2) << "Received " << num_frames << " frames";
+      feature_pipeline_->AcceptFeatures(feats_.data(), num_frames);
+      if (admission_->Overloaded(feature_pipeline_->NumQueuedFrames())) {
+        LOG(WARNING) << "Decoding falls behind, terminate the stream";
+        overloaded_ = true;
+      }
+      ScheduleDecode();
+    }
+  } else {
+    // Read binary PCM data
+    const std::string& audio = request_.audio_data();
+    const int16_t* pcm_data = reinterpret_cast<const int16_t*>(audio.c_str());
+    int num_samples = audio.length() / sizeof(int16_t);
+    if (audio_decoder_ != nullptr) {
+      // Or one packet of the compressed audio
+      pcm_.clear();
+      audio_decoder_->Decode(audio.data(), audio.size(), &pcm_);
+      pcm_data = pcm_.data();
+      num_samples = pcm_.size();
+    }
+    VLOG(2) << "Received " << num_samples << " samples";
+    if (!overloaded_) {
+      feature_pipeline_->AcceptWaveform(pcm_data, num_samples);
+      if (admission_->Overloaded(feature_pipeline_->NumQueuedFrames())) {
+        LOG(WARNING) << "Decoding falls behind, terminate the stream";
+        overloaded_ = true;
+      }
+      ScheduleDecode();
+    }
+  }
+  stream_.Read(&request_, &read_tag_);
+}
+
+void AsyncRecognizeCall::OnWrite(bool ok) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The written response and the dropped ones are reused, the repeated
+    // fields are cleared but kept
+    size_t num_done = ok ? 1 : write_queue_.size();
+    if (!ok) {
+      // The stream is broken, drop all the pending responses
+      write_failed_ = true;
+    }
+    for (size_t i = 0; i < num_done; ++i) {
+      write_queue_.front()->Clear();
+      free_responses_.push_back(write_queue_.front());
+      write_queue_.pop_front();
+    }
+    if (write_queue_.empty()) {
+      writing_ = false;
+    } else {
+      stream_.Write(*write_queue_.front(), &write_tag_);
+      return;
+    }
+  }
+  MaybeFinish();
+}
+
+void AsyncRecognizeCall::OnSpeechStart() {
+  LOG(INFO) << "Received speech start signal, start reading speech";
+  got_start_tag_ = true;
+  Response* response = NewResponse();
+  response->set_status(Response::ok);
+  response->set_type(Response::server_ready);
+  Send(response);
+  session_ = session_pool_->Acquire(resources_->Get());
+  feature_pipeline_ = session_->feature_pipeline;
+  // The compressed audio is decoded at the sample rate of the model
+  bool resample = sample_rate_ > 0 && audio_decoder_ == nullptr;
+  feature_pipeline_->set_input_sample_rate(
+      resample ? sample_rate_ : feature_config_->sample_rate);
+  decoder_ = session_->decoder;
+  decoder_->set_trace_id(Tracer::Instance().NewSessionId());
+  decoder_->set_partial_nbest(nbest_);
+  coalescer_ = std::make_unique<PartialCoalescer>(nbest_, partial_interval_ms_);
+}
+
+void AsyncRecognizeCall::OnReject(Response::Type type,
+                                  const std::string& message,
+                                  const Status& status) {
+  Response* response = NewResponse();
+  response->set_status(Response::failed);
+  response->set_type(type);
+  response->set_message(message);
+  Send(response);
+  // Stop reading, the stream is finished after the response is written
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reading_done_ = true;
+    decode_done_ = true;
+    finish_status_ = status;
+  }
+  MaybeFinish();
+}
+
+Response* AsyncRecognizeCall::NewResponse() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_responses_.empty()) {
+    return google::protobuf::Arena::CreateMessage<Response>(&arena_);
+  }
+  Response* response = free_responses_.back();
+  free_responses_.pop_back();
+  return response;
+}
+
+void AsyncRecognizeCall::Send(Response* response) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (write_failed_) {
+    response->Clear();
+    free_responses_.push_back(response);
+    return;
+  }
+  write_queue_.push_back(response);
+  // Only one write is allowed to be outstanding at the same time
+  if (!writing_) {
+    writing_ = true;
+    stream_.Write(*write_queue_.front(), &write_tag_);
+  }
+}
+
+void AsyncRecognizeCall::SerializeResult(bool finish, Response* response) {
+  for (const DecodeResult& path : decoder_->result()) {
+    Response_OneBest* one_best_ = response->add_nbest();
+    one_best_->set_sentence(path.sentence);
+    if (finish) {
+      for (const WordPiece& word_piece : path.word_pieces) {
+        Response_OnePiece* one_piece_ = one_best_->add_wordpieces();
+        one_piece_->set_word(word_piece.word);
+        one_piece_->set_start(word_piece.start);
+        one_piece_->set_end(word_piece.end);
+      }
+    }
+    if (response->nbest_size() == nbest_) {
+      break;
+    }
+  }
+}
+
+void AsyncRecognizeCall::ScheduleDecode() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (decode_done_) return;
+    deadline_.OnAudio();
+    if (decoding_) {
+      // DecodeFunc is running, let it check the new data again
+      decode_pending_ = true;
+      return;
+    }
+    decoding_ = true;
+  }
+  // The chunks of the streams are decoded before the offline batches. The
+  // task holds a reference until DecodeFunc returns, so the call outlives
+  // the finish of the stream by the completion queue thread.
+  Ref();
+  deadline_.Post(decode_pool_.get(), [this] { DecodeFunc(); });
+}
+
+void AsyncRecognizeCall::DecodeFunc() {
+  bool stop_recognition = false;
+  while (true) {
+    bool second_pass = false;
+    bool late = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      decode_pending_ = false;
+      late = deadline_.Take();
+    }
+    try {
+      decoder_->set_late(late);
+      while (!stop_recognition) {
+        if (overloaded_) {
+          Response* response = NewResponse();
+          response->set_status(Response::failed);
+          response->set_type(Response::overloaded);
+          response->set_message("server overloaded, too many queued frames");
+          Send(response);
+          stop_recognition = true;
+          break;
+        }
+        DecodeState state = decoder_->Decode(false);
+        if (state == DecodeState::kWaitFeats) {
+          second_pass = decoder_->SecondPassDue();
+          break;
+        }
+        if (state == DecodeState::kEndFeats) {
+          decoder_->Rescoring();
+          Response* response = NewResponse();
+          response->set_status(Response::ok);
+          SerializeResult(true, response);
+          response->set_type(Response::final_result);
+          Send(response);
+          stop_recognition = true;
+        } else if (state == DecodeState::kEndpoint) {
+          decoder_->Rescoring();
+          Response* response = NewResponse();
+          response->set_status(Response::ok);
+          SerializeResult(true, response);
+          response->set_type(Response::final_result);
+          Send(response);
+          // If it's not continuous decoding, continue to do next recognition
+          // otherwise stop the recognition
+          if (continuous_decoding_) {
+            decoder_->ResetContinuousDecoding();
+            coalescer_->Reset();
+          } else {
+            stop_recognition = true;
+          }
+        } else if (decoder_->DecodedSomething() &&
+                   coalescer_->ShouldSend(decoder_->result())) {
+          Response* response = NewResponse();
+          response->set_status(Response::ok);
+          SerializeResult(false, response);
+          response->set_type(Response::partial_result);
+          Send(response);
+        }
+      }
+    } catch (std::exception const& e) {
+      LOG(ERROR) << e.what();
+      stop_recognition = true;
+    }
+    if (stop_recognition && !overloaded_) {
+      // Send finish tag
+      Response* response = NewResponse();
+      response->set_status(Response::ok);
+      response->set_type(Response::speech_end);
+      Send(response);
+    }
+    if (second_pass) {
+      // decoding_ stays set until DecodeFunc runs again after it, which
+      // takes over the reference of this task
+      decode_pool_->post(TaskPriority::kLow, [this] { SecondPassFunc(); });
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!stop_recognition && decode_pending_) continue;
+      decoding_ = false;
+      decode_done_ = stop_recognition;
+      if (overloaded_) {
+        finish_status_ = Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                                "too many queued frames");
+      }
+    }
+    break;
+  }
+  if (stop_recognition) MaybeFinish();
+  // The reference of the task, after which `this` may be deleted
+  Unref();
+}
+
+void AsyncRecognizeCall::SecondPassFunc() {
+  try {
+    if (decoder_->SecondPassPartial() &&
+        coalescer_->ShouldSend(decoder_->result())) {
+      Response* response = NewResponse();
+      response->set_status(Response::ok);
+      SerializeResult(false, response);
+      response->set_type(Response::partial_result);
+      Send(response);
+    }
+  } catch (std::exception const& e) {
+    LOG(ERROR) << e.what();
+  }
+  DecodeFunc();
+}
+
+void AsyncRecognizeCall::MaybeFinish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finish_called_ || !reading_done_ || !decode_done_ || writing_) {
+      return;
+    }
+    finish_called_ = true;
+  }
+  // The completion queue thread may drop its reference right after Finish
+  stream_.Finish(finish_status_, &finish_tag_);
+}
+
+AsyncGrpcServer::~AsyncGrpcServer() { Shutdown(); }
+
+void AsyncGrpcServer::Run(const std::string& address, int num_cqs,
+                          int num_decode_threads) {
+  CHECK_GT(num_cqs, 0);
+  CHECK_GT(num_decode_threads, 0);
+  decode_pool_ = std::make_shared<ThreadPool>(num_decode_threads);
+  std::weak_ptr<ThreadPool> weak_pool = decode_pool_;
+  LoadMonitor::Instance().AddQueue(
+      [weak_pool]() {
+        auto pool = weak_pool.lock();
+        return pool != nullptr ? pool->num_pending_tasks() : 0;
+      },
+      num_decode_threads);
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+  builder.RegisterService(&service_);
+  for (int i = 0; i < num_cqs; ++i) {
+    cqs_.emplace_back(builder.AddCompletionQueue());
+  }
+  server_ = builder.BuildAndStart();
+  CHECK(server_ != nullptr);
+  LOG(INFO) << "Async server listening on " << address << " with " << num_cqs
+            << " completion queues and " << num_decode_threads
+            << " decode threads";
+  for (auto& cq : cqs_) {
+    // The call deletes itself when it's done
+    new AsyncRecognizeCall(&service_, cq.get(), feature_config_,
+                           decode_config_, resources_, decode_pool_,
+                           session_pool_, admission_);
+    threads_.emplace_back(&AsyncGrpcServer::PollFunc, this, cq.get());
+  }
+  for (auto& t : threads_) {
+    t.join();
+  }
+  threads_.clear();
+}
+
+void AsyncGrpcServer::Shutdown() {
+  if (server_ == nullptr) return;
+  server_->Shutdown();
+  // Always shutdown the completion queues after the server
+  for (auto& cq : cqs_) {
+    cq->Shutdown();
+  }
+  server_ = nullptr;
+}
+
+void AsyncGrpcServer::PollFunc(ServerCompletionQueue* cq) {
+  void* tag = nullptr;
+  bool ok = false;
+  while (cq->Next(&tag, &ok)) {
+    auto call_tag = static_cast<AsyncRecognizeCall::Tag*>(tag);
+    call_tag->call->Proceed(call_tag->op, ok);
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,284 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GRPC_ASYNC_GRPC_SERVER_H_
+#define GRPC_ASYNC_GRPC_SERVER_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "decoder/asr_decoder.h"
+#include "decoder/partial_coalescer.h"
+#include "decoder/resource_registry.h"
+#include "decoder/session_pool.h"
+#include "frontend/audio_decoder.h"
+#include "frontend/feature_decoder.h"
+#include "frontend/feature_pipeline.h"
+#include "grpc/batch_recognizer.h"
+#include "utils/admission_control.h"
+#include "utils/chunk_deadline.h"
+#include "utils/load_monitor.h"
+#include "utils/log.h"
+#include "utils/thread_pool.h"
+
+#include "grpc/wenet.grpc.pb.h"
+
+namespace wenet {
+
+using grpc::ServerAsyncReaderWriter;
+using grpc::ServerCompletionQueue;
+using grpc::ServerContext;
+using grpc::ServerReader;
+using grpc::Status;
+using wenet::ASR;
+using wenet::Request;
+using wenet::Response;
+
+// Recognize is served by the completion queues of the async server, and the
+// batch rpcs, which take a thread for the whole batch anyway, by the sync
+// threads of the server.
+class AsyncAsrService final
+    : public ASR::WithAsyncMethod_Recognize<ASR::Service> {
+ public:
+  explicit AsyncAsrService(std::shared_ptr<BatchRecognizer> batch)
+      : batch_(std::move(batch)) {}
+  Status BatchRecognize(ServerContext* context, const BatchRequest* request,
+                        BatchResponse* response) override {
+    return batch_->Recognize(*request, response);
+  }
+  Status StreamingBatchRecognize(ServerContext* context,
+                                 ServerReader<BatchRequest>* reader,
+                                 BatchResponse* response) override {
+    return batch_->Recognize(reader, response);
+  }
+  Status GetLoad(ServerContext* context, const LoadRequest* request,
+                 LoadResponse* response) override {
+    LoadReport report = LoadMonitor::Instance().Report();
+    response->set_sessions(report.sessions);
+    response->set_queue_depth(report.queue_depth);
+    response->set_chunk_latency_p99_ms(report.chunk_latency_p99_ms);
+    response->set_cpu_usage(report.cpu_usage);
+    response->set_gpu_usage(report.gpu_usage);
+    return Status::OK;
+  }
+
+ private:
+  std::shared_ptr<BatchRecognizer> batch_;
+};
+
+// One Recognize stream of the async server. It is driven by the events of
+// its completion queue, and the decoding is done on the shared decode pool
+// by AsrDecoder::Decode(false), so no thread is pinned to the stream.
+// It's reference counted: the completion queue holds a reference until the
+// finish of the stream is done, and each decode task holds one from when
+// it's posted until it returns, so the last of them deletes the call.
+class AsyncRecognizeCall {
+ public:
+  AsyncRecognizeCall(AsyncAsrService* service, ServerCompletionQueue* cq,
+                     std::shared_ptr<FeaturePipelineConfig> feature_config,
+                     std::shared_ptr<DecodeOptions> decode_config,
+                     std::shared_ptr<ResourceRegistry> resources,
+                     std::shared_ptr<ThreadPool> decode_pool,
+                     std::shared_ptr<SessionPool> session_pool,
+                     std::shared_ptr<AdmissionController> admission);
+
+  enum Op { kConnect = 0, kRead, kWrite, kFinish };
+  struct Tag {
+    AsyncRecognizeCall* call;
+    Op op;
+  };
+  // Called by the completion queue thread
+  void Proceed(Op op, bool ok);
+
+ private:
+  void OnConnect(bool ok);
+  void OnRead(bool ok);
+  void OnWrite(bool ok);
+  void OnSpeechStart();
+  // Send the failed status of `type`, e.g. rejected, and finish the stream
+  // with `status` once it's written
+  void OnReject(Response::Type type, const std::string& message,
+                const Status& status);
+  void ScheduleDecode();
+  void DecodeFunc();
+  // The second pass of the partial result on a low priority task, before
+  // DecodeFunc goes on, see AsrDecoder::SecondPassPartial()
+  void SecondPassFunc();
+  void SerializeResult(bool finish, Response* response);
+  // A cleared response of the arena of the stream, which is given back by
+  // Send() once it's written, so the messages and their repeated fields
+  // are reused by the next results instead of being allocated again
+  Response* NewResponse();
+  void Send(Response* response);
+  // Finish the stream if all the reads, decoding and writes are done. The
+  // caller is to hold a reference, see Unref()
+  void MaybeFinish();
+  void Ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+  // Delete the call by the last reference
+  void Unref() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  AsyncAsrService* service_;
+  ServerCompletionQueue* cq_;
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  // The resource is taken at the start of the speech, the calls are created
+  // ahead of their streams
+  std::shared_ptr<ResourceRegistry> resources_;
+  std::shared_ptr<ThreadPool> decode_pool_;
+  std::shared_ptr<SessionPool> session_pool_;
+  std::shared_ptr<AdmissionController> admission_;
+  std::unique_ptr<AdmissionController::Ticket> ticket_ = nullptr;
+
+  ServerContext ctx_;
+  ServerAsyncReaderWriter<Response, Request> stream_;
+  Request request_;
+  Tag connect_tag_{this, kConnect};
+  Tag read_tag_{this, kRead};
+  Tag write_tag_{this, kWrite};
+  Tag finish_tag_{this, kFinish};
+  // The one of the completion queue
+  std::atomic<int> refs_{1};
+
+  bool continuous_decoding_ = false;
+  int nbest_ = 1;
+  // The sample rate of the audio, 0 if it's the one of the model
+  int sample_rate_ = 0;
+  // The min time between two partial results, see PartialCoalescer
+  int partial_interval_ms_ = 0;
+  bool got_start_tag_ = false;
+  // Too many frames are queued, the audio is dropped and DecodeFunc sends
+  // the status
+  std::atomic<bool> overloaded_{false};
+  // The pipeline and the decoder of the session, which is returned to the
+  // pool after them
+  std::shared_ptr<DecodeSession> session_ = nullptr;
+  std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
+  std::shared_ptr<AsrDecoder> decoder_ = nullptr;
+  // Only used by DecodeFunc
+  std::unique_ptr<PartialCoalescer> coalescer_ = nullptr;
+  // nullptr for pcm, only used by OnRead
+  std::unique_ptr<AudioDecoder> audio_decoder_ = nullptr;
+  std::vector<int16_t> pcm_;
+  // Not nullptr if the features are uploaded, feats_ are the decoded frames
+  std::unique_ptr<FeatureDecoder> feature_decoder_ = nullptr;
+  std::vector<float> feats_;
+
+  // All the following states are guarded by mutex_
+  std::mutex mutex_;
+  bool decoding_ = false;
+  bool decode_pending_ = false;
+  ChunkDeadline deadline_;
+  bool decode_done_ = false;
+  bool reading_done_ = false;
+  bool writing_ = false;
+  bool write_failed_ = false;
+  bool finish_called_ = false;
+  Status finish_status_ = Status::OK;
+  google::protobuf::Arena arena_;
+  std::deque<Response*> write_queue_;
+  std::vector<Response*> free_responses_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AsyncRecognizeCall);
+};
+
+// AsyncGrpcServer multiplexes many Recognize streams over `num_cqs`
+// completion queue threads and decodes them on a shared pool of
+// `num_decode_threads` threads.
+class AsyncGrpcServer {
+ public:
+  AsyncGrpcServer(std::shared_ptr<FeaturePipelineConfig> feature_config,
+                  std::shared_ptr<DecodeOptions> decode_config,
+                  std::shared_ptr<DecodeResource> decode_resource)
+      : feature_config_(std::move(feature_config)),
+        decode_config_(std::move(decode_config)),
+        resources_(std::make_shared<ResourceRegistry>(
+            std::move(decode_resource))),
+        session_pool_(std::make_shared<SessionPool>(
+            feature_config_, decode_config_, resources_, 0)),
+        batch_(std::make_shared<BatchRecognizer>(
+            feature_config_, decode_config_, resources_)),
+        service_(batch_) {}
+  ~AsyncGrpcServer();
+
+  // Build and start the server, blocks until Shutdown() is called.
+  void Run(const std::string& address, int num_cqs, int num_decode_threads);
+  void Shutdown();
+  // The new streams decode with the current resource of it
+  std::shared_ptr<ResourceRegistry> resources() const { return resources_; }
+  // Keep up to `capacity` Reset() sessions of the finished streams for the
+  // new ones, see SessionPool. The pool is filled at once if `prefill`.
+  // Call it before Run().
+  void EnableSessionPool(int capacity, bool prefill = true) {
+    session_pool_ = std::make_shared<SessionPool>(
+        feature_config_, decode_config_, resources_, capacity);
+    if (prefill) session_pool_->Prefill();
+  }
+  // Reject the new streams and terminate the ones falling behind by `opts`,
+  // see AdmissionController. Call it before Run().
+  void EnableAdmissionControl(const AdmissionOptions& opts) {
+    admission_ = std::make_shared<AdmissionController>(opts);
+    batch_->set_admission(admission_);
+  }
+  // Keep up to `capacity` Reset() decoders of the finished batch calls for
+  // the new ones, see BatchDecoderPool. The pool is filled at once.
+  // Call it before Run().
+  void EnableBatchDecoderPool(int capacity) {
+    batch_->EnableDecoderPool(capacity);
+  }
+  // Batch the utterances of all the batch calls by length, see
+  // GrpcServer::EnableBatchScheduler. Call it before Run().
+  void EnableBatchScheduler(const BatchSchedulerOptions& opts) {
+    batch_->EnableBatchScheduler(opts);
+  }
+  // Answer the repeated utterances of the batch calls from the cache, see
+  // BatchRecognizer::EnableResultCache. Call it before Run().
+  void EnableResultCache(std::shared_ptr<ResultCache> cache,
+                         uint64_t context) {
+    batch_->EnableResultCache(std::move(cache), context);
+  }
+
+ private:
+  void PollFunc(ServerCompletionQueue* cq);
+
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  std::shared_ptr<SessionPool> session_pool_;
+  std::shared_ptr<AdmissionController> admission_ =
+      std::make_shared<AdmissionController>(AdmissionOptions());
+  std::shared_ptr<ThreadPool> decode_pool_ = nullptr;
+  std::shared_ptr<BatchRecognizer> batch_;
+  AsyncAsrService service_;
+  std::unique_ptr<grpc::Server> server_ = nullptr;
+  std::vector<std::unique_ptr<ServerCompletionQueue>> cqs_;
+  std::vector<std::thread> threads_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AsyncGrpcServer);
+};
+
+}  // namespace wenet
+
+#endif  // GRPC_ASYNC_GRPC_SERVER_H_
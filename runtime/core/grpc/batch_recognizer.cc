@@ -0,0 +1,172 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "grpc/batch_recognizer.h"
+
+#include <algorithm>
+#include <future>
+#include <string>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+using grpc::Status;
+using grpc::StatusCode;
+
+grpc::Status BatchRecognizer::Recognize(const BatchRequest& request,
+                                        BatchResponse* response) {
+  std::vector<std::vector<float>> wavs;
+  Status status = AppendAudio(request, &wavs);
+  if (!status.ok()) return status;
+  return Decode(request.batch_config(), std::move(wavs), response);
+}
+
+grpc::Status BatchRecognizer::Recognize(
+    grpc::ServerReader<BatchRequest>* reader, BatchResponse* response) {
+  BatchRequest request;
+  BatchRequest::BatchConfig config;
+  std::vector<std::vector<float>> wavs;
+  bool first = true;
+  while (reader->Read(&request)) {
+    if (first) {
+      config = request.batch_config();
+      first = false;
+    }
+    Status status = AppendAudio(request, &wavs);
+    if (!status.ok()) return status;
+  }
+  return Decode(config, std::move(wavs), response);
+}
+
+grpc::Status BatchRecognizer::AppendAudio(
+    const BatchRequest& request, std::vector<std::vector<float>>* wavs) {
+  for (const std::string& audio : request.audio_data()) {
+    if (audio.size() % sizeof(int16_t) != 0) {
+      return Status(StatusCode::INVALID_ARGUMENT,
+                    "16 bit pcm is expected for audio_data");
+    }
+    const auto* pcm = reinterpret_cast<const int16_t*>(audio.data());
+    wavs->emplace_back(pcm, pcm + audio.size() / sizeof(int16_t));
+  }
+  return Status::OK;
+}
+
+grpc::Status BatchRecognizer::Decode(const BatchRequest::BatchConfig& config,
+                                     std::vector<std::vector<float>> wavs,
+                                     BatchResponse* response) {
+  if (wavs.empty()) {
+    return Status(StatusCode::INVALID_ARGUMENT, "no audio_data is given");
+  }
+  // Only the utterances not in the result cache are decoded, and the call
+  // takes no ticket if all of them are cached
+  std::vector<std::vector<DecodeResult>> batch_result(wavs.size());
+  std::vector<size_t> misses;
+  std::vector<uint64_t> keys;
+  if (result_cache_ != nullptr) {
+    // The entries of a tenant are not shared with the others
+    int version = batch_scheduler_ != nullptr ? scheduler_version_
+                                              : resources_->version();
+    uint64_t context = ResultCache::Hash(
+        config.tenant_config(),
+        ResultCache::Hash(&version, sizeof(version), result_context_));
+    for (size_t i = 0; i < wavs.size(); ++i) {
+      uint64_t key = ResultCache::Key(wavs[i].data(), wavs[i].size(), context);
+      if (!result_cache_->Lookup(key, wavs[i].data(), wavs[i].size(),
+                                 &batch_result[i])) {
+        misses.push_back(i);
+        keys.push_back(key);
+      }
+    }
+  } else {
+    for (size_t i = 0; i < wavs.size(); ++i) misses.push_back(i);
+  }
+  if (!misses.empty()) {
+    std::string reason;
+    auto ticket = admission_->Admit(config.tenant_config(), &reason);
+    double seconds = 0;
+    for (size_t i : misses) {
+      seconds += static_cast<double>(wavs[i].size()) /
+                 feature_config_->sample_rate;
+    }
+    if (ticket != nullptr &&
+        !ticket->tenant()->TakeBatchAudio(seconds, &reason)) {
+      ticket.reset();
+    }
+    if (ticket == nullptr) {
+      LOG(WARNING) << "Reject the batch, " << reason;
+      return Status(StatusCode::RESOURCE_EXHAUSTED, reason);
+    }
+    LOG(INFO) << "Decode a batch of " << misses.size() << " utterances, "
+              << wavs.size() - misses.size() << " from the result cache";
+    // The pcm of the misses is kept for the cache
+    std::vector<std::vector<float>> decode_wavs;
+    for (size_t i : misses) {
+      if (result_cache_ != nullptr) {
+        decode_wavs.push_back(wavs[i]);
+      } else {
+        decode_wavs.emplace_back(std::move(wavs[i]));
+      }
+    }
+    try {
+      if (batch_scheduler_ != nullptr) {
+        std::vector<std::future<std::vector<DecodeResult>>> futures;
+        for (auto& wav : decode_wavs) {
+          futures.emplace_back(batch_scheduler_->Submit(std::move(wav)));
+        }
+        for (size_t j = 0; j < futures.size(); ++j) {
+          batch_result[misses[j]] = futures[j].get();
+        }
+      } else {
+        std::shared_ptr<BatchAsrDecoder> decoder =
+            decoder_pool_->Acquire(resources_->Get());
+        decoder->Decode(decode_wavs);
+        const auto& results = decoder->batch_result();
+        for (size_t j = 0; j < results.size(); ++j) {
+          batch_result[misses[j]] = results[j];
+        }
+      }
+    } catch (std::exception const& e) {
+      LOG(ERROR) << e.what();
+      return Status(StatusCode::INTERNAL, "Decoder got some exception!");
+    }
+    for (size_t j = 0; j < keys.size(); ++j) {
+      const std::vector<float>& wav = wavs[misses[j]];
+      result_cache_->Insert(keys[j], wav.data(), wav.size(),
+                            batch_result[misses[j]]);
+    }
+  }
+  // nbest_config is 0 if it's not set
+  int nbest = std::max(config.nbest_config(), 1);
+  for (const auto& result : batch_result) {
+    BatchResponse::Result* one_result = response->add_results();
+    for (const DecodeResult& path : result) {
+      if (one_result->nbest_size() == nbest) break;
+      Response::OneBest* one_best = one_result->add_nbest();
+      one_best->set_sentence(path.sentence);
+      if (config.enable_timestamp_config()) {
+        for (const WordPiece& word_piece : path.word_pieces) {
+          Response::OnePiece* one_piece = one_best->add_wordpieces();
+          one_piece->set_word(word_piece.word);
+          one_piece->set_start(word_piece.start);
+          one_piece->set_end(word_piece.end);
+        }
+      }
+    }
+  }
+  return Status::OK;
+}
+
+}  // namespace wenet
@@ -0,0 +1,110 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GRPC_BATCH_RECOGNIZER_H_
+#define GRPC_BATCH_RECOGNIZER_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "decoder/batch_decoder_pool.h"
+#include "decoder/batch_scheduler.h"
+#include "decoder/resource_registry.h"
+#include "decoder/result_cache.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/admission_control.h"
+#include "utils/utils.h"
+
+#include "grpc/wenet.grpc.pb.h"
+
+namespace wenet {
+
+// BatchRecognizer serves the BatchRecognize and StreamingBatchRecognize rpcs
+// for both of the servers, as BatchConnectionHandler does for websocket.
+// The utterances of a call are decoded as one batch by a BatchAsrDecoder
+// borrowed from the BatchDecoderPool, or batched with the ones of all the
+// calls by length if the BatchScheduler is enabled. A call holds one ticket
+// of the admission control while it's decoded.
+class BatchRecognizer {
+ public:
+  BatchRecognizer(std::shared_ptr<FeaturePipelineConfig> feature_config,
+                  std::shared_ptr<DecodeOptions> decode_config,
+                  std::shared_ptr<ResourceRegistry> resources)
+      : feature_config_(std::move(feature_config)),
+        decode_config_(std::move(decode_config)),
+        resources_(std::move(resources)),
+        decoder_pool_(std::make_shared<BatchDecoderPool>(
+            feature_config_, decode_config_, resources_, 0)) {}
+
+  // Keep up to `capacity` Reset() decoders of the finished calls for the
+  // new ones, see BatchDecoderPool. The pool is filled at once if `prefill`.
+  void EnableDecoderPool(int capacity, bool prefill = true) {
+    decoder_pool_ = std::make_shared<BatchDecoderPool>(
+        feature_config_, decode_config_, resources_, capacity);
+    if (prefill) decoder_pool_->Prefill();
+  }
+
+  // The scheduler keeps the current resource of it
+  void EnableBatchScheduler(const BatchSchedulerOptions& opts) {
+    batch_scheduler_ = std::make_shared<BatchScheduler>(
+        opts, feature_config_, decode_config_, resources_->Get());
+    scheduler_version_ = resources_->version();
+  }
+  // Answer the utterances decoded before from the cache, see ResultCache.
+  // `context` identifies the options, e.g. ResultCacheContextFromFlags,
+  // and the version of the resource is added to it, so the results of a
+  // replaced model are not returned. The nbest and timestamp configs of a
+  // call only select from the cached n-best.
+  void EnableResultCache(std::shared_ptr<ResultCache> cache,
+                         uint64_t context) {
+    result_cache_ = std::move(cache);
+    result_context_ = context;
+  }
+  void set_admission(std::shared_ptr<AdmissionController> admission) {
+    admission_ = std::move(admission);
+  }
+
+  grpc::Status Recognize(const BatchRequest& request, BatchResponse* response);
+  grpc::Status Recognize(grpc::ServerReader<BatchRequest>* reader,
+                         BatchResponse* response);
+
+ private:
+  // Append the utterances of `request` to `wavs`
+  static grpc::Status AppendAudio(const BatchRequest& request,
+                                  std::vector<std::vector<float>>* wavs);
+  grpc::Status Decode(const BatchRequest::BatchConfig& config,
+                      std::vector<std::vector<float>> wavs,
+                      BatchResponse* response);
+
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  std::shared_ptr<BatchDecoderPool> decoder_pool_;
+  std::shared_ptr<BatchScheduler> batch_scheduler_ = nullptr;
+  int scheduler_version_ = 0;
+  std::shared_ptr<ResultCache> result_cache_ = nullptr;
+  uint64_t result_context_ = 0;
+  std::shared_ptr<AdmissionController> admission_ =
+      std::make_shared<AdmissionController>(AdmissionOptions());
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(BatchRecognizer);
+};
+
+}  // namespace wenet
+
+#endif  // GRPC_BATCH_RECOGNIZER_H_
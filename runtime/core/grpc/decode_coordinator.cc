@@ -0,0 +1,171 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "grpc/decode_coordinator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <grpcpp/grpcpp.h>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+std::unordered_set<std::string> ReadDoneKeys(const std::string& path) {
+  std::unordered_set<std::string> keys;
+  std::ifstream is(path);
+  std::string line;
+  while (std::getline(is, line)) {
+    // The last line without the newline is cut short
+    if (is.eof()) break;
+    size_t end = line.find(' ');
+    if (end == 0 || line.empty()) continue;
+    keys.insert(line.substr(0, end));
+  }
+  return keys;
+}
+
+grpc::Status CoordinatorService::FetchWork(grpc::ServerContext* context,
+                                           const FetchWorkRequest* request,
+                                           FetchWorkResponse* response) {
+  int unit_id = -1;
+  std::vector<WorkItem> items;
+  switch (coordinator_->Fetch(&unit_id, &items)) {
+    case WorkCoordinator::Status::kWork:
+      response->set_status(FetchWorkResponse::work);
+      break;
+    case WorkCoordinator::Status::kWait:
+      response->set_status(FetchWorkResponse::wait);
+      return grpc::Status::OK;
+    case WorkCoordinator::Status::kDone:
+      response->set_status(FetchWorkResponse::done);
+      return grpc::Status::OK;
+  }
+  VLOG(1) << "Unit " << unit_id << " of " << items.size()
+          << " utterances to " << request->worker();
+  response->set_unit_id(unit_id);
+  for (const auto& item : items) {
+    auto* out = response->add_items();
+    out->set_key(item.key);
+    out->set_wav_path(item.path);
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status CoordinatorService::SubmitResults(
+    grpc::ServerContext* context, const SubmitResultsRequest* request,
+    SubmitResultsResponse* response) {
+  std::ostringstream lines;
+  for (const auto& result : request->results()) {
+    lines << result.key() << " " << result.sentence() << "\n";
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Under the lock with the write, so a unit is written once
+  bool accepted = coordinator_->Complete(request->unit_id());
+  response->set_accepted(accepted);
+  if (!accepted) return grpc::Status::OK;
+  *result_ << lines.str() << std::flush;
+  LOG(INFO) << "Unit " << request->unit_id() << " by " << request->worker()
+            << ", " << coordinator_->num_completed() << "/"
+            << coordinator_->num_units() << " units completed";
+  return grpc::Status::OK;
+}
+
+CoordinatorClient::CoordinatorClient(const std::string& address,
+                                     const std::string& worker,
+                                     int retry_seconds)
+    : stub_(Coordinator::NewStub(
+          grpc::CreateChannel(address, grpc::InsecureChannelCredentials()))),
+      worker_(worker),
+      retry_seconds_(retry_seconds) {}
+
+// Call until it's not UNAVAILABLE, e.g. the coordinator is restarted, or
+// retry_seconds passed
+template <typename Call>
+static grpc::Status CallWithRetry(int retry_seconds, const Call& call) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(retry_seconds);
+  int backoff_ms = 100;
+  while (true) {
+    grpc::Status status = call();
+    if (status.error_code() != grpc::StatusCode::UNAVAILABLE ||
+        std::chrono::steady_clock::now() >= deadline) {
+      return status;
+    }
+    LOG(WARNING) << "Coordinator unavailable, retry in " << backoff_ms
+                 << "ms: " << status.error_message();
+    std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+    backoff_ms = std::min(backoff_ms * 2, 5000);
+  }
+}
+
+WorkCoordinator::Status CoordinatorClient::FetchWork(
+    int* unit_id, std::vector<WorkItem>* items, bool* ok) {
+  FetchWorkRequest request;
+  request.set_worker(worker_);
+  FetchWorkResponse response;
+  grpc::Status status = CallWithRetry(retry_seconds_, [&]() {
+    grpc::ClientContext context;
+    return stub_->FetchWork(&context, request, &response);
+  });
+  *ok = status.ok();
+  if (!*ok) {
+    LOG(ERROR) << "FetchWork failed: " << status.error_message();
+    return WorkCoordinator::Status::kDone;
+  }
+  if (response.status() == FetchWorkResponse::wait) {
+    return WorkCoordinator::Status::kWait;
+  }
+  if (response.status() == FetchWorkResponse::done) {
+    return WorkCoordinator::Status::kDone;
+  }
+  *unit_id = response.unit_id();
+  items->clear();
+  for (const auto& item : response.items()) {
+    items->push_back({item.key(), item.wav_path(), 0});
+  }
+  return WorkCoordinator::Status::kWork;
+}
+
+bool CoordinatorClient::SubmitResults(
+    int unit_id,
+    const std::vector<std::pair<std::string, std::string>>& results) {
+  SubmitResultsRequest request;
+  request.set_worker(worker_);
+  request.set_unit_id(unit_id);
+  for (const auto& result : results) {
+    auto* out = request.add_results();
+    out->set_key(result.first);
+    out->set_sentence(result.second);
+  }
+  SubmitResultsResponse response;
+  grpc::Status status = CallWithRetry(retry_seconds_, [&]() {
+    grpc::ClientContext context;
+    return stub_->SubmitResults(&context, request, &response);
+  });
+  if (!status.ok()) {
+    LOG(ERROR) << "SubmitResults failed: " << status.error_message();
+    return false;
+  }
+  VLOG_IF(1, !response.accepted()) << "Unit " << unit_id
+                                   << " is completed by another worker";
+  return true;
+}
+
+}  // namespace wenet
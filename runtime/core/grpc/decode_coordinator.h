@@ -0,0 +1,90 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef GRPC_DECODE_COORDINATOR_H_
+#define GRPC_DECODE_COORDINATOR_H_
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "utils/utils.h"
+#include "utils/work_coordinator.h"
+
+#include "grpc/wenet.grpc.pb.h"
+
+namespace wenet {
+
+// The keys of the lines of a result file of "key sentence" per line, the
+// last line is dropped if it's not complete, e.g. of a coordinator killed
+std::unordered_set<std::string> ReadDoneKeys(const std::string& path);
+
+// The gRPC service of a WorkCoordinator. The results of a unit are
+// appended to `result` at once as it's completed, and flushed, so the
+// utterances in it are skipped on a restart by ReadDoneKeys().
+class CoordinatorService final : public Coordinator::Service {
+ public:
+  CoordinatorService(std::shared_ptr<WorkCoordinator> coordinator,
+                     std::ostream* result)
+      : coordinator_(std::move(coordinator)), result_(result) {}
+
+  grpc::Status FetchWork(grpc::ServerContext* context,
+                         const FetchWorkRequest* request,
+                         FetchWorkResponse* response) override;
+  grpc::Status SubmitResults(grpc::ServerContext* context,
+                             const SubmitResultsRequest* request,
+                             SubmitResultsResponse* response) override;
+
+ private:
+  std::shared_ptr<WorkCoordinator> coordinator_;
+  std::mutex mutex_;
+  std::ostream* result_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(CoordinatorService);
+};
+
+// The worker side of CoordinatorService, the failed calls are retried
+// with backoff for up to `retry_seconds` before they fail.
+class CoordinatorClient {
+ public:
+  CoordinatorClient(const std::string& address, const std::string& worker,
+                    int retry_seconds = 60);
+
+  // kDone, and false if the coordinator is not reachable
+  WorkCoordinator::Status FetchWork(int* unit_id,
+                                    std::vector<WorkItem>* items,
+                                    bool* ok);
+  // The (key, sentence) of the unit, false if they are not delivered
+  bool SubmitResults(
+      int unit_id,
+      const std::vector<std::pair<std::string, std::string>>& results);
+
+ private:
+  std::unique_ptr<Coordinator::Stub> stub_;
+  const std::string worker_;
+  const int retry_seconds_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(CoordinatorClient);
+};
+
+}  // namespace wenet
+
+#endif  // GRPC_DECODE_COORDINATOR_H_
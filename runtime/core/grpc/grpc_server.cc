@@ -14,24 +14,80 @@
 
 #include "grpc/grpc_server.h"
 
+#include <algorithm>
+
+#include <grpc/compression.h>
+#include <grpc/slice.h>
+
+#include "frontend/resampler.h"
+#include "utils/json_writer.h"
+
 namespace wenet {
 
 using grpc::ServerReaderWriter;
 using wenet::Request;
 using wenet::Response;
 
+// Compress the responses of the stream by the `name` of the algorithm,
+// return false if it's unknown
+static bool SetCompression(const std::string& name, ServerContext* context) {
+  if (name.empty()) return true;
+  grpc_compression_algorithm algorithm;
+  if (!grpc_compression_algorithm_parse(
+          grpc_slice_from_static_buffer(name.data(), name.size()),
+          &algorithm)) {
+    return false;
+  }
+  context->set_compression_algorithm(algorithm);
+  return true;
+}
+
+// The start signal of the websocket protocol of the decode config, the
+// options of the default values are left out
+static std::string StartSignal(const Request::DecodeConfig& config) {
+  JsonWriter writer;
+  writer.StartObject().Key("signal").String("start");
+  writer.Key("nbest").Int(config.nbest_config());
+  writer.Key("continuous_decoding").Bool(config.continuous_decoding_config());
+  if (config.sample_rate_config() > 0) {
+    writer.Key("sample_rate").Int(config.sample_rate_config());
+  }
+  if (!config.audio_format_config().empty()) {
+    writer.Key("audio_format").String(config.audio_format_config());
+  }
+  if (!config.feature_format_config().empty()) {
+    writer.Key("feature_format").String(config.feature_format_config());
+    if (config.num_bins_config() > 0) {
+      writer.Key("num_bins").Int(config.num_bins_config());
+    }
+    if (config.frame_shift_ms_config() > 0) {
+      writer.Key("frame_shift_ms").Int(config.frame_shift_ms_config());
+    }
+  }
+  if (config.partial_interval_ms_config() > 0) {
+    writer.Key("partial_interval_ms").Int(config.partial_interval_ms_config());
+  }
+  writer.EndObject();
+  return writer.str();
+}
+
 GrpcConnectionHandler::GrpcConnectionHandler(
-    ServerReaderWriter<Response, Request>* stream,
+    ServerContext* context, ServerReaderWriter<Response, Request>* stream,
     std::shared_ptr<Request> request, std::shared_ptr<Response> response,
     std::shared_ptr<FeaturePipelineConfig> feature_config,
     std::shared_ptr<DecodeOptions> decode_config,
-    std::shared_ptr<DecodeResource> decode_resource)
-    : stream_(std::move(stream)),
+    std::shared_ptr<DecodeResource> decode_resource,
+    std::shared_ptr<SessionPool> session_pool,
+    std::shared_ptr<AdmissionController> admission)
+    : context_(context),
+      stream_(stream),
       request_(std::move(request)),
       response_(std::move(response)),
       feature_config_(std::move(feature_config)),
       decode_config_(std::move(decode_config)),
-      decode_resource_(std::move(decode_resource)) {}
+      decode_resource_(std::move(decode_resource)),
+      session_pool_(std::move(session_pool)),
+      admission_(std::move(admission)) {}
 
 void GrpcConnectionHandler::OnSpeechStart() {
   LOG(INFO) << "Received speech start signal, start reading speech";
@@ -39,15 +95,24 @@ void GrpcConnectionHandler::OnSpeechStart() {
   response_->set_status(Response::ok);
   response_->set_type(Response::server_ready);
   stream_->Write(*response_);
-  feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
-  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, decode_resource_,
-                                          *decode_config_);
+  session_ = session_pool_->Acquire(decode_resource_);
+  feature_pipeline_ = session_->feature_pipeline;
+  // The compressed audio is decoded at the sample rate of the model
+  bool resample = sample_rate_ > 0 && audio_decoder_ == nullptr;
+  feature_pipeline_->set_input_sample_rate(
+      resample ? sample_rate_ : feature_config_->sample_rate);
+  decoder_ = session_->decoder;
+  trace_id_ = Tracer::Instance().NewSessionId();
+  decoder_->set_trace_id(trace_id_);
+  decoder_->set_partial_nbest(nbest_);
+  coalescer_ = std::make_unique<PartialCoalescer>(nbest_, partial_interval_ms_);
   // Start decoder thread
   decode_thread_ = std::make_shared<std::thread>(
       &GrpcConnectionHandler::DecodeThreadFunc, this);
 }
 
 void GrpcConnectionHandler::OnSpeechEnd() {
+  if (got_end_tag_) return;
   LOG(INFO) << "Received speech end signal";
   CHECK(feature_pipeline_ != nullptr);
   feature_pipeline_->set_input_finished();
@@ -56,6 +121,7 @@ void GrpcConnectionHandler::OnSpeechEnd() {
 
 void GrpcConnectionHandler::OnPartialResult() {
   LOG(INFO) << "Partial result";
+  TraceScope trace(trace_id_, "send_partial_result");
   response_->set_status(Response::ok);
   response_->set_type(Response::partial_result);
   stream_->Write(*response_);
@@ -63,6 +129,8 @@ void GrpcConnectionHandler::OnPartialResult() {
 
 void GrpcConnectionHandler::OnFinalResult() {
   LOG(INFO) << "Final result";
+  TraceScope trace(trace_id_, "send_final_result");
+  coalescer_->Reset();
   response_->set_status(Response::ok);
   response_->set_type(Response::final_result);
   stream_->Write(*response_);
@@ -76,18 +144,43 @@ void GrpcConnectionHandler::OnFinish() {
 }
 
 void GrpcConnectionHandler::OnSpeechData() {
-  // Read binary PCM data
-  const int16_t* pcm_data =
-      reinterpret_cast<const int16_t*>(request_->audio_data().c_str());
-  int num_samples = request_->audio_data().length() / sizeof(int16_t);
-  VLOG(2) << "Received " << num_samples << " samples";
+  const std::string& audio = request_->audio_data();
   CHECK(feature_pipeline_ != nullptr);
   CHECK(decoder_ != nullptr);
-  feature_pipeline_->AcceptWaveform(pcm_data, num_samples);
+  if (feature_decoder_ != nullptr) {
+    // The frames computed by the client, the broken ones are dropped
+    feats_.clear();
+    if (feature_decoder_->Decode(audio.data(), audio.size(), &feats_)) {
+      int num_frames = feats_.size() / feature_decoder_->feature_dim();
+      VLOG(2) << "Received " << num_frames << " frames";
+      feature_pipeline_->AcceptFeatures(feats_.data(), num_frames);
+    } else {
+      LOG(WARNING) << "Drop the audio_data of partial feature frames";
+    }
+  } else {
+    // Read binary PCM data
+    const int16_t* pcm_data = reinterpret_cast<const int16_t*>(audio.c_str());
+    int num_samples = audio.length() / sizeof(int16_t);
+    TraceScope trace(trace_id_, "accept_waveform");
+    if (audio_decoder_ != nullptr) {
+      // Or one packet of the compressed audio
+      pcm_.clear();
+      audio_decoder_->Decode(audio.data(), audio.size(), &pcm_);
+      pcm_data = pcm_.data();
+      num_samples = pcm_.size();
+    }
+    VLOG(2) << "Received " << num_samples << " samples";
+    feature_pipeline_->AcceptWaveform(pcm_data, num_samples);
+  }
+  if (admission_->Overloaded(feature_pipeline_->NumQueuedFrames())) {
+    LOG(WARNING) << "Decoding falls behind, terminate the stream";
+    overloaded_ = true;
+  }
 }
 
-void GrpcConnectionHandler::SerializeResult(bool finish) {
-  for (const DecodeResult& path : decoder_->result()) {
+void GrpcConnectionHandler::SerializeResult(
+    const std::vector<DecodeResult>& result, bool finish) {
+  for (const DecodeResult& path : result) {
     Response_OneBest* one_best_ = response_->add_nbest();
     one_best_->set_sentence(path.sentence);
     if (finish) {
@@ -105,35 +198,60 @@ void GrpcConnectionHandler::SerializeResult(bool finish) {
   return;
 }
 
+void GrpcConnectionHandler::SendSegmentResults(bool block) {
+  while (decoder_->PopSegmentResult(&segment_result_, block)) {
+    SerializeResult(segment_result_, true);
+    OnFinalResult();
+    response_->clear_nbest();
+  }
+}
+
 void GrpcConnectionHandler::DecodeThreadFunc() {
   while (true) {
-    DecodeState state = decoder_->Decode();
+    if (overloaded_) {
+      response_->set_status(Response::failed);
+      response_->set_type(Response::overloaded);
+      response_->set_message("server overloaded, too many queued frames");
+      stream_->Write(*response_);
+      break;
+    }
+    // While a segment is rescored, the next one is decoded as far as the
+    // audio goes, then its result is waited for
+    bool pending = decoder_->num_pending_segments() > 0;
+    DecodeState state = decoder_->Decode(!pending);
     response_->clear_status();
     response_->clear_type();
     response_->clear_nbest();
+    SendSegmentResults(state == DecodeState::kWaitFeats);
     if (state == DecodeState::kEndFeats) {
+      SendSegmentResults(true);
       decoder_->Rescoring();
-      SerializeResult(true);
+      SerializeResult(decoder_->result(), true);
       OnFinalResult();
       OnFinish();
       stop_recognition_ = true;
       break;
     } else if (state == DecodeState::kEndpoint) {
-      decoder_->Rescoring();
-      SerializeResult(true);
-      OnFinalResult();
       // If it's not continuous decoding, continue to do next recognition
       // otherwise stop the recognition
       if (continuous_decoding_) {
-        decoder_->ResetContinuousDecoding();
+        decoder_->FinishSegment();
+        SendSegmentResults(false);
       } else {
+        decoder_->Rescoring();
+        SerializeResult(decoder_->result(), true);
+        OnFinalResult();
         OnFinish();
         stop_recognition_ = true;
         break;
       }
-    } else {
-      if (decoder_->DecodedSomething()) {
-        SerializeResult(false);
+    } else if (state == DecodeState::kEndBatch) {
+      // The partial results of a segment follow the final results of the
+      // previous ones
+      if (decoder_->num_pending_segments() == 0 &&
+          decoder_->DecodedSomething() &&
+          coalescer_->ShouldSend(decoder_->result())) {
+        SerializeResult(decoder_->result(), false);
         OnPartialResult();
       }
     }
@@ -142,15 +260,71 @@ void GrpcConnectionHandler::DecodeThreadFunc() {
 
 void GrpcConnectionHandler::operator()() {
   try {
+    // The network_read stage includes the time the client takes to send
+    int64_t read_start = 0;
+    recorder_ = SessionRecorder::NewSession();
     while (stream_->Read(request_.get())) {
+      Tracer::Instance().Record(trace_id_, "network_read", read_start);
+      if (recorder_ != nullptr) {
+        if (got_start_tag_) {
+          recorder_->Record(RecordedPacket::kBinary, request_->audio_data());
+        } else {
+          recorder_->Record(RecordedPacket::kText,
+                            StartSignal(request_->decode_config()));
+        }
+      }
       if (!got_start_tag_) {
         nbest_ = request_->decode_config().nbest_config();
         continuous_decoding_ =
             request_->decode_config().continuous_decoding_config();
+        std::string audio_format =
+            request_->decode_config().audio_format_config();
+        if (audio_format.empty()) audio_format = "pcm";
+        int sample_rate = request_->decode_config().sample_rate_config();
+        if (!IsSupportedAudioFormat(audio_format) ||
+            (sample_rate != 0 && !IsSupportedSampleRate(sample_rate))) {
+          LOG(ERROR) << "Unsupported audio format " << audio_format
+                     << " or sample rate " << sample_rate;
+          response_->set_status(Response::failed);
+          stream_->Write(*response_);
+          return;
+        }
+        audio_decoder_ =
+            CreateAudioDecoder(audio_format, feature_config_->sample_rate);
+        const auto& config = request_->decode_config();
+        if (!config.feature_format_config().empty()) {
+          std::string error;
+          feature_decoder_ = CreateFeatureDecoder(
+              config.feature_format_config(), *feature_config_,
+              config.num_bins_config(), config.frame_shift_ms_config(),
+              &error);
+          if (feature_decoder_ == nullptr) {
+            LOG(ERROR) << "Unsupported features, " << error;
+            response_->set_status(Response::failed);
+            response_->set_message(error);
+            stream_->Write(*response_);
+            return;
+          }
+        }
+        // Before the initial metadata is sent with the first response
+        if (!SetCompression(config.compression_config(), context_)) {
+          LOG(WARNING) << "Unsupported compression "
+                       << config.compression_config()
+                       << ", the responses are not compressed";
+        }
+        sample_rate_ = request_->decode_config().sample_rate_config();
+        partial_interval_ms_ =
+            std::max(request_->decode_config().partial_interval_ms_config(), 0);
         OnSpeechStart();
       } else {
         OnSpeechData();
+        // Stop reading, the decoding thread sends the status
+        if (overloaded_) break;
       }
+      read_start = trace_id_ != 0 ? Tracer::NowNs() : 0;
+    }
+    if (recorder_ != nullptr && !overloaded_) {
+      recorder_->Record(RecordedPacket::kText, "{\"signal\":\"end\"}");
     }
     OnSpeechEnd();
     LOG(INFO) << "Read all pcm data, wait for decoding thread";
@@ -165,10 +339,28 @@ void GrpcConnectionHandler::operator()() {
 Status GrpcServer::Recognize(ServerContext* context,
                              ServerReaderWriter<Response, Request>* stream) {
   LOG(INFO) << "Get Recognize request" << std::endl;
+  // Held until the stream is finished
+  std::string reason;
+  auto ticket = admission_->Admit(&reason);
+  if (ticket == nullptr) {
+    LOG(WARNING) << "Reject the stream, " << reason;
+    Response rejected;
+    rejected.set_status(Response::failed);
+    rejected.set_type(Response::rejected);
+    rejected.set_message(reason);
+    stream->Write(rejected);
+    return Status(grpc::StatusCode::RESOURCE_EXHAUSTED, reason);
+  }
   auto request = std::make_shared<Request>();
-  auto response = std::make_shared<Response>();
-  GrpcConnectionHandler handler(stream, request, response, feature_config_,
-                                decode_config_, decode_resource_);
+  // The nbest and the word pieces of the response are cleared but kept for
+  // the next result, and they are all freed with the arena of the stream
+  google::protobuf::Arena arena;
+  std::shared_ptr<Response> response(
+      google::protobuf::Arena::CreateMessage<Response>(&arena),
+      [](Response*) {});
+  GrpcConnectionHandler handler(context, stream, request, response,
+                                feature_config_, decode_config_,
+                                resources_->Get(), session_pool_, admission_);
   std::thread t(std::move(handler));
   t.join();
   return Status::OK;
@@ -23,14 +23,25 @@
 #include <vector>
 
 #include "decoder/asr_decoder.h"
+#include "decoder/partial_coalescer.h"
+#include "decoder/resource_registry.h"
+#include "decoder/session_pool.h"
+#include "frontend/audio_decoder.h"
+#include "frontend/feature_decoder.h"
 #include "frontend/feature_pipeline.h"
+#include "grpc/batch_recognizer.h"
+#include "utils/admission_control.h"
+#include "utils/load_monitor.h"
 #include "utils/log.h"
+#include "utils/session_record.h"
+#include "utils/trace.h"
 
 #include "grpc/wenet.grpc.pb.h"
 
 namespace wenet {
 
 using grpc::ServerContext;
+using grpc::ServerReader;
 using grpc::ServerReaderWriter;
 using grpc::Status;
 using wenet::ASR;
@@ -39,12 +50,17 @@ using wenet::Response;
 
 class GrpcConnectionHandler {
  public:
-  GrpcConnectionHandler(ServerReaderWriter<Response, Request>* stream,
+  // The `response` is reused by all the results of the stream, e.g. on
+  // the arena of the stream, see GrpcServer::Recognize
+  GrpcConnectionHandler(ServerContext* context,
+                        ServerReaderWriter<Response, Request>* stream,
                         std::shared_ptr<Request> request,
                         std::shared_ptr<Response> response,
                         std::shared_ptr<FeaturePipelineConfig> feature_config,
                         std::shared_ptr<DecodeOptions> decode_config,
-                        std::shared_ptr<DecodeResource> decode_resource);
+                        std::shared_ptr<DecodeResource> decode_resource,
+                        std::shared_ptr<SessionPool> session_pool,
+                        std::shared_ptr<AdmissionController> admission);
   void operator()();
 
  private:
@@ -55,24 +71,52 @@ class GrpcConnectionHandler {
   void OnPartialResult();
   void OnFinalResult();
   void DecodeThreadFunc();
-  void SerializeResult(bool finish);
+  void SerializeResult(const std::vector<DecodeResult>& result, bool finish);
+  // Send the final results of the segments rescored by now, or wait for
+  // all of them if block, see AsrDecoder::FinishSegment()
+  void SendSegmentResults(bool block);
 
   bool continuous_decoding_ = false;
   int nbest_ = 1;
+  // The sample rate of the audio, 0 if it's the one of the model
+  int sample_rate_ = 0;
+  // The min time between two partial results, see PartialCoalescer
+  int partial_interval_ms_ = 0;
+  ServerContext* context_;
   ServerReaderWriter<Response, Request>* stream_;
   std::shared_ptr<Request> request_;
   std::shared_ptr<Response> response_;
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
   std::shared_ptr<DecodeResource> decode_resource_;
+  std::shared_ptr<SessionPool> session_pool_;
+  std::shared_ptr<AdmissionController> admission_;
 
   bool got_start_tag_ = false;
   bool got_end_tag_ = false;
   // When endpoint is detected, stop recognition, and stop receiving data.
   bool stop_recognition_ = false;
+  // Too many frames are queued, the reading thread stops the decoding
+  bool overloaded_ = false;
+  // Non zero if the session is traced, see utils/trace.h
+  uint64_t trace_id_ = 0;
+  // The pipeline and the decoder of the session, which is returned to the
+  // pool after them
+  std::shared_ptr<DecodeSession> session_ = nullptr;
   std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<AsrDecoder> decoder_ = nullptr;
   std::shared_ptr<std::thread> decode_thread_ = nullptr;
+  std::unique_ptr<PartialCoalescer> coalescer_ = nullptr;
+  std::vector<DecodeResult> segment_result_;
+  // nullptr for pcm, see frontend/audio_decoder.h
+  std::unique_ptr<AudioDecoder> audio_decoder_ = nullptr;
+  std::vector<int16_t> pcm_;
+  // Not nullptr if the features are uploaded, feats_ are the decoded frames
+  std::unique_ptr<FeatureDecoder> feature_decoder_ = nullptr;
+  std::vector<float> feats_;
+  // Not nullptr if the requests of the stream are recorded, as the
+  // messages of the websocket protocol, see SessionRecorder
+  std::unique_ptr<SessionRecorder> recorder_ = nullptr;
 };
 
 class GrpcServer final : public ASR::Service {
@@ -82,14 +126,77 @@ class GrpcServer final : public ASR::Service {
              std::shared_ptr<DecodeResource> decode_resource)
       : feature_config_(std::move(feature_config)),
         decode_config_(std::move(decode_config)),
-        decode_resource_(std::move(decode_resource)) {}
+        resources_(std::make_shared<ResourceRegistry>(
+            std::move(decode_resource))),
+        session_pool_(std::make_shared<SessionPool>(
+            feature_config_, decode_config_, resources_, 0)),
+        batch_(std::make_shared<BatchRecognizer>(
+            feature_config_, decode_config_, resources_)) {}
   Status Recognize(ServerContext* context,
                    ServerReaderWriter<Response, Request>* reader) override;
+  Status BatchRecognize(ServerContext* context, const BatchRequest* request,
+                        BatchResponse* response) override {
+    return batch_->Recognize(*request, response);
+  }
+  Status StreamingBatchRecognize(ServerContext* context,
+                                 ServerReader<BatchRequest>* reader,
+                                 BatchResponse* response) override {
+    return batch_->Recognize(reader, response);
+  }
+  Status GetLoad(ServerContext* context, const LoadRequest* request,
+                 LoadResponse* response) override {
+    LoadReport report = LoadMonitor::Instance().Report();
+    response->set_sessions(report.sessions);
+    response->set_queue_depth(report.queue_depth);
+    response->set_chunk_latency_p99_ms(report.chunk_latency_p99_ms);
+    response->set_cpu_usage(report.cpu_usage);
+    response->set_gpu_usage(report.gpu_usage);
+    return Status::OK;
+  }
+  // The new streams decode with the current resource of it
+  std::shared_ptr<ResourceRegistry> resources() const { return resources_; }
+  // Keep up to `capacity` Reset() sessions of the finished streams for the
+  // new ones, see SessionPool. The pool is filled at once if `prefill`.
+  // Call it before the server is started.
+  void EnableSessionPool(int capacity, bool prefill = true) {
+    session_pool_ = std::make_shared<SessionPool>(
+        feature_config_, decode_config_, resources_, capacity);
+    if (prefill) session_pool_->Prefill();
+  }
+  // Reject the new streams and terminate the ones falling behind by `opts`,
+  // see AdmissionController. Call it before the server is started.
+  void EnableAdmissionControl(const AdmissionOptions& opts) {
+    admission_ = std::make_shared<AdmissionController>(opts);
+    batch_->set_admission(admission_);
+  }
+  // Keep up to `capacity` Reset() decoders of the finished batch calls for
+  // the new ones, see BatchDecoderPool. The pool is filled at once.
+  // Call it before the server is started.
+  void EnableBatchDecoderPool(int capacity) {
+    batch_->EnableDecoderPool(capacity);
+  }
+  // Batch the utterances of all the batch calls by length, instead of
+  // decoding the ones of each call as a batch. Call it before the server
+  // is started.
+  void EnableBatchScheduler(const BatchSchedulerOptions& opts) {
+    batch_->EnableBatchScheduler(opts);
+  }
+  // Answer the repeated utterances of the batch calls from the cache, see
+  // BatchRecognizer::EnableResultCache. Call it before the server is
+  // started.
+  void EnableResultCache(std::shared_ptr<ResultCache> cache,
+                         uint64_t context) {
+    batch_->EnableResultCache(std::move(cache), context);
+  }
 
  private:
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
-  std::shared_ptr<DecodeResource> decode_resource_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  std::shared_ptr<SessionPool> session_pool_;
+  std::shared_ptr<BatchRecognizer> batch_;
+  std::shared_ptr<AdmissionController> admission_ =
+      std::make_shared<AdmissionController>(AdmissionOptions());
   DISALLOW_COPY_AND_ASSIGN(GrpcServer);
 };
 
@@ -38,7 +38,9 @@ LatticeFasterDecoderTpl<FST, Token>::LatticeFasterDecoderTpl(
       delete_fst_(false),
       config_(config),
       num_toks_(0),
-      context_graph_(context_graph) {
+      context_graph_(context_graph),
+      token_pool_(kTokenPoolBlockSize),
+      link_pool_(kLinkPoolBlockSize) {
   config.Check();
   toks_.SetSize(
       1000);  // just so on the first frame we do something reasonable.
@@ -47,7 +49,12 @@ LatticeFasterDecoderTpl<FST, Token>::LatticeFasterDecoderTpl(
 template <typename FST, typename Token>
 LatticeFasterDecoderTpl<FST, Token>::LatticeFasterDecoderTpl(
     const LatticeFasterDecoderConfig &config, FST *fst)
-    : fst_(fst), delete_fst_(true), config_(config), num_toks_(0) {
+    : fst_(fst),
+      delete_fst_(true),
+      config_(config),
+      num_toks_(0),
+      token_pool_(kTokenPoolBlockSize),
+      link_pool_(kLinkPoolBlockSize) {
   config.Check();
   toks_.SetSize(
       1000);  // just so on the first frame we do something reasonable.
@@ -73,7 +80,8 @@ void LatticeFasterDecoderTpl<FST, Token>::InitDecoding() {
   StateId start_state = fst_->Start();
   KALDI_ASSERT(start_state != fst::kNoStateId);
   active_toks_.resize(1);
-  Token *start_tok = new Token(0.0, 0.0, NULL, NULL, NULL);
+  Token *start_tok = new (token_pool_.Allocate()) Token(0.0, 0.0, NULL, NULL,
+                                                        NULL);
   active_toks_[0].toks = start_tok;
   toks_.Insert(start_state, start_tok);
   num_toks_++;
@@ -111,7 +119,8 @@ bool LatticeFasterDecoderTpl<FST, Token>::GetBestPath(
 // Outputs an FST corresponding to the raw, state-level lattice
 template <typename FST, typename Token>
 bool LatticeFasterDecoderTpl<FST, Token>::GetRawLattice(
-    Lattice *ofst, bool use_final_probs) const {
+    Lattice *ofst, bool use_final_probs, int32 begin_frame,
+    std::vector<Token *> *begin_toks) const {
   typedef LatticeArc Arc;
   typedef Arc::StateId StateId;
   typedef Arc::Weight Weight;
@@ -136,11 +145,15 @@ bool LatticeFasterDecoderTpl<FST, Token>::GetRawLattice(
   // an extra frame for the start-state).
   int32 num_frames = active_toks_.size() - 1;
   KALDI_ASSERT(num_frames > 0);
+  KALDI_ASSERT(begin_frame >= 0 && begin_frame <= num_frames);
+  KALDI_ASSERT(begin_frame == 0 || begin_toks != NULL);
   const int32 bucket_count = num_toks_ / 2 + 3;
   unordered_map<Token *, StateId> tok_map(bucket_count);
+  // The extra start state of the lattice from begin_frame
+  if (begin_frame > 0) ofst->AddState();
   // First create all states.
   std::vector<Token *> token_list;
-  for (int32 f = 0; f <= num_frames; f++) {
+  for (int32 f = begin_frame; f <= num_frames; f++) {
     if (active_toks_[f].toks == NULL) {
       KALDI_WARN << "GetRawLattice: no tokens active on frame " << f
                  << ": not producing lattice.\n";
@@ -153,13 +166,23 @@ bool LatticeFasterDecoderTpl<FST, Token>::GetRawLattice(
   // The next statement sets the start state of the output FST.  Because we
   // topologically sorted the tokens, state zero must be the start-state.
   ofst->SetStart(0);
+  if (begin_frame > 0) {
+    begin_toks->clear();
+    for (Token *tok = active_toks_[begin_frame].toks; tok != NULL;
+         tok = tok->next) {
+      Arc arc(kBeginTokenLabel + static_cast<Label>(begin_toks->size()), 0,
+              Weight(tok->tot_cost, 0), tok_map[tok]);
+      ofst->AddArc(0, arc);
+      begin_toks->push_back(tok);
+    }
+  }
 
   KALDI_VLOG(4) << "init:" << num_toks_ / 2 + 3
                 << " buckets:" << tok_map.bucket_count()
                 << " load:" << tok_map.load_factor()
                 << " max:" << tok_map.max_load_factor();
   // Now create all arcs.
-  for (int32 f = 0; f <= num_frames; f++) {
+  for (int32 f = begin_frame; f <= num_frames; f++) {
     for (Token *tok = active_toks_[f].toks; tok != NULL; tok = tok->next) {
       StateId cur_state = tok_map[tok];
       for (ForwardLinkT *l = tok->links; l != NULL; l = l->next) {
@@ -214,9 +237,10 @@ bool LatticeFasterDecoderTpl<FST, Token>::GetRawLattice(
 // lattice-determinized lattice (one path per word sequence).
 template <typename FST, typename Token>
 bool LatticeFasterDecoderTpl<FST, Token>::GetLattice(
-    CompactLattice *ofst, bool use_final_probs) const {
+    CompactLattice *ofst, bool use_final_probs, int32 begin_frame,
+    std::vector<Token *> *begin_toks) const {
   Lattice raw_fst;
-  GetRawLattice(&raw_fst, use_final_probs);
+  GetRawLattice(&raw_fst, use_final_probs, begin_frame, begin_toks);
   Invert(&raw_fst);  // make it so word labels are on the input.
   // (in phase where we get backward-costs).
   fst::ILabelCompare<LatticeArc> ilabel_comp;
@@ -285,7 +309,8 @@ LatticeFasterDecoderTpl<FST, Token>::FindOrAddToken(StateId state,
     // tokens on the currently final frame have zero extra_cost
     // as any of them could end up
     // on the winning path.
-    Token *new_tok = new Token(tot_cost, extra_cost, NULL, toks, backpointer);
+    Token *new_tok = new (token_pool_.Allocate())
+        Token(tot_cost, extra_cost, NULL, toks, backpointer);
     // NULL: no forward links yet
     toks = new_tok;
     num_toks_++;
@@ -371,7 +396,7 @@ void LatticeFasterDecoderTpl<FST, Token>::PruneForwardLinks(
             prev_link->next = next_link;
           else
             tok->links = next_link;
-          delete link;
+          link_pool_.Free(link);
           link = next_link;  // advance link but leave prev_link the same.
           *links_pruned = true;
         } else {  // keep the link and update the tok_extra_cost if needed.
@@ -463,7 +488,7 @@ void LatticeFasterDecoderTpl<FST, Token>::PruneForwardLinksFinal() {
             prev_link->next = next_link;
           else
             tok->links = next_link;
-          delete link;
+          link_pool_.Free(link);
           link = next_link;  // advance link but leave prev_link the same.
         } else {  // keep the link and update the tok_extra_cost if needed.
           if (link_extra_cost < 0.0) {  // this is just a precaution.
@@ -525,7 +550,7 @@ void LatticeFasterDecoderTpl<FST, Token>::PruneTokensForFrame(
         prev_tok->next = tok->next;
       else
         toks = tok->next;
-      delete tok;
+      token_pool_.Free(tok);
       num_toks_--;
     } else {  // fetch next Token
       prev_tok = tok;
@@ -853,9 +878,10 @@ BaseFloat LatticeFasterDecoderTpl<FST, Token>::ProcessEmitting(
           }
           // Add ForwardLink from tok to next_tok (put on head of list
           // tok->links)
-          tok->links = new ForwardLinkT(e_next->val, arc.ilabel, arc.olabel,
-                                        graph_cost, ac_cost, is_start_boundary,
-                                        is_end_boundary, tok->links);
+          tok->links = new (link_pool_.Allocate())
+              ForwardLinkT(e_next->val, arc.ilabel, arc.olabel, graph_cost,
+                           ac_cost, is_start_boundary, is_end_boundary,
+                           tok->links);
           tok->links->context_score = context_score;
         }
       }  // for all arcs
@@ -866,13 +892,13 @@ BaseFloat LatticeFasterDecoderTpl<FST, Token>::ProcessEmitting(
   return next_cutoff;
 }
 
-// static inline
+// inline
 template <typename FST, typename Token>
 void LatticeFasterDecoderTpl<FST, Token>::DeleteForwardLinks(Token *tok) {
   ForwardLinkT *l = tok->links, *m;
   while (l != NULL) {
     m = l->next;
-    delete l;
+    link_pool_.Free(l);
     l = m;
   }
   tok->links = NULL;
@@ -951,9 +977,9 @@ void LatticeFasterDecoderTpl<FST, Token>::ProcessNonemitting(BaseFloat cutoff) {
             }
           }
 
-          tok->links =
-              new ForwardLinkT(e_new->val, 0, arc.olabel, graph_cost, 0,
-                               is_start_boundary, is_end_boundary, tok->links);
+          tok->links = new (link_pool_.Allocate())
+              ForwardLinkT(e_new->val, 0, arc.olabel, graph_cost, 0,
+                           is_start_boundary, is_end_boundary, tok->links);
           tok->links->context_score = context_score;
 
           // "changed" tells us whether the new token has a different
@@ -984,7 +1010,7 @@ void LatticeFasterDecoderTpl<
     for (Token *tok = active_toks_[i].toks; tok != NULL;) {
       DeleteForwardLinks(tok);
       Token *next_tok = tok->next;
-      delete tok;
+      token_pool_.Free(tok);
       num_toks_--;
       tok = next_tok;
     }
@@ -32,11 +32,13 @@
 #include "base/kaldi-common.h"
 #include "decoder/context_graph.h"
 #include "fst/fstlib.h"
+#include "fst/memory.h"
 #include "fstext/fstext-lib.h"
 #include "itf/decodable-itf.h"
 #include "lat/determinize-lattice-pruned.h"
 #include "lat/kaldi-lattice.h"
 #include "util/hash-list.h"
+#include "util/open-hash-list.h"
 
 namespace kaldi {
 
@@ -322,7 +324,18 @@ class LatticeFasterDecoderTpl {
   /// which also supports a pruning beam, in case for some reason
   /// you want it pruned tighter than the regular lattice beam.
   /// We could put that here in future needed.
-  bool GetRawLattice(Lattice *ofst, bool use_final_probs = true) const;
+  ///
+  /// If begin_frame > 0, only the frames from begin_frame on are in the
+  /// lattice, so its size doesn't grow with the length of the utterance. The
+  /// start state then has an arc to each token active on begin_frame, whose
+  /// weight is the forward cost(tot_cost) of the token and whose ilabel is
+  /// kBeginTokenLabel + i, where i is the index of the token in *begin_toks.
+  bool GetRawLattice(Lattice *ofst, bool use_final_probs = true,
+                     int32 begin_frame = 0,
+                     std::vector<Token *> *begin_toks = NULL) const;
+
+  /// The ilabels of the start arcs of the lattice from begin_frame
+  static const int32 kBeginTokenLabel = 1 << 29;
 
   /// [Deprecated, users should now use GetRawLattice and determinize it
   /// themselves, e.g. using DeterminizeLatticePhonePrunedWrapper].
@@ -331,7 +344,10 @@ class LatticeFasterDecoderTpl {
   /// nonempty. If "use_final_probs" is true AND we reached the final-state of
   /// the graph then it will include those as final-probs, else it will treat
   /// all final-probs as one.
-  bool GetLattice(CompactLattice *ofst, bool use_final_probs = true) const;
+  /// begin_frame and begin_toks are the same as GetRawLattice().
+  bool GetLattice(CompactLattice *ofst, bool use_final_probs = true,
+                  int32 begin_frame = 0,
+                  std::vector<Token *> *begin_toks = NULL) const;
 
   /// InitDecoding initializes the decoding, and should only be used if you
   /// intend to call AdvanceDecoding().  If you call Decode(), you don't need to
@@ -375,7 +391,7 @@ class LatticeFasterDecoderTpl {
   // internals.
 
   // Deletes the elements of the singly linked list tok->links.
-  inline static void DeleteForwardLinks(Token *tok);
+  inline void DeleteForwardLinks(Token *tok);
 
   // head of per-frame list of Tokens (list is in topological order),
   // and something saying whether we ever pruned it using PruneForwardLinks.
@@ -387,7 +403,15 @@ class LatticeFasterDecoderTpl {
         : toks(NULL), must_prune_forward_links(true), must_prune_tokens(true) {}
   };
 
-  using Elem = typename HashList<StateId, Token *>::Elem;
+  // The open addressing OpenHashList replaces the chained HashList if built
+  // with KALDI_OPEN_HASH_TOKENS (cmake -DOPEN_HASH_TOKENS=ON), it has less
+  // cache misses on the lookups of many active tokens.
+#ifdef KALDI_OPEN_HASH_TOKENS
+  using TokenHash = OpenHashList<StateId, Token *>;
+#else
+  using TokenHash = HashList<StateId, Token *>;
+#endif
+  using Elem = typename TokenHash::Elem;
   // Equivalent to:
   //  struct Elem {
   //    StateId key;
@@ -477,14 +501,15 @@ class LatticeFasterDecoderTpl {
   /// preceding ProcessEmitting().
   void ProcessNonemitting(BaseFloat cost_cutoff);
 
-  // HashList defined in ../util/hash-list.h.  It actually allows us to maintain
+  // TokenHash, HashList defined in ../util/hash-list.h or OpenHashList in
+  // ../util/open-hash-list.h.  It actually allows us to maintain
   // more than one list (e.g. for current and previous frames), but only one of
   // them at a time can be indexed by StateId.  It is indexed by frame-index
   // plus one, where the frame-index is zero-based, as used in decodable object.
   // That is, the emitting probs of frame t are accounted for in tokens at
   // toks_[t+1].  The zeroth frame is for nonemitting transition at the start of
   // the graph.
-  HashList<StateId, Token *> toks_;
+  TokenHash toks_;
 
   std::vector<TokenList> active_toks_;  // Lists of tokens, indexed by
   // frame (members of TokenList are toks, must_prune_forward_links,
@@ -547,6 +572,16 @@ class LatticeFasterDecoderTpl {
 
   void ClearActiveTokens();
 
+  // Tokens and forward links are allocated from the free lists of the pools
+  // of each decoder instead of the global heap, the freed ones are recycled
+  // for the next frames and utterances (see ClearActiveTokens() called by
+  // InitDecoding()), and the memory is released with the decoder. They are
+  // trivially destructible, so no destructor is called when freeing them.
+  static const size_t kTokenPoolBlockSize = 1024;
+  static const size_t kLinkPoolBlockSize = 4096;
+  fst::MemoryPool<Token> token_pool_;
+  fst::MemoryPool<ForwardLinkT> link_pool_;
+
   KALDI_DISALLOW_COPY_AND_ASSIGN(LatticeFasterDecoderTpl);
 };
 
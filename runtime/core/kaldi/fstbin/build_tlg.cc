@@ -0,0 +1,146 @@
+// fstbin/build_tlg.cc
+
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "base/kaldi-common.h"
+#include "fst/fstlib.h"
+#include "fstext/determinize-star.h"
+#include "fstext/fstext-utils.h"
+#include "fstext/kaldi-fst-io.h"
+#include "fstext/parallel-compose.h"
+#include "fstext/table-matcher.h"
+#include "util/parse-options.h"
+
+namespace {
+
+using fst::StdArc;
+using fst::VectorFst;
+
+// Compose by ParallelCompose() if it applies, or by TableCompose()
+void Compose(const VectorFst<StdArc> &fst1, const VectorFst<StdArc> &fst2,
+             int num_threads, VectorFst<StdArc> *ofst) {
+  if (num_threads > 1 && fst::ParallelComposable(fst2)) {
+    fst::ParallelCompose(fst1, fst2, ofst, num_threads);
+  } else {
+    if (num_threads > 1) {
+      KALDI_WARN << "The right FST has input epsilons, compose on one thread";
+    }
+    fst::TableComposeOptions opts;
+    fst::TableCompose(fst1, fst2, ofst, opts);
+  }
+}
+
+class StageTimer {
+ public:
+  void Log(const std::string &stage, const VectorFst<StdArc> &fst) {
+    auto now = std::chrono::steady_clock::now();
+    KALDI_LOG << stage << ": " << fst.NumStates() << " states, "
+              << std::chrono::duration<double>(now - start_).count() << "s";
+    start_ = now;
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_ =
+      std::chrono::steady_clock::now();
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;  // NOLINT
+    using namespace fst;  // NOLINT
+
+    const char *usage =
+        "Builds the decoding graph TLG in one process, which is\n"
+        "  fsttablecompose L.fst G.fst | fstdeterminizestar --use-log=true |\n"
+        "    fstminimizeencoded | fstarcsort --sort_type=ilabel > LG.fst\n"
+        "  fsttablecompose T.fst LG.fst > TLG.fst\n"
+        "of tools/fst/make_tlg.sh. T.fst is read while LG is built, and the\n"
+        "compositions run on --num-threads threads if the right FSTs have\n"
+        "no input epsilons, e.g. G after fstrmepsilon and LG.\n"
+        "\n"
+        "Usage:  build_tlg [options] T.fst L.fst G.fst TLG.fst\n";
+
+    int num_threads = 1;
+    bool use_log = true;
+    float delta = kDelta;
+    int max_states = -1;
+    std::string lg_out;
+    ParseOptions po(usage);
+    po.Register("num-threads", &num_threads,
+                "Threads of the compositions of L and G, and of T and LG.");
+    po.Register("use-log", &use_log, "Determinize LG in log semiring.");
+    po.Register("delta", &delta,
+                "Delta value used to determine equivalence of weights.");
+    po.Register("max-states", &max_states,
+                "Maximum number of states in determinized LG before it will "
+                "abort.");
+    po.Register("lg-out", &lg_out, "If not empty, LG is written to it too.");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 4) {
+      po.PrintUsage();
+      exit(1);
+    }
+    std::string t_in = po.GetArg(1), l_in = po.GetArg(2),
+                g_in = po.GetArg(3), tlg_out = po.GetArg(4);
+
+    StageTimer timer;
+    VectorFst<StdArc> *t_fst = nullptr;
+    std::thread t_reader([&]() { t_fst = ReadFstKaldi(t_in); });
+    VectorFst<StdArc> *l_fst = ReadFstKaldi(l_in);
+    VectorFst<StdArc> *g_fst = ReadFstKaldi(g_in);
+    if (g_fst->Properties(kILabelSorted, true) == 0) {
+      ArcSort(g_fst, ILabelCompare<StdArc>());
+    }
+    timer.Log("Read G", *g_fst);
+
+    VectorFst<StdArc> lg_fst;
+    Compose(*l_fst, *g_fst, num_threads, &lg_fst);
+    delete l_fst;
+    delete g_fst;
+    timer.Log("Compose LG", lg_fst);
+    ArcSort(&lg_fst, ILabelCompare<StdArc>());  // improves speed.
+    if (use_log) {
+      DeterminizeStarInLog(&lg_fst, delta, nullptr, max_states);
+    } else {
+      VectorFst<StdArc> det_fst;
+      DeterminizeStar(lg_fst, &det_fst, delta, nullptr, max_states);
+      lg_fst = det_fst;
+    }
+    timer.Log("Determinize LG", lg_fst);
+    MinimizeEncoded(&lg_fst, delta);
+    ArcSort(&lg_fst, ILabelCompare<StdArc>());
+    timer.Log("Minimize LG", lg_fst);
+    if (!lg_out.empty()) WriteFstKaldi(lg_fst, lg_out);
+
+    t_reader.join();
+    VectorFst<StdArc> tlg_fst;
+    Compose(*t_fst, lg_fst, num_threads, &tlg_fst);
+    delete t_fst;
+    timer.Log("Compose TLG", tlg_fst);
+    WriteFstKaldi(tlg_fst, tlg_out);
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,166 @@
+// fstbin/fstquantize.cc
+
+// Copyright 2022 Binbin Zhang (binbzha@qq.com)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "fst/fstlib.h"
+#include "fstext/kaldi-fst-io.h"
+#include "util/parse-options.h"
+#include "utils/quantized_fst.h"
+
+namespace {
+
+// Iterate all the arcs through the Fst interface as the decoder does,
+// returns arcs per second
+double ArcsPerSecond(const fst::Fst<fst::StdArc> &fst, int num_passes) {
+  auto start = std::chrono::steady_clock::now();
+  int64 num_arcs = 0;
+  float sum = 0;
+  for (int i = 0; i < num_passes; ++i) {
+    for (fst::StateIterator<fst::Fst<fst::StdArc>> siter(fst); !siter.Done();
+         siter.Next()) {
+      for (fst::ArcIterator<fst::Fst<fst::StdArc>> aiter(fst, siter.Value());
+           !aiter.Done(); aiter.Next()) {
+        sum += aiter.Value().weight.Value();
+        ++num_arcs;
+      }
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  KALDI_VLOG(2) << "Sum of weights " << sum;
+  return num_arcs / std::max(seconds, 1e-9);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;  // NOLINT
+    using namespace fst;  // NOLINT
+    using wenet::QuantizedArcCompactor;
+    using wenet::QuantizedFst;
+
+    const char *usage =
+        "Converts an FST to the compact QuantizedFst of the runtime, which "
+        "takes 12 bytes\n"
+        "per arc with 16 bits input labels and 16 bits quantized weights, "
+        "instead of 16\n"
+        "bytes. The arrays are aligned so it can be memory mapped too.\n"
+        "\n"
+        "Usage:  fstquantize [options] in.fst out.fst\n"
+        "E.g:  fstquantize --benchmark=true TLG.fst TLG.quantized.fst\n";
+
+    bool benchmark = false;
+    int num_passes = 3;
+    ParseOptions po(usage);
+    po.Register("benchmark", &benchmark,
+                "Compare the arcs/sec of iterating the input and output FSTs");
+    po.Register("num-passes", &num_passes,
+                "Passes over all the arcs for --benchmark");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string fst_in_filename = po.GetArg(1),
+                fst_out_filename = po.GetArg(2);
+
+    Fst<StdArc> *fst = ReadFstKaldiGeneric(fst_in_filename);
+
+    // The range of the weights for the quantization step
+    float min_weight = std::numeric_limits<float>::max();
+    float max_weight = -std::numeric_limits<float>::max();
+    int64 num_states = 0, num_arcs = 0, num_finals = 0;
+    for (StateIterator<Fst<StdArc>> siter(*fst); !siter.Done();
+         siter.Next()) {
+      StdArc::StateId s = siter.Value();
+      ++num_states;
+      std::vector<float> weights;
+      if (fst->Final(s) != StdArc::Weight::Zero()) {
+        weights.push_back(fst->Final(s).Value());
+        ++num_finals;
+      }
+      for (ArcIterator<Fst<StdArc>> aiter(*fst, s); !aiter.Done();
+           aiter.Next()) {
+        const StdArc &arc = aiter.Value();
+        if (arc.ilabel < 0 || arc.ilabel >= QuantizedArcCompactor::kMaxILabel)
+          KALDI_ERR << "fstquantize: input label " << arc.ilabel
+                    << " is out of the 16 bits range";
+        if (arc.weight != StdArc::Weight::Zero())
+          weights.push_back(arc.weight.Value());
+        ++num_arcs;
+      }
+      for (float w : weights) {
+        min_weight = std::min(min_weight, w);
+        max_weight = std::max(max_weight, w);
+      }
+    }
+    if (min_weight > max_weight) min_weight = max_weight = 0;
+    float step = std::max((max_weight - min_weight) /
+                              QuantizedArcCompactor::kMaxLevel,
+                          1e-6f);
+    KALDI_LOG << "States " << num_states << ", arcs " << num_arcs
+              << ", weights in [" << min_weight << ", " << max_weight
+              << "], quantization step " << step;
+
+    QuantizedFst quantized_fst(*fst, QuantizedArcCompactor(min_weight, step));
+
+    // Alignment requires a seekable output, so no pipe here
+    std::ofstream os(fst_out_filename,
+                     std::ios_base::out | std::ios_base::binary);
+    FstWriteOptions wopts(fst_out_filename);
+    wopts.align = true;
+    if (!os || !quantized_fst.Write(os, wopts))
+      KALDI_ERR << "fstquantize: error writing FST to " << fst_out_filename;
+
+    // ConstFst keeps a 20 bytes state and 16 bytes arcs, QuantizedFst keeps
+    // a 4 bytes offset per state and 12 bytes elements for arcs and finals
+    int64 const_bytes = num_states * 20 + num_arcs * sizeof(StdArc);
+    int64 quantized_bytes =
+        (num_states + 1) * sizeof(uint32) +
+        (num_arcs + num_finals) * sizeof(wenet::QuantizedArc);
+    KALDI_LOG << "Memory of ConstFst " << const_bytes << " bytes, "
+              << "QuantizedFst " << quantized_bytes << " bytes, saved "
+              << 100.0 * (const_bytes - quantized_bytes) /
+                     std::max<int64>(const_bytes, 1)
+              << "%";
+
+    if (benchmark) {
+      KALDI_LOG << "Input " << fst->Type() << " fst: "
+                << ArcsPerSecond(*fst, num_passes) << " arcs/sec";
+      KALDI_LOG << "QuantizedFst: " << ArcsPerSecond(quantized_fst, num_passes)
+                << " arcs/sec";
+    }
+
+    delete fst;
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+  return 0;
+}
@@ -22,6 +22,7 @@
 #include "fst/fstlib.h"
 #include "fstext/fstext-utils.h"
 #include "fstext/kaldi-fst-io.h"
+#include "fstext/parallel-compose.h"
 #include "fstext/table-matcher.h"
 #include "util/parse-options.h"
 
@@ -66,6 +67,7 @@ int main(int argc, char *argv[]) {
     TableComposeOptions opts;
     std::string match_side = "left";
     std::string compose_filter = "sequence";
+    int num_threads = 1;
 
     po.Register("connect", &opts.connect, "If true, trim FST before output.");
     po.Register("match-side", &match_side,
@@ -74,6 +76,10 @@ int main(int argc, char *argv[]) {
     po.Register("compose-filter", &compose_filter,
                 "Composition filter to use, "
                 "one of: \"alt_sequence\", \"auto\", \"match\", \"sequence\"");
+    po.Register("num-threads", &num_threads,
+                "Threads of the composition if > 1 and the second FST has "
+                "no input epsilons, the match-side and compose-filter are "
+                "not used then.");
 
     po.Read(argc, argv);
 
@@ -119,7 +125,15 @@ int main(int argc, char *argv[]) {
 
     VectorFst<StdArc> composed_fst;
 
-    TableCompose(*fst1, *fst2, &composed_fst, opts);
+    if (num_threads > 1 && ParallelComposable(*fst2)) {
+      ParallelCompose(*fst1, *fst2, &composed_fst, num_threads, opts.connect);
+    } else {
+      if (num_threads > 1) {
+        KALDI_WARN << "The second FST has input epsilons or is not ilabel "
+                   << "sorted, compose it on one thread.";
+      }
+      TableCompose(*fst1, *fst2, &composed_fst, opts);
+    }
 
     delete fst1;
     delete fst2;
@@ -0,0 +1,76 @@
+// fstbin/fsttoconst.cc
+
+// Copyright 2022 Binbin Zhang (binbzha@qq.com)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fstream>
+
+#include "base/kaldi-common.h"
+#include "fst/fstlib.h"
+#include "fstext/kaldi-fst-io.h"
+#include "util/parse-options.h"
+
+/* some test examples:
+ ( echo "0 1 1 1"; echo "1 0" ) | fstcompile > in.fst
+ fsttoconst in.fst out.fst && fstinfo out.fst | grep "fst type"
+*/
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;  // NOLINT
+    using namespace fst;  // NOLINT
+
+    const char *usage =
+        "Converts an FST to a ConstFst with aligned arrays, which can be "
+        "memory mapped\n"
+        "read-only, so that the decoding processes on one host share the "
+        "pages of the graph\n"
+        "(see --fst_mmap of the runtime)\n"
+        "\n"
+        "Usage:  fsttoconst in.fst out.fst\n"
+        "E.g:  fsttoconst TLG.fst TLG.const.fst\n";
+
+    ParseOptions po(usage);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string fst_in_filename = po.GetArg(1),
+                fst_out_filename = po.GetArg(2);
+
+    Fst<StdArc> *fst = ReadFstKaldiGeneric(fst_in_filename);
+    ConstFst<StdArc> const_fst(*fst);
+    delete fst;
+
+    // Alignment requires a seekable output, so no pipe here
+    std::ofstream os(fst_out_filename,
+                     std::ios_base::out | std::ios_base::binary);
+    FstWriteOptions wopts(fst_out_filename);
+    wopts.align = true;
+    if (!os || !const_fst.Write(os, wopts))
+      KALDI_ERR << "fsttoconst: error writing FST to " << fst_out_filename;
+
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+  return 0;
+}
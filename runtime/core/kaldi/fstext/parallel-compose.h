@@ -0,0 +1,178 @@
+// fstext/parallel-compose.h
+
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef KALDI_FSTEXT_PARALLEL_COMPOSE_H_
+#define KALDI_FSTEXT_PARALLEL_COMPOSE_H_
+
+#include <fst/fstlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+namespace fst {
+
+/// Returns true if ParallelCompose() applies to fst2 as the right hand FST,
+/// i.e. it's ilabel sorted and has no input epsilons, e.g. G after
+/// fstrmepsilon and LG after fstdeterminizestar.
+template <class Arc>
+bool ParallelComposable(const Fst<Arc> &fst2) {
+  const uint64 props = kNoIEpsilons | kILabelSorted;
+  return fst2.Properties(props, true) == props;
+}
+
+/// ParallelCompose composes fst1 and fst2 into ofst on num_threads threads.
+/// The right hand FST has no input epsilons, see ParallelComposable(), so
+/// no composition filter is needed and the composed states are the pairs of
+/// the states. They are expanded level by level of the breadth first
+/// search, the threads take the states of the level from a shared counter
+/// and look up the pairs of the next level in the sharded table. The
+/// result is equivalent to the one of Compose() or TableCompose(), but the
+/// state ids depend on the order of the threads.
+template <class Arc>
+void ParallelCompose(const ExpandedFst<Arc> &fst1,
+                     const ExpandedFst<Arc> &fst2, MutableFst<Arc> *ofst,
+                     int num_threads, bool connect = true) {
+  typedef typename Arc::StateId StateId;
+  typedef typename Arc::Weight Weight;
+  typedef std::pair<StateId, std::pair<StateId, StateId> > Pending;
+  KALDI_ASSERT(ParallelComposable(fst2));
+  ofst->DeleteStates();
+  ofst->SetInputSymbols(fst1.InputSymbols());
+  ofst->SetOutputSymbols(fst2.OutputSymbols());
+  if (fst1.Start() == kNoStateId || fst2.Start() == kNoStateId) return;
+  num_threads = std::max(num_threads, 1);
+
+  // The ids of the pairs, sharded by the hash of the pair
+  const int kNumShards = 256;
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<uint64, StateId> ids;
+  };
+  std::vector<Shard> shards(kNumShards);
+  std::atomic<StateId> num_states(0);
+  // The id of the pair, which is added to `fresh` if it's new
+  auto find_or_add = [&](StateId s1, StateId s2,
+                         std::vector<Pending> *fresh) -> StateId {
+    uint64 key = (static_cast<uint64>(s1) << 32) | static_cast<uint32>(s2);
+    Shard &shard = shards[(key * 0x9E3779B97F4A7C15ULL) >> 56];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.ids.find(key);
+    if (it != shard.ids.end()) return it->second;
+    StateId id = num_states++;
+    shard.ids.emplace(key, id);
+    fresh->emplace_back(id, std::make_pair(s1, s2));
+    return id;
+  };
+
+  // The expanded states of each thread, which are added to ofst at the end
+  struct Expanded {
+    StateId id;
+    Weight final;
+    std::vector<Arc> arcs;
+  };
+  std::vector<std::vector<Expanded> > expanded(num_threads);
+  auto expand = [&](const Pending &pending, std::vector<Pending> *fresh,
+                    std::vector<Expanded> *out) {
+    StateId s1 = pending.second.first, s2 = pending.second.second;
+    out->emplace_back();
+    Expanded &state = out->back();
+    state.id = pending.first;
+    state.final = Times(fst1.Final(s1), fst2.Final(s2));
+    const size_t num_arcs2 = fst2.NumArcs(s2);
+    ArcIterator<Fst<Arc> > aiter2(fst2, s2);
+    for (ArcIterator<Fst<Arc> > aiter1(fst1, s1); !aiter1.Done();
+         aiter1.Next()) {
+      const Arc &arc1 = aiter1.Value();
+      if (arc1.olabel == 0) {
+        state.arcs.emplace_back(arc1.ilabel, 0, arc1.weight,
+                                find_or_add(arc1.nextstate, s2, fresh));
+        continue;
+      }
+      // The first arc of fst2 of the ilabel
+      size_t low = 0, high = num_arcs2;
+      while (low < high) {
+        size_t mid = (low + high) / 2;
+        aiter2.Seek(mid);
+        if (aiter2.Value().ilabel < arc1.olabel) {
+          low = mid + 1;
+        } else {
+          high = mid;
+        }
+      }
+      for (aiter2.Seek(low);
+           !aiter2.Done() && aiter2.Value().ilabel == arc1.olabel;
+           aiter2.Next()) {
+        const Arc &arc2 = aiter2.Value();
+        state.arcs.emplace_back(
+            arc1.ilabel, arc2.olabel, Times(arc1.weight, arc2.weight),
+            find_or_add(arc1.nextstate, arc2.nextstate, fresh));
+      }
+    }
+  };
+
+  std::vector<Pending> level;
+  find_or_add(fst1.Start(), fst2.Start(), &level);
+  while (!level.empty()) {
+    const size_t kBatch = 64;
+    std::atomic<size_t> next(0);
+    std::vector<std::vector<Pending> > fresh(num_threads);
+    auto work = [&](int t) {
+      for (;;) {
+        size_t begin = next.fetch_add(kBatch);
+        if (begin >= level.size()) break;
+        size_t end = std::min(begin + kBatch, level.size());
+        for (size_t i = begin; i < end; ++i) {
+          expand(level[i], &fresh[t], &expanded[t]);
+        }
+      }
+    };
+    // The small levels, e.g. the first ones, are expanded by this thread
+    int level_threads = std::min<size_t>(num_threads, level.size() / kBatch);
+    std::vector<std::thread> threads;
+    for (int t = 1; t < level_threads; ++t) threads.emplace_back(work, t);
+    work(0);
+    for (auto &thread : threads) thread.join();
+    level.clear();
+    for (auto &states : fresh) {
+      level.insert(level.end(), states.begin(), states.end());
+    }
+  }
+
+  ofst->ReserveStates(num_states);
+  for (StateId s = 0; s < num_states; ++s) ofst->AddState();
+  ofst->SetStart(0);
+  for (auto &states : expanded) {
+    for (auto &state : states) {
+      ofst->SetFinal(state.id, state.final);
+      ofst->ReserveArcs(state.id, state.arcs.size());
+      for (const Arc &arc : state.arcs) ofst->AddArc(state.id, arc);
+      std::vector<Arc>().swap(state.arcs);
+    }
+  }
+  if (connect) Connect(ofst);
+}
+
+}  // namespace fst
+
+#endif  // KALDI_FSTEXT_PARALLEL_COMPOSE_H_
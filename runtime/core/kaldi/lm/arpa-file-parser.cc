@@ -20,7 +20,9 @@
 
 #include <fst/fstlib.h>
 
+#include <algorithm>
 #include <sstream>
+#include <thread>
 
 #include "base/kaldi-error.h"
 #include "base/kaldi-math.h"
@@ -128,9 +130,6 @@ void ArpaFileParser::Read(std::istream& is) {
   // Signal that grammar order and n-gram counts are known.
   HeaderAvailable();
 
-  NGram ngram;
-  ngram.words.reserve(ngram_counts_.size());
-
   // Processes "\N-grams:" section.
   for (int32 cur_order = 1; cur_order <= ngram_counts_.size(); ++cur_order) {
     // Skips n-grams with zero count.
@@ -147,6 +146,10 @@ void ArpaFileParser::Read(std::istream& is) {
     }
     KALDI_LOG << "Reading " << current_line_ << " section.";
 
+    // The data lines are parsed in batches, by multiple threads if required
+    const size_t kBatchSize = 1 << 16;
+    std::vector<NGramLine> batch;
+    batch.reserve(kBatchSize);
     int32 ngram_count = 0;
     while (++line_number_, getline(is, current_line_) && !is.eof()) {
       if (current_line_.find_first_not_of(" \n\t\r") == std::string::npos) {
@@ -175,72 +178,22 @@ void ArpaFileParser::Read(std::istream& is) {
         }
       }
 
-      std::vector<std::string> col;
-      SplitStringToVector(current_line_, " \t", true, &col);
-
-      if (col.size() < 1 + cur_order || col.size() > 2 + cur_order ||
-          (cur_order == ngram_counts_.size() && col.size() != 1 + cur_order)) {
-        PARSE_ERR << "Invalid n-gram data line";
-      }
       ++ngram_count;
-
-      // Parse out n-gram logprob and, if present, backoff weight.
-      if (!ConvertStringToReal(col[0], &ngram.logprob)) {
-        PARSE_ERR << "invalid n-gram logprob '" << col[0] << "'";
-      }
-      ngram.backoff = 0.0;
-      if (col.size() > cur_order + 1) {
-        if (!ConvertStringToReal(col[cur_order + 1], &ngram.backoff))
-          PARSE_ERR << "invalid backoff weight '" << col[cur_order + 1] << "'";
-      }
-      // Convert to natural log.
-      ngram.logprob *= M_LN10;
-      ngram.backoff *= M_LN10;
-
-      ngram.words.resize(cur_order);
-      bool skip_ngram = false;
-      for (int32 index = 0; !skip_ngram && index < cur_order; ++index) {
-        int32 word;
-        if (symbols_) {
-          // Symbol table provided, so symbol labels are expected.
-          if (options_.oov_handling == ArpaParseOptions::kAddToSymbols) {
-            word = symbols_->AddSymbol(col[1 + index]);
-          } else {
-            word = symbols_->Find(col[1 + index]);
-            if (word == -1) {  // fst::kNoSymbol
-              switch (options_.oov_handling) {
-                case ArpaParseOptions::kReplaceWithUnk:
-                  word = options_.unk_symbol;
-                  break;
-                case ArpaParseOptions::kSkipNGram:
-                  if (ShouldWarn())
-                    KALDI_WARN << LineReference() << " skipped: word '"
-                               << col[1 + index] << "' not in symbol table";
-                  skip_ngram = true;
-                  break;
-                default:
-                  PARSE_ERR << "word '" << col[1 + index]
-                            << "' not in symbol table";
-              }
-            }
-          }
-        } else {
-          // Symbols not provided, LM file should contain integers.
-          if (!ConvertStringToInteger(col[1 + index], &word) || word < 0) {
-            PARSE_ERR << "invalid symbol '" << col[1 + index] << "'";
-          }
-        }
-        // Whichever way we got it, an epsilon is invalid.
-        if (word == 0) {
-          PARSE_ERR << "epsilon symbol '" << col[1 + index]
-                    << "' is illegal in ARPA LM";
-        }
-        ngram.words[index] = word;
-      }
-      if (!skip_ngram) {
-        ConsumeNGram(ngram);
+      batch.emplace_back();
+      batch.back().line.swap(current_line_);
+      batch.back().line_number = line_number_;
+      if (batch.size() == kBatchSize) {
+        ConsumeNGramLines(cur_order, &batch);
+        batch.clear();
       }
     }
+    // The directive line is kept for the checks below
+    std::string directive_line;
+    directive_line.swap(current_line_);
+    int32 directive_line_number = line_number_;
+    ConsumeNGramLines(cur_order, &batch);
+    current_line_.swap(directive_line);
+    line_number_ = directive_line_number;
     if (ngram_count > ngram_counts_[cur_order - 1]) {
       PARSE_ERR << "header said there would be " << ngram_counts_[cur_order - 1]
                 << " n-grams of order " << cur_order
@@ -271,6 +224,132 @@ std::string ArpaFileParser::LineReference() const {
   return ss.str();
 }
 
+void ArpaFileParser::ParseNGramLine(int32 order, NGramLine* ngram_line) const {
+  NGram& ngram = ngram_line->ngram;
+  ngram_line->status = NGramLine::kInvalid;
+  std::vector<std::string> col;
+  SplitStringToVector(ngram_line->line, " \t", true, &col);
+
+  if (col.size() < 1 + order || col.size() > 2 + order ||
+      (order == ngram_counts_.size() && col.size() != 1 + order)) {
+    ngram_line->message = "Invalid n-gram data line";
+    return;
+  }
+
+  // Parse out n-gram logprob and, if present, backoff weight.
+  if (!ConvertStringToReal(col[0], &ngram.logprob)) {
+    ngram_line->message = "invalid n-gram logprob '" + col[0] + "'";
+    return;
+  }
+  ngram.backoff = 0.0;
+  if (col.size() > order + 1) {
+    if (!ConvertStringToReal(col[order + 1], &ngram.backoff)) {
+      ngram_line->message = "invalid backoff weight '" + col[order + 1] + "'";
+      return;
+    }
+  }
+  // Convert to natural log.
+  ngram.logprob *= M_LN10;
+  ngram.backoff *= M_LN10;
+
+  ngram.words.resize(order);
+  for (int32 index = 0; index < order; ++index) {
+    int32 word;
+    if (symbols_) {
+      // Symbol table provided, so symbol labels are expected.
+      if (options_.oov_handling == ArpaParseOptions::kAddToSymbols) {
+        // Mapped in the file order by ConsumeNGramLines().
+        continue;
+      }
+      word = symbols_->Find(col[1 + index]);
+      if (word == -1) {  // fst::kNoSymbol
+        switch (options_.oov_handling) {
+          case ArpaParseOptions::kReplaceWithUnk:
+            word = options_.unk_symbol;
+            break;
+          case ArpaParseOptions::kSkipNGram:
+            ngram_line->status = NGramLine::kSkipped;
+            ngram_line->message =
+                "word '" + col[1 + index] + "' not in symbol table";
+            return;
+          default:
+            ngram_line->message =
+                "word '" + col[1 + index] + "' not in symbol table";
+            return;
+        }
+      }
+    } else {
+      // Symbols not provided, LM file should contain integers.
+      if (!ConvertStringToInteger(col[1 + index], &word) || word < 0) {
+        ngram_line->message = "invalid symbol '" + col[1 + index] + "'";
+        return;
+      }
+    }
+    // Whichever way we got it, an epsilon is invalid.
+    if (word == 0) {
+      ngram_line->message =
+          "epsilon symbol '" + col[1 + index] + "' is illegal in ARPA LM";
+      return;
+    }
+    ngram.words[index] = word;
+  }
+  ngram_line->status = NGramLine::kParsed;
+}
+
+void ArpaFileParser::ConsumeNGramLines(int32 order,
+                                       std::vector<NGramLine>* lines) {
+  int32 num_threads =
+      std::max(1, std::min<int32>(options_.num_threads, lines->size()));
+  if (num_threads == 1) {
+    for (NGramLine& ngram_line : *lines) ParseNGramLine(order, &ngram_line);
+  } else {
+    std::vector<std::thread> threads;
+    size_t step = (lines->size() + num_threads - 1) / num_threads;
+    for (size_t begin = 0; begin < lines->size(); begin += step) {
+      size_t end = std::min(begin + step, lines->size());
+      threads.emplace_back([this, order, lines, begin, end]() {
+        for (size_t i = begin; i < end; ++i)
+          ParseNGramLine(order, &(*lines)[i]);
+      });
+    }
+    for (std::thread& thread : threads) thread.join();
+  }
+
+  // The n-grams are consumed in the file order, and the diagnostics refer
+  // to their lines.
+  for (NGramLine& ngram_line : *lines) {
+    current_line_.swap(ngram_line.line);
+    line_number_ = ngram_line.line_number;
+    if (ngram_line.status == NGramLine::kParsed && symbols_ != NULL &&
+        options_.oov_handling == ArpaParseOptions::kAddToSymbols) {
+      std::vector<std::string> col;
+      SplitStringToVector(current_line_, " \t", true, &col);
+      for (int32 index = 0; index < order; ++index) {
+        int32 word = symbols_->AddSymbol(col[1 + index]);
+        if (word == 0) {
+          ngram_line.status = NGramLine::kInvalid;
+          ngram_line.message =
+              "epsilon symbol '" + col[1 + index] + "' is illegal in ARPA LM";
+          break;
+        }
+        ngram_line.ngram.words[index] = word;
+      }
+    }
+    switch (ngram_line.status) {
+      case NGramLine::kParsed:
+        ConsumeNGram(ngram_line.ngram);
+        break;
+      case NGramLine::kSkipped:
+        if (ShouldWarn())
+          KALDI_WARN << LineReference() << " skipped: " << ngram_line.message;
+        break;
+      default:
+        KALDI_ERR << LineReference() << ": " << ngram_line.message;
+    }
+  }
+  current_line_.clear();
+}
+
 bool ArpaFileParser::ShouldWarn() {
   return (warning_count_ != -1) &&
          (++warning_count_ <= static_cast<uint32>(options_.max_warnings));
@@ -47,7 +47,8 @@ struct ArpaParseOptions {
         eos_symbol(-1),
         unk_symbol(-1),
         oov_handling(kRaiseError),
-        max_warnings(30) {}
+        max_warnings(30),
+        num_threads(1) {}
 
   void Register(OptionsItf* opts) {
     // Registering only the max_warnings count, since other options are
@@ -56,6 +57,8 @@ struct ArpaParseOptions {
     opts->Register("max-arpa-warnings", &max_warnings,
                    "Maximum warnings to report on ARPA parsing, "
                    "0 to disable, -1 to show all");
+    opts->Register("num-threads", &num_threads,
+                   "Number of threads to parse the n-gram lines of ARPA file");
   }
 
   int32 bos_symbol;  ///< Symbol for <s>, Required non-epsilon.
@@ -63,6 +66,7 @@ struct ArpaParseOptions {
   int32 unk_symbol;  ///< Symbol for <unk>, Required for kReplaceWithUnk.
   OovHandling oov_handling;  ///< How to handle OOV words in the file.
   int32 max_warnings;        ///< Maximum warnings to report, <0 unlimited.
+  int32 num_threads;  ///< Threads to parse the n-gram lines, in batches.
 };
 
 /**
@@ -136,6 +140,25 @@ class ArpaFileParser {
   const std::vector<int32>& NgramCounts() const { return ngram_counts_; }
 
  private:
+  /// An n-gram line of the batch which is parsed in parallel.
+  struct NGramLine {
+    enum Status { kParsed, kSkipped, kInvalid };
+    std::string line;
+    int32 line_number;
+    NGram ngram;
+    Status status;
+    std::string message;  // Why the line is skipped or invalid.
+  };
+
+  /// Parses the n-gram lines of the given order. The words are mapped here
+  /// unless oov_handling is kAddToSymbols, which changes the symbol table
+  /// and is left to ConsumeNGramLines(), so it's safe to call in parallel.
+  void ParseNGramLine(int32 order, NGramLine* ngram_line) const;
+
+  /// Parses the batch by options_.num_threads threads, then consumes the
+  /// n-grams in the file order.
+  void ConsumeNGramLines(int32 order, std::vector<NGramLine>* lines);
+
   ArpaParseOptions options_;
   fst::SymbolTable* symbols_;  // the pointer is not owned here.
   int32 line_number_;
@@ -288,6 +288,12 @@ ArpaLmCompiler::~ArpaLmCompiler() {
 
 void ArpaLmCompiler::HeaderAvailable() {
   KALDI_ASSERT(impl_ == NULL);
+  // There is a state for each n-gram except the highest order ones, plus the
+  // 0-gram and the </s> states, reserve them to avoid growing the FST.
+  int64 num_states = 2;
+  for (size_t i = 0; i + 1 < NgramCounts().size(); ++i)
+    num_states += NgramCounts()[i];
+  fst_.ReserveStates(num_states);
   // Use optimized implementation if the grammar is 4-gram or less, and the
   // maximum attained symbol id will fit into the optimized range.
   int64 max_symbol = 0;
@@ -372,6 +378,10 @@ void ArpaLmCompiler::Check() const {
 }
 
 void ArpaLmCompiler::ReadComplete() {
+  // The history map is as large as the FST for big models, and isn't needed
+  // anymore, free it before post-processing the FST.
+  delete impl_;
+  impl_ = NULL;
   fst_.SetInputSymbols(Symbols());
   fst_.SetOutputSymbols(Symbols());
   RemoveRedundantStates();
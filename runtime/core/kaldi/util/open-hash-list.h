@@ -0,0 +1,210 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_OPEN_HASH_LIST_H_
+#define KALDI_UTIL_OPEN_HASH_LIST_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "base/kaldi-types.h"
+#include "base/kaldi-error.h"
+
+/* OpenHashList has the interface of HashList (see hash-list.h), i.e. a
+   singly-linked list of Elems of which the current one is indexed by the key,
+   but the index is an open addressing hash table with linear probing instead
+   of the chained buckets. The keys and the Elem pointers of the slots are in
+   two separate arrays, so a probe reads consecutive keys of one cache line
+   and the Elem is only touched on a hit, while Find() of HashList walks the
+   Elems of the bucket, which are scattered over the heap. The table is kept
+   at most half full and grows by itself, Clear() only resets the slots in
+   use. It is selected for the tokens of LatticeFasterDecoderTpl by
+   KALDI_OPEN_HASH_TOKENS, see lattice-faster-decoder.h.
+
+   The max value of I is the mark of the empty slots, it must not be a key.
+*/
+
+namespace kaldi {
+
+template <class I, class T>
+class OpenHashList {
+ public:
+  struct Elem {
+    I key;
+    T val;
+    Elem *tail;
+  };
+
+  OpenHashList()
+      : list_head_(NULL), list_tail_(NULL), freed_head_(NULL), mask_(0) {}
+
+  /// Clears the hash and gives the head of the current list to the user,
+  /// who must call Delete() for each element in the list, as HashList.
+  Elem *Clear() {
+    for (size_t slot : used_) keys_[slot] = kEmptyKey;
+    used_.clear();
+    Elem *ans = list_head_;
+    list_head_ = list_tail_ = NULL;
+    return ans;
+  }
+
+  const Elem *GetList() const { return list_head_; }
+
+  inline void Delete(Elem *e) {
+    e->tail = freed_head_;
+    freed_head_ = e;
+  }
+
+  inline Elem *New() {
+    if (freed_head_ == NULL) {
+      Elem *block = new Elem[kAllocateBlockSize];
+      for (size_t i = 0; i + 1 < kAllocateBlockSize; i++)
+        block[i].tail = block + i + 1;
+      block[kAllocateBlockSize - 1].tail = NULL;
+      freed_head_ = block;
+      allocated_.push_back(block);
+    }
+    Elem *ans = freed_head_;
+    freed_head_ = freed_head_->tail;
+    return ans;
+  }
+
+  /// Returns the first Elem of the key in the current list, or NULL.
+  inline Elem *Find(I key) {
+    if (used_.empty()) return NULL;
+    for (size_t slot = Slot(key);; slot = (slot + 1) & mask_) {
+      if (keys_[slot] == key) return elems_[slot];
+      if (keys_[slot] == kEmptyKey) return NULL;
+    }
+  }
+
+  /// Returns the existing Elem of the key, or appends a new one to the
+  /// current list.
+  inline Elem *Insert(I key, T val) {
+    KALDI_ASSERT(key != kEmptyKey);
+    // Keep the table at most half full
+    if ((used_.size() + 1) * 2 > keys_.size()) Rehash(keys_.size() * 2);
+    size_t slot = Slot(key);
+    for (; keys_[slot] != kEmptyKey; slot = (slot + 1) & mask_) {
+      if (keys_[slot] == key) return elems_[slot];
+    }
+    Elem *elem = New();
+    elem->key = key;
+    elem->val = val;
+    elem->tail = NULL;
+    if (list_tail_ == NULL) {
+      list_head_ = elem;
+    } else {
+      list_tail_->tail = elem;
+    }
+    list_tail_ = elem;
+    keys_[slot] = key;
+    elems_[slot] = elem;
+    used_.push_back(slot);
+    return elem;
+  }
+
+  /// Inserts another element of a key already present, after the last
+  /// element of the key, so the elements of the same key follow each other.
+  inline void InsertMore(I key, T val) {
+    Elem *e = Find(key);
+    KALDI_ASSERT(e != NULL);  // assume one element is already here
+    while (e->tail != NULL && e->tail->key == key) e = e->tail;
+    Elem *elem = New();
+    elem->key = key;
+    elem->val = val;
+    elem->tail = e->tail;
+    e->tail = elem;
+    if (list_tail_ == e) list_tail_ = elem;
+  }
+
+  /// Reserves the slots of about sz / 2 elements, the table grows beyond it
+  /// if needed. It must be called while the hash is empty.
+  void SetSize(size_t sz) {
+    KALDI_ASSERT(list_head_ == NULL && used_.empty());  // make sure empty.
+    if (sz > keys_.size()) Rehash(sz);
+  }
+
+  /// Returns current number of slots.
+  inline size_t Size() { return keys_.size(); }
+
+  ~OpenHashList() {
+    // The same check of the memory leak as HashList
+    size_t num_in_list = 0, num_allocated = 0;
+    for (Elem *e = freed_head_; e != NULL; e = e->tail) num_in_list++;
+    for (size_t i = 0; i < allocated_.size(); i++) {
+      num_allocated += kAllocateBlockSize;
+      delete[] allocated_[i];
+    }
+    if (num_in_list != num_allocated) {
+      KALDI_WARN << "Possible memory leak: " << num_in_list
+                 << " != " << num_allocated
+                 << ": you might have forgotten to call Delete on "
+                 << "some Elems";
+    }
+  }
+
+ private:
+  static constexpr I kEmptyKey = std::numeric_limits<I>::max();
+  static const size_t kAllocateBlockSize = 1024;
+
+  // Fibonacci hashing, so the close keys, e.g. the states of a graph, are
+  // spread over the table.
+  inline size_t Slot(I key) const {
+    return static_cast<size_t>(
+               (static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> 32) &
+           mask_;
+  }
+
+  // Reindex the current list in a table of the power of two above size
+  void Rehash(size_t size) {
+    size_t capacity = 16;
+    while (capacity < size) capacity *= 2;
+    keys_.assign(capacity, kEmptyKey);
+    elems_.resize(capacity);
+    mask_ = capacity - 1;
+    used_.clear();
+    for (Elem *e = list_head_; e != NULL; e = e->tail) {
+      size_t slot = Slot(e->key);
+      // The first of the elements of the same key is indexed
+      for (; keys_[slot] != kEmptyKey && keys_[slot] != e->key;
+           slot = (slot + 1) & mask_) {
+      }
+      if (keys_[slot] == e->key) continue;
+      keys_[slot] = e->key;
+      elems_[slot] = e;
+      used_.push_back(slot);
+    }
+  }
+
+  Elem *list_head_;  // head of currently stored list.
+  Elem *list_tail_;  // tail of it, where the new elements are appended.
+  Elem *freed_head_;
+  std::vector<Elem *> allocated_;
+
+  // The slots, keys_ are kEmptyKey if empty
+  std::vector<I> keys_;
+  std::vector<Elem *> elems_;
+  size_t mask_;
+  // The slots in use, so Clear() doesn't scan the whole table
+  std::vector<size_t> used_;
+};
+
+template <class I, class T>
+constexpr I OpenHashList<I, T>::kEmptyKey;
+
+}  // end namespace kaldi
+
+#endif  // KALDI_UTIL_OPEN_HASH_LIST_H_
@@ -0,0 +1,167 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "post_processor/itn_processor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "post_processor/token_parser.h"
+#include "utils/fst_io.h"
+#include "utils/log.h"
+
+namespace wenet {
+
+// The FSTs of WeTextProcessing are sorted, the others are sorted in a copy
+static std::shared_ptr<const fst::StdFst> ArcSorted(
+    std::shared_ptr<const fst::StdFst> fst) {
+  if (fst->Properties(fst::kILabelSorted, true)) return fst;
+  auto sorted = std::make_shared<fst::StdVectorFst>(*fst);
+  fst::ArcSort(sorted.get(), fst::StdILabelCompare());
+  return sorted;
+}
+
+ItnProcessor::ItnProcessor(std::shared_ptr<const fst::StdFst> tagger,
+                           std::shared_ptr<const fst::StdFst> verbalizer)
+    : tagger_(ArcSorted(std::move(tagger))),
+      verbalizer_(ArcSorted(std::move(verbalizer))) {}
+
+std::shared_ptr<ItnProcessor> ItnProcessor::Read(
+    const std::string& tagger_path, const std::string& verbalizer_path) {
+  std::shared_ptr<const fst::StdFst> tagger = ReadFst(tagger_path);
+  std::shared_ptr<const fst::StdFst> verbalizer = ReadFst(verbalizer_path);
+  if (tagger == nullptr || verbalizer == nullptr) return nullptr;
+  return std::make_shared<ItnProcessor>(std::move(tagger),
+                                        std::move(verbalizer));
+}
+
+std::string ItnProcessor::Normalize(const std::string& text) const {
+  if (text.empty()) return text;
+  std::string tagged, reordered, output;
+  if (!ShortestOutput(*tagger_, text, &tagged) ||
+      !ReorderTextTokens(tagged, &reordered) ||
+      !ShortestOutput(*verbalizer_, reordered, &output)) {
+    VLOG(1) << "Skip the itn of " << text;
+    return text;
+  }
+  return output;
+}
+
+bool ItnProcessor::ShortestOutput(const fst::StdFst& fst,
+                                  const std::string& input,
+                                  std::string* output) {
+  using Arc = fst::StdArc;
+  // A state of the fst at a byte position, reached by `olabel` from `back`
+  struct Node {
+    int state;
+    float cost;
+    int back;
+    int olabel;
+    bool queued;
+  };
+  output->clear();
+  if (fst.Start() == fst::kNoStateId) return false;
+  std::vector<Node> nodes;
+  // The nodes of the position by the state
+  std::unordered_map<int, int> layer, next_layer;
+  // Return the node if its cost is improved
+  auto relax = [&nodes](std::unordered_map<int, int>* nodes_of, int state,
+                        float cost, int back, int olabel) -> int {
+    auto it = nodes_of->find(state);
+    if (it == nodes_of->end()) {
+      nodes.push_back({state, cost, back, olabel, false});
+      nodes_of->emplace(state, nodes.size() - 1);
+      return nodes.size() - 1;
+    }
+    Node& node = nodes[it->second];
+    if (cost >= node.cost) return -1;
+    node.cost = cost;
+    node.back = back;
+    node.olabel = olabel;
+    return it->second;
+  };
+  relax(&layer, fst.Start(), 0.0, -1, 0);
+  std::deque<int> queue;
+  for (size_t pos = 0; pos <= input.size(); ++pos) {
+    int label = pos < input.size() ? static_cast<uint8_t>(input[pos]) : -1;
+    for (const auto& item : layer) {
+      queue.push_back(item.second);
+      nodes[item.second].queued = true;
+    }
+    // The epsilon arcs stay at the position, until the costs converge
+    while (!queue.empty()) {
+      int id = queue.front();
+      queue.pop_front();
+      nodes[id].queued = false;
+      int state = nodes[id].state;
+      float cost = nodes[id].cost;
+      size_t num_arcs = fst.NumArcs(state);
+      fst::ArcIterator<fst::StdFst> aiter(fst, state);
+      for (; !aiter.Done() && aiter.Value().ilabel == 0; aiter.Next()) {
+        const Arc& arc = aiter.Value();
+        int next = relax(&layer, arc.nextstate, cost + arc.weight.Value(), id,
+                         arc.olabel);
+        if (next >= 0 && !nodes[next].queued) {
+          nodes[next].queued = true;
+          queue.push_back(next);
+        }
+      }
+      if (label < 0) continue;
+      // The first arc of the label by binary search
+      size_t low = aiter.Done() ? num_arcs : aiter.Position();
+      size_t high = num_arcs;
+      while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        aiter.Seek(mid);
+        if (aiter.Value().ilabel < label) {
+          low = mid + 1;
+        } else {
+          high = mid;
+        }
+      }
+      for (aiter.Seek(low); !aiter.Done() && aiter.Value().ilabel == label;
+           aiter.Next()) {
+        const Arc& arc = aiter.Value();
+        relax(&next_layer, arc.nextstate, cost + arc.weight.Value(), id,
+              arc.olabel);
+      }
+    }
+    if (pos == input.size()) break;
+    if (next_layer.empty()) return false;
+    layer.swap(next_layer);
+    next_layer.clear();
+  }
+  int best = -1;
+  float best_cost = std::numeric_limits<float>::infinity();
+  for (const auto& item : layer) {
+    float cost = nodes[item.second].cost + fst.Final(item.first).Value();
+    if (cost < best_cost) {
+      best_cost = cost;
+      best = item.second;
+    }
+  }
+  if (best < 0) return false;
+  for (int id = best; id >= 0; id = nodes[id].back) {
+    if (nodes[id].olabel != 0) *output += static_cast<char>(nodes[id].olabel);
+  }
+  std::reverse(output->begin(), output->end());
+  return true;
+}
+
+}  // namespace wenet
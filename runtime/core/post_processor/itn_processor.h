@@ -0,0 +1,61 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef POST_PROCESSOR_ITN_PROCESSOR_H_
+#define POST_PROCESSOR_ITN_PROCESSOR_H_
+
+#include <memory>
+#include <string>
+
+#include "fst/fstlib.h"
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The inverse text normalization by the tagger and the verbalizer FSTs
+// compiled by WeTextProcessing, over the UTF-8 bytes, e.g.
+//   "二零二二年三月一日" -> "2022/03/01"
+// The text is tagged by the shortest path of the tagger, of which the tokens
+// are reordered for the verbalizer, then verbalized by its shortest path.
+// The paths are searched on the pair of the byte position and the state,
+// so the FSTs are only read, instead of composed with the text, and one
+// ItnProcessor is shared by all the sessions.
+class ItnProcessor {
+ public:
+  ItnProcessor(std::shared_ptr<const fst::StdFst> tagger,
+               std::shared_ptr<const fst::StdFst> verbalizer);
+  // nullptr if the FSTs can't be read
+  static std::shared_ptr<ItnProcessor> Read(const std::string& tagger_path,
+                                            const std::string& verbalizer_path);
+
+  // The text is returned as it is if it's not accepted by the FSTs
+  std::string Normalize(const std::string& text) const;
+
+  // The output of the shortest path of the fst on the input bytes, false if
+  // there is no path. The arcs of fst are sorted by the input labels.
+  static bool ShortestOutput(const fst::StdFst& fst, const std::string& input,
+                             std::string* output);
+
+ private:
+  std::shared_ptr<const fst::StdFst> tagger_;
+  std::shared_ptr<const fst::StdFst> verbalizer_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ItnProcessor);
+};
+
+}  // namespace wenet
+
+#endif  // POST_PROCESSOR_ITN_PROCESSOR_H_
@@ -14,53 +14,70 @@
 
 #include "post_processor/post_processor.h"
 
-#include <sstream>
-#include <vector>
+#include <string>
 
 #include "utils/string.h"
 
 namespace wenet {
 
 std::string PostProcessor::ProcessSpace(const std::string& str) {
-  std::string result = str;
-  // 1. remove ' ' if needed
-  // only spaces between mandarin words need to be removed, please note that
-  // if str contains '_', we assume that the decoding type must be
-  // `CtcPrefixBeamSearch` and this branch will do nothing since str must be
-  // obtained via "".join() (in function `AsrDecoder::UpdateResult()`)
-  if (opts_.language_type == kMandarinEnglish && !str.empty()) {
-    result.clear();
-    // split str by ' '
-    std::vector<std::string> words;
-    std::stringstream ss(str);
-    std::string tmp;
-    while (ss >> tmp) {
-      words.push_back(tmp);
-    }
-    // check english word
+  std::string result;
+  ProcessSpace(str, &result);
+  return result;
+}
+
+void PostProcessor::ProcessSpace(const std::string& str,
+                                 std::string* out) const {
+  static const char* kWhitespace = " \n\r\t\f\v";
+  out->clear();
+  // Both '▁' is replaced with ' ' and the case is converted by the writer,
+  // for both kMandarinEnglish and kIndoEuropean
+  BlankWriter writer(opts_.lowercase, out);
+  if (opts_.language_type == kMandarinEnglish) {
+    // only spaces between mandarin words need to be removed, please note that
+    // if str contains '_', we assume that the decoding type must be
+    // `CtcPrefixBeamSearch` and this branch will do nothing since str must be
+    // obtained via "".join() (in function `AsrDecoder::UpdateResult()`)
     bool is_englishword_prev = false;
-    bool is_englishword_now = false;
-    for (std::string& w : words) {
-      is_englishword_now = CheckEnglishWord(w);
-      if (is_englishword_prev && is_englishword_now) {
-        result += (' ' + w);
-      } else {
-        result += (w);
-      }
+    size_t start = str.find_first_not_of(kWhitespace);
+    while (start != std::string::npos) {
+      size_t end = str.find_first_of(kWhitespace, start);
+      if (end == std::string::npos) end = str.size();
+      bool is_englishword_now = CheckEnglishWord(str.data() + start,
+                                                 end - start);
+      if (is_englishword_prev && is_englishword_now) writer.Append(" ", 1);
+      writer.Append(str.data() + start, end - start);
       is_englishword_prev = is_englishword_now;
+      start = str.find_first_not_of(kWhitespace, end);
+    }
+  } else {
+    size_t start = str.find_first_not_of(kWhitespace);
+    if (start != std::string::npos) {
+      size_t end = str.find_last_not_of(kWhitespace) + 1;
+      writer.Append(str.data() + start, end - start);
     }
   }
-  // 2. replace '_' with ' '
-  // this should be done for all cases (both kMandarinEnglish and kIndoEuropean)
-  result = ProcessBlank(result, opts_.lowercase);
-  return result;
+  writer.Finish();
+}
+
+std::string PostProcessor::InverseTN(const std::string& str) {
+  if (resource_ == nullptr || resource_->itn == nullptr) return str;
+  return resource_->itn->Normalize(str);
 }
 
 std::string PostProcessor::Process(const std::string& str, bool finish) {
   std::string result;
-  result = ProcessSpace(str);
-  // TODO(xcsong): do itn/punctuation if finish == true
+  Process(str, finish, &result);
   return result;
 }
 
+void PostProcessor::Process(const std::string& str, bool finish,
+                            std::string* out) {
+  ProcessSpace(str, out);
+  if (finish && resource_ != nullptr && resource_->itn != nullptr) {
+    *out = resource_->itn->Normalize(*out);
+  }
+  // TODO(xcsong): do punctuation if finish == true
+}
+
 }  // namespace wenet
@@ -19,6 +19,7 @@
 #include <string>
 #include <utility>
 
+#include "post_processor/itn_processor.h"
 #include "utils/utils.h"
 
 namespace wenet {
@@ -45,24 +46,44 @@ struct PostProcessOptions {
   bool lowercase = true;
 };
 
-// TODO(xcsong): add itn/punctuation related resource
-struct PostProcessResource {};
+// The resource of the post processing, which is loaded once and shared
+// by the sessions
+struct PostProcessResource {
+  // Optional, the inverse text normalization of the final results
+  std::shared_ptr<const ItnProcessor> itn = nullptr;
+  // TODO(xcsong): add punctuation related resource
+};
 
 // Post Processor
 class PostProcessor {
  public:
-  explicit PostProcessor(PostProcessOptions&& opts) : opts_(std::move(opts)) {}
-  explicit PostProcessor(const PostProcessOptions& opts) : opts_(opts) {}
-  // call other functions to do post processing
+  explicit PostProcessor(PostProcessOptions&& opts,
+                         std::shared_ptr<PostProcessResource> resource =
+                             nullptr)
+      : opts_(std::move(opts)), resource_(std::move(resource)) {}
+  explicit PostProcessor(const PostProcessOptions& opts,
+                         std::shared_ptr<PostProcessResource> resource =
+                             nullptr)
+      : opts_(opts), resource_(std::move(resource)) {}
+  // call other functions to do post processing, the itn is only done if
+  // finish is true
   std::string Process(const std::string& str, bool finish);
+  // the same as above, but the result is written to out, of which the
+  // buffer is reused
+  void Process(const std::string& str, bool finish, std::string* out);
   // process spaces according to configurations
   std::string ProcessSpace(const std::string& str);
-  // TODO(xcsong): add itn/punctuation
-  // void InverseTN(const std::string& str);
+  // the same as above in one pass over str, and nothing is allocated once
+  // the buffer of out has grown to the size of the results
+  void ProcessSpace(const std::string& str, std::string* out) const;
+  // inverse text normalization by the itn of the resource if it's set
+  std::string InverseTN(const std::string& str);
+  // TODO(xcsong): add punctuation
   // void Punctuate(const std::string& str);
 
  private:
   const PostProcessOptions opts_;
+  std::shared_ptr<PostProcessResource> resource_;
 
  public:
   WENET_DISALLOW_COPY_AND_ASSIGN(PostProcessor);
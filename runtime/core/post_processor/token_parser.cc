@@ -0,0 +1,154 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "post_processor/token_parser.h"
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+
+namespace wenet {
+
+// The member orders of the verbalizers of the inverse text normalization
+static const std::unordered_map<std::string, std::vector<std::string>>&
+ItnOrders() {
+  static const auto* orders =
+      new std::unordered_map<std::string, std::vector<std::string>>{
+          {"date", {"year", "month", "day"}},
+          {"fraction", {"sign", "numerator", "denominator"}},
+          {"measure", {"numerator", "denominator", "value"}},
+          {"money", {"currency", "value", "decimal"}},
+          {"time", {"hour", "minute", "second", "noon"}}};
+  return *orders;
+}
+
+std::string TextToken::String() const {
+  std::vector<const std::pair<std::string, std::string>*> ordered;
+  for (const auto& member : members) ordered.push_back(&member);
+  auto it = ItnOrders().find(name);
+  bool preserve = std::any_of(members.begin(), members.end(),
+                              [](const std::pair<std::string, std::string>& m) {
+                                return m.first == "preserve_order";
+                              });
+  if (it != ItnOrders().end() && !preserve) {
+    const std::vector<std::string>& order = it->second;
+    auto rank = [&order](const std::string& key) {
+      return std::find(order.begin(), order.end(), key) - order.begin();
+    };
+    std::stable_sort(
+        ordered.begin(), ordered.end(),
+        [&rank](const std::pair<std::string, std::string>* a,
+                const std::pair<std::string, std::string>* b) {
+          return rank(a->first) < rank(b->first);
+        });
+  }
+  std::string out = name + " {";
+  for (const auto* member : ordered) {
+    out += ' ' + member->first + ": \"" + member->second + '"';
+  }
+  return out + " }";
+}
+
+// A cursor over the tagged text, which skips the spaces before each item
+class TagReader {
+ public:
+  explicit TagReader(const std::string& text) : text_(text) {}
+
+  bool Done() {
+    SkipSpaces();
+    return pos_ == text_.size();
+  }
+  bool Expect(char c) {
+    SkipSpaces();
+    if (pos_ == text_.size() || text_[pos_] != c) return false;
+    ++pos_;
+    return true;
+  }
+  bool Peek(char c) {
+    SkipSpaces();
+    return pos_ < text_.size() && text_[pos_] == c;
+  }
+  // A name or a key
+  bool Word(std::string* word) {
+    SkipSpaces();
+    size_t start = pos_;
+    while (pos_ < text_.size() &&
+           (isalnum(static_cast<unsigned char>(text_[pos_])) ||
+            text_[pos_] == '_')) {
+      ++pos_;
+    }
+    word->assign(text_, start, pos_ - start);
+    return !word->empty();
+  }
+  // A quoted value, of which the escapes are kept
+  bool Quoted(std::string* value) {
+    if (!Expect('"')) return false;
+    size_t start = pos_;
+    while (pos_ < text_.size() && text_[pos_] != '"') {
+      if (text_[pos_] == '\\') ++pos_;
+      ++pos_;
+    }
+    if (pos_ >= text_.size()) return false;
+    value->assign(text_, start, pos_ - start);
+    ++pos_;
+    return true;
+  }
+
+ private:
+  void SkipSpaces() {
+    while (pos_ < text_.size() && text_[pos_] == ' ') ++pos_;
+  }
+
+  const std::string& text_;
+  size_t pos_ = 0;
+};
+
+bool ParseTextTokens(const std::string& tagged,
+                     std::vector<TextToken>* tokens) {
+  tokens->clear();
+  TagReader reader(tagged);
+  std::string word;
+  while (!reader.Done()) {
+    if (!reader.Word(&word) || word != "tokens" || !reader.Expect('{')) {
+      return false;
+    }
+    TextToken token;
+    if (!reader.Word(&token.name) || !reader.Expect('{')) return false;
+    while (!reader.Peek('}')) {
+      std::string key, value;
+      if (!reader.Word(&key) || !reader.Expect(':') ||
+          !reader.Quoted(&value)) {
+        return false;
+      }
+      token.members.emplace_back(std::move(key), std::move(value));
+    }
+    if (!reader.Expect('}') || !reader.Expect('}')) return false;
+    tokens->emplace_back(std::move(token));
+  }
+  return true;
+}
+
+bool ReorderTextTokens(const std::string& tagged, std::string* reordered) {
+  std::vector<TextToken> tokens;
+  if (!ParseTextTokens(tagged, &tokens)) return false;
+  reordered->clear();
+  for (const TextToken& token : tokens) {
+    if (!reordered->empty()) *reordered += ' ';
+    *reordered += token.String();
+  }
+  return true;
+}
+
+}  // namespace wenet
@@ -0,0 +1,47 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef POST_PROCESSOR_TOKEN_PARSER_H_
+#define POST_PROCESSOR_TOKEN_PARSER_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace wenet {
+
+// The tokens tagged by the tagger FST of WeTextProcessing, e.g.
+//   tokens { char { value: "在" } } tokens { date { month: "3" day: "1" } }
+// The values are kept as they are, with the escaped quotes.
+struct TextToken {
+  std::string name;
+  std::vector<std::pair<std::string, std::string>> members;
+
+  // "name { key: "value" ... }" with the members of the order of the name
+  // first, e.g. year, month then day of a date, then the others. The order
+  // is kept if there is a preserve_order member.
+  std::string String() const;
+};
+
+// Return false if the tagged text is malformed
+bool ParseTextTokens(const std::string& tagged, std::vector<TextToken>* tokens);
+
+// Reorder the members of the tagged tokens to the order of the verbalizer,
+// which is the input of the verbalizer FST
+bool ReorderTextTokens(const std::string& tagged, std::string* reordered);
+
+}  // namespace wenet
+
+#endif  // POST_PROCESSOR_TOKEN_PARSER_H_
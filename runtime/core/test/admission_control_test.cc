@@ -0,0 +1,137 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/admission_control.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(AdmissionControlTest, MaxSessionsTest) {
+  wenet::AdmissionOptions opts;
+  opts.max_sessions = 2;
+  wenet::AdmissionController controller(opts, []() { return 0.0f; });
+  std::string reason;
+  auto first = controller.Admit(&reason);
+  auto second = controller.Admit(&reason);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  EXPECT_EQ(controller.num_sessions(), 2);
+  EXPECT_EQ(controller.Admit(&reason), nullptr);
+  EXPECT_FALSE(reason.empty());
+  EXPECT_EQ(controller.num_sessions(), 2);
+  // The session leaves with its ticket
+  first.reset();
+  EXPECT_EQ(controller.num_sessions(), 1);
+  EXPECT_NE(controller.Admit(&reason), nullptr);
+  EXPECT_EQ(controller.num_sessions(), 1);
+}
+
+TEST(AdmissionControlTest, QueueDepthTest) {
+  wenet::AdmissionOptions opts;
+  opts.max_queue_depth = 1.5;
+  float depth = 1.0;
+  wenet::AdmissionController controller(opts, [&depth]() { return depth; });
+  std::string reason;
+  auto ticket = controller.Admit(&reason);
+  EXPECT_NE(ticket, nullptr);
+  depth = 2.0;
+  EXPECT_EQ(controller.Admit(&reason), nullptr);
+  EXPECT_EQ(controller.num_sessions(), 1);
+}
+
+TEST(AdmissionControlTest, QueuedFramesTest) {
+  wenet::AdmissionOptions opts;
+  wenet::AdmissionController unlimited(opts);
+  EXPECT_FALSE(unlimited.Overloaded(1000000));
+  opts.max_queued_frames = 100;
+  wenet::AdmissionController controller(opts, []() { return 0.0f; });
+  EXPECT_FALSE(controller.Overloaded(100));
+  EXPECT_TRUE(controller.Overloaded(101));
+}
+
+TEST(AdmissionControlTest, SessionBytesTest) {
+  wenet::AdmissionOptions opts;
+  opts.max_session_bytes = 1000;
+  int64_t bytes = 1000;
+  wenet::AdmissionController controller(
+      opts, []() { return 0.0f; }, [&bytes]() { return bytes; });
+  std::string reason;
+  auto ticket = controller.Admit(&reason);
+  EXPECT_NE(ticket, nullptr);
+  bytes = 1001;
+  EXPECT_EQ(controller.Admit(&reason), nullptr);
+  EXPECT_FALSE(reason.empty());
+  EXPECT_EQ(controller.num_sessions(), 1);
+}
+
+TEST(AdmissionControlTest, ParseTenantQuotasTest) {
+  std::map<std::string, wenet::TenantQuota> quotas;
+  ASSERT_TRUE(wenet::ParseTenantQuotas("a=4:100, b=0.5:20:8,default=1:10",
+                                       &quotas));
+  ASSERT_EQ(quotas.size(), 3);
+  EXPECT_EQ(quotas["a"].weight, 4);
+  EXPECT_EQ(quotas["a"].max_sessions, 100);
+  EXPECT_EQ(quotas["a"].max_batch_audio_rate, 0);
+  EXPECT_EQ(quotas["b"].weight, 0.5);
+  EXPECT_EQ(quotas["b"].max_batch_audio_rate, 8);
+  EXPECT_EQ(quotas["default"].max_sessions, 10);
+  EXPECT_TRUE(wenet::ParseTenantQuotas("", &quotas));
+  for (const char* spec : {"a", "a=", "a=0", "a=1:x", "a=1:2:3:4", "=1"}) {
+    EXPECT_FALSE(wenet::ParseTenantQuotas(spec, &quotas)) << spec;
+  }
+}
+
+TEST(AdmissionControlTest, TenantSessionsTest) {
+  wenet::AdmissionOptions opts;
+  opts.max_sessions = 3;
+  ASSERT_TRUE(wenet::ParseTenantQuotas("a=1:1,default=1:1",
+                                       &opts.tenant_quotas));
+  wenet::AdmissionController controller(opts, []() { return 0.0f; });
+  std::string reason;
+  auto a = controller.Admit("a", &reason);
+  ASSERT_NE(a, nullptr);
+  EXPECT_EQ(a->tenant()->name(), "a");
+  EXPECT_EQ(controller.Admit("a", &reason), nullptr);
+  EXPECT_FALSE(reason.empty());
+  // The tenants not listed share the default one
+  auto other = controller.Admit("x", &reason);
+  ASSERT_NE(other, nullptr);
+  EXPECT_EQ(other->tenant()->name(), "default");
+  EXPECT_EQ(controller.Admit(&reason), nullptr);
+  EXPECT_EQ(controller.num_sessions(), 2);
+  a.reset();
+  EXPECT_EQ(controller.num_sessions(), 1);
+  EXPECT_NE(controller.Admit("a", &reason), nullptr);
+}
+
+TEST(AdmissionControlTest, TenantBatchAudioTest) {
+  wenet::TenantQuota quota;
+  quota.max_batch_audio_rate = 1;
+  wenet::Tenant tenant("t", quota);
+  std::string reason;
+  // A batch is taken as a whole within the burst, then the tenant is in
+  // debt until it's paid back
+  EXPECT_TRUE(tenant.TakeBatchAudio(wenet::Tenant::kBatchBurstSeconds - 1,
+                                    &reason));
+  EXPECT_TRUE(tenant.TakeBatchAudio(100, &reason));
+  EXPECT_FALSE(tenant.TakeBatchAudio(1, &reason));
+  EXPECT_FALSE(reason.empty());
+  wenet::Tenant unlimited("u", wenet::TenantQuota());
+  EXPECT_TRUE(unlimited.TakeBatchAudio(1e6, &reason));
+}
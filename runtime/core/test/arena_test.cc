@@ -0,0 +1,78 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/arena.h"
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(ArenaTest, FreeListTest) {
+  wenet::Arena arena(4096);
+  void* a = arena.Allocate(24);
+  void* b = arena.Allocate(32);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % wenet::Arena::kAlign, 0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % wenet::Arena::kAlign, 0);
+  EXPECT_EQ(arena.capacity(), 4096);
+  EXPECT_EQ(arena.used_bytes(), 64);
+  // The freed allocation is reused by the next one of its size class
+  arena.Deallocate(a, 24);
+  EXPECT_EQ(arena.used_bytes(), 32);
+  EXPECT_EQ(arena.Allocate(32), a);
+  arena.Deallocate(b, 32);
+  arena.Deallocate(a, 32);
+  EXPECT_EQ(arena.used_bytes(), 0);
+  // The large ones are of the heap
+  void* large = arena.Allocate(wenet::Arena::kMaxPooled + 1);
+  EXPECT_EQ(arena.used_bytes(), 0);
+  arena.Deallocate(large, wenet::Arena::kMaxPooled + 1);
+  EXPECT_EQ(arena.capacity(), 4096);
+}
+
+TEST(ArenaTest, NewBlockTest) {
+  wenet::Arena arena(4096);
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 100; ++i) ptrs.push_back(arena.Allocate(64));
+  EXPECT_EQ(arena.capacity(), 2 * 4096);
+  EXPECT_EQ(arena.used_bytes(), 100 * 64);
+  for (void* ptr : ptrs) arena.Deallocate(ptr, 64);
+  // All are from the free list this time
+  for (int i = 0; i < 100; ++i) arena.Allocate(64);
+  EXPECT_EQ(arena.capacity(), 2 * 4096);
+}
+
+TEST(ArenaTest, AllocatorTest) {
+  using Allocator = wenet::ArenaAllocator<std::pair<const int, float>>;
+  using Map = std::unordered_map<int, float, std::hash<int>,
+                                 std::equal_to<int>, Allocator>;
+  wenet::Arena arena;
+  for (wenet::Arena* a : {&arena, static_cast<wenet::Arena*>(nullptr)}) {
+    Map map(0, std::hash<int>(), std::equal_to<int>(), Allocator(a));
+    for (int frame = 0; frame < 10; ++frame) {
+      map.clear();
+      for (int i = 0; i < 100; ++i) map[i * frame] += i;
+      EXPECT_EQ(map.size(), frame == 0 ? 1 : 100);
+    }
+    EXPECT_FLOAT_EQ(map[9 * 99], 99);
+  }
+  // The nodes of the cleared map are reused by the next frames, so they all
+  // fit in one block, and all are freed with the map
+  EXPECT_EQ(arena.used_bytes(), 0);
+  EXPECT_GT(arena.capacity(), 0);
+  EXPECT_LE(arena.capacity(), 64 * 1024);
+}
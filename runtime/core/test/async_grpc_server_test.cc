@@ -0,0 +1,125 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "grpc/async_grpc_server.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+// A model of 3 tokens whose every frame is mostly blank, without the
+// attention decoder, so the streams are decoded fast
+class BlankAsrModel : public AsrModel {
+ public:
+  BlankAsrModel() { has_decoder_ = false; }
+  void Reset() override { offset_ = 0; }
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {
+    rescoring_score->assign(hyps.size(), 0.0f);
+  }
+  std::shared_ptr<AsrModel> Copy() const override {
+    return std::make_shared<BlankAsrModel>();
+  }
+
+ protected:
+  void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
+                          std::vector<std::vector<float>>* ctc_prob) override {
+    ctc_prob->assign(chunk_feats.size(), {-0.1f, -3.0f, -3.0f});
+    offset_ += chunk_feats.size();
+  }
+};
+
+class AsyncGrpcServerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    auto resource = std::make_shared<DecodeResource>();
+    resource->model = std::make_shared<BlankAsrModel>();
+    auto units = std::make_shared<fst::SymbolTable>();
+    units->AddSymbol("<blank>", 0);
+    units->AddSymbol("a", 1);
+    units->AddSymbol("b", 2);
+    resource->unit_table = units;
+    resource->symbol_table = units;
+    server_ = std::make_unique<AsyncGrpcServer>(
+        std::make_shared<FeaturePipelineConfig>(80, 16000),
+        std::make_shared<DecodeOptions>(), resource);
+    address_ = "127.0.0.1:" + std::to_string(20000 + getpid() % 20000);
+    thread_ = std::thread([this] { server_->Run(address_, 2, 2); });
+  }
+  void TearDown() override {
+    server_->Shutdown();
+    thread_.join();
+  }
+
+  // Recognize 50ms of audio, return whether the stream ends with the
+  // speech end and the ok status
+  bool Recognize(ASR::Stub* stub) {
+    grpc::ClientContext context;
+    auto stream = stub->Recognize(&context);
+    Request request;
+    request.mutable_decode_config()->set_nbest_config(1);
+    if (!stream->Write(request)) return false;
+    std::string pcm(16 * 50 * sizeof(int16_t), '\0');
+    request.set_audio_data(pcm);
+    stream->Write(request);
+    stream->WritesDone();
+    Response response;
+    bool speech_end = false;
+    while (stream->Read(&response)) {
+      if (response.type() == Response::speech_end) speech_end = true;
+    }
+    return stream->Finish().ok() && speech_end;
+  }
+
+  std::unique_ptr<AsyncGrpcServer> server_;
+  std::string address_;
+  std::thread thread_;
+};
+
+TEST_F(AsyncGrpcServerTest, ManyShortStreamsTest) {
+  // The streams finish on the completion queue threads while their decode
+  // tasks are returning, which the calls are to outlive
+  auto channel =
+      grpc::CreateChannel(address_, grpc::InsecureChannelCredentials());
+  ASSERT_TRUE(channel->WaitForConnected(std::chrono::system_clock::now() +
+                                        std::chrono::seconds(10)));
+  auto stub = ASR::NewStub(channel);
+  const int num_threads = 16;
+  const int num_streams = 20;
+  std::atomic<int> num_ok(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < num_streams; ++j) {
+        if (Recognize(stub.get())) ++num_ok;
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(num_ok, num_threads * num_streams);
+}
+
+}  // namespace wenet
@@ -0,0 +1,68 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/audio_decoder.h"
+
+#include <cmath>
+#include <vector>
+
+#ifdef USE_OPUS
+#include "opus.h"
+#endif
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+TEST(AudioDecoderTest, PcmTest) {
+  EXPECT_TRUE(IsSupportedAudioFormat("pcm"));
+  EXPECT_FALSE(IsSupportedAudioFormat("mp3"));
+  EXPECT_EQ(CreateAudioDecoder("pcm", 16000), nullptr);
+}
+
+#ifdef USE_OPUS
+TEST(AudioDecoderTest, OpusTest) {
+  const int kSampleRate = 16000;
+  const int kFrameSize = kSampleRate / 50;  // 20ms
+  int error = OPUS_OK;
+  OpusEncoder* encoder =
+      opus_encoder_create(kSampleRate, 1, OPUS_APPLICATION_VOIP, &error);
+  ASSERT_EQ(error, OPUS_OK);
+  std::unique_ptr<AudioDecoder> decoder = CreateAudioDecoder("opus",
+                                                             kSampleRate);
+  ASSERT_NE(decoder, nullptr);
+
+  std::vector<int16_t> frame(kFrameSize);
+  std::vector<unsigned char> packet(4000);
+  std::vector<int16_t> pcm;
+  const int kNumFrames = 10;
+  for (int i = 0; i < kNumFrames; ++i) {
+    for (int j = 0; j < kFrameSize; ++j) {
+      frame[j] = 8000 * std::sin(2 * M_PI * 440 * (i * kFrameSize + j) /
+                                 kSampleRate);
+    }
+    int size = opus_encode(encoder, frame.data(), kFrameSize, packet.data(),
+                           packet.size());
+    ASSERT_GT(size, 0);
+    EXPECT_TRUE(decoder->Decode(reinterpret_cast<const char*>(packet.data()),
+                                size, &pcm));
+  }
+  EXPECT_EQ(pcm.size(), kNumFrames * kFrameSize);
+  EXPECT_FALSE(decoder->Decode("", 0, &pcm));
+  EXPECT_EQ(pcm.size(), kNumFrames * kFrameSize);
+  opus_encoder_destroy(encoder);
+}
+#endif
+
+}  // namespace wenet
@@ -0,0 +1,81 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include "decoder/batch_ctc_prefix_beam_search.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "torch/torch.h"
+
+#include "decoder/ctc_prefix_beam_search.h"
+
+namespace wenet {
+
+// The n-best of the batch search are the ones of CtcPrefixBeamSearch of
+// each utterance on random posteriors. The small vocab makes the same
+// prefixes of the different paths common.
+TEST(BatchCtcPrefixBeamSearchTest, RandomPosteriorTest) {
+  torch::manual_seed(777);
+  const int vocab_size = 5;
+  const std::vector<int64_t> lens = {40, 17, 1, 29};
+  const int batch_size = lens.size();
+  const int num_frames = *std::max_element(lens.begin(), lens.end());
+  CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = 4;
+  opts.second_beam_size = 6;
+  opts.enable_times = false;
+  torch::Tensor logp = torch::log_softmax(
+      torch::randn({batch_size, num_frames, vocab_size}) * 2, 2);
+  auto topk = logp.topk(opts.first_beam_size, 2);
+  torch::Tensor topk_scores = std::get<0>(topk);
+  torch::Tensor topk_indexs = std::get<1>(topk).to(torch::kInt);
+
+  BatchCtcPrefixBeamSearch batch_search(opts);
+  batch_search.Search(topk_scores, topk_indexs, torch::tensor(lens));
+  std::vector<std::vector<std::vector<int>>> hyps;
+  std::vector<std::vector<float>> scores;
+  std::vector<std::vector<std::vector<int>>> times;
+  batch_search.GetResults(&hyps, &scores, &times);
+  ASSERT_EQ(hyps.size(), batch_size);
+
+  for (int i = 0; i < batch_size; ++i) {
+    std::vector<std::vector<float>> utt_scores(lens[i]);
+    std::vector<std::vector<int32_t>> utt_indexs(lens[i]);
+    for (int t = 0; t < lens[i]; ++t) {
+      torch::Tensor s = topk_scores[i][t].contiguous();
+      torch::Tensor idx = topk_indexs[i][t].contiguous();
+      utt_scores[t].assign(s.data_ptr<float>(),
+                           s.data_ptr<float>() + s.numel());
+      utt_indexs[t].assign(idx.data_ptr<int32_t>(),
+                           idx.data_ptr<int32_t>() + idx.numel());
+    }
+    CtcPrefixBeamSearch search(opts);
+    search.Search(utt_scores, utt_indexs);
+    const std::vector<std::vector<int>>& outputs = search.Outputs();
+    const std::vector<float>& likelihood = search.Likelihood();
+    // No padding hyps of -inf, the short ones have fewer prefixes
+    ASSERT_EQ(hyps[i].size(), outputs.size()) << "utterance " << i;
+    ASSERT_EQ(scores[i].size(), outputs.size());
+    for (size_t j = 0; j < outputs.size(); ++j) {
+      EXPECT_EQ(hyps[i][j], outputs[j]) << "utterance " << i << " hyp " << j;
+      EXPECT_NEAR(scores[i][j], likelihood[j], 1e-4);
+    }
+  }
+}
+
+}  // namespace wenet
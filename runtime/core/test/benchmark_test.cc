@@ -0,0 +1,64 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/benchmark.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(BenchmarkTest, JsonTest) {
+  wenet::BenchResult result;
+  result.scenario = "streaming_tlg";
+  result.metrics["rtf"] = 0.125;
+  result.metrics["chunk_latency_p99_ms"] = 42;
+  std::string json = wenet::BenchResultsToJson({result});
+  std::vector<wenet::BenchResult> results;
+  ASSERT_TRUE(wenet::ParseBenchResults(json, &results));
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].scenario, "streaming_tlg");
+  EXPECT_EQ(results[0].metrics, result.metrics);
+  EXPECT_FALSE(wenet::ParseBenchResults("{\"runs\": []}", &results));
+}
+
+TEST(BenchmarkTest, CompareTest) {
+  wenet::BenchResult baseline;
+  baseline.scenario = "offline";
+  baseline.metrics["rtf"] = 0.1;
+  baseline.metrics["throughput"] = 100;
+  baseline.metrics["final_latency_p99_ms"] = 200;
+  wenet::BenchResult result = baseline;
+  result.metrics["rtf"] = 0.105;
+  result.metrics["throughput"] = 80;
+  result.metrics["final_latency_p99_ms"] = 300;
+  result.metrics["peak_rss_mb"] = 500;
+  wenet::BenchThresholds thresholds;
+  ASSERT_TRUE(
+      wenet::ParseBenchThresholds("final_latency_p99_ms=0.6", &thresholds));
+  // The rtf is in the default 10%, the latency in its 60%, and the peak rss
+  // is not in the baseline
+  auto regressions = wenet::CompareBenchResults(result, baseline, thresholds);
+  ASSERT_EQ(regressions.size(), 1);
+  EXPECT_NE(regressions[0].find("offline throughput"), std::string::npos);
+  // A negative default only compares the metrics of the thresholds
+  ASSERT_TRUE(wenet::ParseBenchThresholds(
+      "default=-1,final_latency_p99_ms=0.2", &thresholds));
+  regressions = wenet::CompareBenchResults(result, baseline, thresholds);
+  ASSERT_EQ(regressions.size(), 1);
+  EXPECT_NE(regressions[0].find("final_latency_p99_ms"), std::string::npos);
+  EXPECT_FALSE(wenet::ParseBenchThresholds("rtf", &thresholds));
+  EXPECT_FALSE(wenet::ParseBenchThresholds("rtf=x", &thresholds));
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "decoder/block_allocator.h"
+
+#include "gtest/gtest.h"
+
+TEST(BlockAllocatorTest, AllocateFreeTest) {
+  wenet::BlockAllocator allocator(3);
+  EXPECT_EQ(allocator.num_free_blocks(), 3);
+  std::set<int> blocks;
+  for (int i = 0; i < 3; ++i) {
+    int block = allocator.Allocate();
+    EXPECT_GE(block, 0);
+    EXPECT_LT(block, 3);
+    blocks.insert(block);
+  }
+  EXPECT_EQ(blocks.size(), 3);
+  // Exhausted
+  EXPECT_EQ(allocator.Allocate(), -1);
+  EXPECT_EQ(allocator.num_free_blocks(), 0);
+  // The block freed last is reused first
+  allocator.Free(2);
+  allocator.Free(0);
+  EXPECT_EQ(allocator.num_free_blocks(), 2);
+  EXPECT_EQ(allocator.Allocate(), 0);
+  EXPECT_EQ(allocator.Allocate(), 2);
+  EXPECT_EQ(allocator.Allocate(), -1);
+}
+
+TEST(BlockAllocatorTest, ThreadsTest) {
+  wenet::BlockAllocator allocator(64);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&allocator]() {
+      for (int i = 0; i < 1000; ++i) {
+        std::vector<int> blocks;
+        for (int j = 0; j < 16; ++j) {
+          int block = allocator.Allocate();
+          ASSERT_GE(block, 0);
+          blocks.push_back(block);
+        }
+        for (int block : blocks) allocator.Free(block);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(allocator.num_free_blocks(), 64);
+}
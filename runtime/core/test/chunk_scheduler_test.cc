@@ -0,0 +1,133 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/chunk_scheduler.h"
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+// A model which records the threads of its forwards, and whose batch
+// forward fails if `fail`
+class ThreadAsrModel : public AsrModel {
+ public:
+  ThreadAsrModel(bool batch, std::atomic<int>* num_batches, bool fail = false)
+      : batch_(batch), num_batches_(num_batches), fail_(fail) {}
+  void Reset() override { offset_ = 0; }
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {
+    rescoring_score->assign(hyps.size(), 0.0f);
+  }
+  std::shared_ptr<AsrModel> Copy() const override {
+    return std::make_shared<ThreadAsrModel>(batch_, num_batches_, fail_);
+  }
+  bool batch_forward_supported() const override { return batch_; }
+
+  std::thread::id forward_thread;
+
+ protected:
+  void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
+                          std::vector<std::vector<float>>* ctc_prob) override {
+    forward_thread = std::this_thread::get_id();
+    ctc_prob->assign(chunk_feats.size(), {-0.1f, -3.0f, -3.0f});
+  }
+  void ForwardEncoderBatchFunc(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+      const std::vector<std::vector<std::vector<float>>*>& ctc_probs)
+      override {
+    ++*num_batches_;
+    if (fail_) throw std::runtime_error("batch forward fails");
+    AsrModel::ForwardEncoderBatchFunc(models, chunk_feats, ctc_probs);
+  }
+
+ private:
+  bool batch_;
+  std::atomic<int>* num_batches_;
+  bool fail_;
+};
+
+// Forward a chunk of each model on a thread of its own, returns whether
+// each one is forwarded by its thread
+static std::vector<char> ForwardOnThreads(
+    ChunkScheduler* scheduler,
+    const std::vector<std::shared_ptr<ThreadAsrModel>>& models) {
+  std::vector<std::vector<float>> feats(8, std::vector<float>(80, 0.0f));
+  std::vector<char> own_thread(models.size(), false);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < models.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      std::vector<std::vector<float>> ctc_prob;
+      scheduler->ForwardEncoder(models[i].get(), feats, &ctc_prob);
+      EXPECT_EQ(ctc_prob.size(), feats.size());
+      own_thread[i] = models[i]->forward_thread == std::this_thread::get_id();
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  return own_thread;
+}
+
+TEST(ChunkSchedulerTest, BatchForwardTest) {
+  ChunkSchedulerOptions opts;
+  opts.max_wait_ms = 20;
+  ChunkScheduler scheduler(opts);
+  std::atomic<int> num_batches(0);
+  std::vector<std::shared_ptr<ThreadAsrModel>> models;
+  for (int i = 0; i < 4; ++i) {
+    models.push_back(std::make_shared<ThreadAsrModel>(true, &num_batches));
+  }
+  // The chunks are forwarded together by the scheduler thread
+  std::vector<char> own_thread = ForwardOnThreads(&scheduler, models);
+  EXPECT_GT(num_batches, 0);
+  EXPECT_LE(num_batches, 4);
+  for (bool own : own_thread) EXPECT_FALSE(own);
+}
+
+TEST(ChunkSchedulerTest, SerialForwardTest) {
+  ChunkScheduler scheduler(ChunkSchedulerOptions{});
+  std::atomic<int> num_batches(0);
+  std::vector<std::shared_ptr<ThreadAsrModel>> models;
+  for (int i = 0; i < 4; ++i) {
+    models.push_back(std::make_shared<ThreadAsrModel>(false, &num_batches));
+  }
+  // The model forwards the chunks one by one, so each session forwards its
+  // own chunk, in parallel
+  std::vector<char> own_thread = ForwardOnThreads(&scheduler, models);
+  EXPECT_EQ(num_batches, 0);
+  for (bool own : own_thread) EXPECT_TRUE(own);
+}
+
+TEST(ChunkSchedulerTest, ErrorTest) {
+  ChunkScheduler scheduler(ChunkSchedulerOptions{});
+  std::atomic<int> num_batches(0);
+  ThreadAsrModel failed(true, &num_batches, true);
+  std::vector<std::vector<float>> feats(8, std::vector<float>(80, 0.0f));
+  std::vector<std::vector<float>> ctc_prob;
+  // The error is thrown to the session, and the scheduler keeps running
+  EXPECT_THROW(scheduler.ForwardEncoder(&failed, feats, &ctc_prob),
+               std::runtime_error);
+  ThreadAsrModel model(true, &num_batches);
+  scheduler.ForwardEncoder(&model, feats, &ctc_prob);
+  EXPECT_EQ(ctc_prob.size(), feats.size());
+}
+
+}  // namespace wenet
@@ -0,0 +1,158 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License
+
+#include "decoder/context_graph.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "utils/metrics.h"
+
+class ContextGraphTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    symbol_table_ = std::make_shared<fst::SymbolTable>();
+    symbol_table_->AddSymbol("<eps>", 0);
+    for (const std::string word : {"你", "好", "吗", "世", "界"}) {
+      symbol_table_->AddSymbol(word);
+    }
+    config_.context_score = 3.0;
+  }
+
+  // Walks the words from the root, returns the total context score
+  float Walk(wenet::ContextGraph* graph, const std::vector<std::string>& words,
+             int* num_start, int* num_end) {
+    int state = 0;
+    float total = 0;
+    *num_start = *num_end = 0;
+    for (const auto& word : words) {
+      float score = 0;
+      bool is_start = false, is_end = false;
+      state = graph->GetNextState(state, symbol_table_->Find(word), &score,
+                                  &is_start, &is_end);
+      total += score;
+      *num_start += is_start;
+      *num_end += is_end;
+    }
+    return total;
+  }
+
+  std::shared_ptr<fst::SymbolTable> symbol_table_;
+  wenet::ContextConfig config_;
+};
+
+TEST_F(ContextGraphTest, MatchAndEscapeTest) {
+  wenet::ContextGraph graph(config_);
+  graph.BuildContextGraph({"你好", "世界"}, symbol_table_);
+  int num_start = 0, num_end = 0;
+  EXPECT_FLOAT_EQ(Walk(&graph, {"你", "好"}, &num_start, &num_end), 6.0);
+  EXPECT_EQ(num_start, 1);
+  EXPECT_EQ(num_end, 1);
+  // The score of the uncompleted context is cleaned
+  EXPECT_FLOAT_EQ(Walk(&graph, {"你", "吗"}, &num_start, &num_end), 0.0);
+  EXPECT_EQ(num_end, 0);
+  // The completed contexts keep their scores
+  EXPECT_FLOAT_EQ(
+      Walk(&graph, {"你", "好", "吗", "世", "界"}, &num_start, &num_end),
+      12.0);
+  EXPECT_EQ(num_start, 2);
+  EXPECT_EQ(num_end, 2);
+}
+
+TEST_F(ContextGraphTest, RestartTest) {
+  wenet::ContextGraph graph(config_);
+  graph.BuildContextGraph({"你好", "好吗"}, symbol_table_);
+  int num_start = 0, num_end = 0;
+  // The second 你 restarts the context instead of escaping to the root
+  EXPECT_FLOAT_EQ(Walk(&graph, {"你", "你", "好"}, &num_start, &num_end),
+                  6.0);
+  EXPECT_EQ(num_end, 1);
+  // 你 is escaped by 世, then 好吗 is matched
+  EXPECT_FLOAT_EQ(
+      Walk(&graph, {"你", "世", "好", "吗"}, &num_start, &num_end), 6.0);
+  EXPECT_EQ(num_end, 1);
+}
+
+TEST_F(ContextGraphTest, PrefixContextTest) {
+  wenet::ContextGraph graph(config_);
+  graph.BuildContextGraph({"你好", "你好吗"}, symbol_table_);
+  int num_start = 0, num_end = 0;
+  EXPECT_FLOAT_EQ(Walk(&graph, {"你", "好", "吗"}, &num_start, &num_end),
+                  9.0);
+  EXPECT_EQ(num_end, 2);
+  // 你好 is kept when 你好吗 isn't completed
+  EXPECT_FLOAT_EQ(Walk(&graph, {"你", "好", "世"}, &num_start, &num_end),
+                  6.0);
+  EXPECT_EQ(num_end, 1);
+}
+
+TEST_F(ContextGraphTest, OverlayTest) {
+  auto base = std::make_shared<wenet::ContextGraph>(config_);
+  base->BuildContextGraph({"你好"}, symbol_table_);
+  wenet::ContextGraph overlay(config_, base);
+  overlay.BuildContextGraph({"世界"}, symbol_table_);
+  EXPECT_EQ(overlay.start_tag_id(), base->start_tag_id());
+  int num_start = 0, num_end = 0;
+  // Both the base and the overlay contexts are matched
+  EXPECT_FLOAT_EQ(
+      Walk(&overlay, {"你", "好", "世", "界"}, &num_start, &num_end), 12.0);
+  EXPECT_EQ(num_start, 2);
+  EXPECT_EQ(num_end, 2);
+  // The base graph doesn't know the contexts of the overlay
+  EXPECT_FLOAT_EQ(Walk(base.get(), {"世", "界"}, &num_start, &num_end), 0.0);
+}
+
+TEST_F(ContextGraphTest, CacheTest) {
+  wenet::Counter* hits = wenet::Metrics::Instance().GetCounter(
+      "wenet_context_graph_cache_hits_total", "");
+  wenet::ContextGraph graph(config_);
+  graph.BuildContextGraph({"你好", "好吗"}, symbol_table_);
+  // The same contexts are compiled once
+  int64_t num_hits = hits->value();
+  wenet::ContextGraph cached(config_);
+  cached.BuildContextGraph({"你好", "好吗"}, symbol_table_);
+  EXPECT_EQ(hits->value(), num_hits + 1);
+  int num_start = 0, num_end = 0;
+  EXPECT_FLOAT_EQ(Walk(&cached, {"你", "好", "吗"}, &num_start, &num_end),
+                  Walk(&graph, {"你", "好", "吗"}, &num_start, &num_end));
+  // Another score or one more context is compiled again
+  config_.context_score = 2.0;
+  wenet::ContextGraph rescored(config_);
+  rescored.BuildContextGraph({"你好", "好吗"}, symbol_table_);
+  EXPECT_FLOAT_EQ(Walk(&rescored, {"你", "好"}, &num_start, &num_end), 4.0);
+  wenet::ContextGraph added(config_);
+  added.BuildContextGraph({"你好", "好吗", "世界"}, symbol_table_);
+  EXPECT_FLOAT_EQ(Walk(&added, {"世", "界"}, &num_start, &num_end), 4.0);
+  EXPECT_EQ(hits->value(), num_hits + 1);
+}
+
+TEST_F(ContextGraphTest, BalanceTagsTest) {
+  using ::testing::ElementsAre;
+  wenet::ContextGraph graph(config_);
+  graph.BuildContextGraph({"你好"}, symbol_table_);
+  const int s = graph.start_tag_id();
+  const int e = graph.end_tag_id();
+  // The start of the uncompleted context and the end without a start
+  std::vector<int> output = {s, 1, s, 2, 3, e, e, 4, s, 5};
+  graph.BalanceTags(&output);
+  EXPECT_THAT(output, ElementsAre(1, s, 2, 3, e, 4, 5));
+  // The end of the context continued by a longer one is moved
+  output = {s, 1, 2, e, 3, e, s, 4, e};
+  graph.BalanceTags(&output);
+  EXPECT_THAT(output, ElementsAre(s, 1, 2, 3, e, s, 4, e));
+}
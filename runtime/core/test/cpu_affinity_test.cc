@@ -0,0 +1,66 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/cpu_affinity.h"
+
+#include <set>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace wenet {
+
+TEST(CpuAffinityTest, ParseCpuListTest) {
+  using ::testing::ElementsAre;
+  EXPECT_THAT(ParseCpuList("0-3,8,10-11\n"),
+              ElementsAre(0, 1, 2, 3, 8, 10, 11));
+  EXPECT_THAT(ParseCpuList("5"), ElementsAre(5));
+  EXPECT_TRUE(ParseCpuList("").empty());
+}
+
+TEST(CpuAffinityTest, NumaNodeTest) {
+  std::vector<std::vector<int>> nodes = GetNumaNodeCpus();
+  ASSERT_FALSE(nodes.empty());
+  std::set<int> cpus;
+  for (const auto& node : nodes) {
+    ASSERT_FALSE(node.empty());
+    for (int cpu : node) EXPECT_TRUE(cpus.insert(cpu).second);
+  }
+}
+
+#ifdef __linux__
+TEST(CpuAffinityTest, RunOnCpusTest) {
+  cpu_set_t allowed;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, &allowed)) ++cpu;
+  int num_cpus = -1;
+  RunOnCpus({cpu}, [&num_cpus]() {
+    cpu_set_t set;
+    sched_getaffinity(0, sizeof(set), &set);
+    num_cpus = CPU_COUNT(&set);
+  });
+  EXPECT_EQ(num_cpus, 1);
+  // The calling thread is not pinned
+  ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+  EXPECT_GE(CPU_COUNT(&allowed), 1);
+}
+#endif
+
+}  // namespace wenet
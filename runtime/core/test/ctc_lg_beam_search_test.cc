@@ -0,0 +1,143 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/ctc_lg_beam_search.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "utils/utils.h"
+
+// A free loop of the tokens without the ctc topology, word i is token i, of
+// which the ilabel is i + 1
+static fst::StdVectorFst TokenLoop(int vocab_size) {
+  fst::StdVectorFst graph;
+  graph.AddState();
+  graph.SetStart(0);
+  graph.SetFinal(0, fst::TropicalWeight::One());
+  for (int i = 1; i < vocab_size; ++i) {
+    graph.AddArc(0, fst::StdArc(i + 1, i, 0.0, 0));
+  }
+  return graph;
+}
+
+static std::vector<std::vector<float>> Log(
+    const std::vector<std::vector<float>>& probs) {
+  std::vector<std::vector<float>> logp = probs;
+  for (auto& frame : logp) {
+    for (auto& x : frame) x = std::log(x);
+  }
+  return logp;
+}
+
+TEST(CtcLgBeamSearchTest, TokenLoopTest) {
+  using ::testing::ElementsAre;
+  fst::StdVectorFst graph = TokenLoop(4);
+  wenet::CtcWfstBeamSearchOptions opts;
+  wenet::CtcLgBeamSearch searcher(graph, opts);
+  // 1, blank, 1 is two tokens, 2, 2 with the skipped blank frame between
+  // them are two as well, as those of the TLG
+  searcher.Search(Log({{0.1, 0.7, 0.1, 0.1},
+                       {0.6, 0.2, 0.1, 0.1},
+                       {0.2, 0.6, 0.1, 0.1},
+                       {0.1, 0.05, 0.8, 0.05},
+                       {0.99, 0.004, 0.003, 0.003},
+                       {0.1, 0.05, 0.8, 0.05}}));
+  searcher.FinalizeSearch();
+  ASSERT_FALSE(searcher.Outputs().empty());
+  EXPECT_THAT(searcher.Outputs()[0], ElementsAre(1, 1, 2, 2));
+  EXPECT_THAT(searcher.Inputs()[0], ElementsAre(1, 1, 2, 2));
+  EXPECT_THAT(searcher.Times()[0], ElementsAre(0, 2, 3, 5));
+  // The repeats without a blank are one token
+  searcher.Reset();
+  searcher.Search(Log({{0.1, 0.7, 0.1, 0.1},
+                       {0.1, 0.7, 0.1, 0.1},
+                       {0.1, 0.1, 0.1, 0.7},
+                       {0.1, 0.1, 0.1, 0.7}}));
+  searcher.FinalizeSearch();
+  ASSERT_FALSE(searcher.Outputs().empty());
+  EXPECT_THAT(searcher.Outputs()[0], ElementsAre(1, 3));
+  EXPECT_NEAR(searcher.Likelihood()[0], 4 * std::log(0.7), 1e-4);
+}
+
+TEST(CtcLgBeamSearchTest, WordGraphTest) {
+  using ::testing::ElementsAre;
+  // Word 1 is tokens 1 2, and word 2 is token 3 after the epsilon arc of
+  // cost 1 to state 2, only state 0 is final
+  fst::StdVectorFst graph;
+  for (int i = 0; i < 3; ++i) graph.AddState();
+  graph.SetStart(0);
+  graph.SetFinal(0, fst::TropicalWeight::One());
+  graph.AddArc(0, fst::StdArc(2, 1, 0.0, 1));
+  graph.AddArc(1, fst::StdArc(3, 0, 0.0, 0));
+  graph.AddArc(0, fst::StdArc(0, 0, 1.0, 2));
+  graph.AddArc(2, fst::StdArc(4, 2, 0.0, 0));
+  wenet::CtcWfstBeamSearchOptions opts;
+  opts.nbest = 2;
+  wenet::CtcLgBeamSearch searcher(graph, opts);
+  auto logp = Log({{0.1, 0.7, 0.1, 0.1},
+                   {0.1, 0.1, 0.7, 0.1},
+                   {0.6, 0.2, 0.1, 0.1},
+                   {0.1, 0.1, 0.1, 0.7},
+                   {0.1, 0.1, 0.1, 0.7}});
+  // In two chunks, the partial result is of the best token
+  searcher.Search(std::vector<std::vector<float>>(logp.begin(),
+                                                  logp.begin() + 1));
+  ASSERT_FALSE(searcher.Outputs().empty());
+  EXPECT_THAT(searcher.Outputs()[0], ElementsAre(1));
+  searcher.Search(std::vector<std::vector<float>>(logp.begin() + 1,
+                                                  logp.end()));
+  searcher.FinalizeSearch();
+  ASSERT_EQ(searcher.Outputs().size(), 2);
+  EXPECT_THAT(searcher.Outputs()[0], ElementsAre(1, 2));
+  EXPECT_THAT(searcher.Inputs()[0], ElementsAre(1, 2, 3));
+  EXPECT_THAT(searcher.Times()[0], ElementsAre(0, 1, 3));
+  float expected = std::log(0.7) * 4 + std::log(0.6) - 1.0;
+  EXPECT_NEAR(searcher.Likelihood()[0], expected, 1e-4);
+  EXPECT_LT(searcher.Likelihood()[1], searcher.Likelihood()[0]);
+}
+
+TEST(CtcLgBeamSearchTest, TopKSearchTest) {
+  fst::StdVectorFst graph = TokenLoop(4);
+  wenet::CtcWfstBeamSearchOptions opts;
+  auto logp = Log({{0.1, 0.7, 0.1, 0.1},
+                   {0.6, 0.2, 0.1, 0.1},
+                   {0.2, 0.6, 0.1, 0.1},
+                   {0.1, 0.05, 0.8, 0.05},
+                   {0.99, 0.004, 0.003, 0.003},
+                   {0.1, 0.05, 0.8, 0.05}});
+  wenet::CtcLgBeamSearch full(graph, opts);
+  full.Search(logp);
+  full.FinalizeSearch();
+  for (int k : {2, 4}) {
+    std::vector<std::vector<float>> scores(logp.size());
+    std::vector<std::vector<int32_t>> indexs(logp.size());
+    for (size_t i = 0; i < logp.size(); ++i) {
+      std::vector<int> index;
+      wenet::TopK(logp[i], k, &scores[i], &index);
+      indexs[i].assign(index.begin(), index.end());
+    }
+    wenet::CtcLgBeamSearch searcher(graph, opts);
+    searcher.Search(scores, indexs);
+    searcher.FinalizeSearch();
+    ASSERT_FALSE(searcher.Outputs().empty());
+    EXPECT_EQ(searcher.Outputs()[0], full.Outputs()[0]) << "k " << k;
+    EXPECT_EQ(searcher.Times()[0], full.Times()[0]) << "k " << k;
+    EXPECT_NEAR(searcher.Likelihood()[0], full.Likelihood()[0], 1e-4);
+  }
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/ctc_prefix_beam_search_group.h"
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "utils/matrix.h"
+
+// [T, vocab] log softmax of random logits, mostly blank
+static wenet::Matrix<float> RandomLogProbs(int num_frames, int vocab_size,
+                                           std::mt19937* rng) {
+  std::normal_distribution<float> logit(0, 2);
+  wenet::Matrix<float> logp(num_frames, vocab_size);
+  for (int t = 0; t < num_frames; ++t) {
+    float* row = logp.row(t);
+    float sum = 0;
+    for (int i = 0; i < vocab_size; ++i) {
+      row[i] = logit(*rng) + (i == 0 ? 2.0f : 0.0f);
+      sum += std::exp(row[i]);
+    }
+    for (int i = 0; i < vocab_size; ++i) row[i] -= std::log(sum);
+  }
+  return logp;
+}
+
+static void ExpectSameResults(const wenet::CtcPrefixBeamSearch& a,
+                              const wenet::CtcPrefixBeamSearch& b) {
+  ASSERT_EQ(a.Outputs(), b.Outputs());
+  ASSERT_EQ(a.Times(), b.Times());
+  ASSERT_EQ(a.Likelihood().size(), b.Likelihood().size());
+  for (size_t i = 0; i < a.Likelihood().size(); ++i) {
+    EXPECT_NEAR(a.Likelihood()[i], b.Likelihood()[i], 1e-4);
+  }
+  for (size_t i = 0; i < a.viterbi_likelihood().size(); ++i) {
+    EXPECT_NEAR(a.viterbi_likelihood()[i], b.viterbi_likelihood()[i], 1e-4);
+  }
+  EXPECT_EQ(a.BlankScores(), b.BlankScores());
+}
+
+TEST(CtcPrefixBeamSearchGroupTest, SameAsAloneTest) {
+  // The sessions of different chunk sizes in a few chunks, some of which
+  // end earlier, are of the same results as the ones searched alone
+  const int kNumSessions = 6;
+  const int kVocabSize = 7;
+  for (bool enable_times : {true, false}) {
+    SCOPED_TRACE(enable_times ? "times" : "no times");
+    wenet::CtcPrefixBeamSearchOptions opts;
+    opts.first_beam_size = 4;
+    opts.second_beam_size = 5;
+    opts.enable_times = enable_times;
+    std::mt19937 rng(7);
+    std::vector<std::unique_ptr<wenet::CtcPrefixBeamSearch>> alone, grouped;
+    for (int i = 0; i < kNumSessions; ++i) {
+      alone.emplace_back(new wenet::CtcPrefixBeamSearch(opts));
+      grouped.emplace_back(new wenet::CtcPrefixBeamSearch(opts));
+    }
+    wenet::CtcPrefixBeamSearchGroup group;
+    for (int chunk = 0; chunk < 4; ++chunk) {
+      std::vector<wenet::Matrix<float>> logps;
+      std::vector<wenet::CtcPrefixBeamSearch*> searches;
+      std::vector<wenet::MatrixView<float>> views;
+      for (int i = 0; i < kNumSessions; ++i) {
+        int num_frames = i > chunk + 2 ? 0 : 2 + (i * 3 + chunk) % 9;
+        logps.push_back(RandomLogProbs(num_frames, kVocabSize, &rng));
+      }
+      for (int i = 0; i < kNumSessions; ++i) {
+        alone[i]->Search(logps[i].view());
+        searches.push_back(grouped[i].get());
+        views.push_back(logps[i].view());
+      }
+      group.Search(searches, views);
+      for (int i = 0; i < kNumSessions; ++i) {
+        SCOPED_TRACE("chunk " + std::to_string(chunk) + " session " +
+                     std::to_string(i));
+        ExpectSameResults(*alone[i], *grouped[i]);
+      }
+    }
+  }
+}
+
+TEST(CtcPrefixBeamSearchGroupTest, BlankSkipTest) {
+  // The skipped blank frames of a session don't hold the others
+  wenet::CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = 3;
+  opts.second_beam_size = 3;
+  opts.blank_skip_thresh = 0.8;
+  std::mt19937 rng(3);
+  wenet::Matrix<float> blank(5, 4);
+  for (int t = 0; t < 5; ++t) {
+    for (int i = 0; i < 4; ++i) blank(t, i) = std::log(i == 0 ? 0.97 : 0.01);
+  }
+  wenet::Matrix<float> speech = RandomLogProbs(5, 4, &rng);
+  wenet::CtcPrefixBeamSearch alone1(opts), alone2(opts);
+  wenet::CtcPrefixBeamSearch grouped1(opts), grouped2(opts);
+  alone1.Search(blank.view());
+  alone2.Search(speech.view());
+  wenet::CtcPrefixBeamSearchGroup group;
+  group.Search({&grouped1, &grouped2}, {blank.view(), speech.view()});
+  ExpectSameResults(alone1, grouped1);
+  ExpectSameResults(alone2, grouped2);
+  EXPECT_EQ(grouped1.BlankScores().size(), 5);
+}
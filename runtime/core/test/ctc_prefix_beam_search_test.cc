@@ -15,12 +15,18 @@
 
 #include "decoder/ctc_prefix_beam_search.h"
 
+#include <algorithm>
 #include <cmath>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include "decoder/context_graph.h"
+#include "utils/matrix.h"
+#include "utils/state_io.h"
 #include "utils/utils.h"
 
 TEST(CtcPrefixBeamSearchTest, CtcPrefixBeamSearchLogicTest) {
@@ -72,3 +78,364 @@ TEST(CtcPrefixBeamSearchTest, CtcPrefixBeamSearchLogicTest) {
   ASSERT_THAT(times[1], ElementsAre(0, 2));
   ASSERT_THAT(times[2], ElementsAre(2));
 }
+
+TEST(CtcPrefixBeamSearchTest, BlankSkipTest) {
+  std::vector<std::vector<float>> data = {
+      {0.25, 0.40, 0.35}, {0.99, 0.005, 0.005}, {0.10, 0.50, 0.40},
+      {0.98, 0.01, 0.01}, {0.97, 0.02, 0.01},   {0.30, 0.10, 0.60},
+      {0.99, 0.005, 0.005}};
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+  }
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 3;
+  option.second_beam_size = 3;
+  wenet::CtcPrefixBeamSearch no_skip_search(option);
+  no_skip_search.Search(data);
+
+  wenet::CtcPrefixBeamSearchOptions skip_option(option);
+  skip_option.blank_skip_thresh = 0.95;
+  wenet::CtcPrefixBeamSearch skip_search(skip_option);
+  skip_search.Search(data);
+
+  EXPECT_EQ(skip_search.Outputs()[0], no_skip_search.Outputs()[0]);
+  EXPECT_EQ(skip_search.Times()[0], no_skip_search.Times()[0]);
+
+  // thresh 1.0 never skips, so the search is unchanged
+  skip_option.blank_skip_thresh = 1.0;
+  wenet::CtcPrefixBeamSearch thresh_one_search(skip_option);
+  thresh_one_search.Search(data);
+  EXPECT_EQ(thresh_one_search.Outputs(), no_skip_search.Outputs());
+  EXPECT_EQ(thresh_one_search.Likelihood(), no_skip_search.Likelihood());
+}
+
+TEST(CtcPrefixBeamSearchTest, BlankScoresTest) {
+  std::vector<std::vector<float>> data = {
+      {0.40, 0.35, 0.25}, {0.99, 0.005, 0.005}, {0.10, 0.50, 0.40}};
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+  }
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 2;
+  option.blank_skip_thresh = 0.95;
+  wenet::CtcPrefixBeamSearch search(option);
+  // The blank of each frame, the skipped one included, of the last chunk
+  search.Search(data);
+  ASSERT_EQ(search.BlankScores().size(), 3);
+  EXPECT_FLOAT_EQ(search.BlankScores()[0], data[0][0]);
+  EXPECT_FLOAT_EQ(search.BlankScores()[1], data[1][0]);
+  // Out of the top 2
+  EXPECT_EQ(search.BlankScores()[2], -wenet::kFloatMax);
+  search.Search(std::vector<std::vector<float>>(1, data[1]));
+  ASSERT_EQ(search.BlankScores().size(), 1);
+  EXPECT_FLOAT_EQ(search.BlankScores()[0], data[1][0]);
+  search.Search(std::vector<std::vector<float>>());
+  EXPECT_TRUE(search.BlankScores().empty());
+}
+
+TEST(CtcPrefixBeamSearchTest, MatrixSearchTest) {
+  std::vector<std::vector<float>> data = {
+      {0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40},
+      {0.98, 0.01, 0.01}, {0.30, 0.10, 0.60}};
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+  }
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 2;
+  option.second_beam_size = 3;
+  wenet::CtcPrefixBeamSearch vector_search(option);
+  vector_search.Search(data);
+
+  // The same frames in one matrix, searched in two chunks
+  wenet::Matrix<float> matrix;
+  matrix.CopyFrom(data);
+  wenet::CtcPrefixBeamSearch matrix_search(option);
+  matrix_search.Search(matrix.view().RowRange(0, 2));
+  matrix_search.Search(matrix.view().RowRange(2, matrix.rows()));
+
+  EXPECT_EQ(matrix_search.Outputs(), vector_search.Outputs());
+  EXPECT_EQ(matrix_search.Likelihood(), vector_search.Likelihood());
+  EXPECT_EQ(matrix_search.Times(), vector_search.Times());
+}
+
+TEST(CtcPrefixBeamSearchTest, BeamScaleTest) {
+  std::vector<std::vector<float>> data = {
+      {0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40},
+      {0.98, 0.01, 0.01}, {0.30, 0.10, 0.60}};
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+  }
+  // The scaled beams are the ones of the narrow options
+  wenet::CtcPrefixBeamSearchOptions narrow_option;
+  narrow_option.first_beam_size = 2;
+  narrow_option.second_beam_size = 2;
+  wenet::CtcPrefixBeamSearch narrow_search(narrow_option);
+  narrow_search.Search(data);
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 3;
+  option.second_beam_size = 4;
+  wenet::CtcPrefixBeamSearch scaled_search(option);
+  scaled_search.SetBeamScale(0.5);
+  scaled_search.Search(data);
+  EXPECT_EQ(scaled_search.Outputs(), narrow_search.Outputs());
+  EXPECT_EQ(scaled_search.Likelihood(), narrow_search.Likelihood());
+  // And back to the configured ones
+  wenet::CtcPrefixBeamSearch search(option);
+  search.Search(data);
+  scaled_search.Reset();
+  scaled_search.SetBeamScale(1.0);
+  scaled_search.Search(data);
+  EXPECT_EQ(scaled_search.Outputs(), search.Outputs());
+  EXPECT_EQ(scaled_search.Likelihood(), search.Likelihood());
+}
+
+TEST(CtcPrefixBeamSearchTest, DisableTimesTest) {
+  std::vector<std::vector<float>> data = {
+      {0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40},
+      {0.98, 0.01, 0.01}, {0.30, 0.10, 0.60}};
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+  }
+  // The hyps and the scores are the same without the times
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 3;
+  option.second_beam_size = 3;
+  wenet::CtcPrefixBeamSearch search(option);
+  search.Search(data);
+  wenet::CtcPrefixBeamSearchOptions no_times_option = option;
+  no_times_option.enable_times = false;
+  wenet::CtcPrefixBeamSearch no_times_search(no_times_option);
+  no_times_search.Search(data);
+  EXPECT_EQ(no_times_search.Outputs(), search.Outputs());
+  EXPECT_EQ(no_times_search.Likelihood(), search.Likelihood());
+  EXPECT_TRUE(no_times_search.Times().empty());
+  EXPECT_TRUE(no_times_search.viterbi_likelihood().empty());
+  EXPECT_EQ(search.Times().size(), search.Outputs().size());
+}
+
+TEST(CtcPrefixBeamSearchTest, SaveStateTest) {
+  std::vector<std::vector<float>> data = {
+      {0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40},
+      {0.98, 0.01, 0.01}, {0.30, 0.10, 0.60}};
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+  }
+  // The search continued from the state of the first frames is the same as
+  // the one of all the frames
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 3;
+  option.second_beam_size = 3;
+  wenet::CtcPrefixBeamSearch search(option);
+  search.Search(data);
+  wenet::CtcPrefixBeamSearch first(option);
+  first.Search(std::vector<std::vector<float>>(data.begin(), data.begin() + 2));
+  wenet::StateWriter writer;
+  ASSERT_TRUE(first.SaveState(&writer));
+  wenet::CtcPrefixBeamSearch second(option);
+  wenet::StateReader reader(writer.str());
+  ASSERT_TRUE(second.LoadState(&reader));
+  EXPECT_TRUE(reader.done());
+  EXPECT_EQ(second.Outputs(), first.Outputs());
+  second.Search(std::vector<std::vector<float>>(data.begin() + 2, data.end()));
+  EXPECT_EQ(second.Outputs(), search.Outputs());
+  EXPECT_EQ(second.Likelihood(), search.Likelihood());
+  EXPECT_EQ(second.Times(), search.Times());
+  // A truncated state is not loaded
+  std::string truncated = writer.str().substr(0, writer.str().size() - 1);
+  wenet::StateReader truncated_reader(truncated);
+  EXPECT_FALSE(second.LoadState(&truncated_reader));
+}
+
+TEST(CtcPrefixBeamSearchTest, ReclaimNodesTest) {
+  // Mostly blank frames of a long utterance, whose candidates of each frame
+  // are new prefixes and lists which are pruned soon after
+  std::vector<std::vector<float>> data(20000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    float p = 0.01 + 0.01 * (i % 7);
+    data[i] = {std::log(0.9f - p), std::log(p), std::log(0.1f)};
+  }
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 3;
+  option.second_beam_size = 3;
+  wenet::CtcPrefixBeamSearch search(option);
+  std::vector<std::vector<float>> chunk(data.begin(), data.begin() + 2000);
+  search.Search(chunk);
+  int64_t bytes = search.memory_bytes();
+  for (size_t i = 2000; i < data.size(); i += 2000) {
+    chunk.assign(data.begin() + i, data.begin() + i + 2000);
+    search.Search(chunk);
+  }
+  // The nodes are bounded by the ones of the hypotheses
+  EXPECT_LT(search.memory_bytes(), bytes * 2);
+  // The reclaimed state is still loaded, and the search continued from it
+  // is the same
+  wenet::StateWriter writer;
+  ASSERT_TRUE(search.SaveState(&writer));
+  wenet::CtcPrefixBeamSearch loaded(option);
+  wenet::StateReader reader(writer.str());
+  ASSERT_TRUE(loaded.LoadState(&reader));
+  EXPECT_EQ(loaded.Outputs(), search.Outputs());
+  EXPECT_EQ(loaded.Times(), search.Times());
+  search.Search(chunk);
+  loaded.Search(chunk);
+  EXPECT_EQ(loaded.Outputs(), search.Outputs());
+  EXPECT_EQ(loaded.Likelihood(), search.Likelihood());
+}
+
+TEST(CtcPrefixBeamSearchTest, MatrixTopKSearchTest) {
+  std::vector<std::vector<float>> data = {
+      {0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40}};
+  std::vector<std::vector<float>> topk_scores(data.size());
+  std::vector<std::vector<int32_t>> topk_indexs(data.size());
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+    wenet::TopK(data[i], 2, &topk_scores[i], &topk_indexs[i]);
+  }
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.second_beam_size = 3;
+  wenet::CtcPrefixBeamSearch vector_search(option);
+  vector_search.Search(topk_scores, topk_indexs);
+
+  // The same topk in the rows of a strided buffer
+  std::vector<float> scores(data.size() * 3, 0.0f);
+  std::vector<int32_t> indexs(data.size() * 3, 0);
+  for (int i = 0; i < data.size(); i++) {
+    std::copy(topk_scores[i].begin(), topk_scores[i].end(), &scores[i * 3]);
+    std::copy(topk_indexs[i].begin(), topk_indexs[i].end(), &indexs[i * 3]);
+  }
+  wenet::CtcPrefixBeamSearch matrix_search(option);
+  matrix_search.Search(
+      wenet::MatrixView<float>(scores.data(), data.size(), 2, 3),
+      wenet::MatrixView<int32_t>(indexs.data(), data.size(), 2, 3));
+
+  EXPECT_EQ(matrix_search.Outputs(), vector_search.Outputs());
+  EXPECT_EQ(matrix_search.Likelihood(), vector_search.Likelihood());
+  EXPECT_EQ(matrix_search.Times(), vector_search.Times());
+}
+
+// Counts the batches, and scores the tokens by a fixed table
+class TableLanguageModel : public wenet::LanguageModel {
+ public:
+  explicit TableLanguageModel(const std::vector<float>& log_probs)
+      : log_probs_(log_probs) {}
+  int Start() override { return 0; }
+  void Score(const std::vector<int>& states, const std::vector<int>& tokens,
+             std::vector<float>* log_probs,
+             std::vector<int>* next_states) override {
+    ++num_batches;
+    log_probs->clear();
+    for (int token : tokens) log_probs->push_back(log_probs_[token]);
+    next_states->assign(tokens.size(), 0);
+  }
+  std::shared_ptr<wenet::LanguageModel> Copy() const override {
+    return std::make_shared<TableLanguageModel>(log_probs_);
+  }
+
+  int num_batches = 0;
+
+ private:
+  std::vector<float> log_probs_;
+};
+
+TEST(CtcPrefixBeamSearchTest, LanguageModelTest) {
+  using ::testing::ElementsAre;
+  std::vector<std::vector<float>> data = {
+      {0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40}};
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+  }
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 3;
+  option.second_beam_size = 3;
+  option.lm_weight = 1.0;
+  // Token 1 is much more likely than token 2, so [1] is the 1-best, which
+  // is the 3rd by the ctc scores, see CtcPrefixBeamSearchLogicTest
+  auto lm = std::make_shared<TableLanguageModel>(
+      std::vector<float>{0.0, std::log(0.9f), std::log(0.1f)});
+  wenet::CtcPrefixBeamSearch search(option, nullptr, lm);
+  search.Search(data);
+  ASSERT_THAT(search.Outputs()[0], ElementsAre(1));
+  // At most one batch per frame, the prefixes are scored once
+  EXPECT_GT(lm->num_batches, 0);
+  EXPECT_LE(lm->num_batches, data.size());
+
+  // The n-gram of the sentences of [1, 2]
+  auto ngram = std::make_shared<wenet::NgramLanguageModel>(
+      2, 3, std::vector<std::vector<int>>(10, {1, 2}));
+  wenet::CtcPrefixBeamSearch ngram_search(option, nullptr, ngram->Copy());
+  ngram_search.Search(data);
+  ASSERT_THAT(ngram_search.Outputs()[0], ElementsAre(1, 2));
+  // The states of the utterance are cleared
+  ngram_search.Reset();
+  ngram_search.Search(data);
+  ASSERT_THAT(ngram_search.Outputs()[0], ElementsAre(1, 2));
+}
+
+// Searches the peaky posteriors of the words, returns the 1-best with the
+// tags of the contexts
+static std::string SearchContexts(const std::vector<std::string>& contexts,
+                                  const std::vector<std::string>& words) {
+  auto symbol_table = std::make_shared<fst::SymbolTable>();
+  symbol_table->AddSymbol("<blank>", 0);
+  for (const std::string word : {"你", "好", "吗", "世"}) {
+    symbol_table->AddSymbol(word);
+  }
+  // The scores of the contexts don't outweigh the posteriors
+  wenet::ContextConfig config;
+  config.context_score = 1.0;
+  auto context_graph = std::make_shared<wenet::ContextGraph>(config);
+  context_graph->BuildContextGraph(contexts, symbol_table);
+  // A frame of each word and a blank frame after it
+  std::vector<std::vector<float>> data;
+  for (const auto& word : words) {
+    int id = symbol_table->Find(word);
+    for (int peak : {id, 0}) {
+      std::vector<float> frame(5, std::log(0.02f));
+      frame[peak] = std::log(0.92f);
+      data.emplace_back(std::move(frame));
+    }
+  }
+  wenet::CtcPrefixBeamSearchOptions option;
+  wenet::CtcPrefixBeamSearch search(option, context_graph);
+  search.Search(data);
+  std::string output;
+  for (int id : search.Outputs()[0]) {
+    output += symbol_table->Find(id);
+  }
+  return output;
+}
+
+TEST(CtcPrefixBeamSearchTest, ContextTagsTest) {
+  EXPECT_EQ(SearchContexts({"你好"}, {"吗", "你", "好", "世"}),
+            "吗<context>你好</context>世");
+  // The uncompleted context isn't tagged, and 好吗 isn't matched from the
+  // middle of 你好世
+  EXPECT_EQ(SearchContexts({"你好世", "好吗"}, {"你", "好", "吗"}), "你好吗");
+  EXPECT_EQ(SearchContexts({"你好世", "吗"}, {"你", "好", "吗"}),
+            "你好<context>吗</context>");
+  EXPECT_EQ(SearchContexts({"你好世", "好吗"}, {"你", "好", "好", "吗"}),
+            "你好<context>好吗</context>");
+  // The longer context of a prefix one moves its end tag
+  EXPECT_EQ(SearchContexts({"你好", "你好吗"}, {"你", "好", "吗"}),
+            "<context>你好吗</context>");
+  EXPECT_EQ(SearchContexts({"你好", "你好吗世"}, {"你", "好", "吗", "你"}),
+            "<context>你好</context>吗你");
+  EXPECT_EQ(SearchContexts({"你好", "吗世"}, {"你", "好", "吗", "世"}),
+            "<context>你好</context><context>吗世</context>");
+}
@@ -0,0 +1,320 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/ctc_wfst_beam_search.h"
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "utils/quantized_fst.h"
+#include "utils/utils.h"
+
+// A free loop of the tokens, of which word i is token i, so the best path
+// is the greedy ctc path. Ilabel i + 1 is token i, state 0 takes the blank,
+// state i stays on token i and goes back to state 0 by epsilon.
+static fst::StdVectorFst TokenLoop(int vocab_size) {
+  fst::StdVectorFst graph;
+  graph.AddState();
+  graph.SetStart(0);
+  graph.SetFinal(0, fst::TropicalWeight::One());
+  graph.AddArc(0, fst::StdArc(1, 0, 0.0, 0));
+  for (int i = 1; i < vocab_size; ++i) {
+    int state = graph.AddState();
+    graph.SetFinal(state, fst::TropicalWeight::One());
+    graph.AddArc(0, fst::StdArc(i + 1, i, 0.0, state));
+    graph.AddArc(state, fst::StdArc(i + 1, 0, 0.0, state));
+    graph.AddArc(state, fst::StdArc(0, 0, 0.0, 0));
+  }
+  return graph;
+}
+
+// A unigram of the words [1, vocab_size) of `cost` each, sorted by the
+// input labels. It accepts nothing if !final.
+static std::shared_ptr<fst::Fst<fst::StdArc>> Unigram(int vocab_size,
+                                                      float cost,
+                                                      bool final = true) {
+  auto lm = std::make_shared<fst::StdVectorFst>();
+  lm->AddState();
+  lm->SetStart(0);
+  if (final) lm->SetFinal(0, fst::TropicalWeight::One());
+  for (int i = 1; i < vocab_size; ++i) {
+    lm->AddArc(0, fst::StdArc(i, i, cost, 0));
+  }
+  fst::ArcSort(lm.get(), fst::ILabelCompare<fst::StdArc>());
+  return lm;
+}
+
+static std::vector<std::vector<float>> Log(
+    const std::vector<std::vector<float>>& probs) {
+  std::vector<std::vector<float>> logp = probs;
+  for (auto& frame : logp) {
+    for (auto& x : frame) x = std::log(x);
+  }
+  return logp;
+}
+
+class CtcWfstBeamSearchTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // 1, blank, 1 is two tokens, and the skipped blank frame between the
+    // two 2s is added back
+    logp_ = Log({{0.1, 0.7, 0.1, 0.1},
+                 {0.6, 0.2, 0.1, 0.1},
+                 {0.2, 0.6, 0.1, 0.1},
+                 {0.1, 0.05, 0.8, 0.05},
+                 {0.99, 0.004, 0.003, 0.003},
+                 {0.1, 0.05, 0.8, 0.05}});
+  }
+
+  void TopK(int k, std::vector<std::vector<float>>* scores,
+            std::vector<std::vector<int32_t>>* indexs) const {
+    scores->resize(logp_.size());
+    indexs->resize(logp_.size());
+    for (size_t i = 0; i < logp_.size(); ++i) {
+      std::vector<int> index;
+      wenet::TopK(logp_[i], k, &(*scores)[i], &index);
+      (*indexs)[i].assign(index.begin(), index.end());
+    }
+  }
+
+  fst::StdVectorFst graph_ = TokenLoop(4);
+  std::vector<std::vector<float>> logp_;
+  wenet::CtcWfstBeamSearchOptions opts_;
+};
+
+TEST_F(CtcWfstBeamSearchTest, FullSearchTest) {
+  using ::testing::ElementsAre;
+  wenet::CtcWfstBeamSearch searcher(graph_, opts_, nullptr);
+  searcher.Search(logp_);
+  searcher.FinalizeSearch();
+  ASSERT_FALSE(searcher.Outputs().empty());
+  ASSERT_THAT(searcher.Outputs()[0], ElementsAre(1, 1, 2, 2));
+  ASSERT_THAT(searcher.Inputs()[0], ElementsAre(1, 1, 2, 2));
+}
+
+TEST_F(CtcWfstBeamSearchTest, TopKSearchTest) {
+  wenet::CtcWfstBeamSearch full(graph_, opts_, nullptr);
+  full.Search(logp_);
+  full.FinalizeSearch();
+  // The tokens out of the topk are not reached, the best path is the same
+  for (int k : {1, 2, 4}) {
+    std::vector<std::vector<float>> scores;
+    std::vector<std::vector<int32_t>> indexs;
+    TopK(k, &scores, &indexs);
+    wenet::CtcWfstBeamSearch searcher(graph_, opts_, nullptr);
+    // In two chunks, the skipped blank frame is the last one of the first
+    std::vector<std::vector<float>> scores1(scores.begin(),
+                                            scores.begin() + 5);
+    std::vector<std::vector<int32_t>> indexs1(indexs.begin(),
+                                              indexs.begin() + 5);
+    std::vector<std::vector<float>> scores2(scores.begin() + 5, scores.end());
+    std::vector<std::vector<int32_t>> indexs2(indexs.begin() + 5,
+                                              indexs.end());
+    searcher.Search(scores1, indexs1);
+    searcher.Search(scores2, indexs2);
+    searcher.FinalizeSearch();
+    ASSERT_FALSE(searcher.Outputs().empty());
+    EXPECT_EQ(searcher.Outputs()[0], full.Outputs()[0]) << "k " << k;
+    EXPECT_EQ(searcher.Inputs()[0], full.Inputs()[0]) << "k " << k;
+    EXPECT_EQ(searcher.Times()[0], full.Times()[0]) << "k " << k;
+  }
+}
+
+TEST_F(CtcWfstBeamSearchTest, PartialBestPathTest) {
+  // The partial result traced from the cached best path of the last chunk
+  // is the one traced from the start
+  wenet::CtcWfstBeamSearch searcher(graph_, opts_, nullptr);
+  for (size_t i = 0; i < logp_.size(); ++i) {
+    searcher.Search(std::vector<std::vector<float>>(1, logp_[i]));
+    wenet::CtcWfstBeamSearch full(graph_, opts_, nullptr);
+    full.Search(std::vector<std::vector<float>>(logp_.begin(),
+                                                logp_.begin() + i + 1));
+    ASSERT_EQ(searcher.Outputs().size(), full.Outputs().size()) << i;
+    if (full.Outputs().empty()) continue;
+    EXPECT_EQ(searcher.Outputs()[0], full.Outputs()[0]) << "frame " << i;
+    EXPECT_EQ(searcher.Inputs()[0], full.Inputs()[0]) << "frame " << i;
+    EXPECT_NEAR(searcher.Likelihood()[0], full.Likelihood()[0], 1e-4);
+  }
+}
+
+TEST_F(CtcWfstBeamSearchTest, PartialNbestWindowTest) {
+  // The lattice of the last 2 decoded frames only, whose paths start by the
+  // arcs of the begin tokens and are prefixed by their best paths. They
+  // are the paths of the whole lattice, which has them all in its n-best.
+  wenet::CtcWfstBeamSearchOptions window_opts = opts_;
+  window_opts.partial_nbest = 3;
+  window_opts.partial_lattice_frames = 2;
+  wenet::CtcWfstBeamSearchOptions full_opts = opts_;
+  full_opts.partial_nbest = 10000;
+  wenet::CtcWfstBeamSearch window(graph_, window_opts, nullptr);
+  wenet::CtcWfstBeamSearch full(graph_, full_opts, nullptr);
+  for (size_t i = 0; i < logp_.size(); ++i) {
+    window.Search(std::vector<std::vector<float>>(1, logp_[i]));
+    full.Search(std::vector<std::vector<float>>(1, logp_[i]));
+    ASSERT_EQ(window.Outputs().empty(), full.Outputs().empty()) << i;
+    if (full.Outputs().empty()) continue;
+    ASSERT_LE(window.Outputs().size(), 3);
+    // The best path is the same
+    EXPECT_EQ(window.Outputs()[0], full.Outputs()[0]) << "frame " << i;
+    EXPECT_EQ(window.Inputs()[0], full.Inputs()[0]) << "frame " << i;
+    EXPECT_NEAR(window.Likelihood()[0], full.Likelihood()[0], 1e-4);
+    for (size_t j = 0; j < window.Outputs().size(); ++j) {
+      if (j > 0) {
+        EXPECT_LE(window.Likelihood()[j], window.Likelihood()[j - 1] + 1e-4);
+      }
+      bool found = false;
+      for (size_t k = 0; k < full.Outputs().size() && !found; ++k) {
+        found = window.Outputs()[j] == full.Outputs()[k] &&
+                window.Inputs()[j] == full.Inputs()[k] &&
+                std::fabs(window.Likelihood()[j] - full.Likelihood()[k]) <
+                    1e-4;
+      }
+      EXPECT_TRUE(found) << "frame " << i << " path " << j;
+    }
+  }
+}
+
+TEST_F(CtcWfstBeamSearchTest, SparseTopKTest) {
+  // The full posteriors are reduced to the topk of sparse_topk
+  wenet::CtcWfstBeamSearch full(graph_, opts_, nullptr);
+  full.Search(logp_);
+  full.FinalizeSearch();
+  opts_.sparse_topk = 2;
+  wenet::CtcWfstBeamSearch searcher(graph_, opts_, nullptr);
+  searcher.Search(logp_);
+  searcher.FinalizeSearch();
+  ASSERT_FALSE(searcher.Outputs().empty());
+  EXPECT_EQ(searcher.Outputs()[0], full.Outputs()[0]);
+  EXPECT_EQ(searcher.Times()[0], full.Times()[0]);
+}
+
+TEST_F(CtcWfstBeamSearchTest, WordLatticeTest) {
+  // The best path of the lattice is the 1-best, with or without the
+  // lattice determinized for the n-best
+  for (int nbest : {1, 10}) {
+    opts_.nbest = nbest;
+    wenet::CtcWfstBeamSearch searcher(graph_, opts_, nullptr);
+    searcher.Search(logp_);
+    searcher.FinalizeSearch();
+    wenet::WordLattice lattice;
+    ASSERT_TRUE(searcher.GetWordLattice(&lattice));
+    ASSERT_GT(lattice.num_states(), 0);
+    // Viterbi over the topologically sorted states
+    int n = lattice.num_states();
+    std::vector<float> costs(n, std::numeric_limits<float>::infinity());
+    std::vector<const wenet::WordLattice::Arc*> backs(n, nullptr);
+    std::vector<int> prevs(n, -1);
+    costs[0] = 0.0;
+    int best = -1;
+    float best_cost = std::numeric_limits<float>::infinity();
+    for (int s = 0; s < n; ++s) {
+      if (lattice.IsFinal(s)) {
+        float cost = costs[s] + lattice.final_graph_cost(s) +
+                     lattice.final_acoustic_cost(s);
+        if (cost < best_cost) {
+          best_cost = cost;
+          best = s;
+        }
+      }
+      for (auto arc = lattice.arcs_begin(s); arc != lattice.arcs_end(s);
+           ++arc) {
+        EXPECT_LE(lattice.time(s), lattice.time(arc->next));
+        float cost = costs[s] + arc->graph_cost + arc->acoustic_cost;
+        if (cost < costs[arc->next]) {
+          costs[arc->next] = cost;
+          backs[arc->next] = arc;
+          prevs[arc->next] = s;
+        }
+      }
+    }
+    ASSERT_GE(best, 0);
+    std::vector<int> words;
+    for (int s = best; prevs[s] >= 0; s = prevs[s]) {
+      if (backs[s]->word != 0) words.insert(words.begin(), backs[s]->word);
+    }
+    EXPECT_EQ(words, searcher.Outputs()[0]) << "nbest " << nbest;
+    EXPECT_NEAR(-best_cost, searcher.Likelihood()[0], 1e-3);
+    // The skipped blank frame is counted in the times
+    EXPECT_EQ(lattice.time(best), logp_.size());
+  }
+}
+
+TEST_F(CtcWfstBeamSearchTest, LatticeRescoringTest) {
+  wenet::CtcWfstBeamSearch full(graph_, opts_, nullptr);
+  full.Search(logp_);
+  full.FinalizeSearch();
+  ASSERT_FALSE(full.Outputs().empty());
+  // The new LM costs 0.5 more of every word, so the best path is the same
+  // and its likelihood is lowered by 0.5 of each of the 4 words
+  auto rescorer = std::make_shared<wenet::LatticeRescorer>(Unigram(4, 0.0),
+                                                           Unigram(4, 0.5));
+  for (int nbest : {1, 10}) {
+    opts_.nbest = nbest;
+    wenet::CtcWfstBeamSearch searcher(graph_, opts_, nullptr, rescorer);
+    searcher.Search(logp_);
+    searcher.FinalizeSearch();
+    ASSERT_FALSE(searcher.Outputs().empty());
+    EXPECT_EQ(searcher.Outputs()[0], full.Outputs()[0]) << "nbest " << nbest;
+    EXPECT_EQ(searcher.Times()[0], full.Times()[0]) << "nbest " << nbest;
+    EXPECT_NEAR(searcher.Likelihood()[0], full.Likelihood()[0] - 2.0, 1e-3);
+  }
+}
+
+TEST_F(CtcWfstBeamSearchTest, LatticeRescoringFailureTest) {
+  wenet::CtcWfstBeamSearch full(graph_, opts_, nullptr);
+  full.Search(logp_);
+  full.FinalizeSearch();
+  // No path is accepted by the new LM, the lattice is kept as it is
+  auto rescorer = std::make_shared<wenet::LatticeRescorer>(
+      Unigram(4, 0.0), Unigram(4, 0.0, false));
+  wenet::CtcWfstBeamSearch searcher(graph_, opts_, nullptr, rescorer);
+  searcher.Search(logp_);
+  searcher.FinalizeSearch();
+  ASSERT_FALSE(searcher.Outputs().empty());
+  EXPECT_EQ(searcher.Outputs()[0], full.Outputs()[0]);
+  EXPECT_NEAR(searcher.Likelihood()[0], full.Likelihood()[0], 1e-3);
+}
+
+TEST_F(CtcWfstBeamSearchTest, SharedQuantizedFstTest) {
+  wenet::CtcWfstBeamSearch full(graph_, opts_, nullptr);
+  full.Search(logp_);
+  full.FinalizeSearch();
+  // One graph of the compact arcs is shared by the searches of the threads,
+  // each of which expands the arcs in the cache of its copy
+  wenet::QuantizedFst quantized(graph_);
+  const int kNumThreads = 8;
+  std::vector<std::vector<int>> outputs(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      for (int n = 0; n < 20; ++n) {
+        wenet::CtcWfstBeamSearch searcher(quantized, opts_, nullptr);
+        searcher.Search(logp_);
+        searcher.FinalizeSearch();
+        if (searcher.Outputs().empty()) return;
+        outputs[i] = searcher.Outputs()[0];
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  for (int i = 0; i < kNumThreads; ++i) {
+    EXPECT_EQ(outputs[i], full.Outputs()[0]) << "thread " << i;
+  }
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/encoder_out_store.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(EncoderOutStoreTest, HalfTest) {
+  using wenet::EncoderOutStore;
+  // Exact ones, the max, a subnormal and the round to the nearest even
+  for (float value : {0.0f, 1.0f, -2.5f, 65504.0f, 5.9604645e-8f}) {
+    EXPECT_EQ(EncoderOutStore::HalfToFloat(EncoderOutStore::FloatToHalf(
+                  value)), value);
+  }
+  EXPECT_EQ(EncoderOutStore::FloatToHalf(1.0f + 1.0f / 2048), 0x3c00);
+  EXPECT_EQ(EncoderOutStore::FloatToHalf(1.0f + 3.0f / 2048), 0x3c02);
+  EXPECT_TRUE(std::isinf(EncoderOutStore::HalfToFloat(
+      EncoderOutStore::FloatToHalf(65520.0f))));
+  EXPECT_TRUE(std::isnan(EncoderOutStore::HalfToFloat(
+      EncoderOutStore::FloatToHalf(std::nanf("")))));
+}
+
+TEST(EncoderOutStoreTest, StorageTest) {
+  const int dim = 8;
+  std::vector<float> rows(3 * dim);
+  for (size_t i = 0; i < rows.size(); ++i) {
+    rows[i] = std::sin(static_cast<float>(i)) * (i / dim + 1);
+  }
+  rows.back() = 0;
+  for (auto storage : {wenet::EncoderOutStorage::kFloat32,
+                       wenet::EncoderOutStorage::kFloat16,
+                       wenet::EncoderOutStorage::kInt8}) {
+    wenet::EncoderOutStore store(storage);
+    // Appended by the chunks
+    store.Append(rows.data(), 1, dim);
+    store.Append(rows.data() + dim, 2, dim);
+    ASSERT_EQ(store.num_rows(), 3);
+    ASSERT_EQ(store.dim(), dim);
+    std::vector<float> out(rows.size());
+    store.CopyTo(out.data());
+    for (size_t i = 0; i < rows.size(); ++i) {
+      float max_abs = i / dim + 1;
+      float tolerance = storage == wenet::EncoderOutStorage::kFloat32 ? 0
+                        : storage == wenet::EncoderOutStorage::kFloat16
+                            ? max_abs / 1024
+                            : max_abs / 127 / 2;
+      EXPECT_NEAR(out[i], rows[i], tolerance) << i;
+    }
+    store.Clear();
+    EXPECT_TRUE(store.empty());
+  }
+}
@@ -0,0 +1,221 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "frontend/cmvn.h"
+#include "frontend/fbank.h"
+#include "frontend/fbank_kernels.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+std::vector<float> RandomVector(int n, std::default_random_engine* gen) {
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  std::vector<float> v(n);
+  for (int i = 0; i < n; ++i) v[i] = dist(*gen);
+  return v;
+}
+
+}  // namespace
+
+TEST(FbankTest, KernelsMatchScalarTest) {
+  const wenet::FbankKernels& simd = wenet::GetFbankKernels();
+  const wenet::FbankKernels& ref = wenet::GetScalarFbankKernels();
+  std::default_random_engine gen(0);
+  // Cover lengths around the vector widths and the real frame length
+  for (int n : {1, 3, 7, 8, 9, 15, 16, 17, 31, 33, 255, 400, 512}) {
+    std::vector<float> a = RandomVector(n, &gen);
+    std::vector<float> b = RandomVector(n, &gen);
+    EXPECT_NEAR(simd.sum(a.data(), n), ref.sum(a.data(), n), 1e-4);
+    EXPECT_NEAR(simd.dot(a.data(), b.data(), n),
+                ref.dot(a.data(), b.data(), n), 1e-4);
+
+    std::vector<float> x1 = a, x2 = a;
+    simd.add_scalar(0.5, x1.data(), n);
+    ref.add_scalar(0.5, x2.data(), n);
+    EXPECT_THAT(x1, testing::Pointwise(testing::FloatNear(1e-6), x2));
+
+    x1 = a, x2 = a;
+    simd.pre_emphasis(0.97, x1.data(), n);
+    ref.pre_emphasis(0.97, x2.data(), n);
+    EXPECT_THAT(x1, testing::Pointwise(testing::FloatNear(1e-6), x2));
+
+    x1 = a, x2 = a;
+    simd.mul(b.data(), x1.data(), n);
+    ref.mul(b.data(), x2.data(), n);
+    EXPECT_THAT(x1, testing::Pointwise(testing::FloatNear(1e-6), x2));
+
+    std::vector<float> p1(n), p2(n);
+    simd.power_spectrum(a.data(), b.data(), p1.data(), n);
+    ref.power_spectrum(a.data(), b.data(), p2.data(), n);
+    EXPECT_THAT(p1, testing::Pointwise(testing::FloatNear(1e-6), p2));
+
+    std::vector<int16_t> pcm(n);
+    for (int i = 0; i < n; ++i) pcm[i] = a[i] * 32767;
+    simd.int16_to_float(pcm.data(), p1.data(), n);
+    ref.int16_to_float(pcm.data(), p2.data(), n);
+    EXPECT_EQ(p1, p2);
+  }
+}
+
+TEST(FbankTest, ComputeTest) {
+  std::default_random_engine gen(0);
+  std::vector<float> wave = RandomVector(16000, &gen);
+  for (float& x : wave) x *= 32768;
+  wenet::Fbank fbank(80, 16000, 400, 160);
+  std::vector<std::vector<float>> feat;
+  ASSERT_EQ(fbank.Compute(wave, &feat), 98);
+  ASSERT_EQ(feat.size(), 98);
+  for (const auto& frame : feat) {
+    ASSERT_EQ(frame.size(), 80);
+    for (float x : frame) ASSERT_TRUE(std::isfinite(x));
+  }
+}
+
+TEST(FbankTest, RealFftTest) {
+  std::default_random_engine gen(0);
+  std::vector<float> wave = RandomVector(16000, &gen);
+  for (float& x : wave) x *= 32768;
+  wenet::Fbank real_fbank(80, 16000, 400, 160);
+  wenet::Fbank complex_fbank(80, 16000, 400, 160);
+  complex_fbank.set_use_real_fft(false);
+  std::vector<std::vector<float>> real_feat, complex_feat;
+  real_fbank.Compute(wave, &real_feat);
+  complex_fbank.Compute(wave, &complex_feat);
+  ASSERT_EQ(real_feat.size(), complex_feat.size());
+  for (size_t i = 0; i < real_feat.size(); ++i) {
+    EXPECT_THAT(real_feat[i],
+                testing::Pointwise(testing::FloatNear(1e-3), complex_feat[i]));
+  }
+}
+
+TEST(FbankTest, ComputeBatchTest) {
+  std::default_random_engine gen(0);
+  // 98 frames, 3 full blocks and a partial one
+  std::vector<float> wave = RandomVector(16000, &gen);
+  for (float& x : wave) x *= 32768;
+  wenet::Fbank fbank(80, 16000, 400, 160);
+  std::vector<std::vector<float>> feat, batch_feat;
+  int num_frames = fbank.Compute(wave, &feat);
+  ASSERT_EQ(fbank.ComputeBatch(wave, &batch_feat), num_frames);
+  ASSERT_EQ(batch_feat.size(), feat.size());
+  for (size_t i = 0; i < feat.size(); ++i) {
+    EXPECT_THAT(batch_feat[i],
+                testing::Pointwise(testing::FloatNear(1e-3), feat[i]));
+  }
+}
+
+TEST(FbankTest, SharedTablesTest) {
+  std::default_random_engine gen(0);
+  std::vector<float> wave = RandomVector(16000, &gen);
+  for (float& x : wave) x *= 32768;
+  auto tables = std::make_shared<const wenet::FbankTables>(80, 16000, 400);
+  EXPECT_TRUE(tables->Match(80, 16000, 400));
+  EXPECT_FALSE(tables->Match(40, 16000, 400));
+  // The Fbanks of the shared tables compute the same as their own, and keep
+  // their own options
+  wenet::Fbank own(80, 16000, 400, 160);
+  wenet::Fbank shared(tables, 160);
+  wenet::Fbank shared_complex(tables, 160);
+  shared_complex.set_use_real_fft(false);
+  EXPECT_EQ(shared.tables(), shared_complex.tables());
+  std::vector<std::vector<float>> own_feat, shared_feat, complex_feat;
+  own.Compute(wave, &own_feat);
+  shared.Compute(wave, &shared_feat);
+  shared_complex.Compute(wave, &complex_feat);
+  EXPECT_EQ(shared_feat, own_feat);
+  ASSERT_EQ(complex_feat.size(), own_feat.size());
+  for (size_t i = 0; i < own_feat.size(); ++i) {
+    EXPECT_THAT(complex_feat[i],
+                testing::Pointwise(testing::FloatNear(1e-3), own_feat[i]));
+  }
+}
+
+TEST(FbankTest, CmvnTest) {
+  std::default_random_engine gen(0);
+  std::vector<float> wave = RandomVector(16000, &gen);
+  for (float& x : wave) x *= 32768;
+  wenet::Fbank fbank(80, 16000, 400, 160);
+  std::vector<std::vector<float>> feat;
+  int num_frames = fbank.Compute(wave, &feat);
+  // The stats of the frames themselves, in the json of the training
+  std::vector<double> mean_stat(80, 0), var_stat(80, 0);
+  for (const auto& frame : feat) {
+    for (int j = 0; j < 80; ++j) {
+      mean_stat[j] += frame[j];
+      var_stat[j] += frame[j] * frame[j];
+    }
+  }
+  std::string path = testing::TempDir() + "fbank_test_global_cmvn";
+  {
+    std::ofstream os(path);
+    os << "{\"mean_stat\": [";
+    for (int j = 0; j < 80; ++j) os << (j > 0 ? ", " : "") << mean_stat[j];
+    os << "], \"var_stat\": [";
+    for (int j = 0; j < 80; ++j) os << (j > 0 ? ", " : "") << var_stat[j];
+    os << "], \"frame_num\": " << num_frames << "}";
+  }
+  auto cmvn = wenet::GlobalCmvn::Read(path);
+  std::remove(path.c_str());
+  ASSERT_NE(cmvn, nullptr);
+  ASSERT_EQ(cmvn->dim(), 80);
+  for (int j = 0; j < 80; ++j) {
+    double mean = mean_stat[j] / num_frames;
+    double var = var_stat[j] / num_frames - mean * mean;
+    EXPECT_NEAR(cmvn->mean()[j], mean, 1e-3 * std::abs(mean));
+    EXPECT_NEAR(cmvn->istd()[j], 1.0 / std::sqrt(var), 1e-2 / std::sqrt(var));
+  }
+  // The fused cmvn is (x - mean) * istd, of both Compute and ComputeBatch
+  fbank.set_cmvn(cmvn);
+  std::vector<std::vector<float>> norm_feat, batch_feat;
+  ASSERT_EQ(fbank.Compute(wave, &norm_feat), num_frames);
+  ASSERT_EQ(fbank.ComputeBatch(wave, &batch_feat), num_frames);
+  for (int i = 0; i < num_frames; ++i) {
+    std::vector<float> expected(80);
+    for (int j = 0; j < 80; ++j) {
+      expected[j] = (feat[i][j] - cmvn->mean()[j]) * cmvn->istd()[j];
+      EXPECT_NEAR(cmvn->Denormalize(norm_feat[i][j], j), feat[i][j], 1e-3);
+    }
+    EXPECT_THAT(norm_feat[i],
+                testing::Pointwise(testing::FloatNear(1e-3), expected));
+    EXPECT_THAT(batch_feat[i],
+                testing::Pointwise(testing::FloatNear(1e-2), expected));
+  }
+}
+
+TEST(FbankTest, InvalidCmvnTest) {
+  std::string path = testing::TempDir() + "fbank_test_invalid_cmvn";
+  for (const char* json : {"{\"mean_stat\": [1, 2], \"var_stat\": [4], "
+                           "\"frame_num\": 1}",
+                           "{\"mean_stat\": [1], \"var_stat\": [4]}",
+                           "{\"mean_stat\": [1, 2 \"var_stat\": [4, 5], "
+                           "\"frame_num\": 1}"}) {
+    {
+      std::ofstream os(path);
+      os << json;
+    }
+    EXPECT_EQ(wenet::GlobalCmvn::Read(path), nullptr) << json;
+  }
+  std::remove(path.c_str());
+  EXPECT_EQ(wenet::GlobalCmvn::Read(path), nullptr);
+}
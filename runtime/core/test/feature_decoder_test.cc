@@ -0,0 +1,103 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/feature_decoder.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+TEST(FeatureDecoderTest, CreateTest) {
+  FeaturePipelineConfig config(80, 16000);
+  std::string error;
+  EXPECT_NE(CreateFeatureDecoder("fbank", config, 0, 0, &error), nullptr);
+  EXPECT_NE(CreateFeatureDecoder("fbank_fp16", config, 80, 10, &error),
+            nullptr);
+  EXPECT_EQ(CreateFeatureDecoder("mfcc", config, 0, 0, &error), nullptr);
+  // The options of the client must match the config
+  EXPECT_EQ(CreateFeatureDecoder("fbank_int8", config, 40, 0, &error),
+            nullptr);
+  EXPECT_EQ(CreateFeatureDecoder("fbank_int8", config, 0, 20, &error),
+            nullptr);
+  EXPECT_FALSE(error.empty());
+}
+
+TEST(FeatureDecoderTest, DecodeTest) {
+  std::vector<float> expected = {0.0f, -1.5f, 2.25f, 65504.0f,
+                                 -0.5f, 1.0f, 0.125f, -3.0f};
+  std::vector<float> feats;
+  // float32
+  FeatureDecoder float32(FeatureFormat::kFloat32, 4);
+  std::string data(reinterpret_cast<const char*>(expected.data()),
+                   expected.size() * sizeof(float));
+  ASSERT_TRUE(float32.Decode(data.data(), data.size(), &feats));
+  EXPECT_EQ(feats, expected);
+  // Not of whole frames
+  EXPECT_FALSE(float32.Decode(data.data(), data.size() - 4, &feats));
+
+  // IEEE half of the values above, all of which are exact in half
+  std::vector<uint16_t> halves = {0x0000, 0xBE00, 0x4080, 0x7BFF,
+                                  0xB800, 0x3C00, 0x3000, 0xC200};
+  FeatureDecoder float16(FeatureFormat::kFloat16, 4);
+  ASSERT_EQ(float16.frame_bytes(), 8);
+  feats.clear();
+  ASSERT_TRUE(float16.Decode(reinterpret_cast<const char*>(halves.data()),
+                             halves.size() * sizeof(uint16_t), &feats));
+  EXPECT_EQ(feats, expected);
+  // The smallest subnormal half
+  uint16_t subnormal = 0x0001;
+  FeatureDecoder float16_dim1(FeatureFormat::kFloat16, 1);
+  feats.clear();
+  ASSERT_TRUE(float16_dim1.Decode(reinterpret_cast<const char*>(&subnormal),
+                                  sizeof(subnormal), &feats));
+  EXPECT_EQ(feats[0], std::ldexp(1.0f, -24));
+
+  // int8 with a scale per frame
+  FeatureDecoder int8(FeatureFormat::kInt8, 4);
+  ASSERT_EQ(int8.frame_bytes(), 8);
+  std::string quantized(16, '\0');
+  float scales[2] = {0.5f, 0.25f};
+  int8_t values[2][4] = {{0, -3, 4, 127}, {-2, 4, 1, -12}};
+  for (int i = 0; i < 2; ++i) {
+    memcpy(&quantized[i * 8], &scales[i], sizeof(float));
+    memcpy(&quantized[i * 8 + 4], values[i], 4);
+  }
+  feats.clear();
+  ASSERT_TRUE(int8.Decode(quantized.data(), quantized.size(), &feats));
+  std::vector<float> dequantized = {0.0f, -1.5f, 2.0f, 63.5f,
+                                    -0.5f, 1.0f, 0.25f, -3.0f};
+  EXPECT_EQ(feats, dequantized);
+}
+
+TEST(FeatureDecoderTest, AcceptFeaturesTest) {
+  FeaturePipelineConfig config(4, 16000);
+  FeaturePipeline pipeline(config);
+  std::vector<float> frames = {1, 2, 3, 4, 5, 6, 7, 8};
+  pipeline.AcceptFeatures(frames.data(), 2);
+  pipeline.set_input_finished();
+  EXPECT_EQ(pipeline.num_frames(), 2);
+  std::vector<std::vector<float>> feats;
+  EXPECT_FALSE(pipeline.Read(3, &feats));
+  ASSERT_EQ(feats.size(), 2);
+  EXPECT_EQ(feats[0], std::vector<float>({1, 2, 3, 4}));
+  EXPECT_EQ(feats[1], std::vector<float>({5, 6, 7, 8}));
+}
+
+}  // namespace wenet
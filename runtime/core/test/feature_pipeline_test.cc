@@ -12,11 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include "frontend/feature_pipeline.h"
 #include "utils/blocking_queue.h"
+#include "utils/spsc_queue.h"
+#include "utils/state_io.h"
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -54,6 +60,151 @@ TEST(FeaturePipelineTest, BlockingQueueTest) {
   ASSERT_TRUE(pop_data.empty());
 }
 
+TEST(FeaturePipelineTest, SpscQueueTest) {
+  // Blocks of 4 values to cross the blocks
+  wenet::SpscQueue<int, 4> queue;
+  std::thread push_thread([&queue]() {
+    for (int i = 0; i < 1000; i += 10) {
+      std::vector<int> values;
+      for (int j = i; j < i + 10; ++j) values.push_back(j);
+      queue.Push(&values);
+      ASSERT_TRUE(values.empty());
+    }
+    queue.Push(1000);
+    queue.Close();
+  });
+  std::vector<int> pop_data;
+  while (queue.Pop(7, &pop_data) == 7) {
+  }
+  push_thread.join();
+  ASSERT_EQ(pop_data.size(), 1001);
+  for (int i = 0; i <= 1000; ++i) ASSERT_EQ(pop_data[i], i);
+  ASSERT_EQ(queue.Size(), 0);
+  ASSERT_TRUE(queue.closed());
+  ASSERT_EQ(queue.Pop(1, &pop_data), 0);
+
+  queue.Clear();
+  ASSERT_FALSE(queue.closed());
+  queue.Push(1);
+  ASSERT_EQ(queue.Size(), 1);
+  pop_data.clear();
+  ASSERT_EQ(queue.Pop(0, &pop_data), 0);
+  ASSERT_EQ(queue.Pop(1, &pop_data), 1);
+  ASSERT_EQ(pop_data[0], 1);
+
+  // The values moved into the slots of the recycled blocks
+  wenet::SpscQueue<std::vector<int>, 4> vector_queue;
+  std::thread lockstep_thread([&vector_queue]() {
+    for (int i = 0; i < 100; ++i) {
+      std::vector<std::vector<int>> values;
+      for (int j = 0; j < 3; ++j) values.emplace_back(i + 1, j);
+      vector_queue.Push(&values);
+    }
+    vector_queue.Close();
+  });
+  std::vector<std::vector<int>> vector_data;
+  for (int i = 0; i < 100; ++i) {
+    vector_data.clear();
+    ASSERT_EQ(vector_queue.Pop(3, &vector_data), 3);
+    for (int j = 0; j < 3; ++j) {
+      ASSERT_EQ(vector_data[j], std::vector<int>(i + 1, j));
+    }
+  }
+  lockstep_thread.join();
+  ASSERT_EQ(vector_queue.Pop(1, &vector_data), 0);
+}
+
+TEST(FeaturePipelineTest, SpscPipelineTest) {
+  wenet::FeaturePipelineConfig config(80, 8000);
+  wenet::FeaturePipeline expected_pipeline(config);
+  config.use_spsc_queue = true;
+  wenet::FeaturePipeline feature_pipeline(config);
+  int audio_len = 8 * 55;  // audio len 55ms,4 frames
+  std::vector<float> pcm(audio_len);
+  for (int i = 0; i < audio_len; ++i) pcm[i] = (i % 100) * 100;
+  for (int i = 0; i < 20; ++i) {
+    expected_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  }
+  expected_pipeline.set_input_finished();
+  std::thread push_thread([&]() {
+    for (int i = 0; i < 20; ++i) {
+      feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+    }
+    feature_pipeline.set_input_finished();
+  });
+
+  wenet::FeatureView view, expected;
+  while (feature_pipeline.Read(16, &view)) {
+    ASSERT_TRUE(expected_pipeline.Read(16, &expected));
+    for (int i = 0; i < 16 * 80; ++i) {
+      ASSERT_EQ(view.data()[i], expected.data()[i]);
+    }
+  }
+  push_thread.join();
+  ASSERT_FALSE(expected_pipeline.Read(16, &expected));
+  ASSERT_EQ(view.num_frames(), expected.num_frames());
+  ASSERT_EQ(feature_pipeline.NumQueuedFrames(), 0);
+
+  feature_pipeline.Reset();
+  feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  ASSERT_EQ(feature_pipeline.NumQueuedFrames(), 4);
+  ASSERT_TRUE(feature_pipeline.Read(2, &view));
+  ASSERT_EQ(feature_pipeline.NumQueuedFrames(), 2);
+}
+
+TEST(FeaturePipelineTest, DeferFeaturesTest) {
+  // The pipelines refer to their configs
+  wenet::FeaturePipelineConfig expected_config(80, 8000);
+  wenet::FeaturePipeline expected_pipeline(expected_config);
+  wenet::FeaturePipelineConfig config(80, 8000);
+  config.defer_features = true;
+  wenet::FeaturePipeline feature_pipeline(config);
+  int audio_len = 8 * 55;  // audio len 55ms,4 frames
+  std::vector<int16_t> pcm(audio_len, 0);
+  for (int i = 0; i < audio_len; ++i) pcm[i] = (i % 100) * 100;
+  for (int i = 0; i < 20; ++i) {
+    expected_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  }
+  expected_pipeline.set_input_finished();
+  // The waveform is only buffered by the pushing thread, and extracted by
+  // the reading one
+  std::thread push_thread([&]() {
+    for (int i = 0; i < 20; ++i) {
+      feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+    }
+    feature_pipeline.set_input_finished();
+  });
+
+  // The packets drained together are extracted by one ComputeBatch(),
+  // which may sum the mel energies by blocks
+  wenet::FeatureView view, expected;
+  while (feature_pipeline.Read(16, &view)) {
+    ASSERT_TRUE(expected_pipeline.Read(16, &expected));
+    for (int i = 0; i < 16 * 80; ++i) {
+      ASSERT_NEAR(view.data()[i], expected.data()[i], 1e-3);
+    }
+  }
+  push_thread.join();
+  ASSERT_FALSE(expected_pipeline.Read(16, &expected));
+  ASSERT_EQ(view.num_frames(), expected.num_frames());
+  ASSERT_TRUE(feature_pipeline.input_finished());
+  ASSERT_EQ(feature_pipeline.num_frames(), expected_pipeline.num_frames());
+
+  feature_pipeline.Reset();
+  feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  // Counted by the frame shift before it's extracted
+  ASSERT_EQ(feature_pipeline.num_frames(), 0);
+  ASSERT_EQ(feature_pipeline.NumQueuedFrames(), audio_len / config.frame_shift);
+  feature_pipeline.ComputePending();
+  ASSERT_EQ(feature_pipeline.num_frames(), 4);
+  ASSERT_FALSE(feature_pipeline.input_finished());
+  feature_pipeline.set_input_finished();
+  ASSERT_FALSE(feature_pipeline.input_finished());
+  ASSERT_TRUE(feature_pipeline.Read(4, &view));
+  ASSERT_TRUE(feature_pipeline.input_finished());
+  ASSERT_FALSE(feature_pipeline.Read(1, &view));
+}
+
 TEST(FeaturePipelineTest, PipelineTest) {
   wenet::FeaturePipelineConfig config(80, 8000);
   wenet::FeaturePipeline feature_pipeline(config);
@@ -89,3 +240,256 @@ TEST(FeaturePipelineTest, PipelineTest) {
   ASSERT_EQ(out_feats.size(), 0);
   ASSERT_EQ(feature_pipeline.NumQueuedFrames(), 0);
 }
+
+TEST(FeaturePipelineTest, FeatureViewTest) {
+  wenet::FeaturePipelineConfig config(80, 8000);
+  wenet::FeaturePipeline feature_pipeline(config);
+  int audio_len = 8 * 55;  // audio len 55ms,4 frames
+  std::vector<float> pcm(audio_len);
+  for (int i = 0; i < audio_len; ++i) pcm[i] = (i % 100) * 100;
+  feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  std::vector<std::vector<float>> expected;
+  {
+    wenet::FeaturePipeline copy_pipeline(config);
+    copy_pipeline.AcceptWaveform(pcm.data(), audio_len);
+    copy_pipeline.Read(4, &expected);
+  }
+
+  wenet::FeatureView view;
+  ASSERT_TRUE(feature_pipeline.Read(3, &view));
+  ASSERT_EQ(view.num_frames(), 3);
+  ASSERT_EQ(view.feature_dim(), 80);
+  ASSERT_EQ(feature_pipeline.NumQueuedFrames(), 1);
+  // The view stays valid while more frames are added
+  for (int i = 0; i < 100; ++i) {
+    feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  }
+  for (int i = 0; i < 3; ++i) {
+    std::vector<float> frame(view.frame(i), view.frame(i) + 80);
+    ASSERT_EQ(frame, expected[i]);
+  }
+  ASSERT_EQ(view.frame(1), view.data() + 80);
+  int num_queued = feature_pipeline.NumQueuedFrames();
+  ASSERT_EQ(num_queued, feature_pipeline.num_frames() - 3);
+
+  feature_pipeline.set_input_finished();
+  ASSERT_FALSE(feature_pipeline.Read(num_queued + 1, &view));
+  ASSERT_EQ(view.num_frames(), num_queued);
+  ASSERT_TRUE(feature_pipeline.input_finished());
+}
+
+TEST(FeaturePipelineTest, VadTest) {
+  // 0.9s noise, 1.1s harmonics of 200Hz in noise, then 1s noise
+  const int sample_rate = 16000;
+  std::vector<float> pcm(3 * sample_rate);
+  unsigned int seed = 1;
+  for (int i = 0; i < pcm.size(); ++i) {
+    seed = seed * 1103515245 + 12345;
+    pcm[i] = static_cast<int>((seed >> 16) % 21) - 10;
+    if (i >= sample_rate * 9 / 10 && i < 2 * sample_rate) {
+      for (int k = 1; k <= 10; ++k) {
+        pcm[i] += 3000.0 / k * std::sin(2 * M_PI * 200 * k * i / sample_rate);
+      }
+    }
+  }
+  wenet::FeaturePipelineConfig config(80, sample_rate);
+  config.enable_vad = true;
+  // The vad runs on the log mel energies, with the cmvn applied or not
+  std::vector<double> mean_stat(80), var_stat(80);
+  for (int i = 0; i < 80; ++i) {
+    mean_stat[i] = 10.0 + 0.1 * i;
+    var_stat[i] = 100.0 + 4.0 * (i + 1);
+  }
+  for (int k = 0; k < 4; ++k) {
+    config.use_spsc_queue = k % 2 == 1;
+    config.cmvn = nullptr;
+    if (k >= 2) {
+      config.cmvn =
+          std::make_shared<wenet::GlobalCmvn>(mean_stat, var_stat, 1.0);
+    }
+    wenet::FeaturePipeline feature_pipeline(config);
+    feature_pipeline.AcceptWaveform(pcm.data(), pcm.size());
+    feature_pipeline.set_input_finished();
+    // Chunks of 20 frames, the speech is in frames [88, 200), and kept by
+    // the hangover of 30 frames after, so are the first 30 frames
+    std::vector<bool> silent;
+    wenet::FeatureView view;
+    while (feature_pipeline.Read(20, &view)) {
+      silent.push_back(feature_pipeline.last_read_silent());
+    }
+    ASSERT_EQ(silent.size(), 14);
+    std::vector<bool> expected = {false, false, true,  true,  false,
+                                  false, false, false, false, false,
+                                  false, false, true,  true};
+    ASSERT_EQ(silent, expected);
+    // The tail of less than a chunk
+    ASSERT_TRUE(feature_pipeline.last_read_silent());
+  }
+}
+
+TEST(FeaturePipelineTest, ComputeUtteranceTest) {
+  // The same frames as the ones read from the pipeline, with or without
+  // resampling
+  wenet::FeaturePipelineConfig config(80, 16000);
+  for (int input_rate : {16000, 8000}) {
+    std::vector<float> pcm(input_rate / 2);
+    for (int i = 0; i < pcm.size(); ++i) pcm[i] = (i % 100) * 100;
+    wenet::FeaturePipeline feature_pipeline(config);
+    feature_pipeline.set_input_sample_rate(input_rate);
+    feature_pipeline.AcceptWaveform(pcm.data(), pcm.size() / 3);
+    feature_pipeline.AcceptWaveform(pcm.data() + pcm.size() / 3,
+                                    pcm.size() - pcm.size() / 3);
+    feature_pipeline.set_input_finished();
+    std::vector<std::vector<float>> expected;
+    feature_pipeline.Read(feature_pipeline.num_frames(), &expected);
+
+    wenet::FeaturePipeline offline_pipeline(config);
+    offline_pipeline.set_input_sample_rate(input_rate);
+    wenet::FeatureView view;
+    offline_pipeline.ComputeUtterance(pcm.data(), pcm.size(), &view);
+    ASSERT_EQ(view.num_frames(), expected.size()) << input_rate;
+    ASSERT_EQ(view.feature_dim(), 80);
+    for (int i = 0; i < view.num_frames(); ++i) {
+      std::vector<float> frame(view.frame(i), view.frame(i) + 80);
+      ASSERT_THAT(frame, ::testing::Pointwise(::testing::FloatNear(1e-3),
+                                              expected[i]))
+          << input_rate << " frame " << i;
+    }
+    // The pipeline is not touched
+    ASSERT_EQ(offline_pipeline.num_frames(), 0);
+  }
+}
+
+TEST(FeaturePipelineTest, MultiChannelTest) {
+  // Each channel of the interleaved stereo makes the frames of its own
+  // mono waveform, of both the float and the 16 bit PCM
+  wenet::FeaturePipelineConfig config(80, 16000);
+  int num_samples = 16000 / 2;
+  std::vector<std::vector<int16_t>> channels(2,
+                                             std::vector<int16_t>(num_samples));
+  std::vector<int16_t> stereo(num_samples * 2);
+  for (int i = 0; i < num_samples; ++i) {
+    channels[0][i] = (i % 100) * 100;
+    channels[1][i] = (i % 37) * 200;
+    stereo[i * 2] = channels[0][i];
+    stereo[i * 2 + 1] = channels[1][i];
+  }
+  std::vector<float> float_stereo(stereo.begin(), stereo.end());
+  auto expect_near = [](const std::vector<std::vector<float>>& feats,
+                        const std::vector<std::vector<float>>& expected) {
+    ASSERT_EQ(feats.size(), expected.size());
+    for (size_t i = 0; i < feats.size(); ++i) {
+      ASSERT_THAT(feats[i], ::testing::Pointwise(::testing::FloatNear(1e-3),
+                                                 expected[i]))
+          << "frame " << i;
+    }
+  };
+  for (int c = 0; c < 2; ++c) {
+    SCOPED_TRACE("channel " + std::to_string(c));
+    wenet::FeaturePipeline expected_pipeline(config);
+    expected_pipeline.AcceptWaveform(channels[c].data(), num_samples);
+    expected_pipeline.set_input_finished();
+    std::vector<std::vector<float>> expected;
+    expected_pipeline.Read(expected_pipeline.num_frames(), &expected);
+    ASSERT_FALSE(expected.empty());
+
+    wenet::FeaturePipeline pipeline(config);
+    int half = num_samples / 2;
+    pipeline.AcceptWaveform(stereo.data(), half, 2, c);
+    pipeline.AcceptWaveform(stereo.data() + half * 2, num_samples - half, 2,
+                            c);
+    pipeline.set_input_finished();
+    std::vector<std::vector<float>> feats;
+    pipeline.Read(pipeline.num_frames(), &feats);
+    expect_near(feats, expected);
+
+    wenet::FeaturePipeline float_pipeline(config);
+    float_pipeline.AcceptWaveform(float_stereo.data(), num_samples, 2, c);
+    float_pipeline.set_input_finished();
+    float_pipeline.Read(float_pipeline.num_frames(), &feats);
+    expect_near(feats, expected);
+  }
+}
+
+TEST(FeaturePipelineTest, MinAcceptFramesTest) {
+  // 20ms packets of 16 bit PCM make the same frames held back by 5 frames
+  wenet::FeaturePipelineConfig config(80, 16000);
+  std::vector<int16_t> pcm(16000 / 2);
+  for (int i = 0; i < pcm.size(); ++i) pcm[i] = (i % 100) * 100;
+  const int packet = 320;
+  wenet::FeaturePipeline feature_pipeline(config);
+  config.min_accept_frames = 5;
+  wenet::FeaturePipeline buffered_pipeline(config);
+  for (int i = 0; i < pcm.size(); i += packet) {
+    int size = std::min(packet, static_cast<int>(pcm.size()) - i);
+    feature_pipeline.AcceptWaveform(pcm.data() + i, size);
+    buffered_pipeline.AcceptWaveform(pcm.data() + i, size);
+    int num_frames = buffered_pipeline.num_frames();
+    ASSERT_TRUE(num_frames == 0 || num_frames >= 5);
+    ASSERT_LE(num_frames, feature_pipeline.num_frames());
+    ASSERT_GT(num_frames + 5, feature_pipeline.num_frames());
+  }
+  feature_pipeline.set_input_finished();
+  buffered_pipeline.set_input_finished();
+  ASSERT_EQ(buffered_pipeline.num_frames(), feature_pipeline.num_frames());
+  std::vector<std::vector<float>> expected, feats;
+  feature_pipeline.Read(feature_pipeline.num_frames(), &expected);
+  buffered_pipeline.Read(buffered_pipeline.num_frames(), &feats);
+  ASSERT_EQ(feats, expected);
+}
+
+TEST(FeaturePipelineTest, SaveStateTest) {
+  // The frames of a pipeline continued from the state of another are the
+  // ones of a single pipeline, with the resampler and the vad
+  std::vector<float> pcm(8000);
+  unsigned int seed = 1;
+  for (int i = 0; i < pcm.size(); ++i) {
+    seed = seed * 1103515245 + 12345;
+    pcm[i] = static_cast<int>((seed >> 16) % 201) - 100 +
+             1000 * std::sin(2 * M_PI * 300 * i / 8000);
+  }
+  wenet::FeaturePipelineConfig config(80, 16000);
+  config.enable_vad = true;
+  wenet::FeaturePipeline expected_pipeline(config);
+  expected_pipeline.set_input_sample_rate(8000);
+  expected_pipeline.AcceptWaveform(pcm.data(), pcm.size());
+  expected_pipeline.set_input_finished();
+  std::vector<std::vector<float>> expected;
+  expected_pipeline.Read(1000, &expected);
+
+  const int half = 3001;
+  wenet::FeaturePipeline first(config);
+  first.set_input_sample_rate(8000);
+  first.AcceptWaveform(pcm.data(), half);
+  std::vector<std::vector<float>> feats;
+  ASSERT_TRUE(first.Read(10, &feats));
+  wenet::StateWriter writer;
+  ASSERT_TRUE(first.SaveState(&writer));
+  wenet::FeaturePipeline second(config);
+  second.set_input_sample_rate(8000);
+  wenet::StateReader reader(writer.str());
+  ASSERT_TRUE(second.LoadState(&reader));
+  EXPECT_TRUE(reader.done());
+  EXPECT_EQ(second.num_frames(), first.num_frames());
+  second.AcceptWaveform(pcm.data() + half, pcm.size() - half);
+  second.set_input_finished();
+  std::vector<std::vector<float>> rest;
+  second.Read(1000, &rest);
+  feats.insert(feats.end(), rest.begin(), rest.end());
+  ASSERT_EQ(feats.size(), expected.size());
+  for (int i = 0; i < feats.size(); ++i) {
+    for (int j = 0; j < feats[i].size(); ++j) {
+      ASSERT_NEAR(feats[i][j], expected[i][j], 1e-4) << i;
+    }
+  }
+  // The state of another input sample rate is not loaded
+  wenet::FeaturePipeline other(config);
+  wenet::StateReader other_reader(writer.str());
+  EXPECT_FALSE(other.LoadState(&other_reader));
+  // Nor the one of the vad by the pipeline without it
+  wenet::FeaturePipelineConfig no_vad_config(80, 16000);
+  wenet::FeaturePipeline no_vad(no_vad_config);
+  no_vad.set_input_sample_rate(8000);
+  wenet::StateReader no_vad_reader(writer.str());
+  EXPECT_FALSE(no_vad.LoadState(&no_vad_reader));
+}
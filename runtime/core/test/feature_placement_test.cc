@@ -0,0 +1,62 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/feature_placement.h"
+
+#include "gtest/gtest.h"
+
+TEST(FeaturePlacementTest, ParseTest) {
+  wenet::FeaturePlacement placement;
+  EXPECT_TRUE(wenet::ParseFeaturePlacement("gpu", &placement));
+  EXPECT_EQ(placement, wenet::FeaturePlacement::kGpu);
+  EXPECT_TRUE(wenet::ParseFeaturePlacement("cpu", &placement));
+  EXPECT_EQ(placement, wenet::FeaturePlacement::kCpu);
+  EXPECT_TRUE(wenet::ParseFeaturePlacement("auto", &placement));
+  EXPECT_EQ(placement, wenet::FeaturePlacement::kAuto);
+  EXPECT_FALSE(wenet::ParseFeaturePlacement("tpu", &placement));
+}
+
+TEST(FeaturePlacementTest, FixedTest) {
+  wenet::FeaturePlacementOptions opts;
+  opts.placement = wenet::FeaturePlacement::kGpu;
+  wenet::FeaturePlacer gpu(opts, true);
+  EXPECT_TRUE(gpu.Place(1));
+  EXPECT_TRUE(gpu.Place(1));
+  EXPECT_TRUE(gpu.Place(1));
+  EXPECT_EQ(gpu.gpu_inflight(), 3);
+  // No GPU fbank, everything is on CPU
+  wenet::FeaturePlacer no_gpu(opts, false);
+  EXPECT_FALSE(no_gpu.Place(64));
+  opts.placement = wenet::FeaturePlacement::kCpu;
+  wenet::FeaturePlacer cpu(opts, true);
+  EXPECT_FALSE(cpu.Place(64));
+}
+
+TEST(FeaturePlacementTest, AutoTest) {
+  wenet::FeaturePlacementOptions opts;
+  opts.placement = wenet::FeaturePlacement::kAuto;
+  opts.min_gpu_batch_size = 4;
+  opts.max_gpu_inflight = 2;
+  wenet::FeaturePlacer placer(opts, true);
+  // Small batches on CPU
+  EXPECT_FALSE(placer.Place(3));
+  EXPECT_TRUE(placer.Place(4));
+  EXPECT_TRUE(placer.Place(8));
+  // The device is busy
+  EXPECT_FALSE(placer.Place(8));
+  placer.Release();
+  EXPECT_TRUE(placer.Place(8));
+  EXPECT_EQ(placer.gpu_inflight(), 2);
+}
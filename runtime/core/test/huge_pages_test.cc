@@ -0,0 +1,68 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/huge_pages.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+TEST(HugePagesTest, ParseTest) {
+  HugePageSize size;
+  ASSERT_TRUE(ParseHugePageSize("", &size));
+  EXPECT_EQ(size, HugePageSize::kNone);
+  ASSERT_TRUE(ParseHugePageSize("2m", &size));
+  EXPECT_EQ(size, HugePageSize::k2M);
+  ASSERT_TRUE(ParseHugePageSize("1g", &size));
+  EXPECT_EQ(size, HugePageSize::k1G);
+  EXPECT_FALSE(ParseHugePageSize("4k", &size));
+}
+
+TEST(HugePagesTest, AllocateTest) {
+  // Falls back to the regular pages whatever the machine has
+  for (HugePageSize page_size :
+       {HugePageSize::kNone, HugePageSize::k2M, HugePageSize::k1G}) {
+    HugePageAllocator allocator;
+    allocator.set_page_size(page_size);
+    for (size_t size : {0, 1, 100, 3 << 20, 5 << 20}) {
+      char* data = static_cast<char*>(allocator.Allocate(size));
+      ASSERT_NE(data, nullptr) << size;
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(data) %
+                    HugePageAllocator::kAlignment,
+                0);
+      memset(data, 0x5a, size);
+      if (size > 0) {
+        EXPECT_EQ(data[size - 1], 0x5a);
+      }
+      HugePageAllocator::Free(data);
+    }
+  }
+  HugePageAllocator::Free(nullptr);
+}
+
+TEST(HugePagesTest, AdviseTest) {
+  // Less than an aligned huge page has nothing to advise
+  std::vector<char> small(4096);
+  EXPECT_FALSE(AdviseHugePages(small.data(), small.size()));
+  std::vector<char> large(8 << 20, 1);
+  AdviseHugePages(large.data(), large.size());
+  EXPECT_EQ(large[large.size() / 2], 1);
+}
+
+}  // namespace wenet
@@ -0,0 +1,60 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/language_model.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(NgramLanguageModelTest, LogProbTest) {
+  // 1 2 3 twice and 1 3 once, of 3 + 1 tokens of the vocab
+  wenet::NgramLanguageModel lm(2, 4, {{1, 2, 3}, {1, 2, 3}, {1, 3}});
+  int start = lm.Start();
+  // All the sentences start with 1
+  EXPECT_FLOAT_EQ(lm.LogProb(start, 1), 0.0);
+  int state = lm.NextState(start, 1);
+  EXPECT_FLOAT_EQ(lm.LogProb(state, 2), std::log(2.0f / 3));
+  EXPECT_FLOAT_EQ(lm.LogProb(state, 3), std::log(1.0f / 3));
+  // 1 is never after 1, backoff to the unigram of the 3 sentence starts and
+  // the 8 tokens, plus one
+  EXPECT_FLOAT_EQ(lm.LogProb(state, 1),
+                  std::log(0.4f) + std::log((3.0f + 1) / (11 + 4)));
+  // The unseen token 0
+  EXPECT_FLOAT_EQ(lm.LogProb(state, 0),
+                  std::log(0.4f) + std::log(1.0f / (11 + 4)));
+
+  // The batch is the same as one by one
+  std::vector<float> log_probs;
+  std::vector<int> next_states;
+  lm.Score({start, state}, {1, 2}, &log_probs, &next_states);
+  ASSERT_EQ(log_probs.size(), 2);
+  EXPECT_FLOAT_EQ(log_probs[0], lm.LogProb(start, 1));
+  EXPECT_FLOAT_EQ(log_probs[1], lm.LogProb(state, 2));
+  EXPECT_EQ(next_states[0], state);
+  EXPECT_EQ(next_states[1], lm.NextState(state, 2));
+}
+
+TEST(NgramLanguageModelTest, HistoryTest) {
+  wenet::NgramLanguageModel lm(3, 4, {{1, 2, 3}});
+  // The history is the last 2 tokens, 1 2 -> 3
+  int state = lm.NextState(lm.NextState(lm.Start(), 1), 2);
+  EXPECT_FLOAT_EQ(lm.LogProb(state, 3), 0.0);
+  // 2 3 is seen, while 3 2 is backed off to 2
+  int seen = lm.NextState(state, 3);
+  int unseen = lm.NextState(lm.NextState(seen, 2), 2);
+  EXPECT_NE(seen, unseen);
+  EXPECT_FLOAT_EQ(lm.LogProb(unseen, 3), std::log(0.4f));
+}
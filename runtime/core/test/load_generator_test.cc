@@ -0,0 +1,80 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/load_generator.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+// Answers in place, as if the server were infinitely fast
+class FakeStream : public wenet::LoadStream {
+ public:
+  enum Behavior { kOk = 0, kRefuse, kHang };
+  FakeStream(wenet::LoadStreamListener* listener, Behavior behavior,
+             std::atomic<int>* num_samples)
+      : listener_(listener), behavior_(behavior), num_samples_(num_samples) {}
+
+  void Start() override {
+    if (behavior_ == kRefuse) {
+      listener_->OnDone(false, "refused");
+    } else {
+      listener_->OnReady();
+    }
+  }
+  void SendAudio(const int16_t* data, size_t size) override {
+    *num_samples_ += size;
+    listener_->OnPartial();
+  }
+  void SendEnd() override {
+    if (behavior_ == kHang) return;
+    listener_->OnFinal();
+    listener_->OnDone(true, "");
+  }
+  void Cancel() override { EXPECT_EQ(behavior_, kHang); }
+
+ private:
+  wenet::LoadStreamListener* listener_;
+  Behavior behavior_;
+  std::atomic<int>* num_samples_;
+};
+
+TEST(LoadGeneratorTest, RunTest) {
+  // 0.25s of audio, sent in 3 chunks
+  auto wave = std::make_shared<std::vector<int16_t>>(4000);
+  wenet::LoadOptions opts;
+  opts.num_streams = 20;
+  opts.max_concurrency = 4;
+  opts.arrival_rate = 0;
+  opts.pace = 0;
+  opts.timeout_ms = 50;
+  wenet::LoadGenerator generator(opts, {wave});
+  std::atomic<int> num_streams(0), num_samples(0);
+  generator.Run([&](wenet::LoadStreamListener* listener) {
+    int i = num_streams++;
+    FakeStream::Behavior behavior = FakeStream::kOk;
+    if (i % 10 == 3) behavior = FakeStream::kRefuse;
+    if (i == 7) behavior = FakeStream::kHang;
+    return std::make_shared<FakeStream>(listener, behavior, &num_samples);
+  });
+  EXPECT_EQ(num_streams, 20);
+  // All but the 2 refused streams are sent
+  EXPECT_EQ(num_samples, 18 * 4000);
+  EXPECT_EQ(generator.num_done(), 20);
+  // The refused ones and the one timed out
+  EXPECT_EQ(generator.num_failed(), 3);
+  generator.Report();
+}
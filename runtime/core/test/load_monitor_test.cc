@@ -0,0 +1,138 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <limits>
+
+#include "decoder/adaptive_beam.h"
+#include "decoder/adaptive_chunk.h"
+#include "utils/load_monitor.h"
+
+#include "gtest/gtest.h"
+
+TEST(LoadMonitorTest, QueueDepthTest) {
+  wenet::LoadMonitor& monitor = wenet::LoadMonitor::Instance();
+  // Sampled by Update() only
+  monitor.set_interval_ms(1000000);
+  std::atomic<size_t> depth0{0}, depth1{0};
+  monitor.AddQueue([&depth0]() -> size_t { return depth0; }, 2);
+  monitor.AddQueue([&depth1]() -> size_t { return depth1; }, 2);
+  monitor.Update();
+  EXPECT_FLOAT_EQ(monitor.queue_depth(), 0);
+  depth0 = 6;
+  depth1 = 2;
+  EXPECT_FLOAT_EQ(monitor.queue_depth(), 0);
+  monitor.Update();
+  EXPECT_FLOAT_EQ(monitor.queue_depth(), 2);
+  EXPECT_GE(monitor.cpu_usage(), 0);
+  EXPECT_LE(monitor.cpu_usage(), 1);
+  depth0 = 0;
+  depth1 = 0;
+  monitor.Update();
+}
+
+TEST(LoadMonitorTest, LatencyWindowTest) {
+  wenet::LatencyWindow window(10);
+  EXPECT_FLOAT_EQ(window.Quantile(0.99, 100), 0);
+  // 98 chunks of 1ms and 2 of 100ms
+  for (int i = 0; i < 98; ++i) window.Record(1000, 100);
+  window.Record(100000, 101);
+  window.Record(100000, 101);
+  // Within the 9% of a bucket
+  EXPECT_NEAR(window.Quantile(0.5, 101), 1, 0.09);
+  EXPECT_NEAR(window.Quantile(0.95, 101), 1, 0.09);
+  EXPECT_NEAR(window.Quantile(0.99, 101), 100, 9);
+  EXPECT_NEAR(window.Quantile(1, 101), 100, 9);
+  // The second 100 is out of the window, then its slot is reused
+  EXPECT_NEAR(window.Quantile(0.5, 110), 100, 9);
+  window.Record(10000, 111);
+  EXPECT_NEAR(window.Quantile(0.5, 111), 10, 0.9);
+  EXPECT_FLOAT_EQ(window.Quantile(0.5, 200), 0);
+}
+
+TEST(LoadMonitorTest, ReportTest) {
+  wenet::LoadMonitor& monitor = wenet::LoadMonitor::Instance();
+  int num_sessions = monitor.num_sessions();
+  monitor.AddSessions(2);
+  monitor.RecordChunkLatency(50000);
+  wenet::LoadReport report = monitor.Report();
+  EXPECT_EQ(report.sessions, num_sessions + 2);
+  EXPECT_GT(report.chunk_latency_p99_ms, 0);
+  EXPECT_LE(report.cpu_usage, 1);
+  EXPECT_LE(report.gpu_usage, 1);
+  monitor.AddSessions(-2);
+  report.sessions = 3;
+  report.queue_depth = 0.5;
+  report.chunk_latency_p99_ms = 20;
+  report.cpu_usage = 0.25;
+  report.gpu_usage = -1;
+  EXPECT_EQ(wenet::LoadReportToJson(report),
+            "{\"sessions\":3,\"queue_depth\":0.5,"
+            "\"chunk_latency_p99_ms\":20,\"cpu_usage\":0.25,"
+            "\"gpu_usage\":-1}");
+}
+
+TEST(LoadMonitorTest, AdaptChunkSizeTest) {
+  wenet::AdaptiveChunkOptions opts;
+  // Disabled
+  EXPECT_EQ(wenet::AdaptChunkSize(16, 16, opts, 1.0, 10), 16);
+  opts.max_chunk_size = 64;
+  // Overloaded by the cpu or the queue
+  EXPECT_EQ(wenet::AdaptChunkSize(16, 16, opts, 0.95, 0), 32);
+  EXPECT_EQ(wenet::AdaptChunkSize(32, 16, opts, 0.5, 3), 64);
+  EXPECT_EQ(wenet::AdaptChunkSize(64, 16, opts, 0.95, 3), 64);
+  // Kept in between
+  EXPECT_EQ(wenet::AdaptChunkSize(64, 16, opts, 0.8, 0), 64);
+  EXPECT_EQ(wenet::AdaptChunkSize(64, 16, opts, 0.5, 1), 64);
+  // Shrink back
+  EXPECT_EQ(wenet::AdaptChunkSize(64, 16, opts, 0.5, 0), 32);
+  EXPECT_EQ(wenet::AdaptChunkSize(16, 16, opts, 0.1, 0), 16);
+  // Non streaming
+  EXPECT_EQ(wenet::AdaptChunkSize(-1, -1, opts, 1.0, 10), -1);
+}
+
+TEST(LoadMonitorTest, CatchupChunksTest) {
+  wenet::AdaptiveChunkOptions opts;
+  // Disabled
+  EXPECT_EQ(wenet::CatchupChunks(640, 64, opts), 1);
+  opts.max_catchup_chunks = 4;
+  // Not behind
+  EXPECT_EQ(wenet::CatchupChunks(0, 64, opts), 1);
+  EXPECT_EQ(wenet::CatchupChunks(127, 64, opts), 1);
+  // The queued chunks, up to max_catchup_chunks
+  EXPECT_EQ(wenet::CatchupChunks(200, 64, opts), 3);
+  EXPECT_EQ(wenet::CatchupChunks(640, 64, opts), 4);
+  // Non streaming
+  EXPECT_EQ(wenet::CatchupChunks(640, -1, opts), 1);
+}
+
+TEST(LoadMonitorTest, AdaptBeamScaleTest) {
+  wenet::AdaptiveBeamOptions opts;
+  // Disabled
+  EXPECT_FLOAT_EQ(wenet::AdaptBeamScale(1.0, opts, 10), 1.0);
+  opts.max_search_rtf = 0.1;
+  // Narrowed down to min_beam_scale over the budget
+  EXPECT_FLOAT_EQ(wenet::AdaptBeamScale(1.0, opts, 0.2), 0.8);
+  EXPECT_FLOAT_EQ(wenet::AdaptBeamScale(0.6, opts, 0.2), 0.5);
+  // Kept in between
+  EXPECT_FLOAT_EQ(wenet::AdaptBeamScale(0.64, opts, 0.08), 0.64);
+  // Widened back up to 1
+  EXPECT_FLOAT_EQ(wenet::AdaptBeamScale(0.64, opts, 0.01), 0.8);
+  EXPECT_FLOAT_EQ(wenet::AdaptBeamScale(0.9, opts, 0.01), 1.0);
+  // The beam sizes
+  EXPECT_EQ(wenet::ScaleBeamSize(10, 0.5), 5);
+  EXPECT_EQ(wenet::ScaleBeamSize(1, 0.5), 1);
+  EXPECT_EQ(wenet::ScaleBeamSize(std::numeric_limits<int>::max(), 0.5),
+            std::numeric_limits<int>::max());
+}
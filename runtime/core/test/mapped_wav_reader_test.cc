@@ -0,0 +1,93 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/mapped_wav_reader.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "frontend/wav.h"
+
+namespace wenet {
+
+class MappedWavReaderTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "mapped_wav_reader_test.wav";
+    for (int i = 0; i < 1000; ++i) {
+      wave_.push_back((i * 37 % 2000) - 1000);
+    }
+  }
+  void TearDown() override { remove(path_.c_str()); }
+
+  // Write the header of WavHeader with a "LIST" chunk before "data"
+  void WriteFile(int bits, uint32_t data_size, int num_samples) {
+    WavHeader header(wave_.size(), 1, 8000, bits);
+    FILE* fp = fopen(path_.c_str(), "wb");
+    fwrite(&header, 1, 36, fp);
+    const char list[] = {'L', 'I', 'S', 'T', 3, 0, 0, 0, 'a', 'b', 'c', 0};
+    fwrite(list, 1, sizeof(list), fp);
+    fwrite("data", 1, 4, fp);
+    fwrite(&data_size, 1, 4, fp);
+    std::vector<int16_t> samples(wave_.begin(), wave_.begin() + num_samples);
+    fwrite(samples.data(), sizeof(int16_t), samples.size(), fp);
+    fclose(fp);
+  }
+
+  std::string path_;
+  std::vector<float> wave_;
+};
+
+TEST_F(MappedWavReaderTest, ReadTest) {
+  WavWriter writer(wave_.data(), wave_.size(), 1, 16000, 16);
+  writer.Write(path_);
+  MappedWavReader mapped(path_);
+  WavReader reader(path_);
+  ASSERT_EQ(mapped.num_samples(), reader.num_samples());
+  EXPECT_EQ(mapped.sample_rate(), 16000);
+  EXPECT_EQ(mapped.num_channel(), 1);
+  for (int i = 0; i < mapped.num_samples(); ++i) {
+    ASSERT_EQ(mapped.data()[i], reader.data()[i]);
+  }
+}
+
+TEST_F(MappedWavReaderTest, ChunkTest) {
+  WriteFile(16, wave_.size() * 2, wave_.size());
+  MappedWavReader mapped;
+  ASSERT_TRUE(mapped.Open(path_));
+  EXPECT_EQ(mapped.sample_rate(), 8000);
+  ASSERT_EQ(mapped.num_samples(), wave_.size());
+  EXPECT_EQ(mapped.data()[999], wave_[999]);
+}
+
+TEST_F(MappedWavReaderTest, TruncatedTest) {
+  // The data size is larger than the file, or unknown of a streamed wav
+  WriteFile(16, 0xFFFFFFFF, 100);
+  MappedWavReader mapped;
+  ASSERT_TRUE(mapped.Open(path_));
+  EXPECT_EQ(mapped.num_samples(), 100);
+}
+
+TEST_F(MappedWavReaderTest, InvalidTest) {
+  MappedWavReader mapped;
+  EXPECT_FALSE(mapped.Open(path_));
+  WriteFile(8, wave_.size(), 0);
+  EXPECT_FALSE(mapped.Open(path_));
+  EXPECT_EQ(mapped.data(), nullptr);
+}
+
+}  // namespace wenet
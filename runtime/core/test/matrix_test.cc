@@ -0,0 +1,63 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/matrix.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "utils/utils.h"
+
+TEST(MatrixTest, CopyAndViewTest) {
+  std::vector<std::vector<float>> rows = {{1, 2, 3}, {4, 5, 6}};
+  wenet::Matrix<float> matrix;
+  matrix.CopyFrom(rows);
+  EXPECT_EQ(matrix.rows(), 2);
+  EXPECT_EQ(matrix.cols(), 3);
+  EXPECT_FLOAT_EQ(matrix(1, 2), 6);
+
+  wenet::MatrixView<float> view = matrix.view();
+  EXPECT_EQ(view.row(1), matrix.data() + 3);
+  wenet::MatrixView<float> last = view.RowRange(1, 2);
+  EXPECT_EQ(last.rows(), 1);
+  EXPECT_FLOAT_EQ(last(0, 0), 4);
+
+  std::vector<std::vector<float>> copied;
+  matrix.CopyTo(&copied);
+  EXPECT_EQ(copied, rows);
+}
+
+TEST(MatrixTest, ResizeKeepsCapacityTest) {
+  wenet::Matrix<float> matrix(4, 8);
+  const float* data = matrix.data();
+  matrix.Clear();
+  EXPECT_TRUE(matrix.empty());
+  matrix.Resize(2, 8);
+  EXPECT_EQ(matrix.data(), data);
+}
+
+TEST(MatrixTest, StridedViewTest) {
+  // The first 2 of the 3 columns
+  std::vector<float> data = {1, 2, 0, 3, 4, 0};
+  wenet::MatrixView<float> view(data.data(), 2, 2, 3);
+  EXPECT_FLOAT_EQ(view(1, 0), 3);
+  std::vector<float> values;
+  std::vector<int> indices;
+  wenet::TopK(view.row(1), view.cols(), 1, &values, &indices);
+  EXPECT_THAT(indices, ::testing::ElementsAre(1));
+  EXPECT_THAT(values, ::testing::ElementsAre(4));
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/memory_budget.h"
+
+#include "gtest/gtest.h"
+
+TEST(MemoryBudgetTest, ParseProcessMemoryTest) {
+  std::string status =
+      "Name:\tdecoder_main\n"
+      "VmPeak:\t  900000 kB\n"
+      "VmHWM:\t  204800 kB\n"
+      "VmRSS:\t  102400 kB\n";
+  int64_t rss = 0, peak_rss = 0;
+  EXPECT_TRUE(wenet::ParseProcessMemory(status, &rss, &peak_rss));
+  EXPECT_EQ(rss, 100 << 20);
+  EXPECT_EQ(peak_rss, 200 << 20);
+  EXPECT_FALSE(wenet::ParseProcessMemory("Name:\tx\n", &rss, &peak_rss));
+}
+
+TEST(MemoryBudgetTest, BreakdownTest) {
+  wenet::MemoryBudget budget(100 << 20);
+  budget.Add("model weights", 60 << 20);
+  budget.Add("sessions", 10 << 20);
+  budget.Add("sessions", 10 << 20);
+  EXPECT_EQ(budget.total_bytes(), 80 << 20);
+  EXPECT_FALSE(budget.over_budget());
+  std::string report = budget.Report();
+  EXPECT_NE(report.find("model weights: 60.0MB"), std::string::npos);
+  EXPECT_NE(report.find("sessions: 20.0MB"), std::string::npos);
+  EXPECT_NE(report.find("total: 80.0MB of budget 100.0MB"), std::string::npos);
+  budget.Add("graph", 30 << 20);
+  EXPECT_TRUE(budget.over_budget());
+  // No budget
+  wenet::MemoryBudget unlimited;
+  unlimited.Add("model weights", 1 << 30);
+  EXPECT_FALSE(unlimited.over_budget());
+}
+
+TEST(MemoryBudgetTest, SessionMemoryTrackerTest) {
+  int64_t base = wenet::SessionMemoryTracker::TotalBytes();
+  wenet::SessionMemory usage;
+  usage.feature = 100;
+  usage.cache = 1000;
+  {
+    wenet::SessionMemoryTracker first, second;
+    first.Update(usage);
+    second.Update(usage);
+    EXPECT_EQ(wenet::SessionMemoryTracker::TotalBytes(), base + 2200);
+    // The change since the last update is added
+    usage.cache = 500;
+    first.Update(usage);
+    EXPECT_EQ(first.usage().total(), 600);
+    EXPECT_EQ(wenet::SessionMemoryTracker::TotalBytes(), base + 1700);
+  }
+  // Removed with the sessions
+  EXPECT_EQ(wenet::SessionMemoryTracker::TotalBytes(), base);
+}
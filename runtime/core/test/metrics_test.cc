@@ -0,0 +1,106 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/metrics.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+TEST(MetricsTest, HistogramBuckets) {
+  wenet::Histogram histogram({0.1, 1, 10});
+  for (double value : {0.05, 0.1, 0.5, 5.0, 50.0}) {
+    histogram.Observe(value);
+  }
+  // The upper bounds are inclusive
+  EXPECT_EQ(histogram.bucket_count(0), 2);
+  EXPECT_EQ(histogram.bucket_count(1), 1);
+  EXPECT_EQ(histogram.bucket_count(2), 1);
+  EXPECT_EQ(histogram.bucket_count(3), 1);
+  EXPECT_EQ(histogram.count(), 5);
+  EXPECT_NEAR(histogram.sum(), 55.65, 1e-6);
+}
+
+TEST(MetricsTest, ConcurrentUpdates) {
+  wenet::Metrics& metrics = wenet::Metrics::Instance();
+  wenet::Counter* counter = metrics.GetCounter("test_updates_total", "");
+  wenet::Histogram* histogram = metrics.GetHistogram("test_update_seconds", "");
+  const int kNumThreads = 4;
+  const int kNumUpdates = 10000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([=]() {
+      for (int j = 0; j < kNumUpdates; ++j) {
+        counter->Increment();
+        histogram->Observe(0.5);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  EXPECT_EQ(counter->value(), kNumThreads * kNumUpdates);
+  EXPECT_EQ(histogram->count(), kNumThreads * kNumUpdates);
+  EXPECT_NEAR(histogram->sum(), 0.5 * kNumThreads * kNumUpdates, 1e-6);
+  // The same name gets the same metric
+  EXPECT_EQ(metrics.GetCounter("test_updates_total", ""), counter);
+}
+
+TEST(MetricsTest, Serialize) {
+  using ::testing::HasSubstr;
+  wenet::Metrics& metrics = wenet::Metrics::Instance();
+  metrics.GetGauge("test_sessions", "Test sessions")->Set(3);
+  wenet::Histogram* histogram =
+      metrics.GetHistogram("test_latency_seconds", "Test latency", {1, 2});
+  histogram->Observe(0.5);
+  histogram->Observe(1.5);
+  histogram->Observe(3);
+  std::string text = metrics.Serialize();
+  EXPECT_THAT(text, HasSubstr("# HELP test_sessions Test sessions\n"
+                              "# TYPE test_sessions gauge\n"
+                              "test_sessions 3\n"));
+  // The buckets are cumulative
+  EXPECT_THAT(text, HasSubstr("# TYPE test_latency_seconds histogram\n"
+                              "test_latency_seconds_bucket{le=\"1\"} 1\n"
+                              "test_latency_seconds_bucket{le=\"2\"} 2\n"
+                              "test_latency_seconds_bucket{le=\"+Inf\"} 3\n"
+                              "test_latency_seconds_sum 5\n"
+                              "test_latency_seconds_count 3\n"));
+}
+
+TEST(MetricsTest, LabeledSerialize) {
+  using ::testing::HasSubstr;
+  wenet::Metrics& metrics = wenet::Metrics::Instance();
+  using wenet::Metrics;
+  EXPECT_EQ(Metrics::Labeled("test_tenant_sessions", "tenant", "a\"b"),
+            "test_tenant_sessions{tenant=\"a\\\"b\"}");
+  metrics.GetGauge(Metrics::Labeled("test_tenant_sessions", "tenant", "b"),
+                   "Test sessions of a tenant")
+      ->Set(2);
+  metrics.GetGauge("test_tenant_sessions_max", "Test max")->Set(1);
+  metrics.GetGauge(Metrics::Labeled("test_tenant_sessions", "tenant", "a"),
+                   "")
+      ->Set(1);
+  // One help and type of all the labels, the help is of any of them
+  std::string text = metrics.Serialize();
+  EXPECT_THAT(text,
+              HasSubstr("# HELP test_tenant_sessions Test sessions of a "
+                        "tenant\n"
+                        "# TYPE test_tenant_sessions gauge\n"
+                        "test_tenant_sessions{tenant=\"a\"} 1\n"
+                        "test_tenant_sessions{tenant=\"b\"} 2\n"));
+  EXPECT_THAT(text, HasSubstr("# TYPE test_tenant_sessions_max gauge\n"
+                              "test_tenant_sessions_max 1\n"));
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/model_bundle.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+class ModelBundleTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "model_bundle_test.bundle";
+  }
+  void TearDown() override { remove(path_.c_str()); }
+
+  std::string path_;
+};
+
+TEST_F(ModelBundleTest, WriteOpenTest) {
+  std::vector<std::pair<std::string, std::string>> sections = {
+      {"final.zip", std::string(5000, 'm')},
+      {"context", "hello world\nwenet\n"},
+      {"empty", ""}};
+  ASSERT_TRUE(ModelBundle::Write(path_, sections));
+  ASSERT_TRUE(ModelBundle::IsBundle(path_));
+  std::shared_ptr<ModelBundle> bundle = ModelBundle::Open(path_);
+  ASSERT_NE(bundle, nullptr);
+  EXPECT_EQ(bundle->path(), path_);
+  for (const auto& section : sections) {
+    const ModelBundle::Section* found = bundle->Find(section.first);
+    ASSERT_NE(found, nullptr) << section.first;
+    EXPECT_EQ(found->offset % ModelBundle::kAlignment, 0);
+    EXPECT_EQ(std::string(found->data, found->size), section.second);
+  }
+  EXPECT_EQ(bundle->Find("units"), nullptr);
+  EXPECT_THAT(bundle->ReadLines("context"),
+              testing::ElementsAre("hello world", "wenet"));
+  EXPECT_TRUE(bundle->ReadLines("units").empty());
+}
+
+TEST_F(ModelBundleTest, NotBundleTest) {
+  FILE* fp = fopen(path_.c_str(), "wb");
+  fputs("PK not a bundle", fp);
+  fclose(fp);
+  EXPECT_FALSE(ModelBundle::IsBundle(path_));
+  EXPECT_EQ(ModelBundle::Open(path_), nullptr);
+  EXPECT_FALSE(ModelBundle::IsBundle(path_ + ".none"));
+}
+
+TEST_F(ModelBundleTest, SymbolTableTest) {
+  fst::SymbolTable units;
+  units.AddSymbol("<blank>", 0);
+  units.AddSymbol("a", 1);
+  units.AddSymbol("b", 2);
+  ASSERT_TRUE(ModelBundle::Write(
+      path_, {{"units", ModelBundle::SymbolTableContent(units)}}));
+  std::shared_ptr<ModelBundle> bundle = ModelBundle::Open(path_);
+  ASSERT_NE(bundle, nullptr);
+  std::shared_ptr<fst::SymbolTable> read = bundle->ReadSymbolTable("units");
+  ASSERT_NE(read, nullptr);
+  EXPECT_EQ(read->Find("b"), 2);
+  EXPECT_EQ(read->Find(1), "a");
+  EXPECT_EQ(bundle->ReadSymbolTable("words"), nullptr);
+}
+
+TEST(MemoryStreamTest, SeekTest) {
+  std::string data = "0123456789";
+  MemoryStream is(data.data(), data.size());
+  is.seekg(4);
+  EXPECT_EQ(is.get(), '4');
+  is.seekg(-2, std::ios::end);
+  EXPECT_EQ(is.tellg(), 8);
+  EXPECT_EQ(is.get(), '8');
+  is.seekg(-3, std::ios::cur);
+  EXPECT_EQ(is.get(), '6');
+}
+
+}  // namespace wenet
@@ -0,0 +1,41 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <memory>
+#include <vector>
+
+#include "decoder/model_replicas.h"
+
+#include "gtest/gtest.h"
+
+TEST(ModelReplicasTest, PlacementTest) {
+  // The models are not used by the placement
+  wenet::ModelReplicas replicas(
+      std::vector<std::shared_ptr<wenet::AsrModel>>(3));
+  EXPECT_EQ(replicas.size(), 3);
+  // Round robin when the loads are the same
+  EXPECT_EQ(replicas.Acquire(), 0);
+  EXPECT_EQ(replicas.Acquire(), 1);
+  EXPECT_EQ(replicas.Acquire(), 2);
+  EXPECT_EQ(replicas.Acquire(), 0);
+  EXPECT_EQ(replicas.load(0), 2);
+  // The least loaded one
+  replicas.Release(2);
+  replicas.Release(1);
+  EXPECT_EQ(replicas.load(1), 0);
+  EXPECT_EQ(replicas.Acquire(), 1);
+  EXPECT_EQ(replicas.Acquire(), 2);
+  EXPECT_EQ(replicas.Acquire(), 1);
+}
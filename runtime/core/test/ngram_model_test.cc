@@ -0,0 +1,117 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/ngram_model.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+static const float kLn10 = std::log(10.0f);
+
+class NgramModelTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    arpa_path_ = testing::TempDir() + "ngram_model_test.arpa";
+    path_ = testing::TempDir() + "ngram_model_test.bin";
+    std::ofstream arpa(arpa_path_);
+    arpa << "\\data\\\n"
+         << "ngram 1=5\nngram 2=3\nngram 3=1\n\n"
+         << "\\1-grams:\n"
+         << "-1.0\t<s>\t-0.5\n"
+         << "-0.5\ta\t-0.3\n"
+         << "-0.7\tb\t-0.2\n"
+         << "-1.2\t</s>\n"
+         << "-2.0\t<unk>\n\n"
+         << "\\2-grams:\n"
+         << "-0.2\t<s> a\t-0.1\n"
+         << "-0.4\ta b\t-0.15\n"
+         << "-0.3\tb </s>\n\n"
+         << "\\3-grams:\n"
+         << "-0.1\t<s> a b\n\n"
+         << "\\end\\\n";
+  }
+  void TearDown() override {
+    remove(arpa_path_.c_str());
+    remove(path_.c_str());
+  }
+
+  std::string arpa_path_;
+  std::string path_;
+};
+
+TEST_F(NgramModelTest, LogProbTest) {
+  ASSERT_TRUE(wenet::NgramModel::Build(arpa_path_, path_));
+  wenet::NgramModel model;
+  ASSERT_TRUE(model.Open(path_));
+  EXPECT_EQ(model.order(), 3);
+  EXPECT_EQ(model.num_words(), 5);
+  int bos = model.bos(), a = model.WordId("a"), b = model.WordId("b");
+  EXPECT_EQ(model.WordId("<unk>"), wenet::NgramModel::kUnk);
+  EXPECT_EQ(model.WordId("c"), wenet::NgramModel::kUnk);
+  EXPECT_NEAR(model.LogProb({bos}, a), -0.2 * kLn10, 1e-5);
+  // Only the last 2 words are used
+  EXPECT_NEAR(model.LogProb({b, bos, a}, b), -0.1 * kLn10, 1e-5);
+  EXPECT_NEAR(model.LogProb({b}, model.eos()), -0.3 * kLn10, 1e-5);
+  // Backoff of a b, then b, to the unigram
+  EXPECT_NEAR(model.LogProb({a, b}, b), (-0.15 - 0.2 - 0.7) * kLn10, 1e-5);
+  EXPECT_NEAR(model.LogProb({a}, wenet::NgramModel::kUnk),
+              (-0.3 - 2.0) * kLn10, 1e-5);
+  EXPECT_NEAR(model.LogProb({}, a), -0.5 * kLn10, 1e-5);
+}
+
+TEST_F(NgramModelTest, OpenTest) {
+  wenet::NgramModel model;
+  EXPECT_FALSE(model.Open(path_));
+  // Not a model
+  EXPECT_FALSE(model.Open(arpa_path_));
+  EXPECT_FALSE(wenet::NgramModel::Build(path_, path_));
+}
+
+TEST_F(NgramModelTest, WordLanguageModelTest) {
+  ASSERT_TRUE(wenet::NgramModel::Build(arpa_path_, path_));
+  auto model = std::make_shared<wenet::NgramModel>();
+  ASSERT_TRUE(model->Open(path_));
+  // a is unit 1, and b is units 2 3
+  auto lexicon = std::make_shared<wenet::Lexicon>();
+  lexicon->Add({1}, model->WordId("a"));
+  lexicon->Add({2, 3}, model->WordId("b"));
+  lexicon->Smear(*model);
+  wenet::WordNgramLanguageModel lm(model, lexicon);
+  std::vector<float> log_probs;
+  std::vector<int> states;
+  lm.Score({lm.Start()}, {1}, &log_probs, &states);
+  EXPECT_NEAR(log_probs[0], -0.2 * kLn10, 1e-5);
+  // b is pending, and scored by its unigram
+  int a = states[0];
+  lm.Score({a}, {2}, &log_probs, &states);
+  EXPECT_NEAR(log_probs[0], -0.7 * kLn10, 1e-5);
+  int pending = states[0];
+  lm.Score({pending, pending}, {3, 1}, &log_probs, &states);
+  // Committed, which is a b of <s> a b in total
+  EXPECT_NEAR(log_probs[0], (-0.1 + 0.7) * kLn10, 1e-5);
+  // The units 2 1 are <unk> then a, both backed off to the unigram
+  EXPECT_NEAR(log_probs[1], (0.7 + (-0.1 - 0.3 - 2.0) - 0.5) * kLn10, 1e-5);
+
+  // The copy has its own states
+  auto copy = lm.Copy();
+  copy->Score({copy->Start()}, {1}, &log_probs, &states);
+  EXPECT_NEAR(log_probs[0], -0.2 * kLn10, 1e-5);
+  EXPECT_EQ(states[0], 1);
+}
@@ -0,0 +1,122 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "util/open-hash-list.h"
+
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "util/hash-list.h"
+
+namespace {
+
+template <class List>
+std::vector<std::pair<int, int>> ToVector(const typename List::Elem* e) {
+  std::vector<std::pair<int, int>> elems;
+  for (; e != nullptr; e = e->tail) elems.emplace_back(e->key, e->val);
+  return elems;
+}
+
+template <class List>
+void DeleteElems(List* list, typename List::Elem* e) {
+  while (e != nullptr) {
+    typename List::Elem* tail = e->tail;
+    list->Delete(e);
+    e = tail;
+  }
+}
+
+}  // namespace
+
+TEST(OpenHashListTest, InsertFindTest) {
+  kaldi::OpenHashList<int, int> list;
+  list.SetSize(8);
+  EXPECT_EQ(list.Find(3), nullptr);
+  EXPECT_EQ(list.Insert(3, 30)->val, 30);
+  // The existing element is returned
+  EXPECT_EQ(list.Insert(3, 31)->val, 30);
+  EXPECT_EQ(list.Find(3)->val, 30);
+  // Grows beyond SetSize(), the elements are kept in the order inserted
+  for (int i = 100; i < 200; ++i) list.Insert(i, i * 10);
+  EXPECT_GE(list.Size(), 202);
+  for (int i = 100; i < 200; ++i) EXPECT_EQ(list.Find(i)->val, i * 10);
+  auto elems = ToVector<kaldi::OpenHashList<int, int>>(list.GetList());
+  ASSERT_EQ(elems.size(), 101);
+  EXPECT_EQ(elems[0], std::make_pair(3, 30));
+  EXPECT_EQ(elems[100], std::make_pair(199, 1990));
+  // The elements of the same key follow each other
+  list.InsertMore(3, 32);
+  list.InsertMore(199, 1991);
+  elems = ToVector<kaldi::OpenHashList<int, int>>(list.GetList());
+  ASSERT_EQ(elems.size(), 103);
+  EXPECT_EQ(elems[1], std::make_pair(3, 32));
+  EXPECT_EQ(elems[102], std::make_pair(199, 1991));
+  EXPECT_EQ(list.Find(3)->val, 30);
+  // The cleared list is no longer indexed, but still valid
+  auto* head = list.Clear();
+  EXPECT_EQ(list.GetList(), nullptr);
+  EXPECT_EQ(list.Find(3), nullptr);
+  auto cleared = ToVector<kaldi::OpenHashList<int, int>>(head);
+  EXPECT_EQ(cleared.size(), 103);
+  DeleteElems(&list, head);
+}
+
+TEST(OpenHashListTest, MatchHashListTest) {
+  // The frames of a decoder, the tokens of the previous frame are deleted
+  // while those of the next one are inserted
+  kaldi::HashList<int, int> hash_list;
+  kaldi::OpenHashList<int, int> open_list;
+  hash_list.SetSize(1000);
+  open_list.SetSize(1000);
+  std::default_random_engine gen(0);
+  std::uniform_int_distribution<int> key(0, 20000);
+  for (int frame = 0; frame < 20; ++frame) {
+    auto* hash_prev = hash_list.Clear();
+    auto* open_prev = open_list.Clear();
+    int num_keys = 100 + frame * 400;
+    for (int i = 0; i < num_keys; ++i) {
+      int k = key(gen);
+      auto* h = hash_list.Find(k);
+      auto* o = open_list.Find(k);
+      ASSERT_EQ(h == nullptr, o == nullptr);
+      if (h != nullptr) {
+        ASSERT_EQ(h->val, o->val);
+        h->val = o->val = i;
+      } else {
+        hash_list.Insert(k, i);
+        open_list.Insert(k, i);
+      }
+    }
+    DeleteElems(&hash_list, hash_prev);
+    DeleteElems(&open_list, open_prev);
+    std::map<int, int> hash_elems, open_elems;
+    for (const auto& e :
+         ToVector<kaldi::HashList<int, int>>(hash_list.GetList())) {
+      hash_elems.insert(e);
+    }
+    for (const auto& e :
+         ToVector<kaldi::OpenHashList<int, int>>(open_list.GetList())) {
+      ASSERT_TRUE(open_elems.insert(e).second);
+    }
+    ASSERT_EQ(hash_elems, open_elems);
+  }
+  DeleteElems(&hash_list, hash_list.Clear());
+  DeleteElems(&open_list, open_list.Clear());
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/parallel_loader.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+TEST(ParallelLoaderTest, ParallelTest) {
+  // The loads wait for each other, so they only finish if they run at the
+  // same time
+  std::atomic<int> started(0);
+  auto load = [&started]() {
+    ++started;
+    while (started.load() < 3) std::this_thread::yield();
+  };
+  ParallelLoader loader(true);
+  loader.Run("a", load);
+  loader.Run("b", load);
+  loader.RunHere("c", load);
+  loader.Wait();
+  EXPECT_EQ(loader.times().size(), 3);
+  EXPECT_GE(loader.elapsed(), 0);
+}
+
+TEST(ParallelLoaderTest, SequentialTest) {
+  std::string order;
+  ParallelLoader loader(false);
+  loader.Run("a", [&order]() { order += "a"; });
+  loader.Run("b", [&order]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    order += "b";
+  });
+  loader.RunHere("c", [&order]() { order += "c"; });
+  loader.Wait();
+  EXPECT_EQ(order, "abc");
+  auto times = loader.times();
+  ASSERT_EQ(times.size(), 3);
+  EXPECT_EQ(times[1].first, "b");
+  EXPECT_GE(times[1].second, 20);
+}
+
+TEST(ParallelLoaderTest, ExceptionTest) {
+  ParallelLoader loader(true);
+  std::atomic<bool> done(false);
+  loader.Run("bad", []() { throw std::runtime_error("bad"); });
+  loader.Run("good", [&done]() { done = true; });
+  EXPECT_THROW(loader.Wait(), std::runtime_error);
+  EXPECT_TRUE(done.load());
+  EXPECT_EQ(loader.times().size(), 1);
+}
+
+}  // namespace wenet
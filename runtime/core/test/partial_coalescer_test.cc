@@ -0,0 +1,56 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/partial_coalescer.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+static std::vector<wenet::DecodeResult> MakeResult(
+    const std::vector<std::string>& sentences) {
+  std::vector<wenet::DecodeResult> result(sentences.size());
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    result[i].sentence = sentences[i];
+  }
+  return result;
+}
+
+TEST(PartialCoalescerTest, TextChangeTest) {
+  wenet::PartialCoalescer coalescer(2, 0);
+  EXPECT_TRUE(coalescer.ShouldSend(MakeResult({"a"}), 0));
+  EXPECT_FALSE(coalescer.ShouldSend(MakeResult({"a"}), 10));
+  // A new path in the n-best is a change
+  EXPECT_TRUE(coalescer.ShouldSend(MakeResult({"a", "b"}), 20));
+  // But not the ones out of it
+  EXPECT_FALSE(coalescer.ShouldSend(MakeResult({"a", "b", "c"}), 30));
+  EXPECT_TRUE(coalescer.ShouldSend(MakeResult({"a", "c"}), 40));
+  // The partials start over after a final result
+  coalescer.Reset();
+  EXPECT_TRUE(coalescer.ShouldSend(MakeResult({"a", "c"}), 50));
+}
+
+TEST(PartialCoalescerTest, IntervalTest) {
+  wenet::PartialCoalescer coalescer(1, 100);
+  EXPECT_TRUE(coalescer.ShouldSend(MakeResult({"a"}), 0));
+  EXPECT_FALSE(coalescer.ShouldSend(MakeResult({"ab"}), 50));
+  // The skipped change is sent once the interval has passed
+  EXPECT_TRUE(coalescer.ShouldSend(MakeResult({"ab"}), 100));
+  EXPECT_FALSE(coalescer.ShouldSend(MakeResult({"ab"}), 300));
+  EXPECT_TRUE(coalescer.ShouldSend(MakeResult({"abc"}), 300));
+  // The first partial after a final result is not delayed
+  coalescer.Reset();
+  EXPECT_TRUE(coalescer.ShouldSend(MakeResult({"d"}), 310));
+}
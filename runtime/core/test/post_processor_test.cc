@@ -14,12 +14,20 @@
 
 #include "post_processor/post_processor.h"
 
+#include <algorithm>
+#include <codecvt>
+#include <locale>
+#include <memory>
+#include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include "post_processor/token_parser.h"
+#include "utils/string.h"
 #include "utils/utils.h"
 
 TEST(PostProcessorTest, ProcessSpacekMandarinEnglishTest) {
@@ -108,3 +116,146 @@ TEST(PostProcessorTest, ProcessSpacekIndoEuropeanTest) {
               result_uppercase[i]);
   }
 }
+
+// The ProcessSpace of the split words and the wide string, to which the one
+// pass ProcessSpace is compared
+static std::string ReferenceProcessSpace(const std::string& str,
+                                         bool mandarin_english,
+                                         bool lowercase) {
+  std::string joined = str;
+  if (mandarin_english) {
+    joined.clear();
+    std::stringstream ss(str);
+    std::string word;
+    bool is_englishword_prev = false;
+    while (ss >> word) {
+      bool is_englishword_now = wenet::CheckEnglishWord(word);
+      if (is_englishword_prev && is_englishword_now) joined += ' ';
+      joined += word;
+      is_englishword_prev = is_englishword_now;
+    }
+  }
+  std::string result;
+  std::vector<std::string> chars;
+  wenet::SplitUTF8StringToChars(wenet::Trim(joined), &chars);
+  for (const std::string& ch : chars) {
+    if (ch != wenet::kSpaceSymbol) {
+      result += ch;
+    } else if (!result.empty() && result.back() != ' ') {
+      result += ' ';
+    }
+  }
+  if (!result.empty() && result.back() == ' ') result.pop_back();
+  std::locale loc("");
+  std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
+  std::wstring wresult = converter.from_bytes(result);
+  for (auto& c : wresult) {
+    c = lowercase ? std::tolower(c, loc) : std::toupper(c, loc);
+  }
+  return converter.to_bytes(wresult);
+}
+
+TEST(PostProcessorTest, ProcessSpaceBufferTest) {
+  std::vector<std::string> pieces = {"▁",     " ",  "\t", "震东", "Is",
+                                     "schön", "'s", "ÄÖ", "a",    "▁▁"};
+  std::vector<std::string> inputs = {"", " ", "▁", "  ▁ "};
+  std::mt19937 rng(7);
+  for (int i = 0; i < 1000; ++i) {
+    std::string input;
+    int size = rng() % 10;
+    for (int k = 0; k < size; ++k) input += pieces[rng() % pieces.size()];
+    inputs.push_back(input);
+  }
+  for (bool mandarin_english : {true, false}) {
+    for (bool lowercase : {true, false}) {
+      wenet::PostProcessOptions opts;
+      opts.language_type =
+          mandarin_english ? wenet::kMandarinEnglish : wenet::kIndoEuropean;
+      opts.lowercase = lowercase;
+      wenet::PostProcessor post_processor(opts);
+      // The buffer is reused over the inputs
+      std::string result;
+      for (const std::string& input : inputs) {
+        post_processor.Process(input, false, &result);
+        EXPECT_EQ(result,
+                  ReferenceProcessSpace(input, mandarin_english, lowercase))
+            << input;
+        EXPECT_EQ(result, post_processor.ProcessSpace(input));
+      }
+    }
+  }
+}
+
+TEST(PostProcessorTest, TokenParserTest) {
+  std::vector<wenet::TextToken> tokens;
+  ASSERT_TRUE(wenet::ParseTextTokens(
+      "tokens { char { value: \"在\" } } "
+      "tokens { date { day: \"1\" month: \"3\" } }",
+      &tokens));
+  ASSERT_EQ(tokens.size(), 2);
+  EXPECT_EQ(tokens[0].String(), "char { value: \"在\" }");
+  // The members of a date are in the order of the verbalizer
+  EXPECT_EQ(tokens[1].String(), "date { month: \"3\" day: \"1\" }");
+  std::string reordered;
+  ASSERT_TRUE(wenet::ReorderTextTokens(
+      "tokens { char { value: \"\\\"\" } }tokens { time { noon: \"下午\" "
+      "hour: \"3\" preserve_order: \"true\" } }",
+      &reordered));
+  EXPECT_EQ(reordered,
+            "char { value: \"\\\"\" } time { noon: \"下午\" hour: \"3\" "
+            "preserve_order: \"true\" }");
+  EXPECT_FALSE(wenet::ParseTextTokens("tokens { char { value: \"x } }",
+                                      &tokens));
+  EXPECT_FALSE(wenet::ParseTextTokens("tokens { char { value } }", &tokens));
+  EXPECT_FALSE(wenet::ParseTextTokens("char { value: \"x\" }", &tokens));
+}
+
+// A path from state 0 back to it on the bytes of in, of which the outputs
+// are the bytes of out
+static void AddLoop(const std::string& in, const std::string& out,
+                    float cost, fst::StdVectorFst* fst) {
+  size_t length = std::max(in.size(), out.size());
+  int state = 0;
+  for (size_t i = 0; i < length; ++i) {
+    int next = i + 1 == length ? 0 : fst->AddState();
+    int ilabel = i < in.size() ? static_cast<uint8_t>(in[i]) : 0;
+    int olabel = i < out.size() ? static_cast<uint8_t>(out[i]) : 0;
+    fst->AddArc(state,
+                fst::StdArc(ilabel, olabel, i == 0 ? cost : 0.0, next));
+    state = next;
+  }
+}
+
+TEST(PostProcessorTest, InverseTNTest) {
+  auto tagger = std::make_shared<fst::StdVectorFst>();
+  tagger->AddState();
+  tagger->SetStart(0);
+  tagger->SetFinal(0, fst::TropicalWeight::One());
+  for (const std::string c : {"一", "二", "个"}) {
+    AddLoop(c, "tokens { char { value: \"" + c + "\" } }", 1.0, tagger.get());
+  }
+  // The numbers are preferred
+  AddLoop("一", "tokens { cardinal { value: \"1\" } }", 0.5, tagger.get());
+  AddLoop("二", "tokens { cardinal { value: \"2\" } }", 0.5, tagger.get());
+  auto verbalizer = std::make_shared<fst::StdVectorFst>();
+  verbalizer->AddState();
+  verbalizer->SetStart(0);
+  verbalizer->SetFinal(0, fst::TropicalWeight::One());
+  for (const std::string c : {"一", "二", "个"}) {
+    AddLoop("char { value: \"" + c + "\" }", c, 0.0, verbalizer.get());
+  }
+  AddLoop("cardinal { value: \"1\" }", "1", 0.0, verbalizer.get());
+  AddLoop("cardinal { value: \"2\" }", "2", 0.0, verbalizer.get());
+  AddLoop(" ", "", 0.0, verbalizer.get());
+
+  auto resource = std::make_shared<wenet::PostProcessResource>();
+  resource->itn = std::make_shared<wenet::ItnProcessor>(tagger, verbalizer);
+  wenet::PostProcessOptions opts;
+  wenet::PostProcessor post_processor(opts, resource);
+  EXPECT_EQ(post_processor.Process("一个二", true), "1个2");
+  // The partial results are not normalized
+  EXPECT_EQ(post_processor.Process("一个二", false), "一个二");
+  // Not accepted by the tagger
+  EXPECT_EQ(post_processor.Process("三个", true), "三个");
+  EXPECT_EQ(post_processor.Process("", true), "");
+}
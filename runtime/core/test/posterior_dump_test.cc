@@ -0,0 +1,112 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/posterior_dump.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+class PosteriorDumpTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "posterior_dump_test.bin";
+    // A full chunk with a blank frame of the skipped chunks, and a topk one
+    record_.key = "utt1";
+    record_.num_frames = 21;
+    record_.chunks.resize(2);
+    wenet::PosteriorChunk& full = record_.chunks[0];
+    full.log_probs.Resize(2, 3);
+    float values[] = {-0.1f, -2.5f, -3.0f, 0.0f,
+                      -std::numeric_limits<float>::max(),
+                      -std::numeric_limits<float>::infinity()};
+    std::copy(values, values + 6, full.log_probs.data());
+    wenet::PosteriorChunk& topk = record_.chunks[1];
+    topk.topk = true;
+    topk.topk_scores = {{-0.5f, -1.25f}, {0.0f}};
+    topk.topk_indexs = {{2, 0}, {0}};
+    record_.model_state = std::string("state\0of model", 14);
+  }
+  void TearDown() override { remove(path_.c_str()); }
+
+  std::string path_;
+  wenet::PosteriorRecord record_;
+};
+
+TEST_F(PosteriorDumpTest, ReadWriteTest) {
+  for (bool half : {false, true}) {
+    {
+      wenet::PosteriorWriter writer(path_, half);
+      writer.Write(record_);
+      wenet::PosteriorRecord empty;
+      empty.key = "utt2";
+      writer.Write(empty);
+    }
+    wenet::PosteriorReader reader;
+    ASSERT_TRUE(reader.Open(path_)) << half;
+    ASSERT_EQ(reader.num_records(), 2);
+    EXPECT_EQ(reader.key(0), "utt1");
+    EXPECT_EQ(reader.key(1), "utt2");
+    // Read out of the order
+    wenet::PosteriorRecord record;
+    ASSERT_TRUE(reader.Read(1, &record));
+    EXPECT_EQ(record.key, "utt2");
+    EXPECT_TRUE(record.chunks.empty());
+    ASSERT_TRUE(reader.Read(0, &record));
+    EXPECT_EQ(record.key, "utt1");
+    EXPECT_EQ(record.num_frames, 21);
+    EXPECT_EQ(record.model_state, record_.model_state);
+    ASSERT_EQ(record.chunks.size(), 2);
+    const wenet::PosteriorChunk& full = record.chunks[0];
+    ASSERT_FALSE(full.topk);
+    ASSERT_EQ(full.log_probs.rows(), 2);
+    ASSERT_EQ(full.log_probs.cols(), 3);
+    const float* expected = record_.chunks[0].log_probs.data();
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_NEAR(full.log_probs.data()[i], expected[i], half ? 2e-3 : 0);
+    }
+    // The fp16 of the blank frame are the lowest instead of inf
+    for (int i = 4; i < 6; ++i) {
+      EXPECT_EQ(full.log_probs.data()[i], half ? -65504.0f : expected[i]);
+    }
+    const wenet::PosteriorChunk& topk = record.chunks[1];
+    ASSERT_TRUE(topk.topk);
+    EXPECT_EQ(topk.topk_scores, record_.chunks[1].topk_scores);
+    EXPECT_EQ(topk.topk_indexs, record_.chunks[1].topk_indexs);
+  }
+}
+
+TEST_F(PosteriorDumpTest, InvalidFileTest) {
+  wenet::PosteriorReader missing;
+  EXPECT_FALSE(missing.Open(path_ + ".missing"));
+  // Truncated by a byte of the footer
+  {
+    wenet::PosteriorWriter writer(path_, false);
+    writer.Write(record_);
+    writer.Close();
+  }
+  FILE* fp = fopen(path_.c_str(), "rb");
+  std::string data(1 << 16, '\0');
+  data.resize(fread(&data[0], 1, data.size(), fp));
+  fclose(fp);
+  fp = fopen(path_.c_str(), "wb");
+  fwrite(data.data(), 1, data.size() - 1, fp);
+  fclose(fp);
+  wenet::PosteriorReader reader;
+  EXPECT_FALSE(reader.Open(path_));
+}
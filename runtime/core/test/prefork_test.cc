@@ -0,0 +1,141 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/prefork.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "decoder/asr_model.h"
+#include "decoder/ctc_prefix_beam_search.h"
+#include "utils/thread_pool.h"
+
+namespace wenet {
+
+// A model of the peaky posteriors of token (frame / 2) % 3 + 1 on the even
+// frames and blank on the odd ones, so the decoded tokens are known
+class PeakyAsrModel : public AsrModel {
+ public:
+  void Reset() override { offset_ = 0; }
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {
+    rescoring_score->assign(hyps.size(), 0.0f);
+  }
+  std::shared_ptr<AsrModel> Copy() const override {
+    return std::make_shared<PeakyAsrModel>();
+  }
+
+ protected:
+  void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
+                          std::vector<std::vector<float>>* ctc_prob) override {
+    ctc_prob->clear();
+    for (size_t i = 0; i < chunk_feats.size(); ++i, ++offset_) {
+      std::vector<float> frame(4, -5.0f);
+      frame[offset_ % 2 == 0 ? (offset_ / 2) % 3 + 1 : 0] = -0.01f;
+      ctc_prob->push_back(std::move(frame));
+    }
+  }
+};
+
+class PreforkTest : public testing::Test {
+ protected:
+  std::string Path(int worker) const {
+    return testing::TempDir() + "prefork_test." + std::to_string(worker);
+  }
+  void TearDown() override {
+    for (int i = 0; i < 3; ++i) remove(Path(i).c_str());
+  }
+  bool Exists(int worker) const { return std::ifstream(Path(worker)).good(); }
+  void Touch(int worker) const { std::ofstream(Path(worker)) << getpid(); }
+
+  PreforkOptions opts_;
+};
+
+TEST_F(PreforkTest, ExitTest) {
+  opts_.num_workers = 3;
+  RunPreforkWorkers(opts_, [this](int worker) {
+    Touch(worker);
+    return 0;
+  });
+  for (int i = 0; i < 3; ++i) EXPECT_TRUE(Exists(i)) << i;
+}
+
+TEST_F(PreforkTest, RestartTest) {
+  // The first run of each worker fails, and the restarted one exits
+  opts_.num_workers = 2;
+  opts_.restart_delay_ms = 10;
+  RunPreforkWorkers(opts_, [this](int worker) {
+    if (Exists(worker)) return 0;
+    Touch(worker);
+    if (worker == 0) abort();
+    return 1;
+  });
+  for (int i = 0; i < 2; ++i) EXPECT_TRUE(Exists(i)) << i;
+}
+
+TEST_F(PreforkTest, StopTest) {
+  // The workers are serving until the master is asked to stop
+  opts_.num_workers = 2;
+  RunPreforkWorkers(opts_, [this](int worker) {
+    Touch(worker);
+    if (worker == 0) {
+      while (!Exists(1)) usleep(1000);
+      kill(getppid(), SIGTERM);
+    }
+    for (;;) pause();
+    return 0;
+  });
+  for (int i = 0; i < 2; ++i) EXPECT_TRUE(Exists(i)) << i;
+}
+
+TEST_F(PreforkTest, DecodeTest) {
+  // The model is loaded by the master, whose workers forward and search a
+  // session on the threads they start after the fork
+  std::shared_ptr<AsrModel> model = std::make_shared<PeakyAsrModel>();
+  opts_.num_workers = 2;
+  RunPreforkWorkers(opts_, [&](int worker) {
+    ThreadPool pool(2);
+    auto decoded = pool.enqueue([&]() {
+      std::shared_ptr<AsrModel> session = model->Copy();
+      std::vector<std::vector<float>> feats(12, std::vector<float>(80, 0.0f));
+      std::vector<std::vector<float>> ctc_prob;
+      session->ForwardEncoder(feats, &ctc_prob);
+      CtcPrefixBeamSearchOptions search_opts;
+      CtcPrefixBeamSearch search(search_opts);
+      search.Search(ctc_prob);
+      return search.Inputs()[0];
+    });
+    std::ofstream out(Path(worker));
+    for (int token : decoded.get()) out << token << " ";
+    return 0;
+  });
+  for (int i = 0; i < 2; ++i) {
+    std::ifstream in(Path(i));
+    std::vector<int> tokens;
+    for (int token; in >> token;) tokens.push_back(token);
+    EXPECT_EQ(tokens, std::vector<int>({1, 2, 3, 1, 2, 3})) << i;
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,68 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/profiler.h"
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "utils/trace.h"
+
+TEST(ProfilerTest, CaptureRequests) {
+  using ::testing::HasSubstr;
+  char dir_template[] = "/tmp/profiler_test_XXXXXX";
+  ASSERT_NE(mkdtemp(dir_template), nullptr);
+  std::string dir = dir_template;
+  wenet::Profiler& profiler = wenet::Profiler::Instance();
+  profiler.set_output_dir(dir);
+  std::string prefix;
+  // Nothing is captured before it's started
+  EXPECT_FALSE(profiler.Acquire(&prefix));
+  ASSERT_FALSE(wenet::Tracer::Instance().enabled());
+
+  ASSERT_TRUE(profiler.Start(2));
+  // One capture at a time
+  EXPECT_FALSE(profiler.Start(1));
+  EXPECT_TRUE(wenet::Tracer::Instance().enabled());
+  std::string prefix1, prefix2;
+  ASSERT_TRUE(profiler.Acquire(&prefix1));
+  ASSERT_TRUE(profiler.Acquire(&prefix2));
+  EXPECT_NE(prefix1, prefix2);
+  EXPECT_EQ(prefix1.compare(0, dir.size(), dir), 0);
+  // Only the next 2 requests
+  EXPECT_FALSE(profiler.Acquire(&prefix));
+  profiler.Release();
+  EXPECT_THAT(profiler.Status(), HasSubstr("\"running\":true"));
+  // The last one writes the files
+  profiler.Release();
+  EXPECT_THAT(profiler.Status(), HasSubstr("\"running\":false"));
+  EXPECT_FALSE(wenet::Tracer::Instance().enabled());
+  std::string profile = dir + "/wenet_profile_1";
+  std::ifstream trace(profile + ".trace.json");
+  std::string text((std::istreambuf_iterator<char>(trace)),
+                   std::istreambuf_iterator<char>());
+  EXPECT_THAT(text, HasSubstr("traceEvents"));
+  EXPECT_TRUE(std::ifstream(profile + ".metrics.txt").good());
+  unlink((profile + ".trace.json").c_str());
+  unlink((profile + ".metrics.txt").c_str());
+  rmdir(dir.c_str());
+  // Another capture after it
+  EXPECT_TRUE(profiler.Start(1));
+}
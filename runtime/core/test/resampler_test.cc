@@ -0,0 +1,116 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/resampler.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "frontend/feature_pipeline.h"
+
+namespace wenet {
+
+static std::vector<float> Sine(float freq, int sample_rate, int size) {
+  std::vector<float> wav(size);
+  for (int i = 0; i < size; ++i) {
+    wav[i] = std::sin(2 * M_PI * freq * i / sample_rate);
+  }
+  return wav;
+}
+
+static std::vector<float> ResampleInChunks(Resampler* resampler,
+                                           const std::vector<float>& input,
+                                           int chunk) {
+  std::vector<float> output;
+  for (size_t i = 0; i < input.size(); i += chunk) {
+    int size = std::min<int>(chunk, input.size() - i);
+    resampler->Resample(input.data() + i, size, false, &output);
+  }
+  resampler->Resample(nullptr, 0, true, &output);
+  return output;
+}
+
+TEST(ResamplerTest, SineTest) {
+  const int kOutputRate = 16000;
+  for (int input_rate : {8000, 22050, 44100, 48000}) {
+    Resampler resampler(input_rate, kOutputRate);
+    std::vector<float> input = Sine(440, input_rate, input_rate / 2);
+    std::vector<float> output = ResampleInChunks(&resampler, input, 1234);
+    EXPECT_EQ(output.size(),
+              (input.size() * kOutputRate + input_rate - 1) / input_rate);
+    std::vector<float> expected = Sine(440, kOutputRate, output.size());
+    // Away from the edges of the silence before and after
+    int margin = resampler.num_taps();
+    for (size_t i = margin; i + margin < output.size(); ++i) {
+      ASSERT_NEAR(output[i], expected[i], 5e-3) << input_rate << " " << i;
+    }
+  }
+}
+
+TEST(ResamplerTest, StreamingTest) {
+  std::vector<float> input = Sine(1000, 48000, 10000);
+  Resampler resampler(48000, 16000);
+  std::vector<float> expected = ResampleInChunks(&resampler, input,
+                                                 input.size());
+  for (int chunk : {1, 7, 160, 4801}) {
+    std::vector<float> output = ResampleInChunks(&resampler, input, chunk);
+    ASSERT_EQ(output.size(), expected.size());
+    for (size_t i = 0; i < output.size(); ++i) {
+      ASSERT_NEAR(output[i], expected[i], 1e-5) << chunk << " " << i;
+    }
+  }
+}
+
+TEST(ResamplerTest, AliasingTest) {
+  // 12k is above the nyquist of 16k, it should be filtered out
+  Resampler resampler(48000, 16000);
+  std::vector<float> output =
+      ResampleInChunks(&resampler, Sine(12000, 48000, 48000), 480);
+  double energy = 0;
+  for (float x : output) energy += x * x;
+  EXPECT_LT(std::sqrt(energy / output.size()), 1e-2);
+}
+
+TEST(ResamplerTest, FeaturePipelineTest) {
+  FeaturePipelineConfig config(80, 16000);
+  FeaturePipeline expected(config);
+  std::vector<float> wav = Sine(440, 16000, 16000);
+  expected.AcceptWaveform(wav.data(), wav.size());
+  expected.set_input_finished();
+
+  FeaturePipeline pipeline(config);
+  pipeline.set_input_sample_rate(8000);
+  std::vector<float> wav_8k = Sine(440, 8000, 8000);
+  pipeline.AcceptWaveform(wav_8k.data(), 4000);
+  pipeline.AcceptWaveform(wav_8k.data() + 4000, 4000);
+  pipeline.set_input_finished();
+  EXPECT_EQ(pipeline.num_frames(), expected.num_frames());
+}
+
+TEST(ResamplerTest, SupportedSampleRateTest) {
+  EXPECT_TRUE(IsSupportedSampleRate(8000));
+  EXPECT_TRUE(IsSupportedSampleRate(16000));
+  EXPECT_TRUE(IsSupportedSampleRate(44100));
+  EXPECT_TRUE(IsSupportedSampleRate(48000));
+  EXPECT_FALSE(IsSupportedSampleRate(0));
+  EXPECT_FALSE(IsSupportedSampleRate(-16000));
+  EXPECT_FALSE(IsSupportedSampleRate(16001));
+  EXPECT_FALSE(IsSupportedSampleRate(1000000007));
+  EXPECT_FALSE(IsSupportedSampleRate(2147483648LL));
+  EXPECT_FALSE(IsSupportedSampleRate(4294983296LL));
+}
+
+}  // namespace wenet
@@ -0,0 +1,60 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_cache.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(RescoringCacheTest, LookupTest) {
+  wenet::RescoringCache cache(4);
+  float score = 0;
+  EXPECT_FALSE(cache.Lookup(0, {1, 2}, &score));
+  cache.Insert(0, {1, 2}, -1.5);
+  cache.Insert(0, {1}, -2.5);
+  ASSERT_TRUE(cache.Lookup(0, {1, 2}, &score));
+  EXPECT_FLOAT_EQ(score, -1.5);
+  ASSERT_TRUE(cache.Lookup(0, {1}, &score));
+  EXPECT_FLOAT_EQ(score, -2.5);
+  // The same tokens of another segment
+  EXPECT_FALSE(cache.Lookup(1, {1, 2}, &score));
+  EXPECT_FALSE(cache.Lookup(0, {2, 1}, &score));
+  // Updated in place
+  cache.Insert(0, {1}, -3.5);
+  EXPECT_EQ(cache.size(), 2);
+  ASSERT_TRUE(cache.Lookup(0, {1}, &score));
+  EXPECT_FLOAT_EQ(score, -3.5);
+  cache.Clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_FALSE(cache.Lookup(0, {1}, &score));
+}
+
+TEST(RescoringCacheTest, EvictionTest) {
+  wenet::RescoringCache cache(2);
+  float score = 0;
+  cache.Insert(0, {1}, -1);
+  cache.Insert(0, {2}, -2);
+  // {1} is used, so {2} is the least recently used one
+  ASSERT_TRUE(cache.Lookup(0, {1}, &score));
+  cache.Insert(1, {3}, -3);
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_TRUE(cache.Lookup(0, {1}, &score));
+  EXPECT_FALSE(cache.Lookup(0, {2}, &score));
+  EXPECT_TRUE(cache.Lookup(1, {3}, &score));
+  // Disabled
+  wenet::RescoringCache disabled(0);
+  disabled.Insert(0, {1}, -1);
+  EXPECT_FALSE(disabled.Lookup(0, {1}, &score));
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "decoder/rescoring_scheduler.h"
+
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+// A model which scores each hyp by its length, records the thread of its
+// rescoring, and whose batch rescoring fails if `fail`
+class LengthAsrModel : public AsrModel {
+ public:
+  explicit LengthAsrModel(bool batch, bool fail = false)
+      : batch_(batch), fail_(fail) {}
+  void Reset() override { offset_ = 0; }
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {
+    rescoring_thread = std::this_thread::get_id();
+    rescoring_score->clear();
+    for (const auto& hyp : hyps) rescoring_score->push_back(hyp.size());
+  }
+  std::shared_ptr<AsrModel> Copy() const override {
+    return std::make_shared<LengthAsrModel>(batch_, fail_);
+  }
+  bool batch_rescoring_supported() const override { return batch_; }
+
+  std::thread::id rescoring_thread;
+
+ protected:
+  void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
+                          std::vector<std::vector<float>>* ctc_prob) override {
+  }
+  void AttentionRescoringBatchFunc(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<int>>*>& hyps,
+      float reverse_weight,
+      const std::vector<std::vector<float>*>& rescoring_scores) override {
+    if (fail_) throw std::runtime_error("batch rescoring fails");
+    AsrModel::AttentionRescoringBatchFunc(models, hyps, reverse_weight,
+                                          rescoring_scores);
+  }
+
+ private:
+  bool batch_;
+  bool fail_;
+};
+
+TEST(RescoringSchedulerTest, ThreadTest) {
+  RescoringScheduler scheduler(RescoringSchedulerOptions{});
+  std::vector<std::vector<int>> hyps = {{1}, {1, 2}};
+  for (bool batch : {true, false}) {
+    LengthAsrModel model(batch);
+    std::vector<float> scores;
+    scheduler.AttentionRescoring(&model, hyps, 0.0, &scores);
+    EXPECT_EQ(scores, std::vector<float>({1, 2}));
+    // Only the batches are rescored by the scheduler thread
+    EXPECT_EQ(model.rescoring_thread == std::this_thread::get_id(), !batch);
+  }
+}
+
+TEST(RescoringSchedulerTest, ErrorTest) {
+  RescoringScheduler scheduler(RescoringSchedulerOptions{});
+  std::vector<std::vector<int>> hyps = {{1}, {1, 2}};
+  std::vector<float> scores;
+  LengthAsrModel failed(true, true);
+  EXPECT_THROW(scheduler.AttentionRescoring(&failed, hyps, 0.0, &scores),
+               std::runtime_error);
+  LengthAsrModel model(true);
+  scheduler.AttentionRescoring(&model, hyps, 0.0, &scores);
+  EXPECT_EQ(scores, std::vector<float>({1, 2}));
+}
+
+}  // namespace wenet
@@ -0,0 +1,96 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/result_cache.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+static std::vector<wenet::DecodeResult> NBest(const std::string& sentence) {
+  wenet::DecodeResult result;
+  result.score = -1.0;
+  result.sentence = sentence;
+  result.word_pieces.emplace_back(sentence, 0, 100);
+  return {result};
+}
+
+TEST(ResultCacheTest, HashTest) {
+  std::vector<float> pcm(1001);
+  for (size_t i = 0; i < pcm.size(); ++i) pcm[i] = i % 7;
+  uint64_t key = wenet::ResultCache::Key(pcm.data(), pcm.size(), 0);
+  EXPECT_EQ(key, wenet::ResultCache::Key(pcm.data(), pcm.size(), 0));
+  // The context, the length and any sample change the key
+  EXPECT_NE(key, wenet::ResultCache::Key(pcm.data(), pcm.size(), 1));
+  EXPECT_NE(key, wenet::ResultCache::Key(pcm.data(), pcm.size() - 1, 0));
+  pcm[500] += 1;
+  EXPECT_NE(key, wenet::ResultCache::Key(pcm.data(), pcm.size(), 0));
+  // The tail shorter than 8 bytes is hashed as well
+  EXPECT_NE(wenet::ResultCache::Hash("abcdefghi"),
+            wenet::ResultCache::Hash("abcdefghj"));
+  EXPECT_NE(wenet::ResultCache::Hash(std::string()),
+            wenet::ResultCache::Hash(std::string(), 1));
+}
+
+TEST(ResultCacheTest, LookupTest) {
+  wenet::ResultCache cache(2);
+  std::vector<float> a(100, 1), b(200, 2), c(300, 3);
+  std::vector<wenet::DecodeResult> nbest;
+  EXPECT_FALSE(cache.Lookup(1, a.data(), a.size(), &nbest));
+  cache.Insert(1, a.data(), a.size(), NBest("a"));
+  cache.Insert(2, b.data(), b.size(), NBest("b"));
+  ASSERT_TRUE(cache.Lookup(1, a.data(), a.size(), &nbest));
+  ASSERT_EQ(nbest.size(), 1);
+  EXPECT_EQ(nbest[0].sentence, "a");
+  EXPECT_EQ(nbest[0].word_pieces[0].end, 100);
+  // The number of samples must match too
+  EXPECT_FALSE(cache.Lookup(1, a.data(), a.size() - 1, &nbest));
+  // 2 is the least recently used one
+  cache.Insert(3, c.data(), c.size(), NBest("c"));
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_FALSE(cache.Lookup(2, b.data(), b.size(), &nbest));
+  EXPECT_TRUE(cache.Lookup(1, a.data(), a.size(), &nbest));
+  ASSERT_TRUE(cache.Lookup(3, c.data(), c.size(), &nbest));
+  EXPECT_EQ(nbest[0].sentence, "c");
+  // Replaced in place
+  cache.Insert(3, c.data(), c.size(), NBest("d"));
+  ASSERT_TRUE(cache.Lookup(3, c.data(), c.size(), &nbest));
+  EXPECT_EQ(nbest[0].sentence, "d");
+  EXPECT_EQ(cache.size(), 2);
+}
+
+TEST(ResultCacheTest, CollisionTest) {
+  wenet::ResultCache cache(2);
+  std::vector<float> a(100, 1), b(100, 1);
+  b[99] = 2;
+  std::vector<wenet::DecodeResult> nbest;
+  cache.Insert(1, a.data(), a.size(), NBest("a"));
+  // Another audio of the same key and length is a miss
+  EXPECT_FALSE(cache.Lookup(1, b.data(), b.size(), &nbest));
+  cache.Insert(1, b.data(), b.size(), NBest("b"));
+  EXPECT_FALSE(cache.Lookup(1, a.data(), a.size(), &nbest));
+  ASSERT_TRUE(cache.Lookup(1, b.data(), b.size(), &nbest));
+  EXPECT_EQ(nbest[0].sentence, "b");
+  EXPECT_EQ(cache.size(), 1);
+}
+
+TEST(ResultCacheTest, DisabledTest) {
+  wenet::ResultCache cache(0);
+  std::vector<float> a(100, 1);
+  std::vector<wenet::DecodeResult> nbest;
+  cache.Insert(1, a.data(), a.size(), NBest("a"));
+  EXPECT_FALSE(cache.Lookup(1, a.data(), a.size(), &nbest));
+  EXPECT_EQ(cache.size(), 0);
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/result_serializer.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+static std::vector<DecodeResult> MakeResult(
+    const std::vector<std::string>& sentences) {
+  std::vector<DecodeResult> result(sentences.size());
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    result[i].sentence = sentences[i];
+  }
+  return result;
+}
+
+TEST(JsonWriterTest, EscapeTest) {
+  JsonWriter writer;
+  writer.StartObject()
+      .Key("text")
+      .String("a\"b\\c\n\t\x01 你好")
+      .Key("values")
+      .StartArray()
+      .Int(-1)
+      .Bool(true)
+      .StartObject()
+      .EndObject()
+      .EndArray()
+      .EndObject();
+  EXPECT_EQ(writer.str(),
+            "{\"text\":\"a\\\"b\\\\c\\n\\t\\u0001 你好\","
+            "\"values\":[-1,true,{}]}");
+  writer.Clear();
+  writer.StartArray().EndArray();
+  EXPECT_EQ(writer.str(), "[]");
+}
+
+TEST(ResultSerializerTest, FullMessageTest) {
+  ResultSerializer serializer(2);
+  std::vector<DecodeResult> result = MakeResult({"你好", "你", "泥"});
+  result[0].word_pieces.emplace_back("你", 0, 40);
+  result[0].word_pieces.emplace_back("好", 40, 80);
+  EXPECT_EQ(serializer.PartialMessage(result),
+            "{\"status\":\"ok\",\"type\":\"partial_result\","
+            "\"nbest\":\"[{\\\"sentence\\\":\\\"你好\\\"},"
+            "{\\\"sentence\\\":\\\"你\\\"}]\"}");
+  EXPECT_EQ(serializer.FinalMessage(result),
+            "{\"status\":\"ok\",\"type\":\"final_result\","
+            "\"nbest\":\"[{\\\"sentence\\\":\\\"你好\\\",\\\"word_pieces\\\":"
+            "[{\\\"word\\\":\\\"你\\\",\\\"start\\\":0,\\\"end\\\":40},"
+            "{\\\"word\\\":\\\"好\\\",\\\"start\\\":40,\\\"end\\\":80}]},"
+            "{\\\"sentence\\\":\\\"你\\\",\\\"word_pieces\\\":[]}]\"}");
+}
+
+TEST(ResultSerializerTest, DeltaPartialTest) {
+  ResultSerializer serializer(2, true);
+  EXPECT_EQ(serializer.PartialMessage(MakeResult({"你好"})),
+            "{\"status\":\"ok\",\"type\":\"partial_result\","
+            "\"delta\":[{\"keep\":0,\"append\":\"你好\"}]}");
+  EXPECT_EQ(serializer.PartialMessage(MakeResult({"你好吗", "你号"})),
+            "{\"status\":\"ok\",\"type\":\"partial_result\","
+            "\"delta\":[{\"keep\":2,\"append\":\"吗\"},"
+            "{\"keep\":0,\"append\":\"你号\"}]}");
+  // "好" and "号" share their leading bytes, only whole characters are kept
+  EXPECT_EQ(serializer.PartialMessage(MakeResult({"你号", "你号 a"})),
+            "{\"status\":\"ok\",\"type\":\"partial_result\","
+            "\"delta\":[{\"keep\":1,\"append\":\"号\"},"
+            "{\"keep\":2,\"append\":\" a\"}]}");
+  EXPECT_EQ(serializer.PartialMessage(MakeResult({"你"})),
+            "{\"status\":\"ok\",\"type\":\"partial_result\","
+            "\"delta\":[{\"keep\":1,\"append\":\"\"}]}");
+  // The partials start from scratch after a final result
+  serializer.FinalMessage(MakeResult({"你"}));
+  EXPECT_EQ(serializer.PartialMessage(MakeResult({"好"})),
+            "{\"status\":\"ok\",\"type\":\"partial_result\","
+            "\"delta\":[{\"keep\":0,\"append\":\"好\"}]}");
+}
+
+TEST(ResultSerializerTest, BinaryMessageTest) {
+  ResultSerializer serializer(1, false, true);
+  std::vector<DecodeResult> result = MakeResult({"ab", "b"});
+  // type: partial_result, nbest: [{sentence: "ab"}]
+  EXPECT_EQ(serializer.PartialMessage(result),
+            std::string("\x10\x01\x1a\x04\x0a\x02" "ab"));
+  result[0].word_pieces.emplace_back("a", 0, 40);
+  result[0].word_pieces.emplace_back("b", -1, 300);
+  // type: final_result, nbest: [{sentence: "ab", wordpieces: [
+  //   {word: "a", end: 40}, {word: "b", start: -1, end: 300}]}]
+  std::string expected("\x10\x02\x1a\x1e\x0a\x02" "ab"
+                       "\x12\x05\x0a\x01" "a" "\x18\x28"
+                       "\x12\x11\x0a\x01" "b"
+                       "\x10\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01"
+                       "\x18\xac\x02");
+  EXPECT_EQ(serializer.FinalMessage(result), expected);
+  // An empty path is still a path
+  EXPECT_EQ(serializer.PartialMessage(MakeResult({""})),
+            std::string("\x10\x01\x1a\x00", 4));
+}
+
+TEST(ResultSerializerTest, StreamIdTest) {
+  ResultSerializer serializer(1, true);
+  serializer.set_stream_id(3);
+  EXPECT_EQ(serializer.PartialMessage(MakeResult({"a"})),
+            "{\"status\":\"ok\",\"type\":\"partial_result\","
+            "\"stream_id\":3,\"delta\":[{\"keep\":0,\"append\":\"a\"}]}");
+  EXPECT_EQ(serializer.FinalMessage(MakeResult({"a"})),
+            "{\"status\":\"ok\",\"type\":\"final_result\","
+            "\"stream_id\":3,"
+            "\"nbest\":\"[{\\\"sentence\\\":\\\"a\\\","
+            "\\\"word_pieces\\\":[]}]\"}");
+  // type: partial_result, nbest: [{sentence: "a"}], stream_id: 3
+  ResultSerializer binary(1, false, true);
+  binary.set_stream_id(3);
+  EXPECT_EQ(binary.PartialMessage(MakeResult({"a"})),
+            std::string("\x10\x01\x1a\x03\x0a\x01" "a" "\x28\x03"));
+}
+
+TEST(ResultSerializerTest, BatchResultTest) {
+  JsonWriter writer;
+  std::vector<std::vector<DecodeResult>> batch_result = {
+      MakeResult({"a", "b"}), MakeResult({})};
+  writer.StartArray();
+  for (const auto& result : batch_result) {
+    ResultSerializer::WriteNbest(result, 1, false, &writer);
+  }
+  writer.EndArray();
+  EXPECT_EQ(writer.str(), "[[{\"sentence\":\"a\"}],[]]");
+}
+
+}  // namespace wenet
@@ -0,0 +1,96 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/segmenter.h"
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+// Noise, in which the harmonics of 200Hz are in [speech[i], speech[i+1]) ms
+static std::vector<float> Wave(int ms, const std::vector<int>& speech,
+                               int sample_rate) {
+  const int samples_per_ms = sample_rate / 1000;
+  std::vector<float> pcm(ms * samples_per_ms);
+  unsigned int seed = 1;
+  for (int i = 0; i < pcm.size(); ++i) {
+    seed = seed * 1103515245 + 12345;
+    pcm[i] = static_cast<int>((seed >> 16) % 21) - 10;
+    for (size_t j = 0; j + 1 < speech.size(); j += 2) {
+      if (i >= speech[j] * samples_per_ms &&
+          i < speech[j + 1] * samples_per_ms) {
+        for (int k = 1; k <= 10; ++k) {
+          pcm[i] +=
+              3000.0 / k * std::sin(2 * M_PI * 200 * k * i / sample_rate);
+        }
+      }
+    }
+  }
+  return pcm;
+}
+
+TEST(SegmenterTest, SplitAtSilenceTest) {
+  using ::testing::ElementsAre;
+  using ::testing::Pair;
+  const int sample_rate = 16000;
+  // 2s speech and 1s silence after 1s silence, 4 times
+  std::vector<float> pcm = Wave(
+      13000, {1000, 3000, 4000, 6000, 7000, 9000, 10000, 12000}, sample_rate);
+  wenet::SegmenterOptions opts;
+  opts.min_segment_ms = 1000;
+  opts.max_segment_ms = 5000;
+  std::vector<std::pair<int, int>> segments =
+      wenet::SplitBySilence(pcm.data(), pcm.size(), sample_rate, opts);
+  // The silences are [330, 398) frames and so on, by the hangover of 30
+  // frames, and the one at the end is not a cut
+  ASSERT_THAT(segments, ElementsAre(Pair(0, 364 * 160),
+                                    Pair(364 * 160, 664 * 160),
+                                    Pair(664 * 160, 964 * 160),
+                                    Pair(964 * 160, pcm.size())));
+}
+
+TEST(SegmenterTest, SplitAtMaxSegmentTest) {
+  using ::testing::ElementsAre;
+  using ::testing::Pair;
+  const int sample_rate = 16000;
+  // The pauses of 100ms are kept as speech by the hangover
+  std::vector<int> speech;
+  for (int ms = 0; ms < 5000; ms += 300) {
+    speech.push_back(ms);
+    speech.push_back(ms + 200);
+  }
+  std::vector<float> pcm = Wave(5000, speech, sample_rate);
+  wenet::SegmenterOptions opts;
+  opts.min_segment_ms = 1000;
+  opts.max_segment_ms = 2000;
+  std::vector<std::pair<int, int>> segments =
+      wenet::SplitBySilence(pcm.data(), pcm.size(), sample_rate, opts);
+  ASSERT_THAT(segments, ElementsAre(Pair(0, 32000), Pair(32000, 64000),
+                                    Pair(64000, pcm.size())));
+}
+
+TEST(SegmenterTest, ShortWaveTest) {
+  using ::testing::ElementsAre;
+  using ::testing::Pair;
+  std::vector<float> pcm = Wave(2000, {0, 1000}, 16000);
+  wenet::SegmenterOptions opts;
+  std::vector<std::pair<int, int>> segments =
+      wenet::SplitBySilence(pcm.data(), pcm.size(), 16000, opts);
+  ASSERT_THAT(segments, ElementsAre(Pair(0, pcm.size())));
+  segments = wenet::SplitBySilence(pcm.data(), 100, 16000, opts);
+  ASSERT_THAT(segments, ElementsAre(Pair(0, 100)));
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/session_record.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+
+#include "gtest/gtest.h"
+
+TEST(SessionRecordTest, RecordAndReadTest) {
+  char dir_template[] = "/tmp/session_record_test_XXXXXX";
+  ASSERT_NE(mkdtemp(dir_template), nullptr);
+  std::string dir = dir_template;
+  // Disabled by default
+  EXPECT_EQ(wenet::SessionRecorder::NewSession(), nullptr);
+  wenet::SessionRecorder::Enable(dir, 1);
+  auto recorder = wenet::SessionRecorder::NewSession();
+  ASSERT_NE(recorder, nullptr);
+  // Only max_sessions are recorded
+  EXPECT_EQ(wenet::SessionRecorder::NewSession(), nullptr);
+  std::string audio("\x01\x00\x02\x00", 4);
+  recorder->Record(wenet::RecordedPacket::kText, "{\"signal\":\"start\"}");
+  recorder->Record(wenet::RecordedPacket::kBinary, audio);
+  recorder->Record(wenet::RecordedPacket::kBinary, "", 0);
+  std::string path = recorder->path();
+  recorder.reset();
+
+  wenet::SessionRecord record;
+  ASSERT_TRUE(wenet::ReadSessionRecord(path, &record));
+  EXPECT_GT(record.start_unix_us, 0);
+  ASSERT_EQ(record.packets.size(), 3);
+  EXPECT_EQ(record.packets[0].type, wenet::RecordedPacket::kText);
+  EXPECT_EQ(record.packets[0].data, "{\"signal\":\"start\"}");
+  EXPECT_EQ(record.packets[1].type, wenet::RecordedPacket::kBinary);
+  EXPECT_EQ(record.packets[1].data, audio);
+  EXPECT_TRUE(record.packets[2].data.empty());
+  EXPECT_LE(record.packets[0].time_us, record.packets[1].time_us);
+  EXPECT_LE(record.packets[1].time_us, record.packets[2].time_us);
+
+  // The packets before the truncated one are kept, e.g. of a killed server
+  FILE* file = fopen(path.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);  // NOLINT
+  fclose(file);
+  ASSERT_EQ(truncate(path.c_str(), size - 2), 0);
+  ASSERT_TRUE(wenet::ReadSessionRecord(path, &record));
+  EXPECT_EQ(record.packets.size(), 2);
+  ASSERT_EQ(truncate(path.c_str(), 3), 0);
+  EXPECT_FALSE(wenet::ReadSessionRecord(path, &record));
+  EXPECT_FALSE(wenet::ReadSessionRecord(dir + "/none.wrec", &record));
+  remove(path.c_str());
+  remove(dir.c_str());
+}
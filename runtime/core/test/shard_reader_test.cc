@@ -0,0 +1,119 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/shard_reader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "frontend/wav.h"
+
+namespace wenet {
+
+class ShardReaderTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "shard_reader_test.tar";
+    fp_ = fopen(path_.c_str(), "wb");
+  }
+  void TearDown() override { remove(path_.c_str()); }
+
+  // Write a tar entry as tarfile of python does
+  void WriteEntry(const std::string& name, const std::string& data,
+                  char type = '0') {
+    char header[512] = {0};
+    if (name.size() >= 100) {
+      // GNU long name
+      WriteEntry("././@LongLink", name + '\0', 'L');
+    }
+    strncpy(header, name.c_str(), 99);
+    snprintf(header + 124, 12, "%011o", static_cast<unsigned>(data.size()));
+    header[156] = type;
+    memcpy(header + 257, "ustar  ", 8);
+    fwrite(header, 1, 512, fp_);
+    fwrite(data.data(), 1, data.size(), fp_);
+    std::string padding((512 - data.size() % 512) % 512, '\0');
+    fwrite(padding.data(), 1, padding.size(), fp_);
+  }
+  std::string Wav(int num_samples, int sample_rate) {
+    WavHeader header(num_samples, 1, sample_rate, 16);
+    std::string wav(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (int i = 0; i < num_samples; ++i) {
+      int16_t sample = i - 100;
+      wav.append(reinterpret_cast<const char*>(&sample), sizeof(sample));
+    }
+    return wav;
+  }
+  void Close() {
+    std::string end(1024, '\0');
+    fwrite(end.data(), 1, end.size(), fp_);
+    fclose(fp_);
+  }
+
+  std::string path_;
+  FILE* fp_ = nullptr;
+};
+
+TEST_F(ShardReaderTest, ReadTest) {
+  std::string long_key(120, 'k');
+  WriteEntry("utt1.txt", "hello world\n");
+  WriteEntry("utt1.wav", Wav(1000, 16000));
+  WriteEntry("dir", "", '5');
+  WriteEntry("utt2.wav", Wav(300, 8000));
+  WriteEntry("utt2.txt", "bye");
+  // No wav of utt3
+  WriteEntry("utt3.txt", "nothing");
+  WriteEntry(long_key + ".wav", Wav(10, 16000));
+  Close();
+
+  // Read ahead by 1 to block the reader thread
+  ShardReader reader({"/nonexistent.tar", path_}, 1);
+  ShardSample sample;
+  ASSERT_TRUE(reader.Next(&sample));
+  EXPECT_EQ(sample.key, "utt1");
+  EXPECT_EQ(sample.txt, "hello world");
+  EXPECT_EQ(sample.sample_rate, 16000);
+  ASSERT_EQ(sample.wav.size(), 1000);
+  EXPECT_EQ(sample.wav[0], -100);
+  EXPECT_EQ(sample.wav[999], 899);
+  ASSERT_TRUE(reader.Next(&sample));
+  EXPECT_EQ(sample.key, "utt2");
+  EXPECT_EQ(sample.txt, "bye");
+  EXPECT_EQ(sample.sample_rate, 8000);
+  EXPECT_EQ(sample.wav.size(), 300);
+  ASSERT_TRUE(reader.Next(&sample));
+  EXPECT_EQ(sample.key, long_key);
+  EXPECT_EQ(sample.txt, "");
+  EXPECT_EQ(sample.wav.size(), 10);
+  EXPECT_FALSE(reader.Next(&sample));
+  EXPECT_FALSE(reader.Next(&sample));
+}
+
+TEST_F(ShardReaderTest, StopTest) {
+  for (int i = 0; i < 10; ++i) {
+    WriteEntry("utt" + std::to_string(i) + ".wav", Wav(100, 16000));
+  }
+  Close();
+  // The reader thread is stopped with the queue full
+  ShardReader reader({path_, path_}, 2);
+  ShardSample sample;
+  ASSERT_TRUE(reader.Next(&sample));
+  EXPECT_EQ(sample.key, "utt0");
+}
+
+}  // namespace wenet
@@ -0,0 +1,67 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/stage_timer.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+TEST(StageTimerTest, SubMillisecondStages) {
+  wenet::StageStats* stats =
+      wenet::StageStats::Get("test_stage_seconds", "Test stage");
+  EXPECT_EQ(wenet::StageStats::Get("test_stage_seconds", ""), stats);
+  stats->Record(20000);
+  stats->Record(300000);
+  {
+    wenet::StageTimer timer(stats);
+    EXPECT_GE(timer.Stop(), 0);
+    // Recorded once
+    timer.Stop();
+  }
+  // Pending in the thread until it's flushed
+  EXPECT_EQ(stats->histogram()->count(), 0);
+  wenet::StageStats::Flush();
+  wenet::Histogram* histogram = stats->histogram();
+  EXPECT_EQ(histogram->count(), 3);
+  // The 20us and the 300us are not in the first bucket of 10us
+  EXPECT_EQ(histogram->bucket_count(histogram->BucketIndex(2e-5)), 1);
+  EXPECT_EQ(histogram->bucket_count(histogram->BucketIndex(3e-4)), 1);
+  EXPECT_GE(histogram->sum(), 3.2e-4);
+}
+
+TEST(StageTimerTest, ThreadsAreMerged) {
+  using ::testing::HasSubstr;
+  wenet::StageStats* stats =
+      wenet::StageStats::Get("test_threads_seconds", "Test threads");
+  const int kNumThreads = 4;
+  const int kNumRecords = 1000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([=]() {
+      for (int j = 0; j < kNumRecords; ++j) stats->Record(1000);
+    });
+  }
+  // The buckets of the threads are merged at their exit
+  for (auto& t : threads) t.join();
+  EXPECT_EQ(stats->histogram()->count(), kNumThreads * kNumRecords);
+  // The pending ones of the living threads are merged by Serialize
+  stats->Record(1000);
+  std::string text = wenet::Metrics::Instance().Serialize();
+  EXPECT_THAT(text, HasSubstr("test_threads_seconds_count " +
+                              std::to_string(kNumThreads * kNumRecords + 1)));
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/symbol_map.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+TEST(SymbolMapTest, SymbolTableTest) {
+  fst::SymbolTable table;
+  table.AddSymbol("<blank>", 0);
+  table.AddSymbol("你", 1);
+  table.AddSymbol("▁hello", 2);
+  // The unused ids are empty
+  table.AddSymbol("<sos/eos>", 5);
+  SymbolMap symbols(table);
+  EXPECT_EQ(symbols.size(), 6);
+  for (int64_t id : {0, 1, 2, 5}) {
+    EXPECT_EQ(symbols.Find(id), table.Find(id));
+    EXPECT_EQ(symbols.Find(table.Find(id)), id);
+  }
+  EXPECT_EQ(symbols.Find(3), "");
+  EXPECT_EQ(symbols.Find(-1), "");
+  EXPECT_EQ(symbols.Find(6), "");
+  EXPECT_EQ(symbols.Find("好"), fst::kNoSymbol);
+  EXPECT_EQ(symbols.Find(""), fst::kNoSymbol);
+  EXPECT_EQ(symbols.Find("▁hell"), fst::kNoSymbol);
+
+  std::string sentence;
+  symbols.Append(1, &sentence);
+  symbols.Append(2, &sentence);
+  EXPECT_EQ(sentence, "你▁hello");
+}
+
+TEST(SymbolMapTest, PerfectHashTest) {
+  std::vector<std::pair<int64_t, std::string>> items;
+  for (int i = 0; i < 20000; ++i) {
+    items.emplace_back(i, "w" + std::to_string(i * 7));
+  }
+  SymbolMap symbols(items);
+  for (const auto& item : items) {
+    ASSERT_EQ(symbols.Find(item.second), item.first);
+    ASSERT_EQ(symbols.Find(item.first), item.second);
+  }
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(symbols.Find("w" + std::to_string(i * 7 + 1)), fst::kNoSymbol);
+  }
+  SymbolMap empty(std::vector<std::pair<int64_t, std::string>>{});
+  EXPECT_EQ(empty.size(), 0);
+  EXPECT_EQ(empty.Find("w0"), fst::kNoSymbol);
+  EXPECT_EQ(empty.Find(0), "");
+}
+
+}  // namespace wenet
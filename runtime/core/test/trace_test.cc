@@ -0,0 +1,58 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/trace.h"
+
+#include <string>
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+static int CountOf(const std::string& text, const std::string& pattern) {
+  int count = 0;
+  for (size_t pos = text.find(pattern); pos != std::string::npos;
+       pos = text.find(pattern, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(TraceTest, RingBuffer) {
+  wenet::Tracer& tracer = wenet::Tracer::Instance();
+  // Nothing is traced before it's enabled
+  EXPECT_EQ(tracer.NewSessionId(), 0);
+  { wenet::TraceScope trace(0, "untraced"); }
+
+  tracer.Enable(4);
+  uint64_t session_id = tracer.NewSessionId();
+  EXPECT_NE(session_id, 0);
+  std::thread t([session_id]() {
+    // Only the latest 4 spans of the thread are kept
+    for (int i = 0; i < 6; ++i) {
+      wenet::TraceScope trace(session_id, "encoder_forward", i);
+    }
+  });
+  t.join();
+  std::string text = tracer.ExportChromeTrace();
+  EXPECT_EQ(CountOf(text, "\"name\":\"encoder_forward\""), 4);
+  EXPECT_EQ(CountOf(text, "\"chunk\":0}"), 0);
+  EXPECT_EQ(CountOf(text, "\"chunk\":1}"), 0);
+  EXPECT_EQ(CountOf(text, "\"chunk\":5}"), 1);
+  EXPECT_EQ(CountOf(text, "untraced"), 0);
+  EXPECT_THAT(text, ::testing::StartsWith("{\"traceEvents\":[{"));
+  EXPECT_THAT(text, ::testing::HasSubstr("\"ph\":\"X\",\"ts\":"));
+  EXPECT_THAT(text, ::testing::HasSubstr(
+                        "\"pid\":" + std::to_string(session_id)));
+}
@@ -15,11 +15,27 @@
 
 #include "utils/utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include "utils/chunk_deadline.h"
+#include "utils/snapshot.h"
+#include "utils/string.h"
+#include "utils/thread_pool.h"
+
 TEST(UtilsTest, TopKTest) {
   using ::testing::ElementsAre;
   using ::testing::FloatNear;
@@ -31,3 +47,262 @@ TEST(UtilsTest, TopKTest) {
   EXPECT_THAT(values, Pointwise(FloatNear(1e-8), {10, 9, 8}));
   ASSERT_THAT(indices, ElementsAre(9, 4, 8));
 }
+
+// The top k by sorting, the earlier one first in a tie
+static void ReferenceTopK(const std::vector<float>& data, int k,
+                          std::vector<float>* values,
+                          std::vector<int32_t>* indices) {
+  std::vector<int32_t> order(data.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&data](int a, int b) { return data[a] > data[b]; });
+  order.resize(std::min<size_t>(k, order.size()));
+  indices->assign(order.begin(), order.end());
+  values->clear();
+  for (int i : order) values->push_back(data[i]);
+}
+
+TEST(UtilsTest, TopKRandomTest) {
+  std::mt19937 rng(0);
+  std::normal_distribution<float> normal(0, 3);
+  for (int n : {0, 1, 7, 15, 16, 17, 100, 5000, 10003}) {
+    std::vector<float> data(n);
+    // Quantized so there are ties
+    for (auto& x : data) x = std::round(normal(rng) * 4) / 4;
+    for (int k : {1, 2, 5, 10, 16, 17, 32}) {
+      std::vector<float> values, expected_values;
+      std::vector<int32_t> indices, expected_indices;
+      wenet::TopK(data, k, &values, &indices);
+      ReferenceTopK(data, k, &expected_values, &expected_indices);
+      EXPECT_EQ(values, expected_values) << "n " << n << " k " << k;
+      EXPECT_EQ(indices, expected_indices) << "n " << n << " k " << k;
+    }
+  }
+}
+
+TEST(UtilsTest, LogAddTest) {
+  const float kMin = -std::numeric_limits<float>::max();
+  EXPECT_EQ(wenet::LogAdd(kMin, -1.5f), -1.5f);
+  EXPECT_EQ(wenet::FastLogAdd(-2.5f, kMin), -2.5f);
+  EXPECT_NEAR(wenet::LogAdd(std::log(0.25f), std::log(0.5f)), std::log(0.75f),
+              1e-6);
+  // log(1 + exp(-d)) of the table is within 1e-5 of the exact one
+  double max_error = 0;
+  for (double d = 0; d < 20; d += 1e-3) {
+    double exact = std::log1p(std::exp(-d));
+    max_error =
+        std::max(max_error, std::abs(wenet::FastLogAdd(0, -d) - exact));
+  }
+  EXPECT_LT(max_error, 1e-5);
+  // So is the result, plus its rounding
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> score(-100, 0);
+  for (int i = 0; i < 100000; ++i) {
+    float x = score(rng), y = score(rng);
+    double exact = std::max<double>(x, y) +
+                   std::log1p(std::exp(-std::abs(static_cast<double>(x) - y)));
+    float tolerance =
+        1e-5 + std::abs(exact) * std::numeric_limits<float>::epsilon();
+    ASSERT_NEAR(wenet::FastLogAdd(x, y), exact, tolerance) << x << " " << y;
+  }
+}
+
+TEST(UtilsTest, VectorLogAddTest) {
+  // Of the scalar calls, with the empty scores and the tails of the lanes
+  const float kMin = -std::numeric_limits<float>::max();
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> score(-30, 0);
+  for (int n : {0, 1, 7, 8, 19, 64}) {
+    std::vector<float> x(n), y(n), out(n), fast_out(n);
+    for (int i = 0; i < n; ++i) {
+      x[i] = i % 5 == 0 ? kMin : score(rng);
+      y[i] = i % 7 == 0 ? kMin : score(rng);
+    }
+    wenet::LogAdd(x.data(), y.data(), out.data(), n);
+    wenet::FastLogAdd(x.data(), y.data(), fast_out.data(), n);
+    for (int i = 0; i < n; ++i) {
+      EXPECT_FLOAT_EQ(out[i], wenet::LogAdd(x[i], y[i])) << i;
+      EXPECT_FLOAT_EQ(fast_out[i], wenet::FastLogAdd(x[i], y[i])) << i;
+    }
+  }
+  // In place
+  std::vector<float> x = {std::log(0.25f), kMin, -1.0f};
+  std::vector<float> y = {std::log(0.5f), -2.0f, kMin};
+  wenet::LogAdd(x.data(), y.data(), x.data(), x.size());
+  EXPECT_NEAR(x[0], std::log(0.75f), 1e-5);
+  EXPECT_EQ(x[1], -2.0f);
+  EXPECT_EQ(x[2], -1.0f);
+}
+
+TEST(UtilsTest, ThreadPoolTest) {
+  ThreadPool pool(4);
+  ASSERT_EQ(pool.size(), 4);
+  std::vector<std::future<int>> futures;
+  for (int i = 0; i < 1000; ++i) {
+    futures.emplace_back(pool.enqueue([](int x) { return x * 2; }, i));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(futures[i].get(), i * 2);
+  }
+  // The tasks enqueued by the tasks
+  std::atomic<int> count(0);
+  {
+    ThreadPool nested_pool(2);
+    for (int i = 0; i < 10; ++i) {
+      nested_pool.post(TaskPriority::kNormal, [&]() {
+        for (int j = 0; j < 10; ++j) {
+          nested_pool.post(TaskPriority::kLow, [&]() { ++count; });
+        }
+      });
+    }
+  }
+  ASSERT_EQ(count, 100);
+}
+
+TEST(UtilsTest, ThreadPoolPriorityTest) {
+  ThreadPool pool(1);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  // Block the worker, then queue the tasks of all the priorities
+  pool.post(TaskPriority::kNormal, [opened]() { opened.wait(); });
+  std::mutex mutex;
+  std::vector<int> order;
+  auto record = [&](int i) {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(i);
+  };
+  pool.post(TaskPriority::kLow, [&]() { record(2); });
+  pool.post(TaskPriority::kNormal, [&]() { record(1); });
+  auto future = pool.enqueue_with_priority(TaskPriority::kHigh, record, 0);
+  pool.post(TaskPriority::kLow, [&]() { record(3); });
+  gate.set_value();
+  future.get();
+  pool.enqueue_with_priority(TaskPriority::kLow, [] {}).get();
+  EXPECT_THAT(order, ::testing::ElementsAre(0, 1, 2, 3));
+}
+
+TEST(UtilsTest, ThreadPoolDeadlineTest) {
+  ThreadPool pool(1);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  pool.post(TaskPriority::kNormal, [opened]() { opened.wait(); });
+  std::mutex mutex;
+  std::vector<int> order;
+  auto record = [&](int i) {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(i);
+  };
+  // By the deadline then the posting, and before the lower priorities
+  auto now = std::chrono::steady_clock::now();
+  pool.post(TaskPriority::kNormal, [&]() { record(4); });
+  pool.post_by_deadline(now + std::chrono::milliseconds(20),
+                        [&]() { record(2); });
+  pool.post_by_deadline(now, [&]() { record(0); });
+  pool.post_by_deadline(now + std::chrono::milliseconds(20),
+                        [&]() { record(3); });
+  pool.post_by_deadline(now - std::chrono::milliseconds(5),
+                        [&]() { record(1); });
+  gate.set_value();
+  pool.enqueue_with_priority(TaskPriority::kLow, [] {}).get();
+  EXPECT_THAT(order, ::testing::ElementsAre(1, 0, 2, 3, 4));
+}
+
+TEST(UtilsTest, ThreadPoolFairShareTest) {
+  ThreadPool pool(1);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  pool.post(TaskPriority::kNormal, [opened]() { opened.wait(); });
+  std::mutex mutex;
+  std::vector<int> order;
+  auto record = [&](int i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(i);
+  };
+  // A task of 1ms is 1ms of the virtual time of the group of weight 1, but
+  // 10us of the one of weight 100, so all the tasks of the latter are run
+  // before the second one of the former, though they're due later
+  TaskGroup small(1.0f);
+  TaskGroup large(100.0f);
+  auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 3; ++i) {
+    pool.post_by_deadline(now, [&, i]() { record(i); }, &small);
+  }
+  for (int i = 0; i < 3; ++i) {
+    pool.post_by_deadline(now + std::chrono::seconds(1),
+                          [&, i]() { record(10 + i); }, &large);
+  }
+  gate.set_value();
+  pool.enqueue_with_priority(TaskPriority::kLow, [] {}).get();
+  ASSERT_EQ(order.size(), 6);
+  auto second = std::find(order.begin(), order.end(), 1);
+  EXPECT_EQ(std::count_if(order.begin(), second, [](int i) { return i >= 10; }),
+            3);
+  // In the order of the posting in a group of the same deadline
+  EXPECT_LT(std::find(order.begin(), order.end(), 0), second);
+  EXPECT_LT(second, std::find(order.begin(), order.end(), 2));
+}
+
+TEST(UtilsTest, ChunkDeadlineTest) {
+  wenet::ChunkDeadline off(0);
+  off.OnAudio();
+  EXPECT_FALSE(off.Take());
+  wenet::ChunkDeadline deadline(1);
+  EXPECT_FALSE(deadline.Take());
+  deadline.OnAudio();
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  // It's of the oldest audio pending, the newer one doesn't move it
+  deadline.OnAudio();
+  EXPECT_TRUE(deadline.Take());
+  // Nothing is pending after it's taken
+  EXPECT_FALSE(deadline.Take());
+  wenet::ChunkDeadline relaxed(10000);
+  relaxed.OnAudio();
+  EXPECT_FALSE(relaxed.Take());
+}
+
+TEST(UtilsTest, EditDistanceTest) {
+  using ::testing::ElementsAre;
+  // A word per English word and a char per the others
+  EXPECT_THAT(wenet::ScoringTokens(" 你好 hello world's 世界 "),
+              ElementsAre("你", "好", "hello", "world's", "世", "界"));
+  EXPECT_THAT(wenet::ScoringTokens("ok你好"),
+              ElementsAre("ok", "你", "好"));
+  auto distance = [](const std::string& a, const std::string& b) {
+    return wenet::EditDistance(wenet::ScoringTokens(a),
+                               wenet::ScoringTokens(b));
+  };
+  EXPECT_EQ(distance("", ""), 0);
+  EXPECT_EQ(distance("a b c", ""), 3);
+  EXPECT_EQ(distance("", "a b"), 2);
+  EXPECT_EQ(distance("a b c", "a c"), 1);
+  EXPECT_EQ(distance("a b c", "a x c d"), 2);
+  EXPECT_EQ(distance("今天天气", "今天气温"), 2);
+}
+
+TEST(UtilsTest, SnapshotTest) {
+  wenet::Snapshot<std::string> snapshot;
+  EXPECT_EQ(*snapshot.Get(), "");
+  // A value held by the reader outlives the publication of the next one
+  snapshot.Publish(std::string("a"));
+  std::shared_ptr<const std::string> held = snapshot.Get();
+  snapshot.Publish(std::string("b"));
+  EXPECT_EQ(*held, "a");
+  EXPECT_EQ(*snapshot.Get(), "b");
+  // The readers see the values in the order of publication
+  const int kNumValues = 10000;
+  std::thread writer([&snapshot]() {
+    for (int i = 0; i < kNumValues; ++i) {
+      snapshot.Publish(std::to_string(i));
+    }
+  });
+  int last = -1;
+  while (last < kNumValues - 1) {
+    std::shared_ptr<const std::string> value = snapshot.Get();
+    if (*value == "b") continue;
+    int i = std::stoi(*value);
+    ASSERT_GE(i, last);
+    last = i;
+  }
+  writer.join();
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/word_lattice.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace wenet {
+
+// Two paths "a b" and "c" from 0 to the final state 3
+static void MakeLattice(WordLattice* lattice) {
+  lattice->Clear();
+  lattice->AddState(0);
+  lattice->AddArc(0, {1, 1, 0.5, 10.0});
+  lattice->AddArc(0, {3, 3, 1.5, 25.0});
+  lattice->AddState(12);
+  lattice->AddArc(1, {2, 2, 0.25, 8.0});
+  lattice->AddState(30);
+  lattice->AddArc(2, {0, 3, 0.0, 1.0});
+  lattice->AddState(31);
+  lattice->SetFinal(3, 0.125, 0.0);
+}
+
+TEST(WordLatticeTest, SerializeTest) {
+  WordLattice lattice;
+  MakeLattice(&lattice);
+  std::string data;
+  lattice.Serialize(&data);
+  // 4 magic, 2 counts, 4 * 2 state bytes, 4 * 10 arc bytes, 8 final bytes
+  EXPECT_EQ(data.size(), 4 + 2 + 8 + 40 + 8);
+
+  WordLattice copy;
+  ASSERT_TRUE(copy.Deserialize(data));
+  ASSERT_EQ(copy.num_states(), 4);
+  ASSERT_EQ(copy.num_arcs(), 4);
+  for (int s = 0; s < copy.num_states(); ++s) {
+    EXPECT_EQ(copy.time(s), lattice.time(s));
+    EXPECT_EQ(copy.IsFinal(s), lattice.IsFinal(s));
+    ASSERT_EQ(copy.arcs_end(s) - copy.arcs_begin(s),
+              lattice.arcs_end(s) - lattice.arcs_begin(s));
+    for (int i = 0; i < copy.arcs_end(s) - copy.arcs_begin(s); ++i) {
+      const WordLattice::Arc& a = copy.arcs_begin(s)[i];
+      const WordLattice::Arc& b = lattice.arcs_begin(s)[i];
+      EXPECT_EQ(a.word, b.word);
+      EXPECT_EQ(a.next, b.next);
+      EXPECT_EQ(a.graph_cost, b.graph_cost);
+      EXPECT_EQ(a.acoustic_cost, b.acoustic_cost);
+    }
+  }
+  EXPECT_EQ(copy.final_graph_cost(3), 0.125);
+  EXPECT_EQ(copy.final_acoustic_cost(3), 0.0);
+
+  std::string again;
+  copy.Serialize(&again);
+  EXPECT_EQ(again, data);
+}
+
+TEST(WordLatticeTest, InvalidTest) {
+  WordLattice lattice;
+  MakeLattice(&lattice);
+  std::string data;
+  lattice.Serialize(&data);
+  WordLattice copy;
+  // Truncated, trailing bytes and the bad magic are all rejected
+  for (size_t size = 0; size < data.size(); ++size) {
+    EXPECT_FALSE(copy.Deserialize(data.data(), size)) << size;
+    EXPECT_EQ(copy.num_states(), 0);
+  }
+  EXPECT_FALSE(copy.Deserialize(data + '\0'));
+  std::string bad = data;
+  bad[0] = 'X';
+  EXPECT_FALSE(copy.Deserialize(bad));
+  // The arc of state 2 loops, which is before the final costs and the
+  // state bytes of state 3, and the costs of the arc
+  bad = data;
+  size_t pos = data.size() - 8 - 2 - 8 - 1;
+  ASSERT_EQ(bad[pos], 1);
+  bad[pos] = 0;
+  EXPECT_FALSE(copy.Deserialize(bad));
+}
+
+}  // namespace wenet
@@ -0,0 +1,98 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/work_coordinator.h"
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+static std::vector<wenet::WorkItem> Items(const std::vector<int>& sizes) {
+  std::vector<wenet::WorkItem> items;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    items.push_back({"utt" + std::to_string(i), "", sizes[i]});
+  }
+  return items;
+}
+
+TEST(WorkCoordinatorTest, SortedUnitsTest) {
+  // The longest first, and the utterances done are skipped
+  wenet::WorkCoordinator coordinator(Items({1, 5, 3, 4, 2}), 2, {"utt3"},
+                                     60000);
+  ASSERT_EQ(coordinator.num_units(), 2);
+  int unit_id = -1;
+  std::vector<wenet::WorkItem> items;
+  ASSERT_EQ(coordinator.Fetch(&unit_id, &items),
+            wenet::WorkCoordinator::Status::kWork);
+  EXPECT_EQ(unit_id, 0);
+  ASSERT_EQ(items.size(), 2);
+  EXPECT_EQ(items[0].key, "utt1");
+  EXPECT_EQ(items[1].key, "utt2");
+  ASSERT_EQ(coordinator.Fetch(&unit_id, &items),
+            wenet::WorkCoordinator::Status::kWork);
+  EXPECT_EQ(unit_id, 1);
+  ASSERT_EQ(items.size(), 2);
+  EXPECT_EQ(items[0].key, "utt4");
+  EXPECT_EQ(items[1].key, "utt0");
+  // Both are in progress and not stealable yet
+  EXPECT_EQ(coordinator.Fetch(&unit_id, &items),
+            wenet::WorkCoordinator::Status::kWait);
+  EXPECT_TRUE(coordinator.Complete(0));
+  EXPECT_TRUE(coordinator.Complete(1));
+  EXPECT_EQ(coordinator.Fetch(&unit_id, &items),
+            wenet::WorkCoordinator::Status::kDone);
+  EXPECT_EQ(coordinator.num_stolen(), 0);
+}
+
+TEST(WorkCoordinatorTest, StealTest) {
+  wenet::WorkCoordinator coordinator(Items({3, 2, 1}), 1, {}, 0);
+  int unit_id = -1;
+  std::vector<wenet::WorkItem> items;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_EQ(coordinator.Fetch(&unit_id, &items),
+              wenet::WorkCoordinator::Status::kWork);
+  }
+  EXPECT_TRUE(coordinator.Complete(1));
+  // The idle worker takes the oldest unit in progress
+  ASSERT_EQ(coordinator.Fetch(&unit_id, &items),
+            wenet::WorkCoordinator::Status::kWork);
+  EXPECT_EQ(unit_id, 0);
+  EXPECT_EQ(items[0].key, "utt0");
+  ASSERT_EQ(coordinator.Fetch(&unit_id, &items),
+            wenet::WorkCoordinator::Status::kWork);
+  EXPECT_EQ(unit_id, 2);
+  EXPECT_EQ(coordinator.num_stolen(), 2);
+  // The first results of a unit are taken
+  EXPECT_TRUE(coordinator.Complete(0));
+  EXPECT_FALSE(coordinator.Complete(0));
+  EXPECT_FALSE(coordinator.Complete(1));
+  EXPECT_FALSE(coordinator.Complete(5));
+  EXPECT_TRUE(coordinator.Complete(2));
+  EXPECT_EQ(coordinator.num_completed(), 3);
+  EXPECT_EQ(coordinator.Fetch(&unit_id, &items),
+            wenet::WorkCoordinator::Status::kDone);
+}
+
+TEST(WorkCoordinatorTest, AllDoneTest) {
+  wenet::WorkCoordinator coordinator(Items({1, 2}), 4, {"utt0", "utt1"},
+                                     0);
+  EXPECT_EQ(coordinator.num_units(), 0);
+  int unit_id = -1;
+  std::vector<wenet::WorkItem> items;
+  EXPECT_EQ(coordinator.Fetch(&unit_id, &items),
+            wenet::WorkCoordinator::Status::kDone);
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/admission_control.h"
+
+#include <utility>
+
+#include "utils/load_monitor.h"
+#include "utils/log.h"
+#include "utils/memory_budget.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+AdmissionController::AdmissionController(
+    const AdmissionOptions& opts, std::function<float()> queue_depth,
+    std::function<int64_t()> session_bytes)
+    : opts_(opts),
+      queue_depth_(std::move(queue_depth)),
+      session_bytes_(std::move(session_bytes)),
+      num_sessions_(std::make_shared<std::atomic<int>>(0)),
+      tenants_(opts.tenant_quotas) {
+  if (queue_depth_ == nullptr) {
+    queue_depth_ = []() { return LoadMonitor::Instance().queue_depth(); };
+  }
+  if (session_bytes_ == nullptr) {
+    session_bytes_ = SessionMemoryTracker::TotalBytes;
+  }
+}
+
+AdmissionController::Ticket::Ticket(
+    std::shared_ptr<std::atomic<int>> num_sessions,
+    std::shared_ptr<Tenant> tenant)
+    : num_sessions_(std::move(num_sessions)), tenant_(std::move(tenant)) {
+  LoadMonitor::Instance().AddSessions(1);
+}
+
+AdmissionController::Ticket::~Ticket() {
+  tenant_->Leave();
+  num_sessions_->fetch_sub(1);
+  LoadMonitor::Instance().AddSessions(-1);
+}
+
+std::unique_ptr<AdmissionController::Ticket> AdmissionController::Admit(
+    const std::string& tenant, std::string* reason) {
+  static Counter* num_rejected = Metrics::Instance().GetCounter(
+      "wenet_rejected_sessions_total",
+      "Number of the sessions rejected by the admission control");
+  if (opts_.max_queue_depth > 0) {
+    float depth = queue_depth_();
+    if (depth > opts_.max_queue_depth) {
+      num_rejected->Increment();
+      *reason = "server overloaded, decode queue depth " +
+                std::to_string(depth);
+      return nullptr;
+    }
+  }
+  if (opts_.max_session_bytes > 0) {
+    int64_t bytes = session_bytes_();
+    if (bytes > opts_.max_session_bytes) {
+      num_rejected->Increment();
+      *reason = "server overloaded, sessions memory " +
+                std::to_string(bytes / (1024 * 1024)) + "MB";
+      return nullptr;
+    }
+  }
+  int num_sessions = num_sessions_->fetch_add(1) + 1;
+  if (opts_.max_sessions > 0 && num_sessions > opts_.max_sessions) {
+    num_sessions_->fetch_sub(1);
+    num_rejected->Increment();
+    *reason = "server overloaded, too many sessions";
+    return nullptr;
+  }
+  std::shared_ptr<Tenant> owner = tenants_.Get(tenant);
+  if (!owner->Enter(reason)) {
+    num_sessions_->fetch_sub(1);
+    num_rejected->Increment();
+    return nullptr;
+  }
+  return std::unique_ptr<Ticket>(new Ticket(num_sessions_, std::move(owner)));
+}
+
+bool AdmissionController::Overloaded(int num_queued_frames) const {
+  static Counter* num_overloaded = Metrics::Instance().GetCounter(
+      "wenet_overloaded_sessions_total",
+      "Number of the sessions terminated for the frames queued in them");
+  if (opts_.max_queued_frames > 0 &&
+      num_queued_frames > opts_.max_queued_frames) {
+    num_overloaded->Increment();
+    VLOG(1) << "Session overloaded by " << num_queued_frames
+            << " queued frames";
+    return true;
+  }
+  return false;
+}
+
+}  // namespace wenet
@@ -0,0 +1,112 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_ADMISSION_CONTROL_H_
+#define UTILS_ADMISSION_CONTROL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "utils/tenant_quota.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct AdmissionOptions {
+  // Max number of the concurrent sessions of the server, 0 for no limit
+  int max_sessions = 0;
+  // Max feature frames queued in a session for the decoder, over which the
+  // session is terminated as overloaded, 0 for no limit
+  int max_queued_frames = 0;
+  // Max pending decode tasks per decode thread of the server, see
+  // LoadMonitor::queue_depth, over which the new sessions are rejected,
+  // 0 for no limit
+  float max_queue_depth = 0;
+  // Max bytes of the states of all the live sessions, see
+  // SessionMemoryTracker, over which the new sessions are rejected, 0 for
+  // no limit
+  int64_t max_session_bytes = 0;
+  // The quotas of the tenants by the name, see TenantRegistry, the sessions
+  // are of the default tenant of no limit if it's empty
+  std::map<std::string, TenantQuota> tenant_quotas;
+};
+
+// AdmissionController decides whether a server takes a new session, by its
+// number of sessions, the depth of its decode queues, the memory of its
+// sessions and the quota of the tenant, and whether a running session
+// falls too far behind, so an overloaded server rejects
+// the sessions explicitly instead of queuing them without bound, and the
+// load balancer can route them elsewhere.
+class AdmissionController {
+ public:
+  // Held by an admitted session, which leaves when it's destroyed
+  class Ticket {
+   public:
+    ~Ticket();
+    // The tenant of the session, e.g. the task group of its decoding
+    Tenant* tenant() const { return tenant_.get(); }
+
+   private:
+    friend class AdmissionController;
+    // Counted in LoadMonitor::num_sessions as well for the load report
+    Ticket(std::shared_ptr<std::atomic<int>> num_sessions,
+           std::shared_ptr<Tenant> tenant);
+    std::shared_ptr<std::atomic<int>> num_sessions_;
+    std::shared_ptr<Tenant> tenant_;
+
+   public:
+    WENET_DISALLOW_COPY_AND_ASSIGN(Ticket);
+  };
+
+  // `queue_depth` is LoadMonitor::queue_depth and `session_bytes` is
+  // SessionMemoryTracker::TotalBytes by default
+  explicit AdmissionController(
+      const AdmissionOptions& opts,
+      std::function<float()> queue_depth = nullptr,
+      std::function<int64_t()> session_bytes = nullptr);
+
+  // The ticket of a new session of the `tenant`, or nullptr and the
+  // `reason` if it's rejected
+  std::unique_ptr<Ticket> Admit(const std::string& tenant,
+                                std::string* reason);
+  // Of the default tenant
+  std::unique_ptr<Ticket> Admit(std::string* reason) {
+    return Admit("", reason);
+  }
+  // Whether a session with `num_queued_frames` frames not yet decoded is
+  // overloaded
+  bool Overloaded(int num_queued_frames) const;
+
+  int num_sessions() const { return num_sessions_->load(); }
+  const AdmissionOptions& options() const { return opts_; }
+
+ private:
+  const AdmissionOptions opts_;
+  std::function<float()> queue_depth_;
+  std::function<int64_t()> session_bytes_;
+  std::shared_ptr<std::atomic<int>> num_sessions_;
+  TenantRegistry tenants_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AdmissionController);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_ADMISSION_CONTROL_H_
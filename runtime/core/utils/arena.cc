@@ -0,0 +1,65 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/arena.h"
+
+#include <algorithm>
+
+namespace wenet {
+
+const size_t Arena::kAlign;
+const size_t Arena::kMaxPooled;
+
+Arena::Arena(size_t block_size)
+    : block_size_(std::max(block_size, kMaxPooled)),
+      free_lists_(SizeClass(kMaxPooled) + 1, nullptr) {}
+
+void* Arena::Allocate(size_t bytes) {
+  if (bytes > kMaxPooled) return ::operator new(bytes);
+  size_t size_class = SizeClass(std::max<size_t>(bytes, 1));
+  used_bytes_ += size_class * kAlign;
+  void*& head = free_lists_[size_class];
+  if (head != nullptr) {
+    void* ptr = head;
+    head = *static_cast<void**>(ptr);
+    return ptr;
+  }
+  size_t size = size_class * kAlign;
+  if (remaining_ < size) {
+    // The rest of the last block is left, which is less than kMaxPooled
+    blocks_.emplace_back(new char[block_size_]);
+    cursor_ = blocks_.back().get();
+    remaining_ = block_size_;
+    capacity_ += block_size_;
+  }
+  void* ptr = cursor_;
+  cursor_ += size;
+  remaining_ -= size;
+  return ptr;
+}
+
+void Arena::Deallocate(void* ptr, size_t bytes) {
+  if (ptr == nullptr) return;
+  if (bytes > kMaxPooled) {
+    ::operator delete(ptr);
+    return;
+  }
+  size_t size_class = SizeClass(std::max<size_t>(bytes, 1));
+  used_bytes_ -= size_class * kAlign;
+  void*& head = free_lists_[size_class];
+  *static_cast<void**>(ptr) = head;
+  head = ptr;
+}
+
+}  // namespace wenet
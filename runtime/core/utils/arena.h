@@ -0,0 +1,118 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_ARENA_H_
+#define UTILS_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The memory of a session, e.g. the nodes of the hash maps of its search,
+// carved from the blocks of its own instead of the global heap, as
+// std::pmr::unsynchronized_pool_resource of C++17. The freed allocations are
+// kept in free lists by their size, so the maps cleared per frame reuse the
+// nodes of the last frame without the malloc traffic, and the blocks are
+// only returned to the heap with the arena. The allocations larger than
+// kMaxPooled, e.g. the bucket arrays of the big maps, are from the heap.
+// Not thread safe, it's used by the decoding thread of the session only.
+class Arena {
+ public:
+  static const size_t kAlign = alignof(std::max_align_t);
+  static const size_t kMaxPooled = 1024;
+
+  explicit Arena(size_t block_size = 64 * 1024);
+
+  void* Allocate(size_t bytes);
+  void Deallocate(void* ptr, size_t bytes);
+
+  // Bytes of the blocks, and the ones of the pooled allocations in use
+  int64_t capacity() const { return capacity_; }
+  int64_t used_bytes() const { return used_bytes_; }
+
+ private:
+  static size_t SizeClass(size_t bytes) {
+    return (bytes + kAlign - 1) / kAlign;
+  }
+
+  const size_t block_size_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  // The free space of the last block
+  char* cursor_ = nullptr;
+  size_t remaining_ = 0;
+  // The heads of the free lists by the size class, the next pointer of a
+  // free allocation is kept in itself
+  std::vector<void*> free_lists_;
+  int64_t capacity_ = 0;
+  int64_t used_bytes_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// The STL allocator of an Arena, or of the heap if the arena is nullptr, so
+// the containers of the Arena are still usable without one, e.g.
+//   std::unordered_map<int, float, std::hash<int>, std::equal_to<int>,
+//                      ArenaAllocator<std::pair<const int, float>>>
+//       map(0, std::hash<int>(), std::equal_to<int>(),
+//           ArenaAllocator<std::pair<const int, float>>(arena));
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+  static_assert(alignof(T) <= Arena::kAlign, "over aligned type");
+
+  explicit ArenaAllocator(Arena* arena = nullptr) : arena_(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other)  // NOLINT
+      : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    size_t bytes = n * sizeof(T);
+    void* ptr = arena_ != nullptr ? arena_->Allocate(bytes)
+                                  : ::operator new(bytes);
+    return static_cast<T*>(ptr);
+  }
+  void deallocate(T* ptr, size_t n) {
+    if (arena_ != nullptr) {
+      arena_->Deallocate(ptr, n * sizeof(T));
+    } else {
+      ::operator delete(ptr);
+    }
+  }
+
+  Arena* arena() const { return arena_; }
+
+ private:
+  Arena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return !(a == b);
+}
+
+}  // namespace wenet
+
+#endif  // UTILS_ARENA_H_
@@ -0,0 +1,118 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/benchmark.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "utils/json.h"
+#include "utils/json_writer.h"
+#include "utils/string.h"
+
+namespace wenet {
+
+std::string BenchResultsToJson(const std::vector<BenchResult>& results) {
+  JsonWriter writer;
+  writer.StartObject().Key("scenarios").StartArray();
+  for (const auto& result : results) {
+    writer.StartObject().Key("name").String(result.scenario);
+    writer.Key("metrics").StartObject();
+    for (const auto& metric : result.metrics) {
+      writer.Key(metric.first.c_str()).Double(metric.second);
+    }
+    writer.EndObject().EndObject();
+  }
+  writer.EndArray().EndObject();
+  return writer.str();
+}
+
+bool ParseBenchResults(const std::string& text,
+                       std::vector<BenchResult>* results) {
+  json::JSON root = json::JSON::Load(text);
+  if (!root.hasKey("scenarios")) return false;
+  const json::JSON& scenarios = root["scenarios"];
+  if (scenarios.JSONType() != json::JSON::Class::Array) return false;
+  results->clear();
+  for (const auto& scenario : scenarios.ArrayRange()) {
+    if (!scenario.hasKey("name") || !scenario.hasKey("metrics")) return false;
+    BenchResult result;
+    result.scenario = scenario.at("name").ToString();
+    for (const auto& metric : scenario.at("metrics").ObjectRange()) {
+      bool ok = false;
+      double value = metric.second.ToFloat(&ok);
+      if (!ok) value = metric.second.ToInt(&ok);
+      // The null of a nan is skipped
+      if (ok) result.metrics[metric.first] = value;
+    }
+    results->push_back(std::move(result));
+  }
+  return true;
+}
+
+bool ParseBenchThresholds(const std::string& spec,
+                          BenchThresholds* thresholds) {
+  std::vector<std::string> items;
+  SplitStringToVector(spec, ",", true, &items);
+  for (const auto& item : items) {
+    size_t pos = item.find('=');
+    if (pos == std::string::npos) return false;
+    char* end = nullptr;
+    std::string value = item.substr(pos + 1);
+    double threshold = strtod(value.c_str(), &end);
+    if (end == value.c_str() || *end != '\0') return false;
+    std::string name = Trim(item.substr(0, pos));
+    if (name == "default") {
+      thresholds->default_threshold = threshold;
+    } else {
+      thresholds->metrics[name] = threshold;
+    }
+  }
+  return true;
+}
+
+bool HigherIsBetter(const std::string& metric) {
+  return metric.compare(0, 10, "throughput") == 0;
+}
+
+std::vector<std::string> CompareBenchResults(
+    const BenchResult& result, const BenchResult& baseline,
+    const BenchThresholds& thresholds) {
+  std::vector<std::string> regressions;
+  for (const auto& metric : result.metrics) {
+    auto base = baseline.metrics.find(metric.first);
+    if (base == baseline.metrics.end()) continue;
+    auto it = thresholds.metrics.find(metric.first);
+    double threshold =
+        it != thresholds.metrics.end() ? it->second
+                                       : thresholds.default_threshold;
+    if (threshold < 0) continue;
+    bool regressed =
+        HigherIsBetter(metric.first)
+            ? metric.second < base->second * (1 - threshold)
+            : metric.second > base->second * (1 + threshold);
+    if (regressed) {
+      char buffer[256];
+      snprintf(buffer, sizeof(buffer),
+               "%s %s regressed from %.4g to %.4g, over %.0f%%",
+               result.scenario.c_str(), metric.first.c_str(), base->second,
+               metric.second, threshold * 100);
+      regressions.emplace_back(buffer);
+    }
+  }
+  return regressions;
+}
+
+}  // namespace wenet
@@ -0,0 +1,59 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_BENCHMARK_H_
+#define UTILS_BENCHMARK_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace wenet {
+
+// The metrics of a scenario of wenet_bench, e.g. "rtf", "throughput" and
+// "chunk_latency_p99_ms"
+struct BenchResult {
+  std::string scenario;
+  std::map<std::string, double> metrics;
+};
+
+// The relative regression allowed of each metric, e.g. 0.1 for 10%, the
+// metrics not in it are compared by `default_threshold`, unless it's < 0
+struct BenchThresholds {
+  std::map<std::string, double> metrics;
+  double default_threshold = 0.1;
+};
+
+// {"scenarios": [{"name": ..., "metrics": {...}}, ...]}, which is also the
+// baseline file
+std::string BenchResultsToJson(const std::vector<BenchResult>& results);
+bool ParseBenchResults(const std::string& json,
+                       std::vector<BenchResult>* results);
+
+// Parse "rtf=0.05,chunk_latency_p99_ms=0.2" on top of `thresholds`
+bool ParseBenchThresholds(const std::string& spec, BenchThresholds* thresholds);
+
+// Whether the larger of the metric is the better, e.g. the throughput
+bool HigherIsBetter(const std::string& metric);
+
+// One message per metric of `result` regressed beyond its threshold from
+// `baseline`, the metrics missing in either of them are not compared
+std::vector<std::string> CompareBenchResults(const BenchResult& result,
+                                             const BenchResult& baseline,
+                                             const BenchThresholds& thresholds);
+
+}  // namespace wenet
+
+#endif  // UTILS_BENCHMARK_H_
@@ -0,0 +1,43 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/chunk_deadline.h"
+
+#include <utility>
+
+#include "utils/metrics.h"
+
+namespace wenet {
+
+void ChunkDeadline::Post(ThreadPool* pool, std::function<void()> task) const {
+  if (enabled()) {
+    pool->post_by_deadline(due_, std::move(task), group_);
+  } else if (group_ != nullptr) {
+    pool->post_by_deadline(Clock::now(), std::move(task), group_);
+  } else {
+    pool->post(TaskPriority::kHigh, std::move(task));
+  }
+}
+
+bool ChunkDeadline::Take() {
+  static Counter* num_late = Metrics::Instance().GetCounter(
+      "wenet_late_decode_tasks_total",
+      "Number of the decoding tasks started past the deadline of the audio");
+  bool late = enabled() && pending_ && Clock::now() > due_;
+  pending_ = false;
+  if (late) num_late->Increment();
+  return late;
+}
+
+}  // namespace wenet
@@ -0,0 +1,66 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_CHUNK_DEADLINE_H_
+#define UTILS_CHUNK_DEADLINE_H_
+
+#include <chrono>
+#include <functional>
+
+#include "utils/thread_pool.h"
+
+namespace wenet {
+
+// The real time deadline of the decoding of a streaming session on a shared
+// decode pool: the audio not decoded yet is due by the arrival time of the
+// oldest of it plus the latency target, so the decoding tasks of the
+// sessions already behind are run before the ones of the sessions which
+// just got their audio, see ThreadPool::post_by_deadline. It's not thread
+// safe, it's guarded by the decoding state of the session, e.g.
+//   OnAudio:     deadline.OnAudio(); if (!decoding) deadline.Post(pool, f);
+//   the task f:  decoder->set_late(deadline.Take()); decode what's there
+class ChunkDeadline {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // 0 disables it, the tasks are posted at the high priority as they come
+  explicit ChunkDeadline(int latency_ms) : latency_(latency_ms) {}
+
+  bool enabled() const { return latency_.count() > 0; }
+  // The tasks share the pool with the other groups by fair share, e.g. the
+  // sessions of the tenant, see ThreadPool::post_by_deadline. They're then
+  // in the order of their posting if it's not enabled.
+  void set_group(TaskGroup* group) { group_ = group; }
+  // New audio arrived, it's due now plus the latency if none was pending
+  void OnAudio() {
+    if (pending_) return;
+    pending_ = true;
+    due_ = Clock::now() + latency_;
+  }
+  // Post the decoding task of the audio pending to the pool
+  void Post(ThreadPool* pool, std::function<void()> task) const;
+  // All the audio arrived so far is taken by the decoding, return whether
+  // it's already past its deadline, which is counted in the metrics
+  bool Take();
+
+ private:
+  const std::chrono::milliseconds latency_;
+  TaskGroup* group_ = nullptr;
+  bool pending_ = false;
+  Clock::time_point due_;
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_CHUNK_DEADLINE_H_
@@ -0,0 +1,122 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/cpu_affinity.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <utility>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "utils/log.h"
+#include "utils/string.h"
+
+namespace wenet {
+
+std::vector<int> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::vector<std::string> ranges;
+  SplitStringToVector(Trim(list), ",", true, &ranges);
+  for (const auto& range : ranges) {
+    size_t dash = range.find('-');
+    int first = atoi(range.c_str());
+    int last =
+        dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+    for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<std::vector<int>> GetNumaNodeCpus() {
+  std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+  const std::string root = "/sys/devices/system/node/";
+  std::vector<int> ids;
+  DIR* dir = opendir(root.c_str());
+  if (dir != nullptr) {
+    while (struct dirent* entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+          isdigit(name[4])) {
+        ids.push_back(atoi(name.c_str() + 4));
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(ids.begin(), ids.end());
+  for (int id : ids) {
+    std::ifstream is(root + "node" + std::to_string(id) + "/cpulist");
+    std::string list;
+    if (!std::getline(is, list)) continue;
+    std::vector<int> cpus = ParseCpuList(list);
+    // A node of memory only has no cpu
+    if (!cpus.empty()) nodes.emplace_back(std::move(cpus));
+  }
+#endif
+  if (nodes.empty()) {
+    std::vector<int> cpus(std::max(std::thread::hardware_concurrency(), 1u));
+    for (size_t i = 0; i < cpus.size(); ++i) cpus[i] = i;
+    nodes.emplace_back(std::move(cpus));
+  }
+  return nodes;
+}
+
+#ifdef __linux__
+static bool SetAffinity(pthread_t thread, const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  int ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+  if (ret != 0) {
+    LOG(WARNING) << "Failed to pin the thread to " << cpus.size() << " cpus";
+  }
+  return ret == 0;
+}
+#endif
+
+bool PinCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+  return SetAffinity(pthread_self(), cpus);
+#else
+  return false;
+#endif
+}
+
+bool PinThread(std::thread* thread, const std::vector<int>& cpus) {
+#ifdef __linux__
+  return SetAffinity(thread->native_handle(), cpus);
+#else
+  return false;
+#endif
+}
+
+void RunOnCpus(const std::vector<int>& cpus,
+               const std::function<void()>& func) {
+  std::thread thread([&]() {
+    PinCurrentThread(cpus);
+    func();
+  });
+  thread.join();
+}
+
+}  // namespace wenet
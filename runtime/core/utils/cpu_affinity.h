@@ -0,0 +1,45 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_CPU_AFFINITY_H_
+#define UTILS_CPU_AFFINITY_H_
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wenet {
+
+// Parse a cpu list of the kernel, e.g. "0-3,8,10-11"
+std::vector<int> ParseCpuList(const std::string& list);
+
+// The cpus of each NUMA node, from /sys/devices/system/node on Linux. It's
+// one node of all the cpus if there is no NUMA information.
+std::vector<std::vector<int>> GetNumaNodeCpus();
+
+// Pin a thread to the cpus, return false if it fails or it's not supported
+// on the platform. The threads created by a pinned thread inherit its
+// affinity, e.g. the intra-op threads of libtorch and onnxruntime.
+bool PinCurrentThread(const std::vector<int>& cpus);
+bool PinThread(std::thread* thread, const std::vector<int>& cpus);
+
+// Run `func` on a thread pinned to `cpus` and wait for it. The memory it
+// allocates, e.g. the weights of a model, is placed on the NUMA node of
+// the cpus by the first touch policy of the kernel.
+void RunOnCpus(const std::vector<int>& cpus, const std::function<void()>& func);
+
+}  // namespace wenet
+
+#endif  // UTILS_CPU_AFFINITY_H_
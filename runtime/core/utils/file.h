@@ -15,6 +15,8 @@
 #ifndef UTILS_FILE_H_
 #define UTILS_FILE_H_
 
+#include <sys/stat.h>
+
 #include <fstream>
 #include <string>
 
@@ -25,6 +27,15 @@ inline bool FileExists(const std::string& path) {
   return f.good();
 }
 
+// Whether path exists and is not older than source, e.g. a cache built
+// from the source
+inline bool FileUpToDate(const std::string& path, const std::string& source) {
+  struct stat path_stat, source_stat;
+  if (stat(path.c_str(), &path_stat) != 0) return false;
+  return stat(source.c_str(), &source_stat) != 0 ||
+         path_stat.st_mtime >= source_stat.st_mtime;
+}
+
 }  // namespace wenet
 
 #endif  // UTILS_FILE_H_
@@ -0,0 +1,89 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/fst_io.h"
+
+#include <fstream>
+
+#include "utils/huge_pages.h"
+#include "utils/log.h"
+#include "utils/quantized_fst.h"
+
+namespace wenet {
+
+// So that Fst::Read knows the graph converted by fstquantize
+static fst::FstRegisterer<QuantizedFst> QuantizedFst_registerer;
+
+std::shared_ptr<fst::Fst<fst::StdArc>> ReadFst(const std::string& path,
+                                               bool mmap, uint64_t offset) {
+  std::ifstream strm(path, std::ios_base::in | std::ios_base::binary);
+  if (offset > 0) strm.seekg(offset);
+  if (!strm) {
+    LOG(ERROR) << "Can't open fst " << path;
+    return nullptr;
+  }
+  // The source is required by MAP mode, the file is mapped by the name and
+  // the position of the stream
+  fst::FstReadOptions opts(path);
+  opts.mode = mmap ? fst::FstReadOptions::MAP : fst::FstReadOptions::READ;
+  std::shared_ptr<fst::Fst<fst::StdArc>> graph(
+      fst::Fst<fst::StdArc>::Read(strm, opts));
+  // QuantizedFst is a compact fst, whose type starts with "compact"
+  if (graph != nullptr && mmap && graph->Type() != "const" &&
+      graph->Type().compare(0, 7, "compact") != 0) {
+    LOG(INFO) << path << " is a " << graph->Type() << " fst, which can't be "
+              << "memory mapped, convert it by fsttoconst to share it "
+              << "across processes";
+  }
+  return graph;
+}
+
+bool AdviseFstHugePages(const fst::Fst<fst::StdArc>& graph) {
+  if (graph.Type() != "const") return false;
+  // The arcs of all the states are in one array of the ConstFst
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  for (fst::StateIterator<fst::Fst<fst::StdArc>> siter(graph); !siter.Done();
+       siter.Next()) {
+    fst::ArcIteratorData<fst::StdArc> data;
+    graph.InitArcIterator(siter.Value(), &data);
+    if (data.narcs == 0) continue;
+    const char* arcs = reinterpret_cast<const char*>(data.arcs);
+    if (begin == nullptr || arcs < begin) begin = arcs;
+    const char* arcs_end =
+        reinterpret_cast<const char*>(data.arcs + data.narcs);
+    if (arcs_end > end) end = arcs_end;
+  }
+  if (begin == nullptr) return false;
+  bool advised = AdviseHugePages(begin, end - begin);
+  LOG(INFO) << "Advise " << ((end - begin) >> 20) << "MB of the arcs to the "
+            << "huge pages" << (advised ? "" : ", which is not supported");
+  return advised;
+}
+
+std::shared_ptr<fst::Fst<fst::StdArc>> ComposeLazily(
+    const fst::Fst<fst::StdArc>& tl, const fst::Fst<fst::StdArc>& g,
+    size_t cache_size) {
+  // The default matcher of ComposeFst requires one of them to be sorted
+  if (tl.Properties(fst::kOLabelSorted, true) == 0 &&
+      g.Properties(fst::kILabelSorted, true) == 0) {
+    LOG(ERROR) << "Neither TL is sorted by the output labels nor G is sorted "
+               << "by the input labels, sort them by fstarcsort";
+    return nullptr;
+  }
+  fst::CacheOptions opts(true, cache_size);
+  return std::make_shared<fst::ComposeFst<fst::StdArc>>(tl, g, opts);
+}
+
+}  // namespace wenet
@@ -0,0 +1,54 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_FST_IO_H_
+#define UTILS_FST_IO_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "fst/fstlib.h"
+
+namespace wenet {
+
+// Read the decoding graph. If mmap is true and the graph is an aligned
+// ConstFst(see kaldi/fstbin/fsttoconst) or QuantizedFst(see
+// kaldi/fstbin/fstquantize), its arrays are memory mapped
+// read-only instead of read to the heap, so the processes which load the
+// same graph share its pages and the loading is almost free. Other graphs
+// are read as usual. The graph starts at offset of the file, e.g. in a
+// section of a ModelBundle. Returns nullptr on failure.
+std::shared_ptr<fst::Fst<fst::StdArc>> ReadFst(const std::string& path,
+                                               bool mmap = true,
+                                               uint64_t offset = 0);
+
+// Advise the arcs of a ConstFst read to the heap, i.e. not mapped, to the
+// transparent huge pages, see AdviseHugePages, so the arc traversal of the
+// search over a large graph misses the TLB much less. Returns false for the
+// other graphs, or if it's not supported.
+bool AdviseFstHugePages(const fst::Fst<fst::StdArc>& graph);
+
+// Compose tl(T o L, sorted by the output labels) with g(G, sorted by the input
+// labels) on the fly, so the static TLG isn't built and G can be swapped
+// without rebuilding the graph. The states are expanded when the search
+// visits them, and garbage collected when the cache of each copy of the
+// graph exceeds cache_size bytes. Returns nullptr on failure.
+std::shared_ptr<fst::Fst<fst::StdArc>> ComposeLazily(
+    const fst::Fst<fst::StdArc>& tl, const fst::Fst<fst::StdArc>& g,
+    size_t cache_size);
+
+}  // namespace wenet
+
+#endif  // UTILS_FST_IO_H_
@@ -0,0 +1,185 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/huge_pages.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+namespace {
+
+const size_t k2M = static_cast<size_t>(1) << 21;
+const size_t k1G = static_cast<size_t>(1) << 30;
+
+// Before the data of each buffer, which is how Free() knows how it's
+// allocated
+struct Header {
+  void* base;
+  // 0 if it's malloc'd, or the mapped bytes from base
+  size_t mapped;
+};
+static_assert(sizeof(Header) <= HugePageAllocator::kAlignment,
+              "Header is larger than the alignment");
+
+Gauge* HugePageBytes() {
+  static Gauge* bytes = Metrics::Instance().GetGauge(
+      "wenet_huge_page_bytes",
+      "Bytes of the buffers of the model runtimes in the huge pages");
+  return bytes;
+}
+
+size_t RoundUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+#ifdef __linux__
+// The mapping of the reserved huge pages of page_bytes, nullptr if there are
+// not enough of them
+void* MapHugeTlb(size_t size, size_t page_bytes) {
+#ifdef MAP_HUGETLB
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+  flags |= (page_bytes == k1G ? 30 : 21) << MAP_HUGE_SHIFT;
+#endif
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  return base == MAP_FAILED ? nullptr : base;
+#else
+  return nullptr;
+#endif
+}
+
+// The 2M aligned mapping of the regular pages, which is advised to the
+// transparent huge pages before any of them is touched
+void* MapTransparent(size_t size) {
+  size_t padded = size + k2M;
+  void* map = mmap(nullptr, padded, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return nullptr;
+  char* start = static_cast<char*>(map);
+  char* base = reinterpret_cast<char*>(
+      RoundUp(reinterpret_cast<uintptr_t>(start), k2M));
+  if (base > start) munmap(start, base - start);
+  size_t tail = (start + padded) - (base + size);
+  if (tail > 0) munmap(base + size, tail);
+#ifdef MADV_HUGEPAGE
+  madvise(base, size, MADV_HUGEPAGE);
+#endif
+  return base;
+}
+#endif
+
+}  // namespace
+
+bool ParseHugePageSize(const std::string& name, HugePageSize* size) {
+  if (name.empty() || name == "none") {
+    *size = HugePageSize::kNone;
+  } else if (name == "2m") {
+    *size = HugePageSize::k2M;
+  } else if (name == "1g") {
+    *size = HugePageSize::k1G;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+HugePageAllocator& HugePageAllocator::Instance() {
+  static HugePageAllocator* allocator = new HugePageAllocator();
+  return *allocator;
+}
+
+void* HugePageAllocator::Allocate(size_t size) const {
+  const size_t total = size + kAlignment;
+  char* base = nullptr;
+  size_t mapped = 0;
+#ifdef __linux__
+  if (page_size_ != HugePageSize::kNone && total >= k2M) {
+    // The 1G pages are only for the buffers of at least 1G, so most of the
+    // page isn't wasted
+    size_t page_bytes =
+        page_size_ == HugePageSize::k1G && total >= k1G ? k1G : k2M;
+    mapped = RoundUp(total, page_bytes);
+    base = static_cast<char*>(MapHugeTlb(mapped, page_bytes));
+    if (base == nullptr && page_bytes == k1G) {
+      mapped = RoundUp(total, k2M);
+      base = static_cast<char*>(MapHugeTlb(mapped, k2M));
+    }
+    if (base == nullptr) {
+      static bool logged = false;
+      if (!logged) {
+        logged = true;
+        LOG(INFO) << "No reserved huge pages of a " << (total >> 20)
+                  << "MB buffer, use the transparent huge pages";
+      }
+      mapped = RoundUp(total, k2M);
+      base = static_cast<char*>(MapTransparent(mapped));
+    }
+    if (base == nullptr) mapped = 0;
+  }
+#endif
+  if (base == nullptr) {
+    base = static_cast<char*>(malloc(total + kAlignment));
+    if (base == nullptr) return nullptr;
+  }
+  char* data = reinterpret_cast<char*>(
+      RoundUp(reinterpret_cast<uintptr_t>(base) + sizeof(Header),
+              kAlignment));
+  Header* header = reinterpret_cast<Header*>(data) - 1;
+  header->base = base;
+  header->mapped = mapped;
+  if (mapped > 0) HugePageBytes()->Add(mapped);
+  return data;
+}
+
+void HugePageAllocator::Free(void* data) {
+  if (data == nullptr) return;
+  const Header* header = static_cast<const Header*>(data) - 1;
+  if (header->mapped == 0) {
+    free(header->base);
+    return;
+  }
+  HugePageBytes()->Add(-static_cast<int64_t>(header->mapped));
+#ifdef __linux__
+  munmap(header->base, header->mapped);
+#endif
+}
+
+bool AdviseHugePages(const void* data, size_t size) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  uintptr_t begin = RoundUp(reinterpret_cast<uintptr_t>(data), k2M);
+  uintptr_t end = (reinterpret_cast<uintptr_t>(data) + size) / k2M * k2M;
+  if (begin >= end) return false;
+  void* start = reinterpret_cast<void*>(begin);
+  if (madvise(start, end - begin, MADV_HUGEPAGE) != 0) return false;
+#ifdef MADV_COLLAPSE
+  // Fails on the kernels before it, whose khugepaged collapses them later
+  madvise(start, end - begin, MADV_COLLAPSE);
+#endif
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace wenet
@@ -0,0 +1,70 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_HUGE_PAGES_H_
+#define UTILS_HUGE_PAGES_H_
+
+#include <cstddef>
+#include <string>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+enum class HugePageSize {
+  kNone,
+  k2M,
+  k1G,
+};
+
+// "none"(or empty), "2m" or "1g", false for the others
+bool ParseHugePageSize(const std::string& name, HugePageSize* size);
+
+// HugePageAllocator allocates the large buffers, e.g. the weights of the
+// model runtimes, by the huge pages, so the GEMMs over them miss the TLB much
+// less. A buffer of at least a huge page is mapped from the reserved huge
+// pages(see /proc/sys/vm/nr_hugepages), the 1G ones if it's that large and
+// they're asked for, or else by the transparent huge pages, or else by the
+// regular pages if they're not enabled either. The smaller ones are
+// malloc'd. All are aligned to kAlignment.
+class HugePageAllocator {
+ public:
+  static const size_t kAlignment = 64;
+
+  // The one of the model runtimes, which is kNone until it's set
+  static HugePageAllocator& Instance();
+
+  HugePageSize page_size() const { return page_size_; }
+  void set_page_size(HugePageSize page_size) { page_size_ = page_size; }
+
+  // nullptr on failure
+  void* Allocate(size_t size) const;
+  // The buffer of Allocate() of any HugePageAllocator, or nullptr
+  static void Free(void* data);
+
+ private:
+  HugePageSize page_size_ = HugePageSize::kNone;
+};
+
+// Ask the kernel to back the memory of [data, data + size) by the
+// transparent huge pages, and to collapse its pages at once where it's
+// supported(Linux 6.1), otherwise khugepaged collapses them in the
+// background. Only the 2M aligned pages inside are advised. Returns false if
+// it's not supported or the transparent huge pages are disabled.
+bool AdviseHugePages(const void* data, size_t size);
+
+}  // namespace wenet
+
+#endif  // UTILS_HUGE_PAGES_H_
@@ -0,0 +1,152 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_JSON_WRITER_H_
+#define UTILS_JSON_WRITER_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace wenet {
+
+// JsonWriter writes JSON straight into its buffer, which is reused after
+// Clear(), so no DOM is built and nothing is allocated per message once the
+// buffer has grown to the size of the messages. The commas are inserted as
+// the values are written, e.g.
+//   writer.StartObject().Key("status").String("ok").EndObject();
+class JsonWriter {
+ public:
+  void Clear() {
+    out_.clear();
+    need_comma_ = false;
+  }
+  const std::string& str() const { return out_; }
+
+  JsonWriter& StartObject() { return Open('{'); }
+  JsonWriter& EndObject() { return Close('}'); }
+  JsonWriter& StartArray() { return Open('['); }
+  JsonWriter& EndArray() { return Close(']'); }
+
+  JsonWriter& Key(const char* key) {
+    String(key, std::char_traits<char>::length(key));
+    out_ += ':';
+    need_comma_ = false;
+    return *this;
+  }
+  JsonWriter& String(const std::string& value) {
+    return String(value.data(), value.size());
+  }
+  JsonWriter& String(const char* data, size_t size) {
+    Separate();
+    out_ += '"';
+    AppendEscaped(data, size, &out_);
+    out_ += '"';
+    need_comma_ = true;
+    return *this;
+  }
+  JsonWriter& Int(int64_t value) {
+    Separate();
+    char buffer[24];
+    int size = snprintf(buffer, sizeof(buffer), "%lld",
+                        static_cast<long long>(value));  // NOLINT
+    out_.append(buffer, size);
+    need_comma_ = true;
+    return *this;
+  }
+  // Null for the nan and the infinities, which JSON doesn't have
+  JsonWriter& Double(double value) {
+    Separate();
+    if (std::isfinite(value)) {
+      char buffer[32];
+      int size = snprintf(buffer, sizeof(buffer), "%.6g", value);
+      out_.append(buffer, size);
+    } else {
+      out_ += "null";
+    }
+    need_comma_ = true;
+    return *this;
+  }
+  JsonWriter& Bool(bool value) {
+    Separate();
+    out_ += value ? "true" : "false";
+    need_comma_ = true;
+    return *this;
+  }
+
+  // Append the escaped string without the quotes
+  static void AppendEscaped(const char* data, size_t size, std::string* out) {
+    static const char kHex[] = "0123456789abcdef";
+    size_t start = 0;
+    for (size_t i = 0; i < size; ++i) {
+      unsigned char c = data[i];
+      if (c >= 0x20 && c != '"' && c != '\\') continue;
+      out->append(data + start, i - start);
+      start = i + 1;
+      switch (c) {
+        case '"':
+          *out += "\\\"";
+          break;
+        case '\\':
+          *out += "\\\\";
+          break;
+        case '\b':
+          *out += "\\b";
+          break;
+        case '\f':
+          *out += "\\f";
+          break;
+        case '\n':
+          *out += "\\n";
+          break;
+        case '\r':
+          *out += "\\r";
+          break;
+        case '\t':
+          *out += "\\t";
+          break;
+        default:
+          *out += "\\u00";
+          *out += kHex[c >> 4];
+          *out += kHex[c & 0xf];
+          break;
+      }
+    }
+    out->append(data + start, size - start);
+  }
+
+ private:
+  void Separate() {
+    if (need_comma_) out_ += ',';
+  }
+  JsonWriter& Open(char c) {
+    Separate();
+    out_ += c;
+    need_comma_ = false;
+    return *this;
+  }
+  JsonWriter& Close(char c) {
+    out_ += c;
+    need_comma_ = true;
+    return *this;
+  }
+
+  std::string out_;
+  bool need_comma_ = false;
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_JSON_WRITER_H_
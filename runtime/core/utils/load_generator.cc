@@ -0,0 +1,309 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/load_generator.h"
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <queue>
+#include <random>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+class LoadGenerator::Session : public LoadStreamListener {
+ public:
+  Session(LoadGenerator* generator, const std::vector<int16_t>* wave)
+      : generator_(generator), wave(wave) {}
+
+  void OnReady() override {
+    std::lock_guard<std::mutex> lock(generator_->mutex_);
+    if (done || ready) return;
+    ready = true;
+    ready_time = Clock::now();
+    deadline = Clock::time_point::max();
+    generator_->OnSessionReady(this);
+  }
+
+  void OnPartial() override {
+    std::lock_guard<std::mutex> lock(generator_->mutex_);
+    if (done || has_partial || !ready) return;
+    has_partial = true;
+    first_partial_time = Clock::now();
+  }
+
+  void OnFinal() override {
+    std::lock_guard<std::mutex> lock(generator_->mutex_);
+    if (done) return;
+    if (!has_partial && ready) {
+      has_partial = true;
+      first_partial_time = Clock::now();
+    }
+    // Only the finals after the end signal count for the final latency,
+    // there are finals before it in the continuous decoding
+    if (end_sent) {
+      has_final = true;
+      final_time = Clock::now();
+    }
+  }
+
+  void OnDone(bool ok, const std::string& error) override {
+    std::lock_guard<std::mutex> lock(generator_->mutex_);
+    if (done) return;
+    generator_->OnSessionDone(this, ok, error);
+  }
+
+ private:
+  LoadGenerator* generator_;
+
+ public:
+  // The members are guarded by the mutex of the generator, except `stream`
+  // and `offset` which are only touched by the pacing thread.
+  const std::vector<int16_t>* wave;
+  std::shared_ptr<LoadStream> stream;
+  size_t offset = 0;
+  bool ready = false;
+  bool has_partial = false;
+  bool end_sent = false;
+  bool has_final = false;
+  bool done = false;
+  Clock::time_point start_time;
+  Clock::time_point ready_time;
+  Clock::time_point first_partial_time;
+  Clock::time_point end_time;
+  Clock::time_point final_time;
+  // The session fails if it's not ready or done by then
+  Clock::time_point deadline = Clock::time_point::max();
+};
+
+static double MsBetween(std::chrono::steady_clock::time_point a,
+                        std::chrono::steady_clock::time_point b) {
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+LoadGenerator::LoadGenerator(
+    const LoadOptions& opts,
+    std::vector<std::shared_ptr<std::vector<int16_t>>> waves, int sample_rate)
+    : opts_(opts), waves_(std::move(waves)), sample_rate_(sample_rate) {
+  CHECK(!waves_.empty());
+  CHECK_GT(opts_.num_streams, 0);
+  CHECK_GT(opts_.max_concurrency, 0);
+  CHECK_GT(opts_.chunk_ms, 0);
+}
+
+LoadGenerator::~LoadGenerator() = default;
+
+void LoadGenerator::OnSessionReady(Session* session) {
+  ready_.push_back(session);
+  cv_.notify_one();
+}
+
+void LoadGenerator::OnSessionDone(Session* session, bool ok,
+                                  const std::string& error) {
+  Clock::time_point now = Clock::now();
+  session->done = true;
+  --num_in_flight_;
+  ++num_done_;
+  finished_.push_back(session);
+  if (ok && session->ready) {
+    ready_ms_.push_back(MsBetween(session->start_time, session->ready_time));
+    if (session->has_partial) {
+      first_partial_ms_.push_back(
+          MsBetween(session->ready_time, session->first_partial_time));
+    }
+    if (session->end_sent) {
+      final_ms_.push_back(MsBetween(
+          session->end_time, session->has_final ? session->final_time : now));
+    }
+    audio_ms_ += session->wave->size() * 1000.0 / sample_rate_;
+  } else {
+    ++num_failed_;
+    ++errors_[ok ? "done before ready" : error];
+    VLOG(1) << "Stream failed: " << error;
+  }
+  cv_.notify_one();
+}
+
+LoadGenerator::Clock::time_point LoadGenerator::SendNext(Session* session) {
+  const int chunk_samples = sample_rate_ / 1000 * opts_.chunk_ms;
+  const std::vector<int16_t>& wave = *session->wave;
+  Clock::time_point now = Clock::now();
+  if (session->offset < wave.size()) {
+    int size = std::min<size_t>(chunk_samples, wave.size() - session->offset);
+    session->stream->SendAudio(wave.data() + session->offset, size);
+    session->offset += size;
+    if (opts_.pace <= 0) return now;
+    return now + std::chrono::microseconds(
+                     static_cast<int64_t>(opts_.chunk_ms * 1000 / opts_.pace));
+  }
+  session->stream->SendEnd();
+  std::lock_guard<std::mutex> lock(mutex_);
+  session->end_sent = true;
+  session->end_time = now;
+  session->deadline = now + std::chrono::milliseconds(opts_.timeout_ms);
+  return Clock::time_point::max();
+}
+
+void LoadGenerator::Run(const LoadStreamFactory& factory) {
+  using Queue = std::priority_queue<SessionTime, std::vector<SessionTime>,
+                                    std::greater<SessionTime>>;
+  // Only touched by this thread
+  Queue sends;
+  Queue deadlines;
+  std::mt19937 rng(1234);
+  std::exponential_distribution<double> gap(
+      opts_.arrival_rate > 0 ? opts_.arrival_rate : 1);
+  const auto timeout = std::chrono::milliseconds(opts_.timeout_ms);
+  int num_started = 0;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  sessions_.clear();
+  ready_.clear();
+  finished_.clear();
+  errors_.clear();
+  ready_ms_.clear();
+  first_partial_ms_.clear();
+  final_ms_.clear();
+  num_in_flight_ = num_done_ = num_failed_ = max_in_flight_ = 0;
+  audio_ms_ = 0;
+  Clock::time_point run_start = Clock::now();
+  Clock::time_point next_arrival = run_start;
+  std::vector<Session*> to_start, to_send, to_cancel, finished;
+  while (num_done_ < opts_.num_streams) {
+    Clock::time_point now = Clock::now();
+    to_start.clear();
+    to_send.clear();
+    to_cancel.clear();
+    while (num_started < opts_.num_streams &&
+           num_in_flight_ < opts_.max_concurrency && next_arrival <= now) {
+      sessions_.emplace_back(
+          new Session(this, waves_[num_started % waves_.size()].get()));
+      Session* session = sessions_.back().get();
+      session->start_time = now;
+      session->deadline = now + timeout;
+      deadlines.push({session->deadline, session});
+      to_start.push_back(session);
+      ++num_started;
+      max_in_flight_ = std::max(max_in_flight_, ++num_in_flight_);
+      if (opts_.arrival_rate > 0) {
+        next_arrival += std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(gap(rng)));
+      }
+    }
+    for (Session* session : ready_) {
+      sends.push({now, session});
+    }
+    ready_.clear();
+    while (!sends.empty() && sends.top().time <= now) {
+      if (!sends.top().session->done) to_send.push_back(sends.top().session);
+      sends.pop();
+    }
+    while (!deadlines.empty() && deadlines.top().time <= now) {
+      Session* session = deadlines.top().session;
+      deadlines.pop();
+      if (!session->done && session->deadline <= now) {
+        OnSessionDone(session, false, "timeout");
+        to_cancel.push_back(session);
+      }
+    }
+    finished.swap(finished_);
+
+    // The streams are called without the lock, since they call back
+    lock.unlock();
+    for (Session* session : to_cancel) {
+      session->stream->Cancel();
+    }
+    for (Session* session : finished) {
+      session->stream.reset();
+    }
+    finished.clear();
+    for (Session* session : to_start) {
+      session->stream = factory(session);
+      session->stream->Start();
+    }
+    std::vector<SessionTime> next_sends;
+    for (Session* session : to_send) {
+      Clock::time_point next = SendNext(session);
+      if (next != Clock::time_point::max()) {
+        next_sends.push_back({next, session});
+      }
+    }
+    lock.lock();
+    for (const SessionTime& next : next_sends) {
+      sends.push(next);
+    }
+    for (Session* session : to_send) {
+      if (session->end_sent) deadlines.push({session->deadline, session});
+    }
+
+    Clock::time_point wake = Clock::time_point::max();
+    if (!sends.empty()) wake = std::min(wake, sends.top().time);
+    if (!deadlines.empty()) wake = std::min(wake, deadlines.top().time);
+    if (num_started < opts_.num_streams &&
+        num_in_flight_ < opts_.max_concurrency) {
+      wake = std::min(wake, next_arrival);
+    }
+    if (ready_.empty() && num_done_ < opts_.num_streams) {
+      if (wake == Clock::time_point::max()) {
+        cv_.wait(lock);
+      } else {
+        cv_.wait_until(lock, wake);
+      }
+    }
+  }
+  wall_ms_ = MsBetween(run_start, Clock::now());
+  finished.swap(finished_);
+  lock.unlock();
+  for (Session* session : finished) {
+    session->stream.reset();
+  }
+}
+
+static double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0;
+  size_t k = std::min(values.size() - 1,
+                      static_cast<size_t>(p / 100 * values.size()));
+  std::nth_element(values.begin(), values.begin() + k, values.end());
+  return values[k];
+}
+
+static void ReportLatency(const std::string& name,
+                          const std::vector<double>& values) {
+  LOG(INFO) << std::fixed << std::setprecision(1) << name << " latency(ms) "
+            << "p50 " << Percentile(values, 50) << " p90 "
+            << Percentile(values, 90) << " p99 " << Percentile(values, 99)
+            << " max " << Percentile(values, 100) << " of " << values.size();
+}
+
+void LoadGenerator::Report() const {
+  double wall_seconds = wall_ms_ / 1000;
+  LOG(INFO) << std::fixed << std::setprecision(2) << num_done_
+            << " streams done in " << wall_seconds << "s, " << num_failed_
+            << " failed, error rate " << 100.0 * num_failed_ / num_done_
+            << "%, max concurrency " << max_in_flight_;
+  LOG(INFO) << std::fixed << std::setprecision(2) << "Throughput "
+            << (num_done_ - num_failed_) / wall_seconds << " streams/s, "
+            << audio_ms_ / wall_ms_ << " seconds of audio per second";
+  ReportLatency("Ready", ready_ms_);
+  ReportLatency("First partial", first_partial_ms_);
+  ReportLatency("Final", final_ms_);
+  for (const auto& error : errors_) {
+    LOG(INFO) << "Error \"" << error.first << "\": " << error.second;
+  }
+}
+
+}  // namespace wenet
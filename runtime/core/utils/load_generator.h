@@ -0,0 +1,145 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_LOAD_GENERATOR_H_
+#define UTILS_LOAD_GENERATOR_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Events of a stream to the load generator, they may be called from any
+// thread, and are ignored once the stream is done.
+class LoadStreamListener {
+ public:
+  virtual ~LoadStreamListener() = default;
+  // The server is ready to accept audio
+  virtual void OnReady() = 0;
+  virtual void OnPartial() = 0;
+  virtual void OnFinal() = 0;
+  // The server ended the speech, or the stream failed with `error`
+  virtual void OnDone(bool ok, const std::string& error) = 0;
+};
+
+// The protocol side of a stream, implemented by the websocket and gRPC
+// clients. The calls must not block, they are made by the pacing thread of
+// all the streams.
+class LoadStream {
+ public:
+  virtual ~LoadStream() = default;
+  // Connect and send the start signal
+  virtual void Start() = 0;
+  virtual void SendAudio(const int16_t* data, size_t size) = 0;
+  // Send the end signal
+  virtual void SendEnd() = 0;
+  // Abort the stream, it's called if the stream times out
+  virtual void Cancel() = 0;
+};
+
+using LoadStreamFactory =
+    std::function<std::shared_ptr<LoadStream>(LoadStreamListener*)>;
+
+struct LoadOptions {
+  // Total number of the streams
+  int num_streams = 100;
+  // Number of the streams in flight at most
+  int max_concurrency = 1000;
+  // New streams per second, the arrivals are Poisson.
+  // 0 means to start the streams as soon as max_concurrency allows.
+  float arrival_rate = 10;
+  // Duration of the audio sent at a time
+  int chunk_ms = 100;
+  // Pace of the audio relative to real time, 0 means as fast as possible
+  float pace = 1.0;
+  // A stream fails if it's not done this long after its end signal
+  int timeout_ms = 30000;
+};
+
+// LoadGenerator replays the waves by the streams of a LoadStreamFactory, at
+// the arrival rate and pace of the options. A single pacing thread starts
+// the streams and sends their audio, the I/O is done by the streams on
+// their own small set of threads, so thousands of streams can be driven by
+// one process. It reports the throughput, the tail latencies and the error
+// rate. The waves must be 16 bits PCM of `sample_rate`.
+class LoadGenerator {
+ public:
+  LoadGenerator(const LoadOptions& opts,
+                std::vector<std::shared_ptr<std::vector<int16_t>>> waves,
+                int sample_rate = 16000);
+  ~LoadGenerator();
+
+  // Returns when all the streams are done
+  void Run(const LoadStreamFactory& factory);
+  // Log the report of the last run
+  void Report() const;
+  int num_done() const { return num_done_; }
+  int num_failed() const { return num_failed_; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  class Session;
+  struct SessionTime {
+    Clock::time_point time;
+    Session* session;
+    bool operator>(const SessionTime& other) const { return time > other.time; }
+  };
+
+  // Called by the sessions with mutex_ held
+  void OnSessionReady(Session* session);
+  void OnSessionDone(Session* session, bool ok, const std::string& error);
+  // Send the next chunk or the end signal of the session, returns the time of
+  // the next send, or Clock::time_point::max() if all are sent
+  Clock::time_point SendNext(Session* session);
+
+  LoadOptions opts_;
+  std::vector<std::shared_ptr<std::vector<int16_t>>> waves_;
+  int sample_rate_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::unique_ptr<Session>> sessions_;
+  // Sessions ready to send audio
+  std::vector<Session*> ready_;
+  // Sessions done, whose streams are to be released by the pacing thread
+  std::vector<Session*> finished_;
+  int num_in_flight_ = 0;
+  int num_done_ = 0;
+
+  // Statistics of the last run, in milliseconds
+  int max_in_flight_ = 0;
+  int num_failed_ = 0;
+  double wall_ms_ = 0;
+  double audio_ms_ = 0;
+  std::vector<double> ready_ms_;
+  std::vector<double> first_partial_ms_;
+  std::vector<double> final_ms_;
+  std::map<std::string, int> errors_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(LoadGenerator);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_LOAD_GENERATOR_H_
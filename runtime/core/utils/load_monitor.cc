@@ -0,0 +1,265 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/load_monitor.h"
+
+#ifdef __linux__
+#include <dlfcn.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "utils/json_writer.h"
+
+namespace wenet {
+
+constexpr int LatencyWindow::kNumBuckets;
+
+LatencyWindow::LatencyWindow(int window_seconds)
+    : window_seconds_(std::max(window_seconds, 1)),
+      num_slots_(window_seconds_ + 1),
+      slots_(new Slot[num_slots_]) {
+  for (int i = 0; i < num_slots_; ++i) {
+    for (auto& count : slots_[i].counts) count.store(0);
+  }
+}
+
+int64_t LatencyWindow::NowSeconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int LatencyWindow::Bucket(int64_t us) {
+  if (us <= 1) return 0;
+  int bucket = static_cast<int>(std::log2(static_cast<double>(us)) * 8);
+  return std::min(bucket, kNumBuckets - 1);
+}
+
+void LatencyWindow::Record(int64_t us, int64_t second) {
+  Slot& slot = slots_[second % num_slots_];
+  if (slot.second.load(std::memory_order_acquire) < second) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (slot.second.load(std::memory_order_relaxed) < second) {
+      for (auto& count : slot.counts) {
+        count.store(0, std::memory_order_relaxed);
+      }
+      slot.second.store(second, std::memory_order_release);
+    }
+  }
+  slot.counts[Bucket(us)].fetch_add(1, std::memory_order_relaxed);
+}
+
+float LatencyWindow::Quantile(float q, int64_t second) const {
+  std::vector<uint64_t> counts(kNumBuckets, 0);
+  uint64_t total = 0;
+  for (int i = 0; i < num_slots_; ++i) {
+    int64_t slot_second = slots_[i].second.load(std::memory_order_acquire);
+    if (slot_second > second || slot_second <= second - window_seconds_) {
+      continue;
+    }
+    for (int b = 0; b < kNumBuckets; ++b) {
+      uint32_t count = slots_[i].counts[b].load(std::memory_order_relaxed);
+      counts[b] += count;
+      total += count;
+    }
+  }
+  if (total == 0) return 0;
+  double rank = std::max(1.0, std::ceil(static_cast<double>(q) * total));
+  uint64_t seen = 0;
+  int b = 0;
+  for (; b < kNumBuckets - 1; ++b) {
+    seen += counts[b];
+    if (seen >= rank) break;
+  }
+  return std::exp2((b + 1) / 8.0) / 1000;
+}
+
+static int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+LoadMonitor& LoadMonitor::Instance() {
+  static LoadMonitor* monitor = new LoadMonitor();
+  return *monitor;
+}
+
+std::string LoadReportToJson(const LoadReport& report) {
+  JsonWriter writer;
+  writer.StartObject()
+      .Key("sessions").Int(report.sessions)
+      .Key("queue_depth").Double(report.queue_depth)
+      .Key("chunk_latency_p99_ms").Double(report.chunk_latency_p99_ms)
+      .Key("cpu_usage").Double(report.cpu_usage)
+      .Key("gpu_usage").Double(report.gpu_usage)
+      .EndObject();
+  return writer.str();
+}
+
+LoadReport LoadMonitor::Report() {
+  LoadReport report;
+  report.sessions = num_sessions();
+  report.queue_depth = queue_depth();
+  report.chunk_latency_p99_ms = chunk_latency_.Quantile(0.99);
+  report.cpu_usage = cpu_usage();
+  report.gpu_usage = gpu_usage();
+  return report;
+}
+
+void LoadMonitor::AddQueue(std::function<size_t()> depth, int num_workers) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  queues_.emplace_back(std::move(depth), std::max(num_workers, 1));
+}
+
+void LoadMonitor::MaybeUpdate() {
+  int64_t now = NowMs();
+  if (now - last_update_ms_.load(std::memory_order_relaxed) < interval_ms_) {
+    return;
+  }
+  // One thread samples, the others use the last sample
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  if (!lock.owns_lock()) return;
+  if (now - last_update_ms_.load(std::memory_order_relaxed) < interval_ms_) {
+    return;
+  }
+  UpdateLocked();
+}
+
+void LoadMonitor::Update() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  UpdateLocked();
+}
+
+void LoadMonitor::UpdateLocked() {
+  last_update_ms_.store(NowMs(), std::memory_order_relaxed);
+  uint64_t busy = 0, total = 0;
+  if (ReadCpuTimes(&busy, &total)) {
+    if (last_total_ > 0 && total > last_total_) {
+      cpu_usage_.store(static_cast<float>(busy - last_busy_) /
+                           (total - last_total_),
+                       std::memory_order_relaxed);
+    }
+    last_busy_ = busy;
+    last_total_ = total;
+  }
+  size_t num_tasks = 0;
+  int num_workers = 0;
+  for (const auto& queue : queues_) {
+    num_tasks += queue.first();
+    num_workers += queue.second;
+  }
+  queue_depth_.store(
+      num_workers > 0 ? static_cast<float>(num_tasks) / num_workers : 0,
+      std::memory_order_relaxed);
+  float gpu_usage = -1;
+  ReadGpuUsage(&gpu_usage);
+  gpu_usage_.store(gpu_usage, std::memory_order_relaxed);
+}
+
+bool LoadMonitor::ReadCpuTimes(uint64_t* busy, uint64_t* total) {
+#ifdef __linux__
+  FILE* fp = fopen("/proc/stat", "r");
+  if (fp == nullptr) return false;
+  // cpu user nice system idle iowait irq softirq steal
+  unsigned long long times[8] = {0};  // NOLINT
+  int n = fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &times[0],
+                 &times[1], &times[2], &times[3], &times[4], &times[5],
+                 &times[6], &times[7]);
+  fclose(fp);
+  if (n < 4) return false;
+  *total = 0;
+  for (int i = 0; i < 8; ++i) *total += times[i];
+  *busy = *total - times[3] - times[4];
+  return true;
+#else
+  return false;
+#endif
+}
+
+#ifdef __linux__
+namespace {
+
+// The subset of nvml.h used, whose functions return 0 on success
+struct NvmlUtilization {
+  unsigned int gpu;
+  unsigned int memory;
+};
+
+struct Nvml {
+  int (*device_get_count)(unsigned int*) = nullptr;
+  int (*device_get_handle)(unsigned int, void**) = nullptr;
+  int (*device_get_utilization)(void*, NvmlUtilization*) = nullptr;
+};
+
+// nullptr if NVML isn't installed, e.g. there is no NVIDIA driver
+const Nvml* LoadNvml() {
+  static const Nvml* nvml = []() -> const Nvml* {
+    void* lib = dlopen("libnvidia-ml.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (lib == nullptr) return nullptr;
+    auto init = reinterpret_cast<int (*)()>(dlsym(lib, "nvmlInit_v2"));
+    Nvml* result = new Nvml();
+    result->device_get_count = reinterpret_cast<int (*)(unsigned int*)>(
+        dlsym(lib, "nvmlDeviceGetCount_v2"));
+    result->device_get_handle =
+        reinterpret_cast<int (*)(unsigned int, void**)>(
+            dlsym(lib, "nvmlDeviceGetHandleByIndex_v2"));
+    result->device_get_utilization =
+        reinterpret_cast<int (*)(void*, NvmlUtilization*)>(
+            dlsym(lib, "nvmlDeviceGetUtilizationRates"));
+    if (init == nullptr || result->device_get_count == nullptr ||
+        result->device_get_handle == nullptr ||
+        result->device_get_utilization == nullptr || init() != 0) {
+      delete result;
+      dlclose(lib);
+      return nullptr;
+    }
+    return result;
+  }();
+  return nvml;
+}
+
+}  // namespace
+#endif
+
+bool LoadMonitor::ReadGpuUsage(float* usage) {
+#ifdef __linux__
+  const Nvml* nvml = LoadNvml();
+  if (nvml == nullptr) return false;
+  unsigned int num_devices = 0;
+  if (nvml->device_get_count(&num_devices) != 0 || num_devices == 0) {
+    return false;
+  }
+  unsigned int sum = 0;
+  for (unsigned int i = 0; i < num_devices; ++i) {
+    void* device = nullptr;
+    NvmlUtilization utilization;
+    if (nvml->device_get_handle(i, &device) != 0 ||
+        nvml->device_get_utilization(device, &utilization) != 0) {
+      return false;
+    }
+    sum += utilization.gpu;
+  }
+  *usage = sum / (100.0f * num_devices);
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace wenet
@@ -0,0 +1,162 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_LOAD_MONITOR_H_
+#define UTILS_LOAD_MONITOR_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The latency quantiles of the last seconds, e.g. the p99 of the chunks for
+// the load report. The latencies are counted in the log buckets of the
+// second they're recorded in, 8 buckets per octave of us, so a quantile is
+// within 9% of it. It's lock free but for the first record of a second.
+class LatencyWindow {
+ public:
+  // Up to 2^25us, 33s
+  static constexpr int kNumBuckets = 8 * 25;
+
+  explicit LatencyWindow(int window_seconds = 10);
+
+  void Record(int64_t us) { Record(us, NowSeconds()); }
+  // The latency in ms at the quantile `q` in (0, 1] of the window, which is
+  // the upper bound of its bucket, 0 if there is none
+  float Quantile(float q) const { return Quantile(q, NowSeconds()); }
+
+  // At `second` of the steady clock, e.g. for the tests
+  void Record(int64_t us, int64_t second);
+  float Quantile(float q, int64_t second) const;
+
+ private:
+  struct Slot {
+    std::atomic<int64_t> second{-1};
+    std::atomic<uint32_t> counts[kNumBuckets];
+  };
+
+  static int64_t NowSeconds();
+  static int Bucket(int64_t us);
+
+  const int window_seconds_;
+  // A slot per second of the window, and one being recorded
+  const int num_slots_;
+  std::unique_ptr<Slot[]> slots_;
+  // Guards the reset of a slot for a new second
+  std::mutex mutex_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(LatencyWindow);
+};
+
+// The load of the server reported to the gateway for the least loaded
+// routing, see LoadMonitor::Report()
+struct LoadReport {
+  // The sessions admitted, see AdmissionController
+  int sessions = 0;
+  // The pending tasks per worker of the decode queues
+  float queue_depth = 0;
+  // The p99 of the decoding time of the chunks of the last seconds
+  float chunk_latency_p99_ms = 0;
+  // In [0, 1], the gpu usage is the mean of the GPUs, -1 if not supported
+  float cpu_usage = 0;
+  float gpu_usage = -1;
+};
+
+// {"sessions":3,"queue_depth":0.5,...} by the names of the fields
+std::string LoadReportToJson(const LoadReport& report);
+
+// LoadMonitor samples the load of the server: the cpu and gpu usage of the
+// machine and the depth of the task queues registered by the servers, e.g.
+// their decode ThreadPools. The sample is taken at most once per interval
+// by the thread asking for it, so it's cheap enough to be asked at each
+// chunk. It also counts the sessions and the chunk latencies reported to
+// it for the load report.
+class LoadMonitor {
+ public:
+  static LoadMonitor& Instance();
+
+  // Register a queue of pending tasks served by `num_workers` threads
+  void AddQueue(std::function<size_t()> depth, int num_workers);
+  // The sessions come and go, e.g. by the AdmissionController tickets
+  void AddSessions(int n) {
+    num_sessions_.fetch_add(n, std::memory_order_relaxed);
+  }
+  int num_sessions() const {
+    return num_sessions_.load(std::memory_order_relaxed);
+  }
+  // The decoding time of a chunk, see LatencyWindow
+  void RecordChunkLatency(int64_t us) { chunk_latency_.Record(us); }
+
+  // The cpu usage of the machine in [0, 1] since the last sample, 0 if it's
+  // not supported on the platform
+  float cpu_usage() {
+    MaybeUpdate();
+    return cpu_usage_.load(std::memory_order_relaxed);
+  }
+  // The pending tasks per worker of all the registered queues
+  float queue_depth() {
+    MaybeUpdate();
+    return queue_depth_.load(std::memory_order_relaxed);
+  }
+  // The mean utilization of the GPUs in [0, 1] by NVML, which is loaded at
+  // runtime, -1 if there is no NVIDIA driver
+  float gpu_usage() {
+    MaybeUpdate();
+    return gpu_usage_.load(std::memory_order_relaxed);
+  }
+  LoadReport Report();
+
+  void set_interval_ms(int interval_ms) { interval_ms_ = interval_ms; }
+  // Take a sample now
+  void Update();
+
+ private:
+  LoadMonitor() = default;
+  void MaybeUpdate();
+  // With mutex_ held
+  void UpdateLocked();
+  // Busy and total jiffies of all the cpus, return false if not supported
+  static bool ReadCpuTimes(uint64_t* busy, uint64_t* total);
+  static bool ReadGpuUsage(float* usage);
+
+  std::atomic<int> interval_ms_{1000};
+  std::atomic<int64_t> last_update_ms_{0};
+  std::atomic<float> cpu_usage_{0};
+  std::atomic<float> queue_depth_{0};
+  std::atomic<float> gpu_usage_{-1};
+  std::atomic<int> num_sessions_{0};
+  LatencyWindow chunk_latency_;
+
+  // Guards the fields below, and the sampling
+  std::mutex mutex_;
+  std::vector<std::pair<std::function<size_t()>, int>> queues_;
+  uint64_t last_busy_ = 0;
+  uint64_t last_total_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(LoadMonitor);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_LOAD_MONITOR_H_
@@ -0,0 +1,112 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_MATRIX_H_
+#define UTILS_MATRIX_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+// A borrowed row major [rows, cols] view, the rows are `stride` elements
+// apart. It's what the search consumes for the CTC posteriors, so a model
+// output is read in place instead of being split into a vector per frame.
+template <typename T>
+class MatrixView {
+ public:
+  MatrixView() = default;
+  MatrixView(const T* data, int rows, int cols)
+      : MatrixView(data, rows, cols, cols) {}
+  MatrixView(const T* data, int rows, int cols, int stride)
+      : data_(data), rows_(rows), cols_(cols), stride_(stride) {
+    CHECK_GE(stride, cols);
+  }
+
+  const T* data() const { return data_; }
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  int stride() const { return stride_; }
+  bool empty() const { return rows_ == 0; }
+  const T* row(int r) const { return data_ + static_cast<size_t>(r) * stride_; }
+  const T& operator()(int r, int c) const { return row(r)[c]; }
+  // Rows [begin, end)
+  MatrixView RowRange(int begin, int end) const {
+    return MatrixView(row(begin), end - begin, cols_, stride_);
+  }
+
+ private:
+  const T* data_ = nullptr;
+  int rows_ = 0;
+  int cols_ = 0;
+  int stride_ = 0;
+};
+
+// A contiguous row major [rows, cols] matrix. Resize() keeps the capacity, so
+// a matrix reused for every chunk stops allocating once it's grown.
+template <typename T>
+class Matrix {
+ public:
+  Matrix() = default;
+  Matrix(int rows, int cols) { Resize(rows, cols); }
+
+  void Resize(int rows, int cols) {
+    rows_ = rows;
+    cols_ = cols;
+    data_.resize(static_cast<size_t>(rows) * cols);
+  }
+  void Clear() { Resize(0, 0); }
+
+  T* data() { return data_.data(); }
+  const T* data() const { return data_.data(); }
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  bool empty() const { return rows_ == 0; }
+  T* row(int r) { return data_.data() + static_cast<size_t>(r) * cols_; }
+  const T* row(int r) const {
+    return data_.data() + static_cast<size_t>(r) * cols_;
+  }
+  T& operator()(int r, int c) { return row(r)[c]; }
+  const T& operator()(int r, int c) const { return row(r)[c]; }
+  MatrixView<T> view() const {
+    return MatrixView<T>(data_.data(), rows_, cols_);
+  }
+
+  // Copy the rows of the nested vectors, which are all of the same size
+  void CopyFrom(const std::vector<std::vector<T>>& rows) {
+    Resize(rows.size(), rows.empty() ? 0 : rows[0].size());
+    for (int r = 0; r < rows_; ++r) {
+      CHECK_EQ(rows[r].size(), cols_);
+      std::copy(rows[r].begin(), rows[r].end(), row(r));
+    }
+  }
+  void CopyTo(std::vector<std::vector<T>>* rows) const {
+    rows->resize(rows_);
+    for (int r = 0; r < rows_; ++r) {
+      (*rows)[r].assign(row(r), row(r) + cols_);
+    }
+  }
+
+ private:
+  std::vector<T> data_;
+  int rows_ = 0;
+  int cols_ = 0;
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_MATRIX_H_
@@ -0,0 +1,164 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/memory_budget.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+bool ParseProcessMemory(const std::string& status, int64_t* rss_bytes,
+                        int64_t* peak_rss_bytes) {
+  bool has_rss = false, has_peak = false;
+  std::istringstream in(status);
+  std::string line;
+  while (std::getline(in, line)) {
+    long long kb = 0;  // NOLINT
+    if (sscanf(line.c_str(), "VmRSS: %lld kB", &kb) == 1) {
+      *rss_bytes = kb * 1024;
+      has_rss = true;
+    } else if (sscanf(line.c_str(), "VmHWM: %lld kB", &kb) == 1) {
+      *peak_rss_bytes = kb * 1024;
+      has_peak = true;
+    }
+  }
+  return has_rss && has_peak;
+}
+
+bool ReadProcessMemory(int64_t* rss_bytes, int64_t* peak_rss_bytes) {
+#ifdef __linux__
+  std::ifstream in("/proc/self/status");
+  if (!in) return false;
+  std::stringstream status;
+  status << in.rdbuf();
+  return ParseProcessMemory(status.str(), rss_bytes, peak_rss_bytes);
+#else
+  return false;
+#endif
+}
+
+bool ResetPeakProcessMemory() {
+#ifdef __linux__
+  std::ofstream out("/proc/self/clear_refs");
+  out << "5";
+  out.close();
+  return static_cast<bool>(out);
+#else
+  return false;
+#endif
+}
+
+void MemoryBudget::Add(const std::string& component, int64_t bytes) {
+  for (auto& c : components_) {
+    if (c.first == component) {
+      c.second += bytes;
+      return;
+    }
+  }
+  components_.emplace_back(component, bytes);
+}
+
+int64_t MemoryBudget::total_bytes() const {
+  int64_t total = 0;
+  for (const auto& c : components_) total += c.second;
+  return total;
+}
+
+std::string MemoryBudget::Report() const {
+  auto mb = [](int64_t bytes) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.1fMB", bytes / 1048576.0);
+    return std::string(buffer);
+  };
+  std::ostringstream out;
+  for (const auto& c : components_) {
+    out << c.first << ": " << mb(c.second) << "\n";
+  }
+  out << "total: " << mb(total_bytes());
+  if (budget_bytes_ > 0) {
+    out << " of budget " << mb(budget_bytes_);
+  }
+  int64_t rss = 0, peak_rss = 0;
+  if (ReadProcessMemory(&rss, &peak_rss)) {
+    out << "\nprocess rss: " << mb(rss) << ", peak rss: " << mb(peak_rss);
+  }
+  return out.str();
+}
+
+namespace {
+
+struct SessionMemoryGauges {
+  SessionMemoryGauges() {
+    Metrics& metrics = Metrics::Instance();
+    feature = metrics.GetGauge("wenet_session_feature_bytes",
+                               "Bytes buffered in the feature pipelines");
+    cached_feature = metrics.GetGauge(
+        "wenet_session_cached_feature_bytes",
+        "Bytes of the frames cached by the models for the next chunks");
+    cache = metrics.GetGauge("wenet_session_cache_bytes",
+                             "Bytes of the attention and cnn caches");
+    encoder_outs = metrics.GetGauge(
+        "wenet_session_encoder_outs_bytes",
+        "Bytes of the encoder outputs kept for rescoring");
+    search = metrics.GetGauge("wenet_session_search_bytes",
+                              "Bytes of the hypotheses of the searchers");
+    total = metrics.GetGauge("wenet_session_memory_bytes",
+                             "Bytes of the states of all the live sessions");
+  }
+
+  Gauge* feature;
+  Gauge* cached_feature;
+  Gauge* cache;
+  Gauge* encoder_outs;
+  Gauge* search;
+  Gauge* total;
+};
+
+SessionMemoryGauges& GetSessionMemoryGauges() {
+  static SessionMemoryGauges gauges;
+  return gauges;
+}
+
+}  // namespace
+
+void SessionMemoryTracker::Update(const SessionMemory& usage) {
+  SessionMemoryGauges& gauges = GetSessionMemoryGauges();
+  gauges.feature->Add(usage.feature - usage_.feature);
+  gauges.cached_feature->Add(usage.cached_feature - usage_.cached_feature);
+  gauges.cache->Add(usage.cache - usage_.cache);
+  gauges.encoder_outs->Add(usage.encoder_outs - usage_.encoder_outs);
+  gauges.search->Add(usage.search - usage_.search);
+  gauges.total->Add(usage.total() - usage_.total());
+  usage_ = usage;
+}
+
+int64_t SessionMemoryTracker::TotalBytes() {
+  return GetSessionMemoryGauges().total->value();
+}
+
+void MemoryBudget::Log() const {
+  if (over_budget()) {
+    LOG(WARNING) << "Memory is over budget\n" << Report();
+  } else {
+    LOG(INFO) << "Memory budget\n" << Report();
+  }
+}
+
+}  // namespace wenet
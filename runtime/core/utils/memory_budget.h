@@ -0,0 +1,109 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_MEMORY_BUDGET_H_
+#define UTILS_MEMORY_BUDGET_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The resident and the peak resident memory of the process, by
+// /proc/self/status, return false if it's not supported on the platform
+bool ReadProcessMemory(int64_t* rss_bytes, int64_t* peak_rss_bytes);
+// Reset the peak resident memory to the current one, e.g. between the runs
+// of a benchmark, return false if it's not supported
+bool ResetPeakProcessMemory();
+// Parse the VmRSS and VmHWM lines of the text of /proc/self/status
+bool ParseProcessMemory(const std::string& status, int64_t* rss_bytes,
+                        int64_t* peak_rss_bytes);
+
+// The breakdown of the memory of the decoding by the components, e.g. the
+// weights of the model, the graph, and the sessions, against a budget of
+// the board it runs on.
+class MemoryBudget {
+ public:
+  // 0 budget_bytes for no budget
+  explicit MemoryBudget(int64_t budget_bytes = 0)
+      : budget_bytes_(budget_bytes) {}
+
+  // The bytes are summed if the component is added more than once
+  void Add(const std::string& component, int64_t bytes);
+  int64_t total_bytes() const;
+  bool over_budget() const {
+    return budget_bytes_ > 0 && total_bytes() > budget_bytes_;
+  }
+
+  // One line per component, and the total, the budget and the process
+  // memory, in MB
+  std::string Report() const;
+  // Log the report, as a warning if it's over the budget
+  void Log() const;
+
+ private:
+  int64_t budget_bytes_;
+  std::vector<std::pair<std::string, int64_t>> components_;
+};
+
+// The bytes of the states of a decoding session by component, see
+// AsrDecoder::GetMemoryUsage
+struct SessionMemory {
+  // Samples and frames buffered in the feature pipeline
+  int64_t feature = 0;
+  // Frames cached by the model for the next chunk
+  int64_t cached_feature = 0;
+  // Attention and cnn caches of the encoder
+  int64_t cache = 0;
+  // Encoder outputs kept for rescoring
+  int64_t encoder_outs = 0;
+  // Hypotheses and traces of the searcher
+  int64_t search = 0;
+
+  int64_t total() const {
+    return feature + cached_feature + cache + encoder_outs + search;
+  }
+};
+
+// SessionMemoryTracker exports the bytes of all the live sessions of the
+// server by component, as the wenet_session_<component>_bytes gauges and
+// their total wenet_session_memory_bytes. Each session holds one, updates
+// it with its usage after a chunk is decoded, and its bytes are removed
+// when it's destroyed. The updates are lock free.
+class SessionMemoryTracker {
+ public:
+  SessionMemoryTracker() = default;
+  ~SessionMemoryTracker() { Update(SessionMemory()); }
+
+  void Update(const SessionMemory& usage);
+  const SessionMemory& usage() const { return usage_; }
+
+  // The bytes of all the live sessions, e.g. for the admission control
+  static int64_t TotalBytes();
+
+ private:
+  SessionMemory usage_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(SessionMemoryTracker);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_MEMORY_BUDGET_H_
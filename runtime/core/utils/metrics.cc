@@ -0,0 +1,171 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/metrics.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "utils/log.h"
+#include "utils/stage_timer.h"
+
+namespace wenet {
+
+Histogram::Histogram(const std::vector<double>& bounds)
+    : bounds_(bounds), counts_(new std::atomic<uint64_t>[bounds.size() + 1]) {
+  CHECK(std::is_sorted(bounds_.begin(), bounds_.end()));
+  for (size_t i = 0; i <= bounds_.size(); ++i) {
+    counts_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+int Histogram::BucketIndex(double value) const {
+  return std::lower_bound(bounds_.begin(), bounds_.end(), value) -
+         bounds_.begin();
+}
+
+void Histogram::Observe(double value) {
+  counts_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  double sum = sum_.load(std::memory_order_relaxed);
+  while (!sum_.compare_exchange_weak(sum, sum + value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+void Histogram::Merge(const std::vector<uint64_t>& counts, uint64_t count,
+                      double sum) {
+  CHECK_EQ(counts.size(), bounds_.size() + 1);
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] > 0) {
+      counts_[i].fetch_add(counts[i], std::memory_order_relaxed);
+    }
+  }
+  count_.fetch_add(count, std::memory_order_relaxed);
+  double old_sum = sum_.load(std::memory_order_relaxed);
+  while (!sum_.compare_exchange_weak(old_sum, old_sum + sum,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+Metrics& Metrics::Instance() {
+  // Never destroyed, the metrics may be updated by detached threads at exit
+  static Metrics* metrics = new Metrics();
+  return *metrics;
+}
+
+Counter* Metrics::GetCounter(const std::string& name,
+                             const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = counters_[name];
+  if (entry.metric == nullptr) {
+    entry.help = help;
+    entry.metric.reset(new Counter());
+  }
+  return entry.metric.get();
+}
+
+Gauge* Metrics::GetGauge(const std::string& name, const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = gauges_[name];
+  if (entry.metric == nullptr) {
+    entry.help = help;
+    entry.metric.reset(new Gauge());
+  }
+  return entry.metric.get();
+}
+
+Histogram* Metrics::GetHistogram(const std::string& name,
+                                 const std::string& help,
+                                 const std::vector<double>& bounds) {
+  static const std::vector<double> kLatencyBounds = {
+      0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1, 2, 5, 10};
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = histograms_[name];
+  if (entry.metric == nullptr) {
+    entry.help = help;
+    entry.metric.reset(
+        new Histogram(bounds.empty() ? kLatencyBounds : bounds));
+  }
+  return entry.metric.get();
+}
+
+std::string Metrics::Labeled(const std::string& name,
+                             const std::string& label,
+                             const std::string& value) {
+  std::string labeled = name + "{" + label + "=\"";
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      labeled += '\\';
+      labeled += c;
+    } else if (c == '\n') {
+      labeled += "\\n";
+    } else {
+      labeled += c;
+    }
+  }
+  return labeled + "\"}";
+}
+
+std::string Metrics::Serialize() const {
+  // The stages pending in the threads are merged first
+  StageStats::FlushAll();
+  std::ostringstream os;
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The samples of a name are together after its help and type, the
+  // labeled ones don't sort next to each other, e.g. x_y is between x and
+  // x{...}
+  auto serialize = [&os](const auto& entries, const char* type) {
+    std::map<std::string, std::vector<decltype(&*entries.begin())>> families;
+    for (const auto& it : entries) {
+      families[it.first.substr(0, it.first.find('{'))].push_back(&it);
+    }
+    for (const auto& family : families) {
+      std::string help;
+      for (const auto* it : family.second) {
+        if (help.empty()) help = it->second.help;
+      }
+      os << "# HELP " << family.first << " " << help << "\n";
+      os << "# TYPE " << family.first << " " << type << "\n";
+      for (const auto* it : family.second) {
+        os << it->first << " " << it->second.metric->value() << "\n";
+      }
+    }
+  };
+  serialize(counters_, "counter");
+  serialize(gauges_, "gauge");
+  for (const auto& it : histograms_) {
+    const std::string& name = it.first;
+    const Histogram& histogram = *it.second.metric;
+    os << "# HELP " << name << " " << it.second.help << "\n";
+    os << "# TYPE " << name << " histogram\n";
+    // The buckets are cumulative in the exposition format
+    uint64_t cumulative = 0;
+    const auto& bounds = histogram.bounds();
+    for (size_t i = 0; i < bounds.size(); ++i) {
+      cumulative += histogram.bucket_count(i);
+      os << name << "_bucket{le=\"" << bounds[i] << "\"} " << cumulative
+         << "\n";
+    }
+    cumulative += histogram.bucket_count(bounds.size());
+    os << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+    os << name << "_sum " << histogram.sum() << "\n";
+    os << name << "_count " << cumulative << "\n";
+  }
+  return os.str();
+}
+
+}  // namespace wenet
@@ -0,0 +1,130 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_METRICS_H_
+#define UTILS_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Metrics of the runtime, which are exported in the Prometheus text format.
+// The updates are lock free, so they can be done on the decoding path, the
+// metrics are registered once and live until the process exits, e.g.
+//   static Histogram* latency = Metrics::Instance().GetHistogram(
+//       "wenet_search_seconds", "CTC search latency of a chunk");
+//   latency->Observe(seconds);
+
+class Counter {
+ public:
+  void Increment(int64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+class Gauge {
+ public:
+  void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+  void Add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+class Histogram {
+ public:
+  // `bounds` are the ascending upper bounds of the buckets, the +Inf bucket
+  // is implicit
+  explicit Histogram(const std::vector<double>& bounds);
+
+  void Observe(double value);
+  // The bucket of the value, bounds().size() for +Inf
+  int BucketIndex(double value) const;
+  // Add the observations accumulated elsewhere, e.g. by StageStats, counts
+  // are non cumulative of all the buckets
+  void Merge(const std::vector<uint64_t>& counts, uint64_t count, double sum);
+
+  const std::vector<double>& bounds() const { return bounds_; }
+  // Non cumulative count of bucket i, i == bounds().size() is +Inf
+  uint64_t bucket_count(int i) const {
+    return counts_[i].load(std::memory_order_relaxed);
+  }
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  double sum() const { return sum_.load(std::memory_order_relaxed); }
+
+ private:
+  std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+  std::atomic<uint64_t> count_{0};
+  std::atomic<double> sum_{0.0};
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Histogram);
+};
+
+class Metrics {
+ public:
+  static Metrics& Instance();
+
+  // The metric of the same name is shared, the help and bounds of the first
+  // registration are used. The counters and the gauges of the same name but
+  // the labels, see Labeled(), are serialized as one metric.
+  Counter* GetCounter(const std::string& name, const std::string& help);
+  Gauge* GetGauge(const std::string& name, const std::string& help);
+  // Default bounds are for latencies in seconds, from 1ms to 10s
+  Histogram* GetHistogram(const std::string& name, const std::string& help,
+                          const std::vector<double>& bounds = {});
+
+  // All the metrics in the Prometheus text exposition format
+  std::string Serialize() const;
+
+  // The name with a label, e.g. wenet_tenant_sessions{tenant="a"}, the
+  // value is escaped
+  static std::string Labeled(const std::string& name, const std::string& label,
+                             const std::string& value);
+
+ private:
+  Metrics() = default;
+
+  template <typename T>
+  struct Entry {
+    std::string help;
+    std::unique_ptr<T> metric;
+  };
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry<Counter>> counters_;
+  std::map<std::string, Entry<Gauge>> gauges_;
+  std::map<std::string, Entry<Histogram>> histograms_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Metrics);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_METRICS_H_
@@ -0,0 +1,143 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/metrics_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "utils/load_monitor.h"
+#include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/profiler.h"
+#include "utils/trace.h"
+
+namespace wenet {
+
+MetricsServer::~MetricsServer() { Stop(); }
+
+bool MetricsServer::Start() {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    LOG(ERROR) << "Failed to create metrics socket: " << strerror(errno);
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<uint16_t>(port_));
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(listen_fd_, 16) < 0) {
+    LOG(ERROR) << "Failed to listen metrics port " << port_ << ": "
+               << strerror(errno);
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  thread_ = std::thread(&MetricsServer::Run, this);
+  LOG(INFO) << "Metrics are exported at port " << port_ << " /metrics";
+  return true;
+}
+
+void MetricsServer::Stop() {
+  if (stop_.exchange(true)) return;
+  if (listen_fd_ >= 0) {
+    // Wake up the blocking accept()
+    shutdown(listen_fd_, SHUT_RDWR);
+  }
+  if (thread_.joinable()) thread_.join();
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+}
+
+void MetricsServer::Run() {
+  while (!stop_) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    Serve(fd);
+    close(fd);
+  }
+}
+
+void MetricsServer::Serve(int fd) {
+  // A stalled scraper must not block the others for long
+  timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  // Only the request line matters
+  char buf[1024];
+  ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) return;
+  buf[n] = '\0';
+  std::string request(buf);
+  std::string status = "200 OK";
+  std::string content_type = "text/plain; version=0.0.4";
+  std::string body;
+  if (request.compare(0, 13, "GET /metrics ") == 0 ||
+      request.compare(0, 13, "GET /metrics?") == 0) {
+    body = Metrics::Instance().Serialize();
+  } else if (request.compare(0, 10, "GET /load ") == 0) {
+    content_type = "application/json";
+    body = LoadReportToJson(LoadMonitor::Instance().Report());
+  } else if (request.compare(0, 11, "GET /trace ") == 0) {
+    content_type = "application/json";
+    body = Tracer::Instance().ExportChromeTrace();
+  } else if (request.compare(0, 13, "GET /profile ") == 0 ||
+             request.compare(0, 13, "GET /profile?") == 0) {
+    content_type = "application/json";
+    Profiler& profiler = Profiler::Instance();
+    const std::string kRequests = "GET /profile?requests=";
+    if (request.compare(0, kRequests.size(), kRequests) == 0) {
+      int num_requests = atoi(request.c_str() + kRequests.size());
+      if (num_requests <= 0) {
+        status = "400 Bad Request";
+      } else if (!profiler.Start(num_requests)) {
+        status = "409 Conflict";
+      }
+    }
+    body = profiler.Status();
+  } else {
+    status = "404 Not Found";
+    body = "Not Found\n";
+  }
+  std::string response = "HTTP/1.1 " + status +
+                         "\r\nContent-Type: " + content_type +
+                         "\r\nContent-Length: " +
+                         std::to_string(body.size()) +
+                         "\r\nConnection: close\r\n\r\n" + body;
+  size_t sent = 0;
+  while (sent < response.size()) {
+    ssize_t m = send(fd, response.data() + sent, response.size() - sent,
+                     MSG_NOSIGNAL);
+    if (m <= 0) break;
+    sent += m;
+  }
+}
+
+}  // namespace wenet
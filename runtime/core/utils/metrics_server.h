@@ -0,0 +1,58 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_METRICS_SERVER_H_
+#define UTILS_METRICS_SERVER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// A minimal HTTP server which answers `GET /metrics` with
+// Metrics::Instance().Serialize() for the Prometheus scraper, and
+// `GET /trace` with Tracer::Instance().ExportChromeTrace(), and
+// `GET /profile?requests=N` starts the capture of the next N requests by
+// the Profiler, `GET /profile` returns its status. `GET /load` returns the
+// LoadMonitor::Report() in JSON for the least loaded routing of a gateway.
+// The requests are served one by one on its own thread, away from the
+// decoding threads.
+class MetricsServer {
+ public:
+  explicit MetricsServer(int port) : port_(port) {}
+  ~MetricsServer();
+
+  // Returns false if the port can't be listened on
+  bool Start();
+  void Stop();
+
+ private:
+  void Run();
+  void Serve(int fd);
+
+  int port_;
+  int listen_fd_ = -1;
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(MetricsServer);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_METRICS_SERVER_H_
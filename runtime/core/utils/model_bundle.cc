@@ -0,0 +1,244 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/model_bundle.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utils/fst_io.h"
+#include "utils/log.h"
+
+namespace wenet {
+
+static const char kBundleMagic[8] = {'W', 'N', 'B', 'U', 'N', 'D', 'L', 'E'};
+static const uint32_t kBundleVersion = 1;
+static const size_t kHeaderSize = 16;
+static const size_t kNameSize = 48;
+static const size_t kEntrySize = kNameSize + 2 * sizeof(uint64_t);
+
+MemoryStream::Buffer::Buffer(const char* data, size_t size) {
+  char* begin = const_cast<char*>(data);
+  setg(begin, begin, begin + size);
+}
+
+MemoryStream::Buffer::pos_type MemoryStream::Buffer::seekoff(
+    off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+  char* base = dir == std::ios_base::beg   ? eback()
+               : dir == std::ios_base::cur ? gptr()
+                                           : egptr();
+  char* pos = base + off;
+  if (!(which & std::ios_base::in) || pos < eback() || pos > egptr()) {
+    return pos_type(off_type(-1));
+  }
+  setg(eback(), pos, egptr());
+  return pos_type(pos - eback());
+}
+
+MemoryStream::Buffer::pos_type MemoryStream::Buffer::seekpos(
+    pos_type pos, std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+MemoryStream::MemoryStream(const char* data, size_t size)
+    : std::istream(nullptr), buffer_(data, size) {
+  rdbuf(&buffer_);
+}
+
+static uint64_t Align(uint64_t offset) {
+  return (offset + ModelBundle::kAlignment - 1) / ModelBundle::kAlignment *
+         ModelBundle::kAlignment;
+}
+
+bool ModelBundle::Write(
+    const std::string& path,
+    const std::vector<std::pair<std::string, std::string>>& sections) {
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!os) {
+    LOG(ERROR) << "Can't open " << tmp_path;
+    return false;
+  }
+  uint32_t num_sections = sections.size();
+  os.write(kBundleMagic, sizeof(kBundleMagic));
+  os.write(reinterpret_cast<const char*>(&kBundleVersion), sizeof(uint32_t));
+  os.write(reinterpret_cast<const char*>(&num_sections), sizeof(uint32_t));
+  uint64_t offset = Align(kHeaderSize + kEntrySize * num_sections);
+  for (const auto& section : sections) {
+    if (section.first.empty() || section.first.size() >= kNameSize) {
+      LOG(ERROR) << "Invalid section name " << section.first;
+      return false;
+    }
+    char name[kNameSize] = {0};
+    memcpy(name, section.first.data(), section.first.size());
+    uint64_t size = section.second.size();
+    os.write(name, kNameSize);
+    os.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    offset = Align(offset + size);
+  }
+  const std::string padding(kAlignment, '\0');
+  uint64_t written = kHeaderSize + kEntrySize * num_sections;
+  for (const auto& section : sections) {
+    os.write(padding.data(), Align(written) - written);
+    os.write(section.second.data(), section.second.size());
+    written = Align(written) + section.second.size();
+  }
+  os.close();
+  if (!os) {
+    LOG(ERROR) << "Error in writing " << tmp_path;
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    LOG(ERROR) << "Can't rename " << tmp_path << " to " << path;
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool ModelBundle::IsBundle(const std::string& path) {
+  std::ifstream is(path, std::ios::binary);
+  char magic[sizeof(kBundleMagic)];
+  return is.read(magic, sizeof(magic)) &&
+         memcmp(magic, kBundleMagic, sizeof(magic)) == 0;
+}
+
+std::shared_ptr<ModelBundle> ModelBundle::Open(const std::string& path) {
+  std::shared_ptr<ModelBundle> bundle(new ModelBundle());
+  bundle->path_ = path;
+  const char* file = nullptr;
+  size_t size = 0;
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Can't open bundle " << path;
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    bundle->map_size_ = st.st_size;
+    bundle->map_ =
+        mmap(nullptr, bundle->map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (bundle->map_ == nullptr || bundle->map_ == MAP_FAILED) {
+    bundle->map_ = nullptr;
+    LOG(ERROR) << "Error in mmap " << path;
+    return nullptr;
+  }
+  file = static_cast<const char*>(bundle->map_);
+  size = bundle->map_size_;
+#else
+  std::ifstream is(path, std::ios::binary);
+  if (!is) {
+    LOG(ERROR) << "Can't open bundle " << path;
+    return nullptr;
+  }
+  bundle->buffer_.assign(std::istreambuf_iterator<char>(is),
+                         std::istreambuf_iterator<char>());
+  file = bundle->buffer_.data();
+  size = bundle->buffer_.size();
+#endif
+  uint32_t version = 0;
+  uint32_t num_sections = 0;
+  if (size < kHeaderSize ||
+      memcmp(file, kBundleMagic, sizeof(kBundleMagic)) != 0) {
+    LOG(ERROR) << path << " is not a model bundle";
+    return nullptr;
+  }
+  memcpy(&version, file + 8, sizeof(version));
+  memcpy(&num_sections, file + 12, sizeof(num_sections));
+  if (version != kBundleVersion ||
+      num_sections > (size - kHeaderSize) / kEntrySize) {
+    LOG(ERROR) << "Invalid bundle " << path << " of version " << version;
+    return nullptr;
+  }
+  for (uint32_t i = 0; i < num_sections; ++i) {
+    const char* entry = file + kHeaderSize + i * kEntrySize;
+    Section section;
+    memcpy(&section.offset, entry + kNameSize, sizeof(uint64_t));
+    uint64_t section_size = 0;
+    memcpy(&section_size, entry + kNameSize + sizeof(uint64_t),
+           sizeof(uint64_t));
+    if (memchr(entry, '\0', kNameSize) == nullptr ||
+        section.offset % kAlignment != 0 || section.offset > size ||
+        section_size > size - section.offset) {
+      LOG(ERROR) << "Invalid section " << i << " of bundle " << path;
+      return nullptr;
+    }
+    section.data = file + section.offset;
+    section.size = section_size;
+    bundle->sections_[std::string(entry)] = section;
+  }
+  return bundle;
+}
+
+ModelBundle::~ModelBundle() {
+#ifndef _WIN32
+  if (map_ != nullptr) munmap(map_, map_size_);
+#endif
+}
+
+const ModelBundle::Section* ModelBundle::Find(const std::string& name) const {
+  auto it = sections_.find(name);
+  return it == sections_.end() ? nullptr : &it->second;
+}
+
+std::shared_ptr<fst::SymbolTable> ModelBundle::ReadSymbolTable(
+    const std::string& name) const {
+  const Section* section = Find(name);
+  if (section == nullptr) return nullptr;
+  MemoryStream is(section->data, section->size);
+  return std::shared_ptr<fst::SymbolTable>(
+      fst::SymbolTable::Read(is, path_ + ":" + name));
+}
+
+std::shared_ptr<fst::Fst<fst::StdArc>> ModelBundle::ReadFst(
+    const std::string& name, bool mmap) const {
+  const Section* section = Find(name);
+  if (section == nullptr) return nullptr;
+  // The graph is mapped from the file of the bundle by its offset
+  return ::wenet::ReadFst(path_, mmap, section->offset);
+}
+
+std::vector<std::string> ModelBundle::ReadLines(
+    const std::string& name) const {
+  std::vector<std::string> lines;
+  const Section* section = Find(name);
+  if (section == nullptr) return lines;
+  MemoryStream is(section->data, section->size);
+  std::string line;
+  while (std::getline(is, line)) lines.emplace_back(std::move(line));
+  return lines;
+}
+
+std::string ModelBundle::SymbolTableContent(const fst::SymbolTable& table) {
+  std::ostringstream os;
+  table.Write(os);
+  return os.str();
+}
+
+}  // namespace wenet
@@ -0,0 +1,116 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_MODEL_BUNDLE_H_
+#define UTILS_MODEL_BUNDLE_H_
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <streambuf>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fst/fstlib.h"
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// An istream over the memory of a section, which must outlive it
+class MemoryStream : public std::istream {
+ public:
+  MemoryStream(const char* data, size_t size);
+
+ private:
+  class Buffer : public std::streambuf {
+   public:
+    Buffer(const char* data, size_t size);
+
+   protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+  };
+  Buffer buffer_;
+};
+
+// ModelBundle is all the resources of a deployment in one file, so a deploy
+// is an atomic rename of the file, and the startup maps it instead of
+// reading and parsing the files one by one. The sections of the runtime
+// are "final.zip"(the torch model), "units" and "words"(the symbol tables
+// in the binary format of fst::SymbolTable::Write), "TLG.fst" and
+// "context"(one context per line), see bin/model_bundle_main. The layout
+// of the file is
+//   "WNBUNDLE", uint32 version, uint32 number of the sections,
+//   {char name[48], uint64 offset, uint64 size} of each section,
+//   the sections at the offsets aligned to 4096 bytes
+// so an aligned ConstFst is mapped from the file in place by ReadFst.
+class ModelBundle {
+ public:
+  static const size_t kAlignment = 4096;
+  struct Section {
+    const char* data = nullptr;
+    size_t size = 0;
+    // Offset in the file
+    uint64_t offset = 0;
+  };
+
+  // Whether path is a file of the magic of the bundles
+  static bool IsBundle(const std::string& path);
+  // nullptr if the file can't be mapped or isn't a valid bundle
+  static std::shared_ptr<ModelBundle> Open(const std::string& path);
+  // Write the (name, content) sections to path, by a temporary file in the
+  // same directory which is renamed to path, so the readers see either the
+  // old or the new bundle in whole.
+  static bool Write(
+      const std::string& path,
+      const std::vector<std::pair<std::string, std::string>>& sections);
+  ~ModelBundle();
+
+  const std::string& path() const { return path_; }
+  // nullptr if there is no section of the name
+  const Section* Find(const std::string& name) const;
+  // The symbol table of the binary section, nullptr on failure
+  std::shared_ptr<fst::SymbolTable> ReadSymbolTable(
+      const std::string& name) const;
+  // The graph of the section, see wenet::ReadFst, nullptr on failure
+  std::shared_ptr<fst::Fst<fst::StdArc>> ReadFst(const std::string& name,
+                                                 bool mmap = true) const;
+  // The lines of the text section
+  std::vector<std::string> ReadLines(const std::string& name) const;
+
+  // The binary content of a symbol table section
+  static std::string SymbolTableContent(const fst::SymbolTable& table);
+
+ private:
+  ModelBundle() = default;
+
+  std::string path_;
+  void* map_ = nullptr;
+  size_t map_size_ = 0;
+  // The file content if it's not mapped
+  std::vector<char> buffer_;
+  std::unordered_map<std::string, Section> sections_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ModelBundle);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_MODEL_BUNDLE_H_
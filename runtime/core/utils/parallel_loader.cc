@@ -0,0 +1,79 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/parallel_loader.h"
+
+#include <exception>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+ParallelLoader::~ParallelLoader() {
+  for (auto& future : futures_) {
+    if (future.valid()) future.wait();
+  }
+}
+
+void ParallelLoader::Run(const std::string& name,
+                         std::function<void()> load) {
+  if (!parallel_) {
+    Load(name, load);
+    return;
+  }
+  futures_.emplace_back(std::async(std::launch::async, [this, name, load]() {
+    Load(name, load);
+  }));
+}
+
+void ParallelLoader::RunHere(const std::string& name,
+                             const std::function<void()>& load) {
+  Load(name, load);
+}
+
+void ParallelLoader::Wait() {
+  std::exception_ptr error = nullptr;
+  for (auto& future : futures_) {
+    try {
+      future.get();
+    } catch (...) {
+      if (error == nullptr) error = std::current_exception();
+    }
+  }
+  futures_.clear();
+  elapsed_ = timer_.Elapsed();
+  int total = 0;
+  for (const auto& time : times()) total += time.second;
+  LOG(INFO) << "Loaded the resources in " << elapsed_ << "ms, " << total
+            << "ms of them in total";
+  if (error != nullptr) std::rethrow_exception(error);
+}
+
+std::vector<std::pair<std::string, int>> ParallelLoader::times() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return times_;
+}
+
+void ParallelLoader::Load(const std::string& name,
+                          const std::function<void()>& load) {
+  Timer timer;
+  load();
+  int elapsed = timer.Elapsed();
+  LOG(INFO) << "Loaded " << name << " in " << elapsed << "ms";
+  std::lock_guard<std::mutex> lock(mutex_);
+  times_.emplace_back(name, elapsed);
+}
+
+}  // namespace wenet
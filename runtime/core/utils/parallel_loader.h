@@ -0,0 +1,77 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_PARALLEL_LOADER_H_
+#define UTILS_PARALLEL_LOADER_H_
+
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/timer.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// ParallelLoader loads the independent resources of the startup at the same
+// time, e.g. the model and the TLG fst, each by a thread of its own, and
+// logs how long each one takes. The threads inherit the cpu affinity of the
+// caller, so the resources of a NUMA replica are still loaded on its node.
+// The loads run one by one on the caller if it's not parallel, e.g.
+//   ParallelLoader loader(FLAGS_parallel_loading);
+//   loader.Run("fst", [&]() { fst = ReadFst(FLAGS_fst_path); });
+//   loader.Run("words", [&]() { words = ReadText(FLAGS_dict_path); });
+//   loader.Wait();
+class ParallelLoader {
+ public:
+  explicit ParallelLoader(bool parallel = true) : parallel_(parallel) {}
+  // The loads still running are waited, their exceptions are dropped
+  ~ParallelLoader();
+
+  // Run the load of the resource, which must not touch the resources of the
+  // other loads before Wait()
+  void Run(const std::string& name, std::function<void()> load);
+  // Run the load on the caller, e.g. for the runtimes whose engine threads
+  // are set by the first thread using them, while the others are loading
+  void RunHere(const std::string& name, const std::function<void()>& load);
+  // Wait for all the loads, and rethrow the exception of the first failed
+  // one in the order of Run
+  void Wait();
+
+  // (name, milliseconds) of the finished loads, in the order they finished
+  std::vector<std::pair<std::string, int>> times() const;
+  // Milliseconds from the construction to the last Wait()
+  int elapsed() const { return elapsed_; }
+
+ private:
+  void Load(const std::string& name, const std::function<void()>& load);
+
+  const bool parallel_;
+  Timer timer_;
+  int elapsed_ = 0;
+  std::vector<std::future<void>> futures_;
+  mutable std::mutex mutex_;
+  std::vector<std::pair<std::string, int>> times_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ParallelLoader);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_PARALLEL_LOADER_H_
@@ -0,0 +1,134 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/prefork.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "utils/log.h"
+#include "utils/timer.h"
+
+namespace wenet {
+
+void RunPreforkWorkers(const PreforkOptions& opts,
+                       const std::function<int(int worker)>& worker) {
+  CHECK_GT(opts.num_workers, 0);
+  // The signals are waited by sigwait() in the master, the workers get the
+  // mask of the caller back
+  sigset_t set;
+  sigset_t old_set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigaddset(&set, SIGHUP);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  CHECK_EQ(pthread_sigmask(SIG_BLOCK, &set, &old_set), 0);
+
+  const pid_t master = getpid();
+  std::vector<pid_t> pids(opts.num_workers, 0);
+  std::vector<Timer> uptimes(opts.num_workers);
+  auto spawn = [&](int i) {
+    // The buffered output would be written by both of the processes
+    fflush(nullptr);
+    pid_t pid = fork();
+    CHECK_GE(pid, 0) << "Failed to fork worker " << i << ": "
+                     << strerror(errno);
+    if (pid == 0) {
+#ifdef __linux__
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      // The master died before the prctl
+      if (getppid() != master) _exit(1);
+#endif
+      pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+      int status = worker(i);
+      fflush(nullptr);
+      // The destructors of the master's statics are not run by the workers
+      _exit(status);
+    }
+    pids[i] = pid;
+    uptimes[i].Reset();
+    LOG(INFO) << "Started worker " << i << ", pid " << pid;
+  };
+  auto forward = [&pids](int sig) {
+    for (pid_t pid : pids) {
+      if (pid > 0) kill(pid, sig);
+    }
+  };
+
+  for (int i = 0; i < opts.num_workers; ++i) spawn(i);
+  int num_alive = opts.num_workers;
+  bool stopping = false;
+  while (num_alive > 0) {
+    int sig = 0;
+    if (sigwait(&set, &sig) != 0) continue;
+    if (sig == SIGHUP) {
+      if (opts.forward_sighup) {
+        LOG(INFO) << "Forward SIGHUP to the workers";
+        forward(SIGHUP);
+      }
+      continue;
+    }
+    if (sig != SIGCHLD) {
+      LOG(INFO) << "Received signal " << sig << ", stop the workers";
+      stopping = true;
+      forward(SIGTERM);
+      continue;
+    }
+    // The SIGCHLDs of the workers exiting together are merged into one
+    int status = 0;
+    pid_t pid = 0;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      int i = 0;
+      while (i < opts.num_workers && pids[i] != pid) ++i;
+      if (i == opts.num_workers) continue;
+      pids[i] = 0;
+      --num_alive;
+      bool failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+      if (WIFSIGNALED(status)) {
+        LOG(WARNING) << "Worker " << i << " is killed by signal "
+                     << WTERMSIG(status);
+      } else {
+        LOG(INFO) << "Worker " << i << " exits with status "
+                  << WEXITSTATUS(status);
+      }
+      if (!failed || stopping) continue;
+      if (uptimes[i].Elapsed() < opts.min_uptime_ms) {
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(opts.restart_delay_ms));
+      }
+      // A stop signal received while sleeping is still pending
+      spawn(i);
+      ++num_alive;
+    }
+  }
+  LOG(INFO) << "All the workers have exited";
+  CHECK_EQ(pthread_sigmask(SIG_SETMASK, &old_set, nullptr), 0);
+}
+
+}  // namespace wenet
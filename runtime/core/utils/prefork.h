@@ -0,0 +1,50 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_PREFORK_H_
+#define UTILS_PREFORK_H_
+
+#include <functional>
+
+namespace wenet {
+
+struct PreforkOptions {
+  int num_workers = 2;
+  // A failed worker which ran for less than min_uptime_ms is restarted
+  // after restart_delay_ms, so a worker failing at its start isn't forked
+  // in a busy loop
+  int min_uptime_ms = 1000;
+  int restart_delay_ms = 1000;
+  // Forward SIGHUP to the workers, otherwise it's ignored
+  bool forward_sighup = true;
+};
+
+// Fork opts.num_workers worker processes, worker i runs `worker(i)` and
+// exits by its return value, and supervise them in the calling master
+// process. The pages of the master, e.g. the weights and the graphs loaded
+// before, are shared by the workers copy-on-write, so they are in the
+// memory once as long as they're only read. A worker exiting by a signal
+// or a non zero status is restarted. SIGHUP is forwarded to the workers
+// if opts.forward_sighup, and SIGTERM and SIGINT are forwarded to stop them. Returns in the master
+// once all the workers have exited, and never in the workers.
+// It must be called before the master creates any thread, as only the
+// calling thread is forked, and the threads of the workers are created by
+// `worker`. The worker dies with the master on Linux.
+void RunPreforkWorkers(const PreforkOptions& opts,
+                       const std::function<int(int worker)>& worker);
+
+}  // namespace wenet
+
+#endif  // UTILS_PREFORK_H_
@@ -0,0 +1,111 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/profiler.h"
+
+#include <fstream>
+
+#include "utils/json_writer.h"
+#include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/string.h"
+#include "utils/trace.h"
+
+namespace wenet {
+
+Profiler& Profiler::Instance() {
+  // Never destroyed, the requests may end on detached threads at exit
+  static Profiler* profiler = new Profiler();
+  return *profiler;
+}
+
+void Profiler::set_output_dir(const std::string& dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  output_dir_ = dir;
+}
+
+bool Profiler::Start(int num_requests) {
+  CHECK_GT(num_requests, 0);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) return false;
+  running_ = true;
+  capture_id_++;
+  next_request_ = 0;
+  Tracer& tracer = Tracer::Instance();
+  enabled_tracer_ = !tracer.enabled();
+  if (enabled_tracer_) tracer.Enable();
+  LOG(INFO) << "Profile the next " << num_requests << " requests, capture "
+            << capture_id_;
+  remaining_.store(num_requests, std::memory_order_relaxed);
+  return true;
+}
+
+bool Profiler::Acquire(std::string* prefix) {
+  if (remaining_.load(std::memory_order_relaxed) <= 0) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  int remaining = remaining_.load(std::memory_order_relaxed);
+  if (remaining <= 0) return false;
+  remaining_.store(remaining - 1, std::memory_order_relaxed);
+  active_++;
+  *prefix = JoinPath(output_dir_, "wenet_profile_" +
+                                      std::to_string(capture_id_) + "_" +
+                                      std::to_string(next_request_++));
+  return true;
+}
+
+void Profiler::Release() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_GT(active_, 0);
+  active_--;
+  if (active_ == 0 && remaining_.load(std::memory_order_relaxed) == 0) {
+    Finish();
+  }
+}
+
+void Profiler::Finish() {
+  std::string prefix =
+      JoinPath(output_dir_, "wenet_profile_" + std::to_string(capture_id_));
+  std::ofstream trace(prefix + ".trace.json");
+  trace << Tracer::Instance().ExportChromeTrace();
+  std::ofstream metrics(prefix + ".metrics.txt");
+  metrics << Metrics::Instance().Serialize();
+  if (!trace || !metrics) {
+    LOG(WARNING) << "Failed to write the profile " << prefix;
+  } else {
+    LOG(INFO) << "The profile is written to " << prefix << ".*";
+  }
+  if (enabled_tracer_) Tracer::Instance().Disable();
+  last_prefix_ = prefix;
+  running_ = false;
+}
+
+std::string Profiler::Status() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  JsonWriter writer;
+  writer.StartObject()
+      .Key("capture")
+      .Int(capture_id_)
+      .Key("running")
+      .Bool(running_)
+      .Key("remaining")
+      .Int(remaining_.load(std::memory_order_relaxed))
+      .Key("active")
+      .Int(active_)
+      .Key("last_profile")
+      .String(last_prefix_)
+      .EndObject();
+  return writer.str();
+}
+
+}  // namespace wenet
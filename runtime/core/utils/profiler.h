@@ -0,0 +1,71 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_PROFILER_H_
+#define UTILS_PROFILER_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Profiler captures the next N requests of a running server on demand, e.g.
+// by `GET /profile?requests=N` of the MetricsServer. The model of each
+// captured request profiles its backend kernels into the files of the
+// prefix of the request, see AsrModel::set_profile_prefix. The Tracer is
+// enabled during the capture if it's not, and once all the captured
+// requests are done, its spans and the metrics, e.g. the StageStats, are
+// written to <dir>/wenet_profile_<id>.trace.json and .metrics.txt.
+class Profiler {
+ public:
+  static Profiler& Instance();
+
+  void set_output_dir(const std::string& dir);
+  // Capture the next num_requests requests, false if a capture is running
+  bool Start(int num_requests);
+  // Called at the start of a request, true if it's captured, with the
+  // prefix of its files
+  bool Acquire(std::string* prefix);
+  // Called at the end of a captured request, the last one writes the files
+  void Release();
+  // The state of the capture in JSON
+  std::string Status() const;
+
+ private:
+  Profiler() = default;
+  // Must be called with mutex_ held
+  void Finish();
+
+  mutable std::mutex mutex_;
+  // Checked without the lock by Acquire
+  std::atomic<int> remaining_{0};
+  int active_ = 0;
+  bool running_ = false;
+  int capture_id_ = 0;
+  int next_request_ = 0;
+  bool enabled_tracer_ = false;
+  std::string output_dir_ = ".";
+  // Of the last finished capture
+  std::string last_prefix_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Profiler);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_PROFILER_H_
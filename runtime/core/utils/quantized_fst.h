@@ -0,0 +1,130 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_QUANTIZED_FST_H_
+#define UTILS_QUANTIZED_FST_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "fst/compact-fst.h"
+#include "fst/fstlib.h"
+
+namespace wenet {
+
+// 12 bytes per arc instead of the 16 bytes of StdArc, the input label(the
+// e2e unit id of TLG) is 16 bits and the weight is quantized to 16 bits.
+struct QuantizedArc {
+  uint16_t ilabel;
+  uint16_t weight;
+  int32_t olabel;
+  int32_t nextstate;
+};
+
+// Compactor of fst::CompactFst for the decoding graph. The weights are
+// quantized uniformly by `step` from `min_weight`, and 0xFFFF is for the
+// semiring zero(infinity). The input labels must be less than kMaxILabel,
+// see kaldi/fstbin/fstquantize which converts the graph.
+class QuantizedArcCompactor {
+ public:
+  using Arc = fst::StdArc;
+  using Label = Arc::Label;
+  using StateId = Arc::StateId;
+  using Weight = Arc::Weight;
+  using Element = QuantizedArc;
+
+  static const Label kMaxILabel = 0xFFFF;
+  static const uint16_t kNoILabel = 0xFFFF;  // the final weight element
+  static const uint16_t kZeroWeight = 0xFFFF;
+  static const uint16_t kMaxLevel = 0xFFFE;
+
+  explicit QuantizedArcCompactor(float min_weight = 0.0,
+                                 float step = 1.0 / 1024)
+      : min_weight_(min_weight), step_(step) {}
+
+  Element Compact(StateId s, const Arc& arc) const {
+    Element element;
+    element.ilabel = arc.ilabel == fst::kNoLabel
+                         ? kNoILabel
+                         : static_cast<uint16_t>(arc.ilabel);
+    element.weight = Quantize(arc.weight.Value());
+    element.olabel = arc.olabel;
+    element.nextstate = arc.nextstate;
+    return element;
+  }
+
+  Arc Expand(StateId s, const Element& element,
+             uint32_t f = fst::kArcValueFlags) const {
+    Label ilabel = element.ilabel == kNoILabel ? fst::kNoLabel
+                                               : element.ilabel;
+    return Arc(ilabel, element.olabel, Dequantize(element.weight),
+               element.nextstate);
+  }
+
+  // Variable number of elements per state
+  ssize_t Size() const { return -1; }
+  uint64_t Properties() const { return 0; }
+  bool Compatible(const fst::Fst<Arc>& fst) const { return true; }
+
+  static const std::string& Type() {
+    static const std::string type = "quantized";
+    return type;
+  }
+
+  bool Write(std::ostream& strm) const {
+    fst::WriteType(strm, min_weight_);
+    fst::WriteType(strm, step_);
+    return !strm.fail();
+  }
+
+  static QuantizedArcCompactor* Read(std::istream& strm) {
+    float min_weight = 0.0;
+    float step = 0.0;
+    fst::ReadType(strm, &min_weight);
+    fst::ReadType(strm, &step);
+    if (strm.fail()) return nullptr;
+    return new QuantizedArcCompactor(min_weight, step);
+  }
+
+  float min_weight() const { return min_weight_; }
+  float step() const { return step_; }
+
+ private:
+  uint16_t Quantize(float weight) const {
+    if (weight == Weight::Zero().Value()) return kZeroWeight;
+    float level = std::round((weight - min_weight_) / step_);
+    return static_cast<uint16_t>(
+        std::min(std::max(level, 0.0f), static_cast<float>(kMaxLevel)));
+  }
+  Weight Dequantize(uint16_t weight) const {
+    if (weight == kZeroWeight) return Weight::Zero();
+    return Weight(min_weight_ + weight * step_);
+  }
+
+  float min_weight_;
+  float step_;
+};
+
+// The arcs are expanded in the cache of the CompactFst, which isn't thread
+// safe, so the graph shared by the sessions is used by the copies of
+// Copy(true) of each thread, which share the compact arcs, like
+// CtcWfstBeamSearch does.
+using QuantizedFst =
+    fst::CompactFst<fst::StdArc, QuantizedArcCompactor, uint32_t>;
+
+}  // namespace wenet
+
+#endif  // UTILS_QUANTIZED_FST_H_
@@ -0,0 +1,142 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/session_record.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include "utils/log.h"
+#include "utils/state_io.h"
+#include "utils/string.h"
+
+namespace wenet {
+
+namespace {
+
+const char kMagic[] = "WREC";
+const uint32_t kVersion = 1;
+
+int64_t SteadyUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t UnixUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+std::string SessionRecorder::dir_;  // NOLINT
+int SessionRecorder::max_sessions_ = 0;
+std::atomic<int> SessionRecorder::num_sessions_(0);
+
+void SessionRecorder::Enable(const std::string& dir, int max_sessions) {
+  dir_ = dir;
+  max_sessions_ = max_sessions;
+}
+
+std::unique_ptr<SessionRecorder> SessionRecorder::NewSession() {
+  if (dir_.empty()) return nullptr;
+  int n = num_sessions_.fetch_add(1);
+  if (max_sessions_ > 0 && n >= max_sessions_) return nullptr;
+  std::string name =
+      "session_" + std::to_string(UnixUs()) + "_" + std::to_string(n) + ".wrec";
+  std::unique_ptr<SessionRecorder> recorder(
+      new SessionRecorder(JoinPath(dir_, name)));
+  if (!recorder->ok()) return nullptr;
+  LOG(INFO) << "Record the session to " << recorder->path();
+  return recorder;
+}
+
+SessionRecorder::SessionRecorder(const std::string& path)
+    : path_(path), file_(fopen(path.c_str(), "wb")) {
+  if (file_ == nullptr) {
+    LOG(WARNING) << "Failed to open " << path << " to record the session";
+    return;
+  }
+  StateWriter writer;
+  writer.Write(kMagic, 4);
+  writer.Write(kVersion);
+  writer.Write<int64_t>(UnixUs());
+  fwrite(writer.str().data(), 1, writer.str().size(), file_);
+  last_us_ = SteadyUs();
+}
+
+SessionRecorder::~SessionRecorder() {
+  if (file_ != nullptr) fclose(file_);
+}
+
+void SessionRecorder::Record(RecordedPacket::Type type, const char* data,
+                             size_t size) {
+  if (file_ == nullptr) return;
+  int64_t now = SteadyUs();
+  // The gaps over an hour are cut
+  uint32_t delta = static_cast<uint32_t>(
+      std::min<int64_t>(now - last_us_, 3600 * 1000000LL));
+  last_us_ = now;
+  StateWriter writer;
+  writer.Write<uint8_t>(type);
+  writer.Write(delta);
+  writer.Write<uint32_t>(size);
+  fwrite(writer.str().data(), 1, writer.str().size(), file_);
+  fwrite(data, 1, size, file_);
+  // Flushed per packet, so the record is kept if the server crashes
+  fflush(file_);
+}
+
+bool ReadSessionRecord(const std::string& path, SessionRecord* record) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) return false;
+  std::stringstream buffer;
+  buffer << in.rdbuf();
+  std::string blob = buffer.str();
+  StateReader reader(blob);
+  char magic[4];
+  uint32_t version = 0;
+  if (!reader.Read(magic, 4) || !std::equal(magic, magic + 4, kMagic) ||
+      !reader.Read(&version) || version != kVersion ||
+      !reader.Read(&record->start_unix_us)) {
+    return false;
+  }
+  record->packets.clear();
+  int64_t time_us = 0;
+  while (!reader.done()) {
+    uint8_t type = 0;
+    uint32_t delta = 0, size = 0;
+    if (!reader.Read(&type) || !reader.Read(&delta) || !reader.Read(&size) ||
+        size > reader.remaining() || type > RecordedPacket::kBinary) {
+      LOG(WARNING) << "Truncated record " << path << " after "
+                   << record->packets.size() << " packets";
+      break;
+    }
+    RecordedPacket packet;
+    packet.type = static_cast<RecordedPacket::Type>(type);
+    time_us += delta;
+    packet.time_us = time_us;
+    packet.data.resize(size);
+    reader.Read(&packet.data[0], size);
+    record->packets.push_back(std::move(packet));
+  }
+  return true;
+}
+
+}  // namespace wenet
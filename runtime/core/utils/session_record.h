@@ -0,0 +1,99 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_SESSION_RECORD_H_
+#define UTILS_SESSION_RECORD_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// One message received by the server on a session, with the time it
+// arrived, relative to the start of the session
+struct RecordedPacket {
+  enum Type : uint8_t {
+    kText = 0,    // a signal, e.g. the start one with the options
+    kBinary = 1,  // a packet of the audio, or of the features
+  };
+  Type type = kBinary;
+  int64_t time_us = 0;
+  std::string data;
+};
+
+// A session read back by ReadSessionRecord
+struct SessionRecord {
+  // Unix time of the start of the session, which places the sessions of a
+  // server relative to each other
+  int64_t start_unix_us = 0;
+  std::vector<RecordedPacket> packets;
+};
+
+// SessionRecorder writes the messages a server receives on a session to a
+// file with their arrival times, so the performance issues depending on the
+// exact arrival of the packets can be reproduced by session_replay_main.
+// The messages of the websocket protocol are kept as they are, the gRPC
+// requests are recorded as the same messages, i.e. the decode config as the
+// start signal, the audio as binary packets and the end signal.
+// The file is the magic "WREC" and a version, the start time, then each
+// packet as its type, the microseconds since the previous one, its size and
+// bytes, which are written through as the packets arrive.
+class SessionRecorder {
+ public:
+  // Record up to `max_sessions` sessions, 0 for no limit, to dir/
+  // session_<unix us>_<n>.wrec. Call it before the server is started.
+  static void Enable(const std::string& dir, int max_sessions = 0);
+  // nullptr if the recording is disabled, the file can't be opened, or
+  // max_sessions are recorded
+  static std::unique_ptr<SessionRecorder> NewSession();
+
+  explicit SessionRecorder(const std::string& path);
+  ~SessionRecorder();
+
+  bool ok() const { return file_ != nullptr; }
+  const std::string& path() const { return path_; }
+  // Called by the reading thread of the session
+  void Record(RecordedPacket::Type type, const char* data, size_t size);
+  void Record(RecordedPacket::Type type, const std::string& data) {
+    Record(type, data.data(), data.size());
+  }
+
+ private:
+  static std::string dir_;
+  static int max_sessions_;
+  static std::atomic<int> num_sessions_;
+
+  std::string path_;
+  FILE* file_ = nullptr;
+  // Steady time of the last packet, in microseconds
+  int64_t last_us_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(SessionRecorder);
+};
+
+// False if the file is not a session record, the packets read before a
+// truncated one are kept, e.g. of a server killed in the session
+bool ReadSessionRecord(const std::string& path, SessionRecord* record);
+
+}  // namespace wenet
+
+#endif  // UTILS_SESSION_RECORD_H_
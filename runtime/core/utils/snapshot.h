@@ -0,0 +1,52 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_SNAPSHOT_H_
+#define UTILS_SNAPSHOT_H_
+
+#include <memory>
+#include <utility>
+
+namespace wenet {
+
+// Snapshot publishes an immutable value of one thread, e.g. the result of
+// the decoding thread, to the readers of other threads, RCU style: a new
+// value is published by a swap of the shared_ptr, and an old one is freed
+// by its last reader. So the readers hold no lock of the writer, and the
+// writer is never blocked for longer than the swap, however long the
+// readers keep their values.
+template <typename T>
+class Snapshot {
+ public:
+  Snapshot() : value_(std::make_shared<const T>()) {}
+  explicit Snapshot(T value)
+      : value_(std::make_shared<const T>(std::move(value))) {}
+
+  void Publish(std::shared_ptr<const T> value) {
+    std::atomic_store(&value_, std::move(value));
+  }
+  void Publish(T value) {
+    Publish(std::make_shared<const T>(std::move(value)));
+  }
+  // The last published value, which stays valid while it's held
+  std::shared_ptr<const T> Get() const { return std::atomic_load(&value_); }
+
+ private:
+  std::shared_ptr<const T> value_;
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_SNAPSHOT_H_
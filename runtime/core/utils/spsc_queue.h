@@ -0,0 +1,214 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_SPSC_QUEUE_H_
+#define UTILS_SPSC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// SpscQueue is a lock-free queue of exactly one producer thread and one
+// consumer thread, for the hot paths on which BlockingQueue would take a
+// mutex and signal a condition variable per value. The values are in a
+// chain of fixed size blocks, so a push never blocks, the producer may
+// push all the values before the consumer starts, e.g. decoder_main
+// feeds a whole wave before decoding. The blocks the consumer has drained
+// stay at the front of the chain, from which the producer takes its new
+// tail blocks, so a queue in the steady state allocates none. The counters
+// of the two threads are on their own cache lines.
+//
+// The consumer spins a little, then parks until the number of values it
+// waits for is pushed, so a producer pushing a batch of values wakes it at
+// most once, and never takes the mutex if the consumer is not parked.
+template <typename T, size_t kBlockSize = 256>
+class SpscQueue {
+ public:
+  SpscQueue() { Init(); }
+  ~SpscQueue() { Free(); }
+
+  // Producer: push the values, which are moved from, as one batch
+  void Push(std::vector<T>* values) {
+    for (auto& value : *values) {
+      if (tail_index_ == kBlockSize) {
+        Block* block = NewBlock();
+        tail_->next = block;
+        tail_ = block;
+        tail_index_ = 0;
+      }
+      tail_->values[tail_index_++] = std::move(value);
+    }
+    // Only the producer writes pushed_
+    Publish(pushed_.load(std::memory_order_relaxed) + values->size());
+    values->clear();
+  }
+  void Push(T&& value) {
+    std::vector<T> values;
+    values.emplace_back(std::move(value));
+    Push(&values);
+  }
+
+  // Producer: no more values will be pushed
+  void Close() {
+    closed_.store(true, std::memory_order_seq_cst);
+    Wake(true);
+  }
+
+  // Consumer: wait until `num` values are pushed or the queue is closed,
+  // and append up to `num` values to `values`. Return the number of values
+  // popped, which is less than `num` only if the queue is closed.
+  size_t Pop(size_t num, std::vector<T>* values) {
+    size_t popped = popped_.load(std::memory_order_relaxed);
+    size_t target = popped + num;
+    if (!Ready(target)) Wait(target);
+    size_t available = pushed_.load(std::memory_order_acquire) - popped;
+    size_t n = std::min(num, available);
+    for (size_t i = 0; i < n; ++i) {
+      if (head_index_ == kBlockSize) {
+        // The drained block is left to the producer to recycle
+        head_ = head_->next;
+        head_index_ = 0;
+        consumer_block_.store(head_, std::memory_order_release);
+      }
+      values->emplace_back(std::move(head_->values[head_index_++]));
+    }
+    popped_.store(popped + n, std::memory_order_release);
+    return n;
+  }
+
+  // The values pushed but not popped yet, from any thread. popped_ is
+  // loaded first, so it is not ahead of the pushed_ loaded after it.
+  size_t Size() const {
+    size_t popped = popped_.load(std::memory_order_acquire);
+    return pushed_.load(std::memory_order_acquire) - popped;
+  }
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+  // Drop all the values and reopen the queue, neither thread may use the
+  // queue meanwhile
+  void Clear() {
+    Free();
+    Init();
+  }
+
+ private:
+  struct Block {
+    T values[kBlockSize];
+    Block* next = nullptr;
+  };
+
+  void Init() {
+    head_ = tail_ = first_ = recycled_until_ = new Block();
+    consumer_block_.store(head_);
+    head_index_ = tail_index_ = 0;
+    pushed_.store(0);
+    popped_.store(0);
+    closed_.store(false);
+    waiting_for_.store(0);
+  }
+  void Free() {
+    while (first_ != nullptr) {
+      Block* next = first_->next;
+      delete first_;
+      first_ = next;
+    }
+    head_ = tail_ = recycled_until_ = nullptr;
+  }
+
+  // Producer: the first of the blocks before the one the consumer reads,
+  // which it won't touch again, or a new one
+  Block* NewBlock() {
+    if (first_ == recycled_until_) {
+      recycled_until_ = consumer_block_.load(std::memory_order_acquire);
+    }
+    if (first_ == recycled_until_) return new Block();
+    Block* block = first_;
+    first_ = first_->next;
+    block->next = nullptr;
+    return block;
+  }
+
+  void Publish(size_t pushed) {
+    pushed_.store(pushed, std::memory_order_seq_cst);
+    size_t waiting_for = waiting_for_.load(std::memory_order_seq_cst);
+    Wake(waiting_for != 0 && pushed >= waiting_for);
+  }
+
+  void Wake(bool parked) {
+    if (!parked) return;
+    {
+      // Not notified between the check and the wait of the consumer
+      std::lock_guard<std::mutex> lock(mutex_);
+    }
+    condition_.notify_one();
+  }
+
+  bool Ready(size_t target) const {
+    return pushed_.load(std::memory_order_acquire) >= target ||
+           closed_.load(std::memory_order_acquire);
+  }
+
+  void Wait(size_t target) {
+    for (int i = 0; i < kSpinCount; ++i) {
+      if (Ready(target)) return;
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    waiting_for_.store(target, std::memory_order_seq_cst);
+    condition_.wait(lock, [this, target] {
+      return pushed_.load(std::memory_order_seq_cst) >= target ||
+             closed_.load(std::memory_order_seq_cst);
+    });
+    waiting_for_.store(0, std::memory_order_relaxed);
+  }
+
+  static constexpr int kSpinCount = 64;
+  static constexpr size_t kCacheLine = 64;
+
+  // Consumer side
+  alignas(kCacheLine) Block* head_ = nullptr;
+  size_t head_index_ = 0;
+  std::atomic<size_t> popped_{0};
+  // head_ published to the producer, the blocks before it are drained
+  std::atomic<Block*> consumer_block_{nullptr};
+  // Producer side
+  alignas(kCacheLine) Block* tail_ = nullptr;
+  size_t tail_index_ = 0;
+  std::atomic<size_t> pushed_{0};
+  // The front of the chain, and the last consumer_block_ loaded, the blocks
+  // from first_ up to it are free to recycle
+  Block* first_ = nullptr;
+  Block* recycled_until_ = nullptr;
+  // Shared
+  alignas(kCacheLine) std::atomic<bool> closed_{false};
+  std::atomic<size_t> waiting_for_{0};
+  std::mutex mutex_;
+  std::condition_variable condition_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(SpscQueue);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_SPSC_QUEUE_H_
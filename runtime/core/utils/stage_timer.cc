@@ -0,0 +1,148 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/stage_timer.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace wenet {
+
+namespace {
+
+struct LocalStage {
+  Histogram* histogram = nullptr;
+  // Non cumulative, as the buckets of the histogram
+  std::vector<uint64_t> counts;
+  uint64_t count = 0;
+  double sum = 0.0;
+};
+
+struct ThreadBuckets {
+  // Only taken by FlushAll besides the thread itself
+  std::mutex mutex;
+  // By the id of the StageStats
+  std::vector<LocalStage> stages;
+  std::chrono::steady_clock::time_point last_flush =
+      std::chrono::steady_clock::now();
+
+  void FlushLocked() {
+    for (LocalStage& stage : stages) {
+      if (stage.count == 0) continue;
+      stage.histogram->Merge(stage.counts, stage.count, stage.sum);
+      std::fill(stage.counts.begin(), stage.counts.end(), 0);
+      stage.count = 0;
+      stage.sum = 0.0;
+    }
+    last_flush = std::chrono::steady_clock::now();
+  }
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::map<std::string, StageStats*> stages;
+  std::set<ThreadBuckets*> threads;
+};
+
+Registry& GetRegistry() {
+  // Never destroyed, the threads may exit after it
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+// The buckets of a thread are registered for FlushAll while it lives
+class ThreadHolder {
+ public:
+  ThreadHolder() : buckets_(new ThreadBuckets()) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.insert(buckets_);
+  }
+  ~ThreadHolder() {
+    {
+      Registry& registry = GetRegistry();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      registry.threads.erase(buckets_);
+    }
+    buckets_->FlushLocked();
+    delete buckets_;
+  }
+  ThreadBuckets* buckets() const { return buckets_; }
+
+ private:
+  ThreadBuckets* buckets_;
+};
+
+ThreadBuckets* LocalBuckets() {
+  static thread_local ThreadHolder holder;
+  return holder.buckets();
+}
+
+}  // namespace
+
+StageStats* StageStats::Get(const std::string& name,
+                            const std::string& help) {
+  static const std::vector<double> kStageBounds = {
+      1e-5, 2e-5, 5e-5, 1e-4, 2e-4, 5e-4, 0.001, 0.002, 0.005, 0.01,
+      0.02, 0.05, 0.1,  0.2,  0.5,  1,    2,     5,     10};
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  StageStats*& stats = registry.stages[name];
+  if (stats == nullptr) {
+    Histogram* histogram =
+        Metrics::Instance().GetHistogram(name, help, kStageBounds);
+    stats = new StageStats(registry.stages.size() - 1, histogram);
+  }
+  return stats;
+}
+
+void StageStats::Record(int64_t ns) {
+  ThreadBuckets* buckets = LocalBuckets();
+  std::lock_guard<std::mutex> lock(buckets->mutex);
+  if (id_ >= buckets->stages.size()) buckets->stages.resize(id_ + 1);
+  LocalStage& stage = buckets->stages[id_];
+  if (stage.histogram == nullptr) {
+    stage.histogram = histogram_;
+    stage.counts.assign(histogram_->bounds().size() + 1, 0);
+  }
+  double seconds = ns / 1e9;
+  stage.counts[histogram_->BucketIndex(seconds)]++;
+  stage.count++;
+  stage.sum += seconds;
+  auto now = std::chrono::steady_clock::now();
+  if (now - buckets->last_flush >=
+      std::chrono::milliseconds(kFlushIntervalMs)) {
+    buckets->FlushLocked();
+  }
+}
+
+void StageStats::Flush() {
+  ThreadBuckets* buckets = LocalBuckets();
+  std::lock_guard<std::mutex> lock(buckets->mutex);
+  buckets->FlushLocked();
+}
+
+void StageStats::FlushAll() {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (ThreadBuckets* buckets : registry.threads) {
+    std::lock_guard<std::mutex> thread_lock(buckets->mutex);
+    buckets->FlushLocked();
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,97 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_STAGE_TIMER_H_
+#define UTILS_STAGE_TIMER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "utils/metrics.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// StageStats is the latency histogram of a stage of the decoding, e.g. the
+// search of a chunk, in the Metrics. The latencies are timed in ns by
+// StageTimer, and accumulated in the buckets of the thread, so the stages
+// of the decoding threads don't contend for the atomics of the histogram.
+// The buckets of a thread are merged into the histogram every
+// kFlushIntervalMs of its stages, at its exit, and when the Metrics are
+// serialized, e.g.
+//   static StageStats* search = StageStats::Get(
+//       "wenet_search_seconds", "CTC search latency of a chunk");
+//   StageTimer timer(search);
+//   ...
+//   VLOG(2) << "search takes " << timer.Stop() / 1e6 << " ms";
+class StageStats {
+ public:
+  static constexpr int kFlushIntervalMs = 1000;
+
+  // The histogram of the same name is shared, with the bounds from 10us to
+  // 10s if it's not registered yet. Never destroyed.
+  static StageStats* Get(const std::string& name, const std::string& help);
+
+  void Record(int64_t ns);
+  Histogram* histogram() const { return histogram_; }
+
+  // Merge the buckets of the calling thread into the histograms
+  static void Flush();
+  // Merge the buckets of all the threads into the histograms
+  static void FlushAll();
+
+ private:
+  StageStats(int id, Histogram* histogram) : id_(id), histogram_(histogram) {}
+
+  const int id_;
+  Histogram* const histogram_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(StageStats);
+};
+
+// Times its scope into the StageStats, or until Stop()
+class StageTimer {
+ public:
+  explicit StageTimer(StageStats* stats)
+      : stats_(stats), start_(std::chrono::steady_clock::now()) {}
+  ~StageTimer() { Stop(); }
+
+  int64_t ElapsedNs() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+  }
+  // Record the time so far once, and return it in ns
+  int64_t Stop() {
+    int64_t ns = ElapsedNs();
+    if (stats_ != nullptr) {
+      stats_->Record(ns);
+      stats_ = nullptr;
+    }
+    return ns;
+  }
+
+ private:
+  StageStats* stats_;
+  std::chrono::steady_clock::time_point start_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(StageTimer);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_STAGE_TIMER_H_
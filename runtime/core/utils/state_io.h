@@ -0,0 +1,108 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_STATE_IO_H_
+#define UTILS_STATE_IO_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace wenet {
+
+// StateWriter appends the states of a decoding session to a binary blob,
+// which is read back by StateReader in the same order, e.g. to move the
+// session to another process of the same model and options. The values are
+// in the native byte order, and the vectors are prefixed by their sizes.
+class StateWriter {
+ public:
+  void Clear() { out_.clear(); }
+  const std::string& str() const { return out_; }
+
+  template <typename T>
+  void Write(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "not a plain type");
+    out_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  template <typename T>
+  void Write(const T* data, size_t size) {
+    static_assert(std::is_trivially_copyable<T>::value, "not a plain type");
+    out_.append(reinterpret_cast<const char*>(data), size * sizeof(T));
+  }
+  template <typename T>
+  void WriteVector(const std::vector<T>& values) {
+    Write<uint64_t>(values.size());
+    Write(values.data(), values.size());
+  }
+  void WriteString(const std::string& value) {
+    Write<uint64_t>(value.size());
+    out_.append(value);
+  }
+
+ private:
+  std::string out_;
+};
+
+// All the reads return false once the blob is short of the value, or the
+// size of a vector is out of the blob, after which the reader stays failed.
+class StateReader {
+ public:
+  StateReader(const char* data, size_t size) : data_(data), size_(size) {}
+  explicit StateReader(const std::string& blob)
+      : StateReader(blob.data(), blob.size()) {}
+
+  // Whether no read has failed and the blob is all read
+  bool done() const { return ok_ && pos_ == size_; }
+  // The bytes not read yet, e.g. to bound the count of a list
+  size_t remaining() const { return size_ - pos_; }
+
+  template <typename T>
+  bool Read(T* value) {
+    return Read(value, 1);
+  }
+  template <typename T>
+  bool Read(T* data, size_t size) {
+    static_assert(std::is_trivially_copyable<T>::value, "not a plain type");
+    if (!ok_ || size > (size_ - pos_) / sizeof(T)) return ok_ = false;
+    memcpy(data, data_ + pos_, size * sizeof(T));
+    pos_ += size * sizeof(T);
+    return true;
+  }
+  template <typename T>
+  bool ReadVector(std::vector<T>* values) {
+    uint64_t size = 0;
+    if (!Read(&size) || size > (size_ - pos_) / sizeof(T)) return ok_ = false;
+    values->resize(size);
+    return Read(values->data(), size);
+  }
+  bool ReadString(std::string* value) {
+    uint64_t size = 0;
+    if (!Read(&size) || size > size_ - pos_) return ok_ = false;
+    value->assign(data_ + pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t pos_ = 0;
+  bool ok_ = true;
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_STATE_IO_H_
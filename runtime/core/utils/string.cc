@@ -14,11 +14,15 @@
 
 #include "utils/string.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
 
 #include "utils/log.h"
+#include "utils/symbol_map.h"
 #include "utils/utils.h"
 
 namespace wenet {
@@ -95,10 +99,13 @@ bool CheckEnglishChar(const std::string& ch) {
 }
 
 bool CheckEnglishWord(const std::string& word) {
-  std::vector<std::string> chars;
-  SplitUTF8StringToChars(word, &chars);
-  for (size_t k = 0; k < chars.size(); k++) {
-    if (!CheckEnglishChar(chars[k])) {
+  return CheckEnglishWord(word.data(), word.size());
+}
+
+bool CheckEnglishWord(const char* word, size_t size) {
+  // The chars of more than one byte are not english
+  for (size_t i = 0; i < size; ++i) {
+    if ((word[i] & 0x80) != 0 || !(isalpha(word[i]) || word[i] == '\'')) {
       return false;
     }
   }
@@ -126,10 +133,10 @@ bool IsAlpha(const std::string& str) {
   return true;
 }
 
-bool SplitUTF8StringToWords(
-    const std::string& str,
-    const std::shared_ptr<fst::SymbolTable>& symbol_table,
-    std::vector<std::string>* words) {
+template <typename Symbols>
+static bool SplitUTF8StringToWordsImpl(const std::string& str,
+                                       const Symbols& symbol_table,
+                                       std::vector<std::string>* words) {
   std::vector<std::string> chars;
   SplitUTF8StringToChars(Trim(str), &chars);
 
@@ -150,7 +157,7 @@ bool SplitUTF8StringToWords(
         word = kSpaceSymbol + word;
       }
 
-      if (symbol_table->Find(word) != -1) {
+      if (symbol_table.Find(word) != -1) {
         words->emplace_back(word);
         start = end;
         continue;
@@ -165,37 +172,102 @@ bool SplitUTF8StringToWords(
   return no_oov;
 }
 
+bool SplitUTF8StringToWords(
+    const std::string& str,
+    const std::shared_ptr<fst::SymbolTable>& symbol_table,
+    std::vector<std::string>* words) {
+  return SplitUTF8StringToWordsImpl(str, *symbol_table, words);
+}
+
+bool SplitUTF8StringToWords(const std::string& str, const SymbolMap& symbols,
+                            std::vector<std::string>* words) {
+  return SplitUTF8StringToWordsImpl(str, symbols, words);
+}
+
 std::string ProcessBlank(const std::string& str, bool lowercase) {
   std::string result;
-  if (!str.empty()) {
-    std::vector<std::string> chars;
-    SplitUTF8StringToChars(Trim(str), &chars);
+  size_t start = str.find_first_not_of(WHITESPACE);
+  if (start == std::string::npos) return result;
+  size_t end = str.find_last_not_of(WHITESPACE) + 1;
+  BlankWriter writer(lowercase, &result);
+  writer.Append(str.data() + start, end - start);
+  writer.Finish();
+  return result;
+}
+
+// The case of the non ASCII chars is converted by the wide chars of the
+// user's locale, see issue 745: https://github.com/wenet-e2e/wenet/issues/745
+static const std::ctype<wchar_t>& WideCType() {
+  static const std::locale* loc = new std::locale("");
+  return std::use_facet<std::ctype<wchar_t>>(*loc);
+}
 
-    for (std::string& ch : chars) {
-      if (ch != kSpaceSymbol) {
-        result.append(ch);
+static void AppendUTF8(uint32_t code, std::string* out) {
+  if (code < 0x80) {
+    *out += static_cast<char>(code);
+  } else if (code < 0x800) {
+    *out += static_cast<char>(0xC0 | (code >> 6));
+    *out += static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    *out += static_cast<char>(0xE0 | (code >> 12));
+    *out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    *out += static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    *out += static_cast<char>(0xF0 | (code >> 18));
+    *out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    *out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    *out += static_cast<char>(0x80 | (code & 0x3F));
+  }
+}
+
+void BlankWriter::Append(const char* data, size_t size) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  // The bytes of kSpaceSymbol "▁"
+  static const uint8_t kSpace[] = {0xE2, 0x96, 0x81};
+  for (size_t i = 0; i < size;) {
+    uint8_t c = bytes[i];
+    if (c < 0x80) {
+      if (lowercase_) {
+        *out_ += static_cast<char>(c >= 'A' && c <= 'Z' ? c + 32 : c);
       } else {
-        // Ignore consecutive space or located in head
-        if (!result.empty() && result.back() != ' ') {
-          result.push_back(' ');
-        }
+        *out_ += static_cast<char>(c >= 'a' && c <= 'z' ? c - 32 : c);
       }
+      ++i;
+      continue;
+    }
+    if (i + 3 <= size && memcmp(bytes + i, kSpace, 3) == 0) {
+      // Ignore consecutive space or located in head
+      if (out_->size() > start_ && out_->back() != ' ') *out_ += ' ';
+      i += 3;
+      continue;
+    }
+    size_t length = (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3
+                  : (c & 0xF8) == 0xF0 ? 4 : 1;
+    uint32_t code = length == 2 ? c & 0x1F : length == 3 ? c & 0x0F : c & 0x07;
+    bool valid = length > 1 && i + length <= size;
+    for (size_t k = 1; valid && k < length; ++k) {
+      valid = (bytes[i + k] & 0xC0) == 0x80;
+      code = (code << 6) | (bytes[i + k] & 0x3F);
     }
-    // Ignore tailing space
-    if (!result.empty() && result.back() == ' ') {
-      result.pop_back();
+    if (!valid) {
+      // Not of UTF-8, which is kept as it is
+      *out_ += static_cast<char>(c);
+      ++i;
+      continue;
     }
-    // NOTE: convert string to wstring
-    //       see issue 745: https://github.com/wenet-e2e/wenet/issues/745
-    std::locale loc("");
-    std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-    std::wstring wsresult = converter.from_bytes(result);
-    for (auto& c : wsresult) {
-      c = lowercase ? tolower(c, loc) : toupper(c, loc);
+    if (code <= static_cast<uint32_t>(std::numeric_limits<wchar_t>::max())) {
+      wchar_t wide = static_cast<wchar_t>(code);
+      wide = lowercase_ ? WideCType().tolower(wide) : WideCType().toupper(wide);
+      code = static_cast<uint32_t>(wide);
     }
-    result = converter.to_bytes(wsresult);
+    AppendUTF8(code, out_);
+    i += length;
   }
-  return result;
+}
+
+void BlankWriter::Finish() {
+  // Ignore tailing space
+  if (out_->size() > start_ && out_->back() == ' ') out_->pop_back();
 }
 
 std::string Ltrim(const std::string& str) {
@@ -219,6 +291,46 @@ std::string JoinPath(const std::string& left, const std::string& right) {
   return path;
 }
 
+std::vector<std::string> ScoringTokens(const std::string& text) {
+  std::vector<std::string> chars;
+  SplitUTF8StringToChars(Trim(text), &chars);
+  std::vector<std::string> tokens;
+  bool in_word = false;
+  for (const auto& ch : chars) {
+    if (ch == " ") {
+      in_word = false;
+    } else if (ch.size() == 1 && CheckEnglishChar(ch)) {
+      if (in_word) {
+        tokens.back() += ch;
+      } else {
+        tokens.push_back(ch);
+      }
+      in_word = true;
+    } else {
+      tokens.push_back(ch);
+      in_word = false;
+    }
+  }
+  return tokens;
+}
+
+int EditDistance(const std::vector<std::string>& a,
+                 const std::vector<std::string>& b) {
+  std::vector<int> row(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); ++j) row[j] = j;
+  for (size_t i = 1; i <= a.size(); ++i) {
+    int diagonal = row[0];
+    row[0] = i;
+    for (size_t j = 1; j <= b.size(); ++j) {
+      int up = row[j];
+      row[j] = std::min({row[j] + 1, row[j - 1] + 1,
+                         diagonal + (a[i - 1] == b[j - 1] ? 0 : 1)});
+      diagonal = up;
+    }
+  }
+  return row[b.size()];
+}
+
 #ifdef _MSC_VER
 std::wstring ToWString(const std::string& str) {
   unsigned len = str.size() * 2;
@@ -25,6 +25,8 @@
 
 namespace wenet {
 
+class SymbolMap;
+
 const char WHITESPACE[] = " \n\r\t\f\v";
 
 // Split the string with space or tab.
@@ -49,6 +51,7 @@ bool CheckEnglishChar(const std::string& ch);
 
 // Check whether the UTF-8 word is only contains alphabet or '.
 bool CheckEnglishWord(const std::string& word);
+bool CheckEnglishWord(const char* word, size_t size);
 
 std::string JoinString(const std::string& c,
                        const std::vector<std::string>& strs);
@@ -61,10 +64,33 @@ bool SplitUTF8StringToWords(
     const std::string& str,
     const std::shared_ptr<fst::SymbolTable>& symbol_table,
     std::vector<std::string>* words);
+bool SplitUTF8StringToWords(const std::string& str, const SymbolMap& symbols,
+                            std::vector<std::string>* words);
 
 // Replace ▁ with space, then remove head, tail and consecutive space.
 std::string ProcessBlank(const std::string& str, bool lowercase);
 
+// ProcessBlank of the pieces appended to `out` in one pass, and the case of
+// each char is converted as it's appended, e.g.
+//   BlankWriter writer(true, &out);
+//   writer.Append(word.data(), word.size());
+//   writer.Finish();
+// The head spaces are not trimmed, which is up to the caller.
+class BlankWriter {
+ public:
+  BlankWriter(bool lowercase, std::string* out)
+      : lowercase_(lowercase), out_(out), start_(out->size()) {}
+  // The piece is of whole UTF-8 chars
+  void Append(const char* data, size_t size);
+  // Remove the tailing space
+  void Finish();
+
+ private:
+  bool lowercase_;
+  std::string* out_;
+  size_t start_;
+};
+
 std::string Ltrim(const std::string& str);
 
 std::string Rtrim(const std::string& str);
@@ -73,6 +99,14 @@ std::string Trim(const std::string& str);
 
 std::string JoinPath(const std::string& left, const std::string& right);
 
+// The tokens of a text to score the error rate, a word for English and a
+// char for the others
+std::vector<std::string> ScoringTokens(const std::string& text);
+
+// Levenshtein distance of the tokens
+int EditDistance(const std::vector<std::string>& a,
+                 const std::vector<std::string>& b);
+
 #ifdef _MSC_VER
 std::wstring ToWString(const std::string& str);
 #endif
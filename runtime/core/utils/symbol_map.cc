@@ -0,0 +1,131 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/symbol_map.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+// FNV-1a of the symbol
+static uint64_t Hash(const char* data, size_t length) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// The finalizer of splitmix64, so the slots of the seeds are independent
+static uint64_t Mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+SymbolMap::SymbolMap(const fst::SymbolTable& table) {
+  std::vector<std::pair<int64_t, std::string>> items;
+  items.reserve(table.NumSymbols());
+  for (fst::SymbolTableIterator it(table); !it.Done(); it.Next()) {
+    items.emplace_back(it.Value(), it.Symbol());
+  }
+  Build(items);
+}
+
+SymbolMap::SymbolMap(
+    const std::vector<std::pair<int64_t, std::string>>& items) {
+  Build(items);
+}
+
+uint32_t SymbolMap::Slot(uint64_t hash, uint32_t seed) const {
+  return Mix(hash ^ (seed * 0x9e3779b97f4a7c15ULL)) % slots_.size();
+}
+
+void SymbolMap::Build(
+    const std::vector<std::pair<int64_t, std::string>>& items) {
+  int64_t max_id = -1;
+  for (const auto& item : items) {
+    CHECK_GE(item.first, 0);
+    max_id = std::max(max_id, item.first);
+  }
+  // The pool by the id
+  std::vector<const std::string*> symbols(max_id + 1, nullptr);
+  for (const auto& item : items) symbols[item.first] = &item.second;
+  offsets_.assign(1, 0);
+  offsets_.reserve(max_id + 2);
+  for (const std::string* symbol : symbols) {
+    if (symbol != nullptr) pool_ += *symbol;
+    offsets_.push_back(pool_.size());
+  }
+  if (items.empty()) return;
+
+  // Hash and displace: the buckets of about 2 symbols are placed from the
+  // largest, each by the first seed of which the slots are all free
+  size_t num_buckets = items.size() / 2 + 1;
+  seeds_.assign(num_buckets, 0);
+  slots_.assign(items.size() + items.size() / 4 + 1, -1);
+  std::vector<std::vector<int>> buckets(num_buckets);
+  std::vector<uint64_t> hashes(max_id + 1, 0);
+  for (int64_t id = 0; id <= max_id; ++id) {
+    if (symbols[id] == nullptr) continue;
+    hashes[id] = Hash(data(id), length(id));
+    buckets[hashes[id] % num_buckets].push_back(id);
+  }
+  std::vector<int> order(num_buckets);
+  for (size_t i = 0; i < num_buckets; ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&buckets](int a, int b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+  std::vector<uint32_t> placed;
+  for (int b : order) {
+    const std::vector<int>& bucket = buckets[b];
+    if (bucket.empty()) break;
+    for (uint32_t seed = 0;; ++seed) {
+      placed.clear();
+      for (int id : bucket) {
+        uint32_t slot = Slot(hashes[id], seed);
+        if (slots_[slot] >= 0 ||
+            std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+          break;
+        }
+        placed.push_back(slot);
+      }
+      if (placed.size() == bucket.size()) {
+        seeds_[b] = seed;
+        break;
+      }
+    }
+    for (size_t i = 0; i < bucket.size(); ++i) slots_[placed[i]] = bucket[i];
+  }
+}
+
+int64_t SymbolMap::Find(const char* symbol, size_t length) const {
+  if (slots_.empty()) return fst::kNoSymbol;
+  uint64_t hash = Hash(symbol, length);
+  int32_t id = slots_[Slot(hash, seeds_[hash % seeds_.size()])];
+  if (id < 0 || this->length(id) != length ||
+      memcmp(data(id), symbol, length) != 0) {
+    return fst::kNoSymbol;
+  }
+  return id;
+}
+
+}  // namespace wenet
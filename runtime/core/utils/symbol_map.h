@@ -0,0 +1,85 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_SYMBOL_MAP_H_
+#define UTILS_SYMBOL_MAP_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fst/symbol-table.h"
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// SymbolMap is a read only copy of a fst::SymbolTable for the lookups on the
+// hot path. The symbols are in one contiguous pool by the id, so a symbol is
+// appended to a sentence without a std::string of its own, and the ids are
+// found by a perfect hash of the symbols built once, of which a lookup is a
+// hash and one comparison of the symbol, e.g.
+//   auto symbols = std::make_shared<SymbolMap>(*symbol_table);
+//   symbols->Append(id, &sentence);
+// It's built once in DecodeResource, and shared by the sessions.
+class SymbolMap {
+ public:
+  SymbolMap() = default;
+  explicit SymbolMap(const fst::SymbolTable& table);
+  explicit SymbolMap(const std::vector<std::pair<int64_t, std::string>>& items);
+
+  // Number of the ids, which are [0, size()), the unused ones are empty
+  int64_t size() const { return static_cast<int64_t>(offsets_.size()) - 1; }
+  // Return fst::kNoSymbol if it's not found
+  int64_t Find(const char* symbol, size_t length) const;
+  int64_t Find(const std::string& symbol) const {
+    return Find(symbol.data(), symbol.size());
+  }
+  // The symbol of `id`, empty for the unknown ids
+  const char* data(int64_t id) const {
+    return pool_.data() + offsets_[Valid(id) ? id : 0];
+  }
+  size_t length(int64_t id) const {
+    return Valid(id) ? offsets_[id + 1] - offsets_[id] : 0;
+  }
+  void Append(int64_t id, std::string* out) const {
+    out->append(data(id), length(id));
+  }
+  std::string Find(int64_t id) const {
+    return std::string(data(id), length(id));
+  }
+
+ private:
+  bool Valid(int64_t id) const { return id >= 0 && id < size(); }
+  void Build(const std::vector<std::pair<int64_t, std::string>>& items);
+  // The slot of the hash in the bucket of its seed
+  uint32_t Slot(uint64_t hash, uint32_t seed) const;
+
+  std::string pool_;
+  // (size + 1,) symbol id is pool_[offsets_[id], offsets_[id + 1])
+  std::vector<uint32_t> offsets_ = {0};
+  // The perfect hash: the seed of each bucket of the hashes, which places
+  // the symbols of the bucket in the free slots, and the id of each slot,
+  // -1 for the empty ones
+  std::vector<uint32_t> seeds_;
+  std::vector<int32_t> slots_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(SymbolMap);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_SYMBOL_MAP_H_
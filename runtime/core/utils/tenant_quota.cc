@@ -0,0 +1,137 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/tenant_quota.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "utils/string.h"
+
+namespace wenet {
+
+constexpr float Tenant::kBatchBurstSeconds;
+constexpr const char* TenantRegistry::kDefault;
+
+bool ParseTenantQuotas(const std::string& spec,
+                       std::map<std::string, TenantQuota>* quotas) {
+  std::vector<std::string> items;
+  SplitStringToVector(spec, ",", true, &items);
+  for (const auto& item : items) {
+    size_t pos = item.find('=');
+    if (pos == std::string::npos) return false;
+    std::string name = Trim(item.substr(0, pos));
+    std::vector<std::string> fields;
+    SplitStringToVector(item.substr(pos + 1), ":", false, &fields);
+    if (name.empty() || fields.empty() || fields.size() > 3) return false;
+    double values[3] = {1.0, 0.0, 0.0};
+    for (size_t i = 0; i < fields.size(); ++i) {
+      std::string field = Trim(fields[i]);
+      char* end = nullptr;
+      values[i] = strtod(field.c_str(), &end);
+      if (end == field.c_str() || *end != '\0' || values[i] < 0) return false;
+    }
+    if (values[0] <= 0) return false;
+    TenantQuota& quota = (*quotas)[name];
+    quota.weight = values[0];
+    quota.max_sessions = static_cast<int>(values[1]);
+    quota.max_batch_audio_rate = values[2];
+  }
+  return true;
+}
+
+Tenant::Tenant(const std::string& name, const TenantQuota& quota)
+    : TaskGroup(quota.weight),
+      name_(name),
+      quota_(quota),
+      batch_credit_(quota.max_batch_audio_rate * kBatchBurstSeconds),
+      refilled_(std::chrono::steady_clock::now()) {
+  Metrics& metrics = Metrics::Instance();
+  sessions_gauge_ = metrics.GetGauge(
+      Metrics::Labeled("wenet_tenant_sessions", "tenant", name),
+      "Number of the sessions of the tenant");
+  rejected_ = metrics.GetCounter(
+      Metrics::Labeled("wenet_tenant_rejected_total", "tenant", name),
+      "Number of the sessions and batches of the tenant over its quota");
+  decode_us_ = metrics.GetCounter(
+      Metrics::Labeled("wenet_tenant_decode_us_total", "tenant", name),
+      "Time of the decoding tasks of the tenant on the decode pool");
+  batch_audio_ms_ = metrics.GetCounter(
+      Metrics::Labeled("wenet_tenant_batch_audio_ms_total", "tenant", name),
+      "Duration of the batch audio taken of the tenant");
+}
+
+void Tenant::Reject(std::string* reason, const std::string& message) {
+  rejected_->Increment();
+  *reason = "tenant " + name_ + " " + message;
+}
+
+bool Tenant::Enter(std::string* reason) {
+  int num_sessions = num_sessions_.fetch_add(1) + 1;
+  if (quota_.max_sessions > 0 && num_sessions > quota_.max_sessions) {
+    num_sessions_.fetch_sub(1);
+    Reject(reason, "over its quota, too many sessions");
+    return false;
+  }
+  sessions_gauge_->Add(1);
+  return true;
+}
+
+void Tenant::Leave() {
+  num_sessions_.fetch_sub(1);
+  sessions_gauge_->Add(-1);
+}
+
+bool Tenant::TakeBatchAudio(double seconds, std::string* reason) {
+  if (quota_.max_batch_audio_rate > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - refilled_).count();
+    refilled_ = now;
+    batch_credit_ = std::min<double>(
+        batch_credit_ + elapsed * quota_.max_batch_audio_rate,
+        quota_.max_batch_audio_rate * kBatchBurstSeconds);
+    if (batch_credit_ < 0) {
+      Reject(reason, "over its quota, too much batch audio");
+      return false;
+    }
+    batch_credit_ -= seconds;
+  }
+  batch_audio_ms_->Increment(static_cast<int64_t>(seconds * 1000));
+  return true;
+}
+
+void Tenant::OnTaskDone(int64_t ns) { decode_us_->Increment(ns / 1000); }
+
+TenantRegistry::TenantRegistry(
+    const std::map<std::string, TenantQuota>& quotas) {
+  for (const auto& it : quotas) {
+    tenants_[it.first] = std::make_shared<Tenant>(it.first, it.second);
+  }
+  auto it = tenants_.find(kDefault);
+  if (it == tenants_.end()) {
+    it = tenants_.emplace(kDefault, std::make_shared<Tenant>(
+                                        kDefault, TenantQuota()))
+             .first;
+  }
+  default_ = it->second;
+}
+
+std::shared_ptr<Tenant> TenantRegistry::Get(const std::string& name) const {
+  auto it = tenants_.find(name);
+  return it != tenants_.end() ? it->second : default_;
+}
+
+}  // namespace wenet
@@ -0,0 +1,118 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_TENANT_QUOTA_H_
+#define UTILS_TENANT_QUOTA_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "utils/metrics.h"
+#include "utils/thread_pool.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct TenantQuota {
+  // The share of the decode pool of the tenant against the others when it's
+  // contended, see TaskGroup
+  float weight = 1.0;
+  // Max concurrent sessions of the tenant, the streams and the batch
+  // calls, 0 for no limit
+  int max_sessions = 0;
+  // Max seconds of the batch audio taken per second, over which the new
+  // batches of the tenant are rejected until it's paid back, 0 for no
+  // limit
+  float max_batch_audio_rate = 0;
+};
+
+// Parse "name=weight[:max_sessions[:max_batch_audio_rate]]" separated by
+// commas into `quotas`, e.g. "a=4:100,b=1:20:8,default=1:10", where
+// "default" is the quota of the tenants not listed
+bool ParseTenantQuotas(const std::string& spec,
+                       std::map<std::string, TenantQuota>* quotas);
+
+// A tenant of the server, whose sessions are counted against its quota,
+// and whose decoding tasks are a task group of the decode pool. The
+// metrics are labeled by the name: wenet_tenant_sessions,
+// wenet_tenant_rejected_total, wenet_tenant_decode_us_total and
+// wenet_tenant_batch_audio_ms_total.
+class Tenant : public TaskGroup {
+ public:
+  // The burst of the batch audio in seconds of max_batch_audio_rate
+  static constexpr float kBatchBurstSeconds = 60;
+
+  Tenant(const std::string& name, const TenantQuota& quota);
+
+  const std::string& name() const { return name_; }
+  const TenantQuota& quota() const { return quota_; }
+  int num_sessions() const { return num_sessions_.load(); }
+  // A new session of the tenant, or false and the `reason` if it's over
+  // max_sessions
+  bool Enter(std::string* reason);
+  void Leave();
+  // Take `seconds` of the batch audio, or false and the `reason` if the
+  // tenant is over max_batch_audio_rate. A batch is taken as a whole if
+  // the tenant is not in debt, so the rate is kept on average.
+  bool TakeBatchAudio(double seconds, std::string* reason);
+  void OnTaskDone(int64_t ns) override;
+
+ private:
+  void Reject(std::string* reason, const std::string& message);
+
+  const std::string name_;
+  const TenantQuota quota_;
+  std::atomic<int> num_sessions_{0};
+  Gauge* sessions_gauge_;
+  Counter* rejected_;
+  Counter* decode_us_;
+  Counter* batch_audio_ms_;
+  // The credit of the batch audio in seconds, refilled by the rate
+  std::mutex mutex_;
+  double batch_credit_;
+  std::chrono::steady_clock::time_point refilled_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Tenant);
+};
+
+// The tenants of the server by the name, which the clients put in their
+// start messages. The tenants not in the quotas share the default one of
+// the "default" quota, so the clients can't make the tenants without
+// bound.
+class TenantRegistry {
+ public:
+  static constexpr const char* kDefault = "default";
+
+  explicit TenantRegistry(const std::map<std::string, TenantQuota>& quotas);
+  // The tenant of the name, the default one if it's not in the quotas,
+  // e.g. the empty name
+  std::shared_ptr<Tenant> Get(const std::string& name) const;
+
+ private:
+  std::map<std::string, std::shared_ptr<Tenant>> tenants_;
+  std::shared_ptr<Tenant> default_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(TenantRegistry);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_TENANT_QUOTA_H_
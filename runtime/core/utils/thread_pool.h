@@ -1,113 +1,325 @@
-// Copyright (c) 2012 Jakob Progsch, Václav Zeman
-
-// This software is provided 'as-is', without any express or implied
-// warranty. In no event will the authors be held liable for any damages
-// arising from the use of this software.
-
-// Permission is granted to anyone to use this software for any purpose,
-// including commercial applications, and to alter it and redistribute it
-// freely, subject to the following restrictions:
-
-//    1. The origin of this software must not be misrepresented; you must not
-//    claim that you wrote the original software. If you use this software
-//    in a product, an acknowledgment in the product documentation would be
-//    appreciated but is not required.
-
-//    2. Altered source versions must be plainly marked as such, and must not be
-//    misrepresented as being the original software.
-
-//    3. This notice may not be removed or altered from any source
-//    distribution.
-
-#ifndef UTILS_THREAD_POOL_H_
-#define UTILS_THREAD_POOL_H_
-
-#include <condition_variable>
-#include <functional>
-#include <future>
-#include <memory>
-#include <mutex>
-#include <queue>
-#include <stdexcept>
-#include <thread>
-#include <utility>
-#include <vector>
-
-class ThreadPool {
- public:
-  explicit ThreadPool(size_t);
-  template <class F, class... Args>
-  auto enqueue(F&& f, Args&&... args)
-      -> std::future<typename std::result_of<F(Args...)>::type>;
-  ~ThreadPool();
-
- private:
-  // need to keep track of threads so we can join them
-  std::vector<std::thread> workers;
-  // the task queue
-  std::queue<std::function<void()> > tasks;
-
-  // synchronization
-  std::mutex queue_mutex;
-  std::condition_variable condition;
-  bool stop;
-};
-
-// the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads) : stop(false) {
-  for (size_t i = 0; i < threads; ++i)
-    workers.emplace_back([this] {
-      for (;;) {
-        std::function<void()> task;
-
-        {
-          std::unique_lock<std::mutex> lock(this->queue_mutex);
-          this->condition.wait(
-              lock, [this] { return this->stop || !this->tasks.empty(); });
-          if (this->stop && this->tasks.empty()) return;
-          task = std::move(this->tasks.front());
-          this->tasks.pop();
-        }
-
-        task();
-      }
-    });
-}
-
-// add new work item to the pool
-template <class F, class... Args>
-auto ThreadPool::enqueue(F&& f, Args&&... args)
-    -> std::future<typename std::result_of<F(Args...)>::type> {
-  using return_type = typename std::result_of<F(Args...)>::type;
-
-  auto task = std::make_shared<std::packaged_task<return_type()> >(
-      std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-
-  std::future<return_type> res = task->get_future();
-  {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-
-    // don't allow enqueueing after stopping the pool
-    if (stop) {
-      throw std::runtime_error("enqueue on stopped ThreadPool");
-    }
-
-    tasks.emplace([task]() { (*task)(); });
-  }
-  condition.notify_one();
-  return res;
-}
-
-// the destructor joins all threads
-inline ThreadPool::~ThreadPool() {
-  {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-    stop = true;
-  }
-  condition.notify_all();
-  for (std::thread& worker : workers) {
-    worker.join();
-  }
-}
-
-#endif  // UTILS_THREAD_POOL_H_
+// Copyright (c) 2012 Jakob Progsch, Václav Zeman
+
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+
+#ifndef UTILS_THREAD_POOL_H_
+#define UTILS_THREAD_POOL_H_
+
+// Altered from the original: the single task queue is replaced by the
+// queues of each worker with work stealing and priorities.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The tasks of a higher priority are run first by all the workers, e.g. the
+// chunks of the streaming decoding before the offline batches when they
+// share a pool. A running task is never interrupted.
+enum class TaskPriority { kHigh = 0, kNormal = 1, kLow = 2 };
+
+// The tasks posted by deadline of a group, e.g. the sessions of a tenant,
+// share the pool with the other groups by the weights when it's contended,
+// see ThreadPool::post_by_deadline. It outlives its tasks.
+class TaskGroup {
+ public:
+  explicit TaskGroup(float weight = 1.0f) : weight_(weight) {}
+  virtual ~TaskGroup() = default;
+  float weight() const { return weight_; }
+  // Called by the worker after a task of the group is run for `ns`
+  virtual void OnTaskDone(int64_t ns) {}
+
+ private:
+  const float weight_;
+};
+
+// Every worker has its own queue of each priority, so the workers don't
+// contend for one queue. The tasks enqueued by a worker go to its own
+// queue, the others are spread over the workers round robin, and an idle
+// worker steals the tasks of the others.
+class ThreadPool {
+ public:
+  // The workers are pinned to `cpus` if it's not empty, e.g. the cpus of
+  // a NUMA node, see utils/cpu_affinity.h
+  explicit ThreadPool(size_t threads, const std::vector<int>& cpus = {});
+  template <class F, class... Args>
+  auto enqueue(F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+  template <class F, class... Args>
+  auto enqueue_with_priority(TaskPriority priority, F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+  // Without a future, so there is no packaged_task and shared state to
+  // allocate for the task
+  void post(TaskPriority priority, std::function<void()> task);
+  // Earliest deadline first: the tasks posted by it are run at the high
+  // priority, in the order of their deadlines instead of their posting,
+  // e.g. the chunks of the sessions by the arrival time of their audio.
+  // Across the groups, the next task is of the group of the least run time
+  // over its weight, which is weighted fair queuing by the measured time of
+  // the tasks, and nullptr is a group of weight 1.
+  void post_by_deadline(std::chrono::steady_clock::time_point deadline,
+                        std::function<void()> task,
+                        TaskGroup* group = nullptr);
+  size_t size() const { return workers.size(); }
+  // The queued tasks which are not started yet
+  size_t num_pending_tasks() const { return num_pending; }
+  ~ThreadPool();
+
+ private:
+  static constexpr int kNumPriorities = 3;
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks[kNumPriorities];
+  };
+
+  struct DeadlineTask {
+    std::chrono::steady_clock::time_point deadline;
+    // The earlier posted first of the same deadline
+    uint64_t seq;
+    std::function<void()> task;
+    // For the min heap of std::push_heap
+    bool operator<(const DeadlineTask& other) const {
+      return deadline != other.deadline ? deadline > other.deadline
+                                        : seq > other.seq;
+    }
+  };
+
+  struct GroupQueue {
+    // The min heap of the tasks
+    std::vector<DeadlineTask> tasks;
+    // The run time in ns over the weight, it's raised to the virtual clock
+    // when the group gets a task after it's idle, so it can't save up.
+    double virtual_time = 0;
+  };
+
+  void run(size_t index);
+  // Run the earliest task of the group next by the fair share, one is
+  // posted for each task of post_by_deadline
+  void run_earliest();
+  // Take the task of the highest priority, from the own queue first
+  bool pop(size_t index, std::function<void()>* task);
+  // The pool and the index of the worker running on this thread
+  static const ThreadPool*& current_pool() {
+    static thread_local const ThreadPool* pool = nullptr;
+    return pool;
+  }
+  static size_t& current_index() {
+    static thread_local size_t index = 0;
+    return index;
+  }
+
+  // need to keep track of threads so we can join them
+  std::vector<std::thread> workers;
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
+  std::atomic<size_t> next_queue{0};
+  // The tasks in the queues
+  std::atomic<size_t> num_pending{0};
+
+  std::mutex deadline_mutex;
+  // Never erased, the groups are few, e.g. the tenants
+  std::map<TaskGroup*, GroupQueue> deadline_groups;
+  uint64_t deadline_seq = 0;
+  // The virtual time of the group of the last task taken
+  double virtual_clock = 0;
+
+  // synchronization of the idle workers
+  std::mutex queue_mutex;
+  std::condition_variable condition;
+  bool stop;
+};
+
+// the constructor just launches some amount of workers
+inline ThreadPool::ThreadPool(size_t threads, const std::vector<int>& cpus)
+    : stop(false) {
+  for (size_t i = 0; i < threads; ++i) {
+    queues.emplace_back(new WorkerQueue());
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([this, i] { run(i); });
+#ifdef __linux__
+    if (!cpus.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+      }
+      pthread_setaffinity_np(workers.back().native_handle(), sizeof(set),
+                             &set);
+    }
+#endif
+  }
+}
+
+inline void ThreadPool::run(size_t index) {
+  current_pool() = this;
+  current_index() = index;
+  for (;;) {
+    std::function<void()> task;
+    if (pop(index, &task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    condition.wait(lock, [this] { return stop || num_pending > 0; });
+    if (stop && num_pending == 0) return;
+  }
+}
+
+inline bool ThreadPool::pop(size_t index, std::function<void()>* task) {
+  if (num_pending == 0) return false;
+  size_t n = queues.size();
+  for (int p = 0; p < kNumPriorities; ++p) {
+    for (size_t i = 0; i < n; ++i) {
+      WorkerQueue& queue = *queues[(index + i) % n];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks[p].empty()) {
+        *task = std::move(queue.tasks[p].front());
+        queue.tasks[p].pop_front();
+        --num_pending;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+inline void ThreadPool::post(TaskPriority priority,
+                             std::function<void()> task) {
+  bool in_worker = current_pool() == this;
+  size_t index = in_worker ? current_index() : next_queue++ % queues.size();
+  if (!in_worker) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    // don't allow enqueueing after stopping the pool, but the tasks may
+    // still enqueue while the queued tasks are drained
+    if (stop) {
+      throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+  }
+  // Counted before it's queued, so it's never taken before it's counted
+  ++num_pending;
+  {
+    WorkerQueue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks[static_cast<int>(priority)].emplace_back(std::move(task));
+  }
+  {
+    // Not notified between the check and the wait of a worker
+    std::lock_guard<std::mutex> lock(queue_mutex);
+  }
+  condition.notify_one();
+}
+
+inline void ThreadPool::post_by_deadline(
+    std::chrono::steady_clock::time_point deadline,
+    std::function<void()> task, TaskGroup* group) {
+  {
+    std::lock_guard<std::mutex> lock(deadline_mutex);
+    GroupQueue& queue = deadline_groups[group];
+    if (queue.tasks.empty()) {
+      queue.virtual_time = std::max(queue.virtual_time, virtual_clock);
+    }
+    queue.tasks.push_back({deadline, deadline_seq++, std::move(task)});
+    std::push_heap(queue.tasks.begin(), queue.tasks.end());
+  }
+  post(TaskPriority::kHigh, [this] { run_earliest(); });
+}
+
+inline void ThreadPool::run_earliest() {
+  std::function<void()> task;
+  TaskGroup* group = nullptr;
+  GroupQueue* queue = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(deadline_mutex);
+    for (auto& it : deadline_groups) {
+      if (!it.second.tasks.empty() &&
+          (queue == nullptr ||
+           it.second.virtual_time < queue->virtual_time)) {
+        group = it.first;
+        queue = &it.second;
+      }
+    }
+    virtual_clock = std::max(virtual_clock, queue->virtual_time);
+    std::pop_heap(queue->tasks.begin(), queue->tasks.end());
+    task = std::move(queue->tasks.back().task);
+    queue->tasks.pop_back();
+  }
+  auto start = std::chrono::steady_clock::now();
+  task();
+  int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+  {
+    std::lock_guard<std::mutex> lock(deadline_mutex);
+    queue->virtual_time += ns / (group != nullptr ? group->weight() : 1.0);
+  }
+  if (group != nullptr) group->OnTaskDone(ns);
+}
+
+// add new work item to the pool
+template <class F, class... Args>
+auto ThreadPool::enqueue(F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  return enqueue_with_priority(TaskPriority::kNormal, std::forward<F>(f),
+                               std::forward<Args>(args)...);
+}
+
+template <class F, class... Args>
+auto ThreadPool::enqueue_with_priority(TaskPriority priority, F&& f,
+                                       Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  using return_type = typename std::result_of<F(Args...)>::type;
+
+  auto task = std::make_shared<std::packaged_task<return_type()> >(
+      std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+  std::future<return_type> res = task->get_future();
+  post(priority, [task]() { (*task)(); });
+  return res;
+}
+
+// the destructor joins all threads, after all the queued tasks are done
+inline ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    stop = true;
+  }
+  condition.notify_all();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+#endif  // UTILS_THREAD_POOL_H_
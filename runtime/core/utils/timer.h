@@ -16,6 +16,7 @@
 #define UTILS_TIMER_H_
 
 #include <chrono>
+#include <cstdint>
 
 namespace wenet {
 
@@ -30,6 +31,20 @@ class Timer {
                                                                  time_start_)
         .count();
   }
+  // return int64_t in nanoseconds, e.g. for the stages under 1ms
+  int64_t ElapsedNs() const {
+    auto time_now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time_now -
+                                                                time_start_)
+        .count();
+  }
+  // return int64_t in microseconds
+  int64_t ElapsedUs() const {
+    auto time_now = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(time_now -
+                                                                 time_start_)
+        .count();
+  }
 
  private:
   std::chrono::time_point<std::chrono::steady_clock> time_start_;
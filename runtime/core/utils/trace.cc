@@ -0,0 +1,129 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/trace.h"
+
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+Tracer& Tracer::Instance() {
+  // Never destroyed, the spans may be recorded by detached threads at exit
+  static Tracer* tracer = new Tracer();
+  return *tracer;
+}
+
+void Tracer::Enable(int capacity_per_thread) {
+  CHECK_GT(capacity_per_thread, 0);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity_per_thread;
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::NewSessionId() {
+  if (!enabled()) return 0;
+  return next_session_id_.fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t Tracer::NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Tracer::BufferHolder::~BufferHolder() {
+  if (buffer != nullptr) Tracer::Instance().ReleaseBuffer(buffer);
+}
+
+Tracer::Buffer* Tracer::ThreadBuffer() {
+  thread_local BufferHolder holder;
+  if (holder.buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_buffers_.empty()) {
+      holder.buffer = free_buffers_.back();
+      free_buffers_.pop_back();
+    } else {
+      buffers_.emplace_back(new Buffer());
+      holder.buffer = buffers_.back().get();
+      holder.buffer->tid = buffers_.size();
+      holder.buffer->spans.resize(capacity_);
+    }
+  }
+  return holder.buffer;
+}
+
+void Tracer::ReleaseBuffer(Buffer* buffer) {
+  // The spans are kept for the export until they are overwritten
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_buffers_.push_back(buffer);
+}
+
+void Tracer::Record(const TraceSpan& span) {
+  if (!enabled()) return;
+  Buffer* buffer = ThreadBuffer();
+  // Only contended with the export
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  buffer->spans[buffer->next] = span;
+  if (++buffer->next == buffer->spans.size()) {
+    buffer->next = 0;
+    buffer->full = true;
+  }
+}
+
+int64_t Tracer::Record(uint64_t session_id, const char* stage,
+                       int64_t start_ns, int chunk) {
+  if (session_id == 0) return 0;
+  TraceSpan span;
+  span.session_id = session_id;
+  span.chunk = chunk;
+  span.stage = stage;
+  span.start_ns = start_ns;
+  span.end_ns = NowNs();
+  Record(span);
+  return span.end_ns;
+}
+
+std::string Tracer::ExportChromeTrace() const {
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  bool first = true;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& buffer : buffers_) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    size_t size = buffer->full ? buffer->spans.size() : buffer->next;
+    size_t start = buffer->full ? buffer->next : 0;
+    for (size_t i = 0; i < size; ++i) {
+      const TraceSpan& span =
+          buffer->spans[(start + i) % buffer->spans.size()];
+      if (!first) os << ",";
+      first = false;
+      // Complete events, the timestamps are in microseconds
+      os << "{\"name\":\"" << span.stage << "\",\"cat\":\"wenet\""
+         << ",\"ph\":\"X\",\"ts\":" << span.start_ns / 1000.0
+         << ",\"dur\":" << (span.end_ns - span.start_ns) / 1000.0
+         << ",\"pid\":" << span.session_id << ",\"tid\":" << buffer->tid
+         << ",\"args\":{\"chunk\":" << span.chunk << "}}";
+    }
+  }
+  os << "]}";
+  return os.str();
+}
+
+}  // namespace wenet
@@ -0,0 +1,125 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_TRACE_H_
+#define UTILS_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The time span of one stage of a decoding session
+struct TraceSpan {
+  uint64_t session_id = 0;
+  // Index of the decoded chunk, -1 if the stage is not of a chunk
+  int chunk = -1;
+  // Must be a string literal, only the pointer is kept
+  const char* stage = nullptr;
+  int64_t start_ns = 0;
+  int64_t end_ns = 0;
+};
+
+// Tracer records the spans of the traced sessions into per thread ring
+// buffers, so the recording threads never contend, and only the latest
+// spans of each thread are kept. A session is traced if it gets a non zero
+// id from NewSessionId(), which is only the case after Enable().
+// The spans are exported in the Chrome trace event format, which can be
+// loaded by chrome://tracing or https://ui.perfetto.dev, one process per
+// session and one thread per recording thread.
+class Tracer {
+ public:
+  static Tracer& Instance();
+
+  void Enable(int capacity_per_thread = 4096);
+  // The sessions started after it are not traced, the spans are kept
+  void Disable() { enabled_.store(false, std::memory_order_relaxed); }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+  // 0 if the tracing is disabled
+  uint64_t NewSessionId();
+
+  void Record(const TraceSpan& span);
+  // Record the span from `start_ns` to now if `session_id` is not 0, and
+  // return now
+  int64_t Record(uint64_t session_id, const char* stage, int64_t start_ns,
+                 int chunk = -1);
+  std::string ExportChromeTrace() const;
+
+  static int64_t NowNs();
+
+ private:
+  struct Buffer {
+    std::mutex mutex;
+    int tid = 0;
+    std::vector<TraceSpan> spans;
+    // Next slot to write, the ring is full once it wraps around
+    size_t next = 0;
+    bool full = false;
+  };
+  // Releases the buffer of the thread at its exit, to be reused by the
+  // threads created later, so the per connection threads don't pile up
+  // buffers.
+  struct BufferHolder {
+    Buffer* buffer = nullptr;
+    ~BufferHolder();
+  };
+
+  Tracer() = default;
+  Buffer* ThreadBuffer();
+  void ReleaseBuffer(Buffer* buffer);
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<uint64_t> next_session_id_{1};
+  int capacity_ = 4096;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+  std::vector<Buffer*> free_buffers_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Tracer);
+};
+
+// Record the span from its construction to its destruction, nothing is
+// done for the untraced session 0.
+class TraceScope {
+ public:
+  TraceScope(uint64_t session_id, const char* stage, int chunk = -1) {
+    span_.session_id = session_id;
+    if (session_id == 0) return;
+    span_.stage = stage;
+    span_.chunk = chunk;
+    span_.start_ns = Tracer::NowNs();
+  }
+  ~TraceScope() {
+    if (span_.session_id == 0) return;
+    span_.end_ns = Tracer::NowNs();
+    Tracer::Instance().Record(span_);
+  }
+
+ private:
+  TraceSpan span_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(TraceScope);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_TRACE_H_
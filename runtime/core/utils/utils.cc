@@ -23,14 +23,134 @@
 
 #include "utils/log.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WENET_UTILS_X86 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WENET_UTILS_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace wenet {
 
-float LogAdd(float x, float y) {
+namespace {
+
+float ExactLogAdd(float x, float y) {
+  static float num_min = -std::numeric_limits<float>::max();
+  if (x <= num_min) return y;
+  if (y <= num_min) return x;
+  float xmax = std::max(x, y);
+  float xmin = std::min(x, y);
+  return xmax + std::log1p(std::exp(xmin - xmax));
+}
+
+// log(1 + exp(-d)) for d in [0, kLogAddTableRange], at the step of
+// 1 / kLogAddTableScale. The error of the linear interpolation is below
+// max(f'') / 8 * step^2 = 1 / 4 / 8 / 64^2 = 7.6e-6, and log(1 + exp(-d))
+// is below exp(-16) = 1.1e-7 beyond the range.
+const int kLogAddTableRange = 16;
+const int kLogAddTableScale = 64;
+
+struct LogAddTable {
+  float values[kLogAddTableRange * kLogAddTableScale + 2];
+  LogAddTable() {
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+      values[i] = std::log1p(std::exp(-static_cast<double>(i) /
+                                      kLogAddTableScale));
+    }
+  }
+};
+
+}  // namespace
+
+float FastLogAdd(float x, float y) {
+  static const LogAddTable table;
   static float num_min = -std::numeric_limits<float>::max();
   if (x <= num_min) return y;
   if (y <= num_min) return x;
   float xmax = std::max(x, y);
-  return std::log(std::exp(x - xmax) + std::exp(y - xmax)) + xmax;
+  float d = xmax - std::min(x, y);
+  if (!(d < kLogAddTableRange)) return xmax;
+  float pos = d * kLogAddTableScale;
+  int i = static_cast<int>(pos);
+  const float* t = table.values + i;
+  return xmax + t[0] + (pos - i) * (t[1] - t[0]);
+}
+
+float LogAdd(float x, float y) {
+#ifdef WENET_FAST_LOGADD
+  return FastLogAdd(x, y);
+#else
+  return ExactLogAdd(x, y);
+#endif
+}
+
+namespace {
+
+void FastLogAddScalar(const float* x, const float* y, float* out, int n) {
+  for (int i = 0; i < n; ++i) out[i] = FastLogAdd(x[i], y[i]);
+}
+
+#ifdef WENET_UTILS_X86
+// The operations of FastLogAdd in the same order without fma, so the lanes
+// are rounded as the scalar ones
+__attribute__((target("avx2"))) void FastLogAddAvx2(const float* x,
+                                                    const float* y,
+                                                    float* out, int n) {
+  static const LogAddTable table;
+  const __m256 num_min = _mm256_set1_ps(-std::numeric_limits<float>::max());
+  const __m256 range = _mm256_set1_ps(kLogAddTableRange);
+  const __m256 scale = _mm256_set1_ps(kLogAddTableScale);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 vx = _mm256_loadu_ps(x + i);
+    __m256 vy = _mm256_loadu_ps(y + i);
+    __m256 xmax = _mm256_max_ps(vx, vy);
+    __m256 d = _mm256_sub_ps(xmax, _mm256_min_ps(vx, vy));
+    __m256 in_range = _mm256_cmp_ps(d, range, _CMP_LT_OQ);
+    // The lanes out of the range read the first entries
+    __m256 pos = _mm256_mul_ps(_mm256_and_ps(d, in_range), scale);
+    __m256i index = _mm256_cvttps_epi32(pos);
+    __m256 t0 = _mm256_i32gather_ps(table.values, index, 4);
+    __m256 t1 = _mm256_i32gather_ps(table.values + 1, index, 4);
+    __m256 frac = _mm256_sub_ps(pos, _mm256_cvtepi32_ps(index));
+    __m256 sum = _mm256_add_ps(
+        _mm256_add_ps(xmax, t0),
+        _mm256_mul_ps(frac, _mm256_sub_ps(t1, t0)));
+    sum = _mm256_blendv_ps(xmax, sum, in_range);
+    sum = _mm256_blendv_ps(sum, vx, _mm256_cmp_ps(vy, num_min, _CMP_LE_OQ));
+    sum = _mm256_blendv_ps(sum, vy, _mm256_cmp_ps(vx, num_min, _CMP_LE_OQ));
+    _mm256_storeu_ps(out + i, sum);
+  }
+  FastLogAddScalar(x + i, y + i, out + i, n - i);
+}
+#endif  // WENET_UTILS_X86
+
+using LogAddsFunc = void (*)(const float* x, const float* y, float* out,
+                             int n);
+
+LogAddsFunc SelectFastLogAdds() {
+#ifdef WENET_UTILS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return FastLogAddAvx2;
+#endif
+  return FastLogAddScalar;
+}
+
+}  // namespace
+
+void FastLogAdd(const float* x, const float* y, float* out, int n) {
+  static const LogAddsFunc fast_log_adds = SelectFastLogAdds();
+  fast_log_adds(x, y, out, n);
+}
+
+void LogAdd(const float* x, const float* y, float* out, int n) {
+#ifdef WENET_FAST_LOGADD
+  FastLogAdd(x, y, out, n);
+#else
+  for (int i = 0; i < n; ++i) out[i] = ExactLogAdd(x[i], y[i]);
+#endif
 }
 
 template <typename T>
@@ -45,10 +165,9 @@ struct ValueComp {
 // We refer the pytorch topk implementation
 // https://github.com/pytorch/pytorch/blob/master/caffe2/operators/top_k.cc
 template <typename T>
-void TopK(const std::vector<T>& data, int32_t k, std::vector<T>* values,
-          std::vector<int>* indices) {
+void HeapTopK(const T* data, int n, int32_t k, std::vector<T>* values,
+              std::vector<int>* indices) {
   std::vector<std::pair<T, int32_t>> heap_data;
-  int n = data.size();
   for (int32_t i = 0; i < k && i < n; ++i) {
     heap_data.emplace_back(data[i], i);
   }
@@ -74,8 +193,180 @@ void TopK(const std::vector<T>& data, int32_t k, std::vector<T>* values,
   }
 }
 
-template void TopK<float>(const std::vector<float>& data, int32_t k,
-                          std::vector<float>* values,
-                          std::vector<int>* indices);
+namespace {
+
+// Insert data[index] into the sorted top k of `*size`, the last one is
+// dropped if it's full, so the caller makes sure it's greater than the last.
+// It goes after the equal ones, which are earlier.
+inline void InsertTopK(float value, int index, int k, int* size,
+                       float* values, int* indices) {
+  int pos = *size < k ? (*size)++ : k - 1;
+  while (pos > 0 && values[pos - 1] < value) {
+    values[pos] = values[pos - 1];
+    indices[pos] = indices[pos - 1];
+    --pos;
+  }
+  values[pos] = value;
+  indices[pos] = index;
+}
+
+// Returns the size of the top k, which is min(k, n)
+int SmallTopKScalar(const float* data, int n, int k, float* values,
+                    int* indices) {
+  int size = 0;
+  int i = 0;
+  for (; i < k && i < n; ++i) InsertTopK(data[i], i, k, &size, values, indices);
+  for (; i < n; ++i) {
+    if (data[i] > values[k - 1]) {
+      InsertTopK(data[i], i, k, &size, values, indices);
+    }
+  }
+  return size;
+}
+
+#ifdef WENET_UTILS_X86
+__attribute__((target("avx2"))) int SmallTopKAvx2(const float* data, int n,
+                                                  int k, float* values,
+                                                  int* indices) {
+  int size = 0;
+  int i = 0;
+  for (; i < k && i < n; ++i) InsertTopK(data[i], i, k, &size, values, indices);
+  if (size < k) return size;
+  float threshold = values[k - 1];
+  __m256 vt = _mm256_set1_ps(threshold);
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(data + i);
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(v, vt, _CMP_GT_OQ));
+    if (mask == 0) continue;
+    for (; mask != 0; mask &= mask - 1) {
+      int j = i + __builtin_ctz(mask);
+      if (data[j] > threshold) {
+        InsertTopK(data[j], j, k, &size, values, indices);
+        threshold = values[k - 1];
+      }
+    }
+    vt = _mm256_set1_ps(threshold);
+  }
+  for (; i < n; ++i) {
+    if (data[i] > threshold) {
+      InsertTopK(data[i], i, k, &size, values, indices);
+      threshold = values[k - 1];
+    }
+  }
+  return size;
+}
+
+__attribute__((target("avx512f"))) int SmallTopKAvx512(const float* data,
+                                                       int n, int k,
+                                                       float* values,
+                                                       int* indices) {
+  int size = 0;
+  int i = 0;
+  for (; i < k && i < n; ++i) InsertTopK(data[i], i, k, &size, values, indices);
+  if (size < k) return size;
+  float threshold = values[k - 1];
+  __m512 vt = _mm512_set1_ps(threshold);
+  for (; i + 16 <= n; i += 16) {
+    __m512 v = _mm512_loadu_ps(data + i);
+    unsigned mask = _mm512_cmp_ps_mask(v, vt, _CMP_GT_OQ);
+    if (mask == 0) continue;
+    for (; mask != 0; mask &= mask - 1) {
+      int j = i + __builtin_ctz(mask);
+      if (data[j] > threshold) {
+        InsertTopK(data[j], j, k, &size, values, indices);
+        threshold = values[k - 1];
+      }
+    }
+    vt = _mm512_set1_ps(threshold);
+  }
+  for (; i < n; ++i) {
+    if (data[i] > threshold) {
+      InsertTopK(data[i], i, k, &size, values, indices);
+      threshold = values[k - 1];
+    }
+  }
+  return size;
+}
+#endif  // WENET_UTILS_X86
+
+#ifdef WENET_UTILS_NEON
+inline bool AnyLane(uint32x4_t v) {
+#ifdef __aarch64__
+  return vmaxvq_u32(v) != 0;
+#else
+  uint32x2_t m = vpmax_u32(vget_low_u32(v), vget_high_u32(v));
+  return vget_lane_u32(vpmax_u32(m, m), 0) != 0;
+#endif
+}
+
+int SmallTopKNeon(const float* data, int n, int k, float* values,
+                  int* indices) {
+  int size = 0;
+  int i = 0;
+  for (; i < k && i < n; ++i) InsertTopK(data[i], i, k, &size, values, indices);
+  if (size < k) return size;
+  float threshold = values[k - 1];
+  float32x4_t vt = vdupq_n_f32(threshold);
+  for (; i + 4 <= n; i += 4) {
+    if (!AnyLane(vcgtq_f32(vld1q_f32(data + i), vt))) continue;
+    for (int j = i; j < i + 4; ++j) {
+      if (data[j] > threshold) {
+        InsertTopK(data[j], j, k, &size, values, indices);
+        threshold = values[k - 1];
+      }
+    }
+    vt = vdupq_n_f32(threshold);
+  }
+  for (; i < n; ++i) {
+    if (data[i] > threshold) {
+      InsertTopK(data[i], i, k, &size, values, indices);
+      threshold = values[k - 1];
+    }
+  }
+  return size;
+}
+#endif  // WENET_UTILS_NEON
+
+using SmallTopKFunc = int (*)(const float* data, int n, int k, float* values,
+                              int* indices);
+
+SmallTopKFunc SelectSmallTopK() {
+#ifdef WENET_UTILS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return SmallTopKAvx512;
+  if (__builtin_cpu_supports("avx2")) return SmallTopKAvx2;
+#endif
+#ifdef WENET_UTILS_NEON
+  return SmallTopKNeon;
+#endif
+  return SmallTopKScalar;
+}
+
+}  // namespace
+
+template <>
+void TopK<float>(const std::vector<float>& data, int32_t k,
+                 std::vector<float>* values, std::vector<int>* indices) {
+  TopK(data.data(), data.size(), k, values, indices);
+}
+
+void TopK(const float* data, int n, int32_t k, std::vector<float>* values,
+          std::vector<int>* indices) {
+  if (k > kSmallTopK) {
+    HeapTopK(data, n, k, values, indices);
+    return;
+  }
+  static const SmallTopKFunc small_topk = SelectSmallTopK();
+  if (k <= 0) {
+    values->clear();
+    indices->clear();
+    return;
+  }
+  float top_values[kSmallTopK];
+  int top_indices[kSmallTopK];
+  int size = small_topk(data, n, k, top_values, top_indices);
+  values->assign(top_values, top_values + size);
+  indices->assign(top_indices, top_indices + size);
+}
 
 }  // namespace wenet
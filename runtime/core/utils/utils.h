@@ -29,13 +29,49 @@ const float kFloatMax = std::numeric_limits<float>::max();
 // kSpaceSymbol in UTF-8 is: ▁
 const char kSpaceSymbol[] = "\xe2\x96\x81";
 
-// Return the sum of two probabilities in log scale
+// Return the sum of two probabilities in log scale. It's exact by default,
+// or FastLogAdd() if built with WENET_FAST_LOGADD (cmake -DFAST_LOGADD=ON).
 float LogAdd(float x, float y);
 
+// LogAdd by a table of log(1 + exp(-d)) with linear interpolation, instead
+// of exp() and log1p(). Its absolute error to the exact one is below 1e-5,
+// plus the rounding of the result, see utils_test.cc.
+float FastLogAdd(float x, float y);
+
+// LogAdd() of the n pairs of x[i] and y[i] into out[i], out may be x or y
+void LogAdd(const float* x, const float* y, float* out, int n);
+// FastLogAdd() of the n pairs, by the AVX2 gathers of its table on the cpus
+// having it, each result is the one of the scalar call
+void FastLogAdd(const float* x, const float* y, float* out, int n);
+
+// The top k of data, in descending order, the earlier one first in a tie.
 template <typename T>
 void TopK(const std::vector<T>& data, int32_t k, std::vector<T>* values,
           std::vector<int>* indices);
 
+// For the small k(<= kSmallTopK) of the CTC search, the top k of float is
+// kept in a sorted array, and the data is scanned by SIMD comparisons with
+// the current k-th value, which are rarely passed.
+const int kSmallTopK = 16;
+template <>
+void TopK<float>(const std::vector<float>& data, int32_t k,
+                 std::vector<float>* values, std::vector<int>* indices);
+// The top k of the n floats of a row in place
+void TopK(const float* data, int n, int32_t k, std::vector<float>* values,
+          std::vector<int>* indices);
+
+// The bytes allocated by the vectors, for the memory accounting
+template <typename T>
+int64_t CapacityBytes(const std::vector<T>& data) {
+  return data.capacity() * sizeof(T);
+}
+template <typename T>
+int64_t CapacityBytes(const std::vector<std::vector<T>>& data) {
+  int64_t bytes = data.capacity() * sizeof(std::vector<T>);
+  for (const auto& v : data) bytes += v.capacity() * sizeof(T);
+  return bytes;
+}
+
 }  // namespace wenet
 
 #endif  // UTILS_UTILS_H_
@@ -0,0 +1,103 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "utils/work_coordinator.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+WorkCoordinator::WorkCoordinator(
+    std::vector<WorkItem> items, int unit_size,
+    const std::unordered_set<std::string>& done_keys, int steal_after_ms)
+    : steal_after_(steal_after_ms) {
+  CHECK_GT(unit_size, 0);
+  items.erase(std::remove_if(items.begin(), items.end(),
+                             [&](const WorkItem& item) {
+                               return done_keys.count(item.key) > 0;
+                             }),
+              items.end());
+  std::stable_sort(items.begin(), items.end(),
+                   [](const WorkItem& a, const WorkItem& b) {
+                     return a.size > b.size;
+                   });
+  for (size_t i = 0; i < items.size(); i += unit_size) {
+    Unit unit;
+    size_t end = std::min(items.size(), i + unit_size);
+    unit.items.assign(std::make_move_iterator(items.begin() + i),
+                      std::make_move_iterator(items.begin() + end));
+    units_.emplace_back(std::move(unit));
+  }
+}
+
+WorkCoordinator::Status WorkCoordinator::Fetch(int* unit_id,
+                                               std::vector<WorkItem>* items) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (num_completed_ == static_cast<int>(units_.size())) return Status::kDone;
+  Clock::time_point now = Clock::now();
+  Unit* unit = nullptr;
+  if (next_ < units_.size()) {
+    *unit_id = static_cast<int>(next_++);
+    unit = &units_[*unit_id];
+  } else {
+    for (size_t i = 0; i < units_.size(); ++i) {
+      const Unit& candidate = units_[i];
+      if (candidate.completed || now - candidate.fetched < steal_after_) {
+        continue;
+      }
+      if (unit == nullptr || candidate.num_fetches < unit->num_fetches ||
+          (candidate.num_fetches == unit->num_fetches &&
+           candidate.fetched < unit->fetched)) {
+        *unit_id = static_cast<int>(i);
+        unit = &units_[i];
+      }
+    }
+    if (unit == nullptr) return Status::kWait;
+    ++num_stolen_;
+    VLOG(1) << "Unit " << *unit_id << " is stolen";
+  }
+  ++unit->num_fetches;
+  unit->fetched = now;
+  *items = unit->items;
+  return Status::kWork;
+}
+
+bool WorkCoordinator::Complete(int unit_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (unit_id < 0 || unit_id >= static_cast<int>(next_) ||
+      units_[unit_id].completed) {
+    return false;
+  }
+  units_[unit_id].completed = true;
+  // The items are not handed out any more
+  std::vector<WorkItem>().swap(units_[unit_id].items);
+  ++num_completed_;
+  return true;
+}
+
+int WorkCoordinator::num_completed() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_completed_;
+}
+
+int WorkCoordinator::num_stolen() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_stolen_;
+}
+
+}  // namespace wenet
@@ -0,0 +1,92 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef UTILS_WORK_COORDINATOR_H_
+#define UTILS_WORK_COORDINATOR_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// An utterance of the offline decoding, whose size is the bytes of the
+// wave, which orders the utterances by their lengths
+struct WorkItem {
+  std::string key;
+  std::string path;
+  int64_t size = 0;
+};
+
+// WorkCoordinator hands out the utterances of a distributed offline
+// decoding to the workers in units. The utterances are sorted by the size,
+// the longest first, so the batches of a unit are of similar lengths and
+// the short units at the end balance the workers. Once all the units are
+// fetched, the idle workers steal the units in progress for longer than
+// steal_after_ms, the ones handed out the fewest times and then the oldest
+// first, whose first results are taken, e.g. of a straggler
+// or a worker gone. The utterances with the keys in done_keys, e.g. of the
+// results of a previous run, are skipped, so a run is resumable.
+class WorkCoordinator {
+ public:
+  enum class Status {
+    kWork,  // A unit is fetched
+    kWait,  // All the units are in progress, fetch again later
+    kDone,  // All the units are completed
+  };
+
+  WorkCoordinator(std::vector<WorkItem> items, int unit_size,
+                  const std::unordered_set<std::string>& done_keys,
+                  int steal_after_ms);
+
+  Status Fetch(int* unit_id, std::vector<WorkItem>* items);
+  // True if it's the first completion of the unit, whose results are
+  // taken, the ones of the other holders are dropped
+  bool Complete(int unit_id);
+
+  int num_units() const { return static_cast<int>(units_.size()); }
+  int num_completed() const;
+  int num_stolen() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  struct Unit {
+    std::vector<WorkItem> items;
+    bool completed = false;
+    // The times it's handed out, and the last one
+    int num_fetches = 0;
+    Clock::time_point fetched;
+  };
+
+  const std::chrono::milliseconds steal_after_;
+  std::vector<Unit> units_;
+  mutable std::mutex mutex_;
+  // The units before it are fetched
+  size_t next_ = 0;
+  int num_completed_ = 0;
+  int num_stolen_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(WorkCoordinator);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_WORK_COORDINATOR_H_
@@ -0,0 +1,458 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "websocket/async_connection_handler.h"
+
+#include <utility>
+
+#include "boost/asio/dispatch.hpp"
+#include "boost/asio/post.hpp"
+#include "boost/json.hpp"
+#include "frontend/resampler.h"
+#include "utils/log.h"
+#include "utils/stage_timer.h"
+#include "utils/trace.h"
+
+namespace wenet {
+
+namespace json = boost::json;
+
+AsyncConnectionHandler::AsyncConnectionHandler(
+    tcp::socket&& socket, std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeOptions> decode_config,
+    std::shared_ptr<ResourceRegistry> resources, size_t placement,
+    std::shared_ptr<ThreadPool> decode_pool,
+    std::shared_ptr<SessionPool> session_pool,
+    std::shared_ptr<AdmissionController> admission)
+    : ws_(std::move(socket)),
+      feature_config_(std::move(feature_config)),
+      decode_config_(std::move(decode_config)),
+      resources_(std::move(resources)),
+      placement_(placement),
+      decode_pool_(std::move(decode_pool)),
+      session_pool_(std::move(session_pool)),
+      admission_(std::move(admission)),
+      deadline_(decode_config_->chunk_deadline_ms) {}
+
+void AsyncConnectionHandler::Start() {
+  // Run on the strand of the socket, all the handlers of this connection
+  // are serialized on it.
+  asio::dispatch(ws_.get_executor(), [self = shared_from_this()] {
+    self->ws_.async_accept(beast::bind_front_handler(
+        &AsyncConnectionHandler::OnAccept, self));
+  });
+}
+
+void AsyncConnectionHandler::OnAccept(beast::error_code ec) {
+  if (ec) {
+    LOG(ERROR) << "Accept failed: " << ec.message();
+    return;
+  }
+  DoRead();
+}
+
+void AsyncConnectionHandler::DoRead() {
+  ws_.async_read(buffer_, beast::bind_front_handler(
+                              &AsyncConnectionHandler::OnRead,
+                              shared_from_this()));
+}
+
+void AsyncConnectionHandler::OnRead(beast::error_code ec,
+                                    size_t bytes_transferred) {
+  if (ec) {
+    LOG(INFO) << ec.message();
+    // Closed or broken connection, finish the decoding of received audio
+    if (!got_end_tag_) {
+      OnSpeechEnd();
+    }
+    return;
+  }
+  try {
+    if (ws_.got_text()) {
+      std::string message = beast::buffers_to_string(buffer_.data());
+      LOG(INFO) << message;
+      OnText(message);
+    } else {
+      if (!got_start_tag_) {
+        OnError("Start signal is expected before binary data");
+      } else if (!stop_recognition_) {
+        OnSpeechData();
+      }
+    }
+  } catch (std::exception const& e) {
+    LOG(ERROR) << e.what();
+    OnError("Decoder got some exception!");
+  }
+  buffer_.consume(buffer_.size());
+  DoRead();
+}
+
+void AsyncConnectionHandler::OnSpeechStart() {
+  LOG(INFO) << "Received speech start signal, start reading speech";
+  auto resource = resources_->Find(model_, placement_);
+  if (resource == nullptr) {
+    OnError("unknown model " + model_);
+    return;
+  }
+  std::string reason;
+  if (!feature_format_.empty()) {
+    feature_decoder_ = CreateFeatureDecoder(feature_format_, *feature_config_,
+                                            num_bins_, frame_shift_ms_,
+                                            &reason);
+    if (feature_decoder_ == nullptr) {
+      OnError(reason);
+      return;
+    }
+  }
+  ticket_ = admission_->Admit(tenant_, &reason);
+  if (ticket_ == nullptr) {
+    LOG(WARNING) << "Reject the connection, " << reason;
+    OnReject("rejected", reason);
+    return;
+  }
+  // The decoding is not started yet
+  deadline_.set_group(ticket_->tenant());
+  got_start_tag_ = true;
+  json::value rv = {{"status", "ok"}, {"type", "server_ready"}};
+  Send(json::serialize(rv));
+  session_ = session_pool_->Acquire(std::move(resource));
+  feature_pipeline_ = session_->feature_pipeline;
+  // The compressed audio is decoded at the sample rate of the model
+  bool resample = sample_rate_ > 0 && audio_format_ == "pcm";
+  feature_pipeline_->set_input_sample_rate(
+      resample ? sample_rate_ : feature_config_->sample_rate);
+  decoder_ = session_->decoder;
+  decoder_->set_trace_id(Tracer::Instance().NewSessionId());
+  decoder_->set_partial_nbest(nbest_);
+  serializer_ = std::make_unique<ResultSerializer>(nbest_, delta_partial_,
+                                                   binary_result_);
+  coalescer_ = std::make_unique<PartialCoalescer>(nbest_, partial_interval_ms_);
+  audio_decoder_ =
+      CreateAudioDecoder(audio_format_, feature_config_->sample_rate);
+}
+
+void AsyncConnectionHandler::OnSpeechEnd() {
+  LOG(INFO) << "Received speech end signal";
+  got_end_tag_ = true;
+  if (feature_pipeline_ != nullptr) {
+    feature_pipeline_->set_input_finished();
+    ScheduleDecode();
+  }
+}
+
+void AsyncConnectionHandler::OnSpeechData() {
+  CHECK(feature_pipeline_ != nullptr);
+  if (feature_decoder_ != nullptr) {
+    // The frames computed by the client
+    feats_.clear();
+    if (!feature_decoder_->Decode(
+            static_cast<const char*>(buffer_.data().data()), buffer_.size(),
+            &feats_)) {
+      stop_recognition_ = true;
+      OnError("the binary data is not of whole feature frames");
+      return;
+    }
+    int num_frames = feats_.size() / feature_decoder_->feature_dim();
+    VLOG(2) << "Received " << num_frames << " frames";
+    feature_pipeline_->AcceptFeatures(feats_.data(), num_frames);
+  } else {
+    // Read binary PCM data
+    int num_samples = buffer_.size() / sizeof(int16_t);
+    const auto* pcm_data = static_cast<const int16_t*>(buffer_.data().data());
+    if (audio_decoder_ != nullptr) {
+      // Or one packet of the compressed audio
+      pcm_.clear();
+      audio_decoder_->Decode(static_cast<const char*>(buffer_.data().data()),
+                             buffer_.size(), &pcm_);
+      pcm_data = pcm_.data();
+      num_samples = pcm_.size();
+    }
+    VLOG(2) << "Received " << num_samples << " samples";
+    feature_pipeline_->AcceptWaveform(pcm_data, num_samples);
+  }
+  if (admission_->Overloaded(feature_pipeline_->NumQueuedFrames())) {
+    LOG(WARNING) << "Decoding falls behind, terminate the connection";
+    // The running DecodeFunc stops at the next chunk
+    stop_recognition_ = true;
+    OnReject("overloaded", "server overloaded, too many queued frames");
+    return;
+  }
+  ScheduleDecode();
+}
+
+void AsyncConnectionHandler::OnError(const std::string& message) {
+  json::value rv = {{"status", "failed"}, {"message", message}};
+  Send(json::serialize(rv), true);
+}
+
+void AsyncConnectionHandler::OnReject(const std::string& type,
+                                      const std::string& message) {
+  json::value rv = {
+      {"status", "failed"}, {"type", type}, {"message", message}};
+  Send(json::serialize(rv), true);
+}
+
+void AsyncConnectionHandler::OnText(const std::string& message) {
+  json::value v = json::parse(message);
+  if (v.is_object()) {
+    json::object obj = v.get_object();
+    if (obj.find("signal") != obj.end()) {
+      json::string signal = obj["signal"].as_string();
+      if (signal == "start") {
+        if (obj.find("nbest") != obj.end()) {
+          if (obj["nbest"].is_int64()) {
+            nbest_ = obj["nbest"].as_int64();
+          } else {
+            OnError("integer is expected for nbest option");
+          }
+        }
+        if (obj.find("continuous_decoding") != obj.end()) {
+          if (obj["continuous_decoding"].is_bool()) {
+            continuous_decoding_ = obj["continuous_decoding"].as_bool();
+          } else {
+            OnError(
+                "boolean true or false is expected for "
+                "continuous_decoding option");
+          }
+        }
+        if (obj.find("delta_partial") != obj.end()) {
+          if (obj["delta_partial"].is_bool()) {
+            delta_partial_ = obj["delta_partial"].as_bool();
+          } else {
+            OnError(
+                "boolean true or false is expected for "
+                "delta_partial option");
+          }
+        }
+        if (obj.find("sample_rate") != obj.end()) {
+          if (obj["sample_rate"].is_int64() &&
+              IsSupportedSampleRate(obj["sample_rate"].as_int64())) {
+            sample_rate_ = obj["sample_rate"].as_int64();
+          } else {
+            OnError("unsupported sample_rate option");
+          }
+        }
+        if (obj.find("audio_format") != obj.end()) {
+          if (obj["audio_format"].is_string() &&
+              IsSupportedAudioFormat(obj["audio_format"].as_string().c_str())) {
+            audio_format_ = obj["audio_format"].as_string().c_str();
+          } else {
+            OnError("unsupported audio_format option");
+          }
+        }
+        if (obj.find("feature_format") != obj.end()) {
+          if (obj["feature_format"].is_string()) {
+            feature_format_ = obj["feature_format"].as_string().c_str();
+          } else {
+            OnError("string is expected for feature_format option");
+          }
+        }
+        if (obj.find("num_bins") != obj.end()) {
+          if (obj["num_bins"].is_int64() && obj["num_bins"].as_int64() > 0) {
+            num_bins_ = obj["num_bins"].as_int64();
+          } else {
+            OnError("positive integer is expected for num_bins option");
+          }
+        }
+        if (obj.find("frame_shift_ms") != obj.end()) {
+          if (obj["frame_shift_ms"].is_int64() &&
+              obj["frame_shift_ms"].as_int64() > 0) {
+            frame_shift_ms_ = obj["frame_shift_ms"].as_int64();
+          } else {
+            OnError("positive integer is expected for frame_shift_ms option");
+          }
+        }
+        if (obj.find("binary_result") != obj.end()) {
+          if (obj["binary_result"].is_bool()) {
+            binary_result_ = obj["binary_result"].as_bool();
+          } else {
+            OnError(
+                "boolean true or false is expected for "
+                "binary_result option");
+          }
+        }
+        if (obj.find("partial_interval_ms") != obj.end()) {
+          if (obj["partial_interval_ms"].is_int64() &&
+              obj["partial_interval_ms"].as_int64() >= 0) {
+            partial_interval_ms_ = obj["partial_interval_ms"].as_int64();
+          } else {
+            OnError(
+                "non negative integer is expected for "
+                "partial_interval_ms option");
+          }
+        }
+        if (obj.find("model") != obj.end()) {
+          if (obj["model"].is_string()) {
+            model_ = obj["model"].as_string().c_str();
+          } else {
+            OnError("string is expected for model option");
+          }
+        }
+        if (obj.find("tenant") != obj.end()) {
+          if (obj["tenant"].is_string()) {
+            tenant_ = obj["tenant"].as_string().c_str();
+          } else {
+            OnError("string is expected for tenant option");
+          }
+        }
+        OnSpeechStart();
+      } else if (signal == "end") {
+        OnSpeechEnd();
+      } else {
+        OnError("Unexpected signal type");
+      }
+    } else {
+      OnError("Wrong message header");
+    }
+  } else {
+    OnError("Wrong protocol");
+  }
+}
+
+void AsyncConnectionHandler::ScheduleDecode() {
+  {
+    std::lock_guard<std::mutex> lock(decode_mutex_);
+    deadline_.OnAudio();
+    if (decoding_) {
+      // DecodeFunc is running, let it check the new data again
+      decode_pending_ = true;
+      return;
+    }
+    decoding_ = true;
+  }
+  // The chunks of the streams are decoded before the offline batches
+  deadline_.Post(decode_pool_.get(),
+                 [self = shared_from_this()] { self->DecodeFunc(); });
+}
+
+void AsyncConnectionHandler::DecodeFunc() {
+  static StageStats* task_latency = StageStats::Get(
+      "wenet_decode_task_seconds",
+      "Latency of a decoding task of a connection on the decode pool");
+  StageTimer stage(task_latency);
+  while (true) {
+    bool late = false;
+    {
+      std::lock_guard<std::mutex> lock(decode_mutex_);
+      decode_pending_ = false;
+      late = deadline_.Take();
+    }
+    try {
+      decoder_->set_late(late);
+      while (!stop_recognition_) {
+        DecodeState state = decoder_->Decode(false);
+        if (state == DecodeState::kWaitFeats) {
+          if (decoder_->SecondPassDue()) {
+            // decoding_ stays set until DecodeFunc runs again after it
+            decode_pool_->post(TaskPriority::kLow, [self = shared_from_this()] {
+              self->SecondPassFunc();
+            });
+            return;
+          }
+          break;
+        } else if (state == DecodeState::kEndFeats) {
+          decoder_->Rescoring();
+          Send(serializer_->FinalMessage(decoder_->result()), false,
+               serializer_->binary());
+          json::value finish = {{"status", "ok"}, {"type", "speech_end"}};
+          Send(json::serialize(finish), true);
+          stop_recognition_ = true;
+        } else if (state == DecodeState::kEndpoint) {
+          decoder_->Rescoring();
+          Send(serializer_->FinalMessage(decoder_->result()), false,
+               serializer_->binary());
+          // If it's not continuous decoding, continue to do next recognition
+          // otherwise stop the recognition
+          if (continuous_decoding_) {
+            decoder_->ResetContinuousDecoding();
+            coalescer_->Reset();
+          } else {
+            json::value finish = {{"status", "ok"}, {"type", "speech_end"}};
+            Send(json::serialize(finish), true);
+            stop_recognition_ = true;
+          }
+        } else {
+          if (decoder_->DecodedSomething() &&
+              coalescer_->ShouldSend(decoder_->result())) {
+            Send(serializer_->PartialMessage(decoder_->result()), false,
+                 serializer_->binary());
+          }
+        }
+      }
+    } catch (std::exception const& e) {
+      LOG(ERROR) << e.what();
+      stop_recognition_ = true;
+    }
+    std::lock_guard<std::mutex> lock(decode_mutex_);
+    if (!decode_pending_ || stop_recognition_) {
+      decoding_ = false;
+      return;
+    }
+  }
+}
+
+void AsyncConnectionHandler::SecondPassFunc() {
+  try {
+    if (!stop_recognition_ && decoder_->SecondPassPartial() &&
+        coalescer_->ShouldSend(decoder_->result())) {
+      Send(serializer_->PartialMessage(decoder_->result()), false,
+           serializer_->binary());
+    }
+  } catch (std::exception const& e) {
+    LOG(ERROR) << e.what();
+  }
+  DecodeFunc();
+}
+
+void AsyncConnectionHandler::Send(std::string message, bool close_after,
+                                  bool binary) {
+  asio::post(ws_.get_executor(), [self = shared_from_this(),
+                                  message = std::move(message), close_after,
+                                  binary] {
+    if (self->close_after_write_) return;
+    self->write_queue_.emplace_back(std::move(message), binary);
+    self->close_after_write_ = close_after;
+    // Only one async_write is allowed at the same time
+    if (self->write_queue_.size() == 1) {
+      self->DoWrite();
+    }
+  });
+}
+
+void AsyncConnectionHandler::DoWrite() {
+  ws_.binary(write_queue_.front().second);
+  ws_.async_write(asio::buffer(write_queue_.front().first),
+                  beast::bind_front_handler(&AsyncConnectionHandler::OnWrite,
+                                            shared_from_this()));
+}
+
+void AsyncConnectionHandler::OnWrite(beast::error_code ec,
+                                     size_t bytes_transferred) {
+  if (ec) {
+    LOG(ERROR) << "Write failed: " << ec.message();
+    stop_recognition_ = true;
+    return;
+  }
+  write_queue_.pop_front();
+  if (!write_queue_.empty()) {
+    DoWrite();
+  } else if (close_after_write_) {
+    ws_.async_close(websocket::close_code::normal,
+                    [self = shared_from_this()](beast::error_code ec) {
+                      LOG(INFO) << "ws_ is closed, bye :)";
+                    });
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,163 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WEBSOCKET_ASYNC_CONNECTION_HANDLER_H_
+#define WEBSOCKET_ASYNC_CONNECTION_HANDLER_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/asio/ip/tcp.hpp"
+#include "boost/beast/core.hpp"
+#include "boost/beast/websocket.hpp"
+
+#include "decoder/asr_decoder.h"
+#include "decoder/partial_coalescer.h"
+#include "decoder/result_serializer.h"
+#include "decoder/session_pool.h"
+#include "frontend/audio_decoder.h"
+#include "frontend/feature_decoder.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/admission_control.h"
+#include "utils/chunk_deadline.h"
+#include "utils/thread_pool.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+namespace beast = boost::beast;          // from <boost/beast.hpp>
+namespace websocket = beast::websocket;  // from <boost/beast/websocket.hpp>
+namespace asio = boost::asio;            // from <boost/asio.hpp>
+using tcp = boost::asio::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
+
+// AsyncConnectionHandler speaks the same protocol as ConnectionHandler, but
+// it never blocks a thread. All the websocket I/O is done asynchronously on
+// the strand of the socket, and the decoding is done on a shared decode
+// pool by calling AsrDecoder::Decode(false) until kWaitFeats is returned,
+// the decoding of one session is rescheduled when new audio arrives.
+class AsyncConnectionHandler
+    : public std::enable_shared_from_this<AsyncConnectionHandler> {
+ public:
+  AsyncConnectionHandler(tcp::socket&& socket,
+                         std::shared_ptr<FeaturePipelineConfig> feature_config,
+                         std::shared_ptr<DecodeOptions> decode_config,
+                         std::shared_ptr<ResourceRegistry> resources,
+                         size_t placement,
+                         std::shared_ptr<ThreadPool> decode_pool,
+                         std::shared_ptr<SessionPool> session_pool,
+                         std::shared_ptr<AdmissionController> admission);
+  // Start the websocket handshake
+  void Start();
+
+ private:
+  void OnAccept(beast::error_code ec);
+  void DoRead();
+  void OnRead(beast::error_code ec, size_t bytes_transferred);
+  void OnText(const std::string& message);
+  void OnSpeechStart();
+  void OnSpeechEnd();
+  void OnSpeechData();
+  void OnError(const std::string& message);
+  // Send the failed status of `type`, e.g. rejected, and close
+  void OnReject(const std::string& type, const std::string& message);
+
+  // Schedule DecodeFunc on the decode pool if it is not running
+  void ScheduleDecode();
+  void DecodeFunc();
+  // The second pass of the partial result on a low priority task, before
+  // DecodeFunc goes on, see AsrDecoder::SecondPassPartial()
+  void SecondPassFunc();
+
+  // Send is thread safe, the messages are written in order on the strand
+  void Send(std::string message, bool close_after = false,
+            bool binary = false);
+  void DoWrite();
+  void OnWrite(beast::error_code ec, size_t bytes_transferred);
+
+  websocket::stream<beast::tcp_stream> ws_;
+  beast::flat_buffer buffer_;
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  // The replica of the resource of the connection
+  size_t placement_;
+  std::shared_ptr<ThreadPool> decode_pool_;
+  std::shared_ptr<SessionPool> session_pool_;
+  std::shared_ptr<AdmissionController> admission_;
+  std::unique_ptr<AdmissionController::Ticket> ticket_ = nullptr;
+
+  bool continuous_decoding_ = false;
+  int nbest_ = 1;
+  bool delta_partial_ = false;
+  bool binary_result_ = false;
+  // The audio format of the binary frames, see frontend/audio_decoder.h
+  std::string audio_format_ = "pcm";
+  // The sample rate of the audio, 0 if it's the one of the model
+  int sample_rate_ = 0;
+  // The format of the frames uploaded instead of the audio, see
+  // frontend/feature_decoder.h, and their options checked against the
+  // feature config, 0 if not set
+  std::string feature_format_;
+  int num_bins_ = 0;
+  int frame_shift_ms_ = 0;
+  // The min time between two partial results, see PartialCoalescer
+  int partial_interval_ms_ = 0;
+  // The name of the resource to decode with, see ResourceRegistry::Find,
+  // empty for the default one
+  std::string model_;
+  // The tenant of the session, see TenantRegistry, empty for the default
+  // one
+  std::string tenant_;
+  bool got_start_tag_ = false;
+  bool got_end_tag_ = false;
+  // When endpoint is detected, stop recognition, and stop receiving data.
+  std::atomic<bool> stop_recognition_{false};
+  // The pipeline and the decoder of the session, which is returned to the
+  // pool after them
+  std::shared_ptr<DecodeSession> session_ = nullptr;
+  std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
+  std::shared_ptr<AsrDecoder> decoder_ = nullptr;
+  // Only used by DecodeFunc
+  std::unique_ptr<ResultSerializer> serializer_ = nullptr;
+  std::unique_ptr<PartialCoalescer> coalescer_ = nullptr;
+  // nullptr for pcm, only used on the strand
+  std::unique_ptr<AudioDecoder> audio_decoder_ = nullptr;
+  std::vector<int16_t> pcm_;
+  // Not nullptr if the features are uploaded, feats_ are the decoded frames
+  std::unique_ptr<FeatureDecoder> feature_decoder_ = nullptr;
+  std::vector<float> feats_;
+
+  // Decode scheduling state, guarded by decode_mutex_
+  std::mutex decode_mutex_;
+  bool decoding_ = false;
+  bool decode_pending_ = false;
+  ChunkDeadline deadline_;
+
+  // Write queue, only accessed on the strand
+  // Pending messages and whether they are binary, the front one is in flight
+  std::deque<std::pair<std::string, bool>> write_queue_;
+  bool close_after_write_ = false;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AsyncConnectionHandler);
+};
+
+}  // namespace wenet
+
+#endif  // WEBSOCKET_ASYNC_CONNECTION_HANDLER_H_
@@ -0,0 +1,161 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "websocket/async_websocket_client.h"
+
+#include "boost/json.hpp"
+
+#include "utils/log.h"
+#include "websocket/websocket_client.h"
+
+namespace wenet {
+
+namespace json = boost::json;
+
+AsyncWebSocketClient::AsyncWebSocketClient(asio::io_context* ioc,
+                                           const std::string& hostname,
+                                           int port, int nbest,
+                                           bool continuous_decoding,
+                                           LoadStreamListener* listener)
+    : hostname_(hostname),
+      port_(port),
+      nbest_(nbest),
+      continuous_decoding_(continuous_decoding),
+      listener_(listener),
+      resolver_(asio::make_strand(*ioc)),
+      ws_(asio::make_strand(*ioc)) {}
+
+void AsyncWebSocketClient::Start() {
+  resolver_.async_resolve(
+      hostname_, std::to_string(port_),
+      beast::bind_front_handler(&AsyncWebSocketClient::OnResolve,
+                                shared_from_this()));
+}
+
+void AsyncWebSocketClient::OnResolve(beast::error_code ec,
+                                     tcp::resolver::results_type results) {
+  if (ec) return Fail("resolve", ec);
+  beast::get_lowest_layer(ws_).expires_after(std::chrono::seconds(30));
+  beast::get_lowest_layer(ws_).async_connect(
+      results, beast::bind_front_handler(&AsyncWebSocketClient::OnConnect,
+                                         shared_from_this()));
+}
+
+void AsyncWebSocketClient::OnConnect(
+    beast::error_code ec, tcp::resolver::results_type::endpoint_type ep) {
+  if (ec) return Fail("connect", ec);
+  // The websocket stream has its own timeouts
+  beast::get_lowest_layer(ws_).expires_never();
+  ws_.set_option(
+      websocket::stream_base::timeout::suggested(beast::role_type::client));
+  std::string host = hostname_ + ":" + std::to_string(ep.port());
+  ws_.async_handshake(
+      host, "/",
+      beast::bind_front_handler(&AsyncWebSocketClient::OnHandshake,
+                                shared_from_this()));
+}
+
+void AsyncWebSocketClient::OnHandshake(beast::error_code ec) {
+  if (ec) return Fail("handshake", ec);
+  Write(WebSocketClient::StartSignal(nbest_, continuous_decoding_), true);
+  DoRead();
+}
+
+void AsyncWebSocketClient::SendAudio(const int16_t* data, size_t size) {
+  std::string message(reinterpret_cast<const char*>(data),
+                      size * sizeof(int16_t));
+  asio::post(ws_.get_executor(),
+             [self = shared_from_this(), message = std::move(message)]() {
+               self->Write(std::move(message), false);
+             });
+}
+
+void AsyncWebSocketClient::SendEnd() {
+  asio::post(ws_.get_executor(), [self = shared_from_this()]() {
+    self->Write(WebSocketClient::EndSignal(), true);
+  });
+}
+
+void AsyncWebSocketClient::Cancel() {
+  asio::post(ws_.get_executor(), [self = shared_from_this()]() {
+    self->Fail("canceled", beast::error_code());
+  });
+}
+
+void AsyncWebSocketClient::Write(std::string message, bool text) {
+  if (done_) return;
+  writes_.emplace_back(std::move(message), text);
+  if (writes_.size() == 1) DoWrite();
+}
+
+void AsyncWebSocketClient::DoWrite() {
+  ws_.text(writes_.front().second);
+  ws_.async_write(asio::buffer(writes_.front().first),
+                  beast::bind_front_handler(&AsyncWebSocketClient::OnWrite,
+                                            shared_from_this()));
+}
+
+void AsyncWebSocketClient::OnWrite(beast::error_code ec, size_t bytes) {
+  if (ec) return Fail("write", ec);
+  writes_.pop_front();
+  if (!writes_.empty() && !done_) DoWrite();
+}
+
+void AsyncWebSocketClient::DoRead() {
+  ws_.async_read(buffer_,
+                 beast::bind_front_handler(&AsyncWebSocketClient::OnRead,
+                                           shared_from_this()));
+}
+
+void AsyncWebSocketClient::OnRead(beast::error_code ec, size_t bytes) {
+  if (ec) return Fail("read", ec);
+  std::string message = beast::buffers_to_string(buffer_.data());
+  buffer_.consume(buffer_.size());
+  VLOG(2) << message;
+  json::error_code json_ec;
+  json::value value = json::parse(message, json_ec);
+  if (json_ec || !value.is_object()) {
+    return Fail("parse", beast::error_code());
+  }
+  json::object& obj = value.as_object();
+  if (obj["status"] != "ok") {
+    return Fail("status not ok", beast::error_code());
+  }
+  const json::value& type = obj["type"];
+  if (type == "server_ready") {
+    listener_->OnReady();
+  } else if (type == "partial_result") {
+    listener_->OnPartial();
+  } else if (type == "final_result") {
+    listener_->OnFinal();
+  } else if (type == "speech_end") {
+    done_ = true;
+    listener_->OnDone(true, "");
+    ws_.async_close(websocket::close_code::normal,
+                    [self = shared_from_this()](beast::error_code) {});
+    return;
+  }
+  DoRead();
+}
+
+void AsyncWebSocketClient::Fail(const std::string& what,
+                                beast::error_code ec) {
+  if (done_) return;
+  done_ = true;
+  listener_->OnDone(false, ec ? what + ": " + ec.message() : what);
+  beast::error_code ignored;
+  beast::get_lowest_layer(ws_).socket().close(ignored);
+}
+
+}  // namespace wenet
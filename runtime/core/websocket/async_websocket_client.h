@@ -0,0 +1,86 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WEBSOCKET_ASYNC_WEBSOCKET_CLIENT_H_
+#define WEBSOCKET_ASYNC_WEBSOCKET_CLIENT_H_
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "boost/asio/ip/tcp.hpp"
+#include "boost/asio/strand.hpp"
+#include "boost/beast/core.hpp"
+#include "boost/beast/websocket.hpp"
+
+#include "utils/load_generator.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+namespace beast = boost::beast;          // from <boost/beast.hpp>
+namespace websocket = beast::websocket;  // from <boost/beast/websocket.hpp>
+namespace asio = boost::asio;            // from <boost/asio.hpp>
+using tcp = boost::asio::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
+
+// A websocket stream of the load test. It speaks the protocol of
+// WebSocketClient, but all its I/O is asynchronous on a strand of a shared
+// io_context, so many clients are served by the few threads running the
+// io_context. Its events are reported to the listener.
+class AsyncWebSocketClient
+    : public LoadStream,
+      public std::enable_shared_from_this<AsyncWebSocketClient> {
+ public:
+  AsyncWebSocketClient(asio::io_context* ioc, const std::string& hostname,
+                       int port, int nbest, bool continuous_decoding,
+                       LoadStreamListener* listener);
+
+  void Start() override;
+  void SendAudio(const int16_t* data, size_t size) override;
+  void SendEnd() override;
+  void Cancel() override;
+
+ private:
+  void OnResolve(beast::error_code ec, tcp::resolver::results_type results);
+  void OnConnect(beast::error_code ec,
+                 tcp::resolver::results_type::endpoint_type ep);
+  void OnHandshake(beast::error_code ec);
+  // Queue the message on the strand, one write is in flight at a time
+  void Write(std::string message, bool text);
+  void DoWrite();
+  void OnWrite(beast::error_code ec, size_t bytes);
+  void DoRead();
+  void OnRead(beast::error_code ec, size_t bytes);
+  void Fail(const std::string& what, beast::error_code ec);
+
+  std::string hostname_;
+  int port_;
+  int nbest_;
+  bool continuous_decoding_;
+  LoadStreamListener* listener_;
+  tcp::resolver resolver_;
+  websocket::stream<beast::tcp_stream> ws_;
+  beast::flat_buffer buffer_;
+  // Pending messages and whether they are text, the front one is in flight
+  std::deque<std::pair<std::string, bool>> writes_;
+  bool done_ = false;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AsyncWebSocketClient);
+};
+
+}  // namespace wenet
+
+#endif  // WEBSOCKET_ASYNC_WEBSOCKET_CLIENT_H_
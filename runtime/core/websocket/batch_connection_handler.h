@@ -16,6 +16,9 @@
 #ifndef WEBSOCKET_BATCH_CONNECTION_HANDLER_H_
 #define WEBSOCKET_BATCH_CONNECTION_HANDLER_H_
 
+#include <algorithm>
+#include <cstring>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -31,6 +34,8 @@
 
 #include "decoder/asr_decoder.h"
 #include "decoder/batch_asr_decoder.h"
+#include "decoder/batch_decoder_pool.h"
+#include "decoder/batch_scheduler.h"
 #include "frontend/feature_pipeline.h"
 #include "utils/log.h"
 
@@ -49,11 +54,15 @@ class BatchConnectionHandler {
       tcp::socket&& socket,
       std::shared_ptr<FeaturePipelineConfig> feature_config,
       std::shared_ptr<DecodeOptions> decode_config,
-      std::shared_ptr<DecodeResource> decode_resource)
+      std::shared_ptr<DecodeResource> decode_resource,
+      std::shared_ptr<BatchDecoderPool> decoder_pool,
+      std::shared_ptr<BatchScheduler> batch_scheduler = nullptr)
     : ws_(std::move(socket)),
       feature_config_(std::move(feature_config)),
       decode_config_(std::move(decode_config)),
-      decode_resource_(std::move(decode_resource)) {}
+      decode_resource_(std::move(decode_resource)),
+      decoder_pool_(std::move(decoder_pool)),
+      batch_scheduler_(std::move(batch_scheduler)) {}
 
   void operator()() {
     try {
@@ -74,6 +83,12 @@ class BatchConnectionHandler {
         } else {
           if (!got_start_tag_) {
             OnError("Start signal is expected before binary data");
+          } else if (chunked_) {
+            OnSpeechChunk(buffer);
+            if (next_utt_ == batch_lens_.size()) {
+              OnChunkedSpeechEnd();
+              break;
+            }
           } else {
             OnSpeechData(buffer);
             break;
@@ -101,9 +116,18 @@ class BatchConnectionHandler {
     json::value rv = {{"status", "ok"}, {"type", "server_ready"}};
     ws_.text(true);
     ws_.write(asio::buffer(json::serialize(rv)));
-    decoder_ = std::make_shared<BatchAsrDecoder>(
-        feature_config_, decode_resource_,
-        *decode_config_);
+    // The utterances are batched with others by the scheduler if any, a
+    // pooled decoder goes back to the pool with the connection
+    if (batch_scheduler_ == nullptr) {
+      decoder_ = decoder_pool_->Acquire(decode_resource_);
+    }
+    if (chunked_) {
+      next_utt_ = 0;
+      wav_.clear();
+      while (next_utt_ < batch_lens_.size() && batch_lens_[next_utt_] < 2) {
+        OnUtteranceEnd();
+      }
+    }
   }
 
   void OnSpeechEnd() {
@@ -146,6 +170,13 @@ class BatchConnectionHandler {
               OnError("a list of batch_lens should be given");
             }
           }
+          if (obj.find("chunked") != obj.end()) {
+            if (obj["chunked"].is_bool()) {
+              chunked_ = obj["chunked"].as_bool();
+            } else {
+              OnError("boolean true or false is expected for chunked option");
+            }
+          }
           OnSpeechStart();
         } else if (signal == "end") {
           OnSpeechEnd();
@@ -184,9 +215,132 @@ class BatchConnectionHandler {
       wavs.push_back(std::move(wav));
       offset += len;
     }
-    CHECK(decoder_ != nullptr);
-    decoder_->Decode(wavs);
-    std::string result = decoder_->get_batch_result(nbest_, enable_timestamp_);
+    std::string result;
+    if (batch_scheduler_ != nullptr) {
+      std::vector<std::future<std::vector<DecodeResult>>> futures;
+      for (auto& wav : wavs) {
+        futures.emplace_back(batch_scheduler_->Submit(std::move(wav)));
+      }
+      std::vector<std::vector<DecodeResult>> batch_result;
+      for (auto& future : futures) {
+        batch_result.emplace_back(future.get());
+      }
+      result = BatchAsrDecoder::SerializeBatchResult(batch_result, nbest_,
+                                                     enable_timestamp_);
+    } else {
+      CHECK(decoder_ != nullptr);
+      decoder_->Decode(wavs);
+      result = decoder_->get_batch_result(nbest_, enable_timestamp_);
+    }
+    ws_.text(true);
+    ws_.write(asio::buffer(result));
+  }
+
+  // The chunked upload: the binary frames are the int16 PCM of the
+  // utterances one after another, of any size, and batch_lens splits them.
+  // The samples are converted into the wav of the current utterance as they
+  // arrive, and each utterance is submitted to the scheduler, or turned into
+  // features on the thread pool, once it's complete, so neither the whole
+  // batch of PCM nor the waves of the finished utterances are kept.
+  void OnSpeechChunk(const beast::flat_buffer& buffer) {
+    const auto* data = static_cast<const char*>(buffer.data().data());
+    size_t size = buffer.size();
+    // A sample may be split by the frames
+    if (has_odd_byte_ && size > 0) {
+      char bytes[2] = {odd_byte_, data[0]};
+      int16_t sample;
+      memcpy(&sample, bytes, sizeof(sample));
+      AppendSamples(&sample, 1);
+      has_odd_byte_ = false;
+      data++;
+      size--;
+    }
+    while (size >= 2 && next_utt_ < batch_lens_.size()) {
+      size_t num_samples = batch_lens_[next_utt_] / 2 - wav_.size();
+      num_samples = std::min(num_samples, size / 2);
+      // The frames are not aligned to int16_t in the buffer
+      std::vector<int16_t> samples(num_samples);
+      memcpy(samples.data(), data, num_samples * sizeof(int16_t));
+      AppendSamples(samples.data(), num_samples);
+      data += num_samples * sizeof(int16_t);
+      size -= num_samples * sizeof(int16_t);
+    }
+    if (size == 1 && next_utt_ < batch_lens_.size()) {
+      odd_byte_ = data[0];
+      has_odd_byte_ = true;
+    } else if (size > 0) {
+      OnError("More PCM data than batch_lens");
+    }
+  }
+
+  void AppendSamples(const int16_t* samples, size_t num_samples) {
+    if (wav_.empty()) wav_.reserve(batch_lens_[next_utt_] / 2);
+    for (size_t i = 0; i < num_samples; ++i) {
+      wav_.push_back(static_cast<float>(samples[i]));
+    }
+    while (next_utt_ < batch_lens_.size() &&
+           wav_.size() == batch_lens_[next_utt_] / 2) {
+      OnUtteranceEnd();
+    }
+  }
+
+  void OnUtteranceEnd() {
+    std::vector<float> wav = std::move(wav_);
+    wav_.clear();
+    next_utt_++;
+    if (batch_scheduler_ != nullptr) {
+      futures_.emplace_back(batch_scheduler_->Submit(std::move(wav)));
+    } else if (decode_config_->streaming_batch) {
+      // The streaming batch decodes the audio chunk by chunk
+      wavs_.push_back(std::move(wav));
+    } else {
+      auto feats = std::make_shared<feature_t>();
+      // The tasks may outlive the connection if it fails
+      auto compute = [decoder = decoder_,
+                      feats](const std::vector<float>& wav) {
+        return decoder->ComputeFeature(wav, feats.get());
+      };
+      if (decode_resource_->thread_pool != nullptr) {
+        feats_lens_.emplace_back(
+            decode_resource_->thread_pool->enqueue_with_priority(
+                TaskPriority::kLow, compute, std::move(wav)));
+      } else {
+        feats_lens_.emplace_back(
+            std::async(std::launch::deferred, compute, std::move(wav)));
+      }
+      feats_.push_back(std::move(feats));
+    }
+  }
+
+  void OnChunkedSpeechEnd() {
+    std::string result;
+    if (batch_scheduler_ != nullptr) {
+      std::vector<std::vector<DecodeResult>> batch_result;
+      for (auto& future : futures_) {
+        batch_result.emplace_back(future.get());
+      }
+      futures_.clear();
+      result = BatchAsrDecoder::SerializeBatchResult(batch_result, nbest_,
+                                                     enable_timestamp_);
+    } else {
+      CHECK(decoder_ != nullptr);
+      if (decode_config_->streaming_batch) {
+        decoder_->Decode(wavs_);
+        wavs_.clear();
+      } else {
+        batch_feature_t batch_feats;
+        std::vector<int> batch_feats_lens;
+        for (size_t i = 0; i < feats_.size(); ++i) {
+          batch_feats_lens.push_back(feats_lens_[i].get());
+          batch_feats.push_back(std::move(*feats_[i]));
+        }
+        feats_.clear();
+        feats_lens_.clear();
+        decoder_->DecodeFeatures(std::move(batch_feats),
+                                 std::move(batch_feats_lens));
+      }
+      result = decoder_->get_batch_result(nbest_, enable_timestamp_);
+    }
     ws_.text(true);
     ws_.write(asio::buffer(result));
   }
@@ -202,10 +356,23 @@ class BatchConnectionHandler {
   int nbest_ = 1;
   bool enable_timestamp_ = false;
   std::vector<int> batch_lens_;
+  // The chunked upload, the utterance being received and its samples so far
+  bool chunked_ = false;
+  size_t next_utt_ = 0;
+  std::vector<float> wav_;
+  bool has_odd_byte_ = false;
+  char odd_byte_ = 0;
+  // The utterances received, by the way they are decoded
+  std::vector<std::future<std::vector<DecodeResult>>> futures_;
+  std::vector<std::vector<float>> wavs_;
+  std::vector<std::shared_ptr<feature_t>> feats_;
+  std::vector<std::future<int>> feats_lens_;
   websocket::stream<tcp::socket> ws_;
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
   std::shared_ptr<DecodeResource> decode_resource_;
+  std::shared_ptr<BatchDecoderPool> decoder_pool_;
+  std::shared_ptr<BatchScheduler> batch_scheduler_ = nullptr;
 
   bool got_start_tag_ = false;
   bool got_end_tag_ = false;
@@ -0,0 +1,533 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "websocket/mux_connection_handler.h"
+
+#include <limits>
+#include <utility>
+
+#include "boost/asio/dispatch.hpp"
+#include "boost/asio/post.hpp"
+#include "frontend/resampler.h"
+#include "utils/log.h"
+#include "utils/trace.h"
+
+namespace wenet {
+
+namespace json = boost::json;
+
+// The stream id prefix of the binary frames
+static const size_t kStreamIdBytes = 4;
+
+MuxConnectionHandler::MuxConnectionHandler(
+    tcp::socket&& socket, std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeOptions> decode_config,
+    std::shared_ptr<ResourceRegistry> resources, size_t placement,
+    std::shared_ptr<ThreadPool> decode_pool,
+    std::shared_ptr<SessionPool> session_pool,
+    std::shared_ptr<AdmissionController> admission)
+    : ws_(std::move(socket)),
+      feature_config_(std::move(feature_config)),
+      decode_config_(std::move(decode_config)),
+      resources_(std::move(resources)),
+      placement_(placement),
+      decode_pool_(std::move(decode_pool)),
+      session_pool_(std::move(session_pool)),
+      admission_(std::move(admission)) {}
+
+void MuxConnectionHandler::Start() {
+  asio::dispatch(ws_.get_executor(), [self = shared_from_this()] {
+    self->ws_.async_accept(
+        beast::bind_front_handler(&MuxConnectionHandler::OnAccept, self));
+  });
+}
+
+void MuxConnectionHandler::OnAccept(beast::error_code ec) {
+  if (ec) {
+    LOG(ERROR) << "Accept failed: " << ec.message();
+    return;
+  }
+  DoRead();
+}
+
+void MuxConnectionHandler::DoRead() {
+  ws_.async_read(buffer_,
+                 beast::bind_front_handler(&MuxConnectionHandler::OnRead,
+                                           shared_from_this()));
+}
+
+void MuxConnectionHandler::OnRead(beast::error_code ec,
+                                  size_t bytes_transferred) {
+  if (ec) {
+    LOG(INFO) << ec.message();
+    // Closed or broken connection, finish the decoding of received audio
+    for (auto& it : streams_) {
+      if (!it.second->got_end_tag && !it.second->stop) {
+        OnSpeechEnd(it.second);
+      }
+    }
+    return;
+  }
+  try {
+    if (ws_.got_text()) {
+      std::string message = beast::buffers_to_string(buffer_.data());
+      VLOG(1) << message;
+      OnText(message);
+    } else {
+      OnSpeechData();
+    }
+  } catch (std::exception const& e) {
+    LOG(ERROR) << e.what();
+    OnError("Decoder got some exception!");
+  }
+  buffer_.consume(buffer_.size());
+  DoRead();
+}
+
+bool MuxConnectionHandler::ParseOptions(const json::object& obj,
+                                        Stream* stream,
+                                        std::string* error) const {
+  auto it = obj.find("nbest");
+  if (it != obj.end()) {
+    if (!it->value().is_int64()) {
+      *error = "integer is expected for nbest option";
+      return false;
+    }
+    stream->nbest = it->value().as_int64();
+  }
+  it = obj.find("continuous_decoding");
+  if (it != obj.end()) {
+    if (!it->value().is_bool()) {
+      *error = "boolean true or false is expected for continuous_decoding "
+               "option";
+      return false;
+    }
+    stream->continuous_decoding = it->value().as_bool();
+  }
+  it = obj.find("delta_partial");
+  if (it != obj.end()) {
+    if (!it->value().is_bool()) {
+      *error = "boolean true or false is expected for delta_partial option";
+      return false;
+    }
+    stream->delta_partial = it->value().as_bool();
+  }
+  it = obj.find("sample_rate");
+  if (it != obj.end()) {
+    if (!it->value().is_int64() ||
+        !IsSupportedSampleRate(it->value().as_int64())) {
+      *error = "unsupported sample_rate option";
+      return false;
+    }
+    stream->sample_rate = it->value().as_int64();
+  }
+  it = obj.find("audio_format");
+  if (it != obj.end()) {
+    if (!it->value().is_string() ||
+        !IsSupportedAudioFormat(it->value().as_string().c_str())) {
+      *error = "unsupported audio_format option";
+      return false;
+    }
+    stream->audio_format = it->value().as_string().c_str();
+  }
+  it = obj.find("feature_format");
+  if (it != obj.end()) {
+    if (!it->value().is_string()) {
+      *error = "string is expected for feature_format option";
+      return false;
+    }
+    stream->feature_format = it->value().as_string().c_str();
+  }
+  it = obj.find("num_bins");
+  if (it != obj.end()) {
+    if (!it->value().is_int64() || it->value().as_int64() <= 0) {
+      *error = "positive integer is expected for num_bins option";
+      return false;
+    }
+    stream->num_bins = it->value().as_int64();
+  }
+  it = obj.find("frame_shift_ms");
+  if (it != obj.end()) {
+    if (!it->value().is_int64() || it->value().as_int64() <= 0) {
+      *error = "positive integer is expected for frame_shift_ms option";
+      return false;
+    }
+    stream->frame_shift_ms = it->value().as_int64();
+  }
+  it = obj.find("binary_result");
+  if (it != obj.end()) {
+    if (!it->value().is_bool()) {
+      *error = "boolean true or false is expected for binary_result option";
+      return false;
+    }
+    stream->binary_result = it->value().as_bool();
+  }
+  it = obj.find("partial_interval_ms");
+  if (it != obj.end()) {
+    if (!it->value().is_int64() || it->value().as_int64() < 0) {
+      *error = "non negative integer is expected for partial_interval_ms "
+               "option";
+      return false;
+    }
+    stream->partial_interval_ms = it->value().as_int64();
+  }
+  it = obj.find("model");
+  if (it != obj.end()) {
+    if (!it->value().is_string()) {
+      *error = "string is expected for model option";
+      return false;
+    }
+    stream->model = it->value().as_string().c_str();
+  }
+  it = obj.find("tenant");
+  if (it != obj.end()) {
+    if (!it->value().is_string()) {
+      *error = "string is expected for tenant option";
+      return false;
+    }
+    stream->tenant = it->value().as_string().c_str();
+  }
+  return true;
+}
+
+void MuxConnectionHandler::OnText(const std::string& message) {
+  json::value v = json::parse(message);
+  if (!v.is_object()) {
+    OnError("Wrong protocol");
+    return;
+  }
+  const json::object& obj = v.get_object();
+  auto signal = obj.find("signal");
+  auto id = obj.find("stream_id");
+  if (signal == obj.end() || !signal->value().is_string()) {
+    OnError("Wrong message header");
+    return;
+  }
+  if (id == obj.end() || !id->value().is_int64() ||
+      id->value().as_int64() < 0 ||
+      id->value().as_int64() > std::numeric_limits<int32_t>::max()) {
+    OnError("non negative integer is expected for stream_id");
+    return;
+  }
+  int stream_id = id->value().as_int64();
+  const json::string& type = signal->value().as_string();
+  if (type == "start") {
+    OnSpeechStart(stream_id, obj);
+  } else if (type == "end") {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+      OnStreamError(stream_id, "error", "unknown stream");
+    } else if (!it->second->got_end_tag) {
+      OnSpeechEnd(it->second);
+    }
+  } else {
+    OnStreamError(stream_id, "error", "Unexpected signal type");
+  }
+}
+
+void MuxConnectionHandler::OnSpeechStart(int stream_id,
+                                         const json::object& obj) {
+  if (streams_.find(stream_id) != streams_.end()) {
+    OnStreamError(stream_id, "error", "stream is running");
+    return;
+  }
+  auto stream = std::make_shared<Stream>(stream_id,
+                                         decode_config_->chunk_deadline_ms);
+  std::string error;
+  if (!ParseOptions(obj, stream.get(), &error)) {
+    OnStreamError(stream_id, "error", error);
+    return;
+  }
+  auto resource = resources_->Find(stream->model, placement_);
+  if (resource == nullptr) {
+    OnStreamError(stream_id, "error", "unknown model " + stream->model);
+    return;
+  }
+  if (!stream->feature_format.empty()) {
+    stream->feature_decoder = CreateFeatureDecoder(
+        stream->feature_format, *feature_config_, stream->num_bins,
+        stream->frame_shift_ms, &error);
+    if (stream->feature_decoder == nullptr) {
+      OnStreamError(stream_id, "error", error);
+      return;
+    }
+  }
+  stream->ticket = admission_->Admit(stream->tenant, &error);
+  if (stream->ticket == nullptr) {
+    LOG(WARNING) << "Reject stream " << stream_id << ", " << error;
+    OnStreamError(stream_id, "rejected", error);
+    return;
+  }
+  stream->deadline.set_group(stream->ticket->tenant());
+  json::value rv = {
+      {"status", "ok"}, {"type", "server_ready"}, {"stream_id", stream_id}};
+  Send(json::serialize(rv));
+  stream->session = session_pool_->Acquire(std::move(resource));
+  // The compressed audio is decoded at the sample rate of the model
+  bool resample = stream->sample_rate > 0 && stream->audio_format == "pcm";
+  stream->session->feature_pipeline->set_input_sample_rate(
+      resample ? stream->sample_rate : feature_config_->sample_rate);
+  stream->session->decoder->set_trace_id(Tracer::Instance().NewSessionId());
+  stream->session->decoder->set_partial_nbest(stream->nbest);
+  stream->serializer = std::make_unique<ResultSerializer>(
+      stream->nbest, stream->delta_partial, stream->binary_result);
+  stream->serializer->set_stream_id(stream_id);
+  stream->coalescer = std::make_unique<PartialCoalescer>(
+      stream->nbest, stream->partial_interval_ms);
+  stream->audio_decoder =
+      CreateAudioDecoder(stream->audio_format, feature_config_->sample_rate);
+  streams_[stream_id] = std::move(stream);
+}
+
+void MuxConnectionHandler::OnSpeechEnd(const std::shared_ptr<Stream>& stream) {
+  stream->got_end_tag = true;
+  stream->session->feature_pipeline->set_input_finished();
+  ScheduleDecode(stream);
+}
+
+void MuxConnectionHandler::OnSpeechData() {
+  if (buffer_.size() < kStreamIdBytes) {
+    OnError("stream id is expected before binary data");
+    return;
+  }
+  const auto* data = static_cast<const unsigned char*>(buffer_.data().data());
+  uint32_t stream_id = data[0] | (data[1] << 8) | (data[2] << 16) |
+                       (static_cast<uint32_t>(data[3]) << 24);
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end()) {
+    // The stream is finished, e.g. by the endpoint, or not started
+    VLOG(2) << "Drop the data of stream " << stream_id;
+    return;
+  }
+  Stream* stream = it->second.get();
+  if (stream->got_end_tag || stream->stop) return;
+  const char* audio = reinterpret_cast<const char*>(data) + kStreamIdBytes;
+  size_t size = buffer_.size() - kStreamIdBytes;
+  FeaturePipeline* feature_pipeline = stream->session->feature_pipeline.get();
+  if (stream->feature_decoder != nullptr) {
+    // The frames computed by the client
+    stream->feats.clear();
+    if (!stream->feature_decoder->Decode(audio, size, &stream->feats)) {
+      OnStreamError(stream_id, "error",
+                    "the binary data is not of whole feature frames");
+      return;
+    }
+    int num_frames =
+        stream->feats.size() / stream->feature_decoder->feature_dim();
+    VLOG(2) << "Received " << num_frames << " frames of stream " << stream_id;
+    feature_pipeline->AcceptFeatures(stream->feats.data(), num_frames);
+  } else {
+    int num_samples = size / sizeof(int16_t);
+    const auto* pcm_data = reinterpret_cast<const int16_t*>(audio);
+    if (stream->audio_decoder != nullptr) {
+      stream->pcm.clear();
+      stream->audio_decoder->Decode(audio, size, &stream->pcm);
+      pcm_data = stream->pcm.data();
+      num_samples = stream->pcm.size();
+    }
+    VLOG(2) << "Received " << num_samples << " samples of stream "
+            << stream_id;
+    feature_pipeline->AcceptWaveform(pcm_data, num_samples);
+  }
+  if (admission_->Overloaded(feature_pipeline->NumQueuedFrames())) {
+    LOG(WARNING) << "Decoding falls behind, terminate stream " << stream_id;
+    OnStreamError(stream_id, "overloaded",
+                  "server overloaded, too many queued frames");
+    return;
+  }
+  ScheduleDecode(it->second);
+}
+
+void MuxConnectionHandler::OnError(const std::string& message) {
+  json::value rv = {{"status", "failed"}, {"message", message}};
+  Send(json::serialize(rv), true);
+}
+
+void MuxConnectionHandler::OnStreamError(int stream_id,
+                                         const std::string& type,
+                                         const std::string& message) {
+  json::value rv = {{"status", "failed"},
+                    {"type", type},
+                    {"stream_id", stream_id},
+                    {"message", message}};
+  Send(json::serialize(rv));
+  auto it = streams_.find(stream_id);
+  if (it != streams_.end()) {
+    // The running DecodeFunc stops at the next chunk
+    it->second->stop = true;
+    streams_.erase(it);
+  }
+}
+
+void MuxConnectionHandler::Finish(const std::shared_ptr<Stream>& stream) {
+  asio::post(ws_.get_executor(), [self = shared_from_this(), stream] {
+    auto it = self->streams_.find(stream->id);
+    // Or it's erased by OnStreamError, and the id may be reused
+    if (it != self->streams_.end() && it->second == stream) {
+      self->streams_.erase(it);
+    }
+  });
+}
+
+void MuxConnectionHandler::ScheduleDecode(
+    const std::shared_ptr<Stream>& stream) {
+  {
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    stream->deadline.OnAudio();
+    if (stream->decoding) {
+      // DecodeFunc is running, let it check the new data again
+      stream->pending = true;
+      return;
+    }
+    stream->decoding = true;
+  }
+  stream->deadline.Post(decode_pool_.get(),
+                        [self = shared_from_this(), stream] {
+                          self->DecodeFunc(stream);
+                        });
+}
+
+std::string MuxConnectionHandler::SpeechEndMessage(int stream_id) const {
+  json::value finish = {
+      {"status", "ok"}, {"type", "speech_end"}, {"stream_id", stream_id}};
+  return json::serialize(finish);
+}
+
+void MuxConnectionHandler::DecodeFunc(const std::shared_ptr<Stream>& stream) {
+  AsrDecoder* decoder = stream->session->decoder.get();
+  ResultSerializer* serializer = stream->serializer.get();
+  PartialCoalescer* coalescer = stream->coalescer.get();
+  while (true) {
+    bool late = false;
+    {
+      std::lock_guard<std::mutex> lock(stream->mutex);
+      stream->pending = false;
+      late = stream->deadline.Take();
+    }
+    try {
+      decoder->set_late(late);
+      while (!stream->stop) {
+        DecodeState state = decoder->Decode(false);
+        if (state == DecodeState::kWaitFeats) {
+          if (decoder->SecondPassDue()) {
+            // stream->decoding stays set until DecodeFunc runs again
+            decode_pool_->post(TaskPriority::kLow,
+                               [self = shared_from_this(), stream] {
+                                 self->SecondPassFunc(stream);
+                               });
+            return;
+          }
+          break;
+        } else if (state == DecodeState::kEndFeats) {
+          decoder->Rescoring();
+          Send(serializer->FinalMessage(decoder->result()), false,
+               serializer->binary());
+          Send(SpeechEndMessage(stream->id));
+          stream->stop = true;
+          Finish(stream);
+        } else if (state == DecodeState::kEndpoint) {
+          decoder->Rescoring();
+          Send(serializer->FinalMessage(decoder->result()), false,
+               serializer->binary());
+          if (stream->continuous_decoding) {
+            decoder->ResetContinuousDecoding();
+            coalescer->Reset();
+          } else {
+            Send(SpeechEndMessage(stream->id));
+            stream->stop = true;
+            Finish(stream);
+          }
+        } else {
+          if (decoder->DecodedSomething() &&
+              coalescer->ShouldSend(decoder->result())) {
+            Send(serializer->PartialMessage(decoder->result()), false,
+                 serializer->binary());
+          }
+        }
+      }
+    } catch (std::exception const& e) {
+      LOG(ERROR) << e.what();
+      json::value rv = {{"status", "failed"},
+                        {"type", "error"},
+                        {"stream_id", stream->id},
+                        {"message", "Decoder got some exception!"}};
+      Send(json::serialize(rv));
+      stream->stop = true;
+      Finish(stream);
+    }
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    if (!stream->pending || stream->stop) {
+      stream->decoding = false;
+      return;
+    }
+  }
+}
+
+void MuxConnectionHandler::SecondPassFunc(
+    const std::shared_ptr<Stream>& stream) {
+  AsrDecoder* decoder = stream->session->decoder.get();
+  ResultSerializer* serializer = stream->serializer.get();
+  try {
+    if (!stream->stop && decoder->SecondPassPartial() &&
+        stream->coalescer->ShouldSend(decoder->result())) {
+      Send(serializer->PartialMessage(decoder->result()), false,
+           serializer->binary());
+    }
+  } catch (std::exception const& e) {
+    LOG(ERROR) << e.what();
+  }
+  DecodeFunc(stream);
+}
+
+void MuxConnectionHandler::Send(std::string message, bool close_after,
+                                bool binary) {
+  asio::post(ws_.get_executor(), [self = shared_from_this(),
+                                  message = std::move(message), close_after,
+                                  binary] {
+    if (self->close_after_write_) return;
+    self->write_queue_.emplace_back(std::move(message), binary);
+    self->close_after_write_ = close_after;
+    // Only one async_write is allowed at the same time
+    if (self->write_queue_.size() == 1) {
+      self->DoWrite();
+    }
+  });
+}
+
+void MuxConnectionHandler::DoWrite() {
+  ws_.binary(write_queue_.front().second);
+  ws_.async_write(asio::buffer(write_queue_.front().first),
+                  beast::bind_front_handler(&MuxConnectionHandler::OnWrite,
+                                            shared_from_this()));
+}
+
+void MuxConnectionHandler::OnWrite(beast::error_code ec,
+                                   size_t bytes_transferred) {
+  if (ec) {
+    LOG(ERROR) << "Write failed: " << ec.message();
+    for (auto& it : streams_) it.second->stop = true;
+    return;
+  }
+  write_queue_.pop_front();
+  if (!write_queue_.empty()) {
+    DoWrite();
+  } else if (close_after_write_) {
+    ws_.async_close(websocket::close_code::normal,
+                    [self = shared_from_this()](beast::error_code ec) {
+                      LOG(INFO) << "ws_ is closed, bye :)";
+                    });
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,175 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WEBSOCKET_MUX_CONNECTION_HANDLER_H_
+#define WEBSOCKET_MUX_CONNECTION_HANDLER_H_
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/asio/ip/tcp.hpp"
+#include "boost/beast/core.hpp"
+#include "boost/beast/websocket.hpp"
+#include "boost/json.hpp"
+
+#include "decoder/partial_coalescer.h"
+#include "decoder/result_serializer.h"
+#include "decoder/session_pool.h"
+#include "frontend/audio_decoder.h"
+#include "frontend/feature_decoder.h"
+#include "utils/admission_control.h"
+#include "utils/chunk_deadline.h"
+#include "utils/thread_pool.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+namespace beast = boost::beast;          // from <boost/beast.hpp>
+namespace websocket = beast::websocket;  // from <boost/beast/websocket.hpp>
+namespace asio = boost::asio;            // from <boost/asio.hpp>
+using tcp = boost::asio::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
+
+// MuxConnectionHandler serves many streams over one websocket connection, so
+// a client, e.g. a gateway, doesn't need a connection and its handshake per
+// utterance. It's AsyncConnectionHandler with the session state per stream:
+//   * The text messages are the ones of ConnectionHandler with a
+//     "stream_id", e.g. {"signal":"start","stream_id":1,"nbest":1}, the id
+//     is chosen by the client and reused only after the stream is finished.
+//   * A binary frame is the 4 bytes little endian stream id followed by the
+//     audio of the stream.
+//   * All the messages of a stream carry its "stream_id", or the stream_id
+//     of wenet.Response for the binary results. The stream is finished after
+//     its speech_end, or its failed status, e.g. rejected, overloaded.
+// The connection stays open until the client closes it, or a message can't
+// be parsed at all, then the received audio of all the streams is decoded
+// as AsyncConnectionHandler does.
+class MuxConnectionHandler
+    : public std::enable_shared_from_this<MuxConnectionHandler> {
+ public:
+  MuxConnectionHandler(tcp::socket&& socket,
+                       std::shared_ptr<FeaturePipelineConfig> feature_config,
+                       std::shared_ptr<DecodeOptions> decode_config,
+                       std::shared_ptr<ResourceRegistry> resources,
+                       size_t placement,
+                       std::shared_ptr<ThreadPool> decode_pool,
+                       std::shared_ptr<SessionPool> session_pool,
+                       std::shared_ptr<AdmissionController> admission);
+  // Start the websocket handshake
+  void Start();
+
+ private:
+  struct Stream {
+    Stream(int id, int deadline_ms) : id(id), deadline(deadline_ms) {}
+
+    const int id;
+    bool continuous_decoding = false;
+    int nbest = 1;
+    bool delta_partial = false;
+    bool binary_result = false;
+    std::string audio_format = "pcm";
+    int sample_rate = 0;
+    int partial_interval_ms = 0;
+    // The name of the resource, see ResourceRegistry::Find
+    std::string model;
+    // The tenant, see TenantRegistry
+    std::string tenant;
+    // The uploaded features, see frontend/feature_decoder.h
+    std::string feature_format;
+    int num_bins = 0;
+    int frame_shift_ms = 0;
+    // Only used on the strand
+    bool got_end_tag = false;
+    std::unique_ptr<AudioDecoder> audio_decoder = nullptr;
+    std::vector<int16_t> pcm;
+    std::unique_ptr<FeatureDecoder> feature_decoder = nullptr;
+    std::vector<float> feats;
+    // The decoding is finished or canceled
+    std::atomic<bool> stop{false};
+    std::unique_ptr<AdmissionController::Ticket> ticket = nullptr;
+    std::shared_ptr<DecodeSession> session = nullptr;
+    // Only used by DecodeFunc
+    std::unique_ptr<ResultSerializer> serializer = nullptr;
+    std::unique_ptr<PartialCoalescer> coalescer = nullptr;
+    // Decode scheduling state, guarded by mutex
+    std::mutex mutex;
+    bool decoding = false;
+    bool pending = false;
+    ChunkDeadline deadline;
+  };
+
+  void OnAccept(beast::error_code ec);
+  void DoRead();
+  void OnRead(beast::error_code ec, size_t bytes_transferred);
+  void OnText(const std::string& message);
+  void OnSpeechStart(int stream_id, const boost::json::object& obj);
+  void OnSpeechEnd(const std::shared_ptr<Stream>& stream);
+  void OnSpeechData();
+  // Send the failed status of the connection, and close it
+  void OnError(const std::string& message);
+  // Send the failed status of `type` of the stream, e.g. rejected, and
+  // finish it
+  void OnStreamError(int stream_id, const std::string& type,
+                     const std::string& message);
+  // Parse the options of the start signal into `stream`
+  bool ParseOptions(const boost::json::object& obj, Stream* stream,
+                    std::string* error) const;
+  // Remove the finished stream on the strand, the id can be reused then
+  void Finish(const std::shared_ptr<Stream>& stream);
+
+  // Schedule DecodeFunc of the stream on the decode pool if it is not running
+  void ScheduleDecode(const std::shared_ptr<Stream>& stream);
+  void DecodeFunc(const std::shared_ptr<Stream>& stream);
+  // The second pass of the partial result on a low priority task, before
+  // DecodeFunc goes on, see AsrDecoder::SecondPassPartial()
+  void SecondPassFunc(const std::shared_ptr<Stream>& stream);
+  std::string SpeechEndMessage(int stream_id) const;
+
+  // Send is thread safe, the messages are written in order on the strand
+  void Send(std::string message, bool close_after = false,
+            bool binary = false);
+  void DoWrite();
+  void OnWrite(beast::error_code ec, size_t bytes_transferred);
+
+  websocket::stream<beast::tcp_stream> ws_;
+  beast::flat_buffer buffer_;
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  // The replica of the resources of the connection
+  size_t placement_;
+  std::shared_ptr<ThreadPool> decode_pool_;
+  std::shared_ptr<SessionPool> session_pool_;
+  std::shared_ptr<AdmissionController> admission_;
+
+  // The running streams by id, only accessed on the strand
+  std::map<int, std::shared_ptr<Stream>> streams_;
+
+  // Write queue, only accessed on the strand
+  // Pending messages and whether they are binary, the front one is in flight
+  std::deque<std::pair<std::string, bool>> write_queue_;
+  bool close_after_write_ = false;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(MuxConnectionHandler);
+};
+
+}  // namespace wenet
+
+#endif  // WEBSOCKET_MUX_CONNECTION_HANDLER_H_
@@ -63,9 +63,13 @@ void WebSocketClient::ReadLoopFunc() {
     while (true) {
       beast::flat_buffer buffer;
       ws_.read(buffer);
+      if (!ws_.got_text()) {
+        // A binary wenet.Response result
+        LOG(INFO) << "Binary result of " << buffer.size() << " bytes";
+        continue;
+      }
       std::string message = beast::buffers_to_string(buffer.data());
       LOG(INFO) << message;
-      CHECK(ws_.got_text());
       json::object obj = json::parse(message).as_object();
       if (obj["status"] != "ok") {
         break;
@@ -87,19 +91,37 @@ void WebSocketClient::ReadLoopFunc() {
 
 void WebSocketClient::Join() { t_->join(); }
 
-void WebSocketClient::SendStartSignal() {
+std::string WebSocketClient::StartSignal(int nbest, bool continuous_decoding,
+                                         bool delta_partial,
+                                         bool binary_result,
+                                         const std::string& model) {
   // TODO(Binbin Zhang): Add sample rate and other setting support
-  json::value start_tag = {{"signal", "start"},
-                           {"nbest", nbest_},
-                           {"continuous_decoding", continuous_decoding_}};
-  std::string start_message = json::serialize(start_tag);
-  this->SendTextData(start_message);
+  json::object start_tag = {{"signal", "start"},
+                            {"nbest", nbest},
+                            {"continuous_decoding", continuous_decoding}};
+  // Only sent when enabled, the servers without it keep working
+  if (delta_partial) {
+    start_tag.emplace("delta_partial", true);
+  }
+  if (binary_result) {
+    start_tag.emplace("binary_result", true);
+  }
+  if (!model.empty()) {
+    start_tag.emplace("model", model);
+  }
+  return json::serialize(start_tag);
 }
 
-void WebSocketClient::SendEndSignal() {
+std::string WebSocketClient::EndSignal() {
   json::value end_tag = {{"signal", "end"}};
-  std::string end_message = json::serialize(end_tag);
-  this->SendTextData(end_message);
+  return json::serialize(end_tag);
 }
 
+void WebSocketClient::SendStartSignal() {
+  this->SendTextData(StartSignal(nbest_, continuous_decoding_, delta_partial_,
+                                 binary_result_, model_));
+}
+
+void WebSocketClient::SendEndSignal() { this->SendTextData(EndSignal()); }
+
 }  // namespace wenet
@@ -50,14 +50,30 @@ class WebSocketClient {
   void set_continuous_decoding(bool continuous_decoding) {
     continuous_decoding_ = continuous_decoding;
   }
+  // Ask for the partial results as deltas, see ResultSerializer
+  void set_delta_partial(bool delta_partial) { delta_partial_ = delta_partial; }
+  // Ask for the results as binary wenet.Response frames
+  void set_binary_result(bool binary_result) { binary_result_ = binary_result; }
+  // The named model of the server to decode with, empty for the default one
+  void set_model(const std::string& model) { model_ = model; }
   bool done() const { return done_; }
 
+  // The messages of the protocol, shared with the async client
+  static std::string StartSignal(int nbest, bool continuous_decoding,
+                                 bool delta_partial = false,
+                                 bool binary_result = false,
+                                 const std::string& model = "");
+  static std::string EndSignal();
+
  private:
   void Connect();
   std::string hostname_;
   int port_;
   int nbest_ = 1;
   bool continuous_decoding_ = false;
+  bool delta_partial_ = false;
+  bool binary_result_ = false;
+  std::string model_;
   bool done_ = false;
   asio::io_context ioc_;
   websocket::stream<tcp::socket> ws_{ioc_};
@@ -15,12 +15,19 @@
 
 #include "websocket/websocket_server.h"
 
+#include <algorithm>
 #include <thread>
 #include <utility>
 #include <vector>
 
+#include "boost/asio/strand.hpp"
+#include "websocket/async_connection_handler.h"
 #include "websocket/batch_connection_handler.h"
+#include "websocket/mux_connection_handler.h"
 #include "boost/json/src.hpp"
+#include "frontend/resampler.h"
+#include "utils/cpu_affinity.h"
+#include "utils/load_monitor.h"
 #include "utils/log.h"
 
 namespace wenet {
@@ -35,27 +42,66 @@ namespace json = boost::json;
 ConnectionHandler::ConnectionHandler(
     tcp::socket&& socket, std::shared_ptr<FeaturePipelineConfig> feature_config,
     std::shared_ptr<DecodeOptions> decode_config,
-    std::shared_ptr<DecodeResource> decode_resource)
+    std::shared_ptr<ResourceRegistry> resources, size_t placement,
+    std::shared_ptr<SessionPool> session_pool,
+    std::shared_ptr<AdmissionController> admission)
     : ws_(std::move(socket)),
       feature_config_(std::move(feature_config)),
       decode_config_(std::move(decode_config)),
-      decode_resource_(std::move(decode_resource)) {}
+      resources_(std::move(resources)),
+      placement_(placement),
+      session_pool_(std::move(session_pool)),
+      admission_(std::move(admission)) {}
 
 void ConnectionHandler::OnSpeechStart() {
   LOG(INFO) << "Received speech start signal, start reading speech";
+  auto resource = resources_->Find(model_, placement_);
+  if (resource == nullptr) {
+    OnError("unknown model " + model_);
+    return;
+  }
+  std::string reason;
+  if (!feature_format_.empty()) {
+    feature_decoder_ = CreateFeatureDecoder(feature_format_, *feature_config_,
+                                            num_bins_, frame_shift_ms_,
+                                            &reason);
+    if (feature_decoder_ == nullptr) {
+      OnError(reason);
+      return;
+    }
+  }
+  ticket_ = admission_->Admit(tenant_, &reason);
+  if (ticket_ == nullptr) {
+    LOG(WARNING) << "Reject the connection, " << reason;
+    OnReject("rejected", reason);
+    return;
+  }
   got_start_tag_ = true;
   json::value rv = {{"status", "ok"}, {"type", "server_ready"}};
   ws_.text(true);
   ws_.write(asio::buffer(json::serialize(rv)));
-  feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
-  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, decode_resource_,
-                                          *decode_config_);
+  session_ = session_pool_->Acquire(std::move(resource));
+  feature_pipeline_ = session_->feature_pipeline;
+  // The compressed audio is decoded at the sample rate of the model
+  bool resample = sample_rate_ > 0 && audio_format_ == "pcm";
+  feature_pipeline_->set_input_sample_rate(
+      resample ? sample_rate_ : feature_config_->sample_rate);
+  decoder_ = session_->decoder;
+  trace_id_ = Tracer::Instance().NewSessionId();
+  decoder_->set_trace_id(trace_id_);
+  decoder_->set_partial_nbest(nbest_);
+  serializer_ = std::make_unique<ResultSerializer>(nbest_, delta_partial_,
+                                                   binary_result_);
+  coalescer_ = std::make_unique<PartialCoalescer>(nbest_, partial_interval_ms_);
+  audio_decoder_ =
+      CreateAudioDecoder(audio_format_, feature_config_->sample_rate);
   // Start decoder thread
   decode_thread_ =
       std::make_shared<std::thread>(&ConnectionHandler::DecodeThreadFunc, this);
 }
 
 void ConnectionHandler::OnSpeechEnd() {
+  if (got_end_tag_) return;
   LOG(INFO) << "Received speech end signal";
   if (feature_pipeline_ != nullptr) {
     feature_pipeline_->set_input_finished();
@@ -63,20 +109,36 @@ void ConnectionHandler::OnSpeechEnd() {
   got_end_tag_ = true;
 }
 
-void ConnectionHandler::OnPartialResult(const std::string& result) {
-  LOG(INFO) << "Partial result: " << result;
-  json::value rv = {
-      {"status", "ok"}, {"type", "partial_result"}, {"nbest", result}};
-  ws_.text(true);
-  ws_.write(asio::buffer(json::serialize(rv)));
+void ConnectionHandler::OnPartialResult() {
+  TraceScope trace(trace_id_, "send_partial_result");
+  const std::string& message = serializer_->PartialMessage(decoder_->result());
+  if (serializer_->binary()) {
+    LOG(INFO) << "Partial result of " << message.size() << " bytes";
+  } else {
+    LOG(INFO) << "Partial result: " << message;
+  }
+  ws_.text(!serializer_->binary());
+  ws_.write(asio::buffer(message));
 }
 
-void ConnectionHandler::OnFinalResult(const std::string& result) {
-  LOG(INFO) << "Final result: " << result;
-  json::value rv = {
-      {"status", "ok"}, {"type", "final_result"}, {"nbest", result}};
-  ws_.text(true);
-  ws_.write(asio::buffer(json::serialize(rv)));
+void ConnectionHandler::OnFinalResult(
+    const std::vector<DecodeResult>& result) {
+  TraceScope trace(trace_id_, "send_final_result");
+  coalescer_->Reset();
+  const std::string& message = serializer_->FinalMessage(result);
+  if (serializer_->binary()) {
+    LOG(INFO) << "Final result of " << message.size() << " bytes";
+  } else {
+    LOG(INFO) << "Final result: " << message;
+  }
+  ws_.text(!serializer_->binary());
+  ws_.write(asio::buffer(message));
+}
+
+void ConnectionHandler::SendSegmentResults(bool block) {
+  while (decoder_->PopSegmentResult(&segment_result_, block)) {
+    OnFinalResult(segment_result_);
+  }
 }
 
 void ConnectionHandler::OnFinish() {
@@ -87,66 +149,85 @@ void ConnectionHandler::OnFinish() {
 }
 
 void ConnectionHandler::OnSpeechData(const beast::flat_buffer& buffer) {
-  // Read binary PCM data
-  int num_samples = buffer.size() / sizeof(int16_t);
-  VLOG(2) << "Received " << num_samples << " samples";
   CHECK(feature_pipeline_ != nullptr);
   CHECK(decoder_ != nullptr);
-  const auto* pcm_data = static_cast<const int16_t*>(buffer.data().data());
-  feature_pipeline_->AcceptWaveform(pcm_data, num_samples);
-}
-
-std::string ConnectionHandler::SerializeResult(bool finish) {
-  json::array nbest;
-  for (const DecodeResult& path : decoder_->result()) {
-    json::object jpath({{"sentence", path.sentence}});
-    if (finish) {
-      json::array word_pieces;
-      for (const WordPiece& word_piece : path.word_pieces) {
-        json::object jword_piece({{"word", word_piece.word},
-                                  {"start", word_piece.start},
-                                  {"end", word_piece.end}});
-        word_pieces.emplace_back(jword_piece);
-      }
-      jpath.emplace("word_pieces", word_pieces);
+  if (feature_decoder_ != nullptr) {
+    // The frames computed by the client
+    feats_.clear();
+    if (!feature_decoder_->Decode(
+            static_cast<const char*>(buffer.data().data()), buffer.size(),
+            &feats_)) {
+      OnError("the binary data is not of whole feature frames");
+      return;
     }
-    nbest.emplace_back(jpath);
-
-    if (nbest.size() == nbest_) {
-      break;
+    int num_frames = feats_.size() / feature_decoder_->feature_dim();
+    VLOG(2) << "Received " << num_frames << " frames";
+    feature_pipeline_->AcceptFeatures(feats_.data(), num_frames);
+    if (admission_->Overloaded(feature_pipeline_->NumQueuedFrames())) {
+      LOG(WARNING) << "Decoding falls behind, terminate the connection";
+      overloaded_ = true;
     }
+    return;
+  }
+  // Read binary PCM data
+  int num_samples = buffer.size() / sizeof(int16_t);
+  const auto* pcm_data = static_cast<const int16_t*>(buffer.data().data());
+  TraceScope trace(trace_id_, "accept_waveform");
+  if (audio_decoder_ != nullptr) {
+    // Or one packet of the compressed audio
+    pcm_.clear();
+    audio_decoder_->Decode(static_cast<const char*>(buffer.data().data()),
+                           buffer.size(), &pcm_);
+    pcm_data = pcm_.data();
+    num_samples = pcm_.size();
+  }
+  VLOG(2) << "Received " << num_samples << " samples";
+  feature_pipeline_->AcceptWaveform(pcm_data, num_samples);
+  if (admission_->Overloaded(feature_pipeline_->NumQueuedFrames())) {
+    LOG(WARNING) << "Decoding falls behind, terminate the connection";
+    overloaded_ = true;
   }
-  return json::serialize(nbest);
 }
 
 void ConnectionHandler::DecodeThreadFunc() {
   try {
     while (true) {
-      DecodeState state = decoder_->Decode();
+      if (overloaded_) {
+        OnReject("overloaded", "server overloaded, too many queued frames");
+        break;
+      }
+      // While a segment is rescored, the next one is decoded as far as
+      // the audio goes, then its result is waited for
+      bool pending = decoder_->num_pending_segments() > 0;
+      DecodeState state = decoder_->Decode(!pending);
+      SendSegmentResults(state == DecodeState::kWaitFeats);
       if (state == DecodeState::kEndFeats) {
+        SendSegmentResults(true);
         decoder_->Rescoring();
-        std::string result = SerializeResult(true);
-        OnFinalResult(result);
+        OnFinalResult(decoder_->result());
         OnFinish();
         stop_recognition_ = true;
         break;
       } else if (state == DecodeState::kEndpoint) {
-        decoder_->Rescoring();
-        std::string result = SerializeResult(true);
-        OnFinalResult(result);
         // If it's not continuous decoding, continue to do next recognition
         // otherwise stop the recognition
         if (continuous_decoding_) {
-          decoder_->ResetContinuousDecoding();
+          decoder_->FinishSegment();
+          SendSegmentResults(false);
         } else {
+          decoder_->Rescoring();
+          OnFinalResult(decoder_->result());
           OnFinish();
           stop_recognition_ = true;
           break;
         }
-      } else {
-        if (decoder_->DecodedSomething()) {
-          std::string result = SerializeResult(false);
-          OnPartialResult(result);
+      } else if (state == DecodeState::kEndBatch) {
+        // The partial results of a segment follow the final results of the
+        // previous ones
+        if (decoder_->num_pending_segments() == 0 &&
+            decoder_->DecodedSomething() &&
+            coalescer_->ShouldSend(decoder_->result())) {
+          OnPartialResult();
         }
       }
     }
@@ -163,6 +244,15 @@ void ConnectionHandler::OnError(const std::string& message) {
   ws_.close(websocket::close_code::normal);
 }
 
+void ConnectionHandler::OnReject(const std::string& type,
+                                 const std::string& message) {
+  json::value rv = {
+      {"status", "failed"}, {"type", type}, {"message", message}};
+  ws_.text(true);
+  ws_.write(asio::buffer(json::serialize(rv)));
+  ws_.close(websocket::close_code::try_again_later);
+}
+
 void ConnectionHandler::OnText(const std::string& message) {
   json::value v = json::parse(message);
   if (v.is_object()) {
@@ -186,6 +276,86 @@ void ConnectionHandler::OnText(const std::string& message) {
                 "continuous_decoding option");
           }
         }
+        if (obj.find("delta_partial") != obj.end()) {
+          if (obj["delta_partial"].is_bool()) {
+            delta_partial_ = obj["delta_partial"].as_bool();
+          } else {
+            OnError(
+                "boolean true or false is expected for "
+                "delta_partial option");
+          }
+        }
+        if (obj.find("sample_rate") != obj.end()) {
+          if (obj["sample_rate"].is_int64() &&
+              IsSupportedSampleRate(obj["sample_rate"].as_int64())) {
+            sample_rate_ = obj["sample_rate"].as_int64();
+          } else {
+            OnError("unsupported sample_rate option");
+          }
+        }
+        if (obj.find("audio_format") != obj.end()) {
+          if (obj["audio_format"].is_string() &&
+              IsSupportedAudioFormat(obj["audio_format"].as_string().c_str())) {
+            audio_format_ = obj["audio_format"].as_string().c_str();
+          } else {
+            OnError("unsupported audio_format option");
+          }
+        }
+        if (obj.find("feature_format") != obj.end()) {
+          if (obj["feature_format"].is_string()) {
+            feature_format_ = obj["feature_format"].as_string().c_str();
+          } else {
+            OnError("string is expected for feature_format option");
+          }
+        }
+        if (obj.find("num_bins") != obj.end()) {
+          if (obj["num_bins"].is_int64() && obj["num_bins"].as_int64() > 0) {
+            num_bins_ = obj["num_bins"].as_int64();
+          } else {
+            OnError("positive integer is expected for num_bins option");
+          }
+        }
+        if (obj.find("frame_shift_ms") != obj.end()) {
+          if (obj["frame_shift_ms"].is_int64() &&
+              obj["frame_shift_ms"].as_int64() > 0) {
+            frame_shift_ms_ = obj["frame_shift_ms"].as_int64();
+          } else {
+            OnError("positive integer is expected for frame_shift_ms option");
+          }
+        }
+        if (obj.find("binary_result") != obj.end()) {
+          if (obj["binary_result"].is_bool()) {
+            binary_result_ = obj["binary_result"].as_bool();
+          } else {
+            OnError(
+                "boolean true or false is expected for "
+                "binary_result option");
+          }
+        }
+        if (obj.find("partial_interval_ms") != obj.end()) {
+          if (obj["partial_interval_ms"].is_int64() &&
+              obj["partial_interval_ms"].as_int64() >= 0) {
+            partial_interval_ms_ = obj["partial_interval_ms"].as_int64();
+          } else {
+            OnError(
+                "non negative integer is expected for "
+                "partial_interval_ms option");
+          }
+        }
+        if (obj.find("model") != obj.end()) {
+          if (obj["model"].is_string()) {
+            model_ = obj["model"].as_string().c_str();
+          } else {
+            OnError("string is expected for model option");
+          }
+        }
+        if (obj.find("tenant") != obj.end()) {
+          if (obj["tenant"].is_string()) {
+            tenant_ = obj["tenant"].as_string().c_str();
+          } else {
+            OnError("string is expected for tenant option");
+          }
+        }
         OnSpeechStart();
       } else if (signal == "end") {
         OnSpeechEnd();
@@ -204,11 +374,21 @@ void ConnectionHandler::operator()() {
   try {
     // Accept the websocket handshake
     ws_.accept();
+    recorder_ = SessionRecorder::NewSession();
     for (;;) {
       // This buffer will hold the incoming message
       beast::flat_buffer buffer;
-      // Read a message
+      // Read a message, the network_read stage includes the time the client
+      // takes to send it
+      int64_t read_start = trace_id_ != 0 ? Tracer::NowNs() : 0;
       ws_.read(buffer);
+      Tracer::Instance().Record(trace_id_, "network_read", read_start);
+      if (recorder_ != nullptr) {
+        recorder_->Record(ws_.got_text() ? RecordedPacket::kText
+                                         : RecordedPacket::kBinary,
+                          static_cast<const char*>(buffer.data().data()),
+                          buffer.size());
+      }
       if (ws_.got_text()) {
         std::string message = beast::buffers_to_string(buffer.data());
         LOG(INFO) << message;
@@ -224,6 +404,11 @@ void ConnectionHandler::operator()() {
             break;
           }
           OnSpeechData(buffer);
+          if (overloaded_) {
+            // Stop reading, the decoding thread sends the status
+            OnSpeechEnd();
+            break;
+          }
         }
       }
     }
@@ -246,25 +431,55 @@ void ConnectionHandler::operator()() {
   }
 }
 
+std::unique_ptr<tcp::acceptor> WebSocketServer::Listen() {
+  auto const address = asio::ip::make_address("0.0.0.0");
+  tcp::endpoint endpoint{address, static_cast<uint16_t>(port_)};
+  auto acceptor = std::make_unique<tcp::acceptor>(ioc_);
+  acceptor->open(endpoint.protocol());
+  acceptor->set_option(asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+  if (reuse_port_) {
+    acceptor->set_option(
+        asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+  }
+#else
+  CHECK(!reuse_port_) << "SO_REUSEPORT isn't supported on the platform";
+#endif
+  acceptor->bind(endpoint);
+  acceptor->listen();
+  return acceptor;
+}
+
 void WebSocketServer::Start(bool run_batch) {
   try {
-    auto const address = asio::ip::make_address("0.0.0.0");
-    tcp::acceptor acceptor{ioc_, {address, static_cast<uint16_t>(port_)}};
+    acceptor_ = Listen();
     for (;;) {
       // This will receive the new connection
       tcp::socket socket{ioc_};
       // Block until we get a connection
-      acceptor.accept(socket);
+      acceptor_->accept(socket);
       // Launch the session, transferring ownership of the socket
+      size_t placement = NextPlacement();
+      std::vector<int> cpus;
+      if (!cpu_sets_.empty()) cpus = cpu_sets_[placement % cpu_sets_.size()];
+      // The threads created by the session inherit the affinity
       if (run_batch) {
         BatchConnectionHandler handler(std::move(socket), feature_config_,
-            decode_config_, decode_resource_);
-        std::thread t(std::move(handler));
+            decode_config_, resources_->Get(placement), batch_decoder_pool_,
+            batch_scheduler_);
+        std::thread t([handler = std::move(handler), cpus]() mutable {
+          if (!cpus.empty()) PinCurrentThread(cpus);
+          handler();
+        });
         t.detach();
       } else {
         ConnectionHandler handler(std::move(socket), feature_config_,
-            decode_config_, decode_resource_);
-        std::thread t(std::move(handler));
+            decode_config_, resources_, placement, session_pool_,
+            admission_);
+        std::thread t([handler = std::move(handler), cpus]() mutable {
+          if (!cpus.empty()) PinCurrentThread(cpus);
+          handler();
+        });
         t.detach();
       }
     }
@@ -273,4 +488,70 @@ void WebSocketServer::Start(bool run_batch) {
   }
 }
 
+void WebSocketServer::StartAsync(int num_io_threads, int num_decode_threads) {
+  CHECK_GT(num_io_threads, 0);
+  CHECK_GT(num_decode_threads, 0);
+  if (cpu_sets_.empty()) {
+    decode_pools_.emplace_back(
+        std::make_shared<ThreadPool>(num_decode_threads));
+  } else {
+    int num_threads =
+        std::max(1, num_decode_threads / static_cast<int>(cpu_sets_.size()));
+    for (const auto& cpus : cpu_sets_) {
+      decode_pools_.emplace_back(
+          std::make_shared<ThreadPool>(num_threads, cpus));
+    }
+  }
+  for (const auto& pool : decode_pools_) {
+    std::weak_ptr<ThreadPool> weak_pool = pool;
+    LoadMonitor::Instance().AddQueue(
+        [weak_pool]() {
+          auto pool = weak_pool.lock();
+          return pool != nullptr ? pool->num_pending_tasks() : 0;
+        },
+        pool->size());
+  }
+  try {
+    acceptor_ = Listen();
+    DoAccept();
+    std::vector<std::thread> io_threads;
+    for (int i = 0; i < num_io_threads - 1; ++i) {
+      io_threads.emplace_back([this] { ioc_.run(); });
+    }
+    ioc_.run();
+    for (auto& t : io_threads) {
+      t.join();
+    }
+  } catch (const std::exception& e) {
+    LOG(FATAL) << e.what();
+  }
+}
+
+void WebSocketServer::DoAccept() {
+  // Each connection gets its own strand, so its handlers never run
+  // concurrently even though ioc_ is run by many threads
+  acceptor_->async_accept(
+      asio::make_strand(ioc_),
+      [this](beast::error_code ec, tcp::socket socket) {
+        if (ec) {
+          LOG(ERROR) << "Accept failed: " << ec.message();
+        } else {
+          size_t placement = NextPlacement();
+          auto decode_pool = decode_pools_[placement % decode_pools_.size()];
+          if (multiplexed_) {
+            std::make_shared<MuxConnectionHandler>(
+                std::move(socket), feature_config_, decode_config_,
+                resources_, placement, decode_pool, session_pool_, admission_)
+                ->Start();
+          } else {
+            std::make_shared<AsyncConnectionHandler>(
+                std::move(socket), feature_config_, decode_config_,
+                resources_, placement, decode_pool, session_pool_, admission_)
+                ->Start();
+          }
+        }
+        DoAccept();
+      });
+}
+
 }  // namespace wenet
@@ -20,6 +20,7 @@
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "boost/asio/connect.hpp"
 #include "boost/asio/ip/tcp.hpp"
@@ -27,8 +28,20 @@
 #include "boost/beast/websocket.hpp"
 
 #include "decoder/asr_decoder.h"
+#include "decoder/batch_decoder_pool.h"
+#include "decoder/batch_scheduler.h"
+#include "decoder/resource_registry.h"
+#include "decoder/partial_coalescer.h"
+#include "decoder/result_serializer.h"
+#include "decoder/session_pool.h"
+#include "frontend/audio_decoder.h"
+#include "frontend/feature_decoder.h"
 #include "frontend/feature_pipeline.h"
+#include "utils/admission_control.h"
 #include "utils/log.h"
+#include "utils/session_record.h"
+#include "utils/thread_pool.h"
+#include "utils/trace.h"
 
 namespace wenet {
 
@@ -43,7 +56,10 @@ class ConnectionHandler {
   ConnectionHandler(tcp::socket&& socket,
                     std::shared_ptr<FeaturePipelineConfig> feature_config,
                     std::shared_ptr<DecodeOptions> decode_config,
-                    std::shared_ptr<DecodeResource> decode_resource_);
+                    std::shared_ptr<ResourceRegistry> resources,
+                    size_t placement,
+                    std::shared_ptr<SessionPool> session_pool,
+                    std::shared_ptr<AdmissionController> admission);
   void operator()();
 
  private:
@@ -53,25 +69,75 @@ class ConnectionHandler {
   void OnFinish();
   void OnSpeechData(const beast::flat_buffer& buffer);
   void OnError(const std::string& message);
-  void OnPartialResult(const std::string& result);
-  void OnFinalResult(const std::string& result);
+  // Send the failed status of `type`, e.g. rejected, and close
+  void OnReject(const std::string& type, const std::string& message);
+  void OnPartialResult();
+  void OnFinalResult(const std::vector<DecodeResult>& result);
+  // Send the final results of the segments rescored by now, or wait for
+  // all of them if block, see AsrDecoder::FinishSegment()
+  void SendSegmentResults(bool block);
   void DecodeThreadFunc();
-  std::string SerializeResult(bool finish);
 
   bool continuous_decoding_ = false;
   int nbest_ = 1;
+  // Send the partial results as the changes of them, see ResultSerializer
+  bool delta_partial_ = false;
+  // Send the results as binary wenet.Response, see ResultSerializer
+  bool binary_result_ = false;
+  // The audio format of the binary frames, see frontend/audio_decoder.h
+  std::string audio_format_ = "pcm";
+  // The sample rate of the audio, 0 if it's the one of the model
+  int sample_rate_ = 0;
+  // The format of the frames uploaded instead of the audio, see
+  // frontend/feature_decoder.h, and their options checked against the
+  // feature config, 0 if not set
+  std::string feature_format_;
+  int num_bins_ = 0;
+  int frame_shift_ms_ = 0;
+  // The min time between two partial results, see PartialCoalescer
+  int partial_interval_ms_ = 0;
+  // The name of the resource to decode with, see ResourceRegistry::Find,
+  // empty for the default one
+  std::string model_;
+  // The tenant of the session, see TenantRegistry, empty for the default
+  // one
+  std::string tenant_;
   websocket::stream<tcp::socket> ws_;
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
-  std::shared_ptr<DecodeResource> decode_resource_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  // The replica of the resource of the connection, see set_cpu_sets()
+  size_t placement_;
+  std::shared_ptr<SessionPool> session_pool_;
+  std::shared_ptr<AdmissionController> admission_;
+  std::unique_ptr<AdmissionController::Ticket> ticket_ = nullptr;
 
   bool got_start_tag_ = false;
   bool got_end_tag_ = false;
   // When endpoint is detected, stop recognition, and stop receiving data.
   bool stop_recognition_ = false;
+  // Too many frames are queued, the reading thread stops the decoding
+  bool overloaded_ = false;
+  // Non zero if the session is traced, see utils/trace.h
+  uint64_t trace_id_ = 0;
+  // The pipeline and the decoder of the session, which is returned to the
+  // pool after them
+  std::shared_ptr<DecodeSession> session_ = nullptr;
   std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<AsrDecoder> decoder_ = nullptr;
   std::shared_ptr<std::thread> decode_thread_ = nullptr;
+  std::unique_ptr<ResultSerializer> serializer_ = nullptr;
+  std::unique_ptr<PartialCoalescer> coalescer_ = nullptr;
+  std::vector<DecodeResult> segment_result_;
+  // nullptr for pcm, pcm_ is the decoded audio of the frame
+  std::unique_ptr<AudioDecoder> audio_decoder_ = nullptr;
+  std::vector<int16_t> pcm_;
+  // Not nullptr if the features are uploaded, feats_ are the decoded frames
+  std::unique_ptr<FeatureDecoder> feature_decoder_ = nullptr;
+  std::vector<float> feats_;
+  // Not nullptr if the messages of the connection are recorded, see
+  // SessionRecorder
+  std::unique_ptr<SessionRecorder> recorder_ = nullptr;
 };
 
 class WebSocketServer {
@@ -83,17 +149,108 @@ class WebSocketServer {
       : port_(port),
         feature_config_(std::move(feature_config)),
         decode_config_(std::move(decode_config)),
-        decode_resource_(std::move(decode_resource)) {}
+        resources_(std::make_shared<ResourceRegistry>(
+            std::move(decode_resource))),
+        session_pool_(std::make_shared<SessionPool>(
+            feature_config_, decode_config_, resources_, 0)),
+        batch_decoder_pool_(std::make_shared<BatchDecoderPool>(
+            feature_config_, decode_config_, resources_, 0)) {}
+  // With a replica of the resource per cpu set of set_cpu_sets()
+  WebSocketServer(int port,
+                  std::shared_ptr<FeaturePipelineConfig> feature_config,
+                  std::shared_ptr<DecodeOptions> decode_config,
+                  std::vector<std::shared_ptr<DecodeResource>> replicas)
+      : port_(port),
+        feature_config_(std::move(feature_config)),
+        decode_config_(std::move(decode_config)),
+        resources_(std::make_shared<ResourceRegistry>(std::move(replicas))),
+        session_pool_(std::make_shared<SessionPool>(
+            feature_config_, decode_config_, resources_, 0)),
+        batch_decoder_pool_(std::make_shared<BatchDecoderPool>(
+            feature_config_, decode_config_, resources_, 0)) {}
+
+  // Place the connections on the cpu sets round robin, e.g. one per NUMA
+  // node, see CpuSetsFromFlags. The decode threads of a connection are
+  // pinned to its set, and it decodes with the replica of the set. Call it
+  // before the server is started.
+  void set_cpu_sets(std::vector<std::vector<int>> cpu_sets) {
+    cpu_sets_ = std::move(cpu_sets);
+  }
+
+  // Keep up to `capacity` Reset() sessions of the finished connections for
+  // the new ones, so they're not constructed per connection, see
+  // SessionPool. The pool is filled at once if `prefill`. Call it before
+  // the server is started.
+  void EnableSessionPool(int capacity, bool prefill = true) {
+    session_pool_ = std::make_shared<SessionPool>(
+        feature_config_, decode_config_, resources_, capacity);
+    if (prefill) session_pool_->Prefill();
+  }
+
+  // Reject the new connections and terminate the ones falling behind by
+  // `opts`, see AdmissionController. Call it before the server is started.
+  void EnableAdmissionControl(const AdmissionOptions& opts) {
+    admission_ = std::make_shared<AdmissionController>(opts);
+  }
+
+  // Keep up to `capacity` Reset() decoders of the finished batch
+  // connections for the new ones, see BatchDecoderPool. The pool is filled
+  // at once if `prefill`. Call it before the server is started.
+  void EnableBatchDecoderPool(int capacity, bool prefill = true) {
+    batch_decoder_pool_ = std::make_shared<BatchDecoderPool>(
+        feature_config_, decode_config_, resources_, capacity);
+    if (prefill) batch_decoder_pool_->Prefill();
+  }
 
   void Start(bool run_batch = false);
+  // Batch the utterances of all the batch connections by length in the
+  // server, instead of decoding the batch of each connection as it is.
+  void EnableBatchScheduler(const BatchSchedulerOptions& opts) {
+    batch_scheduler_ = std::make_shared<BatchScheduler>(
+        opts, feature_config_, decode_config_, resources_->Get());
+  }
+  // Non-blocking server, the connections are served by `num_io_threads`
+  // I/O threads, and decoded by a pool of `num_decode_threads` threads,
+  // so no thread is created per connection. There is a pool per cpu set,
+  // which shares the threads.
+  void StartAsync(int num_io_threads, int num_decode_threads);
+  // Serve many streams over each connection of StartAsync, see
+  // MuxConnectionHandler for the protocol. Call it before the server is
+  // started.
+  void EnableMultiplexing() { multiplexed_ = true; }
+  // Listen with SO_REUSEPORT, so the workers of the pre-fork server listen
+  // on the same port, and the kernel spreads the connections over them.
+  // Call it before the server is started.
+  void set_reuse_port(bool reuse_port) { reuse_port_ = reuse_port; }
+  // The new connections decode with the current resource of it, which can
+  // be updated while the server is running.
+  std::shared_ptr<ResourceRegistry> resources() const { return resources_; }
 
  private:
+  // The acceptor listening on port_
+  std::unique_ptr<tcp::acceptor> Listen();
+  void DoAccept();
+  // The cpu set and the replica of the next connection
+  size_t NextPlacement() { return num_connections_++; }
+
   int port_;
   // The io_context is required for all I/O
-  asio::io_context ioc_{1};
+  asio::io_context ioc_;
+  std::unique_ptr<tcp::acceptor> acceptor_ = nullptr;
+  // One per cpu set, or one unpinned pool
+  std::vector<std::shared_ptr<ThreadPool>> decode_pools_;
+  std::vector<std::vector<int>> cpu_sets_;
+  size_t num_connections_ = 0;
+  bool multiplexed_ = false;
+  bool reuse_port_ = false;
+  std::shared_ptr<BatchScheduler> batch_scheduler_ = nullptr;
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
-  std::shared_ptr<DecodeResource> decode_resource_;
+  std::shared_ptr<ResourceRegistry> resources_;
+  std::shared_ptr<SessionPool> session_pool_;
+  std::shared_ptr<BatchDecoderPool> batch_decoder_pool_;
+  std::shared_ptr<AdmissionController> admission_ =
+      std::make_shared<AdmissionController>(AdmissionOptions());
   WENET_DISALLOW_COPY_AND_ASSIGN(WebSocketServer);
 };
 
@@ -28,6 +28,13 @@ if __name__ == "__main__":
                         help="onnx model path")
     parser.add_argument('--lm_path', default=None, type=str, required=False,
                         help="the additional language model path")
+    parser.add_argument('--native_backend', action='store_true',
+                        help="serve feature_extractor and scoring by the "
+                             "wenet backend of triton_backend/")
+    parser.add_argument('--fst_path', default="", type=str, required=False,
+                        help="TLG.fst for the scoring of the wenet backend")
+    parser.add_argument('--dict_path', default="", type=str, required=False,
+                        help="words.txt of TLG.fst")
     args = parser.parse_args()
     with open(args.config, 'r') as fin:
         configs = yaml.load(fin, Loader=yaml.FullLoader)
@@ -38,7 +45,7 @@ if __name__ == "__main__":
     params = [("#beam_size", 10), ("#num_mel_bins", 80), ("#frame_shift", 10),
               ("#frame_length", 25), ("#sample_rate", 16000), ("#output_size", 256),
               ("#lm_path", ""), ("#bidecoder", 0), ("#vocabulary_path", ""),
-              ("#DTYPE", "FP32")]
+              ("#DTYPE", "FP32"), ("#fst_path", ""), ("#dict_path", "")]
     model_params = dict(params)
     # fill values
     model_params["#beam_size"] = onnx_configs["beam_size"]
@@ -57,6 +64,8 @@ if __name__ == "__main__":
         model_params["#bidecoder"] = 1
     model_params["#vocabulary_path"] = args.vocab
     model_params["#vocab_size"] = configs["output_dim"]
+    model_params["#fst_path"] = args.fst_path
+    model_params["#dict_path"] = args.dict_path
 
     streaming = "decoding_window" in onnx_configs
     if streaming:
@@ -86,6 +95,10 @@ if __name__ == "__main__":
         # streaming transformer encoder
         if "encoder" == model and model_params.get("#cnn_module_cache", -1) == 0:
             template = "config_template2.pbtxt"
+        native_template = os.path.join(args.model_repo, model,
+                                       "config_template_native.pbtxt")
+        if args.native_backend and os.path.exists(native_template):
+            template = "config_template_native.pbtxt"
 
         model_dir = os.path.join(args.model_repo, model)
         out = os.path.join(model_dir, "config.pbtxt")
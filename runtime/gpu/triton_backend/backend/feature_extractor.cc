@@ -0,0 +1,128 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "backend/feature_extractor.h"
+
+#include <algorithm>
+#include <string>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+FeatureExtractor::FeatureExtractor(TritonJson::Value& config, int device_id)
+    : num_bins_(GetIntParameter(config, "num_mel_bins", 80)),
+      fbank_(num_bins_, GetIntParameter(config, "sample_rate", 16000),
+             std::stof(GetStringParameter(config, "frame_shift_in_ms", "10")),
+             std::stof(GetStringParameter(config, "frame_length_in_ms", "25")),
+             device_id) {
+  std::vector<int64_t> dims;
+  TRITONSERVER_Error* err =
+      GetIOConfig(config, "output", "speech", &speech_dtype_, &dims);
+  if (err != nullptr) {
+    LOG(WARNING) << TRITONSERVER_ErrorMessage(err) << ", use FP32";
+    TRITONSERVER_ErrorDelete(err);
+    speech_dtype_ = TRITONSERVER_TYPE_FP32;
+  }
+}
+
+void FeatureExtractor::Execute(
+    const std::vector<TRITONBACKEND_Request*>& requests,
+    const std::vector<TRITONBACKEND_Response*>& responses,
+    std::vector<TRITONSERVER_Error*>* errors) {
+  // The wavs of all the requests, and the batch size and the padded number
+  // of samples of each request
+  std::vector<std::vector<float>> wavs;
+  std::vector<int> batch_sizes(requests.size(), 0);
+  std::vector<int> max_samples(requests.size(), 0);
+  for (size_t r = 0; r < requests.size(); ++r) {
+    if ((*errors)[r] != nullptr) continue;
+    HostTensor wav, wav_lens;
+    TRITONSERVER_Error* err = ReadInput(requests[r], "wav", &wav);
+    if (err == nullptr) err = ReadInput(requests[r], "wav_lens", &wav_lens);
+    if (err == nullptr && wav.shape.size() != 2) {
+      err = TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG,
+                                  "wav should be [batch, samples]");
+    }
+    if (err != nullptr) {
+      (*errors)[r] = err;
+      continue;
+    }
+    int batch_size = wav.shape[0];
+    int num_samples = wav.shape[1];
+    const float* samples = wav.data_as<float>();
+    const int32_t* lens = wav_lens.data_as<int32_t>();
+    for (int i = 0; i < batch_size; ++i) {
+      int len = std::min(static_cast<int>(lens[i]), num_samples);
+      const float* begin = samples + i * num_samples;
+      // The fbank is of 16 bits samples
+      std::vector<float> data(begin, begin + len);
+      for (float& x : data) x *= (1 << 15);
+      wavs.emplace_back(std::move(data));
+    }
+    batch_sizes[r] = batch_size;
+    max_samples[r] = num_samples;
+  }
+  if (wavs.empty()) return;
+
+  torch::NoGradGuard no_grad;
+  std::vector<torch::Tensor> feats;
+  std::vector<int> num_frames;
+  try {
+    feats = fbank_.Compute(wavs, &num_frames);
+  } catch (const std::exception& e) {
+    for (size_t r = 0; r < requests.size(); ++r) {
+      if ((*errors)[r] == nullptr) {
+        (*errors)[r] =
+            TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INTERNAL, e.what());
+      }
+    }
+    return;
+  }
+
+  torch::ScalarType type =
+      speech_dtype_ == TRITONSERVER_TYPE_FP16 ? torch::kHalf : torch::kFloat;
+  int index = 0;
+  for (size_t r = 0; r < requests.size(); ++r) {
+    if ((*errors)[r] != nullptr) continue;
+    int batch_size = batch_sizes[r];
+    // All the utterances of a request are padded to the frames of the
+    // padded wav
+    int max_frames = fbank_.NumFrames(max_samples[r]);
+    torch::Tensor speech =
+        torch::zeros({batch_size, max_frames, num_bins_},
+                     torch::dtype(type).device(fbank_.device()));
+    std::vector<int32_t> speech_lengths(batch_size);
+    for (int i = 0; i < batch_size; ++i) {
+      const torch::Tensor& feat = feats[index++];
+      int frames = std::min(static_cast<int>(feat.size(0)), max_frames);
+      speech[i].narrow(0, 0, frames).copy_(feat.narrow(0, 0, frames));
+      speech_lengths[i] = frames;
+    }
+    speech = speech.cpu().contiguous();
+    TRITONSERVER_Error* err =
+        WriteOutput(responses[r], "speech", speech_dtype_,
+                    {batch_size, max_frames, num_bins_}, speech.data_ptr(),
+                    speech.nbytes());
+    if (err == nullptr) {
+      err = WriteOutput(responses[r], "speech_lengths", TRITONSERVER_TYPE_INT32,
+                        {batch_size, 1}, speech_lengths.data(),
+                        speech_lengths.size() * sizeof(int32_t));
+    }
+    (*errors)[r] = err;
+  }
+}
+
+}  // namespace wenet
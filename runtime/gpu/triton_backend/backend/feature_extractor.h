@@ -0,0 +1,51 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BACKEND_FEATURE_EXTRACTOR_H_
+#define BACKEND_FEATURE_EXTRACTOR_H_
+
+#include <vector>
+
+#include "backend/stage.h"
+#include "backend/triton_utils.h"
+#include "frontend/fbank_cuda.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The feature_extractor stage, the fbank of the wavs of all the requests is
+// computed by FbankCuda in one call.
+// inputs: wav [B, T] FP32 in [-1, 1], wav_lens [B, 1] INT32
+// outputs: speech [B, F, num_mel_bins] FP16 or FP32, speech_lengths [B, 1]
+class FeatureExtractor : public Stage {
+ public:
+  FeatureExtractor(TritonJson::Value& config, int device_id);
+
+  void Execute(const std::vector<TRITONBACKEND_Request*>& requests,
+               const std::vector<TRITONBACKEND_Response*>& responses,
+               std::vector<TRITONSERVER_Error*>* errors) override;
+
+ private:
+  int num_bins_;
+  TRITONSERVER_DataType speech_dtype_ = TRITONSERVER_TYPE_FP32;
+  FbankCuda fbank_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(FeatureExtractor);
+};
+
+}  // namespace wenet
+
+#endif  // BACKEND_FEATURE_EXTRACTOR_H_
@@ -0,0 +1,124 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "backend/rescorer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+Rescorer::Rescorer(TritonJson::Value& config, TRITONSERVER_Server* server,
+                   int beam_size, int sos_eos, TRITONSERVER_DataType dtype)
+    : beam_size_(beam_size), sos_(sos_eos), eos_(sos_eos), dtype_(dtype) {
+  bidecoder_ = GetIntParameter(config, "bidecoder", 0) != 0;
+  TRITONSERVER_Error* err = ServerModel::Create(
+      server, GetStringParameter(config, "decoder_model", "decoder"),
+      &decoder_);
+  CHECK(err == nullptr) << TRITONSERVER_ErrorMessage(err);
+}
+
+TRITONSERVER_Error* Rescorer::Rescore(TRITONSERVER_DataType encoder_dtype,
+                                      int dim,
+                                      const std::vector<Utterance>& utterances,
+                                      std::vector<int64_t>* best_index) {
+  const int num_utterances = utterances.size();
+  // 1. The encoder outputs padded to the longest one
+  const size_t frame_size = dim * TRITONSERVER_DataTypeByteSize(encoder_dtype);
+  int64_t max_frames = 0;
+  for (const auto& utterance : utterances) {
+    max_frames = std::max<int64_t>(max_frames, utterance.num_frames);
+  }
+  std::vector<char> encoder_out(num_utterances * max_frames * frame_size, 0);
+  std::vector<int32_t> encoder_lens(num_utterances);
+  for (int i = 0; i < num_utterances; ++i) {
+    memcpy(encoder_out.data() + i * max_frames * frame_size,
+           utterances[i].encoder_out, utterances[i].num_frames * frame_size);
+    encoder_lens[i] = utterances[i].num_frames;
+  }
+
+  // 2. The hyps with sos and eos padded by eos, the nbest less than the
+  // beam is padded by empty hyps which are never the best
+  int max_hyp_len = 0;
+  for (const auto& utterance : utterances) {
+    for (const auto& hyp : *utterance.hyps) {
+      max_hyp_len = std::max(max_hyp_len, static_cast<int>(hyp.size()));
+    }
+  }
+  const int hyps_len = max_hyp_len + 2;
+  const int num_hyps = num_utterances * beam_size_;
+  std::vector<int64_t> hyps_pad(num_hyps * hyps_len, eos_);
+  std::vector<int64_t> r_hyps_pad(bidecoder_ ? num_hyps * hyps_len : 0, eos_);
+  std::vector<int32_t> hyps_lens(num_hyps, 1);
+  std::vector<float> ctc_scores(num_hyps,
+                                -std::numeric_limits<float>::infinity());
+  for (int i = 0; i < num_utterances; ++i) {
+    const auto& hyps = *utterances[i].hyps;
+    int nbest = std::min(static_cast<int>(hyps.size()), beam_size_);
+    for (int j = 0; j < beam_size_; ++j) {
+      int k = i * beam_size_ + j;
+      hyps_pad[k * hyps_len] = sos_;
+      if (bidecoder_) r_hyps_pad[k * hyps_len] = sos_;
+      if (j >= nbest) continue;
+      const std::vector<int>& hyp = hyps[j];
+      std::copy(hyp.begin(), hyp.end(), hyps_pad.begin() + k * hyps_len + 1);
+      if (bidecoder_) {
+        std::copy(hyp.rbegin(), hyp.rend(),
+                  r_hyps_pad.begin() + k * hyps_len + 1);
+      }
+      hyps_lens[k] = hyp.size() + 1;
+      ctc_scores[k] = (*utterances[i].scores)[j];
+    }
+  }
+  std::vector<char> ctc_score;
+  FromFloat(dtype_, ctc_scores.data(), ctc_scores.size(), &ctc_score);
+
+  const int64_t n = num_utterances;
+  std::vector<ServerModel::Input> inputs = {
+      {"encoder_out", encoder_dtype, {n, max_frames, dim},
+       encoder_out.data(), encoder_out.size()},
+      {"encoder_out_lens", TRITONSERVER_TYPE_INT32, {n, 1},
+       encoder_lens.data(), encoder_lens.size() * sizeof(int32_t)},
+      {"hyps_pad_sos_eos", TRITONSERVER_TYPE_INT64, {n, beam_size_, hyps_len},
+       hyps_pad.data(), hyps_pad.size() * sizeof(int64_t)},
+      {"hyps_lens_sos", TRITONSERVER_TYPE_INT32, {n, beam_size_},
+       hyps_lens.data(), hyps_lens.size() * sizeof(int32_t)},
+      {"ctc_score", dtype_, {n, beam_size_}, ctc_score.data(),
+       ctc_score.size()}};
+  if (bidecoder_) {
+    inputs.push_back({"r_hyps_pad_sos_eos", TRITONSERVER_TYPE_INT64,
+                      {n, beam_size_, hyps_len}, r_hyps_pad.data(),
+                      r_hyps_pad.size() * sizeof(int64_t)});
+  }
+  std::vector<HostTensor> outputs;
+  RETURN_IF_ERROR(decoder_->Infer(inputs, {"best_index"}, &outputs));
+  const HostTensor& best = outputs[0];
+  if (best.data.size() != num_utterances * sizeof(int64_t)) {
+    return TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INTERNAL,
+                                 "unexpected best_index of the decoder");
+  }
+  best_index->resize(num_utterances);
+  for (int i = 0; i < num_utterances; ++i) {
+    int nbest = utterances[i].hyps->size();
+    (*best_index)[i] = std::max<int64_t>(
+        0, std::min<int64_t>(best.data_as<int64_t>()[i], nbest - 1));
+  }
+  return nullptr;
+}
+
+}  // namespace wenet
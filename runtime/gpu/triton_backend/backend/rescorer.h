@@ -0,0 +1,69 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BACKEND_RESCORER_H_
+#define BACKEND_RESCORER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "backend/triton_utils.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The attention rescoring by the decoder model of the server. The encoder
+// outputs and the nbest of all the utterances are padded into one request
+// of the decoder, so a batch is rescored by one call.
+class Rescorer {
+ public:
+  // The nbest of an utterance, the hyps of it are less than or equal to the
+  // beam
+  struct Utterance {
+    // [num_frames, dim] of the dtype of the encoder outputs
+    const char* encoder_out;
+    int num_frames;
+    const std::vector<std::vector<int>>* hyps;
+    const std::vector<float>* scores;
+  };
+
+  // The parameters of the model config:
+  //   bidecoder: 1 if the decoder has a right to left decoder
+  //   decoder_model: the name of the decoder model, "decoder" by default
+  // `dtype` is the one of the ctc_score of the decoder
+  Rescorer(TritonJson::Value& config, TRITONSERVER_Server* server,
+           int beam_size, int sos_eos, TRITONSERVER_DataType dtype);
+
+  // The index of the best hyp of each utterance
+  TRITONSERVER_Error* Rescore(TRITONSERVER_DataType encoder_dtype, int dim,
+                              const std::vector<Utterance>& utterances,
+                              std::vector<int64_t>* best_index);
+
+ private:
+  int beam_size_;
+  int sos_;
+  int eos_;
+  bool bidecoder_ = false;
+  TRITONSERVER_DataType dtype_;
+  std::unique_ptr<ServerModel> decoder_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Rescorer);
+};
+
+}  // namespace wenet
+
+#endif  // BACKEND_RESCORER_H_
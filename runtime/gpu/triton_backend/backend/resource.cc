@@ -0,0 +1,139 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "backend/resource.h"
+
+#include <utility>
+
+#include "decoder/ctc_prefix_beam_search.h"
+#include "decoder/ctc_wfst_beam_search.h"
+#include "utils/fst_io.h"
+#include "utils/log.h"
+
+namespace wenet {
+
+std::shared_ptr<DecodeResource> ReadDecodeResource(
+    TritonJson::Value& config) {
+  auto resource = std::make_shared<DecodeResource>();
+  std::string unit_path = GetStringParameter(config, "vocabulary");
+  LOG(INFO) << "Reading unit table " << unit_path;
+  resource->unit_table = std::shared_ptr<fst::SymbolTable>(
+      fst::SymbolTable::ReadText(unit_path));
+  CHECK(resource->unit_table != nullptr);
+
+  std::string fst_path = GetStringParameter(config, "fst_path");
+  if (!fst_path.empty()) {  // With LM
+    std::string dict_path = GetStringParameter(config, "dict_path");
+    CHECK(!dict_path.empty());
+    LOG(INFO) << "Reading fst " << fst_path;
+    resource->fst = ReadFst(fst_path);
+    CHECK(resource->fst != nullptr);
+    LOG(INFO) << "Reading symbol table " << dict_path;
+    resource->symbol_table = std::shared_ptr<fst::SymbolTable>(
+        fst::SymbolTable::ReadText(dict_path));
+    CHECK(resource->symbol_table != nullptr);
+  } else {  // Without LM, symbol_table is the same as unit_table
+    resource->symbol_table = resource->unit_table;
+  }
+
+  PostProcessOptions post_process_opts;
+  post_process_opts.language_type =
+      GetIntParameter(config, "language_type", 0) == 0 ? kMandarinEnglish
+                                                       : kIndoEuropean;
+  post_process_opts.lowercase = GetIntParameter(config, "lowercase", 1) != 0;
+  resource->post_processor =
+      std::make_shared<PostProcessor>(std::move(post_process_opts));
+  resource->thread_pool =
+      std::make_shared<ThreadPool>(GetIntParameter(config, "num_threads", 4));
+  return resource;
+}
+
+DecodeOptions ReadDecodeOptions(TritonJson::Value& config, int beam_size) {
+  DecodeOptions opts;
+  opts.ctc_prefix_search_opts.blank = GetIntParameter(config, "blank_id", 0);
+  opts.ctc_prefix_search_opts.first_beam_size = beam_size;
+  opts.ctc_prefix_search_opts.second_beam_size = beam_size;
+  opts.ctc_wfst_search_opts.nbest = beam_size;
+  return opts;
+}
+
+std::unique_ptr<SearchInterface> CreateSearcher(const DecodeResource& resource,
+                                                const DecodeOptions& opts) {
+  if (resource.fst == nullptr) {
+    return std::unique_ptr<SearchInterface>(
+        new CtcPrefixBeamSearch(opts.ctc_prefix_search_opts));
+  }
+  return std::unique_ptr<SearchInterface>(new CtcWfstBeamSearch(
+      *resource.fst, opts.ctc_wfst_search_opts, nullptr));
+}
+
+std::unique_ptr<SearchInterface> SearcherPool::Acquire() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_searchers_.empty()) {
+      std::unique_ptr<SearchInterface> searcher =
+          std::move(free_searchers_.back());
+      free_searchers_.pop_back();
+      return searcher;
+    }
+  }
+  return CreateSearcher(*resource_, opts_);
+}
+
+void SearcherPool::Release(std::unique_ptr<SearchInterface> searcher) {
+  searcher->Reset();
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_searchers_.push_back(std::move(searcher));
+}
+
+void SearchTopK(const std::vector<std::vector<float>>& topk_scores,
+                const std::vector<std::vector<int32_t>>& topk_indexs,
+                int vocab_size, SearchInterface* searcher) {
+  if (searcher->Type() == kPrefixBeamSearch) {
+    searcher->Search(topk_scores, topk_indexs);
+    return;
+  }
+  const float kFloorScore = -1e10;
+  std::vector<std::vector<float>> logp(topk_scores.size());
+  for (size_t t = 0; t < topk_scores.size(); ++t) {
+    logp[t].assign(vocab_size, kFloorScore);
+    for (size_t i = 0; i < topk_scores[t].size(); ++i) {
+      logp[t][topk_indexs[t][i]] = topk_scores[t][i];
+    }
+  }
+  searcher->Search(logp);
+}
+
+std::string Sentence(const DecodeResource& resource,
+                     const std::vector<int>& outputs, SearchType search_type,
+                     bool finish) {
+  std::string sentence;
+  for (int id : outputs) {
+    std::string word = resource.symbol_table->Find(id);
+    // A detailed explanation of this if-else branch can be found in
+    // https://github.com/wenet-e2e/wenet/issues/583#issuecomment-907994058
+    if (search_type == kWfstBeamSearch) {
+      sentence += (' ' + word);
+    } else {
+      sentence += word;
+    }
+  }
+  if (resource.post_processor != nullptr) {
+    sentence = resource.post_processor->Process(sentence, finish);
+  }
+  return sentence;
+}
+
+}  // namespace wenet
@@ -0,0 +1,88 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BACKEND_RESOURCE_H_
+#define BACKEND_RESOURCE_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "backend/triton_utils.h"
+#include "decoder/asr_decoder.h"
+#include "decoder/search_interface.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The resource of the search stages, read once per model and shared by its
+// instances. The parameters of the model config:
+//   vocabulary: the units.txt of the model, required
+//   fst_path, dict_path: the decoding graph (TLG.fst) and its words.txt,
+//     CtcWfstBeamSearch is used if they are given
+//   language_type: 0 for mandarin and english, 1 for indo-european
+//   lowercase: 1 to lowercase the letters of the results
+//   num_threads: the workers of the searches of a batch
+// The model isn't set, the nets are served by other models of the server.
+std::shared_ptr<DecodeResource> ReadDecodeResource(TritonJson::Value& config);
+
+// The search options of the config of the model, with the beam of the topk
+// log probs of the encoder
+DecodeOptions ReadDecodeOptions(TritonJson::Value& config, int beam_size);
+
+std::unique_ptr<SearchInterface> CreateSearcher(const DecodeResource& resource,
+                                                const DecodeOptions& opts);
+
+// Searchers are expensive to create (especially the WFST one), so they are
+// kept in a free list and reused by the search workers.
+class SearcherPool {
+ public:
+  SearcherPool(std::shared_ptr<DecodeResource> resource,
+               const DecodeOptions& opts)
+      : resource_(std::move(resource)), opts_(opts) {}
+
+  std::unique_ptr<SearchInterface> Acquire();
+  // The searcher is reset
+  void Release(std::unique_ptr<SearchInterface> searcher);
+
+ private:
+  std::shared_ptr<DecodeResource> resource_;
+  DecodeOptions opts_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<SearchInterface>> free_searchers_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(SearcherPool);
+};
+
+// Search the topk log probs of the frames. CtcWfstBeamSearch takes the log
+// probs of all the units of each frame, the ones out of the topk get a floor
+// score, so it's close to the search of the full log probs as long as the
+// topk covers the mass of the frame.
+void SearchTopK(const std::vector<std::vector<float>>& topk_scores,
+                const std::vector<std::vector<int32_t>>& topk_indexs,
+                int vocab_size, SearchInterface* searcher);
+
+// The sentence of the output ids, post processed if the utterance is
+// finished
+std::string Sentence(const DecodeResource& resource,
+                     const std::vector<int>& outputs, SearchType search_type,
+                     bool finish);
+
+}  // namespace wenet
+
+#endif  // BACKEND_RESOURCE_H_
@@ -0,0 +1,173 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "backend/scorer.h"
+
+#include <algorithm>
+#include <future>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+Scorer::Scorer(TritonJson::Value& config,
+               std::shared_ptr<DecodeResource> resource,
+               TRITONSERVER_Server* server)
+    : resource_(std::move(resource)) {
+  TRITONSERVER_DataType dtype;
+  std::vector<int64_t> dims;
+  TRITONSERVER_Error* err =
+      GetIOConfig(config, "input", "batch_log_probs", &dtype, &dims);
+  CHECK(err == nullptr) << TRITONSERVER_ErrorMessage(err);
+  CHECK(!dims.empty() && dims.back() > 0);
+  beam_size_ = dims.back();
+  vocab_size_ = resource_->unit_table->NumSymbols();
+  searchers_.reset(
+      new SearcherPool(resource_, ReadDecodeOptions(config, beam_size_)));
+  rescorer_.reset(
+      new Rescorer(config, server, beam_size_, vocab_size_ - 1, dtype));
+}
+
+void Scorer::Search(const std::vector<std::vector<float>>& topk_scores,
+                    const std::vector<std::vector<int32_t>>& topk_indexs,
+                    Utterance* utterance) {
+  std::unique_ptr<SearchInterface> searcher = searchers_->Acquire();
+  SearchTopK(topk_scores, topk_indexs, vocab_size_, searcher.get());
+  searcher->FinalizeSearch();
+  utterance->hyps = searcher->Inputs();
+  utterance->scores = searcher->Likelihood();
+  utterance->sentences.clear();
+  for (const auto& outputs : searcher->Outputs()) {
+    utterance->sentences.emplace_back(
+        Sentence(*resource_, outputs, searcher->Type(), true));
+  }
+  // No frame at all, the result is empty
+  if (utterance->hyps.empty()) {
+    utterance->hyps.emplace_back();
+    utterance->scores.push_back(0);
+    utterance->sentences.emplace_back();
+  }
+  searchers_->Release(std::move(searcher));
+}
+
+void Scorer::Execute(const std::vector<TRITONBACKEND_Request*>& requests,
+                     const std::vector<TRITONBACKEND_Response*>& responses,
+                     std::vector<TRITONSERVER_Error*>* errors) {
+  // The inputs of the requests, and the topk of all their utterances
+  std::vector<HostTensor> encoder_outs(requests.size());
+  std::vector<int> batch_sizes(requests.size(), 0);
+  std::vector<Rescorer::Utterance> rescore_utterances;
+  std::vector<std::vector<std::vector<float>>> topk_scores;
+  std::vector<std::vector<std::vector<int32_t>>> topk_indexs;
+  for (size_t r = 0; r < requests.size(); ++r) {
+    if ((*errors)[r] != nullptr) continue;
+    HostTensor lens, log_probs, log_probs_idx;
+    TRITONSERVER_Error* err =
+        ReadInput(requests[r], "encoder_out", &encoder_outs[r]);
+    if (err == nullptr) err = ReadInput(requests[r], "encoder_out_lens", &lens);
+    if (err == nullptr) {
+      err = ReadInput(requests[r], "batch_log_probs", &log_probs);
+    }
+    if (err == nullptr) {
+      err = ReadInput(requests[r], "batch_log_probs_idx", &log_probs_idx);
+    }
+    if (err == nullptr &&
+        (encoder_outs[r].shape.size() != 3 || log_probs.shape.size() != 3 ||
+         log_probs.shape[2] != beam_size_ ||
+         log_probs_idx.shape != log_probs.shape)) {
+      err = TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG,
+                                  "unexpected shapes of the inputs");
+    }
+    if (err != nullptr) {
+      (*errors)[r] = err;
+      continue;
+    }
+    const HostTensor& encoder_out = encoder_outs[r];
+    const size_t encoder_frames_size =
+        encoder_out.shape[1] * encoder_out.shape[2] *
+        TRITONSERVER_DataTypeByteSize(encoder_out.dtype);
+    int batch_size = log_probs.shape[0];
+    int max_frames = log_probs.shape[1];
+    std::vector<float> scores(max_frames * beam_size_);
+    const int64_t* indexs = log_probs_idx.data_as<int64_t>();
+    const size_t element_size = TRITONSERVER_DataTypeByteSize(log_probs.dtype);
+    for (int i = 0; i < batch_size; ++i) {
+      int num_frames = std::min(lens.data_as<int32_t>()[i], max_frames);
+      ToFloat(log_probs.dtype,
+              log_probs.data.data() + i * max_frames * beam_size_ *
+                                          element_size,
+              num_frames * beam_size_, scores.data());
+      std::vector<std::vector<float>> utterance_scores(num_frames);
+      std::vector<std::vector<int32_t>> utterance_indexs(num_frames);
+      for (int t = 0; t < num_frames; ++t) {
+        const float* frame_scores = scores.data() + t * beam_size_;
+        const int64_t* frame_indexs =
+            indexs + (i * max_frames + t) * beam_size_;
+        utterance_scores[t].assign(frame_scores, frame_scores + beam_size_);
+        utterance_indexs[t].assign(frame_indexs, frame_indexs + beam_size_);
+      }
+      topk_scores.emplace_back(std::move(utterance_scores));
+      topk_indexs.emplace_back(std::move(utterance_indexs));
+      Rescorer::Utterance utterance;
+      utterance.encoder_out = encoder_out.data.data() + i * encoder_frames_size;
+      utterance.num_frames =
+          std::min<int64_t>(lens.data_as<int32_t>()[i], encoder_out.shape[1]);
+      rescore_utterances.push_back(utterance);
+    }
+    batch_sizes[r] = batch_size;
+  }
+  if (topk_scores.empty()) return;
+
+  // The utterances are searched in parallel
+  std::vector<Utterance> utterances(topk_scores.size());
+  std::vector<std::future<void>> futures;
+  for (size_t i = 0; i < utterances.size(); ++i) {
+    futures.emplace_back(resource_->thread_pool->enqueue(
+        [&, i]() { Search(topk_scores[i], topk_indexs[i], &utterances[i]); }));
+  }
+  for (auto& future : futures) future.get();
+  for (size_t i = 0; i < utterances.size(); ++i) {
+    rescore_utterances[i].hyps = &utterances[i].hyps;
+    rescore_utterances[i].scores = &utterances[i].scores;
+  }
+
+  const HostTensor* encoder_out = nullptr;
+  for (size_t r = 0; r < requests.size() && encoder_out == nullptr; ++r) {
+    if ((*errors)[r] == nullptr) encoder_out = &encoder_outs[r];
+  }
+  std::vector<int64_t> best_index;
+  TRITONSERVER_Error* err =
+      rescorer_->Rescore(encoder_out->dtype, encoder_out->shape[2],
+                         rescore_utterances, &best_index);
+  int index = 0;
+  for (size_t r = 0; r < requests.size(); ++r) {
+    if ((*errors)[r] != nullptr) continue;
+    if (err != nullptr) {
+      (*errors)[r] = TRITONSERVER_ErrorNew(TRITONSERVER_ErrorCode(err),
+                                           TRITONSERVER_ErrorMessage(err));
+      continue;
+    }
+    std::vector<std::string> sentences;
+    for (int i = 0; i < batch_sizes[r]; ++i, ++index) {
+      sentences.emplace_back(utterances[index].sentences[best_index[index]]);
+    }
+    (*errors)[r] = WriteStringOutput(responses[r], "OUTPUT0",
+                                     {batch_sizes[r], 1}, sentences);
+  }
+  if (err != nullptr) TRITONSERVER_ErrorDelete(err);
+}
+
+}  // namespace wenet
@@ -0,0 +1,73 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BACKEND_SCORER_H_
+#define BACKEND_SCORER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "backend/rescorer.h"
+#include "backend/resource.h"
+#include "backend/stage.h"
+#include "backend/triton_utils.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The scoring stage, the topk log probs of the encoder of each utterance
+// are searched by CtcPrefixBeamSearch, or CtcWfstBeamSearch with a decoding
+// graph, on the workers of the resource. Then the hyps of all the requests
+// are rescored by the decoder model of the server in one call, and the best
+// one of each utterance is the result.
+// inputs: encoder_out [B, T, D], encoder_out_lens [B], batch_log_probs
+//   [B, T, beam] FP16 or FP32, batch_log_probs_idx [B, T, beam] INT64
+// outputs: OUTPUT0 [B, 1] STRING
+// The parameters of the model config are the ones of the resource and the
+// Rescorer.
+class Scorer : public Stage {
+ public:
+  Scorer(TritonJson::Value& config, std::shared_ptr<DecodeResource> resource,
+         TRITONSERVER_Server* server);
+
+  void Execute(const std::vector<TRITONBACKEND_Request*>& requests,
+               const std::vector<TRITONBACKEND_Response*>& responses,
+               std::vector<TRITONSERVER_Error*>* errors) override;
+
+ private:
+  // The nbest of an utterance
+  struct Utterance {
+    std::vector<std::vector<int>> hyps;
+    std::vector<float> scores;
+    std::vector<std::string> sentences;
+  };
+  void Search(const std::vector<std::vector<float>>& topk_scores,
+              const std::vector<std::vector<int32_t>>& topk_indexs,
+              Utterance* utterance);
+
+  std::shared_ptr<DecodeResource> resource_;
+  int beam_size_ = 10;
+  int vocab_size_ = 0;
+  std::unique_ptr<SearcherPool> searchers_;
+  std::unique_ptr<Rescorer> rescorer_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Scorer);
+};
+
+}  // namespace wenet
+
+#endif  // BACKEND_SCORER_H_
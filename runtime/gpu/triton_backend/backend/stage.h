@@ -0,0 +1,42 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BACKEND_STAGE_H_
+#define BACKEND_STAGE_H_
+
+#include <vector>
+
+#include "triton/core/tritonbackend.h"
+
+namespace wenet {
+
+// A stage of the Triton ensembles which runs natively in the wenet backend,
+// it's chosen by the "stage" parameter of the model config, see
+// wenet_backend.cc. Execute serves a batch of requests by one call, and
+// writes the outputs of requests[i] to responses[i], or sets errors[i] if
+// the request fails. The requests whose errors are set on the call, e.g.
+// their responses failed to be created, are skipped. The responses are sent
+// and the requests are released by the backend.
+class Stage {
+ public:
+  virtual ~Stage() = default;
+  virtual void Execute(const std::vector<TRITONBACKEND_Request*>& requests,
+                       const std::vector<TRITONBACKEND_Response*>& responses,
+                       std::vector<TRITONSERVER_Error*>* errors) = 0;
+};
+
+}  // namespace wenet
+
+#endif  // BACKEND_STAGE_H_
@@ -0,0 +1,238 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "backend/streaming_scorer.h"
+
+#include <algorithm>
+#include <future>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+StreamingScorer::StreamingScorer(TritonJson::Value& config,
+                                 std::shared_ptr<DecodeResource> resource,
+                                 TRITONSERVER_Server* server)
+    : resource_(std::move(resource)) {
+  TRITONSERVER_DataType dtype;
+  std::vector<int64_t> dims;
+  TRITONSERVER_Error* err =
+      GetIOConfig(config, "input", "log_probs", &dtype, &dims);
+  CHECK(err == nullptr) << TRITONSERVER_ErrorMessage(err);
+  CHECK(!dims.empty() && dims.back() > 0);
+  beam_size_ = dims.back();
+  vocab_size_ = resource_->unit_table->NumSymbols();
+  rescoring_ = GetIntParameter(config, "rescoring", 1) != 0;
+  searchers_.reset(
+      new SearcherPool(resource_, ReadDecodeOptions(config, beam_size_)));
+  if (rescoring_) {
+    rescorer_.reset(
+        new Rescorer(config, server, beam_size_, vocab_size_ - 1, dtype));
+  }
+
+  // The uint64 of the model config is a string in json
+  uint64_t max_idle_us = 1000000;  // The default of the sequence batcher
+  TritonJson::Value batching;
+  if (config.Find("sequence_batching", &batching)) {
+    std::string value;
+    err = batching.MemberAsString("max_sequence_idle_microseconds", &value);
+    if (err != nullptr) {
+      TRITONSERVER_ErrorDelete(err);
+    } else if (!value.empty()) {
+      max_idle_us = std::stoull(value);
+    }
+  }
+  max_idle_ = std::chrono::microseconds(max_idle_us);
+}
+
+TRITONSERVER_Error* StreamingScorer::ReadChunk(TRITONBACKEND_Request* request,
+                                               Chunk* chunk, bool* ready) {
+  HostTensor start, ready_flag, end, corrid;
+  RETURN_IF_ERROR(ReadInput(request, "START", &start));
+  RETURN_IF_ERROR(ReadInput(request, "READY", &ready_flag));
+  RETURN_IF_ERROR(ReadInput(request, "END", &end));
+  RETURN_IF_ERROR(ReadInput(request, "CORRID", &corrid));
+  if (corrid.dtype != TRITONSERVER_TYPE_UINT64) {
+    return TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG,
+                                 "CORRID should be UINT64");
+  }
+  *ready = ready_flag.data_as<float>()[0] != 0;
+  if (!*ready) return nullptr;
+  chunk->corrid = corrid.data_as<uint64_t>()[0];
+  chunk->end = end.data_as<float>()[0] != 0;
+
+  HostTensor log_probs, log_probs_idx, chunk_out, chunk_out_lens;
+  RETURN_IF_ERROR(ReadInput(request, "log_probs", &log_probs));
+  RETURN_IF_ERROR(ReadInput(request, "log_probs_idx", &log_probs_idx));
+  RETURN_IF_ERROR(ReadInput(request, "chunk_out_lens", &chunk_out_lens));
+  if (rescoring_) RETURN_IF_ERROR(ReadInput(request, "chunk_out", &chunk_out));
+  if (log_probs.shape.size() != 3 || log_probs.shape[2] != beam_size_ ||
+      log_probs_idx.shape != log_probs.shape ||
+      (rescoring_ && chunk_out.shape.size() != 3)) {
+    return TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG,
+                                 "unexpected shapes of the inputs");
+  }
+
+  if (start.data_as<float>()[0] != 0) {
+    std::unique_ptr<Sequence>& sequence = sequences_[chunk->corrid];
+    if (sequence != nullptr) searchers_->Release(std::move(sequence->searcher));
+    sequence.reset(new Sequence);
+    sequence->searcher = searchers_->Acquire();
+  }
+  auto it = sequences_.find(chunk->corrid);
+  if (it == sequences_.end()) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INVALID_ARG,
+        ("unknown sequence " + std::to_string(chunk->corrid)).c_str());
+  }
+  Sequence* sequence = it->second.get();
+  sequence->last_active = std::chrono::steady_clock::now();
+  chunk->sequence = sequence;
+
+  int max_frames = log_probs.shape[1];
+  int num_frames = std::min(chunk_out_lens.data_as<int32_t>()[0], max_frames);
+  std::vector<float> scores(num_frames * beam_size_);
+  ToFloat(log_probs.dtype, log_probs.data.data(), scores.size(),
+          scores.data());
+  const int64_t* indexs = log_probs_idx.data_as<int64_t>();
+  chunk->topk_scores.resize(num_frames);
+  chunk->topk_indexs.resize(num_frames);
+  for (int t = 0; t < num_frames; ++t) {
+    chunk->topk_scores[t].assign(scores.begin() + t * beam_size_,
+                                 scores.begin() + (t + 1) * beam_size_);
+    chunk->topk_indexs[t].assign(indexs + t * beam_size_,
+                                 indexs + (t + 1) * beam_size_);
+  }
+
+  if (rescoring_) {
+    // Only the valid frames of the chunk are kept
+    int encoder_frames = std::min<int64_t>(
+        chunk_out_lens.data_as<int32_t>()[0], chunk_out.shape[1]);
+    sequence->encoder_dtype = chunk_out.dtype;
+    sequence->encoder_dim = chunk_out.shape[2];
+    size_t size = encoder_frames * chunk_out.shape[2] *
+                  TRITONSERVER_DataTypeByteSize(chunk_out.dtype);
+    sequence->encoder_out.insert(sequence->encoder_out.end(),
+                                 chunk_out.data.begin(),
+                                 chunk_out.data.begin() + size);
+    sequence->num_frames += encoder_frames;
+  }
+  return nullptr;
+}
+
+void StreamingScorer::Search(Chunk* chunk) {
+  SearchInterface* searcher = chunk->sequence->searcher.get();
+  SearchTopK(chunk->topk_scores, chunk->topk_indexs, vocab_size_, searcher);
+  if (chunk->end) {
+    searcher->FinalizeSearch();
+  } else if (!searcher->Outputs().empty()) {
+    chunk->sentence = Sentence(*resource_, searcher->Outputs()[0],
+                               searcher->Type(), false);
+  }
+}
+
+void StreamingScorer::DropIdleSequences() {
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = sequences_.begin(); it != sequences_.end();) {
+    if (now - it->second->last_active > max_idle_) {
+      VLOG(1) << "Drop the idle sequence " << it->first;
+      searchers_->Release(std::move(it->second->searcher));
+      it = sequences_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void StreamingScorer::Execute(
+    const std::vector<TRITONBACKEND_Request*>& requests,
+    const std::vector<TRITONBACKEND_Response*>& responses,
+    std::vector<TRITONSERVER_Error*>* errors) {
+  DropIdleSequences();
+  std::vector<Chunk> chunks;
+  chunks.reserve(requests.size());
+  for (size_t r = 0; r < requests.size(); ++r) {
+    if ((*errors)[r] != nullptr) continue;
+    Chunk chunk;
+    chunk.request = r;
+    bool ready = false;
+    (*errors)[r] = ReadChunk(requests[r], &chunk, &ready);
+    if ((*errors)[r] != nullptr) continue;
+    if (ready) {
+      chunks.emplace_back(std::move(chunk));
+    } else {
+      (*errors)[r] = WriteStringOutput(responses[r], "OUTPUT0", {1}, {""});
+    }
+  }
+  if (chunks.empty()) return;
+
+  // The chunks are of different sequences, so they are searched in parallel
+  std::vector<std::future<void>> futures;
+  for (Chunk& chunk : chunks) {
+    futures.emplace_back(
+        resource_->thread_pool->enqueue([this, &chunk]() { Search(&chunk); }));
+  }
+  for (auto& future : futures) future.get();
+
+  // The final results of the ended sequences
+  std::vector<Chunk*> ended;
+  for (Chunk& chunk : chunks) {
+    if (chunk.end) ended.push_back(&chunk);
+  }
+  std::vector<int64_t> best_index(ended.size(), 0);
+  TRITONSERVER_Error* err = nullptr;
+  if (rescoring_ && !ended.empty()) {
+    std::vector<Rescorer::Utterance> utterances;
+    for (Chunk* chunk : ended) {
+      const Sequence* sequence = chunk->sequence;
+      Rescorer::Utterance utterance;
+      utterance.encoder_out = sequence->encoder_out.data();
+      utterance.num_frames = sequence->num_frames;
+      utterance.hyps = &sequence->searcher->Inputs();
+      utterance.scores = &sequence->searcher->Likelihood();
+      utterances.push_back(utterance);
+    }
+    const Sequence* sequence = ended[0]->sequence;
+    err = rescorer_->Rescore(sequence->encoder_dtype, sequence->encoder_dim,
+                             utterances, &best_index);
+  }
+  for (size_t i = 0; i < ended.size(); ++i) {
+    Chunk* chunk = ended[i];
+    if (err != nullptr) {
+      (*errors)[chunk->request] = TRITONSERVER_ErrorNew(
+          TRITONSERVER_ErrorCode(err), TRITONSERVER_ErrorMessage(err));
+    } else {
+      SearchInterface* searcher = chunk->sequence->searcher.get();
+      if (!searcher->Outputs().empty()) {
+        chunk->sentence = Sentence(*resource_,
+                                   searcher->Outputs()[best_index[i]],
+                                   searcher->Type(), true);
+      }
+    }
+    auto it = sequences_.find(chunk->corrid);
+    searchers_->Release(std::move(it->second->searcher));
+    sequences_.erase(it);
+  }
+  if (err != nullptr) TRITONSERVER_ErrorDelete(err);
+
+  for (Chunk& chunk : chunks) {
+    if ((*errors)[chunk.request] != nullptr) continue;
+    (*errors)[chunk.request] = WriteStringOutput(
+        responses[chunk.request], "OUTPUT0", {1}, {chunk.sentence});
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,103 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BACKEND_STREAMING_SCORER_H_
+#define BACKEND_STREAMING_SCORER_H_
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "backend/rescorer.h"
+#include "backend/resource.h"
+#include "backend/stage.h"
+#include "backend/triton_utils.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// The streaming scoring stage of model_repo_stateful, it replaces the python
+// "wenet" model. The sequence batcher sends a chunk of each of the sequences
+// in a batch, and routes all the chunks of a sequence to the same instance.
+// The caches of the encoder are the implicit states of the encoder model,
+// while the searcher and the encoder outputs of each sequence are kept here
+// keyed by its correlation id, since the prefix trie of the search isn't a
+// tensor. The chunks of a batch are searched in parallel, and the ended
+// sequences of the batch are rescored by one call of the decoder.
+// inputs: log_probs [1, T, beam] FP16 or FP32, log_probs_idx [1, T, beam]
+//   INT64, chunk_out [1, T, D], chunk_out_lens [1, 1] INT32, and the
+//   controls START, READY, END [1, 1] FP32, CORRID [1, 1] UINT64
+// outputs: OUTPUT0 [1] STRING, the partial result of the sequence, or the
+//   final one on END
+// The parameters of the model config besides the ones of the resource and
+// the Rescorer:
+//   rescoring: 1 to rescore the final results by the decoder
+// The sequences idle longer than max_sequence_idle_microseconds of the
+// sequence batcher are dropped, as the batcher has released them.
+class StreamingScorer : public Stage {
+ public:
+  StreamingScorer(TritonJson::Value& config,
+                  std::shared_ptr<DecodeResource> resource,
+                  TRITONSERVER_Server* server);
+
+  void Execute(const std::vector<TRITONBACKEND_Request*>& requests,
+               const std::vector<TRITONBACKEND_Response*>& responses,
+               std::vector<TRITONSERVER_Error*>* errors) override;
+
+ private:
+  struct Sequence {
+    std::unique_ptr<SearchInterface> searcher;
+    // The encoder outputs of all the chunks, [num_frames, dim]
+    std::vector<char> encoder_out;
+    TRITONSERVER_DataType encoder_dtype = TRITONSERVER_TYPE_FP32;
+    int encoder_dim = 0;
+    int num_frames = 0;
+    std::chrono::steady_clock::time_point last_active;
+  };
+  // The chunk of a sequence in the batch
+  struct Chunk {
+    size_t request;
+    uint64_t corrid;
+    Sequence* sequence;
+    bool end;
+    std::vector<std::vector<float>> topk_scores;
+    std::vector<std::vector<int32_t>> topk_indexs;
+    std::string sentence;
+  };
+  // Read the inputs of the request to the chunk, and get the sequence of it
+  TRITONSERVER_Error* ReadChunk(TRITONBACKEND_Request* request, Chunk* chunk,
+                                bool* ready);
+  void Search(Chunk* chunk);
+  void DropIdleSequences();
+
+  std::shared_ptr<DecodeResource> resource_;
+  int beam_size_ = 10;
+  int vocab_size_ = 0;
+  bool rescoring_ = true;
+  std::chrono::microseconds max_idle_;
+  std::unique_ptr<SearcherPool> searchers_;
+  std::unique_ptr<Rescorer> rescorer_;
+  // Only accessed by the Execute of the instance
+  std::unordered_map<uint64_t, std::unique_ptr<Sequence>> sequences_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(StreamingScorer);
+};
+
+}  // namespace wenet
+
+#endif  // BACKEND_STREAMING_SCORER_H_
@@ -0,0 +1,295 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "backend/triton_utils.h"
+
+#include <cstring>
+#include <future>
+#include <utility>
+
+#include "c10/util/Half.h"
+#include "cuda_runtime_api.h"
+
+namespace wenet {
+
+TRITONSERVER_Error* ReadInput(TRITONBACKEND_Request* request,
+                              const char* name, HostTensor* tensor) {
+  TRITONBACKEND_Input* input = nullptr;
+  RETURN_IF_ERROR(TRITONBACKEND_RequestInput(request, name, &input));
+  const int64_t* shape = nullptr;
+  uint32_t dims_count = 0;
+  uint64_t byte_size = 0;
+  RETURN_IF_ERROR(TRITONBACKEND_InputProperties(input, nullptr,
+                                                &tensor->dtype, &shape,
+                                                &dims_count, &byte_size,
+                                                nullptr));
+  tensor->shape.assign(shape, shape + dims_count);
+  tensor->data.resize(byte_size);
+  size_t size = byte_size;
+  RETURN_IF_ERROR(triton::backend::ReadInputTensor(
+      request, name, tensor->data.data(), &size));
+  return nullptr;
+}
+
+TRITONSERVER_Error* WriteOutput(TRITONBACKEND_Response* response,
+                                const char* name, TRITONSERVER_DataType dtype,
+                                const std::vector<int64_t>& shape,
+                                const void* data, size_t byte_size) {
+  TRITONBACKEND_Output* output = nullptr;
+  RETURN_IF_ERROR(TRITONBACKEND_ResponseOutput(response, &output, name, dtype,
+                                               shape.data(), shape.size()));
+  void* buffer = nullptr;
+  TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+  int64_t memory_type_id = 0;
+  RETURN_IF_ERROR(TRITONBACKEND_OutputBuffer(output, &buffer, byte_size,
+                                             &memory_type, &memory_type_id));
+  if (byte_size == 0) return nullptr;
+  if (memory_type == TRITONSERVER_MEMORY_GPU) {
+    cudaError_t err =
+        cudaMemcpy(buffer, data, byte_size, cudaMemcpyHostToDevice);
+    if (err != cudaSuccess) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          (std::string("failed to copy output ") + name + ": " +
+           cudaGetErrorString(err))
+              .c_str());
+    }
+  } else {
+    memcpy(buffer, data, byte_size);
+  }
+  return nullptr;
+}
+
+TRITONSERVER_Error* WriteStringOutput(TRITONBACKEND_Response* response,
+                                      const char* name,
+                                      const std::vector<int64_t>& shape,
+                                      const std::vector<std::string>& strs) {
+  std::string data;
+  for (const auto& str : strs) {
+    uint32_t size = str.size();
+    data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    data.append(str);
+  }
+  return WriteOutput(response, name, TRITONSERVER_TYPE_BYTES, shape,
+                     data.data(), data.size());
+}
+
+void ToFloat(TRITONSERVER_DataType dtype, const char* data, size_t size,
+             float* out) {
+  if (dtype == TRITONSERVER_TYPE_FP16) {
+    const c10::Half* half = reinterpret_cast<const c10::Half*>(data);
+    for (size_t i = 0; i < size; ++i) out[i] = static_cast<float>(half[i]);
+  } else {
+    memcpy(out, data, size * sizeof(float));
+  }
+}
+
+void FromFloat(TRITONSERVER_DataType dtype, const float* data, size_t size,
+               std::vector<char>* out) {
+  if (dtype == TRITONSERVER_TYPE_FP16) {
+    out->resize(size * sizeof(c10::Half));
+    c10::Half* half = reinterpret_cast<c10::Half*>(out->data());
+    for (size_t i = 0; i < size; ++i) half[i] = c10::Half(data[i]);
+  } else {
+    out->resize(size * sizeof(float));
+    memcpy(out->data(), data, size * sizeof(float));
+  }
+}
+
+std::string GetStringParameter(TritonJson::Value& config,
+                               const std::string& key,
+                               const std::string& default_value) {
+  TritonJson::Value parameters;
+  std::string value;
+  if (!config.Find("parameters", &parameters)) return default_value;
+  TRITONSERVER_Error* err =
+      triton::backend::GetParameterValue(parameters, key, &value);
+  if (err != nullptr) {
+    TRITONSERVER_ErrorDelete(err);
+    return default_value;
+  }
+  return value.empty() ? default_value : value;
+}
+
+int GetIntParameter(TritonJson::Value& config, const std::string& key,
+                    int default_value) {
+  std::string value = GetStringParameter(config, key);
+  return value.empty() ? default_value : std::stoi(value);
+}
+
+TRITONSERVER_Error* GetIOConfig(TritonJson::Value& config, const char* io_key,
+                                const std::string& name,
+                                TRITONSERVER_DataType* dtype,
+                                std::vector<int64_t>* dims) {
+  TritonJson::Value ios;
+  RETURN_IF_ERROR(config.MemberAsArray(io_key, &ios));
+  for (size_t i = 0; i < ios.ArraySize(); ++i) {
+    TritonJson::Value io;
+    RETURN_IF_ERROR(ios.IndexAsObject(i, &io));
+    std::string io_name;
+    RETURN_IF_ERROR(io.MemberAsString("name", &io_name));
+    if (io_name != name) continue;
+    std::string data_type;
+    RETURN_IF_ERROR(io.MemberAsString("data_type", &data_type));
+    *dtype = triton::backend::ModelConfigDataTypeToTritonServerDataType(
+        data_type);
+    return triton::backend::ParseShape(io, "dims", dims);
+  }
+  return TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG,
+                               (std::string(io_key) + " " + name +
+                                " is not in the model config")
+                                   .c_str());
+}
+
+namespace {
+
+TRITONSERVER_Error* ResponseAlloc(TRITONSERVER_ResponseAllocator* allocator,
+                                  const char* tensor_name, size_t byte_size,
+                                  TRITONSERVER_MemoryType memory_type,
+                                  int64_t memory_type_id, void* userp,
+                                  void** buffer, void** buffer_userp,
+                                  TRITONSERVER_MemoryType* actual_memory_type,
+                                  int64_t* actual_memory_type_id) {
+  *actual_memory_type = TRITONSERVER_MEMORY_CPU;
+  *actual_memory_type_id = 0;
+  *buffer = byte_size == 0 ? nullptr : malloc(byte_size);
+  *buffer_userp = nullptr;
+  if (byte_size > 0 && *buffer == nullptr) {
+    return TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INTERNAL,
+                                 "failed to allocate the output");
+  }
+  return nullptr;
+}
+
+TRITONSERVER_Error* ResponseRelease(TRITONSERVER_ResponseAllocator* allocator,
+                                    void* buffer, void* buffer_userp,
+                                    size_t byte_size,
+                                    TRITONSERVER_MemoryType memory_type,
+                                    int64_t memory_type_id) {
+  free(buffer);
+  return nullptr;
+}
+
+void RequestRelease(TRITONSERVER_InferenceRequest* request,
+                    const uint32_t flags, void* userp) {
+  if ((flags & TRITONSERVER_REQUEST_RELEASE_ALL) != 0) {
+    TRITONSERVER_InferenceRequestDelete(request);
+  }
+}
+
+void ResponseComplete(TRITONSERVER_InferenceResponse* response,
+                      const uint32_t flags, void* userp) {
+  // Not decoupled, so there is exactly one response
+  if (response != nullptr) {
+    static_cast<std::promise<TRITONSERVER_InferenceResponse*>*>(userp)
+        ->set_value(response);
+  }
+}
+
+struct RequestDeleter {
+  void operator()(TRITONSERVER_InferenceRequest* request) const {
+    TRITONSERVER_InferenceRequestDelete(request);
+  }
+};
+
+struct ResponseDeleter {
+  void operator()(TRITONSERVER_InferenceResponse* response) const {
+    TRITONSERVER_InferenceResponseDelete(response);
+  }
+};
+
+}  // namespace
+
+TRITONSERVER_Error* ServerModel::Create(TRITONSERVER_Server* server,
+                                        const std::string& name,
+                                        std::unique_ptr<ServerModel>* model) {
+  model->reset(new ServerModel(server, name));
+  return TRITONSERVER_ResponseAllocatorNew(&(*model)->allocator_,
+                                           ResponseAlloc, ResponseRelease,
+                                           nullptr);
+}
+
+ServerModel::~ServerModel() {
+  if (allocator_ != nullptr) {
+    TRITONSERVER_ResponseAllocatorDelete(allocator_);
+  }
+}
+
+TRITONSERVER_Error* ServerModel::Infer(
+    const std::vector<Input>& inputs,
+    const std::vector<std::string>& output_names,
+    std::vector<HostTensor>* outputs) {
+  TRITONSERVER_InferenceRequest* request = nullptr;
+  RETURN_IF_ERROR(
+      TRITONSERVER_InferenceRequestNew(&request, server_, name_.c_str(), -1));
+  // Deleted by us until it's sent to the server
+  std::unique_ptr<TRITONSERVER_InferenceRequest, RequestDeleter> owner(
+      request);
+  for (const auto& input : inputs) {
+    RETURN_IF_ERROR(TRITONSERVER_InferenceRequestAddInput(
+        request, input.name.c_str(), input.dtype, input.shape.data(),
+        input.shape.size()));
+    RETURN_IF_ERROR(TRITONSERVER_InferenceRequestAppendInputData(
+        request, input.name.c_str(), input.data, input.byte_size,
+        TRITONSERVER_MEMORY_CPU, 0));
+  }
+  for (const auto& name : output_names) {
+    RETURN_IF_ERROR(
+        TRITONSERVER_InferenceRequestAddRequestedOutput(request,
+                                                        name.c_str()));
+  }
+  RETURN_IF_ERROR(TRITONSERVER_InferenceRequestSetReleaseCallback(
+      request, RequestRelease, nullptr));
+  std::promise<TRITONSERVER_InferenceResponse*> promise;
+  std::future<TRITONSERVER_InferenceResponse*> future = promise.get_future();
+  RETURN_IF_ERROR(TRITONSERVER_InferenceRequestSetResponseCallback(
+      request, allocator_, nullptr, ResponseComplete, &promise));
+  RETURN_IF_ERROR(TRITONSERVER_ServerInferAsync(server_, request, nullptr));
+  owner.release();
+
+  std::unique_ptr<TRITONSERVER_InferenceResponse, ResponseDeleter> response(
+      future.get());
+  RETURN_IF_ERROR(TRITONSERVER_InferenceResponseError(response.get()));
+  uint32_t output_count = 0;
+  RETURN_IF_ERROR(
+      TRITONSERVER_InferenceResponseOutputCount(response.get(), &output_count));
+  outputs->clear();
+  outputs->resize(output_names.size());
+  for (uint32_t i = 0; i < output_count; ++i) {
+    const char* name = nullptr;
+    TRITONSERVER_DataType dtype;
+    const int64_t* shape = nullptr;
+    uint64_t dims_count = 0;
+    const void* base = nullptr;
+    size_t byte_size = 0;
+    TRITONSERVER_MemoryType memory_type;
+    int64_t memory_type_id = 0;
+    void* userp = nullptr;
+    RETURN_IF_ERROR(TRITONSERVER_InferenceResponseOutput(
+        response.get(), i, &name, &dtype, &shape, &dims_count, &base,
+        &byte_size, &memory_type, &memory_type_id, &userp));
+    for (size_t j = 0; j < output_names.size(); ++j) {
+      if (output_names[j] != name) continue;
+      HostTensor& output = (*outputs)[j];
+      output.dtype = dtype;
+      output.shape.assign(shape, shape + dims_count);
+      const char* data = static_cast<const char*>(base);
+      output.data.assign(data, data + byte_size);
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace wenet
@@ -0,0 +1,123 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef BACKEND_TRITON_UTILS_H_
+#define BACKEND_TRITON_UTILS_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "triton/backend/backend_common.h"
+#include "triton/core/tritonbackend.h"
+#include "triton/core/tritonserver.h"
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+using triton::common::TritonJson;
+
+// A tensor in host memory, an input of a request or an output of a model
+// run by ServerModel
+struct HostTensor {
+  TRITONSERVER_DataType dtype = TRITONSERVER_TYPE_INVALID;
+  std::vector<int64_t> shape;
+  std::vector<char> data;
+
+  template <typename T>
+  const T* data_as() const {
+    return reinterpret_cast<const T*>(data.data());
+  }
+  template <typename T>
+  T* mutable_data_as() {
+    return reinterpret_cast<T*>(data.data());
+  }
+};
+
+// Copy the input of the request to host memory, the buffers of the input
+// may be on GPU
+TRITONSERVER_Error* ReadInput(TRITONBACKEND_Request* request,
+                              const char* name, HostTensor* tensor);
+
+// Add the output to the response and copy the data of host memory to it
+TRITONSERVER_Error* WriteOutput(TRITONBACKEND_Response* response,
+                                const char* name, TRITONSERVER_DataType dtype,
+                                const std::vector<int64_t>& shape,
+                                const void* data, size_t byte_size);
+// The strings are serialized as BYTES, each one is prefixed by its length
+// in 4 bytes
+TRITONSERVER_Error* WriteStringOutput(TRITONBACKEND_Response* response,
+                                      const char* name,
+                                      const std::vector<int64_t>& shape,
+                                      const std::vector<std::string>& strs);
+
+// The FP16 and FP32 tensors are converted from and to float
+void ToFloat(TRITONSERVER_DataType dtype, const char* data, size_t size,
+             float* out);
+void FromFloat(TRITONSERVER_DataType dtype, const float* data, size_t size,
+               std::vector<char>* out);
+
+// The parameters of the model config, the defaults are returned if they are
+// missing or empty
+std::string GetStringParameter(TritonJson::Value& config,
+                               const std::string& key,
+                               const std::string& default_value = "");
+int GetIntParameter(TritonJson::Value& config, const std::string& key,
+                    int default_value);
+// The data type and the dims of the input or output of the model config
+TRITONSERVER_Error* GetIOConfig(TritonJson::Value& config, const char* io_key,
+                                const std::string& name,
+                                TRITONSERVER_DataType* dtype,
+                                std::vector<int64_t>* dims);
+
+// A model of the server run in process by a backend, e.g. the decoder by
+// the scoring stage, see the BLS of Triton. The outputs are allocated in
+// host memory.
+class ServerModel {
+ public:
+  struct Input {
+    std::string name;
+    TRITONSERVER_DataType dtype;
+    std::vector<int64_t> shape;
+    const void* data;
+    size_t byte_size;
+  };
+
+  static TRITONSERVER_Error* Create(TRITONSERVER_Server* server,
+                                    const std::string& name,
+                                    std::unique_ptr<ServerModel>* model);
+  ~ServerModel();
+
+  // Blocks until the response, the outputs are in the order of the names
+  TRITONSERVER_Error* Infer(const std::vector<Input>& inputs,
+                            const std::vector<std::string>& output_names,
+                            std::vector<HostTensor>* outputs);
+
+ private:
+  ServerModel(TRITONSERVER_Server* server, const std::string& name)
+      : server_(server), name_(name) {}
+
+  TRITONSERVER_Server* server_;
+  std::string name_;
+  TRITONSERVER_ResponseAllocator* allocator_ = nullptr;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ServerModel);
+};
+
+}  // namespace wenet
+
+#endif  // BACKEND_TRITON_UTILS_H_
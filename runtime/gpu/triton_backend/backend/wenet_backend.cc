@@ -0,0 +1,230 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The "wenet" backend of Triton, it runs the stages of the ensembles of
+// runtime/gpu natively instead of by the python backend. The stage of a
+// model is chosen by its "stage" parameter:
+//   feature_extractor: see FeatureExtractor
+//   scoring: see Scorer
+//   streaming_scoring: see StreamingScorer, of model_repo_stateful
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "triton/backend/backend_common.h"
+#include "triton/backend/backend_model.h"
+#include "triton/backend/backend_model_instance.h"
+#include "triton/core/tritonbackend.h"
+
+#include "backend/feature_extractor.h"
+#include "backend/resource.h"
+#include "backend/scorer.h"
+#include "backend/stage.h"
+#include "backend/streaming_scorer.h"
+#include "backend/triton_utils.h"
+
+namespace wenet {
+
+using triton::backend::BackendModel;
+using triton::backend::BackendModelInstance;
+
+class ModelState : public BackendModel {
+ public:
+  static TRITONSERVER_Error* Create(TRITONBACKEND_Model* triton_model,
+                                    ModelState** state) {
+    try {
+      *state = new ModelState(triton_model);
+    } catch (const triton::backend::BackendModelException& ex) {
+      RETURN_ERROR_IF_TRUE(ex.err_ == nullptr, TRITONSERVER_ERROR_INTERNAL,
+                           std::string("unexpected nullptr in exception"));
+      RETURN_IF_ERROR(ex.err_);
+    }
+    if ((*state)->stage_ != "feature_extractor" &&
+        (*state)->stage_ != "scoring" &&
+        (*state)->stage_ != "streaming_scoring") {
+      std::string message = "unknown stage " + (*state)->stage_;
+      delete *state;
+      *state = nullptr;
+      return TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INVALID_ARG,
+                                   message.c_str());
+    }
+    return nullptr;
+  }
+
+  const std::string& stage() const { return stage_; }
+
+  // The resource is read by the first instance, and shared by all of them
+  std::shared_ptr<DecodeResource> resource() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (resource_ == nullptr) resource_ = ReadDecodeResource(ModelConfig());
+    return resource_;
+  }
+
+ private:
+  explicit ModelState(TRITONBACKEND_Model* triton_model)
+      : BackendModel(triton_model) {
+    stage_ = GetStringParameter(ModelConfig(), "stage");
+  }
+
+  std::string stage_;
+  std::mutex mutex_;
+  std::shared_ptr<DecodeResource> resource_;
+};
+
+class ModelInstanceState : public BackendModelInstance {
+ public:
+  static TRITONSERVER_Error* Create(
+      ModelState* model_state, TRITONBACKEND_ModelInstance* triton_instance,
+      ModelInstanceState** state) {
+    try {
+      *state = new ModelInstanceState(model_state, triton_instance);
+    } catch (const triton::backend::BackendModelInstanceException& ex) {
+      RETURN_ERROR_IF_TRUE(ex.err_ == nullptr, TRITONSERVER_ERROR_INTERNAL,
+                           std::string("unexpected nullptr in exception"));
+      RETURN_IF_ERROR(ex.err_);
+    }
+    return nullptr;
+  }
+
+  ModelState* model_state() const { return model_state_; }
+  Stage* stage() const { return stage_.get(); }
+
+ private:
+  ModelInstanceState(ModelState* model_state,
+                     TRITONBACKEND_ModelInstance* triton_instance)
+      : BackendModelInstance(model_state, triton_instance),
+        model_state_(model_state) {
+    TritonJson::Value& config = model_state->ModelConfig();
+    if (model_state->stage() == "feature_extractor") {
+      stage_.reset(new FeatureExtractor(config, DeviceId()));
+    } else {
+      TRITONSERVER_Server* server = nullptr;
+      THROW_IF_BACKEND_INSTANCE_ERROR(
+          TRITONBACKEND_ModelServer(model_state->TritonModel(), &server));
+      if (model_state->stage() == "scoring") {
+        stage_.reset(new Scorer(config, model_state->resource(), server));
+      } else {
+        stage_.reset(
+            new StreamingScorer(config, model_state->resource(), server));
+      }
+    }
+  }
+
+  ModelState* model_state_;
+  std::unique_ptr<Stage> stage_;
+};
+
+}  // namespace wenet
+
+namespace triton {
+namespace backend {
+namespace wenet {
+
+using ::wenet::ModelInstanceState;
+using ::wenet::ModelState;
+
+extern "C" {
+
+TRITONSERVER_Error* TRITONBACKEND_ModelInitialize(TRITONBACKEND_Model* model) {
+  ModelState* model_state = nullptr;
+  RETURN_IF_ERROR(ModelState::Create(model, &model_state));
+  RETURN_IF_ERROR(
+      TRITONBACKEND_ModelSetState(model, static_cast<void*>(model_state)));
+  return nullptr;
+}
+
+TRITONSERVER_Error* TRITONBACKEND_ModelFinalize(TRITONBACKEND_Model* model) {
+  void* state = nullptr;
+  RETURN_IF_ERROR(TRITONBACKEND_ModelState(model, &state));
+  delete static_cast<ModelState*>(state);
+  return nullptr;
+}
+
+TRITONSERVER_Error* TRITONBACKEND_ModelInstanceInitialize(
+    TRITONBACKEND_ModelInstance* instance) {
+  TRITONBACKEND_Model* model = nullptr;
+  RETURN_IF_ERROR(TRITONBACKEND_ModelInstanceModel(instance, &model));
+  void* model_state = nullptr;
+  RETURN_IF_ERROR(TRITONBACKEND_ModelState(model, &model_state));
+  ModelInstanceState* instance_state = nullptr;
+  RETURN_IF_ERROR(ModelInstanceState::Create(
+      static_cast<ModelState*>(model_state), instance, &instance_state));
+  RETURN_IF_ERROR(TRITONBACKEND_ModelInstanceSetState(
+      instance, static_cast<void*>(instance_state)));
+  return nullptr;
+}
+
+TRITONSERVER_Error* TRITONBACKEND_ModelInstanceFinalize(
+    TRITONBACKEND_ModelInstance* instance) {
+  void* state = nullptr;
+  RETURN_IF_ERROR(TRITONBACKEND_ModelInstanceState(instance, &state));
+  delete static_cast<ModelInstanceState*>(state);
+  return nullptr;
+}
+
+TRITONSERVER_Error* TRITONBACKEND_ModelInstanceExecute(
+    TRITONBACKEND_ModelInstance* instance, TRITONBACKEND_Request** requests,
+    const uint32_t request_count) {
+  void* state = nullptr;
+  RETURN_IF_ERROR(TRITONBACKEND_ModelInstanceState(instance, &state));
+  ModelInstanceState* instance_state = static_cast<ModelInstanceState*>(state);
+
+  uint64_t exec_start_ns = 0;
+  SET_TIMESTAMP(exec_start_ns);
+  std::vector<TRITONBACKEND_Request*> batch(requests,
+                                            requests + request_count);
+  std::vector<TRITONBACKEND_Response*> responses(request_count, nullptr);
+  std::vector<TRITONSERVER_Error*> errors(request_count, nullptr);
+  for (uint32_t i = 0; i < request_count; ++i) {
+    errors[i] = TRITONBACKEND_ResponseNew(&responses[i], requests[i]);
+  }
+  instance_state->stage()->Execute(batch, responses, &errors);
+  uint64_t exec_end_ns = 0;
+  SET_TIMESTAMP(exec_end_ns);
+
+  size_t total_batch_size = 0;
+  for (uint32_t i = 0; i < request_count; ++i) {
+    bool success = errors[i] == nullptr;
+    if (responses[i] != nullptr) {
+      LOG_IF_ERROR(TRITONBACKEND_ResponseSend(
+                       responses[i], TRITONSERVER_RESPONSE_COMPLETE_FINAL,
+                       errors[i]),
+                   "failed to send the response");
+    }
+    if (errors[i] != nullptr) TRITONSERVER_ErrorDelete(errors[i]);
+    if (success) ++total_batch_size;
+    LOG_IF_ERROR(TRITONBACKEND_ModelInstanceReportStatistics(
+                     instance, requests[i], success, exec_start_ns,
+                     exec_start_ns, exec_end_ns, exec_end_ns),
+                 "failed to report the request statistics");
+    LOG_IF_ERROR(
+        TRITONBACKEND_RequestRelease(requests[i],
+                                     TRITONSERVER_REQUEST_RELEASE_ALL),
+        "failed to release the request");
+  }
+  LOG_IF_ERROR(TRITONBACKEND_ModelInstanceReportBatchStatistics(
+                   instance, total_batch_size, exec_start_ns, exec_start_ns,
+                   exec_end_ns, exec_end_ns),
+               "failed to report the batch statistics");
+  return nullptr;
+}
+
+}  // extern "C"
+
+}  // namespace wenet
+}  // namespace backend
+}  // namespace triton
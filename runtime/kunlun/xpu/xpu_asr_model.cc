@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <utility>
 
 #include "utils/string.h"
@@ -34,9 +35,9 @@ void XPUAsrModel::SetEngineThreads(int num_threads) {
 void XPUAsrModel::SetDeviceId(int dev_id) { device_id_ = dev_id; }
 
 void XPUAsrModel::Read(const std::string& model_dir) {
-  // init xpu runtime params
-  ctx_xpu_ptr = std::make_shared<api::Context>(api::kXPU2);
-  RAII_GUARD.reset(new api::ctx_guard(ctx_xpu_ptr.get()));
+  // init xpu runtime params, the weights are loaded on the card
+  xpu_set_device(device_id_);
+  context_pool_ = std::make_shared<XPUContextPool>(device_id_, num_streams_);
 
   // For XPU, model_dir is params_dir, which is used to store weights for every
   // layer.
@@ -80,16 +81,22 @@ XPUAsrModel::XPUAsrModel(const XPUAsrModel& other) {
   chunk_size_ = other.chunk_size_;
   num_left_chunks_ = other.num_left_chunks_;
   offset_ = other.offset_;
+  replica_ = other.replica_;
 
-  l3ptr = other.l3ptr;
   real_threads_number = other.real_threads_number;
+  num_streams_ = other.num_streams_;
   device_id_ = other.device_id_;
-  ctx_xpu_ptr = other.ctx_xpu_ptr;
-  RAII_GUARD = other.RAII_GUARD;
+  context_pool_ = other.context_pool_;
   encoder_param = other.encoder_param;
   decoder_param = other.decoder_param;
-  stream = other.stream;
-  // other member variables may not need to copy here
+  // other member variables may not need to copy here, the context is drawn
+  // from the pool on the first use
+}
+
+XPUAsrModel::~XPUAsrModel() {
+  if (context_index_ >= 0) context_pool_->Release(context_index_);
+  xpu_set_device(device_id_);
+  if (encoder_out != nullptr) xpu_free(encoder_out);
 }
 
 std::shared_ptr<AsrModel> XPUAsrModel::Copy() const {
@@ -99,10 +106,19 @@ std::shared_ptr<AsrModel> XPUAsrModel::Copy() const {
   return asr_model;
 }
 
+XPUContext* XPUAsrModel::context() {
+  CHECK(context_pool_ != nullptr) << "Read the model first";
+  if (context_index_ < 0) {
+    context_index_ = context_pool_->Acquire();
+    ctx_xpu_ptr = context_pool_->context(context_index_)->ctx;
+    VLOG(1) << "Use XPU:" << device_id_ << " stream " << context_index_;
+  }
+  return context_pool_->context(context_index_);
+}
+
 void XPUAsrModel::Reset() {
   offset_ = 0;
-  encoder_out = nullptr;
-  ctc_probs = nullptr;
+  has_encoder_out_ = false;
   cached_feature_.clear();
   // Reset att_cache
   att_cache_.resize(0, 0.0);
@@ -112,101 +128,194 @@ void XPUAsrModel::Reset() {
 void XPUAsrModel::ForwardEncoderFunc(
     const std::vector<std::vector<float>>& chunk_feats,
     std::vector<std::vector<float>>* out_prob) {
-  // Set Device Id
-  LOG(INFO) << "Now Use XPU:" << device_id_ << "!\n";
-  xpu_set_device(device_id_);
-
-  // 1. Prepare XPU required data, splice cached_feature_ and chunk_feats
-  // The first dimension is for batchsize, which is 1.
-  // chunk
-
-  int num_frames = cached_feature_.size() + chunk_feats.size();
-  const int feature_dim = chunk_feats[0].size();
-
-  std::vector<int> feats_length_shape = {1};
-  std::vector<int> feats_length_data = {num_frames};
-  input_lenghts_cpu_info =
-      std::make_tuple(feats_length_data, feats_length_shape);
-
-  std::vector<int> feats_data_shape = {1, num_frames, feature_dim};
-  std::vector<float> feats_data_cpu;
-  feats_data_cpu.reserve(1 * num_frames * feature_dim);
-  // convert 2d-vector to 1d-vector
-  for (auto& row : chunk_feats) {
-    auto end_iter = feats_data_cpu.end();
-    feats_data_cpu.insert(end_iter, row.cbegin(), row.cend());
-  }
+  ForwardEncoderBatchFunc({this}, {&chunk_feats}, {out_prob});
+}
 
-  float* input_xpu_data = get_xpu_data<float>("wav_test", feats_data_cpu);
-  input_xpu_info = std::make_tuple(input_xpu_data, feats_data_shape);
-
-  // init L3 Memory
-  int ret = 0;
-  real_threads_number = 1;
-  int nsdnn = real_threads_number > 1 ? 2 : 6;
-  int ncluster = real_threads_number > 1 ? 2 : 8;
-  for (int i = 0; i < real_threads_number; i++) {
-    ret = xpu_stream_create(&stream);
-    ctx_xpu_ptr->xpu_stream = stream;
-    ctx_xpu_ptr->set_nsdnn(nsdnn);
-    ctx_xpu_ptr->set_ncluster(ncluster);
+void XPUAsrModel::ForwardEncoderTopKFunc(
+    const FeatureView& chunk_feats, int k,
+    std::vector<std::vector<float>>* topk_scores,
+    std::vector<std::vector<int32_t>>* topk_indexs) {
+  std::vector<std::vector<float>> feats(chunk_feats.num_frames());
+  for (int i = 0; i < chunk_feats.num_frames(); ++i) {
+    feats[i].assign(chunk_feats.frame(i),
+                    chunk_feats.frame(i) + chunk_feats.feature_dim());
   }
+  ForwardChunks({this}, {&feats}, k, {}, {topk_scores}, {topk_indexs});
+}
 
-  std::shared_ptr<api::Context> ctx_xpu = ctx_xpu_ptr;
+void XPUAsrModel::ForwardEncoderBatchFunc(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+    const std::vector<std::vector<std::vector<float>>*>& ctc_probs) {
+  ForwardChunks(models, chunk_feats, 0, ctc_probs, {}, {});
+}
 
-  // get input speech info and data
-  batch = feats_data_shape.at(0);  // batch = 1
-  max_seqlen = feats_data_shape.at(1);
+void XPUAsrModel::ForwardChunks(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+    int k, const std::vector<std::vector<std::vector<float>>*>& ctc_probs,
+    const std::vector<std::vector<std::vector<float>>*>& topk_scores,
+    const std::vector<std::vector<std::vector<int32_t>>*>& topk_indexs) {
+  XPUContext* xpu_context = context();
+  // Set Device Id
+  xpu_set_device(device_id_);
+  api::Context* ctx_xpu = xpu_context->ctx.get();
+
+  // 1. Prepare XPU required data, splice cached_feature_ and chunk_feats of
+  // each session, and pad them to the longest one, the padded frames are
+  // masked out
+  int num_sessions = models.size();
+  const int feature_dim = (*chunk_feats[0])[0].size();
+  std::vector<int> feats_length_data(num_sessions);
+  int num_frames = 0;
+  for (int i = 0; i < num_sessions; ++i) {
+    auto model = static_cast<XPUAsrModel*>(models[i]);
+    feats_length_data[i] =
+        model->cached_feature_.size() + chunk_feats[i]->size();
+    num_frames = std::max(num_frames, feats_length_data[i]);
+  }
+  std::vector<int> feats_data_shape = {num_sessions, num_frames, feature_dim};
+  std::vector<float> feats_data_cpu(num_sessions * num_frames * feature_dim,
+                                    0.0f);
+  for (int i = 0; i < num_sessions; ++i) {
+    auto model = static_cast<XPUAsrModel*>(models[i]);
+    float* dst = feats_data_cpu.data() + i * num_frames * feature_dim;
+    for (const auto& row : model->cached_feature_) {
+      dst = std::copy(row.begin(), row.end(), dst);
+    }
+    for (const auto& row : *chunk_feats[i]) {
+      dst = std::copy(row.begin(), row.end(), dst);
+    }
+  }
+  // Upload to the next input slot on the copy stream, while the forward of
+  // the other slot may still run on the stream of the context
+  auto& input = xpu_context->inputs[xpu_context->next_input++ % 2];
+  std::unique_lock<std::mutex> input_lock(input.mutex);
+  float* input_xpu_data = input.feats.Reserve<float>(feats_data_cpu.size());
+  int ret = xpu_memcpy_async(input_xpu_data, feats_data_cpu.data(),
+                             feats_data_cpu.size() * sizeof(float),
+                             XPUMemcpyKind::XPU_HOST_TO_DEVICE,
+                             xpu_context->copy_stream);
+  CHECK_RET(ret);
+  ret = xpu_wait(xpu_context->copy_stream);
+  CHECK_RET(ret);
 
-  xpu_mask_info_float = create_mask_according_speech_length<float>(
-      feats_length_data, max_seqlen, ctx_xpu->xpu_stream);
+  std::lock_guard<std::mutex> lock(xpu_context->mutex);
 
+  auto mask_info = create_mask_according_speech_length<float>(
+      feats_length_data, num_frames, ctx_xpu->xpu_stream);
   ret = xpu_wait(ctx_xpu->xpu_stream);
   CHECK_RET(ret);
 
-  q_seqlen = ((max_seqlen - 1) / 2 - 1) / 2;
-
-  // Encoder run
+  int out_seqlen = ((num_frames - 1) / 2 - 1) / 2;
   int att_dim = encoder_param.head_num * encoder_param.head_dim;
   int ctc_dim = encoder_param.ctc_dim;
-
-  LOG(INFO) << "\t max_seqlen is " << max_seqlen << "\n";
-  LOG(INFO) << "\t q_seqlen   is " << q_seqlen << "\n";
-  LOG(INFO) << "\t att_dim    is " << att_dim << "\n";
-  LOG(INFO) << "\t ctc_dim    is " << ctc_dim << "\n";
+  VLOG(2) << "batch " << num_sessions << " max_seqlen " << num_frames
+          << " q_seqlen " << out_seqlen;
 
   // T is float16
-  encoder_out = RAII_GUARD->alloc<T>(batch * q_seqlen * att_dim);
-  ctc_probs = RAII_GUARD->alloc<T>(batch * q_seqlen * ctc_dim);
+  T* encoder_outs = xpu_context->encoder_outs.Reserve<T>(
+      num_sessions * out_seqlen * att_dim);
+  T* ctc_outs =
+      xpu_context->ctc_outs.Reserve<T>(num_sessions * out_seqlen * ctc_dim);
 
   // 2. Encoder chunk forward, including ctc_activation
   // get encoder_out & ctc_probs
   ret = xpu::wenet::conformer_encoder_wenet<T, TW, int16_t>(
-      ctx_xpu.get(), input_xpu_data, feats_data_shape, encoder_out, ctc_probs,
-      encoder_param, xpu_mask_info_float);
+      ctx_xpu, input_xpu_data, feats_data_shape, encoder_outs, ctc_outs,
+      encoder_param, mask_info);
   CHECK_RET(ret);
 
-  // Copy to output(cpu)
-  int num_outputs = q_seqlen;
-  int output_dim = ctc_dim;
-  out_prob->resize(num_outputs);
-
-  float* logp = RAII_GUARD->alloc<float>(batch * q_seqlen * ctc_dim);
+  float* logp =
+      xpu_context->logp.Reserve<float>(num_sessions * out_seqlen * ctc_dim);
   // cast T to float32
-  ret = api::cast_v2<T, float>(ctx_xpu.get(), ctc_probs, logp,
-                               batch * q_seqlen * ctc_dim);
+  ret = api::cast_v2<T, float>(ctx_xpu, ctc_outs, logp,
+                               num_sessions * out_seqlen * ctc_dim);
   CHECK_RET(ret);
   ret = xpu_wait(ctx_xpu->xpu_stream);
   CHECK_RET(ret);
+  xpu_free(std::get<0>(mask_info));
+  // The input slot is free for the upload of the next forward
+  input_lock.unlock();
+
+  if (k > 0) {
+    // TopK of all the frames of the batch on the card, as
+    // ctc_prefix_beamsearch does, so the [T, ctc_dim] posteriors stay there
+    k = std::min(k, ctc_dim);
+    int num_rows = num_sessions * out_seqlen;
+    float* topk_score_xpu =
+        xpu_context->topk_scores.Reserve<float>(num_rows * k);
+    int* topk_index_xpu = xpu_context->topk_indexs.Reserve<int>(num_rows * k);
+    ret = api::sorted_topk<float>(ctx_xpu, logp, topk_score_xpu,
+                                  topk_index_xpu, num_rows, ctc_dim, k, true);
+    CHECK_RET(ret);
+    ret = xpu_wait(ctx_xpu->xpu_stream);
+    CHECK_RET(ret);
+    std::vector<float> topk_score_cpu(num_rows * k);
+    std::vector<int> topk_index_cpu(num_rows * k);
+    ret = xpu_memcpy(topk_score_cpu.data(), topk_score_xpu,
+                     topk_score_cpu.size() * sizeof(float),
+                     XPUMemcpyKind::XPU_DEVICE_TO_HOST);
+    CHECK_RET(ret);
+    ret = xpu_memcpy(topk_index_cpu.data(), topk_index_xpu,
+                     topk_index_cpu.size() * sizeof(int),
+                     XPUMemcpyKind::XPU_DEVICE_TO_HOST);
+    CHECK_RET(ret);
+    for (int i = 0; i < num_sessions; ++i) {
+      auto model = static_cast<XPUAsrModel*>(models[i]);
+      int num_outputs = ((feats_length_data[i] - 1) / 2 - 1) / 2;
+      const float* score = topk_score_cpu.data() + i * out_seqlen * k;
+      const int* index = topk_index_cpu.data() + i * out_seqlen * k;
+      topk_scores[i]->resize(num_outputs);
+      topk_indexs[i]->resize(num_outputs);
+      for (int j = 0; j < num_outputs; ++j) {
+        (*topk_scores[i])[j].assign(score + j * k, score + (j + 1) * k);
+        (*topk_indexs[i])[j].assign(index + j * k, index + (j + 1) * k);
+      }
+      model->KeepEncoderOut(encoder_outs + i * out_seqlen * att_dim,
+                            feats_length_data[i], num_outputs);
+    }
+    return;
+  }
 
   // xpu_memcpy logp from device to host
-  for (int i = 0; i < num_outputs; i++) {
-    (*out_prob)[i].resize(output_dim);
-    ret = xpu_memcpy(reinterpret_cast<void*>((*out_prob)[i].data()),
-                     logp + output_dim * i, output_dim * sizeof(float),
-                     XPUMemcpyKind::XPU_DEVICE_TO_HOST);
+  std::vector<float> logp_cpu(num_sessions * out_seqlen * ctc_dim);
+  ret = xpu_memcpy(logp_cpu.data(), logp, logp_cpu.size() * sizeof(float),
+                   XPUMemcpyKind::XPU_DEVICE_TO_HOST);
+  CHECK_RET(ret);
+
+  // Copy to output(cpu), only the frames of each session itself
+  for (int i = 0; i < num_sessions; ++i) {
+    auto model = static_cast<XPUAsrModel*>(models[i]);
+    int num_outputs = ((feats_length_data[i] - 1) / 2 - 1) / 2;
+    const float* src = logp_cpu.data() + i * out_seqlen * ctc_dim;
+    ctc_probs[i]->resize(num_outputs);
+    for (int j = 0; j < num_outputs; ++j) {
+      (*ctc_probs[i])[j].assign(src + j * ctc_dim, src + (j + 1) * ctc_dim);
+    }
+    model->KeepEncoderOut(encoder_outs + i * out_seqlen * att_dim,
+                          feats_length_data[i], num_outputs);
+  }
+}
+
+void XPUAsrModel::KeepEncoderOut(const T* encoder_out_xpu, int num_frames,
+                                 int num_outputs) {
+  int att_dim = encoder_param.head_num * encoder_param.head_dim;
+  int size = num_outputs * att_dim;
+  if (size > encoder_out_capacity_) {
+    if (encoder_out != nullptr) xpu_free(encoder_out);
+    int ret = xpu_malloc(reinterpret_cast<void**>(&encoder_out),
+                         size * sizeof(T));
     CHECK_RET(ret);
+    encoder_out_capacity_ = size;
   }
+  int ret = xpu_memcpy(encoder_out, encoder_out_xpu, size * sizeof(T),
+                       XPUMemcpyKind::XPU_DEVICE_TO_DEVICE);
+  CHECK_RET(ret);
+  // The mask is made of the frames of the sessions rescored together
+  max_seqlen = num_frames;
+  q_seqlen = num_outputs;
+  has_encoder_out_ = true;
 }
 
 float XPUAsrModel::ComputeAttentionScore(const float* prob,
@@ -224,94 +333,128 @@ void XPUAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                                      float reverse_weight,
                                      std::vector<float>* rescoring_score) {
   CHECK(rescoring_score != nullptr);
-  int num_hyps = hyps.size();
-  rescoring_score->resize(num_hyps, 0.0f);
+  AttentionRescoringBatchFunc({this}, {&hyps}, reverse_weight,
+                              {rescoring_score});
+}
 
-  if (num_hyps == 0) {
-    return;
+void XPUAsrModel::AttentionRescoringBatchFunc(
+    const std::vector<AsrModel*>& models,
+    const std::vector<const std::vector<std::vector<int>>*>& hyps,
+    float reverse_weight,
+    const std::vector<std::vector<float>*>& rescoring_scores) {
+  // The sessions with the encoder output of the last chunk and any hyp
+  std::vector<XPUAsrModel*> sessions;
+  std::vector<int> session_index;
+  int max_frames = 0;
+  int max_hyps_len = 0;
+  for (size_t i = 0; i < models.size(); ++i) {
+    auto model = static_cast<XPUAsrModel*>(models[i]);
+    rescoring_scores[i]->assign(hyps[i]->size(), 0.0f);
+    if (hyps[i]->empty() || !model->has_encoder_out_) continue;
+    CHECK_LE(static_cast<int>(hyps[i]->size()), encoder_param.beam_size);
+    sessions.push_back(model);
+    session_index.push_back(i);
+    max_frames = std::max(max_frames, model->max_seqlen);
+    for (const auto& hyp : *hyps[i]) {
+      max_hyps_len = std::max(max_hyps_len, static_cast<int>(hyp.size()));
+    }
   }
+  if (sessions.empty()) return;
 
-  if (encoder_out == nullptr) {
-    return;
+  XPUContext* xpu_context = context();
+  std::lock_guard<std::mutex> lock(xpu_context->mutex);
+  xpu_set_device(device_id_);
+  api::Context* ctx_xpu = xpu_context->ctx.get();
+  api::ctx_guard guard(ctx_xpu);
+
+  // 1. Pad the encoder outputs of the sessions to the longest one, the
+  // padded frames are zeros and masked out
+  int num_sessions = sessions.size();
+  int att_dim = encoder_param.head_num * encoder_param.head_dim;
+  int ctc_dim = encoder_param.ctc_dim;
+  int out_seqlen = ((max_frames - 1) / 2 - 1) / 2;
+  T* encoder_outs = guard.alloc<T>(num_sessions * out_seqlen * att_dim);
+  std::vector<T> zeros;
+  std::vector<int> frames(num_sessions);
+  for (int i = 0; i < num_sessions; ++i) {
+    XPUAsrModel* model = sessions[i];
+    frames[i] = model->max_seqlen;
+    T* dst = encoder_outs + i * out_seqlen * att_dim;
+    int size = model->q_seqlen * att_dim;
+    int ret = xpu_memcpy(dst, model->encoder_out, size * sizeof(T),
+                         XPUMemcpyKind::XPU_DEVICE_TO_DEVICE);
+    CHECK_RET(ret);
+    int pad = out_seqlen * att_dim - size;
+    if (pad > 0) {
+      zeros.resize(pad, static_cast<T>(0.0f));
+      ret = xpu_memcpy(dst + size, zeros.data(), pad * sizeof(T),
+                       XPUMemcpyKind::XPU_HOST_TO_DEVICE);
+      CHECK_RET(ret);
+    }
   }
+  auto mask_info = create_mask_according_speech_length<float>(
+      frames, max_frames, ctx_xpu->xpu_stream);
 
+  // 2. Pad the hyps of each session to beam_size with sos and the hyps to
+  // the longest one with 0, the decoder repeats the encoder output of a
+  // session for its beam_size hyps
   int beam_size = encoder_param.beam_size;
-  int new_bs = batch * beam_size;
-
-  std::vector<int64_t> hyps_lens;
-  int max_hyps_len = 0;
-  for (size_t i = 0; i < num_hyps; ++i) {
-    int length = hyps[i].size() + 1;
-    max_hyps_len = std::max(length, max_hyps_len);
-    hyps_lens.emplace_back(static_cast<int64_t>(length));
-  }
-  LOG(INFO) << "\t num_hyps  is " << num_hyps << "\n";
-  LOG(INFO) << "\t beam_size is " << beam_size << "\n";
-  LOG(INFO) << "\t new_bs    is " << new_bs << "\n";
-  LOG(INFO) << "\t max_hyps_len is " << max_hyps_len << "\n";
-
-  // pad hyps
-  std::vector<int> hyps_pad_cpu(max_hyps_len * beam_size);
-  for (size_t i = 0; i < num_hyps; ++i) {
-    const std::vector<int>& hyp = hyps[i];
-    hyps_pad_cpu.emplace_back(sos_);
-    size_t j = 0;
-    for (; j < hyp.size(); ++j) {
-      hyps_pad_cpu.emplace_back(hyp[j]);
-    }
-    if (j == max_hyps_len - 1) {
-      continue;
-    }
-    for (; j < max_hyps_len - 1; ++j) {
-      hyps_pad_cpu.emplace_back(0);
+  int new_bs = num_sessions * beam_size;
+  int max_target_len = max_hyps_len + 1;
+  std::vector<int> hyps_pad_cpu(new_bs * max_target_len, 0);
+  for (int i = 0; i < num_sessions; ++i) {
+    const auto& session_hyps = *hyps[session_index[i]];
+    for (int j = 0; j < beam_size; ++j) {
+      int* dst = hyps_pad_cpu.data() + (i * beam_size + j) * max_target_len;
+      dst[0] = sos_;
+      if (j < static_cast<int>(session_hyps.size())) {
+        std::copy(session_hyps[j].begin(), session_hyps[j].end(), dst + 1);
+      }
     }
   }
-  int* hyps_xpu = RAII_GUARD->alloc<int>(new_bs * q_seqlen);
-  int max_target_len = max_hyps_len;
-  // xpu_memcpy hyps_pad_cup to device
-  int ret = xpu_memcpy(hyps_xpu, reinterpret_cast<void*>(hyps_pad_cpu.data()),
-                       max_target_len * new_bs * sizeof(int),
+  int* hyps_xpu = guard.alloc<int>(hyps_pad_cpu.size());
+  int ret = xpu_memcpy(hyps_xpu, hyps_pad_cpu.data(),
+                       hyps_pad_cpu.size() * sizeof(int),
                        XPUMemcpyKind::XPU_HOST_TO_DEVICE);
   CHECK_RET(ret);
+  ret = xpu_wait(ctx_xpu->xpu_stream);
+  CHECK_RET(ret);
 
-  // Decoder
-  int att_dim = encoder_param.head_num * encoder_param.head_dim;
-  int ctc_dim = encoder_param.ctc_dim;
+  // 3. Decoder of all the hyps of the sessions in one call
   int pad_target_len = decoder_param.add_sos_num + max_target_len;
   float* character_scores =
-      RAII_GUARD->alloc<float>(new_bs * pad_target_len * ctc_dim);
+      guard.alloc<float>(new_bs * pad_target_len * ctc_dim);
   ret = xpu::wenet::conformer_decoder_wenet<T, TW, int16_t>(
-      ctx_xpu_ptr.get(), encoder_out, {batch, q_seqlen, att_dim},
-      std::get<0>(xpu_mask_info_float), hyps_xpu, {new_bs, max_target_len},
+      ctx_xpu, encoder_outs, {num_sessions, out_seqlen, att_dim},
+      std::get<0>(mask_info), hyps_xpu, {new_bs, max_target_len},
       character_scores, decoder_param);
   CHECK_RET(ret);
-  ret = xpu_wait(ctx_xpu_ptr->xpu_stream);
+  ret = xpu_wait(ctx_xpu->xpu_stream);
   CHECK_RET(ret);
+  xpu_free(std::get<0>(mask_info));
 
   // xpu_memcpy from xpu device to host
-  std::vector<float> decoder_out(new_bs * pad_target_len * ctc_dim);
-  ret = xpu_memcpy(&decoder_out[0], character_scores,
-                   new_bs * max_target_len * ctc_dim * sizeof(float),
+  std::vector<float> decoder_out(new_bs * max_target_len * ctc_dim);
+  ret = xpu_memcpy(decoder_out.data(), character_scores,
+                   decoder_out.size() * sizeof(float),
                    XPUMemcpyKind::XPU_DEVICE_TO_HOST);
   CHECK_RET(ret);
-  ret = xpu_wait(ctx_xpu_ptr->xpu_stream);
-  CHECK_RET(ret);
 
-  // cal score
-  float* decoder_outs_data = decoder_out.data();
-  for (size_t i = 0; i < num_hyps; ++i) {
-    const std::vector<int>& hyp = hyps[i];
-    float score = 0.0f;
-    // left to right decoder score
-    // ctc_dim maybe equal to decode_out_len
-    score = ComputeAttentionScore(
-        decoder_outs_data + max_target_len * ctc_dim * i, hyp, eos_, ctc_dim);
-    // Optional: Used for right to left score
-    float r_score = 0.0f;
-    // reverse_weight is 0 ; so the codes in if-condition is be ignored.
-    // combined left-to-right and right-to-left score
-    (*rescoring_score)[i] =
-        score * (1 - reverse_weight) + r_score * reverse_weight;
+  // 4. cal score
+  for (int i = 0; i < num_sessions; ++i) {
+    const auto& session_hyps = *hyps[session_index[i]];
+    std::vector<float>* scores = rescoring_scores[session_index[i]];
+    for (size_t j = 0; j < session_hyps.size(); ++j) {
+      const float* prob = decoder_out.data() +
+                          (i * beam_size + j) * max_target_len * ctc_dim;
+      // left to right decoder score, ctc_dim maybe equal to decode_out_len
+      float score = ComputeAttentionScore(prob, session_hyps[j], eos_,
+                                          ctc_dim);
+      // Optional: Used for right to left score, reverse_weight is 0, so
+      // the right to left decoder is not run
+      float r_score = 0.0f;
+      (*scores)[j] = score * (1 - reverse_weight) + r_score * reverse_weight;
+    }
   }
 }
 
@@ -28,7 +28,8 @@
 #include "utils/log.h"
 #include "utils/utils.h"
 
-#include "xpu_conformer.h"  // NOLINT
+#include "xpu_context_pool.h"  // NOLINT
+#include "xpu_conformer.h"     // NOLINT
 
 namespace wenet {
 
@@ -43,7 +44,11 @@ class XPUAsrModel : public AsrModel {
  public:
   XPUAsrModel() = default;
   XPUAsrModel(const XPUAsrModel& other);
+  ~XPUAsrModel() override;
   void SetDeviceId(int dev_id);
+  // The number of streams on the card, which the copies of the model are
+  // spread over, see XPUContextPool. Call it before Read.
+  void SetNumStreams(int num_streams) { num_streams_ = num_streams; }
   void Read(const std::string& model_dir);
   void Reset() override;
   void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
@@ -54,11 +59,47 @@ class XPUAsrModel : public AsrModel {
  protected:
   void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
                           std::vector<std::vector<float>>* ctc_prob) override;
+  // The chunks are padded to the longest one and forwarded as one batch on
+  // the context of the first model, all the models are on the same card.
+  void ForwardEncoderBatchFunc(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+      const std::vector<std::vector<std::vector<float>>*>& ctc_probs) override;
+  // The hyps of all the sessions are decoded in one conformer_decoder_wenet
+  // call on the context of the first model, with the encoder outputs of the
+  // sessions padded to the longest one, e.g. for RescoringScheduler.
+  void AttentionRescoringBatchFunc(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<int>>*>& hyps,
+      float reverse_weight,
+      const std::vector<std::vector<float>*>& rescoring_scores) override;
+  // TopK is done on the card by sorted_topk, only [T, k] is copied back to
+  // host for the topk Search, see DecodeOptions::enable_topk_ctc
+  void ForwardEncoderTopKFunc(
+      const FeatureView& chunk_feats, int k,
+      std::vector<std::vector<float>>* topk_scores,
+      std::vector<std::vector<int32_t>>* topk_indexs) override;
 
   float ComputeAttentionScore(const float* prob, const std::vector<int>& hyp,
                               int eos, int decode_out_len);
 
  private:
+  // Draw a context from the pool on the first use
+  XPUContext* context();
+  // Forward the chunks of the sessions as one batch, then copy the full ctc
+  // log probs to `ctc_probs`, or only the top k of each frame to
+  // `topk_scores` and `topk_indexs` if k > 0
+  void ForwardChunks(
+      const std::vector<AsrModel*>& models,
+      const std::vector<const std::vector<std::vector<float>>*>& chunk_feats,
+      int k, const std::vector<std::vector<std::vector<float>>*>& ctc_probs,
+      const std::vector<std::vector<std::vector<float>>*>& topk_scores,
+      const std::vector<std::vector<std::vector<int32_t>>*>& topk_indexs);
+  // Keep the encoder output of the last chunk of `num_frames` frames, which
+  // has `num_outputs` frames, for the rescoring
+  void KeepEncoderOut(const T* encoder_out_xpu, int num_frames,
+                      int num_outputs);
+
   int encoder_output_size_ = 0;
   int num_blocks_ = 0;
   int cnn_module_kernel_ = 0;
@@ -67,29 +108,25 @@ class XPUAsrModel : public AsrModel {
   // XPU device id
   int device_id_ = 0;
   int real_threads_number = 1;
+  int num_streams_ = 1;
 
   // XPU Conformer EncoderParam and DecoderParam
   ConformerEncoderParam<T, TW> encoder_param;
   ConformerDecoderParam<T, TW> decoder_param;
 
-  // XPU input and weights params
-  using INPUT_LENGTH_CPU_TUPLE = std::tuple<std::vector<int>, std::vector<int>>;
-  using INPUT_XPU_INFO_TUPLE = std::tuple<float*, std::vector<int>>;
-  INPUT_LENGTH_CPU_TUPLE input_lenghts_cpu_info;
-  INPUT_XPU_INFO_TUPLE input_xpu_info;
-  INPUT_XPU_INFO_TUPLE xpu_mask_info_float;
-
-  // XPU encoder and decoder outputs
+  // XPU encoder output of the last chunk, owned by the model
   T* encoder_out = nullptr;
-  T* ctc_probs = nullptr;
+  int encoder_out_capacity_ = 0;
+  bool has_encoder_out_ = false;
 
-  // XPU runtime params
-  void* l3ptr = nullptr;
-  XPUStream stream;
+  // XPU runtime params, the context is drawn from the pool of the card
+  std::shared_ptr<XPUContextPool> context_pool_;
+  int context_index_ = -1;
   std::shared_ptr<api::Context> ctx_xpu_ptr;
-  std::shared_ptr<api::ctx_guard> RAII_GUARD;
 
-  int batch, max_seqlen, q_seqlen;
+  // Input frames and output frames of the encoder output of the last chunk
+  int max_seqlen = 0;
+  int q_seqlen = 0;
 
   // caches
   std::vector<float> att_cache_;
@@ -0,0 +1,90 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "xpu_context_pool.h"  // NOLINT
+
+#include "utils/log.h"
+
+namespace wenet {
+
+XPUBuffer::~XPUBuffer() {
+  if (data_ != nullptr) xpu_free(data_);
+}
+
+void* XPUBuffer::Reserve(size_t bytes) {
+  if (bytes > capacity_) {
+    if (data_ != nullptr) xpu_free(data_);
+    data_ = nullptr;
+    int ret = xpu_malloc(&data_, bytes);
+    CHECK_RET(ret);
+    capacity_ = bytes;
+  }
+  return data_;
+}
+
+XPUContextPool::XPUContextPool(int device_id, int num_streams)
+    : device_id_(device_id), loads_(num_streams, 0) {
+  CHECK_GT(num_streams, 0);
+  xpu_set_device(device_id_);
+  // The clusters of the card are shared by the streams
+  int nsdnn = num_streams > 1 ? 2 : 6;
+  int ncluster = num_streams > 1 ? 2 : 8;
+  for (int i = 0; i < num_streams; ++i) {
+    auto context = std::make_unique<XPUContext>();
+    int ret = xpu_stream_create(&context->stream);
+    CHECK_RET(ret);
+    ret = xpu_stream_create(&context->copy_stream);
+    CHECK_RET(ret);
+    context->ctx = std::make_shared<api::Context>(api::kXPU2);
+    context->ctx->xpu_stream = context->stream;
+    context->ctx->set_nsdnn(nsdnn);
+    context->ctx->set_ncluster(ncluster);
+    contexts_.push_back(std::move(context));
+  }
+  LOG(INFO) << num_streams << " XPU streams on XPU:" << device_id_;
+}
+
+XPUContextPool::~XPUContextPool() {
+  xpu_set_device(device_id_);
+  for (auto& context : contexts_) {
+    context->ctx.reset();
+    xpu_stream_destroy(context->stream);
+    xpu_stream_destroy(context->copy_stream);
+  }
+  // The workspaces are freed on the card
+  contexts_.clear();
+}
+
+int XPUContextPool::Acquire() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int num_contexts = contexts_.size();
+  int best = -1;
+  for (int i = 0; i < num_contexts; ++i) {
+    int index = (next_ + i) % num_contexts;
+    if (best < 0 || loads_[index] < loads_[best]) best = index;
+  }
+  next_ = (best + 1) % num_contexts;
+  ++loads_[best];
+  return best;
+}
+
+void XPUContextPool::Release(int index) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(index >= 0 && index < static_cast<int>(loads_.size()));
+  CHECK_GT(loads_[index], 0);
+  --loads_[index];
+}
+
+}  // namespace wenet
@@ -0,0 +1,110 @@
+// Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef RUNTIME_KUNLUN_XPU_XPU_CONTEXT_POOL_H_
+#define RUNTIME_KUNLUN_XPU_XPU_CONTEXT_POOL_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils/utils.h"
+
+#include "xpu_util.h"  // NOLINT
+
+namespace wenet {
+
+// A buffer in the global memory of the card, which is grown on demand and
+// kept, so the forwards of the same shapes allocate nothing.
+class XPUBuffer {
+ public:
+  XPUBuffer() = default;
+  ~XPUBuffer();
+
+  // At least `bytes`, the content is not kept when it's grown
+  void* Reserve(size_t bytes);
+  template <typename T>
+  T* Reserve(size_t size) {
+    return static_cast<T*>(Reserve(size * sizeof(T)));
+  }
+  size_t capacity() const { return capacity_; }
+
+ private:
+  void* data_ = nullptr;
+  size_t capacity_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(XPUBuffer);
+};
+
+// A context and its stream on a card. The copies of XPUAsrModel which draw
+// the same context run on it by turns, with its mutex held.
+// The workspace of the encoder forward is kept on the context instead of
+// the scratch of ctx_guard per forward. The inputs are double buffered:
+// a forward uploads its features to the next input slot on copy_stream
+// with the mutex of the slot held, then takes the mutex of the context, so
+// the upload of the next forward overlaps the encoder of this one.
+struct XPUContext {
+  XPUStream stream = nullptr;
+  std::shared_ptr<api::Context> ctx;
+  std::mutex mutex;
+
+  // The outputs of the forward, used with `mutex` held
+  XPUBuffer encoder_outs;
+  XPUBuffer ctc_outs;
+  XPUBuffer logp;
+  XPUBuffer topk_scores;
+  XPUBuffer topk_indexs;
+
+  struct InputSlot {
+    std::mutex mutex;
+    XPUBuffer feats;
+  };
+  XPUStream copy_stream = nullptr;
+  InputSlot inputs[2];
+  std::atomic<int> next_input{0};
+};
+
+// The contexts of a card, each on its own stream, so the sessions on the
+// card run concurrently instead of serializing on one stream. A new copy of
+// the model draws the least loaded context, the ties are broken round robin,
+// and it's released when the copy is destroyed. The cards are served by the
+// replicas of the model, see ModelReplicas.
+class XPUContextPool {
+ public:
+  XPUContextPool(int device_id, int num_streams);
+  ~XPUContextPool();
+
+  int Acquire();
+  void Release(int index);
+  int device_id() const { return device_id_; }
+  int size() const { return contexts_.size(); }
+  XPUContext* context(int index) { return contexts_[index].get(); }
+
+ private:
+  int device_id_;
+  std::vector<std::unique_ptr<XPUContext>> contexts_;
+  std::mutex mutex_;
+  std::vector<int> loads_;
+  int next_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(XPUContextPool);
+};
+
+}  // namespace wenet
+
+#endif  // RUNTIME_KUNLUN_XPU_XPU_CONTEXT_POOL_H_
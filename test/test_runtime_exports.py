@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+import pytest
+import torch
+
+from wenet.transformer.asr_model import ASRModel
+from wenet.transformer.ctc import CTC
+from wenet.transformer.decoder import BiTransformerDecoder
+from wenet.transformer.encoder import ConformerEncoder
+
+VOCAB_SIZE = 10
+FEATURE_DIM = 20
+CHUNK_SIZE = 4
+# (CHUNK_SIZE - 1) * subsampling_rate + right_context + 1 of conv2d
+CHUNK_FRAMES = (CHUNK_SIZE - 1) * 4 + 7
+
+
+@pytest.fixture(scope="module")
+def model():
+    """ A tiny causal conformer with a bidirectional decoder, scripted as
+        wenet/bin/export_jit.py does
+    """
+    torch.manual_seed(777)
+    encoder = ConformerEncoder(FEATURE_DIM, output_size=16,
+                               attention_heads=2, linear_units=16,
+                               num_blocks=2, cnn_module_kernel=3,
+                               causal=True, cnn_module_norm="layer_norm")
+    decoder = BiTransformerDecoder(VOCAB_SIZE, 16, attention_heads=2,
+                                   linear_units=16, num_blocks=1,
+                                   r_num_blocks=1)
+    ctc = CTC(VOCAB_SIZE, 16)
+    asr_model = ASRModel(VOCAB_SIZE, encoder, decoder, ctc)
+    asr_model.eval()
+    return torch.jit.script(asr_model)
+
+
+def test_batch_forward_encoder_chunk(model):
+    batch_size = 3
+    required_cache_size = 2 * CHUNK_SIZE
+    att_caches = [torch.zeros(0, 0, 0, 0)] * batch_size
+    cnn_caches = [torch.zeros(0, 0, 0, 0)] * batch_size
+    att_cache = torch.stack(att_caches)
+    cnn_cache = torch.stack(cnn_caches)
+    offset = 0
+    with torch.no_grad():
+        for _ in range(4):
+            xs = torch.randn(batch_size, CHUNK_FRAMES, FEATURE_DIM)
+            ys, att_cache, cnn_cache = model.batch_forward_encoder_chunk(
+                xs, offset, required_cache_size, att_cache, cnn_cache)
+            for b in range(batch_size):
+                y, att_caches[b], cnn_caches[b] = model.forward_encoder_chunk(
+                    xs[b:b + 1], offset, required_cache_size, att_caches[b],
+                    cnn_caches[b])
+                assert torch.allclose(ys[b:b + 1], y, atol=1e-5)
+                assert torch.allclose(att_cache[b], att_caches[b], atol=1e-5)
+                assert torch.allclose(cnn_cache[b], cnn_caches[b], atol=1e-5)
+            offset += ys.size(1)
+
+
+def test_forward_encoder_chunk_graph(model):
+    required_cache_size = 2 * CHUNK_SIZE
+    att_cache = torch.zeros(0, 0, 0, 0)
+    cnn_cache = torch.zeros(0, 0, 0, 0)
+    offset = 0
+    with torch.no_grad():
+        for i in range(5):
+            xs = torch.randn(1, CHUNK_FRAMES, FEATURE_DIM)
+            # The runtime replays the graphs once the cache is full
+            if i >= 2:
+                graph_y, graph_att_cache, graph_cnn_cache = \
+                    model.forward_encoder_chunk_graph(
+                        xs, torch.tensor(offset), required_cache_size,
+                        att_cache, cnn_cache)
+            y, att_cache, cnn_cache = model.forward_encoder_chunk(
+                xs, offset, required_cache_size, att_cache, cnn_cache)
+            if i >= 2:
+                assert torch.allclose(graph_y, y, atol=1e-5)
+                assert torch.allclose(graph_att_cache, att_cache, atol=1e-5)
+                assert torch.allclose(graph_cnn_cache, cnn_cache, atol=1e-5)
+            offset += y.size(1)
+
+
+def test_batch_forward_attention_decoder_hyps(model):
+    sos = model.sos_symbol()
+    hyps = [[[1, 2, 3], [4], [5, 6]], [[7, 8]]]
+    encoder_outs = [torch.randn(1, 7, 16), torch.randn(1, 4, 16)]
+    max_hyps_len = max(len(hyp) for utt in hyps for hyp in utt) + 1
+    max_len = max(encoder_out.size(1) for encoder_out in encoder_outs)
+    all_hyps, all_lens, all_encoder_outs, encoder_lens = [], [], [], []
+    for utt_hyps, encoder_out in zip(hyps, encoder_outs):
+        for hyp in utt_hyps:
+            all_hyps.append([sos] + hyp + [0] * (max_hyps_len - len(hyp) - 1))
+            all_lens.append(len(hyp) + 1)
+            all_encoder_outs.append(torch.nn.functional.pad(
+                encoder_out, (0, 0, 0, max_len - encoder_out.size(1))))
+            encoder_lens.append(encoder_out.size(1))
+    with torch.no_grad():
+        decoder_out, r_decoder_out = \
+            model.batch_forward_attention_decoder_hyps(
+                torch.tensor(all_hyps), torch.tensor(all_lens),
+                torch.cat(all_encoder_outs), torch.tensor(encoder_lens), 0.5)
+        k = 0
+        for utt_hyps, encoder_out in zip(hyps, encoder_outs):
+            num_hyps = len(utt_hyps)
+            utt_lens = torch.tensor(all_lens[k:k + num_hyps])
+            utt_max_len = int(utt_lens.max())
+            out, r_out = model.forward_attention_decoder(
+                torch.tensor(all_hyps[k:k + num_hyps])[:, :utt_max_len],
+                utt_lens, encoder_out, 0.5)
+            for i in range(num_hyps):
+                n = all_lens[k + i]
+                assert torch.allclose(decoder_out[k + i, :n], out[i, :n],
+                                      atol=1e-4)
+                # The reversed hyps are padded by eos, so their steps
+                # before the end of the hyp are compared
+                assert torch.allclose(r_decoder_out[k + i, :n],
+                                      r_out[i, :n], atol=1e-4)
+            k += num_hyps
@@ -35,4 +35,20 @@ fsttablecompose $tgt_lang/L.fst $tgt_lang/G.fst | fstdeterminizestar --use-log=t
 fsttablecompose $tgt_lang/T.fst $tgt_lang/LG.fst > $tgt_lang/TLG.fst || exit 1;
 
 echo "Composing decoding graph TLG.fst succeeded"
+# Or build LG and TLG in one process, whose compositions run on the threads
+#build_tlg --num-threads=8 --lg-out=$tgt_lang/LG.fst $tgt_lang/T.fst \
+#  $tgt_lang/L.fst $tgt_lang/G.fst $tgt_lang/TLG.fst || exit 1;
 #rm -r $tgt_lang/LG.fst   # We don't need to keep this intermediate FST
+# Optional, convert TLG.fst to an aligned const fst, which is memory mapped by
+# the runtime(--fst_mmap) and shared by the decoding processes on one host
+#fsttoconst $tgt_lang/TLG.fst $tgt_lang/TLG.const.fst && \
+#  mv $tgt_lang/TLG.const.fst $tgt_lang/TLG.fst
+# Or convert it to the quantized compact fst, which takes 12 bytes per arc
+# instead of 16, and is memory mapped as well
+#fstquantize --benchmark=true $tgt_lang/TLG.fst $tgt_lang/TLG.quantized.fst && \
+#  mv $tgt_lang/TLG.quantized.fst $tgt_lang/TLG.fst
+# Or keep TL.fst and G.fst only, which are composed on the fly by the runtime
+# (--fst_path TL.fst --g_fst_path G.fst), the graph is much smaller and G can
+# be swapped without rebuilding, at some search cost
+#fsttablecompose $tgt_lang/T.fst $tgt_lang/L.fst | \
+#  fstarcsort --sort_type=olabel > $tgt_lang/TL.fst
@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Binbin Zhang (binbzha@qq.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Tune the runtime on a sample set by wenet_bench.
+
+The decoding configs of the chunk sizes and the beams are first decoded
+once to score their error rates against --text, and the ones within
+--wer_tolerance of the best are kept. Then for each intra-op thread
+count, the max concurrent streams of each kept config are searched, for
+which the p99 chunk latency of the real time streaming is within
+--latency_ms. The config of the most streams is recommended, e.g.
+
+  python tools/tune_runtime.py --bench build/bin/wenet_bench \\
+      --wav_scp wav.scp --text text --latency_ms 300 -- \\
+      --model_path final.zip --unit_path units.txt
+
+where the flags after -- are passed to wenet_bench as they are. The beam
+and max_active of the WFST search are tuned instead of first_beam_size
+when --fst_path is one of them. The engine threads are set once per
+process of wenet_bench, so each probe is a process of its own.
+"""
+
+import argparse
+import itertools
+import json
+import logging
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def get_args():
+    parser = argparse.ArgumentParser(description='tune the runtime flags')
+    parser.add_argument('--bench', default='wenet_bench',
+                        help='path of wenet_bench')
+    parser.add_argument('--wav_scp', required=True, help='sample wav scp')
+    parser.add_argument('--text', required=True,
+                        help='reference text of the wav scp')
+    parser.add_argument('--intra_op_threads', default='1,2,4',
+                        help='intra-op thread counts to try')
+    parser.add_argument('--chunk_sizes', default='8,16',
+                        help='chunk sizes to try')
+    parser.add_argument('--first_beam_sizes', default='4,10',
+                        help='first beam sizes of the prefix search to try')
+    parser.add_argument('--beams', default='12,16',
+                        help='beams of the wfst search to try')
+    parser.add_argument('--max_actives', default='3000,7000',
+                        help='max actives of the wfst search to try')
+    parser.add_argument('--latency_ms', type=float, default=300,
+                        help='target of the p99 chunk latency')
+    parser.add_argument('--wer_tolerance', type=float, default=0.002,
+                        help='error rate allowed over the best config')
+    parser.add_argument('--max_streams', type=int, default=64,
+                        help='upper bound of the streams searched')
+    parser.add_argument('--output', default='',
+                        help='json file of all the probes, optional')
+    parser.add_argument('bench_flags', nargs='*',
+                        help='flags of wenet_bench after --')
+    return parser.parse_args()
+
+
+def int_list(spec):
+    return [int(x) for x in spec.split(',') if x]
+
+
+def decode_configs(args):
+    """ The flag overrides of each decoding config
+    """
+    wfst = any(f.startswith('--fst_path') for f in args.bench_flags)
+    configs = []
+    for chunk_size in int_list(args.chunk_sizes):
+        if wfst:
+            beams = [float(x) for x in args.beams.split(',') if x]
+            for beam, max_active in itertools.product(
+                    beams, int_list(args.max_actives)):
+                configs.append({'chunk_size': chunk_size, 'beam': beam,
+                                'max_active': max_active})
+        else:
+            for first_beam_size in int_list(args.first_beam_sizes):
+                configs.append({'chunk_size': chunk_size,
+                                'first_beam_size': first_beam_size})
+    return configs
+
+
+def config_name(config):
+    return '_'.join('{}{}'.format(k, v) for k, v in sorted(config.items()))
+
+
+def run_bench(args, scenarios, flags):
+    """ Run wenet_bench on the scenarios of (name, overrides), and return
+        the metrics by the name
+    """
+    with tempfile.TemporaryDirectory() as tmp:
+        scenario_file = os.path.join(tmp, 'scenarios')
+        with open(scenario_file, 'w') as f:
+            for name, overrides in scenarios:
+                f.write(name + ''.join(' {}={}'.format(k, v)
+                                       for k, v in overrides.items()) + '\n')
+        result_file = os.path.join(tmp, 'results.json')
+        cmd = [args.bench, '--wav_scp', args.wav_scp,
+               '--scenarios', scenario_file, '--output', result_file,
+               '--mode', 'streaming'] + flags + args.bench_flags
+        logging.debug(' '.join(cmd))
+        subprocess.run(cmd, check=True, stderr=subprocess.DEVNULL)
+        with open(result_file) as f:
+            results = json.load(f)
+    return {s['name']: s['metrics'] for s in results['scenarios']}
+
+
+def max_streams(args, config, intra_op_threads):
+    """ The most streams of the config within the latency target, by
+        doubling then bisection, 0 if even one stream misses it
+    """
+    probes = {}
+
+    def probe(num_streams):
+        if num_streams not in probes:
+            # Enough rounds of the waves to keep all the streams busy
+            num_rounds = -(-num_streams // args.num_waves)
+            metrics = run_bench(
+                args, [(config_name(config), config)],
+                ['--pace', '1', '--num_streams', str(num_streams),
+                 '--num_rounds', str(num_rounds),
+                 '--intra_op_threads', str(intra_op_threads)])
+            metrics = metrics[config_name(config)]
+            probes[num_streams] = metrics
+            logging.info('%s intra_op_threads %d streams %d: p99 %.1fms',
+                         config_name(config), intra_op_threads, num_streams,
+                         metrics.get('chunk_latency_p99_ms', 0))
+        return probes[num_streams].get('chunk_latency_p99_ms',
+                                       0) <= args.latency_ms
+
+    if not probe(1):
+        return 0, probes
+    low, high = 1, 2
+    while high <= args.max_streams and probe(high):
+        low, high = high, high * 2
+    high = min(high, args.max_streams + 1)
+    # probe(low) holds and probe(high) doesn't, or high is out of the bound
+    while high - low > 1:
+        mid = (low + high) // 2
+        if probe(mid):
+            low = mid
+        else:
+            high = mid
+    return low, probes
+
+
+def main():
+    args = get_args()
+    logging.basicConfig(level=logging.INFO,
+                        format='%(asctime)s %(levelname)s %(message)s')
+    configs = decode_configs(args)
+    with open(args.wav_scp) as f:
+        args.num_waves = max(1, sum(1 for line in f if line.strip()))
+
+    # The error rate doesn't depend on the threads or the streams, so all
+    # the configs are scored by one process as fast as possible
+    metrics = run_bench(args, [(config_name(c), c) for c in configs],
+                        ['--pace', '0', '--text', args.text,
+                         '--num_streams', str(os.cpu_count() or 1)])
+    wers = {}
+    for config in configs:
+        wer = metrics[config_name(config)].get('wer')
+        if wer is None:
+            sys.exit('no wer of {}, is --text of the wav scp?'.format(
+                config_name(config)))
+        wers[config_name(config)] = wer
+        logging.info('%s: wer %.4f', config_name(config), wer)
+    best_wer = min(wers.values())
+    kept = [c for c in configs
+            if wers[config_name(c)] <= best_wer + args.wer_tolerance]
+
+    candidates = []
+    for intra_op_threads in int_list(args.intra_op_threads):
+        for config in kept:
+            streams, probes = max_streams(args, config, intra_op_threads)
+            p99 = probes[streams]['chunk_latency_p99_ms'] if streams else None
+            candidates.append({'intra_op_threads': intra_op_threads,
+                               'flags': config,
+                               'wer': wers[config_name(config)],
+                               'num_streams': streams,
+                               'chunk_latency_p99_ms': p99,
+                               'probes': probes})
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(candidates, f, indent=2)
+
+    feasible = [c for c in candidates if c['num_streams'] > 0]
+    if not feasible:
+        sys.exit('no config is within {}ms of p99 chunk latency'.format(
+            args.latency_ms))
+    # The most streams, then the lower error rate, then the lower latency
+    best = min(feasible, key=lambda c: (-c['num_streams'], c['wer'],
+                                        c['chunk_latency_p99_ms']))
+    flags = ' '.join('--{} {}'.format(k, v)
+                     for k, v in sorted(best['flags'].items()))
+    print('recommended: --intra_op_threads {} {}'.format(
+        best['intra_op_threads'], flags))
+    print('{} concurrent streams, p99 chunk latency {:.1f}ms, '
+          'wer {:.4f} (best {:.4f})'.format(
+              best['num_streams'], best['chunk_latency_p99_ms'],
+              best['wer'], best_wer))
+
+
+if __name__ == '__main__':
+    main()
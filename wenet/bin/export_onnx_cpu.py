@@ -46,6 +46,16 @@ def get_args():
                         type=int, help='cache chunks')
     parser.add_argument('--reverse_weight', default=0.5,
                         type=float, help='reverse_weight in attention_rescoing')
+    parser.add_argument('--fuse_ctc', action='store_true',
+                        help='also export encoder_ctc.onnx, the encoder and '
+                             'the ctc in one graph')
+    parser.add_argument('--ctc_topk', default=0, type=int,
+                        help='if > 0, encoder_ctc.onnx also emits the topk '
+                             'ctc log probs of each frame')
+    parser.add_argument('--early_exit_layer', default=0, type=int,
+                        help='if > 0, also export encoder_early.onnx and '
+                             'encoder_late.onnx, the encoder split after '
+                             'this layer for the early exit of the runtime')
     args = parser.parse_args()
     return args
 
@@ -354,6 +364,260 @@ def export_decoder(asr_model, args):
     print("\t\tCheck onnx_decoder, pass!")
 
 
+def save_onnx_model(outpath, args, name):
+    """ Add args as the metadata of the exported model, which the runtime
+        reads, and quantize it
+    """
+    onnx_model = onnx.load(outpath)
+    for (k, v) in args.items():
+        meta = onnx_model.metadata_props.add()
+        meta.key, meta.value = str(k), str(v)
+    onnx.checker.check_model(onnx_model)
+    onnx.save(onnx_model, outpath)
+    print_input_output_info(onnx_model, name)
+    model_quant = outpath[:-len('.onnx')] + '.quant.onnx'
+    quantize_dynamic(outpath, model_quant, weight_type=QuantType.QUInt8)
+    print('\t\tExport {}, done! see {}'.format(name, outpath))
+    return [node.name for node in onnx_model.graph.input]
+
+
+def prepare_chunk_inputs(args, num_blocks, chunk):
+    """ The inputs of the first chunk of a chunk graph, see export_encoder
+    """
+    offset = 0
+    head_dim = args['output_size'] // args['head'] * 2
+    if args['left_chunks'] > 0:  # 16/4
+        required_cache_size = args['chunk_size'] * args['left_chunks']
+        offset = required_cache_size
+        att_cache = torch.zeros(
+            (num_blocks, args['head'], required_cache_size, head_dim))
+        att_mask = torch.ones(
+            (args['batch'], 1, required_cache_size + chunk.size(1)),
+            dtype=torch.bool)
+        att_mask[:, :, :required_cache_size] = 0
+    else:  # 16/-1, -1/-1, 16/0
+        required_cache_size = -1 if args['left_chunks'] < 0 else 0
+        att_cache = torch.zeros((num_blocks, args['head'], 0, head_dim))
+        att_mask = torch.ones((0, 0, 0), dtype=torch.bool)
+    cnn_cache = torch.zeros(
+        (num_blocks, args['batch'],
+         args['output_size'], args['cnn_module_kernel'] - 1))
+    return (chunk, offset, required_cache_size, att_cache, cnn_cache,
+            att_mask)
+
+
+def run_onnx_chunk(ort_session, input_names, inputs):
+    chunk, offset, required_cache_size, att_cache, cnn_cache, att_mask = \
+        inputs
+    ort_inputs = {
+        'chunk': to_numpy(chunk),
+        'offset': np.array((offset)).astype(np.int64),
+        'required_cache_size': np.array((required_cache_size)).astype(
+            np.int64),
+        'att_cache': to_numpy(att_cache), 'cnn_cache': to_numpy(cnn_cache),
+        'att_mask': to_numpy(att_mask)
+    }
+    # The constant inputs are removed by ONNX, see export_encoder
+    for k in list(ort_inputs):
+        if k not in input_names:
+            ort_inputs.pop(k)
+    return ort_session.run(None, ort_inputs)
+
+
+CHUNK_INPUT_NAMES = [
+    'chunk', 'offset', 'required_cache_size', 'att_cache', 'cnn_cache',
+    'att_mask'
+]
+CHUNK_DYNAMIC_AXES = {
+    'chunk': {1: 'T'},
+    'att_cache': {2: 'T_CACHE'},
+    'att_mask': {2: 'T_ADD_T_CACHE'},
+    'output': {1: 'T'},
+    'r_att_cache': {2: 'T_CACHE'},
+}
+
+
+class EncoderCTC(torch.nn.Module):
+    """ forward_chunk of the encoder followed by the ctc, and the topk of the
+        ctc log probs if topk > 0, the outputs of encoder_ctc.onnx
+    """
+    def __init__(self, encoder, ctc, topk):
+        super().__init__()
+        self.encoder = encoder
+        self.ctc = ctc
+        self.topk = topk
+
+    def forward(self, chunk, offset, required_cache_size, att_cache,
+                cnn_cache, att_mask):
+        output, r_att_cache, r_cnn_cache = self.encoder.forward_chunk(
+            chunk, offset, required_cache_size, att_cache, cnn_cache,
+            att_mask)
+        ctc_log_probs = self.ctc.log_softmax(output)
+        if self.topk <= 0:
+            return output, r_att_cache, r_cnn_cache, ctc_log_probs
+        topk_scores, topk_indexs = torch.topk(ctc_log_probs, self.topk, dim=2)
+        return (output, r_att_cache, r_cnn_cache, ctc_log_probs, topk_scores,
+                topk_indexs)
+
+
+def export_encoder_ctc(asr_model, args):
+    print("Stage-4: export fused encoder and ctc")
+    encoder_ctc = EncoderCTC(asr_model.encoder, asr_model.ctc,
+                             args['ctc_topk'])
+    outpath = os.path.join(args['output_dir'], 'encoder_ctc.onnx')
+    chunk = torch.randn(
+        (args['batch'], args['decoding_window'], args['feature_size']))
+    inputs = prepare_chunk_inputs(args, args['num_blocks'], chunk)
+    output_names = ['output', 'r_att_cache', 'r_cnn_cache', 'ctc_log_probs']
+    dynamic_axes = dict(CHUNK_DYNAMIC_AXES)
+    dynamic_axes['ctc_log_probs'] = {1: 'T'}
+    if args['ctc_topk'] > 0:
+        output_names += ['topk_scores', 'topk_indexs']
+        dynamic_axes['topk_scores'] = {1: 'T'}
+        dynamic_axes['topk_indexs'] = {1: 'T'}
+    torch.onnx.export(
+        encoder_ctc, inputs, outpath, opset_version=13,
+        export_params=True, do_constant_folding=True,
+        input_names=CHUNK_INPUT_NAMES, output_names=output_names,
+        dynamic_axes=dynamic_axes, verbose=False)
+    input_names = save_onnx_model(outpath, args, "onnx_encoder_ctc")
+
+    torch_outs = encoder_ctc(*inputs)
+    ort_session = onnxruntime.InferenceSession(outpath)
+    onnx_outs = run_onnx_chunk(ort_session, input_names, inputs)
+    for torch_out, onnx_out in zip(torch_outs, onnx_outs):
+        np.testing.assert_allclose(to_numpy(torch_out), onnx_out,
+                                   rtol=1e-03, atol=1e-05)
+    print("\t\tCheck onnx_encoder_ctc, pass!")
+
+
+class HiddenEmbed(torch.nn.Module):
+    """ The embed of the late layers of a split encoder, whose inputs are
+        the hidden outputs of the early layers, so only the positions are
+        encoded
+    """
+    def __init__(self, embed):
+        super().__init__()
+        self.embed = embed
+
+    def forward(self, xs, xs_mask, offset):
+        pos_emb = self.embed.position_encoding(offset, xs.size(1))
+        return xs, pos_emb, xs_mask
+
+    def position_encoding(self, offset, size):
+        return self.embed.position_encoding(offset, size)
+
+
+class EarlyEncoder(torch.nn.Module):
+    """ The layers below the split of the encoder, with the output ctc as
+        the intermediate ctc head on the normalized hidden outputs, the
+        outputs of encoder_early.onnx
+    """
+    def __init__(self, encoder, ctc, num_layers):
+        super().__init__()
+        self.encoder = copy.deepcopy(encoder)
+        self.encoder.encoders = self.encoder.encoders[:num_layers]
+        # The hidden outputs go to the late layers as they are
+        self.after_norm = self.encoder.after_norm
+        self.encoder.after_norm = torch.nn.Identity()
+        self.normalize_before = encoder.normalize_before
+        self.ctc = ctc
+
+    def forward(self, chunk, offset, required_cache_size, att_cache,
+                cnn_cache, att_mask):
+        output, r_att_cache, r_cnn_cache = self.encoder.forward_chunk(
+            chunk, offset, required_cache_size, att_cache, cnn_cache,
+            att_mask)
+        hidden = self.after_norm(output) if self.normalize_before else output
+        ctc_log_probs = self.ctc.log_softmax(hidden)
+        return output, r_att_cache, r_cnn_cache, ctc_log_probs
+
+
+class LateEncoder(torch.nn.Module):
+    """ The layers above the split of the encoder, the outputs of
+        encoder_late.onnx. The runtime feeds the outputs of the chunks
+        exited early together with the next chunk, so the attention cache
+        is sliced from its end rather than a start fixed at export.
+    """
+    def __init__(self, encoder, num_layers, required_cache_size):
+        super().__init__()
+        self.encoder = copy.deepcopy(encoder)
+        self.encoder.encoders = self.encoder.encoders[num_layers:]
+        self.encoder.embed = HiddenEmbed(self.encoder.embed)
+        self.encoder.global_cmvn = None
+        self.required_cache_size = required_cache_size
+
+    def forward(self, chunk, offset, required_cache_size, att_cache,
+                cnn_cache, att_mask):
+        output, r_att_cache, r_cnn_cache = self.encoder.forward_chunk(
+            chunk, offset, -1, att_cache, cnn_cache, att_mask)
+        if self.required_cache_size > 0:
+            r_att_cache = r_att_cache[:, :, -self.required_cache_size:, :]
+        elif self.required_cache_size == 0:
+            r_att_cache = r_att_cache[:, :, r_att_cache.size(2):, :]
+        return output, r_att_cache, r_cnn_cache
+
+
+def export_early_exit_encoder(asr_model, args):
+    print("Stage-5: export split encoder for early exit")
+    num_layers = args['early_exit_layer']
+    assert 0 < num_layers < args['num_blocks']
+    required_cache_size = args['chunk_size'] * args['left_chunks'] \
+        if args['left_chunks'] >= 0 else -1
+    early = EarlyEncoder(asr_model.encoder, asr_model.ctc, num_layers)
+    late = LateEncoder(asr_model.encoder, num_layers, required_cache_size)
+    early_path = os.path.join(args['output_dir'], 'encoder_early.onnx')
+    late_path = os.path.join(args['output_dir'], 'encoder_late.onnx')
+    # The caches of each graph are of its own layers
+    early_args = dict(args)
+    early_args['num_blocks'] = num_layers
+    late_args = dict(args)
+    late_args['num_blocks'] = args['num_blocks'] - num_layers
+
+    chunk = torch.randn(
+        (args['batch'], args['decoding_window'], args['feature_size']))
+    early_inputs = prepare_chunk_inputs(args, num_layers, chunk)
+    dynamic_axes = dict(CHUNK_DYNAMIC_AXES)
+    dynamic_axes['ctc_log_probs'] = {1: 'T'}
+    torch.onnx.export(
+        early, early_inputs, early_path, opset_version=13,
+        export_params=True, do_constant_folding=True,
+        input_names=CHUNK_INPUT_NAMES,
+        output_names=['output', 'r_att_cache', 'r_cnn_cache',
+                      'ctc_log_probs'],
+        dynamic_axes=dynamic_axes, verbose=False)
+    early_input_names = save_onnx_model(early_path, early_args,
+                                        "onnx_encoder_early")
+
+    hidden = early(*early_inputs)[0]
+    late_inputs = prepare_chunk_inputs(
+        args, args['num_blocks'] - num_layers, hidden)
+    torch.onnx.export(
+        late, late_inputs, late_path, opset_version=13,
+        export_params=True, do_constant_folding=True,
+        input_names=CHUNK_INPUT_NAMES,
+        output_names=['output', 'r_att_cache', 'r_cnn_cache'],
+        dynamic_axes=CHUNK_DYNAMIC_AXES, verbose=False)
+    late_input_names = save_onnx_model(late_path, late_args,
+                                       "onnx_encoder_late")
+
+    # The split is exact, the late outputs are those of the whole encoder
+    inputs = prepare_chunk_inputs(args, args['num_blocks'], chunk)
+    torch_output = asr_model.encoder.forward_chunk(*inputs)[0]
+    late_output = late(*late_inputs)[0]
+    np.testing.assert_allclose(to_numpy(torch_output), to_numpy(late_output),
+                               rtol=1e-03, atol=1e-05)
+    early_outs = run_onnx_chunk(onnxruntime.InferenceSession(early_path),
+                                early_input_names, early_inputs)
+    np.testing.assert_allclose(to_numpy(hidden), early_outs[0],
+                               rtol=1e-03, atol=1e-05)
+    late_outs = run_onnx_chunk(onnxruntime.InferenceSession(late_path),
+                               late_input_names, late_inputs)
+    np.testing.assert_allclose(to_numpy(late_output), late_outs[0],
+                               rtol=1e-03, atol=1e-05)
+    print("\t\tCheck onnx_encoder_early and onnx_encoder_late, pass!")
+
+
 def main():
     torch.manual_seed(777)
     args = get_args()
@@ -375,6 +639,8 @@ def main():
     arguments['chunk_size'] = args.chunk_size
     arguments['left_chunks'] = args.num_decoding_left_chunks
     arguments['reverse_weight'] = args.reverse_weight
+    arguments['ctc_topk'] = args.ctc_topk
+    arguments['early_exit_layer'] = args.early_exit_layer
     arguments['output_size'] = configs['encoder_conf']['output_size']
     arguments['num_blocks'] = configs['encoder_conf']['num_blocks']
     arguments['cnn_module_kernel'] = configs['encoder_conf'].get('cnn_module_kernel', 1)
@@ -405,6 +671,10 @@ def main():
     export_encoder(model, arguments)
     export_ctc(model, arguments)
     export_decoder(model, arguments)
+    if args.fuse_ctc:
+        export_encoder_ctc(model, arguments)
+    if args.early_exit_layer > 0:
+        export_early_exit_encoder(model, arguments)
 
 
 if __name__ == '__main__':
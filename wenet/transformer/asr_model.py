@@ -776,6 +776,54 @@ class ASRModel(torch.nn.Module):
         return self.encoder.forward_chunk(xs, offset, required_cache_size,
                                           att_cache, cnn_cache)
 
+    @torch.jit.export
+    def batch_forward_encoder_chunk(
+        self,
+        xs: torch.Tensor,
+        offset: int,
+        required_cache_size: int,
+        att_cache: torch.Tensor = torch.zeros(0, 0, 0, 0, 0),
+        cnn_cache: torch.Tensor = torch.zeros(0, 0, 0, 0, 0),
+    ) -> Tuple[torch.Tensor, torch.Tensor, torch.Tensor]:
+        """ Export interface for c++ call, forward_encoder_chunk of several
+            streams at the same offset with the same cache size in one call,
+            the caches of the streams are stacked in a leading batch dim
+
+        Args:
+            xs (torch.Tensor): chunk inputs, (b, time, mel-dim)
+            offset (int): current offset in encoder output time stamp
+            required_cache_size (int): see forward_encoder_chunk
+            att_cache (torch.Tensor): (b, elayers, head, cache_t1, d_k * 2)
+            cnn_cache (torch.Tensor): (b, elayers, 1, hidden-dim, cache_t2)
+
+        Returns:
+            torch.Tensor: outputs of the chunks, (b, chunk_size, hidden-dim)
+            torch.Tensor: new attention caches, (b, elayers, head, ?, d_k * 2)
+            torch.Tensor: new cnn caches, (b, elayers, 1, hidden-dim, cache_t2)
+
+        """
+        return self.encoder.forward_chunk_batch(xs, offset,
+                                                required_cache_size,
+                                                att_cache, cnn_cache)
+
+    @torch.jit.export
+    def forward_encoder_chunk_graph(
+        self,
+        xs: torch.Tensor,
+        offset: torch.Tensor,
+        required_cache_size: int,
+        att_cache: torch.Tensor,
+        cnn_cache: torch.Tensor,
+    ) -> Tuple[torch.Tensor, torch.Tensor, torch.Tensor]:
+        """ Export interface for c++ call, forward_encoder_chunk with the
+            offset as a scalar tensor on the device of xs, so the CUDA graph
+            of a chunk replays at any offset, see
+            BaseEncoder.forward_chunk_graph
+        """
+        return self.encoder.forward_chunk_graph(xs, offset,
+                                                required_cache_size,
+                                                att_cache, cnn_cache)
+
     @torch.jit.export
     def ctc_activation(self, xs: torch.Tensor) -> torch.Tensor:
         """ Export interface for c++ call, apply linear transform and log
@@ -897,6 +945,60 @@ class ASRModel(torch.nn.Module):
         r_decoder_out = torch.nn.functional.log_softmax(r_decoder_out, dim=-1)
         return decoder_out, r_decoder_out
 
+    @torch.jit.export
+    def batch_forward_attention_decoder_hyps(
+        self,
+        hyps: torch.Tensor,
+        hyps_lens: torch.Tensor,
+        encoder_out: torch.Tensor,
+        encoder_lens: torch.Tensor,
+        reverse_weight: float = 0,
+    ) -> Tuple[torch.Tensor, torch.Tensor]:
+        """ Export interface for c++ call, forward_attention_decoder of the
+            hyps of several utterances in one call, each hyp comes with the
+            encoder output of its utterance
+
+        Args:
+            hyps (torch.Tensor): (num_hyps, max_hyps_len), already pad sos
+                at the begining
+            hyps_lens (torch.Tensor): (num_hyps,), length of each hyp in
+                hyps, which counts sos
+            encoder_out (torch.Tensor): (num_hyps, max_time, hidden-dim),
+                the padded encoder output of the utterance of each hyp
+            encoder_lens (torch.Tensor): (num_hyps,), the length of each
+                encoder output
+            reverse_weight: used for verfing whether used right to left
+                decoder, > 0 will use.
+
+        Returns:
+            torch.Tensor: decoder output, (num_hyps, max_hyps_len, vocab)
+            torch.Tensor: right to left decoder output, the same shape
+        """
+        num_hyps = hyps.size(0)
+        assert hyps_lens.size(0) == num_hyps
+        assert encoder_out.size(0) == num_hyps
+        encoder_mask = ~make_pad_mask(encoder_lens,
+                                      encoder_out.size(1)).unsqueeze(1)
+        # The reversed hyps padded by eos, see forward_attention_decoder
+        r_hyps_lens = hyps_lens - 1
+        r_hyps = hyps[:, 1:]
+        max_len = torch.max(r_hyps_lens)
+        index_range = torch.arange(0, max_len, 1).to(encoder_out.device)
+        seq_len_expand = r_hyps_lens.unsqueeze(1)
+        seq_mask = seq_len_expand > index_range  # (num_hyps, max_len)
+        index = (seq_len_expand - 1) - index_range  # (num_hyps, max_len)
+        index = index * seq_mask
+        r_hyps = torch.gather(r_hyps, 1, index)
+        r_hyps = torch.where(seq_mask, r_hyps, self.eos)
+        r_hyps = torch.cat([hyps[:, 0:1], r_hyps], dim=1)
+
+        decoder_out, r_decoder_out, _ = self.decoder(
+            encoder_out, encoder_mask, hyps, hyps_lens, r_hyps,
+            reverse_weight)  # (num_hyps, max_hyps_len, vocab_size)
+        decoder_out = torch.nn.functional.log_softmax(decoder_out, dim=-1)
+        r_decoder_out = torch.nn.functional.log_softmax(r_decoder_out, dim=-1)
+        return decoder_out, r_decoder_out
+
     @torch.jit.export
     def batch_forward_encoder(
         self,
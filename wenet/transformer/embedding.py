@@ -111,6 +111,23 @@ class PositionalEncoding(torch.nn.Module):
             pos_emb = self.dropout(pos_emb)
         return pos_emb
 
+    def position_encoding_at(self, offset: torch.Tensor,
+                             size: int) -> torch.Tensor:
+        """ position_encoding of a scalar tensor offset without reading it on
+            the host, e.g. in a CUDA graph, the positions out of the range
+            are clamped to it
+
+        Args:
+            offset (torch.tensor): start offset, a scalar
+            size (int): required size of position encoding
+
+        Returns:
+            torch.Tensor: Corresponding encoding, (1, size, d_model)
+        """
+        index = offset + torch.arange(0, size, device=offset.device)
+        index = index.clamp(0, self.max_len - 1)
+        return F.embedding(index, self.pe[0].to(offset.device)).unsqueeze(0)
+
 class RelPositionalEncoding(PositionalEncoding):
     """Relative positional encoding module.
     See : Appendix B in https://arxiv.org/abs/1901.02860
@@ -160,3 +177,7 @@ class NoPositionalEncoding(torch.nn.Module):
     def position_encoding(
             self, offset: Union[int, torch.Tensor], size: int) -> torch.Tensor:
         return torch.zeros(1, size, self.d_model)
+
+    def position_encoding_at(self, offset: torch.Tensor,
+                             size: int) -> torch.Tensor:
+        return torch.zeros(1, size, self.d_model, device=offset.device)
@@ -114,6 +114,7 @@ class BaseEncoder(torch.nn.Module):
         else:
             raise ValueError("unknown input_layer: " + input_layer)
 
+        self.pos_enc_layer_type = pos_enc_layer_type
         self.global_cmvn = global_cmvn
         self.embed = subsampling_class(
             input_size,
@@ -229,11 +230,59 @@ class BaseEncoder(torch.nn.Module):
         # NOTE(xcsong): Before embed, shape(xs) is (b=1, time, mel-dim)
         xs, pos_emb, _ = self.embed(xs, tmp_masks, offset)
         # NOTE(xcsong): After  embed, shape(xs) is (b=1, chunk_size, hidden-dim)
-        elayers, cache_t1 = att_cache.size(0), att_cache.size(2)
-        chunk_size = xs.size(1)
-        attention_key_size = cache_t1 + chunk_size
+        cache_t1 = att_cache.size(2)
+        attention_key_size = cache_t1 + xs.size(1)
         pos_emb = self.embed.position_encoding(
             offset=offset - cache_t1, size=attention_key_size)
+        return self.forward_chunk_layers(xs, pos_emb, required_cache_size,
+                                         att_cache, cnn_cache, att_mask)
+
+    def forward_chunk_graph(
+        self,
+        xs: torch.Tensor,
+        offset: torch.Tensor,
+        required_cache_size: int,
+        att_cache: torch.Tensor,
+        cnn_cache: torch.Tensor,
+    ) -> Tuple[torch.Tensor, torch.Tensor, torch.Tensor]:
+        """ forward_chunk with the offset as a scalar tensor on the device of
+            xs, which is read on the device only, so a CUDA graph captured
+            of it replays at any offset. The chunk embedding of abs_pos
+            depends on the offset, so only rel_pos and no_pos are supported.
+        """
+        assert xs.size(0) == 1
+        assert self.pos_enc_layer_type != "abs_pos"
+        tmp_masks = torch.ones(1,
+                               xs.size(1),
+                               device=xs.device,
+                               dtype=torch.bool)
+        tmp_masks = tmp_masks.unsqueeze(1)
+        if self.global_cmvn is not None:
+            xs = self.global_cmvn(xs)
+        # The positional embedding of the offset 0 is not used
+        xs, _, _ = self.embed(xs, tmp_masks, 0)
+        cache_t1 = att_cache.size(2)
+        attention_key_size = cache_t1 + xs.size(1)
+        pos_emb = self.embed.position_encoding_at(offset - cache_t1,
+                                                  attention_key_size)
+        att_mask = torch.ones((0, 0, 0), dtype=torch.bool)
+        return self.forward_chunk_layers(xs, pos_emb, required_cache_size,
+                                         att_cache, cnn_cache, att_mask)
+
+    def forward_chunk_layers(
+        self,
+        xs: torch.Tensor,
+        pos_emb: torch.Tensor,
+        required_cache_size: int,
+        att_cache: torch.Tensor,
+        cnn_cache: torch.Tensor,
+        att_mask: torch.Tensor,
+    ) -> Tuple[torch.Tensor, torch.Tensor, torch.Tensor]:
+        """ The layers of forward_chunk on the embedded chunk xs, with the
+            positional embedding pos_emb of the cache and the chunk
+        """
+        elayers, cache_t1 = att_cache.size(0), att_cache.size(2)
+        attention_key_size = cache_t1 + xs.size(1)
         if required_cache_size < 0:
             next_cache_start = 0
         elif required_cache_size == 0:
@@ -267,6 +316,81 @@ class BaseEncoder(torch.nn.Module):
 
         return (xs, r_att_cache, r_cnn_cache)
 
+    def forward_chunk_batch(
+        self,
+        xs: torch.Tensor,
+        offset: int,
+        required_cache_size: int,
+        att_cache: torch.Tensor = torch.zeros(0, 0, 0, 0, 0),
+        cnn_cache: torch.Tensor = torch.zeros(0, 0, 0, 0, 0),
+    ) -> Tuple[torch.Tensor, torch.Tensor, torch.Tensor]:
+        """ Forward one chunk of each of several streams, like forward_chunk,
+            the streams must be at the same offset with the same cache size
+
+        Args:
+            xs (torch.Tensor): chunk inputs, (b, time, mel-dim)
+            offset (int): current offset in encoder output time stamp
+            required_cache_size (int): cache size required for next chunk
+                compuation, see forward_chunk
+            att_cache (torch.Tensor): the att_cache of forward_chunk of each
+                stream stacked, (b, elayers, head, cache_t1, d_k * 2), or
+                (b, 0, 0, 0, 0) for the first chunks
+            cnn_cache (torch.Tensor): the cnn_cache of forward_chunk of each
+                stream stacked, (b, elayers, 1, hidden-dim, cache_t2), or
+                (b, 0, 0, 0, 0) for the first chunks
+
+        Returns:
+            torch.Tensor: outputs of the chunks, (b, chunk_size, hidden-dim)
+            torch.Tensor: new attention caches, (b, elayers, head, ?, d_k * 2)
+            torch.Tensor: new cnn caches, (b, elayers, 1, hidden-dim, cache_t2)
+        """
+        batch_size = xs.size(0)
+        tmp_masks = torch.ones(batch_size,
+                               1,
+                               xs.size(1),
+                               device=xs.device,
+                               dtype=torch.bool)
+        if self.global_cmvn is not None:
+            xs = self.global_cmvn(xs)
+        xs, pos_emb, _ = self.embed(xs, tmp_masks, offset)
+        elayers, cache_t1 = att_cache.size(1), att_cache.size(3)
+        chunk_size = xs.size(1)
+        attention_key_size = cache_t1 + chunk_size
+        # The same positions for all the streams, (1, time, hidden-dim)
+        pos_emb = self.embed.position_encoding(
+            offset=offset - cache_t1, size=attention_key_size)
+        if required_cache_size < 0:
+            next_cache_start = 0
+        elif required_cache_size == 0:
+            next_cache_start = attention_key_size
+        else:
+            next_cache_start = max(attention_key_size - required_cache_size, 0)
+        att_mask = torch.ones((0, 0, 0), dtype=torch.bool)
+        empty_cache = torch.zeros(0, 0, 0, 0)
+        r_att_cache = []
+        r_cnn_cache = []
+        for i, layer in enumerate(self.encoders):
+            # NOTE: The caches of the layer are with the batch dim first,
+            #   (b, head, cache_t1, d_k * 2) and (b, hidden-dim, cache_t2),
+            #   which the attention and the convolution take as they are
+            xs, _, new_att_cache, new_cnn_cache = layer(
+                xs, att_mask, pos_emb,
+                att_cache=att_cache[:, i] if elayers > 0 else empty_cache,
+                cnn_cache=cnn_cache[:, i, 0]
+                if cnn_cache.size(1) > 0 else empty_cache)
+            r_att_cache.append(new_att_cache[:, :, next_cache_start:, :])
+            if new_cnn_cache.size(0) == 0:
+                # No convolution in the layer, the empty cache of each stream
+                new_cnn_cache = torch.zeros(batch_size, 0, 0,
+                                            device=xs.device, dtype=xs.dtype)
+            r_cnn_cache.append(new_cnn_cache.unsqueeze(1))
+        if self.normalize_before:
+            xs = self.after_norm(xs)
+
+        r_att_cache = torch.stack(r_att_cache, dim=1)
+        r_cnn_cache = torch.stack(r_cnn_cache, dim=1)
+        return (xs, r_att_cache, r_cnn_cache)
+
     def forward_chunk_by_chunk(
         self,
         xs: torch.Tensor,
@@ -31,6 +31,10 @@ class BaseSubsampling(torch.nn.Module):
                           size: int) -> torch.Tensor:
         return self.pos_enc.position_encoding(offset, size)
 
+    def position_encoding_at(self, offset: torch.Tensor,
+                             size: int) -> torch.Tensor:
+        return self.pos_enc.position_encoding_at(offset, size)
+
 
 class LinearNoSubsampling(BaseSubsampling):
     """Linear transform the input without subsampling